@@ -47,7 +47,8 @@ static AStatsManager_PullAtomCallbackReturn pullAtomCallback(int32_t atomTag, AS
 extern "C" JNIEXPORT void JNICALL
 Java_com_android_internal_os_statsd_libstats_LibStatsPullTests_setStatsPuller(
         JNIEnv* /*env*/, jobject /* this */, jint atomTag, jlong timeoutMillis,
-        jlong coolDownMillis, jint pullRetVal, jlong latencyMillis, int atomsPerPull) {
+        jlong coolDownMillis, jint pullRetVal, jlong latencyMillis, int atomsPerPull,
+        int eventsPerPage) {
     sAtomTag = atomTag;
     sPullReturnVal = pullRetVal;
     sLatencyMillis = latencyMillis;
@@ -56,6 +57,7 @@ Java_com_android_internal_os_statsd_libstats_LibStatsPullTests_setStatsPuller(
     AStatsManager_PullAtomMetadata* metadata = AStatsManager_PullAtomMetadata_obtain();
     AStatsManager_PullAtomMetadata_setCoolDownMillis(metadata, coolDownMillis);
     AStatsManager_PullAtomMetadata_setTimeoutMillis(metadata, timeoutMillis);
+    AStatsManager_PullAtomMetadata_setEventsPerPage(metadata, eventsPerPage);
 
     AStatsManager_setPullAtomCallback(sAtomTag, metadata, &pullAtomCallback, nullptr);
     AStatsManager_PullAtomMetadata_release(metadata);
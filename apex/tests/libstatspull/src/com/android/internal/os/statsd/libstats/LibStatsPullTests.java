@@ -61,6 +61,7 @@ public class LibStatsPullTests {
     private static long sPullTimeoutMillis;
     private static long sCoolDownMillis;
     private static int sAtomsPerPull;
+    private static int sEventsPerPage;
 
     static {
         System.loadLibrary("statspull_testhelper");
@@ -78,6 +79,7 @@ public class LibStatsPullTests {
         sPullTimeoutMillis = 10_000L;
         sCoolDownMillis = 1_000L;
         sAtomsPerPull = 1;
+        sEventsPerPage = 0;
     }
 
     /**
@@ -103,7 +105,7 @@ public class LibStatsPullTests {
 
         // Add the puller.
         setStatsPuller(PULL_ATOM_TAG, sPullTimeoutMillis, sCoolDownMillis, sPullReturnValue,
-                sPullLatencyMillis, sAtomsPerPull);
+                sPullLatencyMillis, sAtomsPerPull, sEventsPerPage);
         Thread.sleep(SHORT_SLEEP_MILLIS);
         StatsLog.logStart(APP_BREADCRUMB_LABEL);
         // Let the current bucket finish.
@@ -136,7 +138,7 @@ public class LibStatsPullTests {
         sPullReturnValue = StatsManager.PULL_SKIP;
         // Add the puller.
         setStatsPuller(PULL_ATOM_TAG, sPullTimeoutMillis, sCoolDownMillis, sPullReturnValue,
-                sPullLatencyMillis, sAtomsPerPull);
+                sPullLatencyMillis, sAtomsPerPull, sEventsPerPage);
         Thread.sleep(SHORT_SLEEP_MILLIS);
         StatsLog.logStart(APP_BREADCRUMB_LABEL);
         // Let the current bucket finish.
@@ -161,7 +163,7 @@ public class LibStatsPullTests {
 
         // Add the puller.
         setStatsPuller(PULL_ATOM_TAG, sPullTimeoutMillis, sCoolDownMillis, sPullReturnValue,
-                sPullLatencyMillis, sAtomsPerPull);
+                sPullLatencyMillis, sAtomsPerPull, sEventsPerPage);
         Thread.sleep(SHORT_SLEEP_MILLIS);
         StatsLog.logStart(APP_BREADCRUMB_LABEL);
         // Let the current bucket finish and the pull timeout.
@@ -184,7 +186,7 @@ public class LibStatsPullTests {
         sCoolDownMillis = 10_000L;
         // Add the puller.
         setStatsPuller(PULL_ATOM_TAG, sPullTimeoutMillis, sCoolDownMillis, sPullReturnValue,
-                sPullLatencyMillis, sAtomsPerPull);
+                sPullLatencyMillis, sAtomsPerPull, sEventsPerPage);
 
         Thread.sleep(SHORT_SLEEP_MILLIS);
         StatsLog.logStart(APP_BREADCRUMB_LABEL);
@@ -222,7 +224,7 @@ public class LibStatsPullTests {
         sAtomsPerPull = 1000;
         // Add the puller.
         setStatsPuller(PULL_ATOM_TAG, sPullTimeoutMillis, sCoolDownMillis, sPullReturnValue,
-                sPullLatencyMillis, sAtomsPerPull);
+                sPullLatencyMillis, sAtomsPerPull, sEventsPerPage);
 
         Thread.sleep(SHORT_SLEEP_MILLIS);
         StatsLog.logStart(APP_BREADCRUMB_LABEL);
@@ -248,6 +250,70 @@ public class LibStatsPullTests {
         }
     }
 
+    /**
+     * Tests that a pull whose result is streamed in pages delivers every page.
+     */
+    @Test
+    public void testPullAtomCallbackInPages() throws Exception {
+        StatsManager statsManager = (StatsManager) mContext.getSystemService(
+                Context.STATS_MANAGER);
+        // Upload a config that captures that pulled atom.
+        createAndAddConfigToStatsd(statsManager);
+        sAtomsPerPull = 1000;
+        // The last page is partial, and is sent with the end of the pull.
+        sEventsPerPage = 64;
+        // Add the puller.
+        setStatsPuller(PULL_ATOM_TAG, sPullTimeoutMillis, sCoolDownMillis, sPullReturnValue,
+                sPullLatencyMillis, sAtomsPerPull, sEventsPerPage);
+
+        Thread.sleep(SHORT_SLEEP_MILLIS);
+        StatsLog.logStart(APP_BREADCRUMB_LABEL);
+        // Let the current bucket finish.
+        Thread.sleep(LONG_SLEEP_MILLIS);
+        List<Atom> data = StatsConfigUtils.getGaugeMetricDataList(statsManager, sConfigId);
+        clearStatsPuller(PULL_ATOM_TAG);
+        assertThat(data.size()).isEqualTo(sAtomsPerPull);
+
+        for (int i = 0; i < data.size(); i++) {
+            TestAtoms.PullCallbackAtomWrapper atomWrapper = null;
+            try {
+                atomWrapper = TestAtoms.PullCallbackAtomWrapper.parser()
+                        .parseFrom(data.get(i).toByteArray());
+            } catch (Exception e) {
+                Log.e(LOG_TAG, "Failed to parse primitive atoms");
+            }
+            assertThat(atomWrapper).isNotNull();
+            assertThat(atomWrapper.hasPullCallbackAtom()).isTrue();
+            TestAtoms.PullCallbackAtom atom =
+                    atomWrapper.getPullCallbackAtom();
+            assertThat(atom.getLongVal()).isEqualTo(1);
+        }
+    }
+
+    /**
+     * Tests that a failed pull whose result is streamed in pages is skipped, with the pages
+     * already sent.
+     */
+    @Test
+    public void testPullAtomCallbackInPagesFailure() throws Exception {
+        StatsManager statsManager = (StatsManager) mContext.getSystemService(
+                Context.STATS_MANAGER);
+        createAndAddConfigToStatsd(statsManager);
+        sPullReturnValue = StatsManager.PULL_SKIP;
+        sAtomsPerPull = 1000;
+        sEventsPerPage = 64;
+        // Add the puller.
+        setStatsPuller(PULL_ATOM_TAG, sPullTimeoutMillis, sCoolDownMillis, sPullReturnValue,
+                sPullLatencyMillis, sAtomsPerPull, sEventsPerPage);
+        Thread.sleep(SHORT_SLEEP_MILLIS);
+        StatsLog.logStart(APP_BREADCRUMB_LABEL);
+        // Let the current bucket finish.
+        Thread.sleep(LONG_SLEEP_MILLIS);
+        List<Atom> data = StatsConfigUtils.getGaugeMetricDataList(statsManager, sConfigId);
+        clearStatsPuller(PULL_ATOM_TAG);
+        assertThat(data.size()).isEqualTo(0);
+    }
+
     private void createAndAddConfigToStatsd(StatsManager statsManager) throws Exception {
         sConfigId = System.currentTimeMillis();
         long triggerMatcherId = sConfigId + 10;
@@ -280,7 +346,7 @@ public class LibStatsPullTests {
     }
 
     private native void setStatsPuller(int atomTag, long timeoutMillis, long coolDownMillis,
-            int pullReturnVal, long latencyMillis, int atomPerPull);
+            int pullReturnVal, long latencyMillis, int atomPerPull, int eventsPerPage);
 
     private native void clearStatsPuller(int atomTag);
 }
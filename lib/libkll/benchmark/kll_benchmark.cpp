@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "kll.h"
+
+namespace dist_proc {
+namespace aggregation {
+namespace {
+
+std::vector<int64_t> GenValues(int64_t num_values) {
+    MTRandomGenerator random(1);
+    std::vector<int64_t> values(num_values);
+    for (int64_t& value : values) {
+        value = random.UnbiasedUniform(1000000);
+    }
+    return values;
+}
+
+void BM_KllAdd(benchmark::State& state) {
+    const std::vector<int64_t> values = GenValues(state.range(0));
+    for (auto _ : state) {
+        std::unique_ptr<KllQuantile> aggregator = KllQuantile::Create();
+        for (const int64_t value : values) {
+            aggregator->Add(value);
+        }
+        benchmark::DoNotOptimize(aggregator->num_stored_values());
+    }
+    state.SetItemsProcessed(state.iterations() * values.size());
+}
+BENCHMARK(BM_KllAdd)->Arg(1000)->Arg(100000);
+
+void BM_KllAddBatch(benchmark::State& state) {
+    const std::vector<int64_t> values = GenValues(state.range(0));
+    for (auto _ : state) {
+        std::unique_ptr<KllQuantile> aggregator = KllQuantile::Create();
+        aggregator->AddBatch(values.data(), values.size());
+        benchmark::DoNotOptimize(aggregator->num_stored_values());
+    }
+    state.SetItemsProcessed(state.iterations() * values.size());
+}
+BENCHMARK(BM_KllAddBatch)->Arg(1000)->Arg(100000);
+
+void BM_KllAddWeighted(benchmark::State& state) {
+    const std::vector<int64_t> values = GenValues(state.range(0));
+    const std::vector<int> weights(values.size(), 1);
+    for (auto _ : state) {
+        std::unique_ptr<KllQuantile> aggregator = KllQuantile::Create();
+        for (size_t i = 0; i < values.size(); i++) {
+            aggregator->AddWeighted(values[i], weights[i]);
+        }
+        benchmark::DoNotOptimize(aggregator->num_stored_values());
+    }
+    state.SetItemsProcessed(state.iterations() * values.size());
+}
+BENCHMARK(BM_KllAddWeighted)->Arg(1000)->Arg(100000);
+
+void BM_KllAddWeightedBatch(benchmark::State& state) {
+    const std::vector<int64_t> values = GenValues(state.range(0));
+    const std::vector<int> weights(values.size(), 1);
+    for (auto _ : state) {
+        std::unique_ptr<KllQuantile> aggregator = KllQuantile::Create();
+        aggregator->AddWeightedBatch(values.data(), weights.data(), values.size());
+        benchmark::DoNotOptimize(aggregator->num_stored_values());
+    }
+    state.SetItemsProcessed(state.iterations() * values.size());
+}
+BENCHMARK(BM_KllAddWeightedBatch)->Arg(1000)->Arg(100000);
+
+}  // namespace
+}  // namespace aggregation
+}  // namespace dist_proc
+
+BENCHMARK_MAIN();
@@ -47,6 +47,12 @@ CompactorStack::~CompactorStack() {
 // Initialize or reset the compactor stack and all counters and thresholds.
 void CompactorStack::Reset() {
     overall_capacity_ = 0;
+    // The levels keep their storage for the next AddLevel() calls, so that a reused stack does
+    // not allocate them again.
+    for (std::vector<int64_t>& compactor : compactors_) {
+        compactor.clear();
+        spare_compactors_.push_back(std::move(compactor));
+    }
     ClearCompactors();
     sampler_ = nullptr;
     AddLevel();
@@ -88,6 +94,66 @@ void CompactorStack::AddWithWeight(int64_t value, int weight) {
     }
 }
 
+void CompactorStack::AddBatch(const int64_t* values, size_t num_values) {
+    size_t i = 0;
+    while (i < num_values && sampler_ == nullptr) {
+        // Appends up to the value that fills the stack, where Add() would compact. The stack is
+        // below its capacity after CompactStack(), so there is room for at least one value.
+        const size_t room = overall_capacity_ - num_items_in_compactors_;
+        const size_t num_appended = std::min(room, num_values - i);
+        compactors_[0].insert(compactors_[0].end(), values + i, values + i + num_appended);
+        num_items_in_compactors_ += num_appended;
+        i += num_appended;
+        CompactStack();
+    }
+    for (; i < num_values; i++) {
+        sampler_->Add(values[i]);
+    }
+}
+
+void CompactorStack::AddWeightedBatch(const int64_t* values, const int* weights,
+                                      size_t num_values) {
+    for (size_t i = 0; i < num_values; i++) {
+        if (weights[i] == 1 && sampler_ == nullptr) {
+            compactors_[0].push_back(values[i]);
+            num_items_in_compactors_++;
+            if (num_items_in_compactors_ >= overall_capacity_) {
+                CompactStack();
+            }
+        } else {
+            AddWithWeight(values[i], weights[i]);
+        }
+    }
+}
+
+void CompactorStack::Merge(const CompactorStack& other) {
+    const std::vector<std::vector<int64_t>>& other_compactors = other.compactors();
+    for (size_t level = 0; level < other_compactors.size(); level++) {
+        const std::vector<int64_t>& items = other_compactors[level];
+        if (items.empty()) {
+            continue;
+        }
+        // Each item of the level stands for 2^level items.
+        if (static_cast<int>(level) < lowest_active_level()) {
+            for (const int64_t item : items) {
+                AddWithWeight(item, 1 << level);
+            }
+            continue;
+        }
+        while (level >= compactors_.size()) {
+            AddLevel();
+        }
+        compactors_[level].insert(compactors_[level].end(), items.begin(), items.end());
+        num_items_in_compactors_ += items.size();
+    }
+    CompactStack();
+
+    const auto sampled_item_and_weight = other.sampled_item_and_weight();
+    if (sampled_item_and_weight.has_value()) {
+        AddWithWeight(sampled_item_and_weight->first, sampled_item_and_weight->second);
+    }
+}
+
 void CompactorStack::SortCompactorContents() {
     for (std::vector<int64_t>& compactor : compactors_) {
         std::sort(compactor.begin(), compactor.end());
@@ -100,7 +166,12 @@ void CompactorStack::ClearCompactors() {
 }
 
 void CompactorStack::AddLevel() {
-    compactors_.resize(compactors_.size() + 1);
+    if (spare_compactors_.empty()) {
+        compactors_.resize(compactors_.size() + 1);
+    } else {
+        compactors_.push_back(std::move(spare_compactors_.back()));
+        spare_compactors_.pop_back();
+    }
 
     int cap_at_lowest_active_level = TargetCapacityAtLevel(lowest_active_level());
     // All levels i get capacity that previously level i-1 had, except the
@@ -132,27 +203,29 @@ void CompactorStack::CompactLevel(int level) {
         AddLevel();
     }
     Halve(&compactors_[level], &compactors_[level + 1]);
-    std::vector<int64_t>().swap(compactors_[level]);
 }
 
 // To compact the items in a compactor to roughly half the size,
 // sorts the items and adds every even or odd item (determined randomly)
-// to the up_compactor.
+// to the up_compactor. down_compactor keeps its capacity, since it fills up
+// again to about the same size before its next compaction.
 void CompactorStack::Halve(std::vector<int64_t>* down_compactor,
                            std::vector<int64_t>* up_compactor) {
-    std::sort(down_compactor->begin(), down_compactor->end());
-    double half_of_items = down_compactor->size() / static_cast<double>(2);
+    // The compactors filled by a previous Halve() or SortCompactorContents() are
+    // often still sorted.
+    if (!std::is_sorted(down_compactor->begin(), down_compactor->end())) {
+        std::sort(down_compactor->begin(), down_compactor->end());
+    }
+    const size_t size = down_compactor->size();
     bool keep_even_items = (random_->UnbiasedUniform(2) == 0);
-    num_items_in_compactors_ -= static_cast<int>(keep_even_items ? std::floor(half_of_items)
-                                                                 : std::ceil(half_of_items));
-
-    bool even = true;
+    // Items at even positions are kept 0-indexed, i.e. the 1st, 3rd, ... item.
+    const size_t first = keep_even_items ? 0 : 1;
+    const size_t num_kept = (size - first + 1) / 2;
+    num_items_in_compactors_ -= static_cast<int>(size - num_kept);
 
-    for (size_t i = 0; i < down_compactor->size(); i++) {
-        if (even == keep_even_items) {
-            up_compactor->push_back((*down_compactor)[i]);
-        }
-        even = !even;
+    up_compactor->reserve(up_compactor->size() + num_kept);
+    for (size_t i = first; i < size; i += 2) {
+        up_compactor->push_back((*down_compactor)[i]);
     }
     down_compactor->clear();
 }
@@ -176,6 +249,19 @@ void CompactorStack::DoubleSamplerCapacity() {
     }
 
     CompactLevel(prev_lowest_active_level);
+    // The level is replaced by the sampler from now on.
+    std::vector<int64_t>().swap(compactors_[prev_lowest_active_level]);
+}
+
+size_t CompactorStack::allocated_bytes() const {
+    size_t capacity = 0;
+    for (const std::vector<int64_t>& compactor : compactors_) {
+        capacity += compactor.capacity();
+    }
+    for (const std::vector<int64_t>& compactor : spare_compactors_) {
+        capacity += compactor.capacity();
+    }
+    return capacity * sizeof(int64_t);
 }
 
 int CompactorStack::num_stored_items() const {
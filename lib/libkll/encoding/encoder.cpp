@@ -62,6 +62,22 @@ void Encoder::SerializeToPackedStringAll(std::vector<int64_t>::const_iterator be
     }
 }
 
+void Encoder::SerializeToDiffEncodedPackedStringAll(std::vector<int64_t>::const_iterator begin,
+                                                    std::vector<int64_t>::const_iterator end,
+                                                    std::string* dst) {
+    dst->clear();
+    if (begin == end) {
+        return;
+    }
+    Encoder::AppendToString(*begin, dst);
+    for (auto previous = begin++; begin != end; previous = begin++) {
+        assert(*previous <= *begin);
+        // The difference of sorted values fits in a uint64 even when it overflows an int64.
+        const uint64_t diff = static_cast<uint64_t>(*begin) - static_cast<uint64_t>(*previous);
+        Encoder::AppendToString(static_cast<int64_t>(diff), dst);
+    }
+}
+
 }  // namespace encoding
 }  // namespace aggregation
 }  // namespace dist_proc
\ No newline at end of file
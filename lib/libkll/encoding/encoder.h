@@ -35,6 +35,12 @@ public:
                                            std::vector<int64_t>::const_iterator end,
                                            std::string* dst);
 
+    // Same as SerializeToPackedStringAll(), but for sorted values, of which only the first one
+    // and the differences to the next ones are encoded. Small differences take one byte.
+    static void SerializeToDiffEncodedPackedStringAll(std::vector<int64_t>::const_iterator begin,
+                                                      std::vector<int64_t>::const_iterator end,
+                                                      std::string* dst);
+
 private:
     // Max number of bytes needed to encode 64 bits as a varint (= ceil(64 / 7)).
     static const int8_t kMaxLength = 10;
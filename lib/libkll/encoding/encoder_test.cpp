@@ -136,6 +136,23 @@ TEST(EncoderTest, SerializeToPackedStringAllClearsPrepopulatedString) {
     EXPECT_EQ(empty, prepopulated);
 }
 
+TEST(EncoderTest, SerializeToDiffEncodedPackedStringAll) {
+    std::string encoded = "some leftovers";
+    std::vector<int64_t> v = {0x80, 0x81, 0x81, 0x100};
+    Encoder::SerializeToDiffEncodedPackedStringAll(v.begin(), v.end(), &encoded);
+    EXPECT_EQ(encoded, std::string_view("\x80\x1\x1\0\x7F", 5));
+
+    v = {std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max()};
+    Encoder::SerializeToDiffEncodedPackedStringAll(v.begin(), v.end(), &encoded);
+    EXPECT_EQ(encoded, std::string_view("\x80\x80\x80\x80\x80\x80\x80\x80\x80\x1"
+                                        "\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x1",
+                                        20));
+
+    v.clear();
+    Encoder::SerializeToDiffEncodedPackedStringAll(v.begin(), v.end(), &encoded);
+    EXPECT_EQ(encoded, "");
+}
+
 }  // namespace
 
 }  // namespace encoding
@@ -41,7 +41,8 @@ public:
     CompactorStack(int64_t inv_eps, int64_t inv_delta, int k, RandomGenerator* random);
     ~CompactorStack();
 
-    // Initialize or reset the compactor stack and all counters and thresholds.
+    // Initialize or reset the compactor stack and all counters and thresholds. The storage of the
+    // levels is kept.
     void Reset();
 
     void Add(const int64_t value);
@@ -50,6 +51,21 @@ public:
     // Does nothing if weight <= 0.
     void AddWithWeight(int64_t value, int weight);
 
+    // Same as calling Add() for each of the [num_values] values, but appends the values to
+    // level 0 in bulk, compacting only once the stack is full, and only checks for the sampler
+    // between compactions. The stack goes through the same states as with Add().
+    void AddBatch(const int64_t* values, size_t num_values);
+
+    // Same as calling AddWithWeight() for each of the [num_values] values and weights, where the
+    // values of weight one skip to level 0 while there is no sampler.
+    void AddWeightedBatch(const int64_t* values, const int* weights, size_t num_values);
+
+    // Adds the items of [other] to this stack, appending each compactor of [other] to the
+    // compactor of the same level, whose items have the same weight. The items below the lowest
+    // active level of this stack, and the sampled item of [other], go through AddWithWeight().
+    // [other] must be another stack.
+    void Merge(const CompactorStack& other);
+
     // Ensures that the contents of each compactor are sorted.
     void SortCompactorContents();
 
@@ -62,6 +78,9 @@ public:
 
     int num_stored_items() const;
 
+    // Bytes allocated by the compactors, including the spare levels kept by Reset().
+    size_t allocated_bytes() const;
+
     std::optional<std::pair<const int64_t, int64_t>> sampled_item_and_weight() const;
 
     // Returns the lowest active level in the compactor stack, which is identical
@@ -104,10 +123,12 @@ private:
 
     // To compact the items in a compactor to roughly half the size,
     // sorts the items and adds every even or odd item (determined randomly)
-    // to the up_compactor.
+    // to the up_compactor. down_compactor keeps its capacity.
     void Halve(std::vector<int64_t>* down_compactor, std::vector<int64_t>* up_compactor);
 
     std::vector<std::vector<int64_t>> compactors_;
+    // Empty levels kept by Reset(), with their capacity.
+    std::vector<std::vector<int64_t>> spare_compactors_;
     int k_;
     const double c_ = 2.0 / 3.0;
     int overall_capacity_;
@@ -16,6 +16,10 @@
 
 #pragma once
 
+#include <optional>
+#include <utility>
+#include <vector>
+
 #include "aggregator.pb.h"
 #include "compactor_stack.h"
 #include "random_generator.h"
@@ -48,6 +52,10 @@ public:
     int64_t num_stored_values() const {
         return compactor_stack_.num_stored_items();
     }
+    // Bytes allocated by the compactors, which may exceed the stored values after a Reset().
+    size_t allocated_bytes() const {
+        return compactor_stack_.allocated_bytes();
+    }
     // Reset the aggregator to its state just after construction.
     void Reset();
     void Add(int64_t value);
@@ -65,8 +73,36 @@ public:
     // downscaling and randomized rounding is negligible.
     void AddWeighted(int64_t value, int weight);
 
+    // Same as Add() for each of the [num_values] values, with the values appended to the
+    // compactor stack in bulk. Cheaper for large batches, e.g. pulled data.
+    void AddBatch(const int64_t* values, size_t num_values);
+
+    // Same as AddWeighted() for each of the [num_values] values and weights.
+    void AddWeightedBatch(const int64_t* values, const int* weights, size_t num_values);
+
+    // Adds the values aggregated by [other], which must be another aggregator, as if they had been
+    // added to this one. The compactors of both are merged level by level, so this is much
+    // cheaper than adding the values again, e.g. to roll up the sketches of several dimensions
+    // or buckets. The approximation guarantee is that of the smaller k.
+    void Merge(const KllQuantile& other);
+
+    // Returns the approximate phi-quantile of the aggregated values, for phi in [0, 1]: a value
+    // whose rank is ceil(phi * num_values()) within the approximation guarantee. 0 and 1 give the
+    // exact minimum and maximum. Returns nullopt if there are no values or phi is out of range.
+    std::optional<int64_t> Quantile(double phi) const;
+
+    // Same as Quantile() for each of [phis], sorting the stored values once.
+    std::vector<std::optional<int64_t>> Quantiles(const std::vector<double>& phis) const;
+
+    // Returns the approximate fraction of the aggregated values that are <= value, or 0 if there
+    // are no values.
+    double Cdf(int64_t value) const;
+
+    // With diff_encode_compactors, the compactors are serialized as sorted differences
+    // (diff_encoded_packed_values), which takes about one byte per value for dense values
+    // instead of the size of each value.
     // Not safe to be called concurrently.
-    zetasketch::android::AggregatorStateProto SerializeToProto();
+    zetasketch::android::AggregatorStateProto SerializeToProto(bool diff_encode_compactors = false);
 
     bool IsSamplerOn() const {
         return compactor_stack_.IsSamplerOn();
@@ -81,6 +117,9 @@ private:
                            random != nullptr ? random : owned_random_.get()) {
         Reset();
     }
+    // Returns the stored values and their weights, sorted by value.
+    std::vector<std::pair<int64_t, int64_t>> SortedWeightedValues() const;
+
     void UpdateMin(const int64_t value);
     void UpdateMax(const int64_t value);
     int64_t inv_eps_;
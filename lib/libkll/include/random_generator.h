@@ -17,6 +17,7 @@
 #pragma once
 
 #include <cstdint>
+#include <limits>
 #include <optional>
 #include <random>
 
@@ -51,5 +52,47 @@ private:
     std::mt19937 bit_gen_;
 };
 
+// xorshift64* generator, whose state is a single word instead of the few KB of
+// MTRandomGenerator, e.g. for one generator shared by many small sketches.
+class XorShiftRandomGenerator : public RandomGenerator {
+public:
+    XorShiftRandomGenerator(std::optional<uint64_t> seed = std::nullopt) {
+        if (seed.has_value()) {
+            state_ = seed.value();
+        } else {
+            std::random_device rd;
+            state_ = (static_cast<uint64_t>(rd()) << 32) | rd();
+        }
+        // A zero state would only ever generate zeros.
+        if (state_ == 0) {
+            state_ = 0x9E3779B97F4A7C15;
+        }
+    }
+    uint64_t UnbiasedUniform(uint64_t n) override {
+        if (n <= 1) {
+            return 0;
+        }
+        // Rejects the values past the largest multiple of n, which would make the
+        // smaller results more likely.
+        const uint64_t max = std::numeric_limits<uint64_t>::max();
+        const uint64_t limit = max - max % n;
+        uint64_t value;
+        do {
+            value = Next();
+        } while (value >= limit);
+        return value % n;
+    }
+
+private:
+    uint64_t Next() {
+        state_ ^= state_ >> 12;
+        state_ ^= state_ << 25;
+        state_ ^= state_ >> 27;
+        return state_ * 0x2545F4914F6CDD1D;
+    }
+
+    uint64_t state_;
+};
+
 }  // namespace aggregation
 }  // namespace dist_proc
@@ -16,6 +16,8 @@
 
 #include "kll.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
 #include <memory>
 
@@ -61,7 +63,117 @@ void KllQuantile::AddWeighted(int64_t value, int weight) {
     }
 }
 
-AggregatorStateProto KllQuantile::SerializeToProto() {
+void KllQuantile::AddBatch(const int64_t* values, size_t num_values) {
+    if (num_values == 0) {
+        return;
+    }
+    compactor_stack_.AddBatch(values, num_values);
+    const auto [min, max] = std::minmax_element(values, values + num_values);
+    UpdateMin(*min);
+    UpdateMax(*max);
+    num_values_ += num_values;
+}
+
+void KllQuantile::AddWeightedBatch(const int64_t* values, const int* weights,
+                                   size_t num_values) {
+    compactor_stack_.AddWeightedBatch(values, weights, num_values);
+    for (size_t i = 0; i < num_values; i++) {
+        if (weights[i] > 0) {
+            UpdateMin(values[i]);
+            UpdateMax(values[i]);
+            num_values_ += weights[i];
+        }
+    }
+}
+
+void KllQuantile::Merge(const KllQuantile& other) {
+    if (other.num_values_ == 0) {
+        return;
+    }
+    compactor_stack_.Merge(other.compactor_stack_);
+    UpdateMin(other.min_);
+    UpdateMax(other.max_);
+    num_values_ += other.num_values_;
+}
+
+std::vector<std::pair<int64_t, int64_t>> KllQuantile::SortedWeightedValues() const {
+    std::vector<std::pair<int64_t, int64_t>> values;
+    values.reserve(compactor_stack_.num_stored_items());
+    const std::vector<std::vector<int64_t>>& compactors = compactor_stack_.compactors();
+    for (size_t level = 0; level < compactors.size(); level++) {
+        // Each item of compactor i stands for 2^i values.
+        for (const int64_t item : compactors[level]) {
+            values.emplace_back(item, int64_t{1} << level);
+        }
+    }
+    const auto& sampled_item_and_weight = compactor_stack_.sampled_item_and_weight();
+    if (sampled_item_and_weight.has_value()) {
+        values.emplace_back(sampled_item_and_weight->first, sampled_item_and_weight->second);
+    }
+    std::sort(values.begin(), values.end());
+    return values;
+}
+
+std::optional<int64_t> KllQuantile::Quantile(double phi) const {
+    return Quantiles({phi})[0];
+}
+
+std::vector<std::optional<int64_t>> KllQuantile::Quantiles(const std::vector<double>& phis) const {
+    std::vector<std::optional<int64_t>> quantiles(phis.size());
+    if (num_values_ == 0) {
+        return quantiles;
+    }
+    const std::vector<std::pair<int64_t, int64_t>> values = SortedWeightedValues();
+    int64_t total_weight = 0;
+    for (const auto& [value, weight] : values) {
+        total_weight += weight;
+    }
+    for (size_t i = 0; i < phis.size(); i++) {
+        const double phi = phis[i];
+        if (!(phi >= 0 && phi <= 1)) {
+            continue;
+        }
+        if (phi == 0) {
+            quantiles[i] = min_;
+            continue;
+        }
+        if (phi == 1) {
+            quantiles[i] = max_;
+            continue;
+        }
+        const int64_t rank = std::max<int64_t>(1, std::ceil(phi * total_weight));
+        int64_t cumulative_weight = 0;
+        quantiles[i] = max_;
+        for (const auto& [value, weight] : values) {
+            cumulative_weight += weight;
+            if (cumulative_weight >= rank) {
+                quantiles[i] = value;
+                break;
+            }
+        }
+    }
+    return quantiles;
+}
+
+double KllQuantile::Cdf(int64_t value) const {
+    if (num_values_ == 0 || value < min_) {
+        return 0;
+    }
+    if (value >= max_) {
+        return 1;
+    }
+    int64_t total_weight = 0;
+    int64_t weight_at_most_value = 0;
+    for (const auto& [item, weight] : SortedWeightedValues()) {
+        total_weight += weight;
+        if (item <= value) {
+            weight_at_most_value += weight;
+        }
+    }
+    return total_weight == 0 ? 0 : weight_at_most_value / static_cast<double>(total_weight);
+}
+
+AggregatorStateProto KllQuantile::SerializeToProto(bool diff_encode_compactors) {
     AggregatorStateProto aggregator_state;
 
     aggregator_state.set_type(zetasketch::android::KLL_QUANTILES);
@@ -92,11 +204,17 @@ AggregatorStateProto KllQuantile::SerializeToProto() {
     quantile_state->mutable_compactors()->Reserve(compactors.size());
 
     for (const auto& compactor : compactors) {
-        encoding::Encoder::SerializeToPackedStringAll(
-                compactor.begin(), compactor.end(),
-                quantile_state
-                        ->add_compactors()  // Adds one compactor to the compactors field.
-                        ->mutable_packed_values());
+        // Adds one compactor to the compactors field.
+        zetasketch::android::KllQuantilesStateProto::Compactor* compactor_state =
+                quantile_state->add_compactors();
+        if (diff_encode_compactors) {
+            encoding::Encoder::SerializeToDiffEncodedPackedStringAll(
+                    compactor.begin(), compactor.end(),
+                    compactor_state->mutable_diff_encoded_packed_values());
+        } else {
+            encoding::Encoder::SerializeToPackedStringAll(compactor.begin(), compactor.end(),
+                                                          compactor_state->mutable_packed_values());
+        }
     }
 
     // Encode sampler.
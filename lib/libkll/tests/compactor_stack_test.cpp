@@ -308,6 +308,112 @@ TEST_P(AddWithSamplerTest, SampledItemIsPresent) {
     EXPECT_LE(sampled_item_weight, (1 << compactor_stack.lowest_active_level()));
 }
 
+TEST(CompactorStackBatchTest, AddBatchMatchesAdd) {
+    MTRandomGenerator random(10);
+    MTRandomGenerator batch_random(10);
+    // Small enough for the sampler to be turned on.
+    CompactorStack compactor_stack(10, 100, &random);
+    CompactorStack batch_compactor_stack(10, 100, &batch_random);
+    std::vector<int64_t> values;
+    for (int i = 0; i < 5000; i++) {
+        values.push_back((i * 7919) % 5000);
+        compactor_stack.Add(values.back());
+    }
+    batch_compactor_stack.AddBatch(values.data(), 1000);
+    batch_compactor_stack.AddBatch(values.data() + 1000, values.size() - 1000);
+
+    ASSERT_TRUE(batch_compactor_stack.IsSamplerOn());
+    EXPECT_EQ(batch_compactor_stack.compactors(), compactor_stack.compactors());
+    EXPECT_EQ(batch_compactor_stack.sampled_item_and_weight(),
+              compactor_stack.sampled_item_and_weight());
+}
+
+TEST(CompactorStackBatchTest, AddWeightedBatchMatchesAddWithWeight) {
+    MTRandomGenerator random(10);
+    MTRandomGenerator batch_random(10);
+    CompactorStack compactor_stack(10, 100, &random);
+    CompactorStack batch_compactor_stack(10, 100, &batch_random);
+    std::vector<int64_t> values;
+    std::vector<int> weights;
+    for (int i = 0; i < 2000; i++) {
+        values.push_back(i);
+        weights.push_back(i % 3);
+        compactor_stack.AddWithWeight(values.back(), weights.back());
+    }
+    batch_compactor_stack.AddWeightedBatch(values.data(), weights.data(), values.size());
+
+    EXPECT_EQ(batch_compactor_stack.compactors(), compactor_stack.compactors());
+    EXPECT_EQ(batch_compactor_stack.num_stored_items(), compactor_stack.num_stored_items());
+}
+
+TEST(CompactorStackResetTest, ReusedStackMatchesNewStack) {
+    MTRandomGenerator random(10);
+    CompactorStack reused_compactor_stack(100, 1000, &random);
+    for (int i = 0; i < 3000; i++) {
+        reused_compactor_stack.Add(i);
+    }
+    ASSERT_GT(reused_compactor_stack.compactors().size(), 1u);
+    const size_t top_level_capacity = reused_compactor_stack.compactors().back().capacity();
+    ASSERT_GT(top_level_capacity, 0u);
+
+    const size_t allocated_bytes = reused_compactor_stack.allocated_bytes();
+    reused_compactor_stack.Reset();
+    EXPECT_EQ(reused_compactor_stack.num_stored_items(), 0);
+    // The spare levels are still allocated.
+    EXPECT_EQ(reused_compactor_stack.allocated_bytes(), allocated_bytes);
+    ASSERT_EQ(reused_compactor_stack.compactors().size(), 1u);
+    // The first level reuses the storage of the top level before Reset().
+    EXPECT_EQ(reused_compactor_stack.compactors()[0].capacity(), top_level_capacity);
+
+    // A copy of the generator, so that both stacks draw the same random values.
+    MTRandomGenerator new_random = random;
+    CompactorStack compactor_stack(100, 1000, &new_random);
+    for (int i = 0; i < 3000; i++) {
+        compactor_stack.Add((i * 7919) % 3000);
+        reused_compactor_stack.Add((i * 7919) % 3000);
+    }
+    EXPECT_EQ(reused_compactor_stack.compactors(), compactor_stack.compactors());
+    EXPECT_EQ(reused_compactor_stack.num_stored_items(), compactor_stack.num_stored_items());
+}
+
+TEST(CompactorStackMergeTest, MergesLevelByLevel) {
+    MTRandomGenerator random(10);
+    CompactorStack compactor_stack(1000, 100000, &random);
+    CompactorStack other(1000, 100000, &random);
+    for (int i = 0; i < 10; i++) {
+        compactor_stack.Add(i);
+        other.Add(10 + i);
+    }
+    other.AddWithWeight(100, 2);
+
+    compactor_stack.Merge(other);
+    const auto& compactors = compactor_stack.compactors();
+    ASSERT_GE(compactors.size(), 2u);
+    EXPECT_EQ(compactors[0].size(), 20u);
+    EXPECT_THAT(compactors[1], ::testing::ElementsAre(100));
+    EXPECT_EQ(compactor_stack.num_stored_items(), 21);
+}
+
+TEST(CompactorStackMergeTest, MergeIntoSamplerStack) {
+    MTRandomGenerator random(10);
+    CompactorStack compactor_stack(10, 10, &random);
+    CompactorStack other(1000, 100000, &random);
+    for (int i = 0; i < 2000; i++) {
+        compactor_stack.Add(i);
+    }
+    ASSERT_TRUE(compactor_stack.IsSamplerOn());
+    for (int i = 0; i < 100; i++) {
+        other.Add(i);
+    }
+
+    // The items of other are below the lowest active level, so they go through the sampler.
+    compactor_stack.Merge(other);
+    const auto& compactors = compactor_stack.compactors();
+    for (int i = 0; i < compactor_stack.lowest_active_level(); i++) {
+        EXPECT_TRUE(compactors[i].empty());
+    }
+}
+
 INSTANTIATE_TEST_SUITE_P(AddWithSamplerTestCases, AddWithSamplerTest,
                          ::testing::ValuesIn(std::vector<AddWithSamplerParam>{
                                  {10, 10, 2400},
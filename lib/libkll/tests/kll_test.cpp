@@ -171,6 +171,162 @@ TEST(KllQuantileSerializationTest, EmptyQuantilesProto) {
     EXPECT_EQ(quantiles_state.compactors_size(), 0);
     ASSERT_FALSE(quantiles_state.has_sampler());
 }
+TEST(KllQuantileMergeTest, MergeAddsTheValuesOfOther) {
+    std::unique_ptr<KllQuantile> aggregator = KllQuantile::Create();
+    std::unique_ptr<KllQuantile> other = KllQuantile::Create();
+    for (int i = 1; i <= 5; i++) {
+        aggregator->Add(i);
+        other->Add(5 + i);
+    }
+
+    aggregator->Merge(*other);
+    EXPECT_EQ(aggregator->num_values(), 10);
+    EXPECT_EQ(aggregator->num_stored_values(), 10);
+
+    const KllQuantilesStateProto quantiles_state =
+            aggregator->SerializeToProto().GetExtension(kll_quantiles_state);
+    EXPECT_EQ(quantiles_state.min(), "\x1");
+    EXPECT_EQ(quantiles_state.max(), "\xA");
+}
+
+TEST(KllQuantileMergeTest, MergeEmpty) {
+    std::unique_ptr<KllQuantile> aggregator = KllQuantile::Create();
+    std::unique_ptr<KllQuantile> empty = KllQuantile::Create();
+    aggregator->Add(3);
+
+    aggregator->Merge(*empty);
+    EXPECT_EQ(aggregator->num_values(), 1);
+
+    empty->Merge(*aggregator);
+    EXPECT_EQ(empty->num_values(), 1);
+    EXPECT_EQ(empty->SerializeToProto().GetExtension(kll_quantiles_state).min(), "\x3");
+}
+
+TEST(KllQuantileMergeTest, MergeLargeSketches) {
+    KllQuantileOptions options;
+    options.set_inv_eps(10);
+    std::unique_ptr<KllQuantile> aggregator = KllQuantile::Create(options);
+    std::unique_ptr<KllQuantile> other = KllQuantile::Create(options);
+    for (int i = 0; i < 100000; i++) {
+        aggregator->Add(i);
+        other->Add(100000 + i);
+    }
+    const int64_t num_stored_values = aggregator->num_stored_values();
+
+    aggregator->Merge(*other);
+    EXPECT_EQ(aggregator->num_values(), 200000);
+    // The merged sketch stays about as small as each of them.
+    EXPECT_LE(aggregator->num_stored_values(), 2 * num_stored_values);
+}
+
+TEST(KllQuantileQueryTest, ExactQuantilesOfSmallSketch) {
+    std::unique_ptr<KllQuantile> aggregator = KllQuantile::Create();
+    EXPECT_EQ(aggregator->Quantile(0.5), std::nullopt);
+    EXPECT_EQ(aggregator->Cdf(0), 0);
+
+    for (int i = 1; i <= 100; i++) {
+        aggregator->Add(i);
+    }
+    EXPECT_EQ(aggregator->Quantile(0), 1);
+    EXPECT_EQ(aggregator->Quantile(0.5), 50);
+    EXPECT_EQ(aggregator->Quantile(0.99), 99);
+    EXPECT_EQ(aggregator->Quantile(1), 100);
+    EXPECT_EQ(aggregator->Quantile(1.5), std::nullopt);
+    EXPECT_EQ(aggregator->Quantiles({0.1, 0.9}),
+              (std::vector<std::optional<int64_t>>{10, 90}));
+
+    EXPECT_EQ(aggregator->Cdf(0), 0);
+    EXPECT_DOUBLE_EQ(aggregator->Cdf(25), 0.25);
+    EXPECT_EQ(aggregator->Cdf(100), 1);
+}
+
+TEST(KllQuantileQueryTest, ApproximateQuantilesOfLargeSketch) {
+    KllQuantileOptions options;
+    options.set_inv_eps(100);
+    std::unique_ptr<KllQuantile> aggregator = KllQuantile::Create(options);
+    const int num_values = 1000000;
+    for (int i = 0; i < num_values; i++) {
+        aggregator->Add(i);
+    }
+    ASSERT_LT(aggregator->num_stored_values(), num_values / 10);
+
+    // Within a few times epsilon of the exact rank.
+    for (const double phi : {0.01, 0.25, 0.5, 0.75, 0.99}) {
+        EXPECT_NEAR(*aggregator->Quantile(phi), phi * num_values, 0.03 * num_values);
+        EXPECT_NEAR(aggregator->Cdf(phi * num_values), phi, 0.03);
+    }
+}
+
+TEST(KllQuantileSerializationTest, DiffEncodedCompactors) {
+    std::unique_ptr<KllQuantile> aggregator = KllQuantile::Create();
+    for (int i = 10; i > 0; i--) {
+        aggregator->Add(1000 + i);
+    }
+
+    const KllQuantilesStateProto packed =
+            aggregator->SerializeToProto().GetExtension(kll_quantiles_state);
+    const KllQuantilesStateProto diff_encoded =
+            aggregator->SerializeToProto(/*diff_encode_compactors=*/true)
+                    .GetExtension(kll_quantiles_state);
+    ASSERT_EQ(diff_encoded.compactors_size(), 1);
+    // 1001 in two bytes, then the differences of 1 to the next values.
+    EXPECT_EQ(diff_encoded.compactors(0).diff_encoded_packed_values(),
+              "\xE9\x07\x01\x01\x01\x01\x01\x01\x01\x01\x01");
+    EXPECT_LT(diff_encoded.compactors(0).diff_encoded_packed_values().size(),
+              packed.compactors(0).packed_values().size());
+    EXPECT_EQ(diff_encoded.min(), packed.min());
+}
+
+TEST(KllQuantileBatchTest, AddBatch) {
+    std::unique_ptr<KllQuantile> aggregator = KllQuantile::Create();
+    const std::vector<int64_t> values = {5, -3, 12, 7};
+    aggregator->AddBatch(values.data(), values.size());
+    aggregator->AddBatch(values.data(), 0);
+    EXPECT_EQ(aggregator->num_values(), 4);
+    EXPECT_EQ(aggregator->Quantile(0), -3);
+    EXPECT_EQ(aggregator->Quantile(1), 12);
+    EXPECT_EQ(aggregator->Quantile(0.5), 5);
+}
+
+TEST(KllQuantileBatchTest, AddWeightedBatch) {
+    std::unique_ptr<KllQuantile> aggregator = KllQuantile::Create();
+    const std::vector<int64_t> values = {5, -3, 12, 7};
+    // Values with weights <= 0 are ignored.
+    const std::vector<int> weights = {3, 0, 1, -1};
+    aggregator->AddWeightedBatch(values.data(), weights.data(), values.size());
+    EXPECT_EQ(aggregator->num_values(), 4);
+    EXPECT_EQ(aggregator->Quantile(0), 5);
+    EXPECT_EQ(aggregator->Quantile(1), 12);
+}
+
+TEST(KllQuantileRandomTest, XorShiftRandomGenerator) {
+    XorShiftRandomGenerator random(42);
+    int counts[3] = {};
+    for (int i = 0; i < 3000; i++) {
+        const uint64_t value = random.UnbiasedUniform(3);
+        ASSERT_LT(value, 3u);
+        counts[value]++;
+    }
+    for (const int count : counts) {
+        EXPECT_GT(count, 900);
+    }
+    EXPECT_EQ(0u, random.UnbiasedUniform(1));
+}
+
+TEST(KllQuantileRandomTest, SketchesShareXorShiftRandomGenerator) {
+    XorShiftRandomGenerator random(42);
+    KllQuantileOptions options;
+    options.set_random(&random);
+    std::unique_ptr<KllQuantile> first = KllQuantile::Create(options);
+    std::unique_ptr<KllQuantile> second = KllQuantile::Create(options);
+    for (int i = 1; i <= 100000; i++) {
+        first->Add(i);
+        second->Add(-i);
+    }
+    EXPECT_NEAR(50000, first->Quantile(0.5).value(), 1000);
+    EXPECT_NEAR(-50000, second->Quantile(0.5).value(), 1000);
+}
+
 }  // namespace
 
 }  // namespace aggregation
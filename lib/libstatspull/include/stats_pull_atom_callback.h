@@ -69,6 +69,42 @@ void AStatsManager_PullAtomMetadata_setTimeoutMillis(AStatsManager_PullAtomMetad
  */
 int64_t AStatsManager_PullAtomMetadata_getTimeoutMillis(AStatsManager_PullAtomMetadata* metadata);
 
+/**
+ * Set the number of events sent to the stats service in each page of the result of a pull.
+ * Large pulls are then streamed as the callback adds events, instead of being sent at once
+ * after it returns; the events of a sent page are released. 0, the default, sends the whole
+ * result at once.
+ *
+ * Introduced in API 34.
+ */
+void AStatsManager_PullAtomMetadata_setEventsPerPage(AStatsManager_PullAtomMetadata* metadata,
+                                                     int32_t events_per_page);
+
+/**
+ * Get the number of events sent in each page of the result of a pull, or 0.
+ *
+ * Introduced in API 34.
+ */
+int32_t AStatsManager_PullAtomMetadata_getEventsPerPage(AStatsManager_PullAtomMetadata* metadata);
+
+/**
+ * Set the maximum number of pulls of this atom that the pull executor runs at once, see
+ * AStatsManager_setPullExecutorThreadCount. Further pulls wait for one of them to finish.
+ * 0, the default, does not limit them.
+ *
+ * Introduced in API 34.
+ */
+void AStatsManager_PullAtomMetadata_setMaxConcurrentPulls(AStatsManager_PullAtomMetadata* metadata,
+                                                          int32_t max_concurrent_pulls);
+
+/**
+ * Get the maximum number of pulls of this atom run at once by the pull executor, or 0.
+ *
+ * Introduced in API 34.
+ */
+int32_t AStatsManager_PullAtomMetadata_getMaxConcurrentPulls(
+        AStatsManager_PullAtomMetadata* metadata);
+
 /**
  * Set the additive fields of this pulled atom.
  *
@@ -165,6 +201,20 @@ void AStatsManager_setPullAtomCallback(int32_t atom_tag, AStatsManager_PullAtomM
  */
 void AStatsManager_clearPullAtomCallback(int32_t atom_tag);
 
+/**
+ * Runs the pull callbacks of this process on a pool of [thread_count] threads, instead of on the
+ * binder thread that receives each pull request. The binder thread returns as soon as the pull is
+ * queued, so that the pulls requested at once by the stats service run in parallel regardless of
+ * the size of the binder thread pool of the process.
+ *
+ * The pool only grows: a smaller count than the current one is ignored. 0, the default, runs the
+ * callbacks on the binder threads. The pulls that find too many pulls already waiting for a thread
+ * also run on their binder thread.
+ *
+ * Introduced in API 34.
+ */
+void AStatsManager_setPullExecutorThreadCount(int32_t thread_count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2022, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pull_executor.h"
+
+PullExecutor::PullExecutor(size_t maxPendingPulls) : mMaxPendingPulls(maxPendingPulls) {
+}
+
+PullExecutor::~PullExecutor() {
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+        threads.swap(mThreads);
+    }
+    mCondition.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+PullExecutor& PullExecutor::getInstance() {
+    // Never destroyed, so that the threads outlive the static destructors.
+    static PullExecutor* executor = new PullExecutor();
+    return *executor;
+}
+
+void PullExecutor::setThreadCount(int32_t threadCount) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    while ((int32_t)mThreads.size() < threadCount) {
+        mThreads.emplace_back(&PullExecutor::run, this);
+    }
+}
+
+bool PullExecutor::submit(int32_t atomTag, int32_t maxConcurrentPulls,
+                          std::function<void()> pull) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mThreads.empty() || mPending.size() >= mMaxPendingPulls) {
+            return false;
+        }
+        mPending.push_back({atomTag, maxConcurrentPulls, std::move(pull)});
+    }
+    mCondition.notify_one();
+    return true;
+}
+
+void PullExecutor::run() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        auto next = mPending.end();
+        mCondition.wait(lock, [this, &next] {
+            if (mStopping) {
+                return true;
+            }
+            next = findRunnableLocked();
+            return next != mPending.end();
+        });
+        if (mStopping) {
+            return;
+        }
+        Pull pull = std::move(*next);
+        mPending.erase(next);
+        mRunning[pull.atomTag]++;
+
+        lock.unlock();
+        pull.run();
+        pull.run = nullptr;
+        lock.lock();
+
+        if (--mRunning[pull.atomTag] == 0) {
+            mRunning.erase(pull.atomTag);
+        }
+        // A pull of the same atom may have been waiting for this one.
+        if (pull.maxConcurrentPulls > 0) {
+            mCondition.notify_all();
+        }
+    }
+}
+
+std::deque<PullExecutor::Pull>::iterator PullExecutor::findRunnableLocked() {
+    for (auto it = mPending.begin(); it != mPending.end(); it++) {
+        if (it->maxConcurrentPulls == 0) {
+            return it;
+        }
+        auto running = mRunning.find(it->atomTag);
+        if (running == mRunning.end() || running->second < it->maxConcurrentPulls) {
+            return it;
+        }
+    }
+    return mPending.end();
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2022, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * The optional pool of threads running the pull callbacks, see
+ * AStatsManager_setPullExecutorThreadCount(). The pulls run in the order they are requested,
+ * except that a pull waits while its atom has maxConcurrentPulls pulls running.
+ *
+ * At most maxPendingPulls pulls wait for a thread. Further pulls are rejected, and the caller runs
+ * them on the binder thread that requested them, which throttles the requests to the size of the
+ * binder thread pool, as without the executor.
+ */
+class PullExecutor {
+public:
+    static const size_t kMaxPendingPulls = 64;
+
+    explicit PullExecutor(size_t maxPendingPulls = kMaxPendingPulls);
+
+    // Stops the threads once the running pulls return. The pending pulls are dropped.
+    ~PullExecutor();
+
+    static PullExecutor& getInstance();
+
+    // Starts threads until there are [threadCount]. The pool never shrinks.
+    void setThreadCount(int32_t threadCount);
+
+    // Queues [pull] if there are threads and the queue is not full, otherwise returns false.
+    bool submit(int32_t atomTag, int32_t maxConcurrentPulls, std::function<void()> pull);
+
+private:
+    struct Pull {
+        int32_t atomTag;
+        int32_t maxConcurrentPulls;
+        std::function<void()> run;
+    };
+
+    void run();
+
+    std::deque<Pull>::iterator findRunnableLocked();
+
+    const size_t mMaxPendingPulls;
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+
+    // Guarded by mMutex.
+    std::vector<std::thread> mThreads;
+    std::deque<Pull> mPending;
+    std::map<int32_t, int32_t> mRunning;
+    bool mStopping = false;
+};
@@ -15,6 +15,7 @@
  */
 
 #include <map>
+#include <mutex>
 #include <thread>
 #include <vector>
 
@@ -24,26 +25,79 @@
 #include <aidl/android/os/BnPullAtomCallback.h>
 #include <aidl/android/os/IPullAtomResultReceiver.h>
 #include <aidl/android/os/IStatsd.h>
-#include <aidl/android/util/StatsEventParcel.h>
+#include <aidl/android/util/StatsEventListParcel.h>
 #include <android/binder_auto_utils.h>
 #include <android/binder_ibinder.h>
 #include <android/binder_manager.h>
 
+#include "pull_executor.h"
+
 using Status = ::ndk::ScopedAStatus;
 using aidl::android::os::BnPullAtomCallback;
 using aidl::android::os::IPullAtomResultReceiver;
 using aidl::android::os::IStatsd;
-using aidl::android::util::StatsEventParcel;
+using aidl::android::util::StatsEventListParcel;
 using ::ndk::SharedRefBase;
 
+// Pages are sent once they reach this size, so that large pulls stay under the binder
+// transaction limit.
+constexpr size_t MAX_PAGE_BYTES = 128 * 1024;
+
 struct AStatsEventList {
-    std::vector<AStatsEvent*> data;
+    // The built events not sent yet, packed in the buffer sent to statsd.
+    StatsEventListParcel packed;
+
+    // The last event returned by AStatsEventList_addStatsEvent(), which is only built once the
+    // callback adds another event or returns.
+    AStatsEvent* pending = nullptr;
+
+    // With AStatsManager_PullAtomMetadata_setEventsPerPage(), the receiver of the pages of the
+    // pull, and whether sending one failed.
+    int32_t events_per_page = 0;
+    int32_t atom_tag = 0;
+    std::shared_ptr<IPullAtomResultReceiver> receiver;
+    bool page_failed = false;
 };
 
+// Appends the pending event, which has been built, to the packed buffer and releases it. The
+// released event is reused by the next AStatsEvent_obtain() of the thread, so the events of a
+// pull are only ever copied once.
+static void packPendingEvent(AStatsEventList* pull_data) {
+    if (pull_data->pending == nullptr) {
+        return;
+    }
+    // Resolves fuzz build failure in b/161575591.
+#if defined(__ANDROID_APEX__) || defined(LIB_STATS_PULL_TESTS_FLAG)
+    size_t size;
+    uint8_t* buffer = AStatsEvent_getBuffer(pull_data->pending, &size);
+    StatsEventListParcel& packed = pull_data->packed;
+    packed.offsets.push_back(packed.buffer.size());
+    packed.buffer.insert(packed.buffer.end(), buffer, buffer + size);
+#endif
+    AStatsEvent_release(pull_data->pending);
+    pull_data->pending = nullptr;
+}
+
+static void clearPackedEvents(AStatsEventList* pull_data) {
+    // Keeps the capacity for the next page.
+    pull_data->packed.buffer.clear();
+    pull_data->packed.offsets.clear();
+}
+
 AStatsEvent* AStatsEventList_addStatsEvent(AStatsEventList* pull_data) {
-    AStatsEvent* event = AStatsEvent_obtain();
-    pull_data->data.push_back(event);
-    return event;
+    // The events added so far have been built, so they can be sent as a page.
+    packPendingEvent(pull_data);
+    const StatsEventListParcel& packed = pull_data->packed;
+    if ((pull_data->events_per_page > 0 && packed.offsets.size() >= pull_data->events_per_page) ||
+        packed.buffer.size() >= MAX_PAGE_BYTES) {
+        if (!pull_data->page_failed) {
+            Status status = pull_data->receiver->pullChunkPacked(pull_data->atom_tag, packed);
+            pull_data->page_failed = !status.isOk();
+        }
+        clearPackedEvents(pull_data);
+    }
+    pull_data->pending = AStatsEvent_obtain();
+    return pull_data->pending;
 }
 
 constexpr int64_t DEFAULT_COOL_DOWN_MILLIS = 1000LL;  // 1 second.
@@ -53,6 +107,8 @@ struct AStatsManager_PullAtomMetadata {
     int64_t cool_down_millis;
     int64_t timeout_millis;
     std::vector<int32_t> additive_fields;
+    int32_t events_per_page;
+    int32_t max_concurrent_pulls;
 };
 
 AStatsManager_PullAtomMetadata* AStatsManager_PullAtomMetadata_obtain() {
@@ -60,6 +116,8 @@ AStatsManager_PullAtomMetadata* AStatsManager_PullAtomMetadata_obtain() {
     metadata->cool_down_millis = DEFAULT_COOL_DOWN_MILLIS;
     metadata->timeout_millis = DEFAULT_TIMEOUT_MILLIS;
     metadata->additive_fields = std::vector<int32_t>();
+    metadata->events_per_page = 0;
+    metadata->max_concurrent_pulls = 0;
     return metadata;
 }
 
@@ -101,47 +159,48 @@ void AStatsManager_PullAtomMetadata_getAdditiveFields(AStatsManager_PullAtomMeta
     std::copy(metadata->additive_fields.begin(), metadata->additive_fields.end(), fields);
 }
 
+void AStatsManager_PullAtomMetadata_setEventsPerPage(AStatsManager_PullAtomMetadata* metadata,
+                                                     int32_t events_per_page) {
+    metadata->events_per_page = events_per_page > 0 ? events_per_page : 0;
+}
+
+int32_t AStatsManager_PullAtomMetadata_getEventsPerPage(AStatsManager_PullAtomMetadata* metadata) {
+    return metadata->events_per_page;
+}
+
+void AStatsManager_PullAtomMetadata_setMaxConcurrentPulls(AStatsManager_PullAtomMetadata* metadata,
+                                                          int32_t max_concurrent_pulls) {
+    metadata->max_concurrent_pulls = max_concurrent_pulls > 0 ? max_concurrent_pulls : 0;
+}
+
+int32_t AStatsManager_PullAtomMetadata_getMaxConcurrentPulls(
+        AStatsManager_PullAtomMetadata* metadata) {
+    return metadata->max_concurrent_pulls;
+}
+
 class StatsPullAtomCallbackInternal : public BnPullAtomCallback {
   public:
     StatsPullAtomCallbackInternal(const AStatsManager_PullAtomCallback callback, void* cookie,
                                   const int64_t coolDownMillis, const int64_t timeoutMillis,
-                                  const std::vector<int32_t> additiveFields)
+                                  const std::vector<int32_t> additiveFields,
+                                  const int32_t eventsPerPage, const int32_t maxConcurrentPulls)
         : mCallback(callback),
           mCookie(cookie),
           mCoolDownMillis(coolDownMillis),
           mTimeoutMillis(timeoutMillis),
-          mAdditiveFields(additiveFields) {}
+          mAdditiveFields(additiveFields),
+          mEventsPerPage(eventsPerPage),
+          mMaxConcurrentPulls(maxConcurrentPulls) {}
 
     Status onPullAtom(int32_t atomTag,
                       const std::shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
-        AStatsEventList statsEventList;
-        int successInt = mCallback(atomTag, &statsEventList, mCookie);
-        bool success = successInt == AStatsManager_PULL_SUCCESS;
-
-        // Convert stats_events into StatsEventParcels.
-        std::vector<StatsEventParcel> parcels;
-
-        // Resolves fuzz build failure in b/161575591.
-#if defined(__ANDROID_APEX__) || defined(LIB_STATS_PULL_TESTS_FLAG)
-        for (int i = 0; i < statsEventList.data.size(); i++) {
-            size_t size;
-            uint8_t* buffer = AStatsEvent_getBuffer(statsEventList.data[i], &size);
-
-            StatsEventParcel p;
-            // vector.assign() creates a copy, but this is inevitable unless
-            // stats_event.h/c uses a vector as opposed to a buffer.
-            p.buffer.assign(buffer, buffer + size);
-            parcels.push_back(std::move(p));
-        }
-#endif
-
-        Status status = resultReceiver->pullFinished(atomTag, success, parcels);
-        if (!status.isOk()) {
-            std::vector<StatsEventParcel> emptyParcels;
-            resultReceiver->pullFinished(atomTag, /*success=*/false, emptyParcels);
-        }
-        for (int i = 0; i < statsEventList.data.size(); i++) {
-            AStatsEvent_release(statsEventList.data[i]);
+        std::shared_ptr<StatsPullAtomCallbackInternal> self =
+                ref<StatsPullAtomCallbackInternal>();
+        bool queued = PullExecutor::getInstance().submit(
+                atomTag, mMaxConcurrentPulls,
+                [self, atomTag, resultReceiver] { self->pull(atomTag, resultReceiver); });
+        if (!queued) {
+            pull(atomTag, resultReceiver);
         }
         return Status::ok();
     }
@@ -151,11 +210,36 @@ class StatsPullAtomCallbackInternal : public BnPullAtomCallback {
     const std::vector<int32_t>& getAdditiveFields() const { return mAdditiveFields; }
 
   private:
+    // Runs the callback and sends its result to [resultReceiver].
+    void pull(int32_t atomTag, const std::shared_ptr<IPullAtomResultReceiver>& resultReceiver) {
+        AStatsEventList statsEventList;
+        statsEventList.events_per_page = mEventsPerPage;
+        statsEventList.atom_tag = atomTag;
+        statsEventList.receiver = resultReceiver;
+        int successInt = mCallback(atomTag, &statsEventList, mCookie);
+        // The pull is incomplete if one of its pages was not sent.
+        bool success = successInt == AStatsManager_PULL_SUCCESS && !statsEventList.page_failed;
+
+        packPendingEvent(&statsEventList);
+        if (!success) {
+            clearPackedEvents(&statsEventList);
+        }
+
+        Status status =
+                resultReceiver->pullFinishedPacked(atomTag, success, statsEventList.packed);
+        if (!status.isOk()) {
+            StatsEventListParcel empty;
+            resultReceiver->pullFinishedPacked(atomTag, /*success=*/false, empty);
+        }
+    }
+
     const AStatsManager_PullAtomCallback mCallback;
     void* mCookie;
     const int64_t mCoolDownMillis;
     const int64_t mTimeoutMillis;
     const std::vector<int32_t> mAdditiveFields;
+    const int32_t mEventsPerPage;
+    const int32_t mMaxConcurrentPulls;
 };
 
 /**
@@ -267,13 +351,18 @@ void AStatsManager_setPullAtomCallback(int32_t atom_tag, AStatsManager_PullAtomM
     int64_t timeoutMillis = metadata == nullptr ? DEFAULT_TIMEOUT_MILLIS : metadata->timeout_millis;
 
     std::vector<int32_t> additiveFields;
+    int32_t eventsPerPage = 0;
+    int32_t maxConcurrentPulls = 0;
     if (metadata != nullptr) {
         additiveFields = metadata->additive_fields;
+        eventsPerPage = metadata->events_per_page;
+        maxConcurrentPulls = metadata->max_concurrent_pulls;
     }
 
     std::shared_ptr<StatsPullAtomCallbackInternal> callbackBinder =
             SharedRefBase::make<StatsPullAtomCallbackInternal>(callback, cookie, coolDownMillis,
-                                                               timeoutMillis, additiveFields);
+                                                               timeoutMillis, additiveFields,
+                                                               eventsPerPage, maxConcurrentPulls);
 
     {
         std::lock_guard<std::mutex> lg(pullAtomMutex);
@@ -297,3 +386,7 @@ void AStatsManager_clearPullAtomCallback(int32_t atom_tag) {
     std::thread unregisterThread(unregisterStatsPullAtomCallbackBlocking, atom_tag, statsProvider);
     unregisterThread.detach();
 }
+
+void AStatsManager_setPullExecutorThreadCount(int32_t thread_count) {
+    PullExecutor::getInstance().setThreadCount(thread_count);
+}
@@ -69,6 +69,30 @@ TEST(AStatsManager_PullAtomMetadataTest, TestSetAdditiveFields) {
     AStatsManager_PullAtomMetadata_release(metadata);
 }
 
+TEST(AStatsManager_PullAtomMetadataTest, TestSetEventsPerPage) {
+    AStatsManager_PullAtomMetadata* metadata = AStatsManager_PullAtomMetadata_obtain();
+    EXPECT_EQ(AStatsManager_PullAtomMetadata_getEventsPerPage(metadata), 0);
+    AStatsManager_PullAtomMetadata_setEventsPerPage(metadata, 500);
+    EXPECT_EQ(AStatsManager_PullAtomMetadata_getEventsPerPage(metadata), 500);
+    EXPECT_EQ(AStatsManager_PullAtomMetadata_getCoolDownMillis(metadata), DEFAULT_COOL_DOWN_MILLIS);
+    EXPECT_EQ(AStatsManager_PullAtomMetadata_getTimeoutMillis(metadata), DEFAULT_TIMEOUT_MILLIS);
+    // Negative sizes disable paging.
+    AStatsManager_PullAtomMetadata_setEventsPerPage(metadata, -1);
+    EXPECT_EQ(AStatsManager_PullAtomMetadata_getEventsPerPage(metadata), 0);
+    AStatsManager_PullAtomMetadata_release(metadata);
+}
+
+TEST(AStatsManager_PullAtomMetadataTest, TestSetMaxConcurrentPulls) {
+    AStatsManager_PullAtomMetadata* metadata = AStatsManager_PullAtomMetadata_obtain();
+    EXPECT_EQ(AStatsManager_PullAtomMetadata_getMaxConcurrentPulls(metadata), 0);
+    AStatsManager_PullAtomMetadata_setMaxConcurrentPulls(metadata, 2);
+    EXPECT_EQ(AStatsManager_PullAtomMetadata_getMaxConcurrentPulls(metadata), 2);
+    // Negative limits remove the limit.
+    AStatsManager_PullAtomMetadata_setMaxConcurrentPulls(metadata, -1);
+    EXPECT_EQ(AStatsManager_PullAtomMetadata_getMaxConcurrentPulls(metadata), 0);
+    AStatsManager_PullAtomMetadata_release(metadata);
+}
+
 TEST(AStatsManager_PullAtomMetadataTest, TestSetAllElements) {
     int64_t timeoutMillis = 500;
     int64_t coolDownMillis = 10000;
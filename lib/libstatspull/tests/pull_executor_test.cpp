@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2022, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pull_executor.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+
+namespace {
+
+constexpr std::chrono::seconds kTimeout(10);
+
+// Pulls that record when they start and finish, and that can be held until released.
+class PullRecorder {
+public:
+    std::function<void()> pull(int32_t id, bool held = false) {
+        return [this, id, held] {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mStarted.insert(id);
+            mCondition.notify_all();
+            if (held) {
+                mCondition.wait(lock, [this, id] { return mReleased.count(id) > 0; });
+            }
+            mFinished.insert(id);
+            mCondition.notify_all();
+        };
+    }
+
+    void release(int32_t id) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mReleased.insert(id);
+        mCondition.notify_all();
+    }
+
+    bool waitForStarted(int32_t id) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        return mCondition.wait_for(lock, kTimeout, [this, id] { return mStarted.count(id) > 0; });
+    }
+
+    bool waitForFinished(int32_t id) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        return mCondition.wait_for(lock, kTimeout, [this, id] { return mFinished.count(id) > 0; });
+    }
+
+    bool hasStarted(int32_t id) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mStarted.count(id) > 0;
+    }
+
+private:
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::set<int32_t> mStarted;
+    std::set<int32_t> mFinished;
+    std::set<int32_t> mReleased;
+};
+
+}  // anonymous namespace
+
+TEST(PullExecutorTest, TestNoThreads) {
+    PullRecorder recorder;
+    PullExecutor executor;
+    EXPECT_FALSE(executor.submit(/*atomTag=*/1, /*maxConcurrentPulls=*/0, recorder.pull(1)));
+}
+
+TEST(PullExecutorTest, TestRunsPullsInParallel) {
+    PullRecorder recorder;
+    PullExecutor executor;
+    executor.setThreadCount(2);
+
+    // The second pull runs while the first one is held.
+    EXPECT_TRUE(executor.submit(/*atomTag=*/1, /*maxConcurrentPulls=*/0, recorder.pull(1, true)));
+    EXPECT_TRUE(executor.submit(/*atomTag=*/1, /*maxConcurrentPulls=*/0, recorder.pull(2)));
+    EXPECT_TRUE(recorder.waitForFinished(2));
+    EXPECT_TRUE(recorder.hasStarted(1));
+
+    recorder.release(1);
+    EXPECT_TRUE(recorder.waitForFinished(1));
+}
+
+TEST(PullExecutorTest, TestMaxConcurrentPulls) {
+    PullRecorder recorder;
+    PullExecutor executor;
+    executor.setThreadCount(2);
+
+    EXPECT_TRUE(executor.submit(/*atomTag=*/1, /*maxConcurrentPulls=*/1, recorder.pull(1, true)));
+    ASSERT_TRUE(recorder.waitForStarted(1));
+
+    // The second pull of atom 1 waits for the first one, the pull of atom 2 queued after it
+    // doesn't.
+    EXPECT_TRUE(executor.submit(/*atomTag=*/1, /*maxConcurrentPulls=*/1, recorder.pull(2)));
+    EXPECT_TRUE(executor.submit(/*atomTag=*/2, /*maxConcurrentPulls=*/1, recorder.pull(3)));
+    EXPECT_TRUE(recorder.waitForFinished(3));
+    EXPECT_FALSE(recorder.hasStarted(2));
+
+    recorder.release(1);
+    EXPECT_TRUE(recorder.waitForFinished(2));
+}
+
+TEST(PullExecutorTest, TestPendingPullsBounded) {
+    PullRecorder recorder;
+    PullExecutor executor(/*maxPendingPulls=*/2);
+    executor.setThreadCount(1);
+
+    EXPECT_TRUE(executor.submit(/*atomTag=*/1, /*maxConcurrentPulls=*/0, recorder.pull(1, true)));
+    ASSERT_TRUE(recorder.waitForStarted(1));
+
+    // The running pull doesn't count towards the bound.
+    EXPECT_TRUE(executor.submit(/*atomTag=*/2, /*maxConcurrentPulls=*/0, recorder.pull(2)));
+    EXPECT_TRUE(executor.submit(/*atomTag=*/3, /*maxConcurrentPulls=*/0, recorder.pull(3)));
+    EXPECT_FALSE(executor.submit(/*atomTag=*/4, /*maxConcurrentPulls=*/0, recorder.pull(4)));
+
+    recorder.release(1);
+    EXPECT_TRUE(recorder.waitForFinished(2));
+    EXPECT_TRUE(recorder.waitForFinished(3));
+
+    // The queue has room again.
+    EXPECT_TRUE(executor.submit(/*atomTag=*/4, /*maxConcurrentPulls=*/0, recorder.pull(4)));
+    EXPECT_TRUE(recorder.waitForFinished(4));
+}
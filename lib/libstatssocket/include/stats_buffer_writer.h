@@ -23,6 +23,13 @@
 extern "C" {
 #endif  // __CPLUSPLUS
 void stats_log_close();
+int stats_log_set_batching(uint32_t maxDelayMillis);
+// Makes the atoms go to the datagram socket bound at [path] instead of statsd, e.g. for
+// benchmarks and tests with their own listener. NULL restores statsd. Returns 0 or -errno.
+int stats_log_set_socket_path(const char* path);
+void stats_log_flush();
+int stats_log_create_ring(size_t capacity, int* ringFd, int* wakeFd);
+void stats_log_close_ring();
 int stats_log_is_closed();
 int write_buffer_to_statsd(void* buffer, size_t size, uint32_t atomId);
 #ifdef __cplusplus
@@ -59,6 +59,42 @@ typedef struct AStatsEvent AStatsEvent;
  */
 AStatsEvent* AStatsEvent_obtain();
 
+/**
+ * Bytes that AStatsEvent_initInBuffer needs in the storage in addition to the encoded atom.
+ */
+#define ASTATSEVENT_STORAGE_OVERHEAD 64
+
+/**
+ * Encoded sizes of the parts of an atom, to size the storage of AStatsEvent_initInBuffer: the
+ * metadata written by the library (timestamp and atom id), then each scalar field without
+ * annotations.
+ */
+#define ASTATSEVENT_METADATA_SIZE 16
+#define ASTATSEVENT_INT32_FIELD_SIZE 5
+#define ASTATSEVENT_INT64_FIELD_SIZE 9
+#define ASTATSEVENT_FLOAT_FIELD_SIZE 5
+#define ASTATSEVENT_BOOL_FIELD_SIZE 2
+
+/**
+ * Size of the storage that AStatsEvent_initInBuffer needs for an atom whose fields are encoded in
+ * [fieldsSize] bytes.
+ */
+#define ASTATSEVENT_STORAGE_SIZE(fieldsSize) \
+    (ASTATSEVENT_STORAGE_OVERHEAD + ASTATSEVENT_METADATA_SIZE + (fieldsSize))
+
+/**
+ * Initializes an AStatsEvent within [storage], e.g. a buffer on the stack of the caller, instead
+ * of allocating it. This is meant for atoms with a fixed layout, whose encoding fits in
+ * ASTATSEVENT_STORAGE_SIZE: the event doesn't grow, and writing past [size] is an overflow error.
+ *
+ * The event is used like one returned by AStatsEvent_obtain, until [storage] is gone or reused.
+ * AStatsEvent_release is a no-op for it and doesn't need to be called.
+ *
+ * Returns NULL if [size] is below ASTATSEVENT_STORAGE_SIZE(ASTATSEVENT_INT32_FIELD_SIZE), which
+ * leaves room to encode the errors of the event.
+ */
+AStatsEvent* AStatsEvent_initInBuffer(void* storage, size_t size);
+
 /**
  * Builds and finalizes the AStatsEvent for a pulled event.
  * This should only be called for pulled AStatsEvents.
@@ -156,6 +192,28 @@ void AStatsEvent_writeInt32Array(AStatsEvent* event, const int32_t* elements, si
  **/
 void AStatsEvent_writeInt64Array(AStatsEvent* event, const int64_t* elements, size_t numElements);
 
+/**
+ * Write a int32 array field to this StatsEvent, with each element encoded in 1 to 5 bytes
+ * depending on its magnitude, instead of 4. The stats service decodes it as the same field as
+ * AStatsEvent_writeInt32Array. Smaller for arrays of values close to 0, such as counts.
+ *
+ * Max size of array is 127. If exceeded, array is not written and ERROR_LIST_TOO_LONG is appended
+ * to StatsEvent.
+ **/
+void AStatsEvent_writePackedInt32Array(AStatsEvent* event, const int32_t* elements,
+                                       size_t numElements);
+
+/**
+ * Write a int64 array field to this StatsEvent, with each element encoded in 1 to 10 bytes
+ * depending on its magnitude, instead of 8. The stats service decodes it as the same field as
+ * AStatsEvent_writeInt64Array.
+ *
+ * Max size of array is 127. If exceeded, array is not written and ERROR_LIST_TOO_LONG is appended
+ * to StatsEvent.
+ **/
+void AStatsEvent_writePackedInt64Array(AStatsEvent* event, const int64_t* elements,
+                                       size_t numElements);
+
 /**
  * Write a float array field to this StatsEvent.
  *
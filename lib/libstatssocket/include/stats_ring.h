@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Layout of the shared memory ring through which a client sends its atoms to statsd, see
+ * AStatsSocket_createRing(). Shared between libstatssocket and statsd: the fields are accessed
+ * with the __atomic builtins on both sides.
+ *
+ * The memory holds a stats_ring_header, then a data area of [capacity] bytes, a power of 2. The
+ * records of the data area are 4-byte aligned and never wrap around: each starts with a uint32_t
+ * word holding STATS_RING_COMMITTED and either the length of the encoded atom that follows, or
+ * STATS_RING_PADDING to skip to the end of the data area. The free space is zeroed: statsd clears
+ * the records it reads before moving readPos past them.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __CPLUSPLUS
+
+#define STATS_RING_MAGIC 0x53524e47  // "SRNG"
+#define STATS_RING_VERSION 1
+
+#define STATS_RING_COMMITTED 0x80000000u
+#define STATS_RING_PADDING 0x40000000u
+#define STATS_RING_LENGTH_MASK 0x3fffffffu
+
+#define STATS_RING_MIN_CAPACITY (16 * 1024)
+#define STATS_RING_MAX_CAPACITY (4 * 1024 * 1024)
+// Same limit as for the atoms written to the socket.
+#define STATS_RING_MAX_ATOM_BYTES 4068
+
+struct stats_ring_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t reserved;
+    // Bytes reserved by the writers since the ring was created.
+    uint64_t reservePos __attribute__((aligned(64)));
+    // Bytes consumed by statsd since the ring was created.
+    uint64_t readPos __attribute__((aligned(64)));
+    // Set by statsd before it waits for the ring: the next writer then signals the wake eventfd.
+    uint32_t readerWaiting __attribute__((aligned(64)));
+};
+
+// Offset of the data area.
+#define STATS_RING_HEADER_SIZE 256
+
+#ifdef __cplusplus
+}
+#endif  // __CPLUSPLUS
@@ -20,6 +20,9 @@
  * Helpers to manage the statsd socket.
  **/
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif  // __CPLUSPLUS
@@ -28,6 +31,45 @@ extern "C" {
  * Closes the statsd socket file descriptor.
  **/
 void AStatsSocket_close();
+
+/**
+ * Batches the atoms written by this process, for processes logging many atoms: they are queued
+ * and sent together, in fewer syscalls, once enough are queued or at the latest [maxDelayMillis]
+ * after they were written. Atoms larger than the batch slots, or written while the queue is
+ * full, are still sent right away. A [maxDelayMillis] of 0 sends the queued atoms and disables
+ * batching.
+ *
+ * The queued atoms are lost if the process dies: call AStatsSocket_flush before exiting.
+ *
+ * Returns 0, or -errno if batching could not be enabled.
+ **/
+int AStatsSocket_setBatching(uint32_t maxDelayMillis);
+
+/**
+ * Sends the atoms queued by AStatsSocket_setBatching now.
+ **/
+void AStatsSocket_flush();
+
+/**
+ * Creates a shared memory ring of [capacityBytes], a power of 2 from 16KB to 4MB, through which
+ * the atoms of this process are then sent to statsd instead of the socket, without syscalls in
+ * the steady state. This is meant for trusted system processes logging many atoms.
+ *
+ * [*ringFd] and [*wakeFd] must then be registered with IStatsd.registerAtomRing, and closed by
+ * the caller afterwards. If the registration fails, or when statsd dies, the caller must call
+ * AStatsSocket_closeRing. Atoms that don't fit in the ring are written to the socket.
+ *
+ * Returns 0, or -errno if the ring could not be created or the process already has one.
+ **/
+int AStatsSocket_createRing(size_t capacityBytes, int* ringFd, int* wakeFd);
+
+/**
+ * Sends the atoms of this process through the socket again, see AStatsSocket_createRing. The
+ * memory of the ring is kept until the process exits. If the ring was registered, the caller
+ * then releases it with IStatsd.unregisterAtomRing.
+ **/
+void AStatsSocket_closeRing();
+
 #ifdef __cplusplus
 }
 #endif  // __CPLUSPLUS
@@ -18,6 +18,7 @@
 #include <errno.h>
 #include <sys/time.h>
 #include <sys/uio.h>
+#include "stats_ring_writer.h"
 #include "statsd_writer.h"
 
 static const uint32_t kStatsEventTag = 1937006964;
@@ -32,6 +33,7 @@ void note_log_drop(int error, int atomId) {
 }
 
 void stats_log_close() {
+    statsd_writer_flush();
     statsd_writer_init_lock();
     __write_to_statsd = __write_to_statsd_init;
     if (statsdLoggerWrite.close) {
@@ -40,6 +42,36 @@ void stats_log_close() {
     statsd_writer_init_unlock();
 }
 
+int stats_log_set_batching(uint32_t maxDelayMillis) {
+    return statsd_writer_set_batching(maxDelayMillis);
+}
+
+int stats_log_set_socket_path(const char* path) {
+    int ret = statsd_writer_set_socket_path(path);
+    if (ret == 0) {
+        // The next write connects to the new path.
+        stats_log_close();
+    }
+    return ret;
+}
+
+void stats_log_flush() {
+    int save_errno = errno;
+    statsd_writer_flush();
+    errno = save_errno;
+}
+
+int stats_log_create_ring(size_t capacity, int* ringFd, int* wakeFd) {
+    int save_errno = errno;
+    int ret = stats_ring_create(capacity, ringFd, wakeFd);
+    errno = save_errno;
+    return ret;
+}
+
+void stats_log_close_ring() {
+    stats_ring_close();
+}
+
 int stats_log_is_closed() {
     return statsdLoggerWrite.isClosed && (*statsdLoggerWrite.isClosed)();
 }
@@ -53,7 +85,21 @@ int write_buffer_to_statsd(void* buffer, size_t size, uint32_t atomId) {
     vecs[1].iov_base = buffer;
     vecs[1].iov_len = size;
 
-    ret = __write_to_statsd(vecs, 2);
+    ret = stats_ring_write(buffer, size);
+    if (ret != -EAGAIN) {
+        return ret;
+    }
+
+    // The first write opens the socket, the batched writes assume it is open.
+    ret = -EAGAIN;
+    if (__write_to_statsd != __write_to_statsd_init) {
+        int save_errno = errno;
+        ret = statsd_writer_batch(vecs, 2, atomId);
+        errno = save_errno;
+    }
+    if (ret == -EAGAIN) {
+        ret = __write_to_statsd(vecs, 2);
+    }
 
     if (ret < 0) {
         note_log_drop(ret, atomId);
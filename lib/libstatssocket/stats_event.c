@@ -15,6 +15,8 @@
  */
 
 #include "include/stats_event.h"
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -33,6 +35,7 @@
 #define POS_ATOM_ID (POS_TIMESTAMP + sizeof(uint8_t) + sizeof(uint64_t))
 
 /* LIMITS */
+#define MAX_VARINT_BYTES 10
 #define MAX_ANNOTATION_COUNT 15
 #define MAX_BYTE_VALUE 127  // parsing side requires that lengths fit in 7 bits
 
@@ -63,6 +66,7 @@
 #define OBJECT_TYPE 0x07
 #define KEY_VALUE_PAIRS_TYPE 0x08
 #define ATTRIBUTION_CHAIN_TYPE 0x09
+#define PACKED_LIST_TYPE 0x0A
 #define ERROR_TYPE 0x0F
 
 // The AStatsEvent struct holds the serialized encoding of an event
@@ -78,9 +82,17 @@ struct AStatsEvent {
     uint32_t atomId;
     uint32_t errors;
     bool built;
+    // Whether buf is the storage given to AStatsEvent_initInBuffer, which is neither grown nor
+    // freed.
+    bool inCallerBuffer;
     size_t bufSize;
 };
 
+_Static_assert(sizeof(AStatsEvent) + _Alignof(AStatsEvent) - 1 <= ASTATSEVENT_STORAGE_OVERHEAD,
+               "an aligned AStatsEvent must fit in ASTATSEVENT_STORAGE_OVERHEAD");
+_Static_assert(POS_ATOM_ID + sizeof(uint8_t) + sizeof(uint32_t) == ASTATSEVENT_METADATA_SIZE,
+               "ASTATSEVENT_METADATA_SIZE must match the encoding of the metadata");
+
 static int64_t get_elapsed_realtime_ns() {
     struct timespec t;
     t.tv_sec = t.tv_nsec = 0;
@@ -88,26 +100,80 @@ static int64_t get_elapsed_realtime_ns() {
     return (int64_t)t.tv_sec * 1000000000LL + t.tv_nsec;
 }
 
-AStatsEvent* AStatsEvent_obtain() {
-    AStatsEvent* event = malloc(sizeof(AStatsEvent));
+// Each thread keeps the last event it released, with its buffer, for its next
+// AStatsEvent_obtain(), so that logging an atom doesn't allocate in the steady state.
+static pthread_once_t sCachedEventKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t sCachedEventKey;
+static bool sCachedEventKeyCreated = false;
+
+static void free_event(void* event) {
+    free(((AStatsEvent*)event)->buf);
+    free(event);
+}
+
+static void create_cached_event_key() {
+    // The cached event of a thread is freed when it exits.
+    sCachedEventKeyCreated = pthread_key_create(&sCachedEventKey, free_event) == 0;
+}
+
+static void init_event(AStatsEvent* event) {
     event->lastFieldPos = 0;
     event->numBytesWritten = 2;  // reserve first 2 bytes for root event type and number of elements
     event->numElements = 0;
     event->atomId = 0;
     event->errors = 0;
     event->built = false;
-    event->bufSize = MAX_PUSH_EVENT_PAYLOAD;
-    event->buf = (uint8_t*)calloc(event->bufSize, 1);
 
     event->buf[0] = OBJECT_TYPE;
     AStatsEvent_writeInt64(event, get_elapsed_realtime_ns());  // write the timestamp
+}
+
+AStatsEvent* AStatsEvent_obtain() {
+    pthread_once(&sCachedEventKeyOnce, create_cached_event_key);
+    AStatsEvent* event = NULL;
+    if (sCachedEventKeyCreated) {
+        event = (AStatsEvent*)pthread_getspecific(sCachedEventKey);
+        if (event != NULL) {
+            pthread_setspecific(sCachedEventKey, NULL);
+        }
+    }
+    if (event == NULL) {
+        event = malloc(sizeof(AStatsEvent));
+        event->bufSize = MAX_PUSH_EVENT_PAYLOAD;
+        // Not zeroed: the bytes of the encoding are all written before being read.
+        event->buf = (uint8_t*)malloc(event->bufSize);
+        event->inCallerBuffer = false;
+    }
+    init_event(event);
+    return event;
+}
 
+AStatsEvent* AStatsEvent_initInBuffer(void* storage, size_t size) {
+    // Leaves room for the error field that build_internal() may write.
+    if (storage == NULL || size < ASTATSEVENT_STORAGE_SIZE(ASTATSEVENT_INT32_FIELD_SIZE)) {
+        return NULL;
+    }
+    const uintptr_t alignMask = _Alignof(AStatsEvent) - 1;
+    AStatsEvent* event = (AStatsEvent*)(((uintptr_t)storage + alignMask) & ~alignMask);
+    event->buf = (uint8_t*)storage + ASTATSEVENT_STORAGE_OVERHEAD;
+    event->bufSize = size - ASTATSEVENT_STORAGE_OVERHEAD;
+    event->inCallerBuffer = true;
+    init_event(event);
     return event;
 }
 
 void AStatsEvent_release(AStatsEvent* event) {
-    free(event->buf);
-    free(event);
+    if (event->inCallerBuffer) {
+        return;
+    }
+    pthread_once(&sCachedEventKeyOnce, create_cached_event_key);
+    // The buffers that grew for pulled atoms are not kept.
+    if (sCachedEventKeyCreated && event->bufSize == MAX_PUSH_EVENT_PAYLOAD &&
+        pthread_getspecific(sCachedEventKey) == NULL &&
+        pthread_setspecific(sCachedEventKey, event) == 0) {
+        return;
+    }
+    free_event(event);
 }
 
 void AStatsEvent_setAtomId(AStatsEvent* event, uint32_t atomId) {
@@ -137,6 +203,12 @@ static bool overflows(AStatsEvent* event, size_t size) {
         return true;
     }
 
+    // The storage of the caller has the exact size of the atom.
+    if (event->inCallerBuffer && totalBytesNeeded > event->bufSize) {
+        event->errors |= ERROR_OVERFLOW;
+        return true;
+    }
+
     // Expand buffer if needed.
     if (event->bufSize < MAX_PULL_EVENT_PAYLOAD && totalBytesNeeded > event->bufSize) {
         do {
@@ -193,6 +265,20 @@ static void append_byte_array(AStatsEvent* event, const uint8_t* buf, size_t siz
     }
 }
 
+// Writes [value] zigzag encoded, so that small negative values are short too, in base 128 from
+// the least significant group, with the high bit of each byte set if a byte follows.
+static void append_zigzag_varint(AStatsEvent* event, int64_t value) {
+    uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    uint8_t bytes[MAX_VARINT_BYTES];
+    size_t size = 0;
+    while (zigzag >= 0x80) {
+        bytes[size++] = (uint8_t)(zigzag | 0x80);
+        zigzag >>= 7;
+    }
+    bytes[size++] = (uint8_t)zigzag;
+    append_byte_array(event, bytes, size);
+}
+
 // Side-effect: modifies event->errors if buf is not properly null-terminated
 static void append_string(AStatsEvent* event, const char* buf) {
     size_t size = strnlen(buf, MAX_PULL_EVENT_PAYLOAD);
@@ -265,20 +351,21 @@ void AStatsEvent_writeAttributionChain(AStatsEvent* event, const uint32_t* uids,
     }
 }
 
-static bool writeArrayMetadata(AStatsEvent* event, size_t numElements, uint8_t elementTypeId) {
+static bool writeListMetadata(AStatsEvent* event, uint8_t listTypeId, size_t numElements,
+                              uint8_t elementTypeId) {
     if (numElements > MAX_BYTE_VALUE) {
         event->errors |= ERROR_LIST_TOO_LONG;
         return false;
     }
 
-    start_field(event, LIST_TYPE);
+    start_field(event, listTypeId);
     append_byte(event, numElements);
     append_byte(event, elementTypeId);
     return true;
 }
 
 void AStatsEvent_writeInt32Array(AStatsEvent* event, const int32_t* elements, size_t numElements) {
-    if (!writeArrayMetadata(event, numElements, INT32_TYPE)) {
+    if (!writeListMetadata(event, LIST_TYPE, numElements, INT32_TYPE)) {
         return;
     }
 
@@ -288,7 +375,7 @@ void AStatsEvent_writeInt32Array(AStatsEvent* event, const int32_t* elements, si
 }
 
 void AStatsEvent_writeInt64Array(AStatsEvent* event, const int64_t* elements, size_t numElements) {
-    if (!writeArrayMetadata(event, numElements, INT64_TYPE)) {
+    if (!writeListMetadata(event, LIST_TYPE, numElements, INT64_TYPE)) {
         return;
     }
 
@@ -297,8 +384,30 @@ void AStatsEvent_writeInt64Array(AStatsEvent* event, const int64_t* elements, si
     }
 }
 
+void AStatsEvent_writePackedInt32Array(AStatsEvent* event, const int32_t* elements,
+                                       size_t numElements) {
+    if (!writeListMetadata(event, PACKED_LIST_TYPE, numElements, INT32_TYPE)) {
+        return;
+    }
+
+    for (size_t i = 0; i < numElements; i++) {
+        append_zigzag_varint(event, elements[i]);
+    }
+}
+
+void AStatsEvent_writePackedInt64Array(AStatsEvent* event, const int64_t* elements,
+                                       size_t numElements) {
+    if (!writeListMetadata(event, PACKED_LIST_TYPE, numElements, INT64_TYPE)) {
+        return;
+    }
+
+    for (size_t i = 0; i < numElements; i++) {
+        append_zigzag_varint(event, elements[i]);
+    }
+}
+
 void AStatsEvent_writeFloatArray(AStatsEvent* event, const float* elements, size_t numElements) {
-    if (!writeArrayMetadata(event, numElements, FLOAT_TYPE)) {
+    if (!writeListMetadata(event, LIST_TYPE, numElements, FLOAT_TYPE)) {
         return;
     }
 
@@ -308,7 +417,7 @@ void AStatsEvent_writeFloatArray(AStatsEvent* event, const float* elements, size
 }
 
 void AStatsEvent_writeBoolArray(AStatsEvent* event, const bool* elements, size_t numElements) {
-    if (!writeArrayMetadata(event, numElements, BOOL_TYPE)) {
+    if (!writeListMetadata(event, LIST_TYPE, numElements, BOOL_TYPE)) {
         return;
     }
 
@@ -319,7 +428,7 @@ void AStatsEvent_writeBoolArray(AStatsEvent* event, const bool* elements, size_t
 
 void AStatsEvent_writeStringArray(AStatsEvent* event, const char* const* elements,
                                   size_t numElements) {
-    if (!writeArrayMetadata(event, numElements, STRING_TYPE)) {
+    if (!writeListMetadata(event, LIST_TYPE, numElements, STRING_TYPE)) {
         return;
     }
 
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// For memfd_create() with glibc.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "stats_ring_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "include/stats_ring.h"
+
+struct stats_ring {
+    struct stats_ring_header* header;
+    uint8_t* data;
+    uint32_t capacity;
+    int wakeFd;
+};
+
+static _Atomic(struct stats_ring*) sRing = NULL;
+
+int stats_ring_create(size_t capacity, int* ringFd, int* wakeFd) {
+    if (capacity < STATS_RING_MIN_CAPACITY || capacity > STATS_RING_MAX_CAPACITY ||
+        (capacity & (capacity - 1)) != 0) {
+        return -EINVAL;
+    }
+    if (atomic_load(&sRing) != NULL) {
+        return -EEXIST;
+    }
+
+    const size_t size = STATS_RING_HEADER_SIZE + capacity;
+    int fd = memfd_create("statsd_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        return -errno;
+    }
+    // statsd maps the ring too, so its size must not change.
+    if (ftruncate(fd, size) != 0 ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+        int ret = -errno;
+        close(fd);
+        return ret;
+    }
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        int ret = -errno;
+        close(fd);
+        return ret;
+    }
+    int efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    int callerEfd = efd < 0 ? -1 : fcntl(efd, F_DUPFD_CLOEXEC, 0);
+    struct stats_ring* ring = malloc(sizeof(struct stats_ring));
+    if (efd < 0 || callerEfd < 0 || ring == NULL) {
+        int ret = ring == NULL ? -ENOMEM : -errno;
+        free(ring);
+        if (efd >= 0) close(efd);
+        if (callerEfd >= 0) close(callerEfd);
+        munmap(memory, size);
+        close(fd);
+        return ret;
+    }
+
+    // The memory of a new memfd is zeroed, which is the free space of the ring.
+    ring->header = (struct stats_ring_header*)memory;
+    ring->data = (uint8_t*)memory + STATS_RING_HEADER_SIZE;
+    ring->capacity = capacity;
+    ring->wakeFd = efd;
+    ring->header->magic = STATS_RING_MAGIC;
+    ring->header->version = STATS_RING_VERSION;
+    ring->header->capacity = capacity;
+
+    struct stats_ring* expected = NULL;
+    if (!atomic_compare_exchange_strong(&sRing, &expected, ring)) {
+        free(ring);
+        close(efd);
+        close(callerEfd);
+        munmap(memory, size);
+        close(fd);
+        return -EEXIST;
+    }
+    *ringFd = fd;
+    *wakeFd = callerEfd;
+    return 0;
+}
+
+int stats_ring_write(const void* buffer, size_t size) {
+    struct stats_ring* ring = atomic_load(&sRing);
+    if (ring == NULL) {
+        return -EAGAIN;
+    }
+    struct stats_ring_header* header = ring->header;
+    const uint64_t recordSize = sizeof(uint32_t) + ((size + 3) & ~(uint64_t)3);
+    if (size > STATS_RING_MAX_ATOM_BYTES || recordSize > ring->capacity / 2) {
+        return -EAGAIN;
+    }
+
+    // Reserves the record, after padding to the end of the data area if it doesn't fit there.
+    uint64_t pos = __atomic_load_n(&header->reservePos, __ATOMIC_RELAXED);
+    uint64_t offset;
+    uint64_t padding;
+    do {
+        offset = pos & (ring->capacity - 1);
+        padding = offset + recordSize > ring->capacity ? ring->capacity - offset : 0;
+        const uint64_t readPos = __atomic_load_n(&header->readPos, __ATOMIC_ACQUIRE);
+        if (pos + padding + recordSize - readPos > ring->capacity) {
+            return -EAGAIN;
+        }
+    } while (!__atomic_compare_exchange_n(&header->reservePos, &pos, pos + padding + recordSize,
+                                          true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    if (padding > 0) {
+        __atomic_store_n((uint32_t*)(ring->data + offset),
+                         STATS_RING_COMMITTED | STATS_RING_PADDING, __ATOMIC_RELEASE);
+        offset = 0;
+    }
+    memcpy(ring->data + offset + sizeof(uint32_t), buffer, size);
+    // Sequentially consistent with the load of readerWaiting, so that either statsd sees the
+    // record before waiting, or this writer sees that it waits.
+    __atomic_store_n((uint32_t*)(ring->data + offset), STATS_RING_COMMITTED | (uint32_t)size,
+                     __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&header->readerWaiting, 0, __ATOMIC_SEQ_CST) != 0) {
+        uint64_t one = 1;
+        // Fails with EAGAIN if statsd has been signaled many times without reading, which is fine.
+        (void)write(ring->wakeFd, &one, sizeof(one));
+    }
+    return size;
+}
+
+void stats_ring_close() {
+    atomic_store(&sRing, NULL);
+}
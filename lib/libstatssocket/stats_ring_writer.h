@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * Writer side of the shared memory ring, see AStatsSocket_createRing().
+ */
+
+/**
+ * Creates the ring of the process and sends the next atoms through it. Returns 0 or -errno.
+ */
+int stats_ring_create(size_t capacity, int* ringFd, int* wakeFd);
+
+/**
+ * Writes the encoded atom to the ring. Returns its size, or -EAGAIN if it must be written to the
+ * socket: there is no ring, or it is full.
+ */
+int stats_ring_write(const void* buffer, size_t size);
+
+/**
+ * Stops writing to the ring. Its memory is kept, since other threads may still be writing to it.
+ */
+void stats_ring_close();
@@ -20,3 +20,19 @@
 void AStatsSocket_close() {
     stats_log_close();
 }
+
+int AStatsSocket_setBatching(uint32_t maxDelayMillis) {
+    return stats_log_set_batching(maxDelayMillis);
+}
+
+void AStatsSocket_flush() {
+    stats_log_flush();
+}
+
+int AStatsSocket_createRing(size_t capacityBytes, int* ringFd, int* wakeFd) {
+    return stats_log_create_ring(capacityBytes, ringFd, wakeFd);
+}
+
+void AStatsSocket_closeRing() {
+    stats_log_close_ring();
+}
@@ -13,6 +13,10 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+// For sendmmsg() with glibc.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "statsd_writer.h"
 
 #include <errno.h>
@@ -22,9 +26,12 @@
 #include <private/android_logger.h>
 #include <stdarg.h>
 #include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -51,10 +58,29 @@ extern pid_t gettid();
 
 #endif  // __BIONIC__
 
+#define STATSD_SOCKET_PATH "/dev/socket/statsdw"
+// Socket of the app uids, read by statsd on its own thread. Statsd closes it when it does not
+// read it, so that the connections are refused and the apps use STATSD_SOCKET_PATH instead.
+#define STATSD_APP_SOCKET_PATH "/dev/socket/statsdw_app"
+#define PER_USER_RANGE 100000
+#define FIRST_APPLICATION_UID 10000
+
 static pthread_mutex_t log_init_lock = PTHREAD_MUTEX_INITIALIZER;
+// Path of the statsd socket, see statsd_writer_set_socket_path(). Guarded by log_init_lock.
+static char socket_path[sizeof(((struct sockaddr_un*)NULL)->sun_path)] = STATSD_SOCKET_PATH;
 static atomic_int dropped = 0;
 static atomic_int log_error = 0;
-static atomic_int atom_tag = 0;
+
+/*
+ * Drops by atom id, for up to DROP_TABLE_SIZE distinct atoms between two reports to statsd. Each
+ * slot packs the atom id in its high 32 bits and the count in its low 32 bits, so that it is
+ * claimed, incremented and taken with single atomic operations. The drops of the atoms that find
+ * no slot are counted in [dropped], and reported without an atom id since they mix several atoms.
+ */
+#define DROP_TABLE_SIZE 8
+static atomic_ullong drop_table[DROP_TABLE_SIZE];
+// Whether there are drops to report, in [dropped] or [drop_table].
+static atomic_int drops_pending = 0;
 
 void statsd_writer_init_lock() {
     /*
@@ -72,6 +98,19 @@ void statsd_writer_init_unlock() {
     pthread_mutex_unlock(&log_init_lock);
 }
 
+int statsd_writer_set_socket_path(const char* path) {
+    if (path == NULL) {
+        path = STATSD_SOCKET_PATH;
+    }
+    if (strlen(path) >= sizeof(socket_path)) {
+        return -ENAMETOOLONG;
+    }
+    statsd_writer_init_lock();
+    strcpy(socket_path, path);
+    statsd_writer_init_unlock();
+    return 0;
+}
+
 static int statsdAvailable();
 static int statsdOpen();
 static void statsdClose();
@@ -90,6 +129,18 @@ struct android_log_transport_write statsdLoggerWrite = {
         .isClosed = statsdIsClosed,
 };
 
+/* log_init_lock assumed */
+static int statsdConnect(int sock, const char* path) {
+    struct sockaddr_un un;
+    memset(&un, 0, sizeof(struct sockaddr_un));
+    un.sun_family = AF_UNIX;
+    strcpy(un.sun_path, path);
+    if (TEMP_FAILURE_RETRY(connect(sock, (struct sockaddr*)&un, sizeof(struct sockaddr_un))) < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
 /* log_init_lock assumed */
 static int statsdOpen() {
     int i, ret = 0;
@@ -112,14 +163,15 @@ static int statsdOpen() {
             // SO_RCVBUF does not have an effect on unix domain socket, but SO_SNDBUF does.
             // Proceed to connect even setsockopt fails.
             setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, bufLen);
-            struct sockaddr_un un;
-            memset(&un, 0, sizeof(struct sockaddr_un));
-            un.sun_family = AF_UNIX;
-            strcpy(un.sun_path, "/dev/socket/statsdw");
-
-            if (TEMP_FAILURE_RETRY(
-                        connect(sock, (struct sockaddr*)&un, sizeof(struct sockaddr_un))) < 0) {
-                ret = -errno;
+            ret = -1;
+            if (strcmp(socket_path, STATSD_SOCKET_PATH) == 0 &&
+                getuid() % PER_USER_RANGE >= FIRST_APPLICATION_UID) {
+                ret = statsdConnect(sock, STATSD_APP_SOCKET_PATH);
+            }
+            if (ret < 0) {
+                ret = statsdConnect(sock, socket_path);
+            }
+            if (ret < 0) {
                 switch (ret) {
                     case -ENOTCONN:
                     case -ECONNREFUSED:
@@ -156,7 +208,10 @@ static void statsdClose() {
 
 static int statsdAvailable() {
     if (atomic_load(&statsdLoggerWrite.sock) < 0) {
-        if (access("/dev/socket/statsdw", W_OK) == 0) {
+        statsd_writer_init_lock();
+        const int ret = access(socket_path, W_OK);
+        statsd_writer_init_unlock();
+        if (ret == 0) {
             return 0;
         }
         return -EBADF;
@@ -164,10 +219,34 @@ static int statsdAvailable() {
     return 1;
 }
 
+// Adds [count] drops of [tag] to drop_table. Returns false if there is no slot for it.
+static bool noteDropsInTable(int tag, int32_t count) {
+    if (tag <= 0) {
+        return false;
+    }
+    const unsigned long long tagBits = (unsigned long long)(uint32_t)tag << 32;
+    for (int i = 0; i < DROP_TABLE_SIZE; i++) {
+        unsigned long long slot = atomic_load_explicit(&drop_table[i], memory_order_relaxed);
+        // The counts stay below INT32_MAX, as they are reported as int32's.
+        while (slot == 0 || ((slot & 0xffffffff00000000ULL) == tagBits &&
+                             (slot & 0xffffffffULL) <= (unsigned long long)(INT32_MAX - count))) {
+            const unsigned long long next = slot == 0 ? tagBits | count : slot + count;
+            if (atomic_compare_exchange_weak_explicit(&drop_table[i], &slot, next,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 static void statsdNoteDrop(int error, int tag) {
-    atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
     atomic_exchange_explicit(&log_error, error, memory_order_relaxed);
-    atomic_exchange_explicit(&atom_tag, tag, memory_order_relaxed);
+    if (!noteDropsInTable(tag, 1)) {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+    }
+    atomic_store_explicit(&drops_pending, 1, memory_order_release);
 }
 
 static int statsdIsClosed() {
@@ -177,6 +256,67 @@ static int statsdIsClosed() {
     return 0;
 }
 
+// Tells statsd that [count] events were dropped, all of them of [tag], or of unknown atoms if [tag]
+// is 0. Returns false if the report could not be written.
+static bool statsdWriteDropReport(int sock, android_log_header_t* header, int32_t tag,
+                                  int32_t count) {
+    android_log_event_long_t buffer;
+    header->id = LOG_ID_STATS;
+    // store the last log error in the tag field. This tag field is not used by statsd.
+    buffer.header.tag = atomic_load(&log_error);
+    buffer.payload.type = EVENT_TYPE_LONG;
+    // format:
+    // |atom_tag|dropped_count|
+    int64_t composed_long = tag;
+    // Send 2 int32's via an int64.
+    composed_long = ((composed_long << 32) | ((int64_t)count));
+    buffer.payload.data = composed_long;
+
+    struct iovec vec[2];
+    vec[0].iov_base = (unsigned char*)header;
+    vec[0].iov_len = sizeof(*header);
+    vec[1].iov_base = &buffer;
+    vec[1].iov_len = sizeof(buffer);
+
+    ssize_t ret = TEMP_FAILURE_RETRY(writev(sock, vec, 2));
+    return ret == (ssize_t)(sizeof(*header) + sizeof(buffer));
+}
+
+// If we dropped events before, try to tell statsd: one report per atom of drop_table, and one
+// for the other drops.
+static void statsdWriteDropped(int sock, android_log_header_t* header) {
+    if (!atomic_exchange_explicit(&drops_pending, 0, memory_order_acquire)) {
+        return;
+    }
+    bool failed = false;
+    for (int i = 0; i < DROP_TABLE_SIZE && !failed; i++) {
+        unsigned long long slot = atomic_exchange_explicit(&drop_table[i], 0,
+                                                           memory_order_relaxed);
+        if (slot == 0) {
+            continue;
+        }
+        const int32_t tag = (int32_t)(slot >> 32);
+        const int32_t count = (int32_t)(slot & 0xffffffffULL);
+        if (!statsdWriteDropReport(sock, header, tag, count)) {
+            // Counted again, in the table if there is still room.
+            if (!noteDropsInTable(tag, count)) {
+                atomic_fetch_add_explicit(&dropped, count, memory_order_relaxed);
+            }
+            failed = true;
+        }
+    }
+    int32_t snapshot = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+    if (snapshot) {
+        if (failed || !statsdWriteDropReport(sock, header, /*tag=*/0, snapshot)) {
+            atomic_fetch_add_explicit(&dropped, snapshot, memory_order_relaxed);
+            failed = true;
+        }
+    }
+    if (failed) {
+        atomic_store_explicit(&drops_pending, 1, memory_order_release);
+    }
+}
+
 static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr) {
     ssize_t ret;
     int sock;
@@ -221,28 +361,7 @@ static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr) {
 
     // If we dropped events before, try to tell statsd.
     if (sock >= 0) {
-        int32_t snapshot = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
-        if (snapshot) {
-            android_log_event_long_t buffer;
-            header.id = LOG_ID_STATS;
-            // store the last log error in the tag field. This tag field is not used by statsd.
-            buffer.header.tag = atomic_load(&log_error);
-            buffer.payload.type = EVENT_TYPE_LONG;
-            // format:
-            // |atom_tag|dropped_count|
-            int64_t composed_long = atomic_load(&atom_tag);
-            // Send 2 int32's via an int64.
-            composed_long = ((composed_long << 32) | ((int64_t)snapshot));
-            buffer.payload.data = composed_long;
-
-            newVec[headerLength].iov_base = &buffer;
-            newVec[headerLength].iov_len = sizeof(buffer);
-
-            ret = TEMP_FAILURE_RETRY(writev(sock, newVec, 2));
-            if (ret != (ssize_t)(sizeof(header) + sizeof(buffer))) {
-                atomic_fetch_add_explicit(&dropped, snapshot, memory_order_relaxed);
-            }
-        }
+        statsdWriteDropped(sock, &header);
     }
 
     header.id = LOG_ID_STATS;
@@ -307,3 +426,227 @@ static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr) {
 
     return ret;
 }
+
+/*
+ * Batching. The atoms are copied to a bounded lock-free queue, so that writers never block, and
+ * sent together with sendmmsg(), each still in its own datagram. Each slot has a sequence number:
+ * a writer may fill the slot of position pos when it is pos, and the flusher may send it when it
+ * is pos + 1, after which it becomes pos + BATCH_SLOT_COUNT.
+ */
+#define BATCH_SLOT_COUNT 64
+#define BATCH_FLUSH_THRESHOLD (BATCH_SLOT_COUNT / 2)
+#define BATCH_MAX_PAYLOAD 1024
+
+struct batch_slot {
+    atomic_size_t seq;
+    android_log_header_t header;
+    uint32_t atomId;
+    size_t size;
+    uint8_t payload[BATCH_MAX_PAYLOAD];
+};
+
+// Allocated when batching is first enabled, and kept for the lifetime of the process.
+static _Atomic(struct batch_slot*) batch_slots = NULL;
+static atomic_size_t batch_tail = 0;
+static atomic_size_t batch_head = 0;
+// Held by the only flusher allowed at a time, which owns batch_head.
+static atomic_flag batch_flushing = ATOMIC_FLAG_INIT;
+// Longest time an atom stays in the queue, or 0 if batching is disabled.
+static atomic_uint batch_delay_ms = 0;
+static atomic_bool batch_thread_running = false;
+
+// Sends [msgs], reconnecting once if statsd restarted. Returns the number of messages sent and
+// sets [error] to -errno if some were not.
+static unsigned statsdSendBatch(struct mmsghdr* msgs, unsigned count, int* error) {
+    unsigned sent = 0;
+    bool reconnected = false;
+    while (sent < count) {
+        int sock = atomic_load(&statsdLoggerWrite.sock);
+        int ret = sock;
+        if (sock >= 0) {
+            ret = TEMP_FAILURE_RETRY(sendmmsg(sock, msgs + sent, count - sent, 0));
+            if (ret > 0) {
+                sent += ret;
+                continue;
+            }
+            ret = ret < 0 ? -errno : -EAGAIN;
+        }
+        *error = ret;
+        switch (ret) {
+            case -ENOTCONN:
+            case -ECONNREFUSED:
+            case -ENOENT:
+                if (reconnected || statd_writer_trylock()) {
+                    return sent;
+                }
+                reconnected = true;
+                __statsdClose(ret);
+                ret = statsdOpen();
+                statsd_writer_init_unlock();
+                if (ret < 0) {
+                    *error = ret;
+                    return sent;
+                }
+                break;
+            default:
+                return sent;
+        }
+    }
+    return sent;
+}
+
+void statsd_writer_flush() {
+    struct batch_slot* slots = atomic_load(&batch_slots);
+    if (slots == NULL || atomic_flag_test_and_set(&batch_flushing)) {
+        return;
+    }
+    struct mmsghdr msgs[BATCH_SLOT_COUNT];
+    struct iovec vecs[BATCH_SLOT_COUNT][2];
+    const size_t head = atomic_load_explicit(&batch_head, memory_order_relaxed);
+    unsigned count = 0;
+    // Stops at the first slot still being written, which is sent by a later flush.
+    while (count < BATCH_SLOT_COUNT) {
+        struct batch_slot* slot = &slots[(head + count) % BATCH_SLOT_COUNT];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != head + count + 1) {
+            break;
+        }
+        vecs[count][0].iov_base = &slot->header;
+        vecs[count][0].iov_len = sizeof(slot->header);
+        vecs[count][1].iov_base = slot->payload;
+        vecs[count][1].iov_len = slot->size;
+        memset(&msgs[count], 0, sizeof(msgs[count]));
+        msgs[count].msg_hdr.msg_iov = vecs[count];
+        msgs[count].msg_hdr.msg_iovlen = 2;
+        count++;
+    }
+    if (count > 0) {
+        int sock = atomic_load(&statsdLoggerWrite.sock);
+        if (sock >= 0) {
+            statsdWriteDropped(sock, &slots[head % BATCH_SLOT_COUNT].header);
+        }
+        int error = 0;
+        const unsigned sent = statsdSendBatch(msgs, count, &error);
+        for (unsigned i = 0; i < count; i++) {
+            struct batch_slot* slot = &slots[(head + i) % BATCH_SLOT_COUNT];
+            if (i >= sent) {
+                statsdNoteDrop(error, slot->atomId);
+            }
+            atomic_store_explicit(&slot->seq, head + i + BATCH_SLOT_COUNT, memory_order_release);
+        }
+        atomic_store_explicit(&batch_head, head + count, memory_order_relaxed);
+    }
+    atomic_flag_clear(&batch_flushing);
+}
+
+int statsd_writer_batch(struct iovec* vec, size_t nr, uint32_t atomId) {
+    struct batch_slot* slots = atomic_load(&batch_slots);
+    if (slots == NULL || atomic_load_explicit(&batch_delay_ms, memory_order_relaxed) == 0) {
+        return -EAGAIN;
+    }
+    size_t size = 0;
+    for (size_t i = 0; i < nr; i++) {
+        size += vec[i].iov_len;
+    }
+    if (size > BATCH_MAX_PAYLOAD) {
+        // Sends the queued atoms first, so that the atoms mostly arrive in order.
+        statsd_writer_flush();
+        return -EAGAIN;
+    }
+
+    size_t pos = atomic_load_explicit(&batch_tail, memory_order_relaxed);
+    struct batch_slot* slot;
+    for (;;) {
+        slot = &slots[pos % BATCH_SLOT_COUNT];
+        const size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&batch_tail, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The queue is full.
+            statsd_writer_flush();
+            return -EAGAIN;
+        } else {
+            pos = atomic_load_explicit(&batch_tail, memory_order_relaxed);
+        }
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    slot->header.id = LOG_ID_STATS;
+    slot->header.tid = gettid();
+    slot->header.realtime.tv_sec = ts.tv_sec;
+    slot->header.realtime.tv_nsec = ts.tv_nsec;
+    slot->atomId = atomId;
+    slot->size = 0;
+    for (size_t i = 0; i < nr; i++) {
+        memcpy(slot->payload + slot->size, vec[i].iov_base, vec[i].iov_len);
+        slot->size += vec[i].iov_len;
+    }
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    if (pos + 1 - atomic_load_explicit(&batch_head, memory_order_relaxed) >=
+        BATCH_FLUSH_THRESHOLD) {
+        statsd_writer_flush();
+    }
+    return size;
+}
+
+static void* batch_thread_main(void* arg) {
+    (void)arg;
+    for (;;) {
+        const unsigned delayMs = atomic_load(&batch_delay_ms);
+        if (delayMs == 0) {
+            atomic_store(&batch_thread_running, false);
+            // Keeps running if batching was enabled again meanwhile.
+            bool expected = false;
+            if (atomic_load(&batch_delay_ms) == 0 ||
+                !atomic_compare_exchange_strong(&batch_thread_running, &expected, true)) {
+                return NULL;
+            }
+            continue;
+        }
+        struct timespec delay;
+        delay.tv_sec = delayMs / 1000;
+        delay.tv_nsec = (long)(delayMs % 1000) * 1000000;
+        nanosleep(&delay, NULL);
+        statsd_writer_flush();
+    }
+}
+
+int statsd_writer_set_batching(uint32_t maxDelayMillis) {
+    if (maxDelayMillis == 0) {
+        atomic_store(&batch_delay_ms, 0);
+        statsd_writer_flush();
+        return 0;
+    }
+    if (atomic_load(&batch_slots) == NULL) {
+        struct batch_slot* slots = malloc(BATCH_SLOT_COUNT * sizeof(struct batch_slot));
+        if (slots == NULL) {
+            return -ENOMEM;
+        }
+        for (size_t i = 0; i < BATCH_SLOT_COUNT; i++) {
+            atomic_init(&slots[i].seq, i);
+        }
+        struct batch_slot* expected = NULL;
+        if (!atomic_compare_exchange_strong(&batch_slots, &expected, slots)) {
+            free(slots);
+        }
+    }
+    atomic_store(&batch_delay_ms, maxDelayMillis);
+    bool expected = false;
+    if (atomic_compare_exchange_strong(&batch_thread_running, &expected, true)) {
+        pthread_t thread;
+        int ret = pthread_create(&thread, NULL, batch_thread_main, NULL);
+        if (ret != 0) {
+            atomic_store(&batch_thread_running, false);
+            atomic_store(&batch_delay_ms, 0);
+            return -ret;
+        }
+        pthread_detach(thread);
+    }
+    return 0;
+}
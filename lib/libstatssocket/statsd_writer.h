@@ -19,7 +19,10 @@
 
 #include <pthread.h>
 #include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 /**
  * Internal lock should not be exposed. This is bad design.
@@ -30,6 +33,29 @@ void statsd_writer_init_lock();
 int statsd_writer_init_trylock();
 void statsd_writer_init_unlock();
 
+/**
+ * Sets the path of the socket the next connection goes to, or restores the statsd socket if
+ * [path] is NULL. Returns 0 or -ENAMETOOLONG.
+ */
+int statsd_writer_set_socket_path(const char* path);
+
+/**
+ * Batching of the writes, see AStatsSocket_setBatching(). Enabling it allocates the queue and
+ * starts the thread flushing it. Returns 0 or -errno.
+ */
+int statsd_writer_set_batching(uint32_t maxDelayMillis);
+
+/**
+ * Queues the atom in [vec] if batching is enabled. Returns its size, or -EAGAIN if it must be
+ * written directly: batching is disabled, the atom is too large or the queue is full.
+ */
+int statsd_writer_batch(struct iovec* vec, size_t nr, uint32_t atomId);
+
+/**
+ * Sends the queued atoms, unless another thread is already doing it.
+ */
+void statsd_writer_flush();
+
 struct android_log_transport_write {
     const char* name; /* human name to describe the transport */
     atomic_int sock;
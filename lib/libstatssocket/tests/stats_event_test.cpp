@@ -46,6 +46,7 @@
 #define OBJECT_TYPE 0x07
 #define KEY_VALUE_PAIRS_TYPE 0x08
 #define ATTRIBUTION_CHAIN_TYPE 0x09
+#define PACKED_LIST_TYPE 0x0A
 #define ERROR_TYPE 0x0F
 
 using std::string;
@@ -332,6 +333,48 @@ TEST(StatsEventTest, TestAllArrays) {
     AStatsEvent_release(event);
 }
 
+TEST(StatsEventTest, TestPackedArrays) {
+    uint32_t atomId = 100;
+
+    int32_t int32Array[4] = {0, -1, 64, INT32_MIN};
+    int64_t int64Array[2] = {1, INT64_MAX};
+
+    int64_t startTime = android::elapsedRealtimeNano();
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, atomId);
+    AStatsEvent_writePackedInt32Array(event, int32Array, 4);
+    AStatsEvent_writePackedInt64Array(event, int64Array, 2);
+    AStatsEvent_build(event);
+    int64_t endTime = android::elapsedRealtimeNano();
+
+    size_t bufferSize;
+    uint8_t* buffer = AStatsEvent_getBuffer(event, &bufferSize);
+    uint8_t* bufferEnd = buffer + bufferSize;
+
+    checkMetadata(&buffer, /*numTopLevelElements=*/2, startTime, endTime, atomId);
+
+    // Zigzag maps 0, -1, 64 and INT32_MIN to 0, 1, 128 and 2^32 - 1.
+    checkTypeHeader(&buffer, PACKED_LIST_TYPE);
+    EXPECT_EQ(readNext<uint8_t>(&buffer), 4);
+    checkTypeHeader(&buffer, INT32_TYPE);
+    vector<uint8_t> expectedInt32s = {0x00, 0x01, 0x80, 0x01, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F};
+    EXPECT_EQ(vector<uint8_t>(buffer, buffer + expectedInt32s.size()), expectedInt32s);
+    buffer += expectedInt32s.size();
+
+    // Zigzag maps 1 and INT64_MAX to 2 and 2^64 - 2.
+    checkTypeHeader(&buffer, PACKED_LIST_TYPE);
+    EXPECT_EQ(readNext<uint8_t>(&buffer), 2);
+    checkTypeHeader(&buffer, INT64_TYPE);
+    vector<uint8_t> expectedInt64s = {0x02, 0xFE, 0xFF, 0xFF, 0xFF, 0xFF,
+                                      0xFF, 0xFF, 0xFF, 0xFF, 0x01};
+    EXPECT_EQ(vector<uint8_t>(buffer, buffer + expectedInt64s.size()), expectedInt64s);
+    buffer += expectedInt64s.size();
+
+    EXPECT_EQ(buffer, bufferEnd);  // ensure that we have read the entire buffer
+    EXPECT_EQ(AStatsEvent_getErrors(event), 0);
+    AStatsEvent_release(event);
+}
+
 TEST(StatsEventTest, TestAttributionChains) {
     uint32_t atomId = 100;
 
@@ -664,3 +707,85 @@ TEST(StatsEventTest, TestListTooLongError) {
     uint32_t errors = AStatsEvent_getErrors(event);
     EXPECT_EQ(errors & ERROR_LIST_TOO_LONG, ERROR_LIST_TOO_LONG);
 }
+
+TEST(StatsEventTest, TestReleasedEventIsReused) {
+    uint32_t atomId = 100;
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, atomId);
+    AStatsEvent_writeInt32(event, 5);
+    AStatsEvent_writeString(event, "test");
+    AStatsEvent_build(event);
+    AStatsEvent_release(event);
+
+    // The next event of the thread reuses the released one, without its fields.
+    int64_t startTime = android::elapsedRealtimeNano();
+    AStatsEvent* reusedEvent = AStatsEvent_obtain();
+    EXPECT_EQ(event, reusedEvent);
+    AStatsEvent_setAtomId(reusedEvent, atomId);
+    AStatsEvent_writeBool(reusedEvent, true);
+    AStatsEvent_build(reusedEvent);
+    int64_t endTime = android::elapsedRealtimeNano();
+
+    size_t bufferSize;
+    uint8_t* buffer = AStatsEvent_getBuffer(reusedEvent, &bufferSize);
+    uint8_t* bufferEnd = buffer + bufferSize;
+
+    checkMetadata(&buffer, /*numElements=*/1, startTime, endTime, atomId);
+    checkTypeHeader(&buffer, BOOL_TYPE);
+    checkScalar(&buffer, true);
+
+    EXPECT_EQ(buffer, bufferEnd);
+    EXPECT_EQ(AStatsEvent_getErrors(reusedEvent), 0);
+
+    // Only one event is kept per thread.
+    AStatsEvent* otherEvent = AStatsEvent_obtain();
+    EXPECT_NE(reusedEvent, otherEvent);
+    AStatsEvent_release(otherEvent);
+    AStatsEvent_release(reusedEvent);
+}
+
+TEST(StatsEventTest, TestEventInBuffer) {
+    uint32_t atomId = 100;
+    uint8_t storage[ASTATSEVENT_STORAGE_SIZE(ASTATSEVENT_INT32_FIELD_SIZE +
+                                             ASTATSEVENT_BOOL_FIELD_SIZE)];
+    int64_t startTime = android::elapsedRealtimeNano();
+    AStatsEvent* event = AStatsEvent_initInBuffer(storage, sizeof(storage));
+    ASSERT_NE(event, nullptr);
+    AStatsEvent_setAtomId(event, atomId);
+    AStatsEvent_writeInt32(event, 5);
+    AStatsEvent_writeBool(event, true);
+    AStatsEvent_build(event);
+    int64_t endTime = android::elapsedRealtimeNano();
+
+    size_t bufferSize;
+    uint8_t* buffer = AStatsEvent_getBuffer(event, &bufferSize);
+    uint8_t* bufferEnd = buffer + bufferSize;
+    EXPECT_GE(buffer, storage);
+    EXPECT_LE(bufferEnd, storage + sizeof(storage));
+
+    checkMetadata(&buffer, /*numElements=*/2, startTime, endTime, atomId);
+    checkTypeHeader(&buffer, INT32_TYPE);
+    checkScalar(&buffer, (int32_t)5);
+    checkTypeHeader(&buffer, BOOL_TYPE);
+    checkScalar(&buffer, true);
+
+    EXPECT_EQ(buffer, bufferEnd);
+    EXPECT_EQ(AStatsEvent_getErrors(event), 0);
+    AStatsEvent_release(event);
+}
+
+TEST(StatsEventTest, TestEventInBufferOverflowError) {
+    uint8_t storage[ASTATSEVENT_STORAGE_SIZE(ASTATSEVENT_INT32_FIELD_SIZE)];
+    AStatsEvent* event = AStatsEvent_initInBuffer(storage, sizeof(storage));
+    ASSERT_NE(event, nullptr);
+    AStatsEvent_setAtomId(event, 100);
+    AStatsEvent_writeInt32(event, 5);
+    // The storage doesn't grow for the extra field.
+    AStatsEvent_writeInt64(event, 6);
+    AStatsEvent_build(event);
+
+    EXPECT_EQ(AStatsEvent_getErrors(event) & ERROR_OVERFLOW, ERROR_OVERFLOW);
+    AStatsEvent_release(event);
+
+    EXPECT_EQ(AStatsEvent_initInBuffer(storage, sizeof(storage) - 1), nullptr);
+}
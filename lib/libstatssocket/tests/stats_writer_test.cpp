@@ -15,6 +15,14 @@
  */
 
 #include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <string>
+
 #include "stats_buffer_writer.h"
 #include "stats_event.h"
 #include "stats_socket.h"
@@ -34,3 +42,56 @@ TEST(StatsWriterTest, TestSocketClose) {
 
     EXPECT_TRUE(stats_log_is_closed());
 }
+
+TEST(StatsWriterTest, TestSocketPath) {
+    const char* tmpDir = getenv("TMPDIR");
+    std::string dir = std::string(tmpDir != nullptr ? tmpDir : "/data/local/tmp") +
+                      "/stats_writer_test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(dir.data()));
+    const std::string socketPath = dir + "/socket";
+
+    int sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    ASSERT_GE(sock, 0);
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strcpy(addr.sun_path, socketPath.c_str());
+    ASSERT_EQ(0, bind(sock, (struct sockaddr*)&addr, sizeof(addr)));
+
+    ASSERT_EQ(0, stats_log_set_socket_path(socketPath.c_str()));
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, 100);
+    AStatsEvent_writeInt32(event, 5);
+    const int bytes = AStatsEvent_write(event);
+    AStatsEvent_release(event);
+    EXPECT_GT(bytes, 0);
+
+    // The datagram also has the header of the log entry.
+    char buffer[1024];
+    EXPECT_GT(recv(sock, buffer, sizeof(buffer), 0), bytes);
+
+    EXPECT_EQ(0, stats_log_set_socket_path(nullptr));
+    close(sock);
+    unlink(socketPath.c_str());
+    rmdir(dir.c_str());
+}
+
+TEST(StatsWriterTest, TestBatchedWrites) {
+    ASSERT_EQ(AStatsSocket_setBatching(/*maxDelayMillis=*/1000), 0);
+
+    // Batched writes also return the number of bytes, as they are only sent later.
+    for (int i = 0; i < 100; i++) {
+        AStatsEvent* event = AStatsEvent_obtain();
+        AStatsEvent_setAtomId(event, 100);
+        AStatsEvent_writeInt32(event, i);
+        EXPECT_GT(AStatsEvent_write(event), 0);
+        AStatsEvent_release(event);
+    }
+    AStatsSocket_flush();
+    EXPECT_FALSE(stats_log_is_closed());
+
+    EXPECT_EQ(AStatsSocket_setBatching(/*maxDelayMillis=*/0), 0);
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, 100);
+    AStatsEvent_writeInt32(event, 5);
+    EXPECT_GT(AStatsEvent_write(event), 0);
+    AStatsEvent_release(event);
+}
@@ -23,6 +23,7 @@ import android.app.AlarmManager;
 import android.app.AlarmManager.OnAlarmListener;
 import android.app.StatsManager;
 import android.content.BroadcastReceiver;
+import android.content.ComponentCallbacks2;
 import android.content.ComponentName;
 import android.content.Context;
 import android.content.Intent;
@@ -33,6 +34,7 @@ import android.content.pm.PackageManager;
 import android.content.pm.ResolveInfo;
 import android.content.pm.Signature;
 import android.content.pm.SigningInfo;
+import android.content.res.Configuration;
 import android.os.Binder;
 import android.os.Bundle;
 import android.os.FileUtils;
@@ -136,6 +138,7 @@ public class StatsCompanionService extends IStatsCompanionService.Stub {
 
         mPullingAlarmListener = new PullingAlarmListener(context);
         mPeriodicAlarmListener = new PeriodicAlarmListener(context);
+        mContext.registerComponentCallbacks(new MemoryPressureCallbacks());
     }
 
     /**
@@ -503,6 +506,36 @@ public class StatsCompanionService extends IStatsCompanionService.Stub {
         }
     }
 
+    private static final class MemoryPressureCallbacks implements ComponentCallbacks2 {
+        @Override
+        public void onTrimMemory(int level) {
+            if (level >= TRIM_MEMORY_RUNNING_LOW) {
+                informMemoryPressure();
+            }
+        }
+
+        @Override
+        public void onLowMemory() {
+            informMemoryPressure();
+        }
+
+        @Override
+        public void onConfigurationChanged(Configuration newConfig) {}
+
+        private static void informMemoryPressure() {
+            IStatsd statsd = getStatsdNonblocking();
+            if (statsd == null) {
+                Log.w(TAG, "Could not access statsd to inform it of memory pressure.");
+                return;
+            }
+            try {
+                statsd.informMemoryPressure();
+            } catch (RemoteException e) {
+                Log.w(TAG, "Failed to inform statsd of memory pressure.", e);
+            }
+        }
+    }
+
     @Override // Binder call
     // Unused, but keep the IPC due to the bootstrap apex issue on R.
     public void setAnomalyAlarm(long timestampMs) {}
@@ -27,6 +27,7 @@ import android.os.Binder;
 import android.os.IPullAtomCallback;
 import android.os.IStatsManagerService;
 import android.os.IStatsd;
+import android.os.ParcelFileDescriptor;
 import android.os.PowerManager;
 import android.os.Process;
 import android.os.RemoteException;
@@ -35,8 +36,11 @@ import android.util.Log;
 
 import com.android.internal.annotations.GuardedBy;
 
+import java.io.IOException;
 import java.util.Map;
 import java.util.Objects;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ExecutionException;
 
 /**
  * Service for {@link android.app.StatsManager}.
@@ -410,6 +414,35 @@ public class StatsManagerService extends IStatsManagerService.Stub {
         throw new IllegalStateException("Failed to connect to statsd to getMetadata");
     }
 
+    /**
+     * Reads the data of the config from a pipe, so that statsd can stream it and its size is not
+     * bound by the binder buffer. getDataFd() returns once the data is written, so the pipe is
+     * read by another thread meanwhile.
+     */
+    private static byte[] getDataThroughPipe(IStatsd statsd, long key, int callingUid)
+            throws RemoteException, IOException {
+        ParcelFileDescriptor[] pipe = ParcelFileDescriptor.createPipe();
+        CompletableFuture<byte[]> data = new CompletableFuture<>();
+        Thread reader = new Thread(() -> {
+            try (ParcelFileDescriptor.AutoCloseInputStream input =
+                    new ParcelFileDescriptor.AutoCloseInputStream(pipe[0])) {
+                data.complete(input.readAllBytes());
+            } catch (IOException e) {
+                data.completeExceptionally(e);
+            }
+        }, TAG + ".getData");
+        reader.start();
+        // Closing the write end ends the data for the reader, even if the call failed.
+        try (ParcelFileDescriptor writeEnd = pipe[1]) {
+            statsd.getDataFd(key, callingUid, writeEnd);
+        }
+        try {
+            return data.get();
+        } catch (InterruptedException | ExecutionException e) {
+            throw new IOException("Failed to read the data of statsd", e);
+        }
+    }
+
     @Override
     public byte[] getData(long key, String packageName) throws IllegalStateException {
         enforceDumpAndUsageStatsPermission(packageName);
@@ -423,9 +456,9 @@ public class StatsManagerService extends IStatsManagerService.Stub {
         try {
             IStatsd statsd = waitForStatsd();
             if (statsd != null) {
-                return statsd.getData(key, callingUid);
+                return getDataThroughPipe(statsd, key, callingUid);
             }
-        } catch (RemoteException e) {
+        } catch (RemoteException | IOException e) {
             Log.e(TAG, "Failed to getData with statsd");
             throw new IllegalStateException(e.getMessage(), e);
         } finally {
@@ -0,0 +1,515 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "metric_util.h"
+#include "src/anomaly/AlarmMonitor.h"
+#include "src/external/StatsPullerManager.h"
+#include "src/metrics/parsing_utils/config_update_utils.h"
+#include "src/metrics/parsing_utils/metrics_manager_util.h"
+#include "src/packages/UidMap.h"
+
+// Counts the allocations made while sCountAllocations is set, to report the allocations of each
+// phase of the config loads and updates.
+static std::atomic<bool> sCountAllocations(false);
+static std::atomic<int64_t> sAllocationCount(0);
+static std::atomic<int64_t> sAllocatedBytes(0);
+
+void* operator new(size_t size) {
+    if (sCountAllocations.load(std::memory_order_relaxed)) {
+        sAllocationCount.fetch_add(1, std::memory_order_relaxed);
+        sAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    void* ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+        abort();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::map;
+using std::pair;
+using std::set;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+static const ConfigKey kConfigKey(/*uid=*/0, StringToId("ConfigLoadBenchmark"));
+
+static const int64_t kTimeBaseNs = 1000 * NS_PER_SEC;
+
+static const int64_t kUpdateTimeNs = kTimeBaseNs + 600 * NS_PER_SEC;
+
+// The matchers are spread over these atoms, 2 consecutive matchers on each atom.
+static const int kFirstAtomId = 100000;
+static const int kNumAtoms = 100;
+
+static int MatcherAtomId(int matcherIndex) {
+    return kFirstAtomId + (matcherIndex / 2) % kNumAtoms;
+}
+
+static int64_t MatcherId(int matcherIndex) {
+    return StringToId("Matcher" + std::to_string(matcherIndex));
+}
+
+static int64_t PredicateId(int predicateIndex) {
+    return StringToId("Predicate" + std::to_string(predicateIndex));
+}
+
+static int64_t MetricId(int metricIndex) {
+    return StringToId("Metric" + std::to_string(metricIndex));
+}
+
+static int NumPredicates(int numMetrics) {
+    return std::max(1, numMetrics / 10);
+}
+
+// Stays within StatsdStats::kMaxAlertCountPerConfig.
+static int NumAlerts(int numMetrics) {
+    return std::min(numMetrics / 4, 200);
+}
+
+// A config with [numMetrics] matchers, each one matching a value of field 3 of its atom, and
+// [numMetrics] metrics sliced by field 1: count metrics, a half of them with a condition,
+// duration metrics, value metrics and gauge metrics in turn. The predicates start and stop on
+// consecutive matchers, and there is an alert on each of the first count metrics.
+static StatsdConfig CreateLargeConfig(int numMetrics) {
+    StatsdConfig config;
+    config.set_id(kConfigKey.GetId());
+    // The events of metric_util are logged by root.
+    config.add_allowed_log_source("AID_ROOT");
+    for (int i = 0; i < numMetrics; i++) {
+        AtomMatcher* matcher = config.add_atom_matcher();
+        matcher->set_id(MatcherId(i));
+        SimpleAtomMatcher* simpleMatcher = matcher->mutable_simple_atom_matcher();
+        simpleMatcher->set_atom_id(MatcherAtomId(i));
+        FieldValueMatcher* fieldValueMatcher = simpleMatcher->add_field_value_matcher();
+        fieldValueMatcher->set_field(3);
+        fieldValueMatcher->set_eq_int(i);
+    }
+    const int numPredicates = NumPredicates(numMetrics);
+    for (int i = 0; i < numPredicates; i++) {
+        Predicate* predicate = config.add_predicate();
+        predicate->set_id(PredicateId(i));
+        SimplePredicate* simplePredicate = predicate->mutable_simple_predicate();
+        simplePredicate->set_start(MatcherId(2 * i));
+        simplePredicate->set_stop(MatcherId(2 * i + 1));
+        *simplePredicate->mutable_dimensions() = CreateDimensions(MatcherAtomId(2 * i), {1});
+    }
+    for (int i = 0; i < numMetrics; i++) {
+        const FieldMatcher dimensions = CreateDimensions(MatcherAtomId(i), {1});
+        const int predicateIndex = (i / 4) % numPredicates;
+        switch (i % 4) {
+            case 0: {
+                CountMetric* metric = config.add_count_metric();
+                metric->set_id(MetricId(i));
+                metric->set_what(MatcherId(i));
+                if ((i / 4) % 2 == 1) {
+                    metric->set_condition(PredicateId(predicateIndex));
+                }
+                metric->set_bucket(ONE_HOUR);
+                *metric->mutable_dimensions_in_what() = dimensions;
+                break;
+            }
+            case 1: {
+                DurationMetric* metric = config.add_duration_metric();
+                metric->set_id(MetricId(i));
+                metric->set_what(PredicateId(predicateIndex));
+                metric->set_aggregation_type(DurationMetric::SUM);
+                metric->set_bucket(ONE_HOUR);
+                *metric->mutable_dimensions_in_what() =
+                        CreateDimensions(MatcherAtomId(2 * predicateIndex), {1});
+                break;
+            }
+            case 2: {
+                ValueMetric* metric = config.add_value_metric();
+                metric->set_id(MetricId(i));
+                metric->set_what(MatcherId(i));
+                metric->set_bucket(ONE_HOUR);
+                *metric->mutable_value_field() = CreateDimensions(MatcherAtomId(i), {2});
+                *metric->mutable_dimensions_in_what() = dimensions;
+                break;
+            }
+            case 3: {
+                GaugeMetric* metric = config.add_gauge_metric();
+                metric->set_id(MetricId(i));
+                metric->set_what(MatcherId(i));
+                metric->set_bucket(ONE_HOUR);
+                metric->set_sampling_type(GaugeMetric::FIRST_N_SAMPLES);
+                metric->mutable_gauge_fields_filter()->set_include_all(true);
+                *metric->mutable_dimensions_in_what() = dimensions;
+                break;
+            }
+        }
+    }
+    const int numAlerts = NumAlerts(numMetrics);
+    for (int i = 0; i < numAlerts; i++) {
+        Alert* alert = config.add_alert();
+        alert->set_id(StringToId("Alert" + std::to_string(i)));
+        alert->set_metric_id(config.count_metric(i).id());
+        alert->set_num_buckets(1);
+        alert->set_refractory_period_secs(60);
+        alert->set_trigger_if_sum_gt(1000);
+    }
+    return config;
+}
+
+enum ConfigChange {
+    // The same config.
+    NO_CHANGE = 0,
+    // A tenth of the metrics, of each type, have a new bucket size, so they are replaced.
+    METRICS_CHANGED = 1,
+    // A tenth of the matchers match another value, so they are replaced with the predicates and
+    // metrics that use them.
+    MATCHERS_CHANGED = 2,
+};
+
+// Returns [config] with [change].
+static StatsdConfig ChangeConfig(StatsdConfig config, ConfigChange change) {
+    const int numMetrics = config.atom_matcher_size();
+    for (int j = 0; 10 * j < numMetrics; j++) {
+        // Cycles through the metric types, which alternate in the config.
+        const int i = std::min(10 * j + j % 4, numMetrics - 1);
+        if (change == METRICS_CHANGED) {
+            switch (i % 4) {
+                case 0:
+                    config.mutable_count_metric(i / 4)->set_bucket(ONE_DAY);
+                    break;
+                case 1:
+                    config.mutable_duration_metric(i / 4)->set_bucket(ONE_DAY);
+                    break;
+                case 2:
+                    config.mutable_value_metric(i / 4)->set_bucket(ONE_DAY);
+                    break;
+                case 3:
+                    config.mutable_gauge_metric(i / 4)->set_bucket(ONE_DAY);
+                    break;
+            }
+        } else if (change == MATCHERS_CHANGED) {
+            config.mutable_atom_matcher(i)
+                    ->mutable_simple_atom_matcher()
+                    ->mutable_field_value_matcher(0)
+                    ->set_eq_int(numMetrics + i);
+        }
+    }
+    return config;
+}
+
+// The outputs of initStatsdConfig() and updateStatsdConfig(), which MetricsManager keeps.
+struct ConfigState {
+    set<int> allTagIds;
+    vector<sp<AtomMatchingTracker>> atomMatchingTrackers;
+    unordered_map<int64_t, int> atomMatchingTrackerMap;
+    vector<sp<ConditionTracker>> conditionTrackers;
+    unordered_map<int64_t, int> conditionTrackerMap;
+    vector<sp<MetricProducer>> metricProducers;
+    unordered_map<int64_t, int> metricProducerMap;
+    vector<sp<AnomalyTracker>> anomalyTrackers;
+    unordered_map<int64_t, int> alertTrackerMap;
+    vector<sp<AlarmTracker>> periodicAlarmTrackers;
+    unordered_map<int, vector<int>> conditionToMetricMap;
+    unordered_map<int, vector<int>> trackerToMetricMap;
+    unordered_map<int, vector<int>> trackerToConditionMap;
+    unordered_map<int, vector<int>> activationAtomTrackerToMetricMap;
+    unordered_map<int, vector<int>> deactivationAtomTrackerToMetricMap;
+    vector<int> metricsWithActivation;
+    map<int64_t, uint64_t> stateProtoHashes;
+    set<int64_t> noReportMetricIds;
+};
+
+// The dependencies of the config loads, as StatsLogProcessor creates them.
+struct ConfigEnvironment {
+    sp<UidMap> uidMap = new UidMap();
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor = CreateAlarmMonitor();
+    sp<AlarmMonitor> periodicAlarmMonitor = CreateAlarmMonitor();
+
+    static sp<AlarmMonitor> CreateAlarmMonitor() {
+        return new AlarmMonitor(
+                /*minDiffToUpdateRegisteredAlarmTimeSec=*/0,
+                [](const shared_ptr<IStatsCompanionService>&, int64_t) {},
+                [](const shared_ptr<IStatsCompanionService>&) {});
+    }
+};
+
+// The wall time and allocations of a phase, summed over the benchmark iterations.
+struct PhaseCost {
+    string name;
+    int64_t ns = 0;
+    int64_t allocations = 0;
+    int64_t allocatedBytes = 0;
+};
+
+// Runs [phase], adding its wall time and allocations to [cost]. Returns the result of [phase].
+template <typename Phase>
+static bool MeasurePhase(PhaseCost& cost, Phase&& phase) {
+    const int64_t allocationsBefore = sAllocationCount.load();
+    const int64_t allocatedBytesBefore = sAllocatedBytes.load();
+    sCountAllocations = true;
+    const auto start = std::chrono::steady_clock::now();
+    const bool success = phase();
+    const auto end = std::chrono::steady_clock::now();
+    sCountAllocations = false;
+    cost.ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    cost.allocations += sAllocationCount.load() - allocationsBefore;
+    cost.allocatedBytes += sAllocatedBytes.load() - allocatedBytesBefore;
+    return success;
+}
+
+// Reports the average cost of each of [costs] per iteration, and sets the iteration time to
+// their total.
+static void ReportPhaseCosts(benchmark::State& state, const vector<PhaseCost>& costs,
+                             int64_t iterationNs) {
+    for (const PhaseCost& cost : costs) {
+        state.counters[cost.name + "_us"] =
+                benchmark::Counter(cost.ns / 1e3, benchmark::Counter::kAvgIterations);
+        state.counters[cost.name + "_allocs"] =
+                benchmark::Counter(cost.allocations, benchmark::Counter::kAvgIterations);
+        state.counters[cost.name + "_alloc_bytes"] =
+                benchmark::Counter(cost.allocatedBytes, benchmark::Counter::kAvgIterations);
+    }
+    state.SetIterationTime(iterationNs / 1e9);
+}
+
+static int64_t SumNs(const vector<PhaseCost>& costs) {
+    int64_t ns = 0;
+    for (const PhaseCost& cost : costs) {
+        ns += cost.ns;
+    }
+    return ns;
+}
+
+// Runs the phases of initStatsdConfig() on [config], adding their costs to [costs] if not null.
+static bool InitConfig(const ConfigEnvironment& env, const StatsdConfig& config,
+                       ConfigState& out, vector<PhaseCost>* costs) {
+    vector<PhaseCost> unused(6);
+    vector<PhaseCost>& phases = costs != nullptr ? *costs : unused;
+    vector<ConditionState> initialConditionCache;
+    unordered_map<int64_t, int> stateAtomIdMap;
+    unordered_map<int64_t, unordered_map<int, int64_t>> allStateGroupMaps;
+    return MeasurePhase(phases[0],
+                        [&] {
+                            return initAtomMatchingTrackers(config, env.uidMap,
+                                                            out.atomMatchingTrackerMap,
+                                                            out.atomMatchingTrackers,
+                                                            out.allTagIds);
+                        }) &&
+           MeasurePhase(phases[1],
+                        [&] {
+                            return initConditions(kConfigKey, config, out.atomMatchingTrackerMap,
+                                                  out.conditionTrackerMap, out.conditionTrackers,
+                                                  out.trackerToConditionMap,
+                                                  initialConditionCache);
+                        }) &&
+           MeasurePhase(phases[2],
+                        [&] {
+                            return initStates(config, stateAtomIdMap, allStateGroupMaps,
+                                              out.stateProtoHashes);
+                        }) &&
+           MeasurePhase(phases[3],
+                        [&] {
+                            return initMetrics(
+                                    kConfigKey, config, kTimeBaseNs, kTimeBaseNs,
+                                    env.pullerManager, out.atomMatchingTrackerMap,
+                                    out.conditionTrackerMap, out.atomMatchingTrackers,
+                                    stateAtomIdMap, allStateGroupMaps, out.conditionTrackers,
+                                    initialConditionCache, out.metricProducers,
+                                    out.conditionToMetricMap, out.trackerToMetricMap,
+                                    out.metricProducerMap, out.noReportMetricIds,
+                                    out.activationAtomTrackerToMetricMap,
+                                    out.deactivationAtomTrackerToMetricMap,
+                                    out.metricsWithActivation);
+                        }) &&
+           MeasurePhase(phases[4],
+                        [&] {
+                            return initAlerts(config, kTimeBaseNs, out.metricProducerMap,
+                                              out.alertTrackerMap, env.anomalyAlarmMonitor,
+                                              out.metricProducers, out.anomalyTrackers);
+                        }) &&
+           MeasurePhase(phases[5], [&] {
+               return initAlarms(config, kConfigKey, env.periodicAlarmMonitor, kTimeBaseNs,
+                                 kTimeBaseNs, out.periodicAlarmTrackers);
+           });
+}
+
+// Loads a config with state.range(0) metrics and matchers from scratch, phase by phase as
+// initStatsdConfig() does, and reports the wall time and allocations of each phase.
+static void BM_InitStatsdConfig(benchmark::State& state) {
+    const StatsdConfig config = CreateLargeConfig(state.range(0));
+    const ConfigEnvironment env;
+    vector<PhaseCost> costs = {{"matchers"}, {"conditions"}, {"states"},
+                               {"metrics"},  {"alerts"},     {"alarms"}};
+    for (auto _ : state) {
+        ConfigState out;
+        const int64_t nsBefore = SumNs(costs);
+        if (!InitConfig(env, config, out, &costs)) {
+            state.SkipWithError("initStatsdConfig failed");
+            return;
+        }
+        ReportPhaseCosts(state, costs, SumNs(costs) - nsBefore);
+    }
+}
+BENCHMARK(BM_InitStatsdConfig)->Arg(100)->Arg(500)->Arg(2000)->UseManualTime();
+
+// Updates a loaded config with state.range(0) metrics and matchers to the same config with
+// the ConfigChange state.range(1), phase by phase as updateStatsdConfig() does, and reports the
+// wall time and allocations of each phase and the share of the metrics that were preserved.
+static void BM_UpdateStatsdConfig(benchmark::State& state) {
+    const StatsdConfig config = CreateLargeConfig(state.range(0));
+    const StatsdConfig newConfig = ChangeConfig(config, static_cast<ConfigChange>(state.range(1)));
+    const ConfigEnvironment env;
+    vector<PhaseCost> costs = {{"matchers"}, {"conditions"}, {"states"},
+                               {"metrics"},  {"alerts"},     {"alarms"}};
+    double preservedMetrics = 0;
+    for (auto _ : state) {
+        ConfigState old;
+        if (!InitConfig(env, config, old, nullptr)) {
+            state.SkipWithError("initStatsdConfig failed");
+            return;
+        }
+        ConfigState out;
+        set<int64_t> replacedMatchers;
+        set<int64_t> replacedConditions;
+        set<int64_t> replacedStates;
+        set<int64_t> replacedMetrics;
+        vector<ConditionState> conditionCache;
+        unordered_map<int64_t, int> stateAtomIdMap;
+        unordered_map<int64_t, unordered_map<int, int64_t>> allStateGroupMaps;
+        const int64_t nsBefore = SumNs(costs);
+        const bool success =
+                MeasurePhase(costs[0],
+                             [&] {
+                                 return updateAtomMatchingTrackers(
+                                         newConfig, env.uidMap, old.atomMatchingTrackerMap,
+                                         old.atomMatchingTrackers, out.allTagIds,
+                                         out.atomMatchingTrackerMap, out.atomMatchingTrackers,
+                                         replacedMatchers);
+                             }) &&
+                MeasurePhase(costs[1],
+                             [&] {
+                                 return updateConditions(
+                                         kConfigKey, newConfig, out.atomMatchingTrackerMap,
+                                         replacedMatchers, old.conditionTrackerMap,
+                                         old.conditionTrackers, out.conditionTrackerMap,
+                                         out.conditionTrackers, out.trackerToConditionMap,
+                                         conditionCache, replacedConditions);
+                             }) &&
+                MeasurePhase(costs[2],
+                             [&] {
+                                 return updateStates(newConfig, old.stateProtoHashes,
+                                                     stateAtomIdMap, allStateGroupMaps,
+                                                     out.stateProtoHashes, replacedStates);
+                             }) &&
+                MeasurePhase(costs[3],
+                             [&] {
+                                 return updateMetrics(
+                                         kConfigKey, newConfig, kTimeBaseNs, kUpdateTimeNs,
+                                         env.pullerManager, old.atomMatchingTrackerMap,
+                                         out.atomMatchingTrackerMap, replacedMatchers,
+                                         out.atomMatchingTrackers, out.conditionTrackerMap,
+                                         replacedConditions, out.conditionTrackers,
+                                         conditionCache, stateAtomIdMap, allStateGroupMaps,
+                                         replacedStates, old.metricProducerMap,
+                                         old.metricProducers, out.metricProducerMap,
+                                         out.metricProducers, out.conditionToMetricMap,
+                                         out.trackerToMetricMap, out.noReportMetricIds,
+                                         out.activationAtomTrackerToMetricMap,
+                                         out.deactivationAtomTrackerToMetricMap,
+                                         out.metricsWithActivation, replacedMetrics);
+                             }) &&
+                MeasurePhase(costs[4],
+                             [&] {
+                                 return updateAlerts(newConfig, kUpdateTimeNs,
+                                                     out.metricProducerMap, replacedMetrics,
+                                                     old.alertTrackerMap, old.anomalyTrackers,
+                                                     env.anomalyAlarmMonitor,
+                                                     out.metricProducers, out.alertTrackerMap,
+                                                     out.anomalyTrackers);
+                             }) &&
+                MeasurePhase(costs[5], [&] {
+                    return initAlarms(newConfig, kConfigKey, env.periodicAlarmMonitor,
+                                      kTimeBaseNs, kUpdateTimeNs, out.periodicAlarmTrackers);
+                });
+        if (!success) {
+            state.SkipWithError("updateStatsdConfig failed");
+            return;
+        }
+        ReportPhaseCosts(state, costs, SumNs(costs) - nsBefore);
+        preservedMetrics = 1 - static_cast<double>(replacedMetrics.size()) /
+                                       out.metricProducers.size();
+    }
+    state.counters["preserved_metrics"] = preservedMetrics;
+}
+BENCHMARK(BM_UpdateStatsdConfig)
+        ->ArgsProduct({{100, 500, 2000}, {NO_CHANGE, METRICS_CHANGED, MATCHERS_CHANGED}})
+        ->UseManualTime();
+
+// Loads and then updates a config with state.range(0) metrics and matchers through
+// StatsLogProcessor::OnConfigUpdated(), which also creates the MetricsManager, checks the
+// guardrails and registers the pulled atoms and alarms.
+static void BM_OnConfigUpdated(benchmark::State& state) {
+    const StatsdConfig config = CreateLargeConfig(state.range(0));
+    const StatsdConfig newConfig = ChangeConfig(config, METRICS_CHANGED);
+    PhaseCost load{"load"};
+    PhaseCost update{"update"};
+    for (auto _ : state) {
+        sp<StatsLogProcessor> processor =
+                CreateStatsLogProcessor(kTimeBaseNs / NS_PER_SEC, vector<StatsdConfig>());
+        const int64_t nsBefore = load.ns + update.ns;
+        MeasurePhase(load, [&] {
+            processor->OnConfigUpdated(kTimeBaseNs, kConfigKey, config);
+            return true;
+        });
+        MeasurePhase(update, [&] {
+            processor->OnConfigUpdated(kUpdateTimeNs, kConfigKey, newConfig);
+            return true;
+        });
+        // Invalid configs are dropped.
+        vector<int64_t> activeConfigs;
+        processor->GetActiveConfigs(kConfigKey.GetUid(), activeConfigs);
+        if (activeConfigs.empty()) {
+            state.SkipWithError("invalid config");
+            return;
+        }
+        ReportPhaseCosts(state, {load, update}, load.ns + update.ns - nsBefore);
+        processor.clear();
+    }
+}
+BENCHMARK(BM_OnConfigUpdated)->Arg(100)->Arg(500)->Arg(2000)->UseManualTime();
+
+}  //  namespace statsd
+}  //  namespace os
+}  //  namespace android
@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <malloc.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "metric_util.h"
+#include "stats_log_util.h"
+#include "storage/StorageManager.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using android::util::ProtoOutputStream;
+using std::vector;
+
+static const int64_t kTimeBaseSec = 10;
+
+static const int64_t kBucketSizeNs = 60 * NS_PER_SEC;
+
+// The reports of this key are written to the data dir of statsd, and erased by each benchmark.
+static const ConfigKey kConfigKey(/*uid=*/0, StringToId("DumpReportBenchmark"));
+
+// A count metric and a value metric of the process states, both sliced by uid, in 1 minute
+// buckets.
+static StatsdConfig CreateDumpConfig() {
+    StatsdConfig config;
+    config.set_id(kConfigKey.GetId());
+    // The events of metric_util are logged by root.
+    config.add_allowed_log_source("AID_ROOT");
+    const AtomMatcher matcher = CreateUidProcessStateChangedAtomMatcher();
+    *config.add_atom_matcher() = matcher;
+
+    CountMetric* countMetric = config.add_count_metric();
+    countMetric->set_id(StringToId("ProcessStateChangeCount"));
+    countMetric->set_what(matcher.id());
+    countMetric->set_bucket(ONE_MINUTE);
+    *countMetric->mutable_dimensions_in_what() =
+            CreateDimensions(util::UID_PROCESS_STATE_CHANGED, {1 /*uid*/});
+
+    ValueMetric* valueMetric = config.add_value_metric();
+    valueMetric->set_id(StringToId("ProcessStateSum"));
+    valueMetric->set_what(matcher.id());
+    valueMetric->set_bucket(ONE_MINUTE);
+    *valueMetric->mutable_value_field() =
+            CreateDimensions(util::UID_PROCESS_STATE_CHANGED, {2 /*state*/});
+    *valueMetric->mutable_dimensions_in_what() =
+            CreateDimensions(util::UID_PROCESS_STATE_CHANGED, {1 /*uid*/});
+    return config;
+}
+
+// The end of the buckets populated by PopulateProcessor().
+static int64_t GetPopulatedEndNs(int numBuckets) {
+    return kTimeBaseSec * NS_PER_SEC + numBuckets * kBucketSizeNs;
+}
+
+// Creates a processor whose metrics have [numDimensions] dimensions in each of [numBuckets]
+// buckets: the last one is the current bucket.
+static sp<StatsLogProcessor> PopulateProcessor(int numDimensions, int numBuckets) {
+    sp<StatsLogProcessor> processor =
+            CreateStatsLogProcessor(kTimeBaseSec, CreateDumpConfig(), kConfigKey);
+    for (int bucket = 0; bucket < numBuckets; bucket++) {
+        const int64_t bucketStartNs = kTimeBaseSec * NS_PER_SEC + bucket * kBucketSizeNs;
+        for (int i = 0; i < numDimensions; i++) {
+            std::unique_ptr<LogEvent> event = CreateUidProcessStateChangedEvent(
+                    bucketStartNs + NS_PER_SEC + i, 10000 + i,
+                    i % 2 == 0 ? android::app::PROCESS_STATE_TOP
+                               : android::app::PROCESS_STATE_CACHED_EMPTY);
+            processor->OnLogEvent(event.get());
+        }
+    }
+    return processor;
+}
+
+static size_t GetHeapBytes() {
+    return mallinfo().uordblks;
+}
+
+// Erases the reports of kConfigKey on disk, returning their size.
+static size_t EraseReportsOnDisk() {
+    ProtoOutputStream proto;
+    StorageManager::appendConfigMetricsReport(kConfigKey, &proto, /*erase_data=*/true,
+                                              /*isAdb=*/false);
+    return proto.size();
+}
+
+// Dumps the in-memory report of metrics with state.range(0) dimensions and state.range(1)
+// buckets. Reports the estimated byte size of the metrics before the dump, the size of the
+// report, and the heap growth from before the dump to after it, with the report still held.
+static void BM_OnDumpReport(benchmark::State& state) {
+    const int numDimensions = state.range(0);
+    const int numBuckets = state.range(1);
+    const int64_t dumpTimeNs = GetPopulatedEndNs(numBuckets) - NS_PER_SEC;
+    size_t metricsBytes = 0;
+    size_t reportBytes = 0;
+    size_t heapGrowthBytes = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        sp<StatsLogProcessor> processor = PopulateProcessor(numDimensions, numBuckets);
+        metricsBytes = std::max(metricsBytes, processor->GetMetricsSize(kConfigKey));
+        vector<uint8_t> output;
+        const size_t heapBytesBefore = GetHeapBytes();
+        state.ResumeTiming();
+        processor->onDumpReport(kConfigKey, dumpTimeNs, getWallClockNs(),
+                                /*include_current_partial_bucket=*/true, /*erase_data=*/true,
+                                ADB_DUMP, NO_TIME_CONSTRAINTS, &output);
+        state.PauseTiming();
+        const size_t heapBytesAfter = GetHeapBytes();
+        heapGrowthBytes = std::max(heapGrowthBytes,
+                                   heapBytesAfter > heapBytesBefore
+                                           ? heapBytesAfter - heapBytesBefore
+                                           : 0);
+        reportBytes = output.size();
+        output.clear();
+        processor.clear();
+        state.ResumeTiming();
+    }
+    state.counters["metrics_bytes"] = metricsBytes;
+    state.counters["report_bytes"] = reportBytes;
+    state.counters["heap_growth_bytes"] = heapGrowthBytes;
+}
+BENCHMARK(BM_OnDumpReport)
+        ->Args({10, 1})
+        ->Args({10, 60})
+        ->Args({100, 10})
+        ->Args({500, 1})
+        ->Args({500, 10})
+        ->Args({500, 60})
+        ->Unit(benchmark::kMillisecond);
+
+// Writes the reports of metrics with state.range(0) dimensions and state.range(1) buckets to
+// disk, compressed if state.range(2). Reports the uncompressed size of the reports.
+static void BM_WriteDataToDisk(benchmark::State& state) {
+    const int numDimensions = state.range(0);
+    const int numBuckets = state.range(1);
+    StorageManager::setCompressReports(state.range(2) != 0);
+    const int64_t writeTimeNs = GetPopulatedEndNs(numBuckets) - NS_PER_SEC;
+    size_t reportBytes = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        sp<StatsLogProcessor> processor = PopulateProcessor(numDimensions, numBuckets);
+        state.ResumeTiming();
+        processor->WriteDataToDisk(ADB_DUMP, NO_TIME_CONSTRAINTS, writeTimeNs, getWallClockNs());
+        StorageManager::flushWrites();
+        state.PauseTiming();
+        reportBytes = EraseReportsOnDisk();
+        processor.clear();
+        state.ResumeTiming();
+    }
+    StorageManager::setCompressReports(false);
+    state.counters["report_bytes"] = reportBytes;
+}
+BENCHMARK(BM_WriteDataToDisk)
+        ->Args({10, 60, 0})
+        ->Args({500, 10, 0})
+        ->Args({500, 60, 0})
+        ->Args({500, 60, 1})
+        ->Unit(benchmark::kMillisecond);
+
+// Reads back and erases the reports written by WriteDataToDisk() for metrics with state.range(0)
+// dimensions and state.range(1) buckets, compressed if state.range(2). This is what the dumps of
+// the configs with reports on disk do before the in-memory report.
+static void BM_AppendConfigMetricsReport(benchmark::State& state) {
+    const int numDimensions = state.range(0);
+    const int numBuckets = state.range(1);
+    StorageManager::setCompressReports(state.range(2) != 0);
+    const int64_t writeTimeNs = GetPopulatedEndNs(numBuckets) - NS_PER_SEC;
+    size_t reportBytes = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        sp<StatsLogProcessor> processor = PopulateProcessor(numDimensions, numBuckets);
+        processor->WriteDataToDisk(ADB_DUMP, NO_TIME_CONSTRAINTS, writeTimeNs, getWallClockNs());
+        StorageManager::flushWrites();
+        processor.clear();
+        ProtoOutputStream proto;
+        state.ResumeTiming();
+        StorageManager::appendConfigMetricsReport(kConfigKey, &proto, /*erase_data=*/true,
+                                                  /*isAdb=*/false);
+        state.PauseTiming();
+        reportBytes = proto.size();
+        state.ResumeTiming();
+    }
+    StorageManager::setCompressReports(false);
+    state.counters["report_bytes"] = reportBytes;
+}
+BENCHMARK(BM_AppendConfigMetricsReport)
+        ->Args({10, 60, 0})
+        ->Args({500, 10, 0})
+        ->Args({500, 60, 0})
+        ->Args({500, 60, 1})
+        ->Unit(benchmark::kMillisecond);
+
+}  //  namespace statsd
+}  //  namespace os
+}  //  namespace android
@@ -67,6 +67,23 @@ static void BM_FilterValue(benchmark::State& state) {
 
 BENCHMARK(BM_FilterValue);
 
+static void BM_FilterValueReusingKey(benchmark::State& state) {
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    FieldMatcher field_matcher;
+    createLogEventAndMatcher(&event, &field_matcher);
+
+    std::vector<Matcher> matchers;
+    translateFieldMatcher(field_matcher, &matchers);
+
+    HashableDimensionKey output;
+    while (state.KeepRunning()) {
+        output.clear();
+        filterValues(matchers, event.getValues(), &output);
+    }
+}
+
+BENCHMARK(BM_FilterValueReusingKey);
+
 }  //  namespace statsd
 }  //  namespace os
 }  //  namespace android
@@ -71,6 +71,20 @@ static void BM_GetDimensionInCondition(benchmark::State& state) {
 
 BENCHMARK(BM_GetDimensionInCondition);
 
+static void BM_GetDimensionInConditionReusingKey(benchmark::State& state) {
+    Metric2Condition link;
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    createLogEventAndLink(&event, &link);
+
+    HashableDimensionKey output;
+    while (state.KeepRunning()) {
+        output.clear();
+        getDimensionForCondition(event.getValues(), link, &output);
+    }
+}
+
+BENCHMARK(BM_GetDimensionInConditionReusingKey);
+
 
 }  //  namespace statsd
 }  //  namespace os
@@ -13,6 +13,7 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <memory>
 #include <vector>
 #include "benchmark/benchmark.h"
 #include "logd/LogEvent.h"
@@ -45,6 +46,47 @@ static void BM_LogEventCreation(benchmark::State& state) {
 }
 BENCHMARK(BM_LogEventCreation);
 
+static size_t createScalarStatsEvent(uint8_t* msg, int numFields) {
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, 100);
+    for (int i = 0; i < numFields; i++) {
+        if (i % 2 == 0) {
+            AStatsEvent_writeInt32(event, i);
+        } else {
+            AStatsEvent_writeInt64(event, i);
+        }
+    }
+    AStatsEvent_build(event);
+
+    size_t size;
+    uint8_t* buf = AStatsEvent_getBuffer(event, &size);
+    memcpy(msg, buf, size);
+    AStatsEvent_release(event);
+    return size;
+}
+
+static void BM_LogEventCreationScalarAtom(benchmark::State& state) {
+    uint8_t msg[LOGGER_ENTRY_MAX_PAYLOAD];
+    size_t size = createScalarStatsEvent(msg, state.range(0));
+    while (state.KeepRunning()) {
+        LogEvent event(/*uid=*/ 1000, /*pid=*/ 1001);
+        benchmark::DoNotOptimize(event.parseBuffer(msg, size));
+    }
+}
+BENCHMARK(BM_LogEventCreationScalarAtom)->Arg(2)->Arg(8)->Arg(32);
+
+static void BM_LogEventCreationScalarAtomWithParsePlans(benchmark::State& state) {
+    uint8_t msg[LOGGER_ENTRY_MAX_PAYLOAD];
+    size_t size = createScalarStatsEvent(msg, state.range(0));
+    LogEvent::setParsePlans(std::make_shared<LogEventParsePlans>(/*numSlots=*/16));
+    while (state.KeepRunning()) {
+        LogEvent event(/*uid=*/ 1000, /*pid=*/ 1001);
+        benchmark::DoNotOptimize(event.parseBuffer(msg, size));
+    }
+    LogEvent::setParsePlans(nullptr);
+}
+BENCHMARK(BM_LogEventCreationScalarAtomWithParsePlans)->Arg(2)->Arg(8)->Arg(32);
+
 }  //  namespace statsd
 }  //  namespace os
 }  //  namespace android
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <memory>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "metric_util.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::vector;
+
+// Count metrics on screen brightness levels per config, so that the configs together have
+// hundreds of matchers.
+static const int kBrightnessMatchersPerConfig = 10;
+
+static const int kNumUids = 50;
+
+static const size_t kNumEvents = 5000;
+
+static const int64_t kTimeBaseSec = 10;
+
+// A config with sliced conditions, a condition link and a state link, in the style of the
+// configs of the devices, plus brightness matchers that are distinct across configs.
+static StatsdConfig CreatePipelineConfig(int configIndex) {
+    StatsdConfig config;
+    // The events of metric_util are logged by root.
+    config.add_allowed_log_source("AID_ROOT");
+    *config.add_atom_matcher() = CreateScreenTurnedOnAtomMatcher();
+    *config.add_atom_matcher() = CreateScreenTurnedOffAtomMatcher();
+    *config.add_atom_matcher() = CreateStartScheduledJobAtomMatcher();
+    *config.add_atom_matcher() = CreateFinishScheduledJobAtomMatcher();
+    *config.add_atom_matcher() = CreateSyncStartAtomMatcher();
+    *config.add_atom_matcher() = CreateSyncEndAtomMatcher();
+    *config.add_atom_matcher() = CreateAcquireWakelockAtomMatcher();
+    *config.add_atom_matcher() = CreateReleaseWakelockAtomMatcher();
+
+    Predicate screenIsOffPredicate = CreateScreenIsOffPredicate();
+    Predicate isSyncingPredicate = CreateIsSyncingPredicate();
+    *isSyncingPredicate.mutable_simple_predicate()->mutable_dimensions() =
+            CreateAttributionUidDimensions(util::SYNC_STATE_CHANGED, {Position::FIRST});
+    Predicate scheduledJobPredicate = CreateScheduledJobPredicate();
+    *scheduledJobPredicate.mutable_simple_predicate()->mutable_dimensions() =
+            CreateAttributionUidDimensions(util::SCHEDULED_JOB_STATE_CHANGED, {Position::FIRST});
+    *config.add_predicate() = screenIsOffPredicate;
+    *config.add_predicate() = isSyncingPredicate;
+    *config.add_predicate() = scheduledJobPredicate;
+
+    *config.add_state() = CreateUidProcessState();
+
+    CountMetric* syncCount = config.add_count_metric();
+    syncCount->set_id(StringToId("SyncCountWhileScreenOff"));
+    syncCount->set_what(StringToId("SyncStart"));
+    syncCount->set_condition(screenIsOffPredicate.id());
+    syncCount->set_bucket(FIVE_MINUTES);
+    *syncCount->mutable_dimensions_in_what() =
+            CreateAttributionUidDimensions(util::SYNC_STATE_CHANGED, {Position::FIRST});
+
+    CountMetric* wakelockCount = config.add_count_metric();
+    wakelockCount->set_id(StringToId("WakelockCountByProcessState"));
+    wakelockCount->set_what(StringToId("AcquireWakelock"));
+    wakelockCount->set_bucket(FIVE_MINUTES);
+    *wakelockCount->mutable_dimensions_in_what() =
+            CreateAttributionUidDimensions(util::WAKELOCK_STATE_CHANGED, {Position::FIRST});
+    wakelockCount->add_slice_by_state(StringToId("UidProcessState"));
+    MetricStateLink* stateLink = wakelockCount->add_state_link();
+    stateLink->set_state_atom_id(util::UID_PROCESS_STATE_CHANGED);
+    *stateLink->mutable_fields_in_what() =
+            CreateAttributionUidDimensions(util::WAKELOCK_STATE_CHANGED, {Position::FIRST});
+    *stateLink->mutable_fields_in_state() =
+            CreateDimensions(util::UID_PROCESS_STATE_CHANGED, {1 /*uid*/});
+
+    DurationMetric* jobDuration = config.add_duration_metric();
+    jobDuration->set_id(StringToId("JobDurationWhileSyncing"));
+    jobDuration->set_what(scheduledJobPredicate.id());
+    jobDuration->set_condition(isSyncingPredicate.id());
+    jobDuration->set_aggregation_type(DurationMetric::SUM);
+    jobDuration->set_bucket(FIVE_MINUTES);
+    *jobDuration->mutable_dimensions_in_what() =
+            CreateAttributionUidDimensions(util::SCHEDULED_JOB_STATE_CHANGED, {Position::FIRST});
+    MetricConditionLink* link = jobDuration->add_links();
+    link->set_condition(isSyncingPredicate.id());
+    *link->mutable_fields_in_what() =
+            CreateAttributionUidDimensions(util::SCHEDULED_JOB_STATE_CHANGED, {Position::FIRST});
+    *link->mutable_fields_in_condition() =
+            CreateAttributionUidDimensions(util::SYNC_STATE_CHANGED, {Position::FIRST});
+
+    for (int i = 0; i < kBrightnessMatchersPerConfig; i++) {
+        const int level = (configIndex * kBrightnessMatchersPerConfig + i) % 256;
+        AtomMatcher* matcher = config.add_atom_matcher();
+        *matcher = CreateScreenBrightnessChangedAtomMatcher();
+        matcher->set_id(StringToId("ScreenBrightness" + std::to_string(level)));
+        FieldValueMatcher* levelMatcher =
+                matcher->mutable_simple_atom_matcher()->add_field_value_matcher();
+        levelMatcher->set_field(1);  // Level field.
+        levelMatcher->set_eq_int(level);
+
+        CountMetric* brightnessCount = config.add_count_metric();
+        brightnessCount->set_id(StringToId("BrightnessCount" + std::to_string(level)));
+        brightnessCount->set_what(matcher->id());
+        brightnessCount->set_bucket(FIVE_MINUTES);
+    }
+    return config;
+}
+
+// A stream of kNumEvents events of kNumUids uids, 10ms apart so that they stay in the first
+// bucket.
+static vector<std::unique_ptr<LogEvent>> CreatePipelineEvents() {
+    vector<std::unique_ptr<LogEvent>> events;
+    const vector<string> tags = {""};
+    int64_t timestampNs = kTimeBaseSec * NS_PER_SEC;
+    for (int i = 0; events.size() < kNumEvents; i++) {
+        const vector<int> uids = {10000 + i % kNumUids};
+        timestampNs += 10 * NS_PER_SEC / 1000;
+        switch (i % 10) {
+            case 0:
+                events.push_back(CreateScreenStateChangedEvent(
+                        timestampNs, i % 20 == 0 ? android::view::DISPLAY_STATE_OFF
+                                                 : android::view::DISPLAY_STATE_ON));
+                break;
+            case 1:
+                events.push_back(CreateSyncStartEvent(timestampNs, uids, tags, "sync"));
+                break;
+            case 2:
+                events.push_back(CreateStartScheduledJobEvent(timestampNs, uids, tags, "job"));
+                break;
+            case 3:
+                events.push_back(CreateUidProcessStateChangedEvent(
+                        timestampNs, uids[0],
+                        i % 20 < 10 ? android::app::PROCESS_STATE_TOP
+                                    : android::app::PROCESS_STATE_CACHED_EMPTY));
+                break;
+            case 4:
+                events.push_back(CreateAcquireWakelockEvent(timestampNs, uids, tags, "wl"));
+                break;
+            case 5:
+                events.push_back(CreateReleaseWakelockEvent(timestampNs, uids, tags, "wl"));
+                break;
+            case 6:
+                events.push_back(CreateFinishScheduledJobEvent(timestampNs, uids, tags, "job"));
+                break;
+            case 7:
+                events.push_back(CreateSyncEndEvent(timestampNs, uids, tags, "sync"));
+                break;
+            default:
+                events.push_back(CreateScreenBrightnessChangedEvent(timestampNs, i % 256));
+                break;
+        }
+    }
+    return events;
+}
+
+// Replays the events through a processor with state.range(0) configs. Reports the events
+// processed per second, and the time per event.
+static void BM_StatsLogProcessorOnLogEvent(benchmark::State& state) {
+    vector<StatsdConfig> configs;
+    for (int i = 0; i < state.range(0); i++) {
+        configs.push_back(CreatePipelineConfig(i));
+    }
+    const vector<std::unique_ptr<LogEvent>> events = CreatePipelineEvents();
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        sp<StatsLogProcessor> processor = CreateStatsLogProcessor(kTimeBaseSec, configs);
+        state.ResumeTiming();
+        for (const auto& event : events) {
+            processor->OnLogEvent(event.get());
+        }
+        state.PauseTiming();
+        processor.clear();
+        state.ResumeTiming();
+    }
+    const int64_t numEvents = state.iterations() * events.size();
+    state.SetItemsProcessed(numEvents);
+    state.counters["time_per_event"] = benchmark::Counter(
+            numEvents, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+BENCHMARK(BM_StatsLogProcessorOnLogEvent)
+        ->Arg(1)
+        ->Arg(10)
+        ->Arg(30)
+        ->Unit(benchmark::kMillisecond);
+
+}  //  namespace statsd
+}  //  namespace os
+}  //  namespace android
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <malloc.h>
+
+#include <memory>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "metric_util.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::vector;
+
+static const int64_t kTimeBaseSec = 10;
+
+static const int64_t kBucketSizeNs = 60 * NS_PER_SEC;
+
+static const ConfigKey kConfigKey(/*uid=*/0, StringToId("MetricMemoryBenchmark"));
+
+enum MetricType {
+    COUNT = 0,
+    DURATION_ORING = 1,
+    DURATION_MAX = 2,
+    GAUGE = 3,
+    VALUE = 4,
+    KLL = 5,
+    EVENT = 6,
+};
+
+// A metric of [type] in 1 minute buckets, sliced by uid. The duration metrics are on the
+// wakelocks held by each uid, the other metrics on the process state changes.
+static StatsdConfig CreateMemoryConfig(MetricType type) {
+    StatsdConfig config;
+    config.set_id(kConfigKey.GetId());
+    // The events of metric_util are logged by root.
+    config.add_allowed_log_source("AID_ROOT");
+    const AtomMatcher matcher = CreateUidProcessStateChangedAtomMatcher();
+    *config.add_atom_matcher() = matcher;
+    const FieldMatcher uidDimensions =
+            CreateDimensions(util::UID_PROCESS_STATE_CHANGED, {1 /*uid*/});
+    const FieldMatcher stateField =
+            CreateDimensions(util::UID_PROCESS_STATE_CHANGED, {2 /*state*/});
+    switch (type) {
+        case COUNT: {
+            CountMetric* metric = config.add_count_metric();
+            metric->set_id(StringToId("Count"));
+            metric->set_what(matcher.id());
+            metric->set_bucket(ONE_MINUTE);
+            *metric->mutable_dimensions_in_what() = uidDimensions;
+            break;
+        }
+        case DURATION_ORING:
+        case DURATION_MAX: {
+            *config.add_atom_matcher() = CreateAcquireWakelockAtomMatcher();
+            *config.add_atom_matcher() = CreateReleaseWakelockAtomMatcher();
+            Predicate predicate = CreateHoldingWakelockPredicate();
+            *predicate.mutable_simple_predicate()->mutable_dimensions() =
+                    CreateAttributionUidDimensions(util::WAKELOCK_STATE_CHANGED,
+                                                   {Position::FIRST});
+            *config.add_predicate() = predicate;
+            DurationMetric* metric = config.add_duration_metric();
+            metric->set_id(StringToId("Duration"));
+            metric->set_what(predicate.id());
+            metric->set_bucket(ONE_MINUTE);
+            metric->set_aggregation_type(type == DURATION_ORING ? DurationMetric::SUM
+                                                                : DurationMetric::MAX_SPARSE);
+            *metric->mutable_dimensions_in_what() = CreateAttributionUidDimensions(
+                    util::WAKELOCK_STATE_CHANGED, {Position::FIRST});
+            break;
+        }
+        case GAUGE: {
+            GaugeMetric* metric = config.add_gauge_metric();
+            metric->set_id(StringToId("Gauge"));
+            metric->set_what(matcher.id());
+            metric->set_bucket(ONE_MINUTE);
+            metric->set_sampling_type(GaugeMetric::FIRST_N_SAMPLES);
+            metric->mutable_gauge_fields_filter()->set_include_all(true);
+            *metric->mutable_dimensions_in_what() = uidDimensions;
+            break;
+        }
+        case VALUE: {
+            ValueMetric* metric = config.add_value_metric();
+            metric->set_id(StringToId("Value"));
+            metric->set_what(matcher.id());
+            metric->set_bucket(ONE_MINUTE);
+            *metric->mutable_value_field() = stateField;
+            *metric->mutable_dimensions_in_what() = uidDimensions;
+            break;
+        }
+        case KLL: {
+            KllMetric* metric = config.add_kll_metric();
+            metric->set_id(StringToId("Kll"));
+            metric->set_what(matcher.id());
+            metric->set_bucket(ONE_MINUTE);
+            *metric->mutable_kll_field() = stateField;
+            *metric->mutable_dimensions_in_what() = uidDimensions;
+            break;
+        }
+        case EVENT: {
+            EventMetric* metric = config.add_event_metric();
+            metric->set_id(StringToId("Event"));
+            metric->set_what(matcher.id());
+            break;
+        }
+    }
+    return config;
+}
+
+static size_t GetHeapBytes() {
+    return mallinfo().uordblks;
+}
+
+// Logs, in each of [numBuckets] buckets, one event of each of [numDimensions] uids: a process
+// state change, or a wakelock held for 30 seconds for the duration metrics.
+static void PopulateMetric(const sp<StatsLogProcessor>& processor, MetricType type,
+                           int numDimensions, int numBuckets) {
+    const vector<string> tags = {""};
+    for (int bucket = 0; bucket < numBuckets; bucket++) {
+        const int64_t bucketStartNs = kTimeBaseSec * NS_PER_SEC + bucket * kBucketSizeNs;
+        for (int i = 0; i < numDimensions; i++) {
+            const int64_t eventTimeNs = bucketStartNs + NS_PER_SEC + i;
+            std::unique_ptr<LogEvent> event;
+            if (type == DURATION_ORING || type == DURATION_MAX) {
+                event = CreateAcquireWakelockEvent(eventTimeNs, {10000 + i}, tags, "wl");
+            } else {
+                event = CreateUidProcessStateChangedEvent(
+                        eventTimeNs, 10000 + i,
+                        i % 2 == 0 ? android::app::PROCESS_STATE_TOP
+                                   : android::app::PROCESS_STATE_CACHED_EMPTY);
+            }
+            processor->OnLogEvent(event.get());
+        }
+        if (type == DURATION_ORING || type == DURATION_MAX) {
+            for (int i = 0; i < numDimensions; i++) {
+                std::unique_ptr<LogEvent> event = CreateReleaseWakelockEvent(
+                        bucketStartNs + 31 * NS_PER_SEC + i, {10000 + i}, tags, "wl");
+                processor->OnLogEvent(event.get());
+            }
+        }
+    }
+}
+
+// Measures the heap used by a metric of type state.range(0) with state.range(1) dimensions in
+// each of state.range(2) buckets, the last one being the current bucket, and compares it to the
+// estimates of the metric:
+//   - heap_bytes: the heap growth from the config load to the end of the events.
+//   - heap_bytes_per_entry: heap_bytes per dimension and bucket.
+//   - estimated_bytes: the current and past bucket bytes of MetricsManager::getMemoryUsage(),
+//     plus the condition state bytes.
+//   - byte_size: MetricProducer::byteSize(), the past buckets that the guardrails apply to.
+//   - estimate_ratio: estimated_bytes / heap_bytes, which should be close to 1.
+// The heap is read with mallinfo(), so the other threads of the benchmark must be idle.
+static void BM_MetricMemory(benchmark::State& state) {
+    const MetricType type = static_cast<MetricType>(state.range(0));
+    const int numDimensions = state.range(1);
+    const int numBuckets = state.range(2);
+    const StatsdConfig config = CreateMemoryConfig(type);
+    size_t heapBytes = 0;
+    MetricsManager::MemoryUsage usage;
+    size_t byteSize = 0;
+    for (auto _ : state) {
+        sp<StatsLogProcessor> processor = CreateStatsLogProcessor(kTimeBaseSec, config, kConfigKey);
+        const size_t heapBytesBefore = GetHeapBytes();
+        PopulateMetric(processor, type, numDimensions, numBuckets);
+        const size_t heapBytesAfter = GetHeapBytes();
+        heapBytes = heapBytesAfter > heapBytesBefore ? heapBytesAfter - heapBytesBefore : 0;
+        usage = processor->GetMemoryUsage(kConfigKey);
+        byteSize = processor->GetMetricsSize(kConfigKey);
+        processor.clear();
+    }
+    const size_t estimatedBytes =
+            usage.currentBucketBytes + usage.pastBucketBytes + usage.conditionStateBytes;
+    state.counters["heap_bytes"] = heapBytes;
+    state.counters["heap_bytes_per_entry"] =
+            static_cast<double>(heapBytes) / (numDimensions * numBuckets);
+    state.counters["estimated_bytes"] = estimatedBytes;
+    state.counters["byte_size"] = byteSize;
+    state.counters["estimate_ratio"] =
+            heapBytes > 0 ? static_cast<double>(estimatedBytes) / heapBytes : 0;
+}
+
+static void MetricMemoryArgs(benchmark::internal::Benchmark* benchmark) {
+    for (int type = COUNT; type <= EVENT; type++) {
+        benchmark->Args({type, 100, 1});
+        benchmark->Args({type, 100, 10});
+        benchmark->Args({type, 500, 10});
+    }
+}
+BENCHMARK(BM_MetricMemory)->Apply(MetricMemoryArgs)->Iterations(1);
+
+}  //  namespace statsd
+}  //  namespace os
+}  //  namespace android
@@ -40,6 +40,9 @@ AtomMatcher CreateFinishScheduledJobAtomMatcher();
 // Create AtomMatcher proto for screen brightness state changed.
 AtomMatcher CreateScreenBrightnessChangedAtomMatcher();
 
+// Create AtomMatcher proto for uid process state changed.
+AtomMatcher CreateUidProcessStateChangedAtomMatcher();
+
 // Create AtomMatcher proto for acquiring wakelock.
 AtomMatcher CreateAcquireWakelockAtomMatcher();
 
@@ -79,6 +82,9 @@ Predicate CreateIsSyncingPredicate();
 // Create a Predicate proto for app is in background.
 Predicate CreateIsInBackgroundPredicate();
 
+// Create State proto for uid process state.
+State CreateUidProcessState();
+
 // Add a predicate to the predicate combination.
 void addPredicateToPredicateCombination(const Predicate& predicate, Predicate* combination);
 
@@ -102,6 +108,25 @@ void parseStatsEventToLogEvent(AStatsEvent* statsEvent, LogEvent* logEvent);
 std::unique_ptr<LogEvent> CreateScreenStateChangedEvent(
         uint64_t timestampNs, const android::view::DisplayStateEnum state);
 
+// Create log event for screen brightness changed.
+std::unique_ptr<LogEvent> CreateScreenBrightnessChangedEvent(uint64_t timestampNs, int level);
+
+// Create log event for uid process state changed.
+std::unique_ptr<LogEvent> CreateUidProcessStateChangedEvent(
+        uint64_t timestampNs, int uid, const android::app::ProcessStateEnum state);
+
+// Create log event for acquiring wakelock.
+std::unique_ptr<LogEvent> CreateAcquireWakelockEvent(uint64_t timestampNs,
+                                                     const vector<int>& attributionUids,
+                                                     const vector<string>& attributionTags,
+                                                     const string& wakelockName);
+
+// Create log event for releasing wakelock.
+std::unique_ptr<LogEvent> CreateReleaseWakelockEvent(uint64_t timestampNs,
+                                                     const vector<int>& attributionUids,
+                                                     const vector<string>& attributionTags,
+                                                     const string& wakelockName);
+
 // Create log event when scheduled job starts.
 std::unique_ptr<LogEvent> CreateStartScheduledJobEvent(uint64_t timestampNs,
                                                        const vector<int>& attributionUids,
@@ -130,6 +155,11 @@ std::unique_ptr<LogEvent> CreateSyncEndEvent(uint64_t timestampNs,
 sp<StatsLogProcessor> CreateStatsLogProcessor(const long timeBaseSec, const StatsdConfig& config,
                                               const ConfigKey& key);
 
+// Create a statsd log event processor with each of the configs, whose keys have uid 0 and the
+// index of the config as id.
+sp<StatsLogProcessor> CreateStatsLogProcessor(const long timeBaseSec,
+                                              const std::vector<StatsdConfig>& configs);
+
 // Util function to sort the log events by timestamp.
 void sortLogEventsByTimestamp(std::vector<std::unique_ptr<LogEvent>> *events);
 
@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <aidl/android/os/BnPullAtomCallback.h>
+#include <aidl/android/util/StatsEventParcel.h>
+#include <android/binder_interface_utils.h>
+#include <private/android_filesystem_config.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "annotations.h"
+#include "benchmark/benchmark.h"
+#include "external/StatsPuller.h"
+#include "external/StatsPullerManager.h"
+#include "external/puller_util.h"
+#include "metric_util.h"
+#include "stats_event.h"
+#include "stats_log_util.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using aidl::android::os::BnPullAtomCallback;
+using aidl::android::os::IPullAtomResultReceiver;
+using aidl::android::util::StatsEventParcel;
+using ::ndk::SharedRefBase;
+using std::shared_ptr;
+using std::vector;
+using Status = ::ndk::ScopedAStatus;
+
+// Pulled atoms without a puller of their own: the fake callbacks are registered for
+// kFirstPullTag, kFirstPullTag + 1, ...
+static const int kFirstPullTag = 10900;
+
+static const int kHostUidBase = 10000;
+
+static const int64_t kTimeBaseSec = 10;
+
+static const int64_t kBucketSizeNs = 60 * NS_PER_SEC;
+
+// Not a real config, the reports are not written to disk.
+static const ConfigKey kConfigKey(/*uid=*/0, StringToId("PullBenchmark"));
+
+// Builds a pulled atom of [tag]: an int uid field, annotated as such, and an int64 counter.
+static AStatsEvent* CreatePulledEvent(int tag, int32_t uid, int64_t value) {
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, tag);
+    AStatsEvent_writeInt32(event, uid);
+    AStatsEvent_addBoolAnnotation(event, ANNOTATION_ID_IS_UID, true);
+    AStatsEvent_writeInt64(event, value);
+    AStatsEvent_build(event);
+    return event;
+}
+
+static std::shared_ptr<LogEvent> CreatePulledLogEvent(int tag, int32_t uid, int64_t value) {
+    AStatsEvent* statsEvent = CreatePulledEvent(tag, uid, value);
+    std::shared_ptr<LogEvent> logEvent = std::make_shared<LogEvent>(/*uid=*/0, /*pid=*/0);
+    parseStatsEventToLogEvent(statsEvent, logEvent.get());
+    return logEvent;
+}
+
+// Returns [numRows] rows of distinct uids after [latencyNs]. The counters of the rows grow with
+// each pull, so that the value metrics compute non-zero diffs.
+class FakePullAtomCallback : public BnPullAtomCallback {
+public:
+    FakePullAtomCallback(int numRows, int64_t latencyNs)
+        : mNumRows(numRows), mLatencyNs(latencyNs) {
+    }
+
+    Status onPullAtom(int atomTag,
+                      const shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        const int64_t pullCount = ++mPullCount;
+        vector<StatsEventParcel> parcels(mNumRows);
+        for (int i = 0; i < mNumRows; i++) {
+            AStatsEvent* event = CreatePulledEvent(atomTag, kHostUidBase + i, pullCount * (i + 1));
+            size_t size;
+            uint8_t* buffer = AStatsEvent_getBuffer(event, &size);
+            parcels[i].buffer.assign(buffer, buffer + size);
+            AStatsEvent_release(event);
+        }
+        if (mLatencyNs > 0) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(mLatencyNs));
+        }
+        resultReceiver->pullFinished(atomTag, /*success=*/true, parcels);
+        return Status::ok();
+    }
+
+private:
+    const int mNumRows;
+    const int64_t mLatencyNs;
+    std::atomic<int64_t> mPullCount{0};
+};
+
+static void RegisterFakePullers(const sp<StatsPullerManager>& pullerManager, int numAtoms,
+                                int numRows, int64_t latencyNs) {
+    for (int i = 0; i < numAtoms; i++) {
+        pullerManager->RegisterPullAtomCallback(
+                AID_SYSTEM, kFirstPullTag + i, /*coolDownNs=*/NS_PER_SEC,
+                /*timeoutNs=*/10 * NS_PER_SEC, /*additiveFields=*/{},
+                SharedRefBase::make<FakePullAtomCallback>(numRows, latencyNs));
+    }
+}
+
+// Pulls an atom of state.range(0) rows taking state.range(1) microseconds, past the cool down of
+// the previous pull so that it is not served from the cache.
+static void BM_StatsPullerManagerPull(benchmark::State& state) {
+    const int numRows = state.range(0);
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    StatsPuller::SetUidMap(new UidMap());
+    RegisterFakePullers(pullerManager, /*numAtoms=*/1, numRows, state.range(1) * 1000);
+    int64_t pullTimeNs = kTimeBaseSec * NS_PER_SEC;
+    for (auto _ : state) {
+        pullTimeNs += 2 * NS_PER_SEC;
+        vector<shared_ptr<LogEvent>> data;
+        pullerManager->Pull(kFirstPullTag, {AID_SYSTEM}, pullTimeNs, &data);
+        benchmark::DoNotOptimize(data);
+    }
+    state.SetItemsProcessed(state.iterations() * numRows);
+}
+BENCHMARK(BM_StatsPullerManagerPull)
+        ->Args({10, 0})
+        ->Args({1000, 0})
+        ->Args({10000, 0})
+        ->Args({1000, 1000})
+        ->Unit(benchmark::kMicrosecond);
+
+// Maps and merges state.range(0) rows, of which one in state.range(1) has an isolated uid. The
+// rows share their host uids in groups of 4, so that the merge sums the counters. The merge
+// groups the rows by hash if state.range(2), else by sorting them.
+static void BM_MapAndMergeIsolatedUidsToHostUid(benchmark::State& state) {
+    const int numRows = state.range(0);
+    const int isolatedInterval = state.range(1);
+    setHashMergeIsolatedUids(state.range(2) != 0);
+    sp<UidMap> uidMap = new UidMap();
+    vector<shared_ptr<LogEvent>> rows;
+    for (int i = 0; i < numRows; i++) {
+        const int hostUid = kHostUidBase + i / 4;
+        int uid = hostUid;
+        if (i % isolatedInterval == 0) {
+            uid = AID_ISOLATED_START + i;
+            uidMap->assignIsolatedUid(uid, hostUid);
+        }
+        rows.push_back(CreatePulledLogEvent(kFirstPullTag, uid, i));
+    }
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        vector<shared_ptr<LogEvent>> data;
+        for (const auto& row : rows) {
+            data.push_back(std::make_shared<LogEvent>(*row));
+        }
+        state.ResumeTiming();
+        mapAndMergeIsolatedUidsToHostUid(data, uidMap, kFirstPullTag, /*additiveFields=*/{2});
+        benchmark::DoNotOptimize(data);
+    }
+    setHashMergeIsolatedUids(false);
+    state.SetItemsProcessed(state.iterations() * numRows);
+}
+BENCHMARK(BM_MapAndMergeIsolatedUidsToHostUid)
+        ->Args({100, 2, 0})
+        ->Args({1000, 2, 0})
+        ->Args({1000, 2, 1})
+        ->Args({10000, 2, 0})
+        ->Args({10000, 2, 1})
+        ->Args({10000, 100, 1})
+        ->Unit(benchmark::kMicrosecond);
+
+// A value metric summing the counter diffs of each pulled atom, or a gauge metric sampling one
+// atom per bucket, sliced by uid, in 1 minute buckets.
+static StatsdConfig CreatePullConfig(bool gauge, int numAtoms) {
+    StatsdConfig config;
+    config.set_id(kConfigKey.GetId());
+    config.add_allowed_log_source("AID_ROOT");
+    // The fake callbacks are registered for AID_SYSTEM.
+    config.add_default_pull_packages("AID_SYSTEM");
+    for (int i = 0; i < numAtoms; i++) {
+        const int tag = kFirstPullTag + i;
+        const AtomMatcher matcher =
+                CreateSimpleAtomMatcher("Pulled" + std::to_string(tag), tag);
+        *config.add_atom_matcher() = matcher;
+        if (gauge) {
+            GaugeMetric* metric = config.add_gauge_metric();
+            metric->set_id(StringToId("PulledGauge" + std::to_string(tag)));
+            metric->set_what(matcher.id());
+            metric->set_bucket(ONE_MINUTE);
+            metric->set_sampling_type(GaugeMetric::RANDOM_ONE_SAMPLE);
+            metric->mutable_gauge_fields_filter()->set_include_all(true);
+            *metric->mutable_dimensions_in_what() = CreateDimensions(tag, {1 /*uid*/});
+        } else {
+            ValueMetric* metric = config.add_value_metric();
+            metric->set_id(StringToId("PulledValue" + std::to_string(tag)));
+            metric->set_what(matcher.id());
+            metric->set_bucket(ONE_MINUTE);
+            *metric->mutable_value_field() = CreateDimensions(tag, {2 /*counter*/});
+            *metric->mutable_dimensions_in_what() = CreateDimensions(tag, {1 /*uid*/});
+        }
+    }
+    return config;
+}
+
+// Fires the pull alarms at the bucket boundaries of a config with state.range(1) pulled atoms of
+// state.range(2) rows each, taking state.range(3) microseconds, pulled on state.range(4) worker
+// threads. The metrics are value metrics, whose NumericValueMetricProducer diffs the pulls, or
+// gauge metrics if state.range(0).
+static void BM_PullAlarm(benchmark::State& state) {
+    const bool gauge = state.range(0) != 0;
+    const int numAtoms = state.range(1);
+    const int numRows = state.range(2);
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    if (state.range(4) > 0) {
+        pullerManager->SetParallelPulls(state.range(4), /*deadlineNs=*/10 * NS_PER_SEC);
+    }
+    RegisterFakePullers(pullerManager, numAtoms, numRows, state.range(3) * 1000);
+
+    sp<UidMap> uidMap = new UidMap();
+    StatsPuller::SetUidMap(uidMap);
+    const int64_t timeBaseNs = kTimeBaseSec * NS_PER_SEC;
+    sp<StatsLogProcessor> processor = new StatsLogProcessor(
+            uidMap, pullerManager, /*anomalyAlarmMonitor=*/nullptr,
+            /*subscriberTriggerAlarmMonitor=*/nullptr, timeBaseNs,
+            [](const ConfigKey&) { return true; },
+            [](const int&, const vector<int64_t>&) { return true; });
+    processor->OnConfigUpdated(timeBaseNs, kConfigKey, CreatePullConfig(gauge, numAtoms));
+
+    int64_t alarmNs = timeBaseNs;
+    int64_t numAlarms = 0;
+    for (auto _ : state) {
+        alarmNs += kBucketSizeNs;
+        processor->informPullAlarmFired(alarmNs);
+        // Drops the past buckets once in a while so that the memory stays bounded.
+        if (++numAlarms % 60 == 0) {
+            state.PauseTiming();
+            vector<uint8_t> output;
+            processor->onDumpReport(kConfigKey, alarmNs + 1, getWallClockNs(),
+                                    /*include_current_partial_bucket=*/false,
+                                    /*erase_data=*/true, ADB_DUMP, FAST, &output);
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * numAtoms * numRows);
+    state.counters["time_per_alarm"] = benchmark::Counter(
+            state.iterations(), benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+BENCHMARK(BM_PullAlarm)
+        // Value metrics.
+        ->Args({0, 1, 10, 0, 0})
+        ->Args({0, 1, 500, 0, 0})
+        ->Args({0, 20, 100, 0, 0})
+        ->Args({0, 20, 100, 1000, 0})
+        ->Args({0, 20, 100, 1000, 3})
+        // Gauge metrics.
+        ->Args({1, 1, 500, 0, 0})
+        ->Args({1, 20, 100, 0, 0})
+        ->Args({1, 20, 100, 1000, 3})
+        ->Unit(benchmark::kMillisecond);
+
+}  //  namespace statsd
+}  //  namespace os
+}  //  namespace android
@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <android-base/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "logd/LogEventQueue.h"
+#include "socket/StatsSocketListener.h"
+#include "stats_buffer_writer.h"
+#include "stats_event.h"
+#include "stats_log_util.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::vector;
+
+static const int32_t kAtomId = 100000;
+
+static const int kEventsPerProducer = 20000;
+
+// Same as the default queue of statsd.
+static const size_t kQueueSize = 4000;
+
+// Time without events after which the consumer considers the queue drained.
+static const int64_t kDrainTimeoutMs = 200;
+
+// A LogEventQueue that counts its drops, and its high-water mark.
+class CountingLogEventQueue : public LogEventQueue {
+public:
+    CountingLogEventQueue() : LogEventQueue(kQueueSize) {
+    }
+
+    bool push(std::unique_ptr<LogEvent> event, int64_t* oldestTimestampNs,
+              vector<DroppedEvent>* droppedEvents) override {
+        const bool pushed = LogEventQueue::push(std::move(event), oldestTimestampNs,
+                                                droppedEvents);
+        noteSize(pushed ? 0 : 1);
+        return pushed;
+    }
+
+    size_t pushBatch(vector<std::unique_ptr<LogEvent>>* events, int64_t* oldestTimestampNs,
+                     vector<DroppedEvent>* droppedEvents) override {
+        const size_t dropped = LogEventQueue::pushBatch(events, oldestTimestampNs, droppedEvents);
+        noteSize(dropped);
+        return dropped;
+    }
+
+    std::atomic<int64_t> drops = 0;
+    std::atomic<size_t> maxSize = 0;
+
+private:
+    void noteSize(size_t dropped) {
+        drops += dropped;
+        const size_t queued = size();
+        size_t max = maxSize;
+        while (queued > max && !maxSize.compare_exchange_weak(max, queued)) {
+        }
+    }
+};
+
+static int64_t percentile(const vector<int64_t>& sorted, double phi) {
+    return sorted.empty() ? 0 : sorted[std::min(sorted.size() - 1, (size_t)(phi * sorted.size()))];
+}
+
+// Producer threads write atoms through libstatssocket to a StatsSocketListener on a socket of a
+// temporary directory, and a consumer thread drains its LogEventQueue.
+// Args: number of producers, atoms per second per producer (0 for as fast as possible), and the
+// batch read size of the listener.
+// Reports the throughput of the consumer, the drops by the sender (socket full), by the queue,
+// and in the kernel, the high-water mark of the queue, and the percentiles of the latency from
+// AStatsEvent_obtain() to the consumer.
+static void BM_StatsSocketListenerIngestion(benchmark::State& state) {
+    const int numProducers = state.range(0);
+    const int64_t ratePerProducer = state.range(1);
+    const size_t batchReadSize = state.range(2);
+
+    TemporaryDir dir;
+    const std::string socketPath = std::string(dir.path) + "/statsdw";
+    int64_t sent = 0;
+    int64_t senderDrops = 0;
+    int64_t queueDrops = 0;
+    int64_t received = 0;
+    size_t maxQueueSize = 0;
+    vector<int64_t> latenciesNs;
+
+    for (auto _ : state) {
+        int sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        strcpy(addr.sun_path, socketPath.c_str());
+        unlink(socketPath.c_str());
+        int on = 1;
+        if (sock < 0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+            setsockopt(sock, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on)) != 0) {
+            state.SkipWithError("Failed to create the socket");
+            break;
+        }
+        stats_log_set_socket_path(socketPath.c_str());
+
+        std::shared_ptr<CountingLogEventQueue> queue = std::make_shared<CountingLogEventQueue>();
+        sp<StatsSocketListener> listener =
+                new StatsSocketListener(queue, batchReadSize, /*eventPool=*/nullptr,
+                                        /*bufferSlab=*/nullptr, /*maxReceiveBufferBytes=*/0,
+                                        /*logEventFilter=*/nullptr, sock);
+        if (listener->startListener(600) != 0) {
+            state.SkipWithError("Failed to start the listener");
+            break;
+        }
+
+        std::atomic<bool> producersDone = false;
+        int64_t lastReceivedNs = 0;
+        std::thread consumer([&] {
+            vector<std::unique_ptr<LogEvent>> events;
+            while (true) {
+                events.clear();
+                if (queue->waitPopBatch(64, kDrainTimeoutMs, &events) == 0) {
+                    if (producersDone) {
+                        return;
+                    }
+                    continue;
+                }
+                lastReceivedNs = getElapsedRealtimeNs();
+                for (const auto& event : events) {
+                    if (event->GetTagId() == kAtomId) {
+                        received++;
+                        latenciesNs.push_back(lastReceivedNs - event->GetElapsedTimestampNs());
+                    }
+                }
+            }
+        });
+
+        const int64_t startNs = getElapsedRealtimeNs();
+        std::atomic<int64_t> iterationSent = 0;
+        std::atomic<int64_t> iterationSenderDrops = 0;
+        vector<std::thread> producers;
+        for (int p = 0; p < numProducers; p++) {
+            producers.emplace_back([&, p] {
+                const auto start = std::chrono::steady_clock::now();
+                for (int i = 0; i < kEventsPerProducer; i++) {
+                    if (ratePerProducer > 0) {
+                        std::this_thread::sleep_until(
+                                start + std::chrono::nanoseconds(i * NS_PER_SEC / ratePerProducer));
+                    }
+                    AStatsEvent* event = AStatsEvent_obtain();
+                    AStatsEvent_setAtomId(event, kAtomId);
+                    AStatsEvent_writeInt32(event, p);
+                    AStatsEvent_writeInt64(event, i);
+                    if (AStatsEvent_write(event) > 0) {
+                        iterationSent++;
+                    } else {
+                        iterationSenderDrops++;
+                    }
+                    AStatsEvent_release(event);
+                }
+            });
+        }
+        for (std::thread& producer : producers) {
+            producer.join();
+        }
+        producersDone = true;
+        consumer.join();
+        listener->stopListener();
+        // The consumer was idle for kDrainTimeoutMs before stopping, which is not counted.
+        state.SetIterationTime(std::max<int64_t>(lastReceivedNs - startNs, 1) / 1e9);
+
+        sent += iterationSent;
+        senderDrops += iterationSenderDrops;
+        queueDrops += queue->drops;
+        maxQueueSize = std::max<size_t>(maxQueueSize, queue->maxSize);
+    }
+    stats_log_set_socket_path(nullptr);
+    unlink(socketPath.c_str());
+
+    std::sort(latenciesNs.begin(), latenciesNs.end());
+    state.SetItemsProcessed(received);
+    state.counters["sent"] = sent;
+    state.counters["sender_drops"] = senderDrops;
+    state.counters["queue_drops"] = queueDrops;
+    state.counters["kernel_drops"] = std::max<int64_t>(sent - received - queueDrops, 0);
+    state.counters["max_queue_size"] = maxQueueSize;
+    state.counters["latency_p50_ns"] = percentile(latenciesNs, 0.5);
+    state.counters["latency_p99_ns"] = percentile(latenciesNs, 0.99);
+    state.counters["latency_max_ns"] = latenciesNs.empty() ? 0 : latenciesNs.back();
+}
+BENCHMARK(BM_StatsSocketListenerIngestion)
+        ->Args({1, 0, 1})
+        ->Args({1, 0, 32})
+        ->Args({4, 0, 32})
+        ->Args({4, 10000, 32})
+        ->UseManualTime()
+        ->Iterations(3)
+        ->Unit(benchmark::kMillisecond);
+
+}  //  namespace statsd
+}  //  namespace os
+}  //  namespace android
@@ -16,6 +16,8 @@
 #include "benchmark/benchmark.h"
 #include <statslog.h>
 
+#include "stats_event.h"
+
 namespace android {
 namespace os {
 namespace statsd {
@@ -35,6 +37,42 @@ static void BM_StatsWrite(benchmark::State& state) {
 }
 BENCHMARK(BM_StatsWrite);
 
+static const int32_t kScalarAtomId = 100000;
+
+// Encodes an atom with scalar fields only, in an event from AStatsEvent_obtain().
+static void BM_StatsEventEncodeObtained(benchmark::State& state) {
+    int64_t value = 1234567;
+    while (state.KeepRunning()) {
+        AStatsEvent* event = AStatsEvent_obtain();
+        AStatsEvent_setAtomId(event, kScalarAtomId);
+        AStatsEvent_writeInt32(event, 1);
+        AStatsEvent_writeInt64(event, value++);
+        AStatsEvent_writeBool(event, true);
+        AStatsEvent_build(event);
+        benchmark::DoNotOptimize(event);
+        AStatsEvent_release(event);
+    }
+}
+BENCHMARK(BM_StatsEventEncodeObtained);
+
+// Same atom, encoded in a stack buffer of its exact size.
+static void BM_StatsEventEncodeInBuffer(benchmark::State& state) {
+    int64_t value = 1234567;
+    while (state.KeepRunning()) {
+        uint8_t storage[ASTATSEVENT_STORAGE_SIZE(ASTATSEVENT_INT32_FIELD_SIZE +
+                                                 ASTATSEVENT_INT64_FIELD_SIZE +
+                                                 ASTATSEVENT_BOOL_FIELD_SIZE)];
+        AStatsEvent* event = AStatsEvent_initInBuffer(storage, sizeof(storage));
+        AStatsEvent_setAtomId(event, kScalarAtomId);
+        AStatsEvent_writeInt32(event, 1);
+        AStatsEvent_writeInt64(event, value++);
+        AStatsEvent_writeBool(event, true);
+        AStatsEvent_build(event);
+        benchmark::DoNotOptimize(event);
+    }
+}
+BENCHMARK(BM_StatsEventEncodeInBuffer);
+
 }  //  namespace statsd
 }  //  namespace os
 }  //  namespace android
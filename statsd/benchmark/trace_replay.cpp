@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Replays an atom trace captured with `adb shell cmd stats capture-atoms` through a
+// StatsLogProcessor loaded with the given configs, and reports the throughput, the memory growth
+// of the metrics and the cost of each metric.
+//
+// usage: statsd_trace_replay [--speed=SPEED] TRACE CONFIG...
+//   SPEED     How many times faster than the capture the atoms are replayed. 0, the default,
+//             replays them as fast as possible.
+//   TRACE     The file written by capture-atoms.
+//   CONFIG    A StatsdConfig in the wire-encoded protobuf format, as passed to
+//             `cmd stats config update`.
+
+#include <android-base/file.h>
+#include <android-base/parsedouble.h>
+#include <android-base/strings.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "guardrail/StatsdStats.h"
+#include "metric_util.h"
+#include "shell/AtomTrace.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+namespace {
+
+using std::string;
+using std::vector;
+
+// The metrics are sized every kMemorySampleInterval events to find the peak.
+const size_t kMemorySampleInterval = 1000;
+
+size_t getMetricsBytes(const sp<StatsLogProcessor>& processor, size_t numConfigs) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < numConfigs; i++) {
+        bytes += processor->GetMetricsSize(ConfigKey(/*uid=*/0, i));
+    }
+    return bytes;
+}
+
+void printMetricCosts() {
+    vector<uint8_t> buffer;
+    StatsdStats::getInstance().dumpStats(&buffer, /*reset=*/false);
+    StatsdStatsReport report;
+    if (!report.ParseFromArray(buffer.data(), buffer.size())) {
+        fprintf(stderr, "Could not parse the statsd stats\n");
+        return;
+    }
+    vector<StatsdStatsReport::AtomMetricStats> metrics(report.atom_metric_stats().begin(),
+                                                       report.atom_metric_stats().end());
+    std::sort(metrics.begin(), metrics.end(), [](const auto& a, const auto& b) {
+        return a.event_processing_time_ns() > b.event_processing_time_ns();
+    });
+    printf("%20s %12s %16s %12s %14s\n", "metric id", "events", "processing (ns)", "dump (ns)",
+           "max bytes");
+    for (const auto& metric : metrics) {
+        printf("%20lld %12lld %16lld %12lld %14lld\n", (long long)metric.metric_id(),
+               (long long)metric.matched_event_count(),
+               (long long)metric.event_processing_time_ns(), (long long)metric.dump_time_ns(),
+               (long long)metric.max_byte_size());
+    }
+}
+
+int replay(const string& tracePath, const vector<string>& configPaths, double speed) {
+    string trace;
+    if (!android::base::ReadFileToString(tracePath, &trace)) {
+        fprintf(stderr, "Could not read %s\n", tracePath.c_str());
+        return 1;
+    }
+    vector<AtomTraceRecord> records;
+    if (!decodeAtomTrace(reinterpret_cast<const uint8_t*>(trace.data()), trace.size(),
+                         &records)) {
+        fprintf(stderr, "%s is not a complete trace, replaying its first %zu atoms\n",
+                tracePath.c_str(), records.size());
+    }
+    if (records.empty()) {
+        fprintf(stderr, "No atom to replay\n");
+        return 1;
+    }
+
+    vector<StatsdConfig> configs;
+    for (const string& path : configPaths) {
+        string serialized;
+        StatsdConfig& config = configs.emplace_back();
+        if (!android::base::ReadFileToString(path, &serialized) ||
+            !config.ParseFromString(serialized)) {
+            fprintf(stderr, "Could not read the config %s\n", path.c_str());
+            return 1;
+        }
+        // Reported in printMetricCosts().
+        config.set_track_metric_cost(true);
+    }
+
+    const int64_t firstTimestampNs = records.front().elapsedTimestampNs;
+    sp<StatsLogProcessor> processor =
+            CreateStatsLogProcessor(firstTimestampNs / NS_PER_SEC, configs);
+    const size_t initialBytes = getMetricsBytes(processor, configs.size());
+    size_t peakBytes = initialBytes;
+
+    std::chrono::nanoseconds parseTime(0);
+    std::chrono::nanoseconds processingTime(0);
+    size_t invalidCount = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < records.size(); i++) {
+        AtomTraceRecord& record = records[i];
+        if (speed > 0) {
+            std::this_thread::sleep_until(
+                    start + std::chrono::nanoseconds(static_cast<int64_t>(
+                                    (record.elapsedTimestampNs - firstTimestampNs) / speed)));
+        }
+        const auto parseStart = std::chrono::steady_clock::now();
+        LogEvent event(record.uid, record.pid);
+        const bool valid = event.parseBuffer(record.payload.data(), record.payload.size());
+        const auto processingStart = std::chrono::steady_clock::now();
+        parseTime += processingStart - parseStart;
+        if (!valid) {
+            invalidCount++;
+            continue;
+        }
+        processor->OnLogEvent(&event);
+        processingTime += std::chrono::steady_clock::now() - processingStart;
+        if (i % kMemorySampleInterval == 0) {
+            peakBytes = std::max(peakBytes, getMetricsBytes(processor, configs.size()));
+        }
+    }
+    const std::chrono::duration<double> wallTime = std::chrono::steady_clock::now() - start;
+    const size_t finalBytes = getMetricsBytes(processor, configs.size());
+    peakBytes = std::max(peakBytes, finalBytes);
+
+    // The dumps report the cost of the metrics to StatsdStats.
+    const int64_t dumpTimeNs = records.back().elapsedTimestampNs + 1;
+    for (size_t i = 0; i < configs.size(); i++) {
+        vector<uint8_t> output;
+        processor->onDumpReport(ConfigKey(/*uid=*/0, i), dumpTimeNs, dumpTimeNs,
+                                /*include_current_partial_bucket=*/true, /*erase_data=*/true,
+                                ADB_DUMP, FAST, &output);
+    }
+
+    const size_t processedCount = records.size() - invalidCount;
+    const double traceSec = (records.back().elapsedTimestampNs - firstTimestampNs) / 1e9;
+    printf("Replayed %zu atoms of %.1f s in %.1f s, %zu invalid\n", records.size(), traceSec,
+           wallTime.count(), invalidCount);
+    printf("Parsing: %.0f ns per atom\n",
+           static_cast<double>(parseTime.count()) / records.size());
+    printf("Processing: %.0f ns per atom, %.0f atoms per second\n",
+           static_cast<double>(processingTime.count()) / std::max<size_t>(processedCount, 1),
+           processedCount / std::max(processingTime.count() / 1e9, 1e-9));
+    printf("Metrics bytes: %zu after the config load, %zu at the end, %zu at the peak\n",
+           initialBytes, finalBytes, peakBytes);
+    printMetricCosts();
+    return 0;
+}
+
+}  // anonymous namespace
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+
+int main(int argc, char** argv) {
+    double speed = 0;
+    int argIndex = 1;
+    if (argIndex < argc && android::base::StartsWith(argv[argIndex], "--speed=")) {
+        if (!android::base::ParseDouble(argv[argIndex] + strlen("--speed="), &speed, 0.0)) {
+            fprintf(stderr, "Invalid speed %s\n", argv[argIndex]);
+            return 1;
+        }
+        argIndex++;
+    }
+    if (argc - argIndex < 2) {
+        fprintf(stderr, "usage: %s [--speed=SPEED] TRACE CONFIG...\n", argv[0]);
+        return 1;
+    }
+    const std::string tracePath = argv[argIndex];
+    const std::vector<std::string> configPaths(argv + argIndex + 1, argv + argc);
+    return android::os::statsd::replay(tracePath, configPaths, speed);
+}
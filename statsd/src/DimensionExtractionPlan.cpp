@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "DimensionExtractionPlan.h"
+
+#include <string.h>
+
+#include "HashableDimensionKey.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::vector;
+
+bool DimensionExtractionPlan::extract(const vector<Matcher>& matchers,
+                                      const vector<FieldValue>& values, const int32_t* fieldIndex,
+                                      HashableDimensionKey* output) {
+    if (fieldIndex == nullptr || values.empty()) {
+        return filterValues(matchers, values, output);
+    }
+    const int32_t tag = values[0].mField.getTag();
+    if (tag != mTag || values.size() != mFields.size() ||
+        memcmp(fieldIndex, mFields.data(), mFields.size() * sizeof(int32_t)) != 0) {
+        compile(matchers, values, fieldIndex);
+    }
+    for (const Step& step : mSteps) {
+        output->addValueWithField(values[step.valueIndex], step.maskedField);
+    }
+    return !mSteps.empty();
+}
+
+void DimensionExtractionPlan::compile(const vector<Matcher>& matchers,
+                                      const vector<FieldValue>& values,
+                                      const int32_t* fieldIndex) {
+    mTag = values[0].mField.getTag();
+    mFields.assign(fieldIndex, fieldIndex + values.size());
+    mSteps.clear();
+    // Same order as filterValues(): by value, then by matcher.
+    for (size_t v = 0; v < values.size(); v++) {
+        const Field& field = values[v].mField;
+        for (const Matcher& matcher : matchers) {
+            if (field.matches(matcher)) {
+                mSteps.push_back({(int)v, field.getField() & matcher.mMask});
+            }
+        }
+    }
+    mCompileCount++;
+    VLOG("Compiled a dimension extraction plan of %zu steps for atom %d", mSteps.size(), mTag);
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
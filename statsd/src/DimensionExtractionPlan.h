@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "FieldValue.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+class HashableDimensionKey;
+
+/**
+ * The values that a list of dimension matchers picks from the events of one atom layout, i.e.
+ * one tag and one sequence of encoded fields, with their masked fields.
+ *
+ * Which values a matcher matches only depends on the tag and the fields of the event, so once
+ * the plan is compiled for a layout, the events with that layout are filtered with one compare
+ * of their field index and a few indexed copies, instead of matching every value against every
+ * matcher. Events with another layout recompile the plan.
+ *
+ * A plan must always be used with the same matchers. It is not thread safe.
+ */
+class DimensionExtractionPlan {
+public:
+    /**
+     * Same as filterValues([matchers], [values], [output], [fieldIndex]). Without [fieldIndex],
+     * the layout of [values] is unknown and the plan is not used.
+     */
+    bool extract(const std::vector<Matcher>& matchers, const std::vector<FieldValue>& values,
+                 const int32_t* fieldIndex, HashableDimensionKey* output);
+
+    // Number of times the plan was compiled.
+    inline size_t getCompileCount() const {
+        return mCompileCount;
+    }
+
+private:
+    struct Step {
+        // Index of the value to copy.
+        int valueIndex;
+
+        // Its field with the mask of the matcher applied.
+        int32_t maskedField;
+    };
+
+    void compile(const std::vector<Matcher>& matchers, const std::vector<FieldValue>& values,
+                 const int32_t* fieldIndex);
+
+    // The layout the plan was compiled for. Empty if it wasn't.
+    int32_t mTag = 0;
+    std::vector<int32_t> mFields;
+
+    std::vector<Step> mSteps;
+
+    size_t mCompileCount = 0;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
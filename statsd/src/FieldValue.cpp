@@ -57,6 +57,77 @@ bool Field::matches(const Matcher& matcher) const {
     return false;
 }
 
+bool findPosRange(const int32_t* fields, int start, int end, int32_t depth, int32_t pos,
+                  int* first, int* last) {
+    const int32_t shift = 8 * (kMaxLogDepth - depth);
+    // As the positions are sorted, first and last are given by the number of positions lower
+    // than pos, and not greater than pos.
+    int numLower = 0;
+    int numNotGreater = 0;
+    int i = start;
+    bool pastPos = false;
+    for (; i + kFieldScanBlockSize <= end; i += kFieldScanBlockSize) {
+        int blockLower = 0;
+        int blockNotGreater = 0;
+        for (int j = 0; j < kFieldScanBlockSize; j++) {
+            const int32_t p = (fields[i + j] >> shift) & kClearLastBitDeco;
+            blockLower += p < pos;
+            blockNotGreater += p <= pos;
+        }
+        numLower += blockLower;
+        numNotGreater += blockNotGreater;
+        if (blockNotGreater < kFieldScanBlockSize) {
+            pastPos = true;
+            break;
+        }
+    }
+    for (; !pastPos && i < end; i++) {
+        const int32_t p = (fields[i] >> shift) & kClearLastBitDeco;
+        if (p > pos) {
+            break;
+        }
+        numLower += p < pos;
+        numNotGreater++;
+    }
+    if (numNotGreater == numLower) {
+        return false;
+    }
+    *first = start + numLower;
+    *last = start + numNotGreater;
+    return true;
+}
+
+bool anyFieldMatches(const int32_t* fields, int start, int end, int32_t tag,
+                     const std::vector<Matcher>& matchers) {
+    for (const Matcher& matcher : matchers) {
+        if (matcher.mMatcher.getTag() != tag) {
+            continue;
+        }
+        const int32_t target = matcher.mMatcher.getField();
+        const int32_t mask = matcher.mMask;
+        // Same as mask when the matcher has no ALL position.
+        const int32_t allPositionMask =
+                matcher.hasAllPositionMatcher() ? (mask & kClearAllPositionMatcherMask) : mask;
+        int i = start;
+        for (; i + kFieldScanBlockSize <= end; i += kFieldScanBlockSize) {
+            bool matched = false;
+            for (int j = 0; j < kFieldScanBlockSize; j++) {
+                matched |= ((fields[i + j] & mask) == target) |
+                           ((fields[i + j] & allPositionMask) == target);
+            }
+            if (matched) {
+                return true;
+            }
+        }
+        for (; i < end; i++) {
+            if ((fields[i] & mask) == target || (fields[i] & allPositionMask) == target) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 void translateFieldMatcher(int tag, const FieldMatcher& matcher, int depth, int* pos, int* mask,
                            std::vector<Matcher>* output) {
     if (depth > kMaxLogDepth) {
@@ -141,29 +212,54 @@ bool isPrimitiveRepeatedField(const Field& field) {
     return field.getDepth() == 1;
 }
 
-Value::Value(const Value& from) {
-    type = from.getType();
-    switch (type) {
-        case INT:
-            int_value = from.int_value;
-            break;
-        case LONG:
-            long_value = from.long_value;
-            break;
-        case FLOAT:
-            float_value = from.float_value;
-            break;
-        case DOUBLE:
-            double_value = from.double_value;
-            break;
-        case STRING:
-            str_value = from.str_value;
-            break;
-        case STORAGE:
-            storage_value = from.storage_value;
-            break;
-        default:
-            break;
+const std::string& ValuePayload::getString() const {
+    if (isView()) {
+        std::call_once(mCopyOnce, [this] { mValue = std::string(mBytes); });
+    }
+    return std::get<std::string>(mValue);
+}
+
+const std::vector<uint8_t>& ValuePayload::getStorage() const {
+    if (isView()) {
+        std::call_once(mCopyOnce, [this] {
+            mValue = std::vector<uint8_t>(mBytes.begin(), mBytes.end());
+        });
+    }
+    return std::get<std::vector<uint8_t>>(mValue);
+}
+
+const std::string& Value::getString() const {
+    static const std::string kEmptyString;
+    if (type != STRING || payload.get() == nullptr) {
+        return kEmptyString;
+    }
+    return payload->getString();
+}
+
+const std::vector<uint8_t>& Value::getStorage() const {
+    static const std::vector<uint8_t> kEmptyStorage;
+    if (type != STORAGE || payload.get() == nullptr) {
+        return kEmptyStorage;
+    }
+    return payload->getStorage();
+}
+
+std::string_view Value::getView() const {
+    if ((type != STRING && type != STORAGE) || payload.get() == nullptr) {
+        return std::string_view();
+    }
+    return payload->bytes();
+}
+
+void Value::detachPayload() {
+    if (payload.get() == nullptr || !payload->isView()) {
+        return;
+    }
+    const std::string_view bytes = payload->bytes();
+    if (type == STRING) {
+        payload = new ValuePayload(std::string(bytes));
+    } else {
+        payload = new ValuePayload(std::vector<uint8_t>(bytes.begin(), bytes.end()));
     }
 }
 
@@ -178,9 +274,9 @@ std::string Value::toString() const {
         case DOUBLE:
             return std::to_string(double_value) + "[D]";
         case STRING:
-            return str_value + "[S]";
+            return std::string(getView()) + "[S]";
         case STORAGE:
-            return "bytes of size " + std::to_string(storage_value.size()) + "[ST]";
+            return "bytes of size " + std::to_string(getView().size()) + "[ST]";
         default:
             return "[UNKNOWN]";
     }
@@ -197,9 +293,8 @@ bool Value::isZero() const {
         case DOUBLE:
             return fabs(double_value) <= std::numeric_limits<double>::epsilon();
         case STRING:
-            return str_value.size() == 0;
         case STORAGE:
-            return storage_value.size() == 0;
+            return getView().empty();
         default:
             return false;
     }
@@ -218,9 +313,9 @@ bool Value::operator==(const Value& that) const {
         case DOUBLE:
             return double_value == that.double_value;
         case STRING:
-            return str_value == that.str_value;
         case STORAGE:
-            return storage_value == that.storage_value;
+            // Copies of a value share its payload.
+            return payload == that.payload || getView() == that.getView();
         default:
             return false;
     }
@@ -238,9 +333,8 @@ bool Value::operator!=(const Value& that) const {
         case DOUBLE:
             return double_value != that.double_value;
         case STRING:
-            return str_value != that.str_value;
         case STORAGE:
-            return storage_value != that.storage_value;
+            return payload != that.payload && getView() != that.getView();
         default:
             return false;
     }
@@ -259,9 +353,8 @@ bool Value::operator<(const Value& that) const {
         case DOUBLE:
             return double_value < that.double_value;
         case STRING:
-            return str_value < that.str_value;
         case STORAGE:
-            return storage_value < that.storage_value;
+            return payload != that.payload && getView() < that.getView();
         default:
             return false;
     }
@@ -280,9 +373,8 @@ bool Value::operator>(const Value& that) const {
         case DOUBLE:
             return double_value > that.double_value;
         case STRING:
-            return str_value > that.str_value;
         case STORAGE:
-            return storage_value > that.storage_value;
+            return getView() > that.getView();
         default:
             return false;
     }
@@ -301,9 +393,8 @@ bool Value::operator>=(const Value& that) const {
         case DOUBLE:
             return double_value >= that.double_value;
         case STRING:
-            return str_value >= that.str_value;
         case STORAGE:
-            return storage_value >= that.storage_value;
+            return getView() >= that.getView();
         default:
             return false;
     }
@@ -344,33 +435,6 @@ Value Value::operator-(const Value& that) const {
     return v;
 }
 
-Value& Value::operator=(const Value& that) {
-    type = that.type;
-    switch (type) {
-        case INT:
-            int_value = that.int_value;
-            break;
-        case LONG:
-            long_value = that.long_value;
-            break;
-        case FLOAT:
-            float_value = that.float_value;
-            break;
-        case DOUBLE:
-            double_value = that.double_value;
-            break;
-        case STRING:
-            str_value = that.str_value;
-            break;
-        case STORAGE:
-            storage_value = that.storage_value;
-            break;
-        default:
-            break;
-    }
-    return *this;
-}
-
 Value& Value::operator+=(const Value& that) {
     if (type != that.type) {
         ALOGE("Can't operate on different value types, %d, %d", type, that.type);
@@ -435,10 +499,8 @@ size_t Value::getSize() const {
             size = sizeof(double);
             break;
         case STRING:
-            size = sizeof(char) * str_value.length();
-            break;
         case STORAGE:
-            size = sizeof(uint8_t) * storage_value.size();
+            size = getView().size();
             break;
         default:
             break;
@@ -15,6 +15,14 @@
  */
 #pragma once
 
+#include <utils/LightRefBase.h>
+#include <utils/StrongPointer.h>
+
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <variant>
+
 #include "src/statsd_config.pb.h"
 #include "annotations.h"
 
@@ -262,12 +270,111 @@ inline Matcher getFirstUidMatcher(int32_t atomId) {
     return Matcher(Field(atomId, pos, 2), 0xff7f7f7f);
 }
 
+/**
+ * Scans over the encoded fields of an atom stored contiguously, see LogEvent::getFieldIndex().
+ * The fields are processed kFieldScanBlockSize at a time in fixed-size loops, which the compiler
+ * vectorizes.
+ */
+const int kFieldScanBlockSize = 8;
+
+/**
+ * Finds the range [*first, *last) of the fields in [start, end) whose position at [depth] is
+ * [pos]. The positions at [depth] must be non-decreasing in [start, end), which holds for the
+ * fields of a LogEvent that share the same path up to [depth].
+ *
+ * Returns false if there is no such field.
+ */
+bool findPosRange(const int32_t* fields, int start, int end, int32_t depth, int32_t pos,
+                  int* first, int* last);
+
+/**
+ * Returns true if any of the fields in [start, end) of an atom with the given [tag] matches any
+ * of the [matchers], see Field::matches().
+ */
+bool anyFieldMatches(const int32_t* fields, int start, int end, int32_t tag,
+                     const std::vector<Matcher>& matchers);
+
+/**
+ * Immutable string or bytes payload of a Value. Copies of a Value share the same payload, so
+ * copying FieldValues never copies strings or bytes.
+ *
+ * A payload can also be a view into the bytes of another payload, typically the serialized atom
+ * a LogEvent was parsed from, which it keeps alive. The bytes of a view are only copied out if
+ * getString() or getStorage() is called, see Value::detachPayload().
+ *
+ * Interned strings are shared by all values holding the same string, and know their hash, see
+ * StringValueInterner.
+ */
+class ValuePayload : public LightRefBase<ValuePayload> {
+public:
+    explicit ValuePayload(std::string v) : mValue(std::move(v)) {
+        mBytes = std::get<std::string>(mValue);
+    }
+
+    /**
+     * [hash] must be std::hash<std::string_view>() of [v].
+     */
+    ValuePayload(std::string v, size_t hash) : mHash(hash), mValue(std::move(v)) {
+        mBytes = std::get<std::string>(mValue);
+    }
+
+    explicit ValuePayload(std::vector<uint8_t> v) : mValue(std::move(v)) {
+        const auto& storage = std::get<std::vector<uint8_t>>(mValue);
+        mBytes = std::string_view((const char*)storage.data(), storage.size());
+    }
+
+    /**
+     * View of [bytes], which must be a range of the bytes of [buffer].
+     */
+    ValuePayload(sp<const ValuePayload> buffer, std::string_view bytes)
+        : mBuffer(std::move(buffer)), mBytes(bytes) {
+    }
+
+    ValuePayload(const ValuePayload&) = delete;
+    ValuePayload& operator=(const ValuePayload&) = delete;
+
+    // Raw bytes of the string or byte array, without copying them.
+    inline std::string_view bytes() const {
+        return mBytes;
+    }
+
+    inline bool isView() const {
+        return mBuffer != nullptr;
+    }
+
+    // std::hash<std::string_view>() of the bytes.
+    inline size_t hash() const {
+        return mHash ? *mHash : std::hash<std::string_view>()(mBytes);
+    }
+
+    // The bytes as a string. Views copy their bytes on the first call.
+    const std::string& getString() const;
+
+    // The bytes as a byte array. Views copy their bytes on the first call.
+    const std::vector<uint8_t>& getStorage() const;
+
+private:
+    // Payload that mBytes points into, for views. Null otherwise.
+    const sp<const ValuePayload> mBuffer;
+
+    std::string_view mBytes;
+
+    // Set for interned payloads.
+    const std::optional<size_t> mHash;
+
+    // Owned copy of mBytes. Filled lazily for views.
+    mutable std::once_flag mCopyOnce;
+    mutable std::variant<std::monostate, std::string, std::vector<uint8_t>> mValue;
+};
+
 /**
  * A wrapper for a union type to contain multiple types of values.
  *
+ * Numeric values are stored inline. Strings and bytes are stored in a shared ValuePayload, which
+ * keeps a Value at 24 bytes and a FieldValue well within a cache line.
  */
 struct Value {
-    Value() : type(UNKNOWN) {}
+    Value() : long_value(0), type(UNKNOWN) {}
 
     Value(int32_t v) {
         int_value = v;
@@ -289,34 +396,39 @@ struct Value {
         type = DOUBLE;
     }
 
-    Value(const std::string& v) {
-        str_value = v;
-        type = STRING;
+    Value(std::string v) : long_value(0), type(STRING), payload(new ValuePayload(std::move(v))) {
+    }
+
+    Value(std::vector<uint8_t> v)
+        : long_value(0), type(STORAGE), payload(new ValuePayload(std::move(v))) {
     }
 
-    Value(const std::vector<uint8_t>& v) {
-        storage_value = v;
-        type = STORAGE;
+    // [t] must be STRING or STORAGE.
+    Value(Type t, sp<const ValuePayload> p) : long_value(0), type(t), payload(std::move(p)) {
     }
 
     void setInt(int32_t v) {
         int_value = v;
         type = INT;
+        payload.clear();
     }
 
     void setLong(int64_t v) {
         long_value = v;
         type = LONG;
+        payload.clear();
     }
 
     void setFloat(float v) {
         float_value = v;
         type = FLOAT;
+        payload.clear();
     }
 
     void setDouble(double v) {
         double_value = v;
         type = DOUBLE;
+        payload.clear();
     }
 
     union {
@@ -325,11 +437,27 @@ struct Value {
         float float_value;
         double double_value;
     };
-    std::string str_value;
-    std::vector<uint8_t> storage_value;
 
     Type type;
 
+    // Set iff type is STRING or STORAGE.
+    sp<const ValuePayload> payload;
+
+    // Returns the string value, or an empty string if type is not STRING.
+    const std::string& getString() const;
+
+    // Returns the bytes value, or an empty vector if type is not STORAGE.
+    const std::vector<uint8_t>& getStorage() const;
+
+    // Returns the raw bytes of a STRING or STORAGE value without copying them, or an empty view
+    // for the other types. Valid as long as this Value or a copy of it is.
+    std::string_view getView() const;
+
+    // Replaces a payload that is a view into a larger buffer by an owned copy of its bytes, so
+    // that the value no longer keeps the buffer alive. Must be called before values parsed from
+    // a LogEvent are stored for longer than the event.
+    void detachPayload();
+
     std::string toString() const;
 
     bool isZero() const;
@@ -342,8 +470,6 @@ struct Value {
 
     size_t getSize() const;
 
-    Value(const Value& from);
-
     bool operator==(const Value& that) const;
     bool operator!=(const Value& that) const;
 
@@ -352,7 +478,6 @@ struct Value {
     bool operator>=(const Value& that) const;
     Value operator-(const Value& that) const;
     Value& operator+=(const Value& that);
-    Value& operator=(const Value& that);
 };
 
 class Annotations {
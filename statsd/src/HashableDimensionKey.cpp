@@ -17,7 +17,13 @@
 #include "Log.h"
 
 #include "HashableDimensionKey.h"
+#include "DimensionExtractionPlan.h"
 #include "FieldValue.h"
+#include "hash.h"
+
+#include <string.h>
+
+#include <algorithm>
 
 namespace android {
 namespace os {
@@ -70,7 +76,7 @@ static void populateStatsDimensionsValueParcelChildren(StatsDimensionsValueParce
                     break;
                 case STRING:
                     child.valueType = STATS_DIMENSIONS_VALUE_STRING_TYPE;
-                    child.stringValue = dim.mValue.str_value;
+                    child.stringValue = dim.mValue.getString();
                     break;
                 default:
                     ALOGE("Encountered FieldValue with unsupported value type.");
@@ -111,35 +117,63 @@ StatsDimensionsValueParcel HashableDimensionKey::toStatsDimensionsValueParcel()
     return root;
 }
 
-android::hash_t hashDimension(const HashableDimensionKey& value) {
-    android::hash_t hash = 0;
-    for (const auto& fieldValue : value.getValues()) {
-        hash = android::JenkinsHashMix(hash, android::hash_type((int)fieldValue.mField.getField()));
-        hash = android::JenkinsHashMix(hash, android::hash_type((int)fieldValue.mField.getTag()));
-        hash = android::JenkinsHashMix(hash, android::hash_type((int)fieldValue.mValue.getType()));
-        switch (fieldValue.mValue.getType()) {
-            case INT:
-                hash = android::JenkinsHashMix(hash,
-                                               android::hash_type(fieldValue.mValue.int_value));
-                break;
-            case LONG:
-                hash = android::JenkinsHashMix(hash,
-                                               android::hash_type(fieldValue.mValue.long_value));
-                break;
-            case STRING:
-                hash = android::JenkinsHashMix(hash, static_cast<uint32_t>(std::hash<std::string>()(
-                                                             fieldValue.mValue.str_value)));
-                break;
-            case FLOAT: {
-                hash = android::JenkinsHashMix(hash,
-                                               android::hash_type(fieldValue.mValue.float_value));
-                break;
-            }
-            default:
-                break;
+namespace {
+
+// Words that hashDimension() packs for each FieldValue: the tag and field, the type, the value.
+const size_t kWordsPerValue = 3;
+
+// Keys with up to this many values are packed on the stack.
+const size_t kMaxInlineValues = 16;
+
+uint64_t packedValue(const Value& value) {
+    switch (value.getType()) {
+        case INT:
+            return (uint64_t)value.int_value;
+        case LONG:
+            return (uint64_t)value.long_value;
+        case FLOAT: {
+            uint32_t bits;
+            memcpy(&bits, &value.float_value, sizeof(bits));
+            return bits;
         }
+        case STRING:
+            // Interned strings don't need to be hashed again.
+            return value.payload != nullptr ? value.payload->hash()
+                                            : std::hash<std::string_view>()(std::string_view());
+        default:
+            return 0;
+    }
+}
+
+}  // anonymous namespace
+
+uint64_t hashDimension(const HashableDimensionKey& value) {
+    return hashFieldValues(value.getValues());
+}
+
+uint64_t hashFieldValues(const vector<FieldValue>& values) {
+    uint64_t inlineWords[kMaxInlineValues * kWordsPerValue];
+    vector<uint64_t> heapWords;
+    uint64_t* words = inlineWords;
+    if (values.size() > kMaxInlineValues) {
+        heapWords.resize(values.size() * kWordsPerValue);
+        words = heapWords.data();
+    }
+    size_t count = 0;
+    for (const auto& fieldValue : values) {
+        words[count++] = ((uint64_t)(uint32_t)fieldValue.mField.getTag() << 32) |
+                         (uint32_t)fieldValue.mField.getField();
+        words[count++] = (uint64_t)fieldValue.mValue.getType();
+        words[count++] = packedValue(fieldValue.mValue);
     }
-    return JenkinsHashWhiten(hash);
+    const uint64_t hash = Hash64(reinterpret_cast<const char*>(words), count * sizeof(uint64_t));
+    // 0 marks keys without a cached hash, see HashableDimensionKey::getHash().
+    return hash != 0 ? hash : 1;
+}
+
+uint64_t hashValue(const Value& value) {
+    const uint64_t words[] = {(uint64_t)value.getType(), packedValue(value)};
+    return Hash64(reinterpret_cast<const char*>(words), sizeof(words));
 }
 
 bool filterValues(const Matcher& matcherField, const vector<FieldValue>& values,
@@ -154,17 +188,30 @@ bool filterValues(const Matcher& matcherField, const vector<FieldValue>& values,
 }
 
 bool filterValues(const vector<Matcher>& matcherFields, const vector<FieldValue>& values,
-                  HashableDimensionKey* output) {
+                  HashableDimensionKey* output, const int32_t* fieldIndex) {
     size_t num_matches = 0;
-    for (const auto& value : values) {
-        for (size_t i = 0; i < matcherFields.size(); ++i) {
-            const auto& matcher = matcherFields[i];
-            if (value.mField.matches(matcher)) {
-                output->addValue(value);
-                output->mutableValue(num_matches)->mField.setTag(value.mField.getTag());
-                output->mutableValue(num_matches)->mField.setField(
-                    value.mField.getField() & matcher.mMask);
-                num_matches++;
+    const int numValues = values.size();
+    // With the field index, blocks of values that no matcher matches are skipped without
+    // reading the values. All values of an event share its tag.
+    const int blockSize = fieldIndex != nullptr ? kFieldScanBlockSize : numValues;
+    for (int start = 0; start < numValues; start += blockSize) {
+        const int end = std::min(start + blockSize, numValues);
+        if (fieldIndex != nullptr && !anyFieldMatches(fieldIndex, start, end,
+                                                      values[start].mField.getTag(),
+                                                      matcherFields)) {
+            continue;
+        }
+        for (int v = start; v < end; v++) {
+            const FieldValue& value = values[v];
+            for (size_t i = 0; i < matcherFields.size(); ++i) {
+                const auto& matcher = matcherFields[i];
+                if (value.mField.matches(matcher)) {
+                    output->addValue(value);
+                    output->mutableValue(num_matches)->mField.setTag(value.mField.getTag());
+                    output->mutableValue(num_matches)->mField.setField(
+                        value.mField.getField() & matcher.mMask);
+                    num_matches++;
+                }
             }
         }
     }
@@ -227,9 +274,14 @@ void filterGaugeValues(const std::vector<Matcher>& matcherFields,
 
 void getDimensionForCondition(const std::vector<FieldValue>& eventValues,
                               const Metric2Condition& links,
-                              HashableDimensionKey* conditionDimension) {
+                              HashableDimensionKey* conditionDimension,
+                              const int32_t* fieldIndex, DimensionExtractionPlan* plan) {
     // Get the dimension first by using dimension from what.
-    filterValues(links.metricFields, eventValues, conditionDimension);
+    if (plan != nullptr) {
+        plan->extract(links.metricFields, eventValues, fieldIndex, conditionDimension);
+    } else {
+        filterValues(links.metricFields, eventValues, conditionDimension, fieldIndex);
+    }
 
     size_t count = conditionDimension->getValues().size();
     if (count != links.conditionFields.size()) {
@@ -245,10 +297,15 @@ void getDimensionForCondition(const std::vector<FieldValue>& eventValues,
 }
 
 void getDimensionForState(const std::vector<FieldValue>& eventValues, const Metric2State& link,
-                          HashableDimensionKey* statePrimaryKey) {
+                          HashableDimensionKey* statePrimaryKey, const int32_t* fieldIndex,
+                          DimensionExtractionPlan* plan) {
     // First, get the dimension from the event using the "what" fields from the
     // MetricStateLinks.
-    filterValues(link.metricFields, eventValues, statePrimaryKey);
+    if (plan != nullptr) {
+        plan->extract(link.metricFields, eventValues, fieldIndex, statePrimaryKey);
+    } else {
+        filterValues(link.metricFields, eventValues, statePrimaryKey, fieldIndex);
+    }
 
     // Then check that the statePrimaryKey size equals the number of state fields
     size_t count = statePrimaryKey->getValues().size();
@@ -327,6 +384,12 @@ bool HashableDimensionKey::operator==(const HashableDimensionKey& that) const {
     if (mValues.size() != that.getValues().size()) {
         return false;
     }
+    // Keys found in a hash map usually have their hash cached already.
+    const uint64_t hash = mHash.load(std::memory_order_relaxed);
+    const uint64_t thatHash = that.mHash.load(std::memory_order_relaxed);
+    if (hash != 0 && thatHash != 0 && hash != thatHash) {
+        return false;
+    }
     size_t count = mValues.size();
     for (size_t i = 0; i < count; i++) {
         if (mValues[i] != (that.getValues())[i]) {
@@ -18,9 +18,12 @@
 
 #include <aidl/android/os/StatsDimensionsValueParcel.h>
 #include <utils/JenkinsHash.h>
+
+#include <atomic>
 #include <vector>
 #include "android-base/stringprintf.h"
 #include "FieldValue.h"
+#include "hash.h"
 #include "logd/LogEvent.h"
 
 namespace android {
@@ -50,35 +53,92 @@ struct Metric2State {
     std::vector<Matcher> stateFields;
 };
 
+class DimensionExtractionPlan;
+class HashableDimensionKey;
+
+// Hashes the values of [key] in one pass over a packed copy of them. Never returns 0.
+uint64_t hashDimension(const HashableDimensionKey& key);
+
+// Same as above, for values that are not in a key.
+uint64_t hashFieldValues(const std::vector<FieldValue>& values);
+
+// Hashes [value] alone, so that the hash doesn't depend on its field.
+uint64_t hashValue(const Value& value);
+
+// Dimension keys outlive the events they are built from, so string and bytes values that are
+// views into an event's buffer are copied when added, see Value::detachPayload().
+//
+// Keys are probed in several dimension maps per event, so their hash is computed once and cached
+// until their values are modified.
 class HashableDimensionKey {
 public:
     explicit HashableDimensionKey(const std::vector<FieldValue>& values) {
         mValues = values;
+        for (auto& value : mValues) {
+            value.mValue.detachPayload();
+        }
     }
 
     HashableDimensionKey() {};
 
-    HashableDimensionKey(const HashableDimensionKey& that) : mValues(that.getValues()){};
+    HashableDimensionKey(const HashableDimensionKey& that)
+        : mValues(that.getValues()), mHash(that.mHash.load(std::memory_order_relaxed)){};
+
+    HashableDimensionKey& operator=(const HashableDimensionKey& that) {
+        mValues = that.getValues();
+        mHash.store(that.mHash.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
 
     inline void addValue(const FieldValue& value) {
         mValues.push_back(value);
+        mValues.back().mValue.detachPayload();
+        invalidateHash();
+    }
+
+    // Same as addValue(), with the field of the added value replaced by [field].
+    inline void addValueWithField(const FieldValue& value, int32_t field) {
+        addValue(value);
+        mValues.back().mField.setField(field);
+    }
+
+    inline void reserve(size_t size) {
+        mValues.reserve(size);
     }
 
     inline const std::vector<FieldValue>& getValues() const {
         return mValues;
     }
 
-    inline std::vector<FieldValue>* mutableValues() {
-        return &mValues;
+    // Estimated heap bytes of the values, see hashMapEntryByteSize().
+    inline size_t getValuesByteSize() const {
+        return mValues.capacity() * sizeof(FieldValue);
+    }
+
+    // Removes the values, keeping the capacity for the next ones.
+    inline void clear() {
+        mValues.clear();
+        invalidateHash();
     }
 
     inline FieldValue* mutableValue(size_t i) {
         if (i >= 0 && i < mValues.size()) {
+            invalidateHash();
             return &(mValues[i]);
         }
         return nullptr;
     }
 
+    // Returns hashDimension() of this key, computed once until the values are modified.
+    inline uint64_t getHash() const {
+        uint64_t hash = mHash.load(std::memory_order_relaxed);
+        if (hash == 0) {
+            hash = hashDimension(*this);
+            mHash.store(hash, std::memory_order_relaxed);
+        }
+        return hash;
+    }
+
     StatsDimensionsValueParcel toStatsDimensionsValueParcel() const;
 
     std::string toString() const;
@@ -92,7 +152,15 @@ public:
     bool contains(const HashableDimensionKey& that) const;
 
 private:
+    inline void invalidateHash() {
+        mHash.store(0, std::memory_order_relaxed);
+    }
+
     std::vector<FieldValue> mValues;
+
+    // See getHash(), 0 until it is computed. Atomic because const keys, like
+    // DEFAULT_DIMENSION_KEY, may be hashed by several threads; they all store the same value.
+    mutable std::atomic<uint64_t> mHash = 0;
 };
 
 class MetricDimensionKey {
@@ -119,6 +187,10 @@ public:
         return mStateValuesKey;
     }
 
+    inline HashableDimensionKey* getMutableDimensionKeyInWhat() {
+        return &mDimensionKeyInWhat;
+    }
+
     inline HashableDimensionKey* getMutableStateValuesKey() {
         return &mStateValuesKey;
     }
@@ -131,6 +203,10 @@ public:
         return mStateValuesKey.getValues().size() > 0;
     }
 
+    inline size_t getValuesByteSize() const {
+        return mDimensionKeyInWhat.getValuesByteSize() + mStateValuesKey.getValuesByteSize();
+    }
+
     bool operator==(const MetricDimensionKey& that) const;
 
     bool operator<(const MetricDimensionKey& that) const;
@@ -140,6 +216,17 @@ private:
     HashableDimensionKey mStateValuesKey;
 };
 
+// Estimated bytes of a hash map node besides its key and value: the next pointer and the cached
+// hash.
+const size_t kHashMapNodeOverheadBytes = 2 * sizeof(void*);
+
+// Estimated heap bytes of the entry of [key] in a hash map of [valueSize] bytes values, including
+// the values of the key but not the heap memory of the value.
+template <typename Key>
+inline size_t hashMapEntryByteSize(const Key& key, size_t valueSize) {
+    return kHashMapNodeOverheadBytes + sizeof(Key) + key.getValuesByteSize() + valueSize;
+}
+
 class AtomDimensionKey {
 public:
     explicit AtomDimensionKey(const int32_t atomTag, const HashableDimensionKey& atomFieldValues)
@@ -162,8 +249,6 @@ private:
     HashableDimensionKey mAtomFieldValues;
 };
 
-android::hash_t hashDimension(const HashableDimensionKey& key);
-
 /**
  * Returns true if a FieldValue field matches the matcher field.
  * The value of the FieldValue is output.
@@ -180,9 +265,11 @@ bool filterValues(const Matcher& matcherField, const std::vector<FieldValue>& va
  * In another event, uid 1000 is at position 6, and it's the last
  * these 2 events should be mapped to the same dimension.  So we will remove the original position
  * from the dimension key for the uid field (by applying 0x80 bit mask).
+ *
+ * [fieldIndex], if not null, holds the encoded fields of [values], see LogEvent::getFieldIndex().
  */
 bool filterValues(const std::vector<Matcher>& matcherFields, const std::vector<FieldValue>& values,
-                  HashableDimensionKey* output);
+                  HashableDimensionKey* output, const int32_t* fieldIndex = nullptr);
 
 /**
  * Filters FieldValues to create HashableDimensionKey using dimensions matcher fields and create
@@ -227,16 +314,26 @@ bool filterPrimaryKey(const std::vector<FieldValue>& values, HashableDimensionKe
 void filterGaugeValues(const std::vector<Matcher>& matchers, const std::vector<FieldValue>& values,
                        std::vector<FieldValue>* output);
 
+/**
+ * [plan], if not null, is the plan of links.metricFields used to filter the values, see
+ * DimensionExtractionPlan.
+ */
 void getDimensionForCondition(const std::vector<FieldValue>& eventValues,
                               const Metric2Condition& links,
-                              HashableDimensionKey* conditionDimension);
+                              HashableDimensionKey* conditionDimension,
+                              const int32_t* fieldIndex = nullptr,
+                              DimensionExtractionPlan* plan = nullptr);
 
 /**
  * Get dimension values using metric's "what" fields and fill statePrimaryKey's
  * mField information using "state" fields.
+ *
+ * [plan], if not null, is the plan of link.metricFields used to filter the values.
  */
 void getDimensionForState(const std::vector<FieldValue>& eventValues, const Metric2State& link,
-                          HashableDimensionKey* statePrimaryKey);
+                          HashableDimensionKey* statePrimaryKey,
+                          const int32_t* fieldIndex = nullptr,
+                          DimensionExtractionPlan* plan = nullptr);
 
 /**
  * Returns true if the primaryKey values are a subset of the whatKey values.
@@ -277,25 +374,25 @@ using android::os::statsd::MetricDimensionKey;
 template <>
 struct hash<HashableDimensionKey> {
     std::size_t operator()(const HashableDimensionKey& key) const {
-        return hashDimension(key);
+        return key.getHash();
     }
 };
 
 template <>
 struct hash<MetricDimensionKey> {
     std::size_t operator()(const MetricDimensionKey& key) const {
-        android::hash_t hash = hashDimension(key.getDimensionKeyInWhat());
-        hash = android::JenkinsHashMix(hash, hashDimension(key.getStateValuesKey()));
-        return android::JenkinsHashWhiten(hash);
+        const uint64_t hashes[] = {key.getDimensionKeyInWhat().getHash(),
+                                   key.getStateValuesKey().getHash()};
+        return android::os::statsd::Hash64(reinterpret_cast<const char*>(hashes), sizeof(hashes));
     }
 };
 
 template <>
 struct hash<AtomDimensionKey> {
     std::size_t operator()(const AtomDimensionKey& key) const {
-        android::hash_t hash = hashDimension(key.getAtomFieldValues());
-        hash = android::JenkinsHashMix(hash, key.getAtomTag());
-        return android::JenkinsHashWhiten(hash);
+        const uint64_t hashes[] = {key.getAtomFieldValues().getHash(),
+                                   (uint64_t)key.getAtomTag()};
+        return android::os::statsd::Hash64(reinterpret_cast<const char*>(hashes), sizeof(hashes));
     }
 };
 }  // namespace std
@@ -19,6 +19,7 @@
 
 #include "StatsLogProcessor.h"
 
+#include <algorithm>
 #include <android-base/file.h>
 #include <cutils/multiuser.h>
 #include <src/active_config_list.pb.h>
@@ -26,6 +27,7 @@
 
 #include "StatsService.h"
 #include "android-base/stringprintf.h"
+#include "condition/SharedConditionState.h"
 #include "external/StatsPullerManager.h"
 #include "flags/FlagProvider.h"
 #include "guardrail/StatsdStats.h"
@@ -36,6 +38,7 @@
 #include "stats_util.h"
 #include "statslog_statsd.h"
 #include "storage/StorageManager.h"
+#include "utils/ScopedTrace.h"
 
 using namespace android;
 using android::base::StringPrintf;
@@ -93,6 +96,7 @@ StatsLogProcessor::StatsLogProcessor(const sp<UidMap>& uidMap,
                                      const std::function<bool(
                                             const int&, const vector<int64_t>&)>& activateBroadcast)
     : mUidMap(uidMap),
+      mIsolatedUids(uidMap),
       mPullerManager(pullerManager),
       mAnomalyAlarmMonitor(anomalyAlarmMonitor),
       mPeriodicAlarmMonitor(periodicAlarmMonitor),
@@ -139,17 +143,34 @@ void StatsLogProcessor::onPeriodicAlarmFired(
 }
 
 void StatsLogProcessor::mapIsolatedUidToHostUidIfNecessaryLocked(LogEvent* event) const {
+    mIsolatedUids.refresh();
+    if (mIsolatedUids.empty()) {
+        return;
+    }
+    const vector<FieldValue>& fieldValues = event->getValues();
     if (std::pair<size_t, size_t> indexRange; event->hasAttributionChain(&indexRange)) {
-        vector<FieldValue>* const fieldValues = event->getMutableValues();
         for (size_t i = indexRange.first; i <= indexRange.second; i++) {
-            FieldValue& fieldValue = fieldValues->at(i);
+            const FieldValue& fieldValue = fieldValues.at(i);
             if (isAttributionUidField(fieldValue)) {
-                const int hostUid = mUidMap->getHostUidOrSelf(fieldValue.mValue.int_value);
-                fieldValue.mValue.setInt(hostUid);
+                const int uid = fieldValue.mValue.int_value;
+                const int hostUid = mIsolatedUids.getHostUidOrSelf(uid);
+                if (hostUid != uid) {
+                    event->getMutableValue(i).setInt(hostUid);
+                }
             }
         }
-    } else {
-        mapIsolatedUidsToHostUidInLogEvent(mUidMap, *event);
+        return;
+    }
+    uint8_t remainingUidCount = event->getNumUidFields();
+    for (size_t i = 0; i < fieldValues.size() && remainingUidCount > 0; i++) {
+        if (isUidField(fieldValues[i])) {
+            const int uid = fieldValues[i].mValue.int_value;
+            const int hostUid = mIsolatedUids.getHostUidOrSelf(uid);
+            if (hostUid != uid) {
+                event->getMutableValue(i).setInt(hostUid);
+            }
+            remainingUidCount--;
+        }
     }
 }
 
@@ -159,6 +180,8 @@ void StatsLogProcessor::onIsolatedUidChangedEventLocked(const LogEvent& event) {
     auto parent_uid = int(event.GetLong(1, &err2));
     auto isolated_uid = int(event.GetLong(2, &err3));
     if (err == NO_ERROR && err2 == NO_ERROR && err3 == NO_ERROR) {
+        // Not holding the snapshot lets the uid map change its map in place.
+        mIsolatedUids.reset();
         if (is_create) {
             mUidMap->assignIsolatedUid(isolated_uid, parent_uid);
         } else {
@@ -238,7 +261,7 @@ void StatsLogProcessor::getAndUpdateTrainInfoOnDisk(bool is_rollback,
     }
     bool readTrainInfoSuccess = false;
     InstallTrainInfo trainInfoOnDisk;
-    readTrainInfoSuccess = StorageManager::readTrainInfo(trainInfo->trainName, trainInfoOnDisk);
+    readTrainInfoSuccess = readTrainInfoLocked(trainInfo->trainName, &trainInfoOnDisk);
 
     bool resetExperimentIds = false;
     if (readTrainInfoSuccess) {
@@ -293,7 +316,7 @@ void StatsLogProcessor::getAndUpdateTrainInfoOnDisk(bool is_rollback,
         trainInfo->requiresLowLatencyMonitor = trainInfoOnDisk.requiresLowLatencyMonitor;
     }
 
-    StorageManager::writeTrainInfo(*trainInfo);
+    writeTrainInfoLocked(*trainInfo);
 }
 
 void StatsLogProcessor::onWatchdogRollbackOccurredLocked(LogEvent* event) {
@@ -333,7 +356,7 @@ vector<int64_t> StatsLogProcessor::processWatchdogRollbackOccurred(const int32_t
     bool readTrainInfoSuccess = false;
     InstallTrainInfo trainInfoOnDisk;
     // We use the package name of the event as the train name.
-    readTrainInfoSuccess = StorageManager::readTrainInfo(packageNameIn, trainInfoOnDisk);
+    readTrainInfoSuccess = readTrainInfoLocked(packageNameIn, &trainInfoOnDisk);
 
     if (!readTrainInfoSuccess) {
         return vector<int64_t>();
@@ -350,19 +373,44 @@ vector<int64_t> StatsLogProcessor::processWatchdogRollbackOccurred(const int32_t
             if (find(ids.begin(), ids.end(), firstId + 4) == ids.end()) {
                 ids.push_back(firstId + 4);
             }
-            StorageManager::writeTrainInfo(trainInfoOnDisk);
+            writeTrainInfoLocked(trainInfoOnDisk);
             break;
       case android::os::statsd::util::WATCHDOG_ROLLBACK_OCCURRED__ROLLBACK_TYPE__ROLLBACK_SUCCESS:
             if (find(ids.begin(), ids.end(), firstId + 5) == ids.end()) {
                 ids.push_back(firstId + 5);
             }
-            StorageManager::writeTrainInfo(trainInfoOnDisk);
+            writeTrainInfoLocked(trainInfoOnDisk);
             break;
     }
 
     return trainInfoOnDisk.experimentIds;
 }
 
+bool StatsLogProcessor::readTrainInfoLocked(const string& trainName,
+                                            InstallTrainInfo* trainInfo) {
+    if (!mTrainInfosLoaded) {
+        for (InstallTrainInfo& trainInfoOnDisk : StorageManager::readAllTrainInfo()) {
+            mTrainInfos[trainInfoOnDisk.trainName] = std::move(trainInfoOnDisk);
+        }
+        mTrainInfosLoaded = true;
+        VLOG("Loaded %zu train infos", mTrainInfos.size());
+    }
+    auto it = mTrainInfos.find(trainName);
+    if (it == mTrainInfos.end()) {
+        return false;
+    }
+    *trainInfo = it->second;
+    return true;
+}
+
+void StatsLogProcessor::writeTrainInfoLocked(const InstallTrainInfo& trainInfo) {
+    if (trainInfo.trainName.empty()) {
+        return;
+    }
+    mTrainInfos[trainInfo.trainName] = trainInfo;
+    StorageManager::writeTrainInfo(trainInfo);
+}
+
 void StatsLogProcessor::resetConfigs() {
     std::lock_guard<std::mutex> lock(mMetricsMutex);
     resetConfigsLocked(getElapsedRealtimeNs());
@@ -381,15 +429,74 @@ void StatsLogProcessor::OnLogEvent(LogEvent* event) {
 }
 
 void StatsLogProcessor::OnLogEvent(LogEvent* event, int64_t elapsedRealtimeNs) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock(mMetricsMutex);
+    ScopedTrace trace("StatsLogProcessor::OnLogEvent", {{"atom", event->GetTagId()}});
 
+    if (!preprocessLogEventLocked(event)) {
+        return;
+    }
+    resetIfConfigTtlExpiredLocked(event->GetElapsedTimestampNs());
+    informAnomalyAlarmAndClearPullerCacheLocked(elapsedRealtimeNs);
+    mPullerManager->DispatchDeferredPulls(/*waitForPending=*/false);
+
+    std::unordered_set<int> uidsWithActiveConfigsChanged;
+    processLogEventLocked(event, &uidsWithActiveConfigsChanged);
+    onLogEventsProcessedLocked(elapsedRealtimeNs, uidsWithActiveConfigsChanged);
+    lock.unlock();
+    sendStreamedReports();
+    writeSpilledReports();
+}
+
+void StatsLogProcessor::OnLogEvents(const std::vector<std::unique_ptr<LogEvent>>& events) {
+    OnLogEvents(events, getElapsedRealtimeNs());
+}
+
+void StatsLogProcessor::OnLogEvents(const std::vector<std::unique_ptr<LogEvent>>& events,
+                                    int64_t elapsedRealtimeNs) {
+    std::unique_lock<std::mutex> lock(mMetricsMutex);
+    ScopedTrace trace("StatsLogProcessor::OnLogEvents", {{"count", (int64_t)events.size()}});
+
+    std::vector<LogEvent*> validEvents;
+    validEvents.reserve(events.size());
+    int64_t maxEventElapsedTimeNs = 0;
+    for (const auto& event : events) {
+        if (preprocessLogEventLocked(event.get())) {
+            validEvents.push_back(event.get());
+            maxEventElapsedTimeNs =
+                    std::max(maxEventElapsedTimeNs, event->GetElapsedTimestampNs());
+        }
+    }
+    if (validEvents.empty()) {
+        return;
+    }
+
+    // The TTL, anomaly alarm and puller cache checks are done once for the whole batch.
+    resetIfConfigTtlExpiredLocked(maxEventElapsedTimeNs);
+    informAnomalyAlarmAndClearPullerCacheLocked(elapsedRealtimeNs);
+    mPullerManager->DispatchDeferredPulls(/*waitForPending=*/false);
+
+    std::unordered_set<int> uidsWithActiveConfigsChanged;
+    if (mDispatchExecutor != nullptr && mMetricsManagers.size() > 1) {
+        processLogEventsInParallelLocked(validEvents, &uidsWithActiveConfigsChanged);
+    } else {
+        for (LogEvent* event : validEvents) {
+            processLogEventLocked(event, &uidsWithActiveConfigsChanged);
+        }
+    }
+    onLogEventsProcessedLocked(elapsedRealtimeNs, uidsWithActiveConfigsChanged);
+    lock.unlock();
+    sendStreamedReports();
+    writeSpilledReports();
+}
+
+bool StatsLogProcessor::preprocessLogEventLocked(LogEvent* event) {
     // Tell StatsdStats about new event
     const int64_t eventElapsedTimeNs = event->GetElapsedTimestampNs();
     int atomId = event->GetTagId();
     StatsdStats::getInstance().noteAtomLogged(atomId, eventElapsedTimeNs / NS_PER_SEC);
     if (!event->isValid()) {
         StatsdStats::getInstance().noteAtomError(atomId);
-        return;
+        return false;
     }
 
     // Hard-coded logic to update train info on disk and fill in any information
@@ -407,19 +514,11 @@ void StatsLogProcessor::OnLogEvent(LogEvent* event, int64_t elapsedRealtimeNs) {
     if (mPrintAllLogs) {
         ALOGI("%s", event->ToString().c_str());
     }
-    resetIfConfigTtlExpiredLocked(eventElapsedTimeNs);
-
-    // Hard-coded logic to update the isolated uid's in the uid-map.
-    // The field numbers need to be currently updated by hand with atoms.proto
-    if (atomId == android::os::statsd::util::ISOLATED_UID_CHANGED) {
-        onIsolatedUidChangedEventLocked(*event);
-    } else {
-        // Map the isolated uid to host uid if necessary.
-        mapIsolatedUidToHostUidIfNecessaryLocked(event);
-    }
-
-    StateManager::getInstance().onLogEvent(*event);
+    return true;
+}
 
+void StatsLogProcessor::informAnomalyAlarmAndClearPullerCacheLocked(
+        const int64_t elapsedRealtimeNs) {
     if (mMetricsManagers.empty()) {
         return;
     }
@@ -438,41 +537,198 @@ void StatsLogProcessor::OnLogEvent(LogEvent* event, int64_t elapsedRealtimeNs) {
         informAnomalyAlarmFiredLocked(NanoToMillis(elapsedRealtimeNs));
     }
 
-    int64_t curTimeSec = getElapsedRealtimeSec();
+    int64_t curTimeSec = elapsedRealtimeNs / NS_PER_SEC;
     if (curTimeSec - mLastPullerCacheClearTimeSec > StatsdStats::kPullerCacheClearIntervalSec) {
         mPullerManager->ClearPullerCacheIfNecessary(curTimeSec * NS_PER_SEC);
         mLastPullerCacheClearTimeSec = curTimeSec;
     }
+}
 
-    std::unordered_set<int> uidsWithActiveConfigsChanged;
-    std::unordered_map<int, std::vector<int64_t>> activeConfigsPerUid;
-    // pass the event to metrics managers.
-    for (auto& pair : mMetricsManagers) {
-        int uid = pair.first.GetUid();
-        int64_t configId = pair.first.GetId();
-        bool isPrevActive = pair.second->isActive();
-        pair.second->onLogEvent(*event);
-        bool isCurActive = pair.second->isActive();
-        // Map all active configs by uid.
-        if (isCurActive) {
-            auto activeConfigs = activeConfigsPerUid.find(uid);
-            if (activeConfigs != activeConfigsPerUid.end()) {
-                activeConfigs->second.push_back(configId);
-            } else {
-                vector<int64_t> newActiveConfigs;
-                newActiveConfigs.push_back(configId);
-                activeConfigsPerUid[uid] = newActiveConfigs;
+void StatsLogProcessor::setParallelDispatchThreads(size_t numThreads) {
+    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    mDispatchExecutor = numThreads > 0 ? std::make_unique<ParallelExecutor>(numThreads) : nullptr;
+    // The managers no longer get each event one after the other.
+    SharedConditionStateRegistry::getInstance().setEnabled(numThreads == 0);
+}
+
+void StatsLogProcessor::setCheckpointPeriodNs(int64_t periodNs) {
+    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    mCheckpointPeriodNs = periodNs;
+}
+
+void StatsLogProcessor::setReportStream(const ConfigKey& key,
+                                        const ReportStreamCallback& callback) {
+    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    mReportStreams[key] = std::make_shared<ReportStreamCallback>(callback);
+}
+
+void StatsLogProcessor::removeReportStream(const ConfigKey& key) {
+    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    mReportStreams.erase(key);
+}
+
+void StatsLogProcessor::setLogEventFilter(const std::shared_ptr<LogEventFilter>& filter) {
+    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    mLogEventFilter = filter;
+    updateLogEventFilterLocked();
+}
+
+void StatsLogProcessor::updateLogEventFilterLocked() const {
+    if (mLogEventFilter == nullptr) {
+        return;
+    }
+    // Printed logs must show all atoms.
+    mLogEventFilter->setFilteringEnabled(!mPrintAllLogs);
+
+    // Atoms with hard-coded handling, see preprocessLogEventLocked() and
+    // updateSharedStateLocked().
+    LogEventFilter::AtomIdSet atomIds = {
+            android::os::statsd::util::BINARY_PUSH_STATE_CHANGED,
+            android::os::statsd::util::WATCHDOG_ROLLBACK_OCCURRED,
+            android::os::statsd::util::ISOLATED_UID_CHANGED,
+    };
+    StateManager::getInstance().addAllAtomIds(&atomIds);
+    for (const auto& [_, metricsManager] : mMetricsManagers) {
+        metricsManager->addAllAtomIds(&atomIds);
+    }
+    mLogEventFilter->setAtomIds(std::move(atomIds), this);
+}
+
+void StatsLogProcessor::onMetricsManagersChangedLocked() {
+    mMetricsManagersByAtomId.clear();
+    std::unordered_set<int> atomIds;
+    for (const auto& pair : mMetricsManagers) {
+        atomIds.clear();
+        pair.second->addAllAtomIds(&atomIds);
+        for (int atomId : atomIds) {
+            mMetricsManagersByAtomId[atomId].push_back(pair);
+        }
+    }
+    // The activations of the new and updated configs are recomputed on their next event.
+    mNextActivationExpiryNs = std::numeric_limits<int64_t>::min();
+    updateLogEventFilterLocked();
+    publishConfigSummariesLocked();
+}
+
+void StatsLogProcessor::updateSharedStateLocked(LogEvent* event) {
+    // Hard-coded logic to update the isolated uid's in the uid-map.
+    // The field numbers need to be currently updated by hand with atoms.proto
+    if (event->GetTagId() == android::os::statsd::util::ISOLATED_UID_CHANGED) {
+        onIsolatedUidChangedEventLocked(*event);
+    } else {
+        // Map the isolated uid to host uid if necessary.
+        mapIsolatedUidToHostUidIfNecessaryLocked(event);
+    }
+
+    StateManager::getInstance().onLogEvent(*event);
+}
+
+bool StatsLogProcessor::changesSharedStateLocked(const LogEvent& event) const {
+    return event.GetTagId() == android::os::statsd::util::ISOLATED_UID_CHANGED ||
+           StateManager::getInstance().hasStateTracker(event.GetTagId());
+}
+
+void StatsLogProcessor::processLogEventsInParallelLocked(
+        const std::vector<LogEvent*>& events,
+        std::unordered_set<int>* uidsWithActiveConfigsChanged) {
+    std::vector<std::pair<ConfigKey, sp<MetricsManager>>> managers(mMetricsManagers.begin(),
+                                                                   mMetricsManagers.end());
+    // Activation status after each change, per metrics manager. Written by one task each.
+    std::vector<std::vector<bool>> activeStatusChanges(managers.size());
+
+    auto dispatch = [&](size_t begin, size_t end) {
+        if (begin == end) {
+            return;
+        }
+        mDispatchExecutor->run(managers.size(), [&](size_t index) {
+            MetricsManager& manager = *managers[index].second;
+            for (size_t i = begin; i < end; i++) {
+                bool isPrevActive = manager.isActive();
+                manager.onLogEvent(*events[i]);
+                bool isCurActive = manager.isActive();
+                if (isPrevActive != isCurActive) {
+                    activeStatusChanges[index].push_back(isCurActive);
+                }
             }
+        });
+    };
+
+    size_t segmentBegin = 0;
+    for (size_t i = 0; i < events.size(); i++) {
+        if (changesSharedStateLocked(*events[i])) {
+            dispatch(segmentBegin, i);
+            segmentBegin = i;
+        }
+        updateSharedStateLocked(events[i]);
+    }
+    dispatch(segmentBegin, events.size());
+    // The events may have activated metrics.
+    mNextActivationExpiryNs = std::numeric_limits<int64_t>::min();
+
+    for (size_t index = 0; index < managers.size(); index++) {
+        const ConfigKey& key = managers[index].first;
+        for (bool isCurActive : activeStatusChanges[index]) {
+            VLOG("Active status changed for uid  %d", key.GetUid());
+            uidsWithActiveConfigsChanged->insert(key.GetUid());
+            StatsdStats::getInstance().noteActiveStatusChanged(key, isCurActive);
         }
+    }
+}
+
+void StatsLogProcessor::processLogEventLocked(LogEvent* event,
+                                              std::unordered_set<int>* uidsWithActiveConfigsChanged) {
+    updateSharedStateLocked(event);
+
+    auto noteActiveStatus = [&](const ConfigKey& key, bool isPrevActive, bool isCurActive) {
         // The activation state of this config changed.
         if (isPrevActive != isCurActive) {
-            VLOG("Active status changed for uid  %d", uid);
-            uidsWithActiveConfigsChanged.insert(uid);
-            StatsdStats::getInstance().noteActiveStatusChanged(pair.first, isCurActive);
+            VLOG("Active status changed for uid  %d", key.GetUid());
+            uidsWithActiveConfigsChanged->insert(key.GetUid());
+            StatsdStats::getInstance().noteActiveStatusChanged(key, isCurActive);
+        }
+    };
+
+    // The activations expire with time, including in the configs that don't use this atom.
+    const int64_t eventTimeNs = event->GetElapsedTimestampNs();
+    if (eventTimeNs > mNextActivationExpiryNs) {
+        mNextActivationExpiryNs = std::numeric_limits<int64_t>::max();
+        for (auto& pair : mMetricsManagers) {
+            bool isPrevActive = pair.second->isActive();
+            pair.second->flushExpiredActivations(eventTimeNs);
+            noteActiveStatus(pair.first, isPrevActive, pair.second->isActive());
+            mNextActivationExpiryNs =
+                    std::min(mNextActivationExpiryNs, pair.second->getNextActivationExpiryNs());
         }
-        flushIfNecessaryLocked(pair.first, *(pair.second));
     }
 
+    // pass the event to metrics managers.
+    const auto it = mMetricsManagersByAtomId.find(event->GetTagId());
+    if (it == mMetricsManagersByAtomId.end()) {
+        return;
+    }
+    for (auto& pair : it->second) {
+        bool isPrevActive = pair.second->isActive();
+        pair.second->onLogEvent(*event);
+        noteActiveStatus(pair.first, isPrevActive, pair.second->isActive());
+        // The event may have activated metrics.
+        mNextActivationExpiryNs =
+                std::min(mNextActivationExpiryNs, pair.second->getNextActivationExpiryNs());
+    }
+}
+
+void StatsLogProcessor::onLogEventsProcessedLocked(
+        const int64_t elapsedRealtimeNs,
+        const std::unordered_set<int>& uidsWithActiveConfigsChanged) {
+    std::unordered_map<int, std::vector<int64_t>> activeConfigsPerUid;
+    for (auto& pair : mMetricsManagers) {
+        // Map all active configs by uid.
+        if (pair.second->isActive()) {
+            activeConfigsPerUid[pair.first.GetUid()].push_back(pair.first.GetId());
+        }
+        flushIfNecessaryLocked(pair.first, *(pair.second), elapsedRealtimeNs);
+    }
+    publishConfigSummariesLocked();
+
     // Don't use the event timestamp for the guardrail.
     for (int uid : uidsWithActiveConfigsChanged) {
         // Send broadcast so that receivers can pull data.
@@ -502,25 +758,47 @@ void StatsLogProcessor::OnLogEvent(LogEvent* event, int64_t elapsedRealtimeNs) {
 }
 
 void StatsLogProcessor::GetActiveConfigs(const int uid, vector<int64_t>& outActiveConfigs) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
-    GetActiveConfigsLocked(uid, outActiveConfigs);
-}
-
-void StatsLogProcessor::GetActiveConfigsLocked(const int uid, vector<int64_t>& outActiveConfigs) {
     outActiveConfigs.clear();
-    for (auto& pair : mMetricsManagers) {
-        if (pair.first.GetUid() == uid && pair.second->isActive()) {
-            outActiveConfigs.push_back(pair.first.GetId());
+    for (const ConfigSummary& summary : *getConfigSummaries()) {
+        if (summary.key.GetUid() == uid && summary.isActive) {
+            outActiveConfigs.push_back(summary.key.GetId());
         }
     }
 }
 
+void StatsLogProcessor::publishConfigSummariesLocked() {
+    vector<ConfigSummary> summaries;
+    summaries.reserve(mMetricsManagers.size());
+    for (const auto& [key, metricsManager] : mMetricsManagers) {
+        summaries.push_back({key, metricsManager->isActive(),
+                             metricsManager->getLastReportTimeNs()});
+    }
+    // Only the processing thread publishes, so the current summaries can't change meanwhile.
+    if (summaries != *mConfigSummaries) {
+        std::atomic_store(&mConfigSummaries, std::make_shared<const vector<ConfigSummary>>(
+                                                     std::move(summaries)));
+    }
+}
+
 void StatsLogProcessor::OnConfigUpdated(const int64_t timestampNs, const int64_t wallClockNs,
                                         const ConfigKey& key, const StatsdConfig& config,
                                         bool modularUpdate) {
+    // A new MetricsManager is built before taking the lock, so that the events are still
+    // processed meanwhile. Only the modular updates of existing configs are done under it.
+    bool updateInPlace;
+    {
+        std::lock_guard<std::mutex> lock(mMetricsMutex);
+        updateInPlace = modularUpdate && mMetricsManagers.find(key) != mMetricsManagers.end();
+    }
+    sp<MetricsManager> newMetricsManager;
+    if (!updateInPlace) {
+        ScopedTrace trace("StatsLogProcessor::createMetricsManager");
+        newMetricsManager = createMetricsManager(timestampNs, key, config);
+    }
+
     std::lock_guard<std::mutex> lock(mMetricsMutex);
     WriteDataToDiskLocked(key, timestampNs, wallClockNs, CONFIG_UPDATED, NO_TIME_CONSTRAINTS);
-    OnConfigUpdatedLocked(timestampNs, key, config, modularUpdate);
+    OnConfigUpdatedLocked(timestampNs, key, config, modularUpdate, newMetricsManager);
 }
 
 void StatsLogProcessor::OnConfigUpdated(const int64_t timestampNs, const ConfigKey& key,
@@ -529,37 +807,108 @@ void StatsLogProcessor::OnConfigUpdated(const int64_t timestampNs, const ConfigK
 }
 
 void StatsLogProcessor::OnConfigUpdatedLocked(const int64_t timestampNs, const ConfigKey& key,
-                                              const StatsdConfig& config, bool modularUpdate) {
+                                              const StatsdConfig& config, bool modularUpdate,
+                                              const sp<MetricsManager>& newMetricsManager) {
     VLOG("Updated configuration for key %s", key.ToString().c_str());
+    // The next checkpoint writes the uid map with the options of the updated config.
+    mCheckpointLogBytes.erase(key);
     // Create new config if this is not a modular update or if this is a new config.
     const auto& it = mMetricsManagers.find(key);
-    bool configValid = false;
     if (!modularUpdate || it == mMetricsManagers.end()) {
-        sp<MetricsManager> newMetricsManager =
-                new MetricsManager(key, config, mTimeBaseNs, timestampNs, mUidMap, mPullerManager,
-                                   mAnomalyAlarmMonitor, mPeriodicAlarmMonitor);
-        configValid = newMetricsManager->isConfigValid();
-        if (configValid) {
-            newMetricsManager->init();
-            mUidMap->OnConfigUpdated(key);
-            newMetricsManager->refreshTtl(timestampNs);
-            mMetricsManagers[key] = newMetricsManager;
-            VLOG("StatsdConfig valid");
-        }
+        addMetricsManagerLocked(timestampNs, key,
+                                newMetricsManager != nullptr
+                                        ? newMetricsManager
+                                        : createMetricsManager(timestampNs, key, config));
     } else {
         // Preserve the existing MetricsManager, update necessary components and metadata in place.
-        configValid = it->second->updateConfig(config, mTimeBaseNs, timestampNs,
-                                               mAnomalyAlarmMonitor, mPeriodicAlarmMonitor);
-        if (configValid) {
+        // The updated metrics and alerts may have reset their activations and refractory periods.
+        mSavedActiveConfigs.erase(key);
+        mSavedMetadata.erase(key);
+        if (it->second->updateConfig(config, mTimeBaseNs, timestampNs, mAnomalyAlarmMonitor,
+                                     mPeriodicAlarmMonitor)) {
             mUidMap->OnConfigUpdated(key);
+        } else {
+            // If there is any error in the config, don't use it.
+            ALOGE("StatsdConfig NOT valid");
+            mMetricsManagers.erase(key);
         }
     }
-    if (!configValid) {
+    onMetricsManagersChangedLocked();
+}
+
+sp<MetricsManager> StatsLogProcessor::createMetricsManager(const int64_t timestampNs,
+                                                           const ConfigKey& key,
+                                                           const StatsdConfig& config) const {
+    return new MetricsManager(key, config, mTimeBaseNs, timestampNs, mUidMap, mPullerManager,
+                              mAnomalyAlarmMonitor, mPeriodicAlarmMonitor);
+}
+
+bool StatsLogProcessor::addMetricsManagerLocked(const int64_t timestampNs, const ConfigKey& key,
+                                                const sp<MetricsManager>& metricsManager) {
+    // The versions of the saved state do not apply to the new MetricsManager.
+    mSavedActiveConfigs.erase(key);
+    mSavedMetadata.erase(key);
+    if (!metricsManager->isConfigValid()) {
         // If there is any error in the config, don't use it.
         // Remove any existing config with the same key.
         ALOGE("StatsdConfig NOT valid");
         mMetricsManagers.erase(key);
+        return false;
+    }
+    metricsManager->init();
+    mUidMap->OnConfigUpdated(key);
+    metricsManager->refreshTtl(timestampNs);
+    mMetricsManagers[key] = metricsManager;
+    VLOG("StatsdConfig valid");
+    return true;
+}
+
+void StatsLogProcessor::OnConfigsLoaded(
+        const int64_t timestampNs, const vector<std::pair<ConfigKey, StatsdConfig>>& configs) {
+    ScopedTrace trace("StatsLogProcessor::OnConfigsLoaded", {{"configs", (int64_t)configs.size()}});
+    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    const int64_t wallClockNs = getWallClockNs();
+    // The existing configs are updated in place instead, like in OnConfigUpdated().
+    vector<size_t> newConfigs;
+    for (size_t i = 0; i < configs.size(); i++) {
+        if (mMetricsManagers.find(configs[i].first) == mMetricsManagers.end()) {
+            newConfigs.push_back(i);
+        }
     }
+    vector<sp<MetricsManager>> newMetricsManagers(configs.size());
+    auto build = [&](size_t i) {
+        const auto& [key, config] = configs[newConfigs[i]];
+        newMetricsManagers[newConfigs[i]] = createMetricsManager(timestampNs, key, config);
+    };
+    if (mConfigLoadThreads > 0 && newConfigs.size() > 1) {
+        ParallelExecutor executor(std::min(mConfigLoadThreads, newConfigs.size() - 1));
+        executor.run(newConfigs.size(), build);
+    } else {
+        for (size_t i = 0; i < newConfigs.size(); i++) {
+            build(i);
+        }
+    }
+
+    for (size_t i = 0; i < configs.size(); i++) {
+        const auto& [key, config] = configs[i];
+        WriteDataToDiskLocked(key, timestampNs, wallClockNs, CONFIG_UPDATED, NO_TIME_CONSTRAINTS);
+        if (newMetricsManagers[i] != nullptr) {
+            addMetricsManagerLocked(timestampNs, key, newMetricsManagers[i]);
+        } else {
+            OnConfigUpdatedLocked(timestampNs, key, config, true /* modularUpdate */);
+        }
+    }
+    onMetricsManagersChangedLocked();
+}
+
+void StatsLogProcessor::setParallelConfigLoadThreads(size_t numThreads) {
+    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    mConfigLoadThreads = numThreads;
+}
+
+void StatsLogProcessor::setParallelDumpThreads(size_t numThreads) {
+    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    mDumpExecutor = numThreads > 0 ? std::make_unique<ParallelExecutor>(numThreads) : nullptr;
 }
 
 size_t StatsLogProcessor::GetMetricsSize(const ConfigKey& key) const {
@@ -572,6 +921,15 @@ size_t StatsLogProcessor::GetMetricsSize(const ConfigKey& key) const {
     return it->second->byteSize();
 }
 
+MetricsManager::MemoryUsage StatsLogProcessor::GetMemoryUsage(const ConfigKey& key) const {
+    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    auto it = mMetricsManagers.find(key);
+    if (it == mMetricsManagers.end()) {
+        return MetricsManager::MemoryUsage();
+    }
+    return it->second->getMemoryUsage();
+}
+
 void StatsLogProcessor::dumpStates(int out, bool verbose) {
     std::lock_guard<std::mutex> lock(mMetricsMutex);
     FILE* fout = fdopen(out, "w");
@@ -586,6 +944,21 @@ void StatsLogProcessor::dumpStates(int out, bool verbose) {
     fclose(fout);
 }
 
+void StatsLogProcessor::dumpMemoryUsage(int out) {
+    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    for (const auto& [key, metricsManager] : mMetricsManagers) {
+        const MetricsManager::MemoryUsage usage = metricsManager->getMemoryUsage();
+        dprintf(out,
+                "Config %s: current buckets %zu, past buckets %zu, condition state %zu, "
+                "anomaly trackers %zu\n",
+                key.ToString().c_str(), usage.currentBucketBytes, usage.pastBucketBytes,
+                usage.conditionStateBytes, usage.anomalyTrackerBytes);
+    }
+    dprintf(out, "State trackers: %zu\n", StateManager::getInstance().getStateTrackersByteSize());
+    dprintf(out, "Pull cache: %zu\n", mPullerManager->GetPullerCacheByteSize());
+    dprintf(out, "UidMap: %zu\n", mUidMap->getBytesUsed());
+}
+
 /*
  * onDumpReport dumps serialized ConfigMetricsReportList into proto.
  */
@@ -594,7 +967,17 @@ void StatsLogProcessor::onDumpReport(const ConfigKey& key, const int64_t dumpTim
                                      const bool include_current_partial_bucket,
                                      const bool erase_data, const DumpReportReason dumpReportReason,
                                      const DumpLatency dumpLatency, ProtoOutputStream* proto) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    ScopedTrace trace("StatsLogProcessor::onDumpReport",
+                      {{"uid", key.GetUid()}, {"config", key.GetId()}});
+    std::lock_guard<std::mutex> dumpLock(mDumpReportMutex);
+
+    bool keepFile = false;
+    vector<uint8_t> buffer;
+    const bool configExists =
+            dumpInMemoryReport(key, dumpTimeStampNs, wallClockNs, include_current_partial_bucket,
+                               erase_data, dumpReportReason, dumpLatency, &keepFile, &buffer);
+    // The past buckets spilled before this dump are read back from disk below.
+    writeSpilledReports();
 
     // Start of ConfigKey.
     uint64_t configKeyToken = proto->start(FIELD_TYPE_MESSAGE | FIELD_ID_CONFIG_KEY);
@@ -603,35 +986,115 @@ void StatsLogProcessor::onDumpReport(const ConfigKey& key, const int64_t dumpTim
     proto->end(configKeyToken);
     // End of ConfigKey.
 
-    bool keepFile = false;
-    auto it = mMetricsManagers.find(key);
-    if (it != mMetricsManagers.end() && it->second->shouldPersistLocalHistory()) {
-        keepFile = true;
-    }
-
     // Then, check stats-data directory to see there's any file containing
     // ConfigMetricsReport from previous shutdowns to concatenate to reports.
     StorageManager::appendConfigMetricsReport(
             key, proto, erase_data && !keepFile /* should remove file after appending it */,
             dumpReportReason == ADB_DUMP /*if caller is adb*/);
 
-    if (it != mMetricsManagers.end()) {
-        // This allows another broadcast to be sent within the rate-limit period if we get close to
-        // filling the buffer again soon.
-        mLastBroadcastTimes.erase(key);
-
-        vector<uint8_t> buffer;
-        onConfigMetricsReportLocked(key, dumpTimeStampNs, wallClockNs,
-                                    include_current_partial_bucket, erase_data, dumpReportReason,
-                                    dumpLatency, false /* is this data going to be saved on disk */,
-                                    &buffer);
-        proto->write(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_REPORTS,
-                     reinterpret_cast<char*>(buffer.data()), buffer.size());
-    } else {
+    if (!configExists) {
         ALOGW("Config source %s does not exist", key.ToString().c_str());
+        return;
+    }
+    proto->write(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_REPORTS,
+                 reinterpret_cast<char*>(buffer.data()), buffer.size());
+
+    // save buffer to disk if needed
+    if (erase_data && keepFile) {
+        saveLocalHistory(key, buffer);
     }
 }
 
+/*
+ * onDumpReport streams serialized ConfigMetricsReportList into outFd.
+ */
+bool StatsLogProcessor::onDumpReport(const ConfigKey& key, const int64_t dumpTimeStampNs,
+                                     const int64_t wallClockNs,
+                                     const bool include_current_partial_bucket,
+                                     const bool erase_data, const DumpReportReason dumpReportReason,
+                                     const DumpLatency dumpLatency, int outFd) {
+    ScopedTrace trace("StatsLogProcessor::onDumpReport",
+                      {{"uid", key.GetUid()}, {"config", key.GetId()}});
+    std::lock_guard<std::mutex> dumpLock(mDumpReportMutex);
+
+    bool keepFile = false;
+    vector<uint8_t> buffer;
+    const bool configExists =
+            dumpInMemoryReport(key, dumpTimeStampNs, wallClockNs, include_current_partial_bucket,
+                               erase_data, dumpReportReason, dumpLatency, &keepFile, &buffer);
+    // The past buckets spilled before this dump are read back from disk below.
+    writeSpilledReports();
+
+    ProtoOutputStream configKeyProto;
+    uint64_t configKeyToken = configKeyProto.start(FIELD_TYPE_MESSAGE | FIELD_ID_CONFIG_KEY);
+    configKeyProto.write(FIELD_TYPE_INT32 | FIELD_ID_UID, key.GetUid());
+    configKeyProto.write(FIELD_TYPE_INT64 | FIELD_ID_ID, (long long)key.GetId());
+    configKeyProto.end(configKeyToken);
+    size_t totalBytes = configKeyProto.size();
+    // The reports on disk, then the one in memory.
+    bool written =
+            configKeyProto.flush(outFd) &&
+            StorageManager::writeConfigMetricsReportsToFd(
+                    key, outFd, erase_data && !keepFile /* should remove file after writing it */,
+                    dumpReportReason == ADB_DUMP /*if caller is adb*/, &totalBytes);
+    if (!configExists) {
+        ALOGW("Config source %s does not exist", key.ToString().c_str());
+        return written;
+    }
+    if (written) {
+        const size_t reportBytes = StorageManager::writeConfigMetricsReportToFd(outFd, buffer);
+        totalBytes += reportBytes;
+        written = reportBytes > 0;
+    }
+    StatsdStats::getInstance().noteMetricsReportSent(key, totalBytes);
+
+    if (!written) {
+        // The erased data is written to disk for the next dump instead of being lost.
+        if (erase_data) {
+            const string file_name = StorageManager::getDataFileName(
+                    (long)getWallClockSec(), key.GetUid(), key.GetId());
+            StorageManager::writeReportFile(file_name, std::move(buffer));
+        }
+        return false;
+    }
+    if (erase_data && keepFile) {
+        saveLocalHistory(key, buffer);
+    }
+    return true;
+}
+
+bool StatsLogProcessor::dumpInMemoryReport(const ConfigKey& key, const int64_t dumpTimeStampNs,
+                                           const int64_t wallClockNs,
+                                           const bool include_current_partial_bucket,
+                                           const bool erase_data,
+                                           const DumpReportReason dumpReportReason,
+                                           const DumpLatency dumpLatency, bool* keepFile,
+                                           vector<uint8_t>* buffer) {
+    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    auto it = mMetricsManagers.find(key);
+    if (it == mMetricsManagers.end()) {
+        return false;
+    }
+    *keepFile = it->second->shouldPersistLocalHistory();
+
+    // This allows another broadcast to be sent within the rate-limit period if we get close to
+    // filling the buffer again soon.
+    mLastBroadcastTimes.erase(key);
+    // The dump seals the checkpoint logs it reads.
+    mCheckpointLogBytes.erase(key);
+
+    onConfigMetricsReportLocked(key, dumpTimeStampNs, wallClockNs, include_current_partial_bucket,
+                                erase_data, dumpReportReason, dumpLatency, buffer);
+    return true;
+}
+
+void StatsLogProcessor::saveLocalHistory(const ConfigKey& key, const vector<uint8_t>& buffer) {
+    VLOG("save history to disk");
+    string file_name = StorageManager::getDataHistoryFileName((long)getWallClockSec(),
+                                                              key.GetUid(), key.GetId());
+    StorageManager::writeReportFile(file_name, buffer);
+}
+
 /*
  * onDumpReport dumps serialized ConfigMetricsReportList into outData.
  */
@@ -671,32 +1134,51 @@ void StatsLogProcessor::onConfigMetricsReportLocked(
         const ConfigKey& key, const int64_t dumpTimeStampNs, const int64_t wallClockNs,
         const bool include_current_partial_bucket, const bool erase_data,
         const DumpReportReason dumpReportReason, const DumpLatency dumpLatency,
-        const bool dataSavedOnDisk, vector<uint8_t>* buffer) {
+        vector<uint8_t>* buffer) {
     // We already checked whether key exists in mMetricsManagers in
     // WriteDataToDisk.
     auto it = mMetricsManagers.find(key);
     if (it == mMetricsManagers.end()) {
         return;
     }
+    // The report includes the data of the deferred pulls, unless it must be fast.
+    mPullerManager->DispatchDeferredPulls(/*waitForPending=*/dumpLatency == NO_TIME_CONSTRAINTS);
     int64_t lastReportTimeNs = it->second->getLastReportTimeNs();
     int64_t lastReportWallClockNs = it->second->getLastReportWallClockNs();
 
-    std::set<string> str_set;
+    ReportStrings str_set(it->second->stringDictionaryInReport());
 
-    ProtoOutputStream tempProto;
+    // The stream of the previous report is reused, so that its buffer chunks are only allocated
+    // once the reports outgrow them.
+    if (mReportProto == nullptr) {
+        mReportProto = std::make_unique<ProtoOutputStream>();
+    }
+    ProtoOutputStream& tempProto = *mReportProto;
+    tempProto.clear();
     // First, fill in ConfigMetricsReport using current data on memory, which
     // starts from filling in StatsLogReport's.
     it->second->onDumpReport(dumpTimeStampNs, wallClockNs, include_current_partial_bucket,
-                             erase_data, dumpLatency, &str_set, &tempProto);
+                             erase_data, dumpLatency, &str_set, &tempProto, mDumpExecutor.get());
+    if (erase_data) {
+        publishConfigSummariesLocked();
+    }
 
     // Fill in UidMap if there is at least one metric to report.
     // This skips the uid map if it's an empty config.
     if (it->second->getNumMetrics() > 0) {
         uint64_t uidMapToken = tempProto.start(FIELD_TYPE_MESSAGE | FIELD_ID_UID_MAP);
-        mUidMap->appendUidMap(dumpTimeStampNs, key, it->second->versionStringsInReport(),
-                              it->second->installerInReport(),
-                              it->second->packageCertificateHashSizeBytes(),
-                              it->second->hashStringInReport() ? &str_set : nullptr, &tempProto);
+        ReportStrings* uidMapStrings = it->second->hashStringInReport() ? &str_set : nullptr;
+        if (dumpReportReason == CHECKPOINT && mCheckpointLogBytes.count(key) > 0) {
+            // The checkpoints appended to a log share the snapshot of the first one.
+            mUidMap->appendUidMapChanges(dumpTimeStampNs, key,
+                                         it->second->versionStringsInReport(), uidMapStrings,
+                                         &tempProto);
+        } else {
+            mUidMap->appendUidMap(dumpTimeStampNs, key, it->second->versionStringsInReport(),
+                                  it->second->installerInReport(),
+                                  it->second->packageCertificateHashSizeBytes(),
+                                  it->second->uidMapDeltasInReport(), uidMapStrings, &tempProto);
+        }
         tempProto.end(uidMapToken);
     }
 
@@ -712,18 +1194,17 @@ void StatsLogProcessor::onConfigMetricsReportLocked(
     // Dump report reason
     tempProto.write(FIELD_TYPE_INT32 | FIELD_ID_DUMP_REPORT_REASON, dumpReportReason);
 
-    for (const auto& str : str_set) {
+    str_set.forEach([&tempProto](const string& str) {
         tempProto.write(FIELD_TYPE_STRING | FIELD_COUNT_REPEATED | FIELD_ID_STRINGS, str);
-    }
+    });
 
     flushProtoToBuffer(tempProto, buffer);
 
-    // save buffer to disk if needed
-    if (erase_data && !dataSavedOnDisk && it->second->shouldPersistLocalHistory()) {
-        VLOG("save history to disk");
-        string file_name = StorageManager::getDataHistoryFileName((long)getWallClockSec(),
-                                                                  key.GetUid(), key.GetId());
-        StorageManager::writeFile(file_name.c_str(), buffer->data(), buffer->size());
+    // Reports this large are rare, so their chunks are not worth holding on to.
+    if (tempProto.size() > kMaxRetainedReportBytes) {
+        mReportProto.reset();
+    } else {
+        tempProto.clear();
     }
 }
 
@@ -767,10 +1248,18 @@ void StatsLogProcessor::OnConfigRemoved(const ConfigKey& key) {
                               NO_TIME_CONSTRAINTS);
         mMetricsManagers.erase(it);
         mUidMap->OnConfigRemoved(key);
+        onMetricsManagersChangedLocked();
     }
     StatsdStats::getInstance().noteConfigRemoved(key);
 
     mLastBroadcastTimes.erase(key);
+    mLastByteSizes.erase(key);
+    mLastSpillTimes.erase(key);
+    mLastCheckpointTimes.erase(key);
+    mCheckpointLogBytes.erase(key);
+    mReportStreams.erase(key);
+    mSavedActiveConfigs.erase(key);
+    mSavedMetadata.erase(key);
 
     int uid = key.GetUid();
     bool lastConfigForUid = true;
@@ -790,8 +1279,8 @@ void StatsLogProcessor::OnConfigRemoved(const ConfigKey& key) {
 }
 
 void StatsLogProcessor::flushIfNecessaryLocked(const ConfigKey& key,
-                                               MetricsManager& metricsManager) {
-    int64_t elapsedRealtimeNs = getElapsedRealtimeNs();
+                                               MetricsManager& metricsManager,
+                                               const int64_t elapsedRealtimeNs) {
     auto lastCheckTime = mLastByteSizeTimes.find(key);
     if (lastCheckTime != mLastByteSizeTimes.end()) {
         if (elapsedRealtimeNs - lastCheckTime->second < StatsdStats::kMinByteSizeCheckPeriodNs) {
@@ -802,13 +1291,25 @@ void StatsLogProcessor::flushIfNecessaryLocked(const ConfigKey& key,
     // We suspect that the byteSize() computation is expensive, so we set a rate limit.
     size_t totalBytes = metricsManager.byteSize();
     mLastByteSizeTimes[key] = elapsedRealtimeNs;
+    mLastByteSizes[key] = totalBytes;
+    // Streamed buckets leave memory before they can count towards the limits.
+    if (streamReportIfNecessaryLocked(key, metricsManager, elapsedRealtimeNs)) {
+        totalBytes = mLastByteSizes[key];
+    }
     bool requestDump = false;
     if (totalBytes > StatsdStats::kMaxMetricsBytesPerConfig) {
         // Too late. We need to start clearing data.
         metricsManager.dropData(elapsedRealtimeNs);
         StatsdStats::getInstance().noteDataDropped(key, totalBytes);
         VLOG("StatsD had to toss out metrics for %s", key.ToString().c_str());
-    } else if ((totalBytes > StatsdStats::kBytesPerConfigTriggerGetData) ||
+        mLastByteSizes[key] = 0;
+        return;
+    }
+
+    checkpointIfNecessaryLocked(key, metricsManager, elapsedRealtimeNs);
+    // This config may be among the ones moved to disk, which the check below then reports.
+    spillToMemoryLimitLocked(elapsedRealtimeNs);
+    if ((totalBytes > StatsdStats::kBytesPerConfigTriggerGetData) ||
                (mOnDiskDataConfigs.find(key) != mOnDiskDataConfigs.end())) {
         // Request to send a broadcast if:
         // 1. in memory data > threshold   OR
@@ -835,21 +1336,184 @@ void StatsLogProcessor::flushIfNecessaryLocked(const ConfigKey& key,
     }
 }
 
+void StatsLogProcessor::spillToMemoryLimitLocked(const int64_t elapsedRealtimeNs) {
+    size_t limit = StatsdStats::kMaxMetricsBytesTotal;
+    if (elapsedRealtimeNs < mMemoryPressureEndNs) {
+        limit = StatsdStats::kMaxMetricsBytesTotalUnderMemoryPressure;
+    }
+    size_t totalBytes = 0;
+    vector<std::pair<size_t, ConfigKey>> configsBySize;
+    for (const auto& [key, bytes] : mLastByteSizes) {
+        totalBytes += bytes;
+        configsBySize.emplace_back(bytes, key);
+    }
+    if (totalBytes <= limit) {
+        return;
+    }
+    std::sort(configsBySize.begin(), configsBySize.end(),
+              [](const auto& a, const auto& b) { return a.first > b.first; });
+    for (const auto& [bytes, key] : configsBySize) {
+        if (totalBytes <= limit) {
+            break;
+        }
+        auto it = mMetricsManagers.find(key);
+        if (it == mMetricsManagers.end() || !it->second->shouldWriteToDisk()) {
+            continue;
+        }
+        auto lastSpillTime = mLastSpillTimes.find(key);
+        if (lastSpillTime != mLastSpillTimes.end() &&
+            elapsedRealtimeNs - lastSpillTime->second < StatsdStats::kMinMetricsSpillPeriodNs) {
+            continue;
+        }
+        // The current buckets stay in memory since they are still being filled. The report is
+        // written by writeSpilledReports() once mMetricsMutex is released.
+        SpilledReport report{StorageManager::getDataFileName((long)getWallClockSec(),
+                                                             key.GetUid(), key.GetId()),
+                             {}};
+        onConfigMetricsReportLocked(key, elapsedRealtimeNs, getWallClockNs(),
+                                    false /* include_current_partial_bucket */,
+                                    true /* erase_data */, MEMORY_PRESSURE, FAST, &report.buffer);
+        mSpilledReports.push_back(std::move(report));
+        mHasSpilledReports = true;
+        mOnDiskDataConfigs.insert(key);
+        mLastSpillTimes[key] = elapsedRealtimeNs;
+        const size_t remainingBytes = it->second->byteSize();
+        mLastByteSizes[key] = remainingBytes;
+        totalBytes = totalBytes - bytes + remainingBytes;
+        VLOG("StatsD wrote the past buckets of %s to disk, %zu bytes left", key.ToString().c_str(),
+             remainingBytes);
+    }
+}
+
+void StatsLogProcessor::onMemoryPressure(const int64_t elapsedRealtimeNs) {
+    {
+        std::lock_guard<std::mutex> lock(mMetricsMutex);
+        mMemoryPressureEndNs = elapsedRealtimeNs + StatsdStats::kMemoryPressurePeriodNs;
+        for (const auto& [key, metricsManager] : mMetricsManagers) {
+            mLastByteSizes[key] = metricsManager->byteSize();
+            mLastByteSizeTimes[key] = elapsedRealtimeNs;
+        }
+        spillToMemoryLimitLocked(elapsedRealtimeNs);
+    }
+    writeSpilledReports();
+}
+
+void StatsLogProcessor::writeSpilledReports() {
+    if (!mHasSpilledReports) {
+        return;
+    }
+    std::lock_guard<std::mutex> writeLock(mSpilledReportWriteMutex);
+    vector<SpilledReport> reports;
+    {
+        std::lock_guard<std::mutex> lock(mMetricsMutex);
+        reports.swap(mSpilledReports);
+        mHasSpilledReports = false;
+    }
+    for (SpilledReport& report : reports) {
+        StorageManager::writeReportFile(report.fileName, std::move(report.buffer));
+    }
+}
+
+void StatsLogProcessor::checkpointIfNecessaryLocked(const ConfigKey& key,
+                                                    MetricsManager& metricsManager,
+                                                    const int64_t elapsedRealtimeNs) {
+    if (mCheckpointPeriodNs <= 0 || !metricsManager.shouldWriteToDisk()) {
+        return;
+    }
+    // The first period of a config starts when it is first checked.
+    auto [lastCheckpointTime, inserted] = mLastCheckpointTimes.emplace(key, elapsedRealtimeNs);
+    if (inserted || elapsedRealtimeNs - lastCheckpointTime->second < mCheckpointPeriodNs) {
+        return;
+    }
+    lastCheckpointTime->second = elapsedRealtimeNs;
+    if (mLastByteSizes[key] == 0) {
+        // No bucket was completed since the last checkpoint.
+        return;
+    }
+    vector<uint8_t> buffer;
+    onConfigMetricsReportLocked(key, elapsedRealtimeNs, getWallClockNs(),
+                                false /* include_current_partial_bucket */, true /* erase_data */,
+                                CHECKPOINT, FAST, &buffer);
+    VLOG("StatsD checkpointed %zu bytes of %s", buffer.size(), key.ToString().c_str());
+    // Counts the report header too, so that the log is left for a new one here no later than in
+    // StorageManager::appendCheckpoint(). A log that ends up with two snapshots is harmless.
+    size_t& logBytes = mCheckpointLogBytes[key];
+    logBytes += buffer.size() + kMaxReportHeaderBytes;
+    if (logBytes >= StatsdStats::kMaxCheckpointLogBytes) {
+        mCheckpointLogBytes.erase(key);
+    }
+    StorageManager::appendCheckpoint(key, std::move(buffer));
+    mLastByteSizes[key] = metricsManager.byteSize();
+}
+
+bool StatsLogProcessor::streamReportIfNecessaryLocked(const ConfigKey& key,
+                                                      MetricsManager& metricsManager,
+                                                      const int64_t elapsedRealtimeNs) {
+    auto stream = mReportStreams.find(key);
+    if (stream == mReportStreams.end() || mLastByteSizes[key] == 0) {
+        return false;
+    }
+    StreamedReport report{key, stream->second, {}};
+    onConfigMetricsReportLocked(key, elapsedRealtimeNs, getWallClockNs(),
+                                false /* include_current_partial_bucket */, true /* erase_data */,
+                                REPORT_STREAMED, FAST, &report.buffer);
+    mLastByteSizes[key] = metricsManager.byteSize();
+    mPendingStreamedReports.push_back(std::move(report));
+    return true;
+}
+
+void StatsLogProcessor::sendStreamedReports() {
+    // Keeps the reports of a config in order when several threads send them.
+    std::lock_guard<std::mutex> sendLock(mReportStreamSendMutex);
+    vector<StreamedReport> reports;
+    {
+        std::lock_guard<std::mutex> lock(mMetricsMutex);
+        reports.swap(mPendingStreamedReports);
+    }
+    std::set<const ReportStreamCallback*> failedStreams;
+    vector<uint8_t> chunk;
+    for (const StreamedReport& report : reports) {
+        if (failedStreams.count(report.stream.get()) > 0) {
+            continue;
+        }
+        size_t offset = 0;
+        do {
+            const size_t end = std::min(report.buffer.size(), offset + kMaxReportStreamChunkBytes);
+            chunk.assign(report.buffer.begin() + offset, report.buffer.begin() + end);
+            if (!(*report.stream)(chunk, end == report.buffer.size())) {
+                // The erased buckets are lost with the consumer.
+                ALOGW("Report stream of %s failed, removing it", report.key.ToString().c_str());
+                failedStreams.insert(report.stream.get());
+                std::lock_guard<std::mutex> lock(mMetricsMutex);
+                // Unless the stream was replaced meanwhile.
+                auto it = mReportStreams.find(report.key);
+                if (it != mReportStreams.end() && it->second == report.stream) {
+                    mReportStreams.erase(it);
+                }
+                break;
+            }
+            offset = end;
+        } while (offset < report.buffer.size());
+        VLOG("StatsD streamed %zu bytes of %s", report.buffer.size(),
+             report.key.ToString().c_str());
+    }
+}
+
 void StatsLogProcessor::WriteDataToDiskLocked(const ConfigKey& key, const int64_t timestampNs,
                                               const int64_t wallClockNs,
                                               const DumpReportReason dumpReportReason,
-                                              const DumpLatency dumpLatency) {
+                                              const DumpLatency dumpLatency,
+                                              const bool includeCurrentPartialBucket) {
     if (mMetricsManagers.find(key) == mMetricsManagers.end() ||
         !mMetricsManagers.find(key)->second->shouldWriteToDisk()) {
         return;
     }
     vector<uint8_t> buffer;
-    onConfigMetricsReportLocked(key, timestampNs, wallClockNs,
-                                true /* include_current_partial_bucket*/, true /* erase_data */,
-                                dumpReportReason, dumpLatency, true, &buffer);
+    onConfigMetricsReportLocked(key, timestampNs, wallClockNs, includeCurrentPartialBucket,
+                                true /* erase_data */, dumpReportReason, dumpLatency, &buffer);
     string file_name =
             StorageManager::getDataFileName((long)getWallClockSec(), key.GetUid(), key.GetId());
-    StorageManager::writeFile(file_name.c_str(), buffer.data(), buffer.size());
+    StorageManager::writeReportFile(file_name, std::move(buffer));
 
     // We were able to write the ConfigMetricsReport to disk, so we should trigger collection ASAP.
     mOnDiskDataConfigs.insert(key);
@@ -867,18 +1531,39 @@ void StatsLogProcessor::SaveActiveConfigsToDisk(int64_t currentTimeNs) {
     }
     mLastActiveMetricsWriteNs = timeNs;
 
+    // The removed configs were erased in OnConfigRemoved(), so a different count means new ones.
+    bool changed = mSavedActiveConfigs.size() != mMetricsManagers.size();
     ProtoOutputStream proto;
-    WriteActiveConfigsToProtoOutputStreamLocked(currentTimeNs, DEVICE_SHUTDOWN, &proto);
+    for (const auto& [key, metricsManager] : mMetricsManagers) {
+        const uint64_t version = metricsManager->getActivationsVersion();
+        auto [it, inserted] = mSavedActiveConfigs.emplace(key, SavedActiveConfig());
+        SavedActiveConfig& saved = it->second;
+        if (inserted || saved.hadRunningActivation || saved.activationsVersion != version) {
+            ProtoOutputStream configProto;
+            metricsManager->writeActiveConfigToProtoOutputStream(currentTimeNs, DEVICE_SHUTDOWN,
+                                                                 &configProto);
+            saved.bytes.clear();
+            configProto.serializeToString(&saved.bytes);
+            saved.activationsVersion = version;
+            saved.hadRunningActivation = metricsManager->hasRunningActivation();
+            changed = true;
+        }
+        proto.write(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_ACTIVE_CONFIG_LIST_CONFIG,
+                    saved.bytes.data(), saved.bytes.size());
+    }
+    if (!changed) {
+        VLOG("Active configs did not change since they were saved");
+        return;
+    }
 
-    string file_name = StringPrintf("%s/active_metrics", STATS_ACTIVE_METRIC_DIR);
-    StorageManager::deleteFile(file_name.c_str());
-    android::base::unique_fd fd(
-            open(file_name.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR));
-    if (fd == -1) {
-        ALOGE("Attempt to write %s but failed", file_name.c_str());
+    string data;
+    if (!proto.serializeToString(&data)) {
+        ALOGE("Failed to serialize the active configs");
+        mSavedActiveConfigs.clear();
         return;
     }
-    proto.flush(fd.get());
+    string file_name = StringPrintf("%s/active_metrics", STATS_ACTIVE_METRIC_DIR);
+    StorageManager::writeFileAsync(file_name, std::move(data));
 }
 
 void StatsLogProcessor::SaveMetadataToDisk(int64_t currentWallClockTimeNs,
@@ -893,9 +1578,42 @@ void StatsLogProcessor::SaveMetadataToDisk(int64_t currentWallClockTimeNs,
     }
     mLastMetadataWriteNs = systemElapsedTimeNs;
 
+    bool changed = mSavedMetadata.size() != mMetricsManagers.size();
+    const int64_t wallClockSec = currentWallClockTimeNs / NS_PER_SEC;
+    const int64_t wallClockOffsetSec = wallClockSec - systemElapsedTimeNs / NS_PER_SEC;
     metadata::StatsMetadataList metadataList;
-    WriteMetadataToProtoLocked(
-            currentWallClockTimeNs, systemElapsedTimeNs, &metadataList);
+    for (const auto& [key, metricsManager] : mMetricsManagers) {
+        const uint64_t version = metricsManager->getAlertMetadataVersion();
+        auto [it, inserted] = mSavedMetadata.emplace(key, SavedMetadata());
+        SavedMetadata& saved = it->second;
+        // The rounding of the two clocks to seconds may move the offset by one.
+        if (inserted || saved.alertMetadataVersion != version ||
+            std::abs(saved.wallClockOffsetSec - wallClockOffsetSec) > 1 ||
+            saved.earliestRefractoryEndSec < wallClockSec) {
+            saved.metadata.Clear();
+            saved.written = metricsManager->writeMetadataToProto(
+                    currentWallClockTimeNs, systemElapsedTimeNs, &saved.metadata);
+            saved.alertMetadataVersion = version;
+            saved.wallClockOffsetSec = wallClockOffsetSec;
+            saved.earliestRefractoryEndSec = std::numeric_limits<int64_t>::max();
+            for (const metadata::AlertMetadata& alertMetadata : saved.metadata.alert_metadata()) {
+                for (const metadata::AlertDimensionKeyedData& keyedData :
+                     alertMetadata.alert_dim_keyed_data()) {
+                    saved.earliestRefractoryEndSec =
+                            std::min(saved.earliestRefractoryEndSec,
+                                     (int64_t)keyedData.last_refractory_ends_sec());
+                }
+            }
+            changed = true;
+        }
+        if (saved.written) {
+            *metadataList.add_stats_metadata() = saved.metadata;
+        }
+    }
+    if (!changed) {
+        VLOG("Metadata did not change since it was saved");
+        return;
+    }
 
     string file_name = StringPrintf("%s/metadata", STATS_METADATA_DIR);
     StorageManager::deleteFile(file_name.c_str());
@@ -907,7 +1625,7 @@ void StatsLogProcessor::SaveMetadataToDisk(int64_t currentWallClockTimeNs,
 
     std::string data;
     metadataList.SerializeToString(&data);
-    StorageManager::writeFile(file_name.c_str(), data.c_str(), data.size());
+    StorageManager::writeFileAsync(file_name, std::move(data));
 }
 
 void StatsLogProcessor::WriteMetadataToProto(int64_t currentWallClockTimeNs,
@@ -959,6 +1677,7 @@ void StatsLogProcessor::LoadMetadataFromDisk(int64_t currentWallClockTimeNs,
     }
     SetMetadataStateLocked(statsMetadataList, currentWallClockTimeNs, systemElapsedTimeNs);
     StorageManager::deleteFile(file_name.c_str());
+    mSavedMetadata.clear();
 }
 
 void StatsLogProcessor::SetMetadataState(const metadata::StatsMetadataList& statsMetadataList,
@@ -1029,6 +1748,7 @@ void StatsLogProcessor::LoadActiveConfigsFromDisk() {
     // Passing in mTimeBaseNs only works as long as we only load from disk is when statsd starts.
     SetConfigsActiveStateLocked(activeConfigList, mTimeBaseNs);
     StorageManager::deleteFile(file_name.c_str());
+    mSavedActiveConfigs.clear();
 }
 
 void StatsLogProcessor::SetConfigsActiveState(const ActiveConfigList& activeConfigList,
@@ -1050,6 +1770,8 @@ void StatsLogProcessor::SetConfigsActiveStateLocked(const ActiveConfigList& acti
         VLOG("Setting active config %s", key.ToString().c_str());
         it->second->loadActiveConfig(config, currentTimeNs);
     }
+    mNextActivationExpiryNs = std::numeric_limits<int64_t>::min();
+    publishConfigSummariesLocked();
     VLOG("Successfully loaded %d active configs.", activeConfigList.config_size());
 }
 
@@ -1067,6 +1789,8 @@ void StatsLogProcessor::WriteDataToDiskLocked(const DumpReportReason dumpReportR
         return;
     }
     mLastWriteTimeNs = elapsedRealtimeNs;
+    // The reports of all configs are made durable together.
+    StorageManager::ScopedSyncBatch syncBatch;
     for (auto& pair : mMetricsManagers) {
         WriteDataToDiskLocked(pair.first, elapsedRealtimeNs, wallClockNs, dumpReportReason,
                               dumpLatency);
@@ -1083,16 +1807,17 @@ void StatsLogProcessor::WriteDataToDisk(const DumpReportReason dumpReportReason,
 
 void StatsLogProcessor::informPullAlarmFired(const int64_t timestampNs) {
     std::lock_guard<std::mutex> lock(mMetricsMutex);
+    mPullerManager->DispatchDeferredPulls(/*waitForPending=*/false);
     mPullerManager->OnAlarmFired(timestampNs);
 }
 
 int64_t StatsLogProcessor::getLastReportTimeNs(const ConfigKey& key) {
-    auto it = mMetricsManagers.find(key);
-    if (it == mMetricsManagers.end()) {
-        return 0;
-    } else {
-        return it->second->getLastReportTimeNs();
+    for (const ConfigSummary& summary : *getConfigSummaries()) {
+        if (summary.key == key) {
+            return summary.lastReportTimeNs;
+        }
     }
+    return 0;
 }
 
 void StatsLogProcessor::notifyAppUpgrade(const int64_t& eventTimeNs, const string& apk,
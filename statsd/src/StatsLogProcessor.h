@@ -22,11 +22,15 @@
 #include "metrics/MetricsManager.h"
 #include "packages/UidMap.h"
 #include "external/StatsPullerManager.h"
+#include "socket/LogEventFilter.h"
+#include "utils/ParallelExecutor.h"
 
 #include "src/statsd_config.pb.h"
 #include "src/statsd_metadata.pb.h"
 
 #include <stdio.h>
+#include <limits>
+#include <memory>
 #include <unordered_map>
 
 namespace android {
@@ -47,6 +51,48 @@ public:
 
     void OnLogEvent(LogEvent* event);
 
+    /**
+     * Processes a batch of events in order. mMetricsMutex, the config TTL check, the anomaly
+     * alarm check and the activation broadcasts are paid once for the whole batch.
+     */
+    void OnLogEvents(const std::vector<std::unique_ptr<LogEvent>>& events);
+
+    /**
+     * Enables parallel dispatch of event batches in OnLogEvents(): each metrics manager consumes
+     * the batch on one of [numThreads] worker threads or the calling thread. Uid map and state
+     * updates stay serial. A value of 0 disables parallel dispatch. Parallel dispatch also stops
+     * the sharing of condition states across configs, so it should be set before configs are
+     * added.
+     */
+    void setParallelDispatchThreads(size_t numThreads);
+
+    /**
+     * Appends the completed buckets of each config that writes to disk to its checkpoint log
+     * every [periodNs], see StorageManager::appendCheckpoint(). This bounds the past buckets in
+     * memory and the data lost to a crash. A value of 0 disables checkpoints.
+     */
+    void setCheckpointPeriodNs(int64_t periodNs);
+
+    // Receives the next chunk of a serialized ConfigMetricsReport streamed for a config. [last] is
+    // set on the final chunk of each report. Returns false if the consumer is gone.
+    using ReportStreamCallback =
+            std::function<bool(const std::vector<uint8_t>& chunk, bool last)>;
+
+    /**
+     * Streams the completed buckets of the config to [callback] as they close, in chunks of at
+     * most kMaxReportStreamChunkBytes, instead of keeping them for the next dump. There can be at
+     * most one stream per config key. The stream is removed once the callback fails.
+     */
+    void setReportStream(const ConfigKey& key, const ReportStreamCallback& callback);
+
+    void removeReportStream(const ConfigKey& key);
+
+    /**
+     * Sets the filter the socket listener consults to drop the atoms nobody listens to. The
+     * processor keeps it up to date with the atoms used by the configs.
+     */
+    void setLogEventFilter(const std::shared_ptr<LogEventFilter>& filter);
+
     void OnConfigUpdated(const int64_t timestampNs, const int64_t wallClockNs, const ConfigKey& key,
                          const StatsdConfig& config, bool modularUpdate = true);
     // For testing only.
@@ -54,8 +100,32 @@ public:
                          const StatsdConfig& config, bool modularUpdate = true);
     void OnConfigRemoved(const ConfigKey& key);
 
+    // Builds the metrics managers of the new configs in parallel, see
+    // setParallelConfigLoadThreads(), then adds them in order.
+    void OnConfigsLoaded(const int64_t timestampNs,
+                         const std::vector<std::pair<ConfigKey, StatsdConfig>>& configs) override;
+
+    /**
+     * Builds the metrics managers of the configs loaded together on [numThreads] worker threads
+     * in addition to the calling one, which exist for the duration of each load. A value of 0
+     * builds them on the calling thread.
+     */
+    void setParallelConfigLoadThreads(size_t numThreads);
+
+    /**
+     * Serializes the reports of the metrics of a config on [numThreads] worker threads in
+     * addition to the dumping thread, see MetricsManager::onDumpReport(). A value of 0 serializes
+     * them on the dumping thread.
+     */
+    void setParallelDumpThreads(size_t numThreads);
+
     size_t GetMetricsSize(const ConfigKey& key) const;
 
+    // Estimated heap bytes of the data of the config, by subsystem. Zero if the config does not
+    // exist.
+    MetricsManager::MemoryUsage GetMemoryUsage(const ConfigKey& key) const;
+
+    // Reads the config summaries, without waiting for the events being processed.
     void GetActiveConfigs(const int uid, vector<int64_t>& outActiveConfigs);
 
     void onDumpReport(const ConfigKey& key, const int64_t dumpTimeNs, const int64_t wallClockNs,
@@ -66,6 +136,13 @@ public:
                       const bool include_current_partial_bucket, const bool erase_data,
                       const DumpReportReason dumpReportReason, const DumpLatency dumpLatency,
                       ProtoOutputStream* proto);
+    // Writes the ConfigMetricsReportList to [outFd] as it goes. The reports on disk are copied
+    // from their files without being read into memory. Returns false if writing to [outFd]
+    // failed, in which case the reports not fully written stay on disk for the next dump.
+    bool onDumpReport(const ConfigKey& key, const int64_t dumpTimeNs, const int64_t wallClockNs,
+                      const bool include_current_partial_bucket, const bool erase_data,
+                      const DumpReportReason dumpReportReason, const DumpLatency dumpLatency,
+                      int outFd);
     // For testing only.
     void onDumpReport(const ConfigKey& key, const int64_t dumpTimeNs,
                       const bool include_current_partial_bucket, const bool erase_data,
@@ -77,11 +154,22 @@ public:
             const int64_t& timestampNs,
             unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>> alarmSet);
 
+    /**
+     * Called when the system is low on memory. For kMemoryPressurePeriodNs, the metrics of all
+     * configs are held to kMaxMetricsBytesTotalUnderMemoryPressure by writing the past buckets of
+     * the largest configs to disk, starting now.
+     */
+    void onMemoryPressure(const int64_t elapsedRealtimeNs);
+
     /* Flushes data to disk. Data on memory will be gone after written to disk. */
     void WriteDataToDisk(const DumpReportReason dumpReportReason, const DumpLatency dumpLatency,
                          const int64_t elapsedRealtimeNs, const int64_t wallClockNs);
 
-    /* Persist configs containing metrics with active activations to disk. */
+    /*
+     * Persist configs containing metrics with active activations to disk. Only the configs whose
+     * activations changed since the last save are serialized again, and the file is not rewritten
+     * if none did.
+     */
     void SaveActiveConfigsToDisk(int64_t currentTimeNs);
 
     /* Writes the current active status/ttl for all configs and metrics to ProtoOutputStream. */
@@ -91,7 +179,10 @@ public:
     /* Load configs containing metrics with active activations from disk. */
     void LoadActiveConfigsFromDisk();
 
-    /* Persist metadata for configs and metrics to disk. */
+    /*
+     * Persist metadata for configs and metrics to disk. Like SaveActiveConfigsToDisk(), only
+     * rewrites the metadata of the configs whose refractory periods changed since the last save.
+     */
     void SaveMetadataToDisk(int64_t currentWallClockTimeNs, int64_t systemElapsedTimeNs);
 
     /* Writes the statsd metadata for all configs and metrics to StatsMetadataList. */
@@ -135,13 +226,20 @@ public:
 
     void dumpStates(int outFd, bool verbose);
 
+    // Prints the estimated heap bytes of each config by subsystem, and of the state trackers,
+    // the pull cache and the uid map.
+    void dumpMemoryUsage(int outFd);
+
     void informPullAlarmFired(const int64_t timestampNs);
 
+    // Reads the config summaries, without waiting for the events being processed. 0 if [key]
+    // has no config.
     int64_t getLastReportTimeNs(const ConfigKey& key);
 
     inline void setPrintLogs(bool enabled) {
         std::lock_guard<std::mutex> lock(mMetricsMutex);
         mPrintAllLogs = enabled;
+        updateLogEventFilterLocked();
     }
 
     // Add a specific config key to the possible configs to dump ASAP.
@@ -163,6 +261,10 @@ private:
 
     mutable mutex mMetricsMutex;
 
+    // Serializes onDumpReport(), which reads and removes the reports on disk without holding
+    // mMetricsMutex. Acquired before mMetricsMutex.
+    mutex mDumpReportMutex;
+
     // Guards mNextAnomalyAlarmTime. A separate mutex is needed because alarms are set/cancelled
     // in the onLogEvent code path, which is locked by mMetricsMutex.
     // DO NOT acquire mMetricsMutex while holding mAnomalyAlarmMutex. This can lead to a deadlock.
@@ -170,6 +272,22 @@ private:
 
     std::unordered_map<ConfigKey, sp<MetricsManager>> mMetricsManagers;
 
+    // The summaries of mMetricsManagers as of the last config change or processed events. Never
+    // modified once published: publishConfigSummariesLocked() swaps in new ones with
+    // std::atomic_store, so that the read-only binder queries don't take mMetricsMutex.
+    std::shared_ptr<const std::vector<ConfigSummary>> mConfigSummaries =
+            std::make_shared<const std::vector<ConfigSummary>>();
+
+    // Maps each atom id to the metrics managers whose configs use it, so that the events skip
+    // the other configs. See onMetricsManagersChangedLocked().
+    std::unordered_map<int, std::vector<std::pair<ConfigKey, sp<MetricsManager>>>>
+            mMetricsManagersByAtomId;
+
+    // No activation of mMetricsManagers expires before this time, so the configs that don't get
+    // an earlier event don't need to flush their activations. INT64_MIN when it must be
+    // recomputed on the next event.
+    int64_t mNextActivationExpiryNs = std::numeric_limits<int64_t>::min();
+
     std::unordered_map<ConfigKey, int64_t> mLastBroadcastTimes;
 
     // Last time we sent a broadcast to this uid that the active configs had changed.
@@ -178,25 +296,182 @@ private:
     // Tracks when we last checked the bytes consumed for each config key.
     std::unordered_map<ConfigKey, int64_t> mLastByteSizeTimes;
 
+    // The bytes consumed by each config key as of the last check.
+    std::unordered_map<ConfigKey, size_t> mLastByteSizes;
+
+    // Tracks when we last wrote the past buckets of each config key to disk to save memory.
+    std::unordered_map<ConfigKey, int64_t> mLastSpillTimes;
+
+    // A report of past buckets dumped to save memory, written by writeSpilledReports().
+    struct SpilledReport {
+        std::string fileName;
+        std::vector<uint8_t> buffer;
+    };
+
+    // The reports dumped under mMetricsMutex, to be written once it is released.
+    std::vector<SpilledReport> mSpilledReports;
+
+    // Whether mSpilledReports has reports, checked without mMetricsMutex.
+    std::atomic<bool> mHasSpilledReports = false;
+
+    // Held while writing the spilled reports, so that a dump waits for them to be on disk.
+    // Acquired before mMetricsMutex.
+    std::mutex mSpilledReportWriteMutex;
+
+    // The lower memory limit applies until then, see onMemoryPressure().
+    int64_t mMemoryPressureEndNs = 0;
+
+    // See setCheckpointPeriodNs().
+    int64_t mCheckpointPeriodNs = 0;
+
+    // Tracks when we last checkpointed each config key.
+    std::unordered_map<ConfigKey, int64_t> mLastCheckpointTimes;
+
+    // The bytes appended to the checkpoint log of each config key since the first report of the
+    // log, which has the uid map snapshot. The next checkpoints only have the uid map changes. A
+    // key is erased once its log is expected to be sealed, see StorageManager::appendCheckpoint().
+    // The in-memory report of a dump still has a snapshot for the logs that lost theirs.
+    std::unordered_map<ConfigKey, size_t> mCheckpointLogBytes;
+
+    // Upper bound of the field header of a report in a checkpoint log: a tag and a size varint.
+    static constexpr size_t kMaxReportHeaderBytes = 1 + 10;
+
+    // See setReportStream().
+    std::unordered_map<ConfigKey, std::shared_ptr<ReportStreamCallback>> mReportStreams;
+
+    // A report dumped for a stream, sent by sendStreamedReports().
+    struct StreamedReport {
+        ConfigKey key;
+        std::shared_ptr<ReportStreamCallback> stream;
+        std::vector<uint8_t> buffer;
+    };
+
+    // The reports dumped under mMetricsMutex, to be sent once it is released.
+    std::vector<StreamedReport> mPendingStreamedReports;
+
+    // Held while sending the streamed reports, so that they are sent in order.
+    std::mutex mReportStreamSendMutex;
+
+    // Bounds the chunks of the streamed reports, which are sent over binder.
+    static constexpr size_t kMaxReportStreamChunkBytes = 64 * 1024;
+
     // Tracks which config keys has metric reports on disk
     std::set<ConfigKey> mOnDiskDataConfigs;
 
     sp<UidMap> mUidMap;  // Reference to the UidMap to lookup app name and version for each uid.
 
+    // Isolated uids of mUidMap, read without locking by mapIsolatedUidToHostUidIfNecessaryLocked().
+    mutable IsolatedUidSnapshot mIsolatedUids;
+
     sp<StatsPullerManager> mPullerManager;  // Reference to StatsPullerManager
 
     sp<AlarmMonitor> mAnomalyAlarmMonitor;
 
     sp<AlarmMonitor> mPeriodicAlarmMonitor;
 
+    // Runs the metrics managers in parallel in OnLogEvents(). Null unless parallel dispatch is
+    // enabled.
+    std::unique_ptr<ParallelExecutor> mDispatchExecutor;
+
+    // See setParallelConfigLoadThreads().
+    size_t mConfigLoadThreads = 0;
+
+    // Serializes the metric reports in parallel in onConfigMetricsReportLocked(). Null unless
+    // parallel dumps are enabled.
+    std::unique_ptr<ParallelExecutor> mDumpExecutor;
+
+    // The stream onConfigMetricsReportLocked() serializes the reports into, kept across reports
+    // unless they exceed kMaxRetainedReportBytes. Guarded by mMetricsMutex.
+    std::unique_ptr<ProtoOutputStream> mReportProto;
+
+    static constexpr size_t kMaxRetainedReportBytes = 256 * 1024;
+
+    // Filter of the atoms to be processed by the socket listener. May be null.
+    std::shared_ptr<LogEventFilter> mLogEventFilter;
+
+    // Sets the atoms used by the configs, the state trackers and the hard-coded handling in
+    // mLogEventFilter. Must be called whenever a metrics manager is created or updated.
+    void updateLogEventFilterLocked() const;
+
+    // Rebuilds mMetricsManagersByAtomId and updates mLogEventFilter. Must be called whenever a
+    // metrics manager is created, updated or removed.
+    void onMetricsManagersChangedLocked();
+
     void OnLogEvent(LogEvent* event, int64_t elapsedRealtimeNs);
 
+    void OnLogEvents(const std::vector<std::unique_ptr<LogEvent>>& events,
+                     int64_t elapsedRealtimeNs);
+
+    // Notes the event in StatsdStats and applies the hard-coded train info handling.
+    // Returns false if the event is invalid and must be dropped.
+    bool preprocessLogEventLocked(LogEvent* event);
+
+    // Fires the anomaly alarm if it is due and clears the puller cache if necessary.
+    void informAnomalyAlarmAndClearPullerCacheLocked(const int64_t elapsedRealtimeNs);
+
+    // Updates the uid map and the state trackers, then passes the event to the metrics managers
+    // that use its atom, after flushing the expired activations of all of them.
+    // Uids of configs whose activation status changed are added to uidsWithActiveConfigsChanged.
+    void processLogEventLocked(LogEvent* event,
+                               std::unordered_set<int>* uidsWithActiveConfigsChanged);
+
+    // Updates the uid map and the state trackers for the event. This affects all configs.
+    void updateSharedStateLocked(LogEvent* event);
+
+    // Returns true if updateSharedStateLocked() for the event may change what metrics managers
+    // observe, so that the events before it must have been dispatched first.
+    bool changesSharedStateLocked(const LogEvent& event) const;
+
+    // Processes a batch of events with every metrics manager consuming the events on the
+    // dispatch executor. The batch is split at events that change shared state, whose update is
+    // applied serially once the metrics managers are done with the preceding events.
+    void processLogEventsInParallelLocked(const std::vector<LogEvent*>& events,
+                                          std::unordered_set<int>* uidsWithActiveConfigsChanged);
+
+    // Flushes configs over their memory limit and sends activation broadcasts after one or more
+    // events were processed.
+    void onLogEventsProcessedLocked(const int64_t elapsedRealtimeNs,
+                                    const std::unordered_set<int>& uidsWithActiveConfigsChanged);
+
     void resetIfConfigTtlExpiredLocked(const int64_t eventTimeNs);
 
+    // Applies [config]. [newMetricsManager], if set, was built for it without the lock and is
+    // used unless the config is updated in place.
     void OnConfigUpdatedLocked(const int64_t currentTimestampNs, const ConfigKey& key,
-                               const StatsdConfig& config, bool modularUpdate);
-
-    void GetActiveConfigsLocked(const int uid, vector<int64_t>& outActiveConfigs);
+                               const StatsdConfig& config, bool modularUpdate,
+                               const sp<MetricsManager>& newMetricsManager = nullptr);
+
+    // Builds the metrics manager of a new config. Only reads the members that are set at
+    // construction, so that several can be built at once, and without mMetricsMutex.
+    sp<MetricsManager> createMetricsManager(const int64_t currentTimestampNs,
+                                            const ConfigKey& key,
+                                            const StatsdConfig& config) const;
+
+    // Starts [metricsManager] for [key] if its config is valid, otherwise drops any existing
+    // metrics manager for [key]. Returns whether the config is valid.
+    bool addMetricsManagerLocked(const int64_t currentTimestampNs, const ConfigKey& key,
+                                 const sp<MetricsManager>& metricsManager);
+
+    // What the read-only binder queries need to know about a config.
+    struct ConfigSummary {
+        ConfigKey key;
+        bool isActive;
+        int64_t lastReportTimeNs;
+
+        bool operator==(const ConfigSummary& other) const {
+            return key == other.key && isActive == other.isActive &&
+                   lastReportTimeNs == other.lastReportTimeNs;
+        }
+    };
+
+    // Publishes the summaries of mMetricsManagers if they changed. Should be called whenever
+    // the configs, their active state or their last report time may have changed.
+    void publishConfigSummariesLocked();
+
+    // Returns the latest published config summaries.
+    inline std::shared_ptr<const std::vector<ConfigSummary>> getConfigSummaries() const {
+        return std::atomic_load(&mConfigSummaries);
+    }
 
     void WriteActiveConfigsToProtoOutputStreamLocked(
             int64_t currentTimeNs, const DumpReportReason reason, ProtoOutputStream* proto);
@@ -218,19 +493,53 @@ private:
 
     void WriteDataToDiskLocked(const ConfigKey& key, const int64_t timestampNs,
                                const int64_t wallClockNs, const DumpReportReason dumpReportReason,
-                               const DumpLatency dumpLatency);
+                               const DumpLatency dumpLatency,
+                               const bool includeCurrentPartialBucket = true);
 
     void onConfigMetricsReportLocked(
             const ConfigKey& key, const int64_t dumpTimeStampNs, const int64_t wallClockNs,
             const bool include_current_partial_bucket, const bool erase_data,
             const DumpReportReason dumpReportReason, const DumpLatency dumpLatency,
-            /*if dataSavedToDisk is true, it indicates the caller will write the data to disk
-             (e.g., before reboot). So no need to further persist local history.*/
-            const bool dataSavedToDisk, vector<uint8_t>* proto);
+            vector<uint8_t>* proto);
+
+    // Serializes the report in memory of [key] under mMetricsMutex, so that the reports on disk
+    // can be read and written after releasing it. Returns false if there is no such config.
+    bool dumpInMemoryReport(const ConfigKey& key, const int64_t dumpTimeStampNs,
+                            const int64_t wallClockNs, const bool include_current_partial_bucket,
+                            const bool erase_data, const DumpReportReason dumpReportReason,
+                            const DumpLatency dumpLatency, bool* keepFile,
+                            vector<uint8_t>* buffer);
+
+    // Writes the report in [buffer] to disk as a history file of [key].
+    void saveLocalHistory(const ConfigKey& key, const vector<uint8_t>& buffer);
 
     /* Check if we should send a broadcast if approaching memory limits and if we're over, we
-     * actually delete the data. */
-    void flushIfNecessaryLocked(const ConfigKey& key, MetricsManager& metricsManager);
+     * actually delete the data. [elapsedRealtimeNs] is the time the events were processed at,
+     * read once per batch. */
+    void flushIfNecessaryLocked(const ConfigKey& key, MetricsManager& metricsManager,
+                                const int64_t elapsedRealtimeNs);
+
+    /* Writes the past buckets of the largest configs to disk while the last checked bytes of all
+     * configs exceed the memory limit. */
+    void spillToMemoryLimitLocked(const int64_t elapsedRealtimeNs);
+
+    /* Appends the past buckets of the config to its checkpoint log if the checkpoint period
+     * elapsed since the last one. */
+    void checkpointIfNecessaryLocked(const ConfigKey& key, MetricsManager& metricsManager,
+                                     const int64_t elapsedRealtimeNs);
+
+    /* Dumps the past buckets of the config for its report stream, if it has one. Returns whether
+     * the buckets were dumped. They are sent by sendStreamedReports(). */
+    bool streamReportIfNecessaryLocked(const ConfigKey& key, MetricsManager& metricsManager,
+                                       const int64_t elapsedRealtimeNs);
+
+    /* Sends the reports dumped by streamReportIfNecessaryLocked() to their streams. Called without
+     * mMetricsMutex, since the streams are binder calls. */
+    void sendStreamedReports();
+
+    /* Writes the reports dumped by spillToMemoryLimitLocked() to disk. Called without
+     * mMetricsMutex, so that the events are not processed at the pace of the disk. */
+    void writeSpilledReports();
 
     // Maps the isolated uid in the log event to host uid if the log event contains uid fields.
     void mapIsolatedUidToHostUidIfNecessaryLocked(LogEvent* event) const;
@@ -254,6 +563,13 @@ private:
     std::vector<int64_t> processWatchdogRollbackOccurred(const int32_t rollbackTypeIn,
                                                           const string& packageName);
 
+    // Reads the train info of [trainName] from mTrainInfos, which is loaded from disk first if
+    // needed. Returns false if there is none.
+    bool readTrainInfoLocked(const string& trainName, InstallTrainInfo* trainInfo);
+
+    // Updates the train info in mTrainInfos, and on disk once the write queue gets to it.
+    void writeTrainInfoLocked(const InstallTrainInfo& trainInfo);
+
     // Reset all configs.
     void resetConfigsLocked(const int64_t timestampNs);
     // Reset the specified configs.
@@ -294,6 +610,50 @@ private:
     //Last time we wrote metadata to disk.
     int64_t mLastMetadataWriteNs = 0;
 
+    // The train info on disk by train name, so that the train events don't read it from disk.
+    // Loaded with the first train event.
+    std::unordered_map<string, InstallTrainInfo> mTrainInfos;
+
+    bool mTrainInfosLoaded = false;
+
+    // The ActiveConfig of a config as of the last SaveActiveConfigsToDisk().
+    struct SavedActiveConfig {
+        // MetricsManager::getActivationsVersion() when it was serialized.
+        uint64_t activationsVersion;
+
+        // Whether an activation was running, i.e. whether the remaining ttls are stale.
+        bool hadRunningActivation;
+
+        std::string bytes;
+    };
+
+    // The active configs on disk, reused for the configs whose activations did not change.
+    // Cleared when the file is.
+    std::unordered_map<ConfigKey, SavedActiveConfig> mSavedActiveConfigs;
+
+    // The StatsMetadata of a config as of the last SaveMetadataToDisk().
+    struct SavedMetadata {
+        // MetricsManager::getAlertMetadataVersion() when it was written.
+        uint64_t alertMetadataVersion;
+
+        // Whether there was any metadata to write.
+        bool written;
+
+        // The wall clock minus the elapsed realtime in seconds when it was written, which
+        // converted the refractory periods to wall clock time.
+        int64_t wallClockOffsetSec;
+
+        // The earliest refractory period end written, in wall clock seconds.
+        int64_t earliestRefractoryEndSec;
+
+        metadata::StatsMetadata metadata;
+    };
+
+    // The metadata on disk, reused for the configs whose refractory periods did not change, as
+    // long as the wall clock did not move against the elapsed realtime and none of its refractory
+    // periods expired. Cleared when the file is.
+    std::unordered_map<ConfigKey, SavedMetadata> mSavedMetadata;
+
     // The time for the next anomaly alarm for alerts.
     int64_t mNextAnomalyAlarmTime = 0;
 
@@ -303,6 +663,10 @@ private:
     FRIEND_TEST(StatsLogProcessorTest, TestRateLimitByteSize);
     FRIEND_TEST(StatsLogProcessorTest, TestRateLimitBroadcast);
     FRIEND_TEST(StatsLogProcessorTest, TestDropWhenByteSizeTooLarge);
+    FRIEND_TEST(StatsLogProcessorTest, TestSpillLargestConfigOverMemoryLimit);
+    FRIEND_TEST(StatsLogProcessorTest, TestSpillOnMemoryPressure);
+    FRIEND_TEST(StatsLogProcessorTest, TestCheckpointAppendsCompletedBuckets);
+    FRIEND_TEST(StatsLogProcessorTest, TestReportStreamSendsCompletedBuckets);
     FRIEND_TEST(StatsLogProcessorTest, InvalidConfigRemoved);
     FRIEND_TEST(StatsLogProcessorTest, TestActiveConfigMetricDiskWriteRead);
     FRIEND_TEST(StatsLogProcessorTest, TestActivationOnBoot);
@@ -310,6 +674,14 @@ private:
     FRIEND_TEST(StatsLogProcessorTest,
             TestActivationOnBootMultipleActivationsDifferentActivationTypes);
     FRIEND_TEST(StatsLogProcessorTest, TestActivationsPersistAcrossSystemServerRestart);
+    FRIEND_TEST(StatsLogProcessorTest, TestOnLogEventsBatch);
+    FRIEND_TEST(StatsLogProcessorTest, TestReportProtoReused);
+    FRIEND_TEST(StatsLogProcessorTest, TestSaveActiveConfigsOnlyWhenChanged);
+    FRIEND_TEST(StatsLogProcessorTest, TestTrainInfoCached);
+    FRIEND_TEST(StatsLogProcessorTest, TestOnLogEventsParallelDispatch);
+    FRIEND_TEST(StatsLogProcessorTest, TestOnConfigsLoadedInParallel);
+    FRIEND_TEST(StatsLogProcessorTest, TestSlicedStateConfigsBuiltWhileProcessing);
+    FRIEND_TEST(StatsLogProcessorTest, TestEventsRoutedByAtom);
 
     FRIEND_TEST(WakelockDurationE2eTest, TestAggregatedPredicateDimensionsForSumDuration1);
     FRIEND_TEST(WakelockDurationE2eTest, TestAggregatedPredicateDimensionsForSumDuration2);
@@ -334,6 +706,7 @@ private:
     FRIEND_TEST(AnomalyDetectionE2eTest, TestCountMetric_save_refractory_to_disk_no_data_written);
     FRIEND_TEST(AnomalyDetectionE2eTest, TestCountMetric_save_refractory_to_disk);
     FRIEND_TEST(AnomalyDetectionE2eTest, TestCountMetric_load_refractory_from_disk);
+    FRIEND_TEST(AnomalyDetectionE2eTest, TestCountMetric_save_refractory_after_wall_clock_change);
     FRIEND_TEST(AnomalyDetectionE2eTest, TestDurationMetric_SUM_single_bucket);
     FRIEND_TEST(AnomalyDetectionE2eTest, TestDurationMetric_SUM_partial_bucket);
     FRIEND_TEST(AnomalyDetectionE2eTest, TestDurationMetric_SUM_multiple_buckets);
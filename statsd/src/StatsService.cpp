@@ -22,9 +22,13 @@
 #include "android-base/stringprintf.h"
 #include "config/ConfigKey.h"
 #include "config/ConfigManager.h"
+#include "flags/FlagProvider.h"
 #include "guardrail/StatsdStats.h"
+#include "metrics/MetricsManager.h"
+#include "socket/StatsSocketListener.h"
 #include "storage/StorageManager.h"
 #include "subscriber/SubscriberReporter.h"
+#include "utils/ThreadTopology.h"
 
 #include <android-base/file.h>
 #include <android-base/strings.h>
@@ -42,6 +46,7 @@
 using namespace android;
 
 using android::base::StringPrintf;
+using android::base::unique_fd;
 using android::util::FIELD_COUNT_REPEATED;
 using android::util::FIELD_TYPE_MESSAGE;
 
@@ -62,6 +67,57 @@ constexpr const char* kIncludeCertificateHash = "include_certificate_hash";
 // for StatsDataDumpProto
 const int FIELD_ID_REPORTS_LIST = 1;
 
+// Max number of pushed events handed to StatsLogProcessor at once in batched processing mode.
+const size_t kMaxLogEventBatchSize = 64;
+
+// Default and max duration of `cmd stats capture-atoms`.
+const int kDefaultAtomCaptureSec = 10;
+const int kMaxAtomCaptureSec = 3600;
+
+// Number of worker threads dispatching event batches to metrics managers in parallel, in
+// addition to the log reader thread.
+const size_t kNumParallelDispatchThreads = 3;
+
+// Worker threads of the parallel pulls, and how long after a pull alarm they may still start.
+const size_t kNumParallelPullThreads = 3;
+const int64_t kParallelPullDeadlineNs = 10 * NS_PER_SEC;
+
+// Worker threads building the metrics managers of the configs loaded at startup.
+const size_t kNumParallelConfigLoadThreads = 3;
+
+// Worker threads serializing the metric reports of a config, in addition to the dumping thread.
+const size_t kNumParallelDumpThreads = 3;
+
+// With CHECKPOINT_METRICS_FLAG, the completed buckets are moved to disk this often.
+const int64_t kCheckpointPeriodNs = 5 * 60 * NS_PER_SEC;
+
+// How long a pull may be deferred to share the wakeup of a later pull.
+const int64_t kPullAlarmAlignmentWindowNs = 5 * NS_PER_SEC;
+
+// With COALESCED_TRIGGER_PULLS_FLAG, how long a deferred pull waits for the pulls deferred after
+// it. Well below the default max pull delay of the gauge metrics.
+const int64_t kDeferredPullWindowNs = NS_PER_SEC;
+
+// Adds how long a pushed event waited in the queue and how long it took to process to
+// [latencies], which are reported to StatsdStats once for several events.
+static void noteIngestionLatency(const LogEvent& event, int64_t processedNs,
+                                 StatsdStats::LogEventLatencies* latencies) {
+    if (event.getReceivedTimestampNs() == 0) {
+        return;
+    }
+    latencies->add(event.GetTagId(),
+                   event.getDequeuedTimestampNs() - event.getReceivedTimestampNs(),
+                   processedNs - event.getDequeuedTimestampNs());
+}
+
+// Reports the events parsed since the last call whose values were reallocated while parsing.
+static void noteLogEventValuesRegrown() {
+    const int64_t count = LogEvent::takeValuesRegrowCount();
+    if (count > 0) {
+        StatsdStats::getInstance().noteLogEventValuesRegrown(count);
+    }
+}
+
 static Status exception(int32_t code, const std::string& msg) {
     ALOGE("%s (%d)", msg.c_str(), code);
     return Status::fromExceptionCodeWithMessage(code, msg.c_str());
@@ -90,7 +146,9 @@ Status checkUid(uid_t expectedUid) {
     }                                                             \
 }
 
-StatsService::StatsService(const sp<Looper>& handlerLooper, shared_ptr<LogEventQueue> queue)
+StatsService::StatsService(const sp<Looper>& handlerLooper, shared_ptr<LogEventQueue> queue,
+                           shared_ptr<LogEventPool> eventPool,
+                           shared_ptr<LogEventFilter> logEventFilter)
     : mAnomalyAlarmMonitor(new AlarmMonitor(
               MIN_DIFF_TO_UPDATE_REGISTERED_ALARM_SECS,
               [this](const shared_ptr<IStatsCompanionService>& /*sc*/, int64_t timeMillis) {
@@ -116,6 +174,8 @@ StatsService::StatsService(const sp<Looper>& handlerLooper, shared_ptr<LogEventQ
                   }
               })),
       mEventQueue(queue),
+      mEventPool(eventPool),
+      mLogEventFilter(logEventFilter),
       mBootCompleteTrigger({kBootCompleteTag, kUidMapReceivedTag, kAllPullersRegisteredTag},
                            [this]() { mProcessor->onStatsdInitCompleted(getElapsedRealtimeNs()); }),
       mStatsCompanionServiceDeathRecipient(
@@ -164,6 +224,52 @@ StatsService::StatsService(const sp<Looper>& handlerLooper, shared_ptr<LogEventQ
                 return false;
             });
 
+    ThreadTopology& topology = ThreadTopology::getInstance();
+
+    // Parallel dispatch only applies to batches, see readLogBatches().
+    if (FlagProvider::getInstance().getBootFlagBool(BATCHED_EVENT_PROCESSING_FLAG, FLAG_FALSE) &&
+        FlagProvider::getInstance().getBootFlagBool(PARALLEL_DISPATCH_FLAG, FLAG_FALSE)) {
+        mProcessor->setParallelDispatchThreads(
+                topology.getPoolSize(ThreadRole::WORKERS, kNumParallelDispatchThreads));
+    }
+
+    if (FlagProvider::getInstance().getBootFlagBool(PARALLEL_CONFIG_LOAD_FLAG, FLAG_FALSE)) {
+        mProcessor->setParallelConfigLoadThreads(
+                topology.getPoolSize(ThreadRole::WORKERS, kNumParallelConfigLoadThreads));
+    }
+
+    if (FlagProvider::getInstance().getBootFlagBool(PARALLEL_DUMP_FLAG, FLAG_FALSE)) {
+        mProcessor->setParallelDumpThreads(
+                topology.getPoolSize(ThreadRole::WORKERS, kNumParallelDumpThreads));
+    }
+
+    if (FlagProvider::getInstance().getBootFlagBool(CHECKPOINT_METRICS_FLAG, FLAG_FALSE)) {
+        mProcessor->setCheckpointPeriodNs(kCheckpointPeriodNs);
+    }
+
+    if (FlagProvider::getInstance().getBootFlagBool(PARALLEL_PULLS_FLAG, FLAG_FALSE)) {
+        mPullerManager->SetParallelPulls(
+                topology.getPoolSize(ThreadRole::PULLS, kNumParallelPullThreads),
+                kParallelPullDeadlineNs);
+    }
+
+    if (FlagProvider::getInstance().getBootFlagBool(ALIGNED_PULL_ALARMS_FLAG, FLAG_FALSE)) {
+        mPullerManager->SetPullAlignmentWindow(kPullAlarmAlignmentWindowNs);
+    }
+
+    if (FlagProvider::getInstance().getBootFlagBool(COALESCED_TRIGGER_PULLS_FLAG, FLAG_FALSE)) {
+        mPullerManager->SetDeferredPullWindow(kDeferredPullWindowNs);
+        mPullerManager->EnableDeferredPulls();
+    } else if (FlagProvider::getInstance().getBootFlagBool(DEFERRED_CONDITION_PULLS_FLAG,
+                                                           FLAG_FALSE)) {
+        mPullerManager->EnableDeferredPulls();
+    }
+
+    if (mLogEventFilter != nullptr) {
+        mProcessor->setLogEventFilter(mLogEventFilter);
+    }
+    mAtomTraceRecorder = new AtomTraceRecorder(mLogEventFilter);
+
     mUidMap->setListener(mProcessor);
     mConfigManager->AddListener(mProcessor);
 
@@ -180,18 +286,81 @@ StatsService::~StatsService() {
 
 /* Runs on a dedicated thread to process pushed events. */
 void StatsService::readLogs() {
+    ScopedThreadRole role(ThreadRole::PROCESSING);
+    if (FlagProvider::getInstance().getBootFlagBool(BATCHED_EVENT_PROCESSING_FLAG, FLAG_FALSE)) {
+        readLogBatches();
+        return;
+    }
+
+    StatsdStats::LogEventLatencies latencies;
     // Read forever..... long live statsd
     while (1) {
         // Block until an event is available.
         auto event = mEventQueue->waitPop();
+        event->setDequeuedTimestampNs(getElapsedRealtimeNs());
+        // Events pushed in the deferred parse mode are parsed here, off the socket thread.
+        if (event->hasDeferredBuffer()) {
+            event->parseDeferredBuffer();
+        }
         // Pass it to StatsLogProcess to all configs/metrics
         // At this point, the LogEventQueue is not blocked, so that the socketListener
         // can read events from the socket and write to buffer to avoid data drop.
         mProcessor->OnLogEvent(event.get());
+        noteIngestionLatency(*event, getElapsedRealtimeNs(), &latencies);
+        // Reported once the queue is drained, or for as many events as a batch.
+        if (latencies.count() >= (int64_t)kMaxLogEventBatchSize || mEventQueue->size() == 0) {
+            StatsdStats::getInstance().noteLogEventLatencies(&latencies);
+        }
+        noteLogEventValuesRegrown();
         // The ShellSubscriber is only used by shell for local debugging.
         if (mShellSubscriber != nullptr) {
             mShellSubscriber->onLogEvent(*event);
         }
+        mAtomTraceRecorder->onLogEvent(*event);
+        if (mEventPool != nullptr) {
+            mEventPool->release(std::move(event));
+        }
+    }
+}
+
+void StatsService::readLogBatches() {
+    std::vector<std::unique_ptr<LogEvent>> events;
+    events.reserve(kMaxLogEventBatchSize);
+    StatsdStats::LogEventLatencies latencies;
+    // Read forever..... long live statsd
+    while (1) {
+        // Block until at least one event is available, then take everything that is queued.
+        mEventQueue->waitPopBatch(kMaxLogEventBatchSize, /*timeoutMs=*/-1, &events);
+        const int64_t dequeuedNs = getElapsedRealtimeNs();
+        // Events pushed in the deferred parse mode are parsed here, off the socket thread.
+        for (const auto& event : events) {
+            event->setDequeuedTimestampNs(dequeuedNs);
+            if (event->hasDeferredBuffer()) {
+                event->parseDeferredBuffer();
+            }
+        }
+        mProcessor->OnLogEvents(events);
+        // The processing latency of an event includes the rest of its batch.
+        const int64_t processedNs = getElapsedRealtimeNs();
+        for (const auto& event : events) {
+            noteIngestionLatency(*event, processedNs, &latencies);
+        }
+        StatsdStats::getInstance().noteLogEventLatencies(&latencies);
+        noteLogEventValuesRegrown();
+        // The ShellSubscriber is only used by shell for local debugging.
+        if (mShellSubscriber != nullptr) {
+            for (const auto& event : events) {
+                mShellSubscriber->onLogEvent(*event);
+            }
+        }
+        for (const auto& event : events) {
+            mAtomTraceRecorder->onLogEvent(*event);
+        }
+        if (mEventPool != nullptr) {
+            mEventPool->release(&events);
+        } else {
+            events.clear();
+        }
     }
 }
 
@@ -360,7 +529,8 @@ status_t StatsService::handleShellCommand(int in, int out, int err, const char**
             {
                 std::lock_guard<std::mutex> lock(mShellSubscriberMutex);
                 if (mShellSubscriber == nullptr) {
-                    mShellSubscriber = new ShellSubscriber(mUidMap, mPullerManager);
+                    mShellSubscriber =
+                            new ShellSubscriber(mUidMap, mPullerManager, mLogEventFilter);
                 }
             }
             int timeoutSec = -1;
@@ -370,6 +540,10 @@ status_t StatsService::handleShellCommand(int in, int out, int err, const char**
             mShellSubscriber->startNewSubscription(in, out, timeoutSec);
             return NO_ERROR;
         }
+
+        if (!utf8Args[0].compare(String8("capture-atoms"))) {
+            return cmd_capture_atoms(out, err, utf8Args);
+        }
     }
 
     print_cmd_help(out);
@@ -489,12 +663,21 @@ void StatsService::print_cmd_help(int out) {
     dprintf(out, "  --proto       Print proto binary instead of string format.\n");
     dprintf(out, "\n");
     dprintf(out, "\n");
+    dprintf(out, "usage: adb shell cmd stats meminfo\n");
+    dprintf(out, "  Prints the estimated memory used by each config and by the shared data.\n");
+    dprintf(out, "\n");
+    dprintf(out, "\n");
     dprintf(out, "usage: adb shell cmd stats clear-puller-cache\n");
     dprintf(out, "  Clear cached puller data.\n");
     dprintf(out, "\n");
     dprintf(out, "usage: adb shell cmd stats print-logs\n");
     dprintf(out, "  Requires root privileges.\n");
     dprintf(out, "  Can be disabled by calling adb shell cmd stats print-logs 0\n");
+    dprintf(out, "\n");
+    dprintf(out, "usage: adb shell cmd stats capture-atoms [SECONDS] > trace\n");
+    dprintf(out, "  Writes a binary trace of the pushed atoms, with their uid, pid and\n");
+    dprintf(out, "  timestamp, that statsd_trace_replay can replay.\n");
+    dprintf(out, "  SECONDS       The duration of the capture. Default is 10.\n");
 }
 
 status_t StatsService::cmd_trigger_broadcast(int out, Vector<String8>& args) {
@@ -862,7 +1045,11 @@ status_t StatsService::cmd_remove_all_configs(int out) {
 }
 
 status_t StatsService::cmd_dump_memory_info(int out) {
-    dprintf(out, "meminfo not available.\n");
+    dprintf(out, "Estimated heap bytes by subsystem:\n");
+    mProcessor->dumpMemoryUsage(out);
+    if (mEventQueue != nullptr) {
+        dprintf(out, "Log event queue: %zu\n", mEventQueue->getQueuedByteSize());
+    }
     return NO_ERROR;
 }
 
@@ -894,6 +1081,29 @@ status_t StatsService::cmd_print_logs(int out, const Vector<String8>& args) {
     return NO_ERROR;
 }
 
+status_t StatsService::cmd_capture_atoms(int out, int err, const Vector<String8>& args) {
+    int durationSec = kDefaultAtomCaptureSec;
+    if (args.size() >= 2) {
+        durationSec = atoi(args[1].c_str());
+        if (durationSec <= 0 || durationSec > kMaxAtomCaptureSec) {
+            dprintf(err, "The duration must be in [1, %d] seconds\n", kMaxAtomCaptureSec);
+            return BAD_VALUE;
+        }
+    }
+    VLOG("StatsService::cmd_capture_atoms for %d seconds", durationSec);
+    AtomTraceRecorder::CaptureStats stats;
+    if (!mAtomTraceRecorder->capture(out, durationSec, &stats)) {
+        dprintf(err, "Another capture is running\n");
+        return INVALID_OPERATION;
+    }
+    dprintf(err,
+            "Captured %lld atoms in %lld bytes, dropped %lld atoms, %lld atoms without "
+            "payload\n",
+            (long long)stats.atomCount, (long long)stats.byteCount,
+            (long long)stats.droppedAtomCount, (long long)stats.missingPayloadCount);
+    return NO_ERROR;
+}
+
 bool StatsService::getUidFromArgs(const Vector<String8>& args, size_t uidArgIndex, int32_t& uid) {
     return getUidFromString(args[uidArgIndex].c_str(), uid);
 }
@@ -933,34 +1143,7 @@ Status StatsService::informAllUidData(const ScopedFileDescriptor& fd) {
         return exception(EX_ILLEGAL_ARGUMENT, "Error parsing proto stream for UidData.");
     }
 
-    vector<String16> versionStrings;
-    vector<String16> installers;
-    vector<String16> packageNames;
-    vector<int32_t> uids;
-    vector<int64_t> versions;
-    vector<vector<uint8_t>> certificateHashes;
-
-    const auto numEntries = uidData.app_info_size();
-    versionStrings.reserve(numEntries);
-    installers.reserve(numEntries);
-    packageNames.reserve(numEntries);
-    uids.reserve(numEntries);
-    versions.reserve(numEntries);
-    certificateHashes.reserve(numEntries);
-
-    for (const auto& appInfo: uidData.app_info()) {
-        packageNames.emplace_back(String16(appInfo.package_name().c_str()));
-        uids.push_back(appInfo.uid());
-        versions.push_back(appInfo.version());
-        versionStrings.emplace_back(String16(appInfo.version_string().c_str()));
-        installers.emplace_back(String16(appInfo.installer().c_str()));
-
-        const string& certHash = appInfo.certificate_hash();
-        certificateHashes.emplace_back(certHash.begin(), certHash.end());
-    }
-
-    mUidMap->updateMap(getElapsedRealtimeNs(), uids, versions, versionStrings, packageNames,
-                       installers, certificateHashes);
+    mUidMap->updateMap(getElapsedRealtimeNs(), uidData);
 
     mBootCompleteTrigger.markComplete(kUidMapReceivedTag);
     VLOG("StatsService::informAllUidData UidData proto parsed successfully.");
@@ -1037,12 +1220,72 @@ Status StatsService::informDeviceShutdown() {
     VLOG("StatsService::informDeviceShutdown");
     int64_t elapsedRealtimeNs = getElapsedRealtimeNs();
     int64_t wallClockNs = getWallClockNs();
-    mProcessor->WriteDataToDisk(DEVICE_SHUTDOWN, FAST, elapsedRealtimeNs, wallClockNs);
-    mProcessor->SaveActiveConfigsToDisk(elapsedRealtimeNs);
-    mProcessor->SaveMetadataToDisk(wallClockNs, elapsedRealtimeNs);
+    {
+        StorageManager::ScopedSyncBatch syncBatch;
+        mProcessor->WriteDataToDisk(DEVICE_SHUTDOWN, FAST, elapsedRealtimeNs, wallClockNs);
+        mProcessor->SaveActiveConfigsToDisk(elapsedRealtimeNs);
+        mProcessor->SaveMetadataToDisk(wallClockNs, elapsedRealtimeNs);
+    }
+    // The device may power off once this returns.
+    StorageManager::flushWrites();
+    return Status::ok();
+}
+
+Status StatsService::informMemoryPressure() {
+    ENFORCE_UID(AID_SYSTEM);
+    VLOG("StatsService::informMemoryPressure");
+    mProcessor->onMemoryPressure(getElapsedRealtimeNs());
+    return Status::ok();
+}
+
+Status StatsService::registerAtomRing(const ScopedFileDescriptor& ring,
+                                      const ScopedFileDescriptor& wakeFd, bool* _aidl_return) {
+    *_aidl_return = false;
+    const uid_t uid = AIBinder_getCallingUid();
+    const pid_t pid = AIBinder_getCallingPid();
+    // The rings save syscalls for the heaviest loggers, the native processes trusted to
+    // register pullers.
+    if (!checkPermission(kPermissionRegisterPullAtom)) {
+        return exception(EX_SECURITY,
+                         StringPrintf("Uid %d does not have the %s permission when registering "
+                                      "an atom ring",
+                                      uid, kPermissionRegisterPullAtom));
+    }
+    VLOG("StatsService::registerAtomRing from uid %d pid %d", uid, pid);
+    sp<StatsSocketListener> socketListener;
+    {
+        lock_guard<mutex> lock(mSocketListenerMutex);
+        socketListener = mSocketListener;
+    }
+    if (socketListener == nullptr) {
+        return Status::ok();
+    }
+    *_aidl_return = socketListener->registerRing(unique_fd(dup(ring.get())),
+                                                 unique_fd(dup(wakeFd.get())), uid, pid);
+    return Status::ok();
+}
+
+Status StatsService::unregisterAtomRing() {
+    const uid_t uid = AIBinder_getCallingUid();
+    const pid_t pid = AIBinder_getCallingPid();
+    VLOG("StatsService::unregisterAtomRing from uid %d pid %d", uid, pid);
+    sp<StatsSocketListener> socketListener;
+    {
+        lock_guard<mutex> lock(mSocketListenerMutex);
+        socketListener = mSocketListener;
+    }
+    if (socketListener != nullptr) {
+        // Only the rings of the caller can be released.
+        socketListener->unregisterRing(uid, pid);
+    }
     return Status::ok();
 }
 
+void StatsService::setSocketListener(const sp<StatsSocketListener>& socketListener) {
+    lock_guard<mutex> lock(mSocketListenerMutex);
+    mSocketListener = socketListener;
+}
+
 void StatsService::sayHiToStatsCompanion() {
     shared_ptr<IStatsCompanionService> statsCompanion = getStatsCompanionService();
     if (statsCompanion != nullptr) {
@@ -1080,6 +1323,7 @@ Status StatsService::bootCompleted() {
 }
 
 void StatsService::Startup() {
+    StorageManager::rebuildDataFileIndex();
     mConfigManager->Startup();
     mProcessor->LoadActiveConfigsFromDisk();
     mProcessor->LoadMetadataFromDisk(getWallClockNs(), getElapsedRealtimeNs());
@@ -1090,10 +1334,14 @@ void StatsService::Terminate() {
     if (mProcessor != nullptr) {
         int64_t elapsedRealtimeNs = getElapsedRealtimeNs();
         int64_t wallClockNs = getWallClockNs();
-        mProcessor->WriteDataToDisk(TERMINATION_SIGNAL_RECEIVED, FAST, elapsedRealtimeNs,
-                                    wallClockNs);
-        mProcessor->SaveActiveConfigsToDisk(elapsedRealtimeNs);
-        mProcessor->SaveMetadataToDisk(wallClockNs, elapsedRealtimeNs);
+        {
+            StorageManager::ScopedSyncBatch syncBatch;
+            mProcessor->WriteDataToDisk(TERMINATION_SIGNAL_RECEIVED, FAST, elapsedRealtimeNs,
+                                        wallClockNs);
+            mProcessor->SaveActiveConfigsToDisk(elapsedRealtimeNs);
+            mProcessor->SaveMetadataToDisk(wallClockNs, elapsedRealtimeNs);
+        }
+        StorageManager::flushWrites();
     }
 }
 
@@ -1103,6 +1351,7 @@ void StatsService::OnLogEvent(LogEvent* event) {
     if (mShellSubscriber != nullptr) {
         mShellSubscriber->onLogEvent(*event);
     }
+    mAtomTraceRecorder->onLogEvent(*event);
 }
 
 Status StatsService::getData(int64_t key, const int32_t callingUid, vector<uint8_t>* output) {
@@ -1118,6 +1367,21 @@ Status StatsService::getData(int64_t key, const int32_t callingUid, vector<uint8
     return Status::ok();
 }
 
+Status StatsService::getDataFd(int64_t key, const int32_t callingUid,
+                               const ScopedFileDescriptor& fd) {
+    ENFORCE_UID(AID_SYSTEM);
+
+    VLOG("StatsService::getDataFd with Uid %i", callingUid);
+    ConfigKey configKey(callingUid, key);
+    // The fd is closed once the call returns, which ends the data for the reader.
+    if (!mProcessor->onDumpReport(configKey, getElapsedRealtimeNs(), getWallClockNs(),
+                                  false /* include_current_bucket*/, true /* erase_data */,
+                                  GET_DATA_CALLED, FAST, fd.get())) {
+        return exception(EX_ILLEGAL_STATE, "Failed to write the data to the file descriptor.");
+    }
+    return Status::ok();
+}
+
 Status StatsService::getMetadata(vector<uint8_t>* output) {
     ENFORCE_UID(AID_SYSTEM);
 
@@ -1171,6 +1435,26 @@ Status StatsService::setDataFetchOperation(int64_t key,
     return Status::ok();
 }
 
+Status StatsService::setReportStreamCallback(int64_t key,
+                                             const shared_ptr<IReportStreamCallback>& callback,
+                                             const int32_t callingUid) {
+    ENFORCE_UID(AID_SYSTEM);
+
+    ConfigKey configKey(callingUid, key);
+    mProcessor->setReportStream(configKey, [callback](const vector<uint8_t>& chunk, bool last) {
+        Status status = callback->onReportChunk(chunk, last);
+        return !(status.getExceptionCode() == EX_TRANSACTION_FAILED &&
+                 status.getStatus() == STATUS_DEAD_OBJECT);
+    });
+    return Status::ok();
+}
+
+Status StatsService::removeReportStreamCallback(int64_t key, const int32_t callingUid) {
+    ENFORCE_UID(AID_SYSTEM);
+    mProcessor->removeReportStream(ConfigKey(callingUid, key));
+    return Status::ok();
+}
+
 Status StatsService::setActiveConfigsChangedOperation(const shared_ptr<IPendingIntentRef>& pir,
                                                       const int32_t callingUid,
                                                       vector<int64_t>* output) {
@@ -1310,6 +1594,10 @@ Status StatsService::updateProperties(const vector<PropertyParcel>& properties)
     for (const auto& [property, value] : properties) {
         if (property == kIncludeCertificateHash) {
             mUidMap->setIncludeCertificateHash(value == "true");
+        } else if (property == THREAD_TOPOLOGY_FLAG) {
+            ThreadTopology::getInstance().setConfig(value);
+        } else if (property == CONFIG_COST_BUDGET_FLAG) {
+            MetricsManager::SetConfigCostBudget(value);
         }
     }
     return Status::ok();
@@ -20,6 +20,7 @@
 #include <aidl/android/os/BnStatsd.h>
 #include <aidl/android/os/IPendingIntentRef.h>
 #include <aidl/android/os/IPullAtomCallback.h>
+#include <aidl/android/os/IReportStreamCallback.h>
 #include <aidl/android/util/PropertyParcel.h>
 #include <gtest/gtest_prod.h>
 #include <utils/Looper.h>
@@ -30,9 +31,12 @@
 #include "anomaly/AlarmMonitor.h"
 #include "config/ConfigManager.h"
 #include "external/StatsPullerManager.h"
+#include "logd/LogEventPool.h"
 #include "logd/LogEventQueue.h"
 #include "packages/UidMap.h"
+#include "shell/AtomTraceRecorder.h"
 #include "shell/ShellSubscriber.h"
+#include "socket/LogEventFilter.h"
 #include "statscompanion_util.h"
 #include "utils/MultiConditionTrigger.h"
 
@@ -44,6 +48,7 @@ using Status = ::ndk::ScopedAStatus;
 using aidl::android::os::BnStatsd;
 using aidl::android::os::IPendingIntentRef;
 using aidl::android::os::IPullAtomCallback;
+using aidl::android::os::IReportStreamCallback;
 using aidl::android::util::PropertyParcel;
 using ::ndk::ScopedAIBinder_DeathRecipient;
 using ::ndk::ScopedFileDescriptor;
@@ -53,9 +58,13 @@ namespace android {
 namespace os {
 namespace statsd {
 
+class StatsSocketListener;
+
 class StatsService : public BnStatsd {
 public:
-    StatsService(const sp<Looper>& handlerLooper, std::shared_ptr<LogEventQueue> queue);
+    StatsService(const sp<Looper>& handlerLooper, std::shared_ptr<LogEventQueue> queue,
+                 std::shared_ptr<LogEventPool> eventPool = nullptr,
+                 std::shared_ptr<LogEventFilter> logEventFilter = nullptr);
     virtual ~StatsService();
 
     /** The anomaly alarm registered with AlarmManager won't be updated by less than this. */
@@ -79,6 +88,27 @@ public:
     virtual Status informOnePackageRemoved(const string& app, int32_t uid);
     virtual Status informDeviceShutdown();
 
+    /**
+     * Binder call to tell statsd that the system is low on memory.
+     */
+    virtual Status informMemoryPressure();
+
+    /**
+     * Binder call to register the shared memory ring of a system process.
+     */
+    virtual Status registerAtomRing(const ScopedFileDescriptor& ring,
+                                    const ScopedFileDescriptor& wakeFd, bool* _aidl_return);
+
+    /**
+     * Binder call to release the shared memory ring of the calling process.
+     */
+    virtual Status unregisterAtomRing();
+
+    /**
+     * Enables the shared memory rings, which are drained by [socketListener].
+     */
+    void setSocketListener(const sp<StatsSocketListener>& socketListener);
+
     /**
      * Called right before we start processing events.
      */
@@ -101,6 +131,13 @@ public:
                            const int32_t callingUid,
                            vector<uint8_t>* output) override;
 
+    /**
+     * Binder call for clients to request data for this configuration key through a file
+     * descriptor.
+     */
+    virtual Status getDataFd(int64_t key, const int32_t callingUid,
+                             const ScopedFileDescriptor& fd) override;
+
 
     /**
      * Binder call for clients to get metadata across all configs in statsd.
@@ -129,6 +166,18 @@ public:
     virtual Status removeDataFetchOperation(int64_t key,
                                             const int32_t callingUid) override;
 
+    /**
+     * Binder call to let clients receive the completed buckets of a config as they close.
+     */
+    virtual Status setReportStreamCallback(int64_t key,
+                                           const shared_ptr<IReportStreamCallback>& callback,
+                                           const int32_t callingUid) override;
+
+    /**
+     * Binder call to remove the report stream callback for the specified config key.
+     */
+    virtual Status removeReportStreamCallback(int64_t key, const int32_t callingUid) override;
+
     /**
      * Binder call to let clients register the active configs changed operation.
      */
@@ -235,6 +284,9 @@ private:
     /* Runs on its dedicated thread to process pushed stats event from socket. */
     void readLogs();
 
+    /* Same as readLogs, but pops and processes the queued events in batches. */
+    void readLogBatches();
+
     /**
      * Trigger a broadcast.
      */
@@ -307,6 +359,11 @@ private:
      */
     status_t cmd_print_logs(int outFd, const Vector<String8>& args);
 
+    /**
+     * Write a trace of the pushed atoms to outFd, see AtomTraceRecorder.
+     */
+    status_t cmd_capture_atoms(int outFd, int errFd, const Vector<String8>& args);
+
     /**
      * Writes the value of args[uidArgIndex] into uid.
      * Returns whether the uid is reasonable (type uid_t) and whether
@@ -387,8 +444,22 @@ private:
      * Mutex for setting the shell subscriber
      */
     mutable mutex mShellSubscriberMutex;
+
+    // Records the pushed atoms for `cmd stats capture-atoms`.
+    sp<AtomTraceRecorder> mAtomTraceRecorder;
+
+    // Drains the shared memory rings. Null if they are disabled. Guarded by mSocketListenerMutex.
+    sp<StatsSocketListener> mSocketListener;
+    mutable mutex mSocketListenerMutex;
+
     std::shared_ptr<LogEventQueue> mEventQueue;
 
+    // Processed pushed events are returned here for reuse. May be null.
+    std::shared_ptr<LogEventPool> mEventPool;
+
+    // Filter of the atoms parsed by the socket listener in the lazy parse mode. May be null.
+    std::shared_ptr<LogEventFilter> mLogEventFilter;
+
     MultiConditionTrigger mBootCompleteTrigger;
     static const inline string kBootCompleteTag = "BOOT_COMPLETE";
     static const inline string kUidMapReceivedTag = "UID_MAP";
@@ -45,26 +45,38 @@ void AlarmMonitor::setStatsCompanionService(
         return;
     }
     VLOG("Creating link to statsCompanionService");
-    const sp<const InternalAlarm> top = mPq.top();
-    if (top != nullptr) {
-        updateRegisteredAlarmTime_l(top->timestampSec);
+    if (!mAlarms.empty()) {
+        updateRegisteredAlarmTime_l((*mAlarms.begin())->timestampSec);
     }
 }
 
-void AlarmMonitor::add(sp<const InternalAlarm> alarm) {
-    std::lock_guard<std::mutex> lock(mLock);
+bool AlarmMonitor::addLocked(const sp<const InternalAlarm>& alarm) {
     if (alarm == nullptr) {
         ALOGW("Asked to add a null alarm.");
-        return;
+        return false;
     }
     if (alarm->timestampSec < 1) {
         // forbidden since a timestamp 0 is used to indicate no alarm registered
         ALOGW("Asked to add a 0-time alarm.");
-        return;
+        return false;
     }
     // TODO(b/110563466): Ensure that refractory period is respected.
     VLOG("Adding alarm with time %u", alarm->timestampSec);
-    mPq.push(alarm);
+    return mAlarms.insert(alarm).second;
+}
+
+bool AlarmMonitor::removeLocked(const sp<const InternalAlarm>& alarm) {
+    if (alarm == nullptr) {
+        ALOGW("Asked to remove a null alarm.");
+        return false;
+    }
+    VLOG("Removing alarm with time %u", alarm->timestampSec);
+    return mAlarms.erase(alarm) > 0;
+}
+
+void AlarmMonitor::add(sp<const InternalAlarm> alarm) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (!addLocked(alarm)) return;
     if (mRegisteredAlarmTimeSec < 1 ||
         alarm->timestampSec + mMinUpdateTimeSec < mRegisteredAlarmTimeSec) {
         updateRegisteredAlarmTime_l(alarm->timestampSec);
@@ -73,26 +85,46 @@ void AlarmMonitor::add(sp<const InternalAlarm> alarm) {
 
 void AlarmMonitor::remove(sp<const InternalAlarm> alarm) {
     std::lock_guard<std::mutex> lock(mLock);
-    if (alarm == nullptr) {
-        ALOGW("Asked to remove a null alarm.");
+    if (!removeLocked(alarm)) return;
+    if (mAlarms.empty()) {
+        VLOG("Queue is empty. Cancel any alarm.");
+        cancelRegisteredAlarmTime_l();
         return;
     }
-    VLOG("Removing alarm with time %u", alarm->timestampSec);
-    bool wasPresent = mPq.remove(alarm);
-    if (!wasPresent) return;
-    if (mPq.empty()) {
+    uint32_t soonestAlarmTimeSec = (*mAlarms.begin())->timestampSec;
+    VLOG("Soonest alarm is %u", soonestAlarmTimeSec);
+    if (soonestAlarmTimeSec > mRegisteredAlarmTimeSec + mMinUpdateTimeSec) {
+        updateRegisteredAlarmTime_l(soonestAlarmTimeSec);
+    }
+}
+
+void AlarmMonitor::update(const std::vector<sp<const InternalAlarm>>& toRemove,
+                          const std::vector<sp<const InternalAlarm>>& toAdd) {
+    std::lock_guard<std::mutex> lock(mLock);
+    bool changed = false;
+    for (const sp<const InternalAlarm>& alarm : toRemove) {
+        changed |= removeLocked(alarm);
+    }
+    for (const sp<const InternalAlarm>& alarm : toAdd) {
+        changed |= addLocked(alarm);
+    }
+    if (!changed) return;
+    if (mAlarms.empty()) {
         VLOG("Queue is empty. Cancel any alarm.");
         cancelRegisteredAlarmTime_l();
         return;
     }
-    uint32_t soonestAlarmTimeSec = mPq.top()->timestampSec;
+    // Moves the registered alarm earlier as add() would, or later as remove() would.
+    uint32_t soonestAlarmTimeSec = (*mAlarms.begin())->timestampSec;
     VLOG("Soonest alarm is %u", soonestAlarmTimeSec);
-    if (soonestAlarmTimeSec > mRegisteredAlarmTimeSec + mMinUpdateTimeSec) {
+    if (mRegisteredAlarmTimeSec < 1 ||
+        soonestAlarmTimeSec + mMinUpdateTimeSec < mRegisteredAlarmTimeSec ||
+        soonestAlarmTimeSec > mRegisteredAlarmTimeSec + mMinUpdateTimeSec) {
         updateRegisteredAlarmTime_l(soonestAlarmTimeSec);
     }
 }
 
-// More efficient than repeatedly calling remove(mPq.top()) since it batches the
+// More efficient than repeatedly calling remove() on the soonest alarm since it batches the
 // updates to the registered alarm.
 unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>> AlarmMonitor::popSoonerThan(
         uint32_t timestampSec) {
@@ -100,19 +132,19 @@ unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>> AlarmMonitor::popS
     unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>> oldAlarms;
     std::lock_guard<std::mutex> lock(mLock);
 
-    for (sp<const InternalAlarm> t = mPq.top(); t != nullptr && t->timestampSec <= timestampSec;
-        t = mPq.top()) {
-        oldAlarms.insert(t);
-        mPq.pop();  // remove t
+    auto it = mAlarms.begin();
+    for (; it != mAlarms.end() && (*it)->timestampSec <= timestampSec; it++) {
+        oldAlarms.insert(*it);
     }
+    mAlarms.erase(mAlarms.begin(), it);
     // Always update registered alarm time (if anything has changed).
     if (!oldAlarms.empty()) {
-        if (mPq.empty()) {
+        if (mAlarms.empty()) {
             VLOG("Queue is empty. Cancel any alarm.");
             cancelRegisteredAlarmTime_l();
         } else {
             // Always update the registered alarm in this case (unlike remove()).
-            updateRegisteredAlarmTime_l(mPq.top()->timestampSec);
+            updateRegisteredAlarmTime_l((*mAlarms.begin())->timestampSec);
         }
     }
     return oldAlarms;
@@ -16,14 +16,17 @@
 
 #pragma once
 
-#include "anomaly/indexed_priority_queue.h"
-
 #include <aidl/android/os/IStatsCompanionService.h>
 #include <utils/RefBase.h>
 
+#include <functional>
+#include <mutex>
+#include <set>
 #include <unordered_set>
 #include <vector>
 
+#include "utils/SpHash.h"
+
 using namespace android;
 
 using aidl::android::os::IStatsCompanionService;
@@ -53,6 +56,16 @@ struct InternalAlarm : public RefBase {
             return (a->timestampSec < b->timestampSec);
         }
     };
+
+    /** Orders alarms by timestamp, then by address, so that distinct alarms are never equal. */
+    struct SoonerThan {
+        bool operator()(const sp<const InternalAlarm>& a, const sp<const InternalAlarm>& b) const {
+            if (a->timestampSec != b->timestampSec) {
+                return a->timestampSec < b->timestampSec;
+            }
+            return std::less<const InternalAlarm*>()(a.get(), b.get());
+        }
+    };
 };
 
 /**
@@ -91,6 +104,13 @@ public:
      */
     void remove(sp<const InternalAlarm> alarm);
 
+    /**
+     * Removes the alarms of [toRemove] and adds those of [toAdd], as remove() and add() would,
+     * but updates the registered alarm at most once, for the resulting soonest alarm.
+     */
+    void update(const std::vector<sp<const InternalAlarm>>& toRemove,
+                const std::vector<sp<const InternalAlarm>>& toAdd);
+
     /**
      * Returns and removes all alarms whose timestamp <= the given timestampSec.
      * Always updates the registered alarm if return is non-empty.
@@ -113,15 +133,16 @@ private:
     /**
      * Timestamp (seconds since epoch) of the alarm registered with
      * StatsCompanionService. This, in general, may not be equal to the soonest
-     * alarm stored in mPq, but should be within minUpdateTimeSec of it.
+     * alarm stored in mAlarms, but should be within minUpdateTimeSec of it.
      * A value of 0 indicates that no alarm is currently registered.
      */
     uint32_t mRegisteredAlarmTimeSec;
 
     /**
-     * Priority queue of alarms, prioritized by soonest alarm.timestampSec.
+     * Alarms ordered by soonest alarm.timestampSec. Removing an alarm is a single lookup, and
+     * popping the ones that fired removes a range.
      */
-    indexed_priority_queue<InternalAlarm, InternalAlarm::SmallerTimestamp> mPq;
+    std::set<sp<const InternalAlarm>, InternalAlarm::SoonerThan> mAlarms;
 
     /**
      * Binder interface for communicating with StatsCompanionService.
@@ -134,6 +155,12 @@ private:
      */
     uint32_t mMinUpdateTimeSec;
 
+    /** Adds [alarm] to mAlarms. Returns false if it is invalid or already present. */
+    bool addLocked(const sp<const InternalAlarm>& alarm);
+
+    /** Removes [alarm] from mAlarms. Returns false if it was not present. */
+    bool removeLocked(const sp<const InternalAlarm>& alarm);
+
     /**
      * Updates the alarm registered with StatsCompanionService to the given time.
      * Also correspondingly updates mRegisteredAlarmTimeSec.
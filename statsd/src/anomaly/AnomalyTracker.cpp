@@ -50,10 +50,10 @@ void AnomalyTracker::onConfigUpdated() {
 
 void AnomalyTracker::resetStorage() {
     VLOG("resetStorage() called.");
-    mPastBuckets.clear();
+    mPastDimensions.clear();
     // Excludes the current bucket.
-    mPastBuckets.resize(mNumOfPastBuckets);
-    mSumOverPastBuckets.clear();
+    mBucketDimensions.clear();
+    mBucketDimensions.resize(mNumOfPastBuckets);
 }
 
 size_t AnomalyTracker::index(int64_t bucketNum) const {
@@ -80,11 +80,9 @@ void AnomalyTracker::advanceMostRecentBucketTo(const int64_t& bucketNum) {
         return;
     }
 
-    // Clear out space by emptying out old mPastBuckets[i] values and update mSumOverPastBuckets.
+    // Clear out space by expiring the values of the old buckets.
     for (int64_t i = mMostRecentBucketNum + 1; i <= bucketNum; i++) {
-        const int idx = index(i);
-        subtractBucketFromSum(mPastBuckets[idx]);
-        mPastBuckets[idx] = nullptr;  // release (but not clear) the old bucket.
+        clearPastBucket(index(i));
     }
     mMostRecentBucketNum = bucketNum;
 }
@@ -98,25 +96,11 @@ void AnomalyTracker::addPastBucket(const MetricDimensionKey& key,
         return;
     }
 
-    const int bucketIndex = index(bucketNum);
-    if (bucketNum <= mMostRecentBucketNum && (mPastBuckets[bucketIndex] != nullptr)) {
-        // We need to insert into an already existing past bucket.
-        std::shared_ptr<DimToValMap>& bucket = mPastBuckets[bucketIndex];
-        auto itr = bucket->find(key);
-        if (itr != bucket->end()) {
-            // Old entry already exists; update it.
-            subtractValueFromSum(key, itr->second);
-            itr->second = bucketValue;
-        } else {
-            bucket->insert({key, bucketValue});
-        }
-        mSumOverPastBuckets[key] += bucketValue;
-    } else {
-        // Bucket does not exist yet (in future or was never made), so we must make it.
-        std::shared_ptr<DimToValMap> bucket = std::make_shared<DimToValMap>();
-        bucket->insert({key, bucketValue});
-        addPastBucket(bucket, bucketNum);
+    if (bucketNum > mMostRecentBucketNum) {
+        // Clear space for the new bucket to be at bucketNum.
+        advanceMostRecentBucketTo(bucketNum);
     }
+    setPastBucketValue(key, index(bucketNum), bucketValue);
 }
 
 void AnomalyTracker::addPastBucket(std::shared_ptr<DimToValMap> bucket,
@@ -127,47 +111,54 @@ void AnomalyTracker::addPastBucket(std::shared_ptr<DimToValMap> bucket,
         return;
     }
 
+    const size_t bucketIndex = index(bucketNum);
     if (bucketNum <= mMostRecentBucketNum) {
         // We are updating an old bucket, not adding a new one.
-        subtractBucketFromSum(mPastBuckets[index(bucketNum)]);
+        clearPastBucket(bucketIndex);
     } else {
         // Clear space for the new bucket to be at bucketNum.
         advanceMostRecentBucketTo(bucketNum);
     }
-    mPastBuckets[index(bucketNum)] = bucket;
-    addBucketToSum(bucket);
-}
-
-void AnomalyTracker::subtractBucketFromSum(const shared_ptr<DimToValMap>& bucket) {
     if (bucket == nullptr) {
         return;
     }
-    for (const auto& keyValuePair : *bucket) {
-        subtractValueFromSum(keyValuePair.first, keyValuePair.second);
+    for (const auto& [key, value] : *bucket) {
+        setPastBucketValue(key, bucketIndex, value);
     }
 }
 
-
-void AnomalyTracker::subtractValueFromSum(const MetricDimensionKey& key,
-                                          const int64_t& bucketValue) {
-    auto itr = mSumOverPastBuckets.find(key);
-    if (itr == mSumOverPastBuckets.end()) {
-        return;
-    }
-    itr->second -= bucketValue;
-    if (itr->second == 0) {
-        mSumOverPastBuckets.erase(itr);
+void AnomalyTracker::clearPastBucket(size_t bucketIndex) {
+    std::vector<PastDimensionMap::value_type*>& dimensions = mBucketDimensions[bucketIndex];
+    for (PastDimensionMap::value_type* entry : dimensions) {
+        PastDimension& dimension = entry->second;
+        dimension.sum -= dimension.values[bucketIndex];
+        dimension.values[bucketIndex] = 0;
+        dimension.hasValue[bucketIndex] = false;
+        if (--dimension.numBuckets == 0) {
+            mPastDimensions.erase(mPastDimensions.find(entry->first));
+        }
     }
+    dimensions.clear();
 }
 
-void AnomalyTracker::addBucketToSum(const shared_ptr<DimToValMap>& bucket) {
-    if (bucket == nullptr) {
-        return;
+void AnomalyTracker::setPastBucketValue(const MetricDimensionKey& key, size_t bucketIndex,
+                                        const int64_t& bucketValue) {
+    PastDimensionMap::value_type& entry = *mPastDimensions.try_emplace(key).first;
+    PastDimension& dimension = entry.second;
+    if (dimension.values.empty()) {
+        dimension.values.resize(mNumOfPastBuckets);
+        dimension.hasValue.resize(mNumOfPastBuckets);
     }
-    // For each dimension present in the bucket, add its value to its corresponding sum.
-    for (const auto& keyValuePair : *bucket) {
-        mSumOverPastBuckets[keyValuePair.first] += keyValuePair.second;
+    if (dimension.hasValue[bucketIndex]) {
+        // Old entry already exists; update it.
+        dimension.sum -= dimension.values[bucketIndex];
+    } else {
+        dimension.hasValue[bucketIndex] = true;
+        dimension.numBuckets++;
+        mBucketDimensions[bucketIndex].push_back(&entry);
     }
+    dimension.values[bucketIndex] = bucketValue;
+    dimension.sum += bucketValue;
 }
 
 int64_t AnomalyTracker::getPastBucketValue(const MetricDimensionKey& key,
@@ -178,18 +169,14 @@ int64_t AnomalyTracker::getPastBucketValue(const MetricDimensionKey& key,
         return 0;
     }
 
-    const auto& bucket = mPastBuckets[index(bucketNum)];
-    if (bucket == nullptr) {
-        return 0;
-    }
-    const auto& itr = bucket->find(key);
-    return itr == bucket->end() ? 0 : itr->second;
+    const auto& itr = mPastDimensions.find(key);
+    return itr == mPastDimensions.end() ? 0 : itr->second.values[index(bucketNum)];
 }
 
 int64_t AnomalyTracker::getSumOverPastBuckets(const MetricDimensionKey& key) const {
-    const auto& itr = mSumOverPastBuckets.find(key);
-    if (itr != mSumOverPastBuckets.end()) {
-        return itr->second;
+    const auto& itr = mPastDimensions.find(key);
+    if (itr != mPastDimensions.end()) {
+        return itr->second.sum;
     }
     return 0;
 }
@@ -217,6 +204,7 @@ void AnomalyTracker::declareAnomaly(const int64_t& timestampNs, int64_t metricId
     if (mAlert.has_refractory_period_secs()) {
         mRefractoryPeriodEndsSec[key] = ((timestampNs + NS_PER_SEC - 1) / NS_PER_SEC) // round up
                                         + mAlert.refractory_period_secs();
+        mRefractoryPeriodsVersion++;
         // TODO(b/110563466): If we had access to the bucket_size_millis, consider
         // calling resetStorage()
         // if (mAlert.refractory_period_secs() > mNumOfPastBuckets * bucketSizeNs) {resetStorage();}
@@ -264,6 +252,22 @@ std::pair<bool, uint64_t> AnomalyTracker::getProtoHash() const {
     return {true, Hash64(serializedAlert)};
 }
 
+size_t AnomalyTracker::byteSize() const {
+    size_t totalSize = 0;
+    for (const auto& [key, pastDimension] : mPastDimensions) {
+        totalSize += hashMapEntryByteSize(key, sizeof(PastDimension)) +
+                     pastDimension.values.capacity() * sizeof(int64_t) +
+                     pastDimension.hasValue.capacity() / 8;
+    }
+    for (const auto& bucketDimensions : mBucketDimensions) {
+        totalSize += bucketDimensions.capacity() * sizeof(PastDimensionMap::value_type*);
+    }
+    for (const auto& [key, _] : mRefractoryPeriodEndsSec) {
+        totalSize += hashMapEntryByteSize(key, sizeof(uint32_t));
+    }
+    return totalSize;
+}
+
 void AnomalyTracker::informSubscribers(const MetricDimensionKey& key, int64_t metric_id,
                                        int64_t metricValue) {
     triggerSubscribers(mAlert.id(), metric_id, key, metricValue, mConfigKey, mSubscriptions);
@@ -318,6 +322,7 @@ void AnomalyTracker::loadAlertMetadata(
         int32_t refractoryPeriodEndsSec = (int32_t) keyedData.last_refractory_ends_sec() -
                 currentWallClockTimeNs / NS_PER_SEC + systemElapsedTimeNs / NS_PER_SEC;
         mRefractoryPeriodEndsSec[metricKey] = refractoryPeriodEndsSec;
+        mRefractoryPeriodsVersion++;
     }
 }
 
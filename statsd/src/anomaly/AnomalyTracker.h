@@ -104,6 +104,12 @@ public:
         return it != mRefractoryPeriodEndsSec.end() ? it->second : 0;
     }
 
+    // Incremented whenever a refractory period is set, i.e. whenever writeAlertMetadataToProto()
+    // may write something new.
+    inline uint64_t getRefractoryPeriodsVersion() const {
+        return mRefractoryPeriodsVersion;
+    }
+
     // Returns the (constant) number of past buckets this anomaly tracker can store.
     inline int getNumOfPastBuckets() const {
         return mNumOfPastBuckets;
@@ -111,6 +117,9 @@ public:
 
     std::pair<bool, uint64_t> getProtoHash() const;
 
+    // Estimated heap bytes of the past buckets, refractory periods and alarms of this tracker.
+    virtual size_t byteSize() const;
+
     // Sets an alarm for the given timestamp.
     // Replaces previous alarm if one already exists.
     virtual void startAlarm(const MetricDimensionKey& dimensionKey, const int64_t& eventTime) {
@@ -124,6 +133,13 @@ public:
         return;  // The base AnomalyTracker class doesn't have alarms.
     }
 
+    // Adds a single value of the metric for the given dimension key, and declares an anomaly if
+    // the distribution of the values now meets the alert.
+    virtual void addValue(const int64_t& timestampNs, const int64_t& currBucketNum,
+                          int64_t metricId, const MetricDimensionKey& key, int64_t value) {
+        return;  // The base AnomalyTracker class only tracks the sums of the buckets.
+    }
+
     // Stop all the alarms owned by this tracker. Does not declare any anomalies.
     virtual void cancelAllAlarms() {
         return;  // The base AnomalyTracker class doesn't have alarms.
@@ -168,13 +184,31 @@ protected:
     // for the anomaly detection (since the current bucket is not in the past).
     const int mNumOfPastBuckets;
 
-    // Values for each of the past mNumOfPastBuckets buckets. Always of size mNumOfPastBuckets.
-    // mPastBuckets[i] can be null, meaning that no data is present in that bucket.
-    std::vector<shared_ptr<DimToValMap>> mPastBuckets;
+    // The values of a dimension in the past buckets.
+    struct PastDimension {
+        // Value of each past bucket, at index(bucketNum). Of size mNumOfPastBuckets.
+        std::vector<int64_t> values;
+
+        // Whether each past bucket has a value for this dimension.
+        std::vector<bool> hasValue;
 
-    // Cached sum over all existing buckets in mPastBuckets.
-    // Its buckets never contain entries of 0.
-    DimToValMap mSumOverPastBuckets;
+        // Cached sum over values.
+        int64_t sum = 0;
+
+        // Number of past buckets with a value for this dimension.
+        int numBuckets = 0;
+    };
+
+    using PastDimensionMap = unordered_map<MetricDimensionKey, PastDimension>;
+
+    // The past buckets of each dimension with a value in at least one of them, so that the sum
+    // over the past buckets is a single lookup.
+    PastDimensionMap mPastDimensions;
+
+    // For each of the past mNumOfPastBuckets buckets, the entries of mPastDimensions with a value
+    // in it, so that expiring a bucket only touches those. Always of size mNumOfPastBuckets.
+    // Entries are erased from mPastDimensions once they are in none of these lists.
+    std::vector<std::vector<PastDimensionMap::value_type*>> mBucketDimensions;
 
     // The bucket number of the last added bucket.
     int64_t mMostRecentBucketNum = -1;
@@ -185,20 +219,21 @@ protected:
     // Entries may be, but are not guaranteed to be, removed after the period is finished.
     unordered_map<MetricDimensionKey, uint32_t> mRefractoryPeriodEndsSec;
 
+    // See getRefractoryPeriodsVersion().
+    uint64_t mRefractoryPeriodsVersion = 0;
+
     // Advances mMostRecentBucketNum to bucketNum, deleting any data that is now too old.
     // Specifically, since it is now too old, removes the data for
     //   [mMostRecentBucketNum - mNumOfPastBuckets + 1, bucketNum - mNumOfPastBuckets].
     void advanceMostRecentBucketTo(const int64_t& bucketNum);
 
-    // Add the information in the given bucket to mSumOverPastBuckets.
-    void addBucketToSum(const shared_ptr<DimToValMap>& bucket);
-
-    // Subtract the information in the given bucket from mSumOverPastBuckets
-    // and remove any items with value 0.
-    void subtractBucketFromSum(const shared_ptr<DimToValMap>& bucket);
+    // Removes the values of the past bucket at bucketIndex, erasing the dimensions that then
+    // have no value left.
+    void clearPastBucket(size_t bucketIndex);
 
-    // From mSumOverPastBuckets[key], subtracts bucketValue, removing it if it is now 0.
-    void subtractValueFromSum(const MetricDimensionKey& key, const int64_t& bucketValue);
+    // Sets the value of [key] in the past bucket at bucketIndex, replacing any previous one.
+    void setPastBucketValue(const MetricDimensionKey& key, size_t bucketIndex,
+                            const int64_t& bucketValue);
 
     // Returns true if in the refractory period, else false.
     bool isInRefractoryPeriod(const int64_t& timestampNs, const MetricDimensionKey& key) const;
@@ -24,9 +24,17 @@ namespace android {
 namespace os {
 namespace statsd {
 
+std::atomic<bool> DurationAnomalyTracker::sCoalescedAlarms(false);
+
+void DurationAnomalyTracker::SetCoalescedAlarms(bool enabled) {
+    sCoalescedAlarms.store(enabled, std::memory_order_relaxed);
+}
+
 DurationAnomalyTracker::DurationAnomalyTracker(const Alert& alert, const ConfigKey& configKey,
                                                const sp<AlarmMonitor>& alarmMonitor)
-        : AnomalyTracker(alert, configKey), mAlarmMonitor(alarmMonitor) {
+        : AnomalyTracker(alert, configKey),
+          mAlarmMonitor(alarmMonitor),
+          mCoalesceAlarms(sCoalescedAlarms.load(std::memory_order_relaxed)) {
     VLOG("DurationAnomalyTracker() called");
 }
 
@@ -44,16 +52,28 @@ void DurationAnomalyTracker::startAlarm(const MetricDimensionKey& dimensionKey,
         return;
     }
 
-    auto itr = mAlarms.find(dimensionKey);
-    if (itr != mAlarms.end() && mAlarmMonitor != nullptr) {
-        mAlarmMonitor->remove(itr->second);
+    sp<const InternalAlarm> alarm = new InternalAlarm{timestampSec};
+    if (mCoalesceAlarms) {
+        auto [itr, inserted] = mAlarms.try_emplace(dimensionKey);
+        if (!inserted) {
+            mPendingAlarms.erase(itr->second);
+        }
+        itr->second = alarm;
+        mPendingAlarms.emplace(alarm, &itr->first);
+        updateRegisteredAlarm();
+        return;
     }
 
-    sp<const InternalAlarm> alarm = new InternalAlarm{timestampSec};
-    mAlarms[dimensionKey] = alarm;
+    sp<const InternalAlarm>& storedAlarm = mAlarms[dimensionKey];
     if (mAlarmMonitor != nullptr) {
-        mAlarmMonitor->add(alarm);
+        // Replaces the previous alarm with a single update of the registered alarm.
+        if (storedAlarm != nullptr) {
+            mAlarmMonitor->update({storedAlarm}, {alarm});
+        } else {
+            mAlarmMonitor->add(alarm);
+        }
     }
+    storedAlarm = alarm;
 }
 
 void DurationAnomalyTracker::stopAlarm(const MetricDimensionKey& dimensionKey,
@@ -69,17 +89,43 @@ void DurationAnomalyTracker::stopAlarm(const MetricDimensionKey& dimensionKey,
                        mAlert.trigger_if_sum_gt() + (timestampNs / NS_PER_SEC) -
                                itr->second->timestampSec);
     }
+    if (mCoalesceAlarms) {
+        mPendingAlarms.erase(itr->second);
+        mAlarms.erase(itr);
+        updateRegisteredAlarm();
+        return;
+    }
     if (mAlarmMonitor != nullptr) {
         mAlarmMonitor->remove(itr->second);
     }
     mAlarms.erase(dimensionKey);
 }
 
+size_t DurationAnomalyTracker::byteSize() const {
+    // The pending alarms are tree nodes of about 4 pointers and their two values.
+    const size_t pendingAlarmSize = 6 * sizeof(void*);
+    size_t totalSize = AnomalyTracker::byteSize() + mPendingAlarms.size() * pendingAlarmSize;
+    for (const auto& [key, _] : mAlarms) {
+        totalSize += hashMapEntryByteSize(key, sizeof(sp<const InternalAlarm>)) +
+                     sizeof(InternalAlarm);
+    }
+    return totalSize;
+}
+
 void DurationAnomalyTracker::cancelAllAlarms() {
-    if (mAlarmMonitor != nullptr) {
+    if (mCoalesceAlarms) {
+        mPendingAlarms.clear();
+        mAlarms.clear();
+        updateRegisteredAlarm();
+        return;
+    }
+    if (mAlarmMonitor != nullptr && !mAlarms.empty()) {
+        std::vector<sp<const InternalAlarm>> alarms;
+        alarms.reserve(mAlarms.size());
         for (const auto& itr : mAlarms) {
-            mAlarmMonitor->remove(itr.second);
+            alarms.push_back(itr.second);
         }
+        mAlarmMonitor->update(alarms, {});
     }
     mAlarms.clear();
 }
@@ -88,6 +134,14 @@ void DurationAnomalyTracker::informAlarmsFired(const int64_t& timestampNs,
         unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>>& firedAlarms) {
 
     if (firedAlarms.empty() || mAlarms.empty()) return;
+    if (mCoalesceAlarms) {
+        if (mRegisteredAlarm == nullptr || firedAlarms.erase(mRegisteredAlarm) == 0) return;
+        // The AlarmMonitor already dropped the registered alarm.
+        mRegisteredAlarm = nullptr;
+        declarePendingAlarmsFired(timestampNs);
+        updateRegisteredAlarm();
+        return;
+    }
     // Find the intersection of firedAlarms and mAlarms.
     // The for loop is inefficient, since it loops over all keys, but that's okay since it is very
     // seldomly called. The alternative would be having InternalAlarms store information about the
@@ -110,6 +164,37 @@ void DurationAnomalyTracker::informAlarmsFired(const int64_t& timestampNs,
     }
 }
 
+void DurationAnomalyTracker::declarePendingAlarmsFired(const int64_t& timestampNs) {
+    const uint32_t timestampSec = static_cast<uint32_t>(timestampNs / NS_PER_SEC);
+    while (!mPendingAlarms.empty() && mPendingAlarms.begin()->first->timestampSec <= timestampSec) {
+        const sp<const InternalAlarm> alarm = mPendingAlarms.begin()->first;
+        const auto itr = mAlarms.find(*mPendingAlarms.begin()->second);
+        mPendingAlarms.erase(mPendingAlarms.begin());
+        declareAnomaly(timestampNs, mAlert.metric_id(), itr->first,
+                       mAlert.trigger_if_sum_gt() + (timestampNs / NS_PER_SEC) -
+                               alarm->timestampSec);
+        mAlarms.erase(itr);
+    }
+}
+
+void DurationAnomalyTracker::updateRegisteredAlarm() {
+    const sp<const InternalAlarm> soonest =
+            mPendingAlarms.empty() ? nullptr : mPendingAlarms.begin()->first;
+    if (mAlarmMonitor == nullptr || soonest == mRegisteredAlarm) {
+        return;
+    }
+    std::vector<sp<const InternalAlarm>> toRemove;
+    std::vector<sp<const InternalAlarm>> toAdd;
+    if (mRegisteredAlarm != nullptr) {
+        toRemove.push_back(mRegisteredAlarm);
+    }
+    if (soonest != nullptr) {
+        toAdd.push_back(soonest);
+    }
+    mAlarmMonitor->update(toRemove, toAdd);
+    mRegisteredAlarm = soonest;
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
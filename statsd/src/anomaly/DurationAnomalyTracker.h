@@ -16,6 +16,9 @@
 
 #pragma once
 
+#include <atomic>
+#include <map>
+
 #include "AlarmMonitor.h"
 #include "AnomalyTracker.h"
 
@@ -51,6 +54,12 @@ public:
     void informAlarmsFired(const int64_t& timestampNs,
             unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>>& firedAlarms) override;
 
+    // Makes the trackers created afterwards register only their soonest alarm with the
+    // AlarmMonitor, and keep the others until it fires.
+    static void SetCoalescedAlarms(bool enabled);
+
+    size_t byteSize() const override;
+
 protected:
     // Returns the alarm timestamp in seconds for the query dimension if it exists. Otherwise
     // returns 0.
@@ -66,6 +75,29 @@ protected:
     // Anomaly alarm monitor.
     sp<AlarmMonitor> mAlarmMonitor;
 
+    // Whether only the soonest alarm of mAlarms is registered with mAlarmMonitor.
+    const bool mCoalesceAlarms;
+
+    // With mCoalesceAlarms, the alarms of mAlarms ordered by soonest timestamp, each with its
+    // key in mAlarms.
+    std::map<sp<const InternalAlarm>, const MetricDimensionKey*, InternalAlarm::SoonerThan>
+            mPendingAlarms;
+
+    // With mCoalesceAlarms, the alarm of mPendingAlarms registered with mAlarmMonitor, if any.
+    sp<const InternalAlarm> mRegisteredAlarm;
+
+    static std::atomic<bool> sCoalescedAlarms;
+
+private:
+    // Registers the soonest alarm of mPendingAlarms with mAlarmMonitor instead of
+    // mRegisteredAlarm, if they differ.
+    void updateRegisteredAlarm();
+
+    // Declares an anomaly for each alarm of mPendingAlarms that is due at timestampNs, and
+    // removes it.
+    void declarePendingAlarmsFired(const int64_t& timestampNs);
+
+    FRIEND_TEST(AnomalyTrackerTest, TestCoalescedDurationAlarms);
     FRIEND_TEST(OringDurationTrackerTest, TestPredictAnomalyTimestamp);
     FRIEND_TEST(OringDurationTrackerTest, TestAnomalyDetectionExpiredAlarm);
     FRIEND_TEST(OringDurationTrackerTest, TestAnomalyDetectionFiredAlarm);
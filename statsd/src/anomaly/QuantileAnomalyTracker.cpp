@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "QuantileAnomalyTracker.h"
+
+#include <algorithm>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+QuantileAnomalyTracker::QuantileAnomalyTracker(const Alert& alert, const ConfigKey& configKey)
+    : AnomalyTracker(alert, configKey),
+      mQuantile(alert.quantile()),
+      mValueCounts(mNumOfPastBuckets) {
+    VLOG("QuantileAnomalyTracker() called");
+}
+
+QuantileAnomalyTracker::~QuantileAnomalyTracker() {
+    VLOG("~QuantileAnomalyTracker() called");
+}
+
+size_t QuantileAnomalyTracker::byteSize() const {
+    size_t totalSize = AnomalyTracker::byteSize() + mValueCounts.byteSize();
+    for (const DimToValMap* counts : {&mCurrentValueCounts, &mCurrentAboveCounts}) {
+        for (const auto& [key, _] : *counts) {
+            totalSize += hashMapEntryByteSize(key, sizeof(int64_t));
+        }
+    }
+    return totalSize;
+}
+
+void QuantileAnomalyTracker::advanceCurrentBucketTo(const int64_t& currBucketNum) {
+    if (currBucketNum <= mCurrentBucketNum) {
+        return;
+    }
+    if (!mCurrentValueCounts.empty()) {
+        addPastBucket(std::make_shared<DimToValMap>(std::move(mCurrentAboveCounts)),
+                      mCurrentBucketNum);
+        mValueCounts.addBucket(std::move(mCurrentValueCounts), mCurrentBucketNum);
+        mCurrentAboveCounts.clear();
+        mCurrentValueCounts.clear();
+    }
+    if (currBucketNum - 1 > mMostRecentBucketNum) {
+        advanceMostRecentBucketTo(currBucketNum - 1);
+    }
+    mValueCounts.advanceTo(currBucketNum - 1);
+    mCurrentBucketNum = currBucketNum;
+}
+
+void QuantileAnomalyTracker::addValue(const int64_t& timestampNs, const int64_t& currBucketNum,
+                                      int64_t metricId, const MetricDimensionKey& key,
+                                      int64_t value) {
+    if (currBucketNum < mCurrentBucketNum) {
+        return;
+    }
+    advanceCurrentBucketTo(currBucketNum);
+
+    const int64_t numValues =
+            mValueCounts.getSum(key) + ++mCurrentValueCounts[key];
+    int64_t numAbove = getSumOverPastBuckets(key);
+    if (value > mAlert.trigger_if_sum_gt()) {
+        numAbove += ++mCurrentAboveCounts[key];
+    } else {
+        const auto it = mCurrentAboveCounts.find(key);
+        numAbove += it == mCurrentAboveCounts.end() ? 0 : it->second;
+    }
+    if (numAbove > (1 - mQuantile) * numValues) {
+        declareAnomaly(timestampNs, metricId, key, value);
+    }
+}
+
+QuantileAnomalyTracker::PastValueCounts::PastValueCounts(int numPastBuckets)
+    : mNumPastBuckets(numPastBuckets), mBuckets(std::max(numPastBuckets, 0)) {
+}
+
+void QuantileAnomalyTracker::PastValueCounts::clearBucket(size_t bucketIndex) {
+    for (const auto& [key, count] : mBuckets[bucketIndex]) {
+        const auto it = mSums.find(key);
+        if (it != mSums.end() && (it->second -= count) == 0) {
+            mSums.erase(it);
+        }
+    }
+    mBuckets[bucketIndex].clear();
+}
+
+void QuantileAnomalyTracker::PastValueCounts::advanceTo(int64_t bucketNum) {
+    if (mNumPastBuckets <= 0 || bucketNum <= mMostRecentBucketNum) {
+        return;
+    }
+    if (bucketNum >= mMostRecentBucketNum + mNumPastBuckets) {
+        // All the past buckets are out of the window.
+        for (DimToValMap& bucket : mBuckets) {
+            bucket.clear();
+        }
+        mSums.clear();
+    } else {
+        for (int64_t i = mMostRecentBucketNum + 1; i <= bucketNum; i++) {
+            clearBucket(i % mNumPastBuckets);
+        }
+    }
+    mMostRecentBucketNum = bucketNum;
+}
+
+void QuantileAnomalyTracker::PastValueCounts::addBucket(DimToValMap&& counts, int64_t bucketNum) {
+    if (mNumPastBuckets <= 0 || bucketNum <= mMostRecentBucketNum) {
+        return;
+    }
+    advanceTo(bucketNum);
+    for (const auto& [key, count] : counts) {
+        mSums[key] += count;
+    }
+    mBuckets[bucketNum % mNumPastBuckets] = std::move(counts);
+}
+
+int64_t QuantileAnomalyTracker::PastValueCounts::getSum(const MetricDimensionKey& key) const {
+    const auto it = mSums.find(key);
+    return it == mSums.end() ? 0 : it->second;
+}
+
+size_t QuantileAnomalyTracker::PastValueCounts::byteSize() const {
+    size_t totalSize = mBuckets.capacity() * sizeof(DimToValMap);
+    for (const DimToValMap& bucket : mBuckets) {
+        for (const auto& [key, _] : bucket) {
+            totalSize += hashMapEntryByteSize(key, sizeof(int64_t));
+        }
+    }
+    for (const auto& [key, _] : mSums) {
+        totalSize += hashMapEntryByteSize(key, sizeof(int64_t));
+    }
+    return totalSize;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
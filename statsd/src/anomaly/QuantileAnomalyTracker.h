@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <gtest/gtest_prod.h>
+
+#include "AnomalyTracker.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+// Tracks an Alert with a quantile, which fires when that quantile of the values of a dimension
+// over the last num_buckets buckets exceeds trigger_if_sum_gt.
+//
+// The quantile exceeds the threshold exactly when more than (1 - quantile) of the values do, so
+// instead of merging quantile sketches, this keeps the number of values and the number of values
+// above the threshold of each bucket. Both are kept as sums over the past buckets, the latter by
+// the AnomalyTracker storage, so each value is checked in constant time.
+class QuantileAnomalyTracker : public virtual AnomalyTracker {
+public:
+    QuantileAnomalyTracker(const Alert& alert, const ConfigKey& configKey);
+
+    virtual ~QuantileAnomalyTracker();
+
+    void addValue(const int64_t& timestampNs, const int64_t& currBucketNum, int64_t metricId,
+                  const MetricDimensionKey& key, int64_t value) override;
+
+    size_t byteSize() const override;
+
+private:
+    // The number of values of each dimension in the past buckets, with the same window as the
+    // AnomalyTracker storage.
+    class PastValueCounts {
+    public:
+        explicit PastValueCounts(int numPastBuckets);
+
+        // Adds the counts of bucket bucketNum, which must be after the last added bucket.
+        void addBucket(DimToValMap&& counts, int64_t bucketNum);
+
+        // Drops the buckets that are no longer in the window ending at bucketNum.
+        void advanceTo(int64_t bucketNum);
+
+        // Sum of the counts of [key] over the past buckets.
+        int64_t getSum(const MetricDimensionKey& key) const;
+
+        size_t byteSize() const;
+
+    private:
+        // Removes the bucket at bucketIndex from the sums.
+        void clearBucket(size_t bucketIndex);
+
+        const int mNumPastBuckets;
+
+        // Counts of each past bucket, at bucketNum % mNumPastBuckets.
+        std::vector<DimToValMap> mBuckets;
+
+        // Sums over mBuckets, without the dimensions that have no value in any of them.
+        DimToValMap mSums;
+
+        int64_t mMostRecentBucketNum = -1;
+    };
+
+    // Moves the counts of the current bucket to the past buckets, if currBucketNum is after it.
+    void advanceCurrentBucketTo(const int64_t& currBucketNum);
+
+    const double mQuantile;
+
+    // Number of values of each dimension in the past buckets. The number of values above the
+    // threshold is kept by the AnomalyTracker storage.
+    PastValueCounts mValueCounts;
+
+    // Number of values, and of values above the threshold, of each dimension in the current
+    // bucket.
+    DimToValMap mCurrentValueCounts;
+    DimToValMap mCurrentAboveCounts;
+
+    int64_t mCurrentBucketNum = -1;
+
+    FRIEND_TEST(QuantileAnomalyTrackerTest, TestQuantileOverBuckets);
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
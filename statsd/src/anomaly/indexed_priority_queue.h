@@ -20,20 +20,14 @@
 #include <unordered_map>
 #include <vector>
 
+#include "utils/SpHash.h"
+
 using namespace android;
 
 namespace android {
 namespace os {
 namespace statsd {
 
-/** Defines a hash function for sp<const AA>, returning the hash of the underlying pointer. */
-template <class AA>
-struct SpHash {
-    size_t operator()(const sp<const AA>& k) const {
-        return std::hash<const AA*>()(k.get());
-    }
-};
-
 /**
  * Min priority queue for generic type AA.
  * Unlike a regular priority queue, this class is also capable of removing interior elements.
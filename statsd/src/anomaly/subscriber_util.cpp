@@ -17,6 +17,8 @@
 #define STATSD_DEBUG false  // STOPSHIP if true
 #include "Log.h"
 
+#include "subscriber_util.h"
+
 #include "external/Perfetto.h"
 #include "subscriber/IncidentdReporter.h"
 #include "subscriber/SubscriberReporter.h"
@@ -25,6 +27,37 @@ namespace android {
 namespace os {
 namespace statsd {
 
+static std::shared_ptr<AsyncTaskQueue> sSubscriberTaskQueue;
+
+void setSubscriberTaskQueue(std::shared_ptr<AsyncTaskQueue> queue) {
+    sSubscriberTaskQueue = std::move(queue);
+}
+
+static void informSubscriber(const Subscription& subscription, int64_t ruleId, int64_t metricId,
+                             const MetricDimensionKey& dimensionKey, int64_t metricValue,
+                             const ConfigKey& configKey) {
+    switch (subscription.subscriber_information_case()) {
+        case Subscription::SubscriberInformationCase::kIncidentdDetails:
+            if (!GenerateIncidentReport(subscription.incidentd_details(), ruleId, metricId,
+                                        dimensionKey, metricValue, configKey)) {
+                ALOGW("Failed to request incident report.");
+            }
+            break;
+        case Subscription::SubscriberInformationCase::kPerfettoDetails:
+            if (!CollectPerfettoTraceAndUploadToDropbox(subscription.perfetto_details(),
+                                                        subscription.id(), ruleId, configKey)) {
+                ALOGW("Failed to generate perfetto traces.");
+            }
+            break;
+        case Subscription::SubscriberInformationCase::kBroadcastSubscriberDetails:
+            SubscriberReporter::getInstance().alertBroadcastSubscriber(configKey, subscription,
+                                                                       dimensionKey);
+            break;
+        default:
+            break;
+    }
+}
+
 void triggerSubscribers(int64_t ruleId, int64_t metricId, const MetricDimensionKey& dimensionKey,
                         int64_t metricValue, const ConfigKey& configKey,
                         const std::vector<Subscription>& subscriptions) {
@@ -42,25 +75,21 @@ void triggerSubscribers(int64_t ruleId, int64_t metricId, const MetricDimensionK
             ALOGI("Fate decided that a subscriber would not be informed.");
             continue;
         }
-        switch (subscription.subscriber_information_case()) {
-            case Subscription::SubscriberInformationCase::kIncidentdDetails:
-                if (!GenerateIncidentReport(subscription.incidentd_details(), ruleId, metricId,
-                                            dimensionKey, metricValue, configKey)) {
-                    ALOGW("Failed to generate incident report.");
-                }
-                break;
-            case Subscription::SubscriberInformationCase::kPerfettoDetails:
-                if (!CollectPerfettoTraceAndUploadToDropbox(subscription.perfetto_details(),
-                                                            subscription.id(), ruleId, configKey)) {
-                    ALOGW("Failed to generate perfetto traces.");
-                }
-                break;
-            case Subscription::SubscriberInformationCase::kBroadcastSubscriberDetails:
-                SubscriberReporter::getInstance().alertBroadcastSubscriber(configKey, subscription,
-                                                                           dimensionKey);
-                break;
-            default:
-                break;
+        if (sSubscriberTaskQueue == nullptr) {
+            informSubscriber(subscription, ruleId, metricId, dimensionKey, metricValue,
+                             configKey);
+            continue;
+        }
+        // The incidentd and broadcast binder calls and the perfetto launch can take a while, so
+        // they are not made from the event processing thread.
+        const bool queued = sSubscriberTaskQueue->push(
+                [subscription, ruleId, metricId, dimensionKey, metricValue, configKey] {
+                    informSubscriber(subscription, ruleId, metricId, dimensionKey, metricValue,
+                                     configKey);
+                });
+        if (!queued) {
+            ALOGW("Too many pending subscriber actions, dropped subscription %lld",
+                  (long long)subscription.id());
         }
     }
 }
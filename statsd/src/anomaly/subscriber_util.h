@@ -16,9 +16,12 @@
 
 #pragma once
 
+#include <memory>
+
 #include "config/ConfigKey.h"
 #include "HashableDimensionKey.h"
 #include "src/statsd_config.pb.h"
+#include "utils/AsyncTaskQueue.h"
 
 namespace android {
 namespace os {
@@ -28,6 +31,10 @@ void triggerSubscribers(const int64_t ruleId, const int64_t metricId,
                         const MetricDimensionKey& dimensionKey, int64_t metricValue,
                         const ConfigKey& configKey, const std::vector<Subscription>& subscriptions);
 
+// Makes triggerSubscribers() inform the subscribers from [queue] instead of the calling thread,
+// dropping the subscriber actions that do not fit in it. Null informs them synchronously.
+void setSubscriberTaskQueue(std::shared_ptr<AsyncTaskQueue> queue);
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
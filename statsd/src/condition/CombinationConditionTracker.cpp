@@ -192,6 +192,7 @@ void CombinationConditionTracker::evaluateCondition(
         return;
     }
 
+    bool childChanged = false;
     for (const int childIndex : mChildren) {
         // So far, this is fine as there is at most one child having sliced output.
         if (nonSlicedConditionCache[childIndex] == ConditionState::kNotEvaluated) {
@@ -199,6 +200,16 @@ void CombinationConditionTracker::evaluateCondition(
             child->evaluateCondition(event, eventMatcherValues, mAllConditions,
                                      nonSlicedConditionCache, conditionChangedCache);
         }
+        childChanged |= conditionChangedCache[childIndex];
+    }
+
+    // An unsliced combination only depends on the states of its children, so it keeps its state
+    // until one of them changes. This holds down the whole tree, since the children report
+    // changes the same way.
+    if (!mSliced && !childChanged) {
+        nonSlicedConditionCache[mIndex] = mUnSlicedPartCondition;
+        conditionChangedCache[mIndex] = false;
+        return;
     }
 
     ConditionState newCondition =
@@ -213,13 +224,10 @@ void CombinationConditionTracker::evaluateCondition(
         mUnSlicedPartCondition = evaluateCombinationCondition(mUnSlicedChildren, mLogicalOperation,
                                                               nonSlicedConditionCache);
 
-        for (const int childIndex : mChildren) {
-            // If any of the sliced condition in children condition changes, the combination
-            // condition may be changed too.
-            if (conditionChangedCache[childIndex]) {
-                conditionChangedCache[mIndex] = true;
-                break;
-            }
+        // If any of the sliced condition in children condition changes, the combination
+        // condition may be changed too.
+        if (childChanged) {
+            conditionChangedCache[mIndex] = true;
         }
         nonSlicedConditionCache[mIndex] = newCondition;
         VLOG("CombinationPredicate %lld sliced may changed? %d", (long long)mConditionId,
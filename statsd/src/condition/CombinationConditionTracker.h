@@ -52,7 +52,7 @@ public:
                         std::vector<ConditionState>& conditionCache) const override;
 
     // Only one child predicate can have dimension.
-    const std::set<HashableDimensionKey>* getChangedToTrueDimensions(
+    const std::unordered_set<HashableDimensionKey>* getChangedToTrueDimensions(
             const std::vector<sp<ConditionTracker>>& allConditions) const override {
         for (const auto& child : mChildren) {
             auto result = allConditions[child]->getChangedToTrueDimensions(allConditions);
@@ -64,7 +64,7 @@ public:
     }
 
     // Only one child predicate can have dimension.
-    const std::set<HashableDimensionKey>* getChangedToFalseDimensions(
+    const std::unordered_set<HashableDimensionKey>* getChangedToFalseDimensions(
             const std::vector<sp<ConditionTracker>>& allConditions) const override {
         for (const auto& child : mChildren) {
             auto result = allConditions[child]->getChangedToFalseDimensions(allConditions);
@@ -85,7 +85,7 @@ public:
         const std::vector<sp<ConditionTracker>>& allConditions,
         const vector<Matcher>& dimensions) const override;
 
-    const std::map<HashableDimensionKey, int>* getSlicedDimensionMap(
+    const std::unordered_map<HashableDimensionKey, int>* getSlicedDimensionMap(
             const std::vector<sp<ConditionTracker>>& allConditions) const override {
         if (mSlicedChildren.size() == 1) {
             return allConditions[mSlicedChildren.front()]->getSlicedDimensionMap(allConditions);
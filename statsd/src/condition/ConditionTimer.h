@@ -141,12 +141,34 @@ public:
         mLastConditionChangeTimestampNs = timestampNs;
     }
 
+    /**
+     * Same as calling onConditionChanged() for a series of changes that each flipped the
+     * condition, without the individual changes.
+     * \param firstCondition the condition of the first change of the series
+     * \param firstTimestampNs the timestamp of the first change
+     * \param trueNs how long the condition was true between the first and the last change
+     * \param lastCondition the condition of the last change, which differs from the first one
+     * \param lastTimestampNs the timestamp of the last change
+     */
+    void onConditionFlips(bool firstCondition, int64_t firstTimestampNs, int64_t trueNs,
+                          bool lastCondition, int64_t lastTimestampNs) {
+        onConditionChanged(firstCondition, firstTimestampNs);
+        if (firstCondition) {
+            // The condition was already true before the first change if it was a no-op.
+            mTimerNs += firstTimestampNs - mLastConditionChangeTimestampNs;
+        }
+        mTimerNs += trueNs;
+        mCondition = lastCondition;
+        mLastConditionChangeTimestampNs = lastTimestampNs;
+    }
+
     FRIEND_TEST(ConditionTimerTest, TestTimer_Inital_False);
     FRIEND_TEST(ConditionTimerTest, TestTimer_Inital_True);
     FRIEND_TEST(ConditionTimerTest, TestTimer_Correction_DelayedChangeToFalse);
     FRIEND_TEST(ConditionTimerTest, TestTimer_Correction_DelayedChangeToTrue);
     FRIEND_TEST(ConditionTimerTest, TestTimer_Correction_DelayedWithInitialFalse);
     FRIEND_TEST(ConditionTimerTest, TestTimer_Correction_DelayedWithInitialTrue);
+    FRIEND_TEST(ConditionTimerTest, TestTimer_ConditionFlips);
 };
 
 }  // namespace statsd
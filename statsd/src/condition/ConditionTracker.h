@@ -23,7 +23,10 @@
 
 #include <utils/RefBase.h>
 
+#include <atomic>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
 
 namespace android {
 namespace os {
@@ -122,9 +125,9 @@ public:
         return mSliced;
     }
 
-    virtual const std::set<HashableDimensionKey>* getChangedToTrueDimensions(
+    virtual const std::unordered_set<HashableDimensionKey>* getChangedToTrueDimensions(
             const std::vector<sp<ConditionTracker>>& allConditions) const = 0;
-    virtual const std::set<HashableDimensionKey>* getChangedToFalseDimensions(
+    virtual const std::unordered_set<HashableDimensionKey>* getChangedToFalseDimensions(
             const std::vector<sp<ConditionTracker>>& allConditions) const = 0;
 
     inline int64_t getConditionId() const {
@@ -135,7 +138,7 @@ public:
         return mProtoHash;
     }
 
-    virtual const std::map<HashableDimensionKey, int>* getSlicedDimensionMap(
+    virtual const std::unordered_map<HashableDimensionKey, int>* getSlicedDimensionMap(
             const std::vector<sp<ConditionTracker>>& allConditions) const = 0;
 
     virtual bool IsChangedDimensionTrackable() const = 0;
@@ -146,12 +149,40 @@ public:
         const std::vector<sp<ConditionTracker>>& allConditions,
         const vector<Matcher>& dimensions) const = 0;
 
+    // Shares the state of this condition with the identical conditions of other configs, see
+    // SharedConditionStateRegistry. [key] describes the condition and the events it sees, or is
+    // empty to stop sharing. Only simple conditions have a state to share.
+    virtual void shareState(const std::string& key) {
+    }
+
+    // Estimates the number of distinct dimension keys of the condition from now on if [enabled],
+    // reported to StatsdStats, see StatsdConfig.estimate_dimension_cardinality. The previous
+    // estimate is dropped. Only sliced simple conditions have keys.
+    virtual void setDimensionCardinalityEstimate(const bool enabled) {
+    }
+
+    // Estimated heap bytes of the sliced state of the condition. A shared state is counted by
+    // each of its trackers.
+    virtual size_t byteSize() const {
+        return 0;
+    }
+
     // Return the current condition state of the unsliced part of the condition.
     inline ConditionState getUnSlicedPartConditionState() const  {
         return mUnSlicedPartCondition;
     }
 
+    // Returns a counter that moves whenever the state of any condition may have changed, so that
+    // answers derived from the conditions can be kept until it moves. See ConditionWizard::query.
+    static inline uint64_t getStateGeneration() {
+        return sStateGeneration.load(std::memory_order_relaxed);
+    }
+
 protected:
+    static inline void noteStateMayHaveChanged() {
+        sStateGeneration.fetch_add(1, std::memory_order_relaxed);
+    }
+
     const int64_t mConditionId;
 
     // the index of this condition in the manager's condition list.
@@ -178,6 +209,8 @@ protected:
     // Used to determine if the definition of this condition has changed across a config update.
     const uint64_t mProtoHash;
 
+    static inline std::atomic<uint64_t> sStateGeneration = 0;
+
     FRIEND_TEST(ConfigUpdateTest, TestUpdateConditions);
 };
 
@@ -19,24 +19,55 @@ namespace android {
 namespace os {
 namespace statsd {
 
+using std::unordered_set;
 using std::vector;
 
+size_t ConditionWizard::hashQuery(const int conditionIndex, const ConditionKey& parameters,
+                                  const bool isPartialLink) {
+    android::hash_t hash = android::JenkinsHashMix(0, android::hash_type(conditionIndex));
+    hash = android::JenkinsHashMix(hash, android::hash_type(isPartialLink));
+    for (const auto& [conditionId, key] : parameters) {
+        hash = android::JenkinsHashMix(hash, android::hash_type(conditionId));
+        const uint64_t keyHash = key.getHash();
+        hash = android::JenkinsHashMix(hash, (uint32_t)(keyHash ^ (keyHash >> 32)));
+    }
+    return android::JenkinsHashWhiten(hash);
+}
+
 ConditionState ConditionWizard::query(const int index, const ConditionKey& parameters,
                                       const bool isPartialLink) {
+    std::lock_guard<std::mutex> lock(mQueryCacheMutex);
+    const uint64_t generation = ConditionTracker::getStateGeneration();
+    if (generation != mQueryCacheGeneration || mQueryCache.size() >= kMaxCachedQueries) {
+        mQueryCache.clear();
+        mQueryCacheGeneration = generation;
+    }
+
+    const size_t hash = hashQuery(index, parameters, isPartialLink);
+    const auto range = mQueryCache.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        const CachedQuery& cached = it->second;
+        if (cached.conditionIndex == index && cached.isPartialLink == isPartialLink &&
+            cached.conditionParameters == parameters) {
+            return cached.state;
+        }
+    }
+
     vector<ConditionState> cache(mAllConditions.size(), ConditionState::kNotEvaluated);
 
     mAllConditions[index]->isConditionMet(
         parameters, mAllConditions, isPartialLink,
         cache);
+    mQueryCache.emplace(hash, CachedQuery{index, isPartialLink, parameters, cache[index]});
     return cache[index];
 }
 
-const set<HashableDimensionKey>* ConditionWizard::getChangedToTrueDimensions(
+const unordered_set<HashableDimensionKey>* ConditionWizard::getChangedToTrueDimensions(
         const int index) const {
     return mAllConditions[index]->getChangedToTrueDimensions(mAllConditions);
 }
 
-const set<HashableDimensionKey>* ConditionWizard::getChangedToFalseDimensions(
+const unordered_set<HashableDimensionKey>* ConditionWizard::getChangedToFalseDimensions(
         const int index) const {
     return mAllConditions[index]->getChangedToFalseDimensions(mAllConditions);
 }
@@ -17,6 +17,11 @@
 #ifndef CONDITION_WIZARD_H
 #define CONDITION_WIZARD_H
 
+#include <gtest/gtest_prod.h>
+
+#include <mutex>
+#include <unordered_map>
+
 #include "ConditionTracker.h"
 #include "condition_util.h"
 #include "stats_util.h"
@@ -39,11 +44,15 @@ public:
     //                       condition.
     // The ConditionTracker at [conditionIndex] can be a CombinationConditionTracker. In this case,
     // the conditionParameters contains the parameters for it's children SimpleConditionTrackers.
+    // The answers are kept until a condition is next evaluated, see
+    // ConditionTracker::getStateGeneration(), since the metrics linked to a condition tend to ask
+    // the same question for one event.
     virtual ConditionState query(const int conditionIndex, const ConditionKey& conditionParameters,
                                  const bool isPartialLink);
 
-    virtual const std::set<HashableDimensionKey>* getChangedToTrueDimensions(const int index) const;
-    virtual const std::set<HashableDimensionKey>* getChangedToFalseDimensions(
+    virtual const std::unordered_set<HashableDimensionKey>* getChangedToTrueDimensions(
+            const int index) const;
+    virtual const std::unordered_set<HashableDimensionKey>* getChangedToFalseDimensions(
             const int index) const;
     bool equalOutputDimensions(const int index, const vector<Matcher>& dimensions);
 
@@ -54,12 +63,36 @@ public:
         return mAllConditions[index]->getUnSlicedPartConditionState();
     }
 
-    const std::map<HashableDimensionKey, int>* getSlicedDimensionMap(const int index) const {
+    const std::unordered_map<HashableDimensionKey, int>* getSlicedDimensionMap(
+            const int index) const {
         return mAllConditions[index]->getSlicedDimensionMap(mAllConditions);
     }
 
 private:
+    struct CachedQuery {
+        int conditionIndex;
+        bool isPartialLink;
+        ConditionKey conditionParameters;
+        ConditionState state;
+    };
+
+    // Bounds mQueryCache between two condition evaluations.
+    static const size_t kMaxCachedQueries = 1000;
+
     std::vector<sp<ConditionTracker>> mAllConditions;
+
+    std::mutex mQueryCacheMutex;
+
+    // The ConditionTracker::getStateGeneration() of the entries in mQueryCache.
+    uint64_t mQueryCacheGeneration = 0;
+
+    // The answers of query(), by hashQuery() of their arguments.
+    std::unordered_multimap<size_t, CachedQuery> mQueryCache;
+
+    static size_t hashQuery(const int conditionIndex, const ConditionKey& conditionParameters,
+                            const bool isPartialLink);
+
+    FRIEND_TEST(ConditionWizardTest, TestQueryCache);
 };
 
 }  // namespace statsd
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "PartialLinkIndex.h"
+
+#include <algorithm>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unordered_map;
+using std::vector;
+
+namespace {
+
+enum ProjectionResult {
+    // The slice contains no key with the fields.
+    NOT_PROJECTED,
+    PROJECTED,
+    // The slice has several values for a field, so it contains several keys with the fields.
+    AMBIGUOUS,
+};
+
+// Sets [projected] to the values of [slice] for [fields], in that order, which is the only key
+// with these fields that [slice] contains, see HashableDimensionKey::contains().
+ProjectionResult projectSlice(const HashableDimensionKey& slice, const vector<Field>& fields,
+                              HashableDimensionKey* projected) {
+    const vector<FieldValue>& values = slice.getValues();
+    if (values.size() < fields.size()) {
+        return NOT_PROJECTED;
+    }
+    if (values.size() == fields.size()) {
+        // Keys of the same size are only contained if they are equal.
+        for (size_t i = 0; i < fields.size(); i++) {
+            if (!(values[i].mField == fields[i])) {
+                return NOT_PROJECTED;
+            }
+        }
+        *projected = slice;
+        return PROJECTED;
+    }
+    vector<FieldValue> projectedValues;
+    projectedValues.reserve(fields.size());
+    for (const Field& field : fields) {
+        const FieldValue* found = nullptr;
+        for (const FieldValue& value : values) {
+            if (value.mField == field) {
+                if (found != nullptr && !(found->mValue == value.mValue)) {
+                    return AMBIGUOUS;
+                }
+                found = &value;
+            }
+        }
+        if (found == nullptr) {
+            return NOT_PROJECTED;
+        }
+        projectedValues.push_back(*found);
+    }
+    *projected = HashableDimensionKey(projectedValues);
+    return PROJECTED;
+}
+
+}  // namespace
+
+void PartialLinkIndex::addToProjection(Projection& projection, const HashableDimensionKey& slice,
+                                       bool started, int delta) {
+    HashableDimensionKey projected;
+    switch (projectSlice(slice, projection.fields, &projected)) {
+        case NOT_PROJECTED:
+            return;
+        case AMBIGUOUS:
+            projection.ambiguousSlices += delta;
+            return;
+        case PROJECTED:
+            break;
+    }
+    const auto it = projection.counts.try_emplace(projected).first;
+    (started ? it->second.started : it->second.stopped) += delta;
+    if (it->second.started <= 0 && it->second.stopped <= 0) {
+        projection.counts.erase(it);
+    }
+}
+
+void PartialLinkIndex::add(const HashableDimensionKey& slice, bool started) {
+    for (Projection& projection : mProjections) {
+        addToProjection(projection, slice, started, 1);
+    }
+}
+
+void PartialLinkIndex::remove(const HashableDimensionKey& slice, bool started) {
+    for (Projection& projection : mProjections) {
+        addToProjection(projection, slice, started, -1);
+    }
+}
+
+void PartialLinkIndex::clear() {
+    for (Projection& projection : mProjections) {
+        projection.counts.clear();
+        projection.ambiguousSlices = 0;
+    }
+}
+
+bool PartialLinkIndex::query(const HashableDimensionKey& key,
+                             const unordered_map<HashableDimensionKey, int>& slices,
+                             bool* anyStarted, bool* anyStopped) {
+    const vector<FieldValue>& values = key.getValues();
+    Projection* projection = nullptr;
+    for (Projection& candidate : mProjections) {
+        if (candidate.fields.size() == values.size() &&
+            std::equal(values.begin(), values.end(), candidate.fields.begin(),
+                       [](const FieldValue& value, const Field& field) {
+                           return value.mField == field;
+                       })) {
+            projection = &candidate;
+            break;
+        }
+    }
+    if (projection == nullptr) {
+        if (mProjections.size() >= kMaxProjections) {
+            return false;
+        }
+        projection = &mProjections.emplace_back();
+        for (const FieldValue& value : values) {
+            projection->fields.push_back(value.mField);
+        }
+        for (const auto& [slice, startedCount] : slices) {
+            addToProjection(*projection, slice, startedCount > 0, 1);
+        }
+        VLOG("Projected %zu slices on %zu fields", slices.size(), values.size());
+    }
+    if (projection->ambiguousSlices > 0) {
+        return false;
+    }
+    const auto it = projection->counts.find(key);
+    *anyStarted = it != projection->counts.end() && it->second.started > 0;
+    *anyStopped = it != projection->counts.end() && it->second.stopped > 0;
+    return true;
+}
+
+size_t PartialLinkIndex::byteSize() const {
+    size_t totalSize = 0;
+    for (const Projection& projection : mProjections) {
+        totalSize += projection.fields.capacity() * sizeof(Field);
+        for (const auto& [key, _] : projection.counts) {
+            totalSize += hashMapEntryByteSize(key, sizeof(SliceCounts));
+        }
+    }
+    return totalSize;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
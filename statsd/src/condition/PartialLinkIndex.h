@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "HashableDimensionKey.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Indexes the slices of a sliced condition by the values of the linked fields, for the queries of
+ * the metrics whose links only cover part of the condition dimensions. A slice matches a query key
+ * if it contains each of its values, see HashableDimensionKey::contains().
+ *
+ * There is a projection of the slices per set of query fields, built on the first query with
+ * these fields and then kept up to date with the slices.
+ */
+class PartialLinkIndex {
+public:
+    // Notes that [slice] was added, [started] if its started count is positive.
+    void add(const HashableDimensionKey& slice, bool started);
+
+    // Notes that [slice] was removed, [started] if its started count was positive.
+    void remove(const HashableDimensionKey& slice, bool started);
+
+    // Notes that the started count of [slice] became positive if [started], or 0 otherwise.
+    void update(const HashableDimensionKey& slice, bool started) {
+        remove(slice, !started);
+        add(slice, started);
+    }
+
+    // Notes that all the slices were removed.
+    void clear();
+
+    // Sets [anyStarted] and [anyStopped] to whether some of the [slices] that contain [key] are
+    // started and stopped. Builds the projection for the fields of [key] from [slices] if there is
+    // none. Returns false if the slices must be scanned instead, when there are too many
+    // projections or a slice has several values for a field of [key].
+    bool query(const HashableDimensionKey& key,
+               const std::unordered_map<HashableDimensionKey, int>& slices, bool* anyStarted,
+               bool* anyStopped);
+
+    // Estimated heap bytes of the projections.
+    size_t byteSize() const;
+
+    // Each projection costs a hash map entry per slice, so the queries with more sets of fields
+    // than this scan the slices.
+    static const size_t kMaxProjections = 4;
+
+private:
+    struct SliceCounts {
+        int started = 0;
+        int stopped = 0;
+    };
+
+    struct Projection {
+        // The fields of the query keys, in order.
+        std::vector<Field> fields;
+
+        // The number of started and stopped slices for each projected key.
+        std::unordered_map<HashableDimensionKey, SliceCounts> counts;
+
+        // The number of slices with several values for one of the fields, which cannot be
+        // projected. The projection is usable again once they are all removed.
+        int ambiguousSlices = 0;
+    };
+
+    // Adds [delta] to the counts of the projection of [slice], if it has one.
+    static void addToProjection(Projection& projection, const HashableDimensionKey& slice,
+                                bool started, int delta);
+
+    std::vector<Projection> mProjections;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "SharedConditionState.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::lock_guard;
+using std::shared_ptr;
+using std::string;
+
+SimpleConditionState::SimpleConditionState(const SimpleConditionState& other)
+    : initialValue(other.initialValue),
+      lastChangedToTrueDimensions(other.lastChangedToTrueDimensions),
+      lastChangedToFalseDimensions(other.lastChangedToFalseDimensions),
+      slicedConditionState(other.slicedConditionState),
+      slicedKeyFilter(other.slicedKeyFilter),
+      partialLinkIndex(other.partialLinkIndex),
+      keysByRecency(other.keysByRecency),
+      version(other.version),
+      lastEventMatchId(other.lastEventMatchId),
+      lastCondition(other.lastCondition),
+      lastChanged(other.lastChanged),
+      lastEvictedKeyCount(other.lastEvictedKeyCount) {
+    for (auto it = keysByRecency.begin(); it != keysByRecency.end(); it++) {
+        keyRecency[*it] = it;
+    }
+}
+
+SharedConditionStateRegistry& SharedConditionStateRegistry::getInstance() {
+    static SharedConditionStateRegistry registry;
+    return registry;
+}
+
+shared_ptr<SimpleConditionState> SharedConditionStateRegistry::share(
+        const string& key, const shared_ptr<SimpleConditionState>& state) {
+    lock_guard<std::mutex> lock(mMutex);
+    if (!mEnabled) {
+        return state;
+    }
+    std::weak_ptr<SimpleConditionState>& entry = mStates[key];
+    shared_ptr<SimpleConditionState> shared = entry.lock();
+    if (shared != nullptr && shared->version == 0 && state->version == 0) {
+        return shared;
+    }
+    if (shared == nullptr || state->version == 0) {
+        // Later predicates can still share [state].
+        entry = state;
+        // Prunes once the map doubled, so that config loads stay linear in the predicates.
+        if (mStates.size() >= 2 * mSizeAfterPrune) {
+            pruneLocked();
+        }
+    }
+    return state;
+}
+
+void SharedConditionStateRegistry::setEnabled(bool enabled) {
+    lock_guard<std::mutex> lock(mMutex);
+    mEnabled = enabled;
+}
+
+size_t SharedConditionStateRegistry::size() const {
+    lock_guard<std::mutex> lock(mMutex);
+    size_t count = 0;
+    for (const auto& [key, entry] : mStates) {
+        if (!entry.expired()) {
+            count++;
+        }
+    }
+    return count;
+}
+
+void SharedConditionStateRegistry::pruneLocked() {
+    for (auto it = mStates.begin(); it != mStates.end();) {
+        if (it->second.expired()) {
+            it = mStates.erase(it);
+        } else {
+            it++;
+        }
+    }
+    mSizeAfterPrune = mStates.size();
+    VLOG("%zu shared condition states", mSizeAfterPrune);
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "HashableDimensionKey.h"
+#include "condition/PartialLinkIndex.h"
+#include "condition/condition_util.h"
+#include "utils/BlockedBloomFilter.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * The state of a SimpleConditionTracker. It can be shared by the trackers of identical predicates
+ * in configs that see the same events, see SharedConditionStateRegistry. The first of them to
+ * evaluate an event updates the state and records the outcome, the others reuse the outcome.
+ */
+struct SimpleConditionState {
+    explicit SimpleConditionState(ConditionState initialValue) : initialValue(initialValue) {
+    }
+
+    // Copies keyRecency as positions in the copy of keysByRecency.
+    SimpleConditionState(const SimpleConditionState& other);
+
+    SimpleConditionState& operator=(const SimpleConditionState&) = delete;
+
+    ConditionState initialValue;
+
+    // The keys whose condition changed on the last evaluated event. Probed by the linked metrics
+    // for each of their dimensions, so they are hashed with the cached hashes of the keys.
+    std::unordered_set<HashableDimensionKey> lastChangedToTrueDimensions;
+    std::unordered_set<HashableDimensionKey> lastChangedToFalseDimensions;
+
+    // Maps each output key to its number of starts.
+    std::unordered_map<HashableDimensionKey, int> slicedConditionState;
+
+    // The hashes of the keys added to slicedConditionState, so that the events and queries of new
+    // keys skip the map. Rebuilt from the map once full, so it may still hold removed keys.
+    BlockedBloomFilter slicedKeyFilter;
+
+    // Index of slicedConditionState for the partially linked queries, updated with it.
+    PartialLinkIndex partialLinkIndex;
+
+    // With SimplePredicate.max_dimension_keys, the keys of slicedConditionState from the least to
+    // the most recently started or stopped, and the position of each key in that list.
+    std::list<HashableDimensionKey> keysByRecency;
+    std::unordered_map<HashableDimensionKey, std::list<HashableDimensionKey>::iterator> keyRecency;
+
+    // Number of events that may have changed the state, and LogEvent::getMatchId() of the last.
+    uint64_t version = 0;
+    uint64_t lastEventMatchId = 0;
+
+    // The outcome of that event.
+    ConditionState lastCondition = ConditionState::kNotEvaluated;
+    bool lastChanged = false;
+    int lastEvictedKeyCount = 0;
+};
+
+/**
+ * Process-wide registry of the SimpleConditionStates that can be shared, by a key describing both
+ * the predicate and the events its configs see. A config that is added while an identical one
+ * exists would start from a fresh state, so states are only shared until they see their first
+ * event; this covers the configs loaded together at boot. Entries are not owned by the registry.
+ */
+class SharedConditionStateRegistry {
+public:
+    static SharedConditionStateRegistry& getInstance();
+
+    // Returns the state to use instead of [state] for a predicate identified by [key]: the
+    // registered one if neither has seen an event, otherwise [state] itself.
+    std::shared_ptr<SimpleConditionState> share(const std::string& key,
+                                                const std::shared_ptr<SimpleConditionState>& state);
+
+    // Sharing requires the metrics managers to get the events one at a time, in the same order,
+    // so it is disabled with parallel dispatch. Only affects the states shared afterwards.
+    void setEnabled(bool enabled);
+
+    // Number of live registered states.
+    size_t size() const;
+
+private:
+    // Removes the entries whose states are gone. The caller must hold mMutex.
+    void pruneLocked();
+
+    mutable std::mutex mMutex;
+
+    bool mEnabled = true;
+
+    std::map<std::string, std::weak_ptr<SimpleConditionState>> mStates;
+
+    // Size of mStates after the last prune, see pruneLocked().
+    size_t mSizeAfterPrune = 0;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -20,10 +20,14 @@
 #include "SimpleConditionTracker.h"
 #include "guardrail/StatsdStats.h"
 
+#include <map>
+#include <set>
+
 namespace android {
 namespace os {
 namespace statsd {
 
+using std::string;
 using std::unordered_map;
 
 SimpleConditionTracker::SimpleConditionTracker(
@@ -46,9 +50,15 @@ SimpleConditionTracker::SimpleConditionTracker(
         mContainANYPositionInInternalDimensions = HasPositionANY(simplePredicate.dimensions());
     }
     // If an initial value isn't specified, default to false if sliced and unknown if not sliced.
-    mInitialValue = simplePredicate.has_initial_value()
-                            ? convertInitialValue(simplePredicate.initial_value())
-                            : mSliced ? ConditionState::kFalse : ConditionState::kUnknown;
+    mState = std::make_shared<SimpleConditionState>(
+            simplePredicate.has_initial_value()
+                    ? convertInitialValue(simplePredicate.initial_value())
+                    : mSliced ? ConditionState::kFalse : ConditionState::kUnknown);
+    mMaxDimensionKeys = 0;
+    if (mSliced && simplePredicate.max_dimension_keys() > 0) {
+        mMaxDimensionKeys = std::min(simplePredicate.max_dimension_keys(),
+                                     StatsdStats::kDimensionKeySizeHardLimit);
+    }
     mInitialized = true;
 }
 
@@ -81,6 +91,20 @@ bool SimpleConditionTracker::onConfigUpdated(
     return true;
 }
 
+void SimpleConditionTracker::shareState(const string& key) {
+    if (key == mSharedStateKey) {
+        return;
+    }
+    if (mState.use_count() > 1) {
+        // The events seen by the other trackers or this one change, so this one stops sharing.
+        mState = std::make_shared<SimpleConditionState>(*mState);
+    }
+    mSharedStateKey = key;
+    if (!key.empty()) {
+        mState = SharedConditionStateRegistry::getInstance().share(key, mState);
+    }
+}
+
 void SimpleConditionTracker::setMatcherIndices(
         const SimplePredicate& simplePredicate,
         const unordered_map<int64_t, int>& atomMatchingTrackerMap) {
@@ -125,16 +149,23 @@ void SimpleConditionTracker::setMatcherIndices(
 
 void SimpleConditionTracker::dumpState() {
     VLOG("%lld DUMP:", (long long)mConditionId);
-    for (const auto& pair : mSlicedConditionState) {
+    // Sorted copies, so that the dump doesn't depend on the hash order.
+    const std::map<HashableDimensionKey, int> slicedConditionState(
+            mState->slicedConditionState.begin(), mState->slicedConditionState.end());
+    for (const auto& pair : slicedConditionState) {
         VLOG("\t%s : %d", pair.first.toString().c_str(), pair.second);
     }
 
     VLOG("Changed to true keys: \n");
-    for (const auto& key : mLastChangedToTrueDimensions) {
+    for (const auto& key : std::set<HashableDimensionKey>(
+                 mState->lastChangedToTrueDimensions.begin(),
+                 mState->lastChangedToTrueDimensions.end())) {
         VLOG("%s", key.toString().c_str());
     }
     VLOG("Changed to false keys: \n");
-    for (const auto& key : mLastChangedToFalseDimensions) {
+    for (const auto& key : std::set<HashableDimensionKey>(
+                 mState->lastChangedToFalseDimensions.begin(),
+                 mState->lastChangedToFalseDimensions.end())) {
         VLOG("%s", key.toString().c_str());
     }
 }
@@ -144,29 +175,76 @@ void SimpleConditionTracker::handleStopAll(std::vector<ConditionState>& conditio
     // Unless the default condition is false, and there was nothing started, otherwise we have
     // triggered a condition change.
     conditionChangedCache[mIndex] =
-            (mInitialValue == ConditionState::kFalse && mSlicedConditionState.empty()) ? false
-                                                                                           : true;
+            (mState->initialValue == ConditionState::kFalse &&
+             mState->slicedConditionState.empty())
+                    ? false
+                    : true;
 
-    for (const auto& cond : mSlicedConditionState) {
+    for (const auto& cond : mState->slicedConditionState) {
         if (cond.second > 0) {
-            mLastChangedToFalseDimensions.insert(cond.first);
+            mState->lastChangedToFalseDimensions.insert(cond.first);
         }
     }
 
     // After StopAll, we know everything has stopped. From now on, default condition is false.
-    mInitialValue = ConditionState::kFalse;
-    mSlicedConditionState.clear();
+    mState->initialValue = ConditionState::kFalse;
+    mState->slicedConditionState.clear();
+    mState->slicedKeyFilter.clear();
+    mState->partialLinkIndex.clear();
+    mState->keysByRecency.clear();
+    mState->keyRecency.clear();
     conditionCache[mIndex] = ConditionState::kFalse;
 }
 
+void SimpleConditionTracker::setDimensionCardinalityEstimate(const bool enabled) {
+    mDimensionCardinality = enabled && mSliced ? std::make_unique<HyperLogLog>() : nullptr;
+    mReportedCardinality = 0;
+}
+
+size_t SimpleConditionTracker::byteSize() const {
+    size_t totalSize = 0;
+    for (const auto& [key, _] : mState->slicedConditionState) {
+        totalSize += hashMapEntryByteSize(key, sizeof(int));
+    }
+    for (const auto* changedKeys :
+         {&mState->lastChangedToTrueDimensions, &mState->lastChangedToFalseDimensions}) {
+        for (const HashableDimensionKey& key : *changedKeys) {
+            totalSize += hashMapEntryByteSize(key, 0);
+        }
+    }
+    // Each recency entry is a list node with its key, and a map entry of a copy of the key.
+    for (const HashableDimensionKey& key : mState->keysByRecency) {
+        totalSize += 2 * sizeof(void*) + 2 * hashMapEntryByteSize(key, sizeof(void*));
+    }
+    totalSize += mState->partialLinkIndex.byteSize();
+    totalSize += mState->slicedKeyFilter.byteSize();
+    return totalSize;
+}
+
+void SimpleConditionTracker::noteDimension(const HashableDimensionKey& key) {
+    if (mDimensionCardinality == nullptr) {
+        return;
+    }
+    mDimensionCardinality->add(key.getHash());
+    // Reported when it grew by an eighth, so that StatsdStats is updated a few times per
+    // doubling.
+    const int64_t estimate = mDimensionCardinality->estimate();
+    if (estimate > mReportedCardinality + mReportedCardinality / 8) {
+        StatsdStats::getInstance().noteConditionDimensionCardinality(mConfigKey, mConditionId,
+                                                                     estimate);
+        mReportedCardinality = estimate;
+    }
+}
+
 bool SimpleConditionTracker::hitGuardRail(const HashableDimensionKey& newKey) {
-    if (!mSliced || mSlicedConditionState.find(newKey) != mSlicedConditionState.end()) {
-        // if the condition is not sliced or the key is not new, we are good!
+    if (!mSliced || mMaxDimensionKeys > 0 ||
+        findSlicedKey(newKey) != mState->slicedConditionState.end()) {
+        // if the condition is not sliced, evicts keys itself or the key is not new, we are good!
         return false;
     }
     // 1. Report the tuple count if the tuple count > soft limit
-    if (mSlicedConditionState.size() > StatsdStats::kDimensionKeySizeSoftLimit - 1) {
-        size_t newTupleCount = mSlicedConditionState.size() + 1;
+    if (mState->slicedConditionState.size() > StatsdStats::kDimensionKeySizeSoftLimit - 1) {
+        size_t newTupleCount = mState->slicedConditionState.size() + 1;
         StatsdStats::getInstance().noteConditionDimensionSize(mConfigKey, mConditionId, newTupleCount);
         // 2. Don't add more tuples, we are above the allowed threshold. Drop the data.
         if (newTupleCount > StatsdStats::kDimensionKeySizeHardLimit) {
@@ -178,11 +256,74 @@ bool SimpleConditionTracker::hitGuardRail(const HashableDimensionKey& newKey) {
     return false;
 }
 
+std::unordered_map<HashableDimensionKey, int>::iterator SimpleConditionTracker::findSlicedKey(
+        const HashableDimensionKey& key) const {
+    if (!mState->slicedKeyFilter.mayContain(key.getHash())) {
+        return mState->slicedConditionState.end();
+    }
+    return mState->slicedConditionState.find(key);
+}
+
+void SimpleConditionTracker::addSlicedKey(const HashableDimensionKey& key, int startedCount) {
+    if (mMaxDimensionKeys > 0) {
+        if (mState->slicedConditionState.size() >= mMaxDimensionKeys &&
+            !mState->keysByRecency.empty()) {
+            // The evicted key reads as the initial value again, so it stops being true.
+            const HashableDimensionKey& evictedKey = mState->keysByRecency.front();
+            const auto evictedIt = mState->slicedConditionState.find(evictedKey);
+            if (evictedIt != mState->slicedConditionState.end()) {
+                if (evictedIt->second > 0) {
+                    mState->lastChangedToFalseDimensions.insert(evictedKey);
+                }
+                mState->partialLinkIndex.remove(evictedKey, evictedIt->second > 0);
+                mState->slicedConditionState.erase(evictedIt);
+            }
+            VLOG("Predicate %lld evicted key %s", (long long)mConditionId,
+                 evictedKey.toString().c_str());
+            StatsdStats::getInstance().noteConditionDimensionKeyEvicted(mConfigKey, mConditionId);
+            mState->lastEvictedKeyCount++;
+            mState->keyRecency.erase(evictedKey);
+            mState->keysByRecency.pop_front();
+        }
+        mState->keyRecency[key] = mState->keysByRecency.insert(mState->keysByRecency.end(), key);
+    }
+    mState->slicedConditionState[key] = startedCount;
+    mState->slicedKeyFilter.add(key.getHash());
+    if (mState->slicedKeyFilter.isFull()) {
+        // Also drops the keys that were stopped or evicted since.
+        mState->slicedKeyFilter.rebuild(mState->slicedConditionState,
+                                        [](const auto& entry) { return entry.first.getHash(); });
+    }
+    mState->partialLinkIndex.add(key, startedCount > 0);
+}
+
+void SimpleConditionTracker::touchSlicedKey(const HashableDimensionKey& key) {
+    if (mMaxDimensionKeys == 0) {
+        return;
+    }
+    const auto it = mState->keyRecency.find(key);
+    if (it != mState->keyRecency.end()) {
+        std::list<HashableDimensionKey>& keysByRecency = mState->keysByRecency;
+        keysByRecency.splice(keysByRecency.end(), keysByRecency, it->second);
+    }
+}
+
+void SimpleConditionTracker::forgetSlicedKey(const HashableDimensionKey& key) {
+    if (mMaxDimensionKeys == 0) {
+        return;
+    }
+    const auto it = mState->keyRecency.find(key);
+    if (it != mState->keyRecency.end()) {
+        mState->keysByRecency.erase(it->second);
+        mState->keyRecency.erase(it);
+    }
+}
+
 void SimpleConditionTracker::handleConditionEvent(const HashableDimensionKey& outputKey,
                                                   bool matchStart, ConditionState* conditionCache,
                                                   bool* conditionChangedCache) {
     bool changed = false;
-    auto outputIt = mSlicedConditionState.find(outputKey);
+    auto outputIt = findSlicedKey(outputKey);
     ConditionState newCondition;
     if (hitGuardRail(outputKey)) {
         (*conditionChangedCache) = false;
@@ -190,28 +331,30 @@ void SimpleConditionTracker::handleConditionEvent(const HashableDimensionKey& ou
         (*conditionCache) = ConditionState::kUnknown;
         return;
     }
-    if (outputIt == mSlicedConditionState.end()) {
+    if (outputIt == mState->slicedConditionState.end()) {
         // We get a new output key.
         newCondition = matchStart ? ConditionState::kTrue : ConditionState::kFalse;
-        if (matchStart && mInitialValue != ConditionState::kTrue) {
-            mSlicedConditionState[outputKey] = 1;
+        if (matchStart && mState->initialValue != ConditionState::kTrue) {
+            addSlicedKey(outputKey, 1);
             changed = true;
-            mLastChangedToTrueDimensions.insert(outputKey);
-        } else if (mInitialValue != ConditionState::kFalse) {
+            mState->lastChangedToTrueDimensions.insert(outputKey);
+        } else if (mState->initialValue != ConditionState::kFalse) {
             // it's a stop and we don't have history about it.
             // If the default condition is not false, it means this stop is valuable to us.
-            mSlicedConditionState[outputKey] = 0;
-            mLastChangedToFalseDimensions.insert(outputKey);
+            addSlicedKey(outputKey, 0);
+            mState->lastChangedToFalseDimensions.insert(outputKey);
             changed = true;
         }
     } else {
         // we have history about this output key.
+        touchSlicedKey(outputKey);
         auto& startedCount = outputIt->second;
         // assign the old value first.
         newCondition = startedCount > 0 ? ConditionState::kTrue : ConditionState::kFalse;
         if (matchStart) {
             if (startedCount == 0) {
-                mLastChangedToTrueDimensions.insert(outputKey);
+                mState->lastChangedToTrueDimensions.insert(outputKey);
+                mState->partialLinkIndex.update(outputKey, /*started=*/true);
                 // This condition for this output key will change from false -> true
                 changed = true;
             }
@@ -235,14 +378,17 @@ void SimpleConditionTracker::handleConditionEvent(const HashableDimensionKey& ou
                 }
                 // if everything has stopped for this output key, condition true -> false;
                 if (startedCount == 0) {
-                    mLastChangedToFalseDimensions.insert(outputKey);
+                    mState->lastChangedToFalseDimensions.insert(outputKey);
+                    mState->partialLinkIndex.update(outputKey, /*started=*/false);
                     changed = true;
                 }
             }
 
             // if default condition is false, it means we don't need to keep the false values.
-            if (mInitialValue == ConditionState::kFalse && startedCount == 0) {
-                mSlicedConditionState.erase(outputIt);
+            if (mState->initialValue == ConditionState::kFalse && startedCount == 0) {
+                mState->partialLinkIndex.remove(outputKey, /*started=*/false);
+                mState->slicedConditionState.erase(outputIt);
+                forgetSlicedKey(outputKey);
                 VLOG("erase key %s", outputKey.toString().c_str());
             }
         }
@@ -272,12 +418,26 @@ void SimpleConditionTracker::evaluateCondition(
             (long long)mConditionId, conditionCache[mIndex]);
         return;
     }
-    mLastChangedToTrueDimensions.clear();
-    mLastChangedToFalseDimensions.clear();
+    const uint64_t matchId = event.getMatchId();
+    if (mState->lastEventMatchId == matchId && mStateVersion + 1 == mState->version) {
+        // A tracker sharing the state already evaluated this event.
+        mStateVersion = mState->version;
+        conditionCache[mIndex] = mState->lastCondition;
+        conditionChangedCache[mIndex] = mState->lastChanged;
+        for (int i = 0; i < mState->lastEvictedKeyCount; i++) {
+            StatsdStats::getInstance().noteConditionDimensionKeyEvicted(mConfigKey, mConditionId);
+        }
+        return;
+    }
+    mState->lastChangedToTrueDimensions.clear();
+    mState->lastChangedToFalseDimensions.clear();
 
     if (mStopAllLogMatcherIndex >= 0 && mStopAllLogMatcherIndex < int(eventMatcherValues.size()) &&
         eventMatcherValues[mStopAllLogMatcherIndex] == MatchingState::kMatched) {
+        noteStateMayHaveChanged();
+        mState->lastEvictedKeyCount = 0;
         handleStopAll(conditionCache, conditionChangedCache);
+        noteEventOutcome(matchId, conditionCache[mIndex], conditionChangedCache[mIndex]);
         return;
     }
 
@@ -300,19 +460,19 @@ void SimpleConditionTracker::evaluateCondition(
         if (mSliced) {
             // if the condition result is sliced. The overall condition is true if any of the sliced
             // condition is true
-            conditionCache[mIndex] = mInitialValue;
-            for (const auto& slicedCondition : mSlicedConditionState) {
+            conditionCache[mIndex] = mState->initialValue;
+            for (const auto& slicedCondition : mState->slicedConditionState) {
                 if (slicedCondition.second > 0) {
                     conditionCache[mIndex] = ConditionState::kTrue;
                     break;
                 }
             }
         } else {
-            const auto& itr = mSlicedConditionState.find(DEFAULT_DIMENSION_KEY);
-            if (itr == mSlicedConditionState.end()) {
+            const auto& itr = mState->slicedConditionState.find(DEFAULT_DIMENSION_KEY);
+            if (itr == mState->slicedConditionState.end()) {
                 // condition not sliced, but we haven't seen the matched start or stop yet. so
                 // return initial value.
-                conditionCache[mIndex] = mInitialValue;
+                conditionCache[mIndex] = mState->initialValue;
             } else {
                 // return the cached condition.
                 conditionCache[mIndex] =
@@ -322,7 +482,9 @@ void SimpleConditionTracker::evaluateCondition(
         return;
     }
 
-    ConditionState overallState = mInitialValue;
+    noteStateMayHaveChanged();
+    mState->lastEvictedKeyCount = 0;
+    ConditionState overallState = mState->initialValue;
     bool overallChanged = false;
 
     if (mOutputDimensions.size() == 0) {
@@ -330,7 +492,8 @@ void SimpleConditionTracker::evaluateCondition(
                              &overallChanged);
     } else if (!mContainANYPositionInInternalDimensions) {
         HashableDimensionKey outputValue;
-        filterValues(mOutputDimensions, event.getValues(), &outputValue);
+        filterValues(mOutputDimensions, event.getValues(), &outputValue, event.getFieldIndex());
+        noteDimension(outputValue);
 
         // If this event has multiple nodes in the attribution chain,  this log event probably will
         // generate multiple dimensions. If so, we will find if the condition changes for any
@@ -344,6 +507,15 @@ void SimpleConditionTracker::evaluateCondition(
     }
     conditionCache[mIndex] = overallState;
     conditionChangedCache[mIndex] = overallChanged;
+    noteEventOutcome(matchId, overallState, overallChanged);
+}
+
+void SimpleConditionTracker::noteEventOutcome(uint64_t matchId, ConditionState condition,
+                                              bool changed) {
+    mStateVersion = ++mState->version;
+    mState->lastEventMatchId = matchId;
+    mState->lastCondition = condition;
+    mState->lastChanged = changed;
 }
 
 void SimpleConditionTracker::isConditionMet(
@@ -361,10 +533,10 @@ void SimpleConditionTracker::isConditionMet(
 
     if (pair == conditionParameters.end()) {
         ConditionState conditionState = ConditionState::kNotEvaluated;
-        conditionState = conditionState | mInitialValue;
+        conditionState = conditionState | mState->initialValue;
         if (!mSliced) {
-            const auto& itr = mSlicedConditionState.find(DEFAULT_DIMENSION_KEY);
-            if (itr != mSlicedConditionState.end()) {
+            const auto& itr = mState->slicedConditionState.find(DEFAULT_DIMENSION_KEY);
+            if (itr != mState->slicedConditionState.end()) {
                 ConditionState sliceState =
                     itr->second > 0 ? ConditionState::kTrue : ConditionState::kFalse;
                 conditionState = conditionState | sliceState;
@@ -379,18 +551,30 @@ void SimpleConditionTracker::isConditionMet(
     if (isPartialLink) {
         // For unseen key, check whether the require dimensions are subset of sliced condition
         // output.
-        conditionState = conditionState | mInitialValue;
-        for (const auto& slice : mSlicedConditionState) {
-            ConditionState sliceState =
-                slice.second > 0 ? ConditionState::kTrue : ConditionState::kFalse;
-            if (slice.first.contains(key)) {
-                conditionState = conditionState | sliceState;
+        conditionState = conditionState | mState->initialValue;
+        bool anyStarted = false;
+        bool anyStopped = false;
+        if (mState->partialLinkIndex.query(key, mState->slicedConditionState, &anyStarted,
+                                           &anyStopped)) {
+            if (anyStarted) {
+                conditionState = conditionState | ConditionState::kTrue;
+            }
+            if (anyStopped) {
+                conditionState = conditionState | ConditionState::kFalse;
+            }
+        } else {
+            for (const auto& slice : mState->slicedConditionState) {
+                ConditionState sliceState =
+                    slice.second > 0 ? ConditionState::kTrue : ConditionState::kFalse;
+                if (slice.first.contains(key)) {
+                    conditionState = conditionState | sliceState;
+                }
             }
         }
     } else {
-        auto startedCountIt = mSlicedConditionState.find(key);
-        conditionState = conditionState | mInitialValue;
-        if (startedCountIt != mSlicedConditionState.end()) {
+        auto startedCountIt = findSlicedKey(key);
+        conditionState = conditionState | mState->initialValue;
+        if (startedCountIt != mState->slicedConditionState.end()) {
             ConditionState sliceState =
                 startedCountIt->second > 0 ? ConditionState::kTrue : ConditionState::kFalse;
             conditionState = conditionState | sliceState;
@@ -18,10 +18,16 @@
 #define SIMPLE_CONDITION_TRACKER_H
 
 #include <gtest/gtest_prod.h>
+
+#include <memory>
+#include <string>
+
 #include "ConditionTracker.h"
+#include "condition/SharedConditionState.h"
 #include "config/ConfigKey.h"
 #include "src/statsd_config.pb.h"
 #include "stats_util.h"
+#include "utils/HyperLogLog.h"
 
 namespace android {
 namespace os {
@@ -56,29 +62,35 @@ public:
                         const bool isPartialLink,
                         std::vector<ConditionState>& conditionCache) const override;
 
-    virtual const std::set<HashableDimensionKey>* getChangedToTrueDimensions(
+    virtual const std::unordered_set<HashableDimensionKey>* getChangedToTrueDimensions(
             const std::vector<sp<ConditionTracker>>& allConditions) const {
         if (mSliced) {
-            return &mLastChangedToTrueDimensions;
+            return &mState->lastChangedToTrueDimensions;
         } else {
             return nullptr;
         }
     }
 
-    virtual const std::set<HashableDimensionKey>* getChangedToFalseDimensions(
+    virtual const std::unordered_set<HashableDimensionKey>* getChangedToFalseDimensions(
             const std::vector<sp<ConditionTracker>>& allConditions) const {
         if (mSliced) {
-            return &mLastChangedToFalseDimensions;
+            return &mState->lastChangedToFalseDimensions;
         } else {
             return nullptr;
         }
     }
 
-    const std::map<HashableDimensionKey, int>* getSlicedDimensionMap(
+    const std::unordered_map<HashableDimensionKey, int>* getSlicedDimensionMap(
             const std::vector<sp<ConditionTracker>>& allConditions) const override {
-        return &mSlicedConditionState;
+        return &mState->slicedConditionState;
     }
 
+    void shareState(const std::string& key) override;
+
+    void setDimensionCardinalityEstimate(const bool enabled) override;
+
+    size_t byteSize() const override;
+
     bool IsChangedDimensionTrackable() const  override { return true; }
 
     bool IsSimpleCondition() const  override { return true; }
@@ -103,16 +115,49 @@ private:
     // The index of the LogEventMatcher which defines the stop all.
     int mStopAllLogMatcherIndex;
 
-    ConditionState mInitialValue;
-
     std::vector<Matcher> mOutputDimensions;
 
     bool mContainANYPositionInInternalDimensions;
 
-    std::set<HashableDimensionKey> mLastChangedToTrueDimensions;
-    std::set<HashableDimensionKey> mLastChangedToFalseDimensions;
+    // The state of the condition, possibly shared with other configs, see shareState().
+    std::shared_ptr<SimpleConditionState> mState;
+
+    // The key mState was shared with, or empty.
+    std::string mSharedStateKey;
+
+    // The SimpleConditionState::version of mState as of the last event this tracker evaluated.
+    uint64_t mStateVersion = 0;
+
+    // SimplePredicate.max_dimension_keys, or 0 if the sliced state is only bounded by the
+    // guardrail.
+    size_t mMaxDimensionKeys;
+
+    // Distinct output keys of the events this tracker evaluated, or null if not estimated. The
+    // estimate is reported to StatsdStats as it grows.
+    std::unique_ptr<HyperLogLog> mDimensionCardinality;
+    int64_t mReportedCardinality = 0;
+
+    // Returns the entry of [key] in the sliced state, skipping the lookup if
+    // mState->slicedKeyFilter rules it out.
+    std::unordered_map<HashableDimensionKey, int>::iterator findSlicedKey(
+            const HashableDimensionKey& key) const;
+
+    // Adds [key] to the sliced state, evicting the least recently used key if there are
+    // mMaxDimensionKeys already.
+    void addSlicedKey(const HashableDimensionKey& key, int startedCount);
+
+    // Marks [key] of the sliced state as the most recently used.
+    void touchSlicedKey(const HashableDimensionKey& key);
+
+    // Forgets [key] after removing it from the sliced state.
+    void forgetSlicedKey(const HashableDimensionKey& key);
+
+    // Adds [key] to mDimensionCardinality, if enabled.
+    void noteDimension(const HashableDimensionKey& key);
 
-    std::map<HashableDimensionKey, int> mSlicedConditionState;
+    // Records in mState the outcome of the event with [matchId], which the other trackers sharing
+    // the state reuse.
+    void noteEventOutcome(uint64_t matchId, ConditionState condition, bool changed);
 
     void setMatcherIndices(const SimplePredicate& predicate,
                            const std::unordered_map<int64_t, int>& logTrackerMap);
@@ -132,7 +177,12 @@ private:
     FRIEND_TEST(SimpleConditionTrackerTest, TestStopAll);
     FRIEND_TEST(SimpleConditionTrackerTest, TestGuardrailNotHitWhenDefaultFalse);
     FRIEND_TEST(SimpleConditionTrackerTest, TestGuardrailHitWhenDefaultUnknown);
+    FRIEND_TEST(SimpleConditionTrackerTest, TestMaxDimensionKeysEvictsLeastRecentlyUsed);
+    FRIEND_TEST(SimpleConditionTrackerTest, TestSharedStateAcrossConfigs);
+    FRIEND_TEST(SimpleConditionTrackerTest, TestDimensionCardinality);
+    FRIEND_TEST(SimpleConditionTrackerTest, TestSlicedKeyFilter);
     FRIEND_TEST(ConfigUpdateTest, TestUpdateConditions);
+    FRIEND_TEST(MetricsManagerTest, TestConditionStatesSharedOnInit);
 };
 
 }  // namespace statsd
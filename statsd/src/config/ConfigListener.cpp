@@ -26,6 +26,13 @@ ConfigListener::ConfigListener() {
 ConfigListener::~ConfigListener() {
 }
 
+void ConfigListener::OnConfigsLoaded(
+        const int64_t timestampNs, const std::vector<std::pair<ConfigKey, StatsdConfig>>& configs) {
+    for (const auto& [key, config] : configs) {
+        OnConfigUpdated(timestampNs, key, config);
+    }
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -20,6 +20,9 @@
 
 #include <utils/RefBase.h>
 
+#include <utility>
+#include <vector>
+
 namespace android {
 namespace os {
 namespace statsd {
@@ -39,6 +42,13 @@ public:
     virtual void OnConfigUpdated(const int64_t timestampNs, const ConfigKey& key,
                                  const StatsdConfig& config, bool modularUpdate = true) = 0;
 
+    /**
+     * Configurations were loaded together, such as the ones saved on disk at startup. Same as
+     * OnConfigUpdated() for each of them in order, unless overridden to load them together.
+     */
+    virtual void OnConfigsLoaded(const int64_t timestampNs,
+                                 const std::vector<std::pair<ConfigKey, StatsdConfig>>& configs);
+
     /**
      * A configuration was removed.
      */
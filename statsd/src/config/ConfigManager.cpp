@@ -50,9 +50,28 @@ ConfigManager::~ConfigManager() {
 
 void ConfigManager::Startup() {
     map<ConfigKey, StatsdConfig> configsFromDisk;
-    StorageManager::readConfigFromDisk(configsFromDisk);
-    for (const auto& pair : configsFromDisk) {
-        UpdateConfig(pair.first, pair.second);
+    map<ConfigKey, string> fileNames;
+    StorageManager::readConfigFromDisk(configsFromDisk, &fileNames);
+
+    vector<std::pair<ConfigKey, StatsdConfig>> configs;
+    vector<sp<ConfigListener>> broadcastList;
+    {
+        lock_guard<mutex> lock(mMutex);
+        for (auto& pair : configsFromDisk) {
+            if (addConfigLocked(pair.first, pair.second, false /* saveToDisk */)) {
+                // The config is already saved, so its file is only renamed to refresh its
+                // timestamp instead of being written again.
+                StorageManager::refreshConfigFileTimestamp(pair.first, fileNames[pair.first]);
+                configs.emplace_back(pair.first, std::move(pair.second));
+            }
+        }
+        broadcastList = mListeners;
+    }
+
+    // The listeners get all the configs at once, so that they can load them together.
+    const int64_t timestampNs = getElapsedRealtimeNs();
+    for (const sp<ConfigListener>& listener : broadcastList) {
+        listener->OnConfigsLoaded(timestampNs, configs);
     }
 }
 
@@ -69,39 +88,10 @@ void ConfigManager::UpdateConfig(const ConfigKey& key, const StatsdConfig& confi
     vector<sp<ConfigListener>> broadcastList;
     {
         lock_guard <mutex> lock(mMutex);
-
-        const int numBytes = config.ByteSize();
-        vector<uint8_t> buffer(numBytes);
-        config.SerializeToArray(buffer.data(), numBytes);
-
-        auto uidIt = mConfigs.find(key.GetUid());
-        // GuardRail: Limit the number of configs per uid.
-        if (uidIt != mConfigs.end()) {
-            auto it = uidIt->second.find(key);
-            if (it == uidIt->second.end() &&
-                uidIt->second.size() >= StatsdStats::kMaxConfigCountPerUid) {
-                ALOGE("ConfigManager: uid %d has exceeded the config count limit", key.GetUid());
-                return;
-            }
-        }
-
-        // Check if it's a duplicate config.
-        if (uidIt != mConfigs.end() && uidIt->second.find(key) != uidIt->second.end() &&
-            StorageManager::hasIdenticalConfig(key, buffer)) {
-            // This is a duplicate config.
-            ALOGI("ConfigManager This is a duplicate config %s", key.ToString().c_str());
-            // Update saved file on disk. We still update timestamp of file when
-            // there exists a duplicate configuration to avoid garbage collection.
-            update_saved_configs_locked(key, buffer, numBytes);
+        if (!addConfigLocked(key, config, true /* saveToDisk */)) {
             return;
         }
 
-        // Update saved file on disk.
-        update_saved_configs_locked(key, buffer, numBytes);
-
-        // Add to set.
-        mConfigs[key.GetUid()].insert(key);
-
         for (const sp<ConfigListener>& listener : mListeners) {
             broadcastList.push_back(listener);
         }
@@ -114,6 +104,47 @@ void ConfigManager::UpdateConfig(const ConfigKey& key, const StatsdConfig& confi
     }
 }
 
+bool ConfigManager::addConfigLocked(const ConfigKey& key, const StatsdConfig& config,
+                                    bool saveToDisk) {
+    const int numBytes = saveToDisk ? config.ByteSize() : 0;
+    vector<uint8_t> buffer(numBytes);
+    if (saveToDisk) {
+        config.SerializeToArray(buffer.data(), numBytes);
+    }
+
+    auto uidIt = mConfigs.find(key.GetUid());
+    // GuardRail: Limit the number of configs per uid.
+    if (uidIt != mConfigs.end()) {
+        auto it = uidIt->second.find(key);
+        if (it == uidIt->second.end() &&
+            uidIt->second.size() >= StatsdStats::kMaxConfigCountPerUid) {
+            ALOGE("ConfigManager: uid %d has exceeded the config count limit", key.GetUid());
+            return false;
+        }
+    }
+
+    // Check if it's a duplicate config.
+    if (saveToDisk && uidIt != mConfigs.end() &&
+        uidIt->second.find(key) != uidIt->second.end() &&
+        StorageManager::hasIdenticalConfig(key, buffer)) {
+        // This is a duplicate config.
+        ALOGI("ConfigManager This is a duplicate config %s", key.ToString().c_str());
+        // Update saved file on disk. We still update timestamp of file when
+        // there exists a duplicate configuration to avoid garbage collection.
+        update_saved_configs_locked(key, buffer, numBytes);
+        return false;
+    }
+
+    // Update saved file on disk.
+    if (saveToDisk) {
+        update_saved_configs_locked(key, buffer, numBytes);
+    }
+
+    // Add to set.
+    mConfigs[key.GetUid()].insert(key);
+    return true;
+}
+
 void ConfigManager::SetConfigReceiver(const ConfigKey& key,
                                       const shared_ptr<IPendingIntentRef>& pir) {
     lock_guard<mutex> lock(mMutex);
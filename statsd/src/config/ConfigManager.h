@@ -137,6 +137,12 @@ public:
 private:
     mutable std::mutex mMutex;
 
+    /**
+     * Adds or updates a config, and saves it to disk if [saveToDisk], which the configs loaded
+     * from disk at startup skip. Returns whether the listeners must be told about it.
+     */
+    bool addConfigLocked(const ConfigKey& key, const StatsdConfig& config, bool saveToDisk);
+
     /**
      * Save the configs to disk.
      */
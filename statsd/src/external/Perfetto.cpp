@@ -22,8 +22,11 @@
 
 #include <android-base/unique_fd.h>
 #include <inttypes.h>
+#include <string.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
+#include <atomic>
 #include <string>
 
 namespace {
@@ -34,6 +37,49 @@ namespace android {
 namespace os {
 namespace statsd {
 
+static std::atomic<bool> sLaunchWithVfork(false);
+
+static constexpr const char* kPerfettoBinary = "/system/bin/perfetto";
+static std::atomic<const char*> sPerfettoBinary(kPerfettoBinary);
+
+void setPerfettoLaunchWithVfork(bool enabled) {
+    sLaunchWithVfork.store(enabled, std::memory_order_relaxed);
+}
+
+void setPerfettoBinaryPath(const char* path) {
+    sPerfettoBinary.store(path == nullptr ? kPerfettoBinary : path, std::memory_order_relaxed);
+}
+
+// Runs in the child process, which may share the memory of statsd: only makes system calls on
+// the given descriptors and arguments, and never returns.
+[[noreturn]] static void execPerfetto(const char* binary, int readFd, int writeFd,
+                                      char* const argv[]) {
+    // No malloc calls or library calls after this point. Remember that even
+    // ALOGx (aka android_printLog()) can use dynamic memory for vsprintf().
+
+    close(writeFd);  // Close the write end (owned by the main process).
+
+    // Replace stdin with |readFd| so the main process can write into it.
+    if (dup2(readFd, STDIN_FILENO) < 0) _exit(1);
+
+    // Replace stdout/stderr with /dev/null and close any other file
+    // descriptor. This is to avoid SELinux complaining about perfetto
+    // trying to access files accidentally left open by statsd (i.e. files
+    // that have been opened without the O_CLOEXEC flag).
+    int devNullFd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    if (dup2(devNullFd, STDOUT_FILENO) < 0) _exit(2);
+    if (dup2(devNullFd, STDERR_FILENO) < 0) _exit(3);
+    for (int i = 0; i < 1024; i++) {
+        if (i != STDIN_FILENO && i != STDOUT_FILENO && i != STDERR_FILENO) close(i);
+    }
+
+    execv(binary, argv);
+
+    // execv() doesn't return in case of success, if we get here something
+    // failed.
+    _exit(4);
+}
+
 bool CollectPerfettoTraceAndUploadToDropbox(const PerfettoDetails& config,
                                             int64_t subscription_id,
                                             int64_t alert_id,
@@ -61,43 +107,39 @@ bool CollectPerfettoTraceAndUploadToDropbox(const PerfettoDetails& config,
         return false;
     }
 
-    pid_t pid = fork();
+    // Built before forking, so that the child does not allocate.
+    char dropboxTag[sizeof(kDropboxTag)];
+    memcpy(dropboxTag, kDropboxTag, sizeof(kDropboxTag));
+    char arg0[] = "perfetto";
+    char argBackground[] = "--background";
+    char argConfig[] = "--config";
+    char argStdin[] = "-";
+    char argDropbox[] = "--dropbox";
+    char argAlertId[] = "--alert-id";
+    char argConfigId[] = "--config-id";
+    char argConfigUid[] = "--config-uid";
+    char argSubscriptionId[] = "--subscription-id";
+    char* const argv[] = {arg0, argBackground, argConfig, argStdin, argDropbox, dropboxTag,
+                          argAlertId, alertId, argConfigId, configId, argConfigUid, configUid,
+                          argSubscriptionId, subscriptionId, nullptr};
+
+    // vfork() suspends this thread, but not the other threads of statsd, until perfetto is
+    // executed, and does not copy the address space. The child must not touch the objects
+    // of this frame, so it is handed the raw descriptors.
+    const char* binary = sPerfettoBinary.load(std::memory_order_relaxed);
+    const bool useVfork = sLaunchWithVfork.load(std::memory_order_relaxed);
+    const int readFd = readPipe.get();
+    const int writeFd = writePipe.get();
+    pid_t pid = useVfork ? vfork() : fork();
     if (pid < 0) {
-        ALOGE("fork() failed while calling the Perfetto client: %s", strerror(errno));
+        ALOGE("%s failed while calling the Perfetto client: %s", useVfork ? "vfork()" : "fork()",
+              strerror(errno));
         return false;
     }
 
     if (pid == 0) {
         // Child process.
-
-        // No malloc calls or library calls after this point. Remember that even
-        // ALOGx (aka android_printLog()) can use dynamic memory for vsprintf().
-
-        writePipe.reset();  // Close the write end (owned by the main process).
-
-        // Replace stdin with |readPipe| so the main process can write into it.
-        if (dup2(readPipe.get(), STDIN_FILENO) < 0) _exit(1);
-        readPipe.reset();
-
-        // Replace stdout/stderr with /dev/null and close any other file
-        // descriptor. This is to avoid SELinux complaining about perfetto
-        // trying to access files accidentally left open by statsd (i.e. files
-        // that have been opened without the O_CLOEXEC flag).
-        int devNullFd = open("/dev/null", O_RDWR | O_CLOEXEC);
-        if (dup2(devNullFd, STDOUT_FILENO) < 0) _exit(2);
-        if (dup2(devNullFd, STDERR_FILENO) < 0) _exit(3);
-        close(devNullFd);
-        for (int i = 0; i < 1024; i++) {
-            if (i != STDIN_FILENO && i != STDOUT_FILENO && i != STDERR_FILENO) close(i);
-        }
-
-        execl("/system/bin/perfetto", "perfetto", "--background", "--config", "-", "--dropbox",
-              kDropboxTag, "--alert-id", alertId, "--config-id", configId, "--config-uid",
-              configUid, "--subscription-id", subscriptionId, nullptr);
-
-        // execl() doesn't return in case of success, if we get here something
-        // failed.
-        _exit(4);
+        execPerfetto(binary, readFd, writeFd, argv);
     }
 
     // Main process.
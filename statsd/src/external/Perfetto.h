@@ -32,6 +32,14 @@ bool CollectPerfettoTraceAndUploadToDropbox(const PerfettoDetails& config,
                                             int64_t alert_id,
                                             const ConfigKey& configKey);
 
+// Makes CollectPerfettoTraceAndUploadToDropbox() launch perfetto with vfork() rather than
+// fork(), which does not copy the page tables of statsd.
+void setPerfettoLaunchWithVfork(bool enabled);
+
+// Makes CollectPerfettoTraceAndUploadToDropbox() execute |path|, which must outlive the calls,
+// instead of the perfetto cmdline util. nullptr restores the default. Used by the tests.
+void setPerfettoBinaryPath(const char* path);
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -34,6 +34,16 @@ class PullDataReceiver : virtual public RefBase{
    */
   virtual void onDataPulled(const std::vector<std::shared_ptr<LogEvent>>& data, bool pullSuccess,
                             int64_t originalPullTimeNs) = 0;
+
+  /**
+   * Handles the data of a pull queued with StatsPullerManager::PullDeferred().
+   * @param eventTimeNs The elapsed time of the event that triggered the pull.
+   * @param pullDelayNs How long the pull took once issued, without the time the pull and its
+   * data were queued.
+   */
+  virtual void onDeferredDataPulled(const std::vector<std::shared_ptr<LogEvent>>& data,
+                                    bool pullSuccess, int64_t eventTimeNs, int64_t pullDelayNs) {
+  }
 };
 
 }  // namespace statsd
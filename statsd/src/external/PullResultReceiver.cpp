@@ -14,20 +14,73 @@
  * limitations under the License.
  */
 
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
 #include "PullResultReceiver.h"
 
 namespace android {
 namespace os {
 namespace statsd {
 
+bool PulledEvents::isValid() const {
+    if (mPacked == nullptr) {
+        return true;
+    }
+    // The events cover the whole buffer, so the first one starts it, and a buffer without
+    // events is empty.
+    if (mPacked->offsets.empty() ? !mPacked->buffer.empty() : mPacked->offsets[0] != 0) {
+        return false;
+    }
+    int64_t previous = -1;
+    for (const int32_t offset : mPacked->offsets) {
+        if (offset <= previous || offset >= (int64_t)mPacked->buffer.size()) {
+            return false;
+        }
+        previous = offset;
+    }
+    return true;
+}
+
 PullResultReceiver::PullResultReceiver(
-        std::function<void(int32_t, bool, const vector<StatsEventParcel>&)> pullFinishCb)
-    : pullFinishCallback(std::move(pullFinishCb)) {
+        std::function<void(int32_t, bool, const PulledEvents&)> pullFinishCb,
+        std::function<void(int32_t, const PulledEvents&)> pullChunkCb)
+    : pullFinishCallback(std::move(pullFinishCb)), pullChunkCallback(std::move(pullChunkCb)) {
 }
 
 Status PullResultReceiver::pullFinished(int32_t atomTag, bool success,
                                         const vector<StatsEventParcel>& output) {
-    pullFinishCallback(atomTag, success, output);
+    pullFinishCallback(atomTag, success, PulledEvents(output));
+    return Status::ok();
+}
+
+Status PullResultReceiver::pullChunk(int32_t atomTag, const vector<StatsEventParcel>& output) {
+    if (pullChunkCallback != nullptr) {
+        pullChunkCallback(atomTag, PulledEvents(output));
+    }
+    return Status::ok();
+}
+
+Status PullResultReceiver::pullFinishedPacked(int32_t atomTag, bool success,
+                                              const StatsEventListParcel& output) {
+    const PulledEvents events(output);
+    if (mDroppedPage || !events.isValid()) {
+        ALOGW("Malformed packed pull result for atom %d", atomTag);
+        const StatsEventListParcel empty;
+        pullFinishCallback(atomTag, /*success=*/false, PulledEvents(empty));
+    } else {
+        pullFinishCallback(atomTag, success, events);
+    }
+    return Status::ok();
+}
+
+Status PullResultReceiver::pullChunkPacked(int32_t atomTag, const StatsEventListParcel& output) {
+    const PulledEvents events(output);
+    if (!events.isValid()) {
+        mDroppedPage = true;
+    } else if (pullChunkCallback != nullptr) {
+        pullChunkCallback(atomTag, events);
+    }
     return Status::ok();
 }
 
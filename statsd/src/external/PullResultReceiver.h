@@ -15,22 +15,67 @@
  */
 
 #include <aidl/android/os/BnPullAtomResultReceiver.h>
+#include <aidl/android/util/StatsEventListParcel.h>
 #include <aidl/android/util/StatsEventParcel.h>
 
 using namespace std;
 
 using Status = ::ndk::ScopedAStatus;
 using aidl::android::os::BnPullAtomResultReceiver;
+using aidl::android::util::StatsEventListParcel;
 using aidl::android::util::StatsEventParcel;
 
 namespace android {
 namespace os {
 namespace statsd {
 
+/**
+ * The events of a pull result or page, received either as one parcel per event or packed in one
+ * buffer. Only refers to the received parcels.
+ */
+class PulledEvents {
+public:
+    explicit PulledEvents(const vector<StatsEventParcel>& parcels) : mParcels(&parcels) {
+    }
+
+    explicit PulledEvents(const StatsEventListParcel& packed) : mPacked(&packed) {
+    }
+
+    size_t size() const {
+        return mParcels != nullptr ? mParcels->size() : mPacked->offsets.size();
+    }
+
+    // Whether the offsets of a packed buffer start at 0, are increasing and are within the
+    // buffer.
+    bool isValid() const;
+
+    // Calls [callback] with the buffer and size of each event. Must be valid.
+    template <typename Callback>
+    void forEach(Callback&& callback) const {
+        if (mParcels != nullptr) {
+            for (const StatsEventParcel& parcel : *mParcels) {
+                callback(reinterpret_cast<const uint8_t*>(parcel.buffer.data()),
+                         parcel.buffer.size());
+            }
+            return;
+        }
+        const uint8_t* buffer = reinterpret_cast<const uint8_t*>(mPacked->buffer.data());
+        const size_t count = mPacked->offsets.size();
+        for (size_t i = 0; i < count; i++) {
+            const size_t end = i + 1 < count ? mPacked->offsets[i + 1] : mPacked->buffer.size();
+            callback(buffer + mPacked->offsets[i], end - mPacked->offsets[i]);
+        }
+    }
+
+private:
+    const vector<StatsEventParcel>* mParcels = nullptr;
+    const StatsEventListParcel* mPacked = nullptr;
+};
+
 class PullResultReceiver : public BnPullAtomResultReceiver {
 public:
-    PullResultReceiver(function<void(int32_t, bool, const vector<StatsEventParcel>&)>
-                               pullFinishCallback);
+    PullResultReceiver(function<void(int32_t, bool, const PulledEvents&)> pullFinishCallback,
+                       function<void(int32_t, const PulledEvents&)> pullChunkCallback = nullptr);
     ~PullResultReceiver();
 
     /**
@@ -39,8 +84,31 @@ public:
     Status pullFinished(int32_t atomTag, bool success,
                         const vector<StatsEventParcel>& output) override;
 
+    /**
+     * Binder call for a page of the result of a pull. Ignored without a chunk callback.
+     */
+    Status pullChunk(int32_t atomTag, const vector<StatsEventParcel>& output) override;
+
+    /**
+     * Binder call for finishing a pull, with the events in one buffer. A malformed buffer, or a
+     * malformed page before it, fails the pull.
+     */
+    Status pullFinishedPacked(int32_t atomTag, bool success,
+                              const StatsEventListParcel& output) override;
+
+    /**
+     * Binder call for a page of the result of a pull, with the events in one buffer.
+     */
+    Status pullChunkPacked(int32_t atomTag, const StatsEventListParcel& output) override;
+
 private:
-    function<void(int32_t, bool, const vector<StatsEventParcel>&)> pullFinishCallback;
+    function<void(int32_t, bool, const PulledEvents&)> pullFinishCallback;
+
+    function<void(int32_t, const PulledEvents&)> pullChunkCallback;
+
+    // Whether a packed page was dropped for being malformed. Pages are sent by a single oneway
+    // caller, so they are not received concurrently.
+    bool mDroppedPage = false;
 };
 
 }  // namespace statsd
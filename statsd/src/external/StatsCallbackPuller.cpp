@@ -23,18 +23,129 @@
 #include "logd/LogEvent.h"
 #include "stats_log_util.h"
 
-#include <aidl/android/util/StatsEventParcel.h>
+#include <atomic>
+#include <functional>
 
 using namespace std;
 
 using Status = ::ndk::ScopedAStatus;
-using aidl::android::util::StatsEventParcel;
 using ::ndk::SharedRefBase;
 
 namespace android {
 namespace os {
 namespace statsd {
 
+namespace {
+
+// Bytes of a pulled LogEvent and of its shared_ptr control block, which holds the reference
+// counts, their vtable and the allocator.
+const size_t kPulledEventBytes = sizeof(LogEvent) + 4 * sizeof(void*);
+
+// One block for the LogEvents of a pull result and their shared_ptr control blocks. Each event
+// keeps its own reference count, so it is destroyed, and its values freed, as soon as it is
+// dropped, even when other events of the pull are kept, e.g. as the unchanged rows of delta
+// encoding. The block itself is freed once all of its events are, and the parser released it.
+class PulledEventArena {
+public:
+    explicit PulledEventArena(size_t capacityBytes)
+        : mBlock(static_cast<uint8_t*>(::operator new(capacityBytes))),
+          mCapacityBytes(capacityBytes) {
+    }
+
+    // Only called by the parser, from a single thread.
+    void* allocate(size_t size, size_t alignment) {
+        mRefCount.fetch_add(1, std::memory_order_relaxed);
+        const size_t offset = (mUsedBytes + alignment - 1) & ~(alignment - 1);
+        if (offset + size > mCapacityBytes) {
+            // The control blocks are larger than expected.
+            return ::operator new(size);
+        }
+        mUsedBytes = offset + size;
+        return mBlock + offset;
+    }
+
+    void deallocate(void* p) {
+        const std::less<const void*> less;
+        if (less(p, mBlock) || !less(p, mBlock + mCapacityBytes)) {
+            ::operator delete(p);
+        }
+        release();
+    }
+
+    // Drops a reference: a live allocation, or the one of the parser.
+    void release() {
+        if (mRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+private:
+    ~PulledEventArena() {
+        ::operator delete(mBlock);
+    }
+
+    uint8_t* const mBlock;
+    const size_t mCapacityBytes;
+    size_t mUsedBytes = 0;
+
+    // The live allocations, and the parser.
+    std::atomic<size_t> mRefCount{1};
+};
+
+template <typename T>
+struct PulledEventAllocator {
+    using value_type = T;
+
+    explicit PulledEventAllocator(PulledEventArena* arena) : arena(arena) {
+    }
+
+    template <typename U>
+    PulledEventAllocator(const PulledEventAllocator<U>& other) : arena(other.arena) {
+    }
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t) {
+        arena->deallocate(p);
+    }
+
+    template <typename U>
+    bool operator==(const PulledEventAllocator<U>& other) const {
+        return arena == other.arena;
+    }
+
+    template <typename U>
+    bool operator!=(const PulledEventAllocator<U>& other) const {
+        return arena != other.arena;
+    }
+
+    PulledEventArena* arena;
+};
+
+// Parses [events] into [data]. The LogEvents are allocated together, see PulledEventArena.
+void parsePulledEvents(const PulledEvents& events, vector<shared_ptr<LogEvent>>* data) {
+    if (events.size() == 0) {
+        return;
+    }
+    PulledEventArena* arena = new PulledEventArena(events.size() * kPulledEventBytes);
+    const PulledEventAllocator<LogEvent> allocator(arena);
+    data->reserve(data->size() + events.size());
+    events.forEach([&allocator, data](const uint8_t* buffer, size_t size) {
+        shared_ptr<LogEvent> event = allocate_shared<LogEvent>(allocator, /*uid=*/-1, /*pid=*/-1);
+        bool valid = event->parseBuffer(const_cast<uint8_t*>(buffer), size);
+        if (valid) {
+            data->push_back(std::move(event));
+        } else {
+            StatsdStats::getInstance().noteAtomError(event->GetTagId(), /*pull=*/true);
+        }
+    });
+    arena->release();
+}
+
+}  // namespace
+
 StatsCallbackPuller::StatsCallbackPuller(int tagId, const shared_ptr<IPullAtomCallback>& callback,
                                          const int64_t coolDownNs, int64_t timeoutNs,
                                          const vector<int> additiveFields)
@@ -59,27 +170,25 @@ PullErrorCode StatsCallbackPuller::PullInternal(vector<shared_ptr<LogEvent>>* da
 
     shared_ptr<PullResultReceiver> resultReceiver = SharedRefBase::make<PullResultReceiver>(
             [cv_mutex, cv, pullFinish, pullSuccess, sharedData](
-                    int32_t atomTag, bool success, const vector<StatsEventParcel>& output) {
+                    int32_t atomTag, bool success, const PulledEvents& output) {
                 // This is the result of the pull, executing in a statsd binder thread.
                 // The pull could have taken a long time, and we should only modify
                 // data (the output param) if the pointer is in scope and the pull did not time out.
                 {
                     lock_guard<mutex> lk(*cv_mutex);
-                    for (const StatsEventParcel& parcel: output) {
-                        shared_ptr<LogEvent> event = make_shared<LogEvent>(/*uid=*/-1, /*pid=*/-1);
-                        bool valid = event->parseBuffer((uint8_t*)parcel.buffer.data(),
-                                                        parcel.buffer.size());
-                        if (valid) {
-                            sharedData->push_back(event);
-                        } else {
-                            StatsdStats::getInstance().noteAtomError(event->GetTagId(),
-                                                                     /*pull=*/true);
-                        }
-                    }
+                    parsePulledEvents(output, sharedData.get());
                     *pullSuccess = success;
                     *pullFinish = true;
                 }
                 cv->notify_one();
+            },
+            [cv_mutex, pullFinish, sharedData](int32_t atomTag, const PulledEvents& output) {
+                // A page of a large pull, parsed as it arrives so that the parcels of the whole
+                // pull are never held at once.
+                lock_guard<mutex> lk(*cv_mutex);
+                if (!*pullFinish) {
+                    parsePulledEvents(output, sharedData.get());
+                }
             });
 
     // Initiate the pull. This is a oneway call to a different process, except
@@ -97,7 +206,7 @@ PullErrorCode StatsCallbackPuller::PullInternal(vector<shared_ptr<LogEvent>>* da
     {
         unique_lock<mutex> unique_lk(*cv_mutex);
         // Wait until the pull finishes, or until the pull timeout.
-        cv->wait_for(unique_lk, chrono::nanoseconds(mPullTimeoutNs),
+        cv->wait_for(unique_lk, chrono::nanoseconds(getPullTimeoutNs()),
                      [pullFinish] { return *pullFinish; });
         if (!*pullFinish) {
             // Note: The parent stats puller will also note that there was a timeout and that the
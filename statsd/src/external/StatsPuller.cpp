@@ -18,6 +18,9 @@
 #include "Log.h"
 
 #include "StatsPuller.h"
+
+#include <algorithm>
+
 #include "StatsPullerManager.h"
 #include "guardrail/StatsdStats.h"
 #include "puller_util.h"
@@ -32,6 +35,22 @@ using std::lock_guard;
 sp<UidMap> StatsPuller::mUidMap = nullptr;
 void StatsPuller::SetUidMap(const sp<UidMap>& uidMap) { mUidMap = uidMap; }
 
+std::atomic<bool> StatsPuller::sAdaptiveTimeouts(false);
+
+void StatsPuller::SetAdaptiveTimeouts(bool enabled) {
+    sAdaptiveTimeouts.store(enabled, std::memory_order_relaxed);
+}
+
+std::atomic<bool> StatsPuller::sDeltaEncoding(false);
+
+void StatsPuller::SetDeltaEncoding(bool enabled) {
+    sDeltaEncoding.store(enabled, std::memory_order_relaxed);
+}
+
+bool StatsPuller::IsDeltaEncoding() {
+    return sDeltaEncoding.load(std::memory_order_relaxed);
+}
+
 StatsPuller::StatsPuller(const int tagId, const int64_t coolDownNs, const int64_t pullTimeoutNs,
                          const std::vector<int> additiveFields)
     : mTagId(tagId),
@@ -39,20 +58,32 @@ StatsPuller::StatsPuller(const int tagId, const int64_t coolDownNs, const int64_
       mCoolDownNs(coolDownNs),
       mAdditiveFields(additiveFields),
       mLastPullTimeNs(0),
+      mEffectivePullTimeoutNs(pullTimeoutNs),
+      mEffectiveCoolDownNs(coolDownNs),
       mLastEventTimeNs(0) {
 }
 
 PullErrorCode StatsPuller::Pull(const int64_t eventTimeNs,
                                 std::vector<std::shared_ptr<LogEvent>>* data) {
+    PulledEventBatch batch;
+    const PullErrorCode status = Pull(eventTimeNs, &batch);
+    if (status == PULL_SUCCESS) {
+        (*data) = *batch;
+    }
+    return status;
+}
+
+PullErrorCode StatsPuller::Pull(const int64_t eventTimeNs, PulledEventBatch* batch) {
     lock_guard<std::mutex> lock(mLock);
     const int64_t elapsedTimeNs = getElapsedRealtimeNs();
     const int64_t systemUptimeMillis = getSystemUptimeMillis();
     StatsdStats::getInstance().notePull(mTagId);
     const bool shouldUseCache =
-            (mLastEventTimeNs == eventTimeNs) || (elapsedTimeNs - mLastPullTimeNs < mCoolDownNs);
+            (mLastEventTimeNs == eventTimeNs) ||
+            (elapsedTimeNs - mLastPullTimeNs < mEffectiveCoolDownNs);
     if (shouldUseCache) {
         if (mHasGoodData) {
-            (*data) = mCachedData;
+            (*batch) = mCachedData;
             StatsdStats::getInstance().notePullFromCache(mTagId);
 
         }
@@ -62,10 +93,13 @@ PullErrorCode StatsPuller::Pull(const int64_t eventTimeNs,
         StatsdStats::getInstance().updateMinPullIntervalSec(
                 mTagId, (elapsedTimeNs - mLastPullTimeNs) / NS_PER_SEC);
     }
-    mCachedData.clear();
+    mCachedData.reset();
     mLastPullTimeNs = elapsedTimeNs;
     mLastEventTimeNs = eventTimeNs;
-    PullErrorCode status = PullInternal(&mCachedData);
+    // The timeout PullInternal() waits for, as noteLatencyLocked() may change it.
+    const int64_t pullTimeoutNs = mEffectivePullTimeoutNs;
+    std::vector<std::shared_ptr<LogEvent>> data;
+    PullErrorCode status = PullInternal(&data);
     mHasGoodData = (status == PULL_SUCCESS);
     if (!mHasGoodData) {
         return status;
@@ -73,10 +107,10 @@ PullErrorCode StatsPuller::Pull(const int64_t eventTimeNs,
     const int64_t pullElapsedDurationNs = getElapsedRealtimeNs() - elapsedTimeNs;
     const int64_t pullSystemUptimeDurationMillis = getSystemUptimeMillis() - systemUptimeMillis;
     StatsdStats::getInstance().notePullTime(mTagId, pullElapsedDurationNs);
-    const bool pullTimeOut = pullElapsedDurationNs > mPullTimeoutNs;
+    noteLatencyLocked(pullElapsedDurationNs);
+    const bool pullTimeOut = pullElapsedDurationNs > pullTimeoutNs;
     if (pullTimeOut) {
         // Something went wrong. Discard the data.
-        mCachedData.clear();
         mHasGoodData = false;
         StatsdStats::getInstance().notePullTimeout(
                 mTagId, pullSystemUptimeDurationMillis, NanoToMillis(pullElapsedDurationNs));
@@ -85,38 +119,111 @@ PullErrorCode StatsPuller::Pull(const int64_t eventTimeNs,
         return PULL_FAIL;
     }
 
-    if (mCachedData.size() > 0) {
-        mapAndMergeIsolatedUidsToHostUid(mCachedData, mUidMap, mTagId, mAdditiveFields);
+    if (data.size() > 0) {
+        const int64_t mergeStartNs = getElapsedRealtimeNs();
+        mapAndMergeIsolatedUidsToHostUid(data, mUidMap, mTagId, mAdditiveFields);
+        StatsdStats::getInstance().noteIsolatedUidMergeTime(mTagId,
+                                                            getElapsedRealtimeNs() - mergeStartNs);
     }
 
-    if (mCachedData.empty()) {
+    if (data.empty()) {
         VLOG("Data pulled is empty");
         StatsdStats::getInstance().noteEmptyData(mTagId);
     }
 
-    (*data) = mCachedData;
+    if (IsDeltaEncoding()) {
+        reuseUnchangedRowsLocked(data);
+    }
+
+    mCachedData = std::make_shared<const std::vector<std::shared_ptr<LogEvent>>>(std::move(data));
+    (*batch) = mCachedData;
     return PULL_SUCCESS;
 }
 
+void StatsPuller::noteLatencyLocked(int64_t latencyNs) {
+    if (!sAdaptiveTimeouts.load(std::memory_order_relaxed)) {
+        return;
+    }
+    if (mLatencySamples.size() < kNumLatencySamples) {
+        mLatencySamples.push_back(latencyNs);
+    } else {
+        mLatencySamples[mNextLatencySample] = latencyNs;
+    }
+    mNextLatencySample = (mNextLatencySample + 1) % kNumLatencySamples;
+    if (mLatencySamples.size() < kMinLatencySamples) {
+        return;
+    }
+
+    std::vector<int64_t> sortedSamples = mLatencySamples;
+    std::sort(sortedSamples.begin(), sortedSamples.end());
+    const int64_t medianNs = sortedSamples[(sortedSamples.size() - 1) / 2];
+    const int64_t maxNs = sortedSamples.back();
+    // Timed out pulls count as taking the timeout, so a puller that keeps timing out gets its
+    // timeout doubled until it reaches the bound.
+    const int64_t pullMaxDelayNs = StatsdStats::kPullMaxDelayNs;
+    const int64_t maxTimeoutNs =
+            std::max(mPullTimeoutNs, std::min(2 * mPullTimeoutNs, pullMaxDelayNs));
+    mEffectivePullTimeoutNs = std::clamp(2 * maxNs, mPullTimeoutNs / 2, maxTimeoutNs);
+    mEffectiveCoolDownNs = std::clamp(medianNs, mCoolDownNs, 2 * mCoolDownNs);
+}
+
+void StatsPuller::reuseUnchangedRowsLocked(std::vector<std::shared_ptr<LogEvent>>& data) {
+    std::unordered_multimap<uint64_t, std::shared_ptr<LogEvent>> pulledRows;
+    pulledRows.reserve(data.size());
+    size_t numUnchangedRows = 0;
+    for (std::shared_ptr<LogEvent>& event : data) {
+        const uint64_t hash = hashFieldValues(event->getValues());
+        const auto [begin, end] = mLastPulledRows.equal_range(hash);
+        for (auto it = begin; it != end; it++) {
+            if (it->second->getValues() == event->getValues()) {
+                event = it->second;
+                numUnchangedRows++;
+                break;
+            }
+        }
+        pulledRows.emplace(hash, event);
+    }
+    VLOG("%zu of %zu rows of atom %d unchanged", numUnchangedRows, data.size(), mTagId);
+    mLastPulledRows.swap(pulledRows);
+}
+
 int StatsPuller::ForceClearCache() {
+    {
+        lock_guard<std::mutex> lock(mLock);
+        mLastPulledRows.clear();
+    }
     return clearCache();
 }
 
+size_t StatsPuller::GetCacheByteSize() {
+    lock_guard<std::mutex> lock(mLock);
+    // The last pulled rows are mostly the cached events, so only their nodes are counted.
+    const size_t rowSize =
+            kHashMapNodeOverheadBytes + sizeof(uint64_t) + sizeof(std::shared_ptr<LogEvent>);
+    size_t totalSize = mLastPulledRows.size() * rowSize;
+    if (mCachedData != nullptr) {
+        for (const std::shared_ptr<LogEvent>& event : *mCachedData) {
+            totalSize += sizeof(LogEvent) + event->getValues().capacity() * sizeof(FieldValue);
+        }
+    }
+    return totalSize;
+}
+
 int StatsPuller::clearCache() {
     lock_guard<std::mutex> lock(mLock);
     return clearCacheLocked();
 }
 
 int StatsPuller::clearCacheLocked() {
-    int ret = mCachedData.size();
-    mCachedData.clear();
+    int ret = mCachedData == nullptr ? 0 : mCachedData->size();
+    mCachedData.reset();
     mLastPullTimeNs = 0;
     mLastEventTimeNs = 0;
     return ret;
 }
 
 int StatsPuller::ClearCacheIfNecessary(int64_t timestampNs) {
-    if (timestampNs - mLastPullTimeNs > mCoolDownNs) {
+    if (timestampNs - mLastPullTimeNs > mEffectiveCoolDownNs) {
         return clearCache();
     } else {
         return 0;
@@ -18,7 +18,10 @@
 
 #include <aidl/android/os/IStatsCompanionService.h>
 #include <utils/RefBase.h>
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <unordered_map>
 #include <vector>
 #include "packages/UidMap.h"
 
@@ -39,6 +42,10 @@ enum PullErrorCode {
     PULL_DEAD_OBJECT = 2,
 };
 
+// The events of a successful pull, shared by the puller cache and the receivers of the pull
+// instead of being copied for each of them.
+typedef std::shared_ptr<const std::vector<std::shared_ptr<LogEvent>>> PulledEventBatch;
+
 class StatsPuller : public virtual RefBase {
 public:
     explicit StatsPuller(const int tagId,
@@ -60,14 +67,33 @@ public:
     // should make a copy as this data may be shared with multiple metrics.
     PullErrorCode Pull(const int64_t eventTimeNs, std::vector<std::shared_ptr<LogEvent>>* data);
 
+    // Same as above, but shares the cached events. [batch] is only set on PULL_SUCCESS.
+    PullErrorCode Pull(const int64_t eventTimeNs, PulledEventBatch* batch);
+
     // Clear cache immediately
     int ForceClearCache();
 
     // Clear cache if elapsed time is more than cooldown time
     int ClearCacheIfNecessary(int64_t timestampNs);
 
+    // Estimated heap bytes of the cached events, and of the index of the last pulled rows.
+    size_t GetCacheByteSize();
+
     static void SetUidMap(const sp<UidMap>& uidMap);
 
+    // Makes the pullers derive their timeout and cool down from the latency of their recent
+    // pulls, within bounds set by their registered timeout and cool down. The timeout becomes
+    // twice the slowest recent pull, between half and twice the registered timeout. The cool
+    // down becomes the median pull time, between once and twice the registered cool down.
+    static void SetAdaptiveTimeouts(bool enabled);
+
+    // Makes the pullers hand out the events of their previous pull again for the rows that did
+    // not change since, instead of the newly pulled ones. Receivers that keep the events of a
+    // pull can then tell the unchanged rows of the next one by their identity.
+    static void SetDeltaEncoding(bool enabled);
+
+    static bool IsDeltaEncoding();
+
     virtual void SetStatsCompanionService(
             shared_ptr<IStatsCompanionService> statsCompanionService) {};
 
@@ -80,6 +106,11 @@ protected:
     // marked as false.
     const int64_t mPullTimeoutNs = StatsdStats::kPullMaxDelayNs;
 
+    // The timeout of the current pull, see SetAdaptiveTimeouts(). Only valid in PullInternal().
+    inline int64_t getPullTimeoutNs() const {
+        return mEffectivePullTimeoutNs;
+    }
+
 private:
     mutable std::mutex mLock;
 
@@ -101,6 +132,37 @@ private:
 
     int64_t mLastPullTimeNs;
 
+    // Number of recent pull latencies the adaptive timeout and cool down are derived from, and
+    // how many are needed before they differ from the registered ones.
+    static const size_t kNumLatencySamples = 32;
+    static const size_t kMinLatencySamples = 8;
+
+    // The latencies of the last kNumLatencySamples pulls that returned data, as a ring whose
+    // next sample goes at mNextLatencySample. The pulls that timed out count at the latency they
+    // reached, so that a puller that keeps timing out gets more time.
+    std::vector<int64_t> mLatencySamples;
+    size_t mNextLatencySample = 0;
+
+    // mPullTimeoutNs and mCoolDownNs, unless adapted to the recent latencies.
+    int64_t mEffectivePullTimeoutNs;
+    int64_t mEffectiveCoolDownNs;
+
+    // Records the latency of a pull that returned data, even if it timed out, and adapts the
+    // timeout and cool down to it.
+    void noteLatencyLocked(int64_t latencyNs);
+
+    static std::atomic<bool> sAdaptiveTimeouts;
+
+    // With delta encoding, the events of the last successful pull by the hash of their values.
+    // Unlike mCachedData, they are kept after the cool down, until the next pull.
+    std::unordered_multimap<uint64_t, std::shared_ptr<LogEvent>> mLastPulledRows;
+
+    // Replaces the events of [data] whose values are those of an event in mLastPulledRows by
+    // that event, then makes [data] the last pulled rows.
+    void reuseUnchangedRowsLocked(std::vector<std::shared_ptr<LogEvent>>& data);
+
+    static std::atomic<bool> sDeltaEncoding;
+
     // All pulls happen due to an event (app upgrade, bucket boundary, condition change, etc).
     // If multiple pulls need to be done at the same event time, we will always use the cache after
     // the first pull.
@@ -112,7 +174,8 @@ private:
     //   1) A pull fails
     //   2) A new pull request comes after cooldown time.
     //   3) clearCache is called.
-    std::vector<std::shared_ptr<LogEvent>> mCachedData;
+    // The events are never modified once cached, they are replaced by the next pull.
+    PulledEventBatch mCachedData;
 
     int clearCache();
 
@@ -25,6 +25,7 @@
 
 #include <algorithm>
 #include <iostream>
+#include <map>
 
 #include "../StatsService.h"
 #include "../logd/LogEvent.h"
@@ -33,6 +34,8 @@
 #include "StatsCallbackPuller.h"
 #include "TrainInfoPuller.h"
 #include "statslog_statsd.h"
+#include "utils/ScopedTrace.h"
+#include "utils/ThreadTopology.h"
 
 using std::shared_ptr;
 using std::vector;
@@ -52,6 +55,17 @@ StatsPullerManager::StatsPullerManager()
       mNextPullTimeNs(NO_ALARM_UPDATE) {
 }
 
+StatsPullerManager::~StatsPullerManager() {
+    {
+        std::lock_guard<std::mutex> lock(mDeferredPullMutex);
+        mStopDeferredPulls = true;
+    }
+    mDeferredPullsChanged.notify_all();
+    if (mDeferredPullThread.joinable()) {
+        mDeferredPullThread.join();
+    }
+}
+
 bool StatsPullerManager::Pull(int tagId, const ConfigKey& configKey, const int64_t eventTimeNs,
                               vector<shared_ptr<LogEvent>>* data) {
     std::lock_guard<std::mutex> _l(mLock);
@@ -67,6 +81,27 @@ bool StatsPullerManager::Pull(int tagId, const vector<int32_t>& uids, const int6
 bool StatsPullerManager::PullLocked(int tagId, const ConfigKey& configKey,
                                     const int64_t eventTimeNs, vector<shared_ptr<LogEvent>>* data) {
     vector<int32_t> uids;
+    if (!GetPullUidsLocked(tagId, configKey, &uids)) {
+        return false;
+    }
+    return PullLocked(tagId, uids, eventTimeNs, data);
+}
+
+bool StatsPullerManager::PullLocked(int tagId, const vector<int32_t>& uids,
+                                    const int64_t eventTimeNs, vector<shared_ptr<LogEvent>>* data) {
+    VLOG("Initiating pulling %d", tagId);
+    const auto pullerIt = FindPullerLocked(tagId, uids);
+    if (pullerIt == kAllPullAtomInfo.end()) {
+        return false;  // Return early since we don't know what to pull.
+    }
+    const sp<StatsPuller> puller = pullerIt->second;
+    PullErrorCode status = puller->Pull(eventTimeNs, data);
+    VLOG("pulled %zu items", data->size());
+    return OnPullDoneLocked(pullerIt->first, puller, status);
+}
+
+bool StatsPullerManager::GetPullUidsLocked(int tagId, const ConfigKey& configKey,
+                                           vector<int32_t>* uids) {
     const auto& uidProviderIt = mPullUidProviders.find(configKey);
     if (uidProviderIt == mPullUidProviders.end()) {
         ALOGE("Error pulling tag %d. No pull uid provider for config key %s", tagId,
@@ -81,36 +116,41 @@ bool StatsPullerManager::PullLocked(int tagId, const ConfigKey& configKey,
         StatsdStats::getInstance().notePullUidProviderNotFound(tagId);
         return false;
     }
-    uids = pullUidProvider->getPullAtomUids(tagId);
-    return PullLocked(tagId, uids, eventTimeNs, data);
+    *uids = pullUidProvider->getPullAtomUids(tagId);
+    return true;
 }
 
-bool StatsPullerManager::PullLocked(int tagId, const vector<int32_t>& uids,
-                                    const int64_t eventTimeNs, vector<shared_ptr<LogEvent>>* data) {
-    VLOG("Initiating pulling %d", tagId);
+std::map<const PullerKey, sp<StatsPuller>>::iterator StatsPullerManager::FindPullerLocked(
+        int tagId, const vector<int32_t>& uids) {
     for (int32_t uid : uids) {
         PullerKey key = {.atomTag = tagId, .uid = uid};
         auto pullerIt = kAllPullAtomInfo.find(key);
         if (pullerIt != kAllPullAtomInfo.end()) {
-            PullErrorCode status = pullerIt->second->Pull(eventTimeNs, data);
-            VLOG("pulled %zu items", data->size());
-            if (status != PULL_SUCCESS) {
-                StatsdStats::getInstance().notePullFailed(tagId);
-            }
-            // If we received a dead object exception, it means the client process has died.
-            // We can remove the puller from the map.
-            if (status == PULL_DEAD_OBJECT) {
-                StatsdStats::getInstance().notePullerCallbackRegistrationChanged(
-                        tagId,
-                        /*registered=*/false);
-                kAllPullAtomInfo.erase(pullerIt);
-            }
-            return status == PULL_SUCCESS;
+            return pullerIt;
         }
     }
     StatsdStats::getInstance().notePullerNotFound(tagId);
     ALOGW("StatsPullerManager: Unknown tagId %d", tagId);
-    return false;  // Return early since we don't know what to pull.
+    return kAllPullAtomInfo.end();
+}
+
+bool StatsPullerManager::OnPullDoneLocked(const PullerKey& key, const sp<StatsPuller>& puller,
+                                          PullErrorCode status) {
+    if (status != PULL_SUCCESS) {
+        StatsdStats::getInstance().notePullFailed(key.atomTag);
+    }
+    // If we received a dead object exception, it means the client process has died.
+    // We can remove the puller from the map, unless it was registered again.
+    if (status == PULL_DEAD_OBJECT) {
+        auto pullerIt = kAllPullAtomInfo.find(key);
+        if (pullerIt != kAllPullAtomInfo.end() && pullerIt->second == puller) {
+            StatsdStats::getInstance().notePullerCallbackRegistrationChanged(
+                    key.atomTag,
+                    /*registered=*/false);
+            kAllPullAtomInfo.erase(pullerIt);
+        }
+    }
+    return status == PULL_SUCCESS;
 }
 
 bool StatsPullerManager::PullerForMatcherExists(int tagId) const {
@@ -127,13 +167,36 @@ void StatsPullerManager::updateAlarmLocked() {
 
     // TODO(b/151045771): do not hold a lock while making a binder call
     if (mStatsCompanionService != nullptr) {
-        mStatsCompanionService->setPullingAlarm(mNextPullTimeNs / 1000000);
+        mStatsCompanionService->setPullingAlarm(GetAlignedPullTimeLocked() / 1000000);
     } else {
         VLOG("StatsCompanionService not available. Alarm not set.");
     }
     return;
 }
 
+int64_t StatsPullerManager::GetAlignedPullTimeLocked() const {
+    if (mPullAlignmentWindowNs <= 0 || mNextPullTimeNs == NO_ALARM_UPDATE) {
+        return mNextPullTimeNs;
+    }
+    const int64_t windowEndNs = mNextPullTimeNs + mPullAlignmentWindowNs;
+    int64_t alignedTimeNs = mNextPullTimeNs;
+    for (const auto& [key, receivers] : mReceivers) {
+        for (const ReceiverInfo& receiverInfo : receivers) {
+            if (receiverInfo.nextPullTimeNs <= windowEndNs &&
+                receiverInfo.nextPullTimeNs > alignedTimeNs) {
+                alignedTimeNs = receiverInfo.nextPullTimeNs;
+            }
+        }
+    }
+    return alignedTimeNs;
+}
+
+void StatsPullerManager::SetPullAlignmentWindow(int64_t windowNs) {
+    std::lock_guard<std::mutex> _l(mLock);
+    mPullAlignmentWindowNs = windowNs;
+    updateAlarmLocked();
+}
+
 void StatsPullerManager::SetStatsCompanionService(
         shared_ptr<IStatsCompanionService> statsCompanionService) {
     std::lock_guard<std::mutex> _l(mLock);
@@ -179,6 +242,10 @@ void StatsPullerManager::RegisterReceiver(int tagId, const ConfigKey& configKey,
         VLOG("Updating next pull time %lld", (long long)mNextPullTimeNs);
         mNextPullTimeNs = nextPullTimeNs;
         updateAlarmLocked();
+    } else if (mPullAlignmentWindowNs > 0 &&
+               nextPullTimeNs - mNextPullTimeNs <= mPullAlignmentWindowNs) {
+        // The alarm may be deferred to this pull.
+        updateAlarmLocked();
     }
     VLOG("Puller for tagId %d registered of %d", tagId, (int)receivers.size());
 }
@@ -216,8 +283,19 @@ void StatsPullerManager::UnregisterPullUidProvider(const ConfigKey& configKey,
     }
 }
 
-void StatsPullerManager::OnAlarmFired(int64_t elapsedTimeNs) {
+void StatsPullerManager::SetParallelPulls(size_t numThreads, int64_t deadlineNs) {
+    std::lock_guard<std::mutex> alarmLock(mAlarmMutex);
     std::lock_guard<std::mutex> _l(mLock);
+    mPullExecutor = numThreads > 0
+                            ? std::make_unique<ParallelExecutor>(numThreads, ThreadRole::PULLS)
+                            : nullptr;
+    mParallelPullDeadlineNs = deadlineNs;
+}
+
+void StatsPullerManager::OnAlarmFired(int64_t elapsedTimeNs) {
+    std::lock_guard<std::mutex> alarmLock(mAlarmMutex);
+    std::unique_lock<std::mutex> lock(mLock);
+    ScopedTrace trace("StatsPullerManager::OnAlarmFired");
     int64_t wallClockNs = getWallClockNs();
 
     int64_t minNextPullTimeNs = NO_ALARM_UPDATE;
@@ -240,41 +318,71 @@ void StatsPullerManager::OnAlarmFired(int64_t elapsedTimeNs) {
             }
         }
     }
-    for (const auto& pullInfo : needToPull) {
-        vector<shared_ptr<LogEvent>> data;
-        bool pullSuccess = PullLocked(pullInfo.first->atomTag, pullInfo.first->configKey,
-                                      elapsedTimeNs, &data);
-        if (!pullSuccess) {
-            VLOG("pull failed at %lld, will try again later", (long long)elapsedTimeNs);
-        }
 
-        // Convention is to mark pull atom timestamp at request time.
-        // If we pull at t0, puller starts at t1, finishes at t2, and send back
-        // at t3, we mark t0 as its timestamp, which should correspond to its
-        // triggering event, such as condition change at t0.
-        // Here the triggering event is alarm fired from AlarmManager.
-        // In ValueMetricProducer and GaugeMetricProducer we do same thing
-        // when pull on condition change, etc.
-        for (auto& event : data) {
-            event->setElapsedTimestampNs(elapsedTimeNs);
-            event->setLogdWallClockTimestampNs(wallClockNs);
+    // We may have just come out of a coma, compute next pull time.
+    const auto updateNextPullTime = [elapsedTimeNs,
+                                     &minNextPullTimeNs](ReceiverInfo* receiverInfo) {
+        int numBucketsAhead =
+                (elapsedTimeNs - receiverInfo->nextPullTimeNs) / receiverInfo->intervalNs;
+        receiverInfo->nextPullTimeNs += (numBucketsAhead + 1) * receiverInfo->intervalNs;
+        if (receiverInfo->nextPullTimeNs < minNextPullTimeNs) {
+            minNextPullTimeNs = receiverInfo->nextPullTimeNs;
         }
+    };
 
-        for (const auto& receiverInfo : pullInfo.second) {
+    // Each puller is pulled once, for all the receivers of its atom across configs.
+    vector<DuePull> pulls;
+    std::map<PullerKey, size_t> pullIndices;
+    for (const auto& pullInfo : needToPull) {
+        vector<sp<PullDataReceiver>> receivers;
+        for (ReceiverInfo* receiverInfo : pullInfo.second) {
             sp<PullDataReceiver> receiverPtr = receiverInfo->receiver.promote();
             if (receiverPtr != nullptr) {
-                receiverPtr->onDataPulled(data, pullSuccess, elapsedTimeNs);
-                // We may have just come out of a coma, compute next pull time.
-                int numBucketsAhead =
-                        (elapsedTimeNs - receiverInfo->nextPullTimeNs) / receiverInfo->intervalNs;
-                receiverInfo->nextPullTimeNs += (numBucketsAhead + 1) * receiverInfo->intervalNs;
-                if (receiverInfo->nextPullTimeNs < minNextPullTimeNs) {
-                    minNextPullTimeNs = receiverInfo->nextPullTimeNs;
-                }
+                receivers.push_back(receiverPtr);
+                updateNextPullTime(receiverInfo);
             } else {
                 VLOG("receiver already gone.");
             }
         }
+        if (receivers.empty()) {
+            continue;
+        }
+        const int atomTag = pullInfo.first->atomTag;
+        vector<int32_t> uids;
+        auto pullerIt = kAllPullAtomInfo.end();
+        if (GetPullUidsLocked(atomTag, pullInfo.first->configKey, &uids)) {
+            pullerIt = FindPullerLocked(atomTag, uids);
+        }
+        if (pullerIt == kAllPullAtomInfo.end()) {
+            pulls.push_back({atomTag, {.uid = -1, .atomTag = atomTag}, nullptr, receivers});
+            continue;
+        }
+        const auto [indexIt, inserted] = pullIndices.emplace(pullerIt->first, pulls.size());
+        if (inserted) {
+            pulls.push_back({atomTag, pullerIt->first, pullerIt->second, receivers});
+        } else {
+            vector<sp<PullDataReceiver>>& pullReceivers = pulls[indexIt->second].receivers;
+            pullReceivers.insert(pullReceivers.end(), receivers.begin(), receivers.end());
+        }
+    }
+
+    if (mPullExecutor != nullptr) {
+        // Published before mLock is released, so that the receivers registered meanwhile
+        // lower it if they are due sooner.
+        mNextPullTimeNs = minNextPullTimeNs;
+        PullInParallelLocked(lock, elapsedTimeNs, wallClockNs, pulls);
+        minNextPullTimeNs = std::min(minNextPullTimeNs, mNextPullTimeNs);
+    } else {
+        for (DuePull& pull : pulls) {
+            ScopedTrace pullTrace("StatsPullerManager::pull", {{"atom", pull.atomTag}});
+            PulledEventBatch batch;
+            if (pull.puller != nullptr) {
+                VLOG("Initiating pulling %d", pull.atomTag);
+                pull.status = pull.puller->Pull(elapsedTimeNs, &batch);
+                OnPullDoneLocked(pull.pullerKey, pull.puller, pull.status);
+            }
+            DispatchPulledData(pull, elapsedTimeNs, wallClockNs, batch);
+        }
     }
 
     VLOG("mNextPullTimeNs: %lld updated to %lld", (long long)mNextPullTimeNs,
@@ -283,6 +391,207 @@ void StatsPullerManager::OnAlarmFired(int64_t elapsedTimeNs) {
     updateAlarmLocked();
 }
 
+void StatsPullerManager::DispatchPulledData(const DuePull& pull, int64_t elapsedTimeNs,
+                                            int64_t wallClockNs,
+                                            const PulledEventBatch& batch) {
+    static const vector<shared_ptr<LogEvent>> kNoData;
+    const vector<shared_ptr<LogEvent>>& data = batch != nullptr ? *batch : kNoData;
+    const bool pullSuccess = pull.status == PULL_SUCCESS;
+    if (!pullSuccess) {
+        VLOG("pull failed at %lld, will try again later", (long long)elapsedTimeNs);
+    }
+
+    // Convention is to mark pull atom timestamp at request time.
+    // If we pull at t0, puller starts at t1, finishes at t2, and send back
+    // at t3, we mark t0 as its timestamp, which should correspond to its
+    // triggering event, such as condition change at t0.
+    // Here the triggering event is alarm fired from AlarmManager.
+    // In ValueMetricProducer and GaugeMetricProducer we do same thing
+    // when pull on condition change, etc.
+    for (auto& event : data) {
+        event->setElapsedTimestampNs(elapsedTimeNs);
+        event->setLogdWallClockTimestampNs(wallClockNs);
+    }
+
+    VLOG("pulled %zu items", data.size());
+    ScopedTrace trace("StatsPullerManager::DispatchPulledData",
+                      {{"atom", pull.atomTag}, {"count", (int64_t)data.size()}});
+    // The receivers share the same events, which they must not modify.
+    for (const sp<PullDataReceiver>& receiver : pull.receivers) {
+        receiver->onDataPulled(data, pullSuccess, elapsedTimeNs);
+    }
+}
+
+void StatsPullerManager::PullInParallelLocked(std::unique_lock<std::mutex>& lock,
+                                              int64_t elapsedTimeNs, int64_t wallClockNs,
+                                              vector<DuePull>& pulls) {
+    const int64_t deadlineNs = getElapsedRealtimeNs() + mParallelPullDeadlineNs;
+    // The receivers still get the data one pull at a time, as the pulls complete.
+    std::mutex dispatchMutex;
+    ParallelExecutor* executor = mPullExecutor.get();
+
+    // The pullers and receivers are referenced by the pulls, so that they can be unregistered
+    // meanwhile.
+    lock.unlock();
+    executor->run(pulls.size(), [&](size_t i) {
+        DuePull& pull = pulls[i];
+        ScopedTrace pullTrace("StatsPullerManager::pull", {{"atom", pull.atomTag}});
+        PulledEventBatch batch;
+        if (pull.puller == nullptr) {
+            pull.status = PULL_FAIL;
+        } else if (getElapsedRealtimeNs() > deadlineNs) {
+            ALOGW("Pull for atom %d not started before the deadline", pull.atomTag);
+            pull.status = PULL_FAIL;
+        } else {
+            pull.status = pull.puller->Pull(elapsedTimeNs, &batch);
+        }
+        std::lock_guard<std::mutex> dispatchLock(dispatchMutex);
+        DispatchPulledData(pull, elapsedTimeNs, wallClockNs, batch);
+    });
+    lock.lock();
+
+    for (const DuePull& pull : pulls) {
+        if (pull.puller != nullptr) {
+            OnPullDoneLocked(pull.pullerKey, pull.puller, pull.status);
+        }
+    }
+}
+
+void StatsPullerManager::EnableDeferredPulls() {
+    std::lock_guard<std::mutex> lock(mDeferredPullMutex);
+    if (!mDeferredPullThread.joinable()) {
+        mDeferredPullThread = std::thread([this] { DeferredPullLoop(); });
+    }
+}
+
+void StatsPullerManager::SetDeferredPullWindow(int64_t windowNs) {
+    {
+        std::lock_guard<std::mutex> lock(mDeferredPullMutex);
+        mDeferredPullWindowNs = windowNs;
+    }
+    mDeferredPullsChanged.notify_all();
+}
+
+bool StatsPullerManager::PullDeferred(int tagId, const ConfigKey& configKey, int64_t eventTimeNs,
+                                      wp<PullDataReceiver> receiver) {
+    {
+        std::lock_guard<std::mutex> lock(mDeferredPullMutex);
+        if (!mDeferredPullThread.joinable()) {
+            return false;
+        }
+        mQueuedDeferredPulls.push_back({tagId, configKey, eventTimeNs, receiver});
+    }
+    mDeferredPullsChanged.notify_all();
+    return true;
+}
+
+void StatsPullerManager::DispatchDeferredPulls(bool waitForPending) {
+    static const vector<shared_ptr<LogEvent>> kNoData;
+    vector<DeferredPull> pulls;
+    {
+        std::unique_lock<std::mutex> lock(mDeferredPullMutex);
+        if (waitForPending) {
+            // Ends the window of the queued pulls.
+            mDeferredPullWaiters++;
+            mDeferredPullsChanged.notify_all();
+            mDeferredPullsChanged.wait(lock, [this] {
+                return mStopDeferredPulls ||
+                       (mQueuedDeferredPulls.empty() && !mIssuingDeferredPulls);
+            });
+            mDeferredPullWaiters--;
+        }
+        pulls.swap(mCompletedDeferredPulls);
+    }
+    for (const DeferredPull& pull : pulls) {
+        sp<PullDataReceiver> receiver = pull.receiver.promote();
+        if (receiver == nullptr) {
+            VLOG("receiver already gone.");
+            continue;
+        }
+        receiver->onDeferredDataPulled(pull.batch != nullptr ? *pull.batch : kNoData,
+                                       pull.pullSuccess, pull.eventTimeNs, pull.pullDelayNs);
+    }
+}
+
+void StatsPullerManager::DeferredPullLoop() {
+    ScopedThreadRole role(ThreadRole::PULLS);
+    std::unique_lock<std::mutex> lock(mDeferredPullMutex);
+    while (true) {
+        mDeferredPullsChanged.wait(
+                lock, [this] { return mStopDeferredPulls || !mQueuedDeferredPulls.empty(); });
+        if (mStopDeferredPulls) {
+            return;
+        }
+        if (mDeferredPullWindowNs > 0) {
+            // The pulls queued within the window share the pulls of their pullers.
+            mDeferredPullsChanged.wait_for(
+                    lock, std::chrono::nanoseconds(mDeferredPullWindowNs),
+                    [this] { return mStopDeferredPulls || mDeferredPullWaiters > 0; });
+            if (mStopDeferredPulls) {
+                return;
+            }
+        }
+        vector<DeferredPull> pulls;
+        pulls.swap(mQueuedDeferredPulls);
+        mIssuingDeferredPulls = true;
+        lock.unlock();
+        IssueDeferredPulls(pulls);
+        lock.lock();
+        mIssuingDeferredPulls = false;
+        mCompletedDeferredPulls.insert(mCompletedDeferredPulls.end(),
+                                       std::make_move_iterator(pulls.begin()),
+                                       std::make_move_iterator(pulls.end()));
+        mDeferredPullsChanged.notify_all();
+    }
+}
+
+void StatsPullerManager::IssueDeferredPulls(vector<DeferredPull>& pulls) {
+    std::lock_guard<std::mutex> _l(mLock);
+    // The pulls of each puller, across atoms and configs resolving to it.
+    struct PullerPulls {
+        PullerKey pullerKey;
+        sp<StatsPuller> puller;
+        vector<DeferredPull*> pulls;
+    };
+    vector<PullerPulls> pullerPulls;
+    std::map<PullerKey, size_t> pullerIndices;
+    for (DeferredPull& pull : pulls) {
+        vector<int32_t> uids;
+        auto pullerIt = kAllPullAtomInfo.end();
+        if (GetPullUidsLocked(pull.atomTag, pull.configKey, &uids)) {
+            pullerIt = FindPullerLocked(pull.atomTag, uids);
+        }
+        if (pullerIt == kAllPullAtomInfo.end()) {
+            continue;  // The pull fails.
+        }
+        const auto [indexIt, inserted] = pullerIndices.emplace(pullerIt->first, pullerPulls.size());
+        if (inserted) {
+            pullerPulls.push_back({pullerIt->first, pullerIt->second, {}});
+        }
+        pullerPulls[indexIt->second].pulls.push_back(&pull);
+    }
+
+    for (PullerPulls& pullerPull : pullerPulls) {
+        // The pulls triggered earlier get the data pulled for the last one, which is the most
+        // recent data when their events are processed.
+        int64_t eventTimeNs = 0;
+        for (const DeferredPull* pull : pullerPull.pulls) {
+            eventTimeNs = std::max(eventTimeNs, pull->eventTimeNs);
+        }
+        VLOG("Initiating deferred pulling %d", pullerPull.pullerKey.atomTag);
+        PulledEventBatch batch;
+        const int64_t pullStartNs = getElapsedRealtimeNs();
+        const PullErrorCode status = pullerPull.puller->Pull(eventTimeNs, &batch);
+        const int64_t pullDelayNs = getElapsedRealtimeNs() - pullStartNs;
+        const bool pullSuccess = OnPullDoneLocked(pullerPull.pullerKey, pullerPull.puller, status);
+        for (DeferredPull* pull : pullerPull.pulls) {
+            pull->batch = batch;
+            pull->pullSuccess = pullSuccess;
+            pull->pullDelayNs = pullDelayNs;
+        }
+    }
+}
+
 int StatsPullerManager::ForceClearPullerCache() {
     std::lock_guard<std::mutex> _l(mLock);
     int totalCleared = 0;
@@ -292,6 +601,15 @@ int StatsPullerManager::ForceClearPullerCache() {
     return totalCleared;
 }
 
+size_t StatsPullerManager::GetPullerCacheByteSize() {
+    std::lock_guard<std::mutex> _l(mLock);
+    size_t totalSize = 0;
+    for (const auto& pulledAtom : kAllPullAtomInfo) {
+        totalSize += pulledAtom.second->GetCacheByteSize();
+    }
+    return totalSize;
+}
+
 int StatsPullerManager::ClearPullerCacheIfNecessary(int64_t timestampNs) {
     std::lock_guard<std::mutex> _l(mLock);
     int totalCleared = 0;
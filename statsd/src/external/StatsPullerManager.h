@@ -20,7 +20,10 @@
 #include <aidl/android/os/IStatsCompanionService.h>
 #include <utils/RefBase.h>
 
+#include <condition_variable>
 #include <list>
+#include <memory>
+#include <thread>
 #include <vector>
 
 #include "PullDataReceiver.h"
@@ -29,6 +32,7 @@
 #include "guardrail/StatsdStats.h"
 #include "logd/LogEvent.h"
 #include "packages/UidMap.h"
+#include "utils/ParallelExecutor.h"
 
 using aidl::android::os::IPullAtomCallback;
 using aidl::android::os::IStatsCompanionService;
@@ -63,9 +67,7 @@ class StatsPullerManager : public virtual RefBase {
 public:
     StatsPullerManager();
 
-    virtual ~StatsPullerManager() {
-    }
-
+    virtual ~StatsPullerManager();
 
     // Registers a receiver for tagId. It will be pulled on the nextPullTimeNs
     // and then every intervalNs thereafter.
@@ -90,6 +92,38 @@ public:
 
     void OnAlarmFired(int64_t elapsedTimeNs);
 
+    // Makes OnAlarmFired() issue the due pulls concurrently on [numThreads] worker threads, in
+    // addition to the alarm thread, and pass their data to the receivers as they complete,
+    // without holding mLock. The pulls that have not started [deadlineNs] after the alarm
+    // fail. With 0 threads, the due pulls are issued one after the other.
+    void SetParallelPulls(size_t numThreads, int64_t deadlineNs);
+
+    // Defers the pull alarm to the last pull due within [windowNs] of the next one, so that
+    // closely spaced pulls share a wakeup. Pulls are only deferred, never issued before they are
+    // due, so that the pulled data is still snapped to the bucket end it was scheduled for.
+    void SetPullAlignmentWindow(int64_t windowNs);
+
+    // Starts the deferred pull thread, which issues the pulls queued by PullDeferred().
+    void EnableDeferredPulls();
+
+    // Makes the deferred pull thread wait [windowNs] after a pull is queued before issuing it, so
+    // that the pulls queued meanwhile, like those of all the gauge metrics splitting their bucket
+    // on an app upgrade, share its pull.
+    // DispatchDeferredPulls() waiting for the pending pulls ends the wait.
+    void SetDeferredPullWindow(int64_t windowNs);
+
+    // Queues a pull of [tagId] for [configKey], triggered at [eventTimeNs], so that the caller
+    // does not wait for it. Returns false if deferred pulls are not enabled, in which case the
+    // caller should pull synchronously. The queued pulls of a puller share one pull, and their
+    // data is passed to [receiver]->onDeferredDataPulled() by DispatchDeferredPulls().
+    virtual bool PullDeferred(int tagId, const ConfigKey& configKey, int64_t eventTimeNs,
+                              wp<PullDataReceiver> receiver);
+
+    // Passes the data of the completed deferred pulls to their receivers, in the order the pulls
+    // were queued. If [waitForPending], first waits for the queued pulls to complete. Must be
+    // called by the thread processing the events, which the receivers expect the data from.
+    void DispatchDeferredPulls(bool waitForPending);
+
     // Pulls the most recent data.
     // The data may be served from cache if consecutive pulls come within
     // mCoolDownNs.
@@ -114,6 +148,9 @@ public:
     // Clear pull data cache if it is beyond respective cool down time.
     int ClearPullerCacheIfNecessary(int64_t timestampNs);
 
+    // Estimated heap bytes of the pull data caches.
+    size_t GetPullerCacheByteSize();
+
     void SetStatsCompanionService(shared_ptr<IStatsCompanionService> statsCompanionService);
 
     void RegisterPullAtomCallback(const int uid, const int32_t atomTag, const int64_t coolDownNs,
@@ -157,13 +194,101 @@ private:
     bool PullLocked(int tagId, const vector<int32_t>& uids, const int64_t eventTimeNs,
                     vector<std::shared_ptr<LogEvent>>* data);
 
+    // Sets [uids] to the uids to pull [tagId] from for [configKey]. Returns false if the config
+    // has no pull uid provider.
+    bool GetPullUidsLocked(int tagId, const ConfigKey& configKey, vector<int32_t>* uids);
+
+    // Returns the puller of [tagId] registered by the first of [uids] that has one, or the end
+    // of kAllPullAtomInfo.
+    std::map<const PullerKey, sp<StatsPuller>>::iterator FindPullerLocked(
+            int tagId, const vector<int32_t>& uids);
+
+    // Notes the [status] of a pull from [puller], registered with [key], removing it if its
+    // process died. Returns whether the pull was successful.
+    bool OnPullDoneLocked(const PullerKey& key, const sp<StatsPuller>& puller,
+                          PullErrorCode status);
+
+    // A pull of OnAlarmFired(), for all the receivers of the puller.
+    struct DuePull {
+        int atomTag;
+        PullerKey pullerKey;
+        sp<StatsPuller> puller;
+        std::vector<sp<PullDataReceiver>> receivers;
+        PullErrorCode status = PULL_FAIL;
+    };
+
+    // Sets the timestamps of the pulled [batch], which is null if the pull failed, and passes it
+    // to the receivers of [pull].
+    static void DispatchPulledData(const DuePull& pull, int64_t elapsedTimeNs, int64_t wallClockNs,
+                                   const PulledEventBatch& batch);
+
+    // Issues [pulls] on mPullExecutor, releasing [lock] meanwhile, and notes their outcome.
+    void PullInParallelLocked(std::unique_lock<std::mutex>& lock, int64_t elapsedTimeNs,
+                              int64_t wallClockNs, std::vector<DuePull>& pulls);
+
+    // A pull of PullDeferred().
+    struct DeferredPull {
+        int atomTag;
+        ConfigKey configKey;
+        int64_t eventTimeNs;
+        wp<PullDataReceiver> receiver;
+        // The outcome of the pull, set by the deferred pull thread.
+        PulledEventBatch batch;
+        bool pullSuccess = false;
+        // How long the puller took, without the time spent in the queues.
+        int64_t pullDelayNs = 0;
+    };
+
+    // Issues the pulls queued by PullDeferred() until the manager is destroyed.
+    void DeferredPullLoop();
+
+    // Issues [pulls], pulling each puller once for all its pulls, and sets their outcome.
+    void IssueDeferredPulls(std::vector<DeferredPull>& pulls);
+
+    // Guards the deferred pull queues below. Acquired without holding mLock, and never held
+    // while pulling.
+    std::mutex mDeferredPullMutex;
+
+    // Signaled when pulls are queued or completed, or when the manager is destroyed.
+    std::condition_variable mDeferredPullsChanged;
+
+    std::vector<DeferredPull> mQueuedDeferredPulls;
+    std::vector<DeferredPull> mCompletedDeferredPulls;
+
+    // Whether the deferred pull thread is issuing pulls, which are in neither queue.
+    bool mIssuingDeferredPulls = false;
+
+    // See SetDeferredPullWindow().
+    int64_t mDeferredPullWindowNs = 0;
+
+    // The number of DispatchDeferredPulls() calls waiting for the pending pulls.
+    int mDeferredPullWaiters = 0;
+
+    bool mStopDeferredPulls = false;
+
+    std::thread mDeferredPullThread;
+
+    // See SetParallelPulls(). Guarded by mLock.
+    std::unique_ptr<ParallelExecutor> mPullExecutor;
+    int64_t mParallelPullDeadlineNs = 0;
+
     // locks for data receiver and StatsCompanionService changes
     std::mutex mLock;
 
+    // Serializes OnAlarmFired(), which releases mLock during parallel pulls, and
+    // SetParallelPulls(). Acquired before mLock.
+    std::mutex mAlarmMutex;
+
     void updateAlarmLocked();
 
+    // Returns the time of the pull alarm: mNextPullTimeNs, deferred within the alignment window.
+    int64_t GetAlignedPullTimeLocked() const;
+
     int64_t mNextPullTimeNs;
 
+    // See SetPullAlignmentWindow(), 0 if pull alarms are not aligned.
+    int64_t mPullAlignmentWindowNs = 0;
+
     FRIEND_TEST(GaugeMetricE2ePulledTest, TestRandomSamplePulledEvents);
     FRIEND_TEST(GaugeMetricE2ePulledTest, TestRandomSamplePulledEvent_LateAlarm);
     FRIEND_TEST(GaugeMetricE2ePulledTest, TestRandomSamplePulledEventsWithActivation);
@@ -176,6 +301,9 @@ private:
 
     FRIEND_TEST(ConfigUpdateE2eTest, TestGaugeMetric);
     FRIEND_TEST(ConfigUpdateE2eTest, TestValueMetric);
+
+    FRIEND_TEST(StatsPullerManagerTest, TestPullAlarmsAligned);
+    FRIEND_TEST(StatsPullerManagerTest, TestReceiverRegisteredDuringParallelPulls);
 };
 
 }  // namespace statsd
@@ -18,6 +18,11 @@
 #include "Log.h"
 
 #include "puller_util.h"
+
+#include <atomic>
+#include <unordered_map>
+
+#include "HashableDimensionKey.h"
 #include "stats_log_util.h"
 
 namespace android {
@@ -26,6 +31,56 @@ namespace statsd {
 
 using namespace std;
 
+namespace {
+
+std::atomic<bool> sHashMerge(false);
+
+// Whether the value at [fieldValue] is summed when merging events.
+inline bool isAdditive(const FieldValue& fieldValue, const set<int>& additiveFields) {
+    // Repeated additive fields are treated as non-additive fields.
+    return !isPrimitiveRepeatedField(fieldValue.mField) &&
+           additiveFields.find(fieldValue.mField.getPosAtDepth(0)) != additiveFields.end();
+}
+
+// Merges the events that only differ on additive fields into the first of them.
+void mergeByHash(vector<shared_ptr<LogEvent>>& data, const set<int>& additiveFields) {
+    // The key of an event is its values, with those of the additive fields cleared so that they
+    // don't tell events apart. Maps each key to its event in the merged data.
+    unordered_map<HashableDimensionKey, size_t> mergedIndices;
+    mergedIndices.reserve(data.size());
+    size_t mergedSize = 0;
+    for (size_t i = 0; i < data.size(); i++) {
+        const vector<FieldValue>& values = data[i]->getValues();
+        HashableDimensionKey key;
+        key.reserve(values.size());
+        for (const FieldValue& fieldValue : values) {
+            if (isAdditive(fieldValue, additiveFields)) {
+                key.addValue(FieldValue(fieldValue.mField, Value((int32_t)0)));
+            } else {
+                key.addValue(fieldValue);
+            }
+        }
+        const auto [it, inserted] = mergedIndices.emplace(std::move(key), mergedSize);
+        if (inserted) {
+            data[mergedSize++] = std::move(data[i]);
+            continue;
+        }
+        vector<FieldValue>* mergedValues = data[it->second]->getMutableValues();
+        for (size_t p = 0; p < values.size(); p++) {
+            if (isAdditive(values[p], additiveFields)) {
+                (*mergedValues)[p].mValue += values[p].mValue;
+            }
+        }
+    }
+    data.resize(mergedSize);
+}
+
+}  // namespace
+
+void setHashMergeIsolatedUids(bool enabled) {
+    sHashMerge.store(enabled, std::memory_order_relaxed);
+}
+
 /**
  * Process all data and merge isolated with host if necessary.
  * For example:
@@ -80,6 +135,11 @@ void mapAndMergeIsolatedUidsToHostUid(vector<shared_ptr<LogEvent>>& data, const
         }
     }
 
+    if (sHashMerge.load(std::memory_order_relaxed)) {
+        mergeByHash(data, set<int>(additiveFieldsVec.begin(), additiveFieldsVec.end()));
+        return;
+    }
+
     // 2. sort the data, bit-wise
     sort(data.begin(), data.end(),
          [](const shared_ptr<LogEvent>& lhs, const shared_ptr<LogEvent>& rhs) {
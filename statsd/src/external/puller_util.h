@@ -29,6 +29,11 @@ void mapAndMergeIsolatedUidsToHostUid(std::vector<std::shared_ptr<LogEvent>>& da
                                       const sp<UidMap>& uidMap, int tagId,
                                       const vector<int>& additiveFieldsVec);
 
+// Makes mapAndMergeIsolatedUidsToHostUid() group the events by the hash of their non-additive
+// values in one pass instead of sorting them. The merged events then keep the order in which
+// they were pulled rather than being sorted.
+void setHashMergeIsolatedUids(bool enabled);
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
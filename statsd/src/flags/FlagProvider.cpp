@@ -50,6 +50,14 @@ bool FlagProvider::getBootFlagBool(const string& flagName, const string& default
     return getFlagStringInternal(flagName, defaultValue, /* isBootFlag= */ true) == FLAG_TRUE;
 }
 
+string FlagProvider::getJavaFlagString(const string& flagName, const string& defaultValue) const {
+    std::lock_guard<std::mutex> lock(mFlagsMutex);
+    if (!mIsAtLeastSFunc()) {
+        return defaultValue;
+    }
+    return mGetServerFlagFunc(STATSD_JAVA_NAMESPACE, flagName, defaultValue);
+}
+
 void FlagProvider::initBootFlags(const vector<string>& flags) {
     std::lock_guard<std::mutex> lock(mFlagsMutex);
     mBootFlags.clear();
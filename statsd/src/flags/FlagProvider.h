@@ -36,11 +36,142 @@ using IsAtLeastSFunc = std::function<bool()>;
 
 const std::string STATSD_NATIVE_NAMESPACE = "statsd_native";
 const std::string STATSD_NATIVE_BOOT_NAMESPACE = "statsd_native_boot";
+// The namespace of the flags passed to StatsService::updateProperties() when they change.
+const std::string STATSD_JAVA_NAMESPACE = "statsd_java";
 
 const std::string FLAG_TRUE = "true";
 const std::string FLAG_FALSE = "false";
 const std::string FLAG_EMPTY = "";
 
+// Boot flag. Reads datagrams from the statsd socket in batches with recvmmsg.
+const std::string SOCKET_BATCH_READ_FLAG = "socket_batch_read";
+
+// Boot flag. Uses the lock-free single-producer/single-consumer LogEventQueue.
+const std::string LOCK_FREE_EVENT_QUEUE_FLAG = "lock_free_event_queue";
+
+// Boot flag. Pops pushed events from the LogEventQueue and processes them in batches.
+const std::string BATCHED_EVENT_PROCESSING_FLAG = "batched_event_processing";
+
+// Boot flag. Recycles pushed LogEvents through a LogEventPool instead of freeing them.
+const std::string LOG_EVENT_POOL_FLAG = "log_event_pool";
+
+// Boot flag. On LogEventQueue overflow, sheds events of the uid with the most queued events
+// instead of dropping the incoming event. Ignored with the lock-free queue.
+const std::string SHED_NOISIEST_UID_FLAG = "shed_noisiest_uid";
+
+// Boot flag. Receives pushed atoms into preallocated buffers and parses them on the log reader
+// thread instead of the socket thread.
+const std::string DEFERRED_PARSE_FLAG = "deferred_parse";
+
+// Boot flag. Dispatches event batches to the metrics managers of all configs in parallel.
+// Requires BATCHED_EVENT_PROCESSING_FLAG.
+const std::string PARALLEL_DISPATCH_FLAG = "parallel_dispatch";
+
+// Boot flag. Issues the pulls due on a pull alarm in parallel, without holding the puller
+// manager lock.
+const std::string PARALLEL_PULLS_FLAG = "parallel_pulls";
+
+// Boot flag. Merges the isolated uids of pulled data into their host uids by hashing the events
+// instead of sorting them.
+const std::string HASH_UID_MERGE_FLAG = "hash_uid_merge";
+
+// Boot flag. Defers the pull alarm to share its wakeup with the pulls due shortly after.
+const std::string ALIGNED_PULL_ALARMS_FLAG = "aligned_pull_alarms";
+
+// Boot flag. Adapts the timeout and cool down of each puller to its observed pull latency.
+const std::string ADAPTIVE_PULL_TIMEOUTS_FLAG = "adaptive_pull_timeouts";
+
+// Boot flag. Issues the pulls of gauge metrics at the start of their partial buckets, on app
+// upgrades and boot complete, on a dedicated thread instead of the thread processing the events.
+// The pulls triggered by condition changes, activations and trigger events stay synchronous.
+const std::string DEFERRED_CONDITION_PULLS_FLAG = "deferred_condition_pulls";
+
+// Boot flag. Defers the gauge pulls as DEFERRED_CONDITION_PULLS_FLAG does, and has the pulls
+// deferred shortly after one another, like those of the metrics split by one app upgrade, share
+// one pull of each puller.
+const std::string COALESCED_TRIGGER_PULLS_FLAG = "coalesced_trigger_pulls";
+
+// Boot flag. Hands out the events of the previous pull again for the pulled rows that did not
+// change, so that value metrics skip the dimensions whose rows are all unchanged.
+const std::string DELTA_ENCODED_PULLS_FLAG = "delta_encoded_pulls";
+
+// Boot flag. Registers only the soonest alarm of each duration anomaly tracker with the anomaly
+// alarm monitor, and re-arms it with the next one when it fires.
+const std::string COALESCED_ANOMALY_ALARMS_FLAG = "coalesced_anomaly_alarms";
+
+// Boot flag. Informs the subscribers of anomalies and alarms from a worker thread instead of the
+// thread that declared them.
+const std::string ASYNC_SUBSCRIBERS_FLAG = "async_subscribers";
+
+// Boot flag. Launches perfetto for the perfetto subscriptions with vfork() instead of fork().
+const std::string VFORK_PERFETTO_LAUNCH_FLAG = "vfork_perfetto_launch";
+
+// Boot flag. Compresses the reports and local history saved to disk.
+const std::string COMPRESSED_REPORTS_FLAG = "compressed_reports";
+
+// Boot flag. Periodically appends the completed buckets of the configs to checkpoint logs on
+// disk instead of keeping them in memory until the next report.
+const std::string CHECKPOINT_METRICS_FLAG = "checkpoint_metrics";
+
+// Boot flag. Writes the reports, checkpoints, active configs, metadata and train info to disk
+// from a worker thread instead of the thread that produced them.
+const std::string ASYNC_STORAGE_WRITES_FLAG = "async_storage_writes";
+
+// Boot flag. Builds the metrics managers of the configs saved on disk in parallel at startup.
+const std::string PARALLEL_CONFIG_LOAD_FLAG = "parallel_config_load";
+
+// Boot flag. Serializes the reports of the metrics of a config in parallel when it is dumped.
+const std::string PARALLEL_DUMP_FLAG = "parallel_dump";
+
+// Boot flag. Caps the LogEventQueue by the encoded size of the queued events, and adapts its
+// event capacity to the drain rate. Ignored with the lock-free queue.
+const std::string BYTE_BUDGET_EVENT_QUEUE_FLAG = "byte_budget_event_queue";
+
+// Boot flag. Counts the datagrams dropped by the kernel on the statsd socket, and grows its
+// receive buffer when drops are observed.
+const std::string SOCKET_RCVBUF_AUTOTUNE_FLAG = "socket_rcvbuf_autotune";
+
+// Boot flag. Accepts the shared memory rings of the system processes logging many atoms, which
+// are drained alongside the socket.
+const std::string SHARED_MEMORY_RING_FLAG = "shared_memory_ring";
+
+// Boot flag. Drops pushed atoms that no config, state tracker or shell subscription uses before
+// parsing them.
+const std::string LAZY_PARSE_FLAG = "lazy_parse";
+
+// Boot flag. Parses long string and byte array fields as views into the atom buffer, which are
+// only copied when stored in a dimension key or a gauge atom.
+const std::string BUFFER_VIEW_VALUES_FLAG = "buffer_view_values";
+
+// Boot flag. Interns short string fields, such as attribution tags, so that equal strings of
+// different events share one payload.
+const std::string INTERN_STRING_VALUES_FLAG = "intern_string_values";
+
+// Boot flag. Decodes all-scalar atoms through parse plans learned from their first event.
+const std::string PARSE_PLANS_FLAG = "parse_plans";
+
+// Boot flag. Queues the atoms that change the meaning of the later events, like isolated uid
+// changes, in a priority lane of the LogEventQueue that is drained first and not shed on overflow.
+const std::string PRIORITY_EVENT_LANE_FLAG = "priority_event_lane";
+
+// Boot flag. Reads the atoms of the apps from their own socket, on a dedicated listener thread,
+// and queues them in an app lane of the LogEventQueue, so that a flood of app atoms fills neither
+// the socket buffer nor the queue of the platform atoms. Ignored with the lock-free queue.
+const std::string APP_INGEST_SOCKET_FLAG = "app_ingest_socket";
+
+// Boot flag. Diffs the values of the cumulative pulled atoms of a NumericValueMetricProducer for
+// the whole pull at once, instead of matching a copy of each pulled event.
+const std::string BULK_PULL_DIFFS_FLAG = "bulk_pull_diffs";
+
+// The CPU affinity, priority and pool size of the statsd threads, see ThreadTopology. A flag of
+// STATSD_JAVA_NAMESPACE, read at startup, then updated through StatsService::updateProperties().
+const std::string THREAD_TOPOLOGY_FLAG = "thread_topology";
+
+// The budget of the estimated cost of the configs, see MetricsManager::SetConfigCostBudget(). A
+// flag of STATSD_JAVA_NAMESPACE, read at startup, then updated through
+// StatsService::updateProperties().
+const std::string CONFIG_COST_BUDGET_FLAG = "config_cost_budget";
+
 class FlagProvider {
 public:
     static FlagProvider& getInstance();
@@ -56,6 +187,11 @@ public:
     // Returns true IFF flagName has a value of "true".
     bool getBootFlagBool(const std::string& flagName, const std::string& defaultValue) const;
 
+    // Returns the value of a flag of STATSD_JAVA_NAMESPACE, whose updates are then passed to
+    // StatsService::updateProperties().
+    std::string getJavaFlagString(const std::string& flagName,
+                                  const std::string& defaultValue) const;
+
     // Queries the boot flags. Should only be called once at boot.
     void initBootFlags(const std::vector<std::string>& flags);
 
@@ -121,6 +257,7 @@ private:
     FRIEND_TEST(FlagProviderTest_SPlus, TestGetFlagBoolServerFlagTrue);
     FRIEND_TEST(FlagProviderTest_SPlus, TestGetFlagBoolServerFlagFalse);
     FRIEND_TEST(FlagProviderTest_SPlus, TestOverrideLocalFlags);
+    FRIEND_TEST(FlagProviderTest_SPlus, TestGetJavaFlagString);
     FRIEND_TEST(FlagProviderTest_SPlus, TestGetFlagBoolServerFlagEmptyDefaultFalse);
     FRIEND_TEST(FlagProviderTest_SPlus, TestGetFlagBoolServerFlagEmptyDefaultTrue);
     FRIEND_TEST(FlagProviderTest_SPlus_RealValues, TestGetBootFlagBoolServerFlagTrue);
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "EventRateTimeSeries.h"
+
+#include <algorithm>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using android::util::FIELD_COUNT_REPEATED;
+using android::util::FIELD_TYPE_INT32;
+using android::util::FIELD_TYPE_INT64;
+using android::util::FIELD_TYPE_MESSAGE;
+using android::util::ProtoOutputStream;
+using std::array;
+
+// for EventRateStats
+const int FIELD_ID_EVENT_RATE_STATS_SECOND = 1;
+const int FIELD_ID_EVENT_RATE_STATS_MINUTE = 2;
+
+// for EventRateStats.Sample
+const int FIELD_ID_SAMPLE_START_ELAPSED_SEC = 1;
+const int FIELD_ID_SAMPLE_EVENT_COUNT = 2;
+const int FIELD_ID_SAMPLE_MAX_QUEUE_SIZE = 3;
+const int FIELD_ID_SAMPLE_TOP_ATOM = 4;
+
+// for EventRateStats.AtomCount
+const int FIELD_ID_ATOM_COUNT_ATOM_ID = 1;
+const int FIELD_ID_ATOM_COUNT_COUNT = 2;
+
+EventRateTimeSeries::EventRateTimeSeries(int maxAtomId, std::function<int(int)> getAtomCount)
+    : mMaxAtomId(maxAtomId), mGetAtomCount(std::move(getAtomCount)) {
+}
+
+void EventRateTimeSeries::add(int64_t timeSec, int32_t count, int32_t queueSize) {
+    if (mSeconds.empty()) {
+        mSeconds.resize(kSecondCount);
+        mMinutes.resize(kMinuteCount);
+        mAtomCountsAtMinuteStart.resize(mMaxAtomId + 1);
+        for (int atomId = 0; atomId <= mMaxAtomId; atomId++) {
+            mAtomCountsAtMinuteStart[atomId] = mGetAtomCount(atomId);
+        }
+        mLastSec = timeSec;
+    }
+    timeSec = std::max(timeSec, mLastSec);
+
+    const int64_t minute = timeSec / 60;
+    if (minute != mLastSec / 60) {
+        // Closes the minute of the last sample.
+        MinuteSample& last = mMinutes[(mLastSec / 60) % kMinuteCount];
+        last.topAtoms = getTopAtoms();
+        for (int atomId = 0; atomId <= mMaxAtomId; atomId++) {
+            mAtomCountsAtMinuteStart[atomId] = mGetAtomCount(atomId);
+        }
+    }
+    mLastSec = timeSec;
+
+    addToSample(&mSeconds[timeSec % kSecondCount], timeSec, count, queueSize);
+    MinuteSample& current = mMinutes[minute % kMinuteCount];
+    if (current.sample.startSec != minute * 60) {
+        current.topAtoms = {};
+    }
+    addToSample(&current.sample, minute * 60, count, queueSize);
+}
+
+void EventRateTimeSeries::clear() {
+    mSeconds.clear();
+    mMinutes.clear();
+    mAtomCountsAtMinuteStart.clear();
+    mLastSec = 0;
+}
+
+array<EventRateTimeSeries::AtomCount, EventRateTimeSeries::kTopAtomCount>
+EventRateTimeSeries::getTopAtoms() const {
+    array<AtomCount, kTopAtomCount> topAtoms;
+    for (int atomId = 0; atomId <= mMaxAtomId; atomId++) {
+        int count = mGetAtomCount(atomId);
+        // The cumulative counts are reset with the rest of StatsdStats.
+        if (count >= mAtomCountsAtMinuteStart[atomId]) {
+            count -= mAtomCountsAtMinuteStart[atomId];
+        }
+        if (count <= topAtoms.back().count) {
+            continue;
+        }
+        int i = kTopAtomCount - 1;
+        for (; i > 0 && topAtoms[i - 1].count < count; i--) {
+            topAtoms[i] = topAtoms[i - 1];
+        }
+        topAtoms[i] = {atomId, count};
+    }
+    return topAtoms;
+}
+
+void EventRateTimeSeries::addToSample(Sample* sample, int32_t startSec, int32_t count,
+                                      int32_t queueSize) {
+    if (sample->startSec != startSec) {
+        *sample = Sample();
+        sample->startSec = startSec;
+    }
+    sample->count += count;
+    sample->maxQueueSize = std::max(sample->maxQueueSize, queueSize);
+}
+
+void EventRateTimeSeries::writeToProto(ProtoOutputStream* proto) const {
+    if (mSeconds.empty()) {
+        return;
+    }
+    for (int64_t sec = std::max<int64_t>(0, mLastSec - kSecondCount + 1); sec <= mLastSec;
+         sec++) {
+        const Sample& sample = mSeconds[sec % kSecondCount];
+        if (sample.startSec == sec) {
+            writeSampleToProto(sample, nullptr, FIELD_ID_EVENT_RATE_STATS_SECOND, proto);
+        }
+    }
+    const int64_t lastMinute = mLastSec / 60;
+    for (int64_t minute = std::max<int64_t>(0, lastMinute - kMinuteCount + 1);
+         minute <= lastMinute; minute++) {
+        const MinuteSample& sample = mMinutes[minute % kMinuteCount];
+        if (sample.sample.startSec != minute * 60) {
+            continue;
+        }
+        if (minute == lastMinute) {
+            // The current minute is still open.
+            const array<AtomCount, kTopAtomCount> topAtoms = getTopAtoms();
+            writeSampleToProto(sample.sample, topAtoms.data(), FIELD_ID_EVENT_RATE_STATS_MINUTE,
+                               proto);
+        } else {
+            writeSampleToProto(sample.sample, sample.topAtoms.data(),
+                               FIELD_ID_EVENT_RATE_STATS_MINUTE, proto);
+        }
+    }
+}
+
+void EventRateTimeSeries::writeSampleToProto(const Sample& sample, const AtomCount* topAtoms,
+                                             uint64_t fieldId, ProtoOutputStream* proto) {
+    uint64_t token = proto->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | fieldId);
+    proto->write(FIELD_TYPE_INT64 | FIELD_ID_SAMPLE_START_ELAPSED_SEC, (long long)sample.startSec);
+    proto->write(FIELD_TYPE_INT32 | FIELD_ID_SAMPLE_EVENT_COUNT, sample.count);
+    proto->write(FIELD_TYPE_INT32 | FIELD_ID_SAMPLE_MAX_QUEUE_SIZE, sample.maxQueueSize);
+    for (int i = 0; topAtoms != nullptr && i < kTopAtomCount && topAtoms[i].count > 0; i++) {
+        uint64_t atomToken =
+                proto->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_SAMPLE_TOP_ATOM);
+        proto->write(FIELD_TYPE_INT32 | FIELD_ID_ATOM_COUNT_ATOM_ID, topAtoms[i].atomId);
+        proto->write(FIELD_TYPE_INT32 | FIELD_ID_ATOM_COUNT_COUNT, topAtoms[i].count);
+        proto->end(atomToken);
+    }
+    proto->end(token);
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android/util/ProtoOutputStream.h>
+
+#include <array>
+#include <functional>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Fixed memory time series of the events received by statsd: the number of events and the max
+ * queue size of each second of the last hour and of each minute of the last day, and the most
+ * logged atoms of each minute. The per-atom counts are derived from the cumulative atom counts,
+ * which are sampled when a minute ends. The storage is allocated on the first sample.
+ *
+ * Not thread safe.
+ */
+class EventRateTimeSeries {
+public:
+    static const int kSecondCount = 3600;
+    static const int kMinuteCount = 1440;
+    static const int kTopAtomCount = 3;
+
+    // [getAtomCount] returns the cumulative count of an atom id in [0, maxAtomId].
+    EventRateTimeSeries(int maxAtomId, std::function<int(int)> getAtomCount);
+
+    // Notes [count] events received at [timeSec], elapsed realtime, after which [queueSize]
+    // events were queued. Times before the last sample are counted in the last sample.
+    void add(int64_t timeSec, int32_t count, int32_t queueSize);
+
+    // Forgets all samples.
+    void clear();
+
+    // Writes the samples with events as the fields of a StatsdStatsReport.EventRateStats.
+    void writeToProto(util::ProtoOutputStream* proto) const;
+
+private:
+    struct AtomCount {
+        int32_t atomId = 0;
+        int32_t count = 0;
+    };
+
+    struct Sample {
+        // Start of the sample, or -1 if the slot is unused.
+        int32_t startSec = -1;
+        int32_t count = 0;
+        int32_t maxQueueSize = 0;
+    };
+
+    struct MinuteSample {
+        Sample sample;
+        // Sorted by decreasing count, the unused entries have a count of 0.
+        std::array<AtomCount, kTopAtomCount> topAtoms;
+    };
+
+    // Returns the most logged atoms since mAtomCountsAtMinuteStart was sampled.
+    std::array<AtomCount, kTopAtomCount> getTopAtoms() const;
+
+    static void addToSample(Sample* sample, int32_t startSec, int32_t count, int32_t queueSize);
+
+    static void writeSampleToProto(const Sample& sample, const AtomCount* topAtoms,
+                                   uint64_t fieldId, util::ProtoOutputStream* proto);
+
+    const int mMaxAtomId;
+
+    const std::function<int(int)> mGetAtomCount;
+
+    // Rings indexed by the second and the minute of the samples.
+    std::vector<Sample> mSeconds;
+    std::vector<MinuteSample> mMinutes;
+
+    // Cumulative atom counts at the start of the current minute.
+    std::vector<int> mAtomCountsAtMinuteStart;
+
+    int64_t mLastSec = 0;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -19,6 +19,9 @@
 #include "StatsdStats.h"
 
 #include <android/util/ProtoOutputStream.h>
+#include <algorithm>
+#include <functional>
+#include <set>
 #include "../stats_log_util.h"
 #include "statslog_statsd.h"
 #include "storage/StorageManager.h"
@@ -52,10 +55,17 @@ const int FIELD_ID_SYSTEM_SERVER_RESTART = 15;
 const int FIELD_ID_LOGGER_ERROR_STATS = 16;
 const int FIELD_ID_OVERFLOW = 18;
 const int FIELD_ID_ACTIVATION_BROADCAST_GUARDRAIL = 19;
+const int FIELD_ID_SOCKET_READ_STATS = 20;
+const int FIELD_ID_INGESTION_LATENCY_STATS = 21;
+const int FIELD_ID_LOG_EVENT_PARSE_STATS = 22;
+const int FIELD_ID_EVENT_RATE_STATS = 23;
+const int FIELD_ID_UNATTRIBUTED_CLIENT_DROP_COUNT = 24;
 
 const int FIELD_ID_ATOM_STATS_TAG = 1;
 const int FIELD_ID_ATOM_STATS_COUNT = 2;
 const int FIELD_ID_ATOM_STATS_ERROR_COUNT = 3;
+const int FIELD_ID_ATOM_STATS_SKIP_COUNT = 4;
+const int FIELD_ID_ATOM_STATS_CLIENT_DROP_COUNT = 5;
 
 const int FIELD_ID_ANOMALY_ALARMS_REGISTERED = 1;
 const int FIELD_ID_PERIODIC_ALARMS_REGISTERED = 1;
@@ -70,6 +80,20 @@ const int FIELD_ID_LOG_LOSS_STATS_PID = 6;
 const int FIELD_ID_OVERFLOW_COUNT = 1;
 const int FIELD_ID_OVERFLOW_MAX_HISTORY = 2;
 const int FIELD_ID_OVERFLOW_MIN_HISTORY = 3;
+const int FIELD_ID_OVERFLOW_UID_DROPS = 4;
+const int FIELD_ID_OVERFLOW_DROPPED_BYTES = 5;
+const int FIELD_ID_OVERFLOW_APP_COUNT = 6;
+
+const int FIELD_ID_INGESTION_LATENCY_QUEUE_WAIT = 1;
+const int FIELD_ID_INGESTION_LATENCY_PROCESSING = 2;
+const int FIELD_ID_INGESTION_LATENCY_ATOM = 3;
+
+const int FIELD_ID_ATOM_INGESTION_LATENCY_ATOM_ID = 1;
+const int FIELD_ID_ATOM_INGESTION_LATENCY_QUEUE_WAIT = 2;
+const int FIELD_ID_ATOM_INGESTION_LATENCY_PROCESSING = 3;
+
+const int FIELD_ID_OVERFLOW_UID_DROPS_UID = 1;
+const int FIELD_ID_OVERFLOW_UID_DROPS_COUNT = 2;
 
 const int FIELD_ID_CONFIG_STATS_UID = 1;
 const int FIELD_ID_CONFIG_STATS_ID = 2;
@@ -101,8 +125,11 @@ const int FIELD_ID_MATCHER_STATS_ID = 1;
 const int FIELD_ID_MATCHER_STATS_COUNT = 2;
 const int FIELD_ID_CONDITION_STATS_ID = 1;
 const int FIELD_ID_CONDITION_STATS_COUNT = 2;
+const int FIELD_ID_CONDITION_STATS_EVICTED_KEY_COUNT = 3;
+const int FIELD_ID_CONDITION_STATS_ESTIMATED_CARDINALITY = 4;
 const int FIELD_ID_METRIC_STATS_ID = 1;
 const int FIELD_ID_METRIC_STATS_COUNT = 2;
+const int FIELD_ID_METRIC_STATS_ESTIMATED_CARDINALITY = 3;
 const int FIELD_ID_ALERT_STATS_ID = 1;
 const int FIELD_ID_ALERT_STATS_COUNT = 2;
 
@@ -114,14 +141,23 @@ const int FIELD_ID_UID_MAP_DELETED_APPS = 4;
 const int FIELD_ID_ACTIVATION_BROADCAST_GUARDRAIL_UID = 1;
 const int FIELD_ID_ACTIVATION_BROADCAST_GUARDRAIL_TIME = 2;
 
+const int FIELD_ID_SOCKET_READ_STATS_BATCHED_READ_SIZE = 1;
+const int FIELD_ID_SOCKET_READ_STATS_KERNEL_DROP_COUNT = 2;
+const int FIELD_ID_SOCKET_READ_STATS_RECEIVE_BUFFER_GROW_COUNT = 3;
+const int FIELD_ID_SOCKET_READ_STATS_RECEIVE_BUFFER_BYTES = 4;
+
+const int FIELD_ID_LOG_EVENT_PARSE_STATS_VALUES_REGROW_COUNT = 1;
+
 const std::map<int, std::pair<size_t, size_t>> StatsdStats::kAtomDimensionKeySizeLimitMap = {
         {util::BINDER_CALLS, {6000, 10000}},
         {util::LOOPER_STATS, {1500, 2500}},
         {util::CPU_TIME_PER_UID_FREQ, {6000, 10000}},
 };
 
-StatsdStats::StatsdStats() {
-    mPushedAtomStats.resize(kMaxPushedAtomId + 1);
+StatsdStats::StatsdStats()
+    : mEventRates(kMaxPushedAtomId, [this](int atomId) { return getPushedAtomCount(atomId); }) {
+    mPushedAtomStats = std::make_unique<PushedAtomCounts[]>(kNumPushedAtomStatsShards);
+    mSocketBatchReadHistogram.resize(kNumBinsInSocketBatchReadHistogram);
     mStartTimeSec = getWallClockSec();
 }
 
@@ -199,10 +235,33 @@ void StatsdStats::noteConfigReset(const ConfigKey& key) {
 void StatsdStats::noteLogLost(int32_t wallClockTimeSec, int32_t count, int32_t lastError,
                               int32_t lastTag, int32_t uid, int32_t pid) {
     lock_guard<std::mutex> lock(mLock);
-    if (mLogLossStats.size() == kMaxLoggerErrors) {
-        mLogLossStats.pop_front();
+    // A client sends one report per atom it counted the drops of, and one for the other drops,
+    // all at once. These are recorded as one loss.
+    if (!mLogLossStats.empty() && mLogLossStats.back().mWallClockSec == wallClockTimeSec &&
+        mLogLossStats.back().mUid == uid && mLogLossStats.back().mPid == pid) {
+        LogLossStats& loss = mLogLossStats.back();
+        loss.mCount += count;
+        loss.mLastError = lastError;
+        if (lastTag > 0) {
+            loss.mLastTag = lastTag;
+        }
+    } else {
+        if (mLogLossStats.size() == kMaxLoggerErrors) {
+            mLogLossStats.pop_front();
+        }
+        mLogLossStats.emplace_back(wallClockTimeSec, count, lastError, lastTag, uid, pid);
+    }
+
+    if (count <= 0) {
+        return;
+    }
+    bool present = (mPushedAtomClientDropStats.find(lastTag) != mPushedAtomClientDropStats.end());
+    bool full = (mPushedAtomClientDropStats.size() >= (size_t)kMaxPushedAtomErrorStatsSize);
+    if (lastTag > 0 && (!full || present)) {
+        mPushedAtomClientDropStats[lastTag] += count;
+    } else {
+        mUnattributedClientDrops += count;
     }
-    mLogLossStats.emplace_back(wallClockTimeSec, count, lastError, lastTag, uid, pid);
 }
 
 void StatsdStats::noteBroadcastSent(const ConfigKey& key) {
@@ -259,9 +318,16 @@ void StatsdStats::noteDataDropped(const ConfigKey& key, const size_t totalBytes)
 }
 
 void StatsdStats::noteEventQueueOverflow(int64_t oldestEventTimestampNs) {
+    noteEventQueueOverflow(oldestEventTimestampNs, 1);
+}
+
+void StatsdStats::noteEventQueueOverflow(int64_t oldestEventTimestampNs, int32_t count,
+                                         int64_t droppedBytes, int32_t appCount) {
     lock_guard<std::mutex> lock(mLock);
 
-    mOverflowCount++;
+    mOverflowCount += count;
+    mOverflowBytes += droppedBytes;
+    mAppOverflowCount += appCount;
 
     int64_t history = getElapsedRealtimeNs() - oldestEventTimestampNs;
 
@@ -274,6 +340,189 @@ void StatsdStats::noteEventQueueOverflow(int64_t oldestEventTimestampNs) {
     }
 }
 
+void StatsdStats::noteEventQueueOverflowForUids(const std::vector<int32_t>& droppedUids) {
+    lock_guard<std::mutex> lock(mLock);
+    for (const int32_t uid : droppedUids) {
+        noteEventQueueOverflowForUidLocked(uid);
+    }
+}
+
+void StatsdStats::noteEventQueueOverflowForUid(int32_t uid) {
+    lock_guard<std::mutex> lock(mLock);
+    noteEventQueueOverflowForUidLocked(uid);
+}
+
+void StatsdStats::noteEventQueueOverflowForUidLocked(int32_t uid) {
+    auto it = mEventQueueOverflowPerUid.find(uid);
+    if (it != mEventQueueOverflowPerUid.end()) {
+        it->second++;
+    } else if (mEventQueueOverflowPerUid.size() < kMaxEventQueueOverflowUids) {
+        mEventQueueOverflowPerUid[uid] = 1;
+    }
+}
+
+void StatsdStats::noteSocketBatchRead(size_t batchSize) {
+    size_t bin;
+    if (batchSize < 10) {
+        bin = batchSize;
+    } else if (batchSize < 100) {
+        bin = 9 + batchSize / 10;
+    } else {
+        bin = kNumBinsInSocketBatchReadHistogram - 1;
+    }
+
+    lock_guard<std::mutex> lock(mLock);
+    mSocketBatchReadHistogram[bin]++;
+}
+
+void StatsdStats::noteEventsQueued(int64_t timestampNs, int32_t count, int32_t queueSize) {
+    lock_guard<std::mutex> lock(mLock);
+    mEventRates.add(timestampNs / NS_PER_SEC, count, queueSize);
+}
+
+void StatsdStats::noteSocketKernelDrops(int64_t count) {
+    lock_guard<std::mutex> lock(mLock);
+    mSocketKernelDropCount += count;
+}
+
+void StatsdStats::noteSocketReceiveBufferGrown(int64_t sizeBytes) {
+    lock_guard<std::mutex> lock(mLock);
+    mSocketReceiveBufferGrowCount++;
+    mSocketReceiveBufferBytes = sizeBytes;
+}
+
+void StatsdStats::noteLogEventValuesRegrown(int64_t count) {
+    lock_guard<std::mutex> lock(mLock);
+    mLogEventValuesRegrowCount += count;
+}
+
+size_t StatsdStats::getLatencyHistogramBin(int64_t latencyNs) {
+    const int64_t latencyUs = latencyNs / 1000;
+    if (latencyUs < 1) {
+        return 0;
+    }
+    const int octave = 63 - __builtin_clzll((uint64_t)latencyUs);
+    if (octave >= kNumOctavesInLatencyHistogram) {
+        return kNumBinsInLatencyHistogram - 1;
+    }
+    // The bit below the leading one tells which half of the octave the latency falls in.
+    const int upperHalf = octave > 0 ? (latencyUs >> (octave - 1)) & 1 : 0;
+    return 1 + 2 * octave + upperHalf;
+}
+
+int64_t StatsdStats::getLatencyHistogramPercentileNs(const vector<int64_t>& histogram,
+                                                     int percentile) {
+    int64_t count = 0;
+    for (const int64_t binCount : histogram) {
+        count += binCount;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    // The number of latencies at or below the percentile, rounded up.
+    const int64_t rank = (count * percentile + 99) / 100;
+    int64_t seen = 0;
+    size_t bin = 0;
+    for (; bin + 1 < histogram.size(); bin++) {
+        seen += histogram[bin];
+        if (seen >= rank) {
+            break;
+        }
+    }
+    // The inverse of getLatencyHistogramBin(), see kNumBinsInLatencyHistogram.
+    if (bin == 0) {
+        return 1000;
+    }
+    const int octave = std::min((int)(bin - 1) / 2, kNumOctavesInLatencyHistogram);
+    const int64_t octaveStartUs = 1LL << octave;
+    if (bin == kNumBinsInLatencyHistogram - 1) {
+        // The overflow bin has no upper bound.
+        return octaveStartUs * 1000;
+    }
+    const bool upperHalf = (bin - 1) % 2 == 1;
+    const int64_t upperBoundUs =
+            upperHalf || octave == 0 ? 2 * octaveStartUs : octaveStartUs + octaveStartUs / 2;
+    return upperBoundUs * 1000;
+}
+
+void StatsdStats::LogEventLatencies::add(int atomId, int64_t queueWaitNs, int64_t processingNs) {
+    const size_t queueWaitBin = getLatencyHistogramBin(queueWaitNs);
+    const size_t processingBin = getLatencyHistogramBin(processingNs);
+    for (IngestionLatency* latency : {&mTotal, &mAtoms[atomId]}) {
+        latency->count++;
+        latency->queueWait[queueWaitBin]++;
+        latency->processing[processingBin]++;
+    }
+}
+
+void StatsdStats::noteLogEventLatency(int atomId, int64_t queueWaitNs, int64_t processingNs) {
+    LogEventLatencies latencies;
+    latencies.add(atomId, queueWaitNs, processingNs);
+    noteLogEventLatencies(&latencies);
+}
+
+void StatsdStats::noteLogEventLatencies(LogEventLatencies* latencies) {
+    if (latencies->mTotal.count == 0) {
+        return;
+    }
+    const auto addLatency = [](const IngestionLatency& from, IngestionLatency* to) {
+        to->count += from.count;
+        for (int bin = 0; bin < kNumBinsInLatencyHistogram; bin++) {
+            to->queueWait[bin] += from.queueWait[bin];
+            to->processing[bin] += from.processing[bin];
+        }
+    };
+    {
+        lock_guard<std::mutex> lock(mLock);
+        addLatency(latencies->mTotal, &mIngestionLatency);
+        for (const auto& [atomId, latency] : latencies->mAtoms) {
+            if (latency.count == 0) {
+                continue;
+            }
+            auto it = mAtomIngestionLatency.find(atomId);
+            if (it == mAtomIngestionLatency.end()) {
+                if (mAtomIngestionLatency.size() >= kMaxLatencyTrackedAtoms) {
+                    continue;
+                }
+                it = mAtomIngestionLatency.emplace(atomId, IngestionLatency()).first;
+            }
+            addLatency(latency, &it->second);
+        }
+    }
+
+    const auto clearLatency = [](IngestionLatency* latency) {
+        latency->count = 0;
+        std::fill(latency->queueWait.begin(), latency->queueWait.end(), 0);
+        std::fill(latency->processing.begin(), latency->processing.end(), 0);
+    };
+    clearLatency(&latencies->mTotal);
+    if (latencies->mAtoms.size() > kMaxLatencyTrackedAtoms) {
+        latencies->mAtoms.clear();
+    } else {
+        for (auto& [_, latency] : latencies->mAtoms) {
+            clearLatency(&latency);
+        }
+    }
+}
+
+vector<int> StatsdStats::getLatencyReportedAtomsLocked() const {
+    vector<std::pair<int64_t, int>> atomsByCount;
+    atomsByCount.reserve(mAtomIngestionLatency.size());
+    for (const auto& pair : mAtomIngestionLatency) {
+        atomsByCount.emplace_back(pair.second.count, pair.first);
+    }
+    const size_t numReported = std::min(atomsByCount.size(), kMaxLatencyReportedAtoms);
+    std::partial_sort(atomsByCount.begin(), atomsByCount.begin() + numReported,
+                      atomsByCount.end(), std::greater<>());
+
+    vector<int> atomIds;
+    atomIds.reserve(numReported);
+    for (size_t i = 0; i < numReported; i++) {
+        atomIds.push_back(atomsByCount[i].second);
+    }
+    return atomIds;
+}
+
 void StatsdStats::noteDataDropped(const ConfigKey& key, const size_t totalBytes, int32_t timeSec) {
     lock_guard<std::mutex> lock(mLock);
     auto it = mConfigStats.find(key);
@@ -327,6 +576,28 @@ void StatsdStats::setCurrentUidMapMemory(int bytes) {
     mUidMapStats.bytes_used = bytes;
 }
 
+void StatsdStats::noteConditionDimensionKeyEvicted(const ConfigKey& key, const int64_t& id) {
+    lock_guard<std::mutex> lock(mLock);
+    auto statsIt = mConfigStats.find(key);
+    if (statsIt == mConfigStats.end()) {
+        return;
+    }
+    statsIt->second->condition_eviction_stats[id]++;
+}
+
+void StatsdStats::noteConditionDimensionCardinality(const ConfigKey& key, const int64_t& id,
+                                                    int64_t estimate) {
+    lock_guard<std::mutex> lock(mLock);
+    auto statsIt = mConfigStats.find(key);
+    if (statsIt == mConfigStats.end()) {
+        return;
+    }
+    auto& cardinalityMap = statsIt->second->condition_cardinality_stats;
+    if (estimate > cardinalityMap[id]) {
+        cardinalityMap[id] = estimate;
+    }
+}
+
 void StatsdStats::noteConditionDimensionSize(const ConfigKey& key, const int64_t& id, int size) {
     lock_guard<std::mutex> lock(mLock);
     // if name doesn't exist before, it will create the key with count 0.
@@ -354,6 +625,19 @@ void StatsdStats::noteMetricDimensionSize(const ConfigKey& key, const int64_t& i
     }
 }
 
+void StatsdStats::noteMetricDimensionCardinality(const ConfigKey& key, const int64_t& id,
+                                                 int64_t estimate) {
+    lock_guard<std::mutex> lock(mLock);
+    auto statsIt = mConfigStats.find(key);
+    if (statsIt == mConfigStats.end()) {
+        return;
+    }
+    auto& cardinalityMap = statsIt->second->metric_cardinality_stats;
+    if (estimate > cardinalityMap[id]) {
+        cardinalityMap[id] = estimate;
+    }
+}
+
 void StatsdStats::noteMetricDimensionInConditionSize(
         const ConfigKey& key, const int64_t& id, int size) {
     lock_guard<std::mutex> lock(mLock);
@@ -420,6 +704,19 @@ void StatsdStats::notePullTime(int pullAtomId, int64_t pullTimeNs) {
     pullStats.avgPullTimeNs = (pullStats.avgPullTimeNs * pullStats.numPullTime + pullTimeNs) /
                               (pullStats.numPullTime + 1);
     pullStats.numPullTime += 1;
+    if (pullStats.pullTimeHistogram.empty()) {
+        pullStats.pullTimeHistogram.resize(kNumBinsInLatencyHistogram);
+    }
+    pullStats.pullTimeHistogram[getLatencyHistogramBin(pullTimeNs)]++;
+}
+
+void StatsdStats::noteIsolatedUidMergeTime(int pullAtomId, int64_t mergeTimeNs) {
+    lock_guard<std::mutex> lock(mLock);
+    auto& pullStats = mPulledAtomStats[pullAtomId];
+    pullStats.maxMergeTimeNs = std::max(pullStats.maxMergeTimeNs, mergeTimeNs);
+    pullStats.avgMergeTimeNs = (pullStats.avgMergeTimeNs * pullStats.numMergeTime + mergeTimeNs) /
+                               (pullStats.numMergeTime + 1);
+    pullStats.numMergeTime += 1;
 }
 
 void StatsdStats::notePullDelay(int pullAtomId, int64_t pullDelayNs) {
@@ -456,18 +753,64 @@ void StatsdStats::notePullExceedMaxDelay(int pullAtomId) {
     mPulledAtomStats[pullAtomId].pullExceedMaxDelay++;
 }
 
-void StatsdStats::noteAtomLogged(int atomId, int32_t timeSec) {
-    lock_guard<std::mutex> lock(mLock);
+void StatsdStats::addPushedAtomCount(int atomId, int count) {
+    static std::atomic<int> sNextShard(0);
+    // Threads keep the shard picked on their first count, so that they mostly write to
+    // separate cache lines.
+    thread_local const int shard =
+            sNextShard.fetch_add(1, std::memory_order_relaxed) % kNumPushedAtomStatsShards;
+    mPushedAtomStats[shard].counts[atomId].fetch_add(count, std::memory_order_relaxed);
+}
+
+int StatsdStats::getPushedAtomCount(int atomId) const {
+    int count = 0;
+    for (int shard = 0; shard < kNumPushedAtomStatsShards; shard++) {
+        count += mPushedAtomStats[shard].counts[atomId].load(std::memory_order_relaxed);
+    }
+    return count;
+}
 
+double StatsdStats::getPushedAtomRate(int atomId) const {
+    int count = 0;
+    lock_guard<std::mutex> lock(mLock);
     if (atomId >= 0 && atomId <= kMaxPushedAtomId) {
-        mPushedAtomStats[atomId]++;
+        count = getPushedAtomCount(atomId);
     } else {
-        if (atomId < 0) {
-            android_errorWriteLog(0x534e4554, "187957589");
-        }
-        if (mNonPlatformPushedAtomStats.size() < kMaxNonPlatformPushedAtoms) {
-            mNonPlatformPushedAtomStats[atomId]++;
+        const auto it = mNonPlatformPushedAtomStats.find(atomId);
+        count = it != mNonPlatformPushedAtomStats.end() ? it->second : 0;
+    }
+    const int64_t elapsedSec = std::max<int64_t>(1, getWallClockSec() - mStartTimeSec);
+    return (double)count / elapsedSec;
+}
+
+void StatsdStats::noteAtomLogged(int atomId, int32_t timeSec) {
+    if (atomId >= 0 && atomId <= kMaxPushedAtomId) {
+        addPushedAtomCount(atomId, 1);
+        return;
+    }
+
+    lock_guard<std::mutex> lock(mLock);
+    if (atomId < 0) {
+        android_errorWriteLog(0x534e4554, "187957589");
+    }
+    if (mNonPlatformPushedAtomStats.size() < kMaxNonPlatformPushedAtoms) {
+        mNonPlatformPushedAtomStats[atomId]++;
+    }
+}
+
+void StatsdStats::noteAtomsSkipped(const std::unordered_map<int, int>& skippedAtomCounts) {
+    lock_guard<std::mutex> lock(mLock);
+
+    for (const auto& [atomId, count] : skippedAtomCounts) {
+        if (atomId >= 0 && atomId <= kMaxPushedAtomId) {
+            addPushedAtomCount(atomId, count);
+        } else if (mNonPlatformPushedAtomStats.size() < kMaxNonPlatformPushedAtoms ||
+                   mNonPlatformPushedAtomStats.find(atomId) != mNonPlatformPushedAtomStats.end()) {
+            mNonPlatformPushedAtomStats[atomId] += count;
+        } else {
+            continue;
         }
+        mPushedAtomSkipStats[atomId] += count;
     }
 }
 
@@ -544,6 +887,11 @@ void StatsdStats::noteBucketUnknownCondition(int64_t metricId) {
     getAtomMetricStats(metricId).bucketUnknownCondition++;
 }
 
+void StatsdStats::noteStaleBasesEvicted(int64_t metricId, int count) {
+    lock_guard<std::mutex> lock(mLock);
+    getAtomMetricStats(metricId).staleBasesEvicted += count;
+}
+
 void StatsdStats::noteConditionChangeInNextBucket(int64_t metricId) {
     lock_guard<std::mutex> lock(mLock);
     getAtomMetricStats(metricId).conditionChangeInNextBucket++;
@@ -559,6 +907,17 @@ void StatsdStats::noteBucketCount(int64_t metricId) {
     getAtomMetricStats(metricId).bucketCount++;
 }
 
+void StatsdStats::noteMetricCost(int64_t metricId, int64_t eventCount,
+                                 int64_t eventProcessingTimeNs, int64_t dumpTimeNs,
+                                 int64_t maxByteSize) {
+    lock_guard<std::mutex> lock(mLock);
+    AtomMetricStats& metricStats = getAtomMetricStats(metricId);
+    metricStats.matchedEventCount += eventCount;
+    metricStats.eventProcessingTimeNs += eventProcessingTimeNs;
+    metricStats.dumpTimeNs += dumpTimeNs;
+    metricStats.maxByteSize = std::max(metricStats.maxByteSize, maxByteSize);
+}
+
 void StatsdStats::noteBucketBoundaryDelayNs(int64_t metricId, int64_t timeDelayNs) {
     lock_guard<std::mutex> lock(mLock);
     AtomMetricStats& metricStats = getAtomMetricStats(metricId);
@@ -600,15 +959,32 @@ void StatsdStats::resetInternalLocked() {
     // Reset the historical data, but keep the active ConfigStats
     mStartTimeSec = getWallClockSec();
     mIceBox.clear();
-    std::fill(mPushedAtomStats.begin(), mPushedAtomStats.end(), 0);
+    for (int shard = 0; shard < kNumPushedAtomStatsShards; shard++) {
+        for (std::atomic<int>& count : mPushedAtomStats[shard].counts) {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
     mNonPlatformPushedAtomStats.clear();
+    mPushedAtomSkipStats.clear();
     mAnomalyAlarmRegisteredStats = 0;
     mPeriodicAlarmRegisteredStats = 0;
     mSystemServerRestartSec.clear();
     mLogLossStats.clear();
     mOverflowCount = 0;
+    mUnattributedClientDrops = 0;
+    mOverflowBytes = 0;
+    mAppOverflowCount = 0;
     mMinQueueHistoryNs = kInt64Max;
     mMaxQueueHistoryNs = 0;
+    mEventQueueOverflowPerUid.clear();
+    mIngestionLatency = IngestionLatency();
+    mAtomIngestionLatency.clear();
+    std::fill(mSocketBatchReadHistogram.begin(), mSocketBatchReadHistogram.end(), 0);
+    mSocketKernelDropCount = 0;
+    mSocketReceiveBufferGrowCount = 0;
+    mSocketReceiveBufferBytes = 0;
+    mLogEventValuesRegrowCount = 0;
+    mEventRates.clear();
     for (auto& config : mConfigStats) {
         config.second->broadcast_sent_time_sec.clear();
         config.second->activation_time_sec.clear();
@@ -619,7 +995,10 @@ void StatsdStats::resetInternalLocked() {
         config.second->annotations.clear();
         config.second->matcher_stats.clear();
         config.second->condition_stats.clear();
+        config.second->condition_eviction_stats.clear();
+        config.second->condition_cardinality_stats.clear();
         config.second->metric_stats.clear();
+        config.second->metric_cardinality_stats.clear();
         config.second->metric_dimension_in_condition_stats.clear();
         config.second->alert_stats.clear();
     }
@@ -644,10 +1023,15 @@ void StatsdStats::resetInternalLocked() {
         pullStats.second.atomErrorCount = 0;
         pullStats.second.binderCallFailCount = 0;
         pullStats.second.pullTimeoutMetadata.clear();
+        pullStats.second.avgMergeTimeNs = 0;
+        pullStats.second.maxMergeTimeNs = 0;
+        pullStats.second.numMergeTime = 0;
+        pullStats.second.pullTimeHistogram.clear();
     }
     mAtomMetricStats.clear();
     mActivationBroadcastGuardrailStats.clear();
     mPushedAtomErrorStats.clear();
+    mPushedAtomClientDropStats.clear();
 }
 
 string buildTimeString(int64_t timeSec) {
@@ -667,6 +1051,24 @@ int StatsdStats::getPushedAtomErrors(int atomId) const {
     }
 }
 
+int StatsdStats::getPushedAtomSkips(int atomId) const {
+    const auto& it = mPushedAtomSkipStats.find(atomId);
+    if (it != mPushedAtomSkipStats.end()) {
+        return it->second;
+    } else {
+        return 0;
+    }
+}
+
+int StatsdStats::getPushedAtomClientDrops(int atomId) const {
+    const auto& it = mPushedAtomClientDropStats.find(atomId);
+    if (it != mPushedAtomClientDropStats.end()) {
+        return it->second;
+    } else {
+        return 0;
+    }
+}
+
 void StatsdStats::dumpStats(int out) const {
     lock_guard<std::mutex> lock(mLock);
     time_t t = mStartTimeSec;
@@ -756,6 +1158,21 @@ void StatsdStats::dumpStats(int out) const {
                     stats.second);
         }
 
+        for (const auto& stats : pair.second->condition_eviction_stats) {
+            dprintf(out, "condition %lld evicted %d keys\n", (long long)stats.first,
+                    stats.second);
+        }
+
+        for (const auto& stats : pair.second->condition_cardinality_stats) {
+            dprintf(out, "condition %lld max estimated cardinality %lld\n",
+                    (long long)stats.first, (long long)stats.second);
+        }
+
+        for (const auto& stats : pair.second->metric_cardinality_stats) {
+            dprintf(out, "metric %lld max estimated cardinality %lld\n", (long long)stats.first,
+                    (long long)stats.second);
+        }
+
         for (const auto& stats : pair.second->condition_stats) {
             dprintf(out, "metrics %lld max output tuple size %d\n", (long long)stats.first,
                     stats.second);
@@ -768,16 +1185,22 @@ void StatsdStats::dumpStats(int out) const {
     dprintf(out, "********Disk Usage stats***********\n");
     StorageManager::printStats(out);
     dprintf(out, "********Pushed Atom stats***********\n");
-    const size_t atomCounts = mPushedAtomStats.size();
-    for (size_t i = 2; i < atomCounts; i++) {
-        if (mPushedAtomStats[i] > 0) {
-            dprintf(out, "Atom %zu->(total count)%d, (error count)%d\n", i, mPushedAtomStats[i],
-                    getPushedAtomErrors((int)i));
+    for (int i = 2; i <= kMaxPushedAtomId; i++) {
+        const int count = getPushedAtomCount(i);
+        const int clientDrops = getPushedAtomClientDrops(i);
+        if (count > 0 || clientDrops > 0) {
+            dprintf(out,
+                    "Atom %d->(total count)%d, (error count)%d, (skip count)%d, "
+                    "(client drop count)%d\n",
+                    i, count, getPushedAtomErrors(i), getPushedAtomSkips(i), clientDrops);
         }
     }
     for (const auto& pair : mNonPlatformPushedAtomStats) {
-        dprintf(out, "Atom %d->(total count)%d, (error count)%d\n", pair.first, pair.second,
-                getPushedAtomErrors(pair.first));
+        dprintf(out,
+                "Atom %d->(total count)%d, (error count)%d, (skip count)%d, "
+                "(client drop count)%d\n",
+                pair.first, pair.second, getPushedAtomErrors(pair.first),
+                getPushedAtomSkips(pair.first), getPushedAtomClientDrops(pair.first));
     }
 
     dprintf(out, "********Pulled Atom stats***********\n");
@@ -791,7 +1214,9 @@ void StatsdStats::dumpStats(int out) const {
                 "  (pull timeout)%ld, (pull exceed max delay)%ld"
                 "  (no uid provider count)%ld, (no puller found count)%ld\n"
                 "  (registered count) %ld, (unregistered count) %ld"
-                "  (atom error count) %d\n",
+                "  (atom error count) %d\n"
+                "  (average merge time nanos)%lld, (max merge time nanos)%lld\n"
+                "  (p50 pull time nanos)%lld, (p99 pull time nanos)%lld\n",
                 (int)pair.first, (long)pair.second.totalPull, (long)pair.second.totalPullFromCache,
                 (long)pair.second.pullFailed, (long)pair.second.minPullIntervalSec,
                 (long long)pair.second.avgPullTimeNs, (long long)pair.second.maxPullTimeNs,
@@ -799,7 +1224,10 @@ void StatsdStats::dumpStats(int out) const {
                 pair.second.dataError, pair.second.pullTimeout, pair.second.pullExceedMaxDelay,
                 pair.second.pullUidProviderNotFound, pair.second.pullerNotFound,
                 pair.second.registeredCount, pair.second.unregisteredCount,
-                pair.second.atomErrorCount);
+                pair.second.atomErrorCount, (long long)pair.second.avgMergeTimeNs,
+                (long long)pair.second.maxMergeTimeNs,
+                (long long)getLatencyHistogramPercentileNs(pair.second.pullTimeHistogram, 50),
+                (long long)getLatencyHistogramPercentileNs(pair.second.pullTimeHistogram, 99));
         if (pair.second.pullTimeoutMetadata.size() > 0) {
             string uptimeMillis = "(pull timeout system uptime millis) ";
             string pullTimeoutMillis = "(pull timeout elapsed time millis) ";
@@ -816,6 +1244,22 @@ void StatsdStats::dumpStats(int out) const {
         }
     }
 
+    bool hasMetricCost = false;
+    for (const auto& [metricId, metricStats] : mAtomMetricStats) {
+        if (metricStats.matchedEventCount == 0 && metricStats.dumpTimeNs == 0) {
+            continue;
+        }
+        if (!hasMetricCost) {
+            dprintf(out, "********Metric cost stats***********\n");
+            hasMetricCost = true;
+        }
+        dprintf(out,
+                "Metric %lld: %lld events, processing %lld ns, dumps %lld ns, max %lld bytes\n",
+                (long long)metricId, (long long)metricStats.matchedEventCount,
+                (long long)metricStats.eventProcessingTimeNs, (long long)metricStats.dumpTimeNs,
+                (long long)metricStats.maxByteSize);
+    }
+
     if (mAnomalyAlarmRegisteredStats > 0) {
         dprintf(out, "********AnomalyAlarmStats stats***********\n");
         dprintf(out, "Anomaly alarm registrations: %d\n", mAnomalyAlarmRegisteredStats);
@@ -842,9 +1286,47 @@ void StatsdStats::dumpStats(int out) const {
                 (long long)loss.mWallClockSec, loss.mCount, loss.mLastError, loss.mLastTag,
                 loss.mUid, loss.mPid);
     }
-
-    dprintf(out, "Event queue overflow: %d; MaxHistoryNs: %lld; MinHistoryNs: %lld\n",
-            mOverflowCount, (long long)mMaxQueueHistoryNs, (long long)mMinQueueHistoryNs);
+    dprintf(out, "Client drops of unknown atoms: %lld\n", (long long)mUnattributedClientDrops);
+
+    dprintf(out,
+            "Event queue overflow: %d (%lld bytes, %d of apps); MaxHistoryNs: %lld; "
+            "MinHistoryNs: %lld\n",
+            mOverflowCount, (long long)mOverflowBytes, mAppOverflowCount,
+            (long long)mMaxQueueHistoryNs, (long long)mMinQueueHistoryNs);
+    for (const auto& pair : mEventQueueOverflowPerUid) {
+        dprintf(out, "Event queue overflow for uid %d: %lld\n", pair.first,
+                (long long)pair.second);
+    }
+
+    dprintf(out, "Socket batch read size histogram:");
+    for (const int64_t count : mSocketBatchReadHistogram) {
+        dprintf(out, " %lld", (long long)count);
+    }
+    dprintf(out, "\n");
+    dprintf(out, "Socket kernel drops: %lld; receive buffer grown %d times, to %lld bytes\n",
+            (long long)mSocketKernelDropCount, mSocketReceiveBufferGrowCount,
+            (long long)mSocketReceiveBufferBytes);
+    dprintf(out, "Log events with regrown values: %lld\n", (long long)mLogEventValuesRegrowCount);
+
+    if (mIngestionLatency.count > 0) {
+        dprintf(out, "********Ingestion latency stats***********\n");
+        auto printHistogram = [out](const char* name, const vector<int64_t>& histogram) {
+            dprintf(out, "  %s:", name);
+            for (const int64_t count : histogram) {
+                dprintf(out, " %lld", (long long)count);
+            }
+            dprintf(out, "\n");
+        };
+        dprintf(out, "All atoms, %lld events\n", (long long)mIngestionLatency.count);
+        printHistogram("Queue wait", mIngestionLatency.queueWait);
+        printHistogram("Processing", mIngestionLatency.processing);
+        for (const int atomId : getLatencyReportedAtomsLocked()) {
+            const IngestionLatency& latency = mAtomIngestionLatency.at(atomId);
+            dprintf(out, "Atom %d, %lld events\n", atomId, (long long)latency.count);
+            printHistogram("Queue wait", latency.queueWait);
+            printHistogram("Processing", latency.processing);
+        }
+    }
 
     if (mActivationBroadcastGuardrailStats.size() > 0) {
         dprintf(out, "********mActivationBroadcastGuardrail stats***********\n");
@@ -933,19 +1415,59 @@ void addConfigStatsToProto(const ConfigStats& configStats, ProtoOutputStream* pr
         proto->end(tmpToken);
     }
 
+    // Conditions that evicted keys or have a cardinality estimate without going past
+    // kDimensionKeySizeSoftLimit have no tuple count.
+    std::set<int64_t> conditionIds;
     for (const auto& pair : configStats.condition_stats) {
+        conditionIds.insert(pair.first);
+    }
+    for (const auto& pair : configStats.condition_eviction_stats) {
+        conditionIds.insert(pair.first);
+    }
+    for (const auto& pair : configStats.condition_cardinality_stats) {
+        conditionIds.insert(pair.first);
+    }
+    for (const int64_t id : conditionIds) {
         uint64_t tmpToken = proto->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED |
                                           FIELD_ID_CONFIG_STATS_CONDITION_STATS);
-        proto->write(FIELD_TYPE_INT64 | FIELD_ID_CONDITION_STATS_ID, (long long)pair.first);
-        proto->write(FIELD_TYPE_INT32 | FIELD_ID_CONDITION_STATS_COUNT, pair.second);
+        proto->write(FIELD_TYPE_INT64 | FIELD_ID_CONDITION_STATS_ID, (long long)id);
+        const auto sizeIt = configStats.condition_stats.find(id);
+        if (sizeIt != configStats.condition_stats.end()) {
+            proto->write(FIELD_TYPE_INT32 | FIELD_ID_CONDITION_STATS_COUNT, sizeIt->second);
+        }
+        const auto evictionIt = configStats.condition_eviction_stats.find(id);
+        if (evictionIt != configStats.condition_eviction_stats.end()) {
+            proto->write(FIELD_TYPE_INT32 | FIELD_ID_CONDITION_STATS_EVICTED_KEY_COUNT,
+                         evictionIt->second);
+        }
+        const auto cardinalityIt = configStats.condition_cardinality_stats.find(id);
+        if (cardinalityIt != configStats.condition_cardinality_stats.end()) {
+            proto->write(FIELD_TYPE_INT64 | FIELD_ID_CONDITION_STATS_ESTIMATED_CARDINALITY,
+                         (long long)cardinalityIt->second);
+        }
         proto->end(tmpToken);
     }
 
+    std::set<int64_t> metricIds;
     for (const auto& pair : configStats.metric_stats) {
+        metricIds.insert(pair.first);
+    }
+    for (const auto& pair : configStats.metric_cardinality_stats) {
+        metricIds.insert(pair.first);
+    }
+    for (const int64_t id : metricIds) {
         uint64_t tmpToken = proto->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED |
                                           FIELD_ID_CONFIG_STATS_METRIC_STATS);
-        proto->write(FIELD_TYPE_INT64 | FIELD_ID_METRIC_STATS_ID, (long long)pair.first);
-        proto->write(FIELD_TYPE_INT32 | FIELD_ID_METRIC_STATS_COUNT, pair.second);
+        proto->write(FIELD_TYPE_INT64 | FIELD_ID_METRIC_STATS_ID, (long long)id);
+        const auto sizeIt = configStats.metric_stats.find(id);
+        if (sizeIt != configStats.metric_stats.end()) {
+            proto->write(FIELD_TYPE_INT32 | FIELD_ID_METRIC_STATS_COUNT, sizeIt->second);
+        }
+        const auto cardinalityIt = configStats.metric_cardinality_stats.find(id);
+        if (cardinalityIt != configStats.metric_cardinality_stats.end()) {
+            proto->write(FIELD_TYPE_INT64 | FIELD_ID_METRIC_STATS_ESTIMATED_CARDINALITY,
+                         (long long)cardinalityIt->second);
+        }
         proto->end(tmpToken);
     }
     for (const auto& pair : configStats.metric_dimension_in_condition_stats) {
@@ -982,17 +1504,25 @@ void StatsdStats::dumpStats(std::vector<uint8_t>* output, bool reset) {
         addConfigStatsToProto(*(pair.second), &proto);
     }
 
-    const size_t atomCounts = mPushedAtomStats.size();
-    for (size_t i = 2; i < atomCounts; i++) {
-        if (mPushedAtomStats[i] > 0) {
+    for (int i = 2; i <= kMaxPushedAtomId; i++) {
+        const int count = getPushedAtomCount(i);
+        const int clientDrops = getPushedAtomClientDrops(i);
+        if (count > 0 || clientDrops > 0) {
             uint64_t token =
                     proto.start(FIELD_TYPE_MESSAGE | FIELD_ID_ATOM_STATS | FIELD_COUNT_REPEATED);
             proto.write(FIELD_TYPE_INT32 | FIELD_ID_ATOM_STATS_TAG, (int32_t)i);
-            proto.write(FIELD_TYPE_INT32 | FIELD_ID_ATOM_STATS_COUNT, mPushedAtomStats[i]);
+            proto.write(FIELD_TYPE_INT32 | FIELD_ID_ATOM_STATS_COUNT, count);
             int errors = getPushedAtomErrors(i);
             if (errors > 0) {
                 proto.write(FIELD_TYPE_INT32 | FIELD_ID_ATOM_STATS_ERROR_COUNT, errors);
             }
+            int skips = getPushedAtomSkips(i);
+            if (skips > 0) {
+                proto.write(FIELD_TYPE_INT32 | FIELD_ID_ATOM_STATS_SKIP_COUNT, skips);
+            }
+            if (clientDrops > 0) {
+                proto.write(FIELD_TYPE_INT32 | FIELD_ID_ATOM_STATS_CLIENT_DROP_COUNT, clientDrops);
+            }
             proto.end(token);
         }
     }
@@ -1006,6 +1536,14 @@ void StatsdStats::dumpStats(std::vector<uint8_t>* output, bool reset) {
         if (errors > 0) {
             proto.write(FIELD_TYPE_INT32 | FIELD_ID_ATOM_STATS_ERROR_COUNT, errors);
         }
+        int skips = getPushedAtomSkips(pair.first);
+        if (skips > 0) {
+            proto.write(FIELD_TYPE_INT32 | FIELD_ID_ATOM_STATS_SKIP_COUNT, skips);
+        }
+        int clientDrops = getPushedAtomClientDrops(pair.first);
+        if (clientDrops > 0) {
+            proto.write(FIELD_TYPE_INT32 | FIELD_ID_ATOM_STATS_CLIENT_DROP_COUNT, clientDrops);
+        }
         proto.end(token);
     }
 
@@ -1049,6 +1587,10 @@ void StatsdStats::dumpStats(std::vector<uint8_t>* output, bool reset) {
         proto.write(FIELD_TYPE_INT32 | FIELD_ID_LOG_LOSS_STATS_PID, error.mPid);
         proto.end(token);
     }
+    if (mUnattributedClientDrops > 0) {
+        proto.write(FIELD_TYPE_INT64 | FIELD_ID_UNATTRIBUTED_CLIENT_DROP_COUNT,
+                    (long long)mUnattributedClientDrops);
+    }
 
     if (mOverflowCount > 0) {
         uint64_t token = proto.start(FIELD_TYPE_MESSAGE | FIELD_ID_OVERFLOW);
@@ -1057,9 +1599,80 @@ void StatsdStats::dumpStats(std::vector<uint8_t>* output, bool reset) {
                     (long long)mMaxQueueHistoryNs);
         proto.write(FIELD_TYPE_INT64 | FIELD_ID_OVERFLOW_MIN_HISTORY,
                     (long long)mMinQueueHistoryNs);
+        proto.write(FIELD_TYPE_INT64 | FIELD_ID_OVERFLOW_DROPPED_BYTES, (long long)mOverflowBytes);
+        if (mAppOverflowCount > 0) {
+            proto.write(FIELD_TYPE_INT32 | FIELD_ID_OVERFLOW_APP_COUNT, mAppOverflowCount);
+        }
+        for (const auto& pair : mEventQueueOverflowPerUid) {
+            uint64_t uidToken = proto.start(FIELD_TYPE_MESSAGE | FIELD_ID_OVERFLOW_UID_DROPS |
+                                            FIELD_COUNT_REPEATED);
+            proto.write(FIELD_TYPE_INT32 | FIELD_ID_OVERFLOW_UID_DROPS_UID, pair.first);
+            proto.write(FIELD_TYPE_INT64 | FIELD_ID_OVERFLOW_UID_DROPS_COUNT,
+                        (long long)pair.second);
+            proto.end(uidToken);
+        }
         proto.end(token);
     }
 
+    bool hasSocketReadStats = mSocketKernelDropCount > 0 || mSocketReceiveBufferGrowCount > 0;
+    for (const int64_t count : mSocketBatchReadHistogram) {
+        if (count > 0) {
+            hasSocketReadStats = true;
+            break;
+        }
+    }
+    if (hasSocketReadStats) {
+        uint64_t token = proto.start(FIELD_TYPE_MESSAGE | FIELD_ID_SOCKET_READ_STATS);
+        for (const int64_t count : mSocketBatchReadHistogram) {
+            proto.write(FIELD_TYPE_INT64 | FIELD_ID_SOCKET_READ_STATS_BATCHED_READ_SIZE |
+                                FIELD_COUNT_REPEATED,
+                        (long long)count);
+        }
+        if (mSocketKernelDropCount > 0) {
+            proto.write(FIELD_TYPE_INT64 | FIELD_ID_SOCKET_READ_STATS_KERNEL_DROP_COUNT,
+                        (long long)mSocketKernelDropCount);
+        }
+        if (mSocketReceiveBufferGrowCount > 0) {
+            proto.write(FIELD_TYPE_INT32 | FIELD_ID_SOCKET_READ_STATS_RECEIVE_BUFFER_GROW_COUNT,
+                        mSocketReceiveBufferGrowCount);
+            proto.write(FIELD_TYPE_INT64 | FIELD_ID_SOCKET_READ_STATS_RECEIVE_BUFFER_BYTES,
+                        (long long)mSocketReceiveBufferBytes);
+        }
+        proto.end(token);
+    }
+
+    if (mIngestionLatency.count > 0) {
+        auto writeHistogram = [&proto](int32_t fieldId, const vector<int64_t>& histogram) {
+            for (const int64_t count : histogram) {
+                proto.write(FIELD_TYPE_INT64 | fieldId | FIELD_COUNT_REPEATED, (long long)count);
+            }
+        };
+        uint64_t token = proto.start(FIELD_TYPE_MESSAGE | FIELD_ID_INGESTION_LATENCY_STATS);
+        writeHistogram(FIELD_ID_INGESTION_LATENCY_QUEUE_WAIT, mIngestionLatency.queueWait);
+        writeHistogram(FIELD_ID_INGESTION_LATENCY_PROCESSING, mIngestionLatency.processing);
+        for (const int atomId : getLatencyReportedAtomsLocked()) {
+            const IngestionLatency& latency = mAtomIngestionLatency.at(atomId);
+            uint64_t atomToken = proto.start(FIELD_TYPE_MESSAGE | FIELD_ID_INGESTION_LATENCY_ATOM |
+                                             FIELD_COUNT_REPEATED);
+            proto.write(FIELD_TYPE_INT32 | FIELD_ID_ATOM_INGESTION_LATENCY_ATOM_ID, atomId);
+            writeHistogram(FIELD_ID_ATOM_INGESTION_LATENCY_QUEUE_WAIT, latency.queueWait);
+            writeHistogram(FIELD_ID_ATOM_INGESTION_LATENCY_PROCESSING, latency.processing);
+            proto.end(atomToken);
+        }
+        proto.end(token);
+    }
+
+    if (mLogEventValuesRegrowCount > 0) {
+        uint64_t token = proto.start(FIELD_TYPE_MESSAGE | FIELD_ID_LOG_EVENT_PARSE_STATS);
+        proto.write(FIELD_TYPE_INT64 | FIELD_ID_LOG_EVENT_PARSE_STATS_VALUES_REGROW_COUNT,
+                    (long long)mLogEventValuesRegrowCount);
+        proto.end(token);
+    }
+
+    uint64_t eventRateToken = proto.start(FIELD_TYPE_MESSAGE | FIELD_ID_EVENT_RATE_STATS);
+    mEventRates.writeToProto(&proto);
+    proto.end(eventRateToken);
+
     for (const auto& restart : mSystemServerRestartSec) {
         proto.write(FIELD_TYPE_INT32 | FIELD_ID_SYSTEM_SERVER_RESTART | FIELD_COUNT_REPEATED,
                     restart);
@@ -16,10 +16,14 @@
 #pragma once
 
 #include "config/ConfigKey.h"
+#include "guardrail/EventRateTimeSeries.h"
 
 #include <gtest/gtest_prod.h>
 #include <log/log_time.h>
+#include <atomic>
 #include <list>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
@@ -62,11 +66,24 @@ struct ConfigStats {
     // it means some data has been dropped. The map size is capped by kMaxConfigCount.
     std::map<const int64_t, int> condition_stats;
 
+    // Stores how many dimension keys of a condition with a bounded sliced state were evicted to
+    // make room for new ones. The map size is capped by kMaxConfigCount.
+    std::map<const int64_t, int> condition_eviction_stats;
+
+    // Stores the max estimated number of distinct dimension keys of condition trackers, with
+    // StatsdConfig.estimate_dimension_cardinality. The map size is capped by kMaxConfigCount.
+    std::map<const int64_t, int64_t> condition_cardinality_stats;
+
     // Stores the number of output tuple of metric producers when it's bigger than
     // kDimensionKeySizeSoftLimit. When you see the number is kDimensionKeySizeHardLimit +1,
     // it means some data has been dropped. The map size is capped by kMaxConfigCount.
     std::map<const int64_t, int> metric_stats;
 
+    // Stores the max estimated number of distinct dimension keys of metric producers, with
+    // StatsdConfig.estimate_dimension_cardinality. Unlike metric_stats, it also counts the keys
+    // dropped by the guardrail. The map size is capped by kMaxConfigCount.
+    std::map<const int64_t, int64_t> metric_cardinality_stats;
+
     // Stores the max number of output tuple of dimensions in condition across dimensions in what
     // when it's bigger than kDimensionKeySizeSoftLimit. When you see the number is
     // kDimensionKeySizeHardLimit +1, it means some data has been dropped. The map size is capped by
@@ -128,6 +145,14 @@ public:
     // data subscriber that it's time to call getData.
     static const size_t kBytesPerConfigTriggerGetData = 192 * 1024;
 
+    // Memory limit for the metrics of all configurations. Once this limit is exceeded, the past
+    // buckets of the largest configurations are written to disk until the total is under it.
+    static const size_t kMaxMetricsBytesTotal = 4 * 1024 * 1024;
+
+    // Lower limit for the metrics of all configurations that applies for
+    // kMemoryPressurePeriodNs after the system reports memory pressure.
+    static const size_t kMaxMetricsBytesTotalUnderMemoryPressure = 512 * 1024;
+
     // Cap the UID map's memory usage to this. This should be fairly high since the UID information
     // is critical for understanding the metrics.
     const static size_t kMaxBytesUsedUidMap = 50 * 1024;
@@ -141,6 +166,16 @@ public:
     /* Min period between two checks of byte size per config key in nanoseconds. */
     static const int64_t kMinByteSizeCheckPeriodNs = 60 * NS_PER_SEC;
 
+    /* Min period between two writes of the past buckets of a config key to disk. */
+    static const int64_t kMinMetricsSpillPeriodNs = 10 * NS_PER_SEC;
+
+    /* Period after a memory pressure signal during which the lower memory limit applies. */
+    static const int64_t kMemoryPressurePeriodNs = 10 * 60 * NS_PER_SEC;
+
+    /* Maximum period between two uid map snapshots of a config with uid map deltas, so that a
+     * lost report only affects the reports until the next snapshot. */
+    static const int64_t kMaxUidMapSnapshotPeriodNs = 24 * 60 * 60 * NS_PER_SEC;
+
     /* Minimum period between two activation broadcasts in nanoseconds. */
     static const int64_t kMinActivationBroadcastPeriodNs = 10 * NS_PER_SEC;
 
@@ -156,6 +191,9 @@ public:
     // Maximum size of all files that can be written to stats directory on disk.
     static const int kMaxFileSize = 50 * 1024 * 1024;
 
+    // Size over which a checkpoint log of a config is left for a new one.
+    static const size_t kMaxCheckpointLogBytes = 256 * 1024;
+
     // How long to try to clear puller cache from last time
     static const long kPullerCacheClearIntervalSec = 1;
 
@@ -165,6 +203,9 @@ public:
     // Maximum number of pushed atoms statsd stats will track above kMaxPushedAtomId.
     static const int kMaxNonPlatformPushedAtoms = 600;
 
+    // Maximum number of uids whose event queue overflow drops are tracked.
+    static const size_t kMaxEventQueueOverflowUids = 100;
+
     // Maximum atom id value that we consider a platform pushed atom.
     // This should be updated once highest pushed atom id in atoms.proto approaches this value.
     static const int kMaxPushedAtomId = 750;
@@ -191,6 +232,21 @@ public:
 
     static const int32_t kMaxLoggedBucketDropEvents = 10;
 
+    // Number of bins in the histogram of datagrams read per socket wakeup. Batch sizes of
+    // [0, 10) have a bin each, [10, 100) are grouped by 10, and the last bin is for >= 100.
+    static const int kNumBinsInSocketBatchReadHistogram = 20;
+
+    // Number of powers of two from 1us covered by the ingestion latency histograms. Each power
+    // of two is split into 2 bins, plus a bin below 1us and an overflow bin.
+    static const int kNumOctavesInLatencyHistogram = 23;
+    static const int kNumBinsInLatencyHistogram = 2 * kNumOctavesInLatencyHistogram + 2;
+
+    // Maximum number of atoms with their own ingestion latency histograms.
+    static const size_t kMaxLatencyTrackedAtoms = 50;
+
+    // Number of most logged atoms whose ingestion latency histograms are reported.
+    static const size_t kMaxLatencyReportedAtoms = 10;
+
     /**
      * Report a new config has been received and report the static stats about the config.
      *
@@ -246,6 +302,24 @@ public:
      */
     void noteConditionDimensionSize(const ConfigKey& key, const int64_t& id, int size);
 
+    /**
+     * Report that a condition with a bounded sliced state evicted a dimension key.
+     *
+     * [key]: The config key that this condition belongs to.
+     * [id]: The id of the condition.
+     */
+    void noteConditionDimensionKeyEvicted(const ConfigKey& key, const int64_t& id);
+
+    /**
+     * Report the estimated number of distinct dimension keys of a condition.
+     *
+     * [key]: The config key that this condition belongs to.
+     * [id]: The id of the condition.
+     * [estimate]: The estimated number of distinct keys.
+     */
+    void noteConditionDimensionCardinality(const ConfigKey& key, const int64_t& id,
+                                           int64_t estimate);
+
     /**
      * Report the size of output tuple of a metric.
      *
@@ -258,6 +332,16 @@ public:
      */
     void noteMetricDimensionSize(const ConfigKey& key, const int64_t& id, int size);
 
+    /**
+     * Report the estimated number of distinct dimension keys of a metric.
+     *
+     * [key]: The config key that this metric belongs to.
+     * [id]: The id of the metric.
+     * [estimate]: The estimated number of distinct keys.
+     */
+    void noteMetricDimensionCardinality(const ConfigKey& key, const int64_t& id,
+                                        int64_t estimate);
+
     /**
      * Report the max size of output tuple of dimension in condition across dimensions in what.
      *
@@ -291,6 +375,14 @@ public:
      */
     void noteAtomLogged(int atomId, int32_t timeSec);
 
+    /**
+     * Report pushed atom events that were logged but dropped before being parsed, because no
+     * consumer uses the atom.
+     *
+     * [skippedAtomCounts]: number of events skipped, by atom id.
+     */
+    void noteAtomsSkipped(const std::unordered_map<int, int>& skippedAtomCounts);
+
     /**
      * Report that statsd modified the anomaly alarm registered with StatsCompanionService.
      */
@@ -343,6 +435,19 @@ public:
      */
     void notePullTime(int pullAtomId, int64_t pullTimeNs);
 
+    /*
+     * Records the time spent merging the isolated uids of a pull into their host uids.
+     */
+    void noteIsolatedUidMergeTime(int pullAtomId, int64_t mergeTimeNs);
+
+    /*
+     * Returns the latency below which [percentile]% of the latencies of [histogram] fall, as the
+     * upper bound of their bin, or 0 if the histogram is empty. The bins are described by
+     * kNumBinsInLatencyHistogram.
+     */
+    static int64_t getLatencyHistogramPercentileNs(const std::vector<int64_t>& histogram,
+                                                   int percentile);
+
     /*
      * Records pull delay for a pulled atom, including those served from cache and including statsd
      * processing delays.
@@ -365,7 +470,10 @@ public:
     void noteSystemServerRestart(int32_t timeSec);
 
     /**
-     * Records statsd skipped an event.
+     * Records that a client failed to write [count] events to the socket, all of them of
+     * [lastAtomTag], or of unknown atoms if [lastAtomTag] is 0. The clients report the drops of
+     * each of the atoms they lose most, and the others together. The reports of a client within
+     * the same second are recorded as one loss.
      */
     void noteLogLost(int32_t wallClockTimeSec, int32_t count, int32_t lastError,
                      int32_t lastAtomTag, int32_t uid, int32_t pid);
@@ -459,10 +567,111 @@ public:
      */
     void noteBucketUnknownCondition(int64_t metricId);
 
+    /**
+     * Reports that a pulled value metric evicted [count] diff bases of dimensions missing from its
+     * last pulls.
+     */
+    void noteStaleBasesEvicted(int64_t metricId, int count);
+
+    /**
+     * Adds the cost measured by a metric since its last report: [eventCount] matched events that
+     * took about [eventProcessingTimeNs], [dumpTimeNs] spent in dumps, and its largest byte size.
+     */
+    void noteMetricCost(int64_t metricId, int64_t eventCount, int64_t eventProcessingTimeNs,
+                        int64_t dumpTimeNs, int64_t maxByteSize);
+
+    /**
+     * Returns the average rate at which a pushed atom was logged since the stats were last reset,
+     * in events per second. The counts are reset with the stats, so the rates only cover the time
+     * since then, and are noisy shortly after a reset.
+     */
+    double getPushedAtomRate(int atomId) const;
+
     /* Reports one event has been dropped due to queue overflow, and the oldest event timestamp in
      * the queue */
     void noteEventQueueOverflow(int64_t oldestEventTimestampNs);
 
+    /* Reports [count] events, of [droppedBytes] encoded bytes in total, have been dropped due to
+     * queue overflow in a single push, and the oldest event timestamp in the queue. [appCount]
+     * of them are events of app uids. */
+    void noteEventQueueOverflow(int64_t oldestEventTimestampNs, int32_t count,
+                                int64_t droppedBytes = 0, int32_t appCount = 0);
+
+    /* Reports that an event of [uid] has been dropped due to queue overflow. */
+    void noteEventQueueOverflowForUid(int32_t uid);
+
+    /* Reports that one event of each uid in [droppedUids] has been dropped due to queue
+     * overflow. */
+    void noteEventQueueOverflowForUids(const std::vector<int32_t>& droppedUids);
+
+    /**
+     * Reports the number of datagrams read from the socket in one batched read.
+     */
+    void noteSocketBatchRead(size_t batchSize);
+
+    /**
+     * Reports [count] events read from the socket at [timestampNs], elapsed realtime, after which
+     * [queueSize] events were queued. Feeds the event rate time series.
+     */
+    void noteEventsQueued(int64_t timestampNs, int32_t count, int32_t queueSize);
+
+    /**
+     * Reports that the kernel dropped [count] datagrams sent to the statsd socket.
+     */
+    void noteSocketKernelDrops(int64_t count);
+
+    /**
+     * Reports that the socket receive buffer was grown to [sizeBytes].
+     */
+    void noteSocketReceiveBufferGrown(int64_t sizeBytes);
+
+    /**
+     * Reports that the values of [count] parsed events were reallocated during parsing.
+     */
+    void noteLogEventValuesRegrown(int64_t count);
+
+    struct IngestionLatency {
+        int64_t count = 0;
+        // The bins are described by kNumBinsInLatencyHistogram.
+        std::vector<int64_t> queueWait = std::vector<int64_t>(kNumBinsInLatencyHistogram);
+        std::vector<int64_t> processing = std::vector<int64_t>(kNumBinsInLatencyHistogram);
+    };
+
+    /**
+     * Ingestion latencies collected without mLock by the thread processing the pushed atoms, and
+     * reported together by noteLogEventLatencies().
+     */
+    class LogEventLatencies {
+    public:
+        // Adds the latencies of a pushed atom, see noteLogEventLatency().
+        void add(int atomId, int64_t queueWaitNs, int64_t processingNs);
+
+        inline int64_t count() const {
+            return mTotal.count;
+        }
+
+    private:
+        friend class StatsdStats;
+
+        IngestionLatency mTotal;
+
+        // Kept across the reports up to kMaxLatencyTrackedAtoms atoms, so that the entries of
+        // the logged atoms are not allocated for every batch.
+        std::unordered_map<int, IngestionLatency> mAtoms;
+    };
+
+    /**
+     * Reports the ingestion latency of a pushed atom: how long it waited in the event queue after
+     * the socket read, and how long it took from the dequeue until it was processed.
+     */
+    void noteLogEventLatency(int atomId, int64_t queueWaitNs, int64_t processingNs);
+
+    /**
+     * Reports the ingestion latencies of [latencies] and clears it. Takes mLock once for all of
+     * them.
+     */
+    void noteLogEventLatencies(LogEventLatencies* latencies);
+
     /**
      * Reports that the activation broadcast guardrail was hit for this uid. Namely, the broadcast
      * should have been sent, but instead was skipped due to hitting the guardrail.
@@ -533,6 +742,12 @@ public:
         int32_t atomErrorCount = 0;
         long binderCallFailCount = 0;
         std::list<PullTimeoutMetadata> pullTimeoutMetadata;
+        int64_t avgMergeTimeNs = 0;
+        int64_t maxMergeTimeNs = 0;
+        long numMergeTime = 0;
+        // Histogram of the pull times, empty until the first. The bins are described by
+        // kNumBinsInLatencyHistogram.
+        std::vector<int64_t> pullTimeHistogram;
     } PulledAtomStats;
 
     typedef struct {
@@ -547,6 +762,11 @@ public:
         int64_t maxBucketBoundaryDelayNs = 0;
         long bucketUnknownCondition = 0;
         long bucketCount = 0;
+        int64_t matchedEventCount = 0;
+        int64_t eventProcessingTimeNs = 0;
+        int64_t dumpTimeNs = 0;
+        int64_t maxByteSize = 0;
+        long staleBasesEvicted = 0;
     } AtomMetricStats;
 
 private:
@@ -567,11 +787,21 @@ private:
     // The size of the vector is capped by kMaxIceBoxSize.
     std::list<const std::shared_ptr<ConfigStats>> mIceBox;
 
+    // Number of shards of mPushedAtomStats.
+    static const int kNumPushedAtomStatsShards = 4;
+
+    // The counts of one shard, on their own cache lines.
+    struct alignas(64) PushedAtomCounts {
+        std::atomic<int> counts[kMaxPushedAtomId + 1];
+    };
+
     // Stores the number of times a pushed atom is logged.
-    // The size of the vector is the largest pushed atom id in atoms.proto + 1. Atoms
+    // Each shard is indexed by the atom ids up to kMaxPushedAtomId. Atoms
     // out of that range will be put in mNonPlatformPushedAtomStats.
-    // This is a vector, not a map because it will be accessed A LOT -- for each stats log.
-    std::vector<int> mPushedAtomStats;
+    // This is an array, not a map because it will be accessed A LOT -- for each stats log. The
+    // counts are atomic and sharded by thread so that they are updated without mLock, and the
+    // shards are only summed when the stats are read, see getPushedAtomCount().
+    std::unique_ptr<PushedAtomCounts[]> mPushedAtomStats;
 
     // Stores the number of times a pushed atom is logged for atom ids above kMaxPushedAtomId.
     // The max size of the map is kMaxNonPlatformPushedAtoms.
@@ -586,6 +816,18 @@ private:
     std::map<int, int> mPushedAtomErrorStats;
     int kMaxPushedAtomErrorStatsSize = 100;
 
+    // Stores the number of times a pushed atom was skipped by the socket listener. Only atoms
+    // tracked in mPushedAtomStats or mNonPlatformPushedAtomStats are included.
+    std::unordered_map<int, int> mPushedAtomSkipStats;
+
+    // Stores the number of events of a pushed atom that the clients reported as dropped, see
+    // noteLogLost(). The max size of this map is kMaxPushedAtomErrorStatsSize.
+    std::map<int, int> mPushedAtomClientDropStats;
+
+    // The number of events that the clients reported as dropped without their atom, and those of
+    // the atoms over the size limit of mPushedAtomClientDropStats.
+    int64_t mUnattributedClientDrops = 0;
+
     // Maps metric ID to its stats. The size is capped by the number of metrics.
     std::map<int64_t, AtomMetricStats> mAtomMetricStats;
 
@@ -623,6 +865,39 @@ private:
     // Total number of events that are lost due to queue overflow.
     int32_t mOverflowCount = 0;
 
+    // Total encoded size of the events that are lost due to queue overflow.
+    int64_t mOverflowBytes = 0;
+
+    // Number of the events lost due to queue overflow that are events of app uids.
+    int32_t mAppOverflowCount = 0;
+
+    // Number of events dropped due to queue overflow, per uid of the dropped event.
+    // The max size of the map is kMaxEventQueueOverflowUids.
+    std::map<int32_t, int64_t> mEventQueueOverflowPerUid;
+
+    // Histogram of the number of datagrams read from the socket per batched read.
+    // The bins are described by kNumBinsInSocketBatchReadHistogram.
+    std::vector<int64_t> mSocketBatchReadHistogram;
+
+    // Number of datagrams dropped by the kernel on the statsd socket.
+    int64_t mSocketKernelDropCount = 0;
+
+    // Number of times the socket receive buffer was grown, and its last size in bytes.
+    int32_t mSocketReceiveBufferGrowCount = 0;
+    int64_t mSocketReceiveBufferBytes = 0;
+
+    // Number of parsed events whose values were reallocated during parsing.
+    int64_t mLogEventValuesRegrowCount = 0;
+
+    // Events read and queue size per second and per minute, see noteEventsQueued().
+    EventRateTimeSeries mEventRates;
+
+    // Ingestion latency of all pushed atoms.
+    IngestionLatency mIngestionLatency;
+
+    // Ingestion latency per atom id. The max size of the map is kMaxLatencyTrackedAtoms.
+    std::unordered_map<int, IngestionLatency> mAtomIngestionLatency;
+
     // Timestamps when we detect log loss, and the number of logs lost.
     std::list<LogLossStats> mLogLossStats;
 
@@ -641,6 +916,22 @@ private:
 
     void resetInternalLocked();
 
+    void noteEventQueueOverflowForUidLocked(int32_t uid);
+
+    // Adds [count] to the shard of the calling thread for a pushed atom id up to
+    // kMaxPushedAtomId. Does not need mLock.
+    void addPushedAtomCount(int atomId, int count);
+
+    // Sums the shards of the count of a pushed atom id up to kMaxPushedAtomId.
+    int getPushedAtomCount(int atomId) const;
+
+    // Returns the ingestion latency histogram bin of a latency.
+    static size_t getLatencyHistogramBin(int64_t latencyNs);
+
+    // Returns the ids of the most logged atoms with ingestion latency histograms, most logged
+    // first, at most kMaxLatencyReportedAtoms.
+    std::vector<int> getLatencyReportedAtomsLocked() const;
+
     void noteDataDropped(const ConfigKey& key, const size_t totalBytes, int32_t timeSec);
 
     void noteMetricsReportSent(const ConfigKey& key, const size_t num_bytes, int32_t timeSec);
@@ -655,6 +946,10 @@ private:
 
     int getPushedAtomErrors(int atomId) const;
 
+    int getPushedAtomSkips(int atomId) const;
+
+    int getPushedAtomClientDrops(int atomId) const;
+
     /**
      * Get a reference to AtomMetricStats for a metric. If none exists, create it. The reference
      * will live as long as `this`.
@@ -672,10 +967,20 @@ private:
     FRIEND_TEST(StatsdStatsTest, TestSystemServerCrash);
     FRIEND_TEST(StatsdStatsTest, TestPullAtomStats);
     FRIEND_TEST(StatsdStatsTest, TestAtomMetricsStats);
+    FRIEND_TEST(StatsdStatsTest, TestMetricCost);
     FRIEND_TEST(StatsdStatsTest, TestActivationBroadcastGuardrailHit);
     FRIEND_TEST(StatsdStatsTest, TestAtomErrorStats);
+    FRIEND_TEST(StatsdStatsTest, TestSocketBatchReadStats);
+    FRIEND_TEST(StatsdStatsTest, TestEventQueueOverflowPerUid);
+    FRIEND_TEST(StatsdStatsTest, TestLatencyHistogramBins);
+    FRIEND_TEST(StatsdStatsTest, TestPullTimePercentiles);
+    FRIEND_TEST(StatsdStatsTest, TestIngestionLatencyStats);
+    FRIEND_TEST(StatsdStatsTest, TestIngestionLatencyBatch);
 
     FRIEND_TEST(StatsLogProcessorTest, InvalidConfigRemoved);
+    FRIEND_TEST(StatsPullerManagerTest, TestAlarmPullsCoalescedAcrossConfigs);
+    FRIEND_TEST(StatsPullerManagerTest, TestDeferredPullsShareOnePull);
+    FRIEND_TEST(StatsPullerManagerTest, TestDeferredPullWindow);
 };
 
 }  // namespace statsd
@@ -22,6 +22,8 @@
 #include <log/log.h>
 #include <private/android_filesystem_config.h>
 
+#include <algorithm>
+
 #include "annotations.h"
 #include "stats_log_util.h"
 #include "statslog_statsd.h"
@@ -36,13 +38,41 @@ const int FIELD_ID_EXPERIMENT_ID = 1;
 using namespace android::util;
 using android::base::StringPrintf;
 using android::util::ProtoOutputStream;
+using std::shared_ptr;
 using std::string;
+using std::string_view;
 using std::vector;
 
 LogEvent::LogEvent(int32_t uid, int32_t pid)
     : mLogdTimestampNs(time(nullptr)), mLogUid(uid), mLogPid(pid) {
 }
 
+void LogEvent::reset(int32_t uid, int32_t pid) {
+    mBuf = nullptr;
+    mRemainingLen = 0;
+    mValid = true;
+    mValues.clear();
+    mFieldIndex.clear();
+    refreshMatchId();
+    mLogdTimestampNs = time(nullptr);
+    mElapsedTimestampNs = 0;
+    mReceivedTimestampNs = 0;
+    mDequeuedTimestampNs = 0;
+    mTagId = 0;
+    mLogUid = uid;
+    mLogPid = pid;
+    mTruncateTimestamp = false;
+    mResetState = -1;
+    mNumUidFields = 0;
+    mAttributionChainStartIndex.reset();
+    mAttributionChainEndIndex.reset();
+    mExclusiveStateFieldIndex.reset();
+    mDeferredBuffer.reset();
+    mDeferredOffset = 0;
+    mDeferredLen = 0;
+    mSizeBytes = 0;
+}
+
 LogEvent::LogEvent(const string& trainName, int64_t trainVersionCode, bool requiresStaging,
                    bool rollbackEnabled, bool requiresLowLatencyMonitor, int32_t state,
                    const std::vector<uint8_t>& experimentIds, int32_t userId) {
@@ -97,10 +127,24 @@ void LogEvent::parseString(int32_t* pos, int32_t depth, bool* last, uint8_t numA
         return;
     }
 
-    string value = string((char*)mBuf, numBytes);
+    if (sBufferViewMinBytes > 0 && (uint32_t)numBytes >= sBufferViewMinBytes) {
+        Value value(STRING, makeBufferView(numBytes));
+        addToValues(pos, depth, value, last);
+    } else {
+        sp<const ValuePayload> interned;
+        if (sStringValueInterner != nullptr) {
+            interned = sStringValueInterner->intern(string_view((char*)mBuf, numBytes));
+        }
+        if (interned != nullptr) {
+            Value value(STRING, std::move(interned));
+            addToValues(pos, depth, value, last);
+        } else {
+            string value = string((char*)mBuf, numBytes);
+            addToValues(pos, depth, value, last);
+        }
+    }
     mBuf += numBytes;
     mRemainingLen -= numBytes;
-    addToValues(pos, depth, value, last);
     parseAnnotations(numAnnotations);
 }
 
@@ -124,10 +168,15 @@ void LogEvent::parseByteArray(int32_t* pos, int32_t depth, bool* last, uint8_t n
         return;
     }
 
-    vector<uint8_t> value(mBuf, mBuf + numBytes);
+    if (sBufferViewMinBytes > 0 && (uint32_t)numBytes >= sBufferViewMinBytes) {
+        Value value(STORAGE, makeBufferView(numBytes));
+        addToValues(pos, depth, value, last);
+    } else {
+        vector<uint8_t> value(mBuf, mBuf + numBytes);
+        addToValues(pos, depth, value, last);
+    }
     mBuf += numBytes;
     mRemainingLen -= numBytes;
-    addToValues(pos, depth, value, last);
     parseAnnotations(numAnnotations);
 }
 
@@ -251,6 +300,35 @@ void LogEvent::parseArray(int32_t* pos, int32_t depth, bool* last, uint8_t numAn
     last[1] = false;
 }
 
+void LogEvent::parsePackedArray(int32_t* pos, int32_t depth, bool* last,
+                                uint8_t numAnnotations) {
+    const uint8_t numElements = readNextValue<uint8_t>();
+    const uint8_t typeId = getTypeId(readNextValue<uint8_t>());
+
+    if (numElements > INT8_MAX || (typeId != INT32_TYPE && typeId != INT64_TYPE)) {
+        mValid = false;
+        return;
+    }
+
+    for (pos[1] = 1; pos[1] <= numElements && mValid; pos[1]++) {
+        last[1] = (pos[1] == numElements);
+        int64_t value = readNextZigzagVarint();
+        if (typeId == INT64_TYPE) {
+            addToValues(pos, /*depth=*/1, value, last);
+        } else if (value < INT32_MIN || value > INT32_MAX) {
+            mValid = false;
+        } else {
+            int32_t intValue = (int32_t)value;
+            addToValues(pos, /*depth=*/1, intValue, last);
+        }
+    }
+
+    parseAnnotations(numAnnotations, numElements);
+
+    pos[1] = 1;
+    last[1] = false;
+}
+
 // Assumes that mValues is not empty
 bool LogEvent::checkPreviousValueType(Type expected) {
     return mValues[mValues.size() - 1].mValue.getType() == expected;
@@ -402,80 +480,355 @@ void LogEvent::parseAnnotations(uint8_t numAnnotations, std::optional<uint8_t> n
     }
 }
 
-// This parsing logic is tied to the encoding scheme used in StatsEvent.java and
-// stats_event.c
-bool LogEvent::parseBuffer(uint8_t* buf, size_t len) {
-    mBuf = buf;
-    mRemainingLen = (uint32_t)len;
+void LogEvent::setDeferredBuffer(LogEventBufferSlab::Buffer buffer, size_t offset, size_t len) {
+    mDeferredBuffer = std::move(buffer);
+    mDeferredOffset = (uint32_t)offset;
+    mDeferredLen = (uint32_t)len;
+    mSizeBytes = (uint32_t)len;
+    // Only reads the header, so that the queue can tell the atoms apart.
+    mTagId = std::max(0, parseAtomId(mDeferredBuffer.get() + offset, len));
+}
 
-    int32_t pos[] = {1, 1, 1};
-    bool last[] = {false, false, false};
+bool LogEvent::parseDeferredBuffer() {
+    if (!mDeferredBuffer) {
+        mValid = false;
+        return false;
+    }
+    bool result = parseBuffer(mDeferredBuffer.get() + mDeferredOffset, mDeferredLen);
+    mDeferredBuffer.reset();
+    return result;
+}
 
+uint8_t LogEvent::parseAtomHeader(uint8_t* numElements) {
     // Beginning of buffer is OBJECT_TYPE | NUM_FIELDS | TIMESTAMP | ATOM_ID
     uint8_t typeInfo = readNextValue<uint8_t>();
     if (getTypeId(typeInfo) != OBJECT_TYPE) mValid = false;
 
-    uint8_t numElements = readNextValue<uint8_t>();
-    if (numElements < 2 || numElements > INT8_MAX) mValid = false;
+    *numElements = readNextValue<uint8_t>();
+    if (*numElements < 2 || *numElements > INT8_MAX) mValid = false;
 
     typeInfo = readNextValue<uint8_t>();
     if (getTypeId(typeInfo) != INT64_TYPE) mValid = false;
     mElapsedTimestampNs = readNextValue<int64_t>();
-    numElements--;
+    (*numElements)--;
 
     typeInfo = readNextValue<uint8_t>();
     if (getTypeId(typeInfo) != INT32_TYPE) mValid = false;
     mTagId = readNextValue<int32_t>();
-    numElements--;
+    (*numElements)--;
+    return typeInfo;
+}
+
+int32_t LogEvent::parseAtomId(const uint8_t* buf, size_t len) {
+    // Beginning of buffer is OBJECT_TYPE | NUM_FIELDS | TIMESTAMP | ATOM_ID
+    const size_t timestampOffset = 2 * sizeof(uint8_t);
+    const size_t atomIdOffset = timestampOffset + sizeof(uint8_t) + sizeof(int64_t);
+    if (len < atomIdOffset + sizeof(uint8_t) + sizeof(int32_t) ||
+        getTypeId(buf[0]) != OBJECT_TYPE || getTypeId(buf[timestampOffset]) != INT64_TYPE ||
+        getTypeId(buf[atomIdOffset]) != INT32_TYPE) {
+        return -1;
+    }
+    int32_t atomId;
+    memcpy(&atomId, buf + atomIdOffset + sizeof(uint8_t), sizeof(atomId));
+    return atomId;
+}
+
+// This parsing logic is tied to the encoding scheme used in StatsEvent.java and
+// stats_event.c
+bool LogEvent::parseBuffer(uint8_t* buf, size_t len) {
+    mBuf = buf;
+    mBufStart = buf;
+    mRemainingLen = (uint32_t)len;
+    mSizeBytes = (uint32_t)len;
+
+    int32_t pos[] = {1, 1, 1};
+    bool last[] = {false, false, false};
+
+    uint8_t numElements;
+    uint8_t typeInfo = parseAtomHeader(&numElements);
     parseAnnotations(getNumAnnotations(typeInfo));  // atom-level annotations
 
-    for (pos[0] = 1; pos[0] <= numElements && mValid; pos[0]++) {
-        last[0] = (pos[0] == numElements);
+    std::atomic<uint16_t>& sizeHint = sValuesSizeHints[(uint32_t)mTagId % kNumValuesSizeHints];
+    mValues.reserve(std::max<size_t>(numElements, sizeHint.load(std::memory_order_relaxed)));
+    const size_t reservedCapacity = mValues.capacity();
+
+    const LogEventParsePlan* plan =
+            sParsePlans != nullptr && mValid ? sParsePlans->get(mTagId) : nullptr;
+    if (plan == nullptr || !parseFieldsWithPlan(*plan, numElements)) {
+        // Layout of the fields, to learn the plan of this atom if it has none yet.
+        bool learnPlan = sParsePlans != nullptr && mValid && plan == nullptr;
+        const uint8_t* fieldsStart = mBuf;
+        uint8_t planTypeInfos[INT8_MAX];
+        uint32_t planOffsets[INT8_MAX];
+        std::vector<LogEventParsePlan::AnnotatedField> planAnnotatedFields;
+
+        for (pos[0] = 1; pos[0] <= numElements && mValid; pos[0]++) {
+            last[0] = (pos[0] == numElements);
+
+            if (learnPlan) {
+                planOffsets[pos[0] - 1] = mBuf - fieldsStart;
+            }
+            typeInfo = readNextValue<uint8_t>();
+            if (learnPlan) {
+                planTypeInfos[pos[0] - 1] = typeInfo;
+                learnPlan = isPlannableField(typeInfo);
+            }
+            uint8_t typeId = getTypeId(typeInfo);
+
+            switch (typeId) {
+                case BOOL_TYPE:
+                    parseBool(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
+                    break;
+                case INT32_TYPE:
+                    parseInt32(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
+                    break;
+                case INT64_TYPE:
+                    parseInt64(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
+                    break;
+                case FLOAT_TYPE:
+                    parseFloat(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
+                    break;
+                case BYTE_ARRAY_TYPE:
+                    parseByteArray(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
+                    break;
+                case STRING_TYPE:
+                    parseString(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
+                    break;
+                case KEY_VALUE_PAIRS_TYPE:
+                    parseKeyValuePairs(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
+                    break;
+                case ATTRIBUTION_CHAIN_TYPE:
+                    parseAttributionChain(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
+                    break;
+                case LIST_TYPE:
+                    parseArray(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
+                    break;
+                case PACKED_LIST_TYPE:
+                    parsePackedArray(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
+                    break;
+                case ERROR_TYPE:
+                    /* mErrorBitmask =*/ readNextValue<int32_t>();
+                    mValid = false;
+                    break;
+                default:
+                    mValid = false;
+                    break;
+            }
+            if (learnPlan && mValid && getNumAnnotations(typeInfo) > 0) {
+                learnPlan = learnAnnotatedField(pos[0] - 1, fieldsStart + planOffsets[pos[0] - 1],
+                                                fieldsStart, &planAnnotatedFields);
+            }
+        }
 
-        typeInfo = readNextValue<uint8_t>();
-        uint8_t typeId = getTypeId(typeInfo);
+        if (learnPlan && mValid && mRemainingLen == 0) {
+            sParsePlans->add(mTagId, planTypeInfos, planOffsets, numElements,
+                             mBuf - fieldsStart, std::move(planAnnotatedFields));
+        }
+    }
 
-        switch (typeId) {
-            case BOOL_TYPE:
-                parseBool(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
+    if (mRemainingLen != 0) mValid = false;
+    if (mValues.capacity() != reservedCapacity) {
+        sValuesRegrowCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (mValid) {
+        const uint16_t numValues = std::min<size_t>(mValues.size(), kMaxValuesSizeHint);
+        if (sizeHint.load(std::memory_order_relaxed) != numValues) {
+            sizeHint.store(numValues, std::memory_order_relaxed);
+        }
+    }
+    mRawBuffer.clear();
+    if (mValid && sRawBufferAtoms.hasConsumers() && sRawBufferAtoms.isAtomInUse(mTagId)) {
+        mRawBuffer = mSharedBuffer != nullptr
+                             ? mSharedBuffer
+                             : new ValuePayload(vector<uint8_t>(mBufStart, mBufStart + mSizeBytes));
+    }
+    mBuf = nullptr;
+    mBufStart = nullptr;
+    mFieldIndex.resize(mValues.size());
+    for (size_t i = 0; i < mValues.size(); i++) {
+        mFieldIndex[i] = mValues[i].mField.getField();
+    }
+    refreshMatchId();
+    // The views hold the buffer.
+    mSharedBuffer.clear();
+    return mValid;
+}
+
+uint32_t LogEvent::sBufferViewMinBytes = 0;
+
+void LogEvent::setBufferViewMinBytes(size_t minBytes) {
+    sBufferViewMinBytes = (uint32_t)minBytes;
+}
+
+LogEventFilter LogEvent::sRawBufferAtoms;
+
+void LogEvent::setRawBufferAtomIds(LogEventFilter::AtomIdSet atomIds, const void* consumer) {
+    sRawBufferAtoms.setAtomIds(std::move(atomIds), consumer);
+}
+
+void LogEvent::setAllRawBuffersRetained(bool retained, const void* consumer) {
+    sRawBufferAtoms.setAllAtomsInUse(retained, consumer);
+}
+
+bool LogEvent::isPlannableField(uint8_t typeInfo) {
+    switch (getTypeId(typeInfo)) {
+        case INT32_TYPE:
+        case INT64_TYPE:
+        case FLOAT_TYPE:
+        case BOOL_TYPE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool LogEvent::learnAnnotatedField(
+        uint32_t fieldIndex, const uint8_t* fieldStart, const uint8_t* fieldsStart,
+        std::vector<LogEventParsePlan::AnnotatedField>* annotatedFields) {
+    const uint8_t typeInfo = fieldStart[0];
+    size_t valueSize;
+    switch (getTypeId(typeInfo)) {
+        case INT32_TYPE:
+        case FLOAT_TYPE:
+            valueSize = 4;
+            break;
+        case INT64_TYPE:
+            valueSize = 8;
+            break;
+        case BOOL_TYPE:
+            valueSize = 1;
+            break;
+        default:
+            return false;
+    }
+    // Each annotation is its id, its type and a bool.
+    const uint8_t* annotationsStart = fieldStart + 1 + valueSize;
+    const size_t numBytes = mBuf - annotationsStart;
+    if (numBytes != 3 * getNumAnnotations(typeInfo) || mValues.empty()) {
+        return false;
+    }
+    for (size_t i = 0; i < numBytes; i += 3) {
+        if (annotationsStart[i + 1] != BOOL_TYPE) {
+            return false;
+        }
+        switch (annotationsStart[i]) {
+            case ANNOTATION_ID_IS_UID:
+            case ANNOTATION_ID_PRIMARY_FIELD:
+            case ANNOTATION_ID_EXCLUSIVE_STATE:
+            case ANNOTATION_ID_STATE_NESTED:
                 break;
+            default:
+                return false;
+        }
+    }
+    LogEventParsePlan::AnnotatedField field;
+    field.fieldIndex = fieldIndex;
+    field.offset = annotationsStart - fieldsStart;
+    field.bytes.assign(annotationsStart, mBuf);
+    field.annotations = mValues.back().mAnnotations;
+    field.exclusiveState = mExclusiveStateFieldIndex == mValues.size() - 1;
+    annotatedFields->push_back(std::move(field));
+    return true;
+}
+
+namespace {
+
+template <class T>
+T readUnaligned(const uint8_t* buf) {
+    T value;
+    memcpy(&value, buf, sizeof(T));
+    return value;
+}
+
+}  // anonymous namespace
+
+bool LogEvent::parseFieldsWithPlan(const LogEventParsePlan& plan, uint8_t numElements) {
+    const size_t numFields = plan.typeInfos.size();
+    if (numElements != numFields || mRemainingLen != plan.numBytes) {
+        return false;
+    }
+    for (size_t i = 0; i < numFields; i++) {
+        if (mBuf[plan.offsets[i]] != plan.typeInfos[i]) {
+            return false;
+        }
+    }
+    for (const LogEventParsePlan::AnnotatedField& field : plan.annotatedFields) {
+        if (memcmp(mBuf + field.offset, field.bytes.data(), field.bytes.size()) != 0) {
+            return false;
+        }
+    }
+
+    // The layout matches the plan, so every value is in bounds and has no annotations.
+    int32_t pos[] = {1, 1, 1};
+    for (size_t i = 0; i < numFields; i++) {
+        pos[0] = i + 1;
+        const Field field(mTagId, pos, /*depth=*/0);
+        const uint8_t* value = mBuf + plan.offsets[i] + 1;
+        switch (getTypeId(plan.typeInfos[i])) {
             case INT32_TYPE:
-                parseInt32(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
+                mValues.emplace_back(field, Value(readUnaligned<int32_t>(value)));
                 break;
             case INT64_TYPE:
-                parseInt64(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
+                mValues.emplace_back(field, Value(readUnaligned<int64_t>(value)));
                 break;
             case FLOAT_TYPE:
-                parseFloat(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
-                break;
-            case BYTE_ARRAY_TYPE:
-                parseByteArray(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
-                break;
-            case STRING_TYPE:
-                parseString(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
-                break;
-            case KEY_VALUE_PAIRS_TYPE:
-                parseKeyValuePairs(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
-                break;
-            case ATTRIBUTION_CHAIN_TYPE:
-                parseAttributionChain(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
+                mValues.emplace_back(field, Value(readUnaligned<float>(value)));
                 break;
-            case LIST_TYPE:
-                parseArray(pos, /*depth=*/0, last, getNumAnnotations(typeInfo));
-                break;
-            case ERROR_TYPE:
-                /* mErrorBitmask =*/ readNextValue<int32_t>();
-                mValid = false;
-                break;
-            default:
-                mValid = false;
+            case BOOL_TYPE:
+                // cast to int32_t because FieldValue does not support bools
+                mValues.emplace_back(field, Value((int32_t)*value));
                 break;
         }
     }
+    const size_t firstValueIndex = mValues.size() - numFields;
+    for (const LogEventParsePlan::AnnotatedField& field : plan.annotatedFields) {
+        const size_t valueIndex = firstValueIndex + field.fieldIndex;
+        mValues[valueIndex].mAnnotations = field.annotations;
+        if (field.annotations.isUidField()) {
+            mNumUidFields++;
+        }
+        if (field.exclusiveState) {
+            mExclusiveStateFieldIndex = valueIndex;
+        }
+    }
+    mBuf += plan.numBytes;
+    mRemainingLen = 0;
+    return true;
+}
 
-    if (mRemainingLen != 0) mValid = false;
-    mBuf = nullptr;
-    return mValid;
+shared_ptr<LogEventParsePlans> LogEvent::sParsePlans;
+
+std::atomic<uint16_t> LogEvent::sValuesSizeHints[kNumValuesSizeHints];
+
+std::atomic<int64_t> LogEvent::sValuesRegrowCount(0);
+
+std::atomic<uint64_t> LogEvent::sNextMatchId(1);
+
+int64_t LogEvent::takeValuesRegrowCount() {
+    // Avoids the exchange in the common case.
+    if (sValuesRegrowCount.load(std::memory_order_relaxed) == 0) {
+        return 0;
+    }
+    return sValuesRegrowCount.exchange(0, std::memory_order_relaxed);
+}
+
+void LogEvent::setParsePlans(shared_ptr<LogEventParsePlans> plans) {
+    sParsePlans = std::move(plans);
+}
+
+shared_ptr<StringValueInterner> LogEvent::sStringValueInterner;
+
+void LogEvent::setStringValueInterner(shared_ptr<StringValueInterner> interner) {
+    sStringValueInterner = std::move(interner);
+}
+
+sp<const ValuePayload> LogEvent::makeBufferView(uint32_t numBytes) {
+    if (mSharedBuffer == nullptr) {
+        // Copied once, the receive buffers are reused as soon as the event is parsed.
+        mSharedBuffer = new ValuePayload(vector<uint8_t>(mBufStart, mBufStart + mSizeBytes));
+    }
+    const size_t offset = mBuf - mBufStart;
+    return new ValuePayload(mSharedBuffer, mSharedBuffer->bytes().substr(offset, numBytes));
 }
 
 uint8_t LogEvent::getTypeId(uint8_t typeInfo) {
@@ -534,7 +887,7 @@ const char* LogEvent::GetString(size_t key, status_t* err) const {
     for (const auto& value : mValues) {
         if (value.mField.getField() == field) {
             if (value.mValue.getType() == STRING) {
-                return value.mValue.str_value.c_str();
+                return value.mValue.getString().c_str();
             } else {
                 *err = BAD_TYPE;
                 return 0;
@@ -596,7 +949,7 @@ std::vector<uint8_t> LogEvent::GetStorage(size_t key, status_t* err) const {
     for (const auto& value : mValues) {
         if (value.mField.getField() == field) {
             if (value.mValue.getType() == STORAGE) {
-                return value.mValue.storage_value;
+                return value.mValue.getStorage();
             } else {
                 *err = BAD_TYPE;
                 return vector<uint8_t>();
@@ -19,11 +19,16 @@
 #include <android/util/ProtoOutputStream.h>
 #include <private/android_logger.h>
 
+#include <atomic>
 #include <optional>
 #include <string>
 #include <vector>
 
 #include "FieldValue.h"
+#include "logd/LogEventBufferSlab.h"
+#include "logd/LogEventParsePlans.h"
+#include "logd/StringValueInterner.h"
+#include "socket/LogEventFilter.h"
 
 namespace android {
 namespace os {
@@ -57,6 +62,7 @@ namespace statsd {
 #define OBJECT_TYPE 0x07
 #define KEY_VALUE_PAIRS_TYPE 0x08
 #define ATTRIBUTION_CHAIN_TYPE 0x09
+#define PACKED_LIST_TYPE 0x0A
 #define ERROR_TYPE 0x0F
 
 struct InstallTrainInfo {
@@ -81,6 +87,12 @@ public:
      */
     explicit LogEvent(int32_t uid, int32_t pid);
 
+    /**
+     * Resets this event to the state of a newly constructed LogEvent(uid, pid) so that it can be
+     * reused for parsing another buffer. The capacity of the values vector is retained.
+     */
+    void reset(int32_t uid, int32_t pid);
+
     /**
      * Parses the atomId, timestamp, and vector of values from a buffer
      * containing the StatsEvent/AStatsEvent encoding of an atom.
@@ -93,6 +105,98 @@ public:
      */
     bool parseBuffer(uint8_t* buf, size_t len);
 
+    /**
+     * Makes the string and byte array fields of at least [minBytes] bytes views into one copy of
+     * the serialized atom, owned by the event and shared by its values, instead of copying each
+     * field into its own string or vector. Stored values are copied out of the view, see
+     * Value::detachPayload(). 0, the default, disables the views.
+     *
+     * Must be called before any event is parsed.
+     */
+    static void setBufferViewMinBytes(size_t minBytes);
+
+    /**
+     * Makes the string fields shorter than the buffer view threshold share the payloads of
+     * [interner] instead of copying each field into its own string. nullptr, the default,
+     * disables interning.
+     *
+     * Must be called before any event is parsed.
+     */
+    static void setStringValueInterner(std::shared_ptr<StringValueInterner> interner);
+
+    /**
+     * Decodes the atoms made only of scalar fields without annotations through the plans
+     * learned in [plans] from their first event, instead of dispatching on the type of each
+     * field. Events whose layout doesn't match the plan of their atom use the generic parser.
+     * nullptr, the default, disables the plans.
+     *
+     * Must be called before any event is parsed.
+     */
+    static void setParsePlans(std::shared_ptr<LogEventParsePlans> plans);
+
+    /**
+     * Makes the events of [atomIds] parsed from now on keep a copy of the serialized atom for
+     * [consumer], see getRawBuffer(). An empty set unregisters the consumer. No atom keeps it by
+     * default. Can be called at any time, from any thread.
+     */
+    static void setRawBufferAtomIds(LogEventFilter::AtomIdSet atomIds, const void* consumer);
+
+    /**
+     * Like setRawBufferAtomIds() for every atom, while [retained] is true.
+     */
+    static void setAllRawBuffersRetained(bool retained, const void* consumer);
+
+    /**
+     * The serialized atom, in the StatsEvent/AStatsEvent encoding, this event was parsed from
+     * while the raw buffers were retained, otherwise nullptr.
+     */
+    inline const sp<const ValuePayload>& getRawBuffer() const {
+        return mRawBuffer;
+    }
+
+    /**
+     * Returns the number of events parsed since the last call whose values vector had to be
+     * reallocated during parsing, then resets it.
+     *
+     * Before decoding the fields, parseBuffer() reserves as many values as the last event of the
+     * same atom had, so this stays near zero in steady state.
+     */
+    static int64_t takeValuesRegrowCount();
+
+    /**
+     * Reads the atomId from a buffer containing the StatsEvent/AStatsEvent encoding of an atom,
+     * without parsing it.
+     *
+     * \return the atomId, or -1 if the buffer does not start with a valid header
+     */
+    static int32_t parseAtomId(const uint8_t* buf, size_t len);
+
+    /**
+     * Takes ownership of a received buffer without parsing it. The serialized atom starts at
+     * [offset] and is [len] bytes long. The event is not usable until parseDeferredBuffer() is
+     * called, except for GetUid(), GetPid(), GetElapsedTimestampNs() and GetTagId().
+     */
+    void setDeferredBuffer(LogEventBufferSlab::Buffer buffer, size_t offset, size_t len);
+
+    /**
+     * Size of the serialized atom this event was parsed from, or will be parsed from in the
+     * deferred parse mode. 0 for events that were not built from a buffer.
+     */
+    inline size_t getSizeBytes() const {
+        return mSizeBytes;
+    }
+
+    inline bool hasDeferredBuffer() const {
+        return static_cast<bool>(mDeferredBuffer);
+    }
+
+    /**
+     * Parses the buffer set by setDeferredBuffer() and returns it to its slab.
+     *
+     * \return success of the initialization
+     */
+    bool parseDeferredBuffer();
+
     // Constructs a BinaryPushStateChanged LogEvent from API call.
     explicit LogEvent(const std::string& trainName, int64_t trainVersionCode, bool requiresStaging,
                       bool rollbackEnabled, bool requiresLowLatencyMonitor, int32_t state,
@@ -156,6 +260,29 @@ public:
         mElapsedTimestampNs = timestampNs;
     }
 
+    /**
+     * Elapsed realtime when statsd read the event from the socket, or 0 if it did not come from
+     * the socket.
+     */
+    inline int64_t getReceivedTimestampNs() const {
+        return mReceivedTimestampNs;
+    }
+
+    void setReceivedTimestampNs(int64_t timestampNs) {
+        mReceivedTimestampNs = timestampNs;
+    }
+
+    /**
+     * Elapsed realtime when the event was popped from the LogEventQueue, or 0 if it was not.
+     */
+    inline int64_t getDequeuedTimestampNs() const {
+        return mDequeuedTimestampNs;
+    }
+
+    void setDequeuedTimestampNs(int64_t timestampNs) {
+        mDequeuedTimestampNs = timestampNs;
+    }
+
     /**
      * Set the timestamp if the original logd timestamp is missing.
      */
@@ -171,10 +298,40 @@ public:
         return mValues;
     }
 
+    // Drops the field index, as the values may be restructured. Use getMutableValue() to only
+    // modify values in place.
     std::vector<FieldValue>* getMutableValues() {
+        mFieldIndex.clear();
+        refreshMatchId();
         return &mValues;
     }
 
+    // Returns the value of the i-th FieldValue, to be modified in place. Keeps the field index.
+    inline Value& getMutableValue(size_t i) {
+        refreshMatchId();
+        return mValues[i].mValue;
+    }
+
+    /**
+     * An id that is unique to this event and its current values: it changes whenever the values
+     * may change, and is only shared with unmodified copies. Lets matchers that are shared by
+     * several configs match the event once, see SharedSimpleAtomMatcher. Never 0.
+     */
+    inline uint64_t getMatchId() const {
+        return mMatchId;
+    }
+
+    /**
+     * The encoded fields of getValues(), stored contiguously for the scans that only look at
+     * the fields, see findPosRange(). Built when the event is parsed from a buffer.
+     *
+     * Returns nullptr if there is no index, e.g. after getMutableValues() was called.
+     */
+    inline const int32_t* getFieldIndex() const {
+        return !mFieldIndex.empty() && mFieldIndex.size() == mValues.size() ? mFieldIndex.data()
+                                                                             : nullptr;
+    }
+
     // Default value = false
     inline bool shouldTruncateTimestamp() const {
         return mTruncateTimestamp;
@@ -211,6 +368,7 @@ public:
 
     template <class T>
     status_t updateValue(size_t key, T& value, Type type) {
+        refreshMatchId();
         int field = getSimpleField(key);
         for (auto& fieldValue : mValues) {
             if (fieldValue.mField.getField() == field) {
@@ -244,6 +402,13 @@ private:
     void parseKeyValuePairs(int32_t* pos, int32_t depth, bool* last, uint8_t numAnnotations);
     void parseAttributionChain(int32_t* pos, int32_t depth, bool* last, uint8_t numAnnotations);
     void parseArray(int32_t* pos, int32_t depth, bool* last, uint8_t numAnnotations);
+    // Parses an int32 or int64 array whose elements are zigzag varints, into the same values as
+    // parseArray().
+    void parsePackedArray(int32_t* pos, int32_t depth, bool* last, uint8_t numAnnotations);
+
+    // Reads the header of the buffer being parsed into mElapsedTimestampNs and mTagId. Returns
+    // the type info byte of the atom id, and the number of fields after the header.
+    uint8_t parseAtomHeader(uint8_t* numElements);
 
     void parseAnnotations(uint8_t numAnnotations, std::optional<uint8_t> numElements = std::nullopt,
                           std::optional<size_t> firstUidInChainIndex = std::nullopt);
@@ -267,8 +432,79 @@ private:
     uint8_t* mBuf;
     uint32_t mRemainingLen; // number of valid bytes left in the buffer being parsed
 
+    // Start of the buffer being parsed, and its copy that fields are views into, if any. Only
+    // valid during the execution of parseBuffer.
+    const uint8_t* mBufStart = nullptr;
+    sp<const ValuePayload> mSharedBuffer;
+
+    // See setBufferViewMinBytes().
+    static uint32_t sBufferViewMinBytes;
+
+    // See setStringValueInterner().
+    static std::shared_ptr<StringValueInterner> sStringValueInterner;
+
+    // See setParsePlans().
+    static std::shared_ptr<LogEventParsePlans> sParsePlans;
+
+    // The atoms that keep their raw buffers, see setRawBufferAtomIds().
+    static LogEventFilter sRawBufferAtoms;
+
+    // Number of values of the last parsed event of each atom, indexed by atom id modulo
+    // kNumValuesSizeHints. Atoms that collide only get a worse estimate.
+    static const size_t kNumValuesSizeHints = 1024;
+    static std::atomic<uint16_t> sValuesSizeHints[kNumValuesSizeHints];
+
+    // Hints are capped so that a rare wide atom doesn't inflate the events of colliding atoms.
+    static const uint16_t kMaxValuesSizeHint = 512;
+
+    // See takeValuesRegrowCount().
+    static std::atomic<int64_t> sValuesRegrowCount;
+
+    // The next id returned by getMatchId().
+    static std::atomic<uint64_t> sNextMatchId;
+
+    static inline uint64_t nextMatchId() {
+        return sNextMatchId.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline void refreshMatchId() {
+        mMatchId = nextMatchId();
+    }
+
+    // Returns true if a field with this [typeInfo] can be part of a parse plan, as long as its
+    // annotations can too, see learnAnnotatedField().
+    static bool isPlannableField(uint8_t typeInfo);
+
+    /**
+     * Adds the annotations of the field just parsed, the [fieldIndex]-th one, to
+     * [annotatedFields]. Its type byte is at [fieldStart]. Returns false if they can't be part of
+     * a parse plan: only the bool annotations that don't depend on the other fields can.
+     */
+    bool learnAnnotatedField(uint32_t fieldIndex, const uint8_t* fieldStart,
+                             const uint8_t* fieldsStart,
+                             std::vector<LogEventParsePlan::AnnotatedField>* annotatedFields);
+
+    /**
+     * Decodes the [numElements] fields at mBuf with [plan]. Returns false, without consuming
+     * anything, if the fields don't match the plan.
+     */
+    bool parseFieldsWithPlan(const LogEventParsePlan& plan, uint8_t numElements);
+
+    // Returns a view into mSharedBuffer of the next [numBytes] bytes of mBuf.
+    sp<const ValuePayload> makeBufferView(uint32_t numBytes);
+
     bool mValid = true; // stores whether the event we received from the socket is valid
 
+    // Received buffer waiting to be parsed, see setDeferredBuffer(). Not carried over by copies.
+    LogEventBufferSlab::Buffer mDeferredBuffer;
+    uint32_t mDeferredOffset = 0;
+    uint32_t mDeferredLen = 0;
+
+    uint32_t mSizeBytes = 0;
+
+    // See getRawBuffer().
+    sp<const ValuePayload> mRawBuffer;
+
     /**
      * Side-effects:
      *    If there is enough space in buffer to read value of type T
@@ -299,18 +535,42 @@ private:
         return value;
     }
 
+    // Reads a zigzag encoded varint of at most 10 bytes.
+    int64_t readNextZigzagVarint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (mRemainingLen == 0) {
+                break;
+            }
+            const uint8_t byte = *mBuf++;
+            mRemainingLen--;
+            value |= (uint64_t)(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+            }
+        }
+        mValid = false;
+        return 0;
+    }
+
     template <class T>
     void addToValues(int32_t* pos, int32_t depth, T& value, bool* last) {
         Field f = Field(mTagId, pos, depth);
         // only decorate last position for depths with repeated fields (depth 1)
         if (depth > 0 && last[1]) f.decorateLastPos(1);
 
-        Value v = Value(value);
+        Value v = Value(std::move(value));
         mValues.push_back(FieldValue(f, v));
     }
 
-    uint8_t getTypeId(uint8_t typeInfo);
-    uint8_t getNumAnnotations(uint8_t typeInfo);
+    static uint8_t getTypeId(uint8_t typeInfo);
+    static uint8_t getNumAnnotations(uint8_t typeInfo);
+
+    // Encoded fields of mValues, see getFieldIndex(). Empty if not in sync with mValues.
+    std::vector<int32_t> mFieldIndex;
+
+    // See getMatchId().
+    uint64_t mMatchId = nextMatchId();
 
     // The items are naturally sorted in DFS order as we read them. this allows us to do fast
     // matching.
@@ -322,6 +582,10 @@ private:
     // The elapsed timestamp set by statsd log writer.
     int64_t mElapsedTimestampNs;
 
+    // Ingestion timestamps, see getReceivedTimestampNs() and getDequeuedTimestampNs().
+    int64_t mReceivedTimestampNs = 0;
+    int64_t mDequeuedTimestampNs = 0;
+
     // The atom tag of the event (defaults to 0 if client does not
     // appropriately set the atom id).
     int mTagId = 0;
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "LogEventBufferSlab.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+LogEventBufferSlab::Buffer::Buffer(Buffer&& other) : mSlab(other.mSlab), mData(other.mData) {
+    other.mSlab = nullptr;
+    other.mData = nullptr;
+}
+
+LogEventBufferSlab::Buffer& LogEventBufferSlab::Buffer::operator=(Buffer&& other) {
+    if (this != &other) {
+        reset();
+        mSlab = other.mSlab;
+        mData = other.mData;
+        other.mSlab = nullptr;
+        other.mData = nullptr;
+    }
+    return *this;
+}
+
+LogEventBufferSlab::Buffer& LogEventBufferSlab::Buffer::operator=(const Buffer&) {
+    reset();
+    return *this;
+}
+
+void LogEventBufferSlab::Buffer::reset() {
+    if (mData != nullptr) {
+        mSlab->release(mData);
+        mSlab = nullptr;
+        mData = nullptr;
+    }
+}
+
+LogEventBufferSlab::LogEventBufferSlab(size_t numBuffers, size_t bufferSize)
+    : mBufferSize(bufferSize), mStorage(new uint8_t[numBuffers * bufferSize]) {
+    mFreeBuffers.reserve(numBuffers);
+    for (size_t i = 0; i < numBuffers; i++) {
+        mFreeBuffers.push_back(mStorage.get() + i * bufferSize);
+    }
+}
+
+LogEventBufferSlab::Buffer LogEventBufferSlab::obtain() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mFreeBuffers.empty()) {
+        return Buffer();
+    }
+    uint8_t* data = mFreeBuffers.back();
+    mFreeBuffers.pop_back();
+    return Buffer(this, data);
+}
+
+void LogEventBufferSlab::release(uint8_t* data) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFreeBuffers.push_back(data);
+}
+
+size_t LogEventBufferSlab::available() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mFreeBuffers.size();
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * A thread safe slab of fixed size receive buffers, allocated once and reused.
+ *
+ * In the deferred parse mode the socket listener receives datagrams directly into slab buffers
+ * and hands them to the LogEvent unparsed. The log reader then parses them and the buffers
+ * return to the slab, so the socket thread neither copies nor parses the payload.
+ */
+class LogEventBufferSlab {
+public:
+    /**
+     * Owns one buffer of a slab, and returns it to the slab when destroyed or reset.
+     * Copies never share the buffer: copying a Buffer yields an empty one.
+     */
+    class Buffer {
+    public:
+        Buffer() : mSlab(nullptr), mData(nullptr){};
+
+        Buffer(LogEventBufferSlab* slab, uint8_t* data) : mSlab(slab), mData(data){};
+
+        Buffer(Buffer&& other);
+
+        Buffer& operator=(Buffer&& other);
+
+        Buffer(const Buffer&) : Buffer(){};
+
+        Buffer& operator=(const Buffer&);
+
+        ~Buffer() {
+            reset();
+        }
+
+        inline uint8_t* get() const {
+            return mData;
+        }
+
+        inline explicit operator bool() const {
+            return mData != nullptr;
+        }
+
+        /**
+         * Returns the buffer to its slab, leaving this Buffer empty.
+         */
+        void reset();
+
+    private:
+        LogEventBufferSlab* mSlab;
+        uint8_t* mData;
+    };
+
+    /**
+     * \param numBuffers number of buffers in the slab
+     * \param bufferSize size of each buffer in bytes
+     */
+    LogEventBufferSlab(size_t numBuffers, size_t bufferSize);
+
+    /**
+     * Returns a free buffer, or an empty Buffer if all buffers are in use.
+     * The slab must outlive the returned buffer.
+     */
+    Buffer obtain();
+
+    inline size_t bufferSize() const {
+        return mBufferSize;
+    }
+
+    /**
+     * Number of buffers currently free.
+     */
+    size_t available() const;
+
+private:
+    void release(uint8_t* data);
+
+    const size_t mBufferSize;
+
+    // Backing storage of all buffers.
+    std::unique_ptr<uint8_t[]> mStorage;
+
+    mutable std::mutex mMutex;
+
+    std::vector<uint8_t*> mFreeBuffers;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
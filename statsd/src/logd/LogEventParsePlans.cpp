@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "LogEventParsePlans.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::lock_guard;
+using std::mutex;
+using std::unique_ptr;
+
+namespace {
+
+uint32_t roundUpToPowerOfTwo(size_t n) {
+    uint32_t size = 1;
+    while (size < n) {
+        size <<= 1;
+    }
+    return size;
+}
+
+}  // anonymous namespace
+
+LogEventParsePlans::LogEventParsePlans(size_t numSlots)
+    : mMask(roundUpToPowerOfTwo(numSlots) - 1),
+      mSlots(new std::atomic<const LogEventParsePlan*>[mMask + 1]) {
+    for (uint32_t i = 0; i <= mMask; i++) {
+        mSlots[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+void LogEventParsePlans::add(int32_t atomId, const uint8_t* typeInfos, const uint32_t* offsets,
+                             size_t numFields, uint32_t numBytes,
+                             std::vector<LogEventParsePlan::AnnotatedField> annotatedFields) {
+    lock_guard<mutex> lock(mMutex);
+    if (get(atomId) != nullptr || mPlans.size() >= kMaxPlans) {
+        return;
+    }
+    unique_ptr<LogEventParsePlan> plan(new LogEventParsePlan());
+    plan->atomId = atomId;
+    plan->typeInfos.assign(typeInfos, typeInfos + numFields);
+    plan->numBytes = numBytes;
+    plan->offsets.assign(offsets, offsets + numFields);
+    plan->annotatedFields = std::move(annotatedFields);
+    mSlots[(uint32_t)atomId & mMask].store(plan.get(), std::memory_order_release);
+    mPlans.push_back(std::move(plan));
+}
+
+size_t LogEventParsePlans::size() const {
+    lock_guard<mutex> lock(mMutex);
+    return mPlans.size();
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
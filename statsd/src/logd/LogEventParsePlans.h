@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "FieldValue.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Layout of the top-level fields of an atom made only of scalar fields. Such atoms always encode
+ * to the same number of bytes, so they can be decoded without bounds checks once the size and the
+ * type bytes match the plan, see LogEvent::parseBuffer(). The annotations of the fields are
+ * learned along with the layout, and applied without being decoded again.
+ */
+struct LogEventParsePlan {
+    int32_t atomId;
+
+    // Encoded type byte of each field.
+    std::vector<uint8_t> typeInfos;
+
+    // Offset of each field's type byte, from the start of the fields.
+    std::vector<uint32_t> offsets;
+
+    // Encoded size of the fields.
+    uint32_t numBytes;
+
+    // A field with annotations. The events must encode them byte for byte like the event the plan
+    // was learned from.
+    struct AnnotatedField {
+        uint32_t fieldIndex;
+
+        // Offset of the encoded annotations, from the start of the fields.
+        uint32_t offset;
+
+        std::vector<uint8_t> bytes;
+
+        // The annotations of the field once decoded.
+        Annotations annotations;
+
+        // Whether the field is the exclusive state field of the atom.
+        bool exclusiveState;
+    };
+
+    std::vector<AnnotatedField> annotatedFields;
+};
+
+/**
+ * A thread safe table of parse plans keyed by atom id, learned from the first event of each
+ * atom.
+ *
+ * Lookups don't take a lock. The table is direct mapped, so atoms whose ids collide replace
+ * each other's plan; plans stay allocated until the table is destroyed so that readers never
+ * see a freed plan, and at most kMaxPlans are ever created.
+ */
+class LogEventParsePlans {
+public:
+    static const size_t kMaxPlans = 2048;
+
+    // [numSlots] is rounded up to a power of two.
+    explicit LogEventParsePlans(size_t numSlots);
+
+    // Returns the plan of [atomId], or nullptr.
+    inline const LogEventParsePlan* get(int32_t atomId) const {
+        const LogEventParsePlan* plan =
+                mSlots[(uint32_t)atomId & mMask].load(std::memory_order_acquire);
+        return plan != nullptr && plan->atomId == atomId ? plan : nullptr;
+    }
+
+    /**
+     * Adds the plan of [atomId], whose [numFields] fields have the given encoded [typeInfos]
+     * at [offsets], and are [numBytes] long. An existing plan of [atomId] is kept.
+     */
+    void add(int32_t atomId, const uint8_t* typeInfos, const uint32_t* offsets, size_t numFields,
+             uint32_t numBytes,
+             std::vector<LogEventParsePlan::AnnotatedField> annotatedFields = {});
+
+    // Number of plans created.
+    size_t size() const;
+
+private:
+    const uint32_t mMask;
+
+    std::unique_ptr<std::atomic<const LogEventParsePlan*>[]> mSlots;
+
+    mutable std::mutex mMutex;
+
+    // Owns all the plans ever added.
+    std::vector<std::unique_ptr<const LogEventParsePlan>> mPlans;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "LogEvent.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * A thread safe pool of recycled LogEvent objects for the push path.
+ *
+ * The socket listener obtains events from the pool, and the log reader releases them once they
+ * have been processed. Released events keep the capacity of their values vector, which saves
+ * the allocations done while parsing the next buffer.
+ */
+class LogEventPool {
+public:
+    // Events holding more values than this are freed instead of pooled, so that a rare large
+    // atom does not keep its memory alive.
+    static const size_t kMaxPooledValuesCapacity = 128;
+
+    explicit LogEventPool(size_t maxPoolSize) : mMaxPoolSize(maxPoolSize){};
+
+    /**
+     * Returns a pooled event reset to LogEvent(uid, pid), or a new event if the pool is empty.
+     */
+    std::unique_ptr<LogEvent> obtain(int32_t uid, int32_t pid);
+
+    /**
+     * Returns an event to the pool. The event is freed if the pool is full.
+     */
+    void release(std::unique_ptr<LogEvent> event);
+
+    /**
+     * Returns a batch of events to the pool, taking the lock only once.
+     * The input vector is cleared on return.
+     */
+    void release(std::vector<std::unique_ptr<LogEvent>>* events);
+
+    size_t size() const;
+
+private:
+    bool shouldPoolLocked(const std::unique_ptr<LogEvent>& event) const;
+
+    const size_t mMaxPoolSize;
+
+    mutable std::mutex mMutex;
+
+    std::vector<std::unique_ptr<LogEvent>> mFreeEvents;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
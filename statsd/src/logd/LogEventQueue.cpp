@@ -19,6 +19,13 @@
 
 #include "LogEventQueue.h"
 
+#include <private/android_filesystem_config.h>
+
+#include "stats_log_util.h"
+#include "utils/ScopedTrace.h"
+
+#include <algorithm>
+
 namespace android {
 namespace os {
 namespace statsd {
@@ -26,30 +33,239 @@ namespace statsd {
 using std::unique_lock;
 using std::unique_ptr;
 
-unique_ptr<LogEvent> LogEventQueue::waitPop() {
+void LogEventQueue::setByteBudget(size_t maxBytes, size_t minCapacity) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mMaxBytes = maxBytes;
+    mMinCapacity = std::clamp(minCapacity, (size_t)1, mQueueLimit);
+}
+
+void LogEventQueue::setPriorityLane(const std::unordered_set<int>& atomIds, size_t capacity) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mPriorityAtomIds = atomIds;
+    mPriorityCapacity = capacity;
+}
+
+void LogEventQueue::setAppLane(size_t capacity) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mAppCapacity = capacity;
+}
+
+bool LogEventQueue::isAppUid(int32_t uid) {
+    // Includes the isolated uids, which are above the app uids.
+    return uid % AID_USER_OFFSET >= AID_APP_START;
+}
+
+size_t LogEventQueue::getCapacity() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mCapacity;
+}
+
+size_t LogEventQueue::size() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mQueue.size() + mPriorityQueue.size() + mAppQueue.size();
+}
+
+size_t LogEventQueue::getQueuedByteSize() {
     std::unique_lock<std::mutex> lock(mMutex);
+    return (mQueue.size() + mPriorityQueue.size() + mAppQueue.size()) * sizeof(LogEvent) +
+           mQueuedBytes + mLaneBytes;
+}
 
-    if (mQueue.empty()) {
-        mCondition.wait(lock, [this] { return !this->mQueue.empty(); });
+int64_t LogEventQueue::getOldestTimestampLocked() const {
+    int64_t oldestTimestampNs = INT64_MAX;
+    for (const auto* lane : {&mQueue, &mPriorityQueue, &mAppQueue}) {
+        if (!lane->empty()) {
+            oldestTimestampNs = std::min(oldestTimestampNs, lane->front()->GetElapsedTimestampNs());
+        }
     }
+    return oldestTimestampNs;
+}
 
+unique_ptr<LogEvent> LogEventQueue::popLocked() {
+    if (!mPriorityQueue.empty()) {
+        unique_ptr<LogEvent> item = std::move(mPriorityQueue.front());
+        mPriorityQueue.pop_front();
+        mLaneBytes -= item->getSizeBytes();
+        return item;
+    }
+    if (!mAppQueue.empty() &&
+        (mQueue.empty() ||
+         mAppQueue.front()->GetElapsedTimestampNs() < mQueue.front()->GetElapsedTimestampNs())) {
+        unique_ptr<LogEvent> item = std::move(mAppQueue.front());
+        mAppQueue.pop_front();
+        mLaneBytes -= item->getSizeBytes();
+        return item;
+    }
     unique_ptr<LogEvent> item = std::move(mQueue.front());
-    mQueue.pop();
+    mQueue.pop_front();
 
+    if (mOverflowPolicy == SHED_NOISIEST_UID) {
+        auto it = mQueuedEventsPerUid.find(item->GetUid());
+        if (it != mQueuedEventsPerUid.end() && --it->second == 0) {
+            mQueuedEventsPerUid.erase(it);
+        }
+    }
+    mQueuedBytes -= item->getSizeBytes();
+    return item;
+}
+
+void LogEventQueue::noteDrainLocked(int64_t nowNs, size_t count) {
+    if (mBacklogged) {
+        mBusyNs += nowNs - mLastPopNs;
+        mBusyPops += count;
+    }
+    mLastPopNs = nowNs;
+    mBacklogged = !emptyLocked();
+
+    if (mBusyNs < kDrainRateWindowNs) {
+        return;
+    }
+    // Size the capacity for kTargetBacklogNs of work at the measured drain rate, moving halfway
+    // towards it to smooth out noise.
+    const double drainedPerNs = (double)mBusyPops / mBusyNs;
+    const size_t target = std::clamp((size_t)(drainedPerNs * kTargetBacklogNs), mMinCapacity,
+                                     mQueueLimit);
+    mCapacity = (mCapacity + target) / 2;
+    mBusyNs = 0;
+    mBusyPops = 0;
+}
+
+unique_ptr<LogEvent> LogEventQueue::waitPop() {
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    if (emptyLocked()) {
+        ScopedTrace trace("LogEventQueue::wait");
+        mCondition.wait(lock, [this] { return !this->emptyLocked(); });
+    }
+
+    unique_ptr<LogEvent> item = popLocked();
+    if (mMaxBytes > 0) {
+        noteDrainLocked(getElapsedRealtimeNs(), 1);
+    }
     return item;
 }
 
-bool LogEventQueue::push(unique_ptr<LogEvent> item, int64_t* oldestTimestampNs) {
+size_t LogEventQueue::waitPopBatch(size_t maxSize, int64_t timeoutMs,
+                                   std::vector<unique_ptr<LogEvent>>* events) {
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    if (emptyLocked()) {
+        ScopedTrace trace("LogEventQueue::wait");
+        auto hasEvents = [this] { return !this->emptyLocked(); };
+        if (timeoutMs < 0) {
+            mCondition.wait(lock, hasEvents);
+        } else if (!mCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs), hasEvents)) {
+            return 0;
+        }
+    }
+
+    size_t count = 0;
+    while (!emptyLocked() && count < maxSize) {
+        events->push_back(popLocked());
+        count++;
+    }
+    if (mMaxBytes > 0) {
+        noteDrainLocked(getElapsedRealtimeNs(), count);
+    }
+    return count;
+}
+
+bool LogEventQueue::isFullLocked(size_t incomingSizeBytes) const {
+    if (mQueue.size() >= mCapacity) {
+        return true;
+    }
+    // A single event is always accepted by an empty queue, whatever its size.
+    return mMaxBytes > 0 && !mQueue.empty() && mQueuedBytes + incomingSizeBytes > mMaxBytes;
+}
+
+size_t LogEventQueue::evictOldestLocked(int32_t uid) {
+    size_t sizeBytes = 0;
+    for (auto it = mQueue.begin(); it != mQueue.end(); ++it) {
+        if ((*it)->GetUid() == uid) {
+            sizeBytes = (*it)->getSizeBytes();
+            mQueuedBytes -= sizeBytes;
+            mQueue.erase(it);
+            break;
+        }
+    }
+    auto count = mQueuedEventsPerUid.find(uid);
+    if (count != mQueuedEventsPerUid.end() && --count->second == 0) {
+        mQueuedEventsPerUid.erase(count);
+    }
+    return sizeBytes;
+}
+
+size_t LogEventQueue::pushLocked(unique_ptr<LogEvent> event,
+                                 std::vector<DroppedEvent>* droppedEvents) {
+    const int32_t uid = event->GetUid();
+    const size_t sizeBytes = event->getSizeBytes();
+    size_t dropped = 0;
+
+    if (mPriorityCapacity > 0 && mPriorityAtomIds.count(event->GetTagId()) > 0) {
+        if (mPriorityQueue.size() >= mPriorityCapacity) {
+            droppedEvents->push_back({uid, sizeBytes});
+            return 1;
+        }
+        mLaneBytes += sizeBytes;
+        mPriorityQueue.push_back(std::move(event));
+        return 0;
+    }
+
+    if (mAppCapacity > 0 && isAppUid(uid)) {
+        if (mAppQueue.size() >= mAppCapacity) {
+            droppedEvents->push_back({uid, sizeBytes});
+            return 1;
+        }
+        mLaneBytes += sizeBytes;
+        mAppQueue.push_back(std::move(event));
+        return 0;
+    }
+
+    while (isFullLocked(sizeBytes)) {
+        if (mOverflowPolicy == SHED_NOISIEST_UID && dropped < kMaxEvictionsPerPush) {
+            auto noisiest = mQueuedEventsPerUid.begin();
+            for (auto it = mQueuedEventsPerUid.begin(); it != mQueuedEventsPerUid.end(); ++it) {
+                if (it->second > noisiest->second) {
+                    noisiest = it;
+                }
+            }
+            auto incoming = mQueuedEventsPerUid.find(uid);
+            const size_t incomingCount =
+                    incoming != mQueuedEventsPerUid.end() ? incoming->second : 0;
+            if (noisiest != mQueuedEventsPerUid.end() && incomingCount < noisiest->second) {
+                // Evict the oldest queued event of the noisiest uid.
+                const int32_t noisiestUid = noisiest->first;
+                droppedEvents->push_back({noisiestUid, evictOldestLocked(noisiestUid)});
+                dropped++;
+                continue;
+            }
+            // The incoming uid is (one of) the noisiest, so it pays for its own overflow.
+        }
+        droppedEvents->push_back({uid, sizeBytes});
+        return dropped + 1;
+    }
+
+    if (mOverflowPolicy == SHED_NOISIEST_UID) {
+        mQueuedEventsPerUid[uid]++;
+    }
+    mQueuedBytes += sizeBytes;
+    mQueue.push_back(std::move(event));
+    return dropped;
+}
+
+bool LogEventQueue::push(unique_ptr<LogEvent> item, int64_t* oldestTimestampNs,
+                         std::vector<DroppedEvent>* droppedEvents) {
+    std::vector<DroppedEvent> localDroppedEvents;
+    if (droppedEvents == nullptr) {
+        droppedEvents = &localDroppedEvents;
+    }
     bool success;
     {
         std::unique_lock<std::mutex> lock(mMutex);
-        if (mQueue.size() < mQueueLimit) {
-            mQueue.push(std::move(item));
-            success = true;
-        } else {
+        success = pushLocked(std::move(item), droppedEvents) == 0;
+        if (!success) {
             // safe operation as queue must not be empty.
-            *oldestTimestampNs = mQueue.front()->GetElapsedTimestampNs();
-            success = false;
+            *oldestTimestampNs = getOldestTimestampLocked();
         }
     }
 
@@ -57,6 +273,30 @@ bool LogEventQueue::push(unique_ptr<LogEvent> item, int64_t* oldestTimestampNs)
     return success;
 }
 
+size_t LogEventQueue::pushBatch(std::vector<unique_ptr<LogEvent>>* events,
+                                int64_t* oldestTimestampNs,
+                                std::vector<DroppedEvent>* droppedEvents) {
+    std::vector<DroppedEvent> localDroppedEvents;
+    if (droppedEvents == nullptr) {
+        droppedEvents = &localDroppedEvents;
+    }
+    size_t dropped = 0;
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        for (auto& event : *events) {
+            dropped += pushLocked(std::move(event), droppedEvents);
+        }
+        if (dropped > 0) {
+            // safe operation as queue must not be empty.
+            *oldestTimestampNs = getOldestTimestampLocked();
+        }
+    }
+    events->clear();
+
+    mCondition.notify_one();
+    return dropped;
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
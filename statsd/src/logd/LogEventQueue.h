@@ -18,9 +18,15 @@
 
 #include "LogEvent.h"
 
+#include <gtest/gtest_prod.h>
+#include <log/log_time.h>
+
 #include <condition_variable>
 #include <mutex>
-#include <queue>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace android {
 namespace os {
@@ -31,25 +37,189 @@ namespace statsd {
  */
 class LogEventQueue {
 public:
-    explicit LogEventQueue(size_t maxSize) : mQueueLimit(maxSize){};
+    /**
+     * What to do when an event is pushed to a full queue.
+     */
+    enum OverflowPolicy {
+        // Drop the incoming event.
+        DROP_NEWEST = 0,
+        // Drop the oldest queued event of the uid with the most queued events, unless the
+        // incoming event's uid has at least as many queued events, in which case the incoming
+        // event is dropped. A single flooding uid then only sheds its own events. At most
+        // kMaxEvictionsPerPush events are evicted for one push, past that the incoming event is
+        // dropped, so a shrinking capacity is shed over several pushes.
+        SHED_NOISIEST_UID = 1,
+    };
+
+    /**
+     * An event dropped on overflow.
+     */
+    struct DroppedEvent {
+        int32_t uid;
+        // See LogEvent::getSizeBytes().
+        size_t sizeBytes;
+    };
+
+    explicit LogEventQueue(size_t maxSize, OverflowPolicy policy = DROP_NEWEST)
+        : mQueueLimit(maxSize), mOverflowPolicy(policy), mCapacity(maxSize){};
+
+    virtual ~LogEventQueue(){};
+
+    /**
+     * Enables the byte budget mode. The encoded size of the queued events is capped at
+     * [maxBytes], and the event capacity follows the observed drain rate of the consumer, so
+     * that the queue holds about kTargetBacklogNs worth of events, between [minCapacity] and the
+     * max size.
+     */
+    virtual void setByteBudget(size_t maxBytes, size_t minCapacity);
+
+    /**
+     * Enables the priority lane. The events of [atomIds] are queued in a separate lane of
+     * [capacity] events, which is popped first, so that the atoms that change the meaning of
+     * the later events aren't dropped with the bulk of the events on overflow. The events keep
+     * their order within each lane. They are only dropped once the priority lane is full.
+     */
+    virtual void setPriorityLane(const std::unordered_set<int>& atomIds, size_t capacity);
+
+    /**
+     * Enables the app lane. The events of app uids are queued in a separate lane of [capacity]
+     * events, so that a flood of app atoms only drops app atoms, not the platform ones. The app
+     * lane and the main lane are popped in timestamp order, after the priority lane. The overflow
+     * policy and the byte budget only apply to the main lane.
+     */
+    virtual void setAppLane(size_t capacity);
+
+    // Whether the events of [uid] go to the app lane, see setAppLane().
+    static bool isAppUid(int32_t uid);
 
     /**
      * Blocking read one event from the queue.
      */
-    std::unique_ptr<LogEvent> waitPop();
+    virtual std::unique_ptr<LogEvent> waitPop();
+
+    /**
+     * Blocking read up to maxSize events from the queue. Waits at most timeoutMs for the first
+     * event to arrive, or forever if timeoutMs is negative. Popped events are appended to
+     * [events] in order.
+     * Returns the number of events popped, which is 0 on timeout.
+     */
+    virtual size_t waitPopBatch(size_t maxSize, int64_t timeoutMs,
+                                std::vector<std::unique_ptr<LogEvent>>* events);
 
     /**
      * Puts a LogEvent ptr to the end of the queue.
-     * Returns false on failure when the queue is full, and output the oldest event timestamp
-     * in the queue.
+     * Returns false when events were dropped because the queue is full, and outputs the oldest
+     * event timestamp in the queue. If [droppedEvents] is not null, the dropped events are
+     * appended to it. Depending on the overflow policy, the dropped events may be queued ones
+     * rather than [event].
      */
-    bool push(std::unique_ptr<LogEvent> event, int64_t* oldestTimestampNs);
+    virtual bool push(std::unique_ptr<LogEvent> event, int64_t* oldestTimestampNs,
+                      std::vector<DroppedEvent>* droppedEvents = nullptr);
 
-private:
+    /**
+     * Puts a batch of LogEvent ptrs to the end of the queue, taking the lock only once.
+     * Events that do not fit are dropped according to the overflow policy. Returns the number of
+     * dropped events, and outputs the oldest event timestamp in the queue if any event was
+     * dropped. If [droppedEvents] is not null, the dropped events are appended to it.
+     * The input vector is cleared on return.
+     */
+    virtual size_t pushBatch(std::vector<std::unique_ptr<LogEvent>>* events,
+                             int64_t* oldestTimestampNs,
+                             std::vector<DroppedEvent>* droppedEvents = nullptr);
+
+    /**
+     * Current event capacity. Only differs from the max size in the byte budget mode.
+     */
+    size_t getCapacity();
+
+    /**
+     * Current number of queued events.
+     */
+    virtual size_t size();
+
+    /**
+     * Estimated heap bytes of the queued events: the events and their encoded atoms, which
+     * approximate their values.
+     */
+    virtual size_t getQueuedByteSize();
+
+protected:
     const size_t mQueueLimit;
+
+    const OverflowPolicy mOverflowPolicy;
+
+private:
+    // Backlog the event capacity is sized for in the byte budget mode.
+    static const int64_t kTargetBacklogNs = 2 * NS_PER_SEC;
+
+    // Minimum consumer busy time over which the drain rate is measured.
+    static const int64_t kDrainRateWindowNs = NS_PER_SEC;
+
+    // Maximum number of queued events evicted by one push with SHED_NOISIEST_UID.
+    static const size_t kMaxEvictionsPerPush = 2;
+
+    /**
+     * Pushes [event] with mMutex held. Returns the number of dropped events, which are appended
+     * to [droppedEvents].
+     */
+    size_t pushLocked(std::unique_ptr<LogEvent> event, std::vector<DroppedEvent>* droppedEvents);
+
+    bool isFullLocked(size_t incomingSizeBytes) const;
+
+    // Removes the oldest queued event of [uid] and returns its size.
+    size_t evictOldestLocked(int32_t uid);
+
+    std::unique_ptr<LogEvent> popLocked();
+
+    inline bool emptyLocked() const {
+        return mQueue.empty() && mPriorityQueue.empty() && mAppQueue.empty();
+    }
+
+    // Timestamp of the oldest queued event of the lanes that are not empty.
+    int64_t getOldestTimestampLocked() const;
+
+    // Updates the drain rate estimate after [count] events were popped at [nowNs], and adapts
+    // the capacity once a full window was observed.
+    void noteDrainLocked(int64_t nowNs, size_t count);
+
     std::condition_variable mCondition;
     std::mutex mMutex;
-    std::queue<std::unique_ptr<LogEvent>> mQueue;
+    std::deque<std::unique_ptr<LogEvent>> mQueue;
+
+    // Priority lane state, see setPriorityLane(). The capacity is 0 when the lane is disabled.
+    // The events of the lane count towards neither the capacity nor the byte budget of mQueue.
+    std::deque<std::unique_ptr<LogEvent>> mPriorityQueue;
+    std::unordered_set<int> mPriorityAtomIds;
+    size_t mPriorityCapacity = 0;
+
+    // App lane state, see setAppLane(). The capacity is 0 when the lane is disabled. Like the
+    // priority lane, its events don't count towards the limits of mQueue.
+    std::deque<std::unique_ptr<LogEvent>> mAppQueue;
+    size_t mAppCapacity = 0;
+
+    // Sum of getSizeBytes() of the events of the priority lane and the app lane.
+    size_t mLaneBytes = 0;
+
+    // Number of queued events per uid. Only maintained with SHED_NOISIEST_UID.
+    std::unordered_map<int32_t, size_t> mQueuedEventsPerUid;
+
+    // Current max number of queued events, at most mQueueLimit.
+    size_t mCapacity;
+
+    // Byte budget mode state. mMaxBytes is 0 when the mode is disabled.
+    size_t mMaxBytes = 0;
+    size_t mMinCapacity = 0;
+    size_t mQueuedBytes = 0;
+
+    // Drain rate measurement: the time between two pops counts as consumer busy time when the
+    // queue was not empty after the first one.
+    int64_t mLastPopNs = 0;
+    bool mBacklogged = false;
+    int64_t mBusyNs = 0;
+    size_t mBusyPops = 0;
+
+    FRIEND_TEST(LogEventQueue_test, TestByteBudgetAdaptsToDrainRate);
+    FRIEND_TEST(LogEventQueue_test, TestShedEvictsInSteps);
 };
 
 }  // namespace statsd
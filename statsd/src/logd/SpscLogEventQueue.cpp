@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "SpscLogEventQueue.h"
+#include "utils/ScopedTrace.h"
+
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unique_ptr;
+
+SpscLogEventQueue::SpscLogEventQueue(size_t maxSize)
+    : LogEventQueue(maxSize),
+      mSlots(maxSize),
+      mTimestamps(maxSize),
+      mHead(0),
+      mTail(0),
+      mConsumerIdle(false),
+      mEventFd(eventfd(0, EFD_CLOEXEC)) {
+    if (mEventFd < 0) {
+        ALOGE("Failed to create eventfd for the log event queue: %s", strerror(errno));
+    }
+}
+
+SpscLogEventQueue::~SpscLogEventQueue() {
+    if (mEventFd >= 0) {
+        close(mEventFd);
+    }
+}
+
+void SpscLogEventQueue::store(uint64_t pos, unique_ptr<LogEvent> event) {
+    const size_t index = pos % mQueueLimit;
+    mTimestamps[index] = event->GetElapsedTimestampNs();
+    mSlots[index] = std::move(event);
+}
+
+void SpscLogEventQueue::publish(uint64_t tail) {
+    // seq_cst store and load pair with the consumer's mConsumerIdle store and mTail load, so
+    // that either the consumer sees the new events, or the producer sees the consumer is idle.
+    mTail.store(tail, std::memory_order_seq_cst);
+    if (mConsumerIdle.load(std::memory_order_seq_cst) &&
+        mConsumerIdle.exchange(false, std::memory_order_seq_cst)) {
+        const uint64_t one = 1;
+        if (write(mEventFd, &one, sizeof(one)) < 0) {
+            ALOGE("Failed to wake up log event queue consumer: %s", strerror(errno));
+        }
+    }
+}
+
+void SpscLogEventQueue::setByteBudget(size_t /*maxBytes*/, size_t /*minCapacity*/) {
+    ALOGW("The byte budget mode is not supported by the lock-free queue");
+}
+
+void SpscLogEventQueue::setPriorityLane(const std::unordered_set<int>& /*atomIds*/,
+                                        size_t /*capacity*/) {
+    ALOGW("The priority lane is not supported by the lock-free queue");
+}
+
+bool SpscLogEventQueue::push(unique_ptr<LogEvent> event, int64_t* oldestTimestampNs,
+                             std::vector<DroppedEvent>* droppedEvents) {
+    const uint64_t tail = mTail.load(std::memory_order_relaxed);
+    const uint64_t head = mHead.load(std::memory_order_acquire);
+    if (tail - head >= mQueueLimit) {
+        // The slot at head is still owned by the consumer, but its timestamp is only written by
+        // the producer.
+        *oldestTimestampNs = mTimestamps[head % mQueueLimit];
+        if (droppedEvents != nullptr) {
+            droppedEvents->push_back({event->GetUid(), event->getSizeBytes()});
+        }
+        return false;
+    }
+
+    store(tail, std::move(event));
+    publish(tail + 1);
+    return true;
+}
+
+size_t SpscLogEventQueue::pushBatch(std::vector<unique_ptr<LogEvent>>* events,
+                                    int64_t* oldestTimestampNs,
+                                    std::vector<DroppedEvent>* droppedEvents) {
+    uint64_t tail = mTail.load(std::memory_order_relaxed);
+    const uint64_t head = mHead.load(std::memory_order_acquire);
+    size_t dropped = 0;
+    for (auto& event : *events) {
+        if (tail - head < mQueueLimit) {
+            store(tail++, std::move(event));
+        } else {
+            dropped++;
+            if (droppedEvents != nullptr) {
+                droppedEvents->push_back({event->GetUid(), event->getSizeBytes()});
+            }
+        }
+    }
+    if (dropped > 0) {
+        *oldestTimestampNs = mTimestamps[head % mQueueLimit];
+    }
+    events->clear();
+
+    publish(tail);
+    return dropped;
+}
+
+unique_ptr<LogEvent> SpscLogEventQueue::tryPop() {
+    const uint64_t head = mHead.load(std::memory_order_relaxed);
+    if (head == mTail.load(std::memory_order_seq_cst)) {
+        return nullptr;
+    }
+
+    unique_ptr<LogEvent> item = std::move(mSlots[head % mQueueLimit]);
+    mHead.store(head + 1, std::memory_order_release);
+    return item;
+}
+
+size_t SpscLogEventQueue::size() {
+    const uint64_t head = mHead.load(std::memory_order_acquire);
+    const uint64_t tail = mTail.load(std::memory_order_acquire);
+    return tail > head ? tail - head : 0;
+}
+
+size_t SpscLogEventQueue::getQueuedByteSize() {
+    return mSlots.size() * (sizeof(std::unique_ptr<LogEvent>) + sizeof(int64_t)) +
+           size() * sizeof(LogEvent);
+}
+
+bool SpscLogEventQueue::waitForEvents(int64_t timeoutMs) {
+    ScopedTrace trace("LogEventQueue::wait");
+    struct pollfd pfd = {mEventFd, POLLIN, 0};
+    int ret = poll(&pfd, 1, timeoutMs < 0 ? -1 : (int)timeoutMs);
+    if (ret < 0 && errno != EINTR) {
+        ALOGE("Failed to wait on the log event queue: %s", strerror(errno));
+    }
+    if (ret <= 0) {
+        return ret < 0;
+    }
+
+    uint64_t count;
+    if (read(mEventFd, &count, sizeof(count)) < 0 && errno != EINTR && errno != EAGAIN) {
+        ALOGE("Failed to read the log event queue eventfd: %s", strerror(errno));
+    }
+    return true;
+}
+
+unique_ptr<LogEvent> SpscLogEventQueue::waitPop() {
+    while (true) {
+        unique_ptr<LogEvent> item = tryPop();
+        if (item != nullptr) {
+            return item;
+        }
+
+        mConsumerIdle.store(true, std::memory_order_seq_cst);
+        // Re-check after announcing idleness, the producer may have published in between.
+        item = tryPop();
+        if (item != nullptr) {
+            // A wake up may still be delivered for this item, which only costs one extra
+            // iteration the next time the queue is empty.
+            mConsumerIdle.store(false, std::memory_order_relaxed);
+            return item;
+        }
+
+        waitForEvents(/*timeoutMs=*/-1);
+    }
+}
+
+size_t SpscLogEventQueue::waitPopBatch(size_t maxSize, int64_t timeoutMs,
+                                       std::vector<unique_ptr<LogEvent>>* events) {
+    size_t count = 0;
+    bool waited = false;
+    while (count < maxSize) {
+        unique_ptr<LogEvent> item = tryPop();
+        if (item != nullptr) {
+            events->push_back(std::move(item));
+            count++;
+            continue;
+        }
+        if (count > 0 || waited) {
+            break;
+        }
+
+        mConsumerIdle.store(true, std::memory_order_seq_cst);
+        item = tryPop();
+        if (item != nullptr) {
+            mConsumerIdle.store(false, std::memory_order_relaxed);
+            events->push_back(std::move(item));
+            count++;
+            continue;
+        }
+
+        // A negative timeout waits until the producer signals. A spurious wake up from a stale
+        // signal is retried, while a real timeout returns with no events.
+        if (!waitForEvents(timeoutMs)) {
+            mConsumerIdle.store(false, std::memory_order_relaxed);
+            break;
+        }
+        waited = timeoutMs >= 0;
+    }
+    return count;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "LogEventQueue.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * A bounded, preallocated single-producer/single-consumer LogEventQueue.
+ *
+ * Exactly one thread may push (the socket listener) and exactly one thread may pop (the log
+ * reader). Push and pop do not take a lock; the producer only signals the eventfd when the
+ * consumer has announced that it is about to block.
+ * Events can only be dropped at the tail, so the overflow policy is always DROP_NEWEST.
+ */
+class SpscLogEventQueue : public LogEventQueue {
+public:
+    explicit SpscLogEventQueue(size_t maxSize);
+
+    ~SpscLogEventQueue();
+
+    std::unique_ptr<LogEvent> waitPop() override;
+
+    size_t waitPopBatch(size_t maxSize, int64_t timeoutMs,
+                        std::vector<std::unique_ptr<LogEvent>>* events) override;
+
+    // The slots are preallocated, so the byte budget mode is not supported.
+    void setByteBudget(size_t maxBytes, size_t minCapacity) override;
+
+    // The producer and the consumer share a single ring, so the priority lane is not supported.
+    void setPriorityLane(const std::unordered_set<int>& atomIds, size_t capacity) override;
+
+    bool push(std::unique_ptr<LogEvent> event, int64_t* oldestTimestampNs,
+              std::vector<DroppedEvent>* droppedEvents = nullptr) override;
+
+    size_t pushBatch(std::vector<std::unique_ptr<LogEvent>>* events, int64_t* oldestTimestampNs,
+                     std::vector<DroppedEvent>* droppedEvents = nullptr) override;
+
+    size_t size() override;
+
+    // The queued events are owned by the consumer, so only the slots and the events themselves
+    // are counted.
+    size_t getQueuedByteSize() override;
+
+private:
+    // Stores the event in the next free slot. Must only be called by the producer when the queue
+    // is not full. The event is not visible to the consumer until publish() is called.
+    void store(uint64_t pos, std::unique_ptr<LogEvent> event);
+
+    // Makes all events stored before [tail] visible to the consumer, and wakes it up if idle.
+    void publish(uint64_t tail);
+
+    // Pops one event without blocking. Returns nullptr if the queue is empty.
+    std::unique_ptr<LogEvent> tryPop();
+
+    // Blocks until the producer signals new events, or until timeoutMs elapses if it is not
+    // negative. Returns false on timeout.
+    bool waitForEvents(int64_t timeoutMs);
+
+    // Event slots, indexed by position modulo mQueueLimit.
+    std::vector<std::unique_ptr<LogEvent>> mSlots;
+
+    // Elapsed timestamps of the events in mSlots. Only written and read by the producer, so that
+    // the oldest timestamp can be reported on overflow without touching the consumer's events.
+    std::vector<int64_t> mTimestamps;
+
+    // Position of the next event to pop. Written by the consumer only.
+    alignas(64) std::atomic<uint64_t> mHead;
+
+    // Position of the next event to push. Written by the producer only.
+    alignas(64) std::atomic<uint64_t> mTail;
+
+    // Set by the consumer before blocking on mEventFd.
+    alignas(64) std::atomic<bool> mConsumerIdle;
+
+    const int mEventFd;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "StringValueInterner.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::string_view;
+
+StringValueInterner::StringValueInterner(size_t numSlots, size_t maxLength)
+    : mMaxLength(maxLength) {
+    size_t size = 1;
+    while (size < numSlots) {
+        size <<= 1;
+    }
+    mSlots.resize(size);
+}
+
+sp<const ValuePayload> StringValueInterner::intern(string_view str) {
+    if (str.size() > mMaxLength) {
+        return nullptr;
+    }
+    const size_t hash = std::hash<string_view>()(str);
+    // mSlots.size() is a power of two.
+    const size_t slot = hash & (mSlots.size() - 1);
+
+    lock_guard<mutex> lock(mMutex);
+    sp<const ValuePayload>& payload = mSlots[slot];
+    if (payload != nullptr && payload->hash() == hash && payload->bytes() == str) {
+        mHitCount++;
+        return payload;
+    }
+    payload = new ValuePayload(string(str), hash);
+    return payload;
+}
+
+size_t StringValueInterner::getHitCount() const {
+    lock_guard<mutex> lock(mMutex);
+    return mHitCount;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
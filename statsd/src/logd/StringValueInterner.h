@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "FieldValue.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * A thread safe, fixed size cache of string payloads shared by the values parsed from different
+ * events, such as the tags of attribution chains and package names that most atoms of a uid
+ * repeat.
+ *
+ * The cache is direct mapped: each string hashes to one slot, and replaces the string that was
+ * in it. Values holding an interned string share its payload, so equal strings of different
+ * events compare by pointer and are not hashed again when building dimension keys.
+ */
+class StringValueInterner {
+public:
+    /**
+     * [numSlots] is rounded up to a power of two. Strings longer than [maxLength] are not
+     * interned.
+     */
+    StringValueInterner(size_t numSlots, size_t maxLength);
+
+    /**
+     * Returns the interned payload of [str], or nullptr if it is too long to be interned.
+     */
+    sp<const ValuePayload> intern(std::string_view str);
+
+    // Number of calls to intern() that found the string in the cache.
+    size_t getHitCount() const;
+
+private:
+    const size_t mMaxLength;
+
+    mutable std::mutex mMutex;
+
+    std::vector<sp<const ValuePayload>> mSlots;
+
+    size_t mHitCount = 0;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
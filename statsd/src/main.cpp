@@ -18,8 +18,21 @@
 #include "Log.h"
 
 #include "StatsService.h"
+#include "anomaly/DurationAnomalyTracker.h"
+#include "anomaly/subscriber_util.h"
+#include "external/Perfetto.h"
+#include "external/StatsPuller.h"
+#include "external/puller_util.h"
 #include "flags/FlagProvider.h"
+#include "logd/LogEventParsePlans.h"
+#include "logd/SpscLogEventQueue.h"
+#include "logd/StringValueInterner.h"
+#include "metrics/MetricsManager.h"
+#include "metrics/NumericValueMetricProducer.h"
 #include "socket/StatsSocketListener.h"
+#include "statslog_statsd.h"
+#include "storage/StorageManager.h"
+#include "utils/ThreadTopology.h"
 
 #include <android/binder_interface_utils.h>
 #include <android/binder_process.h>
@@ -39,6 +52,7 @@ using std::make_shared;
 
 shared_ptr<StatsService> gStatsService = nullptr;
 sp<StatsSocketListener> gSocketListener = nullptr;
+sp<StatsSocketListener> gAppSocketListener = nullptr;
 int gCtrlPipe[2];
 
 void signalHandler(int sig) {
@@ -72,14 +86,124 @@ int main(int /*argc*/, char** /*argv*/) {
     ABinderProcess_setThreadPoolMaxThreadCount(9);
     ABinderProcess_startThreadPool();
 
-    std::shared_ptr<LogEventQueue> eventQueue =
-            std::make_shared<LogEventQueue>(4000 /*buffer limit. Buffer is NOT pre-allocated*/);
-
     // Initialize boot flags
-    FlagProvider::getInstance().initBootFlags({});
+    FlagProvider::getInstance().initBootFlags(
+            {SOCKET_BATCH_READ_FLAG, LOCK_FREE_EVENT_QUEUE_FLAG, BATCHED_EVENT_PROCESSING_FLAG,
+             LOG_EVENT_POOL_FLAG, SHED_NOISIEST_UID_FLAG, DEFERRED_PARSE_FLAG,
+             PARALLEL_DISPATCH_FLAG, BYTE_BUDGET_EVENT_QUEUE_FLAG, SOCKET_RCVBUF_AUTOTUNE_FLAG,
+             LAZY_PARSE_FLAG, BUFFER_VIEW_VALUES_FLAG, INTERN_STRING_VALUES_FLAG,
+             PARSE_PLANS_FLAG, PARALLEL_PULLS_FLAG, HASH_UID_MERGE_FLAG,
+             ALIGNED_PULL_ALARMS_FLAG, ADAPTIVE_PULL_TIMEOUTS_FLAG,
+             DEFERRED_CONDITION_PULLS_FLAG, COALESCED_TRIGGER_PULLS_FLAG, DELTA_ENCODED_PULLS_FLAG,
+             COALESCED_ANOMALY_ALARMS_FLAG, ASYNC_SUBSCRIBERS_FLAG, VFORK_PERFETTO_LAUNCH_FLAG,
+             COMPRESSED_REPORTS_FLAG, CHECKPOINT_METRICS_FLAG, ASYNC_STORAGE_WRITES_FLAG,
+             PARALLEL_CONFIG_LOAD_FLAG, SHARED_MEMORY_RING_FLAG, PRIORITY_EVENT_LANE_FLAG,
+             PARALLEL_DUMP_FLAG, APP_INGEST_SOCKET_FLAG, BULK_PULL_DIFFS_FLAG});
+
+    // Before the threads and pools are created, which read it.
+    ThreadTopology::getInstance().setConfig(
+            FlagProvider::getInstance().getJavaFlagString(THREAD_TOPOLOGY_FLAG, FLAG_EMPTY));
+    MetricsManager::SetConfigCostBudget(
+            FlagProvider::getInstance().getJavaFlagString(CONFIG_COST_BUDGET_FLAG, FLAG_EMPTY));
+
+    if (FlagProvider::getInstance().getBootFlagBool(BUFFER_VIEW_VALUES_FLAG, FLAG_FALSE)) {
+        // Shorter fields are cheaper to copy than to share.
+        LogEvent::setBufferViewMinBytes(64);
+    }
+
+    if (FlagProvider::getInstance().getBootFlagBool(INTERN_STRING_VALUES_FLAG, FLAG_FALSE)) {
+        // Tags and package names are short, and a few hundred cover the busy uids.
+        LogEvent::setStringValueInterner(
+                std::make_shared<StringValueInterner>(1024 /*numSlots*/, 128 /*maxLength*/));
+    }
+
+    if (FlagProvider::getInstance().getBootFlagBool(PARSE_PLANS_FLAG, FLAG_FALSE)) {
+        LogEvent::setParsePlans(std::make_shared<LogEventParsePlans>(4096 /*numSlots*/));
+    }
+
+    if (FlagProvider::getInstance().getBootFlagBool(HASH_UID_MERGE_FLAG, FLAG_FALSE)) {
+        setHashMergeIsolatedUids(true);
+    }
+
+    if (FlagProvider::getInstance().getBootFlagBool(ADAPTIVE_PULL_TIMEOUTS_FLAG, FLAG_FALSE)) {
+        StatsPuller::SetAdaptiveTimeouts(true);
+    }
+
+    if (FlagProvider::getInstance().getBootFlagBool(DELTA_ENCODED_PULLS_FLAG, FLAG_FALSE)) {
+        StatsPuller::SetDeltaEncoding(true);
+    }
+
+    if (FlagProvider::getInstance().getBootFlagBool(BULK_PULL_DIFFS_FLAG, FLAG_FALSE)) {
+        NumericValueMetricProducer::SetBulkDiffs(true);
+    }
+
+    if (FlagProvider::getInstance().getBootFlagBool(COALESCED_ANOMALY_ALARMS_FLAG, FLAG_FALSE)) {
+        DurationAnomalyTracker::SetCoalescedAlarms(true);
+    }
+
+    if (FlagProvider::getInstance().getBootFlagBool(ASYNC_SUBSCRIBERS_FLAG, FLAG_FALSE)) {
+        // Anomalies are rare, a burst beyond this is dropped rather than queued.
+        setSubscriberTaskQueue(
+                std::make_shared<AsyncTaskQueue>(64 /*maxPendingTasks*/, "statsd.alerts"));
+    }
+
+    if (FlagProvider::getInstance().getBootFlagBool(VFORK_PERFETTO_LAUNCH_FLAG, FLAG_FALSE)) {
+        setPerfettoLaunchWithVfork(true);
+    }
+
+    if (FlagProvider::getInstance().getBootFlagBool(COMPRESSED_REPORTS_FLAG, FLAG_FALSE)) {
+        StorageManager::setCompressReports(true);
+    }
+
+    if (FlagProvider::getInstance().getBootFlagBool(ASYNC_STORAGE_WRITES_FLAG, FLAG_FALSE)) {
+        // A shutdown sweep writes a report per config; beyond this the writers wait.
+        StorageManager::setWriteQueue(
+                std::make_shared<AsyncTaskQueue>(64 /*maxPendingTasks*/, "statsd.storage"));
+    }
+
+    std::shared_ptr<LogEventQueue> eventQueue;
+    if (FlagProvider::getInstance().getBootFlagBool(LOCK_FREE_EVENT_QUEUE_FLAG, FLAG_FALSE)) {
+        eventQueue = std::make_shared<SpscLogEventQueue>(4000 /*buffer limit. Pre-allocated*/);
+    } else {
+        const LogEventQueue::OverflowPolicy overflowPolicy =
+                FlagProvider::getInstance().getBootFlagBool(SHED_NOISIEST_UID_FLAG, FLAG_FALSE)
+                        ? LogEventQueue::SHED_NOISIEST_UID
+                        : LogEventQueue::DROP_NEWEST;
+        if (FlagProvider::getInstance().getBootFlagBool(BYTE_BUDGET_EVENT_QUEUE_FLAG,
+                                                        FLAG_FALSE)) {
+            // The capacity adapts between 1000 and 16000 events; the byte budget bounds memory.
+            eventQueue = std::make_shared<LogEventQueue>(16000 /*max buffer limit*/,
+                                                         overflowPolicy);
+            eventQueue->setByteBudget(2 * 1024 * 1024 /*max bytes*/, 1000 /*min buffer limit*/);
+        } else {
+            eventQueue = std::make_shared<LogEventQueue>(
+                    4000 /*buffer limit. Buffer is NOT pre-allocated*/, overflowPolicy);
+        }
+        if (FlagProvider::getInstance().getBootFlagBool(PRIORITY_EVENT_LANE_FLAG, FLAG_FALSE)) {
+            eventQueue->setPriorityLane(
+                    {util::ISOLATED_UID_CHANGED, util::BINARY_PUSH_STATE_CHANGED,
+                     util::APP_BREADCRUMB_REPORTED},
+                    1000 /*priority buffer limit*/);
+        }
+        if (FlagProvider::getInstance().getBootFlagBool(APP_INGEST_SOCKET_FLAG, FLAG_FALSE)) {
+            eventQueue->setAppLane(4000 /*app buffer limit*/);
+        }
+    }
+
+    std::shared_ptr<LogEventPool> eventPool;
+    if (FlagProvider::getInstance().getBootFlagBool(LOG_EVENT_POOL_FLAG, FLAG_FALSE)) {
+        // Covers the events in flight in steady state. Bursts beyond that allocate new events.
+        eventPool = std::make_shared<LogEventPool>(1000 /*max pooled events*/);
+    }
+
+    std::shared_ptr<LogEventFilter> logEventFilter;
+    if (FlagProvider::getInstance().getBootFlagBool(LAZY_PARSE_FLAG, FLAG_FALSE)) {
+        logEventFilter = std::make_shared<LogEventFilter>();
+    }
 
     // Create the service
-    gStatsService = SharedRefBase::make<StatsService>(looper, eventQueue);
+    gStatsService =
+            SharedRefBase::make<StatsService>(looper, eventQueue, eventPool, logEventFilter);
     // TODO(b/149582373): Set DUMP_FLAG_PROTO once libbinder_ndk supports
     // setting dumpsys priorities.
     binder_status_t status = AServiceManager_addService(gStatsService->asBinder().get(), "stats");
@@ -92,7 +216,25 @@ int main(int /*argc*/, char** /*argv*/) {
 
     gStatsService->Startup();
 
-    gSocketListener = new StatsSocketListener(eventQueue);
+    const size_t batchReadSize =
+            FlagProvider::getInstance().getBootFlagBool(SOCKET_BATCH_READ_FLAG, FLAG_FALSE)
+                    ? StatsSocketListener::kDefaultBatchReadSize
+                    : 1;
+    std::shared_ptr<LogEventBufferSlab> bufferSlab;
+    if (FlagProvider::getInstance().getBootFlagBool(DEFERRED_PARSE_FLAG, FLAG_FALSE)) {
+        // About 1MB. Events received while all buffers are queued are parsed on the socket thread.
+        bufferSlab = std::make_shared<LogEventBufferSlab>(256 /*buffers*/,
+                                                          StatsSocketListener::kReadBufferSize);
+    }
+    const size_t maxReceiveBufferBytes =
+            FlagProvider::getInstance().getBootFlagBool(SOCKET_RCVBUF_AUTOTUNE_FLAG, FLAG_FALSE)
+                    ? 4 * 1024 * 1024
+                    : 0;
+    gSocketListener = new StatsSocketListener(eventQueue, batchReadSize, eventPool, bufferSlab,
+                                              maxReceiveBufferBytes, logEventFilter);
+    if (FlagProvider::getInstance().getBootFlagBool(SHARED_MEMORY_RING_FLAG, FLAG_FALSE)) {
+        gStatsService->setSocketListener(gSocketListener);
+    }
 
     ALOGI("Statsd starts to listen to socket.");
     // Backlog and /proc/sys/net/unix/max_dgram_qlen set to large value
@@ -100,6 +242,22 @@ int main(int /*argc*/, char** /*argv*/) {
         exit(1);
     }
 
+    const int appSocket = StatsSocketListener::getAppLogSocket();
+    if (appSocket >= 0) {
+        if (FlagProvider::getInstance().getBootFlagBool(APP_INGEST_SOCKET_FLAG, FLAG_FALSE) &&
+            !FlagProvider::getInstance().getBootFlagBool(LOCK_FREE_EVENT_QUEUE_FLAG, FLAG_FALSE)) {
+            gAppSocketListener =
+                    new StatsSocketListener(eventQueue, batchReadSize, eventPool, bufferSlab,
+                                            maxReceiveBufferBytes, logEventFilter, appSocket);
+            if (gAppSocketListener->startListener(600)) {
+                exit(1);
+            }
+        } else {
+            // The app clients are then refused, and write to the statsd socket instead.
+            close(appSocket);
+        }
+    }
+
     // Use self-pipe to notify this thread to gracefully quit
     // when receiving SIGTERM
     registerSignalHandlers();
@@ -111,6 +269,9 @@ int main(int /*argc*/, char** /*argv*/) {
                 if (errno == EINTR) continue;
             }
             gSocketListener->stopListener();
+            if (gAppSocketListener != nullptr) {
+                gAppSocketListener->stopListener();
+            }
             gStatsService->Terminate();
             exit(1);
         }
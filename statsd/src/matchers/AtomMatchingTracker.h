@@ -72,6 +72,19 @@ public:
                             const std::vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers,
                             std::vector<MatchingState>& matcherResults) = 0;
 
+    // Returns the indices of the matchers that this matcher combines. Empty for simple matchers.
+    virtual const std::vector<int>& getChildren() const {
+        static const std::vector<int> kNoChildren;
+        return kNoChildren;
+    }
+
+    // Non-recursive alternative to onLogEvent() for matchers with children, to be called once
+    // all the children were evaluated for the event. [matchedBits] is the bitset of the matchers
+    // that matched it; see MetricsManager::onLogEvent(), which evaluates in topological order.
+    virtual bool matchesChildren(const std::vector<uint64_t>& matchedBits) const {
+        return false;
+    }
+
     // Get the tagIds that this matcher cares about. The combined collection is stored
     // in MetricMananger, so that we can pass any LogEvents that are not interest of us. It uses
     // some memory but hopefully it can save us much CPU time when there is flood of events.
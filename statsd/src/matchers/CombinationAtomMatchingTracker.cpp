@@ -86,6 +86,7 @@ bool CombinationAtomMatchingTracker::init(
         const set<int>& childTagIds = allAtomMatchingTrackers[childIndex]->getAtomIds();
         mAtomIds.insert(childTagIds.begin(), childTagIds.end());
     }
+    mChildMask = makeMatcherMask(mChildren);
 
     mInitialized = true;
     // unmark this node in the recursion stack.
@@ -107,6 +108,7 @@ bool CombinationAtomMatchingTracker::onConfigUpdated(
         }
         mChildren.push_back(pair->second);
     }
+    mChildMask = makeMatcherMask(mChildren);
     return true;
 }
 
@@ -135,6 +137,10 @@ void CombinationAtomMatchingTracker::onLogEvent(
     matcherResults[mIndex] = matched ? MatchingState::kMatched : MatchingState::kNotMatched;
 }
 
+bool CombinationAtomMatchingTracker::matchesChildren(const vector<uint64_t>& matchedBits) const {
+    return combinationMatch(mChildMask, mLogicalOperation, matchedBits);
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -44,11 +44,20 @@ public:
                     const std::vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers,
                     std::vector<MatchingState>& matcherResults) override;
 
+    const std::vector<int>& getChildren() const override {
+        return mChildren;
+    }
+
+    bool matchesChildren(const std::vector<uint64_t>& matchedBits) const override;
+
 private:
     LogicalOperation mLogicalOperation;
 
     std::vector<int> mChildren;
 
+    // mChildren as a mask over the matcher bitsets, see matchesChildren().
+    MatcherMask mChildMask;
+
     FRIEND_TEST(ConfigUpdateTest, TestUpdateMatchers);
 };
 
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "SharedSimpleAtomMatcher.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::lock_guard;
+using std::make_pair;
+using std::shared_ptr;
+using std::string;
+
+SharedSimpleAtomMatcher::SharedSimpleAtomMatcher(const SimpleAtomMatcher& matcher,
+                                                 const sp<UidMap>& uidMap)
+    : mMatcher(compileSimpleAtomMatcher(matcher)),
+      mUidMap(uidMap),
+      mLastResult(0),
+      mEvaluationCount(0) {
+}
+
+bool SharedSimpleAtomMatcher::matches(const LogEvent& event) const {
+    const uint64_t matchId = event.getMatchId() << 1;
+    uint64_t lastResult = mLastResult.load(std::memory_order_relaxed);
+    if ((lastResult & ~1ULL) == matchId) {
+        return lastResult & 1;
+    }
+    lock_guard<std::mutex> lock(mMutex);
+    // Another config may have matched the event meanwhile.
+    lastResult = mLastResult.load(std::memory_order_relaxed);
+    if ((lastResult & ~1ULL) == matchId) {
+        return lastResult & 1;
+    }
+    const bool matched = matchesSimple(mUidMap, mMatcher, event);
+    mLastResult.store(matchId | (matched ? 1 : 0), std::memory_order_relaxed);
+    mEvaluationCount.fetch_add(1, std::memory_order_relaxed);
+    return matched;
+}
+
+SharedSimpleAtomMatcherRegistry& SharedSimpleAtomMatcherRegistry::getInstance() {
+    static SharedSimpleAtomMatcherRegistry registry;
+    return registry;
+}
+
+shared_ptr<SharedSimpleAtomMatcher> SharedSimpleAtomMatcherRegistry::get(
+        const SimpleAtomMatcher& matcher, const sp<UidMap>& uidMap) {
+    string serialized;
+    matcher.SerializeToString(&serialized);
+
+    lock_guard<std::mutex> lock(mMutex);
+    std::weak_ptr<SharedSimpleAtomMatcher>& entry =
+            mMatchers[make_pair(uidMap.get(), std::move(serialized))];
+    shared_ptr<SharedSimpleAtomMatcher> shared = entry.lock();
+    if (shared == nullptr) {
+        shared = std::make_shared<SharedSimpleAtomMatcher>(matcher, uidMap);
+        entry = shared;
+        // Prunes once the map doubled, so that config loads stay linear in the matchers.
+        if (mMatchers.size() >= 2 * mSizeAfterPrune) {
+            pruneLocked();
+        }
+    }
+    return shared;
+}
+
+size_t SharedSimpleAtomMatcherRegistry::size() const {
+    lock_guard<std::mutex> lock(mMutex);
+    size_t count = 0;
+    for (const auto& [key, entry] : mMatchers) {
+        if (!entry.expired()) {
+            count++;
+        }
+    }
+    return count;
+}
+
+void SharedSimpleAtomMatcherRegistry::pruneLocked() {
+    for (auto it = mMatchers.begin(); it != mMatchers.end();) {
+        if (it->second.expired()) {
+            it = mMatchers.erase(it);
+        } else {
+            it++;
+        }
+    }
+    mSizeAfterPrune = mMatchers.size();
+    VLOG("%zu shared simple atom matchers", mSizeAfterPrune);
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
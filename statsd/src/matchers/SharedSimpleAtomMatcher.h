@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <utils/RefBase.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "logd/LogEvent.h"
+#include "matchers/matcher_util.h"
+#include "packages/UidMap.h"
+#include "src/statsd_config.pb.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * A compiled SimpleAtomMatcher shared by all the identical matchers of the configs, see
+ * SharedSimpleAtomMatcherRegistry. The result for the last event is kept, so that an event is
+ * matched once however many configs define the matcher.
+ *
+ * With the parallel dispatch of StatsLogProcessor, the configs sharing a matcher match an event
+ * from several threads at once. This is safe: mLastResult holds the match id and the result in
+ * one atomic word, so a reader either gets the result for its own event or matches the event
+ * itself. Matching is serialized by mMutex, since the compiled matcher caches the uids it
+ * resolves, and a thread that waited for it finds the result of the thread that held it.
+ */
+class SharedSimpleAtomMatcher {
+public:
+    SharedSimpleAtomMatcher(const SimpleAtomMatcher& matcher, const sp<UidMap>& uidMap);
+
+    bool matches(const LogEvent& event) const;
+
+    // Number of events actually matched, i.e. not answered from the last result.
+    inline int64_t getEvaluationCount() const {
+        return mEvaluationCount.load(std::memory_order_relaxed);
+    }
+
+private:
+    const CompiledSimpleAtomMatcher mMatcher;
+    const sp<UidMap> mUidMap;
+
+    // LogEvent::getMatchId() of the last matched event shifted left by one, with the result in the
+    // low bit. 0 if no event was matched yet.
+    mutable std::atomic<uint64_t> mLastResult;
+
+    // Held while matching an event that is not the last one.
+    mutable std::mutex mMutex;
+
+    mutable std::atomic<int64_t> mEvaluationCount;
+};
+
+/**
+ * Process-wide registry deduplicating the SimpleAtomMatchers of all configs by content. Entries
+ * are not owned by the registry, they go away with the last tracker using them.
+ */
+class SharedSimpleAtomMatcherRegistry {
+public:
+    static SharedSimpleAtomMatcherRegistry& getInstance();
+
+    // Returns the shared matcher for [matcher] with [uidMap], creating it if needed.
+    std::shared_ptr<SharedSimpleAtomMatcher> get(const SimpleAtomMatcher& matcher,
+                                                 const sp<UidMap>& uidMap);
+
+    // Number of live shared matchers.
+    size_t size() const;
+
+private:
+    // Removes the entries whose matchers are gone. The caller must hold mMutex.
+    void pruneLocked();
+
+    mutable std::mutex mMutex;
+
+    // Keyed by uid map and serialized matcher. A live entry keeps its uid map alive, so the
+    // address can't be reused while the entry is found.
+    std::map<std::pair<const UidMap*, std::string>, std::weak_ptr<SharedSimpleAtomMatcher>>
+            mMatchers;
+
+    // Size of mMatchers after the last prune, see pruneLocked().
+    size_t mSizeAfterPrune = 0;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
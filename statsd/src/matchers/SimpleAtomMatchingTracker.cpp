@@ -30,7 +30,10 @@ SimpleAtomMatchingTracker::SimpleAtomMatchingTracker(const int64_t& id, const in
                                                      const uint64_t protoHash,
                                                      const SimpleAtomMatcher& matcher,
                                                      const sp<UidMap>& uidMap)
-    : AtomMatchingTracker(id, index, protoHash), mMatcher(matcher), mUidMap(uidMap) {
+    : AtomMatchingTracker(id, index, protoHash),
+      mMatcher(matcher),
+      mSharedMatcher(SharedSimpleAtomMatcherRegistry::getInstance().get(matcher, uidMap)),
+      mUidMap(uidMap) {
     if (!matcher.has_atom_id()) {
         mInitialized = false;
     } else {
@@ -71,7 +74,7 @@ void SimpleAtomMatchingTracker::onLogEvent(
         return;
     }
 
-    bool matched = matchesSimple(mUidMap, mMatcher, event);
+    bool matched = mSharedMatcher->matches(event);
     matcherResults[mIndex] = matched ? MatchingState::kMatched : MatchingState::kNotMatched;
     VLOG("Stats SimpleAtomMatcher %lld matched? %d", (long long)mId, matched);
 }
@@ -17,10 +17,12 @@
 #ifndef SIMPLE_ATOM_MATCHING_TRACKER_H
 #define SIMPLE_ATOM_MATCHING_TRACKER_H
 
+#include <memory>
 #include <unordered_map>
 #include <vector>
 
 #include "AtomMatchingTracker.h"
+#include "matchers/SharedSimpleAtomMatcher.h"
 #include "src/statsd_config.pb.h"
 #include "packages/UidMap.h"
 
@@ -49,6 +51,8 @@ public:
 
 private:
     const SimpleAtomMatcher mMatcher;
+    // mMatcher compiled for matching events, shared with the identical matchers of other configs.
+    const std::shared_ptr<SharedSimpleAtomMatcher> mSharedMatcher;
     const sp<UidMap> mUidMap;
 };
 
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "WildcardStringSet.h"
+
+#include <algorithm>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+bool WildcardStringSet::isValidPattern(string_view pattern) {
+    if (pattern.empty()) {
+        return false;
+    }
+    for (size_t i = 0; i < pattern.size(); i++) {
+        if (pattern[i] == '\\' && ++i == pattern.size()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool WildcardStringSet::add(string_view pattern) {
+    if (!isValidPattern(pattern)) {
+        return false;
+    }
+    vector<Token> tokens;
+    bool hasWildcard = false;
+    for (size_t i = 0; i < pattern.size(); i++) {
+        switch (pattern[i]) {
+            case '*':
+                // Consecutive '*' match the same as one.
+                if (tokens.empty() || tokens.back().kind != Token::ANY_SEQUENCE) {
+                    tokens.push_back({Token::ANY_SEQUENCE, 0});
+                }
+                hasWildcard = true;
+                break;
+            case '?':
+                tokens.push_back({Token::ANY_CHAR, 0});
+                hasWildcard = true;
+                break;
+            case '\\':
+                i++;
+                [[fallthrough]];
+            default:
+                tokens.push_back({Token::CHAR, pattern[i]});
+                break;
+        }
+    }
+
+    string literal;
+    auto literalEnd = hasWildcard ? tokens.end() - 1 : tokens.end();
+    const bool isLiteralOrPrefix =
+            std::all_of(tokens.begin(), literalEnd,
+                        [](const Token& token) { return token.kind == Token::CHAR; }) &&
+            (!hasWildcard || tokens.back().kind == Token::ANY_SEQUENCE);
+    if (!isLiteralOrPrefix) {
+        mPatterns.push_back(std::move(tokens));
+        return true;
+    }
+    for (auto it = tokens.begin(); it != literalEnd; it++) {
+        literal.push_back(it->c);
+    }
+    if (hasWildcard) {
+        addPrefix(literal);
+    } else {
+        auto it = std::lower_bound(mLiterals.begin(), mLiterals.end(), literal);
+        if (it == mLiterals.end() || *it != literal) {
+            mLiterals.insert(it, std::move(literal));
+        }
+    }
+    return true;
+}
+
+void WildcardStringSet::addPrefix(const string& prefix) {
+    uint32_t node = 0;
+    for (const char c : prefix) {
+        auto& children = mPrefixNodes[node].children;
+        auto it = std::lower_bound(children.begin(), children.end(), c,
+                                   [](const auto& child, char c) { return child.first < c; });
+        if (it != children.end() && it->first == c) {
+            node = it->second;
+            continue;
+        }
+        const uint32_t child = mPrefixNodes.size();
+        children.insert(it, {c, child});
+        // May reallocate mPrefixNodes, children is not used after this.
+        mPrefixNodes.emplace_back();
+        node = child;
+    }
+    mPrefixNodes[node].terminal = true;
+}
+
+bool WildcardStringSet::matches(string_view str) const {
+    if (std::binary_search(mLiterals.begin(), mLiterals.end(), str,
+                           [](string_view a, string_view b) { return a < b; })) {
+        return true;
+    }
+    if (matchesPrefix(str)) {
+        return true;
+    }
+    for (const auto& tokens : mPatterns) {
+        if (matchesTokens(tokens, str)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WildcardStringSet::matchesPrefix(string_view str) const {
+    uint32_t node = 0;
+    for (size_t i = 0;; i++) {
+        if (mPrefixNodes[node].terminal) {
+            return true;
+        }
+        if (i == str.size()) {
+            return false;
+        }
+        const auto& children = mPrefixNodes[node].children;
+        auto it = std::lower_bound(children.begin(), children.end(), str[i],
+                                   [](const auto& child, char c) { return child.first < c; });
+        if (it == children.end() || it->first != str[i]) {
+            return false;
+        }
+        node = it->second;
+    }
+}
+
+bool WildcardStringSet::matchesTokens(const vector<Token>& tokens, string_view str) {
+    // Greedy matching that only backtracks to the last '*': a later '*' can match anything an
+    // earlier one could, so this is linear in practice and O(tokens * str) at worst.
+    size_t t = 0;
+    size_t s = 0;
+    size_t starToken = tokens.size();
+    size_t starStr = 0;
+    while (s < str.size()) {
+        if (t < tokens.size() && tokens[t].kind == Token::ANY_SEQUENCE) {
+            starToken = t++;
+            starStr = s;
+        } else if (t < tokens.size() &&
+                   (tokens[t].kind == Token::ANY_CHAR || tokens[t].c == str[s])) {
+            t++;
+            s++;
+        } else if (starToken != tokens.size()) {
+            t = starToken + 1;
+            s = ++starStr;
+        } else {
+            return false;
+        }
+    }
+    while (t < tokens.size() && tokens[t].kind == Token::ANY_SEQUENCE) {
+        t++;
+    }
+    return t == tokens.size();
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * A set of wildcard patterns compiled for matching many strings. '*' matches any sequence of
+ * characters, '?' matches any single character, and '\' escapes the next character.
+ *
+ * Patterns are split by shape: literals are binary searched, patterns whose only wildcard is a
+ * trailing '*' (e.g. "com.vendor.*") are merged into a trie walked once per string, and the other
+ * patterns are matched one by one.
+ */
+class WildcardStringSet {
+public:
+    // Returns false for the patterns that add() rejects: empty ones and ones ending with a lone
+    // escape character.
+    static bool isValidPattern(std::string_view pattern);
+
+    // Adds [pattern] to the set. Returns false, and leaves the set unchanged, if it is invalid.
+    bool add(std::string_view pattern);
+
+    // Returns true if [str] matches any of the patterns.
+    bool matches(std::string_view str) const;
+
+    inline bool empty() const {
+        // "*" only marks the root of the trie.
+        return mLiterals.empty() && mPrefixNodes.size() <= 1 && !mPrefixNodes[0].terminal &&
+               mPatterns.empty();
+    }
+
+private:
+    struct Token {
+        enum Kind : uint8_t { CHAR, ANY_CHAR, ANY_SEQUENCE };
+        Kind kind;
+        char c;
+    };
+
+    struct PrefixNode {
+        // Sorted by character.
+        std::vector<std::pair<char, uint32_t>> children;
+        // True if a prefix pattern ends at this node.
+        bool terminal = false;
+    };
+
+    static bool matchesTokens(const std::vector<Token>& tokens, std::string_view str);
+
+    void addPrefix(const std::string& prefix);
+
+    bool matchesPrefix(std::string_view str) const;
+
+    // Sorted, without duplicates.
+    std::vector<std::string> mLiterals;
+
+    // The root is mPrefixNodes[0].
+    std::vector<PrefixNode> mPrefixNodes = std::vector<PrefixNode>(1);
+
+    std::vector<std::vector<Token>> mPatterns;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -21,6 +21,8 @@
 #include "matchers/matcher_util.h"
 #include "stats_util.h"
 
+#include <map>
+
 using std::set;
 using std::string;
 using std::vector;
@@ -81,24 +83,253 @@ bool combinationMatch(const vector<int>& children, const LogicalOperation& opera
     return matched;
 }
 
-bool tryMatchString(const sp<UidMap>& uidMap, const FieldValue& fieldValue,
-                    const string& str_match) {
+MatcherMask makeMatcherMask(const vector<int>& indices) {
+    std::map<int, uint64_t> words;
+    for (const int index : indices) {
+        words[index >> 6] |= 1ULL << (index & 63);
+    }
+    return MatcherMask(words.begin(), words.end());
+}
+
+bool combinationMatch(const MatcherMask& children, const LogicalOperation& operation,
+                      const vector<uint64_t>& matchedBits) {
+    switch (operation) {
+        case LogicalOperation::AND:
+        case LogicalOperation::NAND: {
+            bool allMatched = true;
+            for (const auto& [word, bits] : children) {
+                if ((matchedBits[word] & bits) != bits) {
+                    allMatched = false;
+                    break;
+                }
+            }
+            return operation == LogicalOperation::AND ? allMatched : !allMatched;
+        }
+        case LogicalOperation::OR:
+        case LogicalOperation::NOR:
+        // NOT has a single child.
+        case LogicalOperation::NOT: {
+            bool anyMatched = false;
+            for (const auto& [word, bits] : children) {
+                if ((matchedBits[word] & bits) != 0) {
+                    anyMatched = true;
+                    break;
+                }
+            }
+            return operation == LogicalOperation::OR ? anyMatched : !anyMatched;
+        }
+        case LogicalOperation::LOGICAL_OPERATION_UNSPECIFIED:
+            return false;
+    }
+    return false;
+}
+
+namespace {
+
+// The field index built for the events without one, see matchesSimple(). Kept across events so
+// that its capacity is reused.
+thread_local vector<int32_t> tLocalFieldIndex;
+
+CompiledFieldValueMatcher compileFieldValueMatcher(const FieldValueMatcher& matcher) {
+    CompiledFieldValueMatcher compiled;
+    compiled.field = matcher.field();
+    compiled.hasPosition = matcher.has_position();
+    compiled.position = matcher.position();
+    auto addStrings = [&compiled](const StringListMatcher& list) {
+        for (const auto& str : list.str_value()) {
+            compiled.strings.emplace_back(str);
+        }
+    };
+    switch (matcher.value_matcher_case()) {
+        case FieldValueMatcher::kMatchesTuple:
+            compiled.op = CompiledFieldValueMatcher::MATCHES_TUPLE;
+            for (const auto& subMatcher : matcher.matches_tuple().field_value_matcher()) {
+                compiled.children.push_back(compileFieldValueMatcher(subMatcher));
+            }
+            break;
+        case FieldValueMatcher::kEqBool:
+            compiled.op = CompiledFieldValueMatcher::EQ_BOOL;
+            compiled.boolValue = matcher.eq_bool();
+            break;
+        case FieldValueMatcher::kEqString:
+            compiled.op = CompiledFieldValueMatcher::EQ_ANY_STRING;
+            compiled.strings.emplace_back(matcher.eq_string());
+            break;
+        case FieldValueMatcher::kNeqAnyString:
+            compiled.op = CompiledFieldValueMatcher::NEQ_ANY_STRING;
+            addStrings(matcher.neq_any_string());
+            break;
+        case FieldValueMatcher::kEqAnyString:
+            compiled.op = CompiledFieldValueMatcher::EQ_ANY_STRING;
+            addStrings(matcher.eq_any_string());
+            break;
+        case FieldValueMatcher::kEqWildcardString:
+            compiled.op = CompiledFieldValueMatcher::EQ_ANY_WILDCARD_STRING;
+            compiled.wildcards.add(matcher.eq_wildcard_string());
+            break;
+        case FieldValueMatcher::kEqAnyWildcardString:
+            compiled.op = CompiledFieldValueMatcher::EQ_ANY_WILDCARD_STRING;
+            for (const auto& pattern : matcher.eq_any_wildcard_string().str_value()) {
+                compiled.wildcards.add(pattern);
+            }
+            break;
+        case FieldValueMatcher::kNeqAnyWildcardString:
+            compiled.op = CompiledFieldValueMatcher::NEQ_ANY_WILDCARD_STRING;
+            for (const auto& pattern : matcher.neq_any_wildcard_string().str_value()) {
+                compiled.wildcards.add(pattern);
+            }
+            break;
+        case FieldValueMatcher::kEqInt:
+            compiled.op = CompiledFieldValueMatcher::EQ_INT;
+            compiled.intValue = matcher.eq_int();
+            break;
+        case FieldValueMatcher::kLtInt:
+            compiled.op = CompiledFieldValueMatcher::LT_INT;
+            compiled.intValue = matcher.lt_int();
+            break;
+        case FieldValueMatcher::kGtInt:
+            compiled.op = CompiledFieldValueMatcher::GT_INT;
+            compiled.intValue = matcher.gt_int();
+            break;
+        case FieldValueMatcher::kLteInt:
+            compiled.op = CompiledFieldValueMatcher::LTE_INT;
+            compiled.intValue = matcher.lte_int();
+            break;
+        case FieldValueMatcher::kGteInt:
+            compiled.op = CompiledFieldValueMatcher::GTE_INT;
+            compiled.intValue = matcher.gte_int();
+            break;
+        case FieldValueMatcher::kLtFloat:
+            compiled.op = CompiledFieldValueMatcher::LT_FLOAT;
+            compiled.floatValue = matcher.lt_float();
+            break;
+        case FieldValueMatcher::kGtFloat:
+            compiled.op = CompiledFieldValueMatcher::GT_FLOAT;
+            compiled.floatValue = matcher.gt_float();
+            break;
+        default:
+            compiled.op = CompiledFieldValueMatcher::NONE;
+            break;
+    }
+    if (compiled.strings.size() >= CompiledFieldValueMatcher::kMinIndexedStrings) {
+        for (size_t i = 0; i < compiled.strings.size(); i++) {
+            compiled.stringIndices.emplace(std::hash<std::string_view>()(compiled.strings[i].str),
+                                           i);
+        }
+    }
+    return compiled;
+}
+
+bool isValidFieldValueMatcher(const FieldValueMatcher& matcher) {
+    auto isValidList = [](const StringListMatcher& list) {
+        for (const auto& pattern : list.str_value()) {
+            if (!WildcardStringSet::isValidPattern(pattern)) {
+                return false;
+            }
+        }
+        return true;
+    };
+    switch (matcher.value_matcher_case()) {
+        case FieldValueMatcher::kMatchesTuple:
+            for (const auto& subMatcher : matcher.matches_tuple().field_value_matcher()) {
+                if (!isValidFieldValueMatcher(subMatcher)) {
+                    return false;
+                }
+            }
+            return true;
+        case FieldValueMatcher::kEqWildcardString:
+            return WildcardStringSet::isValidPattern(matcher.eq_wildcard_string());
+        case FieldValueMatcher::kEqAnyWildcardString:
+            return isValidList(matcher.eq_any_wildcard_string());
+        case FieldValueMatcher::kNeqAnyWildcardString:
+            return isValidList(matcher.neq_any_wildcard_string());
+        default:
+            return true;
+    }
+}
+
+// Returns true if [fieldValue] matches any of the wildcards of [matcher].
+bool tryMatchAnyWildcard(const sp<UidMap>& uidMap, const FieldValue& fieldValue,
+                         const CompiledFieldValueMatcher& matcher) {
     if (isAttributionUidField(fieldValue) || isUidField(fieldValue)) {
-        int uid = fieldValue.mValue.int_value;
-        auto aidIt = UidMap::sAidToUidMapping.find(str_match);
-        if (aidIt != UidMap::sAidToUidMapping.end()) {
-            return ((int)aidIt->second) == uid;
+        const uint64_t version = uidMap->getPackageMapVersion();
+        if (matcher.uidsVersion != version) {
+            matcher.uids = uidMap->getUidsMatchingNormalizedAppName(
+                    [&matcher](const string& name) { return matcher.wildcards.matches(name); });
+            for (const auto& [aidName, aidUid] : UidMap::sAidToUidMapping) {
+                if (matcher.wildcards.matches(aidName)) {
+                    matcher.uids.insert((int)aidUid);
+                }
+            }
+            matcher.uidsVersion = version;
+        }
+        return matcher.uids.find(fieldValue.mValue.int_value) != matcher.uids.end();
+    } else if (fieldValue.mValue.getType() == STRING) {
+        return matcher.wildcards.matches(fieldValue.mValue.getView());
+    }
+    return false;
+}
+
+// Returns true if [fieldValue] matches any of the strings of [matcher].
+bool tryMatchAnyString(const sp<UidMap>& uidMap, const FieldValue& fieldValue,
+                       const CompiledFieldValueMatcher& matcher) {
+    if (isAttributionUidField(fieldValue) || isUidField(fieldValue)) {
+        const uint64_t version = uidMap->getPackageMapVersion();
+        if (matcher.uidsVersion != version) {
+            std::unordered_set<string> packageNames;
+            matcher.uids.clear();
+            for (const auto& str : matcher.strings) {
+                if (str.aidUid.has_value()) {
+                    matcher.uids.insert(*str.aidUid);
+                } else {
+                    packageNames.insert(str.str);
+                }
+            }
+            if (!packageNames.empty()) {
+                std::unordered_set<int32_t> packageUids =
+                        uidMap->getUidsFromNormalizedAppNames(packageNames);
+                matcher.uids.insert(packageUids.begin(), packageUids.end());
+            }
+            matcher.uidsVersion = version;
         }
-        std::set<string> packageNames = uidMap->getAppNamesFromUid(uid, true /* normalize*/);
-        return packageNames.find(str_match) != packageNames.end();
+        return matcher.uids.find(fieldValue.mValue.int_value) != matcher.uids.end();
     } else if (fieldValue.mValue.getType() == STRING) {
-        return fieldValue.mValue.str_value == str_match;
+        const std::string_view view = fieldValue.mValue.getView();
+        if (matcher.stringIndices.empty()) {
+            for (const auto& str : matcher.strings) {
+                if (view == str.str) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        auto range = matcher.stringIndices.equal_range(std::hash<std::string_view>()(view));
+        for (auto it = range.first; it != range.second; it++) {
+            if (view == matcher.strings[it->second].str) {
+                return true;
+            }
+        }
     }
     return false;
 }
 
-bool matchesSimple(const sp<UidMap>& uidMap, const FieldValueMatcher& matcher,
-                   const vector<FieldValue>& values, int start, int end, int depth) {
+// Returns the int or long value of [value] in [*out], or false for other types.
+inline bool getIntegerValue(const Value& value, int64_t* out) {
+    if (value.getType() == INT) {
+        *out = value.int_value;
+        return true;
+    }
+    if (value.getType() == LONG) {
+        *out = value.long_value;
+        return true;
+    }
+    return false;
+}
+
+// [fields] holds the encoded fields of [values], see LogEvent::getFieldIndex().
+bool matchesSimple(const sp<UidMap>& uidMap, const CompiledFieldValueMatcher& matcher,
+                   const vector<FieldValue>& values, const int32_t* fields, int start, int end,
+                   int depth) {
     if (depth > 2) {
         ALOGE("Depth > 3 not supported");
         return false;
@@ -109,236 +340,201 @@ bool matchesSimple(const sp<UidMap>& uidMap, const FieldValueMatcher& matcher,
     }
 
     // Filter by entry field first
-    int newStart = -1;
-    int newEnd = end;
-    // because the fields are naturally sorted in the DFS order. we can safely
-    // break when pos is larger than the one we are searching for.
-    for (int i = start; i < end; i++) {
-        int pos = values[i].mField.getPosAtDepth(depth);
-        if (pos == matcher.field()) {
-            if (newStart == -1) {
-                newStart = i;
-            }
-            newEnd = i + 1;
-        } else if (pos > matcher.field()) {
-            break;
-        }
+    // because the fields are naturally sorted in the DFS order, the matching fields form a
+    // contiguous range.
+    int newStart;
+    int newEnd;
+    if (!findPosRange(fields, start, end, depth, matcher.field, &newStart, &newEnd)) {
+        // No such field found.
+        return false;
     }
 
     // Now we have zoomed in to a new range
     start = newStart;
     end = newEnd;
 
-    if (start == -1) {
-        // No such field found.
-        return false;
-    }
-
-    vector<pair<int, int>> ranges; // the ranges are for matching ANY position
-    if (matcher.has_position()) {
+    // False if the position doesn't select any sub tree for tuple matching.
+    bool hasRanges = true;
+    if (matcher.hasPosition) {
         // Repeated fields position is stored as a node in the path.
         depth++;
         if (depth > 2) {
             return false;
         }
-        switch (matcher.position()) {
+        switch (matcher.position) {
             case Position::FIRST: {
-                for (int i = start; i < end; i++) {
-                    int pos = values[i].mField.getPosAtDepth(depth);
-                    if (pos != 1) {
-                        // Again, the log elements are stored in sorted order. so
-                        // once the position is > 1, we break;
-                        end = i;
-                        break;
-                    }
+                // Again, the log elements are stored in sorted order. so the range ends with
+                // the last field at position 1.
+                int first;
+                int last;
+                if (findPosRange(fields, start, end, depth, 1, &first, &last) && first == start) {
+                    end = last;
+                } else {
+                    end = start;
                 }
-                ranges.push_back(std::make_pair(start, end));
                 break;
             }
             case Position::LAST: {
                 // move the starting index to the first LAST field at the depth.
                 for (int i = start; i < end; i++) {
-                    if (values[i].mField.isLastPos(depth)) {
+                    if (Field(0, fields[i]).isLastPos(depth)) {
                         start = i;
                         break;
                     }
                 }
-                ranges.push_back(std::make_pair(start, end));
                 break;
             }
-            case Position::ANY: {
-                // ANY means all the children matchers match in any of the sub trees, it's a match
-                newStart = start;
-                newEnd = end;
-                // Here start is guaranteed to be a valid index.
-                int currentPos = values[start].mField.getPosAtDepth(depth);
-                // Now find all sub trees ranges.
-                for (int i = start; i < end; i++) {
-                    int newPos = values[i].mField.getPosAtDepth(depth);
-                    if (newPos != currentPos) {
-                        ranges.push_back(std::make_pair(newStart, i));
-                        newStart = i;
-                        currentPos = newPos;
-                    }
-                }
-                ranges.push_back(std::make_pair(newStart, end));
+            case Position::ANY:
+                // The sub trees are split below, only tuples need them.
                 break;
-            }
             case Position::ALL:
                 ALOGE("Not supported: field matcher with ALL position.");
+                hasRanges = false;
                 break;
             case Position::POSITION_UNKNOWN:
+                hasRanges = false;
                 break;
         }
-    } else {
-        // No position
-        ranges.push_back(std::make_pair(start, end));
     }
     // start and end are still pointing to the matched range.
-    switch (matcher.value_matcher_case()) {
-        case FieldValueMatcher::kMatchesTuple: {
-            ++depth;
-            // If any range matches all matchers, good.
-            for (const auto& range : ranges) {
-                bool matched = true;
-                for (const auto& subMatcher : matcher.matches_tuple().field_value_matcher()) {
-                    if (!matchesSimple(uidMap, subMatcher, values, range.first, range.second,
-                                       depth)) {
-                        matched = false;
-                        break;
+    switch (matcher.op) {
+        case CompiledFieldValueMatcher::MATCHES_TUPLE: {
+            if (!hasRanges) {
+                return false;
+            }
+            const int childDepth = depth + 1;
+            auto matchesAllChildren = [&](int rangeStart, int rangeEnd) {
+                for (const auto& child : matcher.children) {
+                    if (!matchesSimple(uidMap, child, values, fields, rangeStart, rangeEnd,
+                                       childDepth)) {
+                        return false;
                     }
                 }
-                if (matched) return true;
+                return true;
+            };
+            if (!matcher.hasPosition || matcher.position != Position::ANY) {
+                return matchesAllChildren(start, end);
             }
-            return false;
+            // ANY means all the children matchers match in any of the sub trees, it's a match.
+            // Here start is guaranteed to be a valid index.
+            int rangeStart = start;
+            int currentPos = Field(0, fields[start]).getPosAtDepth(depth);
+            for (int i = start; i < end; i++) {
+                int newPos = Field(0, fields[i]).getPosAtDepth(depth);
+                if (newPos != currentPos) {
+                    if (matchesAllChildren(rangeStart, i)) {
+                        return true;
+                    }
+                    rangeStart = i;
+                    currentPos = newPos;
+                }
+            }
+            return matchesAllChildren(rangeStart, end);
         }
         // Finally, we get to the point of real value matching.
         // If the field matcher ends with ANY, then we have [start, end) range > 1.
         // In the following, we should return true, when ANY of the values matches.
-        case FieldValueMatcher::ValueMatcherCase::kEqBool: {
+        case CompiledFieldValueMatcher::EQ_BOOL: {
             for (int i = start; i < end; i++) {
-                if ((values[i].mValue.getType() == INT &&
-                     (values[i].mValue.int_value != 0) == matcher.eq_bool()) ||
-                    (values[i].mValue.getType() == LONG &&
-                     (values[i].mValue.long_value != 0) == matcher.eq_bool())) {
+                int64_t value;
+                if (getIntegerValue(values[i].mValue, &value) &&
+                    (value != 0) == matcher.boolValue) {
                     return true;
                 }
             }
             return false;
         }
-        case FieldValueMatcher::ValueMatcherCase::kEqString: {
+        case CompiledFieldValueMatcher::EQ_ANY_STRING: {
             for (int i = start; i < end; i++) {
-                if (tryMatchString(uidMap, values[i], matcher.eq_string())) {
+                if (tryMatchAnyString(uidMap, values[i], matcher)) {
                     return true;
                 }
             }
             return false;
         }
-        case FieldValueMatcher::ValueMatcherCase::kNeqAnyString: {
-            const auto& str_list = matcher.neq_any_string();
+        case CompiledFieldValueMatcher::NEQ_ANY_STRING: {
             for (int i = start; i < end; i++) {
-                for (const auto& str : str_list.str_value()) {
-                    if (tryMatchString(uidMap, values[i], str)) {
-                        return false;
-                    }
+                if (tryMatchAnyString(uidMap, values[i], matcher)) {
+                    return false;
                 }
             }
             return true;
         }
-        case FieldValueMatcher::ValueMatcherCase::kEqAnyString: {
-            const auto& str_list = matcher.eq_any_string();
+        case CompiledFieldValueMatcher::EQ_ANY_WILDCARD_STRING: {
             for (int i = start; i < end; i++) {
-                for (const auto& str : str_list.str_value()) {
-                    if (tryMatchString(uidMap, values[i], str)) {
-                        return true;
-                    }
+                if (tryMatchAnyWildcard(uidMap, values[i], matcher)) {
+                    return true;
                 }
             }
             return false;
         }
-        case FieldValueMatcher::ValueMatcherCase::kEqInt: {
+        case CompiledFieldValueMatcher::NEQ_ANY_WILDCARD_STRING: {
             for (int i = start; i < end; i++) {
-                if (values[i].mValue.getType() == INT &&
-                    (matcher.eq_int() == values[i].mValue.int_value)) {
-                    return true;
+                if (tryMatchAnyWildcard(uidMap, values[i], matcher)) {
+                    return false;
                 }
-                // eq_int covers both int and long.
-                if (values[i].mValue.getType() == LONG &&
-                    (matcher.eq_int() == values[i].mValue.long_value)) {
+            }
+            return true;
+        }
+        // The int matchers cover both int and long values.
+        case CompiledFieldValueMatcher::EQ_INT: {
+            for (int i = start; i < end; i++) {
+                int64_t value;
+                if (getIntegerValue(values[i].mValue, &value) && value == matcher.intValue) {
                     return true;
                 }
             }
             return false;
         }
-        case FieldValueMatcher::ValueMatcherCase::kLtInt: {
+        case CompiledFieldValueMatcher::LT_INT: {
             for (int i = start; i < end; i++) {
-                if (values[i].mValue.getType() == INT &&
-                    (values[i].mValue.int_value < matcher.lt_int())) {
-                    return true;
-                }
-                // lt_int covers both int and long.
-                if (values[i].mValue.getType() == LONG &&
-                    (values[i].mValue.long_value < matcher.lt_int())) {
+                int64_t value;
+                if (getIntegerValue(values[i].mValue, &value) && value < matcher.intValue) {
                     return true;
                 }
             }
             return false;
         }
-        case FieldValueMatcher::ValueMatcherCase::kGtInt: {
+        case CompiledFieldValueMatcher::GT_INT: {
             for (int i = start; i < end; i++) {
-                if (values[i].mValue.getType() == INT &&
-                    (values[i].mValue.int_value > matcher.gt_int())) {
-                    return true;
-                }
-                // gt_int covers both int and long.
-                if (values[i].mValue.getType() == LONG &&
-                    (values[i].mValue.long_value > matcher.gt_int())) {
+                int64_t value;
+                if (getIntegerValue(values[i].mValue, &value) && value > matcher.intValue) {
                     return true;
                 }
             }
             return false;
         }
-        case FieldValueMatcher::ValueMatcherCase::kLtFloat: {
+        case CompiledFieldValueMatcher::LTE_INT: {
             for (int i = start; i < end; i++) {
-                if (values[i].mValue.getType() == FLOAT &&
-                    (values[i].mValue.float_value < matcher.lt_float())) {
+                int64_t value;
+                if (getIntegerValue(values[i].mValue, &value) && value <= matcher.intValue) {
                     return true;
                 }
             }
             return false;
         }
-        case FieldValueMatcher::ValueMatcherCase::kGtFloat: {
+        case CompiledFieldValueMatcher::GTE_INT: {
             for (int i = start; i < end; i++) {
-                if (values[i].mValue.getType() == FLOAT &&
-                    (values[i].mValue.float_value > matcher.gt_float())) {
+                int64_t value;
+                if (getIntegerValue(values[i].mValue, &value) && value >= matcher.intValue) {
                     return true;
                 }
             }
             return false;
         }
-        case FieldValueMatcher::ValueMatcherCase::kLteInt: {
+        case CompiledFieldValueMatcher::LT_FLOAT: {
             for (int i = start; i < end; i++) {
-                if (values[i].mValue.getType() == INT &&
-                    (values[i].mValue.int_value <= matcher.lte_int())) {
-                    return true;
-                }
-                // lte_int covers both int and long.
-                if (values[i].mValue.getType() == LONG &&
-                    (values[i].mValue.long_value <= matcher.lte_int())) {
+                if (values[i].mValue.getType() == FLOAT &&
+                    (values[i].mValue.float_value < matcher.floatValue)) {
                     return true;
                 }
             }
             return false;
         }
-        case FieldValueMatcher::ValueMatcherCase::kGteInt: {
+        case CompiledFieldValueMatcher::GT_FLOAT: {
             for (int i = start; i < end; i++) {
-                if (values[i].mValue.getType() == INT &&
-                    (values[i].mValue.int_value >= matcher.gte_int())) {
-                    return true;
-                }
-                // gte_int covers both int and long.
-                if (values[i].mValue.getType() == LONG &&
-                    (values[i].mValue.long_value >= matcher.gte_int())) {
+                if (values[i].mValue.getType() == FLOAT &&
+                    (values[i].mValue.float_value > matcher.floatValue)) {
                     return true;
                 }
             }
@@ -349,20 +545,65 @@ bool matchesSimple(const sp<UidMap>& uidMap, const FieldValueMatcher& matcher,
     }
 }
 
-bool matchesSimple(const sp<UidMap>& uidMap, const SimpleAtomMatcher& simpleMatcher,
+}  // anonymous namespace
+
+CompiledFieldValueMatcher::String::String(const string& str) : str(str) {
+    auto aidIt = UidMap::sAidToUidMapping.find(str);
+    if (aidIt != UidMap::sAidToUidMapping.end()) {
+        aidUid = (int)aidIt->second;
+    }
+}
+
+bool isValidSimpleAtomMatcher(const SimpleAtomMatcher& simpleMatcher) {
+    for (const auto& matcher : simpleMatcher.field_value_matcher()) {
+        if (!isValidFieldValueMatcher(matcher)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+CompiledSimpleAtomMatcher compileSimpleAtomMatcher(const SimpleAtomMatcher& simpleMatcher) {
+    CompiledSimpleAtomMatcher compiled;
+    compiled.atomId = simpleMatcher.atom_id();
+    for (const auto& matcher : simpleMatcher.field_value_matcher()) {
+        compiled.matchers.push_back(compileFieldValueMatcher(matcher));
+    }
+    return compiled;
+}
+
+bool matchesSimple(const sp<UidMap>& uidMap, const CompiledSimpleAtomMatcher& simpleMatcher,
                    const LogEvent& event) {
-    if (event.GetTagId() != simpleMatcher.atom_id()) {
+    if (event.GetTagId() != simpleMatcher.atomId) {
         return false;
     }
 
-    for (const auto& matcher : simpleMatcher.field_value_matcher()) {
-        if (!matchesSimple(uidMap, matcher, event.getValues(), 0, event.getValues().size(), 0)) {
+    const vector<FieldValue>& values = event.getValues();
+    const int32_t* fields = event.getFieldIndex();
+    if (fields == nullptr && !simpleMatcher.matchers.empty()) {
+        tLocalFieldIndex.resize(values.size());
+        for (size_t i = 0; i < values.size(); i++) {
+            tLocalFieldIndex[i] = values[i].mField.getField();
+        }
+        fields = tLocalFieldIndex.data();
+    }
+
+    for (const auto& matcher : simpleMatcher.matchers) {
+        if (!matchesSimple(uidMap, matcher, values, fields, 0, values.size(), 0)) {
             return false;
         }
     }
     return true;
 }
 
+bool matchesSimple(const sp<UidMap>& uidMap, const SimpleAtomMatcher& simpleMatcher,
+                   const LogEvent& event) {
+    if (event.GetTagId() != simpleMatcher.atom_id()) {
+        return false;
+    }
+    return matchesSimple(uidMap, compileSimpleAtomMatcher(simpleMatcher), event);
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -18,10 +18,17 @@
 
 #include "logd/LogEvent.h"
 
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 #include "src/statsd_config.pb.h"
 #include "packages/UidMap.h"
 #include "stats_util.h"
+#include "matchers/WildcardStringSet.h"
 
 namespace android {
 namespace os {
@@ -36,6 +43,99 @@ enum MatchingState {
 bool combinationMatch(const std::vector<int>& children, const LogicalOperation& operation,
                       const std::vector<MatchingState>& matcherResults);
 
+// A set of matcher indices as (word index, bits) pairs over a bitset of all the matchers, in
+// increasing word order. See makeMatcherMask().
+typedef std::vector<std::pair<int, uint64_t>> MatcherMask;
+
+MatcherMask makeMatcherMask(const std::vector<int>& indices);
+
+inline void setMatcherBit(std::vector<uint64_t>& bits, int index) {
+    bits[index >> 6] |= 1ULL << (index & 63);
+}
+
+// Same as the other combinationMatch() with the matched children given by [matchedBits], the
+// bitset of the matchers that matched. Evaluated a word at a time.
+bool combinationMatch(const MatcherMask& children, const LogicalOperation& operation,
+                      const std::vector<uint64_t>& matchedBits);
+
+/**
+ * A FieldValueMatcher with its oneof and positions resolved into plain members, so that matching
+ * an event doesn't go through the protobuf accessors. See compileSimpleAtomMatcher().
+ */
+struct CompiledFieldValueMatcher {
+    enum Op : uint8_t {
+        NONE,
+        MATCHES_TUPLE,
+        EQ_BOOL,
+        // eq_string is compiled as an eq_any_string of one string.
+        EQ_ANY_STRING,
+        NEQ_ANY_STRING,
+        // eq_wildcard_string is compiled as an eq_any_wildcard_string of one pattern.
+        EQ_ANY_WILDCARD_STRING,
+        NEQ_ANY_WILDCARD_STRING,
+        EQ_INT,
+        LT_INT,
+        GT_INT,
+        LTE_INT,
+        GTE_INT,
+        LT_FLOAT,
+        GT_FLOAT,
+    };
+
+    // A string to match, with the uid it names if it is an AID name like "AID_SYSTEM".
+    struct String {
+        explicit String(const std::string& str);
+
+        std::string str;
+        std::optional<int32_t> aidUid;
+    };
+
+    // String lists at least this long are looked up through stringIndices.
+    static const size_t kMinIndexedStrings = 8;
+
+    int32_t field = 0;
+    bool hasPosition = false;
+    Position position = Position::POSITION_UNKNOWN;
+    Op op = NONE;
+
+    int64_t intValue = 0;
+    float floatValue = 0;
+    bool boolValue = false;
+    std::vector<String> strings;
+
+    // Maps the std::hash<std::string_view> of each string to its index in strings. Empty for
+    // lists shorter than kMinIndexedStrings, which are scanned.
+    std::unordered_multimap<size_t, size_t> stringIndices;
+
+    // The patterns of the wildcard ops.
+    WildcardStringSet wildcards;
+
+    // The uids matching any of the strings or wildcards, as AID names or package names. Resolved
+    // from the uid map when a uid field is first matched and again whenever the package map
+    // version changes. A compiled matcher is meant to be used with one uid map. Matching may
+    // update these, so the matching of a compiled matcher used by several threads must be
+    // serialized, as SharedSimpleAtomMatcher does.
+    mutable std::unordered_set<int32_t> uids;
+    mutable std::optional<uint64_t> uidsVersion;
+
+    // The matchers of a tuple.
+    std::vector<CompiledFieldValueMatcher> children;
+};
+
+struct CompiledSimpleAtomMatcher {
+    int32_t atomId = 0;
+    std::vector<CompiledFieldValueMatcher> matchers;
+};
+
+// Returns false if [simpleMatcher] can't be compiled, i.e. it has an invalid wildcard pattern.
+bool isValidSimpleAtomMatcher(const SimpleAtomMatcher& simpleMatcher);
+
+CompiledSimpleAtomMatcher compileSimpleAtomMatcher(const SimpleAtomMatcher& simpleMatcher);
+
+bool matchesSimple(const sp<UidMap>& uidMap, const CompiledSimpleAtomMatcher& simpleMatcher,
+                   const LogEvent& event);
+
+// Compiles [simpleMatcher] for every call, prefer the compiled version for repeated matching.
 bool matchesSimple(const sp<UidMap>& uidMap, const SimpleAtomMatcher& simpleMatcher,
                    const LogEvent& wrapper);
 
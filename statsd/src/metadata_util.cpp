@@ -39,10 +39,10 @@ void writeValueToProto(metadata::FieldValue* metadataFieldValue, const Value& va
             metadataFieldValue->set_value_double(value.double_value);
             break;
         case STRING:
-            metadataFieldValue->set_value_str(value.str_value.c_str());
+            metadataFieldValue->set_value_str(value.getString().c_str());
             break;
         case STORAGE: // byte array
-            storage_value = ((char*) value.storage_value.data());
+            storage_value = ((char*) value.getStorage().data());
             metadataFieldValue->set_value_storage(storage_value);
             break;
         default:
@@ -19,6 +19,7 @@
 
 #include "CountMetricProducer.h"
 
+#include <algorithm>
 #include <inttypes.h>
 #include <limits.h>
 #include <stdlib.h>
@@ -66,6 +67,7 @@ const int FIELD_ID_COUNT = 3;
 const int FIELD_ID_BUCKET_NUM = 4;
 const int FIELD_ID_START_BUCKET_ELAPSED_MILLIS = 5;
 const int FIELD_ID_END_BUCKET_ELAPSED_MILLIS = 6;
+const int FIELD_ID_COUNT_ERROR = 7;
 
 CountMetricProducer::CountMetricProducer(
         const ConfigKey& key, const CountMetric& metric, const int conditionIndex,
@@ -77,7 +79,9 @@ CountMetricProducer::CountMetricProducer(
         const unordered_map<int, unordered_map<int, int64_t>>& stateGroupMap)
     : MetricProducer(metric.id(), key, timeBaseNs, conditionIndex, initialConditionCache, wizard,
                      protoHash, eventActivationMap, eventDeactivationMap, slicedStateAtoms,
-                     stateGroupMap, getAppUpgradeBucketSplit(metric)) {
+                     stateGroupMap, getAppUpgradeBucketSplit(metric)),
+      mMaxHeavyHitters(std::min(std::max(metric.max_heavy_hitters(), 0),
+                                StatsdStats::kDimensionKeySizeHardLimit)) {
     if (metric.has_bucket()) {
         mBucketSizeNs =
                 TimeUnitToBucketSizeInMillisGuardrailed(key.GetUid(), metric.bucket()) * 1000000;
@@ -203,11 +207,16 @@ void CountMetricProducer::clearPastBucketsLocked(const int64_t dumpTimeNs) {
     mPastBuckets.clear();
 }
 
+void CountMetricProducer::setDimensionKeyTableLocked(
+        const sp<MetricDimensionKeyTable>& keyTable) {
+    mPastBuckets.setKeyTable(keyTable);
+}
+
 void CountMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
                                              const bool include_current_partial_bucket,
                                              const bool erase_data,
                                              const DumpLatency dumpLatency,
-                                             std::set<string> *str_set,
+                                             ReportStrings* str_set,
                                              ProtoOutputStream* protoOutput) {
     if (include_current_partial_bucket) {
         flushLocked(dumpTimeNs);
@@ -236,8 +245,8 @@ void CountMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
 
     uint64_t protoToken = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_ID_COUNT_METRICS);
 
-    for (const auto& counter : mPastBuckets) {
-        const MetricDimensionKey& dimensionKey = counter.first;
+    for (const auto& [dimensionId, dimensionCounts] : mPastBuckets.getDimensions()) {
+        const MetricDimensionKey& dimensionKey = mPastBuckets.getKey(dimensionId);
         VLOG("  dimension key %s", dimensionKey.toString().c_str());
 
         uint64_t wrapperToken =
@@ -245,13 +254,12 @@ void CountMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
 
         // First fill dimension.
         if (mShouldUseNestedDimensions) {
-            uint64_t dimensionToken = protoOutput->start(
-                    FIELD_TYPE_MESSAGE | FIELD_ID_DIMENSION_IN_WHAT);
-            writeDimensionToProto(dimensionKey.getDimensionKeyInWhat(), str_set, protoOutput);
-            protoOutput->end(dimensionToken);
+            mDimensionProtoCache.writeDimension(dimensionKey.getDimensionKeyInWhat(),
+                                                FIELD_ID_DIMENSION_IN_WHAT, str_set, protoOutput);
         } else {
-            writeDimensionLeafNodesToProto(dimensionKey.getDimensionKeyInWhat(),
-                                           FIELD_ID_DIMENSION_LEAF_IN_WHAT, str_set, protoOutput);
+            mDimensionProtoCache.writeDimensionLeafNodes(dimensionKey.getDimensionKeyInWhat(),
+                                                         FIELD_ID_DIMENSION_LEAF_IN_WHAT, str_set,
+                                                         protoOutput);
         }
         // Then fill slice_by_state.
         for (auto state : dimensionKey.getStateValuesKey().getValues()) {
@@ -261,23 +269,32 @@ void CountMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
             protoOutput->end(stateToken);
         }
         // Then fill bucket_info (CountBucketInfo).
-        for (const auto& bucket : counter.second) {
+        for (size_t i = 0; i < dimensionCounts.counts.size(); i++) {
+            const int64_t bucketStartNs =
+                    mPastBuckets.getBucketStartNs(dimensionCounts.bucketIndices[i]);
+            const int64_t bucketEndNs =
+                    mPastBuckets.getBucketEndNs(dimensionCounts.bucketIndices[i]);
+            const int64_t count = dimensionCounts.counts[i];
+            const int64_t error = dimensionCounts.errors.empty() ? 0 : dimensionCounts.errors[i];
             uint64_t bucketInfoToken = protoOutput->start(
                     FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_BUCKET_INFO);
             // Partial bucket.
-            if (bucket.mBucketEndNs - bucket.mBucketStartNs != mBucketSizeNs) {
+            if (bucketEndNs - bucketStartNs != mBucketSizeNs) {
                 protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_START_BUCKET_ELAPSED_MILLIS,
-                                   (long long)NanoToMillis(bucket.mBucketStartNs));
+                                   (long long)NanoToMillis(bucketStartNs));
                 protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_END_BUCKET_ELAPSED_MILLIS,
-                                   (long long)NanoToMillis(bucket.mBucketEndNs));
+                                   (long long)NanoToMillis(bucketEndNs));
             } else {
                 protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_BUCKET_NUM,
-                                   (long long)(getBucketNumFromEndTimeNs(bucket.mBucketEndNs)));
+                                   (long long)(getBucketNumFromEndTimeNs(bucketEndNs)));
+            }
+            protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_COUNT, (long long)count);
+            if (error > 0) {
+                protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_COUNT_ERROR, (long long)error);
             }
-            protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_COUNT, (long long)bucket.mCount);
             protoOutput->end(bucketInfoToken);
-            VLOG("\t bucket [%lld - %lld] count: %lld", (long long)bucket.mBucketStartNs,
-                 (long long)bucket.mBucketEndNs, (long long)bucket.mCount);
+            VLOG("\t bucket [%lld - %lld] count: %lld", (long long)bucketStartNs,
+                 (long long)bucketEndNs, (long long)count);
         }
         protoOutput->end(wrapperToken);
     }
@@ -295,6 +312,14 @@ void CountMetricProducer::dropDataLocked(const int64_t dropTimeNs) {
     mPastBuckets.clear();
 }
 
+void CountMetricProducer::releaseIdleMemoryLocked() {
+    mCurrentSlicedCounterPool.clear();
+}
+
+void CountMetricProducer::rollUpPastBucketsLocked(const int64_t rollupEndNs) {
+    mPastBuckets.rollUp(rollupEndNs, mTimeBaseNs, mRollupBucketSizeNs);
+}
+
 void CountMetricProducer::onConditionChangedLocked(const bool conditionMet,
                                                    const int64_t eventTime) {
     VLOG("Metric %lld onConditionChanged", (long long)mMetricId);
@@ -309,8 +334,13 @@ bool CountMetricProducer::hitGuardRailLocked(const MetricDimensionKey& newKey) {
     // 1. Report the tuple count if the tuple count > soft limit
     if (mCurrentSlicedCounter->size() > StatsdStats::kDimensionKeySizeSoftLimit - 1) {
         size_t newTupleCount = mCurrentSlicedCounter->size() + 1;
+        if (mMaxHeavyHitters > 0) {
+            // The new key replaces a heavy hitter once they are full.
+            newTupleCount = std::min(newTupleCount, mMaxHeavyHitters);
+        }
         StatsdStats::getInstance().noteMetricDimensionSize(mConfigKey, mMetricId, newTupleCount);
         // 2. Don't add more tuples, we are above the allowed threshold. Drop the data.
+        // The heavy hitters never exceed the hard limit.
         if (newTupleCount > StatsdStats::kDimensionKeySizeHardLimit) {
             ALOGE("CountMetric %lld dropping data for dimension key %s",
                 (long long)mMetricId, newKey.toString().c_str());
@@ -322,10 +352,25 @@ bool CountMetricProducer::hitGuardRailLocked(const MetricDimensionKey& newKey) {
     return false;
 }
 
+void CountMetricProducer::evictLowestCountLocked(const MetricDimensionKey& newKey) {
+    const auto [lowestCount, lowestKey] = *mHeavyHitterCounts.begin();
+    mHeavyHitterCounts.erase(mHeavyHitterCounts.begin());
+    VLOG("CountMetric %lld evicting %s with count %lld", (long long)mMetricId,
+         lowestKey->toString().c_str(), (long long)lowestCount);
+    mCurrentCountErrors.erase(*lowestKey);
+    // Reuses the node of the evicted dimension.
+    DimToValMap::node_type node = mCurrentSlicedCounter->extract(*lowestKey);
+    node.key() = newKey;
+    node.mapped() = lowestCount + 1;
+    const auto inserted = mCurrentSlicedCounter->insert(std::move(node));
+    mHeavyHitterCounts.emplace(lowestCount + 1, &inserted.position->first);
+    mCurrentCountErrors[newKey] = lowestCount;
+}
+
 void CountMetricProducer::onMatchedLogEventInternalLocked(
         const size_t matcherIndex, const MetricDimensionKey& eventKey,
         const ConditionKey& conditionKey, bool condition, const LogEvent& event,
-        const map<int, HashableDimensionKey>& statePrimaryKeys) {
+        const vector<HashableDimensionKey>& statePrimaryKeys) {
     int64_t eventTimeNs = event.GetElapsedTimestampNs();
     flushIfNeededLocked(eventTimeNs);
 
@@ -339,11 +384,22 @@ void CountMetricProducer::onMatchedLogEventInternalLocked(
         if (hitGuardRailLocked(eventKey)) {
             return;
         }
-        // create a counter for the new key
-        (*mCurrentSlicedCounter)[eventKey] = 1;
+        if (mMaxHeavyHitters > 0 && mCurrentSlicedCounter->size() >= mMaxHeavyHitters) {
+            evictLowestCountLocked(eventKey);
+        } else {
+            // create a counter for the new key
+            mCurrentSlicedCounterPool.get(*mCurrentSlicedCounter, eventKey) = 1;
+            if (mMaxHeavyHitters > 0) {
+                mHeavyHitterCounts.emplace(1, &mCurrentSlicedCounter->find(eventKey)->first);
+            }
+        }
     } else {
         // increment the existing value
         auto& count = it->second;
+        if (mMaxHeavyHitters > 0) {
+            mHeavyHitterCounts.erase({count, &it->first});
+            mHeavyHitterCounts.emplace(count + 1, &it->first);
+        }
         count++;
     }
     for (auto& tracker : mAnomalyTrackers) {
@@ -401,18 +457,13 @@ bool CountMetricProducer::countPassesThreshold(const int64_t& count) {
 void CountMetricProducer::flushCurrentBucketLocked(const int64_t& eventTimeNs,
                                                    const int64_t& nextBucketStartTimeNs) {
     int64_t fullBucketEndTimeNs = getCurrentBucketEndTimeNs();
-    CountBucket info;
-    info.mBucketStartNs = mCurrentBucketStartTimeNs;
-    if (eventTimeNs < fullBucketEndTimeNs) {
-        info.mBucketEndNs = eventTimeNs;
-    } else {
-        info.mBucketEndNs = fullBucketEndTimeNs;
-    }
+    const int64_t bucketEndNs = std::min(eventTimeNs, fullBucketEndTimeNs);
     for (const auto& counter : *mCurrentSlicedCounter) {
         if (countPassesThreshold(counter.second)) {
-            info.mCount = counter.second;
-            auto& bucketList = mPastBuckets[counter.first];
-            bucketList.push_back(info);
+            const auto error = mCurrentCountErrors.find(counter.first);
+            mPastBuckets.addCount(counter.first, mCurrentBucketStartTimeNs, bucketEndNs,
+                                  counter.second,
+                                  error == mCurrentCountErrors.end() ? 0 : error->second);
             VLOG("metric %lld, dump key value: %s -> %lld", (long long)mMetricId,
                  counter.first.toString().c_str(), (long long)counter.second);
         }
@@ -445,24 +496,177 @@ void CountMetricProducer::flushCurrentBucketLocked(const int64_t& eventTimeNs,
         }
     }
 
+    mCurrentCountErrors.clear();
+    mHeavyHitterCounts.clear();
     StatsdStats::getInstance().noteBucketCount(mMetricId);
     // Only resets the counters, but doesn't setup the times nor numbers.
-    // (Do not clear since the old one is still referenced in mAnomalyTrackers).
-    mCurrentSlicedCounter = std::make_shared<DimToValMap>();
+    // (Do not clear if the old one is still referenced in mAnomalyTrackers).
+    if (mAnomalyTrackers.empty()) {
+        mCurrentSlicedCounterPool.recycle(*mCurrentSlicedCounter);
+    } else {
+        const size_t dimensionCount = mCurrentSlicedCounter->size();
+        mCurrentSlicedCounter = std::make_shared<DimToValMap>();
+        mCurrentSlicedCounter->reserve(dimensionCount);
+    }
     mCurrentBucketStartTimeNs = nextBucketStartTimeNs;
+    rollUpPastBucketsIfNeededLocked(eventTimeNs);
 }
 
 // Rough estimate of CountMetricProducer buffer stored. This number will be
 // greater than actual data size as it contains each dimension of
 // CountMetricData is  duplicated.
 size_t CountMetricProducer::byteSizeLocked() const {
+    return mPastBuckets.byteSize();
+}
+
+size_t CountMetricProducer::currentBucketByteSizeLocked() const {
     size_t totalSize = 0;
-    for (const auto& pair : mPastBuckets) {
-        totalSize += pair.second.size() * kBucketSize;
+    for (const DimToValMap* counts :
+         {mCurrentSlicedCounter.get(), mCurrentFullCounters.get(), &mCurrentCountErrors}) {
+        for (const auto& [key, _] : *counts) {
+            totalSize += hashMapEntryByteSize(key, sizeof(int64_t));
+        }
     }
+    // A tree node holds three pointers and a color besides the value.
+    totalSize += mHeavyHitterCounts.size() *
+                 (sizeof(decltype(mHeavyHitterCounts)::value_type) + 4 * sizeof(void*));
     return totalSize;
 }
 
+CountPastBuckets::CountPastBuckets() : mKeyTable(new MetricDimensionKeyTable()) {
+}
+
+CountPastBuckets::~CountPastBuckets() {
+    clear();
+}
+
+void CountPastBuckets::setKeyTable(const sp<MetricDimensionKeyTable>& keyTable) {
+    if (keyTable == mKeyTable) {
+        return;
+    }
+    std::unordered_map<uint32_t, DimensionCounts> dimensions;
+    for (auto& [dimensionId, dimensionCounts] : mDimensions) {
+        dimensions[keyTable->acquire(mKeyTable->getKey(dimensionId))] = std::move(dimensionCounts);
+        mKeyTable->release(dimensionId);
+    }
+    mDimensions = std::move(dimensions);
+    mKeyTable = keyTable;
+}
+
+void CountPastBuckets::addCount(const MetricDimensionKey& key, const int64_t bucketStartNs,
+                                const int64_t bucketEndNs, const int64_t count,
+                                const int64_t error) {
+    if (mBucketStartNs.empty() || mBucketStartNs.back() != bucketStartNs ||
+        mBucketEndNs.back() != bucketEndNs) {
+        mBucketStartNs.push_back(bucketStartNs);
+        mBucketEndNs.push_back(bucketEndNs);
+    }
+    const uint32_t dimensionId = mKeyTable->acquire(key);
+    auto [it, inserted] = mDimensions.try_emplace(dimensionId);
+    if (!inserted) {
+        mKeyTable->release(dimensionId);
+    }
+    DimensionCounts& dimensionCounts = it->second;
+    dimensionCounts.bucketIndices.push_back(mBucketStartNs.size() - 1);
+    dimensionCounts.counts.push_back(count);
+    mCountSize++;
+    if (error != 0 || !dimensionCounts.errors.empty()) {
+        mErrorSize += dimensionCounts.counts.size() - dimensionCounts.errors.size();
+        dimensionCounts.errors.resize(dimensionCounts.counts.size());
+        dimensionCounts.errors.back() = error;
+    }
+}
+
+void CountPastBuckets::rollUp(const int64_t endNs, const int64_t timeBaseNs,
+                              const int64_t bucketSizeNs) {
+    // The index of each bucket among the merged buckets.
+    vector<uint32_t> mergedIndices(mBucketStartNs.size());
+    vector<int64_t> mergedStartNs;
+    vector<int64_t> mergedEndNs;
+    int64_t lastRollupBucketNum = -1;
+    for (size_t i = 0; i < mBucketStartNs.size(); i++) {
+        const int64_t rollupBucketNum =
+                mBucketEndNs[i] <= endNs ? (mBucketStartNs[i] - timeBaseNs) / bucketSizeNs : -1;
+        if (rollupBucketNum >= 0 && rollupBucketNum == lastRollupBucketNum) {
+            mergedEndNs.back() = mBucketEndNs[i];
+        } else {
+            mergedStartNs.push_back(mBucketStartNs[i]);
+            mergedEndNs.push_back(mBucketEndNs[i]);
+        }
+        lastRollupBucketNum = rollupBucketNum;
+        mergedIndices[i] = mergedStartNs.size() - 1;
+    }
+    if (mergedStartNs.size() == mBucketStartNs.size()) {
+        return;
+    }
+    mBucketStartNs = std::move(mergedStartNs);
+    mBucketEndNs = std::move(mergedEndNs);
+
+    for (auto& [dimensionId, dimensionCounts] : mDimensions) {
+        const bool hasErrors = !dimensionCounts.errors.empty();
+        size_t size = 0;
+        for (size_t i = 0; i < dimensionCounts.counts.size(); i++) {
+            const uint32_t bucketIndex = mergedIndices[dimensionCounts.bucketIndices[i]];
+            if (size > 0 && dimensionCounts.bucketIndices[size - 1] == bucketIndex) {
+                dimensionCounts.counts[size - 1] += dimensionCounts.counts[i];
+                if (hasErrors) {
+                    dimensionCounts.errors[size - 1] += dimensionCounts.errors[i];
+                }
+                continue;
+            }
+            dimensionCounts.bucketIndices[size] = bucketIndex;
+            dimensionCounts.counts[size] = dimensionCounts.counts[i];
+            if (hasErrors) {
+                dimensionCounts.errors[size] = dimensionCounts.errors[i];
+            }
+            size++;
+        }
+        mCountSize -= dimensionCounts.counts.size() - size;
+        dimensionCounts.bucketIndices.resize(size);
+        dimensionCounts.counts.resize(size);
+        if (hasErrors) {
+            mErrorSize -= dimensionCounts.errors.size() - size;
+            dimensionCounts.errors.resize(size);
+        }
+    }
+}
+
+vector<CountBucket> CountPastBuckets::getBuckets(const MetricDimensionKey& key) const {
+    vector<CountBucket> buckets;
+    uint32_t dimensionId;
+    if (!mKeyTable->find(key, &dimensionId)) {
+        return buckets;
+    }
+    const auto it = mDimensions.find(dimensionId);
+    if (it == mDimensions.end()) {
+        return buckets;
+    }
+    const DimensionCounts& dimensionCounts = it->second;
+    for (size_t i = 0; i < dimensionCounts.counts.size(); i++) {
+        const uint32_t bucketIndex = dimensionCounts.bucketIndices[i];
+        buckets.push_back({mBucketStartNs[bucketIndex], mBucketEndNs[bucketIndex],
+                           dimensionCounts.counts[i],
+                           dimensionCounts.errors.empty() ? 0 : dimensionCounts.errors[i]});
+    }
+    return buckets;
+}
+
+void CountPastBuckets::clear() {
+    for (const auto& [dimensionId, dimensionCounts] : mDimensions) {
+        mKeyTable->release(dimensionId);
+    }
+    mBucketStartNs.clear();
+    mBucketEndNs.clear();
+    mDimensions.clear();
+    mCountSize = 0;
+    mErrorSize = 0;
+}
+
+size_t CountPastBuckets::byteSize() const {
+    return mBucketStartNs.size() * 2 * sizeof(int64_t) +
+           mCountSize * (sizeof(uint32_t) + sizeof(int64_t)) + mErrorSize * sizeof(int64_t);
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -20,14 +20,17 @@
 #include <android/util/ProtoOutputStream.h>
 #include <gtest/gtest_prod.h>
 
+#include <set>
 #include <unordered_map>
 
 #include "MetricProducer.h"
 #include "anomaly/AnomalyTracker.h"
 #include "condition/ConditionTracker.h"
+#include "metrics/MetricDimensionKeyTable.h"
 #include "src/statsd_config.pb.h"
 #include "matchers/matcher_util.h"
 #include "stats_util.h"
+#include "utils/MapNodePool.h"
 
 namespace android {
 namespace os {
@@ -37,6 +40,99 @@ struct CountBucket {
     int64_t mBucketStartNs;
     int64_t mBucketEndNs;
     int64_t mCount;
+    // With CountMetric.max_heavy_hitters, how much mCount may exceed the actual count.
+    int64_t mError = 0;
+};
+
+/**
+ * The past buckets of a count metric, stored by column. The bucket boundaries are shared by all
+ * the dimensions, so they are stored once, and each dimension stores its counts along with the
+ * index of their bucket: a dimension is missing from the buckets where it had no events or did not
+ * pass the upload threshold.
+ *
+ * The dimensions are stored by their id in a MetricDimensionKeyTable, which the metrics of a
+ * config share.
+ */
+class CountPastBuckets {
+public:
+    CountPastBuckets();
+
+    ~CountPastBuckets();
+
+    CountPastBuckets(const CountPastBuckets&) = delete;
+    CountPastBuckets& operator=(const CountPastBuckets&) = delete;
+
+    // The counts of one dimension, from the oldest bucket. The errors of the counts are only
+    // stored once one of them is not 0.
+    struct DimensionCounts {
+        std::vector<uint32_t> bucketIndices;
+        std::vector<int64_t> counts;
+        std::vector<int64_t> errors;
+    };
+
+    // Moves the dimension keys to [keyTable].
+    void setKeyTable(const sp<MetricDimensionKeyTable>& keyTable);
+
+    // Adds the [count] of [key] in the bucket [bucketStartNs, bucketEndNs), which must be the last
+    // bucket added if it is not a new one. [error] is how much [count] may be over.
+    void addCount(const MetricDimensionKey& key, const int64_t bucketStartNs,
+                  const int64_t bucketEndNs, const int64_t count, const int64_t error = 0);
+
+    // Merges the buckets that end by [endNs] and start in the same bucket of [bucketSizeNs] from
+    // [timeBaseNs], summing the counts and errors of each dimension.
+    void rollUp(const int64_t endNs, const int64_t timeBaseNs, const int64_t bucketSizeNs);
+
+    // Returns the buckets of [key], from the oldest.
+    std::vector<CountBucket> getBuckets(const MetricDimensionKey& key) const;
+
+    // The counts by dimension id, see getKey().
+    inline const std::unordered_map<uint32_t, DimensionCounts>& getDimensions() const {
+        return mDimensions;
+    }
+
+    inline const MetricDimensionKey& getKey(const uint32_t dimensionId) const {
+        return mKeyTable->getKey(dimensionId);
+    }
+
+    inline int64_t getBucketStartNs(const uint32_t bucketIndex) const {
+        return mBucketStartNs[bucketIndex];
+    }
+
+    inline int64_t getBucketEndNs(const uint32_t bucketIndex) const {
+        return mBucketEndNs[bucketIndex];
+    }
+
+    inline bool contains(const MetricDimensionKey& key) const {
+        uint32_t dimensionId;
+        return mKeyTable->find(key, &dimensionId) &&
+               mDimensions.find(dimensionId) != mDimensions.end();
+    }
+
+    // Number of dimensions.
+    inline size_t size() const {
+        return mDimensions.size();
+    }
+
+    inline bool empty() const {
+        return mDimensions.empty();
+    }
+
+    void clear();
+
+    size_t byteSize() const;
+
+private:
+    std::vector<int64_t> mBucketStartNs;
+    std::vector<int64_t> mBucketEndNs;
+
+    sp<MetricDimensionKeyTable> mKeyTable;
+
+    // Holds a reference to each of its ids in mKeyTable.
+    std::unordered_map<uint32_t, DimensionCounts> mDimensions;
+
+    // Number of counts in mDimensions, and of errors.
+    size_t mCountSize = 0;
+    size_t mErrorSize = 0;
 };
 
 class CountMetricProducer : public MetricProducer {
@@ -65,7 +161,7 @@ protected:
     void onMatchedLogEventInternalLocked(
             const size_t matcherIndex, const MetricDimensionKey& eventKey,
             const ConditionKey& conditionKey, bool condition, const LogEvent& event,
-            const std::map<int, HashableDimensionKey>& statePrimaryKeys) override;
+            const std::vector<HashableDimensionKey>& statePrimaryKeys) override;
 
 private:
 
@@ -73,11 +169,13 @@ private:
                             const bool include_current_partial_bucket,
                             const bool erase_data,
                             const DumpLatency dumpLatency,
-                            std::set<string> *str_set,
+                            ReportStrings* str_set,
                             android::util::ProtoOutputStream* protoOutput) override;
 
     void clearPastBucketsLocked(const int64_t dumpTimeNs) override;
 
+    void setDimensionKeyTableLocked(const sp<MetricDimensionKeyTable>& keyTable) override;
+
     // Internal interface to handle condition change.
     void onConditionChangedLocked(const bool conditionMet, const int64_t eventTime) override;
 
@@ -87,10 +185,16 @@ private:
     // Internal function to calculate the current used bytes.
     size_t byteSizeLocked() const override;
 
+    size_t currentBucketByteSizeLocked() const override;
+
     void dumpStatesLocked(FILE* out, bool verbose) const override;
 
     void dropDataLocked(const int64_t dropTimeNs) override;
 
+    void releaseIdleMemoryLocked() override;
+
+    void rollUpPastBucketsLocked(const int64_t rollupEndNs) override;
+
     // Util function to flush the old packet.
     void flushIfNeededLocked(const int64_t& newEventTime) override;
 
@@ -113,19 +217,36 @@ private:
             std::unordered_map<int, std::vector<int>>& deactivationAtomTrackerToMetricMap,
             std::vector<int>& metricsWithActivation) override;
 
-    std::unordered_map<MetricDimensionKey, std::vector<CountBucket>> mPastBuckets;
+    CountPastBuckets mPastBuckets;
 
     // The current bucket (may be a partial bucket).
     std::shared_ptr<DimToValMap> mCurrentSlicedCounter = std::make_shared<DimToValMap>();
 
+    // The nodes of the last bucket of mCurrentSlicedCounter, reused by the next one.
+    MapNodePool<DimToValMap> mCurrentSlicedCounterPool;
+
     // The sum of previous partial buckets in the current full bucket (excluding the current
     // partial bucket). This is only updated while flushing the current bucket.
     std::shared_ptr<DimToValMap> mCurrentFullCounters = std::make_shared<DimToValMap>();
 
-    static const size_t kBucketSize = sizeof(CountBucket{});
+    // CountMetric.max_heavy_hitters, or 0 if the dimensions are only bounded by the guardrail.
+    const size_t mMaxHeavyHitters;
+
+    // With mMaxHeavyHitters, the error bounds of the counts of mCurrentSlicedCounter that are not
+    // exact, see evictLowestCountLocked().
+    DimToValMap mCurrentCountErrors;
+
+    // With mMaxHeavyHitters, the counts of mCurrentSlicedCounter with their keys, from the lowest,
+    // so that evictLowestCountLocked() doesn't scan the bucket. The keys are those of the map
+    // nodes, which stay in place until the bucket is flushed.
+    std::set<std::pair<int64_t, const MetricDimensionKey*>> mHeavyHitterCounts;
 
     bool hitGuardRailLocked(const MetricDimensionKey& newKey);
 
+    // Replaces the dimension with the lowest count of the full mCurrentSlicedCounter by [newKey],
+    // which takes over its count plus one, as in the Space-Saving algorithm.
+    void evictLowestCountLocked(const MetricDimensionKey& newKey);
+
     bool countPassesThreshold(const int64_t& count);
 
     FRIEND_TEST(CountMetricProducerTest, TestNonDimensionalEvents);
@@ -135,6 +256,9 @@ private:
     FRIEND_TEST(CountMetricProducerTest, TestFirstBucket);
     FRIEND_TEST(CountMetricProducerTest, TestOneWeekTimeUnit);
     FRIEND_TEST(CountMetricProducerTest, TestSplitOnAppUpgradeDisabled);
+    FRIEND_TEST(CountMetricProducerTest, TestMaxHeavyHitters);
+    FRIEND_TEST(CountMetricProducerTest, TestPastBucketRollup);
+    FRIEND_TEST(MetricsManagerTest, TestInactiveMetricMemoryReleased);
 
     FRIEND_TEST(CountMetricProducerTest_PartialBucket, TestSplitInCurrentBucket);
     FRIEND_TEST(CountMetricProducerTest_PartialBucket, TestSplitInNextBucket);
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "src/statsd_config.pb.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Computes the diffs of the [n] values of [current] from the [n] values of [base], as a diffed
+ * NumericValueMetricProducer does for each value field, for the fields of a whole pull at once.
+ *
+ * diffs[i] is the change from base[i] to current[i] along [direction]. The values that went the
+ * other way were reset: their diff is current[i] if [useAbsoluteValueOnReset], otherwise they
+ * have none and valid[i] is 0. [direction] is INCREASING, DECREASING or ANY. The loops have no
+ * branches, so that they are vectorized.
+ */
+inline void computeLongDiffs(const int64_t* __restrict current, const int64_t* __restrict base,
+                             size_t n, ValueMetric::ValueDirection direction,
+                             bool useAbsoluteValueOnReset, int64_t* __restrict diffs,
+                             uint8_t* __restrict valid) {
+    // Wraps around as the subtraction of Values does, without the undefined behavior.
+    const auto subtract = [](int64_t a, int64_t b) {
+        return (int64_t)((uint64_t)a - (uint64_t)b);
+    };
+    switch (direction) {
+        case ValueMetric::INCREASING:
+            for (size_t i = 0; i < n; i++) {
+                const bool reset = current[i] < base[i];
+                diffs[i] = reset ? current[i] : subtract(current[i], base[i]);
+                valid[i] = !reset | useAbsoluteValueOnReset;
+            }
+            break;
+        case ValueMetric::DECREASING:
+            for (size_t i = 0; i < n; i++) {
+                const bool reset = base[i] < current[i];
+                diffs[i] = reset ? current[i] : subtract(base[i], current[i]);
+                valid[i] = !reset | useAbsoluteValueOnReset;
+            }
+            break;
+        case ValueMetric::ANY:
+        default:
+            for (size_t i = 0; i < n; i++) {
+                diffs[i] = subtract(current[i], base[i]);
+                valid[i] = 1;
+            }
+            break;
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "DimensionProtoCache.h"
+
+#include "stats_log_util.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using android::util::FIELD_COUNT_REPEATED;
+using android::util::FIELD_TYPE_MESSAGE;
+using android::util::ProtoOutputStream;
+using std::string;
+
+namespace {
+
+// The field the leaf nodes are serialized to before they are split, see splitLeafNodes().
+const int FIELD_ID_LEAF_NODE = 1;
+
+string toBytes(ProtoOutputStream& proto) {
+    string bytes;
+    bytes.reserve(proto.size());
+    sp<android::util::ProtoReader> reader = proto.data();
+    while (reader->readBuffer() != NULL) {
+        size_t toRead = reader->currentToRead();
+        bytes.append(reinterpret_cast<const char*>(reader->readBuffer()), toRead);
+        reader->move(toRead);
+    }
+    return bytes;
+}
+
+// Reads the varint at [*pos] of [bytes], and moves [*pos] past it.
+uint64_t readVarint(const string& bytes, size_t* pos) {
+    uint64_t value = 0;
+    for (int shift = 0; *pos < bytes.size() && shift < 64; shift += 7) {
+        const uint8_t byte = bytes[(*pos)++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            break;
+        }
+    }
+    return value;
+}
+
+// Splits the repeated FIELD_ID_LEAF_NODE messages of [bytes] into their serialized contents.
+std::vector<string> splitLeafNodes(const string& bytes) {
+    std::vector<string> leafNodes;
+    size_t pos = 0;
+    while (pos < bytes.size()) {
+        readVarint(bytes, &pos);  // The tag, always FIELD_ID_LEAF_NODE.
+        const size_t size = readVarint(bytes, &pos);
+        leafNodes.push_back(bytes.substr(pos, size));
+        pos += size;
+    }
+    return leafNodes;
+}
+
+}  // namespace
+
+void DimensionProtoCache::writeDimension(const HashableDimensionKey& dimension, int fieldId,
+                                         ReportStrings* strSet, ProtoOutputStream* protoOutput) {
+    if (dimension.getValues().empty()) {
+        uint64_t dimensionToken = protoOutput->start(FIELD_TYPE_MESSAGE | fieldId);
+        protoOutput->end(dimensionToken);
+        return;
+    }
+    if (strSet != nullptr && strSet->isDictionary()) {
+        // The indices of the strings are only valid for this dump.
+        uint64_t dimensionToken = protoOutput->start(FIELD_TYPE_MESSAGE | fieldId);
+        writeDimensionToProto(dimension, strSet, protoOutput);
+        protoOutput->end(dimensionToken);
+        return;
+    }
+    Entry& entry = getEntry(dimension);
+    const bool hashStrings = strSet != nullptr;
+    if (entry.dimension.empty() || entry.dimensionHashesStrings != hashStrings) {
+        ProtoOutputStream proto;
+        ReportStrings strings;
+        writeDimensionToProto(dimension, hashStrings ? &strings : nullptr, &proto);
+        entry.dimension = toBytes(proto);
+        entry.dimensionHashesStrings = hashStrings;
+        if (hashStrings) {
+            entry.strings.assign(strings.hashedStrings().begin(), strings.hashedStrings().end());
+        }
+    }
+    addStrings(entry, strSet);
+    protoOutput->write(FIELD_TYPE_MESSAGE | fieldId, entry.dimension.data(),
+                       entry.dimension.size());
+}
+
+void DimensionProtoCache::writeDimensionLeafNodes(const HashableDimensionKey& dimension,
+                                                  int dimensionLeafFieldId, ReportStrings* strSet,
+                                                  ProtoOutputStream* protoOutput) {
+    if (dimension.getValues().empty()) {
+        return;
+    }
+    if (strSet != nullptr && strSet->isDictionary()) {
+        writeDimensionLeafNodesToProto(dimension, dimensionLeafFieldId, strSet, protoOutput);
+        return;
+    }
+    Entry& entry = getEntry(dimension);
+    const bool hashStrings = strSet != nullptr;
+    if (!entry.hasLeafNodes || entry.leafNodesHashStrings != hashStrings) {
+        ProtoOutputStream proto;
+        ReportStrings strings;
+        writeDimensionLeafNodesToProto(dimension, FIELD_ID_LEAF_NODE,
+                                       hashStrings ? &strings : nullptr, &proto);
+        entry.leafNodes = splitLeafNodes(toBytes(proto));
+        entry.leafNodesHashStrings = hashStrings;
+        entry.hasLeafNodes = true;
+        if (hashStrings) {
+            entry.strings.assign(strings.hashedStrings().begin(), strings.hashedStrings().end());
+        }
+    }
+    addStrings(entry, strSet);
+    for (const string& leafNode : entry.leafNodes) {
+        protoOutput->write(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | dimensionLeafFieldId,
+                           leafNode.data(), leafNode.size());
+    }
+}
+
+void DimensionProtoCache::pruneUnused() {
+    for (auto it = mEntries.begin(); it != mEntries.end();) {
+        if (it->second.used) {
+            it->second.used = false;
+            it++;
+        } else {
+            it = mEntries.erase(it);
+        }
+    }
+    VLOG("%zu cached dimension protos", mEntries.size());
+}
+
+size_t DimensionProtoCache::byteSize() const {
+    size_t totalSize = 0;
+    for (const auto& [dimension, entry] : mEntries) {
+        totalSize += hashMapEntryByteSize(dimension, sizeof(Entry)) + entry.dimension.size();
+        for (const auto* strings : {&entry.leafNodes, &entry.strings}) {
+            totalSize += strings->capacity() * sizeof(string);
+            for (const string& str : *strings) {
+                totalSize += str.size();
+            }
+        }
+    }
+    return totalSize;
+}
+
+DimensionProtoCache::Entry& DimensionProtoCache::getEntry(const HashableDimensionKey& dimension) {
+    Entry& entry = mEntries[dimension];
+    entry.used = true;
+    return entry;
+}
+
+void DimensionProtoCache::addStrings(const Entry& entry, ReportStrings* strSet) {
+    if (strSet != nullptr) {
+        for (const string& str : entry.strings) {
+            strSet->insert(str);
+        }
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android/util/ProtoOutputStream.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "HashableDimensionKey.h"
+#include "utils/ReportStrings.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Caches the serialized DimensionsValue protos of the dimensions a metric dumps, so that the
+ * dimensions reported again by the next dumps are copied instead of walking their values again.
+ * The dimensions that a dump does not report are forgotten at the end of the dump. The dimensions
+ * written with a string dictionary are not cached, since their indices are only valid for one dump.
+ *
+ * Not thread safe, used under the mutex of the metric.
+ */
+class DimensionProtoCache {
+public:
+    // Like writeDimensionToProto() into the DimensionsValue field [fieldId] of [protoOutput].
+    void writeDimension(const HashableDimensionKey& dimension, int fieldId,
+                        ReportStrings* strSet,
+                        android::util::ProtoOutputStream* protoOutput);
+
+    // Like writeDimensionLeafNodesToProto().
+    void writeDimensionLeafNodes(const HashableDimensionKey& dimension, int dimensionLeafFieldId,
+                                 ReportStrings* strSet,
+                                 android::util::ProtoOutputStream* protoOutput);
+
+    // Forgets the dimensions not written since the last call. Called at the end of each dump.
+    void pruneUnused();
+
+    inline size_t size() const {
+        return mEntries.size();
+    }
+
+    // Estimated heap bytes of the cached protos and their dimensions.
+    size_t byteSize() const;
+
+private:
+    struct Entry {
+        // The serialized DimensionsValue, and whether its strings are hashed.
+        std::string dimension;
+        bool dimensionHashesStrings = false;
+
+        // The serialized DimensionsValue of each leaf node, and whether their strings are hashed.
+        std::vector<std::string> leafNodes;
+        bool leafNodesHashStrings = false;
+        bool hasLeafNodes = false;
+
+        // The strings to add to the string set of the dump when they are hashed.
+        std::vector<std::string> strings;
+
+        bool used = true;
+    };
+
+    // Returns the entry of [dimension], marked as used.
+    Entry& getEntry(const HashableDimensionKey& dimension);
+
+    // Adds the strings of [entry] to [strSet], if any.
+    static void addStrings(const Entry& entry, ReportStrings* strSet);
+
+    std::unordered_map<HashableDimensionKey, Entry> mEntries;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -23,6 +23,8 @@
 #include <limits.h>
 #include <stdlib.h>
 
+#include <algorithm>
+
 #include "guardrail/StatsdStats.h"
 #include "metrics/parsing_utils/metrics_manager_util.h"
 #include "stats_log_util.h"
@@ -252,8 +254,19 @@ void DurationMetricProducer::initTrueDimensions(const int whatIndex, const int64
     if (whatIndex == -1) {
         return;
     }
-    const map<HashableDimensionKey, int>* slicedWhatMap = mWizard->getSlicedDimensionMap(whatIndex);
-    for (const auto& [internalDimKey, count] : *slicedWhatMap) {
+    const unordered_map<HashableDimensionKey, int>* slicedWhatMap =
+            mWizard->getSlicedDimensionMap(whatIndex);
+    // The keys are started in order, so that the same dimensions are kept whatever the hash
+    // order when the dimension guardrail is hit.
+    vector<const std::pair<const HashableDimensionKey, int>*> sortedWhat;
+    sortedWhat.reserve(slicedWhatMap->size());
+    for (const auto& entry : *slicedWhatMap) {
+        sortedWhat.push_back(&entry);
+    }
+    std::sort(sortedWhat.begin(), sortedWhat.end(),
+              [](const auto* a, const auto* b) { return a->first < b->first; });
+    for (const auto* entry : sortedWhat) {
+        const auto& [internalDimKey, count] = *entry;
         for (int i = 0; i < count; i++) {
             // Fake start events.
             handleMatchedLogEventValuesLocked(mStartIndex, internalDimKey.getValues(), startTimeNs);
@@ -372,7 +385,7 @@ void DurationMetricProducer::onSlicedConditionMayChangeLocked_opt1(bool conditio
     // state based on the new unsliced condition state.
     if (dimensionsChangedToTrue == nullptr || dimensionsChangedToFalse == nullptr ||
         (dimensionsChangedToTrue->empty() && dimensionsChangedToFalse->empty())) {
-        const map<HashableDimensionKey, int>* slicedConditionMap =
+        const unordered_map<HashableDimensionKey, int>* slicedConditionMap =
                 mWizard->getSlicedDimensionMap(mConditionTrackerIndex);
         for (auto& whatIt : mCurrentSlicedDurationTrackerMap) {
             HashableDimensionKey linkedConditionDimensionKey;
@@ -386,18 +399,25 @@ void DurationMetricProducer::onSlicedConditionMayChangeLocked_opt1(bool conditio
     } else {
         // Handle the condition change from the sliced predicate.
         if (currentUnSlicedPartCondition) {
-            for (auto& whatIt : mCurrentSlicedDurationTrackerMap) {
-                HashableDimensionKey linkedConditionDimensionKey;
-                getDimensionForCondition(whatIt.first.getValues(), mMetric2ConditionLinks[0],
-                                         &linkedConditionDimensionKey);
-                if (dimensionsChangedToTrue->find(linkedConditionDimensionKey) !=
-                        dimensionsChangedToTrue->end()) {
-                    whatIt.second->onConditionChanged(true, eventTime);
+            // Only the trackers linked to the changed keys are visited.
+            const auto notifyLinkedTrackers = [&](const HashableDimensionKey& conditionKey,
+                                                  bool conditionMet) {
+                const auto linkedIt = mLinkedConditionKeyToWhatKeys.find(conditionKey);
+                if (linkedIt == mLinkedConditionKeyToWhatKeys.end()) {
+                    return;
                 }
-                if (dimensionsChangedToFalse->find(linkedConditionDimensionKey) !=
-                        dimensionsChangedToFalse->end()) {
-                    whatIt.second->onConditionChanged(false, eventTime);
+                for (const HashableDimensionKey& whatKey : linkedIt->second) {
+                    const auto whatIt = mCurrentSlicedDurationTrackerMap.find(whatKey);
+                    if (whatIt != mCurrentSlicedDurationTrackerMap.end()) {
+                        whatIt->second->onConditionChanged(conditionMet, eventTime);
+                    }
                 }
+            };
+            for (const HashableDimensionKey& conditionKey : *dimensionsChangedToTrue) {
+                notifyLinkedTrackers(conditionKey, true);
+            }
+            for (const HashableDimensionKey& conditionKey : *dimensionsChangedToFalse) {
+                notifyLinkedTrackers(conditionKey, false);
             }
         }
     }
@@ -489,7 +509,7 @@ void DurationMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
                                                 const bool include_current_partial_bucket,
                                                 const bool erase_data,
                                                 const DumpLatency dumpLatency,
-                                                std::set<string> *str_set,
+                                                ReportStrings* str_set,
                                                 ProtoOutputStream* protoOutput) {
     if (include_current_partial_bucket) {
         flushLocked(dumpTimeNs);
@@ -529,13 +549,12 @@ void DurationMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
 
         // First fill dimension.
         if (mShouldUseNestedDimensions) {
-            uint64_t dimensionToken = protoOutput->start(
-                    FIELD_TYPE_MESSAGE | FIELD_ID_DIMENSION_IN_WHAT);
-            writeDimensionToProto(dimensionKey.getDimensionKeyInWhat(), str_set, protoOutput);
-            protoOutput->end(dimensionToken);
+            mDimensionProtoCache.writeDimension(dimensionKey.getDimensionKeyInWhat(),
+                                                FIELD_ID_DIMENSION_IN_WHAT, str_set, protoOutput);
         } else {
-            writeDimensionLeafNodesToProto(dimensionKey.getDimensionKeyInWhat(),
-                                           FIELD_ID_DIMENSION_LEAF_IN_WHAT, str_set, protoOutput);
+            mDimensionProtoCache.writeDimensionLeafNodes(dimensionKey.getDimensionKeyInWhat(),
+                                                         FIELD_ID_DIMENSION_LEAF_IN_WHAT, str_set,
+                                                         protoOutput);
         }
         // Then fill slice_by_state.
         for (auto state : dimensionKey.getStateValuesKey().getValues()) {
@@ -592,6 +611,7 @@ void DurationMetricProducer::flushCurrentBucketLocked(const int64_t& eventTimeNs
             whatIt != mCurrentSlicedDurationTrackerMap.end();) {
         if (whatIt->second->flushCurrentBucket(eventTimeNs, mUploadThreshold, &mPastBuckets)) {
             VLOG("erase bucket for key %s", whatIt->first.toString().c_str());
+            removeLinkedConditionKeyLocked(whatIt->first);
             whatIt = mCurrentSlicedDurationTrackerMap.erase(whatIt);
         } else {
             ++whatIt;
@@ -599,6 +619,29 @@ void DurationMetricProducer::flushCurrentBucketLocked(const int64_t& eventTimeNs
     }
     StatsdStats::getInstance().noteBucketCount(mMetricId);
     mCurrentBucketStartTimeNs = nextBucketStartTimeNs;
+    rollUpPastBucketsIfNeededLocked(eventTimeNs);
+}
+
+void DurationMetricProducer::rollUpPastBucketsLocked(const int64_t rollupEndNs) {
+    for (auto& [key, buckets] : mPastBuckets) {
+        size_t size = 0;
+        int64_t lastRollupBucketNum = -1;
+        for (size_t i = 0; i < buckets.size(); i++) {
+            const DurationBucket& bucket = buckets[i];
+            const int64_t rollupBucketNum =
+                    bucket.mBucketEndNs <= rollupEndNs
+                            ? (bucket.mBucketStartNs - mTimeBaseNs) / mRollupBucketSizeNs
+                            : -1;
+            if (rollupBucketNum >= 0 && rollupBucketNum == lastRollupBucketNum) {
+                buckets[size - 1].mBucketEndNs = bucket.mBucketEndNs;
+                buckets[size - 1].mDuration += bucket.mDuration;
+            } else {
+                buckets[size++] = bucket;
+            }
+            lastRollupBucketNum = rollupBucketNum;
+        }
+        buckets.resize(size);
+    }
 }
 
 void DurationMetricProducer::dumpStatesLocked(FILE* out, bool verbose) const {
@@ -636,6 +679,33 @@ bool DurationMetricProducer::hitGuardRailLocked(const MetricDimensionKey& newKey
     return false;
 }
 
+void DurationMetricProducer::addLinkedConditionKeyLocked(const HashableDimensionKey& whatKey) {
+    if (!usesLinkedConditionKeyIndex()) {
+        return;
+    }
+    HashableDimensionKey linkedConditionDimensionKey;
+    getDimensionForCondition(whatKey.getValues(), mMetric2ConditionLinks[0],
+                             &linkedConditionDimensionKey);
+    mLinkedConditionKeyToWhatKeys[linkedConditionDimensionKey].insert(whatKey);
+}
+
+void DurationMetricProducer::removeLinkedConditionKeyLocked(const HashableDimensionKey& whatKey) {
+    if (!usesLinkedConditionKeyIndex()) {
+        return;
+    }
+    HashableDimensionKey linkedConditionDimensionKey;
+    getDimensionForCondition(whatKey.getValues(), mMetric2ConditionLinks[0],
+                             &linkedConditionDimensionKey);
+    const auto linkedIt = mLinkedConditionKeyToWhatKeys.find(linkedConditionDimensionKey);
+    if (linkedIt == mLinkedConditionKeyToWhatKeys.end()) {
+        return;
+    }
+    linkedIt->second.erase(whatKey);
+    if (linkedIt->second.empty()) {
+        mLinkedConditionKeyToWhatKeys.erase(linkedIt);
+    }
+}
+
 void DurationMetricProducer::handleStartEvent(const MetricDimensionKey& eventKey,
                                               const ConditionKey& conditionKeys, bool condition,
                                               const int64_t eventTimeNs,
@@ -647,6 +717,7 @@ void DurationMetricProducer::handleStartEvent(const MetricDimensionKey& eventKey
             return;
         }
         mCurrentSlicedDurationTrackerMap[whatKey] = createDurationTracker(eventKey);
+        addLinkedConditionKeyLocked(whatKey);
     }
 
     auto it = mCurrentSlicedDurationTrackerMap.find(whatKey);
@@ -667,7 +738,7 @@ void DurationMetricProducer::handleStartEvent(const MetricDimensionKey& eventKey
 void DurationMetricProducer::onMatchedLogEventInternalLocked(
         const size_t matcherIndex, const MetricDimensionKey& eventKey,
         const ConditionKey& conditionKeys, bool condition, const LogEvent& event,
-        const map<int, HashableDimensionKey>& statePrimaryKeys) {
+        const vector<HashableDimensionKey>& statePrimaryKeys) {
     ALOGW("Not used in duration tracker.");
 }
 
@@ -701,15 +772,14 @@ void DurationMetricProducer::handleMatchedLogEventValuesLocked(const size_t matc
         filterValues(mDimensionsInWhat, values, &dimensionInWhat);
     }
 
-    // Stores atom id to primary key pairs for each state atom that the metric is
-    // sliced by.
-    std::map<int, HashableDimensionKey> statePrimaryKeys;
-
     // For states with primary fields, use MetricStateLinks to get the primary
     // field values from the log event. These values will form a primary key
     // that will be used to query StateTracker for the correct state value.
-    for (const auto& stateLink : mMetric2StateLinks) {
-        getDimensionForState(values, stateLink, &statePrimaryKeys[stateLink.stateAtomId]);
+    vector<HashableDimensionKey>& statePrimaryKeys = mScratchStatePrimaryKeys;
+    statePrimaryKeys.resize(mMetric2StateLinks.size());
+    for (size_t i = 0; i < mMetric2StateLinks.size(); i++) {
+        statePrimaryKeys[i].clear();
+        getDimensionForState(values, mMetric2StateLinks[i], &statePrimaryKeys[i]);
     }
 
     // For each sliced state, query StateTracker for the state value using
@@ -723,17 +793,11 @@ void DurationMetricProducer::handleMatchedLogEventValuesLocked(const size_t matc
     HashableDimensionKey stateValuesKey = DEFAULT_DIMENSION_KEY;
     for (auto atomId : mSlicedStateAtoms) {
         FieldValue value;
-        if (statePrimaryKeys.find(atomId) != statePrimaryKeys.end()) {
-            // found a primary key for this state, query using the key
-            queryStateValue(atomId, statePrimaryKeys[atomId], &value);
-        } else {
-            // if no MetricStateLinks exist for this state atom,
-            // query using the default dimension key (empty HashableDimensionKey)
-            queryStateValue(atomId, DEFAULT_DIMENSION_KEY, &value);
-        }
+        queryStateValue(atomId, getStatePrimaryKey(statePrimaryKeys, atomId), &value);
         mapStateValue(atomId, &value);
         stateValuesKey.addValue(value);
     }
+    noteDimensionLocked(dimensionInWhat, stateValuesKey);
 
     // Handles Stop events.
     if ((int)matcherIndex == mStopIndex) {
@@ -787,6 +851,14 @@ size_t DurationMetricProducer::byteSizeLocked() const {
     return totalSize;
 }
 
+size_t DurationMetricProducer::currentBucketByteSizeLocked() const {
+    size_t totalSize = 0;
+    for (const auto& [key, tracker] : mCurrentSlicedDurationTrackerMap) {
+        totalSize += hashMapEntryByteSize(key, sizeof(tracker)) + tracker->byteSize();
+    }
+    return totalSize;
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
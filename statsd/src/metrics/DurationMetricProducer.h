@@ -19,6 +19,7 @@
 #include <android/util/ProtoOutputStream.h>
 
 #include <unordered_map>
+#include <unordered_set>
 
 #include "../anomaly/DurationAnomalyTracker.h"
 #include "../condition/ConditionTracker.h"
@@ -63,6 +64,11 @@ public:
                         const HashableDimensionKey& primaryKey, const FieldValue& oldState,
                         const FieldValue& newState) override;
 
+    // The trackers keep the durations started and stopped while the metric is inactive.
+    bool consumesEventsWhileInactive() const override {
+        return true;
+    }
+
     MetricType getMetricType() const override {
         return METRIC_TYPE_DURATION;
     }
@@ -73,7 +79,7 @@ protected:
     void onMatchedLogEventInternalLocked(
             const size_t matcherIndex, const MetricDimensionKey& eventKey,
             const ConditionKey& conditionKeys, bool condition, const LogEvent& event,
-            const std::map<int, HashableDimensionKey>& statePrimaryKeys) override;
+            const std::vector<HashableDimensionKey>& statePrimaryKeys) override;
 
 private:
     // Initializes true dimensions of the 'what' predicate. Only to be called during initialization.
@@ -90,7 +96,7 @@ private:
                             const bool include_current_partial_bucket,
                             const bool erase_data,
                             const DumpLatency dumpLatency,
-                            std::set<string> *str_set,
+                            ReportStrings* str_set,
                             android::util::ProtoOutputStream* protoOutput) override;
 
     void clearPastBucketsLocked(const int64_t dumpTimeNs) override;
@@ -113,10 +119,14 @@ private:
     // Internal function to calculate the current used bytes.
     size_t byteSizeLocked() const override;
 
+    size_t currentBucketByteSizeLocked() const override;
+
     void dumpStatesLocked(FILE* out, bool verbose) const override;
 
     void dropDataLocked(const int64_t dropTimeNs) override;
 
+    void rollUpPastBucketsLocked(const int64_t rollupEndNs) override;
+
     // Util function to flush the old packet.
     void flushIfNeededLocked(const int64_t& eventTime);
 
@@ -174,6 +184,21 @@ private:
     std::unordered_map<HashableDimensionKey, std::unique_ptr<DurationTracker>>
             mCurrentSlicedDurationTrackerMap;
 
+    // Maps the key of the linked condition to the keys in mCurrentSlicedDurationTrackerMap linked
+    // to it, so that a sliced condition change only visits the trackers of the changed keys.
+    // Only kept when onSlicedConditionMayChangeLocked_opt1() applies, see
+    // usesLinkedConditionKeyIndex().
+    std::unordered_map<HashableDimensionKey, std::unordered_set<HashableDimensionKey>>
+            mLinkedConditionKeyToWhatKeys;
+
+    inline bool usesLinkedConditionKeyIndex() const {
+        return mMetric2ConditionLinks.size() == 1 && mHasLinksToAllConditionDimensionsInTracker;
+    }
+
+    // Adds or removes [whatKey] in mLinkedConditionKeyToWhatKeys.
+    void addLinkedConditionKeyLocked(const HashableDimensionKey& whatKey);
+    void removeLinkedConditionKeyLocked(const HashableDimensionKey& whatKey);
+
     // Helper function to create a duration tracker given the metric aggregation type.
     std::unique_ptr<DurationTracker> createDurationTracker(
             const MetricDimensionKey& eventKey) const;
@@ -184,9 +209,11 @@ private:
     static const size_t kBucketSize = sizeof(DurationBucket{});
 
     FRIEND_TEST(DurationMetricTrackerTest, TestNoCondition);
+    FRIEND_TEST(MetricsManagerTest, TestInactiveConfigDispatchesToDurationMetrics);
     FRIEND_TEST(DurationMetricTrackerTest, TestNonSlicedCondition);
     FRIEND_TEST(DurationMetricTrackerTest, TestNonSlicedConditionUnknownState);
     FRIEND_TEST(WakelockDurationE2eTest, TestAggregatedPredicates);
+    FRIEND_TEST(DurationMetricE2eTest, TestWithSlicedCondition);
     FRIEND_TEST(DurationMetricTrackerTest, TestFirstBucket);
 
     FRIEND_TEST(DurationMetricProducerTest, TestSumDurationAppUpgradeSplitDisabled);
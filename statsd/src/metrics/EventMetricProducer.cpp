@@ -56,6 +56,31 @@ const int FIELD_ID_AGGREGATED_ATOM = 4;
 const int FIELD_ID_ATOM = 1;
 const int FIELD_ID_ATOM_TIMESTAMPS = 2;
 
+namespace {
+
+void appendVarint(uint64_t value, string* bytes) {
+    while (value >= 0x80) {
+        bytes->push_back((char)((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    bytes->push_back((char)value);
+}
+
+// Reads the varint at [*pos] of [bytes], and moves [*pos] past it.
+uint64_t readVarint(const string& bytes, size_t* pos) {
+    uint64_t value = 0;
+    for (int shift = 0; *pos < bytes.size() && shift < 64; shift += 7) {
+        const uint8_t byte = bytes[(*pos)++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            break;
+        }
+    }
+    return value;
+}
+
+}  // anonymous namespace
+
 EventMetricProducer::EventMetricProducer(
         const ConfigKey& key, const EventMetric& metric, const int conditionIndex,
         const vector<ConditionState>& initialConditionCache, const sp<ConditionWizard>& wizard,
@@ -66,7 +91,9 @@ EventMetricProducer::EventMetricProducer(
         const unordered_map<int, unordered_map<int, int64_t>>& stateGroupMap)
     : MetricProducer(metric.id(), key, startTimeNs, conditionIndex, initialConditionCache, wizard,
                      protoHash, eventActivationMap, eventDeactivationMap, slicedStateAtoms,
-                     stateGroupMap, /*splitBucketForAppUpgrade=*/nullopt) {
+                     stateGroupMap, /*splitBucketForAppUpgrade=*/nullopt),
+      mDeduplicateAtoms(metric.deduplicate_atoms()),
+      mLastEncodedTimestampNs(0) {
     if (metric.links().size() > 0) {
         for (const auto& link : metric.links()) {
             Metric2Condition mc;
@@ -127,9 +154,15 @@ bool EventMetricProducer::onConfigUpdatedLocked(
     return true;
 }
 
-void EventMetricProducer::dropDataLocked(const int64_t dropTimeNs) {
+void EventMetricProducer::clearAtomsLocked() {
     mAggregatedAtoms.clear();
+    mEncodedAtoms.clear();
+    mLastEncodedTimestampNs = 0;
     mTotalSize = 0;
+}
+
+void EventMetricProducer::dropDataLocked(const int64_t dropTimeNs) {
+    clearAtomsLocked();
     StatsdStats::getInstance().noteBucketDropped(mMetricId);
 }
 
@@ -155,15 +188,37 @@ std::unique_ptr<std::vector<uint8_t>> serializeProtoLocked(ProtoOutputStream& pr
 }
 
 void EventMetricProducer::clearPastBucketsLocked(const int64_t dumpTimeNs) {
-    mAggregatedAtoms.clear();
-    mTotalSize = 0;
+    clearAtomsLocked();
+}
+
+void EventMetricProducer::writeEncodedAtomsLocked(ProtoOutputStream* protoOutput) const {
+    int64_t timestampNs = 0;
+    size_t pos = 0;
+    while (pos < mEncodedAtoms.size()) {
+        const size_t atomSize = readVarint(mEncodedAtoms, &pos);
+        const size_t atomPos = pos;
+        pos += atomSize;
+        const uint64_t zigzagDelta = readVarint(mEncodedAtoms, &pos);
+        timestampNs += (int64_t)(zigzagDelta >> 1) ^ -(int64_t)(zigzagDelta & 1);
+
+        uint64_t wrapperToken =
+                protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_DATA);
+        uint64_t aggregatedToken =
+                protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_ID_AGGREGATED_ATOM);
+        protoOutput->write(FIELD_TYPE_MESSAGE | FIELD_ID_ATOM, mEncodedAtoms.data() + atomPos,
+                           atomSize);
+        protoOutput->write(FIELD_TYPE_INT64 | FIELD_COUNT_REPEATED | FIELD_ID_ATOM_TIMESTAMPS,
+                           (long long)timestampNs);
+        protoOutput->end(aggregatedToken);
+        protoOutput->end(wrapperToken);
+    }
 }
 
 void EventMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
                                              const bool include_current_partial_bucket,
                                              const bool erase_data,
                                              const DumpLatency dumpLatency,
-                                             std::set<string> *str_set,
+                                             ReportStrings* str_set,
                                              ProtoOutputStream* protoOutput) {
     protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_ID, (long long)mMetricId);
     protoOutput->write(FIELD_TYPE_BOOL | FIELD_ID_IS_ACTIVE, isActiveLocked());
@@ -186,10 +241,10 @@ void EventMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
         protoOutput->end(aggregatedToken);
         protoOutput->end(wrapperToken);
     }
+    writeEncodedAtomsLocked(protoOutput);
     protoOutput->end(protoToken);
     if (erase_data) {
-        mAggregatedAtoms.clear();
-        mTotalSize = 0;
+        clearAtomsLocked();
     }
 }
 
@@ -202,12 +257,16 @@ void EventMetricProducer::onConditionChangedLocked(const bool conditionMet,
 void EventMetricProducer::onMatchedLogEventInternalLocked(
         const size_t matcherIndex, const MetricDimensionKey& eventKey,
         const ConditionKey& conditionKey, bool condition, const LogEvent& event,
-        const map<int, HashableDimensionKey>& statePrimaryKeys) {
+        const vector<HashableDimensionKey>& statePrimaryKeys) {
     if (!condition) {
         return;
     }
 
     const int64_t elapsedTimeNs = truncateTimestampIfNecessary(event);
+    if (!mDeduplicateAtoms) {
+        appendEncodedAtomLocked(event, elapsedTimeNs);
+        return;
+    }
     AtomDimensionKey key(event.GetTagId(), HashableDimensionKey(event.getValues()));
 
     std::vector<int64_t>& aggregatedTimestampsNs = mAggregatedAtoms[key];
@@ -218,6 +277,22 @@ void EventMetricProducer::onMatchedLogEventInternalLocked(
     mTotalSize += sizeof(int64_t); // Add the size of the event timestamp
 }
 
+void EventMetricProducer::appendEncodedAtomLocked(const LogEvent& event,
+                                                  int64_t elapsedTimeNs) {
+    ProtoOutputStream atomProto;
+    writeFieldValueTreeToStream(event.GetTagId(), event.getValues(), &atomProto);
+    string atom;
+    atomProto.serializeToString(&atom);
+
+    const size_t oldSize = mEncodedAtoms.size();
+    appendVarint(atom.size(), &mEncodedAtoms);
+    mEncodedAtoms.append(atom);
+    const int64_t delta = elapsedTimeNs - mLastEncodedTimestampNs;
+    appendVarint(((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63), &mEncodedAtoms);
+    mLastEncodedTimestampNs = elapsedTimeNs;
+    mTotalSize += mEncodedAtoms.size() - oldSize;
+}
+
 size_t EventMetricProducer::byteSizeLocked() const {
     return mTotalSize;
 }
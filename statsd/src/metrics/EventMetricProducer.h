@@ -17,6 +17,9 @@
 #ifndef EVENT_METRIC_PRODUCER_H
 #define EVENT_METRIC_PRODUCER_H
 
+#include <gtest/gtest_prod.h>
+
+#include <string>
 #include <unordered_map>
 
 #include <android/util/ProtoOutputStream.h>
@@ -54,13 +57,13 @@ private:
     void onMatchedLogEventInternalLocked(
             const size_t matcherIndex, const MetricDimensionKey& eventKey,
             const ConditionKey& conditionKey, bool condition, const LogEvent& event,
-            const std::map<int, HashableDimensionKey>& statePrimaryKeys) override;
+            const std::vector<HashableDimensionKey>& statePrimaryKeys) override;
 
     void onDumpReportLocked(const int64_t dumpTimeNs,
                             const bool include_current_partial_bucket,
                             const bool erase_data,
                             const DumpLatency dumpLatency,
-                            std::set<string> *str_set,
+                            ReportStrings* str_set,
                             android::util::ProtoOutputStream* protoOutput) override;
     void clearPastBucketsLocked(const int64_t dumpTimeNs) override;
 
@@ -93,10 +96,32 @@ private:
 
     void dumpStatesLocked(FILE* out, bool verbose) const override{};
 
+    // Encodes the atom of [event] and appends it to mEncodedAtoms.
+    void appendEncodedAtomLocked(const LogEvent& event, int64_t elapsedTimeNs);
+
+    // Writes the atoms of mEncodedAtoms to [protoOutput], one EventMetricData each.
+    void writeEncodedAtomsLocked(android::util::ProtoOutputStream* protoOutput) const;
+
+    // Clears the atoms of both mAggregatedAtoms and mEncodedAtoms.
+    void clearAtomsLocked();
+
+    // EventMetric.deduplicate_atoms.
+    const bool mDeduplicateAtoms;
+
     // Maps the field/value pairs of an atom to a list of timestamps used to deduplicate atoms.
     std::unordered_map<AtomDimensionKey, std::vector<int64_t>> mAggregatedAtoms;
 
+    // Without deduplication, the matched atoms in the order they were logged. Each is the varint
+    // size of the serialized Atom, the Atom, then the zigzag varint of its timestamp minus the
+    // timestamp of the previous one.
+    std::string mEncodedAtoms;
+
+    // Timestamp of the last atom of mEncodedAtoms, or 0.
+    int64_t mLastEncodedTimestampNs;
+
     size_t mTotalSize;
+
+    FRIEND_TEST(EventMetricProducerTest, TestEncodedAtomsWithoutDeduplication);
 };
 
 }  // namespace statsd
@@ -92,6 +92,7 @@ GaugeMetricProducer::GaugeMetricProducer(
       mTriggerAtomId(triggerAtomId),
       mAtomId(atomId),
       mIsPulled(pullTagId != -1),
+      mSampleRandom(std::random_device()()),
       mMinBucketSizeNs(metric.min_bucket_size_nanos()),
       mMaxPullDelayNs(metric.max_pull_delay_sec() > 0 ? metric.max_pull_delay_sec() * NS_PER_SEC
                                                       : StatsdStats::kPullMaxDelayNs),
@@ -131,11 +132,6 @@ GaugeMetricProducer::GaugeMetricProducer(
     mShouldUseNestedDimensions = ShouldUseNestedDimensions(metric.dimensions_in_what());
 
     flushIfNeededLocked(startTimeNs);
-    // Kicks off the puller immediately.
-    if (mIsPulled && mSamplingType == GaugeMetric::RANDOM_ONE_SAMPLE) {
-        mPullerManager->RegisterReceiver(mPullTagId, mConfigKey, this, getCurrentBucketEndTimeNs(),
-                                         mBucketSizeNs);
-    }
 
     // Adjust start for partial first bucket and then pull if needed
     mCurrentBucketStartTimeNs = startTimeNs;
@@ -237,7 +233,7 @@ void GaugeMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
                                              const bool include_current_partial_bucket,
                                              const bool erase_data,
                                              const DumpLatency dumpLatency,
-                                             std::set<string> *str_set,
+                                             ReportStrings* str_set,
                                              ProtoOutputStream* protoOutput) {
     VLOG("Gauge metric %lld report now...", (long long)mMetricId);
     if (include_current_partial_bucket) {
@@ -295,13 +291,12 @@ void GaugeMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
 
         // First fill dimension.
         if (mShouldUseNestedDimensions) {
-            uint64_t dimensionToken = protoOutput->start(
-                    FIELD_TYPE_MESSAGE | FIELD_ID_DIMENSION_IN_WHAT);
-            writeDimensionToProto(dimensionKey.getDimensionKeyInWhat(), str_set, protoOutput);
-            protoOutput->end(dimensionToken);
+            mDimensionProtoCache.writeDimension(dimensionKey.getDimensionKeyInWhat(),
+                                                FIELD_ID_DIMENSION_IN_WHAT, str_set, protoOutput);
         } else {
-            writeDimensionLeafNodesToProto(dimensionKey.getDimensionKeyInWhat(),
-                                           FIELD_ID_DIMENSION_LEAF_IN_WHAT, str_set, protoOutput);
+            mDimensionProtoCache.writeDimensionLeafNodes(dimensionKey.getDimensionKeyInWhat(),
+                                                         FIELD_ID_DIMENSION_LEAF_IN_WHAT, str_set,
+                                                         protoOutput);
         }
 
         // Then fill bucket_info (GaugeBucketInfo).
@@ -356,12 +351,19 @@ void GaugeMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
 }
 
 void GaugeMetricProducer::prepareFirstBucketLocked() {
+    // Kicks off the puller once the metric is in use, not from the constructor: the pulls are
+    // delivered from the alarm thread as soon as the receiver is registered.
+    if (mIsPulled && mSamplingType == GaugeMetric::RANDOM_ONE_SAMPLE) {
+        mPullerManager->RegisterReceiver(mPullTagId, mConfigKey, this, getCurrentBucketEndTimeNs(),
+                                         mBucketSizeNs);
+    }
     if (mIsActive && mIsPulled && mSamplingType == GaugeMetric::RANDOM_ONE_SAMPLE) {
         pullAndMatchEventsLocked(mCurrentBucketStartTimeNs);
     }
 }
 
-void GaugeMetricProducer::pullAndMatchEventsLocked(const int64_t timestampNs) {
+void GaugeMetricProducer::pullAndMatchEventsLocked(const int64_t timestampNs,
+                                                   const bool isBucketBoundary) {
     bool triggerPuller = false;
     switch(mSamplingType) {
         // When the metric wants to do random sampling and there is already one gauge atom for the
@@ -374,7 +376,8 @@ void GaugeMetricProducer::pullAndMatchEventsLocked(const int64_t timestampNs) {
             triggerPuller = mCondition == ConditionState::kTrue;
             break;
         }
-        case GaugeMetric::FIRST_N_SAMPLES: {
+        case GaugeMetric::FIRST_N_SAMPLES:
+        case GaugeMetric::RESERVOIR_SAMPLES: {
             triggerPuller = mCondition == ConditionState::kTrue;
             break;
         }
@@ -384,12 +387,24 @@ void GaugeMetricProducer::pullAndMatchEventsLocked(const int64_t timestampNs) {
     if (!triggerPuller) {
         return;
     }
+    // The data is matched once it is pulled, in the state of the metric now, see
+    // onDeferredDataPulled(). A sliced condition is only known per event, it can't be kept.
+    if (isBucketBoundary && !mConditionSliced &&
+        mPullerManager->PullDeferred(mPullTagId, mConfigKey, timestampNs, this)) {
+        mDeferredPulls.push_back({timestampNs, mIsActive, mCondition});
+        return;
+    }
     vector<std::shared_ptr<LogEvent>> allData;
     if (!mPullerManager->Pull(mPullTagId, mConfigKey, timestampNs, &allData)) {
         ALOGE("Gauge Stats puller failed for tag: %d at %lld", mPullTagId, (long long)timestampNs);
         return;
     }
-    const int64_t pullDelayNs = getElapsedRealtimeNs() - timestampNs;
+    matchPulledEventsLocked(allData, timestampNs, getElapsedRealtimeNs() - timestampNs);
+}
+
+void GaugeMetricProducer::matchPulledEventsLocked(const vector<shared_ptr<LogEvent>>& allData,
+                                                  const int64_t timestampNs,
+                                                  const int64_t pullDelayNs) {
     StatsdStats::getInstance().notePullDelay(mPullTagId, pullDelayNs);
     if (pullDelayNs > mMaxPullDelayNs) {
         ALOGE("Pull finish too late for atom %d", mPullTagId);
@@ -468,6 +483,10 @@ std::shared_ptr<vector<FieldValue>> GaugeMetricProducer::getGaugeFields(const Lo
             }
         }
     }
+    // Gauge atoms are kept until the report, don't keep the event buffer alive.
+    for (auto& fieldValue : *gaugeFields) {
+        fieldValue.mValue.detachPayload();
+    }
     return gaugeFields;
 }
 
@@ -492,6 +511,37 @@ void GaugeMetricProducer::onDataPulled(const std::vector<std::shared_ptr<LogEven
     }
 }
 
+void GaugeMetricProducer::onDeferredDataPulled(const vector<shared_ptr<LogEvent>>& allData,
+                                               bool pullSuccess, int64_t eventTimeNs,
+                                               int64_t pullDelayNs) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = std::find_if(mDeferredPulls.begin(), mDeferredPulls.end(),
+                           [eventTimeNs](const DeferredPullState& state) {
+                               return state.eventTimeNs == eventTimeNs;
+                           });
+    if (it == mDeferredPulls.end()) {
+        return;
+    }
+    const DeferredPullState state = *it;
+    mDeferredPulls.erase(it);
+    if (!pullSuccess) {
+        ALOGE("Gauge Stats puller failed for tag: %d at %lld", mPullTagId, (long long)eventTimeNs);
+        return;
+    }
+    if (!state.isActive || state.condition != ConditionState::kTrue) {
+        return;
+    }
+    // Matched in the state of the metric when the pull was issued. The events are dropped if
+    // their bucket was flushed meanwhile.
+    const bool isActive = mIsActive;
+    const ConditionState condition = mCondition;
+    mIsActive = state.isActive;
+    mCondition = state.condition;
+    matchPulledEventsLocked(allData, eventTimeNs, pullDelayNs);
+    mIsActive = isActive;
+    mCondition = condition;
+}
+
 bool GaugeMetricProducer::hitGuardRailLocked(const MetricDimensionKey& newKey) {
     if (mCurrentSlicedBucket->find(newKey) != mCurrentSlicedBucket->end()) {
         return false;
@@ -515,7 +565,7 @@ bool GaugeMetricProducer::hitGuardRailLocked(const MetricDimensionKey& newKey) {
 void GaugeMetricProducer::onMatchedLogEventInternalLocked(
         const size_t matcherIndex, const MetricDimensionKey& eventKey,
         const ConditionKey& conditionKey, bool condition, const LogEvent& event,
-        const map<int, HashableDimensionKey>& statePrimaryKeys) {
+        const vector<HashableDimensionKey>& statePrimaryKeys) {
     if (condition == false) {
         return;
     }
@@ -541,16 +591,36 @@ void GaugeMetricProducer::onMatchedLogEventInternalLocked(
     if (hitGuardRailLocked(eventKey)) {
         return;
     }
-    if ((*mCurrentSlicedBucket)[eventKey].size() >= mGaugeAtomsPerDimensionLimit) {
-        return;
+    vector<GaugeAtom>& gaugeAtoms = mCurrentSlicedBucketPool.get(*mCurrentSlicedBucket, eventKey);
+    size_t atomIndex = gaugeAtoms.size();
+    if (atomIndex >= mGaugeAtomsPerDimensionLimit) {
+        if (mSamplingType != GaugeMetric::RESERVOIR_SAMPLES) {
+            return;
+        }
+        // Replaces a random atom with probability limit / matched atoms, so that each matched
+        // atom is equally likely to be kept.
+        const int64_t matchedAtomCount = ++mCurrentSampledAtomCounts[eventKey];
+        atomIndex = std::uniform_int_distribution<int64_t>(0, matchedAtomCount - 1)(mSampleRandom);
+        if (atomIndex >= mGaugeAtomsPerDimensionLimit) {
+            return;
+        }
+    } else if (mSamplingType == GaugeMetric::RESERVOIR_SAMPLES) {
+        ++mCurrentSampledAtomCounts[eventKey];
     }
 
     const int64_t truncatedElapsedTimestampNs = truncateTimestampIfNecessary(event);
     GaugeAtom gaugeAtom(getGaugeFields(event), truncatedElapsedTimestampNs);
-    (*mCurrentSlicedBucket)[eventKey].push_back(gaugeAtom);
+    if (atomIndex < gaugeAtoms.size()) {
+        gaugeAtoms[atomIndex] = gaugeAtom;
+    } else {
+        gaugeAtoms.push_back(gaugeAtom);
+    }
     // Anomaly detection on gauge metric only works when there is one numeric
     // field specified.
     if (mAnomalyTrackers.size() > 0) {
+        if (atomIndex == 0) {
+            updateCurrentSlicedBucketForAnomaly(eventKey, gaugeAtom);
+        }
         if (gaugeAtom.mFields->size() == 1) {
             const Value& value = gaugeAtom.mFields->begin()->mValue;
             long gaugeVal = 0;
@@ -567,20 +637,47 @@ void GaugeMetricProducer::onMatchedLogEventInternalLocked(
     }
 }
 
-void GaugeMetricProducer::updateCurrentSlicedBucketForAnomaly() {
-    for (const auto& slice : *mCurrentSlicedBucket) {
-        if (slice.second.empty()) {
-            continue;
-        }
-        const Value& value = slice.second.front().mFields->front().mValue;
-        long gaugeVal = 0;
-        if (value.getType() == INT) {
-            gaugeVal = (long)value.int_value;
-        } else if (value.getType() == LONG) {
-            gaugeVal = value.long_value;
+void GaugeMetricProducer::updateCurrentSlicedBucketForAnomaly(const MetricDimensionKey& eventKey,
+                                                              const GaugeAtom& firstAtom) {
+    if (firstAtom.mFields->empty()) {
+        return;
+    }
+    const Value& value = firstAtom.mFields->front().mValue;
+    long gaugeVal = 0;
+    if (value.getType() == INT) {
+        gaugeVal = (long)value.int_value;
+    } else if (value.getType() == LONG) {
+        gaugeVal = value.long_value;
+    }
+    (*mCurrentSlicedBucketForAnomaly)[eventKey] = gaugeVal;
+}
+
+sp<AnomalyTracker> GaugeMetricProducer::addAnomalyTracker(
+        const Alert& alert, const sp<AlarmMonitor>& anomalyAlarmMonitor,
+        const UpdateStatus& updateStatus, const int64_t updateTimeNs) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    sp<AnomalyTracker> anomalyTracker = new AnomalyTracker(alert, mConfigKey);
+    addAnomalyTrackerLocked(anomalyTracker);
+    return anomalyTracker;
+}
+
+void GaugeMetricProducer::addAnomalyTracker(sp<AnomalyTracker>& anomalyTracker,
+                                            const int64_t updateTimeNs) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    addAnomalyTrackerLocked(anomalyTracker);
+}
+
+void GaugeMetricProducer::addAnomalyTrackerLocked(const sp<AnomalyTracker>& anomalyTracker) {
+    if (mAnomalyTrackers.empty()) {
+        // The atoms stored without trackers, e.g. before the config update that added the
+        // alert, are not in the anomaly slices yet.
+        for (const auto& [eventKey, gaugeAtoms] : *mCurrentSlicedBucket) {
+            if (!gaugeAtoms.empty()) {
+                updateCurrentSlicedBucketForAnomaly(eventKey, gaugeAtoms.front());
+            }
         }
-        (*mCurrentSlicedBucketForAnomaly)[slice.first] = gaugeVal;
     }
+    mAnomalyTrackers.push_back(anomalyTracker);
 }
 
 void GaugeMetricProducer::dropDataLocked(const int64_t dropTimeNs) {
@@ -589,6 +686,10 @@ void GaugeMetricProducer::dropDataLocked(const int64_t dropTimeNs) {
     mPastBuckets.clear();
 }
 
+void GaugeMetricProducer::releaseIdleMemoryLocked() {
+    mCurrentSlicedBucketPool.clear();
+}
+
 // When a new matched event comes in, we check if event falls into the current
 // bucket. If not, flush the old counter to past buckets and initialize the new
 // bucket.
@@ -648,10 +749,8 @@ void GaugeMetricProducer::flushCurrentBucketLocked(const int64_t& eventTimeNs,
         mSkippedBuckets.emplace_back(mCurrentSkippedBucket);
     }
 
-    // If we have anomaly trackers, we need to update the partial bucket values.
+    // The partial bucket values for the anomaly trackers are already up to date.
     if (mAnomalyTrackers.size() > 0) {
-        updateCurrentSlicedBucketForAnomaly();
-
         if (eventTimeNs > fullBucketEndTimeNs) {
             // This is known to be a full bucket, so send this data to the anomaly tracker.
             for (auto& tracker : mAnomalyTrackers) {
@@ -662,7 +761,8 @@ void GaugeMetricProducer::flushCurrentBucketLocked(const int64_t& eventTimeNs,
     }
 
     StatsdStats::getInstance().noteBucketCount(mMetricId);
-    mCurrentSlicedBucket = std::make_shared<DimToGaugeAtomsMap>();
+    mCurrentSlicedBucketPool.recycle(*mCurrentSlicedBucket);
+    mCurrentSampledAtomCounts.clear();
     mCurrentBucketStartTimeNs = nextBucketStartTimeNs;
     mCurrentSkippedBucket.reset();
 }
@@ -681,6 +781,26 @@ size_t GaugeMetricProducer::byteSizeLocked() const {
     return totalSize;
 }
 
+size_t GaugeMetricProducer::currentBucketByteSizeLocked() const {
+    size_t totalSize = 0;
+    for (const auto& [key, gaugeAtoms] : *mCurrentSlicedBucket) {
+        totalSize += hashMapEntryByteSize(key, sizeof(gaugeAtoms)) +
+                     gaugeAtoms.capacity() * sizeof(GaugeAtom);
+        for (const GaugeAtom& gaugeAtom : gaugeAtoms) {
+            if (gaugeAtom.mFields != nullptr) {
+                totalSize += gaugeAtom.mFields->capacity() * sizeof(FieldValue);
+            }
+        }
+    }
+    for (const auto& [key, _] : mCurrentSampledAtomCounts) {
+        totalSize += hashMapEntryByteSize(key, sizeof(int64_t));
+    }
+    for (const auto& [key, _] : *mCurrentSlicedBucketForAnomaly) {
+        totalSize += hashMapEntryByteSize(key, sizeof(int64_t));
+    }
+    return totalSize;
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <random>
 #include <unordered_map>
 
 #include <android/util/ProtoOutputStream.h>
@@ -28,6 +29,7 @@
 #include "MetricProducer.h"
 #include "src/statsd_config.pb.h"
 #include "../stats_util.h"
+#include "../utils/MapNodePool.h"
 
 namespace android {
 namespace os {
@@ -79,11 +81,16 @@ public:
     void onDataPulled(const std::vector<std::shared_ptr<LogEvent>>& data,
                       bool pullSuccess, int64_t originalPullTimeNs) override;
 
+    // Handles the data of a pull deferred by pullAndMatchEventsLocked().
+    void onDeferredDataPulled(const std::vector<std::shared_ptr<LogEvent>>& data,
+                              bool pullSuccess, int64_t eventTimeNs,
+                              int64_t pullDelayNs) override;
+
     // GaugeMetric needs to immediately trigger another pull when we create the partial bucket.
     void notifyAppUpgradeInternalLocked(const int64_t eventTimeNs) override {
         flushLocked(eventTimeNs);
         if (mIsPulled && mSamplingType == GaugeMetric::RANDOM_ONE_SAMPLE) {
-            pullAndMatchEventsLocked(eventTimeNs);
+            pullAndMatchEventsLocked(eventTimeNs, /*isBucketBoundary=*/true);
         }
     };
 
@@ -93,7 +100,7 @@ public:
 
         flushLocked(eventTimeNs);
         if (mIsPulled && mSamplingType == GaugeMetric::RANDOM_ONE_SAMPLE) {
-            pullAndMatchEventsLocked(eventTimeNs);
+            pullAndMatchEventsLocked(eventTimeNs, /*isBucketBoundary=*/true);
         }
     };
 
@@ -101,18 +108,29 @@ public:
         return METRIC_TYPE_GAUGE;
     }
 
+    bool isPulled() const override {
+        return mIsPulled;
+    }
+
+    sp<AnomalyTracker> addAnomalyTracker(const Alert& alert,
+                                         const sp<AlarmMonitor>& anomalyAlarmMonitor,
+                                         const UpdateStatus& updateStatus,
+                                         const int64_t updateTimeNs) override;
+
+    void addAnomalyTracker(sp<AnomalyTracker>& anomalyTracker, const int64_t updateTimeNs) override;
+
 protected:
     void onMatchedLogEventInternalLocked(
             const size_t matcherIndex, const MetricDimensionKey& eventKey,
             const ConditionKey& conditionKey, bool condition, const LogEvent& event,
-            const std::map<int, HashableDimensionKey>& statePrimaryKeys) override;
+            const std::vector<HashableDimensionKey>& statePrimaryKeys) override;
 
 private:
     void onDumpReportLocked(const int64_t dumpTimeNs,
                             const bool include_current_partial_bucket,
                             const bool erase_data,
                             const DumpLatency dumpLatency,
-                            std::set<string> *str_set,
+                            ReportStrings* str_set,
                             android::util::ProtoOutputStream* protoOutput) override;
     void clearPastBucketsLocked(const int64_t dumpTimeNs) override;
 
@@ -128,10 +146,14 @@ private:
     // Internal function to calculate the current used bytes.
     size_t byteSizeLocked() const override;
 
+    size_t currentBucketByteSizeLocked() const override;
+
     void dumpStatesLocked(FILE* out, bool verbose) const override;
 
     void dropDataLocked(const int64_t dropTimeNs) override;
 
+    void releaseIdleMemoryLocked() override;
+
     // Util function to flush the old packet.
     void flushIfNeededLocked(const int64_t& eventTime) override;
 
@@ -140,7 +162,24 @@ private:
 
     void prepareFirstBucketLocked() override;
 
-    void pullAndMatchEventsLocked(const int64_t timestampNs);
+    // Only the pulls at the start of a partial bucket may be deferred, the pulls triggered by
+    // events and condition changes are matched with the state they were triggered in.
+    void pullAndMatchEventsLocked(const int64_t timestampNs, const bool isBucketBoundary = false);
+
+    // Matches the [allData] pulled for an event at [timestampNs], unless the pull took too long.
+    void matchPulledEventsLocked(const std::vector<std::shared_ptr<LogEvent>>& allData,
+                                 const int64_t timestampNs, const int64_t pullDelayNs);
+
+    // The state of the metric when a deferred pull was issued, its data is matched in this state
+    // rather than in the state of the metric when the data arrives.
+    struct DeferredPullState {
+        int64_t eventTimeNs;
+        bool isActive;
+        ConditionState condition;
+    };
+
+    // The deferred pulls whose data has not arrived yet, in the order they were issued.
+    std::vector<DeferredPullState> mDeferredPulls;
 
     bool onConfigUpdatedLocked(
             const StatsdConfig& config, const int configIndex, const int metricIndex,
@@ -181,15 +220,31 @@ private:
     // The current partial bucket.
     std::shared_ptr<DimToGaugeAtomsMap> mCurrentSlicedBucket;
 
+    // The nodes of the last bucket of mCurrentSlicedBucket, reused by the next one.
+    MapNodePool<DimToGaugeAtomsMap> mCurrentSlicedBucketPool;
+
+    // With RESERVOIR_SAMPLES, the number of atoms of each dimension matched in the current bucket.
+    std::unordered_map<MetricDimensionKey, int64_t> mCurrentSampledAtomCounts;
+
+    // Picks the atoms that RESERVOIR_SAMPLES replaces.
+    std::minstd_rand mSampleRandom;
+
     // The current full bucket for anomaly detection. This is updated to the latest value seen for
     // this slice (ie, for partial buckets, we use the last partial bucket in this full bucket).
+    // Each slice is updated when the first atom of its current bucket changes, so it is not
+    // rebuilt when the buckets are flushed. It is only updated while there are anomaly trackers,
+    // so the first tracker added mid-bucket fills it in from the current bucket.
     std::shared_ptr<DimToValMap> mCurrentSlicedBucketForAnomaly;
 
     const int64_t mMinBucketSizeNs;
 
-    // Translate Atom based bucket to single numeric value bucket for anomaly and updates the map
-    // for each slice with the latest value.
-    void updateCurrentSlicedBucketForAnomaly();
+    // Translates [firstAtom], the new first atom of [eventKey] in the current bucket, to the
+    // numeric value of the slice for anomaly detection.
+    void updateCurrentSlicedBucketForAnomaly(const MetricDimensionKey& eventKey,
+                                             const GaugeAtom& firstAtom);
+
+    // Adds [anomalyTracker], filling in mCurrentSlicedBucketForAnomaly if it is the first one.
+    void addAnomalyTrackerLocked(const sp<AnomalyTracker>& anomalyTracker);
 
     // Allowlist of fields to report. Empty means all are reported.
     std::vector<Matcher> mFieldMatchers;
@@ -217,9 +272,12 @@ private:
     FRIEND_TEST(GaugeMetricProducerTest, TestPulledEventsNoCondition);
     FRIEND_TEST(GaugeMetricProducerTest, TestPulledWithAppUpgradeDisabled);
     FRIEND_TEST(GaugeMetricProducerTest, TestPulledEventsAnomalyDetection);
+    FRIEND_TEST(GaugeMetricProducerTest, TestAnomalyTrackerAddedMidBucket);
     FRIEND_TEST(GaugeMetricProducerTest, TestFirstBucket);
     FRIEND_TEST(GaugeMetricProducerTest, TestPullOnTrigger);
     FRIEND_TEST(GaugeMetricProducerTest, TestRemoveDimensionInOutput);
+    FRIEND_TEST(GaugeMetricProducerTest, TestReservoirSamples);
+    FRIEND_TEST(GaugeMetricProducerTest, TestDeferredPullKeepsScheduledState);
 
     FRIEND_TEST(GaugeMetricProducerTest_PartialBucket, TestPushedEvents);
     FRIEND_TEST(GaugeMetricProducerTest_PartialBucket, TestPulled);
@@ -22,6 +22,7 @@
 #include <limits.h>
 #include <stdlib.h>
 
+#include "anomaly/QuantileAnomalyTracker.h"
 #include "guardrail/StatsdStats.h"
 #include "metrics/parsing_utils/metrics_manager_util.h"
 #include "stats_log_util.h"
@@ -37,7 +38,6 @@ using std::optional;
 using std::shared_ptr;
 using std::string;
 using std::unordered_map;
-using zetasketch::android::AggregatorStateProto;
 
 namespace android {
 namespace os {
@@ -48,6 +48,7 @@ const int FIELD_ID_KLL_METRICS = 16;
 // for KllBucketInfo
 const int FIELD_ID_SKETCH_INDEX = 1;
 const int FIELD_ID_KLL_SKETCH = 2;
+const int FIELD_ID_QUANTILE_VALUES = 3;
 const int FIELD_ID_SKETCHES = 3;
 const int FIELD_ID_BUCKET_NUM = 4;
 const int FIELD_ID_START_BUCKET_ELAPSED_MILLIS = 5;
@@ -63,7 +64,12 @@ KllMetricProducer::KllMetricProducer(const ConfigKey& key, const KllMetric& metr
                                      const ActivationOptions& activationOptions,
                                      const GuardrailOptions& guardrailOptions)
     : ValueMetricProducer(metric.id(), key, protoHash, pullOptions, bucketOptions, whatOptions,
-                          conditionOptions, stateOptions, activationOptions, guardrailOptions) {
+                          conditionOptions, stateOptions, activationOptions, guardrailOptions),
+      mReportQuantiles(metric.report_quantiles().begin(), metric.report_quantiles().end()),
+      mDiffEncodeSketches(metric.diff_encode_sketches()),
+      mRandom(metric.compact_sketches()
+                      ? std::make_unique<dist_proc::aggregation::XorShiftRandomGenerator>()
+                      : nullptr) {
 }
 
 KllMetricProducer::DumpProtoFields KllMetricProducer::getDumpProtoFields() const {
@@ -76,18 +82,26 @@ KllMetricProducer::DumpProtoFields KllMetricProducer::getDumpProtoFields() const
 }
 
 void KllMetricProducer::writePastBucketAggregateToProto(
-        const int aggIndex, const unique_ptr<KllQuantile>& kll,
+        const int aggIndex, const unique_ptr<StagedKllQuantile>& kll,
         ProtoOutputStream* const protoOutput) const {
     uint64_t sketchesToken =
             protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_SKETCHES);
     protoOutput->write(FIELD_TYPE_INT32 | FIELD_ID_SKETCH_INDEX, aggIndex);
 
-    // TODO(b/186737273): Serialize directly to ProtoOutputStream
-    const AggregatorStateProto& aggProto = kll->SerializeToProto();
-    const size_t numBytes = aggProto.ByteSizeLong();
-    const unique_ptr<char[]> buffer(new char[numBytes]);
-    aggProto.SerializeToArray(&buffer[0], numBytes);
-    protoOutput->write(FIELD_TYPE_BYTES | FIELD_ID_KLL_SKETCH, &buffer[0], numBytes);
+    // The sketches of the past buckets are closed, see buildPartialBucket().
+    if (!mReportQuantiles.empty()) {
+        // Buckets always have values, so each quantile has one.
+        for (const optional<int64_t>& quantile : kll->getClosedQuantiles()) {
+            protoOutput->write(FIELD_TYPE_INT64 | FIELD_COUNT_REPEATED | FIELD_ID_QUANTILE_VALUES,
+                               (long long)quantile.value_or(0));
+        }
+        protoOutput->end(sketchesToken);
+        return;
+    }
+
+    const string& sketchBytes = kll->getClosedSketchBytes();
+    const size_t numBytes = sketchBytes.size();
+    protoOutput->write(FIELD_TYPE_BYTES | FIELD_ID_KLL_SKETCH, sketchBytes.data(), numBytes);
 
     VLOG("\t\t sketch %d: %zu bytes", aggIndex, numBytes);
     protoOutput->end(sketchesToken);
@@ -109,6 +123,20 @@ optional<int64_t> getInt64ValueFromEvent(const LogEvent& event, const Matcher& m
     return nullopt;
 }
 
+sp<AnomalyTracker> KllMetricProducer::addAnomalyTracker(const Alert& alert,
+                                                       const sp<AlarmMonitor>& anomalyAlarmMonitor,
+                                                       const UpdateStatus& updateStatus,
+                                                       const int64_t updateTimeNs) {
+    if (!alert.has_quantile()) {
+        return ValueMetricProducer::addAnomalyTracker(alert, anomalyAlarmMonitor, updateStatus,
+                                                      updateTimeNs);
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    sp<AnomalyTracker> anomalyTracker = new QuantileAnomalyTracker(alert, mConfigKey);
+    mAnomalyTrackers.push_back(anomalyTracker);
+    return anomalyTracker;
+}
+
 bool KllMetricProducer::aggregateFields(const int64_t eventTimeNs,
                                         const MetricDimensionKey& eventKey, const LogEvent& event,
                                         vector<Interval>& intervals, Empty& empty) {
@@ -126,27 +154,38 @@ bool KllMetricProducer::aggregateFields(const int64_t eventTimeNs,
 
         // interval.aggregate can be nullptr from cases:
         // 1. Initialization from default construction of Interval struct.
-        // 2. Ownership of the unique_ptr<KllQuantile> at interval.aggregate being transferred to
-        // PastBucket after flushing.
+        // 2. Ownership of the unique_ptr<StagedKllQuantile> at interval.aggregate being transferred
+        // to PastBucket after flushing.
         if (!interval.aggregate) {
-            interval.aggregate = KllQuantile::Create();
+            interval.aggregate =
+                    mRandom != nullptr
+                            ? std::make_unique<StagedKllQuantile>(mRandom.get(), &mSketchPool)
+                            : std::make_unique<StagedKllQuantile>(&mSketchPool);
         }
         seenNewData = true;
-        interval.aggregate->Add(valueOpt.value());
+        interval.aggregate->add(valueOpt.value());
         interval.sampleSize += 1;
+        // Quantile alerts are on the first value field.
+        if (i == 0) {
+            for (const sp<AnomalyTracker>& tracker : mAnomalyTrackers) {
+                tracker->addValue(eventTimeNs, mCurrentBucketNum, mMetricId, eventKey,
+                                  valueOpt.value());
+            }
+        }
     }
     return seenNewData;
 }
 
-PastBucket<unique_ptr<KllQuantile>> KllMetricProducer::buildPartialBucket(
+PastBucket<unique_ptr<StagedKllQuantile>> KllMetricProducer::buildPartialBucket(
         int64_t bucketEndTimeNs, vector<Interval>& intervals) {
-    PastBucket<unique_ptr<KllQuantile>> bucket;
+    PastBucket<unique_ptr<StagedKllQuantile>> bucket;
     bucket.mBucketStartNs = mCurrentBucketStartTimeNs;
     bucket.mBucketEndNs = bucketEndTimeNs;
     for (Interval& interval : intervals) {
         if (interval.hasValue()) {
             bucket.aggIndex.push_back(interval.aggIndex);
-            // Transfer ownership of unique_ptr<KllQuantile> from interval.aggregate to
+            interval.aggregate->close(mReportQuantiles, mDiffEncodeSketches);
+            // Transfer ownership of unique_ptr<StagedKllQuantile> from interval.aggregate to
             // bucket.aggregates vector. interval.aggregate is guaranteed to be nullptr after this.
             bucket.aggregates.push_back(std::move(interval.aggregate));
         }
@@ -154,18 +193,35 @@ PastBucket<unique_ptr<KllQuantile>> KllMetricProducer::buildPartialBucket(
     return bucket;
 }
 
+void KllMetricProducer::closeCurrentBucket(const int64_t eventTimeNs,
+                                           const int64_t nextBucketStartTimeNs) {
+    ValueMetricProducer::closeCurrentBucket(eventTimeNs, nextBucketStartTimeNs);
+    mSketchPool.endBucket();
+}
+
 size_t KllMetricProducer::byteSizeLocked() const {
-    size_t totalSize = 0;
+    // The pooled sketches are kept for the next buckets.
+    size_t totalSize = mSketchPool.getByteSize();
     for (const auto& [_, buckets] : mPastBuckets) {
         totalSize += buckets.size() * kBucketSize;
         for (const auto& bucket : buckets) {
             static const size_t kIntSize = sizeof(int);
             totalSize += bucket.aggIndex.size() * kIntSize;
-            if (!bucket.aggregates.empty()) {
-                static const size_t kInt64Size = sizeof(int64_t);
-                // Assume sketch size is the same for all aggregations in a bucket.
-                totalSize += bucket.aggregates.size() * kInt64Size *
-                             bucket.aggregates[0]->num_stored_values();
+            // The sketches of the past buckets are closed, they only keep their report.
+            for (const auto& aggregate : bucket.aggregates) {
+                totalSize += aggregate->getByteSize();
+            }
+        }
+    }
+    return totalSize;
+}
+
+size_t KllMetricProducer::currentBucketByteSizeLocked() const {
+    size_t totalSize = ValueMetricProducer::currentBucketByteSizeLocked();
+    for (const auto& [_, currentBucket] : mCurrentSlicedBucket) {
+        for (const Interval& interval : currentBucket.intervals) {
+            if (interval.aggregate != nullptr) {
+                totalSize += interval.aggregate->getByteSize();
             }
         }
     }
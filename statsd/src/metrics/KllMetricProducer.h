@@ -27,6 +27,7 @@
 #include "condition/ConditionTimer.h"
 #include "condition/ConditionTracker.h"
 #include "matchers/EventMatcherWizard.h"
+#include "metrics/StagedKllQuantile.h"
 #include "src/statsd_config.pb.h"
 #include "stats_log_util.h"
 
@@ -36,13 +37,13 @@ namespace android {
 namespace os {
 namespace statsd {
 
-// Uses KllQuantile to aggregate values within buckets.
+// Uses KllQuantile to aggregate values within buckets, see StagedKllQuantile.
 //
 // There are different events that might complete a bucket
 // - a condition change
 // - an app upgrade
 // - an alarm set to the end of the bucket
-class KllMetricProducer : public ValueMetricProducer<std::unique_ptr<KllQuantile>, Empty> {
+class KllMetricProducer : public ValueMetricProducer<std::unique_ptr<StagedKllQuantile>, Empty> {
 public:
     KllMetricProducer(const ConfigKey& key, const KllMetric& kllMetric, const uint64_t protoHash,
                       const PullOptions& pullOptions, const BucketOptions& bucketOptions,
@@ -54,6 +55,14 @@ public:
         return METRIC_TYPE_KLL;
     }
 
+    using ValueMetricProducer::addAnomalyTracker;
+
+    // Creates a QuantileAnomalyTracker for the alerts with a quantile.
+    sp<AnomalyTracker> addAnomalyTracker(const Alert& alert,
+                                         const sp<AlarmMonitor>& anomalyAlarmMonitor,
+                                         const UpdateStatus& updateStatus,
+                                         const int64_t updateTimeNs) override;
+
 protected:
 private:
     inline optional<int64_t> getConditionIdForMetric(const StatsdConfig& config,
@@ -75,7 +84,7 @@ private:
     // Determine whether or not a LogEvent can be skipped.
     inline bool canSkipLogEventLocked(
             const MetricDimensionKey& eventKey, bool condition, int64_t eventTimeNs,
-            const std::map<int, HashableDimensionKey>& statePrimaryKeys) const override {
+            const std::vector<HashableDimensionKey>& statePrimaryKeys) const override {
         // Can only skip if the condition is false.
         // We assume metric is pushed since KllMetric doesn't support pulled metrics.
         return !condition;
@@ -84,8 +93,8 @@ private:
     DumpProtoFields getDumpProtoFields() const override;
 
     inline std::string aggregatedValueToString(
-            const std::unique_ptr<KllQuantile>& aggregate) const override {
-        return std::to_string(aggregate->num_values()) + " values";
+            const std::unique_ptr<StagedKllQuantile>& aggregate) const override {
+        return std::to_string(aggregate->getNumValues()) + " values";
     }
 
     inline bool multipleBucketsSkipped(const int64_t numBucketsForward) const override {
@@ -93,12 +102,16 @@ private:
         return false;
     }
 
-    // The KllQuantile ptr ownership is transferred to newly created PastBuckets from Intervals.
-    PastBucket<std::unique_ptr<KllQuantile>> buildPartialBucket(
+    // The StagedKllQuantile ptr ownership is transferred to newly created PastBuckets from
+    // Intervals. The sketches are closed, giving their KllQuantile to mSketchPool.
+    PastBucket<std::unique_ptr<StagedKllQuantile>> buildPartialBucket(
             int64_t bucketEndTime, std::vector<Interval>& intervals) override;
 
+    void closeCurrentBucket(const int64_t eventTimeNs,
+                            const int64_t nextBucketStartTimeNs) override;
+
     void writePastBucketAggregateToProto(const int aggIndex,
-                                         const std::unique_ptr<KllQuantile>& kll,
+                                         const std::unique_ptr<StagedKllQuantile>& kll,
                                          ProtoOutputStream* const protoOutput) const override;
 
     bool aggregateFields(const int64_t eventTimeNs, const MetricDimensionKey& eventKey,
@@ -108,10 +121,25 @@ private:
     // Internal function to calculate the current used bytes.
     size_t byteSizeLocked() const override;
 
+    size_t currentBucketByteSizeLocked() const override;
+
+    // KllMetric.report_quantiles, and KllMetric.diff_encode_sketches.
+    const std::vector<double> mReportQuantiles;
+    const bool mDiffEncodeSketches;
+
+    // Shared by the sketches of the metric if KllMetric.compact_sketches is set, or null. Only
+    // used under mMutex.
+    const std::unique_ptr<dist_proc::aggregation::XorShiftRandomGenerator> mRandom;
+
+    // The KllQuantiles of the last closed bucket, reused by the sketches of the current one. Only
+    // used under mMutex.
+    KllSketchPool mSketchPool;
+
     FRIEND_TEST(KllMetricProducerTest, TestByteSize);
     FRIEND_TEST(KllMetricProducerTest, TestPushedEventsWithoutCondition);
     FRIEND_TEST(KllMetricProducerTest, TestPushedEventsWithCondition);
     FRIEND_TEST(KllMetricProducerTest, TestForcedBucketSplitWhenConditionUnknownSkipsBucket);
+    FRIEND_TEST(KllMetricProducerTest, TestSketchesReusedAcrossBuckets);
 
     FRIEND_TEST(KllMetricProducerTest_BucketDrop, TestInvalidBucketWhenConditionUnknown);
     FRIEND_TEST(KllMetricProducerTest_BucketDrop, TestBucketDropWhenBucketTooSmall);
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "MetricDimensionKeyTable.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::lock_guard;
+
+uint32_t MetricDimensionKeyTable::acquire(const MetricDimensionKey& key) {
+    const size_t hash = std::hash<MetricDimensionKey>()(key);
+    lock_guard<std::mutex> lock(mMutex);
+    uint32_t id;
+    if (!findLocked(key, hash, &id)) {
+        if (mFreeIds.empty()) {
+            id = mEntries.size();
+            mEntries.emplace_back();
+        } else {
+            id = mFreeIds.back();
+            mFreeIds.pop_back();
+        }
+        mEntries[id].key = key;
+        mIdsByHash.emplace(hash, id);
+    }
+    mEntries[id].refCount++;
+    return id;
+}
+
+void MetricDimensionKeyTable::release(uint32_t id) {
+    lock_guard<std::mutex> lock(mMutex);
+    Entry& entry = mEntries[id];
+    if (--entry.refCount > 0) {
+        return;
+    }
+    const auto range = mIdsByHash.equal_range(std::hash<MetricDimensionKey>()(entry.key));
+    for (auto it = range.first; it != range.second; it++) {
+        if (it->second == id) {
+            mIdsByHash.erase(it);
+            break;
+        }
+    }
+    entry.key = MetricDimensionKey();
+    mFreeIds.push_back(id);
+}
+
+bool MetricDimensionKeyTable::find(const MetricDimensionKey& key, uint32_t* id) const {
+    const size_t hash = std::hash<MetricDimensionKey>()(key);
+    lock_guard<std::mutex> lock(mMutex);
+    return findLocked(key, hash, id);
+}
+
+const MetricDimensionKey& MetricDimensionKeyTable::getKey(uint32_t id) const {
+    lock_guard<std::mutex> lock(mMutex);
+    return mEntries[id].key;
+}
+
+size_t MetricDimensionKeyTable::size() const {
+    lock_guard<std::mutex> lock(mMutex);
+    return mIdsByHash.size();
+}
+
+bool MetricDimensionKeyTable::findLocked(const MetricDimensionKey& key, size_t hash,
+                                         uint32_t* id) const {
+    const auto range = mIdsByHash.equal_range(hash);
+    for (auto it = range.first; it != range.second; it++) {
+        if (mEntries[it->second].key == key) {
+            *id = it->second;
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <utils/RefBase.h>
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "HashableDimensionKey.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Interns the MetricDimensionKeys of the metrics of a config, so that the metrics store a 32-bit
+ * id per dimension instead of a copy of its values, and identical dimensions of several metrics
+ * share one copy. Ids are reference counted, and reused once released.
+ *
+ * Shared by the metrics of a MetricsManager, which lock their own mutexes, so it is thread safe.
+ */
+class MetricDimensionKeyTable : public virtual RefBase {
+public:
+    // Returns the id of [key] and adds a reference to it.
+    uint32_t acquire(const MetricDimensionKey& key);
+
+    // Removes a reference to [id]. The key is forgotten with its last reference.
+    void release(uint32_t id);
+
+    // Returns true and sets [id] if [key] is in the table. Adds no reference.
+    bool find(const MetricDimensionKey& key, uint32_t* id) const;
+
+    // Returns the key of [id], which stays valid while [id] is referenced.
+    const MetricDimensionKey& getKey(uint32_t id) const;
+
+    // Number of keys referenced.
+    size_t size() const;
+
+private:
+    struct Entry {
+        MetricDimensionKey key;
+        int refCount = 0;
+    };
+
+    bool findLocked(const MetricDimensionKey& key, size_t hash, uint32_t* id) const;
+
+    mutable std::mutex mMutex;
+
+    // Indexed by id. Entries don't move when others are added, so getKey() can return them.
+    std::deque<Entry> mEntries;
+
+    // The ids of the released entries.
+    std::vector<uint32_t> mFreeIds;
+
+    // The ids of the referenced keys by hash, so that each key is only stored in mEntries.
+    std::unordered_multimap<size_t, uint32_t> mIdsByHash;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
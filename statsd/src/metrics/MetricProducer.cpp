@@ -19,9 +19,14 @@
 
 #include "MetricProducer.h"
 
+#include <algorithm>
+#include <limits>
+
 #include "../guardrail/StatsdStats.h"
+#include "hash.h"
 #include "metrics/parsing_utils/metrics_manager_util.h"
 #include "state/StateTracker.h"
+#include "stats_log_util.h"
 
 using android::util::FIELD_COUNT_REPEATED;
 using android::util::FIELD_TYPE_ENUM;
@@ -44,6 +49,10 @@ const int FIELD_ID_ACTIVE_EVENT_ACTIVATION_ATOM_MATCHER_INDEX = 1;
 const int FIELD_ID_ACTIVE_EVENT_ACTIVATION_REMAINING_TTL_NANOS = 2;
 const int FIELD_ID_ACTIVE_EVENT_ACTIVATION_STATE = 3;
 
+// for StatsLogReport
+const int FIELD_ID_ESTIMATED_DIMENSION_CARDINALITY = 17;
+const int FIELD_ID_SAMPLING_SHARD_COUNT = 18;
+
 MetricProducer::MetricProducer(
         const int64_t& metricId, const ConfigKey& key, const int64_t timeBaseNs,
         const int conditionIndex, const vector<ConditionState>& initialConditionCache,
@@ -73,6 +82,7 @@ MetricProducer::MetricProducer(
       mIsActive(mEventActivationMap.empty()),
       mSlicedStateAtoms(slicedStateAtoms),
       mStateGroupMap(stateGroupMap),
+      mStateGroupTables(StateGroupTable::build(stateGroupMap)),
       mSplitBucketForAppUpgrade(splitBucketForAppUpgrade) {
 }
 
@@ -92,6 +102,11 @@ bool MetricProducer::onConfigUpdatedLocked(
         vector<int>& metricsWithActivation) {
     sp<ConditionWizard> tmpWizard = mWizard;
     mWizard = wizard;
+    // The dimensions and links may change.
+    mScratchConditionKey.clear();
+    mDimensionsInWhatPlan = DimensionExtractionPlan();
+    mConditionLinkPlans.clear();
+    mStateLinkPlans.clear();
 
     unordered_map<int, shared_ptr<Activation>> newEventActivationMap;
     unordered_map<int, vector<shared_ptr<Activation>>> newEventDeactivationMap;
@@ -117,12 +132,32 @@ void MetricProducer::onMatchedLogEventLocked(const size_t matcherIndex, const Lo
     if (eventTimeNs < mTimeBaseNs) {
         return;
     }
+    // Before any key is built, so that the dropped shards cost little.
+    if (mShardCount > 1 && !passesSampleCheckLocked(event)) {
+        return;
+    }
+
+    // Most events hit existing dimensions, so the keys are built in the scratch keys, whose
+    // capacity is reused, and only copied by the maps that insert them. Gauge and value metrics
+    // match pulled events from within onMatchedLogEventInternalLocked(), these use local keys.
+    const bool useScratchKeys = !mScratchKeysInUse;
+    MetricDimensionKey localMetricKey;
+    ConditionKey localConditionKey;
+    vector<HashableDimensionKey> localStatePrimaryKeys;
+    MetricDimensionKey& metricKey = useScratchKeys ? mScratchMetricKey : localMetricKey;
+    ConditionKey& conditionKey = useScratchKeys ? mScratchConditionKey : localConditionKey;
+    vector<HashableDimensionKey>& statePrimaryKeys =
+            useScratchKeys ? mScratchStatePrimaryKeys : localStatePrimaryKeys;
 
     bool condition;
-    ConditionKey conditionKey;
     if (mConditionSliced) {
-        for (const auto& link : mMetric2ConditionLinks) {
-            getDimensionForCondition(event.getValues(), link, &conditionKey[link.conditionId]);
+        mConditionLinkPlans.resize(mMetric2ConditionLinks.size());
+        for (size_t i = 0; i < mMetric2ConditionLinks.size(); i++) {
+            const Metric2Condition& link = mMetric2ConditionLinks[i];
+            HashableDimensionKey& conditionDimension = conditionKey[link.conditionId];
+            conditionDimension.clear();
+            getDimensionForCondition(event.getValues(), link, &conditionDimension,
+                                     event.getFieldIndex(), &mConditionLinkPlans[i]);
         }
         auto conditionState =
             mWizard->query(mConditionTrackerIndex, conditionKey,
@@ -133,16 +168,15 @@ void MetricProducer::onMatchedLogEventLocked(const size_t matcherIndex, const Lo
         condition = mCondition == ConditionState::kTrue;
     }
 
-    // Stores atom id to primary key pairs for each state atom that the metric is
-    // sliced by.
-    std::map<int32_t, HashableDimensionKey> statePrimaryKeys;
-
     // For states with primary fields, use MetricStateLinks to get the primary
     // field values from the log event. These values will form a primary key
     // that will be used to query StateTracker for the correct state value.
-    for (const auto& stateLink : mMetric2StateLinks) {
-        getDimensionForState(event.getValues(), stateLink,
-                             &statePrimaryKeys[stateLink.stateAtomId]);
+    mStateLinkPlans.resize(mMetric2StateLinks.size());
+    statePrimaryKeys.resize(mMetric2StateLinks.size());
+    for (size_t i = 0; i < mMetric2StateLinks.size(); i++) {
+        statePrimaryKeys[i].clear();
+        getDimensionForState(event.getValues(), mMetric2StateLinks[i], &statePrimaryKeys[i],
+                             event.getFieldIndex(), &mStateLinkPlans[i]);
     }
 
     // For each sliced state, query StateTracker for the state value using
@@ -153,26 +187,142 @@ void MetricProducer::onMatchedLogEventLocked(const size_t matcherIndex, const Lo
     // links are provided for a state with primary fields, links are provided
     // in the wrong order, etc.), StateTracker will simply return kStateUnknown
     // when queried using an incorrect key.
-    HashableDimensionKey stateValuesKey;
+    HashableDimensionKey* stateValuesKey = metricKey.getMutableStateValuesKey();
+    stateValuesKey->clear();
     for (auto atomId : mSlicedStateAtoms) {
         FieldValue value;
-        if (statePrimaryKeys.find(atomId) != statePrimaryKeys.end()) {
-            // found a primary key for this state, query using the key
-            queryStateValue(atomId, statePrimaryKeys[atomId], &value);
-        } else {
-            // if no MetricStateLinks exist for this state atom,
-            // query using the default dimension key (empty HashableDimensionKey)
-            queryStateValue(atomId, DEFAULT_DIMENSION_KEY, &value);
-        }
+        queryStateValue(atomId, getStatePrimaryKey(statePrimaryKeys, atomId), &value);
         mapStateValue(atomId, &value);
-        stateValuesKey.addValue(value);
+        stateValuesKey->addValue(value);
     }
 
-    HashableDimensionKey dimensionInWhat;
-    filterValues(mDimensionsInWhat, event.getValues(), &dimensionInWhat);
-    MetricDimensionKey metricKey(dimensionInWhat, stateValuesKey);
+    HashableDimensionKey* dimensionInWhat = metricKey.getMutableDimensionKeyInWhat();
+    dimensionInWhat->clear();
+    mDimensionsInWhatPlan.extract(mDimensionsInWhat, event.getValues(), event.getFieldIndex(),
+                                  dimensionInWhat);
+    noteDimensionLocked(*dimensionInWhat, *stateValuesKey);
+
+    mScratchKeysInUse = true;
     onMatchedLogEventInternalLocked(matcherIndex, metricKey, conditionKey, condition, event,
                                     statePrimaryKeys);
+    if (useScratchKeys) {
+        mScratchKeysInUse = false;
+    }
+}
+
+void MetricProducer::setDimensionCardinalityEstimate(const bool enabled) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    // The estimate restarts with the config, like after a report that erases data.
+    mDimensionCardinality = enabled ? std::make_unique<HyperLogLog>() : nullptr;
+}
+
+void MetricProducer::setSamplingInfo(const DimensionalSamplingInfo& samplingInfo) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mSampledWhatFields.clear();
+    translateFieldMatcher(samplingInfo.sampled_what_field(), &mSampledWhatFields);
+    mShardCount = samplingInfo.shard_count();
+}
+
+bool MetricProducer::passesSampleCheckLocked(const LogEvent& event) const {
+    FieldValue sampledValue;
+    if (mSampledWhatFields.empty() ||
+        !filterValues(mSampledWhatFields[0], event.getValues(), &sampledValue)) {
+        return true;
+    }
+    return hashValue(sampledValue.mValue) % mShardCount == 0;
+}
+
+void MetricProducer::writeSamplingInfoLocked(ProtoOutputStream* protoOutput) const {
+    if (mShardCount > 1) {
+        protoOutput->write(FIELD_TYPE_INT32 | FIELD_ID_SAMPLING_SHARD_COUNT, mShardCount);
+    }
+}
+
+void MetricProducer::setPastBucketRollup(const int64_t minAgeNs, const int64_t bucketSizeNs) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (bucketSizeNs <= mBucketSizeNs) {
+        // The buckets already rolled up stay merged.
+        mRollupMinAgeNs = 0;
+        mRollupBucketSizeNs = 0;
+        return;
+    }
+    mRollupMinAgeNs = minAgeNs;
+    mRollupBucketSizeNs = bucketSizeNs;
+}
+
+void MetricProducer::rollUpPastBucketsIfNeededLocked(const int64_t eventTimeNs) {
+    if (mRollupBucketSizeNs == 0 || eventTimeNs - mRollupMinAgeNs <= mTimeBaseNs) {
+        return;
+    }
+    const int64_t rollupEndNs =
+            mTimeBaseNs + (eventTimeNs - mRollupMinAgeNs - mTimeBaseNs) / mRollupBucketSizeNs *
+                                  mRollupBucketSizeNs;
+    if (rollupEndNs <= mRolledUpUntilNs) {
+        return;
+    }
+    rollUpPastBucketsLocked(rollupEndNs);
+    mRolledUpUntilNs = rollupEndNs;
+}
+
+void MetricProducer::setCostTracking(const bool enabled) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mTrackCost = enabled;
+    if (!enabled) {
+        // The cost of a metric that stopped tracking it is not reported.
+        mCostEventCount = 0;
+        mCostEventProcessingNs = 0;
+        mCostMaxByteSize = 0;
+    }
+}
+
+void MetricProducer::onMatchedLogEventWithCostLocked(const size_t matcherIndex,
+                                                     const LogEvent& event) {
+    if (mCostEventCount++ % kCostSamplingInterval != 0) {
+        onMatchedLogEventLocked(matcherIndex, event);
+        return;
+    }
+    const int64_t startNs = getElapsedRealtimeNs();
+    onMatchedLogEventLocked(matcherIndex, event);
+    mCostEventProcessingNs += (getElapsedRealtimeNs() - startNs) * kCostSamplingInterval;
+}
+
+int64_t MetricProducer::startDumpCostLocked() {
+    mCostMaxByteSize =
+            std::max(mCostMaxByteSize, byteSizeLocked() + mDimensionProtoCache.byteSize());
+    return getElapsedRealtimeNs();
+}
+
+void MetricProducer::noteCostLocked(const int64_t dumpStartNs) {
+    StatsdStats::getInstance().noteMetricCost(mMetricId, mCostEventCount, mCostEventProcessingNs,
+                                              getElapsedRealtimeNs() - dumpStartNs,
+                                              mCostMaxByteSize);
+    mCostEventCount = 0;
+    mCostEventProcessingNs = 0;
+    mCostMaxByteSize = 0;
+}
+
+void MetricProducer::noteDimensionLocked(const HashableDimensionKey& dimensionInWhat,
+                                         const HashableDimensionKey& stateValuesKey) {
+    if (mDimensionCardinality == nullptr) {
+        return;
+    }
+    // Same as std::hash<MetricDimensionKey>, without building the key.
+    const uint64_t hashes[] = {dimensionInWhat.getHash(), stateValuesKey.getHash()};
+    mDimensionCardinality->add(Hash64(reinterpret_cast<const char*>(hashes), sizeof(hashes)));
+}
+
+void MetricProducer::writeDimensionCardinalityLocked(const bool eraseData,
+                                                     ProtoOutputStream* protoOutput) {
+    if (mDimensionCardinality == nullptr) {
+        return;
+    }
+    const int64_t estimate = mDimensionCardinality->estimate();
+    protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_ESTIMATED_DIMENSION_CARDINALITY,
+                       (long long)estimate);
+    StatsdStats::getInstance().noteMetricDimensionCardinality(mConfigKey, mMetricId, estimate);
+    if (eraseData) {
+        mDimensionCardinality->clear();
+    }
 }
 
 bool MetricProducer::evaluateActiveStateLocked(int64_t elapsedTimestampNs) {
@@ -200,6 +350,17 @@ void MetricProducer::flushIfExpire(int64_t elapsedTimestampNs) {
     }
 }
 
+int64_t MetricProducer::getActivationExpiryNs() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    int64_t expiryNs = std::numeric_limits<int64_t>::max();
+    for (const auto& it : mEventActivationMap) {
+        if (it.second->state == ActivationState::kActive) {
+            expiryNs = std::min(expiryNs, it.second->start_ns + it.second->ttl_ns);
+        }
+    }
+    return expiryNs;
+}
+
 void MetricProducer::activateLocked(int activationTrackerIndex, int64_t elapsedTimestampNs) {
     auto it = mEventActivationMap.find(activationTrackerIndex);
     if (it == mEventActivationMap.end()) {
@@ -303,6 +464,17 @@ void MetricProducer::writeActiveMetricToProtoOutputStream(
     }
 }
 
+const HashableDimensionKey& MetricProducer::getStatePrimaryKey(
+        const vector<HashableDimensionKey>& statePrimaryKeys, const int32_t atomId) const {
+    // A metric links to few states, a scan is faster than a lookup.
+    for (size_t i = 0; i < mMetric2StateLinks.size() && i < statePrimaryKeys.size(); i++) {
+        if (mMetric2StateLinks[i].stateAtomId == atomId) {
+            return statePrimaryKeys[i];
+        }
+    }
+    return DEFAULT_DIMENSION_KEY;
+}
+
 void MetricProducer::queryStateValue(const int32_t atomId, const HashableDimensionKey& queryKey,
                                      FieldValue* value) {
     if (!StateManager::getInstance().getStateValue(atomId, queryKey, value)) {
@@ -315,20 +487,22 @@ void MetricProducer::queryStateValue(const int32_t atomId, const HashableDimensi
 
 void MetricProducer::mapStateValue(const int32_t atomId, FieldValue* value) {
     // check if there is a state map for this atom
-    auto atomIt = mStateGroupMap.find(atomId);
-    if (atomIt == mStateGroupMap.end()) {
+    for (const StateGroupTable& table : mStateGroupTables) {
+        if (table.getAtomId() != atomId) {
+            continue;
+        }
+        int64_t groupId;
+        if (table.getGroupId(value->mValue.int_value, &groupId)) {
+            // set mValue to group_id
+            value->mValue.setLong(groupId);
+        } else {
+            // state map exists, but value was not put in a state group
+            // so set mValue to kStateUnknown
+            // TODO(tsaichristine): handle incomplete state maps
+            value->mValue.setInt(StateTracker::kStateUnknown);
+        }
         return;
     }
-    auto valueIt = atomIt->second.find(value->mValue.int_value);
-    if (valueIt == atomIt->second.end()) {
-        // state map exists, but value was not put in a state group
-        // so set mValue to kStateUnknown
-        // TODO(tsaichristine): handle incomplete state maps
-        value->mValue.setInt(StateTracker::kStateUnknown);
-    } else {
-        // set mValue to group_id
-        value->mValue.setLong(valueIt->second);
-    }
 }
 
 HashableDimensionKey MetricProducer::getUnknownStateKey() {
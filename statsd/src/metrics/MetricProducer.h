@@ -20,17 +20,24 @@
 #include <src/active_config_list.pb.h>
 #include <utils/RefBase.h>
 
+#include <algorithm>
 #include <unordered_map>
 
+#include "DimensionExtractionPlan.h"
 #include "HashableDimensionKey.h"
 #include "anomaly/AnomalyTracker.h"
 #include "condition/ConditionWizard.h"
 #include "config/ConfigKey.h"
 #include "matchers/EventMatcherWizard.h"
 #include "matchers/matcher_util.h"
+#include "metrics/DimensionProtoCache.h"
+#include "metrics/MetricDimensionKeyTable.h"
 #include "packages/PackageInfoListener.h"
+#include "state/StateGroupTable.h"
 #include "state/StateListener.h"
 #include "state/StateManager.h"
+#include "utils/HyperLogLog.h"
+#include "utils/ReportStrings.h"
 
 namespace android {
 namespace os {
@@ -45,7 +52,10 @@ enum DumpReportReason {
     ADB_DUMP = 5,
     CONFIG_RESET = 6,
     STATSCOMPANION_DIED = 7,
-    TERMINATION_SIGNAL_RECEIVED = 8
+    TERMINATION_SIGNAL_RECEIVED = 8,
+    MEMORY_PRESSURE = 9,
+    CHECKPOINT = 10,
+    REPORT_STREAMED = 11
 };
 
 // If the metric has no activation requirement, it will be active once the metric producer is
@@ -218,6 +228,10 @@ public:
     // Consume the parsed stats log entry that already matched the "what" of the metric.
     void onMatchedLogEvent(const size_t matcherIndex, const LogEvent& event) {
         std::lock_guard<std::mutex> lock(mMutex);
+        if (mTrackCost) {
+            onMatchedLogEventWithCostLocked(matcherIndex, event);
+            return;
+        }
         onMatchedLogEventLocked(matcherIndex, event);
     }
 
@@ -246,13 +260,37 @@ public:
                       const bool include_current_partial_bucket,
                       const bool erase_data,
                       const DumpLatency dumpLatency,
-                      std::set<string> *str_set,
+                      ReportStrings* str_set,
                       android::util::ProtoOutputStream* protoOutput) {
         std::lock_guard<std::mutex> lock(mMutex);
-        return onDumpReportLocked(dumpTimeNs, include_current_partial_bucket, erase_data,
-                dumpLatency, str_set, protoOutput);
+        const int64_t costStartNs = mTrackCost ? startDumpCostLocked() : 0;
+        onDumpReportLocked(dumpTimeNs, include_current_partial_bucket, erase_data, dumpLatency,
+                           str_set, protoOutput);
+        writeDimensionCardinalityLocked(erase_data, protoOutput);
+        writeSamplingInfoLocked(protoOutput);
+        mDimensionProtoCache.pruneUnused();
+        if (mTrackCost) {
+            noteCostLocked(costStartNs);
+        }
     }
 
+    // Estimates the number of distinct dimension keys of the matched events from now on if
+    // [enabled], see StatsdConfig.estimate_dimension_cardinality. The previous estimate is dropped.
+    void setDimensionCardinalityEstimate(const bool enabled);
+
+    // Only keeps the matched events of 1 out of shard_count shards of the sampled field values
+    // from now on, see DimensionalSamplingInfo.
+    void setSamplingInfo(const DimensionalSamplingInfo& samplingInfo);
+
+    // Merges the past buckets that are [minAgeNs] old into buckets of [bucketSizeNs] from now on,
+    // if the metric has smaller buckets, see StatsdConfig.past_bucket_rollup. Stops merging them
+    // otherwise, e.g. with a [bucketSizeNs] of 0.
+    void setPastBucketRollup(const int64_t minAgeNs, const int64_t bucketSizeNs);
+
+    // Measures the cost of the metric from now on, reported to StatsdStats with each dump, see
+    // StatsdConfig.track_metric_cost. Disabling it drops the cost measured since the last dump.
+    void setCostTracking(const bool enabled);
+
     virtual bool onConfigUpdatedLocked(
             const StatsdConfig& config, const int configIndex, const int metricIndex,
             const std::vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers,
@@ -279,11 +317,38 @@ public:
         prepareFirstBucketLocked();
     }
 
-    // Returns the memory in bytes currently used to store this metric's data. Does not change
-    // state.
+    // Interns the dimension keys of the stored data in [keyTable], which the metrics of the config
+    // share.
+    void setDimensionKeyTable(const sp<MetricDimensionKeyTable>& keyTable) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        setDimensionKeyTableLocked(keyTable);
+    }
+
+    // Returns the memory in bytes currently used to store this metric's data, including the
+    // dimension protos cached for the reports. Does not change state.
     size_t byteSize() const {
         std::lock_guard<std::mutex> lock(mMutex);
-        return byteSizeLocked();
+        const size_t byteSize = byteSizeLocked() + mDimensionProtoCache.byteSize();
+        if (mTrackCost) {
+            mCostMaxByteSize = std::max(mCostMaxByteSize, byteSize);
+        }
+        return byteSize;
+    }
+
+    // Returns the estimated heap bytes of the current bucket data.
+    size_t currentBucketByteSize() const {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return currentBucketByteSizeLocked();
+    }
+
+    // Returns the estimated heap bytes of the anomaly trackers of this metric.
+    size_t anomalyTrackerByteSize() const {
+        std::lock_guard<std::mutex> lock(mMutex);
+        size_t totalSize = 0;
+        for (const sp<AnomalyTracker>& anomalyTracker : mAnomalyTrackers) {
+            totalSize += anomalyTracker->byteSize();
+        }
+        return totalSize;
     }
 
     void dumpStates(FILE* out, bool verbose) const {
@@ -322,6 +387,20 @@ public:
 
     void flushIfExpire(int64_t elapsedTimestampNs);
 
+    // Frees the memory kept to reuse it across buckets, unless the metric is active. Called once
+    // the metric has been inactive for StatsdConfig.inactive_metric_memory_release_millis.
+    void releaseIdleMemory() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mIsActive) {
+            releaseIdleMemoryLocked();
+        }
+    }
+
+    // Returns the earliest time at which an active activation of this metric expires, i.e.
+    // flushIfExpire() can't deactivate the metric before a later time. INT64_MAX if none is
+    // active.
+    int64_t getActivationExpiryNs() const;
+
     void writeActiveMetricToProtoOutputStream(
             int64_t currentTimeNs, const DumpReportReason reason, ProtoOutputStream* proto);
 
@@ -336,6 +415,18 @@ public:
 
     virtual MetricType getMetricType() const = 0;
 
+    // Whether the "what" atom is pulled. The pulled events are matched with the
+    // EventMatcherWizard of the config, which the producers share.
+    virtual bool isPulled() const {
+        return false;
+    }
+
+    // Whether the producer keeps state from the events of its "what" while it is inactive, so
+    // that MetricsManager dispatches them to it even when no metric of the config is active.
+    virtual bool consumesEventsWhileInactive() const {
+        return false;
+    }
+
     // For test only.
     inline int64_t getCurrentBucketNum() const {
         return mCurrentBucketNum;
@@ -417,11 +508,12 @@ protected:
      *              query with ConditionWizard; If condition is not sliced, this is the
      *              nonSlicedCondition.
      * [event]: the log event, just in case the metric needs its data, e.g., EventMetric.
+     * [statePrimaryKeys]: the primary key of the event for each of mMetric2StateLinks.
      */
     virtual void onMatchedLogEventInternalLocked(
             const size_t matcherIndex, const MetricDimensionKey& eventKey,
             const ConditionKey& conditionKey, bool condition, const LogEvent& event,
-            const map<int, HashableDimensionKey>& statePrimaryKeys) = 0;
+            const std::vector<HashableDimensionKey>& statePrimaryKeys) = 0;
 
     // Consume the parsed stats log entry that already matched the "what" of the metric.
     virtual void onMatchedLogEventLocked(const size_t matcherIndex, const LogEvent& event);
@@ -432,11 +524,50 @@ protected:
                                     const bool include_current_partial_bucket,
                                     const bool erase_data,
                                     const DumpLatency dumpLatency,
-                                    std::set<string> *str_set,
+                                    ReportStrings* str_set,
                                     android::util::ProtoOutputStream* protoOutput) = 0;
     virtual void clearPastBucketsLocked(const int64_t dumpTimeNs) = 0;
     virtual void prepareFirstBucketLocked(){};
+    virtual void setDimensionKeyTableLocked(const sp<MetricDimensionKeyTable>& keyTable){};
+
+    // Adds the key of a matched event to mDimensionCardinality, if enabled.
+    void noteDimensionLocked(const HashableDimensionKey& dimensionInWhat,
+                             const HashableDimensionKey& stateValuesKey);
+
+    // Writes the estimate of mDimensionCardinality to the report and to StatsdStats, if enabled.
+    void writeDimensionCardinalityLocked(const bool eraseData,
+                                         android::util::ProtoOutputStream* protoOutput);
+
+    // Merges the past buckets that end by [rollupEndNs], which is a rollup bucket boundary, and
+    // that start in the same rollup bucket. Only the count and duration metrics roll up.
+    virtual void rollUpPastBucketsLocked(const int64_t rollupEndNs){};
+
+    // Calls rollUpPastBucketsLocked() once per rollup bucket that became old enough by
+    // [eventTimeNs]. Should be called when a bucket is flushed.
+    void rollUpPastBucketsIfNeededLocked(const int64_t eventTimeNs);
+
+    // Returns false if the sampled field value of [event] is outside of the kept shard. The
+    // events without the field are kept.
+    bool passesSampleCheckLocked(const LogEvent& event) const;
+
+    // Writes the shard count to the report, if sampled.
+    void writeSamplingInfoLocked(android::util::ProtoOutputStream* protoOutput) const;
+
+    // onMatchedLogEventLocked(), timing one event out of kCostSamplingInterval.
+    void onMatchedLogEventWithCostLocked(const size_t matcherIndex, const LogEvent& event);
+
+    // Notes the byte size before a dump erases the data. Returns the start time of the dump.
+    int64_t startDumpCostLocked();
+
+    // Reports the cost measured since the last report to StatsdStats, along with the time of the
+    // dump that started at [dumpStartNs].
+    void noteCostLocked(const int64_t dumpStartNs);
+
     virtual size_t byteSizeLocked() const = 0;
+    // The metrics that keep no current bucket, like event metrics, return 0.
+    virtual size_t currentBucketByteSizeLocked() const {
+        return 0;
+    }
     virtual void dumpStatesLocked(FILE* out, bool verbose) const = 0;
     virtual void dropDataLocked(const int64_t dropTimeNs) = 0;
     void loadActiveMetricLocked(const ActiveMetric& activeMetric, int64_t currentTimeNs);
@@ -455,6 +586,9 @@ protected:
         return mIsActive;
     }
 
+    virtual void releaseIdleMemoryLocked() {
+    }
+
     // Convenience to compute the current bucket's end time, which is always aligned with the
     // start time of the metric.
     int64_t getCurrentBucketEndTimeNs() const {
@@ -475,6 +609,11 @@ protected:
     // If no state map exists, keep the original state value.
     void mapStateValue(const int32_t atomId, FieldValue* value);
 
+    // Returns the key of [statePrimaryKeys], which is indexed like mMetric2StateLinks, for the
+    // state [atomId], or DEFAULT_DIMENSION_KEY if no link is to that state.
+    const HashableDimensionKey& getStatePrimaryKey(
+            const std::vector<HashableDimensionKey>& statePrimaryKeys, const int32_t atomId) const;
+
     // Returns a HashableDimensionKey with unknown state value for each state
     // atom.
     HashableDimensionKey getUnknownStateKey();
@@ -532,6 +671,17 @@ protected:
 
     std::vector<Metric2Condition> mMetric2ConditionLinks;
 
+    // Keys that onMatchedLogEventLocked() fills for each event, see there.
+    MetricDimensionKey mScratchMetricKey;
+    ConditionKey mScratchConditionKey;
+    std::vector<HashableDimensionKey> mScratchStatePrimaryKeys;
+    bool mScratchKeysInUse = false;
+
+    // Plans of mDimensionsInWhat, and of the metric fields of each condition and state link.
+    DimensionExtractionPlan mDimensionsInWhatPlan;
+    std::vector<DimensionExtractionPlan> mConditionLinkPlans;
+    std::vector<DimensionExtractionPlan> mStateLinkPlans;
+
     std::vector<sp<AnomalyTracker>> mAnomalyTrackers;
 
     mutable std::mutex mMutex;
@@ -551,6 +701,37 @@ protected:
     // Maps atom ids and state values to group_ids (<atom_id, <value, group_id>>).
     const std::unordered_map<int32_t, std::unordered_map<int, int64_t>> mStateGroupMap;
 
+    // mStateGroupMap compiled for mapStateValue(), which runs for every sliced event. Metrics
+    // slice by a few atoms, so they are scanned rather than hashed.
+    const std::vector<StateGroupTable> mStateGroupTables;
+
+    // The dimensions in what reported by the last dumps, serialized.
+    DimensionProtoCache mDimensionProtoCache;
+
+    // Distinct dimension keys since the last report, or null if not estimated.
+    std::unique_ptr<HyperLogLog> mDimensionCardinality;
+
+    // See setPastBucketRollup(). The size is 0 if the past buckets don't roll up.
+    int64_t mRollupMinAgeNs = 0;
+    int64_t mRollupBucketSizeNs = 0;
+
+    // The end of the rollup buckets rolled up so far.
+    int64_t mRolledUpUntilNs = 0;
+
+    // The field of DimensionalSamplingInfo and its number of shards, or 0 if not sampled.
+    std::vector<Matcher> mSampledWhatFields;
+    int32_t mShardCount = 0;
+
+    // Only one matched event out of this many is timed, and counts for all of them, so that the
+    // clock reads don't add much to the cost they measure.
+    static constexpr int64_t kCostSamplingInterval = 8;
+
+    // With StatsdConfig.track_metric_cost, the cost since the last report to StatsdStats.
+    bool mTrackCost = false;
+    int64_t mCostEventCount = 0;
+    int64_t mCostEventProcessingNs = 0;
+    mutable size_t mCostMaxByteSize = 0;
+
     // MetricStateLinks defined in statsd_config that link fields in the state
     // atom to fields in the "what" atom.
     std::vector<Metric2State> mMetric2StateLinks;
@@ -602,6 +783,9 @@ protected:
 
     FRIEND_TEST(MetricsManagerTest, TestInitialConditions);
 
+    FRIEND_TEST(CountMetricProducerTest, TestCostTrackingDisabled);
+    FRIEND_TEST(CountMetricProducerTest, TestDimensionCardinalityEstimate);
+
     FRIEND_TEST(ConfigUpdateTest, TestUpdateMetricActivations);
     FRIEND_TEST(ConfigUpdateTest, TestUpdateCountMetrics);
     FRIEND_TEST(ConfigUpdateTest, TestUpdateEventMetrics);
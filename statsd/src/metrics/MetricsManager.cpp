@@ -18,8 +18,13 @@
 
 #include "MetricsManager.h"
 
+#include <android-base/parsedouble.h>
 #include <private/android_filesystem_config.h>
 
+#include <algorithm>
+#include <functional>
+#include <iterator>
+
 #include "CountMetricProducer.h"
 #include "condition/CombinationConditionTracker.h"
 #include "condition/SimpleConditionTracker.h"
@@ -32,6 +37,7 @@
 #include "stats_log_util.h"
 #include "stats_util.h"
 #include "statslog_statsd.h"
+#include "utils/ScopedTrace.h"
 
 using android::util::FIELD_COUNT_REPEATED;
 using android::util::FIELD_TYPE_INT32;
@@ -58,6 +64,40 @@ const int FIELD_ID_ACTIVE_CONFIG_ID = 1;
 const int FIELD_ID_ACTIVE_CONFIG_UID = 2;
 const int FIELD_ID_ACTIVE_CONFIG_METRIC = 3;
 
+namespace {
+
+// Returns whether each of [newComponents] was added or replaced by a config update, rather than
+// being one of [oldComponents]. The maps take the ids of the components to their indices.
+template <typename T>
+vector<bool> findChangedComponents(const unordered_map<int64_t, int>& oldMap,
+                                   const vector<sp<T>>& oldComponents,
+                                   const unordered_map<int64_t, int>& newMap,
+                                   const vector<sp<T>>& newComponents) {
+    vector<bool> changed(newComponents.size(), true);
+    for (const auto& [id, index] : newMap) {
+        // A failed update may have mapped ids past the components it created.
+        if (index >= (int)newComponents.size()) {
+            continue;
+        }
+        const auto it = oldMap.find(id);
+        if (it != oldMap.end() && oldComponents[it->second] == newComponents[index]) {
+            changed[index] = false;
+        }
+    }
+    return changed;
+}
+
+// Returns [values] sorted and without duplicates, for binary searches.
+template <typename Container>
+vector<int32_t> sortedUnique(const Container& values) {
+    vector<int32_t> sorted(values.begin(), values.end());
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    return sorted;
+}
+
+}  // namespace
+
 MetricsManager::MetricsManager(const ConfigKey& key, const StatsdConfig& config,
                                const int64_t timeBaseNs, const int64_t currentTimeNs,
                                const sp<UidMap>& uidMap,
@@ -72,27 +112,47 @@ MetricsManager::MetricsManager(const ConfigKey& key, const StatsdConfig& config,
       mTtlEndNs(-1),
       mLastReportTimeNs(currentTimeNs),
       mLastReportWallClockNs(getWallClockNs()),
+      mAppChangeCoalescingWindowNs(MillisToNano(config.app_upgrade_coalescing_window_millis())),
+      mInactiveMetricMemoryReleaseNs(
+              MillisToNano(std::max<int64_t>(0, config.inactive_metric_memory_release_millis()))),
       mPullerManager(pullerManager),
-      mWhitelistedAtomIds(config.whitelisted_atom_ids().begin(),
-                          config.whitelisted_atom_ids().end()),
+      mAllowedLogSources(std::make_shared<const vector<int32_t>>()),
+      mWhitelistedAtomIds(sortedUnique(config.whitelisted_atom_ids())),
       mShouldPersistHistory(config.persist_locally()) {
     // Init the ttl end timestamp.
     refreshTtl(timeBaseNs);
 
+    StatsdConfig downgradedConfig;
+    const StatsdConfig& admittedConfig = admitConfig(config, &downgradedConfig);
     mConfigValid = initStatsdConfig(
-            key, config, uidMap, pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor,
+            key, admittedConfig, uidMap, pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor,
             timeBaseNs, currentTimeNs, mTagIds, mAllAtomMatchingTrackers, mAtomMatchingTrackerMap,
             mAllConditionTrackers, mConditionTrackerMap, mAllMetricProducers, mMetricProducerMap,
             mAllAnomalyTrackers, mAllPeriodicAlarmTrackers, mConditionToMetricMap,
             mTrackerToMetricMap, mTrackerToConditionMap, mActivationAtomTrackerToMetricMap,
             mDeactivationAtomTrackerToMetricMap, mAlertTrackerMap, mMetricIndexesWithActivation,
             mStateProtoHashes, mNoReportMetricIds);
+    mConfigValid &= !mConfigCostRejected;
+    initTagIdToMatcherIndices();
+    initEventScratch();
+    initActivationMatcherBits();
+    initDispatchTables();
+    initConditionDispatchTable();
+    initInactiveTagIdToMatcherIndices();
 
     mHashStringsInReport = config.hash_strings_in_metric_report();
     mVersionStringsInReport = config.version_strings_in_metric_report();
     mInstallerInReport = config.installer_in_metric_report();
-
-    createAllLogSourcesFromConfig(config);
+    mUidMapDeltasInReport = config.uid_map_deltas_in_metric_report();
+    mStringDictionaryInReport =
+            mHashStringsInReport && config.string_dictionary_in_metric_report();
+
+    createAllLogSourcesFromConfig(admittedConfig);
+    shareConditionStates(admittedConfig, vector<bool>(mAllConditionTrackers.size(), true));
+    shareDimensionKeyTable(vector<bool>(mAllMetricProducers.size(), true));
+    setDimensionCardinalityEstimates(admittedConfig);
+    setMetricCostTracking(admittedConfig);
+    setPastBucketRollups(admittedConfig);
     mPullerManager->RegisterPullUidProvider(mConfigKey, this);
 
     // Store the sub-configs used.
@@ -103,10 +163,258 @@ MetricsManager::MetricsManager(const ConfigKey& key, const StatsdConfig& config,
     initializeConfigActiveStatus();
 }
 
+std::atomic<double> MetricsManager::sConfigCostBudget(0);
+std::atomic<bool> MetricsManager::sDowngradeOverBudget(false);
+
+void MetricsManager::SetConfigCostBudget(const std::string& budget) {
+    const size_t separator = budget.find(':');
+    const std::string action = separator != std::string::npos ? budget.substr(separator + 1) : "";
+    double maxCost = 0;
+    if (!budget.empty() &&
+        (!android::base::ParseDouble(budget.substr(0, separator), &maxCost, 0.0) ||
+         (action != "" && action != "downgrade"))) {
+        ALOGE("Invalid config cost budget %s", budget.c_str());
+        maxCost = 0;
+    }
+    sConfigCostBudget = maxCost;
+    sDowngradeOverBudget = action == "downgrade";
+}
+
+const StatsdConfig& MetricsManager::admitConfig(const StatsdConfig& config,
+                                                StatsdConfig* downgradedConfig) {
+    static const StatsdConfig kEmptyConfig;
+    mConfigCost = estimateConfigCost(config, mPullerManager);
+    mConfigCostRemovedMetrics = 0;
+    mConfigCostRejected = false;
+    const double budget = sConfigCostBudget;
+    if (budget <= 0 || mConfigCost.cost <= budget) {
+        return config;
+    }
+    if (!sDowngradeOverBudget) {
+        ALOGE("Config %s costs %.1f, over the budget of %.1f. Reject!",
+              mConfigKey.ToString().c_str(), mConfigCost.cost, budget);
+        mConfigCostRejected = true;
+        return kEmptyConfig;
+    }
+    *downgradedConfig = config;
+    const int removedMetrics = downgradeConfig(mConfigCost, budget, downgradedConfig);
+    if (removedMetrics < 0) {
+        ALOGE("Config %s costs %.1f without its metrics, over the budget of %.1f. Reject!",
+              mConfigKey.ToString().c_str(), mConfigCost.cost, budget);
+        mConfigCostRejected = true;
+        return kEmptyConfig;
+    }
+    ALOGW("Config %s costs %.1f, over the budget of %.1f. Removed %d metrics",
+          mConfigKey.ToString().c_str(), mConfigCost.cost, budget, removedMetrics);
+    // The metrics share matchers and dimension keys, the estimates of the removed metrics do
+    // not add up to the cost saved.
+    mConfigCost = estimateConfigCost(*downgradedConfig, mPullerManager);
+    if (mConfigCost.cost > budget) {
+        ALOGE("Config %s still costs %.1f once downgraded, over the budget of %.1f. Reject!",
+              mConfigKey.ToString().c_str(), mConfigCost.cost, budget);
+        mConfigCostRejected = true;
+        return kEmptyConfig;
+    }
+    mConfigCostRemovedMetrics = removedMetrics;
+    return *downgradedConfig;
+}
+
+void MetricsManager::initTagIdToMatcherIndices() {
+    // The depth of a matcher is 0 for simple matchers and one more than the deepest child for
+    // combinations, so that sorting by depth puts the children first. The config is validated to
+    // have no cycles.
+    vector<int> depths(mAllAtomMatchingTrackers.size(), -1);
+    std::function<int(int)> getDepth = [&](int index) {
+        if (depths[index] < 0) {
+            int depth = 0;
+            for (const int child : mAllAtomMatchingTrackers[index]->getChildren()) {
+                depth = std::max(depth, getDepth(child) + 1);
+            }
+            depths[index] = depth;
+        }
+        return depths[index];
+    };
+
+    mTagIdToMatcherIndices.clear();
+    for (size_t i = 0; i < mAllAtomMatchingTrackers.size(); i++) {
+        // Combination matchers have the atom ids of all their children.
+        for (const int atomId : mAllAtomMatchingTrackers[i]->getAtomIds()) {
+            mTagIdToMatcherIndices[atomId].push_back(i);
+        }
+    }
+    for (auto& [atomId, indices] : mTagIdToMatcherIndices) {
+        std::stable_sort(indices.begin(), indices.end(),
+                         [&](int a, int b) { return getDepth(a) < getDepth(b); });
+    }
+}
+
+void MetricsManager::initInactiveTagIdToMatcherIndices() {
+    vector<bool> needed(mAllAtomMatchingTrackers.size(), false);
+    std::function<void(int)> markNeeded = [&](int index) {
+        if (index < 0 || index >= (int)needed.size() || needed[index]) {
+            return;
+        }
+        needed[index] = true;
+        for (const int child : mAllAtomMatchingTrackers[index]->getChildren()) {
+            markNeeded(child);
+        }
+    };
+    for (const auto& it : mActivationAtomTrackerToMetricMap) {
+        markNeeded(it.first);
+    }
+    for (const auto& it : mDeactivationAtomTrackerToMetricMap) {
+        markNeeded(it.first);
+    }
+    for (const auto& it : mTrackerToConditionMap) {
+        markNeeded(it.first);
+    }
+    for (const auto& [matcherIndex, metricIndices] : mTrackerToMetricMap) {
+        for (const int metricIndex : metricIndices) {
+            if (mAllMetricProducers[metricIndex]->consumesEventsWhileInactive()) {
+                markNeeded(matcherIndex);
+                break;
+            }
+        }
+    }
+
+    mInactiveTagIdToMatcherIndices.clear();
+    for (const auto& [atomId, indices] : mTagIdToMatcherIndices) {
+        vector<int> neededIndices;
+        // Keeps the children before the combinations.
+        std::copy_if(indices.begin(), indices.end(), std::back_inserter(neededIndices),
+                     [&](int index) { return needed[index]; });
+        if (!neededIndices.empty()) {
+            mInactiveTagIdToMatcherIndices[atomId] = std::move(neededIndices);
+        }
+    }
+}
+
+void MetricsManager::initEventScratch() {
+    mMatcherCache.assign(mAllAtomMatchingTrackers.size(), MatchingState::kNotComputed);
+    mMatchedBits.assign((mAllAtomMatchingTrackers.size() + 63) / 64, 0);
+    mConditionCache.assign(mAllConditionTrackers.size(), ConditionState::kNotEvaluated);
+    mConditionToBeEvaluated.assign(mAllConditionTrackers.size(), false);
+    mConditionChangedCache.assign(mAllConditionTrackers.size(), false);
+    mActiveMetricIndices.resize(mAllMetricProducers.size());
+    mMetricIndicesWithCanceledActivations.resize(mAllMetricProducers.size());
+}
+
+void MetricsManager::initActivationMatcherBits() {
+    const size_t numWords = (mAllAtomMatchingTrackers.size() + 63) / 64;
+    mActivationMatcherBits.assign(numWords, 0);
+    mDeactivationMatcherBits.assign(numWords, 0);
+    for (const auto& it : mActivationAtomTrackerToMetricMap) {
+        setMatcherBit(mActivationMatcherBits, it.first);
+    }
+    for (const auto& it : mDeactivationAtomTrackerToMetricMap) {
+        setMatcherBit(mDeactivationMatcherBits, it.first);
+    }
+    // The metrics and their indices may have changed.
+    mNextActivationExpiryNs = std::numeric_limits<int64_t>::min();
+}
+
+void MetricsManager::initDispatchTables() {
+    const size_t numMatchers = mAllAtomMatchingTrackers.size();
+    mTrackerToMetricTable.build(mTrackerToMetricMap, numMatchers);
+    mConditionToMetricTable.build(mConditionToMetricMap, mAllConditionTrackers.size());
+    mActivationAtomTrackerToMetricTable.build(mActivationAtomTrackerToMetricMap, numMatchers);
+    mDeactivationAtomTrackerToMetricTable.build(mDeactivationAtomTrackerToMetricMap, numMatchers);
+}
+
+void MetricsManager::initConditionDispatchTable() {
+    mTrackerToConditionTable.build(mTrackerToConditionMap, mAllAtomMatchingTrackers.size());
+}
+
+void MetricsManager::shareConditionStates(const StatsdConfig& config,
+                                          const vector<bool>& changedConditions) {
+    if (!mConfigValid) {
+        mConditionStateEventsKey.clear();
+        return;
+    }
+    // Configs see the same events if they have the same uid map and log sources, see
+    // checkLogCredentials().
+    string eventsKey = to_string(reinterpret_cast<uintptr_t>(mUidMap.get())).append("|");
+    for (const int32_t atomId : mWhitelistedAtomIds) {
+        eventsKey.append(to_string(atomId)).append(",");
+    }
+    eventsKey.append("|");
+    for (const int32_t uid : set<int32_t>(mAllowedUid.begin(), mAllowedUid.end())) {
+        eventsKey.append(to_string(uid)).append(",");
+    }
+    eventsKey.append("|");
+    for (const string& pkg : set<string>(mAllowedPkg.begin(), mAllowedPkg.end())) {
+        eventsKey.append(pkg).append(",");
+    }
+    eventsKey.append("|");
+    // The preserved conditions keep the key of their predicate and matchers, which are unchanged.
+    const bool eventsChanged = eventsKey != mConditionStateEventsKey;
+    mConditionStateEventsKey = eventsKey;
+
+    mPendingConditionStateShares.clear();
+    for (int i = 0; i < config.predicate_size() && i < (int)mAllConditionTrackers.size(); i++) {
+        if (!eventsChanged && !changedConditions[i]) {
+            continue;
+        }
+        const string key =
+                getSharedConditionStateKey(config, config.predicate(i), mAtomMatchingTrackerMap);
+        mPendingConditionStateShares.emplace_back(i, key.empty() ? key : eventsKey + key);
+    }
+}
+
+void MetricsManager::applyConditionStateShares() {
+    for (const auto& [conditionIndex, key] : mPendingConditionStateShares) {
+        mAllConditionTrackers[conditionIndex]->shareState(key);
+    }
+    mPendingConditionStateShares.clear();
+}
+
+void MetricsManager::shareDimensionKeyTable(const vector<bool>& changedMetrics) {
+    for (size_t i = 0; i < mAllMetricProducers.size(); i++) {
+        if (changedMetrics[i]) {
+            mAllMetricProducers[i]->setDimensionKeyTable(mDimensionKeyTable);
+        }
+    }
+}
+
+void MetricsManager::setDimensionCardinalityEstimates(const StatsdConfig& config) {
+    // The metrics and conditions kept by a config update get new estimates too, which count the
+    // keys of the new config only.
+    for (const sp<MetricProducer>& producer : mAllMetricProducers) {
+        producer->setDimensionCardinalityEstimate(config.estimate_dimension_cardinality());
+    }
+    for (const sp<ConditionTracker>& tracker : mAllConditionTrackers) {
+        tracker->setDimensionCardinalityEstimate(config.estimate_dimension_cardinality());
+    }
+}
+
+void MetricsManager::setPastBucketRollups(const StatsdConfig& config) {
+    // The metrics kept by a config update stop their rollup if it is no longer asked.
+    int64_t minAgeNs = 0;
+    int64_t bucketSizeNs = 0;
+    if (config.has_past_bucket_rollup()) {
+        minAgeNs =
+                MillisToNano(std::max<int64_t>(0, config.past_bucket_rollup().min_age_millis()));
+        bucketSizeNs =
+                MillisToNano(TimeUnitToBucketSizeInMillis(config.past_bucket_rollup().bucket()));
+    }
+    for (const sp<MetricProducer>& producer : mAllMetricProducers) {
+        producer->setPastBucketRollup(minAgeNs, bucketSizeNs);
+    }
+}
+
+void MetricsManager::setMetricCostTracking(const StatsdConfig& config) {
+    // The metrics kept by a config update stop tracking their cost if it is no longer asked.
+    for (const sp<MetricProducer>& producer : mAllMetricProducers) {
+        producer->setCostTracking(config.track_metric_cost());
+    }
+}
+
 MetricsManager::~MetricsManager() {
     for (auto it : mAllMetricProducers) {
         for (int atomId : it->getSlicedStateAtoms()) {
-            StateManager::getInstance().unregisterListener(atomId, it);
+            if (mStateListenersRegistered) {
+                StateManager::getInstance().unregisterListener(atomId, it);
+            }
         }
     }
     mPullerManager->UnregisterPullUidProvider(mConfigKey, this);
@@ -136,37 +444,64 @@ bool MetricsManager::updateConfig(const StatsdConfig& config, const int64_t time
     mDeactivationAtomTrackerToMetricMap.clear();
     mMetricIndexesWithActivation.clear();
     mNoReportMetricIds.clear();
+    StatsdConfig downgradedConfig;
+    const StatsdConfig& admittedConfig = admitConfig(config, &downgradedConfig);
     mConfigValid = updateStatsdConfig(
-            mConfigKey, config, mUidMap, mPullerManager, anomalyAlarmMonitor, periodicAlarmMonitor,
-            timeBaseNs, currentTimeNs, mAllAtomMatchingTrackers, mAtomMatchingTrackerMap,
-            mAllConditionTrackers, mConditionTrackerMap, mAllMetricProducers, mMetricProducerMap,
-            mAllAnomalyTrackers, mAlertTrackerMap, mStateProtoHashes, mTagIds,
-            newAtomMatchingTrackers, newAtomMatchingTrackerMap, newConditionTrackers,
-            newConditionTrackerMap, newMetricProducers, newMetricProducerMap, newAnomalyTrackers,
-            newAlertTrackerMap, newPeriodicAlarmTrackers, mConditionToMetricMap,
+            mConfigKey, admittedConfig, mUidMap, mPullerManager, anomalyAlarmMonitor,
+            periodicAlarmMonitor, timeBaseNs, currentTimeNs, mAllAtomMatchingTrackers,
+            mAtomMatchingTrackerMap, mAllConditionTrackers, mConditionTrackerMap,
+            mAllMetricProducers, mMetricProducerMap, mAllAnomalyTrackers, mAlertTrackerMap,
+            mStateProtoHashes, mTagIds, newAtomMatchingTrackers, newAtomMatchingTrackerMap,
+            newConditionTrackers, newConditionTrackerMap, newMetricProducers, newMetricProducerMap,
+            newAnomalyTrackers, newAlertTrackerMap, newPeriodicAlarmTrackers, mConditionToMetricMap,
             mTrackerToMetricMap, mTrackerToConditionMap, mActivationAtomTrackerToMetricMap,
             mDeactivationAtomTrackerToMetricMap, mMetricIndexesWithActivation, newStateProtoHashes,
             mNoReportMetricIds);
-    mAllAtomMatchingTrackers = newAtomMatchingTrackers;
-    mAtomMatchingTrackerMap = newAtomMatchingTrackerMap;
-    mAllConditionTrackers = newConditionTrackers;
-    mConditionTrackerMap = newConditionTrackerMap;
-    mAllMetricProducers = newMetricProducers;
-    mMetricProducerMap = newMetricProducerMap;
-    mStateProtoHashes = newStateProtoHashes;
-    mAllAnomalyTrackers = newAnomalyTrackers;
-    mAlertTrackerMap = newAlertTrackerMap;
-    mAllPeriodicAlarmTrackers = newPeriodicAlarmTrackers;
+    mConfigValid &= !mConfigCostRejected;
+    // The preserved components are the same objects in the old and new lists. The indices and
+    // the setup that only depend on them are only redone for the components that changed.
+    const bool matchersChanged = newAtomMatchingTrackers != mAllAtomMatchingTrackers;
+    const bool conditionsChanged =
+            matchersChanged || newConditionTrackers != mAllConditionTrackers;
+    const vector<bool> changedConditions =
+            findChangedComponents(mConditionTrackerMap, mAllConditionTrackers,
+                                  newConditionTrackerMap, newConditionTrackers);
+    const vector<bool> changedMetrics = findChangedComponents(
+            mMetricProducerMap, mAllMetricProducers, newMetricProducerMap, newMetricProducers);
+    mAllAtomMatchingTrackers = std::move(newAtomMatchingTrackers);
+    mAtomMatchingTrackerMap = std::move(newAtomMatchingTrackerMap);
+    mAllConditionTrackers = std::move(newConditionTrackers);
+    mConditionTrackerMap = std::move(newConditionTrackerMap);
+    mAllMetricProducers = std::move(newMetricProducers);
+    mMetricProducerMap = std::move(newMetricProducerMap);
+    mStateProtoHashes = std::move(newStateProtoHashes);
+    mAllAnomalyTrackers = std::move(newAnomalyTrackers);
+    mAlertTrackerMap = std::move(newAlertTrackerMap);
+    mAllPeriodicAlarmTrackers = std::move(newPeriodicAlarmTrackers);
+    if (matchersChanged) {
+        initTagIdToMatcherIndices();
+    }
+    initEventScratch();
+    initActivationMatcherBits();
+    initDispatchTables();
+    if (conditionsChanged) {
+        initConditionDispatchTable();
+    }
+    initInactiveTagIdToMatcherIndices();
 
     mTtlNs = config.has_ttl_in_seconds() ? config.ttl_in_seconds() * NS_PER_SEC : -1;
     refreshTtl(currentTimeNs);
+    mAppChangeCoalescingWindowNs = MillisToNano(config.app_upgrade_coalescing_window_millis());
+    mInactiveMetricMemoryReleaseNs =
+            MillisToNano(std::max<int64_t>(0, config.inactive_metric_memory_release_millis()));
 
     mHashStringsInReport = config.hash_strings_in_metric_report();
     mVersionStringsInReport = config.version_strings_in_metric_report();
     mInstallerInReport = config.installer_in_metric_report();
-    mWhitelistedAtomIds.clear();
-    mWhitelistedAtomIds.insert(config.whitelisted_atom_ids().begin(),
-                               config.whitelisted_atom_ids().end());
+    mUidMapDeltasInReport = config.uid_map_deltas_in_metric_report();
+    mStringDictionaryInReport =
+            mHashStringsInReport && config.string_dictionary_in_metric_report();
+    mWhitelistedAtomIds = sortedUnique(config.whitelisted_atom_ids());
     mShouldPersistHistory = config.persist_locally();
     mPackageCertificateHashSizeBytes = config.package_certificate_hash_size_bytes();
 
@@ -181,7 +516,13 @@ bool MetricsManager::updateConfig(const StatsdConfig& config, const int64_t time
     mDefaultPullUids.clear();
     mPullAtomUids.clear();
     mPullAtomPackages.clear();
-    createAllLogSourcesFromConfig(config);
+    createAllLogSourcesFromConfig(admittedConfig);
+    shareConditionStates(admittedConfig, changedConditions);
+    applyConditionStateShares();
+    shareDimensionKeyTable(changedMetrics);
+    setDimensionCardinalityEstimates(admittedConfig);
+    setMetricCostTracking(admittedConfig);
+    setPastBucketRollups(admittedConfig);
 
     verifyGuardrailsAndUpdateStatsdStats();
     initializeConfigActiveStatus();
@@ -276,19 +617,19 @@ void MetricsManager::initializeConfigActiveStatus() {
 }
 
 void MetricsManager::initAllowedLogSources() {
-    std::lock_guard<std::mutex> lock(mAllowedLogSourcesMutex);
-    mAllowedLogSources.clear();
-    mAllowedLogSources.insert(mAllowedUid.begin(), mAllowedUid.end());
-
+    vector<int32_t> sources(mAllowedUid.begin(), mAllowedUid.end());
     for (const auto& pkg : mAllowedPkg) {
         auto uids = mUidMap->getAppUid(pkg);
-        mAllowedLogSources.insert(uids.begin(), uids.end());
+        sources.insert(sources.end(), uids.begin(), uids.end());
     }
+    sources = sortedUnique(sources);
     if (STATSD_DEBUG) {
-        for (const auto& uid : mAllowedLogSources) {
+        for (const auto& uid : sources) {
             VLOG("Allowed uid %d", uid);
         }
     }
+    std::atomic_store(&mAllowedLogSources,
+                      std::make_shared<const vector<int32_t>>(std::move(sources)));
 }
 
 void MetricsManager::initPullAtomSources() {
@@ -312,8 +653,10 @@ bool MetricsManager::isConfigValid() const {
 void MetricsManager::notifyAppUpgrade(const int64_t& eventTimeNs, const string& apk, const int uid,
                                       const int64_t version) {
     // Inform all metric producers.
-    for (const auto& it : mAllMetricProducers) {
-        it->notifyAppUpgrade(eventTimeNs);
+    if (shouldSplitBucketsForAppChange(eventTimeNs)) {
+        for (const auto& it : mAllMetricProducers) {
+            it->notifyAppUpgrade(eventTimeNs);
+        }
     }
     // check if we care this package
     if (std::find(mAllowedPkg.begin(), mAllowedPkg.end(), apk) != mAllowedPkg.end()) {
@@ -333,8 +676,10 @@ void MetricsManager::notifyAppUpgrade(const int64_t& eventTimeNs, const string&
 void MetricsManager::notifyAppRemoved(const int64_t& eventTimeNs, const string& apk,
                                       const int uid) {
     // Inform all metric producers.
-    for (const auto& it : mAllMetricProducers) {
-        it->notifyAppRemoved(eventTimeNs);
+    if (shouldSplitBucketsForAppChange(eventTimeNs)) {
+        for (const auto& it : mAllMetricProducers) {
+            it->notifyAppRemoved(eventTimeNs);
+        }
     }
     // check if we care this package
     if (std::find(mAllowedPkg.begin(), mAllowedPkg.end(), apk) != mAllowedPkg.end()) {
@@ -351,6 +696,17 @@ void MetricsManager::notifyAppRemoved(const int64_t& eventTimeNs, const string&
     }
 }
 
+bool MetricsManager::shouldSplitBucketsForAppChange(const int64_t eventTimeNs) {
+    if (mAppChangeCoalescingWindowNs > 0 && mLastAppChangeSplitNs >= 0 &&
+        eventTimeNs - mLastAppChangeSplitNs < mAppChangeCoalescingWindowNs) {
+        VLOG("Coalesced app change at %lld with the one at %lld", (long long)eventTimeNs,
+             (long long)mLastAppChangeSplitNs);
+        return false;
+    }
+    mLastAppChangeSplitNs = eventTimeNs;
+    return true;
+}
+
 void MetricsManager::onUidMapReceived(const int64_t& eventTimeNs) {
     // Purposefully don't inform metric producers on a new snapshot
     // because we don't need to flush partial buckets.
@@ -374,6 +730,11 @@ void MetricsManager::init() {
     for (const auto& producer : mAllMetricProducers) {
         producer->prepareFirstBucket();
     }
+    applyConditionStateShares();
+    if (!mStateListenersRegistered) {
+        registerStateListeners(mAllMetricProducers);
+        mStateListenersRegistered = true;
+    }
 }
 
 vector<int32_t> MetricsManager::getPullAtomUids(int32_t atomId) {
@@ -389,13 +750,21 @@ vector<int32_t> MetricsManager::getPullAtomUids(int32_t atomId) {
 
 void MetricsManager::dumpStates(FILE* out, bool verbose) {
     fprintf(out, "ConfigKey %s, allowed source:", mConfigKey.ToString().c_str());
-    {
-        std::lock_guard<std::mutex> lock(mAllowedLogSourcesMutex);
-        for (const auto& source : mAllowedLogSources) {
-            fprintf(out, "%d ", source);
-        }
+    for (const auto& source : *getAllowedLogSources()) {
+        fprintf(out, "%d ", source);
     }
     fprintf(out, "\n");
+    fprintf(out,
+            "Estimated cost %.1f: %.1f matcher evaluations/s, %.1f metric events/s, %lld "
+            "dimension keys, %.1f pulls/h, %.1f alarms/h\n",
+            mConfigCost.cost, mConfigCost.matcherEvaluationsPerSec, mConfigCost.metricEventsPerSec,
+            (long long)mConfigCost.dimensionKeys, mConfigCost.pullsPerHour,
+            mConfigCost.alarmsPerHour);
+    if (mConfigCostRejected) {
+        fprintf(out, "Rejected for costing more than the budget\n");
+    } else if (mConfigCostRemovedMetrics > 0) {
+        fprintf(out, "%d metrics removed to stay within the budget\n", mConfigCostRemovedMetrics);
+    }
     for (const auto& producer : mAllMetricProducers) {
         producer->dumpStates(out, verbose);
     }
@@ -409,24 +778,26 @@ void MetricsManager::dropData(const int64_t dropTimeNs) {
 
 void MetricsManager::onDumpReport(const int64_t dumpTimeStampNs, const int64_t wallClockNs,
                                   const bool include_current_partial_bucket, const bool erase_data,
-                                  const DumpLatency dumpLatency, std::set<string>* str_set,
-                                  ProtoOutputStream* protoOutput) {
+                                  const DumpLatency dumpLatency, ReportStrings* str_set,
+                                  ProtoOutputStream* protoOutput, ParallelExecutor* executor) {
     VLOG("=========================Metric Reports Start==========================");
-    // one StatsLogReport per MetricProduer
-    for (const auto& producer : mAllMetricProducers) {
-        if (mNoReportMetricIds.find(producer->getMetricId()) == mNoReportMetricIds.end()) {
-            uint64_t token = protoOutput->start(
-                    FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_METRICS);
-            if (mHashStringsInReport) {
-                producer->onDumpReport(dumpTimeStampNs, include_current_partial_bucket, erase_data,
-                                       dumpLatency, str_set, protoOutput);
+    // The producers share the string dictionary, so they dump one after the other.
+    if (executor != nullptr && mAllMetricProducers.size() > 1 && !mStringDictionaryInReport) {
+        dumpMetricReportsInParallel(dumpTimeStampNs, include_current_partial_bucket, erase_data,
+                                    dumpLatency, str_set, protoOutput, executor);
+    } else {
+        // one StatsLogReport per MetricProduer
+        for (const auto& producer : mAllMetricProducers) {
+            if (mNoReportMetricIds.find(producer->getMetricId()) == mNoReportMetricIds.end()) {
+                uint64_t token = protoOutput->start(
+                        FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_METRICS);
+                producer->onDumpReport(dumpTimeStampNs, include_current_partial_bucket,
+                                       erase_data, dumpLatency,
+                                       mHashStringsInReport ? str_set : nullptr, protoOutput);
+                protoOutput->end(token);
             } else {
-                producer->onDumpReport(dumpTimeStampNs, include_current_partial_bucket, erase_data,
-                                       dumpLatency, nullptr, protoOutput);
+                producer->clearPastBuckets(dumpTimeStampNs);
             }
-            protoOutput->end(token);
-        } else {
-            producer->clearPastBuckets(dumpTimeStampNs);
         }
     }
     for (const auto& annotation : mAnnotations) {
@@ -447,12 +818,68 @@ void MetricsManager::onDumpReport(const int64_t dumpTimeStampNs, const int64_t w
     VLOG("=========================Metric Reports End==========================");
 }
 
+void MetricsManager::dumpMetricReportsInParallel(const int64_t dumpTimeStampNs,
+                                                 const bool include_current_partial_bucket,
+                                                 const bool erase_data,
+                                                 const DumpLatency dumpLatency,
+                                                 ReportStrings* str_set,
+                                                 ProtoOutputStream* protoOutput,
+                                                 ParallelExecutor* executor) {
+    // Each producer serializes its StatsLogReport into its own buffer, with its own set of
+    // hashed strings. The pulled metrics may pull and match the pulled events while they dump,
+    // with the EventMatcherWizard they share, so they dump one after the other on this thread.
+    // The other producers only share thread safe state, like the dimension key table.
+    const size_t numProducers = mAllMetricProducers.size();
+    vector<string> reports(numProducers);
+    vector<ReportStrings> strSets(mHashStringsInReport && str_set != nullptr ? numProducers
+                                                                                : 0);
+    auto dumpProducer = [&](size_t i) {
+        const sp<MetricProducer>& producer = mAllMetricProducers[i];
+        if (mNoReportMetricIds.find(producer->getMetricId()) != mNoReportMetricIds.end()) {
+            producer->clearPastBuckets(dumpTimeStampNs);
+            return;
+        }
+        ProtoOutputStream report;
+        producer->onDumpReport(dumpTimeStampNs, include_current_partial_bucket, erase_data,
+                               dumpLatency, strSets.empty() ? nullptr : &strSets[i], &report);
+        sp<android::util::ProtoReader> reader = report.data();
+        reports[i].reserve(report.size());
+        while (reader->readBuffer() != nullptr) {
+            const size_t toRead = reader->currentToRead();
+            reports[i].append(reinterpret_cast<const char*>(reader->readBuffer()), toRead);
+            reader->move(toRead);
+        }
+    };
+    vector<size_t> parallelIndices;
+    parallelIndices.reserve(numProducers);
+    for (size_t i = 0; i < numProducers; i++) {
+        if (mAllMetricProducers[i]->isPulled()) {
+            dumpProducer(i);
+        } else {
+            parallelIndices.push_back(i);
+        }
+    }
+    executor->run(parallelIndices.size(), [&](size_t j) { dumpProducer(parallelIndices[j]); });
+
+    for (size_t i = 0; i < numProducers; i++) {
+        if (mNoReportMetricIds.find(mAllMetricProducers[i]->getMetricId()) ==
+            mNoReportMetricIds.end()) {
+            protoOutput->write(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_METRICS,
+                               reports[i].data(), reports[i].size());
+        }
+    }
+    for (ReportStrings& strSet : strSets) {
+        str_set->merge(strSet);
+    }
+}
+
 bool MetricsManager::checkLogCredentials(const LogEvent& event) {
-    if (mWhitelistedAtomIds.find(event.GetTagId()) != mWhitelistedAtomIds.end()) {
+    if (std::binary_search(mWhitelistedAtomIds.begin(), mWhitelistedAtomIds.end(),
+                           event.GetTagId())) {
         return true;
     }
-    std::lock_guard<std::mutex> lock(mAllowedLogSourcesMutex);
-    if (mAllowedLogSources.find(event.GetUid()) == mAllowedLogSources.end()) {
+    const std::shared_ptr<const vector<int32_t>> sources = getAllowedLogSources();
+    if (!std::binary_search(sources->begin(), sources->end(), event.GetUid())) {
         VLOG("log source %d not on the whitelist", event.GetUid());
         return false;
     }
@@ -521,6 +948,67 @@ bool MetricsManager::eventSanityCheck(const LogEvent& event) {
     return true;
 }
 
+void MetricsManager::flushExpiredActivations(int64_t eventTimeNs) {
+    // Update state of all metrics w/ activation conditions as of eventTimeNs. Activations expire
+    // strictly after their ttl, and none does before mNextActivationExpiryNs.
+    if (eventTimeNs <= mNextActivationExpiryNs) {
+        return;
+    }
+    // Set of metrics that are still active after flushing.
+    GenerationIndexSet& activeMetricsIndices = mActiveMetricIndices;
+
+    if (mNextActivationExpiryNs == std::numeric_limits<int64_t>::min()) {
+        activeMetricsIndices.clear();
+        mActivationExpiryQueue.clear();
+        // The indices may have changed.
+        mMemoryReleaseQueue.clear();
+        mMemoryReleaseNs.assign(mAllMetricProducers.size(), std::numeric_limits<int64_t>::max());
+        for (int metricIndex : mMetricIndexesWithActivation) {
+            const sp<MetricProducer>& metric = mAllMetricProducers[metricIndex];
+            metric->flushIfExpire(eventTimeNs);
+            if (metric->isActive()) {
+                // If this metric w/ activation condition is still active after
+                // flushing, remember it.
+                activeMetricsIndices.insert(metricIndex);
+                mActivationExpiryQueue.schedule(metricIndex, metric->getActivationExpiryNs());
+            } else {
+                scheduleMemoryRelease(metricIndex, eventTimeNs);
+            }
+        }
+    } else {
+        // Only flushes the metrics whose earliest activation expired.
+        mActivationExpiryQueue.popExpired(eventTimeNs, [&](int metricIndex) {
+            const sp<MetricProducer>& metric = mAllMetricProducers[metricIndex];
+            metric->flushIfExpire(eventTimeNs);
+            if (metric->isActive()) {
+                mActivationExpiryQueue.schedule(metricIndex, metric->getActivationExpiryNs());
+            } else {
+                activeMetricsIndices.erase(metricIndex);
+                scheduleMemoryRelease(metricIndex, eventTimeNs);
+            }
+        });
+    }
+    mNextActivationExpiryNs = mActivationExpiryQueue.nextDeadlineNs();
+    mIsActive = mIsAlwaysActive || !activeMetricsIndices.empty();
+}
+
+void MetricsManager::scheduleMemoryRelease(int metricIndex, int64_t eventTimeNs) {
+    if (mInactiveMetricMemoryReleaseNs > 0 && metricIndex < (int)mMemoryReleaseNs.size()) {
+        mMemoryReleaseNs[metricIndex] = eventTimeNs + mInactiveMetricMemoryReleaseNs;
+        mMemoryReleaseQueue.schedule(metricIndex, mMemoryReleaseNs[metricIndex]);
+    }
+}
+
+void MetricsManager::releaseInactiveMetricMemory(int64_t eventTimeNs) {
+    // A metric activated again since is skipped, its next deactivation schedules it again.
+    mMemoryReleaseQueue.popExpired(eventTimeNs, [&](int metricIndex) {
+        if (mMemoryReleaseNs[metricIndex] < eventTimeNs) {
+            mMemoryReleaseNs[metricIndex] = std::numeric_limits<int64_t>::max();
+            mAllMetricProducers[metricIndex]->releaseIdleMemory();
+        }
+    });
+}
+
 // Consume the stats log if it's interesting to this metric.
 void MetricsManager::onLogEvent(const LogEvent& event) {
     if (!mConfigValid) {
@@ -538,56 +1026,82 @@ void MetricsManager::onLogEvent(const LogEvent& event) {
     int tagId = event.GetTagId();
     int64_t eventTimeNs = event.GetElapsedTimestampNs();
 
-    bool isActive = mIsAlwaysActive;
-
-    // Set of metrics that are still active after flushing.
-    unordered_set<int> activeMetricsIndices;
-
-    // Update state of all metrics w/ activation conditions as of eventTimeNs.
-    for (int metricIndex : mMetricIndexesWithActivation) {
-        const sp<MetricProducer>& metric = mAllMetricProducers[metricIndex];
-        metric->flushIfExpire(eventTimeNs);
-        if (metric->isActive()) {
-            // If this metric w/ activation condition is still active after
-            // flushing, remember it.
-            activeMetricsIndices.insert(metricIndex);
-        }
-    }
-
-    mIsActive = isActive || !activeMetricsIndices.empty();
+    flushExpiredActivations(eventTimeNs);
+    releaseInactiveMetricMemory(eventTimeNs);
 
     if (mTagIds.find(tagId) == mTagIds.end()) {
         // Not interesting...
         return;
     }
 
-    vector<MatchingState> matcherCache(mAllAtomMatchingTrackers.size(),
-                                       MatchingState::kNotComputed);
-
-    // Evaluate all atom matchers.
-    for (auto& matcher : mAllAtomMatchingTrackers) {
-        matcher->onLogEvent(event, mAllAtomMatchingTrackers, matcherCache);
+    // While no metric is active, only the matchers that can activate one or that keep the
+    // conditions current are evaluated.
+    const bool wasActive = mIsActive;
+    const auto& tagIdToMatcherIndices =
+            wasActive ? mTagIdToMatcherIndices : mInactiveTagIdToMatcherIndices;
+    const auto matchersIt = tagIdToMatcherIndices.find(tagId);
+    if (matchersIt == tagIdToMatcherIndices.end()) {
+        // No matcher looks at this atom.
+        return;
     }
 
+    bool isActive = mIsAlwaysActive;
+
+    // Set of metrics that are still active after flushing.
+    GenerationIndexSet& activeMetricsIndices = mActiveMetricIndices;
+
+    const vector<int>* matcherIndices = &matchersIt->second;
+    ScopedTrace trace("MetricsManager::onLogEvent", {{"atom", tagId},
+                                                     {"uid", mConfigKey.GetUid()},
+                                                     {"config", mConfigKey.GetId()}});
+
+    // Matchers of other atoms stay kNotComputed, which is treated as not matched below.
+    vector<MatchingState>& matcherCache = mMatcherCache;
+
+    // Evaluate the atom matchers that can match this atom. The combinations come after their
+    // children, so they are computed from the bits of the children without recursing.
+    auto evaluateMatchers = [&]() {
+        ScopedTrace matchTrace("MetricsManager::matchers",
+                               {{"count", (int64_t)matcherIndices->size()}});
+        std::fill(matcherCache.begin(), matcherCache.end(), MatchingState::kNotComputed);
+        std::fill(mMatchedBits.begin(), mMatchedBits.end(), 0);
+        for (const int matcherIndex : *matcherIndices) {
+            const sp<AtomMatchingTracker>& matcher = mAllAtomMatchingTrackers[matcherIndex];
+            if (matcher->getChildren().empty()) {
+                matcher->onLogEvent(event, mAllAtomMatchingTrackers, matcherCache);
+            } else {
+                matcherCache[matcherIndex] = matcher->matchesChildren(mMatchedBits)
+                                                     ? MatchingState::kMatched
+                                                     : MatchingState::kNotMatched;
+            }
+            if (matcherCache[matcherIndex] == MatchingState::kMatched) {
+                setMatcherBit(mMatchedBits, matcherIndex);
+            }
+        }
+    };
+    evaluateMatchers();
+
     // Set of metrics that received an activation cancellation.
-    unordered_set<int> metricIndicesWithCanceledActivations;
+    GenerationIndexSet& metricIndicesWithCanceledActivations =
+            mMetricIndicesWithCanceledActivations;
+    metricIndicesWithCanceledActivations.clear();
 
     // Determine which metric activations received a cancellation and cancel them.
-    for (const auto& it : mDeactivationAtomTrackerToMetricMap) {
-        if (matcherCache[it.first] == MatchingState::kMatched) {
-            for (int metricIndex : it.second) {
-                mAllMetricProducers[metricIndex]->cancelEventActivation(it.first);
-                metricIndicesWithCanceledActivations.insert(metricIndex);
-            }
+    forEachMatchedMatcher(mDeactivationMatcherBits, [&](int matcherIndex) {
+        for (int metricIndex : mDeactivationAtomTrackerToMetricTable.get(matcherIndex)) {
+            mAllMetricProducers[metricIndex]->cancelEventActivation(matcherIndex);
+            metricIndicesWithCanceledActivations.insert(metricIndex);
+            mActivationsVersion++;
         }
-    }
+    });
 
     // Determine whether any metrics are no longer active after cancelling metric activations.
-    for (const int metricIndex : metricIndicesWithCanceledActivations) {
+    for (const int metricIndex : metricIndicesWithCanceledActivations.getIndices()) {
         const sp<MetricProducer>& metric = mAllMetricProducers[metricIndex];
         metric->flushIfExpire(eventTimeNs);
         if (!metric->isActive()) {
             activeMetricsIndices.erase(metricIndex);
+            scheduleMemoryRelease(metricIndex, eventTimeNs);
         }
     }
 
@@ -595,78 +1109,107 @@ void MetricsManager::onLogEvent(const LogEvent& event) {
 
 
     // Determine which metric activations should be turned on and turn them on
-    for (const auto& it : mActivationAtomTrackerToMetricMap) {
-        if (matcherCache[it.first] == MatchingState::kMatched) {
-            for (int metricIndex : it.second) {
-                mAllMetricProducers[metricIndex]->activate(it.first, eventTimeNs);
-                isActive |= mAllMetricProducers[metricIndex]->isActive();
+    forEachMatchedMatcher(mActivationMatcherBits, [&](int matcherIndex) {
+        for (int metricIndex : mActivationAtomTrackerToMetricTable.get(matcherIndex)) {
+            const sp<MetricProducer>& metric = mAllMetricProducers[metricIndex];
+            metric->activate(matcherIndex, eventTimeNs);
+            mActivationsVersion++;
+            if (metric->isActive()) {
+                isActive = true;
+                activeMetricsIndices.insert(metricIndex);
+                const int64_t expiryNs = metric->getActivationExpiryNs();
+                mActivationExpiryQueue.schedule(metricIndex, expiryNs);
+                mNextActivationExpiryNs = std::min(mNextActivationExpiryNs, expiryNs);
             }
         }
+    });
+
+    // Each activation schedules the metric again, so the queue is rebuilt once it outgrew the
+    // metrics. This keeps it linear in the metrics, at a constant amortized cost.
+    if (mActivationExpiryQueue.size() > 2 * mMetricIndexesWithActivation.size()) {
+        mActivationExpiryQueue.clear();
+        for (const int metricIndex : activeMetricsIndices.getIndices()) {
+            mActivationExpiryQueue.schedule(
+                    metricIndex, mAllMetricProducers[metricIndex]->getActivationExpiryNs());
+        }
     }
 
     mIsActive = isActive;
 
+    // The metrics activated by this event see it, so the matchers skipped while inactive are
+    // evaluated too.
+    if (!wasActive && isActive) {
+        const auto allMatchersIt = mTagIdToMatcherIndices.find(tagId);
+        if (allMatchersIt->second.size() != matcherIndices->size()) {
+            matcherIndices = &allMatchersIt->second;
+            evaluateMatchers();
+        }
+    }
+
     // A bitmap to see which ConditionTracker needs to be re-evaluated.
-    vector<bool> conditionToBeEvaluated(mAllConditionTrackers.size(), false);
+    vector<bool>& conditionToBeEvaluated = mConditionToBeEvaluated;
+    std::fill(conditionToBeEvaluated.begin(), conditionToBeEvaluated.end(), false);
 
-    for (const auto& pair : mTrackerToConditionMap) {
-        if (matcherCache[pair.first] == MatchingState::kMatched) {
-            const auto& conditionList = pair.second;
-            for (const int conditionIndex : conditionList) {
+    // Only the matchers of this atom can have matched.
+    for (const int i : *matcherIndices) {
+        if (matcherCache[i] == MatchingState::kMatched) {
+            for (const int conditionIndex : mTrackerToConditionTable.get(i)) {
                 conditionToBeEvaluated[conditionIndex] = true;
             }
         }
     }
 
-    vector<ConditionState> conditionCache(mAllConditionTrackers.size(),
-                                          ConditionState::kNotEvaluated);
+    vector<ConditionState>& conditionCache = mConditionCache;
+    std::fill(conditionCache.begin(), conditionCache.end(), ConditionState::kNotEvaluated);
     // A bitmap to track if a condition has changed value.
-    vector<bool> changedCache(mAllConditionTrackers.size(), false);
-    for (size_t i = 0; i < mAllConditionTrackers.size(); i++) {
-        if (conditionToBeEvaluated[i] == false) {
-            continue;
+    vector<bool>& changedCache = mConditionChangedCache;
+    std::fill(changedCache.begin(), changedCache.end(), false);
+    {
+        ScopedTrace conditionTrace("MetricsManager::conditions");
+        for (size_t i = 0; i < mAllConditionTrackers.size(); i++) {
+            if (conditionToBeEvaluated[i] == false) {
+                continue;
+            }
+            sp<ConditionTracker>& condition = mAllConditionTrackers[i];
+            condition->evaluateCondition(event, matcherCache, mAllConditionTrackers,
+                                         conditionCache, changedCache);
         }
-        sp<ConditionTracker>& condition = mAllConditionTrackers[i];
-        condition->evaluateCondition(event, matcherCache, mAllConditionTrackers, conditionCache,
-                                     changedCache);
     }
 
     for (size_t i = 0; i < mAllConditionTrackers.size(); i++) {
         if (changedCache[i] == false) {
             continue;
         }
-        auto pair = mConditionToMetricMap.find(i);
-        if (pair != mConditionToMetricMap.end()) {
-            auto& metricList = pair->second;
-            for (auto metricIndex : metricList) {
-                // Metric cares about non sliced condition, and it's changed.
-                // Push the new condition to it directly.
-                if (!mAllMetricProducers[metricIndex]->isConditionSliced()) {
-                    mAllMetricProducers[metricIndex]->onConditionChanged(conditionCache[i],
-                                                                         eventTimeNs);
-                    // Metric cares about sliced conditions, and it may have changed. Send
-                    // notification, and the metric can query the sliced conditions that are
-                    // interesting to it.
-                } else {
-                    mAllMetricProducers[metricIndex]->onSlicedConditionMayChange(conditionCache[i],
-                                                                                 eventTimeNs);
-                }
+        for (const int metricIndex : mConditionToMetricTable.get(i)) {
+            // Metric cares about non sliced condition, and it's changed.
+            // Push the new condition to it directly.
+            if (!mAllMetricProducers[metricIndex]->isConditionSliced()) {
+                mAllMetricProducers[metricIndex]->onConditionChanged(conditionCache[i],
+                                                                     eventTimeNs);
+                // Metric cares about sliced conditions, and it may have changed. Send
+                // notification, and the metric can query the sliced conditions that are
+                // interesting to it.
+            } else {
+                mAllMetricProducers[metricIndex]->onSlicedConditionMayChange(conditionCache[i],
+                                                                             eventTimeNs);
             }
         }
     }
 
-    // For matched AtomMatchers, tell relevant metrics that a matched event has come.
-    for (size_t i = 0; i < mAllAtomMatchingTrackers.size(); i++) {
+    // For matched AtomMatchers, tell relevant metrics that a matched event has come. While the
+    // config is inactive, only the metrics that keep state from it get it, the others would drop
+    // it.
+    for (const int i : *matcherIndices) {
         if (matcherCache[i] == MatchingState::kMatched) {
             StatsdStats::getInstance().noteMatcherMatched(mConfigKey,
                                                           mAllAtomMatchingTrackers[i]->getId());
-            auto pair = mTrackerToMetricMap.find(i);
-            if (pair != mTrackerToMetricMap.end()) {
-                auto& metricList = pair->second;
-                for (const int metricIndex : metricList) {
-                    // pushed metrics are never scheduled pulls
-                    mAllMetricProducers[metricIndex]->onMatchedLogEvent(i, event);
+            for (const int metricIndex : mTrackerToMetricTable.get(i)) {
+                const sp<MetricProducer>& metric = mAllMetricProducers[metricIndex];
+                if (!isActive && !metric->consumesEventsWhileInactive()) {
+                    continue;
                 }
+                // pushed metrics are never scheduled pulls
+                metric->onMatchedLogEvent(i, event);
             }
         }
     }
@@ -697,6 +1240,19 @@ size_t MetricsManager::byteSize() {
     return totalSize;
 }
 
+MetricsManager::MemoryUsage MetricsManager::getMemoryUsage() {
+    MemoryUsage usage;
+    for (const auto& metricProducer : mAllMetricProducers) {
+        usage.currentBucketBytes += metricProducer->currentBucketByteSize();
+        usage.pastBucketBytes += metricProducer->byteSize();
+        usage.anomalyTrackerBytes += metricProducer->anomalyTrackerByteSize();
+    }
+    for (const auto& conditionTracker : mAllConditionTrackers) {
+        usage.conditionStateBytes += conditionTracker->byteSize();
+    }
+    return usage;
+}
+
 void MetricsManager::loadActiveConfig(const ActiveConfig& config, int64_t currentTimeNs) {
     if (config.metric_size() == 0) {
         ALOGW("No active metric for config %s", mConfigKey.ToString().c_str());
@@ -710,6 +1266,9 @@ void MetricsManager::loadActiveConfig(const ActiveConfig& config, int64_t curren
             if (metric->getMetricId() == activeMetric.id()) {
                 VLOG("Setting active metric: %lld", (long long)metric->getMetricId());
                 metric->loadActiveMetric(activeMetric, currentTimeNs);
+                mActivationsVersion++;
+                // Recomputes the active metrics on the next event.
+                mNextActivationExpiryNs = std::numeric_limits<int64_t>::min();
                 if (!mIsActive && metric->isActive()) {
                     StatsdStats::getInstance().noteActiveStatusChanged(mConfigKey,
                                                                        /*activate=*/ true);
@@ -733,6 +1292,16 @@ void MetricsManager::writeActiveConfigToProtoOutputStream(
     }
 }
 
+bool MetricsManager::hasRunningActivation() const {
+    for (int metricIndex : mMetricIndexesWithActivation) {
+        if (mAllMetricProducers[metricIndex]->getActivationExpiryNs() !=
+            std::numeric_limits<int64_t>::max()) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool MetricsManager::writeMetadataToProto(int64_t currentWallClockTimeNs,
                                           int64_t systemElapsedTimeNs,
                                           metadata::StatsMetadata* statsMetadata) {
@@ -752,6 +1321,15 @@ bool MetricsManager::writeMetadataToProto(int64_t currentWallClockTimeNs,
     return metadataWritten;
 }
 
+uint64_t MetricsManager::getAlertMetadataVersion() const {
+    // The versions only grow, so their sum changes whenever one of them does.
+    uint64_t version = 0;
+    for (const auto& anomalyTracker : mAllAnomalyTrackers) {
+        version += anomalyTracker->getRefractoryPeriodsVersion();
+    }
+    return version;
+}
+
 void MetricsManager::loadMetadata(const metadata::StatsMetadata& metadata,
                                   int64_t currentWallClockTimeNs,
                                   int64_t systemElapsedTimeNs) {
@@ -27,9 +27,18 @@
 #include "logd/LogEvent.h"
 #include "matchers/AtomMatchingTracker.h"
 #include "metrics/MetricProducer.h"
+#include "metrics/parsing_utils/metrics_manager_util.h"
 #include "packages/UidMap.h"
-
+#include "utils/DeadlineQueue.h"
+#include "utils/FlatIndexMap.h"
+#include "utils/GenerationIndexSet.h"
+#include "utils/ParallelExecutor.h"
+
+#include <atomic>
+#include <limits>
+#include <memory>
 #include <unordered_map>
+#include <unordered_set>
 
 namespace android {
 namespace os {
@@ -53,12 +62,32 @@ public:
     // Return whether the configuration is valid.
     bool isConfigValid() const;
 
+    // Adds the ids of all atoms this config matches against to [atomIds].
+    inline void addAllAtomIds(std::unordered_set<int>* atomIds) const {
+        atomIds->insert(mTagIds.begin(), mTagIds.end());
+    }
+
     bool checkLogCredentials(const LogEvent& event);
 
+    // Returns the current snapshot of the allowed log source uids, sorted.
+    inline std::shared_ptr<const std::vector<int32_t>> getAllowedLogSources() const {
+        return std::atomic_load(&mAllowedLogSources);
+    }
+
     bool eventSanityCheck(const LogEvent& event);
 
     void onLogEvent(const LogEvent& event);
 
+    // Flushes the metrics whose activations expired as of [eventTimeNs], and updates isActive().
+    // Done by onLogEvent(), and also needed for the events of other atoms since the activations
+    // expire with time.
+    void flushExpiredActivations(int64_t eventTimeNs);
+
+    // No activation expires before this time, see flushExpiredActivations().
+    inline int64_t getNextActivationExpiryNs() const {
+        return mNextActivationExpiryNs;
+    }
+
     void onAnomalyAlarmFired(
         const int64_t& timestampNs,
         unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>>& alarmSet);
@@ -76,6 +105,10 @@ public:
 
     void onStatsdInitCompleted(const int64_t& elapsedTimeNs);
 
+    // Prepares the first buckets of the metrics, shares the condition states with the other
+    // configs and registers the metrics to the StateTrackers. The constructor can run
+    // concurrently with the processing of the events of the other configs, this is called once
+    // the config is in use.
     void init();
 
     vector<int32_t> getPullAtomUids(int32_t atomId) override;
@@ -110,6 +143,14 @@ public:
         return mPackageCertificateHashSizeBytes;
     }
 
+    inline bool uidMapDeltasInReport() const {
+        return mUidMapDeltasInReport;
+    }
+
+    inline bool stringDictionaryInReport() const {
+        return mStringDictionaryInReport;
+    }
+
     void refreshTtl(const int64_t currentTimestampNs) {
         if (mTtlNs > 0) {
             mTtlEndNs = currentTimestampNs + mTtlNs;
@@ -132,15 +173,30 @@ public:
 
     virtual void dropData(const int64_t dropTimeNs);
 
+    // Writes the report of each metric to [protoOutput]. If [executor] is not null, the reports
+    // of the metrics that are not pulled are serialized on its threads into separate buffers,
+    // then all are copied in order.
     virtual void onDumpReport(const int64_t dumpTimeNs, const int64_t wallClockNs,
                               const bool include_current_partial_bucket, const bool erase_data,
-                              const DumpLatency dumpLatency, std::set<string>* str_set,
-                              android::util::ProtoOutputStream* protoOutput);
+                              const DumpLatency dumpLatency, ReportStrings* str_set,
+                              android::util::ProtoOutputStream* protoOutput,
+                              ParallelExecutor* executor = nullptr);
 
     // Computes the total byte size of all metrics managed by a single config source.
     // Does not change the state.
     virtual size_t byteSize();
 
+    // Estimated heap bytes of the data of this config, by subsystem.
+    struct MemoryUsage {
+        size_t currentBucketBytes = 0;
+        // Same as byteSize().
+        size_t pastBucketBytes = 0;
+        size_t conditionStateBytes = 0;
+        size_t anomalyTrackerBytes = 0;
+    };
+
+    MemoryUsage getMemoryUsage();
+
     // Returns whether or not this config is active.
     // The config is active if any metric in the config is active.
     inline bool isActive() const {
@@ -152,14 +208,37 @@ public:
     void writeActiveConfigToProtoOutputStream(
             int64_t currentTimeNs, const DumpReportReason reason, ProtoOutputStream* proto);
 
+    // Incremented whenever an activation is started, canceled or loaded.
+    inline uint64_t getActivationsVersion() const {
+        return mActivationsVersion;
+    }
+
+    // Returns whether an activation is running, i.e. whether the remaining ttls written by
+    // writeActiveConfigToProtoOutputStream() change over time.
+    bool hasRunningActivation() const;
+
     // Returns true if at least one piece of metadata is written.
     bool writeMetadataToProto(int64_t currentWallClockTimeNs,
                               int64_t systemElapsedTimeNs,
                               metadata::StatsMetadata* statsMetadata);
 
+    // Changes whenever a refractory period of the alerts is set, i.e. whenever
+    // writeMetadataToProto() may write something new.
+    uint64_t getAlertMetadataVersion() const;
+
     void loadMetadata(const metadata::StatsMetadata& metadata,
                       int64_t currentWallClockTimeNs,
                       int64_t systemElapsedTimeNs);
+
+    // Sets the budget of the estimated cost of the configs created or updated after, see
+    // ConfigCost. "<cost>" rejects the configs that cost more, "<cost>:downgrade" removes their
+    // costliest metrics instead. An empty budget admits all configs.
+    static void SetConfigCostBudget(const std::string& budget);
+
+    inline const ConfigCost& getConfigCost() const {
+        return mConfigCost;
+    }
+
 private:
     // For test only.
     inline int64_t getTtlEndNs() const { return mTtlEndNs; }
@@ -170,9 +249,29 @@ private:
 
     bool mConfigValid = false;
 
+    // Budget of the config costs, or 0, see SetConfigCostBudget().
+    static std::atomic<double> sConfigCostBudget;
+    static std::atomic<bool> sDowngradeOverBudget;
+
+    // Estimated cost of the config as of its creation or last update, after any downgrade.
+    ConfigCost mConfigCost;
+
+    // Number of metrics of the config removed to keep it within the budget.
+    int mConfigCostRemovedMetrics = 0;
+
+    // Whether the config was rejected for costing more than the budget.
+    bool mConfigCostRejected = false;
+
+    // Estimates the cost of [config] and applies the config cost budget. Returns the config to
+    // initialize: [config], its downgrade built in [downgradedConfig], or an empty config if it is
+    // rejected.
+    const StatsdConfig& admitConfig(const StatsdConfig& config, StatsdConfig* downgradedConfig);
+
     bool mHashStringsInReport = false;
     bool mVersionStringsInReport = false;
     bool mInstallerInReport = false;
+    bool mUidMapDeltasInReport = false;
+    bool mStringDictionaryInReport = false;
     uint8_t mPackageCertificateHashSizeBytes;
 
     int64_t mTtlNs;
@@ -181,6 +280,15 @@ private:
     int64_t mLastReportTimeNs;
     int64_t mLastReportWallClockNs;
 
+    // StatsdConfig.app_upgrade_coalescing_window_millis in ns, and the time of the last app
+    // change that split the buckets, or -1.
+    int64_t mAppChangeCoalescingWindowNs;
+    int64_t mLastAppChangeSplitNs = -1;
+
+    // StatsdConfig.inactive_metric_memory_release_millis in ns, or 0 if the inactive metrics
+    // keep their memory.
+    int64_t mInactiveMetricMemoryReleaseNs;
+
     sp<StatsPullerManager> mPullerManager;
 
     // The uid log sources from StatsdConfig.
@@ -189,14 +297,17 @@ private:
     // The pkg log sources from StatsdConfig.
     std::vector<std::string> mAllowedPkg;
 
-    // The combined uid sources (after translating pkg name to uid).
+    // The combined uid sources (after translating pkg name to uid), sorted.
     // Logs from uids that are not in the list will be ignored to avoid spamming.
-    std::set<int32_t> mAllowedLogSources;
+    // The list is never modified once published: initAllowedLogSources() swaps in a new one with
+    // std::atomic_store, so that checkLogCredentials() only needs an atomic load per event.
+    std::shared_ptr<const std::vector<int32_t>> mAllowedLogSources;
 
-    // To guard access to mAllowedLogSources
+    // To guard access to mCombinedPullAtomUids
     mutable std::mutex mAllowedLogSourcesMutex;
 
-    std::set<int32_t> mWhitelistedAtomIds;
+    // Sorted and without duplicates, for binary searches in checkLogCredentials().
+    std::vector<int32_t> mWhitelistedAtomIds;
 
     // We can pull any atom from these uids.
     std::set<int32_t> mDefaultPullUids;
@@ -232,9 +343,24 @@ private:
     // Hold all the conditions from the config.
     std::vector<sp<ConditionTracker>> mAllConditionTrackers;
 
+    // The part of the shared condition state keys that describes the events this config sees, as
+    // of the last shareConditionStates().
+    std::string mConditionStateEventsKey;
+
+    // The indices in mAllConditionTrackers and the keys of the condition states to share, see
+    // applyConditionStateShares().
+    std::vector<std::pair<int, std::string>> mPendingConditionStateShares;
+
+    // Whether init() registered mAllMetricProducers to the StateTrackers.
+    bool mStateListenersRegistered = false;
+
     // Hold all metrics from the config.
     std::vector<sp<MetricProducer>> mAllMetricProducers;
 
+    // The dimension keys of the data stored by mAllMetricProducers. Kept across config updates,
+    // like the metrics that are preserved.
+    const sp<MetricDimensionKeyTable> mDimensionKeyTable = new MetricDimensionKeyTable();
+
     // Hold all alert trackers.
     std::vector<sp<AnomalyTracker>> mAllAnomalyTrackers;
 
@@ -247,6 +373,31 @@ private:
     // Maps the id of an atom matching tracker to its index in mAllAtomMatchingTrackers.
     std::unordered_map<int64_t, int> mAtomMatchingTrackerMap;
 
+    // Maps an atom id to the indices of the atom matching trackers that can match it, including
+    // the combination matchers. Each combination comes after its children, and the matchers are
+    // in increasing order otherwise. See initTagIdToMatcherIndices().
+    std::unordered_map<int, std::vector<int>> mTagIdToMatcherIndices;
+
+    // The subset of mTagIdToMatcherIndices evaluated while the config is inactive: the matchers
+    // that activate or deactivate metrics, feed conditions or feed metrics that consume events
+    // while inactive (see MetricProducer::consumesEventsWhileInactive()), and their children.
+    // The other metrics don't get the events, but the conditions must be current once they
+    // activate. See initInactiveTagIdToMatcherIndices().
+    std::unordered_map<int, std::vector<int>> mInactiveTagIdToMatcherIndices;
+
+    // Scratch state of onLogEvent(), kept across events so that it isn't allocated for every
+    // event. See initEventScratch().
+    std::vector<MatchingState> mMatcherCache;
+    // Bit i is set if mAllAtomMatchingTrackers[i] matched the event.
+    std::vector<uint64_t> mMatchedBits;
+    std::vector<ConditionState> mConditionCache;
+    std::vector<bool> mConditionToBeEvaluated;
+    std::vector<bool> mConditionChangedCache;
+    // Kept across events: the metrics with activations that are active, see
+    // mNextActivationExpiryNs.
+    GenerationIndexSet mActiveMetricIndices;
+    GenerationIndexSet mMetricIndicesWithCanceledActivations;
+
     // Maps the id of a condition tracker to its index in mAllConditionTrackers.
     std::unordered_map<int64_t, int> mConditionTrackerMap;
 
@@ -281,12 +432,48 @@ private:
     // Maps deactivation triggering event to MetricProducers.
     std::unordered_map<int, std::vector<int>> mDeactivationAtomTrackerToMetricMap;
 
+    // Flattened copies of the maps above, which onLogEvent() reads. See initDispatchTables().
+    FlatIndexMap mTrackerToMetricTable;
+    FlatIndexMap mTrackerToConditionTable;
+    FlatIndexMap mConditionToMetricTable;
+    FlatIndexMap mActivationAtomTrackerToMetricTable;
+    FlatIndexMap mDeactivationAtomTrackerToMetricTable;
+
     // Maps AlertIds to the index of the corresponding AnomalyTracker stored in mAllAnomalyTrackers.
     // The map is used in LoadMetadata to more efficiently lookup AnomalyTrackers from an AlertId.
     std::unordered_map<int64_t, int> mAlertTrackerMap;
 
     std::vector<int> mMetricIndexesWithActivation;
 
+    // Bit i is set if mAllAtomMatchingTrackers[i] is in mActivationAtomTrackerToMetricMap,
+    // respectively mDeactivationAtomTrackerToMetricMap. See initActivationMatcherBits().
+    std::vector<uint64_t> mActivationMatcherBits;
+    std::vector<uint64_t> mDeactivationMatcherBits;
+
+    // No activation of mMetricIndexesWithActivation expires before this time, so the metrics
+    // don't need to be flushed for earlier events and mActiveMetricIndices is up to date.
+    // INT64_MIN when the metrics must be flushed on the next event, e.g. after loading them.
+    int64_t mNextActivationExpiryNs = std::numeric_limits<int64_t>::min();
+
+    // The activation expiry of each metric of mActiveMetricIndices, and possibly earlier ones:
+    // the metrics whose entries expire are flushed, and scheduled again if still active.
+    DeadlineQueue mActivationExpiryQueue;
+
+    // The metrics of mMetricIndexesWithActivation that were deactivated, at the time they release
+    // their memory if they are still inactive. Empty if mInactiveMetricMemoryReleaseNs is 0.
+    // mMemoryReleaseNs has the latest release time of each metric, the earlier entries of a
+    // metric deactivated again are skipped.
+    DeadlineQueue mMemoryReleaseQueue;
+    std::vector<int64_t> mMemoryReleaseNs;
+
+    // Schedules the release of the memory of the metric at [metricIndex], deactivated at
+    // [eventTimeNs].
+    void scheduleMemoryRelease(int metricIndex, int64_t eventTimeNs);
+
+    // Releases the memory of the metrics that stayed inactive since their release was scheduled
+    // before [eventTimeNs].
+    void releaseInactiveMetricMemory(int64_t eventTimeNs);
+
     void initAllowedLogSources();
 
     void initPullAtomSources();
@@ -303,12 +490,97 @@ private:
     // Should be called on config creation/update.
     void initializeConfigActiveStatus();
 
+    // Builds mTagIdToMatcherIndices from mAllAtomMatchingTrackers.
+    // Should be called on config creation/update.
+    void initTagIdToMatcherIndices();
+
+    // Builds mInactiveTagIdToMatcherIndices from mTagIdToMatcherIndices, the activation maps,
+    // mTrackerToConditionMap and mTrackerToMetricMap.
+    // Should be called on config creation/update.
+    void initInactiveTagIdToMatcherIndices();
+
+    // Sizes the scratch state of onLogEvent() for the current trackers and metrics.
+    // Should be called on config creation/update.
+    void initEventScratch();
+
+    // Builds mActivationMatcherBits and mDeactivationMatcherBits.
+    // Should be called on config creation/update.
+    void initActivationMatcherBits();
+
+    // Builds the dispatch tables from mTrackerToMetricMap, mConditionToMetricMap and the
+    // activation maps.
+    // Should be called on config creation/update.
+    void initDispatchTables();
+
+    // Builds mTrackerToConditionTable from mTrackerToConditionMap, which only changes with the
+    // matchers and conditions.
+    // Should be called on config creation, and on updates that change them.
+    void initConditionDispatchTable();
+
+    // Finds the keys to share the states of the conditions with the identical conditions of the
+    // configs that see the same events, see SharedConditionStateRegistry. The conditions
+    // preserved by an update are skipped unless the events changed, [changedConditions] is
+    // indexed like mAllConditionTrackers. The states are shared by applyConditionStateShares().
+    // Should be called on config creation/update, once the log sources are known.
+    void shareConditionStates(const StatsdConfig& config,
+                              const std::vector<bool>& changedConditions);
+
+    // Shares the condition states found by the last shareConditionStates(). The shared states
+    // are updated by the events of the other configs, so this is done once the config is in
+    // use: by init() for a new config, and by updateConfig().
+    void applyConditionStateShares();
+
+    // Interns the dimension keys of [changedMetrics] in mDimensionKeyTable. It is indexed like
+    // mAllMetricProducers, the preserved metrics already use the table.
+    // Should be called on config creation/update.
+    void shareDimensionKeyTable(const std::vector<bool>& changedMetrics);
+
+    // Restarts the cardinality estimates of the metrics and conditions if the config asks for
+    // them, and drops them otherwise. Should be called on config creation/update.
+    void setDimensionCardinalityEstimates(const StatsdConfig& config);
+
+    // Enables the cost tracking of the metrics if the config asks for it, and disables it
+    // otherwise. Should be called on config creation/update.
+    void setMetricCostTracking(const StatsdConfig& config);
+
+    // onDumpReport() with [executor]: serializes the report of each metric on its threads,
+    // except for the pulled metrics, which dump on the calling thread.
+    void dumpMetricReportsInParallel(const int64_t dumpTimeStampNs,
+                                     const bool include_current_partial_bucket,
+                                     const bool erase_data, const DumpLatency dumpLatency,
+                                     ReportStrings* str_set,
+                                     android::util::ProtoOutputStream* protoOutput,
+                                     ParallelExecutor* executor);
+
+    // Enables the rollup of the past buckets of the metrics if the config asks for it, and
+    // disables it otherwise. Should be called on config creation/update.
+    void setPastBucketRollups(const StatsdConfig& config);
+
+    // Returns whether the app change at [eventTimeNs] splits the buckets of the metrics, which it
+    // doesn't within mAppChangeCoalescingWindowNs of the last one that did.
+    bool shouldSplitBucketsForAppChange(const int64_t eventTimeNs);
+
+    // Calls [callback] with the index of each matcher set in both [matcherBits] and mMatchedBits.
+    template <typename Callback>
+    void forEachMatchedMatcher(const std::vector<uint64_t>& matcherBits, Callback callback) {
+        for (size_t word = 0; word < matcherBits.size(); word++) {
+            uint64_t bits = matcherBits[word] & mMatchedBits[word];
+            while (bits != 0) {
+                callback(word * 64 + __builtin_ctzll(bits));
+                bits &= bits - 1;
+            }
+        }
+    }
+
     // The metrics that don't need to be uploaded or even reported.
     std::set<int64_t> mNoReportMetricIds;
 
    // The config is active if any metric in the config is active.
     bool mIsActive;
 
+    // See getActivationsVersion().
+    uint64_t mActivationsVersion = 0;
+
     // The config is always active if any metric in the config does not have an activation signal.
     bool mIsAlwaysActive;
 
@@ -331,6 +603,7 @@ private:
     FRIEND_TEST(AnomalyDetectionE2eTest, TestCountMetric_save_refractory_to_disk_no_data_written);
     FRIEND_TEST(AnomalyDetectionE2eTest, TestCountMetric_save_refractory_to_disk);
     FRIEND_TEST(AnomalyDetectionE2eTest, TestCountMetric_load_refractory_from_disk);
+    FRIEND_TEST(AnomalyDetectionE2eTest, TestCountMetric_save_refractory_after_wall_clock_change);
     FRIEND_TEST(AnomalyDetectionE2eTest, TestDurationMetric_SUM_single_bucket);
     FRIEND_TEST(AnomalyDetectionE2eTest, TestDurationMetric_SUM_partial_bucket);
     FRIEND_TEST(AnomalyDetectionE2eTest, TestDurationMetric_SUM_multiple_buckets);
@@ -347,6 +620,15 @@ private:
 
     FRIEND_TEST(MetricsManagerTest, TestLogSources);
     FRIEND_TEST(MetricsManagerTest, TestLogSourcesOnConfigUpdate);
+    FRIEND_TEST(MetricsManagerTest, TestTagIdToMatcherIndices);
+    FRIEND_TEST(MetricsManagerTest, TestTagIdToMatcherIndicesChildrenFirst);
+    FRIEND_TEST(MetricsManagerTest, TestConfigUpdatePreservingMatchers);
+    FRIEND_TEST(MetricsManagerTest, TestAppUpgradesCoalesced);
+    FRIEND_TEST(MetricsManagerTest, TestInactiveConfigOnlyEvaluatesActivationAndConditionMatchers);
+    FRIEND_TEST(MetricsManagerTest, TestInactiveConfigDispatchesToDurationMetrics);
+    FRIEND_TEST(MetricsManagerTest, TestParallelDumpPullsOnCallingThread);
+    FRIEND_TEST(MetricsManagerTest, TestInactiveMetricMemoryReleased);
+    FRIEND_TEST(MetricsManagerTest, TestConditionStatesSharedOnInit);
 
     FRIEND_TEST(StatsLogProcessorTest, TestActiveConfigMetricDiskWriteRead);
     FRIEND_TEST(StatsLogProcessorTest, TestActivationOnBoot);
@@ -381,6 +663,7 @@ private:
     FRIEND_TEST(ValueMetricE2eTest, TestInitWithSlicedState);
     FRIEND_TEST(ValueMetricE2eTest, TestInitWithSlicedState_WithDimensions);
     FRIEND_TEST(ValueMetricE2eTest, TestInitWithSlicedState_WithIncorrectDimensions);
+    FRIEND_TEST(MetricsManagerTest, TestConfigOverCostBudget);
 };
 
 }  // namespace statsd
@@ -22,7 +22,11 @@
 #include <limits.h>
 #include <stdlib.h>
 
+#include <algorithm>
+
+#include "external/StatsPuller.h"
 #include "guardrail/StatsdStats.h"
+#include "metrics/DiffKernel.h"
 #include "metrics/parsing_utils/metrics_manager_util.h"
 #include "stats_log_util.h"
 
@@ -60,6 +64,12 @@ const int FIELD_ID_CONDITION_CORRECTION_NS = 11;
 const Value ZERO_LONG((int64_t)0);
 const Value ZERO_DOUBLE(0.0);
 
+std::atomic<bool> NumericValueMetricProducer::sBulkDiffs(false);
+
+void NumericValueMetricProducer::SetBulkDiffs(bool enabled) {
+    sBulkDiffs.store(enabled, std::memory_order_relaxed);
+}
+
 // ValueMetric has a minimum bucket size of 10min so that we don't pull too frequently
 NumericValueMetricProducer::NumericValueMetricProducer(
         const ConfigKey& key, const ValueMetric& metric, const uint64_t protoHash,
@@ -71,6 +81,7 @@ NumericValueMetricProducer::NumericValueMetricProducer(
                           conditionOptions, stateOptions, activationOptions, guardrailOptions),
       mUseAbsoluteValueOnReset(metric.use_absolute_value_on_reset()),
       mAggregationType(metric.aggregation_type()),
+      mAggregate(getAggregateFunction(metric.aggregation_type())),
       mUseDiff(metric.has_use_diff() ? metric.use_diff() : isPulled()),
       mValueDirection(metric.value_direction()),
       mSkipZeroDiffOutput(metric.skip_zero_diff_output()),
@@ -84,6 +95,47 @@ NumericValueMetricProducer::NumericValueMetricProducer(
     }
 }
 
+template <ValueMetric::AggregationType type>
+void NumericValueMetricProducer::aggregateValue(Value& aggregate, const Value& value) {
+    // Value fields are longs or doubles, which are combined without Value's type switch.
+    if (aggregate.type == LONG && value.type == LONG) {
+        if constexpr (type == ValueMetric::MIN) {
+            aggregate.long_value = std::min(aggregate.long_value, value.long_value);
+        } else if constexpr (type == ValueMetric::MAX) {
+            aggregate.long_value = std::max(aggregate.long_value, value.long_value);
+        } else {
+            aggregate.long_value += value.long_value;
+        }
+    } else if (aggregate.type == DOUBLE && value.type == DOUBLE) {
+        if constexpr (type == ValueMetric::MIN) {
+            aggregate.double_value = std::min(aggregate.double_value, value.double_value);
+        } else if constexpr (type == ValueMetric::MAX) {
+            aggregate.double_value = std::max(aggregate.double_value, value.double_value);
+        } else {
+            aggregate.double_value += value.double_value;
+        }
+    } else if constexpr (type == ValueMetric::MIN) {
+        aggregate = std::min(value, aggregate);
+    } else if constexpr (type == ValueMetric::MAX) {
+        aggregate = std::max(value, aggregate);
+    } else {
+        aggregate += value;
+    }
+}
+
+NumericValueMetricProducer::AggregateFunction NumericValueMetricProducer::getAggregateFunction(
+        const ValueMetric::AggregationType type) {
+    switch (type) {
+        case ValueMetric::MIN:
+            return &aggregateValue<ValueMetric::MIN>;
+        case ValueMetric::MAX:
+            return &aggregateValue<ValueMetric::MAX>;
+        default:
+            // For AVG, we add up and take average when flushing the bucket.
+            return &aggregateValue<ValueMetric::SUM>;
+    }
+}
+
 void NumericValueMetricProducer::invalidateCurrentBucket(const int64_t dropTimeNs,
                                                          const BucketDropReason reason) {
     ValueMetricProducer::invalidateCurrentBucket(dropTimeNs, reason);
@@ -150,6 +202,7 @@ void NumericValueMetricProducer::onConditionChangedInternalLocked(const Conditio
 }
 
 void NumericValueMetricProducer::prepareFirstBucketLocked() {
+    ValueMetricProducer::prepareFirstBucketLocked();
     // Kicks off the puller immediately if condition is true and diff based.
     if (mIsActive && isPulled() && mCondition == ConditionState::kTrue && mUseDiff) {
         pullAndMatchEventsLocked(mCurrentBucketStartTimeNs);
@@ -210,23 +263,77 @@ void NumericValueMetricProducer::onDataPulled(const vector<shared_ptr<LogEvent>>
     flushIfNeededLocked(originalPullTimeNs);
 }
 
-void NumericValueMetricProducer::combineValueFields(pair<LogEvent, vector<int>>& eventValues,
+void NumericValueMetricProducer::notifyAppUpgradeInternalLocked(const int64_t eventTimeNs) {
+    mLastPulledRows.clear();
+    ValueMetricProducer::notifyAppUpgradeInternalLocked(eventTimeNs);
+}
+
+void NumericValueMetricProducer::combineValueFields(LogEvent& sum,
+                                                    const vector<int>& sumValueIndices,
                                                     const LogEvent& newEvent,
                                                     const vector<int>& newValueIndices) const {
-    if (eventValues.second.size() != newValueIndices.size()) {
+    if (sumValueIndices.size() != newValueIndices.size()) {
         ALOGE("NumericValueMetricProducer value indices sizes don't match");
         return;
     }
-    vector<FieldValue>* const aggregateFieldValues = eventValues.first.getMutableValues();
+    vector<FieldValue>* const aggregateFieldValues = sum.getMutableValues();
     const vector<FieldValue>& newFieldValues = newEvent.getValues();
-    for (size_t i = 0; i < eventValues.second.size(); ++i) {
-        if (newValueIndices[i] != -1 && eventValues.second[i] != -1) {
-            (*aggregateFieldValues)[eventValues.second[i]].mValue +=
+    for (size_t i = 0; i < sumValueIndices.size(); ++i) {
+        if (newValueIndices[i] != -1 && sumValueIndices[i] != -1) {
+            (*aggregateFieldValues)[sumValueIndices[i]].mValue +=
                     newFieldValues[newValueIndices[i]].mValue;
         }
     }
 }
 
+void NumericValueMetricProducer::matchPulledRowLocked(const LogEvent& event,
+                                                      PulledRow* row) const {
+    row->matched = mEventMatcherWizard->matchLogEvent(event, mWhatMatcherIndex) ==
+                   MatchingState::kMatched;
+    if (!row->matched) {
+        return;
+    }
+    // Get dimensions_in_what key and value indices.
+    row->dimensionsInWhat.clear();
+    row->valueIndices.assign(mFieldMatchers.size(), -1);
+    if (!filterValues(mDimensionsInWhat, mFieldMatchers, event.getValues(), row->dimensionsInWhat,
+                      row->valueIndices)) {
+        StatsdStats::getInstance().noteBadValueType(mMetricId);
+    }
+}
+
+bool NumericValueMetricProducer::skipUnchangedDimensionLocked(
+        const HashableDimensionKey& dimensionsInWhat, const PulledDimension& dimension) {
+    if (!dimension.unchanged) {
+        return false;
+    }
+    const auto dimInfoIt = findDimInfoLocked(dimensionsInWhat);
+    if (dimInfoIt == mDimInfos.end() || dimInfoIt->second.numPulledRows != dimension.numRows) {
+        return false;
+    }
+    const ValueBases& bases = dimInfoIt->second.dimExtras;
+    if (bases.size() < mFieldMatchers.size() ||
+        std::any_of(bases.begin(), bases.end(),
+                    [](const optional<Value>& base) { return !base.has_value(); })) {
+        return false;
+    }
+    // Intervals without a value would get a 0 value.
+    const auto bucketIt = mCurrentSlicedBucket.find(
+            MetricDimensionKey(dimensionsInWhat, dimInfoIt->second.currentState));
+    if (bucketIt == mCurrentSlicedBucket.end()) {
+        return false;
+    }
+    const vector<Interval>& intervals = bucketIt->second.intervals;
+    if (intervals.size() < mFieldMatchers.size() ||
+        std::any_of(intervals.begin(), intervals.end(),
+                    [](const Interval& interval) { return !interval.hasValue(); })) {
+        return false;
+    }
+    mMatchedMetricDimensionKeys.insert(dimensionsInWhat);
+    dimInfoIt->second.seenNewData = true;
+    return true;
+}
+
 // Process events retrieved from a pull.
 void NumericValueMetricProducer::accumulateEvents(const vector<shared_ptr<LogEvent>>& allData,
                                                   int64_t originalPullTimeNs,
@@ -253,44 +360,108 @@ void NumericValueMetricProducer::accumulateEvents(const vector<shared_ptr<LogEve
     }
 
     mMatchedMetricDimensionKeys.clear();
+    mMatchedMetricDimensionKeys.reserve(allData.size());
     if (mUseDiff) {
+        // With delta encoding, the rows handed out again by the puller are matched as in the last
+        // pull. The rows are not shared with the other metrics, whose last pulls may differ.
+        const bool trackRows = StatsPuller::IsDeltaEncoding();
+        if (mLastPulledRowsWizard != mEventMatcherWizard ||
+            mLastPulledRowsMatcherIndex != mWhatMatcherIndex) {
+            mLastPulledRows.clear();
+            mLastPulledRowsWizard = mEventMatcherWizard;
+            mLastPulledRowsMatcherIndex = mWhatMatcherIndex;
+        }
+        std::unordered_map<shared_ptr<LogEvent>, PulledRow> pulledRows;
+        if (trackRows) {
+            pulledRows.reserve(allData.size());
+        }
+
         // An extra aggregation step is needed to sum values with matching dimensions
         // before calculating the diff between sums of consecutive pulls.
-        std::unordered_map<HashableDimensionKey, pair<LogEvent, vector<int>>> aggregateEvents;
+        std::unordered_map<HashableDimensionKey, PulledDimension> aggregateEvents;
+        aggregateEvents.reserve(allData.size());
+        PulledRow localRow;
         for (const auto& data : allData) {
-            if (mEventMatcherWizard->matchLogEvent(*data, mWhatMatcherIndex) !=
-                MatchingState::kMatched) {
-                continue;
+            PulledRow* row = &localRow;
+            if (trackRows) {
+                auto rowIt = pulledRows.find(data);
+                if (rowIt != pulledRows.end()) {
+                    // The same row twice in a pull is not the row of the last pull.
+                    rowIt->second.unchanged = false;
+                } else if (auto lastRowIt = mLastPulledRows.find(data);
+                           lastRowIt != mLastPulledRows.end()) {
+                    rowIt = pulledRows.insert(mLastPulledRows.extract(lastRowIt)).position;
+                    rowIt->second.unchanged = true;
+                } else {
+                    rowIt = pulledRows.emplace(data, PulledRow()).first;
+                    matchPulledRowLocked(*data, &rowIt->second);
+                }
+                row = &rowIt->second;
+            } else {
+                matchPulledRowLocked(*data, row);
             }
-
-            // Get dimensions_in_what key and value indices.
-            HashableDimensionKey dimensionsInWhat;
-            vector<int> valueIndices(mFieldMatchers.size(), -1);
-            if (!filterValues(mDimensionsInWhat, mFieldMatchers, data->getValues(),
-                              dimensionsInWhat, valueIndices)) {
-                StatsdStats::getInstance().noteBadValueType(mMetricId);
+            if (!row->matched) {
+                continue;
             }
 
             // Store new event in map or combine values in existing event.
-            auto it = aggregateEvents.find(dimensionsInWhat);
+            auto it = aggregateEvents.find(row->dimensionsInWhat);
             if (it == aggregateEvents.end()) {
-                aggregateEvents.emplace(std::piecewise_construct,
-                                        std::forward_as_tuple(dimensionsInWhat),
-                                        std::forward_as_tuple(*data, valueIndices));
+                it = aggregateEvents.emplace(row->dimensionsInWhat, PulledDimension()).first;
+                it->second.firstRow = data;
+                it->second.valueIndices = row->valueIndices;
             } else {
-                combineValueFields(it->second, *data, valueIndices);
+                PulledDimension& dimension = it->second;
+                if (!dimension.sum.has_value()) {
+                    dimension.sum.emplace(*dimension.firstRow);
+                }
+                combineValueFields(*dimension.sum, dimension.valueIndices, *data,
+                                   row->valueIndices);
             }
+            it->second.numRows++;
+            it->second.unchanged &= row->unchanged;
         }
 
-        for (auto& [dimKey, eventInfo] : aggregateEvents) {
-            eventInfo.first.setElapsedTimestampNs(eventElapsedTimeNs);
-            onMatchedLogEventLocked(mWhatMatcherIndex, eventInfo.first);
+        // Unchanged dimensions add 0 to their intervals, which is only skipped if that has no
+        // other effect on the metric.
+        const bool skipUnchanged = trackRows && mIsActive && eventElapsedTimeNs >= mTimeBaseNs &&
+                                   !mConditionSliced && mSlicedStateAtoms.empty() &&
+                                   mAnomalyTrackers.empty() &&
+                                   mAggregationType == ValueMetric::SUM;
+        // The events of the other metrics also go through onMatchedLogEventLocked(), which they
+        // would skip or use for more than their own intervals.
+        const bool bulkDiffs = sBulkDiffs.load(std::memory_order_relaxed) && mIsActive &&
+                               eventElapsedTimeNs >= mTimeBaseNs && mShardCount <= 1 &&
+                               !mConditionSliced && mSlicedStateAtoms.empty() &&
+                               mMetric2StateLinks.empty() && mAnomalyTrackers.empty() &&
+                               mValueDirection != ValueMetric::UNKNOWN;
+        for (auto& [dimKey, dimension] : aggregateEvents) {
+            if (skipUnchanged && skipUnchangedDimensionLocked(dimKey, dimension)) {
+                continue;
+            }
+            const LogEvent& pulledEvent =
+                    dimension.sum.has_value() ? *dimension.sum : *dimension.firstRow;
+            if (!bulkDiffs || !addBulkDiffDimensionLocked(dimKey, pulledEvent)) {
+                LogEvent event = dimension.sum.has_value() ? std::move(*dimension.sum)
+                                                           : *dimension.firstRow;
+                event.setElapsedTimestampNs(eventElapsedTimeNs);
+                onMatchedLogEventLocked(mWhatMatcherIndex, event);
+            }
+            if (trackRows) {
+                const auto dimInfoIt = findDimInfoLocked(dimKey);
+                if (dimInfoIt != mDimInfos.end()) {
+                    dimInfoIt->second.numPulledRows = dimension.numRows;
+                }
+            }
         }
+        applyBulkDiffsLocked();
+        mLastPulledRows.swap(pulledRows);
     } else {
         for (const auto& data : allData) {
-            LogEvent localCopy = *data;
-            if (mEventMatcherWizard->matchLogEvent(localCopy, mWhatMatcherIndex) ==
+            // Only the matched events are copied to set their timestamp.
+            if (mEventMatcherWizard->matchLogEvent(*data, mWhatMatcherIndex) ==
                 MatchingState::kMatched) {
+                LogEvent localCopy = *data;
                 localCopy.setElapsedTimestampNs(eventElapsedTimeNs);
                 onMatchedLogEventLocked(mWhatMatcherIndex, localCopy);
             }
@@ -302,6 +473,7 @@ void NumericValueMetricProducer::accumulateEvents(const vector<shared_ptr<LogEve
     // 2. A superset of the current mStateChangePrimaryKey
     // was not found in the new pulled data (i.e. not in mMatchedDimensionInWhatKeys)
     // then we clear the data from mDimInfos to reset the base and current state key.
+    syncAllConditionTimersLocked();
     for (auto& [metricDimensionKey, currentValueBucket] : mCurrentSlicedBucket) {
         const auto& whatKey = metricDimensionKey.getDimensionKeyInWhat();
         bool presentInPulledData =
@@ -309,14 +481,17 @@ void NumericValueMetricProducer::accumulateEvents(const vector<shared_ptr<LogEve
         if (!presentInPulledData &&
             containsLinkedStateValues(whatKey, mStateChangePrimaryKey.second, mMetric2StateLinks,
                                       mStateChangePrimaryKey.first)) {
-            auto it = mDimInfos.find(whatKey);
+            auto it = findDimInfoLocked(whatKey);
             if (it != mDimInfos.end()) {
-                mDimInfos.erase(it);
+                eraseDimInfoLocked(it);
             }
             // Turn OFF condition timer for keys not present in pulled data.
             currentValueBucket.conditionTimer.onConditionChanged(false, eventElapsedTimeNs);
         }
     }
+    if (mUseDiff) {
+        evictStaleBasesLocked(eventElapsedTimeNs);
+    }
     mMatchedMetricDimensionKeys.clear();
     mHasGlobalBase = true;
 
@@ -329,6 +504,37 @@ void NumericValueMetricProducer::accumulateEvents(const vector<shared_ptr<LogEve
     if (hasReachedGuardRailLimit()) {
         invalidateCurrentBucket(eventElapsedTimeNs, BucketDropReason::DIMENSION_GUARDRAIL_REACHED);
         mCurrentSlicedBucket.clear();
+        for (auto& [_, dimensionInWhatInfo] : mDimInfos) {
+            dimensionInWhatInfo.currentConditionTimer = nullptr;
+        }
+    }
+}
+
+void NumericValueMetricProducer::evictStaleBasesLocked(const int64_t eventElapsedTimeNs) {
+    mPullNum++;
+    int numEvicted = 0;
+    for (auto it = mDimInfos.begin(); it != mDimInfos.end();) {
+        DimensionsInWhatInfo& dimInfo = it->second;
+        if (mMatchedMetricDimensionKeys.find(it->first) != mMatchedMetricDimensionKeys.end()) {
+            dimInfo.lastPullNum = mPullNum;
+        } else if (mPullNum - dimInfo.lastPullNum >= kMaxPullsWithoutDimension) {
+            // The values aggregated in the bucket are kept, only the base and the state go.
+            if (!mSlicedStateAtoms.empty()) {
+                const auto bucketIt = mCurrentSlicedBucket.find(
+                        MetricDimensionKey(it->first, dimInfo.currentState));
+                if (bucketIt != mCurrentSlicedBucket.end()) {
+                    bucketIt->second.conditionTimer.onConditionChanged(false, eventElapsedTimeNs);
+                }
+            }
+            it = eraseDimInfoLocked(it);
+            numEvicted++;
+            continue;
+        }
+        it++;
+    }
+    if (numEvicted > 0) {
+        VLOG("Metric %lld evicted %d stale bases", (long long)mMetricId, numEvicted);
+        StatsdStats::getInstance().noteStaleBasesEvicted(mMetricId, numEvicted);
     }
 }
 
@@ -378,6 +584,81 @@ bool getDoubleOrLong(const LogEvent& event, const Matcher& matcher, Value& ret)
     return false;
 }
 
+bool NumericValueMetricProducer::addBulkDiffDimensionLocked(
+        const HashableDimensionKey& dimensionsInWhat, const LogEvent& event) {
+    // Without sliced states, the dimensions are in the buckets of the default state key.
+    const auto dimInfoIt = findDimInfoLocked(dimensionsInWhat);
+    if (dimInfoIt == mDimInfos.end() || !dimInfoIt->second.hasCurrentState ||
+        !(dimInfoIt->second.currentState == DEFAULT_DIMENSION_KEY)) {
+        return false;
+    }
+    const ValueBases& bases = dimInfoIt->second.dimExtras;
+    const auto bucketIt =
+            mCurrentSlicedBucket.find(MetricDimensionKey(dimensionsInWhat, DEFAULT_DIMENSION_KEY));
+    if (bases.size() < mFieldMatchers.size() || bucketIt == mCurrentSlicedBucket.end() ||
+        bucketIt->second.intervals.size() < mFieldMatchers.size()) {
+        return false;
+    }
+    const size_t numQueuedValues = mBulkDiffValues.size();
+    for (size_t i = 0; i < mFieldMatchers.size(); i++) {
+        Value value;
+        if (!bases[i].has_value() || bases[i]->type != LONG ||
+            !getDoubleOrLong(event, mFieldMatchers[i], value) || value.type != LONG) {
+            mBulkDiffValues.resize(numQueuedValues);
+            mBulkDiffBases.resize(numQueuedValues);
+            return false;
+        }
+        mBulkDiffValues.push_back(value.long_value);
+        mBulkDiffBases.push_back(bases[i]->long_value);
+    }
+
+    // What onMatchedLogEventLocked() does for the event besides aggregateFields().
+    noteDimensionLocked(dimensionsInWhat, DEFAULT_DIMENSION_KEY);
+    mMatchedMetricDimensionKeys.insert(dimensionsInWhat);
+    syncConditionTimerLocked(dimensionsInWhat, dimInfoIt->second);
+    mBulkDiffDimensions.push_back({&dimInfoIt->second, &bucketIt->second.intervals});
+    return true;
+}
+
+void NumericValueMetricProducer::applyBulkDiffsLocked() {
+    if (mBulkDiffDimensions.empty()) {
+        return;
+    }
+    const size_t numValues = mBulkDiffValues.size();
+    mBulkDiffs.resize(numValues);
+    mBulkDiffValid.resize(numValues);
+    computeLongDiffs(mBulkDiffValues.data(), mBulkDiffBases.data(), numValues, mValueDirection,
+                     mUseAbsoluteValueOnReset, mBulkDiffs.data(), mBulkDiffValid.data());
+
+    const size_t numFields = mFieldMatchers.size();
+    for (size_t d = 0; d < mBulkDiffDimensions.size(); d++) {
+        ValueBases& bases = mBulkDiffDimensions[d].dimInfo->dimExtras;
+        vector<Interval>& intervals = *mBulkDiffDimensions[d].intervals;
+        for (size_t i = 0; i < numFields; i++) {
+            const size_t index = d * numFields + i;
+            bases[i]->long_value = mBulkDiffValues[index];
+            Interval& interval = intervals[i];
+            interval.aggIndex = i;
+            if (!mBulkDiffValid[index]) {
+                VLOG("Unexpected reset value");
+                StatsdStats::getInstance().notePullDataError(mPullAtomId);
+                continue;
+            }
+            const Value diff(mBulkDiffs[index]);
+            if (interval.hasValue()) {
+                mAggregate(interval.aggregate, diff);
+            } else {
+                interval.aggregate = diff;
+            }
+            interval.sampleSize += 1;
+        }
+        mBulkDiffDimensions[d].dimInfo->seenNewData = true;
+    }
+    mBulkDiffDimensions.clear();
+    mBulkDiffValues.clear();
+    mBulkDiffBases.clear();
+}
+
 bool NumericValueMetricProducer::aggregateFields(const int64_t eventTimeNs,
                                                  const MetricDimensionKey& eventKey,
                                                  const LogEvent& event, vector<Interval>& intervals,
@@ -465,21 +746,7 @@ bool NumericValueMetricProducer::aggregateFields(const int64_t eventTimeNs,
         }
 
         if (interval.hasValue()) {
-            switch (mAggregationType) {
-                case ValueMetric::SUM:
-                    // for AVG, we add up and take average when flushing the bucket
-                case ValueMetric::AVG:
-                    interval.aggregate += value;
-                    break;
-                case ValueMetric::MIN:
-                    interval.aggregate = min(value, interval.aggregate);
-                    break;
-                case ValueMetric::MAX:
-                    interval.aggregate = max(value, interval.aggregate);
-                    break;
-                default:
-                    break;
-            }
+            mAggregate(interval.aggregate, value);
         } else {
             interval.aggregate = value;
         }
@@ -619,6 +886,17 @@ size_t NumericValueMetricProducer::byteSizeLocked() const {
     return totalSize;
 }
 
+size_t NumericValueMetricProducer::currentBucketByteSizeLocked() const {
+    size_t totalSize = ValueMetricProducer::currentBucketByteSizeLocked();
+    // The events are shared with the puller cache, which counts them.
+    for (const auto& [_, row] : mLastPulledRows) {
+        totalSize += kHashMapNodeOverheadBytes + sizeof(std::shared_ptr<LogEvent>) +
+                     sizeof(PulledRow) + row.dimensionsInWhat.getValuesByteSize() +
+                     row.valueIndices.capacity() * sizeof(int);
+    }
+    return totalSize;
+}
+
 bool NumericValueMetricProducer::valuePassesThreshold(const Interval& interval) const {
     if (mUploadThreshold == nullopt) {
         return true;
@@ -18,6 +18,7 @@
 
 #include <gtest/gtest_prod.h>
 
+#include <atomic>
 #include <optional>
 
 #include "ValueMetricProducer.h"
@@ -46,6 +47,10 @@ public:
         return METRIC_TYPE_VALUE;
     }
 
+    // Makes the diffed metrics compute the diffs of the dimensions of a pull together, see
+    // computeLongDiffs(), when each dimension of the pull only updates its own intervals.
+    static void SetBulkDiffs(bool enabled);
+
 protected:
 private:
     void prepareFirstBucketLocked() override;
@@ -68,6 +73,9 @@ private:
 
     void onActiveStateChangedInternalLocked(const int64_t eventTimeNs) override;
 
+    // Forgets the last pulled rows, whose matching may depend on the uid map.
+    void notifyAppUpgradeInternalLocked(const int64_t eventTimeNs) override;
+
     // Only called when mIsActive and the event is NOT too late.
     void onConditionChangedInternalLocked(const ConditionState oldCondition,
                                           const ConditionState newCondition,
@@ -112,7 +120,7 @@ private:
 
     inline bool canSkipLogEventLocked(
             const MetricDimensionKey& eventKey, const bool condition, const int64_t eventTimeNs,
-            const map<int, HashableDimensionKey>& statePrimaryKeys) const override {
+            const vector<HashableDimensionKey>& statePrimaryKeys) const override {
         // For pushed metrics, can only skip if condition is false.
         // For pulled metrics, can only skip if metric is not diffed and condition is false or
         // unknown.
@@ -134,13 +142,71 @@ private:
     // Internal function to calculate the current used bytes.
     size_t byteSizeLocked() const override;
 
-    void combineValueFields(pair<LogEvent, vector<int>>& eventValues, const LogEvent& newEvent,
-                            const vector<int>& newValueIndices) const;
+    // Includes mLastPulledRows, which is not erased by the dumps.
+    size_t currentBucketByteSizeLocked() const override;
+
+    // How a pulled row is accumulated, see accumulateEvents().
+    struct PulledRow {
+        bool matched = false;
+        HashableDimensionKey dimensionsInWhat;
+        std::vector<int> valueIndices;
+        // Whether the row is an event of the last pull, handed out again by the puller.
+        bool unchanged = false;
+    };
+
+    // The rows of a pull with the same dimensions in what.
+    struct PulledDimension {
+        std::shared_ptr<LogEvent> firstRow;
+        std::vector<int> valueIndices;
+        // The first row with the values of the others added, once there are several.
+        std::optional<LogEvent> sum;
+        size_t numRows = 0;
+        bool unchanged = true;
+    };
+
+    // Sets [row] to how [event] is accumulated.
+    void matchPulledRowLocked(const LogEvent& event, PulledRow* row) const;
+
+    // Whether [dimension] can be skipped as its diff is 0 for all value fields, which is the
+    // case if its rows are those of the last pull and adding 0 doesn't change its intervals.
+    // If so, marks [dimensionsInWhat] as present in the pulled data.
+    bool skipUnchangedDimensionLocked(const HashableDimensionKey& dimensionsInWhat,
+                                      const PulledDimension& dimension);
+
+    // Evicts the diff bases of the dimensions missing from the last kMaxPullsWithoutDimension
+    // pulls, so that churning dimensions don't grow mDimInfos until the end of the bucket.
+    // Called after each pull, with mMatchedMetricDimensionKeys set to its dimensions.
+    void evictStaleBasesLocked(int64_t eventElapsedTimeNs);
+
+    // With bulk diffs, queues the diffs of the value fields of [event] for applyBulkDiffsLocked(),
+    // and marks [dimensionsInWhat] as present in the pulled data. Returns false, queueing
+    // nothing, unless the dimension has long bases and values and its bucket has intervals.
+    bool addBulkDiffDimensionLocked(const HashableDimensionKey& dimensionsInWhat,
+                                    const LogEvent& event);
+
+    // Computes the queued diffs and adds them to the intervals, as aggregateFields() would.
+    void applyBulkDiffsLocked();
+
+    void combineValueFields(LogEvent& sum, const vector<int>& sumValueIndices,
+                            const LogEvent& newEvent, const vector<int>& newValueIndices) const;
 
     const bool mUseAbsoluteValueOnReset;
 
     const ValueMetric::AggregationType mAggregationType;
 
+    // Folds [value] into [aggregate], which has a value.
+    using AggregateFunction = void (*)(Value& aggregate, const Value& value);
+
+    // The AggregateFunction of [type], for which AVG sums.
+    template <ValueMetric::AggregationType type>
+    static void aggregateValue(Value& aggregate, const Value& value);
+
+    static AggregateFunction getAggregateFunction(const ValueMetric::AggregationType type);
+
+    // The function of mAggregationType, chosen once so that aggregateFields() doesn't switch on
+    // the type for each value.
+    const AggregateFunction mAggregate;
+
     const bool mUseDiff;
 
     const ValueMetric::ValueDirection mValueDirection;
@@ -161,9 +227,36 @@ private:
 
     const int64_t mMaxPullDelayNs;
 
+    // The number of pulls accumulated with diffs, see evictStaleBasesLocked().
+    uint64_t mPullNum = 0;
+
+    static constexpr uint64_t kMaxPullsWithoutDimension = 10;
+
     // For anomaly detection.
     std::unordered_map<MetricDimensionKey, int64_t> mCurrentFullBucket;
 
+    // With StatsPuller delta encoding, the rows of the last pull by event, so that the rows
+    // handed out again are not matched again. Only valid for the matcher they were matched with.
+    std::unordered_map<std::shared_ptr<LogEvent>, PulledRow> mLastPulledRows;
+    sp<EventMatcherWizard> mLastPulledRowsWizard;
+    int mLastPulledRowsMatcherIndex = -1;
+
+    static std::atomic<bool> sBulkDiffs;
+
+    // The dimensions queued by addBulkDiffDimensionLocked().
+    struct BulkDiffDimension {
+        DimensionsInWhatInfo* dimInfo;
+        std::vector<Interval>* intervals;
+    };
+    std::vector<BulkDiffDimension> mBulkDiffDimensions;
+
+    // The values and bases of the fields of mBulkDiffDimensions, in order, and their diffs. Kept
+    // across pulls for their storage.
+    std::vector<int64_t> mBulkDiffValues;
+    std::vector<int64_t> mBulkDiffBases;
+    std::vector<int64_t> mBulkDiffs;
+    std::vector<uint8_t> mBulkDiffValid;
+
     FRIEND_TEST(NumericValueMetricProducerTest, TestAnomalyDetection);
     FRIEND_TEST(NumericValueMetricProducerTest, TestBaseSetOnConditionChange);
     FRIEND_TEST(NumericValueMetricProducerTest, TestBucketBoundariesOnConditionChange);
@@ -198,6 +291,8 @@ private:
     FRIEND_TEST(NumericValueMetricProducerTest, TestPushedEventsWithCondition);
     FRIEND_TEST(NumericValueMetricProducerTest, TestPushedEventsWithoutCondition);
     FRIEND_TEST(NumericValueMetricProducerTest, TestResetBaseOnPullDelayExceeded);
+    FRIEND_TEST(NumericValueMetricProducerDeltaEncodingTest, TestUnchangedPulledDimensionsSkipped);
+    FRIEND_TEST(NumericValueMetricProducerTest, TestBulkDiffsMatchPerEventDiffs);
     FRIEND_TEST(NumericValueMetricProducerTest, TestResetBaseOnPullFailAfterConditionChange);
     FRIEND_TEST(NumericValueMetricProducerTest,
                 TestResetBaseOnPullFailAfterConditionChange_EndOfBucket);
@@ -209,7 +304,9 @@ private:
     FRIEND_TEST(NumericValueMetricProducerTest, TestSlicedStateWithMap);
     FRIEND_TEST(NumericValueMetricProducerTest, TestSlicedStateWithPrimaryField_WithDimensions);
     FRIEND_TEST(NumericValueMetricProducerTest, TestSlicedStateWithCondition);
+    FRIEND_TEST(NumericValueMetricProducerTest, TestSlicedStateConditionTimersSyncedLazily);
     FRIEND_TEST(NumericValueMetricProducerTest, TestTrimUnusedDimensionKey);
+    FRIEND_TEST(NumericValueMetricProducerTest, TestEvictStaleBases);
     FRIEND_TEST(NumericValueMetricProducerTest, TestUseZeroDefaultBase);
     FRIEND_TEST(NumericValueMetricProducerTest, TestUseZeroDefaultBaseWithPullFailures);
     FRIEND_TEST(NumericValueMetricProducerTest, TestSlicedStateWithMultipleDimensions);
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "StagedKllQuantile.h"
+
+#include <algorithm>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using dist_proc::aggregation::KllQuantile;
+using dist_proc::aggregation::KllQuantileOptions;
+using dist_proc::aggregation::RandomGenerator;
+using zetasketch::android::AggregatorStateProto;
+
+std::unique_ptr<KllQuantile> KllSketchPool::take() {
+    if (mSketches.empty()) {
+        return nullptr;
+    }
+    std::unique_ptr<KllQuantile> sketch = std::move(mSketches.back());
+    mSketches.pop_back();
+    mNumPutSinceEndBucket = std::min(mNumPutSinceEndBucket, mSketches.size());
+    return sketch;
+}
+
+void KllSketchPool::put(std::unique_ptr<KllQuantile> sketch) {
+    sketch->Reset();
+    mSketches.push_back(std::move(sketch));
+    mNumPutSinceEndBucket++;
+}
+
+void KllSketchPool::endBucket() {
+    if (mSketches.size() > mNumPutSinceEndBucket) {
+        mSketches.erase(mSketches.begin(), mSketches.end() - mNumPutSinceEndBucket);
+    }
+    mNumPutSinceEndBucket = 0;
+}
+
+size_t KllSketchPool::getByteSize() const {
+    size_t byteSize = 0;
+    for (const std::unique_ptr<KllQuantile>& sketch : mSketches) {
+        byteSize += sketch->allocated_bytes();
+    }
+    return byteSize;
+}
+
+StagedKllQuantile::StagedKllQuantile(KllSketchPool* pool) : mRandom(nullptr), mPool(pool) {
+    createSketch();
+}
+
+StagedKllQuantile::StagedKllQuantile(RandomGenerator* random, KllSketchPool* pool)
+    : mRandom(random), mPool(pool) {
+}
+
+void StagedKllQuantile::createSketch() {
+    if (mPool != nullptr) {
+        mSketch = mPool->take();
+        if (mSketch != nullptr) {
+            return;
+        }
+    }
+    KllQuantileOptions options;
+    options.set_random(mRandom);
+    mSketch = KllQuantile::Create(options);
+}
+
+void StagedKllQuantile::flush() {
+    if (mSketch == nullptr) {
+        createSketch();
+    }
+    if (mStagedValues.empty()) {
+        return;
+    }
+    std::sort(mStagedValues.begin(), mStagedValues.end());
+    // The repeated values are added with their multiplicity, and the others are moved to the
+    // front and added in one batch.
+    size_t numSingleValues = 0;
+    for (size_t i = 0; i < mStagedValues.size();) {
+        size_t end = i + 1;
+        while (end < mStagedValues.size() && mStagedValues[end] == mStagedValues[i]) {
+            end++;
+        }
+        if (end - i == 1) {
+            mStagedValues[numSingleValues++] = mStagedValues[i];
+        } else {
+            mSketch->AddWeighted(mStagedValues[i], end - i);
+        }
+        i = end;
+    }
+    mSketch->AddBatch(mStagedValues.data(), numSingleValues);
+    mStagedValues.clear();
+}
+
+void StagedKllQuantile::seal() {
+    if (mSketch != nullptr) {
+        flush();
+    }
+    mStagedValues.shrink_to_fit();
+}
+
+void StagedKllQuantile::close(const std::vector<double>& reportQuantiles,
+                              bool diffEncodeCompactors) {
+    flush();
+    mClosedNumValues = mSketch->num_values();
+    mClosedNumStoredValues = mSketch->num_stored_values();
+    if (!reportQuantiles.empty()) {
+        mClosedQuantiles = mSketch->Quantiles(reportQuantiles);
+    } else {
+        mSketch->SerializeToProto(diffEncodeCompactors).SerializeToString(&mClosedSketchBytes);
+    }
+    if (mPool != nullptr) {
+        mPool->put(std::move(mSketch));
+    }
+    mSketch = nullptr;
+    std::vector<int64_t>().swap(mStagedValues);
+    mClosed = true;
+}
+
+size_t StagedKllQuantile::getByteSize() const {
+    if (mClosed) {
+        return mClosedQuantiles.size() * sizeof(std::optional<int64_t>) +
+               mClosedSketchBytes.size();
+    }
+    return (mSketch != nullptr ? mSketch->allocated_bytes() : 0) +
+           mStagedValues.capacity() * sizeof(int64_t);
+}
+
+AggregatorStateProto StagedKllQuantile::serializeToProto(bool diffEncodeCompactors) {
+    flush();
+    return mSketch->SerializeToProto(diffEncodeCompactors);
+}
+
+std::vector<std::optional<int64_t>> StagedKllQuantile::getQuantiles(
+        const std::vector<double>& phis) {
+    flush();
+    return mSketch->Quantiles(phis);
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <kll.h>
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * The KllQuantiles of the closed sketches of a metric, Reset() and reused by the sketches of the
+ * next buckets instead of allocating their compactors again. The sketches sharing a pool must be
+ * created with the same RandomGenerator, or all without one.
+ */
+class KllSketchPool {
+public:
+    // Returns a Reset() KllQuantile, or null if the pool is empty.
+    std::unique_ptr<dist_proc::aggregation::KllQuantile> take();
+
+    void put(std::unique_ptr<dist_proc::aggregation::KllQuantile> sketch);
+
+    // Drops the sketches put before the previous call that were not taken since, so that the
+    // pool holds at most the sketches of one bucket. To be called once the bucket is closed.
+    void endBucket();
+
+    inline size_t size() const {
+        return mSketches.size();
+    }
+
+    // Bytes allocated by the pooled sketches.
+    size_t getByteSize() const;
+
+private:
+    // Oldest first. The most recently put sketches are taken first.
+    std::vector<std::unique_ptr<dist_proc::aggregation::KllQuantile>> mSketches;
+
+    size_t mNumPutSinceEndBucket = 0;
+};
+
+/**
+ * A KllQuantile whose values are staged and added in sorted batches, so that the repeated values
+ * of a batch, common with latency histograms, are added once with their multiplicity.
+ *
+ * A sketch created with a RandomGenerator keeps its first kMaxExactValues values exactly, and
+ * only creates the KllQuantile past them. The KllQuantiles of such sketches share the generator
+ * instead of each owning one.
+ *
+ * With a KllSketchPool, the KllQuantile is taken from the pool, and given back when the sketch is
+ * closed, see close().
+ */
+class StagedKllQuantile {
+public:
+    // Number of values staged before they are added to the sketch.
+    static constexpr size_t kMaxStagedValues = 16;
+
+    // Number of values kept exactly before the KllQuantile is created, see above.
+    static constexpr size_t kMaxExactValues = 64;
+
+    // [pool], if any, must outlive the sketch.
+    explicit StagedKllQuantile(KllSketchPool* pool = nullptr);
+
+    // [random] must outlive the sketch, and is not thread-safe: the sketches sharing it must be
+    // used under the same lock.
+    explicit StagedKllQuantile(dist_proc::aggregation::RandomGenerator* random,
+                               KllSketchPool* pool = nullptr);
+
+    inline void add(const int64_t value) {
+        const size_t maxStagedValues = mSketch != nullptr ? kMaxStagedValues : kMaxExactValues;
+        if (mStagedValues.capacity() == 0) {
+            mStagedValues.reserve(maxStagedValues);
+        }
+        mStagedValues.push_back(value);
+        if (mStagedValues.size() >= maxStagedValues) {
+            flush();
+        }
+    }
+
+    // Adds the staged values to the sketch, creating the KllQuantile if there is none yet.
+    void flush();
+
+    // Flushes and frees the staging buffer, for a sketch that gets no more values. The values of
+    // a sketch without a KllQuantile stay exact.
+    void seal();
+
+    // Keeps what a report needs of the sketch: its quantiles at [reportQuantiles], or if there are
+    // none, its serialized AggregatorStateProto. Then frees the sketch, giving its KllQuantile back
+    // to the pool. A closed sketch takes no more values, and serializeToProto() and getQuantiles()
+    // must not be called, see getClosedQuantiles() and getClosedSketchBytes().
+    void close(const std::vector<double>& reportQuantiles, bool diffEncodeCompactors);
+
+    inline bool isClosed() const {
+        return mClosed;
+    }
+
+    // The quantiles and serialized sketch kept by close().
+    inline const std::vector<std::optional<int64_t>>& getClosedQuantiles() const {
+        return mClosedQuantiles;
+    }
+
+    inline const std::string& getClosedSketchBytes() const {
+        return mClosedSketchBytes;
+    }
+
+    // Number of values added, staged or not.
+    inline int64_t getNumValues() const {
+        if (mClosed) {
+            return mClosedNumValues;
+        }
+        return (mSketch != nullptr ? mSketch->num_values() : 0) + mStagedValues.size();
+    }
+
+    // Number of values stored by the sketch. Does not count the staged values, except the exact
+    // values of a sketch without a KllQuantile.
+    inline int64_t getNumStoredValues() const {
+        if (mClosed) {
+            return mClosedNumStoredValues;
+        }
+        return mSketch != nullptr ? mSketch->num_stored_values() : mStagedValues.size();
+    }
+
+    // Bytes held by the sketch: the storage of its KllQuantile and staged values, or once closed,
+    // the quantiles and serialized sketch kept for the report.
+    size_t getByteSize() const;
+
+    // See KllQuantile::SerializeToProto().
+    zetasketch::android::AggregatorStateProto serializeToProto(bool diffEncodeCompactors = false);
+
+    // Approximate quantiles of the values, see KllQuantile::Quantiles().
+    std::vector<std::optional<int64_t>> getQuantiles(const std::vector<double>& phis);
+
+private:
+    // Takes the KllQuantile from mPool, or creates it.
+    void createSketch();
+
+    // Not owned. Null if the KllQuantile owns its generator.
+    dist_proc::aggregation::RandomGenerator* const mRandom;
+
+    // Not owned, may be null.
+    KllSketchPool* const mPool;
+
+    // Null until the first flush() of a sketch created with a RandomGenerator.
+    std::unique_ptr<dist_proc::aggregation::KllQuantile> mSketch;
+
+    std::vector<int64_t> mStagedValues;
+
+    // Set by close().
+    bool mClosed = false;
+    int64_t mClosedNumValues = 0;
+    int64_t mClosedNumStoredValues = 0;
+    std::vector<std::optional<int64_t>> mClosedQuantiles;
+    std::string mClosedSketchBytes;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -19,13 +19,13 @@
 
 #include "ValueMetricProducer.h"
 
-#include <kll.h>
 #include <limits.h>
 #include <stdlib.h>
 
 #include "FieldValue.h"
 #include "HashableDimensionKey.h"
 #include "guardrail/StatsdStats.h"
+#include "metrics/StagedKllQuantile.h"
 #include "metrics/parsing_utils/metrics_manager_util.h"
 #include "stats_log_util.h"
 #include "stats_util.h"
@@ -36,7 +36,6 @@ using android::util::FIELD_TYPE_INT32;
 using android::util::FIELD_TYPE_INT64;
 using android::util::FIELD_TYPE_MESSAGE;
 using android::util::ProtoOutputStream;
-using dist_proc::aggregation::KllQuantile;
 using std::optional;
 using std::shared_ptr;
 using std::unique_ptr;
@@ -129,11 +128,6 @@ ValueMetricProducer<AggregatedValue, DimExtras>::ValueMetricProducer(
 
     flushIfNeededLocked(bucketOptions.startTimeNs);
 
-    if (isPulled()) {
-        mPullerManager->RegisterReceiver(mPullAtomId, mConfigKey, this, getCurrentBucketEndTimeNs(),
-                                         mBucketSizeNs);
-    }
-
     // Only do this for partial buckets like first bucket. All other buckets should use
     // flushIfNeeded to adjust start and end to bucket boundaries.
     // Adjust start for partial bucket
@@ -145,6 +139,16 @@ ValueMetricProducer<AggregatedValue, DimExtras>::ValueMetricProducer(
                                        mCurrentBucketStartTimeNs);
 }
 
+template <typename AggregatedValue, typename DimExtras>
+void ValueMetricProducer<AggregatedValue, DimExtras>::prepareFirstBucketLocked() {
+    // Registered once the metric is in use, not from the constructor: the pulls are delivered
+    // from the alarm thread as soon as the receiver is registered.
+    if (isPulled()) {
+        mPullerManager->RegisterReceiver(mPullAtomId, mConfigKey, this, getCurrentBucketEndTimeNs(),
+                                         mBucketSizeNs);
+    }
+}
+
 template <typename AggregatedValue, typename DimExtras>
 ValueMetricProducer<AggregatedValue, DimExtras>::~ValueMetricProducer() {
     VLOG("~ValueMetricProducer() called");
@@ -283,6 +287,12 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::dropDataLocked(const int64
     clearPastBucketsLocked(dropTimeNs);
 }
 
+template <typename AggregatedValue, typename DimExtras>
+void ValueMetricProducer<AggregatedValue, DimExtras>::releaseIdleMemoryLocked() {
+    mCurrentSlicedBucketPool.clear();
+    mDimInfosPool.clear();
+}
+
 template <typename AggregatedValue, typename DimExtras>
 void ValueMetricProducer<AggregatedValue, DimExtras>::clearPastBucketsLocked(
         const int64_t dumpTimeNs) {
@@ -293,7 +303,7 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::clearPastBucketsLocked(
 template <typename AggregatedValue, typename DimExtras>
 void ValueMetricProducer<AggregatedValue, DimExtras>::onDumpReportLocked(
         const int64_t dumpTimeNs, const bool includeCurrentPartialBucket, const bool eraseData,
-        const DumpLatency dumpLatency, set<string>* strSet, ProtoOutputStream* protoOutput) {
+        const DumpLatency dumpLatency, ReportStrings* strSet, ProtoOutputStream* protoOutput) {
     VLOG("metric %lld dump report now...", (long long)mMetricId);
 
     // TODO(b/188837487): Add mIsActive check
@@ -365,13 +375,12 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::onDumpReportLocked(
 
         // First fill dimension.
         if (mShouldUseNestedDimensions) {
-            uint64_t dimensionToken =
-                    protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_ID_DIMENSION_IN_WHAT);
-            writeDimensionToProto(metricDimensionKey.getDimensionKeyInWhat(), strSet, protoOutput);
-            protoOutput->end(dimensionToken);
+            mDimensionProtoCache.writeDimension(metricDimensionKey.getDimensionKeyInWhat(),
+                                                FIELD_ID_DIMENSION_IN_WHAT, strSet, protoOutput);
         } else {
-            writeDimensionLeafNodesToProto(metricDimensionKey.getDimensionKeyInWhat(),
-                                           FIELD_ID_DIMENSION_LEAF_IN_WHAT, strSet, protoOutput);
+            mDimensionProtoCache.writeDimensionLeafNodes(metricDimensionKey.getDimensionKeyInWhat(),
+                                                         FIELD_ID_DIMENSION_LEAF_IN_WHAT, strSet,
+                                                         protoOutput);
         }
 
         // Then fill slice_by_state.
@@ -566,18 +575,77 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::updateCurrentSlicedBucketC
         return;
     }
 
-    // Utilize the current state key of each DimensionsInWhat key to determine
-    // which condition timers to update.
-    //
-    // Assumes that the MetricDimensionKey exists in `mCurrentSlicedBucket`.
-    for (const auto& [dimensionInWhatKey, dimensionInWhatInfo] : mDimInfos) {
-        // If the new condition is true, turn ON the condition timer only if
-        // the DimensionInWhat key was present in the data.
-        mCurrentSlicedBucket[MetricDimensionKey(dimensionInWhatKey,
-                                                dimensionInWhatInfo.currentState)]
-                .conditionTimer.onConditionChanged(
-                        newCondition && dimensionInWhatInfo.hasCurrentState, eventTimeNs);
+    // The timers of the dimensions only catch up with the change when they are next touched or
+    // flushed, so that a chatty condition doesn't update every dimension on each change. Repeated
+    // conditions are dropped, like ConditionTimer::onConditionChanged() does.
+    if (!mConditionChanges.empty() && mConditionChanges.back().condition == newCondition) {
+        return;
+    }
+    int64_t trueNs = 0;
+    if (!mConditionChanges.empty()) {
+        const ConditionChange& lastChange = mConditionChanges.back();
+        trueNs = lastChange.trueNs +
+                 (lastChange.condition ? eventTimeNs - lastChange.timestampNs : 0);
+    }
+    mConditionChanges.push_back({newCondition, eventTimeNs, trueNs});
+    mConditionEpoch++;
+
+    // Bounds the log, the dimensions then catch up in constant time per change on average.
+    if (mConditionChanges.size() >= std::max(kMinConditionChangesToSync, mDimInfos.size())) {
+        syncAllConditionTimersLocked();
+    }
+}
+
+template <typename AggregatedValue, typename DimExtras>
+void ValueMetricProducer<AggregatedValue, DimExtras>::syncConditionTimerLocked(
+        const HashableDimensionKey& dimensionInWhatKey,
+        DimensionsInWhatInfo& dimensionInWhatInfo) {
+    if (dimensionInWhatInfo.conditionEpoch == mConditionEpoch) {
+        return;
+    }
+    const size_t firstChangeIndex = mConditionChanges.size() -
+                                    (size_t)(mConditionEpoch - dimensionInWhatInfo.conditionEpoch);
+    dimensionInWhatInfo.conditionEpoch = mConditionEpoch;
+
+    // If the condition is true, turn ON the condition timer only if the DimensionInWhat key was
+    // present in the data.
+    ConditionTimer& timer = getCurrentConditionTimerLocked(dimensionInWhatKey, dimensionInWhatInfo);
+    const ConditionChange& firstChange = mConditionChanges[firstChangeIndex];
+    const ConditionChange& lastChange = mConditionChanges.back();
+    if (!dimensionInWhatInfo.hasCurrentState || &firstChange == &lastChange) {
+        timer.onConditionChanged(firstChange.condition && dimensionInWhatInfo.hasCurrentState,
+                                 firstChange.timestampNs);
+    } else {
+        timer.onConditionFlips(firstChange.condition, firstChange.timestampNs,
+                               lastChange.trueNs - firstChange.trueNs, lastChange.condition,
+                               lastChange.timestampNs);
+    }
+}
+
+template <typename AggregatedValue, typename DimExtras>
+void ValueMetricProducer<AggregatedValue, DimExtras>::syncAllConditionTimersLocked() {
+    if (mConditionChanges.empty()) {
+        return;
+    }
+    for (auto& [dimensionInWhatKey, dimensionInWhatInfo] : mDimInfos) {
+        syncConditionTimerLocked(dimensionInWhatKey, dimensionInWhatInfo);
     }
+    mConditionChanges.clear();
+}
+
+template <typename AggregatedValue, typename DimExtras>
+ConditionTimer& ValueMetricProducer<AggregatedValue, DimExtras>::getCurrentConditionTimerLocked(
+        const HashableDimensionKey& dimensionInWhatKey,
+        DimensionsInWhatInfo& dimensionInWhatInfo) {
+    if (dimensionInWhatInfo.currentConditionTimer == nullptr) {
+        dimensionInWhatInfo.currentConditionTimer =
+                &mCurrentSlicedBucketPool
+                         .get(mCurrentSlicedBucket,
+                              MetricDimensionKey(dimensionInWhatKey,
+                                                 dimensionInWhatInfo.currentState))
+                         .conditionTimer;
+    }
+    return *dimensionInWhatInfo.currentConditionTimer;
 }
 
 template <typename AggregatedValue, typename DimExtras>
@@ -601,6 +669,22 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::dumpStatesLocked(FILE* out
     }
 }
 
+template <typename AggregatedValue, typename DimExtras>
+size_t ValueMetricProducer<AggregatedValue, DimExtras>::currentBucketByteSizeLocked() const {
+    size_t totalSize = 0;
+    for (const auto& [key, currentBucket] : mCurrentSlicedBucket) {
+        totalSize += hashMapEntryByteSize(key, sizeof(CurrentBucket)) +
+                     currentBucket.intervals.capacity() * sizeof(Interval);
+    }
+    for (const auto& [key, dimInfo] : mDimInfos) {
+        totalSize += hashMapEntryByteSize(key, sizeof(DimensionsInWhatInfo)) +
+                     dimInfo.currentState.getValuesByteSize() +
+                     dimExtrasByteSize(dimInfo.dimExtras);
+    }
+    totalSize += mConditionChanges.capacity() * sizeof(ConditionChange);
+    return totalSize;
+}
+
 template <typename AggregatedValue, typename DimExtras>
 bool ValueMetricProducer<AggregatedValue, DimExtras>::hasReachedGuardRailLimit() const {
     return mCurrentSlicedBucket.size() >= mDimensionHardLimit;
@@ -633,15 +717,18 @@ template <typename AggregatedValue, typename DimExtras>
 void ValueMetricProducer<AggregatedValue, DimExtras>::onMatchedLogEventInternalLocked(
         const size_t matcherIndex, const MetricDimensionKey& eventKey,
         const ConditionKey& conditionKey, bool condition, const LogEvent& event,
-        const map<int, HashableDimensionKey>& statePrimaryKeys) {
+        const vector<HashableDimensionKey>& statePrimaryKeys) {
     // Skip this event if a state change occurred for a different primary key.
-    auto it = statePrimaryKeys.find(mStateChangePrimaryKey.first);
-    // Check that both the atom id and the primary key are equal.
-    if (it != statePrimaryKeys.end() && it->second != mStateChangePrimaryKey.second) {
-        VLOG("ValueMetric skip event with primary key %s because state change primary key "
-             "is %s",
-             it->second.toString().c_str(), mStateChangePrimaryKey.second.toString().c_str());
-        return;
+    for (size_t i = 0; i < mMetric2StateLinks.size() && i < statePrimaryKeys.size(); i++) {
+        // Check that both the atom id and the primary key are equal.
+        if (mMetric2StateLinks[i].stateAtomId == mStateChangePrimaryKey.first &&
+            statePrimaryKeys[i] != mStateChangePrimaryKey.second) {
+            VLOG("ValueMetric skip event with primary key %s because state change primary key "
+                 "is %s",
+                 statePrimaryKeys[i].toString().c_str(),
+                 mStateChangePrimaryKey.second.toString().c_str());
+            return;
+        }
     }
 
     const int64_t eventTimeNs = event.GetElapsedTimestampNs();
@@ -651,10 +738,10 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::onMatchedLogEventInternalL
         return;
     }
 
-    const auto whatKey = eventKey.getDimensionKeyInWhat();
-    mMatchedMetricDimensionKeys.insert(whatKey);
-
-    if (!isPulled()) {
+    const HashableDimensionKey& whatKey = eventKey.getDimensionKeyInWhat();
+    if (isPulled()) {
+        mMatchedMetricDimensionKeys.insert(whatKey);
+    } else {
         // Only flushing for pushed because for pulled metrics, we need to do a pull first.
         flushIfNeededLocked(eventTimeNs);
     }
@@ -667,14 +754,22 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::onMatchedLogEventInternalL
         return;
     }
 
-    const auto& returnVal = mDimInfos.emplace(whatKey, DimensionsInWhatInfo(getUnknownStateKey()));
-    DimensionsInWhatInfo& dimensionsInWhatInfo = returnVal.first->second;
+    // Only builds the unknown state key for new dimensions, which have no condition changes to
+    // catch up with.
+    auto dimInfoIt = findDimInfoLocked(whatKey);
+    if (dimInfoIt != mDimInfos.end()) {
+        syncConditionTimerLocked(whatKey, dimInfoIt->second);
+    }
+    DimensionsInWhatInfo& dimensionsInWhatInfo =
+            dimInfoIt != mDimInfos.end() ? dimInfoIt->second : addDimInfoLocked(whatKey);
+    dimensionsInWhatInfo.conditionEpoch = mConditionEpoch;
     const HashableDimensionKey& oldStateKey = dimensionsInWhatInfo.currentState;
-    CurrentBucket& currentBucket = mCurrentSlicedBucket[MetricDimensionKey(whatKey, oldStateKey)];
+    CurrentBucket& currentBucket = mCurrentSlicedBucketPool.get(
+            mCurrentSlicedBucket, MetricDimensionKey(whatKey, oldStateKey));
 
     // Ensure we turn on the condition timer in the case where dimensions
     // were missing on a previous pull due to a state change.
-    const auto stateKey = eventKey.getStateValuesKey();
+    const HashableDimensionKey& stateKey = eventKey.getStateValuesKey();
     const bool stateChange = oldStateKey != stateKey || !dimensionsInWhatInfo.hasCurrentState;
 
     // We need to get the intervals stored with the previous state key so we can
@@ -686,7 +781,10 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::onMatchedLogEventInternalL
     }
 
     dimensionsInWhatInfo.hasCurrentState = true;
-    dimensionsInWhatInfo.currentState = stateKey;
+    if (stateChange) {
+        dimensionsInWhatInfo.currentState = stateKey;
+        dimensionsInWhatInfo.currentConditionTimer = nullptr;
+    }
 
     dimensionsInWhatInfo.seenNewData |= aggregateFields(eventTimeNs, eventKey, event, intervals,
                                                         dimensionsInWhatInfo.dimExtras);
@@ -697,8 +795,8 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::onMatchedLogEventInternalL
         currentBucket.conditionTimer.onConditionChanged(false, eventTimeNs);
 
         // Turn ON the condition timer for the new state key.
-        mCurrentSlicedBucket[MetricDimensionKey(whatKey, stateKey)]
-                .conditionTimer.onConditionChanged(true, eventTimeNs);
+        getCurrentConditionTimerLocked(whatKey, dimensionsInWhatInfo)
+                .onConditionChanged(true, eventTimeNs);
     }
 }
 
@@ -740,6 +838,7 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::flushCurrentBucketLocked(
     VLOG("finalizing bucket for %ld, dumping %d slices", (long)mCurrentBucketStartTimeNs,
          (int)mCurrentSlicedBucket.size());
 
+    syncAllConditionTimersLocked();
     closeCurrentBucket(eventTimeNs, nextBucketStartTimeNs);
     initNextSlicedBucket(nextBucketStartTimeNs);
 
@@ -831,12 +930,36 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::closeCurrentBucket(
     }
 }
 
+template <typename AggregatedValue, typename DimExtras>
+typename ValueMetricProducer<AggregatedValue, DimExtras>::DimInfoMap::iterator
+ValueMetricProducer<AggregatedValue, DimExtras>::eraseDimInfoLocked(
+        typename DimInfoMap::iterator it) {
+    syncConditionTimerLocked(it->first, it->second);
+    return mDimInfosPool.erase(mDimInfos, it, [this](DimensionsInWhatInfo& dimInfo) {
+        dimInfo.reset(getUnknownStateKey());
+    });
+}
+
+template <typename AggregatedValue, typename DimExtras>
+typename ValueMetricProducer<AggregatedValue, DimExtras>::DimensionsInWhatInfo&
+ValueMetricProducer<AggregatedValue, DimExtras>::addDimInfoLocked(
+        const HashableDimensionKey& whatKey) {
+    DimensionsInWhatInfo& dimInfo = mDimInfosPool.emplace(mDimInfos, whatKey, getUnknownStateKey());
+    mDimInfoFilter.add(whatKey.getHash());
+    if (mDimInfoFilter.isFull()) {
+        // Also drops the keys erased since.
+        mDimInfoFilter.rebuild(mDimInfos, [](const auto& entry) { return entry.first.getHash(); });
+    }
+    return dimInfo;
+}
+
 template <typename AggregatedValue, typename DimExtras>
 void ValueMetricProducer<AggregatedValue, DimExtras>::initNextSlicedBucket(
         int64_t nextBucketStartTimeNs) {
     StatsdStats::getInstance().noteBucketCount(mMetricId);
     if (mSlicedStateAtoms.empty()) {
-        mCurrentSlicedBucket.clear();
+        mCurrentSlicedBucketPool.recycle(mCurrentSlicedBucket,
+                                         [](CurrentBucket& bucket) { bucket.reset(); });
     } else {
         for (auto it = mCurrentSlicedBucket.begin(); it != mCurrentSlicedBucket.end();) {
             bool obsolete = true;
@@ -847,14 +970,15 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::initNextSlicedBucket(
             // When slicing by state, only delete the MetricDimensionKey when the
             // state key in the MetricDimensionKey is not the current state key.
             const HashableDimensionKey& dimensionInWhatKey = it->first.getDimensionKeyInWhat();
-            const auto& currentDimInfoItr = mDimInfos.find(dimensionInWhatKey);
+            const auto& currentDimInfoItr = findDimInfoLocked(dimensionInWhatKey);
 
             if ((currentDimInfoItr != mDimInfos.end()) &&
                 (it->first.getStateValuesKey() == currentDimInfoItr->second.currentState)) {
                 obsolete = false;
             }
             if (obsolete) {
-                it = mCurrentSlicedBucket.erase(it);
+                it = mCurrentSlicedBucketPool.erase(mCurrentSlicedBucket, it,
+                                                    [](CurrentBucket& bucket) { bucket.reset(); });
             } else {
                 it++;
             }
@@ -862,7 +986,7 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::initNextSlicedBucket(
     }
     for (auto it = mDimInfos.begin(); it != mDimInfos.end();) {
         if (!it->second.seenNewData) {
-            it = mDimInfos.erase(it);
+            it = eraseDimInfoLocked(it);
         } else {
             it->second.seenNewData = false;
             it++;
@@ -879,7 +1003,7 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::initNextSlicedBucket(
 
 // Explicit template instantiations
 template class ValueMetricProducer<Value, vector<optional<Value>>>;
-template class ValueMetricProducer<unique_ptr<KllQuantile>, Empty>;
+template class ValueMetricProducer<unique_ptr<StagedKllQuantile>, Empty>;
 
 }  // namespace statsd
 }  // namespace os
@@ -19,6 +19,7 @@
 #include <gtest/gtest_prod.h>
 
 #include <optional>
+#include <unordered_set>
 
 #include "FieldValue.h"
 #include "HashableDimensionKey.h"
@@ -32,6 +33,8 @@
 #include "src/statsd_config.pb.h"
 #include "stats_log_util.h"
 #include "stats_util.h"
+#include "utils/BlockedBloomFilter.h"
+#include "utils/MapNodePool.h"
 
 namespace android {
 namespace os {
@@ -139,18 +142,21 @@ protected:
     void onMatchedLogEventInternalLocked(
             const size_t matcherIndex, const MetricDimensionKey& eventKey,
             const ConditionKey& conditionKey, bool condition, const LogEvent& event,
-            const std::map<int, HashableDimensionKey>& statePrimaryKeys) override;
+            const std::vector<HashableDimensionKey>& statePrimaryKeys) override;
 
     // Determine whether or not a LogEvent can be skipped.
     virtual inline bool canSkipLogEventLocked(
             const MetricDimensionKey& eventKey, bool condition, int64_t eventTimeNs,
-            const std::map<int, HashableDimensionKey>& statePrimaryKeys) const = 0;
+            const std::vector<HashableDimensionKey>& statePrimaryKeys) const = 0;
 
     void notifyAppUpgradeInternalLocked(const int64_t eventTimeNs) override;
 
+    // Registers the pulled metrics to the puller manager. Overrides must call this first.
+    void prepareFirstBucketLocked() override;
+
     void onDumpReportLocked(const int64_t dumpTimeNs, const bool includeCurrentPartialBucket,
                             const bool eraseData, const DumpLatency dumpLatency,
-                            std::set<string>* strSet,
+                            ReportStrings* strSet,
                             android::util::ProtoOutputStream* protoOutput) override;
 
     struct DumpProtoFields {
@@ -186,6 +192,8 @@ protected:
 
     void dumpStatesLocked(FILE* out, bool verbose) const override;
 
+    size_t currentBucketByteSizeLocked() const override;
+
     virtual std::string aggregatedValueToString(const AggregatedValue& aggregate) const = 0;
 
     // For pulled metrics, this method should only be called if a pull has been done. Else we will
@@ -199,6 +207,8 @@ protected:
 
     void dropDataLocked(const int64_t dropTimeNs) override;
 
+    void releaseIdleMemoryLocked() override;
+
     // Calculate how many buckets are present between the current bucket and eventTimeNs.
     int64_t calcBucketsForwardCount(const int64_t eventTimeNs) const;
 
@@ -244,8 +254,9 @@ protected:
     // Value fields for matching.
     const std::vector<Matcher> mFieldMatchers;
 
-    // Value fields for matching.
-    std::set<HashableDimensionKey> mMatchedMetricDimensionKeys;
+    // The dimensions in what of the pulled events being accumulated, see
+    // NumericValueMetricProducer::accumulateEvents().
+    std::unordered_set<HashableDimensionKey> mMatchedMetricDimensionKeys;
 
     // Holds the atom id, primary key pair from a state change.
     // Only used for pulled metrics.
@@ -255,6 +266,25 @@ protected:
     // Atom Id for pulled data. -1 if this is not pulled.
     const int mPullAtomId;
 
+    // Clears the extras of a dimension, keeping the storage of vectors.
+    template <typename T>
+    static void clearDimExtras(std::vector<T>& dimExtras) {
+        dimExtras.clear();
+    }
+
+    static void clearDimExtras(Empty& dimExtras) {
+    }
+
+    // Estimated heap bytes of the extras of a dimension.
+    template <typename T>
+    static size_t dimExtrasByteSize(const std::vector<T>& dimExtras) {
+        return dimExtras.capacity() * sizeof(T);
+    }
+
+    static size_t dimExtrasByteSize(const Empty& dimExtras) {
+        return 0;
+    }
+
     // Tracks the value information of one value field.
     struct Interval {
         // Index in multi value aggregation.
@@ -278,7 +308,15 @@ protected:
         // state change) with the correct condition and time.
         CurrentBucket() : intervals(), conditionTimer(ConditionTimer(false, 0)) {
         }
-        // Value information for each value field of the metric.
+
+        // Resets the bucket to its initial state, keeping the storage of intervals.
+        void reset() {
+            intervals.clear();
+            conditionTimer = ConditionTimer(false, 0);
+        }
+
+        // Value information for each value field of the metric. Sized to the number of value
+        // fields once, since the pooled buckets keep their storage.
         std::vector<Interval> intervals;
         // Tracks how long the condition is true.
         ConditionTimer conditionTimer;
@@ -288,12 +326,28 @@ protected:
     // key and StateValuesKey pair.
     std::unordered_map<MetricDimensionKey, CurrentBucket> mCurrentSlicedBucket;
 
+    // The nodes of the last bucket of mCurrentSlicedBucket, reused by the next one along with
+    // their intervals, and of the buckets erased since.
+    MapNodePool<std::unordered_map<MetricDimensionKey, CurrentBucket>> mCurrentSlicedBucketPool;
+
     // State key and any extra information for a specific DimensionsInWhat key.
     struct DimensionsInWhatInfo {
         DimensionsInWhatInfo(const HashableDimensionKey& stateKey)
             : dimExtras(), currentState(stateKey), hasCurrentState(false) {
         }
 
+        // Resets the info to its initial state with [stateKey], keeping the storage of
+        // dimExtras.
+        void reset(const HashableDimensionKey& stateKey) {
+            clearDimExtras(dimExtras);
+            seenNewData = false;
+            currentState = stateKey;
+            hasCurrentState = false;
+            currentConditionTimer = nullptr;
+            numPulledRows = 0;
+            lastPullNum = 0;
+        }
+
         DimExtras dimExtras;
 
         // Whether new data is seen in the bucket.
@@ -304,10 +358,49 @@ protected:
         HashableDimensionKey currentState;
         // Whether this dimensions in what key has a current state key.
         bool hasCurrentState;
+
+        // Number of rows of the last pull aggregated into this key, see
+        // NumericValueMetricProducer::accumulateEvents().
+        size_t numPulledRows = 0;
+
+        // The last NumericValueMetricProducer pull with this key, see
+        // NumericValueMetricProducer::evictStaleBasesLocked().
+        uint64_t lastPullNum = 0;
+
+        // The condition timer of currentState in mCurrentSlicedBucket, or nullptr until it is
+        // looked up. The entries of mCurrentSlicedBucket don't move, so this stays valid until
+        // the entry is erased. See getCurrentConditionTimerLocked().
+        ConditionTimer* currentConditionTimer = nullptr;
+
+        // The mConditionEpoch up to which the condition changes were applied to the condition
+        // timer of currentState. See syncConditionTimerLocked().
+        uint64_t conditionEpoch = 0;
     };
 
+    using DimInfoMap = std::unordered_map<HashableDimensionKey, DimensionsInWhatInfo>;
+
     // Tracks current state key and other information for each DimensionsInWhat key.
-    std::unordered_map<HashableDimensionKey, DimensionsInWhatInfo> mDimInfos;
+    DimInfoMap mDimInfos;
+
+    // The nodes of the erased entries of mDimInfos, reset to the unknown state key, so that the
+    // dimensions coming back reuse their bases.
+    MapNodePool<DimInfoMap> mDimInfosPool;
+
+    // Moves the entry at [it] of mDimInfos to mDimInfosPool. Returns the following iterator.
+    typename DimInfoMap::iterator eraseDimInfoLocked(typename DimInfoMap::iterator it);
+
+    // The hashes of the keys added to mDimInfos, so that the events of new dimensions skip the
+    // lookups. Rebuilt from mDimInfos once full, so it may still hold erased keys.
+    BlockedBloomFilter mDimInfoFilter;
+
+    // Returns the entry of [whatKey] in mDimInfos, or mDimInfos.end().
+    inline typename DimInfoMap::iterator findDimInfoLocked(const HashableDimensionKey& whatKey) {
+        return mDimInfoFilter.mayContain(whatKey.getHash()) ? mDimInfos.find(whatKey)
+                                                            : mDimInfos.end();
+    }
+
+    // Adds [whatKey], which is not in mDimInfos, to it.
+    DimensionsInWhatInfo& addDimInfoLocked(const HashableDimensionKey& whatKey);
 
     // Save the past buckets and we can clear when the StatsLogReport is dumped.
     std::unordered_map<MetricDimensionKey, std::vector<PastBucket<AggregatedValue>>> mPastBuckets;
@@ -332,9 +425,23 @@ protected:
     virtual void initNextSlicedBucket(int64_t nextBucketStartTimeNs);
 
     // Updates the condition timers in the current sliced bucket when there is a
-    // condition change or an active state change.
+    // condition change or an active state change. The change is only logged in
+    // mConditionChanges, each dimension catches up when it is next touched or flushed.
     void updateCurrentSlicedBucketConditionTimers(bool newCondition, int64_t eventTimeNs);
 
+    // Applies the condition changes logged since [dimensionInWhatInfo] was last synced to the
+    // condition timer of its current state.
+    void syncConditionTimerLocked(const HashableDimensionKey& dimensionInWhatKey,
+                                  DimensionsInWhatInfo& dimensionInWhatInfo);
+
+    // Syncs the condition timers of all the dimensions and clears mConditionChanges.
+    void syncAllConditionTimersLocked();
+
+    // Returns the condition timer of the current state of [dimensionInWhatKey], creating its
+    // bucket if needed. Only used when slicing by state.
+    ConditionTimer& getCurrentConditionTimerLocked(const HashableDimensionKey& dimensionInWhatKey,
+                                                   DimensionsInWhatInfo& dimensionInWhatInfo);
+
     virtual void writePastBucketAggregateToProto(const int aggIndex,
                                                  const AggregatedValue& aggregate,
                                                  ProtoOutputStream* const protoOutput) const = 0;
@@ -351,6 +458,27 @@ protected:
 
     ConditionTimer mConditionTimer;
 
+    // A condition change logged for the condition timers of the sliced bucket.
+    struct ConditionChange {
+        bool condition;
+        int64_t timestampNs;
+        // How long the condition was true between the first logged change and this one.
+        int64_t trueNs;
+    };
+
+    // The condition changes not applied to the condition timers of all the dimensions yet,
+    // oldest first. Each change flips the condition of the previous one. Only used when slicing
+    // by state.
+    std::vector<ConditionChange> mConditionChanges;
+
+    // The number of condition changes logged in mConditionChanges so far, the last
+    // mConditionChanges.size() of which are still in it.
+    uint64_t mConditionEpoch = 0;
+
+    // mConditionChanges are applied to every dimension once there are this many of them, or
+    // as many as dimensions.
+    static constexpr size_t kMinConditionChangesToSync = 64;
+
     /** Stores condition correction threshold from the ValueMetric configuration */
     optional<int64_t> mConditionCorrectionThresholdNs;
 
@@ -365,7 +493,7 @@ protected:
                                  DimExtras& dimExtras) = 0;
 
     // If this is a pulled metric
-    inline bool isPulled() const {
+    inline bool isPulled() const override {
         return mPullAtomId != -1;
     }
 
@@ -127,6 +127,9 @@ public:
     // Dump internal states for debugging
     virtual void dumpStates(FILE* out, bool verbose) const = 0;
 
+    // Estimated heap bytes of this tracker.
+    virtual size_t byteSize() const = 0;
+
     virtual int64_t getCurrentStateKeyDuration() const = 0;
 
     virtual int64_t getCurrentStateKeyFullBucketDuration() const = 0;
@@ -154,6 +157,15 @@ public:
 protected:
     virtual bool hasAccumulatingDuration() = 0;
 
+    // Estimated heap bytes of mStateKeyDurationMap.
+    size_t stateKeyDurationByteSize() const {
+        size_t totalSize = 0;
+        for (const auto& [key, _] : mStateKeyDurationMap) {
+            totalSize += hashMapEntryByteSize(key, sizeof(DurationValues));
+        }
+        return totalSize;
+    }
+
     int64_t getCurrentBucketEndTimeNs() const {
         return mStartTimeNs + (mCurrentBucketNum + 1) * mBucketSizeNs;
     }
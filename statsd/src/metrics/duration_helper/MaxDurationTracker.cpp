@@ -63,7 +63,7 @@ void MaxDurationTracker::noteStart(const HashableDimensionKey& key, bool conditi
         return;
     }
 
-    DurationInfo& duration = mInfos[key];
+    MaxDurationInfo& duration = mInfos[key];
     if (mConditionSliced) {
         duration.conditionKeys = conditionKey;
     }
@@ -81,8 +81,7 @@ void MaxDurationTracker::noteStart(const HashableDimensionKey& key, bool conditi
                 // event started, but we need to wait for the condition to become true.
                 duration.state = DurationState::kPaused;
             } else {
-                duration.state = DurationState::kStarted;
-                duration.lastStartTime = eventTime;
+                setStarted(&duration, eventTime);
                 startAnomalyAlarm(eventTime);
             }
             duration.startCount = 1;
@@ -93,11 +92,12 @@ void MaxDurationTracker::noteStart(const HashableDimensionKey& key, bool conditi
 void MaxDurationTracker::noteStop(const HashableDimensionKey& key, const int64_t eventTime,
                                   bool forceStop) {
     VLOG("MaxDuration: key %s stop", key.toString().c_str());
-    if (mInfos.find(key) == mInfos.end()) {
+    auto it = mInfos.find(key);
+    if (it == mInfos.end()) {
         // we didn't see a start event before. do nothing.
         return;
     }
-    DurationInfo& duration = mInfos[key];
+    MaxDurationInfo& duration = it->second;
 
     switch (duration.state) {
         case DurationState::kStopped:
@@ -107,7 +107,7 @@ void MaxDurationTracker::noteStop(const HashableDimensionKey& key, const int64_t
             duration.startCount--;
             if (forceStop || !mNested || duration.startCount <= 0) {
                 stopAnomalyAlarm(eventTime);
-                duration.state = DurationState::kStopped;
+                setNotStarted(&duration, DurationState::kStopped);
                 int64_t durationTime = eventTime - duration.lastStartTime;
                 VLOG("Max, key %s, Stop %lld %lld %lld", key.toString().c_str(),
                      (long long)duration.lastStartTime, (long long)eventTime,
@@ -138,17 +138,25 @@ void MaxDurationTracker::noteStop(const HashableDimensionKey& key, const int64_t
     // Once an atom duration ends, we erase it. Next time, if we see another atom event with the
     // same name, they are still considered as different atom durations.
     if (duration.state == DurationState::kStopped) {
-        mInfos.erase(key);
+        mInfos.erase(it);
     }
 }
 
 bool MaxDurationTracker::hasAccumulatingDuration() {
-    for (auto& pair : mInfos) {
-        if (pair.second.state == kStarted) {
-            return true;
-        }
-    }
-    return false;
+    return !mStartedDurations.empty();
+}
+
+void MaxDurationTracker::setStarted(MaxDurationInfo* info, const int64_t timestamp) {
+    info->state = DurationState::kStarted;
+    info->lastStartTime = timestamp;
+    info->startedDuration = new StartedDuration(timestamp - info->lastDuration);
+    mStartedDurations.push(info->startedDuration);
+}
+
+void MaxDurationTracker::setNotStarted(MaxDurationInfo* info, DurationState state) {
+    info->state = state;
+    mStartedDurations.remove(info->startedDuration);
+    info->startedDuration = nullptr;
 }
 
 void MaxDurationTracker::noteStopAll(const int64_t eventTime) {
@@ -178,18 +186,9 @@ bool MaxDurationTracker::flushCurrentBucket(
         currentBucketEndTimeNs = eventTimeNs;
     }
 
-    bool hasPendingEvent =
-            false;  // has either a kStarted or kPaused event across bucket boundaries
-    // meaning we need to carry them over to the new bucket.
-    for (auto it = mInfos.begin(); it != mInfos.end();) {
-        if (it->second.state == DurationState::kStopped) {
-            // No need to keep buckets for events that were stopped before.
-            it = mInfos.erase(it);
-        } else {
-            ++it;
-            hasPendingEvent = true;
-        }
-    }
+    // Has either a kStarted or kPaused event across bucket boundaries, meaning we need to carry
+    // them over to the new bucket. Stopped events are removed by noteStop().
+    const bool hasPendingEvent = !mInfos.empty();
 
     // mDuration is updated in noteStop to the maximum duration that ended in the current bucket.
     if (durationPassesThreshold(uploadThreshold, mDuration)) {
@@ -265,7 +264,7 @@ void MaxDurationTracker::noteConditionChanged(const HashableDimensionKey& key, b
             // stop anomaly alarm.
             if (!conditionMet) {
                 stopAnomalyAlarm(timestamp);
-                it->second.state = DurationState::kPaused;
+                setNotStarted(&it->second, DurationState::kPaused);
                 it->second.lastDuration += (timestamp - it->second.lastStartTime);
                 if (hasAccumulatingDuration()) {
                     // In case any other dimensions are still started, we need to set the alarm.
@@ -281,8 +280,7 @@ void MaxDurationTracker::noteConditionChanged(const HashableDimensionKey& key, b
             // If condition becomes true, kPaused -> kStarted. and the start time is the condition
             // change time.
             if (conditionMet) {
-                it->second.state = DurationState::kStarted;
-                it->second.lastStartTime = timestamp;
+                setStarted(&it->second, timestamp);
                 startAnomalyAlarm(timestamp);
                 VLOG("MaxDurationTracker Key: %s Paused->Started", key.toString().c_str());
             }
@@ -296,14 +294,8 @@ int64_t MaxDurationTracker::predictAnomalyTimestampNs(const AnomalyTracker& anom
     // The allowed time we can continue in the current state is the
     // (anomaly threshold) - max(elapsed time of the started mInfos).
     int64_t maxElapsed = 0;
-    for (auto it = mInfos.begin(); it != mInfos.end(); ++it) {
-        if (it->second.state == DurationState::kStarted) {
-            int64_t duration =
-                    it->second.lastDuration + (currentTimestamp - it->second.lastStartTime);
-            if (duration > maxElapsed) {
-                maxElapsed = duration;
-            }
-        }
+    if (!mStartedDurations.empty()) {
+        maxElapsed = std::max(maxElapsed, currentTimestamp - mStartedDurations.top()->originNs);
     }
     int64_t anomalyTimeNs = currentTimestamp + anomalyTracker.getAnomalyThreshold() - maxElapsed;
     int64_t refractoryEndNs = anomalyTracker.getRefractoryPeriodEndsSec(mEventKey) * NS_PER_SEC;
@@ -315,6 +307,17 @@ void MaxDurationTracker::dumpStates(FILE* out, bool verbose) const {
     fprintf(out, "\t\t current duration %lld\n", (long long)mDuration);
 }
 
+size_t MaxDurationTracker::byteSize() const {
+    size_t totalSize = sizeof(MaxDurationTracker) + stateKeyDurationByteSize();
+    for (const auto& [key, info] : mInfos) {
+        totalSize += hashMapEntryByteSize(key, sizeof(MaxDurationInfo));
+        for (const auto& [_, conditionKey] : info.conditionKeys) {
+            totalSize += conditionKey.getValuesByteSize();
+        }
+    }
+    return totalSize;
+}
+
 int64_t MaxDurationTracker::getCurrentStateKeyDuration() const {
     ALOGE("MaxDurationTracker does not handle sliced state changes.");
     return -1;
@@ -18,11 +18,27 @@
 #define MAX_DURATION_TRACKER_H
 
 #include "DurationTracker.h"
+#include "anomaly/indexed_priority_queue.h"
 
 namespace android {
 namespace os {
 namespace statsd {
 
+// A started duration of MaxDurationTracker, identified by the time it would have started at had
+// it never been paused: the longest elapsed duration is the one with the earliest origin.
+struct StartedDuration : public RefBase {
+    explicit StartedDuration(int64_t originNs) : originNs(originNs) {
+    }
+
+    const int64_t originNs;
+
+    struct EarlierOrigin {
+        bool operator()(sp<const StartedDuration> a, sp<const StartedDuration> b) const {
+            return a->originNs < b->originNs;
+        }
+    };
+};
+
 // Tracks a pool of atom durations, and output the max duration for each bucket.
 // To get max duration, we need to keep track of each individual durations, and compare them when
 // they stop or bucket expires.
@@ -59,6 +75,8 @@ public:
                                       const int64_t currentTimestamp) const override;
     void dumpStates(FILE* out, bool verbose) const override;
 
+    size_t byteSize() const override;
+
     int64_t getCurrentStateKeyDuration() const override;
 
     int64_t getCurrentStateKeyFullBucketDuration() const override;
@@ -70,7 +88,21 @@ protected:
     bool hasAccumulatingDuration() override;
 
 private:
-    std::unordered_map<HashableDimensionKey, DurationInfo> mInfos;
+    struct MaxDurationInfo : public DurationInfo {
+        // The entry of a kStarted duration in mStartedDurations.
+        sp<const StartedDuration> startedDuration;
+    };
+
+    std::unordered_map<HashableDimensionKey, MaxDurationInfo> mInfos;
+
+    // The kStarted durations of mInfos, so that the longest one is found without scanning them.
+    indexed_priority_queue<StartedDuration, StartedDuration::EarlierOrigin> mStartedDurations;
+
+    // Moves [info] to kStarted at [timestamp].
+    void setStarted(MaxDurationInfo* info, const int64_t timestamp);
+
+    // Moves [info] from kStarted to [state].
+    void setNotStarted(MaxDurationInfo* info, DurationState state);
 
     void noteConditionChanged(const HashableDimensionKey& key, bool conditionMet,
                               const int64_t timestamp);
@@ -84,6 +116,7 @@ private:
     FRIEND_TEST(MaxDurationTrackerTest, TestStopAll);
     FRIEND_TEST(MaxDurationTrackerTest, TestAnomalyDetection);
     FRIEND_TEST(MaxDurationTrackerTest, TestAnomalyPredictedTimestamp);
+    FRIEND_TEST(MaxDurationTrackerTest, TestStartedDurationsFollowStates);
     FRIEND_TEST(MaxDurationTrackerTest, TestUploadThreshold);
 };
 
@@ -22,8 +22,6 @@ namespace android {
 namespace os {
 namespace statsd {
 
-using std::pair;
-
 OringDurationTracker::OringDurationTracker(
         const ConfigKey& key, const int64_t& id, const MetricDimensionKey& eventKey,
         sp<ConditionWizard> wizard, int conditionIndex, bool nesting, int64_t currentBucketStartNs,
@@ -31,20 +29,19 @@ OringDurationTracker::OringDurationTracker(
         bool fullLink, const vector<sp<AnomalyTracker>>& anomalyTrackers)
     : DurationTracker(key, id, eventKey, wizard, conditionIndex, nesting, currentBucketStartNs,
                       currentBucketNum, startTimeNs, bucketSizeNs, conditionSliced, fullLink,
-                      anomalyTrackers),
-      mStarted(),
-      mPaused() {
+                      anomalyTrackers) {
     mLastStartTime = 0;
 }
 
 bool OringDurationTracker::hitGuardRail(const HashableDimensionKey& newKey) {
     // ===========GuardRail==============
     // 1. Report the tuple count if the tuple count > soft limit
-    if (mConditionKeyMap.find(newKey) != mConditionKeyMap.end()) {
+    const KeyInfo* info = mKeys.find(newKey);
+    if (info != nullptr && info->hasConditionKey) {
         return false;
     }
-    if (mConditionKeyMap.size() > StatsdStats::kDimensionKeySizeSoftLimit - 1) {
-        size_t newTupleCount = mConditionKeyMap.size() + 1;
+    if (mConditionKeyCount > StatsdStats::kDimensionKeySizeSoftLimit - 1) {
+        size_t newTupleCount = mConditionKeyCount + 1;
         StatsdStats::getInstance().noteMetricDimensionSize(mConfigKey, mTrackerId, newTupleCount);
         // 2. Don't add more tuples, we are above the allowed threshold. Drop the data.
         if (newTupleCount > StatsdStats::kDimensionKeySizeHardLimit) {
@@ -61,19 +58,22 @@ void OringDurationTracker::noteStart(const HashableDimensionKey& key, bool condi
     if (hitGuardRail(key)) {
         return;
     }
+    KeyInfo& info = mKeys[key];
     if (condition) {
-        if (mStarted.size() == 0) {
+        if (mStartedCount == 0) {
             mLastStartTime = eventTime;
             VLOG("record first start....");
             startAnomalyAlarm(eventTime);
         }
-        mStarted[key]++;
+        updateKeyInfo(key, &info, info.startedCount + 1, info.pausedCount);
     } else {
-        mPaused[key]++;
+        updateKeyInfo(key, &info, info.startedCount, info.pausedCount + 1);
     }
 
-    if (mConditionSliced && mConditionKeyMap.find(key) == mConditionKeyMap.end()) {
-        mConditionKeyMap[key] = conditionKey;
+    if (mConditionSliced && !info.hasConditionKey) {
+        info.hasConditionKey = true;
+        info.conditionKey = conditionKey;
+        mConditionKeyCount++;
     }
     VLOG("Oring: %s start, condition %d", key.toString().c_str(), condition);
 }
@@ -81,14 +81,34 @@ void OringDurationTracker::noteStart(const HashableDimensionKey& key, bool condi
 void OringDurationTracker::noteStop(const HashableDimensionKey& key, const int64_t timestamp,
                                     const bool stopAll) {
     VLOG("Oring: %s stop", key.toString().c_str());
-    auto it = mStarted.find(key);
-    if (it != mStarted.end()) {
-        (it->second)--;
-        if (stopAll || !mNested || it->second <= 0) {
-            mStarted.erase(it);
-            mConditionKeyMap.erase(key);
+    KeyInfo* info = mKeys.find(key);
+    if (info == nullptr) {
+        if (mStartedCount == 0) {
+            stopAnomalyAlarm(timestamp);
+        }
+        return;
+    }
+    const bool wasStarted = info->startedCount > 0;
+    int startedCount = info->startedCount;
+    if (startedCount > 0) {
+        startedCount--;
+        if (stopAll || !mNested || startedCount <= 0) {
+            startedCount = 0;
+            clearConditionKey(info);
+        }
+    }
+    int pausedCount = info->pausedCount;
+    if (pausedCount > 0) {
+        pausedCount--;
+        if (stopAll || !mNested || pausedCount <= 0) {
+            pausedCount = 0;
+            clearConditionKey(info);
         }
-        if (mStarted.empty()) {
+    }
+    updateKeyInfo(key, info, startedCount, pausedCount);
+
+    if (wasStarted) {
+        if (mStartedCount == 0) {
             mStateKeyDurationMap[mEventKey.getStateValuesKey()].mDuration +=
                     (timestamp - mLastStartTime);
             detectAndDeclareAnomaly(
@@ -99,22 +119,13 @@ void OringDurationTracker::noteStop(const HashableDimensionKey& key, const int64
                  mEventKey.getStateValuesKey().toString().c_str());
         }
     }
-
-    auto pausedIt = mPaused.find(key);
-    if (pausedIt != mPaused.end()) {
-        (pausedIt->second)--;
-        if (stopAll || !mNested || pausedIt->second <= 0) {
-            mPaused.erase(pausedIt);
-            mConditionKeyMap.erase(key);
-        }
-    }
-    if (mStarted.empty()) {
+    if (mStartedCount == 0) {
         stopAnomalyAlarm(timestamp);
     }
 }
 
 void OringDurationTracker::noteStopAll(const int64_t timestamp) {
-    if (!mStarted.empty()) {
+    if (mStartedCount > 0) {
         mStateKeyDurationMap[mEventKey.getStateValuesKey()].mDuration +=
                 (timestamp - mLastStartTime);
         VLOG("Oring Stop all: record duration %lld, total duration %lld for state key %s",
@@ -126,9 +137,30 @@ void OringDurationTracker::noteStopAll(const int64_t timestamp) {
     }
 
     stopAnomalyAlarm(timestamp);
-    mStarted.clear();
-    mPaused.clear();
-    mConditionKeyMap.clear();
+    mKeys.clear();
+    mStartedCount = 0;
+    mPausedCount = 0;
+    mConditionKeyCount = 0;
+}
+
+void OringDurationTracker::updateKeyInfo(const HashableDimensionKey& key, KeyInfo* info,
+                                         int startedCount, int pausedCount) {
+    mStartedCount += (startedCount > 0) - (info->startedCount > 0);
+    mPausedCount += (pausedCount > 0) - (info->pausedCount > 0);
+    info->startedCount = startedCount;
+    info->pausedCount = pausedCount;
+    if (startedCount == 0 && pausedCount == 0) {
+        clearConditionKey(info);
+        mKeys.erase(key);
+    }
+}
+
+void OringDurationTracker::clearConditionKey(KeyInfo* info) {
+    if (info->hasConditionKey) {
+        info->hasConditionKey = false;
+        info->conditionKey.clear();
+        mConditionKeyCount--;
+    }
 }
 
 bool OringDurationTracker::flushCurrentBucket(
@@ -153,7 +185,7 @@ bool OringDurationTracker::flushCurrentBucket(
     }
 
     // Process the current bucket.
-    if (mStarted.size() > 0) {
+    if (mStartedCount > 0) {
         // Calculate the duration for the current state key.
         mStateKeyDurationMap[mEventKey.getStateValuesKey()].mDuration +=
                 (currentBucketEndTimeNs - mLastStartTime);
@@ -188,7 +220,7 @@ bool OringDurationTracker::flushCurrentBucket(
         durationIt.second.mDuration = 0;
     }
 
-    if (mStarted.size() > 0) {
+    if (mStartedCount > 0) {
         for (int i = 1; i < numBucketsForward; i++) {
             DurationBucket info;
             info.mBucketStartNs = fullBucketEnd + mBucketSizeNs * (i - 1);
@@ -220,7 +252,7 @@ bool OringDurationTracker::flushCurrentBucket(
     // for anomaly detection.
     // Note: Anomaly trackers can be added on config updates, in which case mAnomalyTrackers > 0 and
     // the full bucket duration could be used, but this is very rare so it is okay to clear.
-    return mStarted.empty() && mPaused.empty() && (isFullBucket || mAnomalyTrackers.size() == 0);
+    return mKeys.empty() && (isFullBucket || mAnomalyTrackers.size() == 0);
 }
 
 bool OringDurationTracker::flushIfNeeded(
@@ -234,103 +266,109 @@ bool OringDurationTracker::flushIfNeeded(
 
 void OringDurationTracker::onSlicedConditionMayChange(bool overallCondition,
                                                       const int64_t timestamp) {
-    vector<pair<HashableDimensionKey, int>> startedToPaused;
-    vector<pair<HashableDimensionKey, int>> pausedToStarted;
-    if (!mStarted.empty()) {
-        for (auto it = mStarted.begin(); it != mStarted.end();) {
-            const auto& key = it->first;
-            const auto& condIt = mConditionKeyMap.find(key);
-            if (condIt == mConditionKeyMap.end()) {
-                VLOG("Key %s dont have condition key", key.toString().c_str());
-                ++it;
-                continue;
+    // The started keys whose condition is no longer true are paused, and the paused keys whose
+    // condition became true are started. A key keeps its count of the state it moves to, if any.
+    const bool hadStarted = mStartedCount > 0;
+    size_t stillStartedCount = 0;
+    size_t pausedToStartedCount = 0;
+    mStartedCount = 0;
+    mPausedCount = 0;
+    mKeys.forEach([&](const HashableDimensionKey& key, KeyInfo& info) {
+        bool toPaused = false;
+        bool toStarted = false;
+        if (!info.hasConditionKey) {
+            VLOG("Key %s dont have condition key", key.toString().c_str());
+        } else {
+            if (info.startedCount > 0) {
+                toPaused = mWizard->query(mConditionTrackerIndex, info.conditionKey,
+                                          !mHasLinksToAllConditionDimensionsInTracker) !=
+                           ConditionState::kTrue;
             }
-            ConditionState conditionState =
-                mWizard->query(mConditionTrackerIndex, condIt->second,
-                               !mHasLinksToAllConditionDimensionsInTracker);
-            if (conditionState != ConditionState::kTrue) {
-                startedToPaused.push_back(*it);
-                it = mStarted.erase(it);
-                VLOG("Key %s started -> paused", key.toString().c_str());
-            } else {
-                ++it;
+            if (info.pausedCount > 0) {
+                toStarted = mWizard->query(mConditionTrackerIndex, info.conditionKey,
+                                           !mHasLinksToAllConditionDimensionsInTracker) ==
+                            ConditionState::kTrue;
             }
         }
-
-        if (mStarted.empty()) {
-            mStateKeyDurationMap[mEventKey.getStateValuesKey()].mDuration +=
-                    (timestamp - mLastStartTime);
-            VLOG("record duration %lld, total duration %lld for state key %s",
-                 (long long)(timestamp - mLastStartTime), (long long)getCurrentStateKeyDuration(),
-                 mEventKey.getStateValuesKey().toString().c_str());
-            detectAndDeclareAnomaly(
-                    timestamp, mCurrentBucketNum,
-                    getCurrentStateKeyDuration() + getCurrentStateKeyFullBucketDuration());
+        const int startedCount = info.startedCount;
+        if (toPaused) {
+            info.startedCount = 0;
+            VLOG("Key %s started -> paused", key.toString().c_str());
+        } else if (info.startedCount > 0) {
+            stillStartedCount++;
         }
-    }
-
-    if (!mPaused.empty()) {
-        for (auto it = mPaused.begin(); it != mPaused.end();) {
-            const auto& key = it->first;
-            if (mConditionKeyMap.find(key) == mConditionKeyMap.end()) {
-                VLOG("Key %s dont have condition key", key.toString().c_str());
-                ++it;
-                continue;
-            }
-            ConditionState conditionState =
-                mWizard->query(mConditionTrackerIndex, mConditionKeyMap[key],
-                               !mHasLinksToAllConditionDimensionsInTracker);
-            if (conditionState == ConditionState::kTrue) {
-                pausedToStarted.push_back(*it);
-                it = mPaused.erase(it);
-                VLOG("Key %s paused -> started", key.toString().c_str());
-            } else {
-                ++it;
+        if (toStarted) {
+            if (info.startedCount == 0) {
+                info.startedCount = info.pausedCount;
             }
+            info.pausedCount = 0;
+            pausedToStartedCount++;
+            VLOG("Key %s paused -> started", key.toString().c_str());
         }
-
-        if (mStarted.empty() && pausedToStarted.size() > 0) {
-            mLastStartTime = timestamp;
+        if (toPaused && info.pausedCount == 0) {
+            info.pausedCount = startedCount;
         }
+        mStartedCount += info.startedCount > 0;
+        mPausedCount += info.pausedCount > 0;
+    });
+
+    if (hadStarted && stillStartedCount == 0) {
+        mStateKeyDurationMap[mEventKey.getStateValuesKey()].mDuration +=
+                (timestamp - mLastStartTime);
+        VLOG("record duration %lld, total duration %lld for state key %s",
+             (long long)(timestamp - mLastStartTime), (long long)getCurrentStateKeyDuration(),
+             mEventKey.getStateValuesKey().toString().c_str());
+        detectAndDeclareAnomaly(
+                timestamp, mCurrentBucketNum,
+                getCurrentStateKeyDuration() + getCurrentStateKeyFullBucketDuration());
     }
 
-    if (mStarted.empty() && !pausedToStarted.empty()) {
+    if (stillStartedCount == 0 && pausedToStartedCount > 0) {
+        mLastStartTime = timestamp;
         startAnomalyAlarm(timestamp);
     }
-    mStarted.insert(pausedToStarted.begin(), pausedToStarted.end());
-    mPaused.insert(startedToPaused.begin(), startedToPaused.end());
 
-    if (mStarted.empty()) {
+    if (mStartedCount == 0) {
         stopAnomalyAlarm(timestamp);
     }
 }
 
 void OringDurationTracker::onConditionChanged(bool condition, const int64_t timestamp) {
     if (condition) {
-        if (!mPaused.empty()) {
+        if (mPausedCount > 0) {
             VLOG("Condition true, all started");
-            if (mStarted.empty()) {
+            if (mStartedCount == 0) {
                 mLastStartTime = timestamp;
-            }
-            if (mStarted.empty() && !mPaused.empty()) {
                 startAnomalyAlarm(timestamp);
             }
-            mStarted.insert(mPaused.begin(), mPaused.end());
-            mPaused.clear();
+            mKeys.forEach([](const HashableDimensionKey&, KeyInfo& info) {
+                if (info.startedCount == 0) {
+                    info.startedCount = info.pausedCount;
+                }
+                info.pausedCount = 0;
+            });
+            mStartedCount = mKeys.size();
+            mPausedCount = 0;
         }
     } else {
-        if (!mStarted.empty()) {
+        if (mStartedCount > 0) {
             VLOG("Condition false, all paused");
             mStateKeyDurationMap[mEventKey.getStateValuesKey()].mDuration +=
                     (timestamp - mLastStartTime);
-            mPaused.insert(mStarted.begin(), mStarted.end());
-            mStarted.clear();
+            mKeys.forEach([](const HashableDimensionKey&, KeyInfo& info) {
+                if (info.pausedCount == 0) {
+                    info.pausedCount = info.startedCount;
+                }
+                info.startedCount = 0;
+            });
+            mStartedCount = 0;
+            mPausedCount = mKeys.size();
             detectAndDeclareAnomaly(
                     timestamp, mCurrentBucketNum,
                     getCurrentStateKeyDuration() + getCurrentStateKeyFullBucketDuration());
         }
     }
-    if (mStarted.empty()) {
+    if (mStartedCount == 0) {
         stopAnomalyAlarm(timestamp);
     }
 }
@@ -339,9 +377,8 @@ void OringDurationTracker::onStateChanged(const int64_t timestamp, const int32_t
                                           const FieldValue& newState) {
     // Nothing needs to be done on a state change if we have not seen a start
     // event, the metric is currently not active, or condition is false.
-    // For these cases, no keys are being tracked in mStarted, so update
-    // the current state key and return.
-    if (mStarted.empty()) {
+    // For these cases, no keys are started, so update the current state key and return.
+    if (mStartedCount == 0) {
         updateCurrentStateKey(atomId, newState);
         return;
     }
@@ -353,7 +390,7 @@ void OringDurationTracker::onStateChanged(const int64_t timestamp, const int32_t
 }
 
 bool OringDurationTracker::hasAccumulatingDuration() {
-    return !mStarted.empty();
+    return mStartedCount > 0;
 }
 int64_t OringDurationTracker::predictAnomalyTimestampNs(const AnomalyTracker& anomalyTracker,
                                                         const int64_t eventTimestampNs) const {
@@ -436,11 +473,22 @@ int64_t OringDurationTracker::predictAnomalyTimestampNs(const AnomalyTracker& an
 }
 
 void OringDurationTracker::dumpStates(FILE* out, bool verbose) const {
-    fprintf(out, "\t\t started count %lu\n", (unsigned long)mStarted.size());
-    fprintf(out, "\t\t paused count %lu\n", (unsigned long)mPaused.size());
+    fprintf(out, "\t\t started count %lu\n", (unsigned long)mStartedCount);
+    fprintf(out, "\t\t paused count %lu\n", (unsigned long)mPausedCount);
     fprintf(out, "\t\t current duration %lld\n", (long long)getCurrentStateKeyDuration());
 }
 
+size_t OringDurationTracker::byteSize() const {
+    size_t totalSize = sizeof(OringDurationTracker) + stateKeyDurationByteSize();
+    mKeys.forEach([&totalSize](const HashableDimensionKey& key, const KeyInfo& keyInfo) {
+        totalSize += hashMapEntryByteSize(key, sizeof(KeyInfo));
+        for (const auto& [_, conditionKey] : keyInfo.conditionKey) {
+            totalSize += conditionKey.getValuesByteSize();
+        }
+    });
+    return totalSize;
+}
+
 int64_t OringDurationTracker::getCurrentStateKeyDuration() const {
     auto it = mStateKeyDurationMap.find(mEventKey.getStateValuesKey());
     if (it == mStateKeyDurationMap.end()) {
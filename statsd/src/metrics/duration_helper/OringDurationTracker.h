@@ -18,6 +18,7 @@
 #define ORING_DURATION_TRACKER_H
 
 #include "DurationTracker.h"
+#include "utils/FlatHashMap.h"
 
 namespace android {
 namespace os {
@@ -58,6 +59,8 @@ public:
                                       const int64_t currentTimestamp) const override;
     void dumpStates(FILE* out, bool verbose) const override;
 
+    size_t byteSize() const override;
+
     int64_t getCurrentStateKeyDuration() const override;
 
     int64_t getCurrentStateKeyFullBucketDuration() const override;
@@ -74,10 +77,35 @@ private:
     // 2) which keys are paused (started but condition was false)
     // 3) whenever a key stops, we remove it from the started set. And if the set becomes empty,
     //    it means everything has stopped, we then record the end time.
-    std::unordered_map<HashableDimensionKey, int> mStarted;
-    std::unordered_map<HashableDimensionKey, int> mPaused;
+    // A key can be both started and paused, e.g. when nested starts saw different conditions.
+    struct KeyInfo {
+        // Number of starts of the key while the condition was true, respectively false.
+        int startedCount = 0;
+        int pausedCount = 0;
+
+        // With a sliced condition, the condition key of the first start.
+        bool hasConditionKey = false;
+        ConditionKey conditionKey;
+    };
+
+    // The started or paused keys, in one table so that each event probes it once.
+    FlatHashMap<HashableDimensionKey, KeyInfo> mKeys;
+
+    // Number of keys of mKeys that are started, respectively paused, and that have a condition
+    // key.
+    size_t mStartedCount = 0;
+    size_t mPausedCount = 0;
+    size_t mConditionKeyCount = 0;
+
     int64_t mLastStartTime;
-    std::unordered_map<HashableDimensionKey, ConditionKey> mConditionKeyMap;
+
+    // Sets the started and paused counts of [info], updating the counts of keys. Removes [key]
+    // from mKeys if it is neither started nor paused, invalidating [info].
+    void updateKeyInfo(const HashableDimensionKey& key, KeyInfo* info, int startedCount,
+                       int pausedCount);
+
+    // Forgets the condition key of [info].
+    void clearConditionKey(KeyInfo* info);
 
     // return true if we should not allow newKey to be tracked because we are above the threshold
     bool hitGuardRail(const HashableDimensionKey& newKey);
@@ -85,6 +113,7 @@ private:
     FRIEND_TEST(OringDurationTrackerTest, TestDurationOverlap);
     FRIEND_TEST(OringDurationTrackerTest, TestCrossBucketBoundary);
     FRIEND_TEST(OringDurationTrackerTest, TestDurationConditionChange);
+    FRIEND_TEST(OringDurationTrackerTest, TestStartedAndPausedKey);
     FRIEND_TEST(OringDurationTrackerTest, TestPredictAnomalyTimestamp);
     FRIEND_TEST(OringDurationTrackerTest, TestAnomalyDetectionExpiredAlarm);
     FRIEND_TEST(OringDurationTrackerTest, TestAnomalyDetectionFiredAlarm);
@@ -38,6 +38,7 @@
 #include "metrics/MetricProducer.h"
 #include "metrics/NumericValueMetricProducer.h"
 #include "state/StateManager.h"
+#include "stats_log_util.h"
 #include "stats_util.h"
 
 using google::protobuf::MessageLite;
@@ -63,6 +64,58 @@ bool hasLeafNode(const FieldMatcher& matcher) {
     return true;
 }
 
+// The sampled field must select a single value of each event.
+bool isValidSamplingInfo(const DimensionalSamplingInfo& samplingInfo, const int64_t metricId) {
+    vector<Matcher> sampledWhatFields;
+    translateFieldMatcher(samplingInfo.sampled_what_field(), &sampledWhatFields);
+    if (sampledWhatFields.size() != 1 || HasPositionALL(samplingInfo.sampled_what_field())) {
+        ALOGE("metric %lld must sample by a single field", (long long)metricId);
+        return false;
+    }
+    if (samplingInfo.shard_count() <= 1) {
+        ALOGE("metric %lld must sample with at least 2 shards", (long long)metricId);
+        return false;
+    }
+    return true;
+}
+
+// Appends [bytes] to [key], prefixed with their size so that the parts can't run together.
+void appendKeyPart(const string& bytes, string* key) {
+    key->append(to_string(bytes.size())).append(":").append(bytes);
+}
+
+// Appends the matcher with [matcherId] to [key], with its children inlined and without the ids.
+// The matchers are validated to have no cycles.
+bool appendMatcherKey(const StatsdConfig& config,
+                      const unordered_map<int64_t, int>& atomMatchingTrackerMap,
+                      const int64_t matcherId, string* key) {
+    const auto it = atomMatchingTrackerMap.find(matcherId);
+    if (it == atomMatchingTrackerMap.end() || it->second >= config.atom_matcher_size()) {
+        return false;
+    }
+    AtomMatcher matcher = config.atom_matcher(it->second);
+    matcher.clear_id();
+    vector<int64_t> children;
+    if (matcher.has_combination()) {
+        children.assign(matcher.combination().matcher().begin(),
+                        matcher.combination().matcher().end());
+        matcher.mutable_combination()->clear_matcher();
+    }
+    string serializedMatcher;
+    if (!matcher.SerializeToString(&serializedMatcher)) {
+        return false;
+    }
+    appendKeyPart(serializedMatcher, key);
+    key->append(to_string(children.size())).append("(");
+    for (const int64_t child : children) {
+        if (!appendMatcherKey(config, atomMatchingTrackerMap, child, key)) {
+            return false;
+        }
+    }
+    key->append(")");
+    return true;
+}
+
 }  // namespace
 
 sp<AtomMatchingTracker> createAtomMatchingTracker(const AtomMatcher& logMatcher, const int index,
@@ -75,6 +128,11 @@ sp<AtomMatchingTracker> createAtomMatchingTracker(const AtomMatcher& logMatcher,
     uint64_t protoHash = Hash64(serializedMatcher);
     switch (logMatcher.contents_case()) {
         case AtomMatcher::ContentsCase::kSimpleAtomMatcher:
+            if (!isValidSimpleAtomMatcher(logMatcher.simple_atom_matcher())) {
+                ALOGE("Matcher \"%lld\" has an invalid wildcard pattern",
+                      (long long)logMatcher.id());
+                return nullptr;
+            }
             return new SimpleAtomMatchingTracker(logMatcher.id(), index, protoHash,
                                                  logMatcher.simple_atom_matcher(), uidMap);
         case AtomMatcher::ContentsCase::kCombination:
@@ -108,6 +166,34 @@ sp<ConditionTracker> createConditionTracker(
     }
 }
 
+string getSharedConditionStateKey(const StatsdConfig& config, const Predicate& predicate,
+                                  const unordered_map<int64_t, int>& atomMatchingTrackerMap) {
+    if (!predicate.has_simple_predicate()) {
+        return "";
+    }
+    SimplePredicate simplePredicate = predicate.simple_predicate();
+    simplePredicate.clear_start();
+    simplePredicate.clear_stop();
+    simplePredicate.clear_stop_all();
+    string serializedPredicate;
+    if (!simplePredicate.SerializeToString(&serializedPredicate)) {
+        return "";
+    }
+    string key;
+    appendKeyPart(serializedPredicate, &key);
+    const SimplePredicate& matchers = predicate.simple_predicate();
+    const std::pair<bool, int64_t> matcherIds[] = {{matchers.has_start(), matchers.start()},
+                                                   {matchers.has_stop(), matchers.stop()},
+                                                   {matchers.has_stop_all(), matchers.stop_all()}};
+    for (const auto& [hasMatcher, matcherId] : matcherIds) {
+        key.append(hasMatcher ? "+" : "-");
+        if (hasMatcher && !appendMatcherKey(config, atomMatchingTrackerMap, matcherId, &key)) {
+            return "";
+        }
+    }
+    return key;
+}
+
 bool getMetricProtoHash(const StatsdConfig& config, const MessageLite& metric, const int64_t id,
                         const unordered_map<int64_t, int>& metricToActivationMap,
                         uint64_t& metricHash) {
@@ -427,9 +513,19 @@ optional<sp<MetricProducer>> createCountMetricProducerAndUpdateMetadata(
         return nullopt;
     }
 
-    return {new CountMetricProducer(key, metric, conditionIndex, initialConditionCache, wizard,
-                                    metricHash, timeBaseNs, currentTimeNs, eventActivationMap,
-                                    eventDeactivationMap, slicedStateAtoms, stateGroupMap)};
+    if (metric.has_dimensional_sampling_info() &&
+        !isValidSamplingInfo(metric.dimensional_sampling_info(), metric.id())) {
+        return nullopt;
+    }
+
+    sp<MetricProducer> producer = new CountMetricProducer(
+            key, metric, conditionIndex, initialConditionCache, wizard, metricHash, timeBaseNs,
+            currentTimeNs, eventActivationMap, eventDeactivationMap, slicedStateAtoms,
+            stateGroupMap);
+    if (metric.has_dimensional_sampling_info()) {
+        producer->setSamplingInfo(metric.dimensional_sampling_info());
+    }
+    return {producer};
 }
 
 optional<sp<MetricProducer>> createDurationMetricProducerAndUpdateMetadata(
@@ -624,9 +720,19 @@ optional<sp<MetricProducer>> createEventMetricProducerAndUpdateMetadata(
         return nullopt;
     }
 
-    return {new EventMetricProducer(key, metric, conditionIndex, initialConditionCache, wizard,
+    if (metric.has_dimensional_sampling_info() &&
+        !isValidSamplingInfo(metric.dimensional_sampling_info(), metric.id())) {
+        return nullopt;
+    }
+
+    sp<MetricProducer> producer =
+            new EventMetricProducer(key, metric, conditionIndex, initialConditionCache, wizard,
                                     metricHash, timeBaseNs, eventActivationMap,
-                                    eventDeactivationMap)};
+                                    eventDeactivationMap);
+    if (metric.has_dimensional_sampling_info()) {
+        producer->setSamplingInfo(metric.dimensional_sampling_info());
+    }
+    return {producer};
 }
 
 optional<sp<MetricProducer>> createNumericValueMetricProducerAndUpdateMetadata(
@@ -792,6 +898,12 @@ optional<sp<MetricProducer>> createKllMetricProducerAndUpdateMetadata(
         ALOGE("incorrect \"kll_field\" in KllMetric \"%lld\"", (long long)metric.id());
         return nullopt;
     }
+    for (const double quantile : metric.report_quantiles()) {
+        if (!(quantile >= 0 && quantile <= 1)) {
+            ALOGE("invalid quantile %f in KllMetric \"%lld\"", quantile, (long long)metric.id());
+            return nullopt;
+        }
+    }
 
     int trackerIndex;
     if (!handleMetricWithAtomMatchingTrackers(metric.what(), metricIndex,
@@ -930,9 +1042,11 @@ optional<sp<MetricProducer>> createGaugeMetricProducerAndUpdateMetadata(
             ALOGW("Pull atom not specified for trigger");
             return nullopt;
         }
-        // trigger_event should be used with FIRST_N_SAMPLES
-        if (metric.sampling_type() != GaugeMetric::FIRST_N_SAMPLES) {
-            ALOGW("Gauge Metric with trigger event must have sampling type FIRST_N_SAMPLES");
+        // trigger_event should be used with FIRST_N_SAMPLES or RESERVOIR_SAMPLES
+        if (metric.sampling_type() != GaugeMetric::FIRST_N_SAMPLES &&
+            metric.sampling_type() != GaugeMetric::RESERVOIR_SAMPLES) {
+            ALOGW("Gauge Metric with trigger event must have sampling type FIRST_N_SAMPLES or "
+                  "RESERVOIR_SAMPLES");
             return nullopt;
         }
         if (!handleMetricWithAtomMatchingTrackers(metric.trigger_event(), metricIndex,
@@ -947,8 +1061,10 @@ optional<sp<MetricProducer>> createGaugeMetricProducerAndUpdateMetadata(
     }
 
     if (!metric.has_trigger_event() && pullTagId != -1 &&
-        metric.sampling_type() == GaugeMetric::FIRST_N_SAMPLES) {
-        ALOGW("FIRST_N_SAMPLES is only for pushed event or pull_on_trigger");
+        (metric.sampling_type() == GaugeMetric::FIRST_N_SAMPLES ||
+         metric.sampling_type() == GaugeMetric::RESERVOIR_SAMPLES)) {
+        ALOGW("FIRST_N_SAMPLES and RESERVOIR_SAMPLES are only for pushed event or "
+              "pull_on_trigger");
         return nullopt;
     }
 
@@ -1012,6 +1128,17 @@ optional<sp<AnomalyTracker>> createAnomalyTracker(
     }
     const int metricIndex = itr->second;
     sp<MetricProducer> metric = allMetricProducers[metricIndex];
+    if (alert.has_quantile()) {
+        if (metric->getMetricType() != METRIC_TYPE_KLL) {
+            ALOGW("invalid alert: quantile on the non-KLL metric %lld",
+                  (long long)alert.metric_id());
+            return nullopt;
+        }
+        if (alert.quantile() <= 0 || alert.quantile() >= 1) {
+            ALOGW("invalid alert: quantile=%f", alert.quantile());
+            return nullopt;
+        }
+    }
     sp<AnomalyTracker> anomalyTracker =
             metric->addAnomalyTracker(alert, anomalyAlarmMonitor, updateStatus, currentTimeNs);
     if (anomalyTracker == nullptr) {
@@ -1283,13 +1410,10 @@ bool initMetrics(const ConfigKey& key, const StatsdConfig& config, const int64_t
     const set<int> whitelistedAtomIds(config.whitelisted_atom_ids().begin(),
                                       config.whitelisted_atom_ids().end());
     for (const auto& it : allMetricProducers) {
-        // Register metrics to StateTrackers
+        // The metrics are registered to the StateTrackers by registerStateListeners(), for
+        // non-whitelisted atoms only. Using whitelisted atom as a sliced state atom is not allowed.
         for (int atomId : it->getSlicedStateAtoms()) {
-            // Register listener for non-whitelisted atoms only. Using whitelisted atom as a sliced
-            // state atom is not allowed.
-            if (whitelistedAtomIds.find(atomId) == whitelistedAtomIds.end()) {
-                StateManager::getInstance().registerListener(atomId, it);
-            } else {
+            if (whitelistedAtomIds.find(atomId) != whitelistedAtomIds.end()) {
                 return false;
             }
         }
@@ -1297,6 +1421,14 @@ bool initMetrics(const ConfigKey& key, const StatsdConfig& config, const int64_t
     return true;
 }
 
+void registerStateListeners(const vector<sp<MetricProducer>>& allMetricProducers) {
+    for (const auto& it : allMetricProducers) {
+        for (int atomId : it->getSlicedStateAtoms()) {
+            StateManager::getInstance().registerListener(atomId, it);
+        }
+    }
+}
+
 bool initAlerts(const StatsdConfig& config, const int64_t currentTimeNs,
                 const unordered_map<int64_t, int>& metricProducerMap,
                 unordered_map<int64_t, int>& alertTrackerMap,
@@ -1419,6 +1551,250 @@ bool initStatsdConfig(const ConfigKey& key, const StatsdConfig& config, const sp
     return true;
 }
 
+namespace {
+
+// The cost of keeping a dimension key, of a pull and of an alarm, in events per second.
+const double kDimensionKeyCost = 0.01;
+const double kPullCost = 500;
+const double kAlarmCost = 50;
+
+// Expected number of distinct values of a dimension field and of a state.
+const int64_t kValuesPerDimensionField = 10;
+const int64_t kValuesPerState = 5;
+
+const int64_t kMillisPerHour = 60 * 60 * 1000LL;
+
+// Adds the atom ids of the matcher at [index], and of its children, to [atomIds].
+void addMatcherAtomIds(const StatsdConfig& config,
+                       const unordered_map<int64_t, int>& matcherIndices, const int index,
+                       const int depth, set<int>* atomIds) {
+    // The matchers of an invalid config may have cycles.
+    if (index < 0 || depth > config.atom_matcher_size()) {
+        return;
+    }
+    const AtomMatcher& matcher = config.atom_matcher(index);
+    if (matcher.has_simple_atom_matcher()) {
+        atomIds->insert(matcher.simple_atom_matcher().atom_id());
+        return;
+    }
+    for (const int64_t child : matcher.combination().matcher()) {
+        const auto it = matcherIndices.find(child);
+        if (it != matcherIndices.end()) {
+            addMatcherAtomIds(config, matcherIndices, it->second, depth + 1, atomIds);
+        }
+    }
+}
+
+int countLeafFields(const FieldMatcher& matcher) {
+    if (matcher.child_size() == 0) {
+        return 1;
+    }
+    int count = 0;
+    for (const FieldMatcher& child : matcher.child()) {
+        count += countLeafFields(child);
+    }
+    return count;
+}
+
+int64_t estimateDimensionKeys(const FieldMatcher& dimensions, const int stateCount) {
+    const int64_t maxKeys = StatsdStats::kDimensionKeySizeHardLimit;
+    int64_t keys = 1;
+    int fields = 0;
+    for (const FieldMatcher& child : dimensions.child()) {
+        fields += countLeafFields(child);
+    }
+    for (int i = 0; i < fields && keys < maxKeys; i++) {
+        keys *= kValuesPerDimensionField;
+    }
+    for (int i = 0; i < stateCount && keys < maxKeys; i++) {
+        keys *= kValuesPerState;
+    }
+    return std::min(keys, maxKeys);
+}
+
+double getBucketsPerHour(const TimeUnit bucket) {
+    const int64_t bucketSizeMillis = TimeUnitToBucketSizeInMillis(bucket);
+    // The metrics without a bucket have buckets of an hour.
+    return bucketSizeMillis > 0 ? (double)kMillisPerHour / bucketSizeMillis : 1;
+}
+
+template <typename T, typename Predicate>
+void removeIf(google::protobuf::RepeatedPtrField<T>* fields, const Predicate& predicate) {
+    int kept = 0;
+    for (int i = 0; i < fields->size(); i++) {
+        if (!predicate(fields->Get(i))) {
+            fields->SwapElements(kept++, i);
+        }
+    }
+    fields->DeleteSubrange(kept, fields->size() - kept);
+}
+
+}  // namespace
+
+ConfigCost estimateConfigCost(const StatsdConfig& config,
+                              const sp<StatsPullerManager>& pullerManager) {
+    ConfigCost cost;
+    unordered_map<int64_t, int> matcherIndices;
+    for (int i = 0; i < config.atom_matcher_size(); i++) {
+        matcherIndices[config.atom_matcher(i).id()] = i;
+    }
+    // The atom ids, events per second and whether any atom is pulled of each matcher, by id.
+    struct MatcherCost {
+        set<int> atomIds;
+        double eventsPerSec = 0;
+        bool pulled = false;
+    };
+    unordered_map<int64_t, MatcherCost> matcherCosts;
+    StatsdStats& stats = StatsdStats::getInstance();
+    for (int i = 0; i < config.atom_matcher_size(); i++) {
+        MatcherCost& matcherCost = matcherCosts[config.atom_matcher(i).id()];
+        addMatcherAtomIds(config, matcherIndices, i, 0, &matcherCost.atomIds);
+        for (const int atomId : matcherCost.atomIds) {
+            matcherCost.eventsPerSec += stats.getPushedAtomRate(atomId);
+            matcherCost.pulled |=
+                    pullerManager != nullptr && pullerManager->PullerForMatcherExists(atomId);
+        }
+        cost.matcherEvaluationsPerSec += matcherCost.eventsPerSec;
+    }
+    const auto getMatcherCost = [&matcherCosts](const int64_t matcherId) -> const MatcherCost& {
+        static const MatcherCost kUnknownMatcher;
+        const auto it = matcherCosts.find(matcherId);
+        return it != matcherCosts.end() ? it->second : kUnknownMatcher;
+    };
+
+    const auto addMetric = [&cost, &getMatcherCost](const int64_t metricId, const int64_t what,
+                                                    const int64_t dimensionKeys,
+                                                    const double pullsPerHour) {
+        MetricCostEstimate metric;
+        metric.metricId = metricId;
+        metric.eventsPerSec = getMatcherCost(what).eventsPerSec;
+        metric.dimensionKeys = dimensionKeys;
+        metric.pullsPerHour = pullsPerHour;
+        metric.cost = metric.eventsPerSec + dimensionKeys * kDimensionKeyCost +
+                      pullsPerHour / 3600 * kPullCost;
+        cost.metricEventsPerSec += metric.eventsPerSec;
+        cost.dimensionKeys += dimensionKeys;
+        cost.pullsPerHour += pullsPerHour;
+        cost.cost += metric.cost;
+        cost.metrics.push_back(metric);
+    };
+    // The pulled metrics pull at each bucket boundary, or on each trigger event.
+    const auto getPullsPerHour = [&getMatcherCost](const int64_t what, const TimeUnit bucket) {
+        return getMatcherCost(what).pulled ? getBucketsPerHour(bucket) : 0;
+    };
+
+    for (const EventMetric& metric : config.event_metric()) {
+        addMetric(metric.id(), metric.what(), 0, 0);
+    }
+    for (const CountMetric& metric : config.count_metric()) {
+        int64_t keys = estimateDimensionKeys(metric.dimensions_in_what(),
+                                             metric.slice_by_state_size());
+        if (metric.max_heavy_hitters() > 0) {
+            keys = std::min<int64_t>(keys, metric.max_heavy_hitters());
+        }
+        addMetric(metric.id(), metric.what(), keys, 0);
+    }
+    for (const DurationMetric& metric : config.duration_metric()) {
+        addMetric(metric.id(), metric.what(),
+                  estimateDimensionKeys(metric.dimensions_in_what(), metric.slice_by_state_size()),
+                  0);
+    }
+    for (const ValueMetric& metric : config.value_metric()) {
+        addMetric(metric.id(), metric.what(),
+                  estimateDimensionKeys(metric.dimensions_in_what(), metric.slice_by_state_size()),
+                  getPullsPerHour(metric.what(), metric.bucket()));
+    }
+    for (const KllMetric& metric : config.kll_metric()) {
+        addMetric(metric.id(), metric.what(),
+                  estimateDimensionKeys(metric.dimensions_in_what(), metric.slice_by_state_size()),
+                  getPullsPerHour(metric.what(), metric.bucket()));
+    }
+    for (const GaugeMetric& metric : config.gauge_metric()) {
+        double pullsPerHour = getPullsPerHour(metric.what(), metric.bucket());
+        if (pullsPerHour > 0 && metric.has_trigger_event()) {
+            pullsPerHour = getMatcherCost(metric.trigger_event()).eventsPerSec * 3600;
+        }
+        addMetric(metric.id(), metric.what(),
+                  estimateDimensionKeys(metric.dimensions_in_what(), /* stateCount */ 0),
+                  pullsPerHour);
+    }
+
+    for (const Alarm& alarm : config.alarm()) {
+        if (alarm.period_millis() > 0) {
+            cost.alarmsPerHour += (double)kMillisPerHour / alarm.period_millis();
+        }
+    }
+    cost.cost += cost.matcherEvaluationsPerSec + cost.alarmsPerHour / 3600 * kAlarmCost;
+    return cost;
+}
+
+int downgradeConfig(const ConfigCost& cost, const double budget, StatsdConfig* config) {
+    vector<const MetricCostEstimate*> metrics;
+    for (const MetricCostEstimate& metric : cost.metrics) {
+        metrics.push_back(&metric);
+    }
+    std::sort(metrics.begin(), metrics.end(),
+              [](const MetricCostEstimate* a, const MetricCostEstimate* b) {
+                  return a->cost > b->cost;
+              });
+    // The matchers and the periodic alarms are kept, removing every metric may not be enough.
+    double nonMetricCost = cost.cost;
+    for (const MetricCostEstimate* metric : metrics) {
+        nonMetricCost -= metric->cost;
+    }
+    if (nonMetricCost > budget) {
+        return -1;
+    }
+    set<int64_t> removedMetrics;
+    double remainingCost = cost.cost;
+    for (const MetricCostEstimate* metric : metrics) {
+        if (remainingCost <= budget) {
+            break;
+        }
+        removedMetrics.insert(metric->metricId);
+        remainingCost -= metric->cost;
+    }
+    if (removedMetrics.empty()) {
+        return 0;
+    }
+
+    const auto isRemoved = [&removedMetrics](const auto& metric) {
+        return removedMetrics.find(metric.id()) != removedMetrics.end();
+    };
+    removeIf(config->mutable_event_metric(), isRemoved);
+    removeIf(config->mutable_count_metric(), isRemoved);
+    removeIf(config->mutable_duration_metric(), isRemoved);
+    removeIf(config->mutable_value_metric(), isRemoved);
+    removeIf(config->mutable_gauge_metric(), isRemoved);
+    removeIf(config->mutable_kll_metric(), isRemoved);
+
+    set<int64_t> removedAlerts;
+    removeIf(config->mutable_alert(), [&](const Alert& alert) {
+        if (removedMetrics.find(alert.metric_id()) == removedMetrics.end()) {
+            return false;
+        }
+        removedAlerts.insert(alert.id());
+        return true;
+    });
+    removeIf(config->mutable_subscription(), [&removedAlerts](const Subscription& subscription) {
+        return subscription.rule_type() == Subscription::ALERT &&
+               removedAlerts.find(subscription.rule_id()) != removedAlerts.end();
+    });
+    removeIf(config->mutable_metric_activation(),
+             [&removedMetrics](const MetricActivation& activation) {
+                 return removedMetrics.find(activation.metric_id()) != removedMetrics.end();
+             });
+    const vector<int64_t> noReportMetrics(config->no_report_metric().begin(),
+                                          config->no_report_metric().end());
+    config->clear_no_report_metric();
+    for (const int64_t metricId : noReportMetrics) {
+        if (removedMetrics.find(metricId) == removedMetrics.end()) {
+            config->add_no_report_metric(metricId);
+        }
+    }
+    return removedMetrics.size();
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
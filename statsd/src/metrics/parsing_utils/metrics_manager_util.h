@@ -53,6 +53,18 @@ sp<ConditionTracker> createConditionTracker(
         const ConfigKey& key, const Predicate& predicate, const int index,
         const unordered_map<int64_t, int>& atomMatchingTrackerMap);
 
+// Get the key under which the state of a predicate can be shared across configs, see
+// SharedConditionStateRegistry.
+// input:
+// [config]: the StatsdConfig of the predicate
+// [predicate]: the input Predicate from the StatsdConfig
+// [atomMatchingTrackerMap]: map of atom matcher id to its index in the config
+// output:
+// the predicate with the matchers it uses inlined and all ids left out, or an empty string if the
+// predicate has no state to share
+std::string getSharedConditionStateKey(const StatsdConfig& config, const Predicate& predicate,
+                                       const unordered_map<int64_t, int>& atomMatchingTrackerMap);
+
 // Get the hash of a metric, combining the activation if the metric has one.
 bool getMetricProtoHash(const StatsdConfig& config, const google::protobuf::MessageLite& metric,
                         const int64_t id,
@@ -310,6 +322,7 @@ bool initStates(const StatsdConfig& config, unordered_map<int64_t, int>& stateAt
 // [conditionToMetricMap]: contains the mapping from condition tracker index to
 //                          the list of MetricProducer index
 // [trackerToMetricMap]: contains the mapping from log tracker to MetricProducer index.
+// [metricMap]: contains the mapping from metric id to MetricProducer index.
 bool initMetrics(
         const ConfigKey& key, const StatsdConfig& config, const int64_t timeBaseTimeNs,
         const int64_t currentTimeNs, const sp<StatsPullerManager>& pullerManager,
@@ -323,11 +336,30 @@ bool initMetrics(
         std::vector<sp<MetricProducer>>& allMetricProducers,
         std::unordered_map<int, std::vector<int>>& conditionToMetricMap,
         std::unordered_map<int, std::vector<int>>& trackerToMetricMap,
-        std::set<int64_t>& noReportMetricIds,
+        std::unordered_map<int64_t, int>& metricMap, std::set<int64_t>& noReportMetricIds,
         std::unordered_map<int, std::vector<int>>& activationAtomTrackerToMetricMap,
         std::unordered_map<int, std::vector<int>>& deactivationAtomTrackerToMetricMap,
         std::vector<int>& metricsWithActivation);
 
+// Initialize AnomalyTrackers.
+// input:
+// [config]: the input config
+// [metricProducerMap]: metric id to index mapping from the previous step.
+// output:
+// [alertTrackerMap]: contains the mapping from alert id to AnomalyTracker index.
+// [allAnomalyTrackers]: contains the list of sp to the AnomalyTrackers created.
+bool initAlerts(const StatsdConfig& config, const int64_t currentTimeNs,
+                const std::unordered_map<int64_t, int>& metricProducerMap,
+                std::unordered_map<int64_t, int>& alertTrackerMap,
+                const sp<AlarmMonitor>& anomalyAlarmMonitor,
+                std::vector<sp<MetricProducer>>& allMetricProducers,
+                std::vector<sp<AnomalyTracker>>& allAnomalyTrackers);
+
+// Registers [allMetricProducers] to the StateTrackers of their sliced state atoms. The
+// StateTrackers are used by the events without a lock, so this is called once the config is in
+// use, under the lock of the event processing.
+void registerStateListeners(const std::vector<sp<MetricProducer>>& allMetricProducers);
+
 // Initialize alarms
 // Is called both on initialize new configs and config updates since alarms do not have any state.
 bool initAlarms(const StatsdConfig& config, const ConfigKey& key,
@@ -359,6 +391,49 @@ bool initStatsdConfig(const ConfigKey& key, const StatsdConfig& config, const sp
                       std::map<int64_t, uint64_t>& stateProtoHashes,
                       std::set<int64_t>& noReportMetricIds);
 
+// Estimated cost of a metric of a config, see ConfigCost.
+struct MetricCostEstimate {
+    int64_t metricId;
+    // Events of the atoms the metric matches, per second.
+    double eventsPerSec;
+    int64_t dimensionKeys;
+    double pullsPerHour;
+    double cost;
+};
+
+// Estimated cost of a config, before it is initialized. The cost is in events per second: each
+// matcher evaluation and each event matched by a metric counts as one, and the dimension keys,
+// pulls and alarms are weighted as their equivalent in events.
+struct ConfigCost {
+    double matcherEvaluationsPerSec = 0;
+    double metricEventsPerSec = 0;
+    int64_t dimensionKeys = 0;
+    double pullsPerHour = 0;
+    double alarmsPerHour = 0;
+    double cost = 0;
+    std::vector<MetricCostEstimate> metrics;
+};
+
+// Estimate the cost of a config.
+// input:
+// [config]: the StatsdConfig to estimate
+// [pullerManager]: the pullers of the atoms, or null if no atom is pulled
+// output:
+// the cost, from the rates of the pushed atoms in StatsdStats, the expected dimension keys of
+// the metrics, the pulls of their buckets and triggers, and the periodic alarms
+ConfigCost estimateConfigCost(const StatsdConfig& config,
+                              const sp<StatsPullerManager>& pullerManager);
+
+// Remove the costliest metrics of a config until its cost is within a budget.
+// input:
+// [cost]: the cost of [config], see estimateConfigCost()
+// [budget]: the cost to stay within
+// output:
+// [config]: without the removed metrics, and the alerts, subscriptions and activations of them
+// the number of removed metrics, or -1 if the config is over the budget even without any metric,
+// in which case [config] is unchanged
+int downgradeConfig(const ConfigCost& cost, const double budget, StatsdConfig* config);
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
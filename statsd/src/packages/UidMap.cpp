@@ -53,12 +53,17 @@ const int FIELD_ID_SNAPSHOT_PACKAGE_INSTALLER = 8;
 const int FIELD_ID_SNAPSHOT_PACKAGE_INSTALLER_HASH = 9;
 const int FIELD_ID_SNAPSHOT_PACKAGE_INSTALLER_INDEX = 10;
 const int FIELD_ID_SNAPSHOT_PACKAGE_TRUNCATED_CERTIFICATE_HASH = 11;
+const int FIELD_ID_SNAPSHOT_PACKAGE_NAME_INDEX = 12;
+const int FIELD_ID_SNAPSHOT_PACKAGE_VERSION_STRING_INDEX = 13;
+const int FIELD_ID_SNAPSHOT_PACKAGE_INSTALLER_STRING_INDEX = 14;
 const int FIELD_ID_SNAPSHOT_TIMESTAMP = 1;
 const int FIELD_ID_SNAPSHOT_PACKAGE_INFO = 2;
 const int FIELD_ID_SNAPSHOTS = 1;
 const int FIELD_ID_CHANGES = 2;
 const int FIELD_ID_INSTALLER_HASH = 3;
 const int FIELD_ID_INSTALLER_NAME = 4;
+const int FIELD_ID_SNAPSHOT_HASH = 5;
+const int FIELD_ID_INSTALLER_STRING_INDEX = 6;
 const int FIELD_ID_CHANGE_DELETION = 1;
 const int FIELD_ID_CHANGE_TIMESTAMP = 2;
 const int FIELD_ID_CHANGE_PACKAGE = 3;
@@ -70,8 +75,29 @@ const int FIELD_ID_CHANGE_NEW_VERSION_STRING = 8;
 const int FIELD_ID_CHANGE_PREV_VERSION_STRING = 9;
 const int FIELD_ID_CHANGE_NEW_VERSION_STRING_HASH = 10;
 const int FIELD_ID_CHANGE_PREV_VERSION_STRING_HASH = 11;
+const int FIELD_ID_CHANGE_PACKAGE_INDEX = 12;
+const int FIELD_ID_CHANGE_NEW_VERSION_STRING_INDEX = 13;
+const int FIELD_ID_CHANGE_PREV_VERSION_STRING_INDEX = 14;
+
+namespace {
+
+// Adds [str] to [strings], and writes its index if they are a dictionary, or else its hash.
+void writeReportString(const string& str, const uint64_t hashFieldId, const uint64_t indexFieldId,
+                       ReportStrings* strings, ProtoOutputStream* proto) {
+    const uint32_t index = strings->insert(str);
+    if (strings->isDictionary()) {
+        proto->write(FIELD_TYPE_UINT32 | indexFieldId, (int)index);
+    } else {
+        proto->write(FIELD_TYPE_UINT64 | hashFieldId, (long long)Hash64(str));
+    }
+}
+
+}  // namespace
 
-UidMap::UidMap() : mBytesUsed(0), mIncludeCertificateHash(false) {
+UidMap::UidMap()
+    : mChanges(StatsdStats::kMaxBytesUsedUidMap / kBytesChangeRecord),
+      mBytesUsed(0),
+      mIncludeCertificateHash(false) {
 }
 
 UidMap::~UidMap() {}
@@ -82,10 +108,9 @@ sp<UidMap> UidMap::getInstance() {
 }
 
 bool UidMap::hasApp(int uid, const string& packageName) const {
-    lock_guard<mutex> lock(mMutex);
-
-    auto it = mMap.find(std::make_pair(uid, packageName));
-    return it != mMap.end() && !it->second.deleted;
+    const auto snapshot = getPackageSnapshot();
+    return snapshot->versionCodes.find(std::make_pair(uid, packageName)) !=
+           snapshot->versionCodes.end();
 }
 
 string UidMap::normalizeAppName(const string& appName) const {
@@ -95,28 +120,49 @@ string UidMap::normalizeAppName(const string& appName) const {
 }
 
 std::set<string> UidMap::getAppNamesFromUid(const int32_t& uid, bool returnNormalized) const {
-    lock_guard<mutex> lock(mMutex);
-    return getAppNamesFromUidLocked(uid,returnNormalized);
-}
-
-std::set<string> UidMap::getAppNamesFromUidLocked(const int32_t& uid, bool returnNormalized) const {
+    const auto snapshot = getPackageSnapshot();
+    const auto it = snapshot->uidToPackages.find(uid);
+    if (it == snapshot->uidToPackages.end()) {
+        return {};
+    }
+    if (!returnNormalized) {
+        return it->second;
+    }
     std::set<string> names;
-    for (const auto& kv : mMap) {
-        if (kv.first.first == uid && !kv.second.deleted) {
-            names.insert(returnNormalized ? normalizeAppName(kv.first.second) : kv.first.second);
-        }
+    for (const string& packageName : it->second) {
+        names.insert(normalizeAppName(packageName));
     }
     return names;
 }
 
-int64_t UidMap::getAppVersion(int uid, const string& packageName) const {
-    lock_guard<mutex> lock(mMutex);
+std::unordered_set<int32_t> UidMap::getUidsFromNormalizedAppName(
+        const string& normalizedName) const {
+    return getUidsFromNormalizedAppNames({normalizedName});
+}
 
-    auto it = mMap.find(std::make_pair(uid, packageName));
-    if (it == mMap.end() || it->second.deleted) {
-        return 0;
+std::unordered_set<int32_t> UidMap::getUidsFromNormalizedAppNames(
+        const std::unordered_set<string>& normalizedNames) const {
+    return getUidsMatchingNormalizedAppName([&normalizedNames](const string& name) {
+        return normalizedNames.find(name) != normalizedNames.end();
+    });
+}
+
+std::unordered_set<int32_t> UidMap::getUidsMatchingNormalizedAppName(
+        const std::function<bool(const string&)>& predicate) const {
+    const auto snapshot = getPackageSnapshot();
+    std::unordered_set<int32_t> uids;
+    for (const auto& [packageName, packageUids] : snapshot->packageToUids) {
+        if (predicate(normalizeAppName(packageName))) {
+            uids.insert(packageUids.begin(), packageUids.end());
+        }
     }
-    return it->second.versionCode;
+    return uids;
+}
+
+int64_t UidMap::getAppVersion(int uid, const string& packageName) const {
+    const auto snapshot = getPackageSnapshot();
+    auto it = snapshot->versionCodes.find(std::make_pair(uid, packageName));
+    return it != snapshot->versionCodes.end() ? it->second : 0;
 }
 
 void UidMap::updateMap(const int64_t& timestamp, const vector<int32_t>& uid,
@@ -152,7 +198,14 @@ void UidMap::updateMap(const int64_t& timestamp, const vector<int32_t>& uid,
                 mMap[kv.first] = kv.second;
             }
         }
+        reindexAppsLocked();
+        mSnapshotHash = 0;
+        for (const auto& [app, appData] : mMap) {
+            mSnapshotHash += appHash(app, appData);
+        }
+        mSnapshotEpoch++;
 
+        publishPackageSnapshotLocked();
         ensureBytesUsedBelowLimit();
         StatsdStats::getInstance().setCurrentUidMapMemory(mBytesUsed);
         broadcast = mSubscriber;
@@ -167,6 +220,69 @@ void UidMap::updateMap(const int64_t& timestamp, const vector<int32_t>& uid,
     }
 }
 
+void UidMap::updateMap(const int64_t& timestamp, const UidData& uidData) {
+    wp<PackageInfoListener> broadcast = NULL;
+    {
+        lock_guard<mutex> lock(mMutex);  // Exclusively lock for updates.
+
+        bool changed = false;
+        // The apps of mMap that are in [uidData]. The values of the map don't move.
+        std::unordered_set<const AppData*> presentApps;
+        presentApps.reserve(uidData.app_info_size());
+        for (const ApplicationInfo& appInfo : uidData.app_info()) {
+            auto [it, inserted] =
+                    mMap.try_emplace(std::make_pair(appInfo.uid(), appInfo.package_name()));
+            AppData& appData = it->second;
+            presentApps.insert(&appData);
+            const string& certificateHash = appInfo.certificate_hash();
+            // Like with a full update, the removed apps that are still listed stay deleted.
+            if (!inserted &&
+                (appData.deleted ||
+                 (appData.versionCode == appInfo.version() &&
+                  appData.versionString == appInfo.version_string() &&
+                  appData.installer == appInfo.installer() &&
+                  std::equal(appData.certificateHash.begin(), appData.certificateHash.end(),
+                             certificateHash.begin(), certificateHash.end(),
+                             [](uint8_t a, char b) { return a == (uint8_t)b; })))) {
+                continue;
+            }
+            if (inserted) {
+                indexAppLocked(appInfo.uid(), appInfo.package_name());
+            } else {
+                mSnapshotHash -= appHash(it->first, appData);
+            }
+            appData = AppData(appInfo.version(), appInfo.version_string(), appInfo.installer(),
+                              vector<uint8_t>(certificateHash.begin(), certificateHash.end()));
+            mSnapshotHash += appHash(it->first, appData);
+            changed = true;
+        }
+        for (auto it = mMap.begin(); it != mMap.end();) {
+            if (presentApps.find(&it->second) != presentApps.end()) {
+                it++;
+                continue;
+            }
+            mSnapshotHash -= appHash(it->first, it->second);
+            if (!it->second.deleted) {
+                unindexAppLocked(it->first.first, it->first.second);
+            }
+            it = mMap.erase(it);
+            changed = true;
+        }
+
+        if (changed) {
+            mSnapshotEpoch++;
+            publishPackageSnapshotLocked();
+            ensureBytesUsedBelowLimit();
+            StatsdStats::getInstance().setCurrentUidMapMemory(mBytesUsed);
+            broadcast = mSubscriber;
+        }
+    }
+    auto strongPtr = broadcast.promote();
+    if (strongPtr != NULL) {
+        strongPtr->onUidMapReceived(timestamp);
+    }
+}
+
 void UidMap::updateApp(const int64_t& timestamp, const String16& app_16, const int32_t& uid,
                        const int64_t& versionCode, const String16& versionString,
                        const String16& installer, const vector<uint8_t>& certificateHash) {
@@ -180,6 +296,11 @@ void UidMap::updateApp(const int64_t& timestamp, const String16& app_16, const i
         string newVersionString = string(String8(versionString).string());
         auto it = mMap.find(std::make_pair(uid, appName));
         if (it != mMap.end()) {
+            mSnapshotHash -= appHash(it->first, it->second);
+            if (it->second.installer != installerName ||
+                it->second.certificateHash != certificateHash) {
+                mAppDetailsEpoch++;
+            }
             prevVersion = it->second.versionCode;
             prevVersionString = it->second.versionString;
             it->second.versionCode = versionCode;
@@ -187,6 +308,7 @@ void UidMap::updateApp(const int64_t& timestamp, const String16& app_16, const i
             it->second.installer = installerName;
             it->second.deleted = false;
             it->second.certificateHash = certificateHash;
+            mSnapshotHash += appHash(it->first, it->second);
 
             // Only notify the listeners if this is an app upgrade. If this app is being installed
             // for the first time, then we don't notify the listeners.
@@ -195,13 +317,21 @@ void UidMap::updateApp(const int64_t& timestamp, const String16& app_16, const i
             broadcast = mSubscriber;
         } else {
             // Otherwise, we need to add an app at this uid.
-            mMap[std::make_pair(uid, appName)] =
-                    AppData(versionCode, newVersionString, installerName, certificateHash);
+            const auto app = std::make_pair(uid, appName);
+            mMap[app] = AppData(versionCode, newVersionString, installerName, certificateHash);
+            mSnapshotHash += appHash(app, mMap[app]);
+            mAppDetailsEpoch++;
         }
+        indexAppLocked(uid, appName);
+
+        publishPackageSnapshotLocked();
 
-        mChanges.emplace_back(false, timestamp, appName, uid, versionCode, newVersionString,
-                              prevVersion, prevVersionString);
-        mBytesUsed += kBytesChangeRecord;
+        if (!mChanges.append(false, timestamp, appName, uid, versionCode, newVersionString,
+                             prevVersion, prevVersionString)) {
+            mSnapshotEpoch++;
+            StatsdStats::getInstance().noteUidMapDropped(1);
+        }
+        mBytesUsed = mChanges.getBytesUsed();
         ensureBytesUsedBelowLimit();
         StatsdStats::getInstance().setCurrentUidMapMemory(mBytesUsed);
         StatsdStats::getInstance().setUidMapChanges(mChanges.size());
@@ -220,13 +350,12 @@ void UidMap::ensureBytesUsedBelowLimit() {
     } else {
         limit = maxBytesOverride;
     }
-    while (mBytesUsed > limit) {
+    while (mBytesUsed > limit && !mChanges.empty()) {
         ALOGI("Bytes used %zu is above limit %zu, need to delete something", mBytesUsed, limit);
-        if (mChanges.size() > 0) {
-            mBytesUsed -= kBytesChangeRecord;
-            mChanges.pop_front();
-            StatsdStats::getInstance().noteUidMapDropped(1);
-        }
+        mChanges.pop_front();
+        mBytesUsed = mChanges.getBytesUsed();
+        mSnapshotEpoch++;
+        StatsdStats::getInstance().noteUidMapDropped(1);
     }
 }
 
@@ -243,18 +372,32 @@ void UidMap::removeApp(const int64_t& timestamp, const String16& app_16, const i
         if (it != mMap.end() && !it->second.deleted) {
             prevVersion = it->second.versionCode;
             prevVersionString = it->second.versionString;
+            mSnapshotHash -= appHash(it->first, it->second);
             it->second.deleted = true;
+            mSnapshotHash += appHash(it->first, it->second);
             mDeletedApps.push_back(key);
+            unindexAppLocked(uid, app);
         }
         if (mDeletedApps.size() > StatsdStats::kMaxDeletedAppsInUidMap) {
             // Delete the oldest one.
             auto oldest = mDeletedApps.front();
             mDeletedApps.pop_front();
-            mMap.erase(oldest);
+            // It may have been installed again since.
+            unindexAppLocked(oldest.first, oldest.second);
+            const auto oldestIt = mMap.find(oldest);
+            if (oldestIt != mMap.end()) {
+                mSnapshotHash -= appHash(oldestIt->first, oldestIt->second);
+                mMap.erase(oldestIt);
+            }
+            mSnapshotEpoch++;
             StatsdStats::getInstance().noteUidMapAppDeletionDropped();
         }
-        mChanges.emplace_back(true, timestamp, app, uid, 0, "", prevVersion, prevVersionString);
-        mBytesUsed += kBytesChangeRecord;
+        publishPackageSnapshotLocked();
+        if (!mChanges.append(true, timestamp, app, uid, 0, "", prevVersion, prevVersionString)) {
+            mSnapshotEpoch++;
+            StatsdStats::getInstance().noteUidMapDropped(1);
+        }
+        mBytesUsed = mChanges.getBytesUsed();
         ensureBytesUsedBelowLimit();
         StatsdStats::getInstance().setCurrentUidMapMemory(mBytesUsed);
         StatsdStats::getInstance().setUidMapChanges(mChanges.size());
@@ -267,6 +410,63 @@ void UidMap::removeApp(const int64_t& timestamp, const String16& app_16, const i
     }
 }
 
+void UidMap::indexAppLocked(const int32_t uid, const string& packageName) {
+    mUidToPackages[uid].insert(packageName);
+    mPackageToUids[packageName].insert(uid);
+}
+
+void UidMap::unindexAppLocked(const int32_t uid, const string& packageName) {
+    auto packagesIt = mUidToPackages.find(uid);
+    if (packagesIt != mUidToPackages.end()) {
+        packagesIt->second.erase(packageName);
+        if (packagesIt->second.empty()) {
+            mUidToPackages.erase(packagesIt);
+        }
+    }
+    auto uidsIt = mPackageToUids.find(packageName);
+    if (uidsIt != mPackageToUids.end()) {
+        uidsIt->second.erase(uid);
+        if (uidsIt->second.empty()) {
+            mPackageToUids.erase(uidsIt);
+        }
+    }
+}
+
+void UidMap::publishPackageSnapshotLocked() {
+    auto snapshot = std::make_shared<PackageSnapshot>();
+    for (const auto& [keyPair, appData] : mMap) {
+        if (!appData.deleted) {
+            snapshot->versionCodes[keyPair] = appData.versionCode;
+        }
+    }
+    snapshot->uidToPackages = mUidToPackages;
+    snapshot->packageToUids = mPackageToUids;
+    std::atomic_store_explicit(&mPackageSnapshot,
+                               std::shared_ptr<const PackageSnapshot>(std::move(snapshot)),
+                               std::memory_order_release);
+    mPackageMapVersion.fetch_add(1, std::memory_order_acq_rel);
+}
+
+uint64_t UidMap::appHash(const std::pair<int, string>& app, const AppData& appData) {
+    string serialized = StringPrintf("%d|%" PRId64 "|%d|", app.first, appData.versionCode,
+                                     appData.deleted);
+    serialized.append(app.second).append("|");
+    serialized.append(appData.versionString).append("|");
+    serialized.append(appData.installer).append("|");
+    serialized.append(appData.certificateHash.begin(), appData.certificateHash.end());
+    return Hash64(serialized);
+}
+
+void UidMap::reindexAppsLocked() {
+    mUidToPackages.clear();
+    mPackageToUids.clear();
+    for (const auto& [keyPair, appData] : mMap) {
+        if (!appData.deleted) {
+            indexAppLocked(keyPair.first, keyPair.second);
+        }
+    }
+}
+
 void UidMap::setListener(wp<PackageInfoListener> listener) {
     lock_guard<mutex> lock(mMutex);  // Lock for updates
     mSubscriber = listener;
@@ -275,30 +475,51 @@ void UidMap::setListener(wp<PackageInfoListener> listener) {
 void UidMap::assignIsolatedUid(int isolatedUid, int parentUid) {
     lock_guard<mutex> lock(mIsolatedMutex);
 
-    mIsolatedUidMap[isolatedUid] = parentUid;
+    mutableIsolatedUidMapLocked()[isolatedUid] = parentUid;
+    mIsolatedUidMapVersion.fetch_add(1, std::memory_order_release);
 }
 
 void UidMap::removeIsolatedUid(int isolatedUid) {
     lock_guard<mutex> lock(mIsolatedMutex);
 
-    auto it = mIsolatedUidMap.find(isolatedUid);
-    if (it != mIsolatedUidMap.end()) {
-        mIsolatedUidMap.erase(it);
+    if (mIsolatedUidMap->find(isolatedUid) != mIsolatedUidMap->end()) {
+        mutableIsolatedUidMapLocked().erase(isolatedUid);
+        mIsolatedUidMapVersion.fetch_add(1, std::memory_order_release);
     }
 }
 
-int UidMap::getHostUidOrSelf(int uid) const {
+UidMap::IsolatedUidMap& UidMap::mutableIsolatedUidMapLocked() {
+    // The snapshots are only handed out under mIsolatedMutex, so a map with a single owner can't
+    // be shared while it is modified.
+    if (mIsolatedUidMap.use_count() > 1) {
+        mIsolatedUidMap = std::make_shared<IsolatedUidMap>(*mIsolatedUidMap);
+    }
+    return *mIsolatedUidMap;
+}
+
+std::shared_ptr<const UidMap::IsolatedUidMap> UidMap::getIsolatedUidMapSnapshot(
+        uint64_t* version) const {
     lock_guard<mutex> lock(mIsolatedMutex);
+    *version = mIsolatedUidMapVersion.load(std::memory_order_relaxed);
+    return mIsolatedUidMap;
+}
 
-    auto it = mIsolatedUidMap.find(uid);
-    if (it != mIsolatedUidMap.end()) {
-        return it->second;
+void IsolatedUidSnapshot::refresh() {
+    if (mMap != nullptr && mUidMap->getIsolatedUidMapVersion() == mVersion) {
+        return;
     }
-    return uid;
+    mMap = mUidMap->getIsolatedUidMapSnapshot(&mVersion);
+}
+
+int UidMap::getHostUidOrSelf(int uid) const {
+    lock_guard<mutex> lock(mIsolatedMutex);
+    auto it = mIsolatedUidMap->find(uid);
+    return it != mIsolatedUidMap->end() ? it->second : uid;
 }
 
 void UidMap::clearOutput() {
     mChanges.clear();
+    mSnapshotEpoch++;
     // Also update the guardrail trackers.
     StatsdStats::getInstance().setUidMapChanges(0);
     mBytesUsed = 0;
@@ -324,7 +545,7 @@ size_t UidMap::getBytesUsed() const {
 void UidMap::writeUidMapSnapshot(int64_t timestamp, bool includeVersionStrings,
                                  bool includeInstaller, const uint8_t truncatedCertificateHashSize,
                                  const std::set<int32_t>& interestingUids,
-                                 map<string, int>* installerIndices, std::set<string>* str_set,
+                                 map<string, int>* installerIndices, ReportStrings* str_set,
                                  ProtoOutputStream* proto) const {
     lock_guard<mutex> lock(mMutex);
 
@@ -338,7 +559,7 @@ void UidMap::writeUidMapSnapshotLocked(const int64_t timestamp, const bool inclu
                                        const uint8_t truncatedCertificateHashSize,
                                        const std::set<int32_t>& interestingUids,
                                        map<string, int>* installerIndices,
-                                       std::set<string>* str_set, ProtoOutputStream* proto) const {
+                                       ReportStrings* str_set, ProtoOutputStream* proto) const {
     int curInstallerIndex = 0;
 
     proto->write(FIELD_TYPE_INT64 | FIELD_ID_SNAPSHOT_TIMESTAMP, (long long)timestamp);
@@ -363,24 +584,24 @@ void UidMap::writeUidMapSnapshotLocked(const int64_t timestamp, const bool inclu
             }
         }
 
-        if (str_set != nullptr) {  // Hash strings in report
-            str_set->insert(packageName);
-            proto->write(FIELD_TYPE_UINT64 | FIELD_ID_SNAPSHOT_PACKAGE_NAME_HASH,
-                         (long long)Hash64(packageName));
+        if (str_set != nullptr) {  // Hash or index strings in report
+            writeReportString(packageName, FIELD_ID_SNAPSHOT_PACKAGE_NAME_HASH,
+                              FIELD_ID_SNAPSHOT_PACKAGE_NAME_INDEX, str_set, proto);
             if (includeVersionStrings) {
-                str_set->insert(appData.versionString);
-                proto->write(FIELD_TYPE_UINT64 | FIELD_ID_SNAPSHOT_PACKAGE_VERSION_STRING_HASH,
-                             (long long)Hash64(appData.versionString));
+                writeReportString(appData.versionString,
+                                  FIELD_ID_SNAPSHOT_PACKAGE_VERSION_STRING_HASH,
+                                  FIELD_ID_SNAPSHOT_PACKAGE_VERSION_STRING_INDEX, str_set, proto);
             }
             if (includeInstaller) {
-                str_set->insert(appData.installer);
                 if (installerIndex != -1) {
-                    // Write installer index.
+                    // Write installer index. The installer list has the string.
+                    str_set->insert(appData.installer);
                     proto->write(FIELD_TYPE_UINT32 | FIELD_ID_SNAPSHOT_PACKAGE_INSTALLER_INDEX,
                                  installerIndex);
                 } else {
-                    proto->write(FIELD_TYPE_UINT64 | FIELD_ID_SNAPSHOT_PACKAGE_INSTALLER_HASH,
-                                 (long long)Hash64(appData.installer));
+                    writeReportString(appData.installer, FIELD_ID_SNAPSHOT_PACKAGE_INSTALLER_HASH,
+                                      FIELD_ID_SNAPSHOT_PACKAGE_INSTALLER_STRING_INDEX, str_set,
+                                      proto);
                 }
             }
         } else {  // Strings not hashed in report
@@ -421,38 +642,36 @@ void UidMap::writeUidMapSnapshotLocked(const int64_t timestamp, const bool inclu
     }
 }
 
-void UidMap::appendUidMap(const int64_t& timestamp, const ConfigKey& key,
-                          const bool includeVersionStrings, const bool includeInstaller,
-                          const uint8_t truncatedCertificateHashSize, std::set<string>* str_set,
-                          ProtoOutputStream* proto) {
-    lock_guard<mutex> lock(mMutex);  // Lock for updates
-
-    for (const ChangeRecord& record : mChanges) {
-        if (record.timestampNs > mLastUpdatePerConfigKey[key]) {
+void UidMap::writeChangesLocked(const ConfigKey& key, const bool includeVersionStrings,
+                                ReportStrings* str_set, ProtoOutputStream* proto) {
+    const int64_t lastUpdateNs = mLastUpdatePerConfigKey[key];
+    for (size_t i = 0; i < mChanges.size(); i++) {
+        const ChangeRecord& record = mChanges[i];
+        if (record.timestampNs > lastUpdateNs) {
+            const string& package = mChanges.getString(record.package);
+            const string& versionString = mChanges.getString(record.versionString);
+            const string& prevVersionString = mChanges.getString(record.prevVersionString);
             uint64_t changesToken =
                     proto->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_CHANGES);
             proto->write(FIELD_TYPE_BOOL | FIELD_ID_CHANGE_DELETION, (bool)record.deletion);
             proto->write(FIELD_TYPE_INT64 | FIELD_ID_CHANGE_TIMESTAMP,
                          (long long)record.timestampNs);
             if (str_set != nullptr) {
-                str_set->insert(record.package);
-                proto->write(FIELD_TYPE_UINT64 | FIELD_ID_CHANGE_PACKAGE_HASH,
-                             (long long)Hash64(record.package));
+                writeReportString(package, FIELD_ID_CHANGE_PACKAGE_HASH,
+                                  FIELD_ID_CHANGE_PACKAGE_INDEX, str_set, proto);
                 if (includeVersionStrings) {
-                    str_set->insert(record.versionString);
-                    proto->write(FIELD_TYPE_UINT64 | FIELD_ID_CHANGE_NEW_VERSION_STRING_HASH,
-                                 (long long)Hash64(record.versionString));
-                    str_set->insert(record.prevVersionString);
-                    proto->write(FIELD_TYPE_UINT64 | FIELD_ID_CHANGE_PREV_VERSION_STRING_HASH,
-                                 (long long)Hash64(record.prevVersionString));
+                    writeReportString(versionString, FIELD_ID_CHANGE_NEW_VERSION_STRING_HASH,
+                                      FIELD_ID_CHANGE_NEW_VERSION_STRING_INDEX, str_set, proto);
+                    writeReportString(prevVersionString, FIELD_ID_CHANGE_PREV_VERSION_STRING_HASH,
+                                      FIELD_ID_CHANGE_PREV_VERSION_STRING_INDEX, str_set, proto);
                 }
             } else {
-                proto->write(FIELD_TYPE_STRING | FIELD_ID_CHANGE_PACKAGE, record.package);
+                proto->write(FIELD_TYPE_STRING | FIELD_ID_CHANGE_PACKAGE, package);
                 if (includeVersionStrings) {
                     proto->write(FIELD_TYPE_STRING | FIELD_ID_CHANGE_NEW_VERSION_STRING,
-                                 record.versionString);
+                                 versionString);
                     proto->write(FIELD_TYPE_STRING | FIELD_ID_CHANGE_PREV_VERSION_STRING,
-                                 record.prevVersionString);
+                                 prevVersionString);
                 }
             }
 
@@ -463,55 +682,92 @@ void UidMap::appendUidMap(const int64_t& timestamp, const ConfigKey& key,
             proto->end(changesToken);
         }
     }
+}
 
-    map<string, int> installerIndices;
+void UidMap::noteUidMapWrittenLocked(const int64_t timestamp, const ConfigKey& key) {
+    int64_t prevMin = getMinimumTimestampNs();
+    mLastUpdatePerConfigKey[key] = timestamp;
+    int64_t newMin = getMinimumTimestampNs();
 
-    // Write snapshot from current uid map state.
-    uint64_t snapshotsToken =
-            proto->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_SNAPSHOTS);
-    writeUidMapSnapshotLocked(timestamp, includeVersionStrings, includeInstaller,
-                              truncatedCertificateHashSize,
-                              std::set<int32_t>() /*empty uid set means including every uid*/,
-                              &installerIndices, str_set, proto);
-    proto->end(snapshotsToken);
-
-    vector<string> installers(installerIndices.size(), "");
-    for (const auto& [installer, index] : installerIndices) {
-        // index is guaranteed to be < installers.size().
-        installers[index] = installer;
+    if (newMin > prevMin) {  // Delete anything possible now that the minimum has
+                             // moved forward.
+        mChanges.removeOlderThan(newMin);
+        mBytesUsed = mChanges.getBytesUsed();
     }
+    StatsdStats::getInstance().setCurrentUidMapMemory(mBytesUsed);
+    StatsdStats::getInstance().setUidMapChanges(mChanges.size());
+}
 
-    if (includeInstaller && mIncludeCertificateHash) {
-        // Write installer list; either strings or hashes.
-        for (const string& installerName : installers) {
-            if (str_set == nullptr) {  // Strings not hashed
-                proto->write(FIELD_TYPE_STRING | FIELD_COUNT_REPEATED | FIELD_ID_INSTALLER_NAME,
-                             installerName);
-            } else {  // Strings are hashed
-                proto->write(FIELD_TYPE_UINT64 | FIELD_COUNT_REPEATED | FIELD_ID_INSTALLER_HASH,
-                             (long long)Hash64(installerName));
-            }
+void UidMap::appendUidMap(const int64_t& timestamp, const ConfigKey& key,
+                          const bool includeVersionStrings, const bool includeInstaller,
+                          const uint8_t truncatedCertificateHashSize,
+                          const bool includeOnlyChanges, ReportStrings* str_set,
+                          ProtoOutputStream* proto) {
+    lock_guard<mutex> lock(mMutex);  // Lock for updates
+
+    writeChangesLocked(key, includeVersionStrings, str_set, proto);
+
+    bool includeSnapshot = true;
+    if (includeOnlyChanges) {
+        proto->write(FIELD_TYPE_UINT64 | FIELD_ID_SNAPSHOT_HASH, (long long)mSnapshotHash);
+        // The changes don't have the installers and certificate hashes of the apps.
+        const bool includeAppDetails = includeInstaller || truncatedCertificateHashSize > 0;
+        const auto baselineIt = mSnapshotBaselines.find(key);
+        // The periodic snapshot bounds the reports a lost one leaves without packages.
+        includeSnapshot = baselineIt == mSnapshotBaselines.end() ||
+                          baselineIt->second.snapshotEpoch != mSnapshotEpoch ||
+                          (includeAppDetails &&
+                           baselineIt->second.appDetailsEpoch != mAppDetailsEpoch) ||
+                          timestamp - baselineIt->second.timestampNs >=
+                                  StatsdStats::kMaxUidMapSnapshotPeriodNs;
+        if (includeSnapshot) {
+            mSnapshotBaselines[key] = {mSnapshotEpoch, mAppDetailsEpoch, timestamp};
         }
     }
 
-    int64_t prevMin = getMinimumTimestampNs();
-    mLastUpdatePerConfigKey[key] = timestamp;
-    int64_t newMin = getMinimumTimestampNs();
+    if (includeSnapshot) {
+        map<string, int> installerIndices;
+
+        // Write snapshot from current uid map state.
+        uint64_t snapshotsToken =
+                proto->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_SNAPSHOTS);
+        writeUidMapSnapshotLocked(timestamp, includeVersionStrings, includeInstaller,
+                                  truncatedCertificateHashSize,
+                                  std::set<int32_t>() /*empty uid set means including every uid*/,
+                                  &installerIndices, str_set, proto);
+        proto->end(snapshotsToken);
+
+        vector<string> installers(installerIndices.size(), "");
+        for (const auto& [installer, index] : installerIndices) {
+            // index is guaranteed to be < installers.size().
+            installers[index] = installer;
+        }
 
-    if (newMin > prevMin) {  // Delete anything possible now that the minimum has
-                             // moved forward.
-        int64_t cutoff_nanos = newMin;
-        for (auto it_changes = mChanges.begin(); it_changes != mChanges.end();) {
-            if (it_changes->timestampNs < cutoff_nanos) {
-                mBytesUsed -= kBytesChangeRecord;
-                it_changes = mChanges.erase(it_changes);
-            } else {
-                ++it_changes;
+        if (includeInstaller && mIncludeCertificateHash) {
+            // Write installer list; either strings or hashes.
+            for (const string& installerName : installers) {
+                if (str_set == nullptr) {  // Strings not hashed
+                    proto->write(FIELD_TYPE_STRING | FIELD_COUNT_REPEATED |
+                                         FIELD_ID_INSTALLER_NAME,
+                                 installerName);
+                } else {  // Strings are hashed or indexed
+                    writeReportString(installerName, FIELD_COUNT_REPEATED | FIELD_ID_INSTALLER_HASH,
+                                      FIELD_COUNT_REPEATED | FIELD_ID_INSTALLER_STRING_INDEX,
+                                      str_set, proto);
+                }
             }
         }
     }
-    StatsdStats::getInstance().setCurrentUidMapMemory(mBytesUsed);
-    StatsdStats::getInstance().setUidMapChanges(mChanges.size());
+
+    noteUidMapWrittenLocked(timestamp, key);
+}
+
+void UidMap::appendUidMapChanges(const int64_t& timestamp, const ConfigKey& key,
+                                 const bool includeVersionStrings, ReportStrings* str_set,
+                                 ProtoOutputStream* proto) {
+    lock_guard<mutex> lock(mMutex);
+    writeChangesLocked(key, includeVersionStrings, str_set, proto);
+    noteUidMapWrittenLocked(timestamp, key);
 }
 
 void UidMap::printUidMap(int out, bool includeCertificateHash) const {
@@ -536,26 +792,25 @@ void UidMap::printUidMap(int out, bool includeCertificateHash) const {
 
 void UidMap::OnConfigUpdated(const ConfigKey& key) {
     mLastUpdatePerConfigKey[key] = -1;
+    mSnapshotBaselines.erase(key);
 }
 
 void UidMap::OnConfigRemoved(const ConfigKey& key) {
     mLastUpdatePerConfigKey.erase(key);
+    mSnapshotBaselines.erase(key);
 }
 
 set<int32_t> UidMap::getAppUid(const string& package) const {
-    lock_guard<mutex> lock(mMutex);
-
-    set<int32_t> results;
-    for (const auto& kv : mMap) {
-        if (kv.first.second == package && !kv.second.deleted) {
-            results.insert(kv.first.first);
-        }
-    }
-    return results;
+    const auto snapshot = getPackageSnapshot();
+    const auto it = snapshot->packageToUids.find(package);
+    return it != snapshot->packageToUids.end() ? it->second : set<int32_t>();
 }
 
 void UidMap::setIncludeCertificateHash(const bool include) {
     lock_guard<mutex> lock(mMutex);
+    if (mIncludeCertificateHash != include) {
+        mAppDetailsEpoch++;
+    }
     mIncludeCertificateHash = include;
 }
 
@@ -18,18 +18,25 @@
 
 #include "config/ConfigKey.h"
 #include "packages/PackageInfoListener.h"
+#include "packages/UidMapChangeLog.h"
+#include "src/uid_data.pb.h"
 #include "stats_util.h"
+#include "utils/ReportStrings.h"
 
 #include <gtest/gtest_prod.h>
 #include <stdio.h>
 #include <utils/RefBase.h>
 #include <utils/String16.h>
 
+#include <atomic>
+#include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <set>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 
 using namespace android;
 using namespace std;
@@ -60,36 +67,10 @@ struct AppData {
           certificateHash(certificateHash){};
 };
 
-// When calling appendUidMap, we retrieve all the ChangeRecords since the last
-// timestamp we called appendUidMap for this configuration key.
-struct ChangeRecord {
-    const bool deletion;
-    const int64_t timestampNs;
-    const string package;
-    const int32_t uid;
-    const int64_t version;
-    const int64_t prevVersion;
-    const string versionString;
-    const string prevVersionString;
-
-    ChangeRecord(const bool isDeletion, const int64_t timestampNs, const string& package,
-                 const int32_t uid, const int64_t version, const string versionString,
-                 const int64_t prevVersion, const string prevVersionString)
-        : deletion(isDeletion),
-          timestampNs(timestampNs),
-          package(package),
-          uid(uid),
-          version(version),
-          prevVersion(prevVersion),
-          versionString(versionString),
-          prevVersionString(prevVersionString) {
-    }
-};
-
-const unsigned int kBytesChangeRecord = sizeof(struct ChangeRecord);
-
 // UidMap keeps track of what the corresponding app name (APK name) and version code for every uid
 // at any given moment. This map must be updated by StatsCompanionService.
+// The lookups of the apps and of the host uids read immutable snapshots that every change
+// replaces, so they don't take any lock.
 class UidMap : public virtual RefBase {
 public:
     UidMap();
@@ -106,6 +87,12 @@ public:
                    const vector<String16>& packageName, const vector<String16>& installer,
                    const vector<vector<uint8_t>>& certificateHash);
 
+    /*
+     * Same as updateMap() above for the apps of [uidData], but only changes the apps that differ
+     * from the current map. The listener is only notified if any did.
+     */
+    void updateMap(const int64_t& timestamp, const UidData& uidData);
+
     void updateApp(const int64_t& timestamp, const String16& packageName, const int32_t& uid,
                    const int64_t& versionCode, const String16& versionString,
                    const String16& installer, const vector<uint8_t>& certificateHash);
@@ -119,6 +106,24 @@ public:
 
     int64_t getAppVersion(int uid, const string& packageName) const;
 
+    // Returns the uids with an app whose normalized name is [normalizedName], i.e. the uids for
+    // which getAppNamesFromUid(uid, true) contains [normalizedName].
+    std::unordered_set<int32_t> getUidsFromNormalizedAppName(const string& normalizedName) const;
+
+    // Same as getUidsFromNormalizedAppName() for any of [normalizedNames], in a single pass.
+    std::unordered_set<int32_t> getUidsFromNormalizedAppNames(
+            const std::unordered_set<string>& normalizedNames) const;
+
+    // Returns the uids with an app whose normalized name satisfies [predicate]. [predicate] is
+    // called on a snapshot of the uid map, which may change meanwhile.
+    std::unordered_set<int32_t> getUidsMatchingNormalizedAppName(
+            const std::function<bool(const string&)>& predicate) const;
+
+    // Version of the package map, incremented by every change to it. Doesn't take any lock.
+    inline uint64_t getPackageMapVersion() const {
+        return mPackageMapVersion.load(std::memory_order_acquire);
+    }
+
     // Helper for debugging contents of this uid map. Can be triggered with:
     // adb shell cmd stats print-uid-map [--with_certificate_hash]
     void printUidMap(int outFd, bool includeCertificateHash) const;
@@ -140,13 +145,33 @@ public:
     // Returns the host uid if it exists. Otherwise, returns the same uid that was passed-in.
     virtual int getHostUidOrSelf(int uid) const;
 
+    typedef std::unordered_map<int, int> IsolatedUidMap;
+
+    // Returns the isolated uid to host uid map, and sets [version] to its version. The returned
+    // map is never modified: a change made while it is held is made on a copy.
+    std::shared_ptr<const IsolatedUidMap> getIsolatedUidMapSnapshot(uint64_t* version) const;
+
+    // Version of the isolated uid map, incremented by every change. Doesn't take any lock.
+    inline uint64_t getIsolatedUidMapVersion() const {
+        return mIsolatedUidMapVersion.load(std::memory_order_acquire);
+    }
+
     // Gets all snapshots and changes that have occurred since the last output.
     // If every config key has received a change or snapshot record, then this
     // record is deleted.
+    // With [includeOnlyChanges], the snapshot is left out if the changes since the last snapshot
+    // written for [key] describe the packages, and the snapshot hash is written. A snapshot is
+    // still written every StatsdStats::kMaxUidMapSnapshotPeriodNs.
     void appendUidMap(const int64_t& timestamp, const ConfigKey& key,
                       const bool includeVersionStrings, const bool includeInstaller,
-                      const uint8_t truncatedCertificateHashSize, std::set<string>* str_set,
-                      ProtoOutputStream* proto);
+                      const uint8_t truncatedCertificateHashSize, const bool includeOnlyChanges,
+                      ReportStrings* str_set, ProtoOutputStream* proto);
+
+    // Like appendUidMap(), without the snapshot. The snapshot of a later report must describe
+    // the packages the changes leave out.
+    void appendUidMapChanges(const int64_t& timestamp, const ConfigKey& key,
+                             const bool includeVersionStrings, ReportStrings* str_set,
+                             ProtoOutputStream* proto);
 
     // Forces the output to be cleared. We still generate a snapshot based on the current state.
     // This results in extra data uploaded but helps us reconstruct the uid mapping on the server
@@ -166,21 +191,28 @@ public:
     void writeUidMapSnapshot(int64_t timestamp, bool includeVersionStrings, bool includeInstaller,
                              const uint8_t truncatedCertificateHashSize,
                              const std::set<int32_t>& interestingUids,
-                             std::map<string, int>* installerIndices, std::set<string>* str_set,
+                             std::map<string, int>* installerIndices, ReportStrings* str_set,
                              ProtoOutputStream* proto) const;
 
     void setIncludeCertificateHash(const bool include);
 
 private:
-    std::set<string> getAppNamesFromUidLocked(const int32_t& uid, bool returnNormalized) const;
     string normalizeAppName(const string& appName) const;
 
+    // Writes the changes since the last uid map written for [key].
+    void writeChangesLocked(const ConfigKey& key, const bool includeVersionStrings,
+                            ReportStrings* str_set, ProtoOutputStream* proto);
+
+    // Marks the changes until [timestamp] as written for [key], and drops the ones written for
+    // every config.
+    void noteUidMapWrittenLocked(const int64_t timestamp, const ConfigKey& key);
+
     void writeUidMapSnapshotLocked(const int64_t timestamp, const bool includeVersionStrings,
                                    const bool includeInstaller,
                                    const uint8_t truncatedCertificateHashSize,
                                    const std::set<int32_t>& interestingUids,
                                    std::map<string, int>* installerIndices,
-                                   std::set<string>* str_set, ProtoOutputStream* proto) const;
+                                   ReportStrings* str_set, ProtoOutputStream* proto) const;
 
     mutable mutex mMutex;
     mutable mutex mIsolatedMutex;
@@ -194,12 +226,71 @@ private:
     // Maps uid and package name to application data.
     std::unordered_map<std::pair<int, string>, AppData, PairHash> mMap;
 
+    // Incremented with mMutex held after every change to mMap.
+    std::atomic<uint64_t> mPackageMapVersion = 0;
+
+    // Indices of the apps of mMap that are not deleted, by uid and by package name.
+    std::unordered_map<int32_t, std::set<string>> mUidToPackages;
+    std::unordered_map<string, std::set<int32_t>> mPackageToUids;
+
+    // Immutable copy of the apps of mMap that are not deleted and of the indices, which readers
+    // load without locking mMutex.
+    struct PackageSnapshot {
+        std::unordered_map<std::pair<int, string>, int64_t, PairHash> versionCodes;
+        std::unordered_map<int32_t, std::set<string>> uidToPackages;
+        std::unordered_map<string, std::set<int32_t>> packageToUids;
+    };
+    std::shared_ptr<const PackageSnapshot> mPackageSnapshot =
+            std::make_shared<const PackageSnapshot>();
+
+    // Publishes a new mPackageSnapshot and increments mPackageMapVersion. The caller must hold
+    // mMutex and call it after every change to mMap.
+    void publishPackageSnapshotLocked();
+
+    inline std::shared_ptr<const PackageSnapshot> getPackageSnapshot() const {
+        return std::atomic_load_explicit(&mPackageSnapshot, std::memory_order_acquire);
+    }
+
+    // Adds and removes an app of mMap from the indices. The caller must hold mMutex.
+    void indexAppLocked(const int32_t uid, const string& packageName);
+    void unindexAppLocked(const int32_t uid, const string& packageName);
+
+    // Rebuilds the indices from mMap. The caller must hold mMutex.
+    void reindexAppsLocked();
+
+    // Sum of appHash() over mMap, which identifies the packages independently of the order of
+    // the map. Updated with every change to mMap.
+    uint64_t mSnapshotHash = 0;
+
+    static uint64_t appHash(const std::pair<int, string>& app, const AppData& appData);
+
+    // Incremented when the packages change in a way that mChanges doesn't describe, or changes
+    // are dropped. mAppDetailsEpoch is incremented when the installer or certificate hash of an
+    // app changes, which the changes don't have either.
+    uint64_t mSnapshotEpoch = 0;
+    uint64_t mAppDetailsEpoch = 0;
+
+    // The epochs and time as of the last snapshot written for each config with deltas, see
+    // appendUidMap().
+    struct SnapshotBaseline {
+        uint64_t snapshotEpoch;
+        uint64_t appDetailsEpoch;
+        int64_t timestampNs;
+    };
+    std::unordered_map<ConfigKey, SnapshotBaseline> mSnapshotBaselines;
+
     // Maps isolated uid to the parent uid. Any metrics for an isolated uid will instead contribute
-    // to the parent uid.
-    std::unordered_map<int, int> mIsolatedUidMap;
+    // to the parent uid. Shared with the holders of getIsolatedUidMapSnapshot().
+    std::shared_ptr<IsolatedUidMap> mIsolatedUidMap = std::make_shared<IsolatedUidMap>();
+    std::atomic<uint64_t> mIsolatedUidMapVersion = 0;
+
+    // Returns mIsolatedUidMap to be modified, copied first if a snapshot of it is still held.
+    // The caller must hold mIsolatedMutex.
+    IsolatedUidMap& mutableIsolatedUidMapLocked();
 
-    // Record the changes that can be provided with the uploads.
-    std::list<ChangeRecord> mChanges;
+    // Record the changes that can be provided with the uploads. Their strings are interned, so
+    // the changes of an app that is updated again and again share its package name.
+    UidMapChangeLog mChanges;
 
     // Store which uid and apps represent deleted ones.
     std::list<std::pair<int, string>> mDeletedApps;
@@ -224,7 +315,7 @@ private:
     // specified in StatsdStats.h with the rest of the guardrails.
     size_t maxBytesOverride = 0;
 
-    // Cache the size of mOutput;
+    // Cache of mChanges.getBytesUsed().
     size_t mBytesUsed;
 
     bool mIncludeCertificateHash;
@@ -236,6 +327,48 @@ private:
     FRIEND_TEST(UidMapTest, TestOutputIncludesAtLeastOneSnapshot);
     FRIEND_TEST(UidMapTest, TestMemoryComputed);
     FRIEND_TEST(UidMapTest, TestMemoryGuardrail);
+    FRIEND_TEST(UidMapTest, TestChangeStringsShared);
+};
+
+/**
+ * Host uid lookups from a snapshot of the isolated uid map of a UidMap, for a single reader
+ * thread. The snapshot is only refreshed when the map changed, so lookups in steady state don't
+ * take any lock, unlike UidMap::getHostUidOrSelf().
+ */
+class IsolatedUidSnapshot {
+public:
+    explicit IsolatedUidSnapshot(sp<UidMap> uidMap) : mUidMap(std::move(uidMap)) {
+    }
+
+    // Refreshes the snapshot if the map changed since the last call.
+    void refresh();
+
+    // Drops the snapshot until the next refresh(), so that the next change of the map is made in
+    // place instead of on a copy.
+    inline void reset() {
+        mMap = nullptr;
+    }
+
+    // True if no isolated uid was assigned as of the last refresh().
+    inline bool empty() const {
+        return mMap == nullptr || mMap->empty();
+    }
+
+    // Returns the host uid of [uid] as of the last refresh(), or [uid].
+    inline int getHostUidOrSelf(int uid) const {
+        if (empty()) {
+            return uid;
+        }
+        auto it = mMap->find(uid);
+        return it != mMap->end() ? it->second : uid;
+    }
+
+private:
+    const sp<UidMap> mUidMap;
+
+    std::shared_ptr<const UidMap::IsolatedUidMap> mMap;
+
+    uint64_t mVersion = 0;
 };
 
 }  // namespace statsd
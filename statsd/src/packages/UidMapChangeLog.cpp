@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "UidMapChangeLog.h"
+
+#include <algorithm>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::string;
+
+uint32_t InternedStringTable::intern(const string& str) {
+    const auto it = mIds.find(str);
+    if (it != mIds.end()) {
+        mEntries[it->second].refs++;
+        return it->second;
+    }
+    uint32_t id;
+    if (!mFreeIds.empty()) {
+        id = mFreeIds.back();
+        mFreeIds.pop_back();
+    } else {
+        id = mEntries.size();
+        mEntries.emplace_back();
+    }
+    Entry& entry = mEntries[id];
+    entry.str = str;
+    entry.refs = 1;
+    mIds.emplace(entry.str, id);
+    mBytesUsed += str.size();
+    return id;
+}
+
+void InternedStringTable::release(uint32_t id) {
+    Entry& entry = mEntries[id];
+    if (--entry.refs > 0) {
+        return;
+    }
+    mIds.erase(entry.str);
+    mBytesUsed -= entry.str.size();
+    // Frees the payload of long strings.
+    string().swap(entry.str);
+    mFreeIds.push_back(id);
+}
+
+void InternedStringTable::clear() {
+    mIds.clear();
+    mEntries.clear();
+    mFreeIds.clear();
+    mBytesUsed = 0;
+}
+
+UidMapChangeLog::UidMapChangeLog(size_t capacity) : mCapacity(std::max<size_t>(capacity, 1)) {
+}
+
+bool UidMapChangeLog::append(const bool deletion, const int64_t timestampNs,
+                             const string& package, const int32_t uid, const int64_t version,
+                             const string& versionString, const int64_t prevVersion,
+                             const string& prevVersionString) {
+    bool dropped = false;
+    if (mSize == mCapacity) {
+        pop_front();
+        dropped = true;
+    }
+    const ChangeRecord record = {timestampNs,
+                                 version,
+                                 prevVersion,
+                                 uid,
+                                 mStrings.intern(package),
+                                 mStrings.intern(versionString),
+                                 mStrings.intern(prevVersionString),
+                                 deletion};
+    if (mSize == mRecords.size()) {
+        linearize();
+        mRecords.push_back(record);
+    } else {
+        mRecords[(mHead + mSize) % mRecords.size()] = record;
+    }
+    mSize++;
+    return !dropped;
+}
+
+void UidMapChangeLog::pop_front() {
+    releaseStrings(mRecords[mHead]);
+    mHead = (mHead + 1) % mRecords.size();
+    mSize--;
+}
+
+size_t UidMapChangeLog::removeOlderThan(const int64_t timestampNs) {
+    linearize();
+    const auto end = mRecords.begin() + mSize;
+    const auto newEnd =
+            std::stable_partition(mRecords.begin(), end, [timestampNs](const ChangeRecord& record) {
+                return record.timestampNs >= timestampNs;
+            });
+    for (auto it = newEnd; it != end; it++) {
+        releaseStrings(*it);
+    }
+    const size_t removed = end - newEnd;
+    mSize -= removed;
+    return removed;
+}
+
+void UidMapChangeLog::clear() {
+    mRecords.clear();
+    mHead = 0;
+    mSize = 0;
+    mStrings.clear();
+}
+
+void UidMapChangeLog::releaseStrings(const ChangeRecord& record) {
+    mStrings.release(record.package);
+    mStrings.release(record.versionString);
+    mStrings.release(record.prevVersionString);
+}
+
+void UidMapChangeLog::linearize() {
+    if (mHead == 0) {
+        return;
+    }
+    std::rotate(mRecords.begin(), mRecords.begin() + mHead, mRecords.end());
+    mHead = 0;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
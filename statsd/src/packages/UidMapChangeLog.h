@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Reference counted strings, by id. Interning a string that is already in the table returns its
+ * id, so that the records repeating a string share it.
+ */
+class InternedStringTable {
+public:
+    // Returns the id of [str], adding a reference to it.
+    uint32_t intern(const std::string& str);
+
+    // Removes a reference to the string of [id], which is freed after the last one.
+    void release(uint32_t id);
+
+    inline const std::string& get(uint32_t id) const {
+        return mEntries[id].str;
+    }
+
+    // Number of distinct strings.
+    inline size_t size() const {
+        return mIds.size();
+    }
+
+    // Sum of the lengths of the distinct strings.
+    inline size_t getBytesUsed() const {
+        return mBytesUsed;
+    }
+
+    void clear();
+
+private:
+    struct Entry {
+        std::string str;
+        uint32_t refs = 0;
+    };
+
+    // A deque doesn't move the strings that mIds views.
+    std::deque<Entry> mEntries;
+
+    std::unordered_map<std::string_view, uint32_t> mIds;
+
+    // Ids of the freed entries, reused first.
+    std::vector<uint32_t> mFreeIds;
+
+    size_t mBytesUsed = 0;
+};
+
+// When calling appendUidMap, we retrieve all the ChangeRecords since the last
+// timestamp we called appendUidMap for this configuration key. The strings are ids of the
+// InternedStringTable of the UidMapChangeLog.
+struct ChangeRecord {
+    int64_t timestampNs;
+    int64_t version;
+    int64_t prevVersion;
+    int32_t uid;
+    uint32_t package;
+    uint32_t versionString;
+    uint32_t prevVersionString;
+    bool deletion;
+};
+
+const unsigned int kBytesChangeRecord = sizeof(struct ChangeRecord);
+
+/**
+ * The package changes of a UidMap, oldest first, in a ring of at most [capacity] records. The
+ * ring only grows up to the capacity as changes are appended.
+ */
+class UidMapChangeLog {
+public:
+    explicit UidMapChangeLog(size_t capacity);
+
+    // Appends a change. Returns false if the log was full and the oldest change was dropped.
+    bool append(const bool deletion, const int64_t timestampNs, const std::string& package,
+                const int32_t uid, const int64_t version, const std::string& versionString,
+                const int64_t prevVersion, const std::string& prevVersionString);
+
+    // Drops the oldest change. The log must not be empty.
+    void pop_front();
+
+    // Drops the changes older than [timestampNs], and returns their number.
+    size_t removeOlderThan(const int64_t timestampNs);
+
+    void clear();
+
+    inline size_t size() const {
+        return mSize;
+    }
+
+    inline bool empty() const {
+        return mSize == 0;
+    }
+
+    // The [index]th oldest change.
+    inline const ChangeRecord& operator[](size_t index) const {
+        return mRecords[(mHead + index) % mRecords.size()];
+    }
+
+    inline const std::string& getString(uint32_t id) const {
+        return mStrings.get(id);
+    }
+
+    // Bytes of the records and of their distinct strings.
+    inline size_t getBytesUsed() const {
+        return mSize * kBytesChangeRecord + mStrings.getBytesUsed();
+    }
+
+private:
+    const size_t mCapacity;
+
+    // The records are mRecords[mHead], ..., wrapping around, for mSize records.
+    std::vector<ChangeRecord> mRecords;
+    size_t mHead = 0;
+    size_t mSize = 0;
+
+    InternedStringTable mStrings;
+
+    void releaseStrings(const ChangeRecord& record);
+
+    // Moves the records to the front of mRecords, in order.
+    void linearize();
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "AtomTrace.h"
+
+#include <cstring>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::string;
+using std::vector;
+
+static void appendVarint(uint64_t value, string* output) {
+    while (value >= 0x80) {
+        output->push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    output->push_back(static_cast<char>(value));
+}
+
+// Reads a varint of at most 10 bytes at [*pos], advancing it. Returns false if it is truncated.
+static bool readVarint(const uint8_t* trace, size_t size, size_t* pos, uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && *pos < size; shift += 7) {
+        const uint8_t byte = trace[(*pos)++];
+        *value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void AtomTraceEncoder::appendHeader(string* output) {
+    output->append(kAtomTraceMagic.data(), kAtomTraceMagic.size());
+}
+
+void AtomTraceEncoder::appendRecord(int32_t uid, int32_t pid, int64_t elapsedTimestampNs,
+                                    const uint8_t* payload, size_t payloadSize,
+                                    string* output) {
+    const uint64_t delta = static_cast<uint64_t>(elapsedTimestampNs) -
+                           static_cast<uint64_t>(mLastTimestampNs);
+    appendVarint((delta << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(delta) >> 63),
+                 output);
+    appendVarint(static_cast<uint32_t>(uid), output);
+    appendVarint(static_cast<uint32_t>(pid), output);
+    appendVarint(payloadSize, output);
+    output->append(reinterpret_cast<const char*>(payload), payloadSize);
+    mLastTimestampNs = elapsedTimestampNs;
+}
+
+bool decodeAtomTrace(const uint8_t* trace, size_t size, vector<AtomTraceRecord>* records) {
+    if (size < kAtomTraceMagic.size() ||
+        memcmp(trace, kAtomTraceMagic.data(), kAtomTraceMagic.size()) != 0) {
+        ALOGE("Not an atom trace");
+        return false;
+    }
+    size_t pos = kAtomTraceMagic.size();
+    uint64_t timestampNs = 0;
+    while (pos < size) {
+        uint64_t delta, uid, pid, payloadSize;
+        if (!readVarint(trace, size, &pos, &delta) || !readVarint(trace, size, &pos, &uid) ||
+            !readVarint(trace, size, &pos, &pid) ||
+            !readVarint(trace, size, &pos, &payloadSize) || payloadSize > size - pos) {
+            ALOGE("Atom trace truncated after %zu records", records->size());
+            return false;
+        }
+        timestampNs += (delta >> 1) ^ -(delta & 1);
+        AtomTraceRecord& record = records->emplace_back();
+        record.uid = static_cast<int32_t>(uid);
+        record.pid = static_cast<int32_t>(pid);
+        record.elapsedTimestampNs = static_cast<int64_t>(timestampNs);
+        record.payload.assign(trace + pos, trace + pos + payloadSize);
+        pos += payloadSize;
+    }
+    return true;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Encoding of the atom traces written by `cmd stats capture-atoms` and replayed by
+ * statsd_trace_replay. A trace is kAtomTraceMagic followed by one record per atom:
+ *   - the elapsed timestamp of the atom minus the one of the previous record, as a zigzag
+ *     varint; the first record is relative to 0,
+ *   - the uid and the pid of the logging process, as varints,
+ *   - the size of the payload as a varint, then the payload: the atom in the
+ *     StatsEvent/AStatsEvent encoding, as read by LogEvent::parseBuffer().
+ */
+inline constexpr std::string_view kAtomTraceMagic = "SDTRACE1";
+
+struct AtomTraceRecord {
+    int32_t uid = 0;
+    int32_t pid = 0;
+    int64_t elapsedTimestampNs = 0;
+    std::vector<uint8_t> payload;
+};
+
+class AtomTraceEncoder {
+public:
+    // Appends kAtomTraceMagic to [output].
+    static void appendHeader(std::string* output);
+
+    // Appends the record of an atom to [output], after the records appended before.
+    void appendRecord(int32_t uid, int32_t pid, int64_t elapsedTimestampNs,
+                      const uint8_t* payload, size_t payloadSize, std::string* output);
+
+private:
+    int64_t mLastTimestampNs = 0;
+};
+
+/**
+ * Decodes [trace], including its header, into [records]. Returns false if the header is missing
+ * or [trace] ends in the middle of a record, in which case [records] holds the complete records
+ * before it.
+ */
+bool decodeAtomTrace(const uint8_t* trace, size_t size, std::vector<AtomTraceRecord>* records);
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "AtomTraceRecorder.h"
+
+#include <android-base/file.h>
+
+#include <chrono>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::string;
+
+bool AtomTraceRecorder::capture(int out, int durationSec, CaptureStats* stats) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mCapturing.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        mPending.clear();
+        AtomTraceEncoder::appendHeader(&mPending);
+        mEncoder = AtomTraceEncoder();
+        mStats = CaptureStats();
+        mCapturing.store(true, std::memory_order_relaxed);
+    }
+    LogEvent::setAllRawBuffersRetained(true, this);
+    if (mLogEventFilter != nullptr) {
+        mLogEventFilter->setAllAtomsInUse(true, this);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mCaptureStarted = true;
+        mCaptureStartedChanged.notify_all();
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(durationSec);
+    string writing;
+    int64_t byteCount = 0;
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        mPendingReady.wait_for(lock, std::chrono::milliseconds(kMaxPendingMs),
+                               [this] { return mPending.size() >= kMinWriteBytes; });
+        const bool ended = std::chrono::steady_clock::now() >= deadline;
+        if (ended) {
+            mCapturing.store(false, std::memory_order_relaxed);
+        }
+        writing.swap(mPending);
+        lock.unlock();
+        const bool written = android::base::WriteFully(out, writing.data(), writing.size());
+        byteCount += writing.size();
+        writing.clear();
+        lock.lock();
+        if (!written) {
+            VLOG("Atom trace reader went away");
+            mCapturing.store(false, std::memory_order_relaxed);
+            break;
+        }
+        if (ended) {
+            break;
+        }
+    }
+    *stats = mStats;
+    stats->byteCount = byteCount;
+    mPending.clear();
+    mCaptureStarted = false;
+    lock.unlock();
+
+    if (mLogEventFilter != nullptr) {
+        mLogEventFilter->setAllAtomsInUse(false, this);
+    }
+    LogEvent::setAllRawBuffersRetained(false, this);
+    return true;
+}
+
+bool AtomTraceRecorder::waitForCaptureStarted(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mCaptureStartedChanged.wait_for(lock, timeout, [this] { return mCaptureStarted; });
+}
+
+void AtomTraceRecorder::onLogEvent(const LogEvent& event) {
+    if (!mCapturing.load(std::memory_order_relaxed)) {
+        return;
+    }
+    const sp<const ValuePayload>& rawBuffer = event.getRawBuffer();
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mCapturing.load(std::memory_order_relaxed)) {
+        return;
+    }
+    if (rawBuffer == nullptr) {
+        mStats.missingPayloadCount++;
+        return;
+    }
+    if (mPending.size() >= kMaxPendingBytes) {
+        mStats.droppedAtomCount++;
+        return;
+    }
+    const std::string_view payload = rawBuffer->bytes();
+    mEncoder.appendRecord(event.GetUid(), event.GetPid(), event.GetElapsedTimestampNs(),
+                          reinterpret_cast<const uint8_t*>(payload.data()), payload.size(),
+                          &mPending);
+    mStats.atomCount++;
+    if (mPending.size() >= kMinWriteBytes) {
+        mPendingReady.notify_one();
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <utils/RefBase.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "logd/LogEvent.h"
+#include "shell/AtomTrace.h"
+#include "socket/LogEventFilter.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Captures the pushed atoms processed by statsd into an atom trace, see AtomTrace.h, for
+ * `adb shell cmd stats capture-atoms`.
+ *
+ * While capturing, the events retain their raw buffers and the log event filter lets every atom
+ * through. The events are encoded by the thread processing them into a pending buffer, which
+ * the capturing thread writes out, so that a slow reader doesn't block the processing: the atoms
+ * are dropped when the pending buffer is full.
+ */
+class AtomTraceRecorder : public virtual RefBase {
+public:
+    explicit AtomTraceRecorder(const std::shared_ptr<LogEventFilter>& logEventFilter)
+        : mLogEventFilter(logEventFilter) {
+    }
+
+    struct CaptureStats {
+        // The atoms written to the trace.
+        int64_t atomCount = 0;
+        // The atoms dropped because the pending buffer was full.
+        int64_t droppedAtomCount = 0;
+        // The atoms parsed before the capture started, which have no raw buffer.
+        int64_t missingPayloadCount = 0;
+        int64_t byteCount = 0;
+    };
+
+    /**
+     * Writes a trace of the atoms processed in the next [durationSec] seconds to [out], blocking
+     * until then or until [out] is closed. Returns false, without writing anything, if another
+     * capture is running.
+     */
+    bool capture(int out, int durationSec, CaptureStats* stats);
+
+    /**
+     * Records [event] if a capture is running.
+     */
+    void onLogEvent(const LogEvent& event);
+
+    /**
+     * Blocks until a capture is fully set up, with the raw buffers retained and every atom let
+     * through, or until [timeout]. Returns whether a capture is running. Used by the tests.
+     */
+    bool waitForCaptureStarted(std::chrono::milliseconds timeout);
+
+private:
+    std::shared_ptr<LogEventFilter> mLogEventFilter;
+
+    // Whether a capture is running, read without the lock as a fast path.
+    std::atomic<bool> mCapturing{false};
+
+    std::mutex mMutex;
+
+    std::condition_variable mPendingReady;
+
+    std::condition_variable mCaptureStartedChanged;
+
+    // Whether the running capture is fully set up. Guarded by mMutex.
+    bool mCaptureStarted = false;
+
+    // The encoded records not written yet. Guarded by mMutex.
+    std::string mPending;
+
+    // Guarded by mMutex.
+    AtomTraceEncoder mEncoder;
+
+    // Guarded by mMutex.
+    CaptureStats mStats;
+
+    // The pending records are written once they reach kMinWriteBytes or every kMaxPendingMs.
+    static constexpr size_t kMinWriteBytes = 64 * 1024;
+    static constexpr int64_t kMaxPendingMs = 100;
+
+    static constexpr size_t kMaxPendingBytes = 8 * 1024 * 1024;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -20,9 +20,17 @@
 
 #include <android-base/file.h>
 
+#include <algorithm>
+
 #include "matchers/matcher_util.h"
 #include "stats_log_util.h"
+#include "utils/ThreadTopology.h"
 
+using android::util::FIELD_COUNT_REPEATED;
+using android::util::FIELD_TYPE_BYTES;
+using android::util::FIELD_TYPE_INT32;
+using android::util::FIELD_TYPE_INT64;
+using android::util::FIELD_TYPE_MESSAGE;
 using android::util::ProtoOutputStream;
 
 namespace android {
@@ -30,55 +38,133 @@ namespace os {
 namespace statsd {
 
 const static int FIELD_ID_ATOM = 1;
+const static int FIELD_ID_RAW_ATOM = 2;
+
+// for RawAtom
+const static int FIELD_ID_RAW_ATOM_UID = 1;
+const static int FIELD_ID_RAW_ATOM_PID = 2;
+const static int FIELD_ID_RAW_ATOM_ELAPSED_TIMESTAMP_NANOS = 3;
+const static int FIELD_ID_RAW_ATOM_PAYLOAD = 4;
+
+// Encodes [event] as a ShellData.raw_atom into [output], with its [rawBuffer] as is.
+static void encodeRawAtom(const LogEvent& event, const ValuePayload& rawBuffer, string* output) {
+    ProtoOutputStream proto;
+    uint64_t rawAtomToken =
+            proto.start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_RAW_ATOM);
+    proto.write(FIELD_TYPE_INT32 | FIELD_ID_RAW_ATOM_UID, event.GetUid());
+    proto.write(FIELD_TYPE_INT32 | FIELD_ID_RAW_ATOM_PID, event.GetPid());
+    proto.write(FIELD_TYPE_INT64 | FIELD_ID_RAW_ATOM_ELAPSED_TIMESTAMP_NANOS,
+                (long long)event.GetElapsedTimestampNs());
+    const std::string_view payload = rawBuffer.bytes();
+    proto.write(FIELD_TYPE_BYTES | FIELD_ID_RAW_ATOM_PAYLOAD, payload.data(), payload.size());
+    proto.end(rawAtomToken);
+    proto.serializeToString(output);
+}
 
-void ShellSubscriber::startNewSubscription(int in, int out, int timeoutSec) {
-    int myToken = claimToken();
-    VLOG("ShellSubscriber: new subscription %d has come in", myToken);
-    mSubscriptionShouldEnd.notify_one();
+// Writes the size of [payload] followed by [payload] to [fd], at once. An empty payload is a
+// heartbeat.
+static bool writeShellData(int fd, const string& payload) {
+    const size_t dataSize = payload.size();
+    string buffer(reinterpret_cast<const char*>(&dataSize), sizeof(dataSize));
+    buffer.append(payload);
+    return android::base::WriteFully(fd, buffer.data(), buffer.size());
+}
 
+void ShellSubscriber::startNewSubscription(int in, int out, int timeoutSec) {
     shared_ptr<SubscriptionInfo> mySubscriptionInfo = make_shared<SubscriptionInfo>(in, out);
     if (!readConfig(mySubscriptionInfo)) return;
 
+    // Pulled once at the start, then on the schedule of mPullerMgr.
+    const int64_t nowNs = getElapsedRealtimeNs();
+    const string pulled = pullAtoms(*mySubscriptionInfo, nowNs);
+    registerPullReceivers(mySubscriptionInfo, nowNs);
+
     {
         std::unique_lock<std::mutex> lock(mMutex);
-        mSubscriptionInfo = mySubscriptionInfo;
-        spawnHelperThread(myToken);
-        waitForSubscriptionToEndLocked(mySubscriptionInfo, myToken, lock, timeoutSec);
+        if (mSubscriptions.size() >= kMaxSubscriptions) {
+            VLOG("ShellSubscriber: ending the oldest of %zu subscriptions", mSubscriptions.size());
+            endSubscriptionLocked(mSubscriptions.front());
+        }
+        mSubscriptions.push_back(mySubscriptionInfo);
+        mSubscriptionCountChanged.notify_all();
+        updatePushedMatchersLocked();
+        VLOG("ShellSubscriber: new subscription, %zu active", mSubscriptions.size());
+        if (!pulled.empty()) {
+            appendPendingAtomLocked(*mySubscriptionInfo, pulled);
+        }
+        spawnHelperThread(mySubscriptionInfo);
+        waitForSubscriptionToEndLocked(mySubscriptionInfo, lock, timeoutSec);
 
-        if (mSubscriptionInfo == mySubscriptionInfo) {
-            mSubscriptionInfo = nullptr;
+        if (!mySubscriptionInfo->mEnded) {
+            endSubscriptionLocked(mySubscriptionInfo);
         }
+    }
+    unregisterPullReceivers(*mySubscriptionInfo);
+}
+
+bool ShellSubscriber::waitForSubscriptionCount(size_t count, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mSubscriptionCountChanged.wait_for(
+            lock, timeout, [this, count] { return mSubscriptions.size() == count; });
+}
 
+void ShellSubscriber::endSubscriptionLocked(const shared_ptr<SubscriptionInfo>& info) {
+    info->mEnded = true;
+    info->mPendingData.clear();
+    mSubscriptions.remove(info);
+    mSubscriptionCountChanged.notify_all();
+    updatePushedMatchersLocked();
+    info->mHelperShouldWake.notify_one();
+    mSubscriptionShouldEnd.notify_all();
+}
+
+void ShellSubscriber::updatePushedMatchersLocked() {
+    mPushedMatchers.clear();
+    // The serialized matchers of mPushedMatchers, with their indices.
+    std::unordered_map<string, size_t> matcherIndices;
+    LogEventFilter::AtomIdSet atomIds;
+    LogEventFilter::AtomIdSet rawAtomIds;
+    for (const auto& info : mSubscriptions) {
+        for (const auto& matcher : info->mPushedMatchers) {
+            vector<PushedMatcher>& atomMatchers = mPushedMatchers[matcher.atom_id()];
+            const auto [it, inserted] =
+                    matcherIndices.emplace(matcher.SerializeAsString(), atomMatchers.size());
+            if (inserted) {
+                atomMatchers.push_back({matcher, {}});
+            }
+            atomMatchers[it->second].mSubscriptions.push_back(info.get());
+            atomIds.insert(matcher.atom_id());
+            if (info->mRawPushedAtoms) {
+                rawAtomIds.insert(matcher.atom_id());
+            }
+        }
+    }
+    if (mLogEventFilter != nullptr) {
+        mLogEventFilter->setAtomIds(std::move(atomIds), this);
     }
+    // The events parsed before keep being sent as Atoms.
+    LogEvent::setRawBufferAtomIds(std::move(rawAtomIds), this);
 }
 
-void ShellSubscriber::spawnHelperThread(int myToken) {
-    std::thread t([this, myToken] { pullAndSendHeartbeats(myToken); });
+void ShellSubscriber::spawnHelperThread(shared_ptr<SubscriptionInfo> myInfo) {
+    std::thread t([this, myInfo] { sendDataAndHeartbeats(myInfo); });
     t.detach();
 }
 
 void ShellSubscriber::waitForSubscriptionToEndLocked(shared_ptr<SubscriptionInfo> myInfo,
-                                                     int myToken,
                                                      std::unique_lock<std::mutex>& lock,
                                                      int timeoutSec) {
     if (timeoutSec > 0) {
-        mSubscriptionShouldEnd.wait_for(lock, timeoutSec * 1s, [this, myToken, &myInfo] {
-            return mToken != myToken || !myInfo->mClientAlive;
+        mSubscriptionShouldEnd.wait_for(lock, timeoutSec * 1s, [&myInfo] {
+            return myInfo->mEnded || !myInfo->mClientAlive;
         });
     } else {
-        mSubscriptionShouldEnd.wait(lock, [this, myToken, &myInfo] {
-            return mToken != myToken || !myInfo->mClientAlive;
+        mSubscriptionShouldEnd.wait(lock, [&myInfo] {
+            return myInfo->mEnded || !myInfo->mClientAlive;
         });
     }
 }
 
-// Atomically claim the next token. Token numbers denote subscriber ordering.
-int ShellSubscriber::claimToken() {
-    std::unique_lock<std::mutex> lock(mMutex);
-    int myToken = ++mToken;
-    return myToken;
-}
-
 // Read and parse single config. There should only one config per input.
 bool ShellSubscriber::readConfig(shared_ptr<SubscriptionInfo> subscriptionInfo) {
     // Read the size of the config.
@@ -103,6 +189,7 @@ bool ShellSubscriber::readConfig(shared_ptr<SubscriptionInfo> subscriptionInfo)
     for (const auto& pushed : config.pushed()) {
         subscriptionInfo->mPushedMatchers.push_back(pushed);
     }
+    subscriptionInfo->mRawPushedAtoms = config.raw_pushed_atoms();
 
     for (const auto& pulled : config.pulled()) {
         vector<string> packages;
@@ -124,58 +211,142 @@ bool ShellSubscriber::readConfig(shared_ptr<SubscriptionInfo> subscriptionInfo)
     return true;
 }
 
-void ShellSubscriber::pullAndSendHeartbeats(int myToken) {
-    VLOG("ShellSubscriber: helper thread %d starting", myToken);
+void ShellSubscriber::sendDataAndHeartbeats(shared_ptr<SubscriptionInfo> myInfo) {
+    VLOG("ShellSubscriber: helper thread starting");
+    ScopedThreadRole role(ThreadRole::BACKGROUND);
+    SubscriptionInfo& info = *myInfo;
+    std::unique_lock<std::mutex> lock(mMutex);
     while (true) {
-        int64_t sleepTimeMs = INT_MAX;
-        {
-            std::lock_guard<std::mutex> lock(mMutex);
-            if (!mSubscriptionInfo || mToken != myToken) {
-                VLOG("ShellSubscriber: helper thread %d done!", myToken);
+        if (info.mEnded || !info.mClientAlive) {
+            VLOG("ShellSubscriber: helper thread done!");
+            return;
+        }
+
+        int64_t nowMillis = getElapsedRealtimeMillis();
+        string pending;
+        const size_t pendingBytes = info.mPendingData.size();
+        if (pendingBytes > 0 && (pendingBytes >= kMaxPendingBytes ||
+                                 nowMillis - info.mFirstPendingMs >= kMaxPendingMs)) {
+            pending.swap(info.mPendingData);
+        }
+
+        // Send a heartbeat, consisting of a data size of 0, if perfd hasn't recently received
+        // data from statsd. When it receives the data size of 0, perfd will not expect any
+        // atoms and recheck whether the subscription should end.
+        if (!pending.empty() || nowMillis - info.mLastWriteMs > kMsBetweenHeartbeats) {
+            // A slow client only delays this thread.
+            lock.unlock();
+            const bool written = writeShellData(info.mOutputFd, pending);
+            lock.lock();
+            if (!written) {
+                // The read end of the pipe has closed, signals to other threads that the
+                // subscription should end.
+                info.mClientAlive = false;
+                mSubscriptionShouldEnd.notify_all();
+                VLOG("ShellSubscriber: helper thread done!");
                 return;
             }
+            info.mLastWriteMs = getElapsedRealtimeMillis();
+            // More atoms may be pending already.
+            continue;
+        }
 
-            int64_t nowMillis = getElapsedRealtimeMillis();
-            int64_t nowNanos = getElapsedRealtimeNs();
-            for (PullInfo& pullInfo : mSubscriptionInfo->mPulledInfo) {
-                if (pullInfo.mPrevPullElapsedRealtimeMs + pullInfo.mInterval >= nowMillis) {
-                    continue;
-                }
+        // Determine how long to sleep before doing more work.
+        int64_t sleepTimeMs = (info.mLastWriteMs + kMsBetweenHeartbeats) - nowMillis;
+        const bool hasPending = !info.mPendingData.empty();
+        if (hasPending) {
+            sleepTimeMs = std::min(sleepTimeMs, info.mFirstPendingMs + kMaxPendingMs - nowMillis);
+        }
+        sleepTimeMs = std::max(sleepTimeMs, (int64_t)0);
 
-                vector<int32_t> uids;
-                getUidsForPullAtom(&uids, pullInfo);
+        VLOG("ShellSubscriber: helper thread sleeping for %lld ms", (long long)sleepTimeMs);
+        info.mHelperShouldWake.wait_for(lock, std::chrono::milliseconds(sleepTimeMs), [&] {
+            const size_t bytes = info.mPendingData.size();
+            return info.mEnded || bytes >= kMaxPendingBytes || (!hasPending && bytes > 0);
+        });
+    }
+}
 
-                vector<std::shared_ptr<LogEvent>> data;
-                mPullerMgr->Pull(pullInfo.mPullerMatcher.atom_id(), uids, nowNanos, &data);
-                VLOG("Pulled %zu atoms with id %d", data.size(), pullInfo.mPullerMatcher.atom_id());
-                writePulledAtomsLocked(data, pullInfo.mPullerMatcher);
+string ShellSubscriber::pullAtoms(const SubscriptionInfo& info, int64_t nowNs) {
+    ProtoOutputStream proto;
+    for (const PullInfo& pullInfo : info.mPulledInfo) {
+        vector<int32_t> uids;
+        getUidsForPullAtom(&uids, pullInfo);
 
-                pullInfo.mPrevPullElapsedRealtimeMs = nowMillis;
-            }
+        vector<std::shared_ptr<LogEvent>> data;
+        mPullerMgr->Pull(pullInfo.mPullerMatcher.atom_id(), uids, nowNs, &data);
+        VLOG("Pulled %zu atoms with id %d", data.size(), pullInfo.mPullerMatcher.atom_id());
+        writePulledAtoms(data, pullInfo.mPullerMatcher, proto);
+    }
 
-            // Send a heartbeat, consisting of a data size of 0, if perfd hasn't recently received
-            // data from statsd. When it receives the data size of 0, perfd will not expect any
-            // atoms and recheck whether the subscription should end.
-            if (nowMillis - mLastWriteMs > kMsBetweenHeartbeats) {
-                attemptWriteToPipeLocked(/*dataSize=*/0);
-            }
+    string pulled;
+    if (proto.bytesWritten() > 0) {
+        proto.serializeToString(&pulled);
+    }
+    return pulled;
+}
 
-            // Determine how long to sleep before doing more work.
-            for (PullInfo& pullInfo : mSubscriptionInfo->mPulledInfo) {
-                int64_t nextPullTime = pullInfo.mPrevPullElapsedRealtimeMs + pullInfo.mInterval;
-                int64_t timeBeforePull = nextPullTime - nowMillis; // guaranteed to be non-negative
-                if (timeBeforePull < sleepTimeMs) sleepTimeMs = timeBeforePull;
-            }
-            int64_t timeBeforeHeartbeat = (mLastWriteMs + kMsBetweenHeartbeats) - nowMillis;
-            if (timeBeforeHeartbeat < sleepTimeMs) sleepTimeMs = timeBeforeHeartbeat;
-        }
+void ShellSubscriber::registerPullReceivers(const shared_ptr<SubscriptionInfo>& info,
+                                            int64_t nowNs) {
+    for (size_t i = 0; i < info->mPulledInfo.size(); i++) {
+        const PullInfo& pullInfo = info->mPulledInfo[i];
+        const ConfigKey configKey(AID_STATSD, ++mLastPullConfigId);
+        sp<PullReceiver> receiver = new PullReceiver(this, info, i, configKey);
+        info->mPullReceivers.push_back(receiver);
+
+        const int64_t intervalNs = pullInfo.mInterval * NS_PER_SEC / 1000;
+        mPullerMgr->RegisterPullUidProvider(configKey, receiver);
+        mPullerMgr->RegisterReceiver(pullInfo.mPullerMatcher.atom_id(), configKey, receiver,
+                                     nowNs + intervalNs, intervalNs);
+    }
+}
 
-        VLOG("ShellSubscriber: helper thread %d sleeping for %lld ms", myToken,
-             (long long)sleepTimeMs);
-        std::this_thread::sleep_for(std::chrono::milliseconds(sleepTimeMs));
+void ShellSubscriber::unregisterPullReceivers(const SubscriptionInfo& info) {
+    for (size_t i = 0; i < info.mPullReceivers.size(); i++) {
+        const sp<PullReceiver>& receiver = info.mPullReceivers[i];
+        mPullerMgr->UnRegisterReceiver(info.mPulledInfo[i].mPullerMatcher.atom_id(),
+                                       receiver->getConfigKey(), receiver);
+        mPullerMgr->UnregisterPullUidProvider(receiver->getConfigKey(), receiver);
     }
 }
 
+void ShellSubscriber::onPulledData(SubscriptionInfo& info, size_t pullIndex,
+                                   const vector<std::shared_ptr<LogEvent>>& data) {
+    // Encoded without holding mMutex, the PullInfos are not modified once registered.
+    ProtoOutputStream proto;
+    writePulledAtoms(data, info.mPulledInfo[pullIndex].mPullerMatcher, proto);
+    if (proto.bytesWritten() == 0) {
+        return;
+    }
+    string pulled;
+    proto.serializeToString(&pulled);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!info.mEnded) {
+        appendPendingAtomLocked(info, pulled);
+    }
+}
+
+void ShellSubscriber::PullReceiver::onDataPulled(const vector<std::shared_ptr<LogEvent>>& data,
+                                                 bool pullSuccess, int64_t originalPullTimeNs) {
+    sp<ShellSubscriber> subscriber = mSubscriber.promote();
+    shared_ptr<SubscriptionInfo> info = mInfo.lock();
+    if (!pullSuccess || subscriber == nullptr || info == nullptr) {
+        return;
+    }
+    subscriber->onPulledData(*info, mPullIndex, data);
+}
+
+vector<int32_t> ShellSubscriber::PullReceiver::getPullAtomUids(int32_t atomId) {
+    vector<int32_t> uids;
+    sp<ShellSubscriber> subscriber = mSubscriber.promote();
+    shared_ptr<SubscriptionInfo> info = mInfo.lock();
+    if (subscriber != nullptr && info != nullptr) {
+        subscriber->getUidsForPullAtom(&uids, info->mPulledInfo[mPullIndex]);
+    }
+    return uids;
+}
+
 void ShellSubscriber::getUidsForPullAtom(vector<int32_t>* uids, const PullInfo& pullInfo) {
     uids->insert(uids->end(), pullInfo.mPullUids.begin(), pullInfo.mPullUids.end());
     // This is slow. Consider storing the uids per app and listening to uidmap updates.
@@ -186,58 +357,65 @@ void ShellSubscriber::getUidsForPullAtom(vector<int32_t>* uids, const PullInfo&
     uids->push_back(DEFAULT_PULL_UID);
 }
 
-void ShellSubscriber::writePulledAtomsLocked(const vector<std::shared_ptr<LogEvent>>& data,
-                                             const SimpleAtomMatcher& matcher) {
-    mProto.clear();
-    int count = 0;
+void ShellSubscriber::writePulledAtoms(const vector<std::shared_ptr<LogEvent>>& data,
+                                       const SimpleAtomMatcher& matcher, ProtoOutputStream& proto) {
     for (const auto& event : data) {
         if (matchesSimple(mUidMap, matcher, *event)) {
-            count++;
-            uint64_t atomToken = mProto.start(util::FIELD_TYPE_MESSAGE |
-                                              util::FIELD_COUNT_REPEATED | FIELD_ID_ATOM);
-            event->ToProto(mProto);
-            mProto.end(atomToken);
+            uint64_t atomToken = proto.start(util::FIELD_TYPE_MESSAGE |
+                                             util::FIELD_COUNT_REPEATED | FIELD_ID_ATOM);
+            event->ToProto(proto);
+            proto.end(atomToken);
         }
     }
-
-    if (count > 0) attemptWriteToPipeLocked(mProto.size());
 }
 
 void ShellSubscriber::onLogEvent(const LogEvent& event) {
     std::lock_guard<std::mutex> lock(mMutex);
-    if (!mSubscriptionInfo) return;
-
-    mProto.clear();
-    for (const auto& matcher : mSubscriptionInfo->mPushedMatchers) {
-        if (matchesSimple(mUidMap, matcher, event)) {
-            uint64_t atomToken = mProto.start(util::FIELD_TYPE_MESSAGE |
-                                              util::FIELD_COUNT_REPEATED | FIELD_ID_ATOM);
-            event.ToProto(mProto);
-            mProto.end(atomToken);
-            attemptWriteToPipeLocked(mProto.size());
+    const auto it = mPushedMatchers.find(event.GetTagId());
+    if (it == mPushedMatchers.end()) return;
+
+    // The atom is encoded once, for all the subscriptions it matched.
+    string encodedAtom;
+    string encodedRawAtom;
+    const sp<const ValuePayload>& rawBuffer = event.getRawBuffer();
+    for (const PushedMatcher& pushedMatcher : it->second) {
+        if (!matchesSimple(mUidMap, pushedMatcher.mMatcher, event)) {
+            continue;
+        }
+        for (SubscriptionInfo* info : pushedMatcher.mSubscriptions) {
+            if (info->mRawPushedAtoms && rawBuffer != nullptr) {
+                if (encodedRawAtom.empty()) {
+                    encodeRawAtom(event, *rawBuffer, &encodedRawAtom);
+                }
+                appendPendingAtomLocked(*info, encodedRawAtom);
+                continue;
+            }
+            if (encodedAtom.empty()) {
+                ProtoOutputStream proto;
+                uint64_t atomToken =
+                        proto.start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_ATOM);
+                event.ToProto(proto);
+                proto.end(atomToken);
+                proto.serializeToString(&encodedAtom);
+            }
+            appendPendingAtomLocked(*info, encodedAtom);
         }
     }
 }
 
-// Tries to write the atom encoded in mProto to the pipe. If the write fails
-// because the read end of the pipe has closed, signals to other threads that
-// the subscription should end.
-void ShellSubscriber::attemptWriteToPipeLocked(size_t dataSize) {
-    // First, write the payload size.
-    if (!android::base::WriteFully(mSubscriptionInfo->mOutputFd, &dataSize, sizeof(dataSize))) {
-        mSubscriptionInfo->mClientAlive = false;
-        mSubscriptionShouldEnd.notify_one();
-        return;
-    }
-
-    // Then, write the payload if this is not just a heartbeat.
-    if (dataSize > 0 && !mProto.flush(mSubscriptionInfo->mOutputFd)) {
-        mSubscriptionInfo->mClientAlive = false;
-        mSubscriptionShouldEnd.notify_one();
-        return;
+void ShellSubscriber::appendPendingAtomLocked(SubscriptionInfo& info, const string& encodedAtom) {
+    const size_t pendingBytes = info.mPendingData.size();
+    // The atoms are repeated fields of a ShellData, so their encodings are concatenated.
+    info.mPendingData.append(encodedAtom);
+
+    // The helper thread writes the atoms, it only needs to be woken up to schedule a new batch
+    // or to write a full one.
+    if (pendingBytes == 0) {
+        info.mFirstPendingMs = getElapsedRealtimeMillis();
+        info.mHelperShouldWake.notify_one();
+    } else if (pendingBytes < kMaxPendingBytes && info.mPendingData.size() >= kMaxPendingBytes) {
+        info.mHelperShouldWake.notify_one();
     }
-
-    mLastWriteMs = getElapsedRealtimeMillis();
 }
 
 }  // namespace statsd
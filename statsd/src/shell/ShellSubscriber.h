@@ -19,15 +19,22 @@
 #include <android/util/ProtoOutputStream.h>
 #include <private/android_filesystem_config.h>
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <list>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
 
+#include "external/PullDataReceiver.h"
+#include "external/PullUidProvider.h"
 #include "external/StatsPullerManager.h"
 #include "src/shell/shell_config.pb.h"
 #include "src/statsd_config.pb.h"
 #include "logd/LogEvent.h"
 #include "packages/UidMap.h"
+#include "socket/LogEventFilter.h"
 
 namespace android {
 namespace os {
@@ -42,47 +49,88 @@ namespace statsd {
  * Shell clients do not subscribe aggregated metrics, as they are responsible for doing the
  * aggregation after receiving the atom events.
  *
- * Shell clients pass ShellSubscription in the proto binary format. Clients can update the
- * subscription by sending a new subscription. The new subscription would replace the old one.
+ * Shell clients pass ShellSubscription in the proto binary format. Each subscription runs
+ * independently of the others, with its own pipes.
  * Input data stream format is:
  *
  * |size_t|subscription proto|size_t|subscription proto|....
  *
  * statsd sends the events back in Atom proto binary format. Each Atom message is preceded
- * with sizeof(size_t) bytes indicating the size of the proto message payload.
+ * with sizeof(size_t) bytes indicating the size of the proto message payload. The matched pushed
+ * atoms are buffered and sent in batches, at least every kMaxPendingMs, by a helper thread of the
+ * subscription, so that a slow client does not block the processing of the events.
  *
  * The stream would be in the following format:
  * |size_t|shellData proto|size_t|shellData proto|....
  *
- * Only one shell subscriber is allowed at a time because each shell subscriber blocks one thread
- * until it exits.
+ * Up to kMaxSubscriptions subscriptions can be active at a time, because each shell subscriber
+ * blocks one thread until it exits. A new subscription beyond that ends the oldest one. A pushed
+ * atom is matched once by each distinct matcher of the subscriptions, and encoded once for all
+ * the subscriptions it matched.
+ *
+ * The pulled atoms are pulled once when the subscription starts, then on the schedule of
+ * StatsPullerManager, as the receivers of a config key of their own, so that they share the pulls
+ * and the puller caches with the configs. Their interval is rounded like the ones of the configs.
+ *
+ * With ShellSubscription.raw_pushed_atoms, the pushed atoms are forwarded in the encoding they
+ * were logged with instead of being encoded as Atoms, see LogEvent::setRawBufferAtomIds().
  */
 class ShellSubscriber : public virtual RefBase {
 public:
-    ShellSubscriber(sp<UidMap> uidMap, sp<StatsPullerManager> pullerMgr)
-        : mUidMap(uidMap), mPullerMgr(pullerMgr){};
+    ShellSubscriber(sp<UidMap> uidMap, sp<StatsPullerManager> pullerMgr,
+                    std::shared_ptr<LogEventFilter> logEventFilter = nullptr)
+        : mUidMap(uidMap), mPullerMgr(pullerMgr), mLogEventFilter(logEventFilter){};
 
     void startNewSubscription(int inFd, int outFd, int timeoutSec);
 
     void onLogEvent(const LogEvent& event);
 
+    // For testing: waits until [count] subscriptions are active. Returns false on timeout.
+    bool waitForSubscriptionCount(size_t count, std::chrono::milliseconds timeout);
+
 private:
     struct PullInfo {
         PullInfo(const SimpleAtomMatcher& matcher, int64_t interval,
                  const std::vector<std::string>& packages, const std::vector<int32_t>& uids)
             : mPullerMatcher(matcher),
               mInterval(interval),
-              mPrevPullElapsedRealtimeMs(0),
               mPullPackages(packages),
               mPullUids(uids) {
         }
         SimpleAtomMatcher mPullerMatcher;
         int64_t mInterval;
-        int64_t mPrevPullElapsedRealtimeMs;
         std::vector<std::string> mPullPackages;
         std::vector<int32_t> mPullUids;
     };
 
+    struct SubscriptionInfo;
+
+    // Receives the scheduled pulls of a PullInfo from mPullerMgr. It is also the pull uid
+    // provider of its config key, so that the pulls are from the uids of the PullInfo.
+    class PullReceiver : public PullDataReceiver, public PullUidProvider {
+    public:
+        PullReceiver(wp<ShellSubscriber> subscriber, std::weak_ptr<SubscriptionInfo> info,
+                     size_t pullIndex, const ConfigKey& configKey)
+            : mSubscriber(subscriber), mInfo(info), mPullIndex(pullIndex), mConfigKey(configKey) {
+        }
+
+        void onDataPulled(const std::vector<std::shared_ptr<LogEvent>>& data, bool pullSuccess,
+                          int64_t originalPullTimeNs) override;
+
+        vector<int32_t> getPullAtomUids(int32_t atomId) override;
+
+        const ConfigKey& getConfigKey() const {
+            return mConfigKey;
+        }
+
+    private:
+        const wp<ShellSubscriber> mSubscriber;
+        const std::weak_ptr<SubscriptionInfo> mInfo;
+        // Index of the PullInfo in SubscriptionInfo::mPulledInfo.
+        const size_t mPullIndex;
+        const ConfigKey mConfigKey;
+    };
+
     struct SubscriptionInfo {
         SubscriptionInfo(const int& inputFd, const int& outputFd)
             : mInputFd(inputFd), mOutputFd(outputFd), mClientAlive(true) {
@@ -92,53 +140,113 @@ private:
         int mOutputFd;
         std::vector<SimpleAtomMatcher> mPushedMatchers;
         std::vector<PullInfo> mPulledInfo;
+        // The receivers of mPulledInfo, in the same order.
+        std::vector<sp<PullReceiver>> mPullReceivers;
         bool mClientAlive;
+
+        // See ShellSubscription.raw_pushed_atoms.
+        bool mRawPushedAtoms = false;
+
+        // Set once the subscription was replaced by a newer one.
+        bool mEnded = false;
+
+        // The encoded atoms of a ShellData not yet written, and when the first of them was added.
+        std::string mPendingData;
+        int64_t mFirstPendingMs = 0;
+
+        // Tracks when we last send data to perfd. We need that time to determine
+        // when next to send a heartbeat.
+        int64_t mLastWriteMs = 0;
+
+        // Wakes up the helper thread when there are new pending atoms to schedule or to write,
+        // or when the subscription ended.
+        std::condition_variable mHelperShouldWake;
     };
 
-    int claimToken();
+    // A distinct pushed atom matcher, and the subscriptions that have it, once per occurrence.
+    struct PushedMatcher {
+        SimpleAtomMatcher mMatcher;
+        std::vector<SubscriptionInfo*> mSubscriptions;
+    };
 
     bool readConfig(std::shared_ptr<SubscriptionInfo> subscriptionInfo);
 
-    void spawnHelperThread(int myToken);
+    void spawnHelperThread(std::shared_ptr<SubscriptionInfo> myInfo);
 
     void waitForSubscriptionToEndLocked(std::shared_ptr<SubscriptionInfo> myInfo,
-                                        int myToken,
                                         std::unique_lock<std::mutex>& lock,
                                         int timeoutSec);
 
-    // Helper thread that pulls atoms at a regular frequency and sends
-    // heartbeats to perfd if statsd hasn't recently sent any data. Statsd must
-    // send heartbeats for perfd to escape a blocking read call and recheck if
-    // the user has terminated the subscription.
-    void pullAndSendHeartbeats(int myToken);
+    // Helper thread that writes the pending atoms and sends heartbeats to
+    // perfd if statsd hasn't recently sent any data. Statsd must send
+    // heartbeats for perfd to escape a blocking read call and recheck if the
+    // user has terminated the subscription. Only this thread writes to the
+    // pipe of the subscription, without holding mMutex.
+    void sendDataAndHeartbeats(std::shared_ptr<SubscriptionInfo> myInfo);
+
+    // Pulls all the atoms of [info] and returns them as a serialized ShellData, or an empty
+    // string if none matched. Must not be called with mMutex held.
+    std::string pullAtoms(const SubscriptionInfo& info, int64_t nowNs);
+
+    // Registers the pulled atoms of [info] in mPullerMgr, from [nowNs]. Must not be called with
+    // mMutex held, mPullerMgr may call the receivers with its lock held.
+    void registerPullReceivers(const std::shared_ptr<SubscriptionInfo>& info, int64_t nowNs);
+
+    void unregisterPullReceivers(const SubscriptionInfo& info);
 
-    void writePulledAtomsLocked(const vector<std::shared_ptr<LogEvent>>& data,
-                                const SimpleAtomMatcher& matcher);
+    // Adds the atoms of [data] matching the [pullIndex]th PullInfo of [info] to its pending
+    // atoms.
+    void onPulledData(SubscriptionInfo& info, size_t pullIndex,
+                      const std::vector<std::shared_ptr<LogEvent>>& data);
+
+    void writePulledAtoms(const vector<std::shared_ptr<LogEvent>>& data,
+                          const SimpleAtomMatcher& matcher,
+                          android::util::ProtoOutputStream& proto);
 
     void getUidsForPullAtom(vector<int32_t>* uids, const PullInfo& pullInfo);
 
-    void attemptWriteToPipeLocked(size_t dataSize);
+    // Adds [encodedAtom] to the pending atoms of [info].
+    void appendPendingAtomLocked(SubscriptionInfo& info, const std::string& encodedAtom);
+
+    // Ends [info] and removes it from mSubscriptions.
+    void endSubscriptionLocked(const std::shared_ptr<SubscriptionInfo>& info);
+
+    // Rebuilds mPushedMatchers and registers the pushed atoms of the subscriptions in
+    // mLogEventFilter.
+    void updatePushedMatchersLocked();
 
     sp<UidMap> mUidMap;
 
     sp<StatsPullerManager> mPullerMgr;
 
-    android::util::ProtoOutputStream mProto;
+    // Filter of the atoms to be processed by the socket listener. May be null.
+    std::shared_ptr<LogEventFilter> mLogEventFilter;
 
     mutable std::mutex mMutex;
 
     std::condition_variable mSubscriptionShouldEnd;
 
-    std::shared_ptr<SubscriptionInfo> mSubscriptionInfo = nullptr;
+    // Signaled when a subscription is added to or removed from mSubscriptions.
+    std::condition_variable mSubscriptionCountChanged;
+
+    // The active subscriptions, from the oldest.
+    std::list<std::shared_ptr<SubscriptionInfo>> mSubscriptions;
 
-    int mToken = 0;
+    // The id of the config key of the last PullReceiver.
+    std::atomic<int64_t> mLastPullConfigId{0};
+
+    // The distinct pushed matchers of mSubscriptions, by atom id.
+    std::unordered_map<int, std::vector<PushedMatcher>> mPushedMatchers;
 
     const int32_t DEFAULT_PULL_UID = AID_SYSTEM;
 
-    // Tracks when we last send data to perfd. We need that time to determine
-    // when next to send a heartbeat.
-    int64_t mLastWriteMs = 0;
     const int64_t kMsBetweenHeartbeats = 1000;
+
+    // The pending atoms are written once they reach kMaxPendingBytes or kMaxPendingMs.
+    const size_t kMaxPendingBytes = 16 * 1024;
+    const int64_t kMaxPendingMs = 100;
+
+    const size_t kMaxSubscriptions = 4;
 };
 
 }  // namespace statsd
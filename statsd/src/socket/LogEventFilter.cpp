@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "LogEventFilter.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+void LogEventFilter::setAtomIds(AtomIdSet atomIds, const void* consumer) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (atomIds.empty()) {
+        mConsumerAtomIds.erase(consumer);
+    } else {
+        mConsumerAtomIds[consumer] = std::move(atomIds);
+    }
+    updateBitmapLocked();
+    updateHasConsumersLocked();
+}
+
+void LogEventFilter::setFilteringEnabled(bool isEnabled) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFilteringEnabled = isEnabled;
+    updateEnabledLocked();
+}
+
+void LogEventFilter::setAllAtomsInUse(bool allAtomsInUse, const void* consumer) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (allAtomsInUse) {
+        mAllAtomsConsumers.insert(consumer);
+    } else {
+        mAllAtomsConsumers.erase(consumer);
+    }
+    updateEnabledLocked();
+    updateHasConsumersLocked();
+}
+
+void LogEventFilter::updateEnabledLocked() {
+    mEnabled.store(mFilteringEnabled && mAllAtomsConsumers.empty(), std::memory_order_relaxed);
+}
+
+void LogEventFilter::updateHasConsumersLocked() {
+    mHasConsumers.store(!mConsumerAtomIds.empty() || !mAllAtomsConsumers.empty(),
+                        std::memory_order_relaxed);
+}
+
+void LogEventFilter::updateBitmapLocked() {
+    std::array<uint64_t, kMaxFilteredAtomId / kBitsPerWord> bitmap{};
+    for (const auto& [consumer, atomIds] : mConsumerAtomIds) {
+        for (const int atomId : atomIds) {
+            if (atomId >= 0 && atomId < kMaxFilteredAtomId) {
+                bitmap[atomId / kBitsPerWord] |= uint64_t(1) << (atomId % kBitsPerWord);
+            }
+        }
+    }
+    for (size_t i = 0; i < bitmap.size(); i++) {
+        if (mBitmap[i].load(std::memory_order_relaxed) != bitmap[i]) {
+            mBitmap[i].store(bitmap[i], std::memory_order_relaxed);
+        }
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Set of the atom ids that some consumer (config, state tracker or shell subscription) listens
+ * to, consulted by the socket listener right after reading the atom id so that the other atoms
+ * are dropped before a LogEvent is allocated.
+ *
+ * Lookups are lock free: the set is kept as a bitmap updated word by word. Updates are
+ * serialized and may be observed by a reader partially applied, which only delays when the
+ * reader sees a new consumer's atoms.
+ *
+ * Atom ids outside of the bitmap are always reported as in use. The filter is disabled when a
+ * consumer needs every atom, in which case all atoms are in use.
+ */
+class LogEventFilter {
+public:
+    typedef std::unordered_set<int> AtomIdSet;
+
+    // Atom ids at or above this value are not filtered.
+    static constexpr int kMaxFilteredAtomId = 1 << 18;
+
+    LogEventFilter() = default;
+
+    /**
+     * Returns true if the atom must be parsed.
+     */
+    inline bool isAtomInUse(int atomId) const {
+        if (!mEnabled.load(std::memory_order_relaxed) || atomId < 0 ||
+            atomId >= kMaxFilteredAtomId) {
+            return true;
+        }
+        const uint64_t word = mBitmap[atomId / kBitsPerWord].load(std::memory_order_relaxed);
+        return (word >> (atomId % kBitsPerWord)) & 1;
+    }
+
+    /**
+     * Returns true if a consumer registered atom ids or needs every atom.
+     */
+    inline bool hasConsumers() const {
+        return mHasConsumers.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Replaces the set of atom ids used by the consumer. An empty set unregisters the consumer.
+     */
+    void setAtomIds(AtomIdSet atomIds, const void* consumer);
+
+    /**
+     * Enables or disables the filtering. A disabled filter reports all atoms as in use.
+     */
+    void setFilteringEnabled(bool isEnabled);
+
+    /**
+     * Makes the filter report all atoms as in use while the consumer needs every atom, regardless
+     * of setFilteringEnabled().
+     */
+    void setAllAtomsInUse(bool allAtomsInUse, const void* consumer);
+
+private:
+    static constexpr int kBitsPerWord = 64;
+
+    void updateBitmapLocked();
+
+    void updateEnabledLocked();
+
+    void updateHasConsumersLocked();
+
+    std::mutex mMutex;
+
+    // Whether the atoms are filtered, see updateEnabledLocked().
+    std::atomic<bool> mEnabled{true};
+
+    // See hasConsumers().
+    std::atomic<bool> mHasConsumers{false};
+
+    // The last value passed to setFilteringEnabled(). Guarded by mMutex.
+    bool mFilteringEnabled = true;
+
+    // The consumers that need every atom. Guarded by mMutex.
+    std::unordered_set<const void*> mAllAtomsConsumers;
+
+    // Atom ids in use, per consumer. Guarded by mMutex.
+    std::unordered_map<const void*, AtomIdSet> mConsumerAtomIds;
+
+    // Union of mConsumerAtomIds.
+    std::array<std::atomic<uint64_t>, kMaxFilteredAtomId / kBitsPerWord> mBitmap{};
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "socket/SharedMemoryRing.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using android::base::unique_fd;
+using std::unique_ptr;
+
+unique_ptr<SharedMemoryRing> SharedMemoryRing::map(unique_fd ringFd, unique_fd wakeFd,
+                                                   int32_t uid, int32_t pid) {
+    // Without the seals, the client could shrink the memory under statsd.
+    const int seals = fcntl(ringFd.get(), F_GET_SEALS);
+    if (seals < 0 || (seals & F_SEAL_SHRINK) == 0) {
+        ALOGE("The ring of uid %d is not a sealed memfd", uid);
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(ringFd.get(), &st) != 0 || st.st_size <= STATS_RING_HEADER_SIZE) {
+        ALOGE("Failed to read the size of the ring of uid %d", uid);
+        return nullptr;
+    }
+    const size_t size = st.st_size;
+    const size_t capacity = size - STATS_RING_HEADER_SIZE;
+    if (capacity < STATS_RING_MIN_CAPACITY || capacity > STATS_RING_MAX_CAPACITY ||
+        (capacity & (capacity - 1)) != 0) {
+        ALOGE("The ring of uid %d has an invalid capacity of %zu bytes", uid, capacity);
+        return nullptr;
+    }
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, ringFd.get(), 0);
+    if (memory == MAP_FAILED) {
+        ALOGE("Failed to map the ring of uid %d: %s", uid, strerror(errno));
+        return nullptr;
+    }
+    const stats_ring_header* header = static_cast<const stats_ring_header*>(memory);
+    if (header->magic != STATS_RING_MAGIC || header->version != STATS_RING_VERSION ||
+        header->capacity != capacity) {
+        ALOGE("The ring of uid %d has an invalid header", uid);
+        munmap(memory, size);
+        return nullptr;
+    }
+    return unique_ptr<SharedMemoryRing>(
+            new SharedMemoryRing(std::move(wakeFd), memory, size, uid, pid));
+}
+
+SharedMemoryRing::SharedMemoryRing(unique_fd wakeFd, void* memory, size_t size, int32_t uid,
+                                   int32_t pid)
+    : mWakeFd(std::move(wakeFd)),
+      mMemory(memory),
+      mSize(size),
+      mHeader(static_cast<stats_ring_header*>(memory)),
+      mData(static_cast<uint8_t*>(memory) + STATS_RING_HEADER_SIZE),
+      mCapacity(size - STATS_RING_HEADER_SIZE),
+      mUid(uid),
+      mPid(pid),
+      mAtomBuffer(STATS_RING_MAX_ATOM_BYTES) {
+    // Resumes where a previous reader of the ring stopped, if any.
+    mReadPos = __atomic_load_n(&mHeader->readPos, __ATOMIC_ACQUIRE) & ~(uint64_t)3;
+}
+
+SharedMemoryRing::~SharedMemoryRing() {
+    munmap(mMemory, mSize);
+}
+
+uint32_t SharedMemoryRing::loadRecordWord() const {
+    return __atomic_load_n(reinterpret_cast<uint32_t*>(mData + (mReadPos & (mCapacity - 1))),
+                           __ATOMIC_SEQ_CST);
+}
+
+bool SharedMemoryRing::read(size_t maxAtoms,
+                            const std::function<void(uint8_t* atom, size_t size)>& onAtom) {
+    for (size_t count = 0; count < maxAtoms;) {
+        const uint32_t word = loadRecordWord();
+        if ((word & STATS_RING_COMMITTED) == 0) {
+            break;
+        }
+        const uint64_t offset = mReadPos & (mCapacity - 1);
+        uint64_t recordSize;
+        if (word & STATS_RING_PADDING) {
+            recordSize = mCapacity - offset;
+        } else {
+            const size_t size = word & STATS_RING_LENGTH_MASK;
+            recordSize = sizeof(uint32_t) + ((size + 3) & ~(uint64_t)3);
+            if (size > STATS_RING_MAX_ATOM_BYTES || offset + recordSize > mCapacity) {
+                ALOGE("Invalid record of %zu bytes in the ring of uid %d", size, mUid);
+                return false;
+            }
+            memcpy(mAtomBuffer.data(), mData + offset + sizeof(uint32_t), size);
+            onAtom(mAtomBuffer.data(), size);
+            count++;
+        }
+        // The free space must stay zeroed for the writers.
+        memset(mData + offset, 0, recordSize);
+        mReadPos += recordSize;
+        __atomic_store_n(&mHeader->readPos, mReadPos, __ATOMIC_RELEASE);
+    }
+    return true;
+}
+
+bool SharedMemoryRing::prepareWait() {
+    __atomic_store_n(&mHeader->readerWaiting, 1, __ATOMIC_SEQ_CST);
+    if ((loadRecordWord() & STATS_RING_COMMITTED) != 0) {
+        __atomic_store_n(&mHeader->readerWaiting, 0, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
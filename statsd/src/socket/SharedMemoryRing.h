@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android-base/unique_fd.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "stats_ring.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * The statsd side of the shared memory ring of a client, see AStatsSocket_createRing(). The
+ * client may write anything to the memory at any time, so the records are copied before being
+ * decoded, and their lengths checked against the capacity mapped by statsd.
+ */
+class SharedMemoryRing {
+public:
+    /**
+     * Maps the ring in [ringFd]. Returns null if it is not a sealed memfd holding a ring.
+     */
+    static std::unique_ptr<SharedMemoryRing> map(android::base::unique_fd ringFd,
+                                                 android::base::unique_fd wakeFd, int32_t uid,
+                                                 int32_t pid);
+
+    ~SharedMemoryRing();
+
+    /**
+     * Calls [onAtom] with each atom committed since the last call, up to [maxAtoms], in the order
+     * they were reserved. Returns false if the ring holds an invalid record, after which it must
+     * no longer be read.
+     */
+    bool read(size_t maxAtoms, const std::function<void(uint8_t* atom, size_t size)>& onAtom);
+
+    /**
+     * Asks the writers to signal the wake eventfd on the next atom. Returns false if an atom is
+     * already there, in which case the ring should be read instead of waited for.
+     */
+    bool prepareWait();
+
+    int wakeFd() const {
+        return mWakeFd.get();
+    }
+
+    int32_t uid() const {
+        return mUid;
+    }
+
+    int32_t pid() const {
+        return mPid;
+    }
+
+private:
+    SharedMemoryRing(android::base::unique_fd wakeFd, void* memory, size_t size, int32_t uid,
+                     int32_t pid);
+
+    // Loads the first word of the record at mReadPos.
+    uint32_t loadRecordWord() const;
+
+    const android::base::unique_fd mWakeFd;
+
+    void* const mMemory;
+    const size_t mSize;
+    stats_ring_header* const mHeader;
+    uint8_t* const mData;
+    const uint64_t mCapacity;
+
+    const int32_t mUid;
+    const int32_t mPid;
+
+    // Local copy of the read position, which the client can't change.
+    uint64_t mReadPos = 0;
+
+    // Where each record is copied before it is decoded.
+    std::vector<uint8_t> mAtomBuffer;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
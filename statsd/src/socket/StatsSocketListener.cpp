@@ -17,50 +17,324 @@
 #include "Log.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdio.h>
+#include <string.h>
+#include <poll.h>
 #include <sys/cdefs.h>
+#include <sys/eventfd.h>
 #include <sys/prctl.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <unistd.h>
 
 #include <cutils/sockets.h>
 
+#include <algorithm>
+
 #include "StatsSocketListener.h"
 #include "guardrail/StatsdStats.h"
 #include "stats_log_util.h"
+#include "utils/ScopedTrace.h"
+#include "utils/ThreadTopology.h"
 
 namespace android {
 namespace os {
 namespace statsd {
 
-StatsSocketListener::StatsSocketListener(std::shared_ptr<LogEventQueue> queue)
-    : SocketListener(getLogSocket(), false /*start listen*/), mQueue(queue) {
+using android::base::unique_fd;
+using std::lock_guard;
+using std::mutex;
+using std::unique_ptr;
+
+namespace {
+
+// Room for the sender credentials and the SO_RXQ_OVFL drop counter.
+constexpr size_t kControlBufferSize =
+        CMSG_SPACE(sizeof(struct ucred)) + CMSG_SPACE(sizeof(uint32_t));
+
+}  // namespace
+
+struct StatsSocketListener::ReadSlot {
+    char buffer[kReadBufferSize];
+    alignas(4) char control[kControlBufferSize];
+    struct iovec iov;
+    // Slab buffer used instead of [buffer] in the deferred parse mode, when one is available.
+    LogEventBufferSlab::Buffer slabBuffer;
+};
+
+StatsSocketListener::StatsSocketListener(std::shared_ptr<LogEventQueue> queue,
+                                         size_t batchReadSize,
+                                         std::shared_ptr<LogEventPool> eventPool,
+                                         std::shared_ptr<LogEventBufferSlab> bufferSlab,
+                                         size_t maxReceiveBufferBytes,
+                                         std::shared_ptr<LogEventFilter> logEventFilter,
+                                         int socket)
+    : SocketListener(socket >= 0 ? socket : getLogSocket(), false /*start listen*/),
+      mQueue(queue),
+      mBatchReadSize(batchReadSize),
+      mEventPool(eventPool),
+      mBufferSlab(bufferSlab),
+      mLogEventFilter(logEventFilter),
+      mMaxReceiveBufferBytes(maxReceiveBufferBytes) {
+    if (mBufferSlab != nullptr && mBufferSlab->bufferSize() < kReadBufferSize) {
+        ALOGE("Slab buffers of %zu bytes are too small, deferred parsing disabled",
+              mBufferSlab->bufferSize());
+        mBufferSlab = nullptr;
+    }
+    if (mBatchReadSize > 1) {
+        mReadSlots = std::make_unique<ReadSlot[]>(mBatchReadSize);
+        mMsgHeaders.resize(mBatchReadSize);
+        for (size_t i = 0; i < mBatchReadSize; i++) {
+            ReadSlot& slot = mReadSlots[i];
+            slot.iov = {slot.buffer, sizeof(slot.buffer) - 1};
+            struct msghdr& hdr = mMsgHeaders[i].msg_hdr;
+            hdr.msg_name = nullptr;
+            hdr.msg_namelen = 0;
+            hdr.msg_iov = &slot.iov;
+            hdr.msg_iovlen = 1;
+            hdr.msg_control = slot.control;
+        }
+        mBatch.reserve(mBatchReadSize);
+    }
 }
 
 StatsSocketListener::~StatsSocketListener() {
+    if (mRingThread.joinable()) {
+        {
+            lock_guard<mutex> lock(mRingMutex);
+            mRingsStopped = true;
+        }
+        const uint64_t one = 1;
+        write(mRingControlFd.get(), &one, sizeof(one));
+        mRingThread.join();
+    }
+}
+
+bool StatsSocketListener::registerRing(unique_fd ringFd, unique_fd wakeFd, int32_t uid,
+                                       int32_t pid) {
+    RegisteredRing registeredRing;
+    registeredRing.ring = SharedMemoryRing::map(std::move(ringFd), std::move(wakeFd), uid, pid);
+    if (registeredRing.ring == nullptr) {
+        return false;
+    }
+    // Becomes readable when the client exits, so that its ring is released.
+    registeredRing.pidFd.reset(syscall(__NR_pidfd_open, pid, 0));
+    if (registeredRing.pidFd.get() < 0) {
+        ALOGE("Failed to open a pidfd for pid %d: %s", pid, strerror(errno));
+        return false;
+    }
+    lock_guard<mutex> lock(mRingMutex);
+    if (mRingsStopped) {
+        return false;
+    }
+    const std::pair<int32_t, int32_t> client(uid, pid);
+    if (mRingClients.find(client) == mRingClients.end() && mRingClients.size() >= kMaxRings) {
+        ALOGE("Too many shared memory rings, rejecting the one of uid %d pid %d", uid, pid);
+        return false;
+    }
+    if (!mRingThread.joinable()) {
+        mRingControlFd.reset(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+        if (mRingControlFd.get() < 0) {
+            ALOGE("Failed to create the ring control eventfd: %s", strerror(errno));
+            return false;
+        }
+        mRingThread = std::thread([this] { readRings(); });
+    }
+    mRingClients.insert(client);
+    mPendingRings.push_back(std::move(registeredRing));
+    const uint64_t one = 1;
+    write(mRingControlFd.get(), &one, sizeof(one));
+    ALOGI("Registered the shared memory ring of uid %d pid %d", uid, pid);
+    return true;
+}
+
+void StatsSocketListener::unregisterRing(int32_t uid, int32_t pid) {
+    lock_guard<mutex> lock(mRingMutex);
+    if (mRingClients.erase({uid, pid}) == 0) {
+        return;
+    }
+    mPendingRings.erase(std::remove_if(mPendingRings.begin(), mPendingRings.end(),
+                                       [uid, pid](const RegisteredRing& pendingRing) {
+                                           return pendingRing.ring->uid() == uid &&
+                                                  pendingRing.ring->pid() == pid;
+                                       }),
+                        mPendingRings.end());
+    // The ring thread drops the ring, after the rings registered before this call.
+    mPendingUnregistrations.emplace_back(uid, pid);
+    mRingCountChanged.notify_all();
+    const uint64_t one = 1;
+    write(mRingControlFd.get(), &one, sizeof(one));
+    ALOGI("Unregistered the shared memory ring of uid %d pid %d", uid, pid);
+}
+
+size_t StatsSocketListener::getRingCount() const {
+    lock_guard<mutex> lock(mRingMutex);
+    return mRingClients.size();
+}
+
+bool StatsSocketListener::waitForRingCount(size_t count, std::chrono::milliseconds timeout) {
+    std::unique_lock<mutex> lock(mRingMutex);
+    return mRingCountChanged.wait_for(lock, timeout,
+                                      [this, count] { return mRingClients.size() == count; });
+}
+
+void StatsSocketListener::releaseRing(const SharedMemoryRing& ring) {
+    lock_guard<mutex> lock(mRingMutex);
+    // Keeps the slot of a replacement that is not picked up yet.
+    for (const RegisteredRing& pendingRing : mPendingRings) {
+        if (pendingRing.ring->uid() == ring.uid() && pendingRing.ring->pid() == ring.pid()) {
+            return;
+        }
+    }
+    mRingClients.erase({ring.uid(), ring.pid()});
+    mRingCountChanged.notify_all();
+}
+
+void StatsSocketListener::readRings() {
+    prctl(PR_SET_NAME, "statsd.rings");
+    ScopedThreadRole role(ThreadRole::INGEST);
+    std::vector<struct pollfd> pollFds;
+    while (true) {
+        {
+            lock_guard<mutex> lock(mRingMutex);
+            if (mRingsStopped) {
+                return;
+            }
+            for (const auto& [uid, pid] : mPendingUnregistrations) {
+                mRings.erase(std::remove_if(mRings.begin(), mRings.end(),
+                                            [uid = uid, pid = pid](const RegisteredRing& ring) {
+                                                return ring.ring->uid() == uid &&
+                                                       ring.ring->pid() == pid;
+                                            }),
+                             mRings.end());
+            }
+            mPendingUnregistrations.clear();
+            for (RegisteredRing& pendingRing : mPendingRings) {
+                auto sameClient = [&pendingRing](const RegisteredRing& ring) {
+                    return ring.ring->uid() == pendingRing.ring->uid() &&
+                           ring.ring->pid() == pendingRing.ring->pid();
+                };
+                // registerRing() checked the limit, a ring of the same client is replaced.
+                mRings.erase(std::remove_if(mRings.begin(), mRings.end(), sameClient),
+                             mRings.end());
+                mRings.push_back(std::move(pendingRing));
+            }
+            mPendingRings.clear();
+        }
+
+        pollFds.clear();
+        pollFds.push_back({mRingControlFd.get(), POLLIN, 0});
+        bool idle = true;
+        for (auto it = mRings.begin(); it != mRings.end();) {
+            if (!readRing(*it->ring)) {
+                releaseRing(*it->ring);
+                it = mRings.erase(it);
+                continue;
+            }
+            it->pidPollIndex = pollFds.size();
+            pollFds.push_back({it->pidFd.get(), POLLIN, 0});
+            it->wakePollIndex = -1;
+            if (it->ring->prepareWait()) {
+                it->wakePollIndex = pollFds.size();
+                pollFds.push_back({it->ring->wakeFd(), POLLIN, 0});
+            } else {
+                idle = false;
+            }
+            it++;
+        }
+
+        // Still polls when a ring has atoms, to notice the clients that exited.
+        if (TEMP_FAILURE_RETRY(poll(pollFds.data(), pollFds.size(), idle ? -1 : 0)) < 0) {
+            ALOGE("Failed to wait for the shared memory rings: %s", strerror(errno));
+            return;
+        }
+        uint64_t count;
+        if (pollFds[0].revents & POLLIN) {
+            read(mRingControlFd.get(), &count, sizeof(count));
+        }
+        for (auto it = mRings.begin(); it != mRings.end();) {
+            if (it->wakePollIndex >= 0 && (pollFds[it->wakePollIndex].revents & POLLIN)) {
+                read(it->ring->wakeFd(), &count, sizeof(count));
+            }
+            if ((pollFds[it->pidPollIndex].revents & (POLLIN | POLLHUP)) == 0) {
+                it++;
+                continue;
+            }
+            // The client exited, so the ring only holds the atoms it left.
+            while (readRing(*it->ring) && !it->ring->prepareWait()) {
+            }
+            ALOGI("Released the shared memory ring of uid %d pid %d, which exited",
+                  it->ring->uid(), it->ring->pid());
+            releaseRing(*it->ring);
+            it = mRings.erase(it);
+        }
+    }
+}
+
+bool StatsSocketListener::readRing(SharedMemoryRing& ring) {
+    ScopedTrace trace("StatsSocketListener::readRing");
+    const int64_t receivedTimestampNs = getElapsedRealtimeNs();
+    const bool valid = ring.read(kRingBatchSize, [&](uint8_t* atom, size_t size) {
+        if (isAtomSkipped(atom, size, mRingSkippedAtomCounts)) {
+            return;
+        }
+        unique_ptr<LogEvent> logEvent = obtainLogEvent(ring.uid(), ring.pid());
+        logEvent->setReceivedTimestampNs(receivedTimestampNs);
+        logEvent->parseBuffer(atom, size);
+        mRingBatch.push_back(std::move(logEvent));
+    });
+    if (!mRingBatch.empty()) {
+        const int32_t batchSize = mRingBatch.size();
+        int64_t oldestTimestamp;
+        if (mQueue->pushBatch(&mRingBatch, &oldestTimestamp, &mRingDroppedEvents) > 0) {
+            noteDroppedEvents(oldestTimestamp, mRingDroppedEvents, mRingDroppedUids);
+        }
+        StatsdStats::getInstance().noteEventsQueued(receivedTimestampNs, batchSize,
+                                                    mQueue->size());
+    }
+    noteSkippedAtoms(mRingSkippedAtomCounts);
+    return valid;
 }
 
 bool StatsSocketListener::onDataAvailable(SocketClient* cli) {
-    static bool name_set;
+    // Each listener has its own thread.
+    static thread_local bool name_set;
     if (!name_set) {
         prctl(PR_SET_NAME, "statsd.writer");
+        // The listener threads never exit.
+        ThreadTopology::getInstance().joinRole(ThreadRole::INGEST);
         name_set = true;
     }
+    ScopedTrace trace("StatsSocketListener::onDataAvailable");
+
+    int socket = cli->getSocket();
+    if (mMaxReceiveBufferBytes > 0 && !mSocketConfigured) {
+        configureSocket(socket);
+    }
+    if (mReadSlots != nullptr) {
+        const bool success = readBatch(socket);
+        checkSocketDrops(socket);
+        noteSkippedAtoms(mSkippedAtomCounts);
+        return success;
+    }
 
-    // + 1 to ensure null terminator if MAX_PAYLOAD buffer is received
-    char buffer[sizeof(android_log_header_t) + LOGGER_ENTRY_MAX_PAYLOAD + 1];
-    struct iovec iov = {buffer, sizeof(buffer) - 1};
+    char stackBuffer[kReadBufferSize];
+    LogEventBufferSlab::Buffer slabBuffer;
+    if (mBufferSlab != nullptr) {
+        slabBuffer = mBufferSlab->obtain();
+    }
+    char* buffer = slabBuffer ? reinterpret_cast<char*>(slabBuffer.get()) : stackBuffer;
+    struct iovec iov = {buffer, kReadBufferSize - 1};
 
-    alignas(4) char control[CMSG_SPACE(sizeof(struct ucred))];
+    alignas(4) char control[kControlBufferSize];
     struct msghdr hdr = {
             NULL, 0, &iov, 1, control, sizeof(control), 0,
     };
 
-    int socket = cli->getSocket();
-
     // To clear the entire buffer is secure/safe, but this contributes to 1.68%
     // overhead under logging load. We are safe because we check counts, but
     // still need to clear null terminator
@@ -70,17 +344,200 @@ bool StatsSocketListener::onDataAvailable(SocketClient* cli) {
         return false;
     }
 
+    std::unique_ptr<LogEvent> logEvent =
+            processMessage(buffer, n, &hdr, &slabBuffer, getElapsedRealtimeNs());
+    checkSocketDrops(socket);
+    noteSkippedAtoms(mSkippedAtomCounts);
+    if (logEvent == nullptr) {
+        return true;
+    }
+
+    int64_t oldestTimestamp;
+    if (!mQueue->push(std::move(logEvent), &oldestTimestamp, &mDroppedEvents)) {
+        noteDroppedEvents(oldestTimestamp, mDroppedEvents, mDroppedUids);
+    }
+
+    return true;
+}
+
+void StatsSocketListener::configureSocket(int socket) {
+    mSocketConfigured = true;
+
+    int on = 1;
+    if (setsockopt(socket, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on))) {
+        ALOGW("Failed to enable SO_RXQ_OVFL: %s", strerror(errno));
+    }
+
+    int size = 0;
+    socklen_t sizeLen = sizeof(size);
+    if (getsockopt(socket, SOL_SOCKET, SO_RCVBUF, &size, &sizeLen) || size <= 0) {
+        ALOGW("Failed to read SO_RCVBUF, receive buffer autotuning disabled: %s",
+              strerror(errno));
+        // Never grow the buffer.
+        mReceiveBufferBytes = mMaxReceiveBufferBytes;
+        return;
+    }
+    mReceiveBufferBytes = size;
+}
+
+void StatsSocketListener::noteKernelDropCounter(uint32_t dropCounter) {
+    // The counter is cumulative over the life of the socket and may wrap around.
+    const uint32_t drops = dropCounter - mKernelDropCounter;
+    if (drops > 0 && drops < INT32_MAX) {
+        mPendingKernelDrops += drops;
+    }
+    mKernelDropCounter = dropCounter;
+}
+
+void StatsSocketListener::checkSocketDrops(int socket) {
+    if (mPendingKernelDrops == 0 && mPendingClientDrops == 0) {
+        return;
+    }
+    if (mPendingKernelDrops > 0) {
+        ALOGW("Kernel dropped %lld events on the statsd socket", (long long)mPendingKernelDrops);
+        StatsdStats::getInstance().noteSocketKernelDrops(mPendingKernelDrops);
+    }
+    mPendingKernelDrops = 0;
+    mPendingClientDrops = 0;
+
+    if (mReceiveBufferBytes >= mMaxReceiveBufferBytes) {
+        return;
+    }
+    // The kernel doubles the value passed to SO_RCVBUF for its bookkeeping overhead, and reports
+    // the doubled value back, so ask for half of the target size.
+    const size_t targetBytes = std::min(mReceiveBufferBytes * 2, mMaxReceiveBufferBytes);
+    int size = targetBytes / 2;
+    socklen_t sizeLen = sizeof(size);
+    if (setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &size, sizeLen) ||
+        getsockopt(socket, SOL_SOCKET, SO_RCVBUF, &size, &sizeLen)) {
+        ALOGW("Failed to grow SO_RCVBUF: %s", strerror(errno));
+        mReceiveBufferBytes = mMaxReceiveBufferBytes;
+        return;
+    }
+    if ((size_t)size <= mReceiveBufferBytes) {
+        // Capped by net.core.rmem_max, so further attempts are pointless.
+        ALOGW("SO_RCVBUF is capped at %d bytes", size);
+        mReceiveBufferBytes = mMaxReceiveBufferBytes;
+        return;
+    }
+    mReceiveBufferBytes = size;
+    ALOGI("Grew the statsd socket receive buffer to %d bytes", size);
+    StatsdStats::getInstance().noteSocketReceiveBufferGrown(size);
+}
+
+bool StatsSocketListener::readBatch(int socket) {
+    for (size_t i = 0; i < mBatchReadSize; i++) {
+        // recvmmsg overwrites the control length and flags of every filled header.
+        ReadSlot& slot = mReadSlots[i];
+        struct msghdr& hdr = mMsgHeaders[i].msg_hdr;
+        hdr.msg_controllen = sizeof(slot.control);
+        hdr.msg_flags = 0;
+        if (mBufferSlab != nullptr) {
+            // Slab buffers are handed over to the events, so refill the slots that used theirs.
+            if (!slot.slabBuffer) {
+                slot.slabBuffer = mBufferSlab->obtain();
+            }
+            slot.iov.iov_base = slot.slabBuffer ? slot.slabBuffer.get() : (void*)slot.buffer;
+        }
+    }
+
+    // The socket is known to be readable, so drain whatever is already queued without blocking.
+    int count = recvmmsg(socket, mMsgHeaders.data(), mBatchReadSize, MSG_DONTWAIT, nullptr);
+    if (count <= 0) {
+        return false;
+    }
+    StatsdStats::getInstance().noteSocketBatchRead(count);
+    ScopedTrace trace("StatsSocketListener::readBatch", {{"count", count}});
+    const int64_t receivedTimestampNs = getElapsedRealtimeNs();
+
+    for (int i = 0; i < count; i++) {
+        ssize_t n = mMsgHeaders[i].msg_len;
+        if (n <= (ssize_t)(sizeof(android_log_header_t))) {
+            continue;
+        }
+        ReadSlot& slot = mReadSlots[i];
+        std::unique_ptr<LogEvent> logEvent =
+                processMessage(reinterpret_cast<char*>(slot.iov.iov_base), n,
+                               &mMsgHeaders[i].msg_hdr, &slot.slabBuffer, receivedTimestampNs);
+        if (logEvent != nullptr) {
+            mBatch.push_back(std::move(logEvent));
+        }
+    }
+
+    if (!mBatch.empty()) {
+        const int32_t batchSize = mBatch.size();
+        int64_t oldestTimestamp;
+        if (mQueue->pushBatch(&mBatch, &oldestTimestamp, &mDroppedEvents) > 0) {
+            noteDroppedEvents(oldestTimestamp, mDroppedEvents, mDroppedUids);
+        }
+        StatsdStats::getInstance().noteEventsQueued(receivedTimestampNs, batchSize,
+                                                    mQueue->size());
+    }
+
+    return true;
+}
+
+void StatsSocketListener::noteDroppedEvents(
+        int64_t oldestTimestampNs, std::vector<LogEventQueue::DroppedEvent>& droppedEvents,
+        std::vector<int32_t>& droppedUids) {
+    int64_t droppedBytes = 0;
+    int32_t droppedAppEvents = 0;
+    droppedUids.clear();
+    for (const auto& dropped : droppedEvents) {
+        droppedBytes += dropped.sizeBytes;
+        droppedAppEvents += LogEventQueue::isAppUid(dropped.uid);
+        droppedUids.push_back(dropped.uid);
+    }
+    StatsdStats::getInstance().noteEventQueueOverflow(oldestTimestampNs, droppedEvents.size(),
+                                                      droppedBytes, droppedAppEvents);
+    StatsdStats::getInstance().noteEventQueueOverflowForUids(droppedUids);
+    droppedEvents.clear();
+}
+
+void StatsSocketListener::noteSkippedAtoms(std::unordered_map<int, int>& skippedAtomCounts) {
+    if (skippedAtomCounts.empty()) {
+        return;
+    }
+    StatsdStats::getInstance().noteAtomsSkipped(skippedAtomCounts);
+    skippedAtomCounts.clear();
+}
+
+bool StatsSocketListener::isAtomSkipped(const uint8_t* msg, uint32_t len,
+                                        std::unordered_map<int, int>& skippedAtomCounts) const {
+    if (mLogEventFilter == nullptr) {
+        return false;
+    }
+    // Invalid headers are left for parseBuffer() to report.
+    const int32_t atomId = LogEvent::parseAtomId(msg, len);
+    if (atomId >= 0 && !mLogEventFilter->isAtomInUse(atomId)) {
+        skippedAtomCounts[atomId]++;
+        return true;
+    }
+    return false;
+}
+
+unique_ptr<LogEvent> StatsSocketListener::obtainLogEvent(int32_t uid, int32_t pid) const {
+    return mEventPool != nullptr ? mEventPool->obtain(uid, pid)
+                                 : std::make_unique<LogEvent>(uid, pid);
+}
+
+std::unique_ptr<LogEvent> StatsSocketListener::processMessage(
+        char* buffer, ssize_t n, struct msghdr* hdr, LogEventBufferSlab::Buffer* slabBuffer,
+        int64_t receivedTimestampNs) {
     buffer[n] = 0;
 
     struct ucred* cred = NULL;
 
-    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(hdr);
     while (cmsg != NULL) {
         if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_CREDENTIALS) {
             cred = (struct ucred*)CMSG_DATA(cmsg);
-            break;
+        } else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t dropCounter;
+            memcpy(&dropCounter, CMSG_DATA(cmsg), sizeof(dropCounter));
+            noteKernelDropCounter(dropCounter);
         }
-        cmsg = CMSG_NXTHDR(&hdr, cmsg);
+        cmsg = CMSG_NXTHDR(hdr, cmsg);
     }
 
     struct ucred fake_cred;
@@ -115,7 +572,10 @@ bool StatsSocketListener::onDataAvailable(SocketClient* cli) {
             StatsdStats::getInstance().noteLogLost((int32_t)getWallClockSec(), dropped_count,
                                                    long_event->header.tag, last_atom_tag, cred->uid,
                                                    cred->pid);
-            return true;
+            if (dropped_count > 0) {
+                mPendingClientDrops += dropped_count;
+            }
+            return nullptr;
         }
     }
 
@@ -125,15 +585,25 @@ bool StatsSocketListener::onDataAvailable(SocketClient* cli) {
     uint32_t uid = cred->uid;
     uint32_t pid = cred->pid;
 
-    int64_t oldestTimestamp;
-    std::unique_ptr<LogEvent> logEvent = std::make_unique<LogEvent>(uid, pid);
-    logEvent->parseBuffer(msg, len);
+    if (isAtomSkipped(msg, len, mSkippedAtomCounts)) {
+        // The slab buffer, if any, is kept for the next read.
+        return nullptr;
+    }
 
-    if (!mQueue->push(std::move(logEvent), &oldestTimestamp)) {
-        StatsdStats::getInstance().noteEventQueueOverflow(oldestTimestamp);
+    std::unique_ptr<LogEvent> logEvent = obtainLogEvent(uid, pid);
+    logEvent->setReceivedTimestampNs(receivedTimestampNs);
+    if (*slabBuffer) {
+        // Stands in for the atom timestamp until the consumer parses the buffer.
+        logEvent->setElapsedTimestampNs(receivedTimestampNs);
+        logEvent->setDeferredBuffer(std::move(*slabBuffer), msg - (uint8_t*)buffer, len);
+    } else {
+        logEvent->parseBuffer(msg, len);
     }
+    return logEvent;
+}
 
-    return true;
+int StatsSocketListener::getAppLogSocket() {
+    return android_get_control_socket("statsdw_app");
 }
 
 int StatsSocketListener::getLogSocket() {
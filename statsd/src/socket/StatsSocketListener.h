@@ -15,9 +15,25 @@
  */
 #pragma once
 
+#include <android-base/unique_fd.h>
+#include <gtest/gtest_prod.h>
+#include <sys/socket.h>
 #include <sysutils/SocketListener.h>
 #include <utils/RefBase.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "logd/LogEventBufferSlab.h"
+#include "logd/LogEventPool.h"
 #include "logd/LogEventQueue.h"
+#include "socket/LogEventFilter.h"
+#include "socket/SharedMemoryRing.h"
 
 // DEFAULT_OVERFLOWUID is defined in linux/highuid.h, which is not part of
 // the uapi headers for userspace to use.  This value is filled in on the
@@ -35,19 +51,231 @@ namespace statsd {
 
 class StatsSocketListener : public SocketListener, public virtual RefBase {
 public:
-    explicit StatsSocketListener(std::shared_ptr<LogEventQueue> queue);
+    // Max number of datagrams drained from the socket per wakeup in batched read mode.
+    static const size_t kDefaultBatchReadSize = 32;
+
+    // Size of a receive buffer for one datagram.
+    // + 1 to ensure null terminator if MAX_PAYLOAD buffer is received
+    static const size_t kReadBufferSize =
+            sizeof(android_log_header_t) + LOGGER_ENTRY_MAX_PAYLOAD + 1;
+
+    // Max number of shared memory rings registered at a time, see registerRing().
+    static const size_t kMaxRings = 8;
+
+    // Max number of atoms read from a ring before moving to the next one.
+    static const size_t kRingBatchSize = 64;
+
+    /**
+     * \param batchReadSize max number of datagrams read per wakeup. A value larger than 1 enables
+     * the batched read mode, which reads with one recvmmsg call and pushes the resulting events
+     * into the queue as one batch.
+     * \param eventPool if not null, LogEvents are obtained from this pool instead of allocated.
+     * \param bufferSlab if not null, enables the deferred parse mode: datagrams are received
+     * into buffers of this slab, and the events are pushed unparsed. The consumer of the queue
+     * must call LogEvent::parseDeferredBuffer(). When the slab is exhausted, events are parsed
+     * on the socket thread as usual. Its buffers must be at least kReadBufferSize long.
+     * \param maxReceiveBufferBytes if not 0, enables the receive buffer autotuning: datagrams
+     * dropped by the kernel are counted with SO_RXQ_OVFL, and SO_RCVBUF is doubled, up to this
+     * ceiling, after a wakeup that observed drops.
+     * \param logEventFilter if not null, datagrams carrying atoms that are not in use are
+     * counted and dropped before a LogEvent is obtained for them.
+     * \param socket if not negative, the datagram socket to read instead of the statsd socket,
+     * e.g. for benchmarks. It must have SO_PASSCRED set, and is closed by the listener.
+     */
+    explicit StatsSocketListener(std::shared_ptr<LogEventQueue> queue, size_t batchReadSize = 1,
+                                 std::shared_ptr<LogEventPool> eventPool = nullptr,
+                                 std::shared_ptr<LogEventBufferSlab> bufferSlab = nullptr,
+                                 size_t maxReceiveBufferBytes = 0,
+                                 std::shared_ptr<LogEventFilter> logEventFilter = nullptr,
+                                 int socket = -1);
 
     virtual ~StatsSocketListener();
 
+    /**
+     * Returns the socket of the app clients, which libstatssocket writes to from app uids, or -1
+     * if init did not create it. The clients write to the statsd socket instead once it is
+     * closed, so it must be either read by a listener or closed.
+     */
+    static int getAppLogSocket();
+
+    /**
+     * Registers the shared memory ring of a client, see AStatsSocket_createRing(). The rings are
+     * drained on a dedicated thread, alongside the socket, and their atoms are pushed into the
+     * queue like the ones read from the socket, attributed to [uid] and [pid]. A new ring of the
+     * same uid and pid replaces the previous one. The ring is released when the process exits,
+     * or by unregisterRing().
+     * Returns false if the ring is invalid, or if kMaxRings other rings are registered, in which
+     * case the client must keep writing to the socket.
+     */
+    bool registerRing(android::base::unique_fd ringFd, android::base::unique_fd wakeFd,
+                      int32_t uid, int32_t pid);
+
+    /**
+     * Releases the ring registered by [uid] and [pid], if any. The atoms already in it may be
+     * dropped.
+     */
+    void unregisterRing(int32_t uid, int32_t pid);
+
 protected:
     virtual bool onDataAvailable(SocketClient* cli);
 
 private:
+    struct ReadSlot;
+
     static int getLogSocket();
+
+    /**
+     * Reads up to mBatchReadSize datagrams with a single recvmmsg call.
+     */
+    bool readBatch(int socket);
+
+    /**
+     * Enables SO_RXQ_OVFL and reads the initial receive buffer size. Called on the first wakeup,
+     * in the receive buffer autotuning mode.
+     */
+    void configureSocket(int socket);
+
+    /**
+     * Reports the drops observed during the last wakeup, and grows the receive buffer if any.
+     */
+    void checkSocketDrops(int socket);
+
+    /**
+     * Reads the cumulative kernel drop counter from the ancillary data of a datagram, and adds
+     * the drops since the previous datagram to mPendingKernelDrops.
+     */
+    void noteKernelDropCounter(uint32_t dropCounter);
+
+    /**
+     * Reports [droppedEvents] to StatsdStats and clears it. [droppedUids] is scratch space.
+     */
+    static void noteDroppedEvents(int64_t oldestTimestampNs,
+                                  std::vector<LogEventQueue::DroppedEvent>& droppedEvents,
+                                  std::vector<int32_t>& droppedUids);
+
+    /**
+     * Reports the atoms in [skippedAtomCounts] to StatsdStats and clears it.
+     */
+    static void noteSkippedAtoms(std::unordered_map<int, int>& skippedAtomCounts);
+
+    /**
+     * Returns true if the atom encoded in [msg] is not in use, after counting it in
+     * [skippedAtomCounts].
+     */
+    bool isAtomSkipped(const uint8_t* msg, uint32_t len,
+                       std::unordered_map<int, int>& skippedAtomCounts) const;
+
+    std::unique_ptr<LogEvent> obtainLogEvent(int32_t uid, int32_t pid) const;
+
+    // A ring registered with registerRing(), with a pidfd of the client.
+    struct RegisteredRing {
+        std::unique_ptr<SharedMemoryRing> ring;
+        android::base::unique_fd pidFd;
+        // Where readRings() polls the pidfd and the wake eventfd, -1 if it doesn't.
+        int pidPollIndex = -1;
+        int wakePollIndex = -1;
+    };
+
+    /**
+     * Body of mRingThread: reads the registered rings, and waits for their wake eventfds once
+     * they are all empty. Releases the rings of the clients that exited.
+     */
+    void readRings();
+
+    /**
+     * Frees the slot of [ring], which the ring thread dropped, unless a replacement is pending.
+     */
+    void releaseRing(const SharedMemoryRing& ring);
+
+    // For testing: the number of rings registered, including the ones not picked up by the ring
+    // thread yet.
+    size_t getRingCount() const;
+
+    // For testing: waits until [count] rings are registered. Returns false on timeout.
+    bool waitForRingCount(size_t count, std::chrono::milliseconds timeout);
+
+    /**
+     * Pushes the atoms read from [ring] into the queue. Returns false if the ring is invalid.
+     */
+    bool readRing(SharedMemoryRing& ring);
+
+    /**
+     * Decodes a datagram read from the socket. [buffer] starts with the android_log_header_t and
+     * is [n] bytes long; [hdr] holds the ancillary data with the sender credentials.
+     * Returns nullptr if the datagram does not carry an atom, e.g. the dropped events notice,
+     * or if the atom is not in use.
+     * If [slabBuffer] is not empty, it must hold [buffer]; it is then moved into the returned
+     * event and parsing is deferred. [receivedTimestampNs] is the elapsed realtime of the read.
+     */
+    std::unique_ptr<LogEvent> processMessage(char* buffer, ssize_t n, struct msghdr* hdr,
+                                             LogEventBufferSlab::Buffer* slabBuffer,
+                                             int64_t receivedTimestampNs);
+
     /**
      * Who is going to get the events when they're read.
      */
     std::shared_ptr<LogEventQueue> mQueue;
+
+    const size_t mBatchReadSize;
+
+    // Source of recycled LogEvents. May be null.
+    std::shared_ptr<LogEventPool> mEventPool;
+
+    // Receive buffers for the deferred parse mode. May be null.
+    std::shared_ptr<LogEventBufferSlab> mBufferSlab;
+
+    // Atoms to be processed. May be null.
+    std::shared_ptr<LogEventFilter> mLogEventFilter;
+
+    // Receive buffers and headers reused across batched reads. Only accessed from the listener
+    // thread.
+    std::unique_ptr<ReadSlot[]> mReadSlots;
+    std::vector<struct mmsghdr> mMsgHeaders;
+    std::vector<std::unique_ptr<LogEvent>> mBatch;
+    // Events dropped by the last push. Only accessed from the listener thread.
+    std::vector<LogEventQueue::DroppedEvent> mDroppedEvents;
+    std::vector<int32_t> mDroppedUids;
+    // Atoms skipped during the current wakeup, by atom id. Only accessed from the listener thread.
+    std::unordered_map<int, int> mSkippedAtomCounts;
+
+    // Ceiling of the receive buffer size. 0 if the autotuning is disabled.
+    const size_t mMaxReceiveBufferBytes;
+
+    // State of the receive buffer autotuning. Only accessed from the listener thread.
+    bool mSocketConfigured = false;
+    size_t mReceiveBufferBytes = 0;
+    // Last value of the kernel's cumulative drop counter.
+    uint32_t mKernelDropCounter = 0;
+    // Drops observed during the current wakeup, by the kernel and by the clients.
+    int64_t mPendingKernelDrops = 0;
+    int64_t mPendingClientDrops = 0;
+
+    // Guards mRingClients, mPendingRings, mPendingUnregistrations and mRingsStopped.
+    mutable std::mutex mRingMutex;
+    // The uid and pid of the clients with a ring in mRings or mPendingRings, at most kMaxRings.
+    std::set<std::pair<int32_t, int32_t>> mRingClients;
+    // Notified when mRingClients shrinks.
+    std::condition_variable mRingCountChanged;
+    // Rings registered since mRingThread last looked, which it moves to mRings.
+    std::vector<RegisteredRing> mPendingRings;
+    // Clients unregistered since mRingThread last looked, whose rings it drops before it moves
+    // mPendingRings.
+    std::vector<std::pair<int32_t, int32_t>> mPendingUnregistrations;
+    bool mRingsStopped = false;
+    // Started with the first ring. mRingControlFd is an eventfd that wakes it up.
+    std::thread mRingThread;
+    android::base::unique_fd mRingControlFd;
+
+    // Only accessed from mRingThread.
+    std::vector<RegisteredRing> mRings;
+    std::vector<std::unique_ptr<LogEvent>> mRingBatch;
+    std::vector<LogEventQueue::DroppedEvent> mRingDroppedEvents;
+    std::vector<int32_t> mRingDroppedUids;
+    std::unordered_map<int, int> mRingSkippedAtomCounts;
+
+    FRIEND_TEST(StatsSocketListenerTest, TestRegisterRing);
+    FRIEND_TEST(StatsSocketListenerTest, TestRingLimit);
+    FRIEND_TEST(StatsSocketListenerTest, TestRingReleasedWhenClientExits);
 };
 }  // namespace statsd
 }  // namespace os
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "StateGroupTable.h"
+
+#include <algorithm>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unordered_map;
+using std::vector;
+
+namespace {
+
+// The array of a StateGroupTable spans at most this many values more than 4 per group.
+const int64_t kMaxDenseSlack = 64;
+
+}  // namespace
+
+StateGroupTable::StateGroupTable(const int32_t atomId,
+                                 const unordered_map<int, int64_t>& stateGroups)
+    : mAtomId(atomId) {
+    if (stateGroups.empty()) {
+        return;
+    }
+    int minState = stateGroups.begin()->first;
+    int maxState = minState;
+    for (const auto& [state, groupId] : stateGroups) {
+        minState = std::min(minState, state);
+        maxState = std::max(maxState, state);
+    }
+    const int64_t range = (int64_t)maxState - minState + 1;
+    if (range > 4 * (int64_t)stateGroups.size() + kMaxDenseSlack) {
+        VLOG("State atom %d has sparse state groups", atomId);
+        mSparseGroupIds = stateGroups;
+        return;
+    }
+    mMinState = minState;
+    mGroupIds.assign(range, 0);
+    mHasGroup.assign(range, 0);
+    for (const auto& [state, groupId] : stateGroups) {
+        mGroupIds[state - minState] = groupId;
+        mHasGroup[state - minState] = 1;
+    }
+}
+
+vector<StateGroupTable> StateGroupTable::build(
+        const unordered_map<int, unordered_map<int, int64_t>>& stateGroupMap) {
+    vector<StateGroupTable> tables;
+    tables.reserve(stateGroupMap.size());
+    for (const auto& [atomId, stateGroups] : stateGroupMap) {
+        tables.emplace_back(atomId, stateGroups);
+    }
+    return tables;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * The state groups of one state atom, compiled from the StateMap of the config. State values are
+ * small enums, so the groups are looked up in an array spanning the values. Maps whose values are
+ * spread much wider than their number fall back to a hash map.
+ */
+class StateGroupTable {
+public:
+    StateGroupTable(const int32_t atomId, const std::unordered_map<int, int64_t>& stateGroups);
+
+    // Compiles the state groups of each atom in [stateGroupMap].
+    static std::vector<StateGroupTable> build(
+            const std::unordered_map<int, std::unordered_map<int, int64_t>>& stateGroupMap);
+
+    inline int32_t getAtomId() const {
+        return mAtomId;
+    }
+
+    // Returns true and sets [groupId] if [state] is in a group.
+    inline bool getGroupId(const int state, int64_t* groupId) const {
+        if (!mHasGroup.empty()) {
+            const uint64_t index = (int64_t)state - mMinState;
+            if (index >= mHasGroup.size() || !mHasGroup[index]) {
+                return false;
+            }
+            *groupId = mGroupIds[index];
+            return true;
+        }
+        const auto it = mSparseGroupIds.find(state);
+        if (it == mSparseGroupIds.end()) {
+            return false;
+        }
+        *groupId = it->second;
+        return true;
+    }
+
+    // Whether the groups are looked up in an array, for tests.
+    inline bool isDense() const {
+        return !mHasGroup.empty();
+    }
+
+private:
+    int32_t mAtomId;
+
+    // mGroupIds[i] is the group of state mMinState + i, if mHasGroup[i].
+    int mMinState = 0;
+    std::vector<int64_t> mGroupIds;
+    std::vector<uint8_t> mHasGroup;
+
+    // The groups when they are too spread out for mGroupIds.
+    std::unordered_map<int, int64_t> mSparseGroupIds;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
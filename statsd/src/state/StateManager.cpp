@@ -25,10 +25,33 @@ namespace android {
 namespace os {
 namespace statsd {
 
+namespace {
+
+// The source of StateManager::mStateVersion.
+std::atomic<uint64_t> sNextStateVersion(1);
+
+// An answer of StateManager::getStateValue().
+struct CachedStateValue {
+    uint64_t stateVersion = 0;
+    int32_t atomId = 0;
+    HashableDimensionKey queryKey;
+    FieldValue value;
+    bool found = false;
+};
+
+const size_t kNumCachedStateValues = 8;
+
+// The last answers of StateManager::getStateValue() on this thread, replaced round robin.
+thread_local CachedStateValue tCachedStateValues[kNumCachedStateValues];
+thread_local size_t tNextCachedStateValue = 0;
+
+}  // namespace
+
 StateManager::StateManager()
     : mAllowedPkg({
               "com.android.systemui",
-      }) {
+      }),
+      mStateVersion(sNextStateVersion.fetch_add(1, std::memory_order_relaxed)) {
 }
 
 StateManager& StateManager::getInstance() {
@@ -38,6 +61,12 @@ StateManager& StateManager::getInstance() {
 
 void StateManager::clear() {
     mStateTrackers.clear();
+    noteStateMayHaveChanged();
+}
+
+void StateManager::noteStateMayHaveChanged() {
+    mStateVersion.store(sNextStateVersion.fetch_add(1, std::memory_order_relaxed),
+                        std::memory_order_relaxed);
 }
 
 void StateManager::onLogEvent(const LogEvent& event) {
@@ -46,16 +75,20 @@ void StateManager::onLogEvent(const LogEvent& event) {
     // Whitelisted AIDs are AID_ROOT and all AIDs in [1000, 2000)
     if (event.GetUid() == AID_ROOT || (event.GetUid() >= 1000 && event.GetUid() < 2000) ||
         mAllowedLogSources.find(event.GetUid()) != mAllowedLogSources.end()) {
-        if (mStateTrackers.find(event.GetTagId()) != mStateTrackers.end()) {
-            mStateTrackers[event.GetTagId()]->onLogEvent(event);
+        if (const auto it = mStateTrackers.find(event.GetTagId()); it != mStateTrackers.end()) {
+            noteStateMayHaveChanged();
+            it->second->onLogEvent(event);
         }
     }
 }
 
 void StateManager::registerListener(const int32_t atomId, wp<StateListener> listener) {
+    // The metrics managers of configs loaded together register from several threads.
+    std::lock_guard<std::mutex> lock(mMutex);
     // Check if state tracker already exists.
     if (mStateTrackers.find(atomId) == mStateTrackers.end()) {
         mStateTrackers[atomId] = new StateTracker(atomId);
+        noteStateMayHaveChanged();
     }
     mStateTrackers[atomId]->registerListener(listener);
 }
@@ -76,6 +109,7 @@ void StateManager::unregisterListener(const int32_t atomId, wp<StateListener> li
         if (it->second->getListenersCount() == 0) {
             toRemove = it->second;
             mStateTrackers.erase(it);
+            noteStateMayHaveChanged();
         }
     } else {
         ALOGE("StateManager cannot unregister listener, StateTracker for atom %d does not exist",
@@ -86,12 +120,44 @@ void StateManager::unregisterListener(const int32_t atomId, wp<StateListener> li
 
 bool StateManager::getStateValue(const int32_t atomId, const HashableDimensionKey& key,
                                  FieldValue* output) const {
+    const uint64_t stateVersion = mStateVersion.load(std::memory_order_relaxed);
+    for (const CachedStateValue& cached : tCachedStateValues) {
+        if (cached.stateVersion == stateVersion && cached.atomId == atomId &&
+            cached.queryKey.getHash() == key.getHash() && cached.queryKey == key) {
+            *output = cached.value;
+            return cached.found;
+        }
+    }
+
+    bool found = false;
     auto it = mStateTrackers.find(atomId);
     if (it != mStateTrackers.end()) {
-        return it->second->getStateValue(key, output);
+        found = it->second->getStateValue(key, output);
+    } else {
+        ALOGE("StateManager cannot get state value, no StateTracker for atom %d", atomId);
+    }
+    CachedStateValue& cached =
+            tCachedStateValues[tNextCachedStateValue++ % kNumCachedStateValues];
+    cached.stateVersion = stateVersion;
+    cached.atomId = atomId;
+    cached.queryKey = key;
+    cached.value = *output;
+    cached.found = found;
+    return found;
+}
+
+void StateManager::addAllAtomIds(std::unordered_set<int>* atomIds) const {
+    for (const auto& [atomId, _] : mStateTrackers) {
+        atomIds->insert(atomId);
+    }
+}
+
+size_t StateManager::getStateTrackersByteSize() const {
+    size_t totalSize = 0;
+    for (const auto& [_, stateTracker] : mStateTrackers) {
+        totalSize += stateTracker->byteSize();
     }
-    ALOGE("StateManager cannot get state value, no StateTracker for atom %d", atomId);
-    return false;
+    return totalSize;
 }
 
 void StateManager::updateLogSources(const sp<UidMap>& uidMap) {
@@ -18,9 +18,11 @@
 #include <inttypes.h>
 #include <utils/RefBase.h>
 
+#include <atomic>
 #include <set>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "HashableDimensionKey.h"
 #include "packages/UidMap.h"
@@ -33,7 +35,9 @@ namespace statsd {
 
 /**
  * This class is NOT thread safe.
- * It should only be used while StatsLogProcessor's lock is held.
+ * It should only be used while StatsLogProcessor's lock is held. getStateValue() is the exception:
+ * it can be called from several threads at once, as the metrics managers do with parallel
+ * dispatch, as long as no other method runs at the same time.
  */
 class StateManager : public virtual RefBase {
 public:
@@ -64,6 +68,8 @@ public:
     // original state value mapped to the given query key. The state value is
     // stored and output in a FieldValue class.
     // Returns false if the StateTracker doesn't exist.
+    // Takes no lock. The answers are cached by the calling thread until the next state event, so
+    // the metrics that query the same state for an event only look it up once.
     bool getStateValue(const int32_t atomId, const HashableDimensionKey& queryKey,
                        FieldValue* output) const;
 
@@ -76,6 +82,16 @@ public:
         return mStateTrackers.size();
     }
 
+    // Adds the ids of all atoms with a StateTracker to [atomIds].
+    void addAllAtomIds(std::unordered_set<int>* atomIds) const;
+
+    // Estimated heap bytes of the state values of all StateTrackers.
+    size_t getStateTrackersByteSize() const;
+
+    inline bool hasStateTracker(const int32_t atomId) const {
+        return mStateTrackers.find(atomId) != mStateTrackers.end();
+    }
+
     inline int getListenersCount(const int32_t atomId) const {
         auto it = mStateTrackers.find(atomId);
         if (it != mStateTrackers.end()) {
@@ -85,8 +101,15 @@ public:
     }
 
 private:
+    // Marks the answers cached by getStateValue() as stale.
+    void noteStateMayHaveChanged();
+
     mutable std::mutex mMutex;
 
+    // Changes whenever a state value may have changed, see getStateValue(). Drawn from a process
+    // wide counter, so that no two StateManagers ever have the same version.
+    std::atomic<uint64_t> mStateVersion;
+
     // Maps state atom ids to StateTrackers
     std::unordered_map<int32_t, sp<StateTracker>> mStateTrackers;
 
@@ -14,13 +14,15 @@
  * limitations under the License.
  */
 
-#define STATSD_DEBUG true  // STOPSHIP if true
+#define STATSD_DEBUG false  // STOPSHIP if true
 #include "Log.h"
 
 #include "stats_util.h"
 
 #include "StateTracker.h"
 
+#include <algorithm>
+
 namespace android {
 namespace os {
 namespace statsd {
@@ -39,6 +41,7 @@ void StateTracker::onLogEvent(const LogEvent& event) {
     if (!getStateFieldValueFromLogEvent(event, &newState)) {
         ALOGE("StateTracker error extracting state from log event. Missing exclusive state field.");
         clearStateForPrimaryKey(eventTimeNs, primaryKey);
+        releasePromotedListeners();
         return;
     }
 
@@ -48,6 +51,7 @@ void StateTracker::onLogEvent(const LogEvent& event) {
         ALOGE("StateTracker error extracting state from log event. Type: %d",
               newState.mValue.getType());
         clearStateForPrimaryKey(eventTimeNs, primaryKey);
+        releasePromotedListeners();
         return;
     }
 
@@ -55,27 +59,45 @@ void StateTracker::onLogEvent(const LogEvent& event) {
         VLOG("StateTracker new reset state: %d", resetState);
         const FieldValue resetStateFieldValue(mField, Value(resetState));
         handleReset(eventTimeNs, resetStateFieldValue);
+        releasePromotedListeners();
         return;
     }
 
     const bool nested = newState.mAnnotations.isNested();
-    StateValueInfo* stateValueInfo = &mStateMap[primaryKey];
-    updateStateForPrimaryKey(eventTimeNs, primaryKey, newState, nested, stateValueInfo);
+    const int32_t newStateValue = newState.mValue.int_value;
+    updateStateForPrimaryKey(eventTimeNs, primaryKey, newStateValue, nested,
+                             &mStateMap[primaryKey]);
+    if (kStateUnknown == newStateValue) {
+        mStateMap.erase(primaryKey);
+    }
+    releasePromotedListeners();
 }
 
 void StateTracker::registerListener(wp<StateListener> listener) {
-    mListeners.insert(listener);
+    if (std::find(mListeners.begin(), mListeners.end(), listener) == mListeners.end()) {
+        mListeners.push_back(listener);
+    }
 }
 
 void StateTracker::unregisterListener(wp<StateListener> listener) {
-    mListeners.erase(listener);
+    mListeners.erase(std::remove(mListeners.begin(), mListeners.end(), listener),
+                     mListeners.end());
+}
+
+size_t StateTracker::byteSize() const {
+    size_t totalSize = sizeof(StateTracker) + mListeners.capacity() * sizeof(wp<StateListener>);
+    mStateMap.forEach([&totalSize](const HashableDimensionKey& key, const StateValueInfo&) {
+        totalSize += hashMapEntryByteSize(key, sizeof(StateValueInfo));
+    });
+    return totalSize;
 }
 
 bool StateTracker::getStateValue(const HashableDimensionKey& queryKey, FieldValue* output) const {
     output->mField = mField;
 
-    if (const auto it = mStateMap.find(queryKey); it != mStateMap.end()) {
-        output->mValue = it->second.state;
+    if (const StateValueInfo* stateValueInfo = mStateMap.find(queryKey);
+        stateValueInfo != nullptr) {
+        output->mValue = stateValueInfo->state;
         return true;
     }
 
@@ -87,42 +109,35 @@ bool StateTracker::getStateValue(const HashableDimensionKey& queryKey, FieldValu
 
 void StateTracker::handleReset(const int64_t eventTimeNs, const FieldValue& newState) {
     VLOG("StateTracker handle reset");
-    for (auto& [primaryKey, stateValueInfo] : mStateMap) {
-        updateStateForPrimaryKey(eventTimeNs, primaryKey, newState,
+    const int32_t newStateValue = newState.mValue.int_value;
+    mStateMap.forEach([&](const HashableDimensionKey& primaryKey, StateValueInfo& stateValueInfo) {
+        updateStateForPrimaryKey(eventTimeNs, primaryKey, newStateValue,
                                  false /* nested; treat this state change as not nested */,
                                  &stateValueInfo);
+    });
+    if (kStateUnknown == newStateValue) {
+        mStateMap.clear();
     }
 }
 
 void StateTracker::clearStateForPrimaryKey(const int64_t eventTimeNs,
                                            const HashableDimensionKey& primaryKey) {
     VLOG("StateTracker clear state for primary key");
-    const std::unordered_map<HashableDimensionKey, StateValueInfo>::iterator it =
-            mStateMap.find(primaryKey);
-
     // If there is no entry for the primaryKey in mStateMap, then the state is already
     // kStateUnknown.
-    const FieldValue state(mField, Value(kStateUnknown));
-    if (it != mStateMap.end()) {
-        updateStateForPrimaryKey(eventTimeNs, primaryKey, state,
+    if (StateValueInfo* stateValueInfo = mStateMap.find(primaryKey); stateValueInfo != nullptr) {
+        updateStateForPrimaryKey(eventTimeNs, primaryKey, kStateUnknown,
                                  false /* nested; treat this state change as not nested */,
-                                 &it->second);
+                                 stateValueInfo);
+        mStateMap.erase(primaryKey);
     }
 }
 
 void StateTracker::updateStateForPrimaryKey(const int64_t eventTimeNs,
                                             const HashableDimensionKey& primaryKey,
-                                            const FieldValue& newState, const bool nested,
+                                            const int32_t newStateValue, const bool nested,
                                             StateValueInfo* stateValueInfo) {
-    FieldValue oldState;
-    oldState.mField = mField;
-    oldState.mValue.setInt(stateValueInfo->state);
     const int32_t oldStateValue = stateValueInfo->state;
-    const int32_t newStateValue = newState.mValue.int_value;
-
-    if (kStateUnknown == newStateValue) {
-        mStateMap.erase(primaryKey);
-    }
 
     // Update state map for non-nested counting case.
     // Every state event triggers a state overwrite.
@@ -132,7 +147,7 @@ void StateTracker::updateStateForPrimaryKey(const int64_t eventTimeNs,
 
         // Notify listeners if state has changed.
         if (oldStateValue != newStateValue) {
-            notifyListeners(eventTimeNs, primaryKey, oldState, newState);
+            notifyListeners(eventTimeNs, primaryKey, oldStateValue, newStateValue);
         }
         return;
     }
@@ -149,29 +164,44 @@ void StateTracker::updateStateForPrimaryKey(const int64_t eventTimeNs,
     // The atom must be logged correctly.
     if (kStateUnknown == newStateValue) {
         if (kStateUnknown != oldStateValue) {
-            notifyListeners(eventTimeNs, primaryKey, oldState, newState);
+            notifyListeners(eventTimeNs, primaryKey, oldStateValue, newStateValue);
         }
     } else if (oldStateValue == kStateUnknown) {
         stateValueInfo->state = newStateValue;
         stateValueInfo->count = 1;
-        notifyListeners(eventTimeNs, primaryKey, oldState, newState);
+        notifyListeners(eventTimeNs, primaryKey, oldStateValue, newStateValue);
     } else if (oldStateValue == newStateValue) {
         stateValueInfo->count++;
     } else if (--stateValueInfo->count == 0) {
         stateValueInfo->state = newStateValue;
         stateValueInfo->count = 1;
-        notifyListeners(eventTimeNs, primaryKey, oldState, newState);
+        notifyListeners(eventTimeNs, primaryKey, oldStateValue, newStateValue);
     }
 }
 
 void StateTracker::notifyListeners(const int64_t eventTimeNs,
                                    const HashableDimensionKey& primaryKey,
-                                   const FieldValue& oldState, const FieldValue& newState) {
-    for (auto l : mListeners) {
-        auto sl = l.promote();
-        if (sl != nullptr) {
-            sl->onStateChanged(eventTimeNs, mField.getTag(), primaryKey, oldState, newState);
+                                   const int32_t oldStateValue, const int32_t newStateValue) {
+    if (!mListenersPromoted) {
+        // A reset notifies for every primary key, the listeners are promoted once.
+        for (const wp<StateListener>& listener : mListeners) {
+            if (sp<StateListener> promoted = listener.promote(); promoted != nullptr) {
+                mPromotedListeners.push_back(std::move(promoted));
+            }
         }
+        mListenersPromoted = true;
+    }
+    const FieldValue oldState(mField, Value(oldStateValue));
+    const FieldValue newState(mField, Value(newStateValue));
+    for (const sp<StateListener>& listener : mPromotedListeners) {
+        listener->onStateChanged(eventTimeNs, mField.getTag(), primaryKey, oldState, newState);
+    }
+}
+
+void StateTracker::releasePromotedListeners() {
+    if (mListenersPromoted) {
+        mPromotedListeners.clear();
+        mListenersPromoted = false;
     }
 }
 
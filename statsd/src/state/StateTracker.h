@@ -20,8 +20,9 @@
 #include "logd/LogEvent.h"
 
 #include "state/StateListener.h"
+#include "utils/FlatHashMap.h"
 
-#include <unordered_map>
+#include <vector>
 
 namespace android {
 namespace os {
@@ -38,7 +39,7 @@ public:
     // the log event and comparing the old and new states.
     void onLogEvent(const LogEvent& event);
 
-    // Adds new listeners to set of StateListeners. If a listener is already
+    // Adds new listeners to list of StateListeners. If a listener is already
     // registered, it is ignored.
     void registerListener(wp<StateListener> listener);
 
@@ -55,6 +56,9 @@ public:
         return mListeners.size();
     }
 
+    // Estimated heap bytes of the state values and listeners.
+    size_t byteSize() const;
+
     const static int kStateUnknown = -1;
 
 private:
@@ -66,10 +70,15 @@ private:
     Field mField;
 
     // Maps primary key to state value info
-    std::unordered_map<HashableDimensionKey, StateValueInfo> mStateMap;
+    FlatHashMap<HashableDimensionKey, StateValueInfo> mStateMap;
+
+    // All StateListeners (objects listening for state changes), without duplicates.
+    std::vector<wp<StateListener>> mListeners;
 
-    // Set of all StateListeners (objects listening for state changes)
-    std::set<wp<StateListener>> mListeners;
+    // mListeners promoted for the event being processed, see notifyListeners(). Empty outside
+    // of onLogEvent(), so that listeners are not kept alive.
+    std::vector<sp<StateListener>> mPromotedListeners;
+    bool mListenersPromoted = false;
 
     // Reset all state values in map to the given state.
     void handleReset(const int64_t eventTimeNs, const FieldValue& newState);
@@ -77,14 +86,19 @@ private:
     // Clears the state value mapped to the given primary key by setting it to kStateUnknown.
     void clearStateForPrimaryKey(const int64_t eventTimeNs, const HashableDimensionKey& primaryKey);
 
-    // Update the StateMap based on the received state value.
+    // Update the StateMap based on the received state value. The caller removes the entry of
+    // [primaryKey] if the new state is kStateUnknown.
     void updateStateForPrimaryKey(const int64_t eventTimeNs, const HashableDimensionKey& primaryKey,
-                                  const FieldValue& newState, const bool nested,
+                                  const int32_t newStateValue, const bool nested,
                                   StateValueInfo* stateValueInfo);
 
-    // Notify registered state listeners of state change.
+    // Notify registered state listeners of state change. Promotes the listeners on the first
+    // call for an event.
     void notifyListeners(const int64_t eventTimeNs, const HashableDimensionKey& primaryKey,
-                         const FieldValue& oldState, const FieldValue& newState);
+                         const int32_t oldStateValue, const int32_t newStateValue);
+
+    // Releases the listeners promoted by notifyListeners().
+    void releasePromotedListeners();
 };
 
 bool getStateFieldValueFromLogEvent(const LogEvent& event, FieldValue* output);
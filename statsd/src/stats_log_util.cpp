@@ -32,6 +32,7 @@ using android::util::FIELD_TYPE_INT32;
 using android::util::FIELD_TYPE_INT64;
 using android::util::FIELD_TYPE_MESSAGE;
 using android::util::FIELD_TYPE_STRING;
+using android::util::FIELD_TYPE_UINT32;
 using android::util::FIELD_TYPE_UINT64;
 using android::util::ProtoOutputStream;
 
@@ -52,6 +53,7 @@ const int DIMENSIONS_VALUE_VALUE_LONG = 4;
 const int DIMENSIONS_VALUE_VALUE_FLOAT = 6;
 const int DIMENSIONS_VALUE_VALUE_TUPLE = 7;
 const int DIMENSIONS_VALUE_VALUE_STR_HASH = 8;
+const int DIMENSIONS_VALUE_VALUE_STR_INDEX = 9;
 
 const int DIMENSIONS_VALUE_TUPLE_VALUE = 1;
 
@@ -84,6 +86,10 @@ const int FIELD_ID_PULLER_NOT_FOUND = 21;
 const int FIELD_ID_PULL_TIMEOUT_METADATA = 22;
 const int FIELD_ID_PULL_TIMEOUT_METADATA_UPTIME_MILLIS = 1;
 const int FIELD_ID_PULL_TIMEOUT_METADATA_ELAPSED_MILLIS = 2;
+const int FIELD_ID_AVERAGE_MERGE_TIME_NANOS = 23;
+const int FIELD_ID_MAX_MERGE_TIME_NANOS = 24;
+const int FIELD_ID_P50_PULL_TIME_NANOS = 25;
+const int FIELD_ID_P99_PULL_TIME_NANOS = 26;
 
 // for AtomMetricStats proto
 const int FIELD_ID_ATOM_METRIC_STATS = 17;
@@ -99,11 +105,30 @@ const int FIELD_ID_MIN_BUCKET_BOUNDARY_DELAY_NS = 9;
 const int FIELD_ID_MAX_BUCKET_BOUNDARY_DELAY_NS = 10;
 const int FIELD_ID_BUCKET_UNKNOWN_CONDITION = 11;
 const int FIELD_ID_BUCKET_COUNT = 12;
+const int FIELD_ID_MATCHED_EVENT_COUNT = 16;
+const int FIELD_ID_EVENT_PROCESSING_TIME_NS = 17;
+const int FIELD_ID_DUMP_TIME_NS = 18;
+const int FIELD_ID_MAX_BYTE_SIZE = 19;
+const int FIELD_ID_STALE_BASES_EVICTED = 20;
 
 namespace {
 
+void writeDimensionStringToProto(const string& str, ReportStrings* str_set,
+                                 ProtoOutputStream* protoOutput) {
+    if (str_set == nullptr) {
+        protoOutput->write(FIELD_TYPE_STRING | DIMENSIONS_VALUE_VALUE_STR, str);
+    } else if (str_set->isDictionary()) {
+        protoOutput->write(FIELD_TYPE_UINT32 | DIMENSIONS_VALUE_VALUE_STR_INDEX,
+                           (int)str_set->insert(str));
+    } else {
+        str_set->insert(str);
+        protoOutput->write(FIELD_TYPE_UINT64 | DIMENSIONS_VALUE_VALUE_STR_HASH,
+                           (long long)Hash64(str));
+    }
+}
+
 void writeDimensionToProtoHelper(const std::vector<FieldValue>& dims, size_t* index, int depth,
-                                 int prefix, std::set<string>* str_set,
+                                 int prefix, ReportStrings* str_set,
                                  ProtoOutputStream* protoOutput) {
     size_t count = dims.size();
     while (*index < count) {
@@ -136,14 +161,7 @@ void writeDimensionToProtoHelper(const std::vector<FieldValue>& dims, size_t* in
                                        dim.mValue.float_value);
                     break;
                 case STRING:
-                    if (str_set == nullptr) {
-                        protoOutput->write(FIELD_TYPE_STRING | DIMENSIONS_VALUE_VALUE_STR,
-                                           dim.mValue.str_value);
-                    } else {
-                        str_set->insert(dim.mValue.str_value);
-                        protoOutput->write(FIELD_TYPE_UINT64 | DIMENSIONS_VALUE_VALUE_STR_HASH,
-                                           (long long)Hash64(dim.mValue.str_value));
-                    }
+                    writeDimensionStringToProto(dim.mValue.getString(), str_set, protoOutput);
                     break;
                 default:
                     break;
@@ -172,7 +190,7 @@ void writeDimensionToProtoHelper(const std::vector<FieldValue>& dims, size_t* in
 
 void writeDimensionLeafToProtoHelper(const std::vector<FieldValue>& dims,
                                      const int dimensionLeafField, size_t* index, int depth,
-                                     int prefix, std::set<string>* str_set,
+                                     int prefix, ReportStrings* str_set,
                                      ProtoOutputStream* protoOutput) {
     size_t count = dims.size();
     while (*index < count) {
@@ -202,14 +220,7 @@ void writeDimensionLeafToProtoHelper(const std::vector<FieldValue>& dims,
                                        dim.mValue.float_value);
                     break;
                 case STRING:
-                    if (str_set == nullptr) {
-                        protoOutput->write(FIELD_TYPE_STRING | DIMENSIONS_VALUE_VALUE_STR,
-                                           dim.mValue.str_value);
-                    } else {
-                        str_set->insert(dim.mValue.str_value);
-                        protoOutput->write(FIELD_TYPE_UINT64 | DIMENSIONS_VALUE_VALUE_STR_HASH,
-                                           (long long)Hash64(dim.mValue.str_value));
-                    }
+                    writeDimensionStringToProto(dim.mValue.getString(), str_set, protoOutput);
                     break;
                 default:
                     break;
@@ -271,7 +282,7 @@ void writeDimensionPathToProtoHelper(const std::vector<Matcher>& fieldMatchers,
 
 }  // namespace
 
-void writeDimensionToProto(const HashableDimensionKey& dimension, std::set<string> *str_set,
+void writeDimensionToProto(const HashableDimensionKey& dimension, ReportStrings* str_set,
                            ProtoOutputStream* protoOutput) {
     if (dimension.getValues().size() == 0) {
         return;
@@ -286,7 +297,7 @@ void writeDimensionToProto(const HashableDimensionKey& dimension, std::set<strin
 
 void writeDimensionLeafNodesToProto(const HashableDimensionKey& dimension,
                                     const int dimensionLeafFieldId,
-                                    std::set<string> *str_set,
+                                    ReportStrings* str_set,
                                     ProtoOutputStream* protoOutput) {
     if (dimension.getValues().size() == 0) {
         return;
@@ -367,15 +378,17 @@ void writeFieldValueTreeToStreamHelper(int tagId, const std::vector<FieldValue>&
                                        dim.mValue.float_value);
                     break;
                 case STRING: {
+                    // Written from the view, atoms are not copied out of their buffer.
+                    const std::string_view str = dim.mValue.getView();
                     protoOutput->write(FIELD_TYPE_STRING | repeatedFieldMask | fieldNum,
-                                       dim.mValue.str_value);
+                                       str.data(), str.size());
                     break;
                 }
-                case STORAGE:
-                    protoOutput->write(FIELD_TYPE_MESSAGE | fieldNum,
-                                       (const char*)dim.mValue.storage_value.data(),
-                                       dim.mValue.storage_value.size());
+                case STORAGE: {
+                    const std::string_view bytes = dim.mValue.getView();
+                    protoOutput->write(FIELD_TYPE_MESSAGE | fieldNum, bytes.data(), bytes.size());
                     break;
+                }
                 default:
                     break;
             }
@@ -516,6 +529,16 @@ void writePullerStatsToStream(const std::pair<int, StatsdStats::PulledAtomStats>
                            pullTimeoutMetadata.pullTimeoutElapsedMillis);
         protoOutput->end(timeoutMetadataToken);
     }
+    protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_AVERAGE_MERGE_TIME_NANOS,
+                       (long long)pair.second.avgMergeTimeNs);
+    protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_MAX_MERGE_TIME_NANOS,
+                       (long long)pair.second.maxMergeTimeNs);
+    protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_P50_PULL_TIME_NANOS,
+                       (long long)StatsdStats::getLatencyHistogramPercentileNs(
+                               pair.second.pullTimeHistogram, 50));
+    protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_P99_PULL_TIME_NANOS,
+                       (long long)StatsdStats::getLatencyHistogramPercentileNs(
+                               pair.second.pullTimeHistogram, 99));
     protoOutput->end(token);
 }
 
@@ -548,6 +571,16 @@ void writeAtomMetricStatsToStream(const std::pair<int64_t, StatsdStats::AtomMetr
                              (long long)pair.second.bucketUnknownCondition, protoOutput);
     writeNonZeroStatToStream(FIELD_TYPE_INT64 | FIELD_ID_BUCKET_COUNT,
                              (long long)pair.second.bucketCount, protoOutput);
+    writeNonZeroStatToStream(FIELD_TYPE_INT64 | FIELD_ID_MATCHED_EVENT_COUNT,
+                             (long long)pair.second.matchedEventCount, protoOutput);
+    writeNonZeroStatToStream(FIELD_TYPE_INT64 | FIELD_ID_EVENT_PROCESSING_TIME_NS,
+                             (long long)pair.second.eventProcessingTimeNs, protoOutput);
+    writeNonZeroStatToStream(FIELD_TYPE_INT64 | FIELD_ID_DUMP_TIME_NS,
+                             (long long)pair.second.dumpTimeNs, protoOutput);
+    writeNonZeroStatToStream(FIELD_TYPE_INT64 | FIELD_ID_MAX_BYTE_SIZE,
+                             (long long)pair.second.maxByteSize, protoOutput);
+    writeNonZeroStatToStream(FIELD_TYPE_INT64 | FIELD_ID_STALE_BASES_EVICTED,
+                             (long long)pair.second.staleBasesEvicted, protoOutput);
     protoOutput->end(token);
 }
 
@@ -616,14 +649,13 @@ bool checkPermissionForIds(const char* permission, pid_t pid, uid_t uid) {
 
 void mapIsolatedUidsToHostUidInLogEvent(const sp<UidMap> uidMap, LogEvent& event) {
     uint8_t remainingUidCount = event.getNumUidFields();
-    vector<FieldValue>* fieldValues = event.getMutableValues();
-    auto it = fieldValues->begin();
-    while(it != fieldValues->end() && remainingUidCount > 0) {
-        if (isUidField(*it)) {
-            it->mValue.setInt(uidMap->getHostUidOrSelf(it->mValue.int_value));
+    const vector<FieldValue>& fieldValues = event.getValues();
+    for (size_t i = 0; i < fieldValues.size() && remainingUidCount > 0; i++) {
+        if (isUidField(fieldValues[i])) {
+            const int hostUid = uidMap->getHostUidOrSelf(fieldValues[i].mValue.int_value);
+            event.getMutableValue(i).setInt(hostUid);
             remainingUidCount--;
         }
-        ++it;
     }
 }
 
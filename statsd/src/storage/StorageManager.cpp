@@ -21,9 +21,13 @@
 #include "guardrail/StatsdStats.h"
 #include "storage/StorageManager.h"
 #include "stats_log_util.h"
+#include "utils/ScopedTrace.h"
 
 #include <android-base/file.h>
 #include <private/android_filesystem_config.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <zlib.h>
 #include <fstream>
 
 namespace android {
@@ -51,17 +55,178 @@ const int FIELD_ID_REPORTS = 2;
 
 std::mutex StorageManager::sTrainInfoMutex;
 
+std::mutex StorageManager::sDataFilesMutex;
+bool StorageManager::sDataFilesLoaded = false;
+std::map<ConfigKey, std::map<string, StorageManager::DataFile>> StorageManager::sDataFiles;
+
+std::atomic<bool> StorageManager::sCompressReports(false);
+
+std::shared_ptr<AsyncTaskQueue> StorageManager::sWriteQueue;
+
+std::mutex StorageManager::sWriteFileMutex;
+
+std::mutex StorageManager::sSyncMutex;
+int StorageManager::sSyncBatchDepth = 0;
+std::set<string> StorageManager::sDirsToSync;
+
 using android::base::StringPrintf;
 using std::unique_ptr;
 
+namespace {
+
+// Returns the tag and length of a ConfigMetricsReportList report of [size] bytes.
+string reportHeader(size_t size) {
+    string header;
+    // Wire type 2 is length delimited.
+    for (uint64_t value : {(uint64_t)(FIELD_ID_REPORTS << 3 | 2), (uint64_t)size}) {
+        while (value >= 0x80) {
+            header.push_back((char)((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        header.push_back((char)value);
+    }
+    return header;
+}
+
+// Parses the header of a ConfigMetricsReportList report from the [size] bytes of [data] into
+// [headerSize] and [reportSize]. Returns false if the header is malformed or incomplete.
+bool parseReportHeader(const uint8_t* data, size_t size, size_t* headerSize, size_t* reportSize) {
+    size_t pos = 0;
+    uint64_t values[2];
+    for (uint64_t& value : values) {
+        value = 0;
+        for (int shift = 0;; shift += 7) {
+            if (pos >= size || shift >= 64) {
+                return false;
+            }
+            const uint8_t byte = data[pos++];
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                break;
+            }
+        }
+    }
+    if (values[0] != (uint64_t)(FIELD_ID_REPORTS << 3 | 2)) {
+        return false;
+    }
+    *headerSize = pos;
+    *reportSize = values[1];
+    return true;
+}
+
+// Returns the bytes of the complete reports at the start of the checkpoint log open at [fd], of
+// [fileSize] bytes. A crash while a report is appended leaves a partial one at the end.
+size_t completeCheckpointBytes(int fd, size_t fileSize) {
+    size_t offset = 0;
+    while (offset < fileSize) {
+        // A header is at most two varints of 10 bytes.
+        uint8_t header[20];
+        const ssize_t bytesRead = pread(fd, header, sizeof(header), offset);
+        size_t headerSize;
+        size_t reportSize;
+        if (bytesRead <= 0 || !parseReportHeader(header, bytesRead, &headerSize, &reportSize) ||
+            reportSize > fileSize - offset - headerSize) {
+            break;
+        }
+        offset += headerSize + reportSize;
+    }
+    return offset;
+}
+
+// Returns the name of [file] in the stats-data directory, or an empty string if [file] is not in
+// that directory.
+string dataFileName(const string& file) {
+    const string dir = STATS_DATA_DIR "/";
+    if (file.compare(0, dir.size(), dir) != 0 || file.find('/', dir.size()) != string::npos) {
+        return "";
+    }
+    return file.substr(dir.size());
+}
+
+// The reports are compressed as gzip streams. A serialized proto cannot start with 0x1f, which
+// would be field 3 with the invalid wire type 7, so the raw and compressed files are told apart
+// by their first bytes.
+const uint8_t kGzipMagic[] = {0x1f, 0x8b};
+
+// Adds 16 to the window size of zlib to use the gzip format.
+const int kGzipWindowBits = 15 + 16;
+
+bool isCompressedReport(const uint8_t* data, size_t size) {
+    return size >= sizeof(kGzipMagic) && memcmp(data, kGzipMagic, sizeof(kGzipMagic)) == 0;
+}
+
+// Compresses the [size] bytes of [data] into [out]. Returns false on failure.
+bool compressReport(const uint8_t* data, size_t size, string* out) {
+    z_stream stream = {};
+    // The reports are written while holding the metrics lock, so speed matters more than ratio.
+    if (deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, kGzipWindowBits, 8 /*memLevel*/,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    out->resize(deflateBound(&stream, size));
+    stream.next_in = const_cast<uint8_t*>(data);
+    stream.avail_in = size;
+    stream.next_out = reinterpret_cast<uint8_t*>(out->data());
+    stream.avail_out = out->size();
+    const int result = deflate(&stream, Z_FINISH);
+    out->resize(stream.total_out);
+    deflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+
+// Decompresses the gzip stream of [in] into [out]. Returns false on failure.
+bool decompressReport(const string& in, string* out) {
+    z_stream stream = {};
+    if (inflateInit2(&stream, kGzipWindowBits) != Z_OK) {
+        return false;
+    }
+    stream.next_in = reinterpret_cast<uint8_t*>(const_cast<char*>(in.data()));
+    stream.avail_in = in.size();
+    out->clear();
+    int result = Z_OK;
+    uint8_t chunk[16 * 1024];
+    while (result == Z_OK) {
+        stream.next_out = chunk;
+        stream.avail_out = sizeof(chunk);
+        result = inflate(&stream, Z_NO_FLUSH);
+        out->append(reinterpret_cast<char*>(chunk), sizeof(chunk) - stream.avail_out);
+    }
+    inflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+
+// Makes the renames in [dir] durable.
+void fsyncDir(const string& dir) {
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        VLOG("Failed to open %s", dir.c_str());
+        return;
+    }
+    if (fsync(fd) != 0) {
+        ALOGE("Failed to sync %s: %s", dir.c_str(), strerror(errno));
+    }
+    close(fd);
+}
+
+// Whether [file] is still the file that [readStat] describes, and was not replaced since.
+bool isSameFile(const string& file, const struct stat& readStat) {
+    struct stat fileStat;
+    return stat(file.c_str(), &fileStat) == 0 && fileStat.st_dev == readStat.st_dev &&
+           fileStat.st_ino == readStat.st_ino;
+}
+
+}  // namespace
+
 struct FileName {
     int64_t mTimestampSec;
     int mUid;
     int64_t mConfigId;
     bool mIsHistory;
+    bool mIsCheckpoint;
     string getFullFileName(const char* path) {
-        return StringPrintf("%s/%lld_%d_%lld%s", path, (long long)mTimestampSec, (int)mUid,
-                            (long long)mConfigId, (mIsHistory ? "_history" : ""));
+        return StringPrintf("%s/%lld_%d_%lld%s%s", path, (long long)mTimestampSec, (int)mUid,
+                            (long long)mConfigId, (mIsCheckpoint ? "_checkpoint" : ""),
+                            (mIsHistory ? "_history" : ""));
     };
 };
 
@@ -75,6 +240,11 @@ string StorageManager::getDataHistoryFileName(long wallClockSec, int uid, int64_
                         (long long)id);
 }
 
+string StorageManager::getDataCheckpointFileName(long wallClockSec, int uid, int64_t id) {
+    return StringPrintf("%s/%ld_%d_%lld_checkpoint", STATS_DATA_DIR, wallClockSec, uid,
+                        (long long)id);
+}
+
 static string findTrainInfoFileNameLocked(const string& trainName) {
     unique_ptr<DIR, decltype(&closedir)> dir(opendir(TRAIN_INFO_DIR), closedir);
     if (dir == NULL) {
@@ -99,7 +269,7 @@ static string findTrainInfoFileNameLocked(const string& trainName) {
 }
 
 // Returns array of int64_t which contains timestamp in seconds, uid,
-// configID and whether the file is a local history file.
+// configID and whether the file is a local history file or a checkpoint log.
 static void parseFileName(char* name, FileName* output) {
     int64_t result[3];
     int index = 0;
@@ -119,34 +289,249 @@ static void parseFileName(char* name, FileName* output) {
     output->mTimestampSec = result[0];
     output->mUid = result[1];
     output->mConfigId = result[2];
-    // check if the file is a local history.
+    // check if the file is a checkpoint log, then if it is a local history.
+    output->mIsCheckpoint = (substr != nullptr && strcmp("checkpoint", substr) == 0);
+    if (output->mIsCheckpoint) {
+        substr = strtok(nullptr, "_");
+    }
     output->mIsHistory = (substr != nullptr && strcmp("history", substr) == 0);
 }
 
 void StorageManager::writeFile(const char* file, const void* buffer, int numBytes) {
-    int fd = open(file, O_WRONLY | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    ScopedTrace trace("StorageManager::writeFile", {{"bytes", numBytes}});
+    // The content goes to a hidden file, which the directory scans skip, then replaces [file], so
+    // that a power loss leaves either the old or the new content.
+    const string path(file);
+    const size_t slash = path.rfind('/');
+    const string dir = slash == string::npos ? "." : path.substr(0, slash);
+    const string tmpFile = dir + "/." + path.substr(slash + 1) + ".tmp";
+    // Two writes to the same file would interleave in the same temporary file.
+    std::unique_lock<std::mutex> writeLock(sWriteFileMutex);
+    int fd = open(tmpFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
     if (fd == -1) {
-        VLOG("Attempt to access %s but failed", file);
+        VLOG("Attempt to access %s but failed", tmpFile.c_str());
         return;
     }
-    trimToFit(STATS_SERVICE_DIR);
-    trimToFit(STATS_DATA_DIR);
+    // The data files are trimmed from the index, without listing the directory, after the write.
+    const bool isDataFile = !dataFileName(file).empty();
+    if (!isDataFile) {
+        trimToFit(STATS_SERVICE_DIR);
+    }
+
+    bool written = android::base::WriteFully(fd, buffer, numBytes) && fdatasync(fd) == 0;
+
+    int result = fchown(fd, AID_STATSD, AID_STATSD);
+    if (result) {
+        VLOG("Failed to chown %s to statsd", file);
+    }
 
-    if (android::base::WriteFully(fd, buffer, numBytes)) {
+    close(fd);
+
+    if (written) {
+        // The data files are replaced under sDataFilesMutex, so that a dump reading the previous
+        // content does not delete the new one, see forEachConfigMetricsReport().
+        std::unique_lock<std::mutex> lock(sDataFilesMutex, std::defer_lock);
+        if (isDataFile) {
+            lock.lock();
+        }
+        written = rename(tmpFile.c_str(), file) == 0;
+    }
+    if (written) {
         VLOG("Successfully wrote %s", file);
+        syncDir(dir);
     } else {
         ALOGE("Failed to write %s", file);
+        written = false;
+        remove(tmpFile.c_str());
     }
+    writeLock.unlock();
 
-    int result = fchown(fd, AID_STATSD, AID_STATSD);
-    if (result) {
-        VLOG("Failed to chown %s to statsd", file);
+    std::lock_guard<std::mutex> lock(sDataFilesMutex);
+    loadDataFileIndexLocked();
+    if (isDataFile && written) {
+        noteDataFileLocked(file, numBytes);
+    }
+    trimDataFilesLocked();
+}
+
+StorageManager::ScopedSyncBatch::ScopedSyncBatch() {
+    std::lock_guard<std::mutex> lock(sSyncMutex);
+    sSyncBatchDepth++;
+}
+
+StorageManager::ScopedSyncBatch::~ScopedSyncBatch() {
+    // Ends after the writes queued during the batch, so that they are synced with it.
+    runWrite([]() {
+        std::set<string> dirs;
+        {
+            std::lock_guard<std::mutex> lock(sSyncMutex);
+            if (--sSyncBatchDepth > 0) {
+                return;
+            }
+            dirs.swap(sDirsToSync);
+        }
+        for (const string& dir : dirs) {
+            fsyncDir(dir);
+        }
+    });
+}
+
+void StorageManager::setWriteQueue(std::shared_ptr<AsyncTaskQueue> queue) {
+    sWriteQueue = std::move(queue);
+}
+
+void StorageManager::flushWrites() {
+    if (sWriteQueue != nullptr) {
+        sWriteQueue->drain();
+    }
+}
+
+void StorageManager::runWrite(std::function<void()> write) {
+    if (sWriteQueue == nullptr) {
+        write();
+        return;
+    }
+    // Shared so that the buffers of the write are not copied into the queue.
+    auto task = std::make_shared<std::function<void()>>(std::move(write));
+    if (sWriteQueue->push([task]() { (*task)(); })) {
+        return;
+    }
+    // The queue is full. Waits for it, so that the writes to a file stay in order.
+    sWriteQueue->drain();
+    (*task)();
+}
+
+void StorageManager::writeFileAsync(const string& file, string content) {
+    runWrite([file, content = std::move(content)]() {
+        writeFile(file.c_str(), content.data(), content.size());
+    });
+}
+
+void StorageManager::syncDir(const string& dir) {
+    {
+        std::lock_guard<std::mutex> lock(sSyncMutex);
+        if (sSyncBatchDepth > 0) {
+            sDirsToSync.insert(dir);
+            return;
+        }
+    }
+    fsyncDir(dir);
+}
+
+void StorageManager::setCompressReports(bool enabled) {
+    sCompressReports.store(enabled, std::memory_order_relaxed);
+}
+
+void StorageManager::writeReportFile(const string& file, vector<uint8_t> report) {
+    // Compressed by the write queue too.
+    runWrite([file, report = std::move(report)]() {
+        if (sCompressReports.load(std::memory_order_relaxed)) {
+            string compressed;
+            if (compressReport(report.data(), report.size(), &compressed)) {
+                VLOG("Compressed a report of %zu bytes to %zu", report.size(), compressed.size());
+                writeFile(file.c_str(), compressed.data(), compressed.size());
+                return;
+            }
+            ALOGE("Failed to compress a report, writing it uncompressed");
+        }
+        writeFile(file.c_str(), report.data(), report.size());
+    });
+}
+
+void StorageManager::appendCheckpoint(const ConfigKey& key, vector<uint8_t> report) {
+    runWrite([key, report = std::move(report)]() { appendCheckpointNow(key, report); });
+}
+
+void StorageManager::appendCheckpointNow(const ConfigKey& key, const vector<uint8_t>& report) {
+    ScopedTrace trace("StorageManager::appendCheckpoint", {{"bytes", (int64_t)report.size()}});
+    // Held during the write, so that the reports being read are not appended to, see
+    // forEachConfigMetricsReport().
+    std::lock_guard<std::mutex> lock(sDataFilesMutex);
+    loadDataFileIndexLocked();
+    std::map<string, DataFile>& dataFiles = sDataFiles[key];
+    string file;
+    for (const auto& [name, dataFile] : dataFiles) {
+        if (dataFile.mIsCheckpoint && !dataFile.mIsHistory && !dataFile.mSealed) {
+            file = StringPrintf("%s/%s", STATS_DATA_DIR, name.c_str());
+        }
+    }
+    for (long wallClockSec = getWallClockSec(); file.empty(); wallClockSec++) {
+        // A sealed log of the same second may still be read.
+        file = getDataCheckpointFileName(wallClockSec, key.GetUid(), key.GetId());
+        if (dataFiles.find(dataFileName(file)) != dataFiles.end()) {
+            file.clear();
+        }
     }
 
+    int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        ALOGE("Failed to open %s", file.c_str());
+        if (dataFiles.empty()) {
+            sDataFiles.erase(key);
+        }
+        return;
+    }
+    struct stat fileStat;
+    size_t fileSize = fstat(fd, &fileStat) == 0 ? fileStat.st_size : 0;
+    // Drops a partial report left by a crash, which would hide the reports appended after it.
+    const size_t completeBytes = completeCheckpointBytes(fd, fileSize);
+    if (completeBytes < fileSize && ftruncate(fd, completeBytes) == 0) {
+        ALOGW("Dropped %zu bytes of a partial report from %s", fileSize - completeBytes,
+              file.c_str());
+        fileSize = completeBytes;
+    }
+    const string header = reportHeader(report.size());
+    if (android::base::WriteFully(fd, header.data(), header.size()) &&
+        android::base::WriteFully(fd, report.data(), report.size())) {
+        VLOG("Appended a report of %zu bytes to %s", report.size(), file.c_str());
+        fileSize += header.size() + report.size();
+    } else {
+        ALOGE("Failed to append a report to %s", file.c_str());
+        if (ftruncate(fd, fileSize) != 0) {
+            ALOGE("Failed to truncate %s", file.c_str());
+        }
+    }
+    if (fchown(fd, AID_STATSD, AID_STATSD)) {
+        VLOG("Failed to chown %s to statsd", file.c_str());
+    }
     close(fd);
+
+    noteDataFileLocked(file, fileSize);
+    // Large logs are sealed so that trimming drops the oldest reports in smaller pieces.
+    if (fileSize >= StatsdStats::kMaxCheckpointLogBytes) {
+        dataFiles[dataFileName(file)].mSealed = true;
+    }
+    trimDataFilesLocked();
+}
+
+bool StorageManager::readReportFile(int fd, string* report) {
+    string content;
+    if (!android::base::ReadFdToString(fd, &content)) {
+        return false;
+    }
+    if (!isCompressedReport(reinterpret_cast<const uint8_t*>(content.data()), content.size())) {
+        *report = std::move(content);
+        return true;
+    }
+    if (!decompressReport(content, report)) {
+        ALOGE("Failed to decompress a report of %zu bytes", content.size());
+        return false;
+    }
+    return true;
 }
 
 bool StorageManager::writeTrainInfo(const InstallTrainInfo& trainInfo) {
+    if (trainInfo.trainName.empty()) {
+        return false;
+    }
+    if (sWriteQueue == nullptr) {
+        return writeTrainInfoNow(trainInfo);
+    }
+    runWrite([trainInfo]() { writeTrainInfoNow(trainInfo); });
+    return true;
+}
+
+bool StorageManager::writeTrainInfoNow(const InstallTrainInfo& trainInfo) {
     std::lock_guard<std::mutex> lock(sTrainInfoMutex);
 
     if (trainInfo.trainName.empty()) {
@@ -261,6 +646,7 @@ bool StorageManager::writeTrainInfo(const InstallTrainInfo& trainInfo) {
 }
 
 bool StorageManager::readTrainInfo(const std::string& trainName, InstallTrainInfo& trainInfo) {
+    flushWrites();
     std::lock_guard<std::mutex> lock(sTrainInfoMutex);
     return readTrainInfoLocked(trainName, trainInfo);
 }
@@ -387,6 +773,7 @@ bool StorageManager::readTrainInfoLocked(const std::string& trainName, InstallTr
 }
 
 vector<InstallTrainInfo> StorageManager::readAllTrainInfo() {
+    flushWrites();
     std::lock_guard<std::mutex> lock(sTrainInfoMutex);
     vector<InstallTrainInfo> trainInfoList;
     unique_ptr<DIR, decltype(&closedir)> dir(opendir(TRAIN_INFO_DIR), closedir);
@@ -418,6 +805,8 @@ void StorageManager::deleteFile(const char* file) {
     } else {
         VLOG("Successfully deleted %s", file);
     }
+    std::lock_guard<std::mutex> lock(sDataFilesMutex);
+    forgetDataFileLocked(file);
 }
 
 void StorageManager::deleteAllFiles(const char* path) {
@@ -478,27 +867,15 @@ void StorageManager::sendBroadcast(const char* path,
 }
 
 bool StorageManager::hasConfigMetricsReport(const ConfigKey& key) {
-    unique_ptr<DIR, decltype(&closedir)> dir(opendir(STATS_DATA_DIR), closedir);
-    if (dir == NULL) {
-        VLOG("Path %s does not exist", STATS_DATA_DIR);
+    flushWrites();
+    std::lock_guard<std::mutex> lock(sDataFilesMutex);
+    loadDataFileIndexLocked();
+    auto it = sDataFiles.find(key);
+    if (it == sDataFiles.end()) {
         return false;
     }
-
-    string suffix = StringPrintf("%d_%lld", key.GetUid(), (long long)key.GetId());
-
-    dirent* de;
-    while ((de = readdir(dir.get()))) {
-        char* name = de->d_name;
-        if (name[0] == '.') continue;
-
-        size_t nameLen = strlen(name);
-        size_t suffixLen = suffix.length();
-        if (suffixLen <= nameLen &&
-            strncmp(name + nameLen - suffixLen, suffix.c_str(), suffixLen) == 0) {
-            // Check again that the file name is parseable.
-            FileName output;
-            parseFileName(name, &output);
-            if (output.mTimestampSec == -1 || output.mIsHistory) continue;
+    for (const auto& [name, dataFile] : it->second) {
+        if (!dataFile.mIsHistory) {
             return true;
         }
     }
@@ -507,49 +884,288 @@ bool StorageManager::hasConfigMetricsReport(const ConfigKey& key) {
 
 void StorageManager::appendConfigMetricsReport(const ConfigKey& key, ProtoOutputStream* proto,
                                                bool erase_data, bool isAdb) {
-    unique_ptr<DIR, decltype(&closedir)> dir(opendir(STATS_DATA_DIR), closedir);
-    if (dir == NULL) {
-        VLOG("Path %s does not exist", STATS_DATA_DIR);
-        return;
+    ScopedTrace trace("StorageManager::appendConfigMetricsReport");
+    forEachConfigMetricsReport(key, erase_data, isAdb, [proto](int fd, bool isCheckpoint) {
+        string content;
+        if (!isCheckpoint) {
+            if (readReportFile(fd, &content)) {
+                proto->write(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_REPORTS,
+                             content.c_str(), content.size());
+            }
+            return true;
+        }
+        if (!android::base::ReadFdToString(fd, &content)) {
+            return true;
+        }
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(content.data());
+        size_t offset = 0;
+        size_t headerSize;
+        size_t reportSize;
+        while (parseReportHeader(data + offset, content.size() - offset, &headerSize,
+                                 &reportSize) &&
+               reportSize <= content.size() - offset - headerSize) {
+            proto->write(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_REPORTS,
+                         content.c_str() + offset + headerSize, reportSize);
+            offset += headerSize + reportSize;
+        }
+        return true;
+    });
+}
+
+bool StorageManager::writeConfigMetricsReportsToFd(const ConfigKey& key, int outFd,
+                                                   bool erase_data, bool isAdb,
+                                                   size_t* totalBytes) {
+    ScopedTrace trace("StorageManager::writeConfigMetricsReportsToFd");
+    // The output is malformed once a write fails, so the files are kept for the next dump.
+    auto writeReports = [outFd, totalBytes](int fd, bool isCheckpoint) {
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0) {
+            return true;
+        }
+        if (isCheckpoint) {
+            // The log is already made of ConfigMetricsReportList reports.
+            const size_t logSize = completeCheckpointBytes(fd, fileStat.st_size);
+            off_t offset = 0;
+            while ((size_t)offset < logSize) {
+                if (sendfile(outFd, fd, &offset, logSize - offset) <= 0) {
+                    ALOGE("Failed to copy a checkpoint log: %s", strerror(errno));
+                    return false;
+                }
+            }
+            *totalBytes += logSize;
+            return true;
+        }
+        const size_t fileSize = fileStat.st_size;
+        uint8_t magic[sizeof(kGzipMagic)];
+        if (pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+            isCompressedReport(magic, sizeof(magic))) {
+            // The kernel cannot decompress, so compressed reports are read into memory.
+            string content;
+            if (!readReportFile(fd, &content)) {
+                return true;
+            }
+            const size_t bytes = writeConfigMetricsReportToFd(
+                    outFd, vector<uint8_t>(content.begin(), content.end()));
+            *totalBytes += bytes;
+            return bytes > 0;
+        }
+        const string header = reportHeader(fileSize);
+        if (!android::base::WriteFully(outFd, header.data(), header.size())) {
+            ALOGE("Failed to write a report header");
+            return false;
+        }
+        off_t offset = 0;
+        while ((size_t)offset < fileSize) {
+            if (sendfile(outFd, fd, &offset, fileSize - offset) <= 0) {
+                ALOGE("Failed to copy a report: %s", strerror(errno));
+                return false;
+            }
+        }
+        *totalBytes += header.size() + fileSize;
+        return true;
+    };
+    return forEachConfigMetricsReport(key, erase_data, isAdb, writeReports);
+}
+
+size_t StorageManager::writeConfigMetricsReportToFd(int outFd, const vector<uint8_t>& buffer) {
+    const string header = reportHeader(buffer.size());
+    if (!android::base::WriteFully(outFd, header.data(), header.size()) ||
+        !android::base::WriteFully(outFd, buffer.data(), buffer.size())) {
+        ALOGE("Failed to write a report");
+        return 0;
     }
+    return header.size() + buffer.size();
+}
 
-    dirent* de;
-    while ((de = readdir(dir.get()))) {
-        char* name = de->d_name;
-        string fileName(name);
-        if (name[0] == '.') continue;
-        FileName output;
-        parseFileName(name, &output);
+bool StorageManager::forEachConfigMetricsReport(
+        const ConfigKey& key, bool erase_data, bool isAdb,
+        const std::function<bool(int fd, bool isCheckpoint)>& consume) {
+    // Includes the reports still queued for writing.
+    flushWrites();
+    // The files are read without holding sDataFilesMutex, one dump per config at a time.
+    std::map<string, DataFile> dataFiles;
+    {
+        std::lock_guard<std::mutex> lock(sDataFilesMutex);
+        loadDataFileIndexLocked();
+        auto it = sDataFiles.find(key);
+        if (it == sDataFiles.end()) {
+            return true;
+        }
+        // The next checkpoints go to a new log.
+        for (auto& [name, dataFile] : it->second) {
+            dataFile.mSealed = true;
+        }
+        dataFiles = it->second;
+    }
 
-        if (output.mTimestampSec == -1 || (output.mIsHistory && !isAdb) ||
-            output.mUid != key.GetUid() || output.mConfigId != key.GetId()) {
+    for (const auto& [fileName, dataFile] : dataFiles) {
+        if (dataFile.mIsHistory && !isAdb) {
             continue;
         }
 
         auto fullPathName = StringPrintf("%s/%s", STATS_DATA_DIR, fileName.c_str());
         int fd = open(fullPathName.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat readStat;
+        bool hasReadStat = false;
         if (fd != -1) {
-            string content;
-            if (android::base::ReadFdToString(fd, &content)) {
-                proto->write(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_REPORTS,
-                             content.c_str(), content.size());
-            }
+            hasReadStat = fstat(fd, &readStat) == 0;
+            const bool consumed = consume(fd, dataFile.mIsCheckpoint);
             close(fd);
+            if (!consumed) {
+                return false;
+            }
         } else {
             ALOGE("file cannot be opened");
         }
 
+        if (!erase_data && (dataFile.mIsHistory || isAdb)) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(sDataFilesMutex);
+        // A report written to the same file name since it was read is kept for the next dump.
+        if (hasReadStat && !isSameFile(fullPathName, readStat)) {
+            VLOG("%s was replaced while it was read, keeping it", fullPathName.c_str());
+            continue;
+        }
         if (erase_data) {
-            remove(fullPathName.c_str());
-        } else if (!output.mIsHistory && !isAdb) {
+            if (remove(fullPathName.c_str()) != 0) {
+                VLOG("Attempt to delete %s but is not found", fullPathName.c_str());
+            }
+            forgetDataFileLocked(fullPathName);
+        } else {
             // This means a real data owner has called to get this data. But the config says it
             // wants to keep a local history. So now this file must be renamed as a history file.
             // So that next time, when owner calls getData() again, this data won't be uploaded
             // again. rename returns 0 on success
             if (rename(fullPathName.c_str(), (fullPathName + "_history").c_str())) {
                 ALOGE("Failed to rename file %s", fullPathName.c_str());
+            } else {
+                forgetDataFileLocked(fullPathName);
+                noteDataFileLocked(fullPathName + "_history", dataFile.mFileSizeBytes);
+            }
+        }
+    }
+    return true;
+}
+
+void StorageManager::rebuildDataFileIndex() {
+    std::lock_guard<std::mutex> lock(sDataFilesMutex);
+    sDataFilesLoaded = false;
+    loadDataFileIndexLocked();
+}
+
+void StorageManager::loadDataFileIndexLocked() {
+    if (sDataFilesLoaded) {
+        return;
+    }
+    sDataFilesLoaded = true;
+    // The logs being read by a dump stay sealed, so that no report is appended to them.
+    std::set<string> sealedFiles;
+    for (const auto& [key, dataFiles] : sDataFiles) {
+        for (const auto& [name, dataFile] : dataFiles) {
+            if (dataFile.mSealed) {
+                sealedFiles.insert(name);
+            }
+        }
+    }
+    sDataFiles.clear();
+    unique_ptr<DIR, decltype(&closedir)> dir(opendir(STATS_DATA_DIR), closedir);
+    if (dir == NULL) {
+        VLOG("Path %s does not exist", STATS_DATA_DIR);
+        return;
+    }
+    dirent* de;
+    while ((de = readdir(dir.get()))) {
+        if (de->d_name[0] == '.') continue;
+        const string file = StringPrintf("%s/%s", STATS_DATA_DIR, de->d_name);
+        struct stat fileStat;
+        noteDataFileLocked(file, stat(file.c_str(), &fileStat) == 0 ? fileStat.st_size : 0);
+    }
+    for (auto& [key, dataFiles] : sDataFiles) {
+        for (auto& [name, dataFile] : dataFiles) {
+            dataFile.mSealed = sealedFiles.find(name) != sealedFiles.end();
+        }
+    }
+}
+
+void StorageManager::noteDataFileLocked(const string& file, size_t fileSizeBytes) {
+    string name = dataFileName(file);
+    if (name.empty()) {
+        return;
+    }
+    string nameToParse = name;
+    FileName output;
+    parseFileName(nameToParse.data(), &output);
+    if (output.mTimestampSec == -1) {
+        return;
+    }
+    std::map<string, DataFile>& dataFiles = sDataFiles[ConfigKey(output.mUid, output.mConfigId)];
+    // A file noted again keeps its seal.
+    const auto it = dataFiles.find(name);
+    const bool sealed = it != dataFiles.end() && it->second.mSealed;
+    dataFiles[name] = {output.mTimestampSec, output.mIsHistory, output.mIsCheckpoint, sealed,
+                       fileSizeBytes};
+}
+
+void StorageManager::forgetDataFileLocked(const string& file) {
+    string name = dataFileName(file);
+    if (name.empty()) {
+        return;
+    }
+    string nameToParse = name;
+    FileName output;
+    parseFileName(nameToParse.data(), &output);
+    if (output.mTimestampSec == -1) {
+        return;
+    }
+    auto it = sDataFiles.find(ConfigKey(output.mUid, output.mConfigId));
+    if (it == sDataFiles.end()) {
+        return;
+    }
+    it->second.erase(name);
+    if (it->second.empty()) {
+        sDataFiles.erase(it);
+    }
+}
+
+void StorageManager::trimDataFilesLocked() {
+    int totalFileSize = 0;
+    vector<FileInfo> fileNames;
+    vector<string> filesToDelete;
+    auto nowSec = getWallClockSec();
+    for (const auto& [key, dataFiles] : sDataFiles) {
+        for (const auto& [name, dataFile] : dataFiles) {
+            string file_name = StringPrintf("%s/%s", STATS_DATA_DIR, name.c_str());
+            long fileAge = nowSec - dataFile.mTimestampSec;
+            if (fileAge > StatsdStats::kMaxAgeSecond ||
+                (dataFile.mIsHistory && fileAge > StatsdStats::kMaxLocalHistoryAgeSecond)) {
+                filesToDelete.push_back(file_name);
+                continue;
             }
+            totalFileSize += dataFile.mFileSizeBytes;
+            fileNames.emplace_back(file_name, dataFile.mIsHistory, dataFile.mFileSizeBytes,
+                                   fileAge);
+        }
+    }
+
+    if (fileNames.size() > StatsdStats::kMaxFileNumber ||
+        totalFileSize > StatsdStats::kMaxFileSize) {
+        sortFiles(&fileNames);
+    }
+
+    // Start removing files from oldest to be under the limit.
+    while (fileNames.size() > 0 && (fileNames.size() > StatsdStats::kMaxFileNumber ||
+                                    totalFileSize > StatsdStats::kMaxFileSize)) {
+        totalFileSize -= fileNames.at(fileNames.size() - 1).mFileSizeBytes;
+        filesToDelete.push_back(fileNames.at(fileNames.size() - 1).mFileName);
+        fileNames.pop_back();
+    }
+
+    for (const string& file : filesToDelete) {
+        if (remove(file.c_str()) != 0) {
+            VLOG("Attempt to delete %s but is not found", file.c_str());
         }
+        forgetDataFileLocked(file);
     }
 }
 
@@ -567,7 +1183,8 @@ bool StorageManager::readFileToString(const char* file, string* content) {
     return res;
 }
 
-void StorageManager::readConfigFromDisk(map<ConfigKey, StatsdConfig>& configsMap) {
+void StorageManager::readConfigFromDisk(map<ConfigKey, StatsdConfig>& configsMap,
+                                        map<ConfigKey, string>* fileNames) {
     unique_ptr<DIR, decltype(&closedir)> dir(opendir(STATS_SERVICE_DIR), closedir);
     if (dir == NULL) {
         VLOG("no default config on disk");
@@ -591,6 +1208,9 @@ void StorageManager::readConfigFromDisk(map<ConfigKey, StatsdConfig>& configsMap
                 StatsdConfig config;
                 if (config.ParseFromString(content)) {
                     configsMap[ConfigKey(output.mUid, output.mConfigId)] = config;
+                    if (fileNames != nullptr) {
+                        (*fileNames)[ConfigKey(output.mUid, output.mConfigId)] = file_name;
+                    }
                     VLOG("map key uid=%lld|configID=%lld", (long long)output.mUid,
                          (long long)output.mConfigId);
                 }
@@ -600,6 +1220,39 @@ void StorageManager::readConfigFromDisk(map<ConfigKey, StatsdConfig>& configsMap
     }
 }
 
+void StorageManager::refreshConfigFileTimestamp(const ConfigKey& key, const string& fileName) {
+    unique_ptr<DIR, decltype(&closedir)> dir(opendir(STATS_SERVICE_DIR), closedir);
+    if (dir == NULL) {
+        VLOG("no default config on disk");
+        return;
+    }
+    // The other files of the key are stale copies, which would get the same name.
+    dirent* de;
+    while ((de = readdir(dir.get()))) {
+        char* name = de->d_name;
+        if (name[0] == '.') continue;
+
+        FileName output;
+        parseFileName(name, &output);
+        if (output.mTimestampSec == -1 || output.mUid != key.GetUid() ||
+            output.mConfigId != key.GetId()) {
+            continue;
+        }
+        const string otherFileName = output.getFullFileName(STATS_SERVICE_DIR);
+        if (otherFileName != fileName) {
+            deleteFile(otherFileName.c_str());
+        }
+    }
+
+    // Same clock as the names of the files written by ConfigManager.
+    const string newFileName = StringPrintf("%s/%ld_%d_%lld", STATS_SERVICE_DIR,
+                                            (long)time(nullptr), key.GetUid(),
+                                            (long long)key.GetId());
+    if (newFileName != fileName && rename(fileName.c_str(), newFileName.c_str()) != 0) {
+        ALOGE("Failed to rename file %s", fileName.c_str());
+    }
+}
+
 bool StorageManager::readConfigFromDisk(const ConfigKey& key, StatsdConfig* config) {
     string content;
     return config != nullptr &&
@@ -675,6 +1328,12 @@ void StorageManager::sortFiles(vector<FileInfo>* fileNames) {
 }
 
 void StorageManager::trimToFit(const char* path, bool parseTimestampOnly) {
+    if (strcmp(path, STATS_DATA_DIR) == 0) {
+        std::lock_guard<std::mutex> lock(sDataFilesMutex);
+        loadDataFileIndexLocked();
+        trimDataFilesLocked();
+        return;
+    }
     unique_ptr<DIR, decltype(&closedir)> dir(opendir(path), closedir);
     if (dir == NULL) {
         VLOG("Path %s does not exist", path);
@@ -694,6 +1353,7 @@ void StorageManager::trimToFit(const char* path, bool parseTimestampOnly) {
             file_name = StringPrintf("%s/%s", path, name);
             output.mTimestampSec = StrToInt64(strtok(name, "_"));
             output.mIsHistory = false;
+            output.mIsCheckpoint = false;
         } else {
             parseFileName(name, &output);
             file_name = output.getFullFileName(path);
@@ -18,10 +18,18 @@
 #define STORAGE_MANAGER_H
 
 #include <android/util/ProtoOutputStream.h>
+#include <gtest/gtest_prod.h>
 #include <utils/Log.h>
 #include <utils/RefBase.h>
 
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+
 #include "packages/UidMap.h"
+#include "utils/AsyncTaskQueue.h"
 
 namespace android {
 namespace os {
@@ -45,12 +53,66 @@ public:
     };
 
     /**
-     * Writes a given byte array as a file to the specified file path.
+     * Defers the directory syncs of the files written while it is alive until it is destroyed,
+     * so that a sweep of writes syncs each directory once. Batches can be nested.
+     */
+    class ScopedSyncBatch {
+    public:
+        ScopedSyncBatch();
+        ~ScopedSyncBatch();
+
+        ScopedSyncBatch(const ScopedSyncBatch&) = delete;
+        ScopedSyncBatch& operator=(const ScopedSyncBatch&) = delete;
+    };
+
+    /**
+     * Writes a given byte array as a file to the specified file path. The file is replaced
+     * atomically, and synced to disk along with its directory, see ScopedSyncBatch.
      */
     static void writeFile(const char* file, const void* buffer, int numBytes);
 
     /**
-     * Writes train info.
+     * Runs the writes of writeFileAsync(), writeReportFile(), appendCheckpoint() and
+     * writeTrainInfo() on the worker of [queue] instead of the calling thread, if not null. A
+     * write that does not fit in the queue waits for the queued ones, then runs on the calling
+     * thread. Should only be called once at boot.
+     */
+    static void setWriteQueue(std::shared_ptr<AsyncTaskQueue> queue);
+
+    /**
+     * Blocks until the writes queued so far are done, and the directory syncs of the ended
+     * ScopedSyncBatches too. The reads of the data files and train info call it first.
+     */
+    static void flushWrites();
+
+    /**
+     * Same as writeFile(), but may return before the file is written, see setWriteQueue().
+     */
+    static void writeFileAsync(const string& file, string content);
+
+    /**
+     * Writes a serialized ConfigMetricsReport as a data file, compressed if enabled with
+     * setCompressReports(). May return before the file is written, see setWriteQueue(). The
+     * reports are decompressed when read back, whether or not compression is still enabled.
+     */
+    static void writeReportFile(const string& file, vector<uint8_t> report);
+
+    /**
+     * Compresses the reports written by writeReportFile() afterwards.
+     */
+    static void setCompressReports(bool enabled);
+
+    /**
+     * Appends a serialized ConfigMetricsReport to the checkpoint log of [key], which is created
+     * if needed. The log is read back like the other data files, and a new log is started once
+     * it was read. The reports of the log are not compressed. May return before the report is
+     * written, see setWriteQueue().
+     */
+    static void appendCheckpoint(const ConfigKey& key, vector<uint8_t> report);
+
+    /**
+     * Writes train info. Returns false if it could not be written, or once queued if there is a
+     * write queue, see setWriteQueue().
      */
     static bool writeTrainInfo(const InstallTrainInfo& trainInfo);
 
@@ -89,6 +151,14 @@ public:
      */
     static void deleteSuffixedFiles(const char* path, const char* suffix);
 
+    /**
+     * Rebuilds the index of the files in the stats-data directory from a scan of the directory.
+     * The index is then kept up to date by the writes and deletions of StorageManager, so this
+     * is called once at startup, and by tests that create files in the directory themselves. The
+     * checkpoint logs being read by a dump stay sealed.
+     */
+    static void rebuildDataFileIndex();
+
     /**
      * Send broadcasts to relevant receiver for each data stored on disk.
      */
@@ -117,10 +187,33 @@ public:
     static void appendConfigMetricsReport(const ConfigKey& key, ProtoOutputStream* proto,
                                           bool erase_data, bool isAdb);
 
+    /**
+     * Same as appendConfigMetricsReport(), but writes the reports to [outFd] as reports of a
+     * ConfigMetricsReportList. The uncompressed files are copied by the kernel instead of being
+     * read into memory. Adds the number of bytes written to [totalBytes]. Returns false if
+     * writing to [outFd] failed, in which case the file being written and the next ones are kept.
+     */
+    static bool writeConfigMetricsReportsToFd(const ConfigKey& key, int outFd, bool erase_data,
+                                              bool isAdb, size_t* totalBytes);
+
+    /**
+     * Writes the serialized ConfigMetricsReport in [buffer] to [outFd] as a report of a
+     * ConfigMetricsReportList. Returns the number of bytes written.
+     */
+    static size_t writeConfigMetricsReportToFd(int outFd, const vector<uint8_t>& buffer);
+
     /**
      * Call to load the saved configs from disk.
      */
-    static void readConfigFromDisk(std::map<ConfigKey, StatsdConfig>& configsMap);
+    static void readConfigFromDisk(std::map<ConfigKey, StatsdConfig>& configsMap,
+                                   std::map<ConfigKey, string>* fileNames = nullptr);
+
+    /**
+     * Renames [fileName], the saved config of [key] read by readConfigFromDisk(), to the current
+     * time, so that it is not trimmed for its age while it is in use. Cheaper than writing it
+     * again. The other files of [key] are deleted first.
+     */
+    static void refreshConfigFileTimestamp(const ConfigKey& key, const string& fileName);
 
     /**
      * Call to load the specified config from disk. Returns false if the config file does not
@@ -150,15 +243,92 @@ public:
 
     static string getDataHistoryFileName(long wallClockSec, int uid, int64_t id);
 
+    static string getDataCheckpointFileName(long wallClockSec, int uid, int64_t id);
+
     static void sortFiles(vector<FileInfo>* fileNames);
 
 private:
+    FRIEND_TEST(StorageManagerTest, ReplacedReportKeptTest);
+    FRIEND_TEST(StorageManagerTest, CheckpointSealedDuringRebuildTest);
+
     /**
      * Prints disk usage statistics about a directory related to statsd.
      */
     static void printDirStats(int out, const char* path);
 
+    /**
+     * Calls [consume] with an open fd of each ConfigMetricsReport or checkpoint log found on disk
+     * for [key], then deletes, renames or keeps the file as described in
+     * appendConfigMetricsReport(). If [consume] returns false, the file and the next ones are
+     * kept as they are, and false is returned. A file replaced by writeFile() while it is read is
+     * kept, since it has a new report.
+     */
+    static bool forEachConfigMetricsReport(
+            const ConfigKey& key, bool erase_data, bool isAdb,
+            const std::function<bool(int fd, bool isCheckpoint)>& consume);
+
+    /**
+     * Reads the report file open at [fd] into [report], decompressing it if needed. Returns false
+     * if the file could not be read or decompressed.
+     */
+    static bool readReportFile(int fd, string* report);
+
+    struct DataFile {
+        int64_t mTimestampSec;
+        bool mIsHistory;
+        // Made of ConfigMetricsReportList reports, see appendCheckpoint().
+        bool mIsCheckpoint;
+        // Whether appendCheckpoint() must start a new log instead of appending to this one.
+        bool mSealed;
+        size_t mFileSizeBytes;
+    };
+
+    // Scans the stats-data directory into sDataFiles if it was not yet.
+    static void loadDataFileIndexLocked();
+
+    // Adds [file] to sDataFiles, or updates it, if it is a data file.
+    static void noteDataFileLocked(const string& file, size_t fileSizeBytes);
+
+    // Removes [file] from sDataFiles, if it is a data file.
+    static void forgetDataFileLocked(const string& file);
+
+    // Same as trimToFit(STATS_DATA_DIR), from sDataFiles.
+    static void trimDataFilesLocked();
+
+    // Guards the index of the stats-data directory, and the replacement of its files.
+    static std::mutex sDataFilesMutex;
+
+    static bool sDataFilesLoaded;
+
+    // The files in the stats-data directory by config key, then by file name.
+    static std::map<ConfigKey, std::map<string, DataFile>> sDataFiles;
+
     static std::mutex sTrainInfoMutex;
+
+    static std::atomic<bool> sCompressReports;
+
+    // Runs [write] on sWriteQueue if there is one, otherwise on the calling thread.
+    static void runWrite(std::function<void()> write);
+
+    static void appendCheckpointNow(const ConfigKey& key, const vector<uint8_t>& report);
+
+    static bool writeTrainInfoNow(const InstallTrainInfo& trainInfo);
+
+    static std::shared_ptr<AsyncTaskQueue> sWriteQueue;
+
+    // Syncs [dir] now, or at the end of the current ScopedSyncBatch.
+    static void syncDir(const string& dir);
+
+    // Serializes the writes of writeFile(), since the writes to a file share its temporary file.
+    // Acquired before sDataFilesMutex.
+    static std::mutex sWriteFileMutex;
+
+    // Guards the directory syncs deferred by ScopedSyncBatch.
+    static std::mutex sSyncMutex;
+
+    static int sSyncBatchDepth;
+
+    static std::set<string> sDirsToSync;
 };
 
 }  // namespace statsd
@@ -20,10 +20,16 @@
 #include "IncidentdReporter.h"
 #include "packages/UidMap.h"
 #include "stats_log_util.h"
+#include "utils/ThreadTopology.h"
 
 #include <android/util/ProtoOutputStream.h>
 #include <incident/incident_report.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 namespace android {
@@ -121,23 +127,13 @@ void getProtoData(const int64_t& rule_id, int64_t metricId, const MetricDimensio
         reader->move(toRead);
     }
 }
-}  // namespace
-
-bool GenerateIncidentReport(const IncidentdDetails& config, int64_t rule_id, int64_t metricId,
-                            const MetricDimensionKey& dimensionKey, int64_t metricValue,
-                            const ConfigKey& configKey) {
-    if (config.section_size() == 0) {
-        VLOG("The alert %lld contains zero section in config(%d,%lld)", (unsigned long long)rule_id,
-             configKey.GetUid(), (long long)configKey.GetId());
-        return false;
-    }
-
+// Builds the incident report of [config] with [headers] and asks incidentd to take it.
+bool takeIncidentReport(const IncidentdDetails& config, const vector<vector<uint8_t>>& headers) {
     AIncidentReportArgs* args = AIncidentReportArgs_init();
 
-    vector<uint8_t> protoData;
-    getProtoData(rule_id, metricId, dimensionKey, metricValue, configKey,
-                 config.alert_description(), &protoData);
-    AIncidentReportArgs_addHeader(args, protoData.data(), protoData.size());
+    for (const vector<uint8_t>& header : headers) {
+        AIncidentReportArgs_addHeader(args, header.data(), header.size());
+    }
 
     for (int i = 0; i < config.section_size(); i++) {
         AIncidentReportArgs_addSection(args, config.section(i));
@@ -166,6 +162,157 @@ bool GenerateIncidentReport(const IncidentdDetails& config, int64_t rule_id, int
     return err == NO_ERROR;
 }
 
+/**
+ * Merges the incident reports requested within kMergeWindowNs of each other with the same
+ * sections, privacy policy and receiver into one report with all their headers, since each
+ * report is expensive for the whole device. The reports are taken by a thread of the merger when
+ * their window expires.
+ */
+class IncidentReportMerger {
+public:
+    static IncidentReportMerger& getInstance() {
+        static IncidentReportMerger merger;
+        return merger;
+    }
+
+    ~IncidentReportMerger() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+        }
+        mCondition.notify_one();
+        if (mThread.joinable()) {
+            mThread.join();
+        }
+    }
+
+    // Returns false if the header is dropped, as the merged report has too many.
+    bool add(const IncidentdDetails& config, vector<uint8_t> header) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        const auto [it, inserted] = mPendingReports.emplace(getMergeKey(config), PendingReport());
+        PendingReport& report = it->second;
+        if (inserted) {
+            report.config = config;
+            report.deadlineNs = getElapsedRealtimeNs() + kMergeWindowNs;
+        }
+        if (report.headers.size() >= kMaxHeaders) {
+            ALOGW("Too many merged incident reports, dropped the header of alert %s",
+                  config.alert_description().c_str());
+            return false;
+        }
+        report.headers.push_back(std::move(header));
+        if (!mThread.joinable()) {
+            mThread = std::thread([this] { run(); });
+        }
+        mCondition.notify_one();
+        return true;
+    }
+
+    void setTakeReportFunc(const TakeIncidentReportFunc& takeReport) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mTakeReport = takeReport != nullptr ? takeReport : takeIncidentReport;
+    }
+
+private:
+    static const int64_t kMergeWindowNs = 2 * NS_PER_SEC;
+
+    // Max number of headers of a merged report, the next ones are dropped.
+    static const size_t kMaxHeaders = 20;
+
+    struct PendingReport {
+        IncidentdDetails config;
+        vector<vector<uint8_t>> headers;
+        int64_t deadlineNs = 0;
+    };
+
+    IncidentReportMerger() = default;
+
+    // The requests with the same key are merged.
+    static string getMergeKey(const IncidentdDetails& config) {
+        vector<int32_t> sections(config.section().begin(), config.section().end());
+        std::sort(sections.begin(), sections.end());
+        sections.erase(std::unique(sections.begin(), sections.end()), sections.end());
+        string key;
+        for (int32_t section : sections) {
+            key += std::to_string(section) + ",";
+        }
+        return key + ";" + std::to_string(config.dest()) + ";" + config.receiver_pkg() + ";" +
+               config.receiver_cls();
+    }
+
+    void run() {
+        ScopedThreadRole role(ThreadRole::BACKGROUND);
+        std::unique_lock<std::mutex> lock(mMutex);
+        while (!mStopping) {
+            const int64_t nowNs = getElapsedRealtimeNs();
+            int64_t nextDeadlineNs = INT64_MAX;
+            vector<PendingReport> dueReports;
+            for (auto it = mPendingReports.begin(); it != mPendingReports.end();) {
+                if (it->second.deadlineNs <= nowNs) {
+                    dueReports.push_back(std::move(it->second));
+                    it = mPendingReports.erase(it);
+                } else {
+                    nextDeadlineNs = std::min(nextDeadlineNs, it->second.deadlineNs);
+                    it++;
+                }
+            }
+
+            if (!dueReports.empty()) {
+                // incidentd is called without blocking the new requests.
+                const TakeIncidentReportFunc takeReport = mTakeReport;
+                lock.unlock();
+                for (const PendingReport& report : dueReports) {
+                    VLOG("Taking an incident report with %zu headers", report.headers.size());
+                    if (!takeReport(report.config, report.headers)) {
+                        ALOGW("Failed to generate incident report.");
+                    }
+                }
+                lock.lock();
+                continue;
+            }
+
+            if (nextDeadlineNs == INT64_MAX) {
+                mCondition.wait(lock,
+                                [this] { return mStopping || !mPendingReports.empty(); });
+            } else {
+                mCondition.wait_for(lock, std::chrono::nanoseconds(nextDeadlineNs - nowNs));
+            }
+        }
+    }
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    bool mStopping = false;
+
+    TakeIncidentReportFunc mTakeReport = takeIncidentReport;
+
+    // By merge key.
+    std::map<string, PendingReport> mPendingReports;
+
+    std::thread mThread;
+};
+
+}  // namespace
+
+bool GenerateIncidentReport(const IncidentdDetails& config, int64_t rule_id, int64_t metricId,
+                            const MetricDimensionKey& dimensionKey, int64_t metricValue,
+                            const ConfigKey& configKey) {
+    if (config.section_size() == 0) {
+        VLOG("The alert %lld contains zero section in config(%d,%lld)", (unsigned long long)rule_id,
+             configKey.GetUid(), (long long)configKey.GetId());
+        return false;
+    }
+
+    vector<uint8_t> protoData;
+    getProtoData(rule_id, metricId, dimensionKey, metricValue, configKey,
+                 config.alert_description(), &protoData);
+    return IncidentReportMerger::getInstance().add(config, std::move(protoData));
+}
+
+void SetTakeIncidentReportFunc(const TakeIncidentReportFunc& takeReport) {
+    IncidentReportMerger::getInstance().setTakeReportFunc(takeReport);
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -16,6 +16,9 @@
 
 #pragma once
 
+#include <functional>
+#include <vector>
+
 #include "HashableDimensionKey.h"
 #include "config/ConfigKey.h"
 #include "src/statsd_config.pb.h"  // Alert, IncidentdDetails
@@ -25,12 +28,23 @@ namespace os {
 namespace statsd {
 
 /**
- * Calls incidentd to trigger an incident report and put in dropbox for uploading.
+ * Calls incidentd to trigger an incident report and put in dropbox for uploading. The reports
+ * requested within a short window with the same sections, privacy policy and receiver are merged
+ * into one report with all their headers, taken asynchronously once the window expires. Returns
+ * false if the request is invalid, or if the merged report already has too many headers. The
+ * failures of incidentd are only logged.
  */
 bool GenerateIncidentReport(const IncidentdDetails& config, int64_t rule_id, int64_t metricId,
                             const MetricDimensionKey& dimensionKey, int64_t metricValue,
                             const ConfigKey& configKey);
 
+// Takes an incident report of [config] with [headers]. Returns false if it failed.
+using TakeIncidentReportFunc = std::function<bool(
+        const IncidentdDetails& config, const std::vector<std::vector<uint8_t>>& headers)>;
+
+// Replaces the calls to incidentd of the merged reports. Only used in tests, null restores them.
+void SetTakeIncidentReportFunc(const TakeIncidentReportFunc& takeReport);
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
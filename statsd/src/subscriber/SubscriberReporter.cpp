@@ -19,6 +19,11 @@
 
 #include "SubscriberReporter.h"
 
+#include <algorithm>
+
+#include "stats_log_util.h"
+#include "utils/ThreadTopology.h"
+
 using std::lock_guard;
 
 namespace android {
@@ -52,9 +57,28 @@ void SubscriberReporter::broadcastSubscriberDied(void* rawPir) {
 }
 
 SubscriberReporter::SubscriberReporter() :
+    mElapsedRealtimeNs(getElapsedRealtimeNs),
     mBroadcastSubscriberDeathRecipient(AIBinder_DeathRecipient_new(broadcastSubscriberDied)) {
 }
 
+SubscriberReporter::~SubscriberReporter() {
+    stopCoalescingThread();
+}
+
+void SubscriberReporter::stopCoalescingThread() {
+    {
+        lock_guard<mutex> lock(mLock);
+        mStopping = true;
+    }
+    mCoalescingCondition.notify_one();
+    if (mCoalescingThread.joinable()) {
+        mCoalescingThread.join();
+    }
+    lock_guard<mutex> lock(mLock);
+    mStopping = false;
+    mCoalescedBroadcasts.clear();
+}
+
 void SubscriberReporter::setBroadcastSubscriber(const ConfigKey& configKey,
                                                 int64_t subscriberId,
                                                 const shared_ptr<IPendingIntentRef>& pir) {
@@ -90,7 +114,7 @@ void SubscriberReporter::unsetBroadcastSubscriber(const ConfigKey& configKey,
 
 void SubscriberReporter::alertBroadcastSubscriber(const ConfigKey& configKey,
                                                   const Subscription& subscription,
-                                                  const MetricDimensionKey& dimKey) const {
+                                                  const MetricDimensionKey& dimKey) {
     // Reminder about ids:
     //  subscription id - name of the Subscription (that ties the Alert to the broadcast)
     //  subscription rule_id - the name of the Alert (that triggers the broadcast)
@@ -102,46 +126,140 @@ void SubscriberReporter::alertBroadcastSubscriber(const ConfigKey& configKey,
     VLOG("SubscriberReporter::alertBroadcastSubscriber called.");
     lock_guard<mutex> lock(mLock);
 
+    const int64_t intervalNs =
+            subscription.broadcast_subscriber_details().min_broadcast_interval_millis() *
+            NS_PER_SEC / 1000;
+    if (intervalNs > 0) {
+        const int64_t nowNs = mElapsedRealtimeNs();
+        const auto [it, inserted] =
+                mCoalescedBroadcasts.emplace(std::make_pair(configKey, subscription.id()),
+                                             CoalescedBroadcast());
+        CoalescedBroadcast& broadcast = it->second;
+        broadcast.intervalNs = intervalNs;
+        if (!inserted && (nowNs < broadcast.lastBroadcastNs + intervalNs ||
+                          !broadcast.pendingKeys.empty())) {
+            const HashableDimensionKey& key = dimKey.getDimensionKeyInWhat();
+            vector<HashableDimensionKey>& pendingKeys = broadcast.pendingKeys;
+            if (std::find(pendingKeys.begin(), pendingKeys.end(), key) == pendingKeys.end()) {
+                if (pendingKeys.size() < kMaxCoalescedDimensionKeys) {
+                    pendingKeys.push_back(key);
+                } else {
+                    VLOG("Too many coalesced dimensions for subscription %lld",
+                         (long long)subscription.id());
+                }
+            }
+            broadcast.subscription = subscription;
+            return;
+        }
+        broadcast.lastBroadcastNs = nowNs;
+        if (!mCoalescingThread.joinable()) {
+            mCoalescingThread = std::thread([this] { sendCoalescedBroadcasts(); });
+        }
+        mCoalescingCondition.notify_one();
+    }
+
+    shared_ptr<IPendingIntentRef> pir = findSubscriberLocked(configKey, subscription);
+    if (pir != nullptr) {
+        sendBroadcastLocked(pir, configKey, subscription,
+                            dimKey.getDimensionKeyInWhat().toStatsDimensionsValueParcel());
+    }
+}
+
+void SubscriberReporter::sendCoalescedBroadcasts() {
+    ScopedThreadRole role(ThreadRole::BACKGROUND);
+    std::unique_lock<mutex> lock(mLock);
+    while (!mStopping) {
+        const int64_t nowNs = mElapsedRealtimeNs();
+        const int64_t nextBroadcastNs = sendDueCoalescedBroadcastsLocked(nowNs);
+        if (nextBroadcastNs == INT64_MAX) {
+            mCoalescingCondition.wait(
+                    lock, [this] { return mStopping || !mCoalescedBroadcasts.empty(); });
+        } else {
+            mCoalescingCondition.wait_for(lock, std::chrono::nanoseconds(nextBroadcastNs - nowNs));
+        }
+    }
+}
+
+int64_t SubscriberReporter::sendDueCoalescedBroadcastsLocked(int64_t nowNs) {
+    int64_t nextBroadcastNs = INT64_MAX;
+    for (auto it = mCoalescedBroadcasts.begin(); it != mCoalescedBroadcasts.end();) {
+        CoalescedBroadcast& broadcast = it->second;
+        if (nowNs < broadcast.lastBroadcastNs + broadcast.intervalNs) {
+            nextBroadcastNs =
+                    std::min(nextBroadcastNs, broadcast.lastBroadcastNs + broadcast.intervalNs);
+            it++;
+            continue;
+        }
+        if (broadcast.pendingKeys.empty()) {
+            // The next trigger is sent right away.
+            it = mCoalescedBroadcasts.erase(it);
+            continue;
+        }
+
+        const ConfigKey& configKey = it->first.first;
+        shared_ptr<IPendingIntentRef> pir =
+                findSubscriberLocked(configKey, broadcast.subscription);
+        if (pir != nullptr) {
+            StatsDimensionsValueParcel dimensions;
+            if (broadcast.pendingKeys.size() == 1) {
+                dimensions = broadcast.pendingKeys[0].toStatsDimensionsValueParcel();
+            } else {
+                dimensions.field = 0;
+                dimensions.valueType = STATS_DIMENSIONS_VALUE_TUPLE_TYPE;
+                for (const HashableDimensionKey& key : broadcast.pendingKeys) {
+                    dimensions.tupleValue.push_back(key.toStatsDimensionsValueParcel());
+                }
+            }
+            sendBroadcastLocked(pir, configKey, broadcast.subscription, dimensions);
+        }
+        broadcast.pendingKeys.clear();
+        broadcast.lastBroadcastNs = nowNs;
+        nextBroadcastNs = std::min(nextBroadcastNs, nowNs + broadcast.intervalNs);
+        it++;
+    }
+    return nextBroadcastNs;
+}
+
+shared_ptr<IPendingIntentRef> SubscriberReporter::findSubscriberLocked(
+        const ConfigKey& configKey, const Subscription& subscription) const {
     if (!subscription.has_broadcast_subscriber_details()
             || !subscription.broadcast_subscriber_details().has_subscriber_id()) {
         ALOGE("Broadcast subscriber does not have an id.");
-        return;
+        return nullptr;
     }
     int64_t subscriberId = subscription.broadcast_subscriber_details().subscriber_id();
 
-    vector<string> cookies;
-    cookies.reserve(subscription.broadcast_subscriber_details().cookie_size());
-    for (auto& cookie : subscription.broadcast_subscriber_details().cookie()) {
-        cookies.push_back(cookie);
-    }
-
     auto it1 = mIntentMap.find(configKey);
     if (it1 == mIntentMap.end()) {
         ALOGW("Cannot inform subscriber for missing config key %s ", configKey.ToString().c_str());
-        return;
+        return nullptr;
     }
     auto it2 = it1->second.find(subscriberId);
     if (it2 == it1->second.end()) {
         ALOGW("Cannot inform subscriber of config %s for missing subscriberId %lld ",
                 configKey.ToString().c_str(), (long long)subscriberId);
-        return;
+        return nullptr;
     }
-    sendBroadcastLocked(it2->second, configKey, subscription, cookies, dimKey);
+    return it2->second;
 }
 
 void SubscriberReporter::sendBroadcastLocked(const shared_ptr<IPendingIntentRef>& pir,
                                              const ConfigKey& configKey,
                                              const Subscription& subscription,
-                                             const vector<string>& cookies,
-                                             const MetricDimensionKey& dimKey) const {
+                                             const StatsDimensionsValueParcel& dimensions) const {
     VLOG("SubscriberReporter::sendBroadcastLocked called.");
+    vector<string> cookies;
+    cookies.reserve(subscription.broadcast_subscriber_details().cookie_size());
+    for (auto& cookie : subscription.broadcast_subscriber_details().cookie()) {
+        cookies.push_back(cookie);
+    }
     pir->sendSubscriberBroadcast(
             configKey.GetUid(),
             configKey.GetId(),
             subscription.id(),
             subscription.rule_id(),
             cookies,
-            dimKey.getDimensionKeyInWhat().toStatsDimensionsValueParcel());
+            dimensions);
 }
 
 }  // namespace statsd
@@ -20,7 +20,11 @@
 #include <utils/RefBase.h>
 #include <utils/String16.h>
 
+#include <condition_variable>
+#include <functional>
+#include <map>
 #include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -49,7 +53,7 @@ public:
         return subscriberReporter;
     }
 
-    ~SubscriberReporter(){};
+    ~SubscriberReporter();
     SubscriberReporter(SubscriberReporter const&) = delete;
     void operator=(SubscriberReporter const&) = delete;
 
@@ -69,16 +73,61 @@ public:
      * Sends a broadcast via the intentSender previously stored for the
      * given (configKey, subscriberId) pair by setBroadcastSubscriber.
      * Information about the subscriber, as well as information extracted from the dimKey, is sent.
+     * With BroadcastSubscriberDetails.min_broadcast_interval_millis, the broadcast may be
+     * coalesced with the next ones of the subscription and sent later.
      */
     void alertBroadcastSubscriber(const ConfigKey& configKey,
                                   const Subscription& subscription,
-                                  const MetricDimensionKey& dimKey) const;
+                                  const MetricDimensionKey& dimKey);
 
 private:
     SubscriberReporter();
 
+    // The max number of dimensions of a coalesced broadcast, the next ones are dropped.
+    static const size_t kMaxCoalescedDimensionKeys = 100;
+
+    // The broadcasts of a subscription with a min broadcast interval.
+    struct CoalescedBroadcast {
+        int64_t intervalNs = 0;
+        int64_t lastBroadcastNs = 0;
+
+        // The subscription and the distinct dimensions of the triggers since the last broadcast.
+        Subscription subscription;
+        vector<HashableDimensionKey> pendingKeys;
+    };
+
     mutable mutex mLock;
 
+    // By config key and subscription id. An entry is removed once its interval expired without
+    // pending dimensions.
+    std::map<std::pair<ConfigKey, int64_t>, CoalescedBroadcast> mCoalescedBroadcasts;
+
+    // The thread that sends the coalesced broadcasts when their interval expires. Started with
+    // the first entry of mCoalescedBroadcasts.
+    std::thread mCoalescingThread;
+    std::condition_variable mCoalescingCondition;
+    bool mStopping = false;
+
+    // The clock of the broadcast intervals, getElapsedRealtimeNs() but in tests.
+    std::function<int64_t()> mElapsedRealtimeNs;
+
+    // Body of mCoalescingThread.
+    void sendCoalescedBroadcasts();
+
+    // Sends the coalesced broadcasts whose interval expired at [nowNs]. Returns the time of the
+    // next one, or INT64_MAX if none is pending.
+    int64_t sendDueCoalescedBroadcastsLocked(int64_t nowNs);
+
+    // Joins mCoalescingThread and drops the coalesced broadcasts. The thread is started again by
+    // the next broadcast with an interval.
+    void stopCoalescingThread();
+
+    /**
+     * Returns the intentSender of the subscriber of [subscription], or nullptr.
+     */
+    shared_ptr<IPendingIntentRef> findSubscriberLocked(const ConfigKey& configKey,
+                                                       const Subscription& subscription) const;
+
     /** Maps <ConfigKey, SubscriberId> -> IPendingIntentRef (which represents a PendingIntent). */
     unordered_map<ConfigKey, unordered_map<int64_t, shared_ptr<IPendingIntentRef>>> mIntentMap;
 
@@ -89,8 +138,7 @@ private:
     void sendBroadcastLocked(const shared_ptr<IPendingIntentRef>& pir,
                              const ConfigKey& configKey,
                              const Subscription& subscription,
-                             const vector<string>& cookies,
-                             const MetricDimensionKey& dimKey) const;
+                             const StatsDimensionsValueParcel& dimensions) const;
 
     ::ndk::ScopedAIBinder_DeathRecipient mBroadcastSubscriberDeathRecipient;
 
@@ -105,6 +153,7 @@ private:
     FRIEND_TEST(SubscriberReporterTest, TestBroadcastSubscriberDeathRemovesPir);
     FRIEND_TEST(SubscriberReporterTest, TestBroadcastSubscriberDeathRemovesPirAndConfigKey);
     FRIEND_TEST(SubscriberReporterTest, TestBroadcastSubscriberDeathKeepsReplacedPir);
+    FRIEND_TEST(SubscriberReporterTest, TestCoalescedBroadcasts);
 };
 
 }  // namespace statsd
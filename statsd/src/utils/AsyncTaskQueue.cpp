@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "AsyncTaskQueue.h"
+
+#include <sys/prctl.h>
+
+#include "utils/ThreadTopology.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+AsyncTaskQueue::AsyncTaskQueue(size_t maxPendingTasks, const std::string& threadName)
+    : mMaxPendingTasks(maxPendingTasks), mThreadName(threadName) {
+    mThread = std::thread([this] { workerLoop(); });
+}
+
+AsyncTaskQueue::~AsyncTaskQueue() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mTaskPushed.notify_all();
+    mThread.join();
+}
+
+bool AsyncTaskQueue::push(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mTasks.size() >= mMaxPendingTasks) {
+            mDroppedTasks++;
+            return false;
+        }
+        mTasks.push_back(std::move(task));
+    }
+    mTaskPushed.notify_one();
+    return true;
+}
+
+void AsyncTaskQueue::drain() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mIdle.wait(lock, [this] { return mStopping || (mTasks.empty() && !mRunning); });
+}
+
+size_t AsyncTaskQueue::getDroppedTaskCount() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mDroppedTasks;
+}
+
+void AsyncTaskQueue::workerLoop() {
+    prctl(PR_SET_NAME, mThreadName.c_str());
+    ScopedThreadRole role(ThreadRole::BACKGROUND);
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        mTaskPushed.wait(lock, [this] { return mStopping || !mTasks.empty(); });
+        if (mStopping) {
+            mTasks.clear();
+            mIdle.notify_all();
+            return;
+        }
+        std::function<void()> task = std::move(mTasks.front());
+        mTasks.pop_front();
+        mRunning = true;
+
+        lock.unlock();
+        task();
+        lock.lock();
+
+        mRunning = false;
+        if (mTasks.empty()) {
+            mIdle.notify_all();
+        }
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
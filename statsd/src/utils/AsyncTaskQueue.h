@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * A bounded queue of tasks run in order by a single worker thread, for work that must not block
+ * the caller, such as binder calls or process launches.
+ *
+ * Tasks pushed while the queue is full are dropped rather than waited for.
+ */
+class AsyncTaskQueue {
+public:
+    /**
+     * \param maxPendingTasks number of tasks that can wait for the worker.
+     * \param threadName name of the worker thread, at most 15 characters.
+     */
+    AsyncTaskQueue(size_t maxPendingTasks, const std::string& threadName);
+
+    AsyncTaskQueue(const AsyncTaskQueue&) = delete;
+    AsyncTaskQueue& operator=(const AsyncTaskQueue&) = delete;
+
+    // Waits for the running task, if any. The pending tasks are dropped.
+    ~AsyncTaskQueue();
+
+    /**
+     * Queues [task] for the worker. Returns false, and drops it, if the queue is full.
+     */
+    bool push(std::function<void()> task);
+
+    /**
+     * Blocks until every task pushed so far has run.
+     */
+    void drain();
+
+    size_t getDroppedTaskCount() const;
+
+private:
+    void workerLoop();
+
+    const size_t mMaxPendingTasks;
+
+    const std::string mThreadName;
+
+    mutable std::mutex mMutex;
+
+    // Signaled when a task is pushed, or when the queue is destroyed.
+    std::condition_variable mTaskPushed;
+
+    // Signaled when the worker runs out of tasks.
+    std::condition_variable mIdle;
+
+    // Guarded by mMutex.
+    std::deque<std::function<void()>> mTasks;
+    bool mRunning = false;
+    bool mStopping = false;
+    size_t mDroppedTasks = 0;
+
+    std::thread mThread;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * A Bloom filter of 64 bit hashes, such as the cached hashes of HashableDimensionKey, that sets
+ * 4 bits in a single 64 bit block per key: a lookup reads one word. A hash that was never added
+ * is rejected, except for a few percent of false positives while the filter is not full.
+ *
+ * Keys can't be removed. The owner of a map rebuilds the filter from the map once it is full,
+ * which also drops the keys erased from the map.
+ */
+class BlockedBloomFilter {
+public:
+    explicit BlockedBloomFilter(size_t expectedKeys = 0) {
+        reset(expectedKeys);
+    }
+
+    // Empties the filter, and sizes it for [expectedKeys].
+    void reset(size_t expectedKeys) {
+        size_t blockCount = 1;
+        while (blockCount * kKeysPerBlock < expectedKeys) {
+            blockCount *= 2;
+        }
+        mBlocks.assign(blockCount, 0);
+        mSize = 0;
+    }
+
+    inline void add(uint64_t hash) {
+        mBlocks[getBlock(hash)] |= getBits(hash);
+        mSize++;
+    }
+
+    // False if [hash] was not added since the last clear() or reset().
+    inline bool mayContain(uint64_t hash) const {
+        const uint64_t bits = getBits(hash);
+        return (mBlocks[getBlock(hash)] & bits) == bits;
+    }
+
+    // Empties the filter, keeping its size.
+    void clear() {
+        std::fill(mBlocks.begin(), mBlocks.end(), 0);
+        mSize = 0;
+    }
+
+    // True once more keys were added than the filter is sized for, after which it should be
+    // rebuilt.
+    inline bool isFull() const {
+        return mSize > mBlocks.size() * kKeysPerBlock;
+    }
+
+    // Resets the filter to the hashes of [keys], with room for as many more.
+    template <typename Container, typename GetHash>
+    void rebuild(const Container& keys, const GetHash& getHash) {
+        reset(2 * keys.size());
+        for (const auto& key : keys) {
+            add(getHash(key));
+        }
+    }
+
+    inline size_t byteSize() const {
+        return mBlocks.size() * sizeof(uint64_t);
+    }
+
+private:
+    static const size_t kKeysPerBlock = 8;
+
+    // The high bits pick the block, the low bits the bits of the block.
+    inline size_t getBlock(uint64_t hash) const {
+        return (hash >> 32) & (mBlocks.size() - 1);
+    }
+
+    static inline uint64_t getBits(uint64_t hash) {
+        return (1ULL << (hash & 63)) | (1ULL << ((hash >> 6) & 63)) |
+               (1ULL << ((hash >> 12) & 63)) | (1ULL << ((hash >> 18) & 63));
+    }
+
+    std::vector<uint64_t> mBlocks;
+
+    // Number of keys added since the last clear() or reset().
+    size_t mSize = 0;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * A min-heap of deadlines of indices, so that a caller checking the deadlines at each event only
+ * visits the indices whose deadline passed. An index may be scheduled several times: entries are
+ * not updated in place, and the caller re-checks an index when each of its entries expires.
+ */
+class DeadlineQueue {
+public:
+    void schedule(int index, int64_t deadlineNs) {
+        mEntries.emplace(deadlineNs, index);
+    }
+
+    // Removes the entries with a deadline strictly before [timeNs], earliest first, and calls
+    // [callback] with their indices. [callback] may schedule new entries, which must not be
+    // before [timeNs].
+    template <typename Callback>
+    void popExpired(int64_t timeNs, Callback&& callback) {
+        while (!mEntries.empty() && mEntries.top().first < timeNs) {
+            const int index = mEntries.top().second;
+            mEntries.pop();
+            callback(index);
+        }
+    }
+
+    // The earliest deadline, or INT64_MAX if the queue is empty.
+    inline int64_t nextDeadlineNs() const {
+        return mEntries.empty() ? std::numeric_limits<int64_t>::max() : mEntries.top().first;
+    }
+
+    inline size_t size() const {
+        return mEntries.size();
+    }
+
+    void clear() {
+        mEntries = {};
+    }
+
+private:
+    typedef std::pair<int64_t, int> Entry;
+
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> mEntries;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * A hash map with open addressing and linear probing, so that lookups scan contiguous slots
+ * instead of following bucket chains. The hash of each key is kept in its slot and compared
+ * before the key. Erasures shift the following entries back, so there are no tombstones.
+ *
+ * Insertions that grow the map and erasures move entries: pointers to values are only valid
+ * until the next such operation.
+ */
+template <typename K, typename V, typename Hash = std::hash<K>>
+class FlatHashMap {
+public:
+    FlatHashMap() = default;
+
+    inline size_t size() const {
+        return mSize;
+    }
+
+    inline bool empty() const {
+        return mSize == 0;
+    }
+
+    // Returns the value of [key], or nullptr.
+    V* find(const K& key) {
+        const size_t slot = findSlot(key, Hash()(key));
+        return mSlots.empty() || !mSlots[slot].used ? nullptr : &mSlots[slot].value;
+    }
+
+    const V* find(const K& key) const {
+        return const_cast<FlatHashMap*>(this)->find(key);
+    }
+
+    // Returns the value of [key], inserting a default value if there is none.
+    V& operator[](const K& key) {
+        const size_t hash = Hash()(key);
+        if (!mSlots.empty()) {
+            Slot& slot = mSlots[findSlot(key, hash)];
+            if (slot.used) {
+                return slot.value;
+            }
+        }
+        // Keeps the load factor at most 3/4.
+        if (4 * (mSize + 1) > 3 * mSlots.size()) {
+            grow();
+        }
+        Slot& slot = mSlots[findSlot(key, hash)];
+        slot.used = true;
+        slot.hash = hash;
+        slot.key = key;
+        slot.value = V();
+        mSize++;
+        return slot.value;
+    }
+
+    // Returns true if [key] was in the map.
+    bool erase(const K& key) {
+        if (mSlots.empty()) {
+            return false;
+        }
+        size_t hole = findSlot(key, Hash()(key));
+        if (!mSlots[hole].used) {
+            return false;
+        }
+        const size_t mask = mSlots.size() - 1;
+        // Moves back the entries after the hole that would no longer be found past it.
+        for (size_t next = (hole + 1) & mask; mSlots[next].used; next = (next + 1) & mask) {
+            const size_t home = mSlots[next].hash & mask;
+            const bool homeAfterHole = ((home - hole - 1) & mask) < ((next - hole) & mask);
+            if (!homeAfterHole) {
+                mSlots[hole] = std::move(mSlots[next]);
+                hole = next;
+            }
+        }
+        mSlots[hole] = Slot();
+        mSize--;
+        return true;
+    }
+
+    // Removes all entries, keeping the capacity.
+    void clear() {
+        if (mSize == 0) {
+            return;
+        }
+        for (Slot& slot : mSlots) {
+            if (slot.used) {
+                slot = Slot();
+            }
+        }
+        mSize = 0;
+    }
+
+    // Calls [callback] with the key and value of each entry, in no particular order. The map must
+    // not be modified by [callback], other than through the values.
+    template <typename Callback>
+    void forEach(Callback&& callback) {
+        for (Slot& slot : mSlots) {
+            if (slot.used) {
+                callback(static_cast<const K&>(slot.key), slot.value);
+            }
+        }
+    }
+
+    template <typename Callback>
+    void forEach(Callback&& callback) const {
+        for (const Slot& slot : mSlots) {
+            if (slot.used) {
+                callback(slot.key, slot.value);
+            }
+        }
+    }
+
+private:
+    struct Slot {
+        bool used = false;
+        size_t hash = 0;
+        K key;
+        V value;
+    };
+
+    // Returns the slot holding [key], or the empty slot ending its probe sequence. mSlots must
+    // not be full.
+    size_t findSlot(const K& key, size_t hash) const {
+        if (mSlots.empty()) {
+            return 0;
+        }
+        const size_t mask = mSlots.size() - 1;
+        size_t slot = hash & mask;
+        while (mSlots[slot].used && (mSlots[slot].hash != hash || !(mSlots[slot].key == key))) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    // Doubles the number of slots, which is always a power of 2.
+    void grow() {
+        std::vector<Slot> oldSlots(mSlots.empty() ? 8 : 2 * mSlots.size());
+        oldSlots.swap(mSlots);
+        const size_t mask = mSlots.size() - 1;
+        for (Slot& oldSlot : oldSlots) {
+            if (oldSlot.used) {
+                size_t slot = oldSlot.hash & mask;
+                while (mSlots[slot].used) {
+                    slot = (slot + 1) & mask;
+                }
+                mSlots[slot] = std::move(oldSlot);
+            }
+        }
+    }
+
+    std::vector<Slot> mSlots;
+
+    size_t mSize = 0;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "FlatIndexMap.h"
+
+#include <algorithm>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unordered_map;
+using std::vector;
+
+void FlatIndexMap::build(const unordered_map<int, vector<int>>& map, size_t numKeys) {
+    mOffsets.assign(numKeys + 1, 0);
+    size_t numIndices = 0;
+    for (const auto& [key, list] : map) {
+        if (key < 0 || (size_t)key >= numKeys) {
+            ALOGE("FlatIndexMap key %d out of range %zu", key, numKeys);
+            continue;
+        }
+        mOffsets[key + 1] = list.size();
+        numIndices += list.size();
+    }
+    for (size_t i = 0; i < numKeys; i++) {
+        mOffsets[i + 1] += mOffsets[i];
+    }
+
+    mIndices.resize(numIndices);
+    for (const auto& [key, list] : map) {
+        if (key < 0 || (size_t)key >= numKeys) {
+            continue;
+        }
+        std::copy(list.begin(), list.end(), mIndices.begin() + mOffsets[key]);
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Read-only map from the indices [0, numKeys) to lists of indices, flattened into one array of
+ * offsets and one array holding all the lists back to back (compressed sparse rows). Looking up a
+ * list is two loads and walking it is a contiguous scan, with no hashing.
+ */
+class FlatIndexMap {
+public:
+    // The list of a key, valid until the map is rebuilt.
+    class Range {
+    public:
+        typedef int value_type;
+        typedef const int* const_iterator;
+
+        Range(const int* begin, const int* end) : mBegin(begin), mEnd(end) {
+        }
+
+        inline const int* begin() const {
+            return mBegin;
+        }
+
+        inline const int* end() const {
+            return mEnd;
+        }
+
+        inline bool empty() const {
+            return mBegin == mEnd;
+        }
+
+        inline size_t size() const {
+            return mEnd - mBegin;
+        }
+
+    private:
+        const int* mBegin;
+        const int* mEnd;
+    };
+
+    FlatIndexMap() = default;
+
+    // Replaces the contents with [map], whose keys must be in [0, numKeys). The lists keep their
+    // order.
+    void build(const std::unordered_map<int, std::vector<int>>& map, size_t numKeys);
+
+    // Returns the list of [key], empty if [key] had none or is out of range.
+    inline Range get(int key) const {
+        if (key < 0 || (size_t)key + 1 >= mOffsets.size()) {
+            return Range(nullptr, nullptr);
+        }
+        const int* indices = mIndices.data();
+        return Range(indices + mOffsets[key], indices + mOffsets[key + 1]);
+    }
+
+private:
+    // The list of key i is mIndices[mOffsets[i], mOffsets[i + 1]).
+    std::vector<uint32_t> mOffsets;
+
+    std::vector<int> mIndices;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
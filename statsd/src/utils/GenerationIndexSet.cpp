@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "GenerationIndexSet.h"
+
+#include <algorithm>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+void GenerationIndexSet::resize(size_t capacity) {
+    mStamps.assign(capacity, 0);
+    mGeneration = 1;
+    mIndices.clear();
+    mIndices.reserve(capacity);
+}
+
+void GenerationIndexSet::clear() {
+    mIndices.clear();
+    mGeneration++;
+    if (mGeneration == 0) {
+        // Stamps of the previous generations could be mistaken for the new ones.
+        std::fill(mStamps.begin(), mStamps.end(), 0);
+        mGeneration = 1;
+    }
+}
+
+bool GenerationIndexSet::insert(int index) {
+    if (mStamps[index] == mGeneration) {
+        return false;
+    }
+    mStamps[index] = mGeneration;
+    mIndices.push_back(index);
+    return true;
+}
+
+void GenerationIndexSet::erase(int index) {
+    if (mStamps[index] != mGeneration) {
+        return;
+    }
+    mStamps[index] = 0;
+    mIndices.erase(std::find(mIndices.begin(), mIndices.end(), index));
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * A set of indices in [0, capacity), for per event scratch state. Clearing the set only bumps a
+ * generation, so it doesn't touch memory proportional to the capacity, and insertions never
+ * allocate once the set has been used at its capacity.
+ */
+class GenerationIndexSet {
+public:
+    GenerationIndexSet() = default;
+
+    GenerationIndexSet(const GenerationIndexSet&) = delete;
+    GenerationIndexSet& operator=(const GenerationIndexSet&) = delete;
+
+    // Sets the capacity and clears the set.
+    void resize(size_t capacity);
+
+    void clear();
+
+    // Returns true if [index] was not in the set.
+    bool insert(int index);
+
+    void erase(int index);
+
+    inline bool contains(int index) const {
+        return mStamps[index] == mGeneration;
+    }
+
+    inline bool empty() const {
+        return mIndices.empty();
+    }
+
+    // The indices in the set, in insertion order.
+    inline const std::vector<int>& getIndices() const {
+        return mIndices;
+    }
+
+private:
+    // mStamps[i] is mGeneration if i is in the set.
+    std::vector<uint32_t> mStamps;
+
+    uint32_t mGeneration = 1;
+
+    std::vector<int> mIndices;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
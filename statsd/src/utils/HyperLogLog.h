@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Estimates the number of distinct 64-bit hashes added, in kNumRegisters bytes, with a standard
+ * error of about 1.04 / sqrt(kNumRegisters), i.e. 3%. The hashes must be well mixed, like the
+ * cached hashes of the dimension keys.
+ *
+ * The sum that the estimate is computed from is updated as the registers change, so estimate()
+ * is constant time and can be checked on every add().
+ */
+class HyperLogLog {
+public:
+    static const int kPrecision = 10;
+    static const size_t kNumRegisters = 1 << kPrecision;
+
+    HyperLogLog() : mRegisters(kNumRegisters, 0) {
+    }
+
+    void add(uint64_t hash) {
+        const size_t index = hash >> (64 - kPrecision);
+        // Position of the first set bit of the other bits. The sentinel bit bounds it.
+        const uint64_t rest = (hash << kPrecision) | (1ULL << (kPrecision - 1));
+        const uint8_t rank = __builtin_clzll(rest) + 1;
+        uint8_t& reg = mRegisters[index];
+        if (rank > reg) {
+            if (reg == 0) {
+                mZeroRegisters--;
+            }
+            mInverseSum += std::ldexp(1.0, -rank) - std::ldexp(1.0, -reg);
+            reg = rank;
+        }
+    }
+
+    // The estimated number of distinct hashes added since the last clear().
+    int64_t estimate() const {
+        const double m = kNumRegisters;
+        const double raw = 0.7213 / (1 + 1.079 / m) * m * m / mInverseSum;
+        // Linear counting is more accurate for small cardinalities.
+        if (raw <= 2.5 * m && mZeroRegisters > 0) {
+            return std::llround(m * std::log(m / mZeroRegisters));
+        }
+        return std::llround(raw);
+    }
+
+    void clear() {
+        std::fill(mRegisters.begin(), mRegisters.end(), 0);
+        mZeroRegisters = kNumRegisters;
+        mInverseSum = kNumRegisters;
+    }
+
+private:
+    std::vector<uint8_t> mRegisters;
+
+    // Number of registers that are 0.
+    size_t mZeroRegisters = kNumRegisters;
+
+    // Sum of 2^-register over the registers.
+    double mInverseSum = kNumRegisters;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
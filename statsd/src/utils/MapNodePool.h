@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Keeps the nodes of an unordered map across its resets, so that a map refilled with mostly the
+ * same keys at each bucket, like the current bucket of a metric producer, does not allocate its
+ * nodes again. The maps keep their bucket arrays, so refilling them does not rehash either.
+ *
+ * recycle() keeps as many nodes as the map had, so the pool follows the cardinality of the last
+ * bucket. Values that own storage, like vectors, can keep it across buckets by being reset with a
+ * callback rather than assigned a default value.
+ */
+template <typename Map>
+class MapNodePool {
+public:
+    using Key = typename Map::key_type;
+    using Value = typename Map::mapped_type;
+
+    // Empties [map] into the pool and resets the values, so that they release their resources.
+    // The nodes left unused since the last call are freed.
+    void recycle(Map& map) {
+        recycle(map, [](Value& value) { value = Value(); });
+    }
+
+    // Like recycle(), but resets the values with [reset], which pooled values come back with.
+    template <typename Reset>
+    void recycle(Map& map, Reset&& reset) {
+        mNodes.clear();
+        mNodes.reserve(map.size());
+        while (!map.empty()) {
+            mNodes.push_back(map.extract(map.begin()));
+            reset(mNodes.back().mapped());
+        }
+    }
+
+    // Moves the entry at [it] to the pool, resetting its value with [reset]. Returns the iterator
+    // following [it]. Pooled nodes are only freed by recycle(), so the pool and [map] together
+    // hold at most as many nodes as [map] had at its largest.
+    template <typename Reset>
+    typename Map::iterator erase(Map& map, typename Map::iterator it, Reset&& reset) {
+        auto next = std::next(it);
+        mNodes.push_back(map.extract(it));
+        reset(mNodes.back().mapped());
+        return next;
+    }
+
+    // Returns the value of [key] in [map], inserting one in a pooled node, with the value it was
+    // reset to, if there is none. Assigning the key reuses the storage of the key of the node.
+    Value& get(Map& map, const Key& key) {
+        auto it = map.find(key);
+        if (it != map.end()) {
+            return it->second;
+        }
+        if (mNodes.empty()) {
+            return map[key];
+        }
+        return insertPooled(map, key);
+    }
+
+    // Like get(), but constructs a missing value from [args] if there is no pooled node.
+    template <typename... Args>
+    Value& emplace(Map& map, const Key& key, Args&&... args) {
+        auto it = map.find(key);
+        if (it != map.end()) {
+            return it->second;
+        }
+        if (mNodes.empty()) {
+            return map.emplace(key, Value(std::forward<Args>(args)...)).first->second;
+        }
+        return insertPooled(map, key);
+    }
+
+    // Frees the pooled nodes, e.g. once the map is not expected to be refilled soon.
+    void clear() {
+        std::vector<typename Map::node_type>().swap(mNodes);
+    }
+
+    // Number of pooled nodes.
+    inline size_t size() const {
+        return mNodes.size();
+    }
+
+private:
+    Value& insertPooled(Map& map, const Key& key) {
+        typename Map::node_type node = std::move(mNodes.back());
+        mNodes.pop_back();
+        node.key() = key;
+        return map.insert(std::move(node)).position->second;
+    }
+
+    std::vector<typename Map::node_type> mNodes;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "ParallelExecutor.h"
+
+#include <sys/prctl.h>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+ParallelExecutor::ParallelExecutor(size_t numThreads, ThreadRole role) {
+    mThreads.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; i++) {
+        mThreads.emplace_back([this, role] { workerLoop(role); });
+    }
+}
+
+ParallelExecutor::~ParallelExecutor() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mJobStarted.notify_all();
+    for (auto& thread : mThreads) {
+        thread.join();
+    }
+}
+
+bool ParallelExecutor::runNextTaskLocked(std::unique_lock<std::mutex>& lock) {
+    if (mNextTask >= mNumTasks) {
+        return false;
+    }
+    const size_t index = mNextTask++;
+    const std::function<void(size_t)>* task = mTask;
+
+    lock.unlock();
+    (*task)(index);
+    lock.lock();
+
+    if (--mPendingTasks == 0) {
+        mJobDone.notify_all();
+    }
+    return true;
+}
+
+void ParallelExecutor::workerLoop(ThreadRole role) {
+    prctl(PR_SET_NAME, "statsd.dispatch");
+    ScopedThreadRole scopedRole(role);
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        mJobStarted.wait(lock, [this] { return mStopping || mNextTask < mNumTasks; });
+        if (mStopping) {
+            return;
+        }
+        runNextTaskLocked(lock);
+    }
+}
+
+void ParallelExecutor::run(size_t numTasks, const std::function<void(size_t)>& task) {
+    if (mThreads.empty() || numTasks <= 1) {
+        for (size_t i = 0; i < numTasks; i++) {
+            task(i);
+        }
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mTask = &task;
+    mNumTasks = numTasks;
+    mNextTask = 0;
+    mPendingTasks = numTasks;
+    mJobStarted.notify_all();
+
+    // The calling thread takes its share of the tasks instead of idling.
+    while (runNextTaskLocked(lock)) {
+    }
+    mJobDone.wait(lock, [this] { return mPendingTasks == 0; });
+
+    mTask = nullptr;
+    mNumTasks = 0;
+    mNextTask = 0;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
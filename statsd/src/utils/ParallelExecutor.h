@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "utils/ThreadTopology.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * A fixed pool of worker threads running fork-join jobs.
+ *
+ * run() splits a job into numbered tasks, runs them on the workers and on the calling thread,
+ * and returns once every task has completed. Only one job runs at a time.
+ */
+class ParallelExecutor {
+public:
+    /**
+     * \param numThreads number of worker threads, in addition to the calling thread.
+     * \param role scheduling role of the worker threads.
+     */
+    explicit ParallelExecutor(size_t numThreads, ThreadRole role = ThreadRole::WORKERS);
+
+    ParallelExecutor(const ParallelExecutor&) = delete;
+    ParallelExecutor& operator=(const ParallelExecutor&) = delete;
+
+    ~ParallelExecutor();
+
+    /**
+     * Runs task(i) for every i in [0, numTasks), and blocks until all of them have completed.
+     * Tasks may run concurrently and in any order. Must not be called from a task.
+     */
+    void run(size_t numTasks, const std::function<void(size_t)>& task);
+
+    inline size_t getNumThreads() const {
+        return mThreads.size();
+    }
+
+private:
+    void workerLoop(ThreadRole role);
+
+    // Runs the next unclaimed task of the current job. Returns false if there is none.
+    // Called with mMutex held through [lock], which is released while the task runs.
+    bool runNextTaskLocked(std::unique_lock<std::mutex>& lock);
+
+    std::vector<std::thread> mThreads;
+
+    std::mutex mMutex;
+
+    // Signaled when a job starts, or when the executor is destroyed.
+    std::condition_variable mJobStarted;
+
+    // Signaled when the last task of a job completes.
+    std::condition_variable mJobDone;
+
+    // The current job. Guarded by mMutex.
+    const std::function<void(size_t)>* mTask = nullptr;
+    size_t mNumTasks = 0;
+    size_t mNextTask = 0;
+    size_t mPendingTasks = 0;
+    bool mStopping = false;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * The strings that the dimensions of a report refer to instead of containing them, written to
+ * ConfigMetricsReport.strings. The dimensions either have the hashes of the strings, see
+ * StatsdConfig.hash_strings_in_metric_report, or their indices in the order they were added, see
+ * StatsdConfig.string_dictionary_in_metric_report.
+ *
+ * Not thread safe.
+ */
+class ReportStrings {
+public:
+    explicit ReportStrings(bool dictionary = false) : mDictionary(dictionary) {
+    }
+
+    inline bool isDictionary() const {
+        return mDictionary;
+    }
+
+    // Adds [str]. Returns its index if the strings are a dictionary, or 0.
+    uint32_t insert(const std::string& str) {
+        if (!mDictionary) {
+            mHashedStrings.insert(str);
+            return 0;
+        }
+        auto [it, inserted] = mIndices.emplace(str, mIndexedStrings.size());
+        if (inserted) {
+            mIndexedStrings.push_back(&it->first);
+        }
+        return it->second;
+    }
+
+    // Moves the strings of [other] here. Both must hash their strings.
+    void merge(ReportStrings& other) {
+        mHashedStrings.merge(other.mHashedStrings);
+    }
+
+    inline size_t size() const {
+        return mDictionary ? mIndexedStrings.size() : mHashedStrings.size();
+    }
+
+    // Calls [callback] with each string, in the order of ConfigMetricsReport.strings.
+    template <typename Callback>
+    void forEach(Callback&& callback) const {
+        if (mDictionary) {
+            for (const std::string* str : mIndexedStrings) {
+                callback(*str);
+            }
+        } else {
+            for (const std::string& str : mHashedStrings) {
+                callback(str);
+            }
+        }
+    }
+
+    inline const std::set<std::string>& hashedStrings() const {
+        return mHashedStrings;
+    }
+
+private:
+    const bool mDictionary;
+
+    std::set<std::string> mHashedStrings;
+
+    // The index of each string of the dictionary, and the strings by index. The keys of the map
+    // don't move, so the strings are only stored once.
+    std::unordered_map<std::string, uint32_t> mIndices;
+    std::vector<const std::string*> mIndexedStrings;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cutils/trace.h>
+
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <utility>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+// Tag of the statsd trace spans. The app tag is only enabled for the processes listed in the
+// atrace_apps of the trace config (or "atrace -a"), so statsd is traced on request only.
+const uint64_t kStatsdTraceTag = ATRACE_TAG_APP;
+
+/**
+ * Traces the enclosing scope as a slice of the calling thread, in systrace and perfetto. The
+ * slice name is only built when tracing is enabled, so a disabled span costs a check of the
+ * enabled tags.
+ */
+class ScopedTrace {
+public:
+    explicit ScopedTrace(const char* name) : mEnabled(atrace_is_tag_enabled(kStatsdTraceTag)) {
+        if (mEnabled) {
+            atrace_begin(kStatsdTraceTag, name);
+        }
+    }
+
+    // Appends each arg to the name, as " key=value".
+    ScopedTrace(const char* name, std::initializer_list<std::pair<const char*, int64_t>> args)
+        : mEnabled(atrace_is_tag_enabled(kStatsdTraceTag)) {
+        if (mEnabled) {
+            std::string slice(name);
+            for (const auto& [key, value] : args) {
+                slice.append(" ").append(key).append("=").append(std::to_string(value));
+            }
+            atrace_begin(kStatsdTraceTag, slice.c_str());
+        }
+    }
+
+    ~ScopedTrace() {
+        if (mEnabled) {
+            atrace_end(kStatsdTraceTag);
+        }
+    }
+
+    ScopedTrace(const ScopedTrace&) = delete;
+    ScopedTrace& operator=(const ScopedTrace&) = delete;
+
+private:
+    const bool mEnabled;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
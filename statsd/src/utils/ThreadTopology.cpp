@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "ThreadTopology.h"
+
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <linux/sched.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using android::base::ParseInt;
+using android::base::ParseUint;
+using android::base::Split;
+using std::lock_guard;
+using std::string;
+using std::vector;
+
+namespace {
+
+const char* const kRoleNames[] = {"ingest", "processing", "pulls", "workers", "background"};
+static_assert(sizeof(kRoleNames) / sizeof(kRoleNames[0]) == (size_t)ThreadRole::COUNT);
+
+// Bounds the pools sized by the topology.
+const size_t kMaxPoolSize = 16;
+
+// The struct sched_attr of the kernel, which the libc headers don't all declare.
+struct SchedAttr {
+    uint32_t size;
+    uint32_t schedPolicy;
+    uint64_t schedFlags;
+    int32_t schedNice;
+    uint32_t schedPriority;
+    uint64_t schedRuntime;
+    uint64_t schedDeadline;
+    uint64_t schedPeriod;
+    uint32_t schedUtilMin;
+    uint32_t schedUtilMax;
+};
+
+}  // namespace
+
+ThreadTopology& ThreadTopology::getInstance() {
+    static ThreadTopology topology;
+    return topology;
+}
+
+bool ThreadTopology::parseRoleSettings(const string& entry, ThreadRole* role,
+                                       RoleSettings* settings) {
+    const size_t colon = entry.find(':');
+    if (colon == string::npos) {
+        return false;
+    }
+    const string roleName = android::base::Trim(entry.substr(0, colon));
+    size_t roleIndex = 0;
+    while (roleIndex < (size_t)ThreadRole::COUNT && roleName != kRoleNames[roleIndex]) {
+        roleIndex++;
+    }
+    if (roleIndex == (size_t)ThreadRole::COUNT) {
+        return false;
+    }
+    *role = (ThreadRole)roleIndex;
+
+    for (const string& setting : Split(entry.substr(colon + 1), ",")) {
+        const size_t equals = setting.find('=');
+        if (equals == string::npos) {
+            return false;
+        }
+        const string key = android::base::Trim(setting.substr(0, equals));
+        const string value = android::base::Trim(setting.substr(equals + 1));
+        bool valid;
+        if (key == "cpus") {
+            valid = android::base::StartsWith(value, "0x") &&
+                    ParseUint(value.c_str(), &settings->cpuMask) && settings->cpuMask != 0;
+        } else if (key == "nice") {
+            valid = ParseInt(value.c_str(), &settings->nice, -20, 19);
+        } else if (key == "uclamp_min") {
+            valid = ParseInt(value.c_str(), &settings->uclampMin, 0, kMaxUclamp);
+        } else if (key == "uclamp_max") {
+            valid = ParseInt(value.c_str(), &settings->uclampMax, 0, kMaxUclamp);
+        } else if (key == "threads") {
+            valid = ParseUint(value.c_str(), &settings->poolSize, kMaxPoolSize);
+        } else {
+            valid = false;
+        }
+        if (!valid) {
+            return false;
+        }
+    }
+    return settings->uclampMin <= settings->uclampMax;
+}
+
+bool ThreadTopology::parseConfig(const string& config,
+                                 std::array<RoleSettings, (size_t)ThreadRole::COUNT>* settings) {
+    bool valid = true;
+    for (const string& entry : Split(config, ";")) {
+        if (android::base::Trim(entry).empty()) {
+            continue;
+        }
+        ThreadRole role;
+        RoleSettings roleSettings;
+        if (parseRoleSettings(entry, &role, &roleSettings)) {
+            (*settings)[(size_t)role] = roleSettings;
+        } else {
+            ALOGW("Ignored the malformed thread topology entry \"%s\"", entry.c_str());
+            valid = false;
+        }
+    }
+    return valid;
+}
+
+void ThreadTopology::setConfig(const string& config) {
+    std::array<RoleSettings, (size_t)ThreadRole::COUNT> settings;
+    parseConfig(config, &settings);
+
+    lock_guard<std::mutex> lock(mMutex);
+    for (size_t role = 0; role < (size_t)ThreadRole::COUNT; role++) {
+        if (settings[role] == mSettings[role]) {
+            continue;
+        }
+        mSettings[role] = settings[role];
+        mConfigured = true;
+        for (pid_t tid : mThreads[role]) {
+            apply(tid, mSettings[role]);
+        }
+        VLOG("Applied the thread topology of %s to %zu threads", kRoleNames[role],
+             mThreads[role].size());
+    }
+}
+
+void ThreadTopology::joinRole(ThreadRole role) {
+    const pid_t tid = gettid();
+    lock_guard<std::mutex> lock(mMutex);
+    mThreads[(size_t)role].insert(tid);
+    // Threads inherit the settings of the thread that created them, which may have another role.
+    if (mConfigured) {
+        apply(tid, mSettings[(size_t)role]);
+    }
+}
+
+void ThreadTopology::leaveRole(ThreadRole role) {
+    const pid_t tid = gettid();
+    lock_guard<std::mutex> lock(mMutex);
+    mThreads[(size_t)role].erase(tid);
+}
+
+size_t ThreadTopology::getPoolSize(ThreadRole role, size_t defaultSize) const {
+    lock_guard<std::mutex> lock(mMutex);
+    const size_t poolSize = mSettings[(size_t)role].poolSize;
+    return poolSize > 0 ? poolSize : defaultSize;
+}
+
+void ThreadTopology::apply(pid_t tid, const RoleSettings& settings) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (settings.cpuMask == 0 || (cpu < 64 && (settings.cpuMask >> cpu & 1))) {
+            CPU_SET(cpu, &cpus);
+        }
+    }
+    if (sched_setaffinity(tid, sizeof(cpus), &cpus) != 0) {
+        ALOGW("Failed to set the CPU affinity of thread %d: %s", tid, strerror(errno));
+    }
+
+    if (setpriority(PRIO_PROCESS, tid, settings.nice) != 0) {
+        ALOGW("Failed to set the nice value of thread %d: %s", tid, strerror(errno));
+    }
+
+    // Kernels without utilization clamping reject the flags, with the default clamps too.
+    SchedAttr attr = {};
+    attr.size = sizeof(attr);
+    attr.schedFlags = SCHED_FLAG_KEEP_ALL | SCHED_FLAG_UTIL_CLAMP;
+    attr.schedUtilMin = settings.uclampMin;
+    attr.schedUtilMax = settings.uclampMax;
+    if (syscall(__NR_sched_setattr, tid, &attr, 0) != 0 &&
+        (settings.uclampMin != 0 || settings.uclampMax != kMaxUclamp)) {
+        ALOGW("Failed to set the utilization clamps of thread %d: %s", tid, strerror(errno));
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <gtest/gtest_prod.h>
+#include <sys/types.h>
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+// The roles of the statsd threads, which share their scheduling settings.
+enum class ThreadRole {
+    // The socket listeners and the shared memory ring reader.
+    INGEST = 0,
+    // The thread processing the pushed events, see StatsService::readLogs().
+    PROCESSING,
+    // The parallel pull executor and the deferred pull thread.
+    PULLS,
+    // The parallel dispatch, dump and config load executors.
+    WORKERS,
+    // The task queues, the subscriber and incident report senders, and the shell helpers.
+    BACKGROUND,
+    COUNT,
+};
+
+/**
+ * The CPU affinity, nice value, utilization clamps and pool size of each thread role.
+ *
+ * The topology is a list of "<role>:<key>=<value>,..." entries separated by ';', e.g.
+ * "ingest:nice=-4;workers:cpus=0x0f,uclamp_max=512,threads=2". The roles are ingest, processing,
+ * pulls, workers and background. The keys are:
+ *   cpus:        hex mask of the CPUs the threads may run on.
+ *   nice:        nice value of the threads, in [-20, 19].
+ *   uclamp_min:  minimum utilization clamp of the threads, in [0, 1024].
+ *   uclamp_max:  maximum utilization clamp of the threads, in [0, 1024].
+ *   threads:     number of worker threads of the pools of the role.
+ *
+ * Threads join their role when they start, and leave it when they exit. A new topology is applied
+ * to the threads that joined, so that changes take effect without a restart. Pool sizes are only
+ * read when the pools are created, at startup.
+ */
+class ThreadTopology {
+public:
+    static ThreadTopology& getInstance();
+
+    ThreadTopology(const ThreadTopology&) = delete;
+    ThreadTopology& operator=(const ThreadTopology&) = delete;
+
+    /**
+     * Replaces the topology with [config], and applies the settings that changed to the threads
+     * of their role. Malformed entries are ignored. An empty [config] restores the defaults.
+     */
+    void setConfig(const std::string& config);
+
+    // Applies the settings of [role] to the calling thread, and keeps it updated until leaveRole().
+    void joinRole(ThreadRole role);
+
+    void leaveRole(ThreadRole role);
+
+    // Returns the pool size of [role], or [defaultSize] if none is set.
+    size_t getPoolSize(ThreadRole role, size_t defaultSize) const;
+
+private:
+    struct RoleSettings {
+        // Bit i allows CPU i. 0 if unset, the threads may run on any CPU.
+        uint64_t cpuMask = 0;
+        int nice = 0;
+        int uclampMin = 0;
+        int uclampMax = kMaxUclamp;
+        // 0 if unset.
+        size_t poolSize = 0;
+
+        bool operator==(const RoleSettings& other) const {
+            return cpuMask == other.cpuMask && nice == other.nice &&
+                   uclampMin == other.uclampMin && uclampMax == other.uclampMax &&
+                   poolSize == other.poolSize;
+        }
+    };
+
+    static const int kMaxUclamp = 1024;
+
+    ThreadTopology() = default;
+
+    // Returns false if [config] is malformed.
+    static bool parseConfig(const std::string& config,
+                            std::array<RoleSettings, (size_t)ThreadRole::COUNT>* settings);
+
+    static bool parseRoleSettings(const std::string& entry, ThreadRole* role,
+                                  RoleSettings* settings);
+
+    static void apply(pid_t tid, const RoleSettings& settings);
+
+    mutable std::mutex mMutex;
+
+    std::array<RoleSettings, (size_t)ThreadRole::COUNT> mSettings;
+
+    // Whether a topology was ever set. Until then, the threads keep the default settings.
+    bool mConfigured = false;
+
+    // The threads that joined each role.
+    std::array<std::set<pid_t>, (size_t)ThreadRole::COUNT> mThreads;
+
+    FRIEND_TEST(ThreadTopologyTest, TestParseConfig);
+    FRIEND_TEST(ThreadTopologyTest, TestMalformedEntriesIgnored);
+};
+
+// Joins [role] for the lifetime of the object.
+class ScopedThreadRole {
+public:
+    explicit ScopedThreadRole(ThreadRole role) : mRole(role) {
+        ThreadTopology::getInstance().joinRole(mRole);
+    }
+
+    ~ScopedThreadRole() {
+        ThreadTopology::getInstance().leaveRole(mRole);
+    }
+
+    ScopedThreadRole(const ScopedThreadRole&) = delete;
+    ScopedThreadRole& operator=(const ScopedThreadRole&) = delete;
+
+private:
+    const ThreadRole mRole;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -64,6 +64,38 @@ TEST(AlarmMonitor, popSoonerThan) {
     ASSERT_EQ(0u, set.size());
 }
 
+TEST(AlarmMonitor, updateRegistersOnce) {
+    int updates = 0;
+    int cancels = 0;
+    AlarmMonitor am(2,
+                    [&updates](const shared_ptr<IStatsCompanionService>&, int64_t) { updates++; },
+                    [&cancels](const shared_ptr<IStatsCompanionService>&) { cancels++; });
+
+    sp<const InternalAlarm> a = new InternalAlarm{10};
+    sp<const InternalAlarm> b = new InternalAlarm{20};
+    sp<const InternalAlarm> c = new InternalAlarm{20};
+    sp<const InternalAlarm> d = new InternalAlarm{30};
+
+    am.update({}, {a, b, c});
+    EXPECT_EQ(1, updates);
+    EXPECT_EQ(10u, am.getRegisteredAlarmTimeSec());
+
+    // Replacing the soonest alarm moves the registered alarm once.
+    am.update({a}, {d});
+    EXPECT_EQ(2, updates);
+    EXPECT_EQ(20u, am.getRegisteredAlarmTimeSec());
+
+    // Removing unknown alarms does nothing.
+    am.update({a}, {});
+    EXPECT_EQ(2, updates);
+
+    am.update({b, c, d}, {});
+    EXPECT_EQ(2, updates);
+    EXPECT_EQ(1, cancels);
+    EXPECT_EQ(0u, am.getRegisteredAlarmTimeSec());
+    EXPECT_TRUE(am.popSoonerThan(100).empty());
+}
+
 #else
 GTEST_LOG_(INFO) << "This test does nothing.\n";
 #endif
@@ -0,0 +1,116 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/DimensionExtractionPlan.h"
+
+#include <gtest/gtest.h>
+
+#include "src/HashableDimensionKey.h"
+#include "statsd_test_util.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::vector;
+
+namespace {
+
+const int kAtomId = 10;
+
+// Checks that [plan] filters the values of [event] like filterValues().
+void expectSameAsFilterValues(DimensionExtractionPlan* plan, const vector<Matcher>& matchers,
+                              const LogEvent& event) {
+    HashableDimensionKey expected;
+    const bool expectedMatched = filterValues(matchers, event.getValues(), &expected);
+    HashableDimensionKey actual;
+    EXPECT_EQ(expectedMatched,
+              plan->extract(matchers, event.getValues(), event.getFieldIndex(), &actual));
+    EXPECT_EQ(expected, actual);
+    ASSERT_EQ(expected.getValues().size(), actual.getValues().size());
+    for (size_t i = 0; i < expected.getValues().size(); i++) {
+        EXPECT_EQ(expected.getValues()[i].mField, actual.getValues()[i].mField);
+    }
+}
+
+}  // anonymous namespace
+
+TEST(DimensionExtractionPlanTest, TestCompiledOncePerLayout) {
+    for (Position position : {Position::FIRST, Position::LAST, Position::ANY}) {
+        vector<Matcher> matchers;
+        translateFieldMatcher(
+                CreateAttributionUidAndOtherDimensions(kAtomId, {position}, {2 /* data1 */}),
+                &matchers);
+        DimensionExtractionPlan plan;
+
+        shared_ptr<LogEvent> event = makeAttributionLogEvent(
+                kAtomId, 100, {111, 222}, {"tag1", "tag2"}, /*data1=*/1, /*data2=*/2);
+        ASSERT_NE(nullptr, event->getFieldIndex());
+        expectSameAsFilterValues(&plan, matchers, *event);
+        EXPECT_EQ(1u, plan.getCompileCount());
+
+        // Same layout, other values.
+        event = makeAttributionLogEvent(kAtomId, 200, {333, 444}, {"tag3", "tag4"},
+                                        /*data1=*/3, /*data2=*/4);
+        expectSameAsFilterValues(&plan, matchers, *event);
+        EXPECT_EQ(1u, plan.getCompileCount());
+
+        // Longer attribution chain.
+        event = makeAttributionLogEvent(kAtomId, 300, {555, 666, 777}, {"tag5", "tag6", "tag7"},
+                                        /*data1=*/5, /*data2=*/6);
+        expectSameAsFilterValues(&plan, matchers, *event);
+        EXPECT_EQ(2u, plan.getCompileCount());
+    }
+}
+
+TEST(DimensionExtractionPlanTest, TestOtherAtom) {
+    vector<Matcher> matchers;
+    translateFieldMatcher(CreateAttributionUidDimensions(kAtomId, {Position::FIRST}), &matchers);
+    DimensionExtractionPlan plan;
+
+    shared_ptr<LogEvent> event =
+            makeAttributionLogEvent(kAtomId, 100, {111}, {"tag1"}, /*data1=*/1, /*data2=*/2);
+    expectSameAsFilterValues(&plan, matchers, *event);
+
+    // Same fields, but no matcher matches the values of another atom.
+    event = makeAttributionLogEvent(kAtomId + 1, 200, {111}, {"tag1"}, /*data1=*/1, /*data2=*/2);
+    HashableDimensionKey output;
+    EXPECT_FALSE(plan.extract(matchers, event->getValues(), event->getFieldIndex(), &output));
+    EXPECT_EQ(DEFAULT_DIMENSION_KEY, output);
+    EXPECT_EQ(2u, plan.getCompileCount());
+}
+
+TEST(DimensionExtractionPlanTest, TestWithoutFieldIndex) {
+    vector<Matcher> matchers;
+    translateFieldMatcher(CreateAttributionUidDimensions(kAtomId, {Position::FIRST}), &matchers);
+    DimensionExtractionPlan plan;
+
+    shared_ptr<LogEvent> event =
+            makeAttributionLogEvent(kAtomId, 100, {111}, {"tag1"}, /*data1=*/1, /*data2=*/2);
+    HashableDimensionKey expected;
+    filterValues(matchers, event->getValues(), &expected);
+    HashableDimensionKey output;
+    EXPECT_TRUE(plan.extract(matchers, event->getValues(), /*fieldIndex=*/nullptr, &output));
+    EXPECT_EQ(expected, output);
+    EXPECT_EQ(0u, plan.getCompileCount());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
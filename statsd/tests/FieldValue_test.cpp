@@ -141,20 +141,20 @@ TEST(AtomMatcherTest, TestFilter_ALL) {
     EXPECT_EQ((int32_t)0x02010101, output.getValues()[0].mField.getField());
     EXPECT_EQ((int32_t)1111, output.getValues()[0].mValue.int_value);
     EXPECT_EQ((int32_t)0x02010102, output.getValues()[1].mField.getField());
-    EXPECT_EQ("location1", output.getValues()[1].mValue.str_value);
+    EXPECT_EQ("location1", output.getValues()[1].mValue.getString());
 
     EXPECT_EQ((int32_t)0x02010201, output.getValues()[2].mField.getField());
     EXPECT_EQ((int32_t)2222, output.getValues()[2].mValue.int_value);
     EXPECT_EQ((int32_t)0x02010202, output.getValues()[3].mField.getField());
-    EXPECT_EQ("location2", output.getValues()[3].mValue.str_value);
+    EXPECT_EQ("location2", output.getValues()[3].mValue.getString());
 
     EXPECT_EQ((int32_t)0x02010301, output.getValues()[4].mField.getField());
     EXPECT_EQ((int32_t)3333, output.getValues()[4].mValue.int_value);
     EXPECT_EQ((int32_t)0x02010302, output.getValues()[5].mField.getField());
-    EXPECT_EQ("location3", output.getValues()[5].mValue.str_value);
+    EXPECT_EQ("location3", output.getValues()[5].mValue.getString());
 
     EXPECT_EQ((int32_t)0x00020000, output.getValues()[6].mField.getField());
-    EXPECT_EQ("some value", output.getValues()[6].mValue.str_value);
+    EXPECT_EQ("some value", output.getValues()[6].mValue.getString());
 }
 
 TEST(AtomMatcherTest, TestFilterRepeated_FIRST) {
@@ -430,10 +430,10 @@ TEST(AtomMatcherTest, TestSubscriberDimensionWrite) {
     ASSERT_EQ(attributionChainParcel.tupleValue.size(), 2);
     checkAttributionNodeInDimensionsValueParcel(attributionChainParcel.tupleValue[0],
                                                 /*nodeDepthInAttributionChain=*/1,
-                                                value1.int_value, value2.str_value);
+                                                value1.int_value, value2.getString());
     checkAttributionNodeInDimensionsValueParcel(attributionChainParcel.tupleValue[1],
                                                 /*nodeDepthInAttributionChain=*/2,
-                                                value3.int_value, value4.str_value);
+                                                value3.int_value, value4.getString());
 
     // Check that the float is populated correctly
     StatsDimensionsValueParcel floatParcel = rootParcel.tupleValue[1];
@@ -792,6 +792,132 @@ TEST(AtomMatcherTest, TestIsPrimitiveRepeatedField) {
     EXPECT_FALSE(isPrimitiveRepeatedField(field7));
 }
 
+TEST(AtomMatcherTest, TestFindPosRange) {
+    const vector<int> uids = {1111, 2222, 3333};
+    const vector<string> tags = {"location1", "location2", "location3"};
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event, 10 /*atomId*/, 1012345, uids, tags, "some value");
+    const int32_t* fields = event.getFieldIndex();
+    ASSERT_NE(nullptr, fields);
+    const int numValues = event.getValues().size();
+    ASSERT_EQ(7, numValues);
+
+    int first;
+    int last;
+    // The attribution chain.
+    EXPECT_TRUE(findPosRange(fields, 0, numValues, 0, 1, &first, &last));
+    EXPECT_EQ(0, first);
+    EXPECT_EQ(6, last);
+    // The second attribution node.
+    EXPECT_TRUE(findPosRange(fields, 0, 6, 1, 2, &first, &last));
+    EXPECT_EQ(2, first);
+    EXPECT_EQ(4, last);
+    // The string.
+    EXPECT_TRUE(findPosRange(fields, 0, numValues, 0, 2, &first, &last));
+    EXPECT_EQ(6, first);
+    EXPECT_EQ(7, last);
+    EXPECT_FALSE(findPosRange(fields, 0, numValues, 0, 3, &first, &last));
+    EXPECT_FALSE(findPosRange(fields, 0, 6, 1, 4, &first, &last));
+}
+
+TEST(AtomMatcherTest, TestFilterValuesWithFieldIndex) {
+    vector<int> uids;
+    vector<string> tags;
+    for (int i = 0; i < 20; i++) {
+        uids.push_back(1000 + i);
+        tags.push_back("tag" + std::to_string(i));
+    }
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event, 10 /*atomId*/, 1012345, uids, tags, "some value");
+
+    FieldMatcher matcher;
+    matcher.set_field(10);
+    FieldMatcher* child = matcher.add_child();
+    child->set_field(1);
+    child->set_position(Position::LAST);
+    child->add_child()->set_field(1);
+    matcher.add_child()->set_field(2);
+    vector<Matcher> matchers;
+    translateFieldMatcher(matcher, &matchers);
+
+    HashableDimensionKey withIndex;
+    EXPECT_TRUE(filterValues(matchers, event.getValues(), &withIndex, event.getFieldIndex()));
+    HashableDimensionKey withoutIndex;
+    EXPECT_TRUE(filterValues(matchers, event.getValues(), &withoutIndex));
+    ASSERT_EQ(2, withIndex.getValues().size());
+    EXPECT_EQ(withoutIndex, withIndex);
+    EXPECT_EQ(1019, withIndex.getValues()[0].mValue.int_value);
+    EXPECT_EQ("some value", withIndex.getValues()[1].mValue.getString());
+
+    // Matchers of another atom.
+    vector<Matcher> otherAtomMatchers = {getSimpleMatcher(11, 2)};
+    HashableDimensionKey otherAtomKey;
+    EXPECT_FALSE(filterValues(otherAtomMatchers, event.getValues(), &otherAtomKey,
+                              event.getFieldIndex()));
+}
+
+TEST(AtomMatcherTest, TestValuePayloadIsShared) {
+    EXPECT_LE(sizeof(FieldValue), 64u);
+
+    Value strValue(string("some string"));
+    Value strCopy = strValue;
+    EXPECT_EQ(strValue.payload.get(), strCopy.payload.get());
+    EXPECT_EQ("some string", strCopy.getString());
+    EXPECT_EQ(strValue, strCopy);
+    EXPECT_EQ(strValue, Value(string("some string")));
+    EXPECT_NE(strValue, Value(string("other string")));
+    EXPECT_EQ(11u, strCopy.getSize());
+    EXPECT_TRUE(strCopy.getStorage().empty());
+
+    Value storageValue(vector<uint8_t>{1, 2, 3});
+    Value storageCopy = storageValue;
+    EXPECT_EQ(storageValue.payload.get(), storageCopy.payload.get());
+    EXPECT_EQ(vector<uint8_t>({1, 2, 3}), storageCopy.getStorage());
+    EXPECT_EQ(storageValue, Value(vector<uint8_t>{1, 2, 3}));
+    EXPECT_TRUE(storageCopy.getString().empty());
+
+    // Numeric values do not hold a payload.
+    strCopy.setInt(5);
+    EXPECT_EQ(nullptr, strCopy.payload.get());
+    EXPECT_EQ("some string", strValue.getString());
+}
+
+TEST(AtomMatcherTest, TestValuePayloadView) {
+    sp<const ValuePayload> buffer = new ValuePayload(string("prefix some string suffix"));
+    Value view(STRING, new ValuePayload(buffer, buffer->bytes().substr(7, 11)));
+    EXPECT_TRUE(view.payload->isView());
+    EXPECT_EQ("some string", view.getView());
+    EXPECT_EQ(view, Value(string("some string")));
+    EXPECT_LT(view, Value(string("some strinh")));
+    EXPECT_EQ(11u, view.getSize());
+    EXPECT_EQ("some string", view.getString());
+
+    // Detaching copies the bytes out of the buffer.
+    Value detached = view;
+    detached.detachPayload();
+    EXPECT_FALSE(detached.payload->isView());
+    EXPECT_NE(view.payload.get(), detached.payload.get());
+    EXPECT_EQ(view, detached);
+
+    Value storageView(STORAGE, new ValuePayload(buffer, buffer->bytes().substr(0, 3)));
+    EXPECT_EQ(vector<uint8_t>({'p', 'r', 'e'}), storageView.getStorage());
+    storageView.detachPayload();
+    EXPECT_FALSE(storageView.payload->isView());
+    EXPECT_EQ(storageView, Value(vector<uint8_t>({'p', 'r', 'e'})));
+
+    // Dimension keys do not hold views.
+    Field field(10, getSimpleField(1));
+    HashableDimensionKey key;
+    key.addValue(FieldValue(field, view));
+    EXPECT_FALSE(key.getValues()[0].mValue.payload->isView());
+    EXPECT_FALSE(HashableDimensionKey({FieldValue(field, view)})
+                         .getValues()[0]
+                         .mValue.payload->isView());
+    key.addValueWithField(FieldValue(field, view), 2);
+    EXPECT_FALSE(key.getValues()[1].mValue.payload->isView());
+    EXPECT_EQ(2, key.getValues()[1].mField.getField());
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -129,6 +129,55 @@ TEST(HashableDimensionKeyTest, TestContainsLinkedStateValues_AllConditionsMet) {
     EXPECT_TRUE(containsLinkedStateValues(whatKey, primaryKey, mMetric2StateLinks, stateAtomId));
 }
 
+TEST(HashableDimensionKeyTest, TestCachedHash) {
+    HashableDimensionKey key;
+    getUidProcessKey(1000, &key);
+    const uint64_t hash = hashDimension(key);
+    EXPECT_EQ(hash, key.getHash());
+    EXPECT_EQ(hash, std::hash<HashableDimensionKey>()(key));
+
+    // Copies keep the hash.
+    HashableDimensionKey copy(key);
+    EXPECT_EQ(hash, copy.getHash());
+    EXPECT_EQ(key, copy);
+
+    // Modifications reset it.
+    copy.mutableValue(0)->mValue.setInt(1001);
+    EXPECT_EQ(hashDimension(copy), copy.getHash());
+    EXPECT_NE(hash, copy.getHash());
+    EXPECT_NE(key, copy);
+
+    copy = key;
+    EXPECT_EQ(hash, copy.getHash());
+    copy.addValue(key.getValues()[0]);
+    EXPECT_EQ(hashDimension(copy), copy.getHash());
+}
+
+TEST(HashableDimensionKeyTest, TestEqualityWithoutCachedHash) {
+    HashableDimensionKey key1;
+    HashableDimensionKey key2;
+    getUidProcessKey(1000, &key1);
+    getUidProcessKey(1000, &key2);
+    key1.getHash();
+    EXPECT_EQ(key1, key2);
+    EXPECT_EQ(key2, key1);
+}
+
+TEST(HashableDimensionKeyTest, TestClearAndReuse) {
+    HashableDimensionKey key;
+    getUidProcessKey(1000, &key);
+    const uint64_t hash = key.getHash();
+    const size_t capacity = key.getValues().capacity();
+
+    key.clear();
+    EXPECT_EQ(DEFAULT_DIMENSION_KEY, key);
+    EXPECT_EQ(hashDimension(key), key.getHash());
+    EXPECT_EQ(capacity, key.getValues().capacity());
+
+    getUidProcessKey(1000, &key);
+    EXPECT_EQ(hash, key.getHash());
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -15,8 +15,11 @@
 #include <gtest/gtest.h>
 #include <stdio.h>
 
+#include <thread>
+
 #include "annotations.h"
 #include "src/statsd_config.pb.h"
+#include "matchers/SharedSimpleAtomMatcher.h"
 #include "matchers/matcher_util.h"
 #include "stats_event.h"
 #include "stats_log_util.h"
@@ -24,6 +27,7 @@
 #include "statsd_test_util.h"
 
 using namespace android::os::statsd;
+using std::shared_ptr;
 using std::unordered_map;
 using std::vector;
 
@@ -1204,6 +1208,326 @@ TEST(AtomMatcherTest, TestNorMatcher) {
     matcherResults.push_back(MatchingState::kMatched);
     EXPECT_FALSE(combinationMatch(children, operation, matcherResults));
 }
+
+TEST(AtomMatcherTest, TestCompileSimpleAtomMatcher) {
+    AtomMatcher matcher;
+    auto simpleMatcher = matcher.mutable_simple_atom_matcher();
+    simpleMatcher->set_atom_id(TAG_ID);
+    auto fieldValueMatcher = simpleMatcher->add_field_value_matcher();
+    fieldValueMatcher->set_field(1);
+    fieldValueMatcher->set_position(Position::ANY);
+    auto tupleMatcher = fieldValueMatcher->mutable_matches_tuple()->add_field_value_matcher();
+    tupleMatcher->set_field(1);
+    tupleMatcher->set_eq_string("AID_ROOT");
+    fieldValueMatcher = simpleMatcher->add_field_value_matcher();
+    fieldValueMatcher->set_field(2);
+    fieldValueMatcher->set_lt_int(10);
+    fieldValueMatcher = simpleMatcher->add_field_value_matcher();
+    fieldValueMatcher->set_field(3);
+    fieldValueMatcher->mutable_neq_any_string()->add_str_value("pkg0");
+    fieldValueMatcher->mutable_neq_any_string()->add_str_value("pkg1");
+
+    const CompiledSimpleAtomMatcher compiled = compileSimpleAtomMatcher(*simpleMatcher);
+    EXPECT_EQ(TAG_ID, compiled.atomId);
+    ASSERT_EQ(3, compiled.matchers.size());
+
+    const CompiledFieldValueMatcher& tuple = compiled.matchers[0];
+    EXPECT_EQ(1, tuple.field);
+    EXPECT_TRUE(tuple.hasPosition);
+    EXPECT_EQ(Position::ANY, tuple.position);
+    EXPECT_EQ(CompiledFieldValueMatcher::MATCHES_TUPLE, tuple.op);
+    ASSERT_EQ(1, tuple.children.size());
+    EXPECT_EQ(CompiledFieldValueMatcher::EQ_ANY_STRING, tuple.children[0].op);
+    ASSERT_EQ(1, tuple.children[0].strings.size());
+    EXPECT_EQ("AID_ROOT", tuple.children[0].strings[0].str);
+    ASSERT_TRUE(tuple.children[0].strings[0].aidUid.has_value());
+    EXPECT_EQ(0, *tuple.children[0].strings[0].aidUid);
+
+    EXPECT_FALSE(compiled.matchers[1].hasPosition);
+    EXPECT_EQ(CompiledFieldValueMatcher::LT_INT, compiled.matchers[1].op);
+    EXPECT_EQ(10, compiled.matchers[1].intValue);
+
+    EXPECT_EQ(CompiledFieldValueMatcher::NEQ_ANY_STRING, compiled.matchers[2].op);
+    ASSERT_EQ(2, compiled.matchers[2].strings.size());
+    EXPECT_EQ("pkg1", compiled.matchers[2].strings[1].str);
+    EXPECT_FALSE(compiled.matchers[2].strings[1].aidUid.has_value());
+}
+
+TEST(AtomMatcherTest, TestCompiledSimpleAtomMatcher) {
+    sp<UidMap> uidMap = new UidMap();
+
+    AtomMatcher matcher;
+    auto simpleMatcher = matcher.mutable_simple_atom_matcher();
+    simpleMatcher->set_atom_id(TAG_ID);
+    auto fieldValueMatcher = simpleMatcher->add_field_value_matcher();
+    fieldValueMatcher->set_field(1);
+    fieldValueMatcher->set_gte_int(5);
+    const CompiledSimpleAtomMatcher compiled = compileSimpleAtomMatcher(*simpleMatcher);
+
+    LogEvent event1(/*uid=*/0, /*pid=*/0);
+    makeIntLogEvent(&event1, TAG_ID, 0, 5);
+    EXPECT_TRUE(matchesSimple(uidMap, compiled, event1));
+
+    LogEvent event2(/*uid=*/0, /*pid=*/0);
+    makeIntLogEvent(&event2, TAG_ID, 0, 4);
+    EXPECT_FALSE(matchesSimple(uidMap, compiled, event2));
+
+    // The atom id is checked before any field.
+    LogEvent event3(/*uid=*/0, /*pid=*/0);
+    makeIntLogEvent(&event3, TAG_ID_2, 0, 5);
+    EXPECT_FALSE(matchesSimple(uidMap, compiled, event3));
+
+    // The uid annotation turns the AID name into a uid comparison.
+    simpleMatcher->set_atom_id(TAG_ID_2);
+    fieldValueMatcher->set_eq_string("AID_ROOT");
+    const CompiledSimpleAtomMatcher compiledAid = compileSimpleAtomMatcher(*simpleMatcher);
+    LogEvent event4(/*uid=*/0, /*pid=*/0);
+    makeIntWithBoolAnnotationLogEvent(&event4, TAG_ID_2, 0, ANNOTATION_ID_IS_UID, true);
+    EXPECT_TRUE(matchesSimple(uidMap, compiledAid, event4));
+    LogEvent event5(/*uid=*/0, /*pid=*/0);
+    makeIntWithBoolAnnotationLogEvent(&event5, TAG_ID_2, 1000, ANNOTATION_ID_IS_UID, true);
+    EXPECT_FALSE(matchesSimple(uidMap, compiledAid, event5));
+}
+
+TEST(AtomMatcherTest, TestCompiledMatcherFollowsPackageChanges) {
+    sp<UidMap> uidMap = new UidMap();
+    uidMap->updateMap(1, {1111, 2222} /* uid list */, {1, 1} /* version list */,
+                      {android::String16("v1"), android::String16("v1")},
+                      {android::String16("pkg0"), android::String16("pkg1")},
+                      {android::String16(""), android::String16("")},
+                      /* certificateHash */ {{}, {}});
+
+    AtomMatcher matcher;
+    auto simpleMatcher = matcher.mutable_simple_atom_matcher();
+    simpleMatcher->set_atom_id(TAG_ID);
+    simpleMatcher->add_field_value_matcher()->set_field(1);
+    simpleMatcher->mutable_field_value_matcher(0)->set_eq_string("pkg0");
+    const CompiledSimpleAtomMatcher compiled = compileSimpleAtomMatcher(*simpleMatcher);
+
+    LogEvent event1(/*uid=*/0, /*pid=*/0);
+    makeIntWithBoolAnnotationLogEvent(&event1, TAG_ID, 1111, ANNOTATION_ID_IS_UID, true);
+    LogEvent event2(/*uid=*/0, /*pid=*/0);
+    makeIntWithBoolAnnotationLogEvent(&event2, TAG_ID, 2222, ANNOTATION_ID_IS_UID, true);
+    EXPECT_TRUE(matchesSimple(uidMap, compiled, event1));
+    EXPECT_FALSE(matchesSimple(uidMap, compiled, event2));
+
+    // The resolved uids are refreshed once the package map changes.
+    uidMap->updateApp(2, android::String16("pkg0"), 2222, 1, android::String16("v1"),
+                      android::String16(""), /* certificateHash */ {});
+    EXPECT_TRUE(matchesSimple(uidMap, compiled, event2));
+    uidMap->removeApp(3, android::String16("pkg0"), 1111);
+    EXPECT_FALSE(matchesSimple(uidMap, compiled, event1));
+    EXPECT_TRUE(matchesSimple(uidMap, compiled, event2));
+}
+
+TEST(AtomMatcherTest, TestIndexedStringList) {
+    sp<UidMap> uidMap = new UidMap();
+    uidMap->updateMap(1, {1111, 2222} /* uid list */, {1, 1} /* version list */,
+                      {android::String16("v1"), android::String16("v1")},
+                      {android::String16("pkg3"), android::String16("Pkg20")},
+                      {android::String16(""), android::String16("")},
+                      /* certificateHash */ {{}, {}});
+
+    AtomMatcher matcher;
+    auto simpleMatcher = matcher.mutable_simple_atom_matcher();
+    simpleMatcher->set_atom_id(TAG_ID);
+    auto fieldValueMatcher = simpleMatcher->add_field_value_matcher();
+    fieldValueMatcher->set_field(1);
+    for (int i = 0; i < 20; i++) {
+        fieldValueMatcher->mutable_eq_any_string()->add_str_value("pkg" + std::to_string(i));
+    }
+    fieldValueMatcher->mutable_eq_any_string()->add_str_value("AID_ROOT");
+    const CompiledSimpleAtomMatcher compiled = compileSimpleAtomMatcher(*simpleMatcher);
+    EXPECT_EQ(21, compiled.matchers[0].stringIndices.size());
+
+    LogEvent event1(/*uid=*/0, /*pid=*/0);
+    makeStringLogEvent(&event1, TAG_ID, 0, "pkg13");
+    EXPECT_TRUE(matchesSimple(uidMap, compiled, event1));
+    LogEvent event2(/*uid=*/0, /*pid=*/0);
+    makeStringLogEvent(&event2, TAG_ID, 0, "pkg20");
+    EXPECT_FALSE(matchesSimple(uidMap, compiled, event2));
+
+    // Uid fields are matched by AID or package names, and pkg20 is not in the list.
+    LogEvent event3(/*uid=*/0, /*pid=*/0);
+    makeIntWithBoolAnnotationLogEvent(&event3, TAG_ID, 1111, ANNOTATION_ID_IS_UID, true);
+    EXPECT_TRUE(matchesSimple(uidMap, compiled, event3));
+    LogEvent event4(/*uid=*/0, /*pid=*/0);
+    makeIntWithBoolAnnotationLogEvent(&event4, TAG_ID, 0, ANNOTATION_ID_IS_UID, true);
+    EXPECT_TRUE(matchesSimple(uidMap, compiled, event4));
+    LogEvent event5(/*uid=*/0, /*pid=*/0);
+    makeIntWithBoolAnnotationLogEvent(&event5, TAG_ID, 2222, ANNOTATION_ID_IS_UID, true);
+    EXPECT_FALSE(matchesSimple(uidMap, compiled, event5));
+
+    // neq_any_string uses the same lookups.
+    const StringListMatcher strings = fieldValueMatcher->eq_any_string();
+    *fieldValueMatcher->mutable_neq_any_string() = strings;
+    const CompiledSimpleAtomMatcher compiledNeq = compileSimpleAtomMatcher(*simpleMatcher);
+    EXPECT_FALSE(matchesSimple(uidMap, compiledNeq, event1));
+    EXPECT_TRUE(matchesSimple(uidMap, compiledNeq, event2));
+    EXPECT_FALSE(matchesSimple(uidMap, compiledNeq, event3));
+    EXPECT_TRUE(matchesSimple(uidMap, compiledNeq, event5));
+}
+
+TEST(AtomMatcherTest, TestWildcardStringMatcher) {
+    sp<UidMap> uidMap = new UidMap();
+    uidMap->updateMap(1, {1111, 2222} /* uid list */, {1, 1} /* version list */,
+                      {android::String16("v1"), android::String16("v1")},
+                      {android::String16("com.Vendor.app"), android::String16("com.other")},
+                      {android::String16(""), android::String16("")},
+                      /* certificateHash */ {{}, {}});
+
+    AtomMatcher matcher;
+    auto simpleMatcher = matcher.mutable_simple_atom_matcher();
+    simpleMatcher->set_atom_id(TAG_ID);
+    auto fieldValueMatcher = simpleMatcher->add_field_value_matcher();
+    fieldValueMatcher->set_field(1);
+    fieldValueMatcher->set_eq_wildcard_string("com.vendor.*");
+    EXPECT_TRUE(isValidSimpleAtomMatcher(*simpleMatcher));
+
+    LogEvent event1(/*uid=*/0, /*pid=*/0);
+    makeStringLogEvent(&event1, TAG_ID, 0, "com.vendor.camera");
+    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event1));
+    LogEvent event2(/*uid=*/0, /*pid=*/0);
+    makeStringLogEvent(&event2, TAG_ID, 0, "com.other");
+    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event2));
+
+    // Uid fields match by normalized package name.
+    LogEvent event3(/*uid=*/0, /*pid=*/0);
+    makeIntWithBoolAnnotationLogEvent(&event3, TAG_ID, 1111, ANNOTATION_ID_IS_UID, true);
+    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event3));
+    LogEvent event4(/*uid=*/0, /*pid=*/0);
+    makeIntWithBoolAnnotationLogEvent(&event4, TAG_ID, 2222, ANNOTATION_ID_IS_UID, true);
+    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event4));
+
+    // And by AID name.
+    fieldValueMatcher->mutable_eq_any_wildcard_string()->add_str_value("AID_R??T");
+    LogEvent event5(/*uid=*/0, /*pid=*/0);
+    makeIntWithBoolAnnotationLogEvent(&event5, TAG_ID, 0, ANNOTATION_ID_IS_UID, true);
+    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event5));
+    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event3));
+
+    fieldValueMatcher->mutable_neq_any_wildcard_string()->add_str_value("*.camera");
+    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event1));
+    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event2));
+
+    fieldValueMatcher->mutable_neq_any_wildcard_string()->add_str_value("bad\\");
+    EXPECT_FALSE(isValidSimpleAtomMatcher(*simpleMatcher));
+}
+
+TEST(AtomMatcherTest, TestSharedSimpleAtomMatcher) {
+    sp<UidMap> uidMap = new UidMap();
+    SimpleAtomMatcher simpleMatcher;
+    simpleMatcher.set_atom_id(TAG_ID);
+    simpleMatcher.add_field_value_matcher()->set_field(1);
+    simpleMatcher.mutable_field_value_matcher(0)->set_eq_int(11);
+    SimpleAtomMatcher otherMatcher = simpleMatcher;
+    otherMatcher.mutable_field_value_matcher(0)->set_eq_int(12);
+
+    SharedSimpleAtomMatcherRegistry& registry = SharedSimpleAtomMatcherRegistry::getInstance();
+    const size_t sizeBefore = registry.size();
+    shared_ptr<SharedSimpleAtomMatcher> shared1 = registry.get(simpleMatcher, uidMap);
+    shared_ptr<SharedSimpleAtomMatcher> shared2 = registry.get(simpleMatcher, uidMap);
+    shared_ptr<SharedSimpleAtomMatcher> other = registry.get(otherMatcher, uidMap);
+    // Other uid maps get their own matchers.
+    shared_ptr<SharedSimpleAtomMatcher> otherUidMap = registry.get(simpleMatcher, new UidMap());
+    EXPECT_EQ(shared1, shared2);
+    EXPECT_NE(shared1, other);
+    EXPECT_NE(shared1, otherUidMap);
+    EXPECT_EQ(sizeBefore + 3, registry.size());
+
+    // An event is only evaluated once.
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    makeIntLogEvent(&event, TAG_ID, 0, 11);
+    EXPECT_TRUE(shared1->matches(event));
+    EXPECT_TRUE(shared2->matches(event));
+    EXPECT_FALSE(other->matches(event));
+    EXPECT_EQ(1, shared1->getEvaluationCount());
+
+    // Modified values are evaluated again.
+    event.getMutableValue(0).setInt(12);
+    EXPECT_FALSE(shared1->matches(event));
+    EXPECT_TRUE(other->matches(event));
+    EXPECT_EQ(2, shared1->getEvaluationCount());
+
+    LogEvent event2(/*uid=*/0, /*pid=*/0);
+    makeIntLogEvent(&event2, TAG_ID, 0, 11);
+    EXPECT_TRUE(shared2->matches(event2));
+    EXPECT_EQ(3, shared1->getEvaluationCount());
+
+    // Entries go away with their last user.
+    shared1.reset();
+    shared2.reset();
+    other.reset();
+    otherUidMap.reset();
+    EXPECT_EQ(sizeBefore, registry.size());
+}
+
+TEST(AtomMatcherTest, TestSharedSimpleAtomMatcherConcurrentConfigs) {
+    sp<UidMap> uidMap = new UidMap();
+    SimpleAtomMatcher simpleMatcher;
+    simpleMatcher.set_atom_id(TAG_ID);
+    simpleMatcher.add_field_value_matcher()->set_field(1);
+    simpleMatcher.mutable_field_value_matcher(0)->set_eq_int(11);
+    shared_ptr<SharedSimpleAtomMatcher> shared =
+            SharedSimpleAtomMatcherRegistry::getInstance().get(simpleMatcher, uidMap);
+
+    const int eventCount = 1000;
+    vector<std::unique_ptr<LogEvent>> events;
+    for (int i = 0; i < eventCount; i++) {
+        events.push_back(std::make_unique<LogEvent>(/*uid=*/0, /*pid=*/0));
+        makeIntLogEvent(events.back().get(), TAG_ID, 0, 10 + i % 2);
+    }
+
+    // Like the configs of a parallel dispatch, each thread matches every event.
+    vector<std::thread> threads;
+    std::atomic<int> matchCount(0);
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&] {
+            for (const auto& event : events) {
+                matchCount += shared->matches(*event) ? 1 : 0;
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    // The threads that fall behind evaluate their events again, but get the same results.
+    EXPECT_EQ(4 * eventCount / 2, matchCount);
+    EXPECT_LE(eventCount, shared->getEvaluationCount());
+}
+
+TEST(AtomMatcherTest, TestCombinationMatchWithBits) {
+    // Children spread over two words of the bitset.
+    const vector<int> children = {3, 64, 100};
+    const MatcherMask mask = makeMatcherMask(children);
+    ASSERT_EQ(2, mask.size());
+    EXPECT_EQ(0, mask[0].first);
+    EXPECT_EQ(1ULL << 3, mask[0].second);
+    EXPECT_EQ(1, mask[1].first);
+    EXPECT_EQ((1ULL << 0) | (1ULL << 36), mask[1].second);
+
+    const vector<LogicalOperation> operations = {LogicalOperation::AND, LogicalOperation::OR,
+                                                 LogicalOperation::NAND, LogicalOperation::NOR};
+    // Every combination of matched children gives the same result as the MatchingState version.
+    for (int matched = 0; matched < 8; matched++) {
+        vector<MatchingState> matcherResults(128, MatchingState::kNotMatched);
+        vector<uint64_t> matchedBits(2, 0);
+        for (int i = 0; i < 3; i++) {
+            if (matched & (1 << i)) {
+                matcherResults[children[i]] = MatchingState::kMatched;
+                setMatcherBit(matchedBits, children[i]);
+            }
+        }
+        for (const LogicalOperation operation : operations) {
+            EXPECT_EQ(combinationMatch(children, operation, matcherResults),
+                      combinationMatch(mask, operation, matchedBits))
+                    << "operation " << operation << " matched " << matched;
+        }
+        const vector<int> notChild = {children[0]};
+        EXPECT_EQ(combinationMatch(notChild, LogicalOperation::NOT, matcherResults),
+                  combinationMatch(makeMatcherMask(notChild), LogicalOperation::NOT, matchedBits));
+    }
+}
 #else
 GTEST_LOG_(INFO) << "This test does nothing.\n";
 #endif
@@ -192,6 +192,26 @@ TEST(LogEventTest, TestPrimitiveParsing) {
     AStatsEvent_release(event);
 }
 
+TEST(LogEventTest, TestParseAtomId) {
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, 100);
+    AStatsEvent_writeInt32(event, 10);
+    AStatsEvent_build(event);
+
+    size_t size;
+    uint8_t* buf = AStatsEvent_getBuffer(event, &size);
+
+    EXPECT_EQ(100, LogEvent::parseAtomId(buf, size));
+    // Truncated header.
+    EXPECT_EQ(-1, LogEvent::parseAtomId(buf, 15));
+    // Not an OBJECT_TYPE.
+    std::vector<uint8_t> corrupted(buf, buf + size);
+    corrupted[0] = INT32_TYPE;
+    EXPECT_EQ(-1, LogEvent::parseAtomId(corrupted.data(), corrupted.size()));
+
+    AStatsEvent_release(event);
+}
+
 TEST(LogEventTest, TestStringAndByteArrayParsing) {
     AStatsEvent* event = AStatsEvent_obtain();
     AStatsEvent_setAtomId(event, 100);
@@ -218,18 +238,245 @@ TEST(LogEventTest, TestStringAndByteArrayParsing) {
     Field expectedField = getField(100, {1, 1, 1}, 0, {false, false, false});
     EXPECT_EQ(expectedField, stringItem.mField);
     EXPECT_EQ(Type::STRING, stringItem.mValue.getType());
-    EXPECT_EQ(str, stringItem.mValue.str_value);
+    EXPECT_EQ(str, stringItem.mValue.getString());
 
     const FieldValue& storageItem = values[1];
     expectedField = getField(100, {2, 1, 1}, 0, {true, false, false});
     EXPECT_EQ(expectedField, storageItem.mField);
     EXPECT_EQ(Type::STORAGE, storageItem.mValue.getType());
     vector<uint8_t> expectedValue = {'t', 'e', 's', 't'};
-    EXPECT_EQ(expectedValue, storageItem.mValue.storage_value);
+    EXPECT_EQ(expectedValue, storageItem.mValue.getStorage());
 
     AStatsEvent_release(event);
 }
 
+TEST(LogEventTest, TestBufferViewValues) {
+    LogEvent::setBufferViewMinBytes(8);
+
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, 100);
+    string longStr = "some long string";
+    string shortStr = "short";
+    AStatsEvent_writeString(event, longStr.c_str());
+    AStatsEvent_writeString(event, shortStr.c_str());
+    AStatsEvent_writeByteArray(event, (uint8_t*)longStr.c_str(), longStr.length());
+    AStatsEvent_build(event);
+
+    size_t size;
+    uint8_t* buf = AStatsEvent_getBuffer(event, &size);
+
+    LogEvent logEvent(/*uid=*/1000, /*pid=*/1001);
+    EXPECT_TRUE(logEvent.parseBuffer(buf, size));
+    AStatsEvent_release(event);
+    LogEvent::setBufferViewMinBytes(0);
+
+    const vector<FieldValue>& values = logEvent.getValues();
+    ASSERT_EQ(3, values.size());
+
+    EXPECT_EQ(Type::STRING, values[0].mValue.getType());
+    EXPECT_TRUE(values[0].mValue.payload->isView());
+    EXPECT_EQ(longStr, values[0].mValue.getView());
+
+    EXPECT_EQ(Type::STRING, values[1].mValue.getType());
+    EXPECT_FALSE(values[1].mValue.payload->isView());
+    EXPECT_EQ(shortStr, values[1].mValue.getString());
+
+    EXPECT_EQ(Type::STORAGE, values[2].mValue.getType());
+    EXPECT_TRUE(values[2].mValue.payload->isView());
+    EXPECT_EQ(vector<uint8_t>(longStr.begin(), longStr.end()), values[2].mValue.getStorage());
+
+    // The views outlive the parsed buffer.
+    EXPECT_EQ(longStr, logEvent.GetString(1, nullptr));
+}
+
+TEST(LogEventTest, TestParsePlans) {
+    auto plans = std::make_shared<LogEventParsePlans>(/*numSlots=*/16);
+    LogEvent::setParsePlans(plans);
+
+    auto parseScalarEvent = [](int32_t intValue, bool uidAnnotation, LogEvent* logEvent) {
+        AStatsEvent* event = AStatsEvent_obtain();
+        AStatsEvent_setAtomId(event, 100);
+        AStatsEvent_writeInt32(event, intValue);
+        if (uidAnnotation) {
+            AStatsEvent_addBoolAnnotation(event, ANNOTATION_ID_IS_UID, true);
+        }
+        AStatsEvent_writeInt64(event, 2);
+        AStatsEvent_writeFloat(event, 3.0);
+        AStatsEvent_writeBool(event, true);
+        AStatsEvent_build(event);
+        size_t size;
+        uint8_t* buf = AStatsEvent_getBuffer(event, &size);
+        EXPECT_TRUE(logEvent->parseBuffer(buf, size));
+        AStatsEvent_release(event);
+    };
+
+    // The first event is parsed generically, and teaches the plan.
+    LogEvent first(/*uid=*/1000, /*pid=*/1001);
+    parseScalarEvent(1, /*uidAnnotation=*/false, &first);
+    ASSERT_NE(nullptr, plans->get(100));
+
+    // The next ones are decoded with it.
+    LogEvent second(/*uid=*/1000, /*pid=*/1001);
+    parseScalarEvent(5, /*uidAnnotation=*/false, &second);
+    const vector<FieldValue>& values = second.getValues();
+    ASSERT_EQ(4, values.size());
+    EXPECT_EQ(Type::INT, values[0].mValue.getType());
+    EXPECT_EQ(5, values[0].mValue.int_value);
+    EXPECT_EQ(Type::LONG, values[1].mValue.getType());
+    EXPECT_EQ(2, values[1].mValue.long_value);
+    EXPECT_EQ(Type::FLOAT, values[2].mValue.getType());
+    EXPECT_EQ(3.0, values[2].mValue.float_value);
+    EXPECT_EQ(Type::INT, values[3].mValue.getType());
+    EXPECT_EQ(1, values[3].mValue.int_value);
+    for (size_t i = 0; i < values.size(); i++) {
+        EXPECT_EQ(first.getValues()[i].mField, values[i].mField);
+    }
+    ASSERT_NE(nullptr, second.getFieldIndex());
+
+    // An annotated field doesn't match the plan, and falls back to the generic parser.
+    LogEvent annotated(/*uid=*/1000, /*pid=*/1001);
+    parseScalarEvent(1000, /*uidAnnotation=*/true, &annotated);
+    LogEvent::setParsePlans(nullptr);
+    ASSERT_EQ(4, annotated.getValues().size());
+    EXPECT_EQ(1000, annotated.getValues()[0].mValue.int_value);
+    EXPECT_EQ(1, annotated.getNumUidFields());
+}
+
+TEST(LogEventTest, TestParsePlansWithAnnotations) {
+    auto plans = std::make_shared<LogEventParsePlans>(/*numSlots=*/16);
+    LogEvent::setParsePlans(plans);
+
+    auto parseStateEvent = [](int32_t uid, bool uidAnnotation, LogEvent* logEvent) {
+        AStatsEvent* event = AStatsEvent_obtain();
+        AStatsEvent_setAtomId(event, 100);
+        AStatsEvent_writeInt32(event, uid);
+        AStatsEvent_addBoolAnnotation(event, ANNOTATION_ID_IS_UID, uidAnnotation);
+        AStatsEvent_addBoolAnnotation(event, ANNOTATION_ID_PRIMARY_FIELD, true);
+        AStatsEvent_writeInt32(event, 2);
+        AStatsEvent_addBoolAnnotation(event, ANNOTATION_ID_EXCLUSIVE_STATE, true);
+        AStatsEvent_addBoolAnnotation(event, ANNOTATION_ID_STATE_NESTED, false);
+        AStatsEvent_build(event);
+        size_t size;
+        uint8_t* buf = AStatsEvent_getBuffer(event, &size);
+        EXPECT_TRUE(logEvent->parseBuffer(buf, size));
+        AStatsEvent_release(event);
+    };
+
+    LogEvent first(/*uid=*/1000, /*pid=*/1001);
+    parseStateEvent(1000, /*uidAnnotation=*/true, &first);
+    const LogEventParsePlan* plan = plans->get(100);
+    ASSERT_NE(nullptr, plan);
+    EXPECT_EQ(2, plan->annotatedFields.size());
+
+    // The annotations are applied from the plan.
+    LogEvent second(/*uid=*/1000, /*pid=*/1001);
+    parseStateEvent(1001, /*uidAnnotation=*/true, &second);
+    const vector<FieldValue>& values = second.getValues();
+    ASSERT_EQ(2, values.size());
+    EXPECT_EQ(1001, values[0].mValue.int_value);
+    EXPECT_TRUE(values[0].mAnnotations.isUidField());
+    EXPECT_TRUE(values[0].mAnnotations.isPrimaryField());
+    EXPECT_FALSE(values[1].mAnnotations.isUidField());
+    EXPECT_TRUE(values[1].mAnnotations.isExclusiveState());
+    EXPECT_FALSE(values[1].mAnnotations.isNested());
+    EXPECT_EQ(1, second.getNumUidFields());
+    ASSERT_TRUE(second.getExclusiveStateFieldIndex());
+    EXPECT_EQ(1, second.getExclusiveStateFieldIndex().value());
+    for (size_t i = 0; i < values.size(); i++) {
+        EXPECT_EQ(first.getValues()[i].mAnnotations.isUidField(),
+                  values[i].mAnnotations.isUidField());
+    }
+
+    // Annotations with other values don't match the plan, and are decoded.
+    LogEvent notUid(/*uid=*/1000, /*pid=*/1001);
+    parseStateEvent(1002, /*uidAnnotation=*/false, &notUid);
+    LogEvent::setParsePlans(nullptr);
+    ASSERT_EQ(2, notUid.getValues().size());
+    EXPECT_FALSE(notUid.getValues()[0].mAnnotations.isUidField());
+    EXPECT_TRUE(notUid.getValues()[0].mAnnotations.isPrimaryField());
+    EXPECT_EQ(0, notUid.getNumUidFields());
+}
+
+TEST(LogEventTest, TestParsePlansNotLearnedForStrings) {
+    auto plans = std::make_shared<LogEventParsePlans>(/*numSlots=*/16);
+    LogEvent::setParsePlans(plans);
+
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, 100);
+    AStatsEvent_writeInt32(event, 1);
+    AStatsEvent_writeString(event, "str");
+    AStatsEvent_build(event);
+    size_t size;
+    uint8_t* buf = AStatsEvent_getBuffer(event, &size);
+    LogEvent logEvent(/*uid=*/1000, /*pid=*/1001);
+    EXPECT_TRUE(logEvent.parseBuffer(buf, size));
+    AStatsEvent_release(event);
+    LogEvent::setParsePlans(nullptr);
+
+    EXPECT_EQ(nullptr, plans->get(100));
+    EXPECT_EQ(0, plans->size());
+}
+
+TEST(LogEventTest, TestValuesCapacityReserved) {
+    auto parseWideEvent = [](LogEvent* logEvent) {
+        AStatsEvent* event = AStatsEvent_obtain();
+        AStatsEvent_setAtomId(event, 1234);
+        uint32_t uids[] = {1001, 1002, 1003, 1004};
+        const char* tags[] = {"tag1", "tag2", "tag3", "tag4"};
+        AStatsEvent_writeAttributionChain(event, uids, tags, 4);
+        for (int i = 0; i < 20; i++) {
+            AStatsEvent_writeInt32(event, i);
+        }
+        AStatsEvent_build(event);
+        size_t size;
+        uint8_t* buf = AStatsEvent_getBuffer(event, &size);
+        EXPECT_TRUE(logEvent->parseBuffer(buf, size));
+        AStatsEvent_release(event);
+    };
+    LogEvent::takeValuesRegrowCount();
+
+    // The attribution chain has more values than top-level fields, so the first event regrows.
+    LogEvent first(/*uid=*/1000, /*pid=*/1001);
+    parseWideEvent(&first);
+    ASSERT_EQ(28, first.getValues().size());
+    EXPECT_EQ(1, LogEvent::takeValuesRegrowCount());
+
+    // The next ones reserve what the first one needed.
+    LogEvent second(/*uid=*/1000, /*pid=*/1001);
+    parseWideEvent(&second);
+    ASSERT_EQ(28, second.getValues().size());
+    EXPECT_EQ(28, second.getValues().capacity());
+    EXPECT_EQ(0, LogEvent::takeValuesRegrowCount());
+}
+
+TEST(LogEventTest, TestMatchId) {
+    AStatsEvent* statsEvent = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(statsEvent, 100);
+    AStatsEvent_writeInt32(statsEvent, 1001);
+    AStatsEvent_build(statsEvent);
+    size_t size;
+    uint8_t* buf = AStatsEvent_getBuffer(statsEvent, &size);
+
+    LogEvent event(/*uid=*/1000, /*pid=*/1001);
+    const uint64_t idBeforeParse = event.getMatchId();
+    EXPECT_TRUE(event.parseBuffer(buf, size));
+    AStatsEvent_release(statsEvent);
+    const uint64_t matchId = event.getMatchId();
+    EXPECT_NE(idBeforeParse, matchId);
+    EXPECT_NE(0, matchId);
+
+    // Copies with the same values share the id, until they are modified.
+    LogEvent copy(event);
+    EXPECT_EQ(matchId, copy.getMatchId());
+    copy.getMutableValue(0).setInt(1002);
+    EXPECT_NE(matchId, copy.getMatchId());
+    EXPECT_EQ(matchId, event.getMatchId());
+
+    event.getMutableValues();
+    EXPECT_NE(matchId, event.getMatchId());
+    EXPECT_NE(copy.getMatchId(), event.getMatchId());
+}
+
 TEST(LogEventTest, TestEmptyString) {
     AStatsEvent* event = AStatsEvent_obtain();
     AStatsEvent_setAtomId(event, 100);
@@ -255,7 +502,7 @@ TEST(LogEventTest, TestEmptyString) {
     Field expectedField = getField(100, {1, 1, 1}, 0, {true, false, false});
     EXPECT_EQ(expectedField, item.mField);
     EXPECT_EQ(Type::STRING, item.mValue.getType());
-    EXPECT_EQ(empty, item.mValue.str_value);
+    EXPECT_EQ(empty, item.mValue.getString());
 
     AStatsEvent_release(event);
 }
@@ -285,9 +532,36 @@ TEST(LogEventTest, TestByteArrayWithNullCharacter) {
     EXPECT_EQ(expectedField, item.mField);
     EXPECT_EQ(Type::STORAGE, item.mValue.getType());
     vector<uint8_t> expectedValue(message, message + 5);
-    EXPECT_EQ(expectedValue, item.mValue.storage_value);
+    EXPECT_EQ(expectedValue, item.mValue.getStorage());
+
+    AStatsEvent_release(event);
+}
 
+TEST(LogEventTest, TestFieldIndex) {
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, 100);
+    AStatsEvent_writeInt32(event, 10);
+    AStatsEvent_writeString(event, "test");
+    AStatsEvent_build(event);
+
+    size_t size;
+    uint8_t* buf = AStatsEvent_getBuffer(event, &size);
+    LogEvent logEvent(/*uid=*/1000, /*pid=*/1001);
+    EXPECT_TRUE(logEvent.parseBuffer(buf, size));
     AStatsEvent_release(event);
+
+    const int32_t* fields = logEvent.getFieldIndex();
+    ASSERT_NE(nullptr, fields);
+    EXPECT_EQ(logEvent.getValues()[0].mField.getField(), fields[0]);
+    EXPECT_EQ(logEvent.getValues()[1].mField.getField(), fields[1]);
+
+    // Modifying a value keeps the index.
+    logEvent.getMutableValue(0).setInt(20);
+    EXPECT_EQ(20, logEvent.getValues()[0].mValue.int_value);
+    EXPECT_NE(nullptr, logEvent.getFieldIndex());
+
+    logEvent.getMutableValues()->pop_back();
+    EXPECT_EQ(nullptr, logEvent.getFieldIndex());
 }
 
 TEST(LogEventTest, TestTooManyTopLevelElements) {
@@ -351,7 +625,7 @@ TEST(LogEventTest, TestAttributionChain) {
     expectedField = getField(100, {1, 1, 2}, 2, {true, false, true});
     EXPECT_EQ(expectedField, tag1Item.mField);
     EXPECT_EQ(Type::STRING, tag1Item.mValue.getType());
-    EXPECT_EQ(tag1, tag1Item.mValue.str_value);
+    EXPECT_EQ(tag1, tag1Item.mValue.getString());
 
     // Check second attribution nodes
     const FieldValue& uid2Item = values[2];
@@ -364,7 +638,7 @@ TEST(LogEventTest, TestAttributionChain) {
     expectedField = getField(100, {1, 2, 2}, 2, {true, true, true});
     EXPECT_EQ(expectedField, tag2Item.mField);
     EXPECT_EQ(Type::STRING, tag2Item.mValue.getType());
-    EXPECT_EQ(tag2, tag2Item.mValue.str_value);
+    EXPECT_EQ(tag2, tag2Item.mValue.getString());
 
     AStatsEvent_release(event);
 }
@@ -501,13 +775,50 @@ TEST(LogEventTest, TestArrayParsing) {
     expectedField = getField(100, {5, 1, 1}, 1, {true, false, false});
     EXPECT_EQ(expectedField, stringArrayItem1.mField);
     EXPECT_EQ(Type::STRING, stringArrayItem1.mValue.getType());
-    EXPECT_EQ("str1", stringArrayItem1.mValue.str_value);
+    EXPECT_EQ("str1", stringArrayItem1.mValue.getString());
 
     const FieldValue& stringArrayItem2 = values[9];
     expectedField = getField(100, {5, 2, 1}, 1, {true, true, false});
     EXPECT_EQ(expectedField, stringArrayItem2.mField);
     EXPECT_EQ(Type::STRING, stringArrayItem2.mValue.getType());
-    EXPECT_EQ("str2", stringArrayItem2.mValue.str_value);
+    EXPECT_EQ("str2", stringArrayItem2.mValue.getString());
+}
+
+TEST(LogEventTest, TestPackedArrayParsing) {
+    int32_t int32Array[3] = {-3, INT32_MAX, INT32_MIN};
+    int64_t int64Array[2] = {1000L, INT64_MIN};
+
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, 100);
+    AStatsEvent_writePackedInt32Array(event, int32Array, 3);
+    AStatsEvent_writePackedInt64Array(event, int64Array, 2);
+    AStatsEvent_build(event);
+
+    size_t size;
+    uint8_t* buf = AStatsEvent_getBuffer(event, &size);
+
+    LogEvent logEvent(/*uid=*/1000, /*pid=*/1001);
+    EXPECT_TRUE(logEvent.parseBuffer(buf, size));
+
+    // The values are the same as with the unpacked arrays.
+    const vector<FieldValue>& values = logEvent.getValues();
+    ASSERT_EQ(5, values.size());
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(getField(100, {1, i + 1, 1}, 1, {false, i == 2, false}), values[i].mField);
+        EXPECT_EQ(Type::INT, values[i].mValue.getType());
+        EXPECT_EQ(int32Array[i], values[i].mValue.int_value);
+    }
+    for (int i = 0; i < 2; i++) {
+        EXPECT_EQ(getField(100, {2, i + 1, 1}, 1, {false, i == 1, false}), values[3 + i].mField);
+        EXPECT_EQ(Type::LONG, values[3 + i].mValue.getType());
+        EXPECT_EQ(int64Array[i], values[3 + i].mValue.long_value);
+    }
+
+    // A truncated varint is invalid.
+    LogEvent truncatedEvent(/*uid=*/1000, /*pid=*/1001);
+    EXPECT_FALSE(truncatedEvent.parseBuffer(buf, size - 1));
+
+    AStatsEvent_release(event);
 }
 
 TEST(LogEventTest, TestEmptyStringArray) {
@@ -538,13 +849,13 @@ TEST(LogEventTest, TestEmptyStringArray) {
     Field expectedField = getField(100, {1, 1, 1}, 1, {true, false, false});
     EXPECT_EQ(expectedField, stringArrayItem1.mField);
     EXPECT_EQ(Type::STRING, stringArrayItem1.mValue.getType());
-    EXPECT_EQ(empty, stringArrayItem1.mValue.str_value);
+    EXPECT_EQ(empty, stringArrayItem1.mValue.getString());
 
     const FieldValue& stringArrayItem2 = values[1];
     expectedField = getField(100, {1, 2, 1}, 1, {true, true, false});
     EXPECT_EQ(expectedField, stringArrayItem2.mField);
     EXPECT_EQ(Type::STRING, stringArrayItem2.mValue.getType());
-    EXPECT_EQ(empty, stringArrayItem2.mValue.str_value);
+    EXPECT_EQ(empty, stringArrayItem2.mValue.getString());
 
     AStatsEvent_release(event);
 }
@@ -18,24 +18,29 @@
 #include <stdio.h>
 
 #include <set>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 #include "metrics/metrics_test_helper.h"
 #include "src/condition/ConditionTracker.h"
+#include "src/condition/SimpleConditionTracker.h"
 #include "src/matchers/AtomMatchingTracker.h"
 #include "src/metrics/CountMetricProducer.h"
+#include "src/metrics/DurationMetricProducer.h"
 #include "src/metrics/GaugeMetricProducer.h"
 #include "src/metrics/MetricProducer.h"
 #include "src/metrics/NumericValueMetricProducer.h"
 #include "src/metrics/parsing_utils/metrics_manager_util.h"
 #include "src/state/StateManager.h"
 #include "src/statsd_config.pb.h"
+#include "src/utils/ParallelExecutor.h"
 #include "statsd_test_util.h"
 
 using namespace testing;
 using android::sp;
 using android::os::statsd::Predicate;
+using android::util::ProtoOutputStream;
 using std::map;
 using std::set;
 using std::unordered_map;
@@ -157,8 +162,8 @@ TEST(MetricsManagerTest, TestLogSources) {
 
     EXPECT_THAT(metricsManager.mAllowedUid, ElementsAre(AID_SYSTEM));
     EXPECT_THAT(metricsManager.mAllowedPkg, ElementsAre(app1));
-    EXPECT_THAT(metricsManager.mAllowedLogSources,
-                ContainerEq(unionSet(vector<set<int32_t>>({app1Uids, {AID_SYSTEM}}))));
+    EXPECT_THAT(*metricsManager.getAllowedLogSources(),
+                ElementsAreArray(unionSet(vector<set<int32_t>>({app1Uids, {AID_SYSTEM}}))));
     EXPECT_THAT(metricsManager.mDefaultPullUids, ContainerEq(defaultPullUids));
 
     vector<int32_t> atom1Uids = metricsManager.getPullAtomUids(atom1);
@@ -247,8 +252,8 @@ TEST(MetricsManagerTest, TestLogSourcesOnConfigUpdate) {
 
     EXPECT_THAT(metricsManager.mAllowedUid, ElementsAre(AID_ROOT));
     EXPECT_THAT(metricsManager.mAllowedPkg, ElementsAre(app2));
-    EXPECT_THAT(metricsManager.mAllowedLogSources,
-                ContainerEq(unionSet(vector<set<int32_t>>({app2Uids, {AID_ROOT}}))));
+    EXPECT_THAT(*metricsManager.getAllowedLogSources(),
+                ElementsAreArray(unionSet(vector<set<int32_t>>({app2Uids, {AID_ROOT}}))));
     const set<int32_t> defaultPullUids = {AID_SYSTEM, AID_STATSD};
     EXPECT_THAT(metricsManager.mDefaultPullUids, ContainerEq(defaultPullUids));
 
@@ -288,6 +293,379 @@ TEST(MetricsManagerTest, TestCheckLogCredentialsWhitelistedAtom) {
     EXPECT_TRUE(metricsManager.checkLogCredentials(event));
 }
 
+TEST(MetricsManagerTest, TestCheckLogCredentialsAllowedLogSource) {
+    sp<UidMap> uidMap = new UidMap();
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+
+    StatsdConfig config;
+    config.add_allowed_log_source("AID_SYSTEM");
+    config.add_allowed_log_source("AID_ROOT");
+    config.add_allowed_log_source("AID_SYSTEM");
+
+    MetricsManager metricsManager(kConfigKey, config, timeBaseSec, timeBaseSec, uidMap,
+                                  pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor);
+    EXPECT_THAT(*metricsManager.getAllowedLogSources(), ElementsAre(AID_ROOT, AID_SYSTEM));
+
+    LogEvent systemEvent(AID_SYSTEM /* uid */, 0 /* pid */);
+    CreateNoValuesLogEvent(&systemEvent, 10 /* atom id */, 0 /* timestamp */);
+    EXPECT_TRUE(metricsManager.checkLogCredentials(systemEvent));
+
+    LogEvent appEvent(10001 /* uid */, 0 /* pid */);
+    CreateNoValuesLogEvent(&appEvent, 10 /* atom id */, 0 /* timestamp */);
+    EXPECT_FALSE(metricsManager.checkLogCredentials(appEvent));
+}
+
+TEST(MetricsManagerTest, TestTagIdToMatcherIndices) {
+    sp<UidMap> uidMap;
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+
+    StatsdConfig config = buildGoodConfig();
+    *config.add_atom_matcher() = CreateAcquireWakelockAtomMatcher();
+    config.add_count_metric()->set_id(4);
+    config.mutable_count_metric(1)->set_what(config.atom_matcher(3).id());
+    config.mutable_count_metric(1)->set_bucket(ONE_MINUTE);
+
+    MetricsManager metricsManager(kConfigKey, config, timeBaseSec, timeBaseSec, uidMap,
+                                  pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor);
+    ASSERT_TRUE(metricsManager.isConfigValid());
+
+    // The combination matcher is indexed with its children.
+    EXPECT_THAT(metricsManager.mTagIdToMatcherIndices,
+                UnorderedElementsAre(Pair(2, ElementsAre(0, 1, 2)),
+                                     Pair(util::WAKELOCK_STATE_CHANGED, ElementsAre(3))));
+
+    // The index is rebuilt on config updates.
+    config.mutable_atom_matcher()->RemoveLast();
+    config.mutable_count_metric()->RemoveLast();
+    metricsManager.updateConfig(config, timeBaseSec, timeBaseSec, anomalyAlarmMonitor,
+                                periodicAlarmMonitor);
+    EXPECT_THAT(metricsManager.mTagIdToMatcherIndices,
+                UnorderedElementsAre(Pair(2, ElementsAre(0, 1, 2))));
+}
+
+TEST(MetricsManagerTest, TestConfigUpdatePreservingMatchers) {
+    sp<UidMap> uidMap;
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+
+    StatsdConfig config = buildGoodConfig();
+    config.add_allowed_log_source("AID_ROOT");
+    MetricsManager metricsManager(kConfigKey, config, timeBaseSec, timeBaseSec, uidMap,
+                                  pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor);
+    ASSERT_TRUE(metricsManager.isConfigValid());
+    const sp<MetricProducer> preservedMetric = metricsManager.mAllMetricProducers[0];
+
+    // Only the metrics change, the matchers keep their indices.
+    CountMetric* metric = config.add_count_metric();
+    metric->set_id(4);
+    metric->set_what(StringToId("SCREEN_ON_OR_OFF"));
+    metric->set_bucket(ONE_MINUTE);
+    ASSERT_TRUE(metricsManager.updateConfig(config, timeBaseSec, timeBaseSec, anomalyAlarmMonitor,
+                                            periodicAlarmMonitor));
+
+    EXPECT_EQ(preservedMetric, metricsManager.mAllMetricProducers[0]);
+    EXPECT_THAT(metricsManager.mTagIdToMatcherIndices,
+                UnorderedElementsAre(Pair(2, ElementsAre(0, 1, 2))));
+    EXPECT_THAT(metricsManager.mTrackerToMetricTable.get(0), ElementsAre(0));
+    EXPECT_THAT(metricsManager.mTrackerToMetricTable.get(2), ElementsAre(1));
+}
+
+TEST(MetricsManagerTest, TestTagIdToMatcherIndicesChildrenFirst) {
+    sp<UidMap> uidMap;
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+
+    StatsdConfig config = buildGoodConfig();
+    AtomMatcher* notMatcher = config.add_atom_matcher();
+    notMatcher->set_id(StringToId("SCREEN_NOT_ON_OR_OFF"));
+    notMatcher->mutable_combination()->set_operation(LogicalOperation::NOT);
+    notMatcher->mutable_combination()->add_matcher(StringToId("SCREEN_ON_OR_OFF"));
+    // Move the new matcher before its children.
+    for (int i = config.atom_matcher_size() - 1; i > 0; i--) {
+        config.mutable_atom_matcher()->SwapElements(i, i - 1);
+    }
+
+    MetricsManager metricsManager(kConfigKey, config, timeBaseSec, timeBaseSec, uidMap,
+                                  pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor);
+    ASSERT_TRUE(metricsManager.isConfigValid());
+
+    // Combinations come after their children, in topological order.
+    EXPECT_THAT(metricsManager.mTagIdToMatcherIndices,
+                UnorderedElementsAre(Pair(2, ElementsAre(1, 2, 3, 0))));
+}
+
+TEST(MetricsManagerTest, TestAppUpgradesCoalesced) {
+    sp<UidMap> uidMap = new UidMap();
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+
+    StatsdConfig config = buildGoodConfig();
+    config.mutable_count_metric(0)->set_split_bucket_for_app_upgrade(true);
+    config.set_app_upgrade_coalescing_window_millis(10000);
+
+    const int64_t startNs = timeBaseSec * NS_PER_SEC;
+    MetricsManager metricsManager(kConfigKey, config, startNs, startNs, uidMap, pullerManager,
+                                  anomalyAlarmMonitor, periodicAlarmMonitor);
+    ASSERT_TRUE(metricsManager.isConfigValid());
+
+    metricsManager.notifyAppUpgrade(startNs + NS_PER_SEC, "app1", 1000, 2);
+    EXPECT_EQ(startNs + NS_PER_SEC, metricsManager.mLastAppChangeSplitNs);
+
+    // The changes within the window don't split the buckets again.
+    metricsManager.notifyAppUpgrade(startNs + 2 * NS_PER_SEC, "app2", 1001, 2);
+    metricsManager.notifyAppRemoved(startNs + 5 * NS_PER_SEC, "app3", 1002);
+    EXPECT_EQ(startNs + NS_PER_SEC, metricsManager.mLastAppChangeSplitNs);
+
+    metricsManager.notifyAppUpgrade(startNs + 11 * NS_PER_SEC, "app1", 1000, 3);
+    EXPECT_EQ(startNs + 11 * NS_PER_SEC, metricsManager.mLastAppChangeSplitNs);
+}
+
+TEST(MetricsManagerTest, TestInactiveConfigOnlyEvaluatesActivationAndConditionMatchers) {
+    sp<UidMap> uidMap = new UidMap();
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+
+    StatsdConfig config;
+    config.add_allowed_log_source("AID_ROOT");
+    AtomMatcher screenOnMatcher = CreateScreenTurnedOnAtomMatcher();
+    *config.add_atom_matcher() = screenOnMatcher;
+    AtomMatcher syncStartMatcher = CreateSyncStartAtomMatcher();
+    *config.add_atom_matcher() = syncStartMatcher;
+    *config.add_atom_matcher() = CreateAcquireWakelockAtomMatcher();
+    *config.add_atom_matcher() = CreateReleaseWakelockAtomMatcher();
+    Predicate holdingWakelockPredicate = CreateHoldingWakelockPredicate();
+    *config.add_predicate() = holdingWakelockPredicate;
+
+    CountMetric metric = createCountMetric("SyncsWhileHoldingWakelock", syncStartMatcher.id(),
+                                           holdingWakelockPredicate.id(), {});
+    *config.add_count_metric() = metric;
+    MetricActivation* activation = config.add_metric_activation();
+    activation->set_metric_id(metric.id());
+    EventActivation* eventActivation = activation->add_event_activation();
+    eventActivation->set_activation_type(ActivationType::ACTIVATE_IMMEDIATELY);
+    eventActivation->set_atom_matcher_id(screenOnMatcher.id());
+    eventActivation->set_ttl_seconds(60);
+
+    const int64_t startNs = timeBaseSec * NS_PER_SEC;
+    MetricsManager metricsManager(kConfigKey, config, startNs, startNs, uidMap, pullerManager,
+                                  anomalyAlarmMonitor, periodicAlarmMonitor);
+    ASSERT_TRUE(metricsManager.isConfigValid());
+    EXPECT_FALSE(metricsManager.isActive());
+
+    // The sync matcher only feeds the metric.
+    EXPECT_THAT(metricsManager.mInactiveTagIdToMatcherIndices,
+                UnorderedElementsAre(Pair(util::SCREEN_STATE_CHANGED, ElementsAre(0)),
+                                     Pair(util::WAKELOCK_STATE_CHANGED, ElementsAre(2, 3))));
+
+    metricsManager.onLogEvent(*CreateSyncStartEvent(startNs + 10, {1000}, {"tag"}, "sync"));
+    EXPECT_EQ(MatchingState::kNotComputed, metricsManager.mMatcherCache[1]);
+
+    // The condition stays current while the config is inactive.
+    metricsManager.onLogEvent(*CreateAcquireWakelockEvent(startNs + 20, {1000}, {"tag"}, "wl"));
+    EXPECT_EQ(MatchingState::kMatched, metricsManager.mMatcherCache[2]);
+
+    metricsManager.onLogEvent(*CreateScreenStateChangedEvent(
+            startNs + 30, android::view::DisplayStateEnum::DISPLAY_STATE_ON));
+    EXPECT_TRUE(metricsManager.isActive());
+
+    metricsManager.onLogEvent(*CreateSyncStartEvent(startNs + 40, {1000}, {"tag"}, "sync"));
+    EXPECT_EQ(MatchingState::kMatched, metricsManager.mMatcherCache[1]);
+}
+
+TEST(MetricsManagerTest, TestInactiveMetricMemoryReleased) {
+    sp<UidMap> uidMap = new UidMap();
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+
+    StatsdConfig config;
+    config.add_allowed_log_source("AID_ROOT");
+    config.set_inactive_metric_memory_release_millis(5000);
+    AtomMatcher screenOnMatcher = CreateScreenTurnedOnAtomMatcher();
+    *config.add_atom_matcher() = screenOnMatcher;
+    AtomMatcher syncStartMatcher = CreateSyncStartAtomMatcher();
+    *config.add_atom_matcher() = syncStartMatcher;
+    CountMetric metric = createCountMetric("Syncs", syncStartMatcher.id(), nullopt, {});
+    *config.add_count_metric() = metric;
+    MetricActivation* activation = config.add_metric_activation();
+    activation->set_metric_id(metric.id());
+    EventActivation* eventActivation = activation->add_event_activation();
+    eventActivation->set_activation_type(ActivationType::ACTIVATE_IMMEDIATELY);
+    eventActivation->set_atom_matcher_id(screenOnMatcher.id());
+    eventActivation->set_ttl_seconds(10);
+
+    const int64_t startNs = timeBaseSec * NS_PER_SEC;
+    MetricsManager metricsManager(kConfigKey, config, startNs, startNs, uidMap, pullerManager,
+                                  anomalyAlarmMonitor, periodicAlarmMonitor);
+    ASSERT_TRUE(metricsManager.isConfigValid());
+    sp<CountMetricProducer> producer =
+            static_cast<CountMetricProducer*>(metricsManager.mAllMetricProducers[0].get());
+
+    metricsManager.onLogEvent(*CreateScreenStateChangedEvent(
+            startNs + NS_PER_SEC, android::view::DisplayStateEnum::DISPLAY_STATE_ON));
+    metricsManager.onLogEvent(
+            *CreateSyncStartEvent(startNs + 2 * NS_PER_SEC, {1000}, {"tag"}, "sync"));
+    EXPECT_TRUE(metricsManager.isActive());
+
+    // The deactivation flushes the counter to the pool.
+    metricsManager.onLogEvent(
+            *CreateSyncStartEvent(startNs + 12 * NS_PER_SEC, {1000}, {"tag"}, "sync"));
+    EXPECT_FALSE(metricsManager.isActive());
+    EXPECT_EQ(1, producer->mCurrentSlicedCounterPool.size());
+
+    metricsManager.onLogEvent(
+            *CreateSyncStartEvent(startNs + 16 * NS_PER_SEC, {1000}, {"tag"}, "sync"));
+    EXPECT_EQ(1, producer->mCurrentSlicedCounterPool.size());
+
+    metricsManager.onLogEvent(
+            *CreateSyncStartEvent(startNs + 18 * NS_PER_SEC, {1000}, {"tag"}, "sync"));
+    EXPECT_EQ(0, producer->mCurrentSlicedCounterPool.size());
+}
+
+TEST(MetricsManagerTest, TestConditionStatesSharedOnInit) {
+    sp<UidMap> uidMap = new UidMap();
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+
+    StatsdConfig config;
+    config.add_allowed_log_source("AID_ROOT");
+    AtomMatcher acquireMatcher = CreateAcquireWakelockAtomMatcher();
+    *config.add_atom_matcher() = acquireMatcher;
+    *config.add_atom_matcher() = CreateReleaseWakelockAtomMatcher();
+    Predicate holdingWakelockPredicate = CreateHoldingWakelockPredicate();
+    *config.add_predicate() = holdingWakelockPredicate;
+    *config.add_count_metric() = createCountMetric("Acquires", acquireMatcher.id(),
+                                                   holdingWakelockPredicate.id(), {});
+
+    MetricsManager manager1(kConfigKey, config, timeBaseSec, timeBaseSec, uidMap, pullerManager,
+                            anomalyAlarmMonitor, periodicAlarmMonitor);
+    MetricsManager manager2(ConfigKey(kConfigKey.GetUid(), kConfigKey.GetId() + 1), config,
+                            timeBaseSec, timeBaseSec, uidMap, pullerManager, anomalyAlarmMonitor,
+                            periodicAlarmMonitor);
+    ASSERT_TRUE(manager1.isConfigValid());
+    ASSERT_TRUE(manager2.isConfigValid());
+    auto getState = [](const MetricsManager& manager) {
+        return static_cast<SimpleConditionTracker*>(manager.mAllConditionTrackers[0].get())
+                ->mState;
+    };
+
+    // The managers may be built while the events are processed, so they only share the states
+    // once in use.
+    EXPECT_NE(getState(manager1), getState(manager2));
+
+    manager1.init();
+    manager2.init();
+    EXPECT_EQ(getState(manager1), getState(manager2));
+}
+
+TEST(MetricsManagerTest, TestInactiveConfigDispatchesToDurationMetrics) {
+    sp<UidMap> uidMap = new UidMap();
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+
+    StatsdConfig config;
+    config.add_allowed_log_source("AID_ROOT");
+    AtomMatcher screenOnMatcher = CreateScreenTurnedOnAtomMatcher();
+    *config.add_atom_matcher() = screenOnMatcher;
+    *config.add_atom_matcher() = CreateSyncStartAtomMatcher();
+    *config.add_atom_matcher() = CreateSyncEndAtomMatcher();
+    Predicate isSyncingPredicate = CreateIsSyncingPredicate();
+    *config.add_predicate() = isSyncingPredicate;
+
+    DurationMetric metric =
+            createDurationMetric("SyncDuration", isSyncingPredicate.id(), nullopt, {});
+    *config.add_duration_metric() = metric;
+    MetricActivation* activation = config.add_metric_activation();
+    activation->set_metric_id(metric.id());
+    EventActivation* eventActivation = activation->add_event_activation();
+    eventActivation->set_activation_type(ActivationType::ACTIVATE_IMMEDIATELY);
+    eventActivation->set_atom_matcher_id(screenOnMatcher.id());
+    eventActivation->set_ttl_seconds(60);
+
+    const int64_t startNs = timeBaseSec * NS_PER_SEC;
+    MetricsManager metricsManager(kConfigKey, config, startNs, startNs, uidMap, pullerManager,
+                                  anomalyAlarmMonitor, periodicAlarmMonitor);
+    ASSERT_TRUE(metricsManager.isConfigValid());
+    EXPECT_FALSE(metricsManager.isActive());
+
+    // The start and stop matchers of the duration metric are evaluated while inactive.
+    EXPECT_THAT(metricsManager.mInactiveTagIdToMatcherIndices,
+                UnorderedElementsAre(Pair(util::SCREEN_STATE_CHANGED, ElementsAre(0)),
+                                     Pair(util::SYNC_STATE_CHANGED, ElementsAre(1, 2))));
+
+    ASSERT_EQ(1, metricsManager.mAllMetricProducers.size());
+    sp<DurationMetricProducer> durationProducer =
+            static_cast<DurationMetricProducer*>(metricsManager.mAllMetricProducers[0].get());
+
+    // A duration started while inactive is tracked.
+    metricsManager.onLogEvent(*CreateSyncStartEvent(startNs + 10, {1000}, {"tag"}, "sync"));
+    EXPECT_EQ(1, durationProducer->mCurrentSlicedDurationTrackerMap.size());
+
+    metricsManager.onLogEvent(*CreateScreenStateChangedEvent(
+            startNs + 20, android::view::DisplayStateEnum::DISPLAY_STATE_ON));
+    EXPECT_TRUE(metricsManager.isActive());
+    EXPECT_EQ(1, durationProducer->mCurrentSlicedDurationTrackerMap.size());
+
+    ASSERT_TRUE(metricsManager.mAllMetricProducers[0]->isActive());
+}
+
+TEST(MetricsManagerTest, TestParallelDumpPullsOnCallingThread) {
+    sp<UidMap> uidMap = new UidMap();
+    sp<MockStatsPullerManager> pullerManager = new NiceMock<MockStatsPullerManager>();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+
+    StatsdConfig config;
+    config.add_allowed_log_source("AID_ROOT");
+    AtomMatcher pulledMatcher =
+            CreateSimpleAtomMatcher("SubsystemSleep", util::SUBSYSTEM_SLEEP_STATE);
+    *config.add_atom_matcher() = pulledMatcher;
+    AtomMatcher wakelockMatcher = CreateAcquireWakelockAtomMatcher();
+    *config.add_atom_matcher() = wakelockMatcher;
+    *config.add_value_metric() =
+            createValueMetric("SleepTime", pulledMatcher, /*valueField=*/4, nullopt, {});
+    *config.add_count_metric() =
+            createCountMetric("Wakelocks", wakelockMatcher.id(), nullopt, {});
+    *config.add_count_metric() =
+            createCountMetric("MoreWakelocks", wakelockMatcher.id(), nullopt, {});
+
+    // The pulled events are matched with the EventMatcherWizard of the config, which the
+    // producers share, so the value metric pulls on the dumping thread.
+    std::thread::id pullThreadId;
+    ON_CALL(*pullerManager, Pull(util::SUBSYSTEM_SLEEP_STATE, kConfigKey, _, _))
+            .WillByDefault(Invoke([&pullThreadId](int, const ConfigKey&, const int64_t,
+                                                  vector<std::shared_ptr<LogEvent>>*) {
+                pullThreadId = std::this_thread::get_id();
+                return true;
+            }));
+
+    const int64_t startNs = timeBaseSec * NS_PER_SEC;
+    MetricsManager metricsManager(kConfigKey, config, startNs, startNs, uidMap, pullerManager,
+                                  anomalyAlarmMonitor, periodicAlarmMonitor);
+    ASSERT_TRUE(metricsManager.isConfigValid());
+    ASSERT_EQ(3, metricsManager.mAllMetricProducers.size());
+    EXPECT_TRUE(metricsManager.mAllMetricProducers[0]->isPulled());
+    EXPECT_FALSE(metricsManager.mAllMetricProducers[1]->isPulled());
+
+    ParallelExecutor executor(2);
+    pullThreadId = std::thread::id();
+    ProtoOutputStream output;
+    metricsManager.onDumpReport(startNs + NS_PER_SEC, startNs + NS_PER_SEC,
+                                /*include_current_partial_bucket=*/true, /*erase_data=*/true,
+                                NO_TIME_CONSTRAINTS, /*str_set=*/nullptr, &output, &executor);
+    EXPECT_EQ(std::this_thread::get_id(), pullThreadId);
+}
+
 TEST(MetricsManagerTest, TestWhitelistedAtomStateTracker) {
     sp<UidMap> uidMap;
     sp<StatsPullerManager> pullerManager = new StatsPullerManager();
@@ -14,11 +14,16 @@
 
 #include "StatsLogProcessor.h"
 
+#include <android-base/file.h>
 #include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
+#include <fcntl.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <stdio.h>
 
+#include <thread>
+
 #include "StatsService.h"
 #include "config/ConfigKey.h"
 #include "guardrail/StatsdStats.h"
@@ -26,6 +31,7 @@
 #include "packages/UidMap.h"
 #include "src/stats_log.pb.h"
 #include "src/statsd_config.pb.h"
+#include "state/StateManager.h"
 #include "statslog_statsdtest.h"
 #include "storage/StorageManager.h"
 #include "tests/statsd_test_util.h"
@@ -82,9 +88,10 @@ TEST(StatsLogProcessorTest, TestRateLimitByteSize) {
     // Expect only the first flush to trigger a check for byte size since the last two are
     // rate-limited.
     EXPECT_CALL(mockMetricsManager, byteSize()).Times(1);
-    p.flushIfNecessaryLocked(key, mockMetricsManager);
-    p.flushIfNecessaryLocked(key, mockMetricsManager);
-    p.flushIfNecessaryLocked(key, mockMetricsManager);
+    const int64_t elapsedRealtimeNs = getElapsedRealtimeNs();
+    p.flushIfNecessaryLocked(key, mockMetricsManager, elapsedRealtimeNs);
+    p.flushIfNecessaryLocked(key, mockMetricsManager, elapsedRealtimeNs + 1);
+    p.flushIfNecessaryLocked(key, mockMetricsManager, elapsedRealtimeNs + 2);
 }
 
 TEST(StatsLogProcessorTest, TestRateLimitBroadcast) {
@@ -109,7 +116,7 @@ TEST(StatsLogProcessorTest, TestRateLimitBroadcast) {
                     StatsdStats::kMaxMetricsBytesPerConfig * .95)));
 
     // Expect only one broadcast despite always returning a size that should trigger broadcast.
-    p.flushIfNecessaryLocked(key, mockMetricsManager);
+    p.flushIfNecessaryLocked(key, mockMetricsManager, getElapsedRealtimeNs());
     EXPECT_EQ(1, broadcastCount);
 
     // b/73089712
@@ -142,10 +149,222 @@ TEST(StatsLogProcessorTest, TestDropWhenByteSizeTooLarge) {
     EXPECT_CALL(mockMetricsManager, dropData(_)).Times(1);
 
     // Expect to call the onDumpReport and skip the broadcast.
-    p.flushIfNecessaryLocked(key, mockMetricsManager);
+    p.flushIfNecessaryLocked(key, mockMetricsManager, getElapsedRealtimeNs());
     EXPECT_EQ(0, broadcastCount);
 }
 
+StatsdConfig MakeWakelockCountConfig() {
+    StatsdConfig config;
+    config.add_allowed_log_source("AID_ROOT");  // LogEvent defaults to UID of root.
+    auto wakelockAcquireMatcher = CreateAcquireWakelockAtomMatcher();
+    *config.add_atom_matcher() = wakelockAcquireMatcher;
+
+    auto countMetric = config.add_count_metric();
+    countMetric->set_id(123456);
+    countMetric->set_what(wakelockAcquireMatcher.id());
+    countMetric->set_bucket(ONE_MINUTE);
+    return config;
+}
+
+// Logs a wakelock in the first bucket and one in the second, so that the first is a past bucket.
+void LogWakelocksInTwoBuckets(StatsLogProcessor* processor, int64_t bucketStartTimeNs) {
+    std::vector<int> attributionUids = {111};
+    std::vector<string> attributionTags = {"App1"};
+    for (int64_t timestampNs : {bucketStartTimeNs + 1, bucketStartTimeNs + 60 * NS_PER_SEC + 1}) {
+        std::unique_ptr<LogEvent> event =
+                CreateAcquireWakelockEvent(timestampNs, attributionUids, attributionTags, "wl1");
+        processor->OnLogEvent(event.get());
+    }
+}
+
+TEST(StatsLogProcessorTest, TestSpillLargestConfigOverMemoryLimit) {
+    const int64_t bucketStartTimeNs = 10 * NS_PER_SEC;
+    StatsdConfig config = MakeWakelockCountConfig();
+    ConfigKey cfgKey(0, 12345);
+    sp<StatsLogProcessor> processor =
+            CreateStatsLogProcessor(bucketStartTimeNs, bucketStartTimeNs, config, cfgKey);
+    ConfigKey otherCfgKey(0, 67890);
+    processor->OnConfigUpdated(bucketStartTimeNs, otherCfgKey, config);
+    LogWakelocksInTwoBuckets(processor.get(), bucketStartTimeNs);
+
+    // Only the largest config needs to move to disk to get under the limit.
+    const size_t limit = StatsdStats::kMaxMetricsBytesTotal;
+    const int64_t spillTimeNs = bucketStartTimeNs + 60 * NS_PER_SEC + 2;
+    processor->mLastByteSizes[cfgKey] = limit;
+    processor->mLastByteSizes[otherCfgKey] = 1024;
+    processor->spillToMemoryLimitLocked(spillTimeNs);
+    EXPECT_EQ(1UL, processor->mOnDiskDataConfigs.count(cfgKey));
+    EXPECT_EQ(0UL, processor->mOnDiskDataConfigs.count(otherCfgKey));
+    EXPECT_LT(processor->mLastByteSizes[cfgKey], limit);
+
+    // Rate limited.
+    processor->mLastByteSizes[cfgKey] = limit;
+    processor->spillToMemoryLimitLocked(spillTimeNs + 1);
+    EXPECT_EQ(limit, processor->mLastByteSizes[cfgKey]);
+
+    // The past bucket comes from disk and the current bucket from memory.
+    vector<uint8_t> bytes;
+    processor->onDumpReport(cfgKey, spillTimeNs + 2, true /* include current bucket */,
+                            true /* erase data */, GET_DATA_CALLED, FAST, &bytes);
+    ConfigMetricsReportList output;
+    output.ParseFromArray(bytes.data(), bytes.size());
+    ASSERT_EQ(2, output.reports_size());
+    EXPECT_EQ(ConfigMetricsReport::MEMORY_PRESSURE, output.reports(0).dump_report_reason());
+    ASSERT_EQ(1, output.reports(0).metrics_size());
+    ASSERT_EQ(1, output.reports(0).metrics(0).count_metrics().data_size());
+    const CountMetricData& pastData = output.reports(0).metrics(0).count_metrics().data(0);
+    ASSERT_EQ(1, pastData.bucket_info_size());
+    EXPECT_EQ(1, pastData.bucket_info(0).count());
+    ASSERT_EQ(1, output.reports(1).metrics_size());
+    ASSERT_EQ(1, output.reports(1).metrics(0).count_metrics().data_size());
+    const CountMetricData& currentData = output.reports(1).metrics(0).count_metrics().data(0);
+    ASSERT_EQ(1, currentData.bucket_info_size());
+    EXPECT_EQ(1, currentData.bucket_info(0).count());
+}
+
+TEST(StatsLogProcessorTest, TestSpillOnMemoryPressure) {
+    const int64_t bucketStartTimeNs = 10 * NS_PER_SEC;
+    ConfigKey cfgKey(0, 12345);
+    sp<StatsLogProcessor> processor = CreateStatsLogProcessor(
+            bucketStartTimeNs, bucketStartTimeNs, MakeWakelockCountConfig(), cfgKey);
+    LogWakelocksInTwoBuckets(processor.get(), bucketStartTimeNs);
+
+    // The config is below the lower limit.
+    const int64_t pressureTimeNs = bucketStartTimeNs + 60 * NS_PER_SEC + 2;
+    processor->onMemoryPressure(pressureTimeNs);
+    EXPECT_EQ(0UL, processor->mOnDiskDataConfigs.count(cfgKey));
+    EXPECT_GT(processor->mLastByteSizes[cfgKey], 0UL);
+
+    // The lower limit only applies for a while.
+    processor->mLastByteSizes[cfgKey] = StatsdStats::kMaxMetricsBytesTotalUnderMemoryPressure + 1;
+    processor->spillToMemoryLimitLocked(pressureTimeNs + StatsdStats::kMemoryPressurePeriodNs);
+    EXPECT_EQ(0UL, processor->mOnDiskDataConfigs.count(cfgKey));
+    processor->spillToMemoryLimitLocked(pressureTimeNs + 1);
+    EXPECT_EQ(1UL, processor->mOnDiskDataConfigs.count(cfgKey));
+    // The report is written once mMetricsMutex is released.
+    ASSERT_EQ(1UL, processor->mSpilledReports.size());
+    EXPECT_FALSE(StorageManager::hasConfigMetricsReport(cfgKey));
+    processor->writeSpilledReports();
+    EXPECT_TRUE(processor->mSpilledReports.empty());
+    EXPECT_TRUE(StorageManager::hasConfigMetricsReport(cfgKey));
+
+    // Removes the report from disk.
+    vector<uint8_t> bytes;
+    processor->onDumpReport(cfgKey, pressureTimeNs + 2, true /* include current bucket */,
+                            true /* erase data */, GET_DATA_CALLED, FAST, &bytes);
+    ConfigMetricsReportList output;
+    output.ParseFromArray(bytes.data(), bytes.size());
+    ASSERT_EQ(2, output.reports_size());
+    EXPECT_EQ(ConfigMetricsReport::MEMORY_PRESSURE, output.reports(0).dump_report_reason());
+}
+
+TEST(StatsLogProcessorTest, TestCheckpointAppendsCompletedBuckets) {
+    const int64_t bucketStartTimeNs = 10 * NS_PER_SEC;
+    const int64_t periodNs = 60 * NS_PER_SEC;
+    ConfigKey cfgKey(0, 12345);
+    sp<StatsLogProcessor> processor = CreateStatsLogProcessor(
+            bucketStartTimeNs, bucketStartTimeNs, MakeWakelockCountConfig(), cfgKey);
+    processor->setCheckpointPeriodNs(periodNs);
+    LogWakelocksInTwoBuckets(processor.get(), bucketStartTimeNs);
+    // The events were flushed with the real clock.
+    processor->mLastCheckpointTimes.clear();
+    MetricsManager& metricsManager = *processor->mMetricsManagers[cfgKey];
+
+    // Starts the period.
+    const int64_t checkpointTimeNs = bucketStartTimeNs + 60 * NS_PER_SEC + 2;
+    processor->mLastByteSizes[cfgKey] = metricsManager.byteSize();
+    processor->checkpointIfNecessaryLocked(cfgKey, metricsManager, checkpointTimeNs - periodNs);
+    processor->checkpointIfNecessaryLocked(cfgKey, metricsManager, checkpointTimeNs - 1);
+    EXPECT_GT(processor->mLastByteSizes[cfgKey], 0UL);
+    EXPECT_FALSE(StorageManager::hasConfigMetricsReport(cfgKey));
+
+    processor->checkpointIfNecessaryLocked(cfgKey, metricsManager, checkpointTimeNs);
+    EXPECT_EQ(0UL, processor->mLastByteSizes[cfgKey]);
+    EXPECT_TRUE(StorageManager::hasConfigMetricsReport(cfgKey));
+
+    // The second bucket is completed by the third and appended to the same log.
+    std::unique_ptr<LogEvent> event = CreateAcquireWakelockEvent(
+            bucketStartTimeNs + 120 * NS_PER_SEC + 1, {111}, {"App1"}, "wl1");
+    processor->OnLogEvent(event.get());
+    processor->mLastByteSizes[cfgKey] = metricsManager.byteSize();
+    processor->checkpointIfNecessaryLocked(cfgKey, metricsManager, checkpointTimeNs + periodNs);
+
+    vector<uint8_t> bytes;
+    processor->onDumpReport(cfgKey, checkpointTimeNs + periodNs + 1,
+                            true /* include current bucket */, true /* erase data */,
+                            GET_DATA_CALLED, FAST, &bytes);
+    ConfigMetricsReportList output;
+    output.ParseFromArray(bytes.data(), bytes.size());
+    ASSERT_EQ(3, output.reports_size());
+    for (int i = 0; i < 2; i++) {
+        EXPECT_EQ(ConfigMetricsReport::CHECKPOINT, output.reports(i).dump_report_reason());
+        ASSERT_EQ(1, output.reports(i).metrics_size());
+        ASSERT_EQ(1, output.reports(i).metrics(0).count_metrics().data_size());
+        const CountMetricData& data = output.reports(i).metrics(0).count_metrics().data(0);
+        ASSERT_EQ(1, data.bucket_info_size());
+        EXPECT_EQ(1, data.bucket_info(0).count());
+    }
+    EXPECT_EQ(ConfigMetricsReport::GET_DATA_CALLED, output.reports(2).dump_report_reason());
+    EXPECT_FALSE(StorageManager::hasConfigMetricsReport(cfgKey));
+
+    // The second checkpoint shares the uid map snapshot of the first one in the log.
+    EXPECT_EQ(1, output.reports(0).uid_map().snapshots_size());
+    EXPECT_EQ(0, output.reports(1).uid_map().snapshots_size());
+    EXPECT_EQ(1, output.reports(2).uid_map().snapshots_size());
+    EXPECT_EQ(0UL, processor->mCheckpointLogBytes.count(cfgKey));
+}
+
+TEST(StatsLogProcessorTest, TestReportStreamSendsCompletedBuckets) {
+    const int64_t bucketStartTimeNs = 10 * NS_PER_SEC;
+    ConfigKey cfgKey(0, 12345);
+    sp<StatsLogProcessor> processor = CreateStatsLogProcessor(
+            bucketStartTimeNs, bucketStartTimeNs, MakeWakelockCountConfig(), cfgKey);
+    LogWakelocksInTwoBuckets(processor.get(), bucketStartTimeNs);
+    vector<uint8_t> streamed;
+    int reports = 0;
+    processor->setReportStream(cfgKey, [&](const vector<uint8_t>& chunk, bool last) {
+        streamed.insert(streamed.end(), chunk.begin(), chunk.end());
+        reports += last;
+        return true;
+    });
+    MetricsManager& metricsManager = *processor->mMetricsManagers[cfgKey];
+
+    const int64_t streamTimeNs = bucketStartTimeNs + 60 * NS_PER_SEC + 2;
+    processor->mLastByteSizes[cfgKey] = metricsManager.byteSize();
+    EXPECT_TRUE(processor->streamReportIfNecessaryLocked(cfgKey, metricsManager, streamTimeNs));
+    EXPECT_EQ(0UL, processor->mLastByteSizes[cfgKey]);
+    // Sent once mMetricsMutex is released.
+    EXPECT_EQ(0, reports);
+    processor->sendStreamedReports();
+    ASSERT_EQ(1, reports);
+    EXPECT_TRUE(processor->mPendingStreamedReports.empty());
+    ConfigMetricsReport report;
+    ASSERT_TRUE(report.ParseFromArray(streamed.data(), streamed.size()));
+    EXPECT_EQ(ConfigMetricsReport::REPORT_STREAMED, report.dump_report_reason());
+    ASSERT_EQ(1, report.metrics_size());
+    ASSERT_EQ(1, report.metrics(0).count_metrics().data_size());
+    const CountMetricData& data = report.metrics(0).count_metrics().data(0);
+    ASSERT_EQ(1, data.bucket_info_size());
+    EXPECT_EQ(1, data.bucket_info(0).count());
+
+    // Nothing is streamed until the next bucket completes.
+    EXPECT_FALSE(processor->streamReportIfNecessaryLocked(cfgKey, metricsManager, streamTimeNs));
+
+    // A failed stream is removed.
+    processor->removeReportStream(cfgKey);
+    std::unique_ptr<LogEvent> event = CreateAcquireWakelockEvent(
+            bucketStartTimeNs + 120 * NS_PER_SEC + 1, {111}, {"App1"}, "wl1");
+    processor->OnLogEvent(event.get());
+    processor->setReportStream(cfgKey, [](const vector<uint8_t>& chunk, bool last) {
+        return false;
+    });
+    processor->mLastByteSizes[cfgKey] = metricsManager.byteSize();
+    EXPECT_TRUE(processor->streamReportIfNecessaryLocked(cfgKey, metricsManager,
+                                                         streamTimeNs + 60 * NS_PER_SEC));
+    processor->sendStreamedReports();
+    EXPECT_TRUE(processor->mReportStreams.empty());
+}
+
 StatsdConfig MakeConfig(bool includeMetric) {
     StatsdConfig config;
     config.add_allowed_log_source("AID_ROOT");  // LogEvent defaults to UID of root.
@@ -305,6 +524,466 @@ TEST(StatsLogProcessorTest, TestOnDumpReportEraseData) {
     EXPECT_TRUE(noData);
 }
 
+TEST(StatsLogProcessorTest, TestOnDumpReportPersistsLocalHistory) {
+    StatsdConfig config = MakeWakelockCountConfig();
+    config.set_persist_locally(true);
+    ConfigKey cfgKey(0, 24680);
+    sp<StatsLogProcessor> processor = CreateStatsLogProcessor(1, 1, config, cfgKey);
+
+    std::vector<int> attributionUids = {111};
+    std::vector<string> attributionTags = {"App1"};
+    std::unique_ptr<LogEvent> event =
+            CreateAcquireWakelockEvent(2 /*timestamp*/, attributionUids, attributionTags, "wl1");
+    processor->OnLogEvent(event.get());
+
+    vector<uint8_t> bytes;
+    ConfigMetricsReportList output;
+    processor->onDumpReport(cfgKey, 3, true, true /* DO erase data. */, GET_DATA_CALLED, FAST,
+                            &bytes);
+    output.ParseFromArray(bytes.data(), bytes.size());
+    ASSERT_EQ(1, output.reports_size());
+    ASSERT_EQ(1, output.reports(0).metrics(0).count_metrics().data_size());
+
+    // The erased data was saved as history, which only adb dumps include.
+    processor->onDumpReport(cfgKey, 4, true, false /* Do NOT erase data. */, ADB_DUMP, FAST,
+                            &bytes);
+    output.ParseFromArray(bytes.data(), bytes.size());
+    ASSERT_EQ(2, output.reports_size());
+    ASSERT_EQ(1, output.reports(0).metrics(0).count_metrics().data_size());
+    EXPECT_EQ(ConfigMetricsReport::GET_DATA_CALLED, output.reports(0).dump_report_reason());
+
+    string suffix = StringPrintf("%d_%lld_history", cfgKey.GetUid(), (long long)cfgKey.GetId());
+    StorageManager::deleteSuffixedFiles(STATS_DATA_DIR, suffix.c_str());
+}
+
+TEST(StatsLogProcessorTest, TestOnDumpReportToFd) {
+    ConfigKey cfgKey(0, 13579);
+    sp<StatsLogProcessor> processor =
+            CreateStatsLogProcessor(1, 1, MakeWakelockCountConfig(), cfgKey);
+
+    std::vector<int> attributionUids = {111};
+    std::vector<string> attributionTags = {"App1"};
+    std::unique_ptr<LogEvent> event =
+            CreateAcquireWakelockEvent(2 /*timestamp*/, attributionUids, attributionTags, "wl1");
+    processor->OnLogEvent(event.get());
+    processor->WriteDataToDisk(DEVICE_SHUTDOWN, FAST, 3, getWallClockNs());
+    event = CreateAcquireWakelockEvent(4 /*timestamp*/, attributionUids, attributionTags, "wl1");
+    processor->OnLogEvent(event.get());
+
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    processor->onDumpReport(cfgKey, 5, getWallClockNs(), true /* include current bucket */,
+                            true /* erase data */, GET_DATA_CALLED, FAST, fds[1]);
+    close(fds[1]);
+    string bytes;
+    ASSERT_TRUE(android::base::ReadFdToString(fds[0], &bytes));
+    close(fds[0]);
+
+    // The report on disk comes first.
+    ConfigMetricsReportList output;
+    ASSERT_TRUE(output.ParseFromString(bytes));
+    EXPECT_EQ(cfgKey.GetUid(), output.config_key().uid());
+    EXPECT_EQ(cfgKey.GetId(), output.config_key().id());
+    ASSERT_EQ(2, output.reports_size());
+    EXPECT_EQ(ConfigMetricsReport::DEVICE_SHUTDOWN, output.reports(0).dump_report_reason());
+    EXPECT_EQ(ConfigMetricsReport::GET_DATA_CALLED, output.reports(1).dump_report_reason());
+    for (const ConfigMetricsReport& report : output.reports()) {
+        ASSERT_EQ(1, report.metrics_size());
+        ASSERT_EQ(1, report.metrics(0).count_metrics().data_size());
+    }
+
+    // The report on disk was erased.
+    EXPECT_FALSE(StorageManager::hasConfigMetricsReport(cfgKey));
+}
+
+TEST(StatsLogProcessorTest, TestOnDumpReportToFdFailure) {
+    ConfigKey cfgKey(0, 13580);
+    sp<StatsLogProcessor> processor =
+            CreateStatsLogProcessor(1, 1, MakeWakelockCountConfig(), cfgKey);
+
+    std::vector<int> attributionUids = {111};
+    std::vector<string> attributionTags = {"App1"};
+    std::unique_ptr<LogEvent> event =
+            CreateAcquireWakelockEvent(2 /*timestamp*/, attributionUids, attributionTags, "wl1");
+    processor->OnLogEvent(event.get());
+
+    // The report can't be written to a read only fd, so it is kept on disk.
+    android::base::unique_fd readOnlyFd(open("/dev/null", O_RDONLY | O_CLOEXEC));
+    ASSERT_NE(-1, readOnlyFd);
+    EXPECT_FALSE(processor->onDumpReport(cfgKey, 3, getWallClockNs(),
+                                         true /* include current bucket */, true /* erase data */,
+                                         GET_DATA_CALLED, FAST, readOnlyFd));
+    StorageManager::flushWrites();
+    EXPECT_TRUE(StorageManager::hasConfigMetricsReport(cfgKey));
+
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    EXPECT_TRUE(processor->onDumpReport(cfgKey, 4, getWallClockNs(),
+                                        true /* include current bucket */, true /* erase data */,
+                                        GET_DATA_CALLED, FAST, fds[1]));
+    close(fds[1]);
+    string bytes;
+    ASSERT_TRUE(android::base::ReadFdToString(fds[0], &bytes));
+    close(fds[0]);
+
+    ConfigMetricsReportList output;
+    ASSERT_TRUE(output.ParseFromString(bytes));
+    ASSERT_EQ(2, output.reports_size());
+    ASSERT_EQ(1, output.reports(0).metrics_size());
+    EXPECT_EQ(1, output.reports(0).metrics(0).count_metrics().data_size());
+    EXPECT_FALSE(StorageManager::hasConfigMetricsReport(cfgKey));
+}
+
+TEST(StatsLogProcessorTest, TestReportProtoReused) {
+    ConfigKey cfgKey(0, 97531);
+    sp<StatsLogProcessor> processor =
+            CreateStatsLogProcessor(1, 1, MakeWakelockCountConfig(), cfgKey);
+
+    std::vector<int> attributionUids = {111};
+    std::vector<string> attributionTags = {"App1"};
+    std::unique_ptr<LogEvent> event =
+            CreateAcquireWakelockEvent(2 /*timestamp*/, attributionUids, attributionTags, "wl1");
+    processor->OnLogEvent(event.get());
+
+    vector<uint8_t> bytes;
+    ConfigMetricsReportList output;
+    processor->onDumpReport(cfgKey, 3, true, false /* Do NOT erase data. */, ADB_DUMP, FAST,
+                            &bytes);
+    ASSERT_TRUE(output.ParseFromArray(bytes.data(), bytes.size()));
+    ASSERT_EQ(1, output.reports_size());
+    ASSERT_NE(nullptr, processor->mReportProto);
+    EXPECT_EQ(0u, processor->mReportProto->size());
+
+    // The reused stream holds nothing of the first report.
+    processor->onDumpReport(cfgKey, 4, true, false /* Do NOT erase data. */, ADB_DUMP, FAST,
+                            &bytes);
+    ASSERT_TRUE(output.ParseFromArray(bytes.data(), bytes.size()));
+    ASSERT_EQ(1, output.reports_size());
+    ASSERT_EQ(1, output.reports(0).metrics_size());
+    ASSERT_EQ(1, output.reports(0).metrics(0).count_metrics().data_size());
+    // Neither dump erased the data, so the last report time is still the config creation.
+    EXPECT_EQ(1, output.reports(0).last_report_elapsed_nanos());
+    EXPECT_EQ(4, output.reports(0).current_report_elapsed_nanos());
+}
+
+TEST(StatsLogProcessorTest, TestOnLogEventsBatch) {
+    // Setup a simple config.
+    StatsdConfig config;
+    config.add_allowed_log_source("AID_ROOT");  // LogEvent defaults to UID of root.
+    auto wakelockAcquireMatcher = CreateAcquireWakelockAtomMatcher();
+    *config.add_atom_matcher() = wakelockAcquireMatcher;
+
+    auto countMetric = config.add_count_metric();
+    countMetric->set_id(123456);
+    countMetric->set_what(wakelockAcquireMatcher.id());
+    countMetric->set_bucket(FIVE_MINUTES);
+
+    ConfigKey cfgKey;
+    sp<StatsLogProcessor> processor = CreateStatsLogProcessor(1, 1, config, cfgKey);
+
+    std::vector<int> attributionUids = {111};
+    std::vector<string> attributionTags = {"App1"};
+    std::vector<std::unique_ptr<LogEvent>> events;
+    events.push_back(
+            CreateAcquireWakelockEvent(2 /*timestamp*/, attributionUids, attributionTags, "wl1"));
+    events.push_back(
+            CreateAcquireWakelockEvent(3 /*timestamp*/, attributionUids, attributionTags, "wl1"));
+    // Invalid events in the batch are dropped without affecting the others.
+    std::unique_ptr<LogEvent> invalidEvent = std::make_unique<LogEvent>(/*uid=*/0, /*pid=*/0);
+    uint8_t garbage[] = {0x1, 0x2, 0x3};
+    invalidEvent->parseBuffer(garbage, sizeof(garbage));
+    ASSERT_FALSE(invalidEvent->isValid());
+    events.push_back(std::move(invalidEvent));
+    events.push_back(
+            CreateAcquireWakelockEvent(4 /*timestamp*/, attributionUids, attributionTags, "wl1"));
+    processor->OnLogEvents(events);
+
+    vector<uint8_t> bytes;
+    ConfigMetricsReportList output;
+    processor->onDumpReport(cfgKey, 5, true, true /* DO erase data. */, ADB_DUMP, FAST, &bytes);
+    output.ParseFromArray(bytes.data(), bytes.size());
+    ASSERT_EQ(output.reports_size(), 1);
+    ASSERT_EQ(output.reports(0).metrics_size(), 1);
+    ASSERT_EQ(output.reports(0).metrics(0).count_metrics().data_size(), 1);
+    const auto& data = output.reports(0).metrics(0).count_metrics().data(0);
+    ASSERT_EQ(data.bucket_info_size(), 1);
+    EXPECT_EQ(data.bucket_info(0).count(), 3);
+}
+
+TEST(StatsLogProcessorTest, TestOnLogEventsParallelDispatch) {
+    // Count wakelocks, sliced by screen state, so that state changes split the batch.
+    StatsdConfig config;
+    config.add_allowed_log_source("AID_ROOT");  // LogEvent defaults to UID of root.
+    auto wakelockAcquireMatcher = CreateAcquireWakelockAtomMatcher();
+    *config.add_atom_matcher() = wakelockAcquireMatcher;
+    auto state = CreateScreenState();
+    *config.add_state() = state;
+
+    auto countMetric = config.add_count_metric();
+    countMetric->set_id(123456);
+    countMetric->set_what(wakelockAcquireMatcher.id());
+    countMetric->set_bucket(FIVE_MINUTES);
+    countMetric->add_slice_by_state(state.id());
+
+    const int64_t bucketStartTimeNs = 10 * NS_PER_SEC;
+    ConfigKey cfgKey1(1000, 1);
+    ConfigKey cfgKey2(1000, 2);
+    ConfigKey cfgKey3(1000, 3);
+    sp<StatsLogProcessor> processor =
+            CreateStatsLogProcessor(bucketStartTimeNs, bucketStartTimeNs, config, cfgKey1);
+    processor->OnConfigUpdated(bucketStartTimeNs, cfgKey2, config);
+    processor->OnConfigUpdated(bucketStartTimeNs, cfgKey3, config);
+    processor->setParallelDispatchThreads(2);
+    ASSERT_EQ(3u, processor->mMetricsManagers.size());
+
+    std::vector<int> attributionUids = {111};
+    std::vector<string> attributionTags = {"App1"};
+    std::vector<std::unique_ptr<LogEvent>> events;
+    events.push_back(CreateAcquireWakelockEvent(bucketStartTimeNs + 1 * NS_PER_SEC,
+                                                attributionUids, attributionTags, "wl1"));
+    events.push_back(CreateScreenStateChangedEvent(
+            bucketStartTimeNs + 2 * NS_PER_SEC, android::view::DisplayStateEnum::DISPLAY_STATE_ON));
+    events.push_back(CreateAcquireWakelockEvent(bucketStartTimeNs + 3 * NS_PER_SEC,
+                                                attributionUids, attributionTags, "wl1"));
+    events.push_back(CreateAcquireWakelockEvent(bucketStartTimeNs + 4 * NS_PER_SEC,
+                                                attributionUids, attributionTags, "wl1"));
+    events.push_back(CreateScreenStateChangedEvent(
+            bucketStartTimeNs + 5 * NS_PER_SEC,
+            android::view::DisplayStateEnum::DISPLAY_STATE_OFF));
+    events.push_back(CreateAcquireWakelockEvent(bucketStartTimeNs + 6 * NS_PER_SEC,
+                                                attributionUids, attributionTags, "wl1"));
+    processor->OnLogEvents(events);
+
+    // Every config sees each wakelock with the screen state at the time it was logged.
+    for (const ConfigKey& key : {cfgKey1, cfgKey2, cfgKey3}) {
+        vector<uint8_t> bytes;
+        ConfigMetricsReportList output;
+        processor->onDumpReport(key, bucketStartTimeNs + 10 * NS_PER_SEC, true,
+                                true /* DO erase data. */, ADB_DUMP, FAST, &bytes);
+        output.ParseFromArray(bytes.data(), bytes.size());
+        ASSERT_EQ(output.reports_size(), 1);
+        ASSERT_EQ(output.reports(0).metrics_size(), 1);
+        std::map<int32_t, int64_t> countsPerState;
+        for (const auto& data : output.reports(0).metrics(0).count_metrics().data()) {
+            ASSERT_EQ(1, data.slice_by_state_size());
+            ASSERT_EQ(1, data.bucket_info_size());
+            countsPerState[data.slice_by_state(0).value()] += data.bucket_info(0).count();
+        }
+        EXPECT_THAT(countsPerState,
+                    UnorderedElementsAre(
+                            Pair(-1 /* StateTracker::kStateUnknown */, 1),
+                            Pair(android::view::DisplayStateEnum::DISPLAY_STATE_ON, 2),
+                            Pair(android::view::DisplayStateEnum::DISPLAY_STATE_OFF, 1)));
+    }
+}
+
+TEST(StatsLogProcessorTest, TestParallelDump) {
+    StatsdConfig config;
+    config.add_allowed_log_source("AID_ROOT");  // LogEvent defaults to UID of root.
+    config.set_hash_strings_in_metric_report(true);
+    auto wakelockAcquireMatcher = CreateAcquireWakelockAtomMatcher();
+    *config.add_atom_matcher() = wakelockAcquireMatcher;
+    for (int64_t metricId : {1, 2, 3, 4}) {
+        auto countMetric = config.add_count_metric();
+        countMetric->set_id(metricId);
+        countMetric->set_what(wakelockAcquireMatcher.id());
+        countMetric->set_bucket(FIVE_MINUTES);
+        // Sliced by the wakelock tag, whose strings are hashed.
+        countMetric->mutable_dimensions_in_what()->set_field(util::WAKELOCK_STATE_CHANGED);
+        countMetric->mutable_dimensions_in_what()->add_child()->set_field(3);
+    }
+    config.add_no_report_metric(3);
+
+    const int64_t bucketStartTimeNs = 10 * NS_PER_SEC;
+    ConfigKey serialKey(1000, 1);
+    ConfigKey parallelKey(1000, 2);
+    sp<StatsLogProcessor> processor =
+            CreateStatsLogProcessor(bucketStartTimeNs, bucketStartTimeNs, config, serialKey);
+    processor->OnConfigUpdated(bucketStartTimeNs, parallelKey, config);
+
+    std::vector<int> attributionUids = {111};
+    std::vector<string> attributionTags = {"App1"};
+    for (const string& wakelockName : {"wl1", "wl2", "wl1"}) {
+        processor->OnLogEvent(CreateAcquireWakelockEvent(bucketStartTimeNs + NS_PER_SEC,
+                                                         attributionUids, attributionTags,
+                                                         wakelockName)
+                                      .get());
+    }
+
+    ConfigMetricsReportList serialReports;
+    vector<uint8_t> bytes;
+    processor->onDumpReport(serialKey, bucketStartTimeNs + 10 * NS_PER_SEC, true,
+                            true /* DO erase data. */, ADB_DUMP, FAST, &bytes);
+    serialReports.ParseFromArray(bytes.data(), bytes.size());
+
+    processor->setParallelDumpThreads(2);
+    ConfigMetricsReportList parallelReports;
+    processor->onDumpReport(parallelKey, bucketStartTimeNs + 10 * NS_PER_SEC, true,
+                            true /* DO erase data. */, ADB_DUMP, FAST, &bytes);
+    parallelReports.ParseFromArray(bytes.data(), bytes.size());
+
+    // The metric reports are in metric order, and the strings of all of them are listed.
+    ASSERT_EQ(1, serialReports.reports_size());
+    ASSERT_EQ(1, parallelReports.reports_size());
+    const ConfigMetricsReport& serialReport = serialReports.reports(0);
+    const ConfigMetricsReport& parallelReport = parallelReports.reports(0);
+    ASSERT_EQ(3, parallelReport.metrics_size());
+    ASSERT_EQ(serialReport.metrics_size(), parallelReport.metrics_size());
+    for (int i = 0; i < parallelReport.metrics_size(); i++) {
+        EXPECT_EQ(serialReport.metrics(i).SerializeAsString(),
+                  parallelReport.metrics(i).SerializeAsString());
+    }
+    EXPECT_EQ(4, parallelReport.metrics(2).metric_id());
+    ASSERT_EQ(2, parallelReport.strings_size());
+    EXPECT_THAT(parallelReport.strings(), UnorderedElementsAreArray(serialReport.strings()));
+}
+
+TEST(StatsLogProcessorTest, TestLogEventFilter) {
+    StatsdConfig config;
+    config.add_allowed_log_source("AID_ROOT");  // LogEvent defaults to UID of root.
+    auto wakelockAcquireMatcher = CreateAcquireWakelockAtomMatcher();
+    *config.add_atom_matcher() = wakelockAcquireMatcher;
+    auto state = CreateScreenState();
+    *config.add_state() = state;
+
+    auto countMetric = config.add_count_metric();
+    countMetric->set_id(123456);
+    countMetric->set_what(wakelockAcquireMatcher.id());
+    countMetric->set_bucket(FIVE_MINUTES);
+    countMetric->add_slice_by_state(state.id());
+
+    const int64_t bucketStartTimeNs = 10 * NS_PER_SEC;
+    ConfigKey cfgKey(1000, 1);
+    sp<StatsLogProcessor> processor =
+            CreateStatsLogProcessor(bucketStartTimeNs, bucketStartTimeNs, config, cfgKey);
+    auto filter = std::make_shared<LogEventFilter>();
+    processor->setLogEventFilter(filter);
+
+    // Atoms used by the config, its state trackers, and the hard-coded handling.
+    EXPECT_TRUE(filter->isAtomInUse(util::WAKELOCK_STATE_CHANGED));
+    EXPECT_TRUE(filter->isAtomInUse(util::SCREEN_STATE_CHANGED));
+    EXPECT_TRUE(filter->isAtomInUse(util::ISOLATED_UID_CHANGED));
+    EXPECT_TRUE(filter->isAtomInUse(util::BINARY_PUSH_STATE_CHANGED));
+    EXPECT_FALSE(filter->isAtomInUse(util::BATTERY_LEVEL_CHANGED));
+
+    processor->setPrintLogs(true);
+    EXPECT_TRUE(filter->isAtomInUse(util::BATTERY_LEVEL_CHANGED));
+    processor->setPrintLogs(false);
+    EXPECT_FALSE(filter->isAtomInUse(util::BATTERY_LEVEL_CHANGED));
+
+    // Atoms of other consumers are kept.
+    filter->setAtomIds({util::WAKELOCK_STATE_CHANGED, util::BATTERY_LEVEL_CHANGED}, this);
+    processor->OnConfigRemoved(cfgKey);
+    EXPECT_TRUE(filter->isAtomInUse(util::WAKELOCK_STATE_CHANGED));
+    EXPECT_TRUE(filter->isAtomInUse(util::BATTERY_LEVEL_CHANGED));
+    EXPECT_FALSE(filter->isAtomInUse(util::SCREEN_STATE_CHANGED));
+    EXPECT_TRUE(filter->isAtomInUse(util::ISOLATED_UID_CHANGED));
+}
+
+TEST(StatsLogProcessorTest, TestEventsRoutedByAtom) {
+    // Counts the wakelocks for 100 seconds after each one.
+    StatsdConfig wakelockConfig;
+    wakelockConfig.add_allowed_log_source("AID_ROOT");  // LogEvent defaults to UID of root.
+    auto wakelockAcquireMatcher = CreateAcquireWakelockAtomMatcher();
+    *wakelockConfig.add_atom_matcher() = wakelockAcquireMatcher;
+    auto countMetric = wakelockConfig.add_count_metric();
+    countMetric->set_id(123456);
+    countMetric->set_what(wakelockAcquireMatcher.id());
+    countMetric->set_bucket(FIVE_MINUTES);
+    auto activation = wakelockConfig.add_metric_activation();
+    activation->set_metric_id(countMetric->id());
+    activation->set_activation_type(ACTIVATE_IMMEDIATELY);
+    auto activationTrigger = activation->add_event_activation();
+    activationTrigger->set_atom_matcher_id(wakelockAcquireMatcher.id());
+    activationTrigger->set_ttl_seconds(100);
+
+    // Counts the screen turning on.
+    StatsdConfig screenConfig;
+    screenConfig.add_allowed_log_source("AID_ROOT");
+    auto screenOnMatcher = CreateScreenTurnedOnAtomMatcher();
+    *screenConfig.add_atom_matcher() = screenOnMatcher;
+    auto screenOnMetric = screenConfig.add_count_metric();
+    screenOnMetric->set_id(654321);
+    screenOnMetric->set_what(screenOnMatcher.id());
+    screenOnMetric->set_bucket(FIVE_MINUTES);
+
+    ConfigKey wakelockKey(1, 12341);
+    ConfigKey screenKey(2, 12342);
+    sp<StatsLogProcessor> processor =
+            CreateStatsLogProcessor(/*timeBaseNs=*/1, /*currentTimeNs=*/1, wakelockConfig,
+                                    wakelockKey);
+    processor->OnConfigUpdated(1, screenKey, screenConfig);
+
+    ASSERT_EQ(1, processor->mMetricsManagersByAtomId[util::WAKELOCK_STATE_CHANGED].size());
+    EXPECT_EQ(wakelockKey,
+              processor->mMetricsManagersByAtomId[util::WAKELOCK_STATE_CHANGED][0].first);
+    ASSERT_EQ(1, processor->mMetricsManagersByAtomId[util::SCREEN_STATE_CHANGED].size());
+    EXPECT_EQ(screenKey, processor->mMetricsManagersByAtomId[util::SCREEN_STATE_CHANGED][0].first);
+    const sp<MetricsManager>& wakelockManager = processor->mMetricsManagers[wakelockKey];
+
+    std::vector<int> attributionUids = {111};
+    std::vector<string> attributionTags = {"App1"};
+    std::unique_ptr<LogEvent> event = CreateAcquireWakelockEvent(
+            10 * NS_PER_SEC, attributionUids, attributionTags, "wl1");
+    processor->OnLogEvent(event.get());
+    EXPECT_TRUE(wakelockManager->isActive());
+
+    // The activation expires at the next event, even if the config doesn't use its atom.
+    event = CreateScreenStateChangedEvent(50 * NS_PER_SEC, android::view::DISPLAY_STATE_ON);
+    processor->OnLogEvent(event.get());
+    EXPECT_TRUE(wakelockManager->isActive());
+    event = CreateScreenStateChangedEvent(200 * NS_PER_SEC, android::view::DISPLAY_STATE_OFF);
+    processor->OnLogEvent(event.get());
+    EXPECT_FALSE(wakelockManager->isActive());
+
+    processor->OnConfigRemoved(screenKey);
+    EXPECT_EQ(processor->mMetricsManagersByAtomId.end(),
+              processor->mMetricsManagersByAtomId.find(util::SCREEN_STATE_CHANGED));
+}
+
+TEST(StatsLogProcessorTest, TestReadOnlyQueriesUseConfigSummaries) {
+    StatsdConfig config;
+    config.add_allowed_log_source("AID_ROOT");  // LogEvent defaults to UID of root.
+    auto wakelockAcquireMatcher = CreateAcquireWakelockAtomMatcher();
+    *config.add_atom_matcher() = wakelockAcquireMatcher;
+    auto countMetric = config.add_count_metric();
+    countMetric->set_id(123456);
+    countMetric->set_what(wakelockAcquireMatcher.id());
+    countMetric->set_bucket(FIVE_MINUTES);
+    auto activation = config.add_metric_activation();
+    activation->set_metric_id(countMetric->id());
+    activation->set_activation_type(ACTIVATE_IMMEDIATELY);
+    auto activationTrigger = activation->add_event_activation();
+    activationTrigger->set_atom_matcher_id(wakelockAcquireMatcher.id());
+    activationTrigger->set_ttl_seconds(100);
+
+    ConfigKey key(1, 12341);
+    sp<StatsLogProcessor> processor =
+            CreateStatsLogProcessor(/*timeBaseNs=*/1, /*currentTimeNs=*/1, config, key);
+    vector<int64_t> activeConfigs;
+    processor->GetActiveConfigs(key.GetUid(), activeConfigs);
+    EXPECT_THAT(activeConfigs, IsEmpty());
+    EXPECT_EQ(1, processor->getLastReportTimeNs(key));
+    EXPECT_EQ(0, processor->getLastReportTimeNs(ConfigKey(2, 12342)));
+
+    // The summaries are published once the events are processed.
+    std::unique_ptr<LogEvent> event =
+            CreateAcquireWakelockEvent(10 * NS_PER_SEC, {111}, {"App1"}, "wl1");
+    processor->OnLogEvent(event.get());
+    processor->GetActiveConfigs(key.GetUid(), activeConfigs);
+    EXPECT_THAT(activeConfigs, ElementsAre(key.GetId()));
+
+    vector<uint8_t> bytes;
+    processor->onDumpReport(key, 20 * NS_PER_SEC, true /* include current bucket */,
+                            true /* erase data */, GET_DATA_CALLED, FAST, &bytes);
+    EXPECT_EQ(20 * NS_PER_SEC, processor->getLastReportTimeNs(key));
+
+    processor->OnConfigRemoved(key);
+    processor->GetActiveConfigs(key.GetUid(), activeConfigs);
+    EXPECT_THAT(activeConfigs, IsEmpty());
+    EXPECT_EQ(0, processor->getLastReportTimeNs(key));
+}
+
 TEST(StatsLogProcessorTest, TestPullUidProviderSetOnConfigUpdate) {
     // Setup simple config key corresponding to empty config.
     sp<UidMap> m = new UidMap();
@@ -328,6 +1007,110 @@ TEST(StatsLogProcessorTest, TestPullUidProviderSetOnConfigUpdate) {
     EXPECT_EQ(pullerManager->mPullUidProviders.find(key), pullerManager->mPullUidProviders.end());
 }
 
+TEST(StatsLogProcessorTest, TestOnConfigsLoadedInParallel) {
+    sp<UidMap> m = new UidMap();
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> subscriberAlarmMonitor;
+    StatsLogProcessor p(
+            m, pullerManager, anomalyAlarmMonitor, subscriberAlarmMonitor, 0,
+            [](const ConfigKey& key) { return true; },
+            [](const int&, const vector<int64_t>&) { return true; });
+    p.setParallelConfigLoadThreads(2);
+
+    ConfigKey existingKey(3, 1);
+    p.OnConfigUpdated(0, existingKey, MakeConfig(true));
+    StatsdConfig invalidConfig = MakeConfig(true);
+    invalidConfig.clear_allowed_log_source();
+    std::vector<std::pair<ConfigKey, StatsdConfig>> configs = {
+            {existingKey, MakeConfig(false)},
+            {ConfigKey(3, 2), MakeConfig(true)},
+            {ConfigKey(3, 3), invalidConfig},
+            {ConfigKey(3, 4), MakeConfig(false)},
+    };
+    p.OnConfigsLoaded(5, configs);
+
+    // The existing config is updated, the invalid one is dropped.
+    ASSERT_EQ(3u, p.mMetricsManagers.size());
+    for (int64_t id : {1, 2, 4}) {
+        const auto it = p.mMetricsManagers.find(ConfigKey(3, id));
+        ASSERT_NE(p.mMetricsManagers.end(), it);
+        EXPECT_TRUE(it->second->isConfigValid());
+    }
+}
+
+TEST(StatsLogProcessorTest, TestSlicedStateConfigsBuiltWhileProcessing) {
+    StatsdConfig config;
+    config.add_allowed_log_source("AID_ROOT");  // LogEvent defaults to UID of root.
+    auto wakelockAcquireMatcher = CreateAcquireWakelockAtomMatcher();
+    *config.add_atom_matcher() = wakelockAcquireMatcher;
+    auto state = CreateScreenState();
+    *config.add_state() = state;
+
+    auto countMetric = config.add_count_metric();
+    countMetric->set_id(123456);
+    countMetric->set_what(wakelockAcquireMatcher.id());
+    countMetric->set_bucket(FIVE_MINUTES);
+    countMetric->add_slice_by_state(state.id());
+
+    StateManager::getInstance().clear();
+    const int64_t bucketStartTimeNs = 10 * NS_PER_SEC;
+    sp<StatsLogProcessor> processor = CreateStatsLogProcessor(bucketStartTimeNs, bucketStartTimeNs,
+                                                              config, ConfigKey(1000, 0));
+
+    // A built manager only listens to the states once it is in use.
+    {
+        MetricsManager metricsManager(ConfigKey(1000, 100), config, bucketStartTimeNs,
+                                      bucketStartTimeNs, processor->mUidMap,
+                                      processor->mPullerManager, processor->mAnomalyAlarmMonitor,
+                                      processor->mPeriodicAlarmMonitor);
+        EXPECT_TRUE(metricsManager.isConfigValid());
+        EXPECT_EQ(1, StateManager::getInstance().getListenersCount(SCREEN_STATE_ATOM_ID));
+    }
+    EXPECT_EQ(1, StateManager::getInstance().getListenersCount(SCREEN_STATE_ATOM_ID));
+
+    // The configs are built on this thread while the other one changes the screen state.
+    const int configCount = 20;
+    std::thread eventThread([&] {
+        std::vector<int> attributionUids = {111};
+        std::vector<string> attributionTags = {"App1"};
+        for (int i = 0; i < 1000; i++) {
+            const int64_t eventTimeNs = bucketStartTimeNs + i * NS_PER_SEC / 1000;
+            const auto screenState = i % 2 == 0
+                                             ? android::view::DisplayStateEnum::DISPLAY_STATE_ON
+                                             : android::view::DisplayStateEnum::DISPLAY_STATE_OFF;
+            processor->OnLogEvent(CreateScreenStateChangedEvent(eventTimeNs, screenState).get());
+            processor->OnLogEvent(CreateAcquireWakelockEvent(eventTimeNs, attributionUids,
+                                                             attributionTags, "wl1")
+                                          .get());
+        }
+    });
+    for (int id = 1; id <= configCount; id++) {
+        processor->OnConfigUpdated(bucketStartTimeNs, ConfigKey(1000, id), config);
+    }
+    eventThread.join();
+
+    ASSERT_EQ(configCount + 1, processor->mMetricsManagers.size());
+    EXPECT_EQ(1, StateManager::getInstance().getStateTrackersCount());
+    EXPECT_EQ(configCount + 1, StateManager::getInstance().getListenersCount(SCREEN_STATE_ATOM_ID));
+
+    // The first config saw every wakelock.
+    vector<uint8_t> bytes;
+    ConfigMetricsReportList output;
+    processor->onDumpReport(ConfigKey(1000, 0), bucketStartTimeNs + 10 * NS_PER_SEC, true,
+                            true /* DO erase data. */, ADB_DUMP, FAST, &bytes);
+    output.ParseFromArray(bytes.data(), bytes.size());
+    ASSERT_EQ(output.reports_size(), 1);
+    ASSERT_EQ(output.reports(0).metrics_size(), 1);
+    int64_t count = 0;
+    for (const auto& data : output.reports(0).metrics(0).count_metrics().data()) {
+        for (const auto& bucket : data.bucket_info()) {
+            count += bucket.count();
+        }
+    }
+    EXPECT_EQ(1000, count);
+}
+
 TEST(StatsLogProcessorTest, InvalidConfigRemoved) {
     // Setup simple config key corresponding to empty config.
     sp<UidMap> m = new UidMap();
@@ -712,6 +1495,116 @@ TEST(StatsLogProcessorTest, TestActiveConfigMetricDiskWriteRead) {
     EXPECT_EQ(broadcastCount, 1);
 }
 
+TEST(StatsLogProcessorTest, TestSaveActiveConfigsOnlyWhenChanged) {
+    StatsdConfig config;
+    config.add_allowed_log_source("AID_ROOT");  // LogEvent defaults to UID of root.
+    auto wakelockAcquireMatcher = CreateAcquireWakelockAtomMatcher();
+    *config.add_atom_matcher() = wakelockAcquireMatcher;
+    auto countMetric = config.add_count_metric();
+    countMetric->set_id(1234561);
+    countMetric->set_what(wakelockAcquireMatcher.id());
+    countMetric->set_bucket(FIVE_MINUTES);
+    auto metricActivation = config.add_metric_activation();
+    metricActivation->set_metric_id(countMetric->id());
+    metricActivation->set_activation_type(ACTIVATE_ON_BOOT);
+    auto activationTrigger = metricActivation->add_event_activation();
+    activationTrigger->set_atom_matcher_id(wakelockAcquireMatcher.id());
+    activationTrigger->set_ttl_seconds(100);
+
+    ConfigKey cfgKey(1111, 12341);
+    sp<StatsLogProcessor> processor = CreateStatsLogProcessor(1, 1, config, cfgKey);
+    const string fileName = "/data/misc/stats-active-metric/active_metrics";
+
+    std::vector<int> attributionUids = {111};
+    std::vector<string> attributionTags = {"App1"};
+    std::unique_ptr<LogEvent> event =
+            CreateAcquireWakelockEvent(100, attributionUids, attributionTags, "wl1");
+    processor->OnLogEvent(event.get());
+
+    string content;
+    processor->SaveActiveConfigsToDisk(100 * NS_PER_SEC);
+    StorageManager::flushWrites();
+    ASSERT_TRUE(android::base::ReadFileToString(fileName, &content));
+    ASSERT_EQ(1, processor->mSavedActiveConfigs.size());
+    EXPECT_FALSE(processor->mSavedActiveConfigs[cfgKey].hadRunningActivation);
+
+    // Nothing changed, so the file is not rewritten.
+    StorageManager::deleteFile(fileName.c_str());
+    processor->mLastActiveMetricsWriteNs = 0;
+    processor->SaveActiveConfigsToDisk(200 * NS_PER_SEC);
+    StorageManager::flushWrites();
+    EXPECT_FALSE(android::base::ReadFileToString(fileName, &content));
+
+    // The activation triggers again.
+    event = CreateAcquireWakelockEvent(300, attributionUids, attributionTags, "wl1");
+    processor->OnLogEvent(event.get());
+    processor->mLastActiveMetricsWriteNs = 0;
+    processor->SaveActiveConfigsToDisk(300 * NS_PER_SEC);
+    StorageManager::flushWrites();
+    ASSERT_TRUE(android::base::ReadFileToString(fileName, &content));
+    ActiveConfigList activeConfigList;
+    ASSERT_TRUE(activeConfigList.ParseFromString(content));
+    ASSERT_EQ(1, activeConfigList.config_size());
+    EXPECT_EQ(cfgKey.GetId(), activeConfigList.config(0).id());
+    ASSERT_EQ(1, activeConfigList.config(0).metric_size());
+    ASSERT_EQ(1, activeConfigList.config(0).metric(0).activation_size());
+
+    StorageManager::deleteFile(fileName.c_str());
+}
+
+TEST(StatsLogProcessorTest, TestTrainInfoCached) {
+    InstallTrainInfo trainInfo;
+    trainInfo.trainName = "StatsLogProcessorTest.TestTrainInfoCached";
+    trainInfo.trainVersionCode = 1;
+    trainInfo.status = 1;
+    trainInfo.experimentIds = {100};
+    ASSERT_TRUE(StorageManager::writeTrainInfo(trainInfo));
+    StorageManager::flushWrites();
+
+    sp<UidMap> m = new UidMap();
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+    StatsLogProcessor p(m, pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor, 0,
+                        [](const ConfigKey& key) { return true; },
+                        [](const int&, const vector<int64_t>&) { return true; });
+    EXPECT_FALSE(p.mTrainInfosLoaded);
+
+    // The first read loads the train infos from disk.
+    InstallTrainInfo readInfo;
+    ASSERT_TRUE(p.readTrainInfoLocked(trainInfo.trainName, &readInfo));
+    EXPECT_TRUE(p.mTrainInfosLoaded);
+    EXPECT_EQ(1, readInfo.trainVersionCode);
+    EXPECT_EQ(trainInfo.experimentIds, readInfo.experimentIds);
+    EXPECT_FALSE(p.readTrainInfoLocked("StatsLogProcessorTest.UnknownTrain", &readInfo));
+
+    // The later reads don't go to disk.
+    InstallTrainInfo otherInfo = trainInfo;
+    otherInfo.trainVersionCode = 2;
+    ASSERT_TRUE(StorageManager::writeTrainInfo(otherInfo));
+    StorageManager::flushWrites();
+    ASSERT_TRUE(p.readTrainInfoLocked(trainInfo.trainName, &readInfo));
+    EXPECT_EQ(1, readInfo.trainVersionCode);
+
+    // The updates are applied in memory and written to disk.
+    trainInfo.trainVersionCode = 3;
+    p.writeTrainInfoLocked(trainInfo);
+    ASSERT_TRUE(p.readTrainInfoLocked(trainInfo.trainName, &readInfo));
+    EXPECT_EQ(3, readInfo.trainVersionCode);
+    StorageManager::flushWrites();
+    InstallTrainInfo infoOnDisk;
+    ASSERT_TRUE(StorageManager::readTrainInfo(trainInfo.trainName, infoOnDisk));
+    EXPECT_EQ(3, infoOnDisk.trainVersionCode);
+
+    // A watchdog rollback reads and updates the cached train info.
+    EXPECT_EQ(vector<int64_t>({100, 104}),
+              p.processWatchdogRollbackOccurred(
+                      util::WATCHDOG_ROLLBACK_OCCURRED__ROLLBACK_TYPE__ROLLBACK_INITIATE,
+                      trainInfo.trainName));
+    ASSERT_TRUE(p.readTrainInfoLocked(trainInfo.trainName, &readInfo));
+    EXPECT_EQ(vector<int64_t>({100, 104}), readInfo.experimentIds);
+}
+
 TEST(StatsLogProcessorTest, TestActivationOnBoot) {
     int uid = 1111;
 
@@ -1839,9 +2732,9 @@ TEST(StatsLogProcessorTest_mapIsolatedUidToHostUid, LogHostUidAttributionChain)
     const vector<FieldValue>* actualFieldValues = &logEvent->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(200, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
     EXPECT_EQ(field1, actualFieldValues->at(4).mValue.int_value);
     EXPECT_EQ(field2, actualFieldValues->at(5).mValue.int_value);
 }
@@ -1867,9 +2760,9 @@ TEST(StatsLogProcessorTest_mapIsolatedUidToHostUid, LogIsolatedUidAttributionCha
     const vector<FieldValue>* actualFieldValues = &logEvent->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(200, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
     EXPECT_EQ(field1, actualFieldValues->at(4).mValue.int_value);
     EXPECT_EQ(field2, actualFieldValues->at(5).mValue.int_value);
 }
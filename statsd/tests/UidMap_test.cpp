@@ -26,6 +26,8 @@
 
 #include <stdio.h>
 
+#include <thread>
+
 using namespace android;
 
 namespace android {
@@ -62,6 +64,55 @@ TEST(UidMapTest, TestIsolatedUID) {
     EXPECT_EQ(101, m->getHostUidOrSelf(101));
 }
 
+TEST(UidMapTest, TestIsolatedUidSnapshot) {
+    sp<UidMap> m = new UidMap();
+    IsolatedUidSnapshot snapshot(m);
+    snapshot.refresh();
+    EXPECT_TRUE(snapshot.empty());
+    EXPECT_EQ(101, snapshot.getHostUidOrSelf(101));
+
+    const uint64_t version = m->getIsolatedUidMapVersion();
+    m->assignIsolatedUid(101, 100);
+    EXPECT_NE(version, m->getIsolatedUidMapVersion());
+    // Not seen until the next refresh.
+    EXPECT_EQ(101, snapshot.getHostUidOrSelf(101));
+    snapshot.refresh();
+    EXPECT_FALSE(snapshot.empty());
+    EXPECT_EQ(100, snapshot.getHostUidOrSelf(101));
+    EXPECT_EQ(102, snapshot.getHostUidOrSelf(102));
+
+    m->removeIsolatedUid(101);
+    snapshot.refresh();
+    EXPECT_TRUE(snapshot.empty());
+    EXPECT_EQ(101, snapshot.getHostUidOrSelf(101));
+}
+
+TEST(UidMapTest, TestIsolatedUidMapCopiedOnWrite) {
+    sp<UidMap> m = new UidMap();
+    m->assignIsolatedUid(101, 100);
+    uint64_t version;
+    std::shared_ptr<const UidMap::IsolatedUidMap> held = m->getIsolatedUidMapSnapshot(&version);
+
+    // The held map is not modified.
+    m->assignIsolatedUid(102, 100);
+    EXPECT_EQ(1, held->size());
+    std::shared_ptr<const UidMap::IsolatedUidMap> copy = m->getIsolatedUidMapSnapshot(&version);
+    EXPECT_NE(held, copy);
+    EXPECT_EQ(2, copy->size());
+
+    // Without any holder, the map is modified in place.
+    const UidMap::IsolatedUidMap* map = copy.get();
+    held = nullptr;
+    copy = nullptr;
+    m->removeIsolatedUid(101);
+    m->assignIsolatedUid(103, 100);
+    copy = m->getIsolatedUidMapSnapshot(&version);
+    EXPECT_EQ(map, copy.get());
+    EXPECT_EQ(2, copy->size());
+    EXPECT_EQ(100, m->getHostUidOrSelf(103));
+    EXPECT_EQ(101, m->getHostUidOrSelf(101));
+}
+
 TEST(UidMapTest, TestMatching) {
     UidMap m;
     const vector<int32_t> uids{1000, 1000};
@@ -158,6 +209,116 @@ TEST(UidMapTest, TestUpdateApp) {
     EXPECT_TRUE(name_set.find("new_app1_name") != name_set.end());
 }
 
+TEST(UidMapTest, TestUidsFromNormalizedAppName) {
+    UidMap m;
+    uint64_t version = m.getPackageMapVersion();
+    m.updateMap(1, {1000, 2000}, {4, 5}, {String16("v4"), String16("v5")},
+                {String16("NeW_aPP1_NAmE"), String16(kApp2.c_str())},
+                {String16(""), String16("")}, /* certificateHash */ {{}, {}});
+    EXPECT_NE(version, m.getPackageMapVersion());
+    EXPECT_EQ(std::unordered_set<int32_t>({1000}),
+              m.getUidsFromNormalizedAppName("new_app1_name"));
+    EXPECT_TRUE(m.getUidsFromNormalizedAppName("NeW_aPP1_NAmE").empty());
+
+    version = m.getPackageMapVersion();
+    m.updateApp(2, String16("NeW_aPP1_NAmE"), 3000, 1, String16("v1"), String16(""),
+                /* certificateHash */ {});
+    EXPECT_NE(version, m.getPackageMapVersion());
+    EXPECT_EQ(std::unordered_set<int32_t>({1000, 3000}),
+              m.getUidsFromNormalizedAppName("new_app1_name"));
+
+    version = m.getPackageMapVersion();
+    m.removeApp(3, String16("NeW_aPP1_NAmE"), 1000);
+    EXPECT_NE(version, m.getPackageMapVersion());
+    EXPECT_EQ(std::unordered_set<int32_t>({3000}),
+              m.getUidsFromNormalizedAppName("new_app1_name"));
+}
+
+TEST(UidMapTest, TestAppUidsAfterChanges) {
+    UidMap m;
+    m.updateMap(1, {1000, 2000, 2000}, {4, 5, 6}, {String16("v4"), String16("v5"), String16("v6")},
+                {String16(kApp1.c_str()), String16(kApp1.c_str()), String16(kApp2.c_str())},
+                {String16(""), String16(""), String16("")}, /* certificateHash */ {{}, {}, {}});
+    EXPECT_EQ(std::set<int32_t>({1000, 2000}), m.getAppUid(kApp1));
+    EXPECT_EQ(std::set<int32_t>({2000}), m.getAppUid(kApp2));
+
+    m.removeApp(2, String16(kApp1.c_str()), 2000);
+    EXPECT_EQ(std::set<int32_t>({1000}), m.getAppUid(kApp1));
+    EXPECT_EQ(std::set<string>({kApp2}), m.getAppNamesFromUid(2000, false /* returnNormalized */));
+
+    // Installing the app again restores it.
+    m.updateApp(3, String16(kApp1.c_str()), 2000, 7, String16("v7"), String16(""),
+                /* certificateHash */ {});
+    EXPECT_EQ(std::set<int32_t>({1000, 2000}), m.getAppUid(kApp1));
+    EXPECT_EQ(std::set<string>({kApp1, kApp2}),
+              m.getAppNamesFromUid(2000, false /* returnNormalized */));
+
+    // A new snapshot replaces the apps.
+    m.updateMap(4, {3000}, {1}, {String16("v1")}, {String16(kApp2.c_str())}, {String16("")},
+                /* certificateHash */ {{}});
+    EXPECT_TRUE(m.getAppUid(kApp1).empty());
+    EXPECT_EQ(std::set<int32_t>({3000}), m.getAppUid(kApp2));
+    EXPECT_TRUE(m.getAppNamesFromUid(2000, false /* returnNormalized */).empty());
+}
+
+TEST(UidMapTest, TestUpdateMapFromUidData) {
+    UidMap m;
+    UidData uidData;
+    ApplicationInfo* appInfo = uidData.add_app_info();
+    appInfo->set_uid(1000);
+    appInfo->set_package_name(kApp1);
+    appInfo->set_version(4);
+    appInfo->set_version_string("v4");
+    appInfo = uidData.add_app_info();
+    appInfo->set_uid(2000);
+    appInfo->set_package_name(kApp2);
+    appInfo->set_version(5);
+    appInfo->set_certificate_hash("\x01\x02");
+    m.updateMap(1, uidData);
+    EXPECT_EQ(4, m.getAppVersion(1000, kApp1));
+    EXPECT_EQ(5, m.getAppVersion(2000, kApp2));
+
+    // Sending the same apps again changes nothing.
+    const uint64_t version = m.getPackageMapVersion();
+    m.updateMap(2, uidData);
+    EXPECT_EQ(version, m.getPackageMapVersion());
+
+    // The changed apps are updated and the missing ones removed.
+    uidData.mutable_app_info(0)->set_version(40);
+    uidData.mutable_app_info()->RemoveLast();
+    m.updateMap(3, uidData);
+    EXPECT_NE(version, m.getPackageMapVersion());
+    EXPECT_EQ(40, m.getAppVersion(1000, kApp1));
+    EXPECT_FALSE(m.hasApp(2000, kApp2));
+    EXPECT_TRUE(m.getAppUid(kApp2).empty());
+}
+
+TEST(UidMapTest, TestLookupsDuringUpdates) {
+    UidMap m;
+    m.updateMap(1, {1000}, {1}, {String16("v1")}, {String16(kApp1.c_str())}, {String16("")},
+                /* certificateHash */ {{}});
+
+    // The readers see either version of the app, never a partial update.
+    std::thread writer([&m] {
+        for (int version = 2; version < 100; version++) {
+            m.updateApp(version, String16(kApp1.c_str()), 1000, version, String16("v"),
+                        String16(""), /* certificateHash */ {});
+            m.assignIsolatedUid(2000 + version, 1000);
+        }
+    });
+    int64_t lastVersion = 1;
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_TRUE(m.hasApp(1000, kApp1));
+        const int64_t version = m.getAppVersion(1000, kApp1);
+        EXPECT_LE(lastVersion, version);
+        lastVersion = version;
+        EXPECT_EQ(std::set<int32_t>({1000}), m.getAppUid(kApp1));
+    }
+    writer.join();
+    EXPECT_EQ(99, m.getAppVersion(1000, kApp1));
+    EXPECT_EQ(1000, m.getHostUidOrSelf(2099));
+}
+
 static void protoOutputStreamToUidMapping(ProtoOutputStream* proto, UidMapping* results) {
     vector<uint8_t> bytes;
     bytes.resize(proto->size());
@@ -195,7 +356,7 @@ TEST(UidMapTest, TestOutputIncludesAtLeastOneSnapshot) {
     ProtoOutputStream proto;
     m.appendUidMap(/* timestamp */ 3, config1, /* includeVersionStrings */ true,
                    /* includeInstaller */ true, /* truncatedCertificateHashSize */ 0,
-                   /* str_set */ nullptr, &proto);
+                   /* includeOnlyChanges */ false, /* str_set */ nullptr, &proto);
 
     // Check there's still a uidmap attached this one.
     UidMapping results;
@@ -204,6 +365,52 @@ TEST(UidMapTest, TestOutputIncludesAtLeastOneSnapshot) {
     EXPECT_EQ("v1", results.snapshots(0).package_info(0).version_string());
 }
 
+TEST(UidMapTest, TestStringDictionary) {
+    UidMap m;
+    ConfigKey config1(1, StringToId("config1"));
+    m.OnConfigUpdated(config1);
+    const vector<int32_t> uids{1000};
+    const vector<int64_t> versions{5};
+    const vector<String16> versionStrings{String16("v1")};
+    const vector<String16> apps{String16(kApp2.c_str())};
+    const vector<String16> installers{String16("installer")};
+    const vector<vector<uint8_t>> certificateHashes{{}};
+    m.updateMap(1 /* timestamp */, uids, versions, versionStrings, apps, installers,
+                certificateHashes);
+    m.updateApp(2 /* timestamp */, String16(kApp2.c_str()), 1000, 6, String16("v2"),
+                String16("installer"), /* certificateHash */ {});
+
+    // The strings are already in the dictionary of the metrics.
+    ReportStrings strings(/* dictionary */ true);
+    EXPECT_EQ(0u, strings.insert("v2"));
+
+    ProtoOutputStream proto;
+    m.appendUidMap(/* timestamp */ 3, config1, /* includeVersionStrings */ true,
+                   /* includeInstaller */ true, /* truncatedCertificateHashSize */ 0,
+                   /* includeOnlyChanges */ false, &strings, &proto);
+
+    UidMapping results;
+    protoOutputStreamToUidMapping(&proto, &results);
+    vector<string> dictionary;
+    strings.forEach([&dictionary](const string& str) { dictionary.push_back(str); });
+
+    ASSERT_EQ(1, results.changes_size());
+    const UidMapping_Change& change = results.changes(0);
+    EXPECT_FALSE(change.has_app_hash());
+    EXPECT_EQ(kApp2, dictionary[change.app_index()]);
+    EXPECT_EQ(0u, change.new_version_string_index());
+    EXPECT_EQ("v1", dictionary[change.prev_version_string_index()]);
+
+    ASSERT_EQ(1, results.snapshots_size());
+    const UidMapping_PackageInfoSnapshot_PackageInfo& info =
+            results.snapshots(0).package_info(0);
+    EXPECT_FALSE(info.has_name_hash());
+    EXPECT_EQ(kApp2, dictionary[info.name_index()]);
+    EXPECT_EQ("v2", dictionary[info.version_string_index()]);
+    EXPECT_EQ("installer", dictionary[info.installer_string_index()]);
+    EXPECT_EQ(4u, dictionary.size());
+}
+
 TEST(UidMapTest, TestRemovedAppRetained) {
     UidMap m;
     // Initialize single config key.
@@ -223,7 +430,7 @@ TEST(UidMapTest, TestRemovedAppRetained) {
     ProtoOutputStream proto;
     m.appendUidMap(/* timestamp */ 3, config1, /* includeVersionStrings */ true,
                    /* includeInstaller */ true, /* truncatedCertificateHashSize */ 0,
-                   /* str_set */ nullptr, &proto);
+                   /* includeOnlyChanges */ false, /* str_set */ nullptr, &proto);
 
     // Snapshot should still contain this item as deleted.
     UidMapping results;
@@ -232,6 +439,57 @@ TEST(UidMapTest, TestRemovedAppRetained) {
     EXPECT_EQ(true, results.snapshots(0).package_info(0).deleted());
 }
 
+TEST(UidMapTest, TestOnlyChangesSinceSnapshot) {
+    UidMap m;
+    ConfigKey config1(1, StringToId("config1"));
+    m.OnConfigUpdated(config1);
+    m.updateMap(1, {1000, 2000}, {4, 5}, {String16("v4"), String16("v5")},
+                {String16(kApp1.c_str()), String16(kApp2.c_str())}, {String16(""), String16("")},
+                /* certificateHash */ {{}, {}});
+    auto appendUidMap = [&](int64_t timestamp) {
+        ProtoOutputStream proto;
+        m.appendUidMap(timestamp, config1, /* includeVersionStrings */ true,
+                       /* includeInstaller */ false, /* truncatedCertificateHashSize */ 0,
+                       /* includeOnlyChanges */ true, /* str_set */ nullptr, &proto);
+        UidMapping results;
+        protoOutputStreamToUidMapping(&proto, &results);
+        return results;
+    };
+
+    // The first report has a snapshot.
+    UidMapping results = appendUidMap(2);
+    ASSERT_EQ(1, results.snapshots_size());
+    EXPECT_EQ(2, results.snapshots(0).package_info_size());
+    const uint64_t snapshotHash = results.snapshot_hash();
+
+    // Then only the changes.
+    results = appendUidMap(3);
+    EXPECT_EQ(0, results.snapshots_size());
+    EXPECT_EQ(0, results.changes_size());
+    EXPECT_EQ(snapshotHash, results.snapshot_hash());
+
+    m.updateApp(4, String16(kApp1.c_str()), 1000, 40, String16("v40"), String16(""),
+                /* certificateHash */ {});
+    results = appendUidMap(5);
+    EXPECT_EQ(0, results.snapshots_size());
+    ASSERT_EQ(1, results.changes_size());
+    EXPECT_EQ(40, results.changes(0).new_version());
+    EXPECT_NE(snapshotHash, results.snapshot_hash());
+
+    // A new uid map isn't described by the changes.
+    m.updateMap(6, {1000}, {4}, {String16("v4")}, {String16(kApp1.c_str())}, {String16("")},
+                /* certificateHash */ {{}});
+    results = appendUidMap(7);
+    ASSERT_EQ(1, results.snapshots_size());
+    EXPECT_EQ(1, results.snapshots(0).package_info_size());
+
+    // A snapshot is written periodically even without changes.
+    results = appendUidMap(7 + StatsdStats::kMaxUidMapSnapshotPeriodNs - 1);
+    EXPECT_EQ(0, results.snapshots_size());
+    results = appendUidMap(7 + StatsdStats::kMaxUidMapSnapshotPeriodNs);
+    EXPECT_EQ(1, results.snapshots_size());
+}
+
 TEST(UidMapTest, TestRemovedAppOverGuardrail) {
     UidMap m;
     // Initialize single config key.
@@ -260,7 +518,7 @@ TEST(UidMapTest, TestRemovedAppOverGuardrail) {
     ProtoOutputStream proto;
     m.appendUidMap(/* timestamp */ 3, config1, /* includeVersionStrings */ true,
                    /* includeInstaller */ true, /* truncatedCertificateHashSize */ 0,
-                   /* str_set */ nullptr, &proto);
+                   /* includeOnlyChanges */ false, /* str_set */ nullptr, &proto);
     protoOutputStreamToUidMapping(&proto, &results);
     ASSERT_EQ(maxDeletedApps + 10, results.snapshots(0).package_info_size());
 
@@ -274,7 +532,7 @@ TEST(UidMapTest, TestRemovedAppOverGuardrail) {
     proto.clear();
     m.appendUidMap(/* timestamp */ 5, config1, /* includeVersionStrings */ true,
                    /* includeInstaller */ true, /* truncatedCertificateHashSize */ 0,
-                   /* str_set */ nullptr, &proto);
+                   /* includeOnlyChanges */ false, /* str_set */ nullptr, &proto);
     // Snapshot drops the first nine items.
     protoOutputStreamToUidMapping(&proto, &results);
     ASSERT_EQ(maxDeletedApps, results.snapshots(0).package_info_size());
@@ -300,7 +558,7 @@ TEST(UidMapTest, TestClearingOutput) {
     ProtoOutputStream proto;
     m.appendUidMap(/* timestamp */ 2, config1, /* includeVersionStrings */ true,
                    /* includeInstaller */ true, /* truncatedCertificateHashSize */ 0,
-                   /* str_set */ nullptr, &proto);
+                   /* includeOnlyChanges */ false, /* str_set */ nullptr, &proto);
     UidMapping results;
     protoOutputStreamToUidMapping(&proto, &results);
     ASSERT_EQ(1, results.snapshots_size());
@@ -309,7 +567,7 @@ TEST(UidMapTest, TestClearingOutput) {
     proto.clear();
     m.appendUidMap(/* timestamp */ 2, config1, /* includeVersionStrings */ true,
                    /* includeInstaller */ true, /* truncatedCertificateHashSize */ 0,
-                   /* str_set */ nullptr, &proto);
+                   /* includeOnlyChanges */ false, /* str_set */ nullptr, &proto);
     protoOutputStreamToUidMapping(&proto, &results);
     ASSERT_EQ(1, results.snapshots_size());
 
@@ -321,7 +579,7 @@ TEST(UidMapTest, TestClearingOutput) {
     proto.clear();
     m.appendUidMap(/* timestamp */ 6, config1, /* includeVersionStrings */ true,
                    /* includeInstaller */ true, /* truncatedCertificateHashSize */ 0,
-                   /* str_set */ nullptr, &proto);
+                   /* includeOnlyChanges */ false, /* str_set */ nullptr, &proto);
     protoOutputStreamToUidMapping(&proto, &results);
     ASSERT_EQ(1, results.snapshots_size());
     ASSERT_EQ(1, results.changes_size());
@@ -336,7 +594,7 @@ TEST(UidMapTest, TestClearingOutput) {
     proto.clear();
     m.appendUidMap(/* timestamp */ 8, config1, /* includeVersionStrings */ true,
                    /* includeInstaller */ true, /* truncatedCertificateHashSize */ 0,
-                   /* str_set */ nullptr, &proto);
+                   /* includeOnlyChanges */ false, /* str_set */ nullptr, &proto);
     protoOutputStreamToUidMapping(&proto, &results);
     ASSERT_EQ(1, results.snapshots_size());
     ASSERT_EQ(1, results.changes_size());
@@ -345,7 +603,7 @@ TEST(UidMapTest, TestClearingOutput) {
     proto.clear();
     m.appendUidMap(/* timestamp */ 9, config2, /* includeVersionStrings */ true,
                    /* includeInstaller */ true, /* truncatedCertificateHashSize */ 0,
-                   /* str_set */ nullptr, &proto);
+                   /* includeOnlyChanges */ false, /* str_set */ nullptr, &proto);
     protoOutputStreamToUidMapping(&proto, &results);
     ASSERT_EQ(1, results.snapshots_size());
     ASSERT_EQ(2, results.changes_size());
@@ -353,6 +611,64 @@ TEST(UidMapTest, TestClearingOutput) {
     ASSERT_EQ(0U, m.mChanges.size());
 }
 
+TEST(UidMapTest, TestChangeStringsShared) {
+    UidMap m;
+    ConfigKey config1(1, StringToId("config1"));
+    m.OnConfigUpdated(config1);
+    m.updateMap(1 /* timestamp */, {1000}, {1}, {String16("v1")}, {String16(kApp1.c_str())},
+                {String16("")}, /* certificateHash */ {{}});
+
+    // Each change shares the package name, and its version string with the next change.
+    size_t versionStringBytes = strlen("v1");
+    for (int version = 2; version <= 11; version++) {
+        const string versionString = "v" + to_string(version);
+        m.updateApp(version, String16(kApp1.c_str()), 1000, version,
+                    String16(versionString.c_str()), String16(""), /* certificateHash */ {});
+        versionStringBytes += versionString.size();
+    }
+    ASSERT_EQ(10U, m.mChanges.size());
+    EXPECT_EQ(10 * kBytesChangeRecord + kApp1.size() + versionStringBytes, m.mBytesUsed);
+
+    ProtoOutputStream proto;
+    m.appendUidMap(/* timestamp */ 12, config1, /* includeVersionStrings */ true,
+                   /* includeInstaller */ false, /* truncatedCertificateHashSize */ 0,
+                   /* includeOnlyChanges */ false, /* str_set */ nullptr, &proto);
+    UidMapping results;
+    protoOutputStreamToUidMapping(&proto, &results);
+    ASSERT_EQ(10, results.changes_size());
+    EXPECT_EQ(kApp1, results.changes(9).app());
+    EXPECT_EQ("v11", results.changes(9).new_version_string());
+    EXPECT_EQ("v10", results.changes(9).prev_version_string());
+
+    // The changes were uploaded, so they and their strings are dropped.
+    EXPECT_EQ(0U, m.mChanges.size());
+    EXPECT_EQ(0U, m.mBytesUsed);
+}
+
+TEST(UidMapChangeLogTest, TestRingDropsOldestChanges) {
+    UidMapChangeLog changes(/* capacity */ 2);
+    EXPECT_TRUE(changes.append(false, 1, "app1", 1000, 2, "v2", 1, "v1"));
+    EXPECT_TRUE(changes.append(false, 2, "app2", 1001, 3, "v3", 2, "v2"));
+    EXPECT_FALSE(changes.append(true, 3, "app1", 1000, 0, "", 2, "v2"));
+
+    ASSERT_EQ(2U, changes.size());
+    EXPECT_EQ(2, changes[0].timestampNs);
+    EXPECT_EQ("app2", changes.getString(changes[0].package));
+    EXPECT_EQ(3, changes[1].timestampNs);
+    EXPECT_TRUE(changes[1].deletion);
+    EXPECT_EQ("app1", changes.getString(changes[1].package));
+    EXPECT_EQ("v2", changes.getString(changes[1].prevVersionString));
+
+    EXPECT_EQ(1U, changes.removeOlderThan(3));
+    ASSERT_EQ(1U, changes.size());
+    EXPECT_EQ(3, changes[0].timestampNs);
+    EXPECT_EQ(kBytesChangeRecord + strlen("app1") + strlen("v2"), changes.getBytesUsed());
+
+    changes.pop_front();
+    EXPECT_TRUE(changes.empty());
+    EXPECT_EQ(0U, changes.getBytesUsed());
+}
+
 TEST(UidMapTest, TestMemoryComputed) {
     UidMap m;
 
@@ -376,12 +692,12 @@ TEST(UidMapTest, TestMemoryComputed) {
     vector<uint8_t> bytes;
     m.appendUidMap(/* timestamp */ 2, config1, /* includeVersionStrings */ true,
                    /* includeInstaller */ true, /* truncatedCertificateHashSize */ 0,
-                   /* str_set */ nullptr, &proto);
+                   /* includeOnlyChanges */ false, /* str_set */ nullptr, &proto);
     size_t prevBytes = m.mBytesUsed;
 
     m.appendUidMap(/* timestamp */ 4, config1, /* includeVersionStrings */ true,
                    /* includeInstaller */ true, /* truncatedCertificateHashSize */ 0,
-                   /* str_set */ nullptr, &proto);
+                   /* includeOnlyChanges */ false, /* str_set */ nullptr, &proto);
     EXPECT_TRUE(m.mBytesUsed < prevBytes);
 }
 
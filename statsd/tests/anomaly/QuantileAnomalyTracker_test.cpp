@@ -0,0 +1,82 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "src/anomaly/QuantileAnomalyTracker.h"
+
+#include <gtest/gtest.h>
+
+#include "tests/statsd_test_util.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+const ConfigKey kConfigKey(0, 12345);
+const int64_t kMetricId = 123;
+
+MetricDimensionKey getDimensionKey(const std::string& value) {
+    int pos[] = {1, 0, 0};
+    HashableDimensionKey dim;
+    dim.addValue(FieldValue(Field(1, pos, 0), Value(value)));
+    return MetricDimensionKey(dim, DEFAULT_DIMENSION_KEY);
+}
+
+}  // namespace
+
+TEST(QuantileAnomalyTrackerTest, TestQuantileOverBuckets) {
+    Alert alert;
+    alert.set_num_buckets(2);
+    alert.set_refractory_period_secs(1);
+    alert.set_trigger_if_sum_gt(100);
+    alert.set_quantile(0.5);
+    QuantileAnomalyTracker tracker(alert, kConfigKey);
+    const MetricDimensionKey keyA = getDimensionKey("a");
+    const MetricDimensionKey keyB = getDimensionKey("b");
+
+    // Half of the values exceed the threshold, so the median does not.
+    tracker.addValue(1 * NS_PER_SEC, 0, kMetricId, keyA, 10);
+    tracker.addValue(2 * NS_PER_SEC, 0, kMetricId, keyA, 10);
+    tracker.addValue(3 * NS_PER_SEC, 0, kMetricId, keyA, 200);
+    tracker.addValue(4 * NS_PER_SEC, 0, kMetricId, keyA, 300);
+    EXPECT_EQ(0u, tracker.getRefractoryPeriodEndsSec(keyA));
+
+    // The past bucket counts toward the median.
+    tracker.addValue(61 * NS_PER_SEC, 1, kMetricId, keyB, 10);
+    tracker.addValue(61 * NS_PER_SEC, 1, kMetricId, keyA, 400);
+    EXPECT_EQ(62u, tracker.getRefractoryPeriodEndsSec(keyA));
+    EXPECT_EQ(0u, tracker.getRefractoryPeriodEndsSec(keyB));
+    EXPECT_EQ(2, tracker.getSumOverPastBuckets(keyA));
+    EXPECT_EQ(4, tracker.mValueCounts.getSum(keyA));
+
+    // Buckets #0 and #1 are out of the window of bucket #3.
+    tracker.addValue(185 * NS_PER_SEC, 3, kMetricId, keyA, 500);
+    EXPECT_EQ(0, tracker.getSumOverPastBuckets(keyA));
+    EXPECT_EQ(0, tracker.mValueCounts.getSum(keyA));
+    EXPECT_EQ(186u, tracker.getRefractoryPeriodEndsSec(keyA));
+
+    tracker.addValue(190 * NS_PER_SEC, 3, kMetricId, keyB, 500);
+    EXPECT_EQ(191u, tracker.getRefractoryPeriodEndsSec(keyB));
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
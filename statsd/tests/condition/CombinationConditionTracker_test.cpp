@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include "condition/CombinationConditionTracker.h"
+#include "condition/SimpleConditionTracker.h"
 #include "condition/condition_util.h"
 #include "src/statsd_config.pb.h"
 
@@ -21,6 +23,8 @@
 #include <vector>
 
 using namespace android::os::statsd;
+using android::sp;
+using std::unordered_map;
 using std::vector;
 
 #ifdef __ANDROID__
@@ -162,6 +166,76 @@ TEST(ConditionTrackerTest, TestNorCondition) {
     EXPECT_FALSE(evaluateCombinationCondition(children, operation, conditionResults));
 }
 
+TEST(ConditionTrackerTest, TestUnslicedCombinationFollowsChildChanges) {
+    // Two unsliced simple predicates started and stopped by matchers 0-1 and 2-3, and their AND.
+    vector<Predicate> predicates(3);
+    unordered_map<int64_t, int> matcherMap = {{10, 0}, {11, 1}, {12, 2}, {13, 3}};
+    unordered_map<int64_t, int> conditionMap = {{1, 0}, {2, 1}, {3, 2}};
+    for (int i = 0; i < 2; i++) {
+        predicates[i].set_id(i + 1);
+        SimplePredicate* simplePredicate = predicates[i].mutable_simple_predicate();
+        simplePredicate->set_start(10 + 2 * i);
+        simplePredicate->set_stop(11 + 2 * i);
+        simplePredicate->set_initial_value(SimplePredicate_InitialValue_FALSE);
+    }
+    predicates[2].set_id(3);
+    predicates[2].mutable_combination()->set_operation(LogicalOperation::AND);
+    predicates[2].mutable_combination()->add_predicate(1);
+    predicates[2].mutable_combination()->add_predicate(2);
+
+    ConfigKey key(0, 12345);
+    vector<sp<ConditionTracker>> trackers;
+    for (int i = 0; i < 2; i++) {
+        trackers.push_back(new SimpleConditionTracker(key, i + 1, /*protoHash=*/i, i,
+                                                      predicates[i].simple_predicate(),
+                                                      matcherMap));
+    }
+    trackers.push_back(new CombinationConditionTracker(3, 2, /*protoHash=*/2));
+    vector<bool> stack(3, false);
+    vector<ConditionState> conditionCache(3, ConditionState::kNotEvaluated);
+    ASSERT_TRUE(trackers[2]->init(predicates, trackers, conditionMap, stack, conditionCache));
+    EXPECT_EQ(ConditionState::kFalse, conditionCache[2]);
+
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    const auto evaluate = [&](const vector<MatchingState>& matcherStates,
+                              vector<bool>& changedCache) {
+        std::fill(conditionCache.begin(), conditionCache.end(), ConditionState::kNotEvaluated);
+        changedCache.assign(3, false);
+        trackers[2]->evaluateCondition(event, matcherStates, trackers, conditionCache,
+                                       changedCache);
+    };
+    const MatchingState kMatched = MatchingState::kMatched;
+    const MatchingState kNotMatched = MatchingState::kNotMatched;
+    vector<bool> changedCache;
+
+    // The first child starts, the combination stays false.
+    evaluate({kMatched, kNotMatched, kNotMatched, kNotMatched}, changedCache);
+    EXPECT_TRUE(changedCache[0]);
+    EXPECT_FALSE(changedCache[2]);
+    EXPECT_EQ(ConditionState::kFalse, conditionCache[2]);
+
+    // The second child starts, so does the combination.
+    evaluate({kNotMatched, kNotMatched, kMatched, kNotMatched}, changedCache);
+    EXPECT_TRUE(changedCache[2]);
+    EXPECT_EQ(ConditionState::kTrue, conditionCache[2]);
+
+    // Nothing changes, the combination keeps its state.
+    evaluate({kNotMatched, kNotMatched, kNotMatched, kNotMatched}, changedCache);
+    EXPECT_FALSE(changedCache[2]);
+    EXPECT_EQ(ConditionState::kTrue, conditionCache[2]);
+
+    // A second start of the first child doesn't change it either.
+    evaluate({kMatched, kNotMatched, kNotMatched, kNotMatched}, changedCache);
+    EXPECT_FALSE(changedCache[0]);
+    EXPECT_FALSE(changedCache[2]);
+    EXPECT_EQ(ConditionState::kTrue, conditionCache[2]);
+
+    // The second child stops.
+    evaluate({kNotMatched, kNotMatched, kNotMatched, kMatched}, changedCache);
+    EXPECT_TRUE(changedCache[2]);
+    EXPECT_EQ(ConditionState::kFalse, conditionCache[2]);
+}
+
 #else
 GTEST_LOG_(INFO) << "This test does nothing.\n";
 #endif
@@ -142,6 +142,29 @@ TEST(ConditionTimerTest, TestTimer_Correction_DelayedWithInitialTrue) {
     EXPECT_EQ(2, timer.mCurrentBucketStartDelayNs);
 }
 
+TEST(ConditionTimerTest, TestTimer_ConditionFlips) {
+    for (bool initCondition : {false, true}) {
+        for (bool firstCondition : {false, true}) {
+            ConditionTimer timer(initCondition, time_base);
+            ConditionTimer expectedTimer(initCondition, time_base);
+
+            // Flips at +5, +10, +30 and +35: the condition is true for 10ns in between if the
+            // first change is to true, 20ns otherwise.
+            expectedTimer.onConditionChanged(firstCondition, ct_start_time + 5);
+            expectedTimer.onConditionChanged(!firstCondition, ct_start_time + 10);
+            expectedTimer.onConditionChanged(firstCondition, ct_start_time + 30);
+            expectedTimer.onConditionChanged(!firstCondition, ct_start_time + 35);
+            timer.onConditionFlips(firstCondition, ct_start_time + 5, firstCondition ? 10 : 20,
+                                   !firstCondition, ct_start_time + 35);
+
+            EXPECT_EQ(expectedTimer.mCondition, timer.mCondition);
+            EXPECT_EQ(expectedTimer.mTimerNs, timer.mTimerNs);
+            EXPECT_EQ(expectedTimer.mLastConditionChangeTimestampNs,
+                      timer.mLastConditionChangeTimestampNs);
+        }
+    }
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
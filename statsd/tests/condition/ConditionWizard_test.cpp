@@ -0,0 +1,133 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/condition/ConditionWizard.h"
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "src/condition/SimpleConditionTracker.h"
+#include "stats_event.h"
+#include "tests/statsd_test_util.h"
+
+using std::unordered_map;
+using std::vector;
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+const ConfigKey kConfigKey(0, 12345);
+
+const int TAG_ID = 1;
+const uint64_t protoHash = 0x123456789;
+
+// A wake lock held condition sliced by the uid of the first attribution node.
+SimplePredicate getWakeLockHeldCondition() {
+    SimplePredicate simplePredicate;
+    simplePredicate.set_start(StringToId("WAKE_LOCK_ACQUIRE"));
+    simplePredicate.set_stop(StringToId("WAKE_LOCK_RELEASE"));
+    simplePredicate.set_stop_all(StringToId("RELEASE_ALL"));
+    simplePredicate.mutable_dimensions()->set_field(TAG_ID);
+    simplePredicate.mutable_dimensions()->add_child()->set_field(1 /*attribution node*/);
+    simplePredicate.mutable_dimensions()->mutable_child(0)->set_position(Position::FIRST);
+    simplePredicate.mutable_dimensions()->mutable_child(0)->add_child()->set_field(1 /*uid*/);
+    simplePredicate.set_count_nesting(true);
+    simplePredicate.set_initial_value(SimplePredicate_InitialValue_FALSE);
+    return simplePredicate;
+}
+
+void makeWakeLockEvent(LogEvent* logEvent, const vector<int>& uids, const string& wl, int acquire) {
+    AStatsEvent* statsEvent = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(statsEvent, TAG_ID);
+    AStatsEvent_overwriteTimestamp(statsEvent, 0);
+
+    vector<std::string> tags(uids.size());  // vector of empty strings
+    writeAttribution(statsEvent, uids, tags);
+
+    AStatsEvent_writeString(statsEvent, wl.c_str());
+    AStatsEvent_writeInt32(statsEvent, acquire);
+
+    parseStatsEventToLogEvent(statsEvent, logEvent);
+}
+
+ConditionKey getWakeLockQueryKey(int uid, const string& conditionName) {
+    int pos[] = {1, 1, 1};
+    Field field(TAG_ID, pos, 2 /*depth*/);
+    HashableDimensionKey dim;
+    dim.addValue(FieldValue(field, Value((int32_t)uid)));
+    ConditionKey key;
+    key[StringToId(conditionName)] = dim;
+    return key;
+}
+
+}  // anonymous namespace
+
+TEST(ConditionWizardTest, TestQueryCache) {
+    string conditionName = "WL_HELD_BY_UID";
+
+    unordered_map<int64_t, int> trackerNameIndexMap;
+    trackerNameIndexMap[StringToId("WAKE_LOCK_ACQUIRE")] = 0;
+    trackerNameIndexMap[StringToId("WAKE_LOCK_RELEASE")] = 1;
+    trackerNameIndexMap[StringToId("RELEASE_ALL")] = 2;
+
+    sp<SimpleConditionTracker> conditionTracker = new SimpleConditionTracker(
+            kConfigKey, StringToId(conditionName), protoHash, 0 /*condition tracker index*/,
+            getWakeLockHeldCondition(), trackerNameIndexMap);
+    vector<sp<ConditionTracker>> allConditions = {conditionTracker};
+    sp<ConditionWizard> wizard = new ConditionWizard(allConditions);
+
+    vector<int> uids = {111};
+    const ConditionKey queryKey = getWakeLockQueryKey(uids[0], conditionName);
+    EXPECT_EQ(ConditionState::kFalse, wizard->query(0, queryKey, false));
+
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    makeWakeLockEvent(&event, uids, "wl", /*acquire=*/1);
+    vector<MatchingState> matcherState = {MatchingState::kMatched, MatchingState::kNotMatched,
+                                          MatchingState::kNotMatched};
+    vector<ConditionState> conditionCache(1, ConditionState::kNotEvaluated);
+    vector<bool> changedCache(1, false);
+    conditionTracker->evaluateCondition(event, matcherState, allConditions, conditionCache,
+                                        changedCache);
+
+    // The evaluation drops the answer from before the start.
+    EXPECT_EQ(ConditionState::kTrue, wizard->query(0, queryKey, false));
+    EXPECT_EQ(ConditionState::kTrue, wizard->query(0, queryKey, false));
+    EXPECT_EQ(ConditionState::kTrue, wizard->query(0, queryKey, true));
+    // One answer per distinct question.
+    EXPECT_EQ(2UL, wizard->mQueryCache.size());
+
+    LogEvent event2(/*uid=*/0, /*pid=*/0);
+    makeWakeLockEvent(&event2, uids, "wl", /*acquire=*/0);
+    matcherState = {MatchingState::kNotMatched, MatchingState::kMatched,
+                    MatchingState::kNotMatched};
+    conditionCache[0] = ConditionState::kNotEvaluated;
+    conditionTracker->evaluateCondition(event2, matcherState, allConditions, conditionCache,
+                                        changedCache);
+    EXPECT_EQ(ConditionState::kFalse, wizard->query(0, queryKey, false));
+    EXPECT_EQ(1UL, wizard->mQueryCache.size());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/condition/PartialLinkIndex.h"
+
+#include <gtest/gtest.h>
+
+#include <unordered_map>
+#include <vector>
+
+#ifdef __ANDROID__
+
+using std::unordered_map;
+using std::vector;
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+const int kTag = 10;
+
+FieldValue makeValue(size_t field, int32_t value) {
+    return FieldValue(Field(kTag, getSimpleField(field)), Value(value));
+}
+
+// A slice of a condition sliced by (uid, tag).
+HashableDimensionKey makeSlice(int32_t uid, int32_t tag) {
+    return HashableDimensionKey({makeValue(1, uid), makeValue(2, tag)});
+}
+
+HashableDimensionKey makeUidKey(int32_t uid) {
+    return HashableDimensionKey({makeValue(1, uid)});
+}
+
+// Queries [index] and checks the result against a scan of [slices].
+void expectQueryMatchesScan(PartialLinkIndex& index,
+                            const unordered_map<HashableDimensionKey, int>& slices,
+                            const HashableDimensionKey& key) {
+    bool anyStarted = false;
+    bool anyStopped = false;
+    ASSERT_TRUE(index.query(key, slices, &anyStarted, &anyStopped));
+    bool expectedAnyStarted = false;
+    bool expectedAnyStopped = false;
+    for (const auto& [slice, startedCount] : slices) {
+        if (slice.contains(key)) {
+            (startedCount > 0 ? expectedAnyStarted : expectedAnyStopped) = true;
+        }
+    }
+    EXPECT_EQ(expectedAnyStarted, anyStarted) << key.toString();
+    EXPECT_EQ(expectedAnyStopped, anyStopped) << key.toString();
+}
+
+}  // anonymous namespace
+
+TEST(PartialLinkIndexTest, TestQueryMatchesScan) {
+    PartialLinkIndex index;
+    unordered_map<HashableDimensionKey, int> slices;
+    // Slices added before the first query are projected by it.
+    slices[makeSlice(1, 1)] = 1;
+    slices[makeSlice(1, 2)] = 0;
+    slices[makeSlice(2, 1)] = 0;
+    for (int uid = 0; uid <= 3; uid++) {
+        expectQueryMatchesScan(index, slices, makeUidKey(uid));
+    }
+
+    // The later changes update the projection.
+    slices[makeSlice(3, 1)] = 2;
+    index.add(makeSlice(3, 1), /*started=*/true);
+    slices[makeSlice(2, 1)] = 1;
+    index.update(makeSlice(2, 1), /*started=*/true);
+    slices[makeSlice(1, 1)] = 0;
+    index.update(makeSlice(1, 1), /*started=*/false);
+    slices.erase(makeSlice(1, 2));
+    index.remove(makeSlice(1, 2), /*started=*/false);
+    for (int uid = 0; uid <= 3; uid++) {
+        expectQueryMatchesScan(index, slices, makeUidKey(uid));
+    }
+
+    // Full keys only match equal slices.
+    expectQueryMatchesScan(index, slices, makeSlice(2, 1));
+    expectQueryMatchesScan(index, slices, makeSlice(2, 2));
+    expectQueryMatchesScan(index, slices,
+                           HashableDimensionKey({makeValue(2, 1), makeValue(1, 2)}));
+
+    // Keys on the other field.
+    expectQueryMatchesScan(index, slices, HashableDimensionKey({makeValue(2, 1)}));
+
+    slices.clear();
+    index.clear();
+    for (int uid = 0; uid <= 3; uid++) {
+        expectQueryMatchesScan(index, slices, makeUidKey(uid));
+    }
+}
+
+TEST(PartialLinkIndexTest, TestAmbiguousSliceIsScanned) {
+    PartialLinkIndex index;
+    unordered_map<HashableDimensionKey, int> slices;
+    slices[HashableDimensionKey({makeValue(1, 1), makeValue(1, 2), makeValue(2, 1)})] = 1;
+    bool anyStarted = false;
+    bool anyStopped = false;
+    EXPECT_FALSE(index.query(makeUidKey(1), slices, &anyStarted, &anyStopped));
+
+    index.clear();
+    slices.clear();
+    expectQueryMatchesScan(index, slices, makeUidKey(1));
+}
+
+TEST(PartialLinkIndexTest, TestAmbiguousSliceRemoved) {
+    PartialLinkIndex index;
+    unordered_map<HashableDimensionKey, int> slices;
+    slices[makeSlice(1, 1)] = 1;
+    expectQueryMatchesScan(index, slices, makeUidKey(1));
+
+    const HashableDimensionKey ambiguousSlice(
+            {makeValue(1, 2), makeValue(1, 3), makeValue(2, 1)});
+    slices[ambiguousSlice] = 1;
+    index.add(ambiguousSlice, /*started=*/true);
+    bool anyStarted = false;
+    bool anyStopped = false;
+    EXPECT_FALSE(index.query(makeUidKey(1), slices, &anyStarted, &anyStopped));
+
+    // Updates of the ambiguous slice keep it ambiguous.
+    slices[ambiguousSlice] = 0;
+    index.update(ambiguousSlice, /*started=*/false);
+    EXPECT_FALSE(index.query(makeUidKey(1), slices, &anyStarted, &anyStopped));
+
+    // The projection is used again once the ambiguous slice is gone.
+    slices.erase(ambiguousSlice);
+    index.remove(ambiguousSlice, /*started=*/false);
+    for (int uid = 0; uid <= 3; uid++) {
+        expectQueryMatchesScan(index, slices, makeUidKey(uid));
+    }
+}
+
+TEST(PartialLinkIndexTest, TestTooManyProjections) {
+    PartialLinkIndex index;
+    unordered_map<HashableDimensionKey, int> slices;
+    slices[HashableDimensionKey({makeValue(1, 1), makeValue(2, 1), makeValue(3, 1),
+                                 makeValue(4, 1), makeValue(5, 1), makeValue(6, 1)})] = 1;
+    for (size_t field = 1; field <= PartialLinkIndex::kMaxProjections; field++) {
+        expectQueryMatchesScan(index, slices, HashableDimensionKey({makeValue(field, 1)}));
+    }
+    bool anyStarted = false;
+    bool anyStopped = false;
+    EXPECT_FALSE(index.query(HashableDimensionKey({makeValue(PartialLinkIndex::kMaxProjections + 1,
+                                                             1)}),
+                             slices, &anyStarted, &anyStopped));
+    EXPECT_GT(index.byteSize(), 0u);
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -424,7 +424,7 @@ TEST_P(SimpleConditionTrackerTest, TestSlicedCondition) {
         conditionTracker.evaluateCondition(event1, matcherState, allPredicates, conditionCache,
                                            changedCache);
 
-        ASSERT_EQ(1UL, conditionTracker.mSlicedConditionState.size());
+        ASSERT_EQ(1UL, conditionTracker.mState->slicedConditionState.size());
         EXPECT_TRUE(changedCache[0]);
         ASSERT_EQ(conditionTracker.getChangedToTrueDimensions(allConditions)->size(), 1u);
         EXPECT_TRUE(conditionTracker.getChangedToFalseDimensions(allConditions)->empty());
@@ -447,7 +447,7 @@ TEST_P(SimpleConditionTrackerTest, TestSlicedCondition) {
         conditionTracker.evaluateCondition(event2, matcherState, allPredicates, conditionCache,
                                            changedCache);
         EXPECT_FALSE(changedCache[0]);
-        ASSERT_EQ(1UL, conditionTracker.mSlicedConditionState.size());
+        ASSERT_EQ(1UL, conditionTracker.mState->slicedConditionState.size());
         EXPECT_TRUE(conditionTracker.getChangedToTrueDimensions(allConditions)->empty());
         EXPECT_TRUE(conditionTracker.getChangedToFalseDimensions(allConditions)->empty());
 
@@ -463,7 +463,7 @@ TEST_P(SimpleConditionTrackerTest, TestSlicedCondition) {
                                            changedCache);
         // nothing changes, because wake lock 2 is still held for this uid
         EXPECT_FALSE(changedCache[0]);
-        ASSERT_EQ(1UL, conditionTracker.mSlicedConditionState.size());
+        ASSERT_EQ(1UL, conditionTracker.mState->slicedConditionState.size());
         EXPECT_TRUE(conditionTracker.getChangedToTrueDimensions(allConditions)->empty());
         EXPECT_TRUE(conditionTracker.getChangedToFalseDimensions(allConditions)->empty());
 
@@ -477,7 +477,7 @@ TEST_P(SimpleConditionTrackerTest, TestSlicedCondition) {
         conditionTracker.evaluateCondition(event4, matcherState, allPredicates, conditionCache,
                                            changedCache);
 
-        ASSERT_EQ(conditionTracker.mSlicedConditionState.size(),
+        ASSERT_EQ(conditionTracker.mState->slicedConditionState.size(),
                   GetParam() == SimplePredicate_InitialValue_FALSE ? 0 : 1);
         EXPECT_TRUE(changedCache[0]);
         ASSERT_EQ(conditionTracker.getChangedToFalseDimensions(allConditions)->size(), 1u);
@@ -529,7 +529,7 @@ TEST(SimpleConditionTrackerTest, TestSlicedWithNoOutputDim) {
     conditionTracker.evaluateCondition(event1, matcherState, allPredicates, conditionCache,
                                        changedCache);
 
-    ASSERT_EQ(1UL, conditionTracker.mSlicedConditionState.size());
+    ASSERT_EQ(1UL, conditionTracker.mState->slicedConditionState.size());
     EXPECT_TRUE(changedCache[0]);
 
     // Now test query
@@ -577,7 +577,7 @@ TEST(SimpleConditionTrackerTest, TestSlicedWithNoOutputDim) {
     changedCache[0] = false;
     conditionTracker.evaluateCondition(event4, matcherState, allPredicates, conditionCache,
                                        changedCache);
-    ASSERT_EQ(0UL, conditionTracker.mSlicedConditionState.size());
+    ASSERT_EQ(0UL, conditionTracker.mState->slicedConditionState.size());
     EXPECT_TRUE(changedCache[0]);
 
     // query again
@@ -620,7 +620,7 @@ TEST_P(SimpleConditionTrackerTest, TestStopAll) {
 
         conditionTracker.evaluateCondition(event1, matcherState, allPredicates, conditionCache,
                                            changedCache);
-        ASSERT_EQ(1UL, conditionTracker.mSlicedConditionState.size());
+        ASSERT_EQ(1UL, conditionTracker.mState->slicedConditionState.size());
         EXPECT_TRUE(changedCache[0]);
         ASSERT_EQ(1UL, conditionTracker.getChangedToTrueDimensions(allConditions)->size());
         EXPECT_TRUE(conditionTracker.getChangedToFalseDimensions(allConditions)->empty());
@@ -644,7 +644,7 @@ TEST_P(SimpleConditionTrackerTest, TestStopAll) {
         changedCache[0] = false;
         conditionTracker.evaluateCondition(event2, matcherState, allPredicates, conditionCache,
                                            changedCache);
-        ASSERT_EQ(2UL, conditionTracker.mSlicedConditionState.size());
+        ASSERT_EQ(2UL, conditionTracker.mState->slicedConditionState.size());
 
         EXPECT_TRUE(changedCache[0]);
         ASSERT_EQ(1UL, conditionTracker.getChangedToTrueDimensions(allConditions)->size());
@@ -671,7 +671,7 @@ TEST_P(SimpleConditionTrackerTest, TestStopAll) {
         conditionTracker.evaluateCondition(event3, matcherState, allPredicates, conditionCache,
                                            changedCache);
         EXPECT_TRUE(changedCache[0]);
-        ASSERT_EQ(0UL, conditionTracker.mSlicedConditionState.size());
+        ASSERT_EQ(0UL, conditionTracker.mState->slicedConditionState.size());
         ASSERT_EQ(2UL, conditionTracker.getChangedToFalseDimensions(allConditions)->size());
         EXPECT_TRUE(conditionTracker.getChangedToTrueDimensions(allConditions)->empty());
 
@@ -719,7 +719,7 @@ TEST(SimpleConditionTrackerTest, TestGuardrailNotHitWhenDefaultFalse) {
         conditionTracker.evaluateCondition(event, matcherState, allPredicates, conditionCache,
                                            changedCache);
 
-        ASSERT_EQ(1UL, conditionTracker.mSlicedConditionState.size());
+        ASSERT_EQ(1UL, conditionTracker.mState->slicedConditionState.size());
 
         LogEvent event2(/*uid=*/0, /*pid=*/0);
         makeWakeLockEvent(&event2, /*uids=*/{i}, "wl", /*acquire=*/0);
@@ -731,7 +731,7 @@ TEST(SimpleConditionTrackerTest, TestGuardrailNotHitWhenDefaultFalse) {
         conditionTracker.evaluateCondition(event2, matcherState, allPredicates, conditionCache,
                                            changedCache);
         // wakelock is now released, key is cleared from map since the default value is false.
-        ASSERT_EQ(0UL, conditionTracker.mSlicedConditionState.size());
+        ASSERT_EQ(0UL, conditionTracker.mState->slicedConditionState.size());
     }
 }
 
@@ -766,7 +766,7 @@ TEST(SimpleConditionTrackerTest, TestGuardrailHitWhenDefaultUnknown) {
         conditionTracker.evaluateCondition(event, matcherState, allPredicates, conditionCache,
                                            changedCache);
 
-        ASSERT_EQ(i + 1, conditionTracker.mSlicedConditionState.size());
+        ASSERT_EQ(i + 1, conditionTracker.mState->slicedConditionState.size());
 
         LogEvent event2(/*uid=*/0, /*pid=*/0);
         makeWakeLockEvent(&event2, /*uids=*/{i}, "wl", /*acquire=*/0);
@@ -778,11 +778,11 @@ TEST(SimpleConditionTrackerTest, TestGuardrailHitWhenDefaultUnknown) {
         conditionTracker.evaluateCondition(event2, matcherState, allPredicates, conditionCache,
                                            changedCache);
         // wakelock is now released, key is not cleared from map since the default value is unknown.
-        ASSERT_EQ(i + 1, conditionTracker.mSlicedConditionState.size());
+        ASSERT_EQ(i + 1, conditionTracker.mState->slicedConditionState.size());
     }
 
     ASSERT_EQ(StatsdStats::kDimensionKeySizeHardLimit,
-              conditionTracker.mSlicedConditionState.size());
+              conditionTracker.mState->slicedConditionState.size());
     // one more acquire after the guardrail is hit.
     LogEvent event3(/*uid=*/0, /*pid=*/0);
     makeWakeLockEvent(&event3, /*uids=*/{i}, "wl", /*acquire=*/1);
@@ -797,9 +797,209 @@ TEST(SimpleConditionTrackerTest, TestGuardrailHitWhenDefaultUnknown) {
                                        changedCache);
 
     ASSERT_EQ(StatsdStats::kDimensionKeySizeHardLimit,
-              conditionTracker.mSlicedConditionState.size());
+              conditionTracker.mState->slicedConditionState.size());
     EXPECT_EQ(conditionCache[0], ConditionState::kUnknown);
 }
+
+TEST(SimpleConditionTrackerTest, TestMaxDimensionKeysEvictsLeastRecentlyUsed) {
+    SimplePredicate simplePredicate =
+            getWakeLockHeldCondition(true /*nesting*/, SimplePredicate_InitialValue_FALSE,
+                                     true /*output slice by uid*/, Position::FIRST);
+    simplePredicate.set_max_dimension_keys(2);
+    string conditionName = "WL_HELD_BY_UID";
+
+    unordered_map<int64_t, int> trackerNameIndexMap;
+    trackerNameIndexMap[StringToId("WAKE_LOCK_ACQUIRE")] = 0;
+    trackerNameIndexMap[StringToId("WAKE_LOCK_RELEASE")] = 1;
+    trackerNameIndexMap[StringToId("RELEASE_ALL")] = 2;
+
+    SimpleConditionTracker conditionTracker(kConfigKey, StringToId(conditionName), protoHash,
+                                            0 /*condition tracker index*/, simplePredicate,
+                                            trackerNameIndexMap);
+    vector<sp<ConditionTracker>> allPredicates;
+    const auto acquire = [&](int uid) {
+        LogEvent event(/*uid=*/0, /*pid=*/0);
+        makeWakeLockEvent(&event, /*uids=*/{uid}, "wl", /*acquire=*/1);
+        vector<MatchingState> matcherState = {MatchingState::kMatched, MatchingState::kNotMatched,
+                                              MatchingState::kNotMatched};
+        vector<ConditionState> conditionCache(1, ConditionState::kNotEvaluated);
+        vector<bool> changedCache(1, false);
+        conditionTracker.evaluateCondition(event, matcherState, allPredicates, conditionCache,
+                                           changedCache);
+        EXPECT_TRUE(changedCache[0]);
+    };
+    const auto isHeld = [&](int uid) {
+        vector<ConditionState> conditionCache(1, ConditionState::kNotEvaluated);
+        conditionTracker.isConditionMet(getWakeLockQueryKey(Position::FIRST, {uid}, conditionName),
+                                        allPredicates, false, conditionCache);
+        return conditionCache[0] == ConditionState::kTrue;
+    };
+
+    acquire(111);
+    acquire(222);
+    // 111 is used again, so 222 is the least recently used key.
+    acquire(111);
+    acquire(333);
+    ASSERT_EQ(2UL, conditionTracker.mState->slicedConditionState.size());
+    EXPECT_TRUE(isHeld(111));
+    EXPECT_FALSE(isHeld(222));
+    EXPECT_TRUE(isHeld(333));
+
+    // The evicted key is reported as changed, along with the new one.
+    ASSERT_EQ(1UL, conditionTracker.getChangedToTrueDimensions(allPredicates)->size());
+    ASSERT_EQ(1UL, conditionTracker.getChangedToFalseDimensions(allPredicates)->size());
+    EXPECT_EQ(2UL, conditionTracker.mState->keysByRecency.size());
+}
+
+TEST(SimpleConditionTrackerTest, TestSharedStateAcrossConfigs) {
+    SimplePredicate simplePredicate =
+            getWakeLockHeldCondition(true /*nesting*/, SimplePredicate_InitialValue_FALSE,
+                                     true /*output slice by uid*/, Position::FIRST);
+    unordered_map<int64_t, int> trackerNameIndexMap;
+    trackerNameIndexMap[StringToId("WAKE_LOCK_ACQUIRE")] = 0;
+    trackerNameIndexMap[StringToId("WAKE_LOCK_RELEASE")] = 1;
+    trackerNameIndexMap[StringToId("RELEASE_ALL")] = 2;
+    const string sharedKey = "TestSharedStateAcrossConfigs";
+
+    SimpleConditionTracker tracker1(ConfigKey(1, 12345), StringToId("WL_HELD_BY_UID"), protoHash,
+                                    0 /*condition tracker index*/, simplePredicate,
+                                    trackerNameIndexMap);
+    SimpleConditionTracker tracker2(ConfigKey(2, 12345), StringToId("WL_HELD_BY_UID"), protoHash,
+                                    0 /*condition tracker index*/, simplePredicate,
+                                    trackerNameIndexMap);
+    tracker1.shareState(sharedKey);
+    tracker2.shareState(sharedKey);
+    EXPECT_EQ(tracker1.mState, tracker2.mState);
+
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    makeWakeLockEvent(&event, /*uids=*/{111}, "wl", /*acquire=*/1);
+    vector<MatchingState> matcherState = {MatchingState::kMatched, MatchingState::kNotMatched,
+                                          MatchingState::kNotMatched};
+    vector<sp<ConditionTracker>> allPredicates;
+    for (SimpleConditionTracker* tracker : {&tracker1, &tracker2}) {
+        vector<ConditionState> conditionCache(1, ConditionState::kNotEvaluated);
+        vector<bool> changedCache(1, false);
+        tracker->evaluateCondition(event, matcherState, allPredicates, conditionCache,
+                                   changedCache);
+        EXPECT_EQ(ConditionState::kTrue, conditionCache[0]);
+        EXPECT_TRUE(changedCache[0]);
+    }
+    // The second tracker reused the outcome rather than counting the start again.
+    ASSERT_EQ(1UL, tracker1.mState->slicedConditionState.size());
+    EXPECT_EQ(1, tracker1.mState->slicedConditionState.begin()->second);
+
+    // A tracker added once the state saw an event starts from its own state.
+    SimpleConditionTracker tracker3(ConfigKey(3, 12345), StringToId("WL_HELD_BY_UID"), protoHash,
+                                    0 /*condition tracker index*/, simplePredicate,
+                                    trackerNameIndexMap);
+    tracker3.shareState(sharedKey);
+    EXPECT_NE(tracker1.mState, tracker3.mState);
+    EXPECT_TRUE(tracker3.mState->slicedConditionState.empty());
+
+    // A tracker that stops sharing keeps a copy of the state.
+    tracker2.shareState("");
+    EXPECT_NE(tracker1.mState, tracker2.mState);
+    EXPECT_EQ(1UL, tracker2.mState->slicedConditionState.size());
+}
+
+TEST(SimpleConditionTrackerTest, TestDimensionCardinality) {
+    SimplePredicate simplePredicate =
+            getWakeLockHeldCondition(true /*nesting*/, SimplePredicate_InitialValue_FALSE,
+                                     true /*output slice by uid*/, Position::FIRST);
+    unordered_map<int64_t, int> trackerNameIndexMap;
+    trackerNameIndexMap[StringToId("WAKE_LOCK_ACQUIRE")] = 0;
+    trackerNameIndexMap[StringToId("WAKE_LOCK_RELEASE")] = 1;
+    trackerNameIndexMap[StringToId("RELEASE_ALL")] = 2;
+
+    SimpleConditionTracker conditionTracker(kConfigKey, StringToId("WL_HELD_BY_UID"), protoHash,
+                                            0 /*condition tracker index*/, simplePredicate,
+                                            trackerNameIndexMap);
+    EXPECT_EQ(nullptr, conditionTracker.mDimensionCardinality);
+    conditionTracker.setDimensionCardinalityEstimate(true);
+    ASSERT_NE(nullptr, conditionTracker.mDimensionCardinality);
+
+    vector<sp<ConditionTracker>> allPredicates;
+    for (int uid : {111, 222, 111, 333}) {
+        LogEvent event(/*uid=*/0, /*pid=*/0);
+        makeWakeLockEvent(&event, /*uids=*/{uid}, "wl", /*acquire=*/1);
+        vector<MatchingState> matcherState = {MatchingState::kMatched, MatchingState::kNotMatched,
+                                              MatchingState::kNotMatched};
+        vector<ConditionState> conditionCache(1, ConditionState::kNotEvaluated);
+        vector<bool> changedCache(1, false);
+        conditionTracker.evaluateCondition(event, matcherState, allPredicates, conditionCache,
+                                           changedCache);
+    }
+    EXPECT_EQ(3, conditionTracker.mDimensionCardinality->estimate());
+    EXPECT_EQ(3, conditionTracker.mReportedCardinality);
+
+    // A config update restarts the estimate, or drops it.
+    conditionTracker.setDimensionCardinalityEstimate(true);
+    ASSERT_NE(nullptr, conditionTracker.mDimensionCardinality);
+    EXPECT_EQ(0, conditionTracker.mDimensionCardinality->estimate());
+    EXPECT_EQ(0, conditionTracker.mReportedCardinality);
+    conditionTracker.setDimensionCardinalityEstimate(false);
+    EXPECT_EQ(nullptr, conditionTracker.mDimensionCardinality);
+}
+
+TEST(SimpleConditionTrackerTest, TestSlicedKeyFilter) {
+    SimplePredicate simplePredicate =
+            getWakeLockHeldCondition(true /*nesting*/, SimplePredicate_InitialValue_FALSE,
+                                     true /*output slice by uid*/, Position::FIRST);
+    string conditionName = "WL_HELD_BY_UID";
+    unordered_map<int64_t, int> trackerNameIndexMap;
+    trackerNameIndexMap[StringToId("WAKE_LOCK_ACQUIRE")] = 0;
+    trackerNameIndexMap[StringToId("WAKE_LOCK_RELEASE")] = 1;
+    trackerNameIndexMap[StringToId("RELEASE_ALL")] = 2;
+
+    SimpleConditionTracker conditionTracker(kConfigKey, StringToId(conditionName), protoHash,
+                                            0 /*condition tracker index*/, simplePredicate,
+                                            trackerNameIndexMap);
+
+    // Enough keys for the filter to be rebuilt a few times.
+    vector<sp<ConditionTracker>> allPredicates;
+    vector<ConditionState> conditionCache(1, ConditionState::kNotEvaluated);
+    vector<bool> changedCache(1, false);
+    const int keyCount = 100;
+    for (int uid = 0; uid < keyCount; uid++) {
+        LogEvent event(/*uid=*/0, /*pid=*/0);
+        makeWakeLockEvent(&event, /*uids=*/{uid}, "wl", /*acquire=*/1);
+        vector<MatchingState> matcherState = {MatchingState::kMatched, MatchingState::kNotMatched,
+                                              MatchingState::kNotMatched};
+        conditionCache[0] = ConditionState::kNotEvaluated;
+        conditionTracker.evaluateCondition(event, matcherState, allPredicates, conditionCache,
+                                           changedCache);
+        EXPECT_TRUE(changedCache[0]);
+    }
+    ASSERT_EQ((size_t)keyCount, conditionTracker.mState->slicedConditionState.size());
+    EXPECT_FALSE(conditionTracker.mState->slicedKeyFilter.isFull());
+
+    // The filter has no false negatives.
+    for (const auto& [key, _] : conditionTracker.mState->slicedConditionState) {
+        EXPECT_TRUE(conditionTracker.mState->slicedKeyFilter.mayContain(key.getHash()));
+    }
+    for (int uid = 0; uid < keyCount; uid++) {
+        const auto queryKey = getWakeLockQueryKey(Position::FIRST, {uid}, conditionName);
+        conditionCache[0] = ConditionState::kNotEvaluated;
+        conditionTracker.isConditionMet(queryKey, allPredicates, false, conditionCache);
+        EXPECT_EQ(ConditionState::kTrue, conditionCache[0]);
+    }
+    const auto newQueryKey = getWakeLockQueryKey(Position::FIRST, {keyCount}, conditionName);
+    conditionCache[0] = ConditionState::kNotEvaluated;
+    conditionTracker.isConditionMet(newQueryKey, allPredicates, false, conditionCache);
+    EXPECT_EQ(ConditionState::kFalse, conditionCache[0]);
+
+    // Stop all clears the filter with the keys.
+    LogEvent stopAllEvent(/*uid=*/0, /*pid=*/0);
+    makeWakeLockEvent(&stopAllEvent, /*uids=*/{0}, "wl", /*acquire=*/1);
+    vector<MatchingState> matcherState = {MatchingState::kNotMatched, MatchingState::kNotMatched,
+                                          MatchingState::kMatched};
+    conditionTracker.evaluateCondition(stopAllEvent, matcherState, allPredicates, conditionCache,
+                                       changedCache);
+    EXPECT_TRUE(conditionTracker.mState->slicedConditionState.empty());
+    const auto firstQueryKey = getWakeLockQueryKey(Position::FIRST, {0}, conditionName);
+    const HashableDimensionKey& firstKey = firstQueryKey.at(StringToId(conditionName));
+    EXPECT_FALSE(conditionTracker.mState->slicedKeyFilter.mayContain(firstKey.getHash()));
+}
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -381,6 +381,46 @@ TEST(AnomalyDetectionE2eTest, TestCountMetric_load_refractory_from_disk) {
               mockElapsedTimeNs / NS_PER_SEC);
 }
 
+TEST(AnomalyDetectionE2eTest, TestCountMetric_save_refractory_after_wall_clock_change) {
+    const int num_buckets = 1;
+    const int threshold = 0;
+    const int refractory_period_sec = 86400 * 365; // 1 year
+    auto config = CreateStatsdConfig(num_buckets, threshold, refractory_period_sec);
+
+    int64_t bucketStartTimeNs = 10000000000;
+    ConfigKey cfgKey(2000, 1000);
+    auto processor = CreateStatsLogProcessor(bucketStartTimeNs, bucketStartTimeNs, config, cfgKey);
+    ASSERT_EQ(processor->mMetricsManagers.size(), 1u);
+    sp<AnomalyTracker> anomalyTracker =
+            processor->mMetricsManagers.begin()->second->mAllAnomalyTrackers[0];
+
+    FieldValue fieldValue1(Field(util::WAKELOCK_STATE_CHANGED, (int32_t)0x02010101),
+                           Value((int32_t)111));
+    MetricDimensionKey dimensionKey1(HashableDimensionKey({fieldValue1}), DEFAULT_DIMENSION_KEY);
+    auto event = CreateAcquireWakelockEvent(bucketStartTimeNs + 2, {111}, {"App1"}, "wl1");
+    processor->OnLogEvent(event.get());
+
+    int64_t mockWallClockNs = 1584991200 * NS_PER_SEC;
+    int64_t mockElapsedTimeNs = bucketStartTimeNs + 5000 * NS_PER_SEC;
+    processor->SaveMetadataToDisk(mockWallClockNs, mockElapsedTimeNs);
+
+    // The wall clock is set an hour forward. The saved metadata is converted again.
+    const int64_t wallClockChangeNs = 3600 * NS_PER_SEC;
+    processor->mLastMetadataWriteNs = 0;
+    processor->SaveMetadataToDisk(mockWallClockNs + wallClockChangeNs, mockElapsedTimeNs);
+
+    auto processor2 = CreateStatsLogProcessor(bucketStartTimeNs, bucketStartTimeNs, config, cfgKey);
+    int64_t mockElapsedTimeSinceBoot = 10 * NS_PER_SEC;
+    processor2->LoadMetadataFromDisk(mockWallClockNs + wallClockChangeNs,
+                                     mockElapsedTimeSinceBoot);
+    sp<AnomalyTracker> anomalyTracker2 =
+            processor2->mMetricsManagers.begin()->second->mAllAnomalyTrackers[0];
+    EXPECT_EQ(anomalyTracker2->getRefractoryPeriodEndsSec(dimensionKey1) -
+              mockElapsedTimeSinceBoot / NS_PER_SEC,
+              anomalyTracker->getRefractoryPeriodEndsSec(dimensionKey1) -
+              mockElapsedTimeNs / NS_PER_SEC);
+}
+
 #else
 GTEST_LOG_(INFO) << "This test does nothing.\n";
 #endif
@@ -17,6 +17,7 @@
 #include <vector>
 
 #include "src/StatsLogProcessor.h"
+#include "src/metrics/DurationMetricProducer.h"
 #include "src/state/StateTracker.h"
 #include "src/stats_log_util.h"
 #include "tests/statsd_test_util.h"
@@ -515,6 +516,12 @@ TEST(DurationMetricE2eTest, TestWithSlicedCondition) {
                                             attributionTags1, "wl1");  // 0:10
     processor->OnLogEvent(event.get());
 
+    // The condition changes reach the tracker through the key of the app's uid.
+    DurationMetricProducer* durationProducer =
+            static_cast<DurationMetricProducer*>(metricProducer.get());
+    ASSERT_EQ(1, durationProducer->mLinkedConditionKeyToWhatKeys.size());
+    EXPECT_EQ(1, durationProducer->mLinkedConditionKeyToWhatKeys.begin()->second.size());
+
     event = CreateMoveToBackgroundEvent(bucketStartTimeNs + 22 * NS_PER_SEC, appUid);  // 0:22
     processor->OnLogEvent(event.get());
 
@@ -554,6 +561,9 @@ TEST(DurationMetricE2eTest, TestWithSlicedCondition) {
     EXPECT_EQ(bucketStartTimeNs, bucketInfo.start_bucket_elapsed_nanos());
     EXPECT_EQ(bucketStartTimeNs + bucketSizeNs, bucketInfo.end_bucket_elapsed_nanos());
     EXPECT_EQ(38 * NS_PER_SEC, bucketInfo.duration_nanos());
+
+    // The tracker is dropped with the bucket, and so is its key.
+    EXPECT_TRUE(durationProducer->mLinkedConditionKeyToWhatKeys.empty());
 }
 
 TEST(DurationMetricE2eTest, TestWithActivationAndSlicedCondition) {
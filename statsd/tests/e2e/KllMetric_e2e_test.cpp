@@ -89,6 +89,42 @@ TEST_F(KllMetricE2eTest, TestSimpleMetric) {
     EXPECT_EQ(metricReport.kll_metrics().skipped_size(), 0);
 }
 
+TEST_F(KllMetricE2eTest, TestReportQuantiles) {
+    config.mutable_kll_metric(0)->add_report_quantiles(0);
+    config.mutable_kll_metric(0)->add_report_quantiles(0.5);
+    config.mutable_kll_metric(0)->add_report_quantiles(1);
+    const sp<StatsLogProcessor> processor =
+            CreateStatsLogProcessor(bucketStartTimeNs, bucketStartTimeNs, config, key);
+
+    for (auto& event : events) {
+        processor->OnLogEvent(event.get());
+    }
+
+    ConfigMetricsReportList reports;
+    vector<uint8_t> buffer;
+    processor->onDumpReport(key, bucketStartTimeNs + bucketSizeNs, true, true, ADB_DUMP, FAST,
+                            &buffer);
+    EXPECT_TRUE(reports.ParseFromArray(&buffer[0], buffer.size()));
+    ASSERT_EQ(reports.reports_size(), 1);
+    ASSERT_EQ(reports.reports(0).metrics_size(), 1);
+    const StatsLogReport& metricReport = reports.reports(0).metrics(0);
+    ASSERT_EQ(metricReport.kll_metrics().data_size(), 1);
+    ASSERT_EQ(metricReport.kll_metrics().data(0).bucket_info_size(), 1);
+    const KllBucketInfo& bucket = metricReport.kll_metrics().data(0).bucket_info(0);
+    ASSERT_EQ(bucket.sketches_size(), 1);
+    EXPECT_FALSE(bucket.sketches(0).has_kll_sketch());
+    EXPECT_THAT(bucket.sketches(0).quantile_values(), testing::ElementsAre(5, 15, 40));
+}
+
+TEST_F(KllMetricE2eTest, TestInitWithInvalidReportQuantile) {
+    config.mutable_kll_metric(0)->add_report_quantiles(1.5);
+    const sp<StatsLogProcessor> processor =
+            CreateStatsLogProcessor(bucketStartTimeNs, bucketStartTimeNs, config, key);
+
+    // Config initialization fails.
+    ASSERT_EQ(0, processor->mMetricsManagers.size());
+}
+
 TEST_F(KllMetricE2eTest, TestInitWithKllFieldPositionALL) {
     // Create config.
     StatsdConfig config;
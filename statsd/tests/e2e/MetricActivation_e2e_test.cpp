@@ -310,6 +310,9 @@ TEST(MetricActivationE2eTest, TestCountMetric) {
     EXPECT_EQ(eventActivationMap[2]->state, ActivationState::kNotActive);
     EXPECT_EQ(eventActivationMap[2]->start_ns, 0);
     EXPECT_EQ(eventActivationMap[2]->ttl_ns, 60 * 2 * NS_PER_SEC);
+    // The metrics are only flushed again once the activation can expire.
+    EXPECT_EQ(metricsManager->mNextActivationExpiryNs,
+              bucketStartTimeNs + 10 + 60 * 6 * NS_PER_SEC);
 
     // First processed event.
     event = CreateAppCrashEvent(bucketStartTimeNs + 15, 222);
@@ -326,6 +329,8 @@ TEST(MetricActivationE2eTest, TestCountMetric) {
     EXPECT_EQ(eventActivationMap[2]->state, ActivationState::kActive);
     EXPECT_EQ(eventActivationMap[2]->start_ns, bucketStartTimeNs + 20);
     EXPECT_EQ(eventActivationMap[2]->ttl_ns, 60 * 2 * NS_PER_SEC);
+    EXPECT_EQ(metricsManager->mNextActivationExpiryNs,
+              bucketStartTimeNs + 20 + 60 * 2 * NS_PER_SEC);
 
     // 2nd processed event.
     // The activation by screen_on event expires, but the one by battery save mode is still active.
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/external/Perfetto.h"
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+
+#include <string>
+
+#include "src/config/ConfigKey.h"
+#include "src/statsd_config.pb.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using android::base::ReadFileToString;
+using android::base::StringPrintf;
+using android::base::WriteStringToFile;
+using std::string;
+
+namespace {
+
+const ConfigKey kConfigKey(1005, 12345);
+
+// Runs CollectPerfettoTraceAndUploadToDropbox() against a script that records its arguments and
+// the config read from stdin instead of the perfetto cmdline util, launched with vfork() when the
+// param is true.
+class PerfettoTest : public testing::TestWithParam<bool> {
+public:
+    static std::string ToString(testing::TestParamInfo<bool> info) {
+        return info.param ? "Vfork" : "Fork";
+    }
+
+protected:
+    void SetUp() override {
+        mBinary = StringPrintf("%s/perfetto", mDir.path);
+        mArgsPath = StringPrintf("%s/args", mDir.path);
+        mConfigPath = StringPrintf("%s/config", mDir.path);
+        const string script = StringPrintf("#!/system/bin/sh\necho \"$@\" > %s\ncat > %s\n",
+                                           mArgsPath.c_str(), mConfigPath.c_str());
+        ASSERT_TRUE(WriteStringToFile(script, mBinary));
+        ASSERT_EQ(0, chmod(mBinary.c_str(), 0700));
+        setPerfettoBinaryPath(mBinary.c_str());
+        setPerfettoLaunchWithVfork(GetParam());
+    }
+
+    void TearDown() override {
+        setPerfettoBinaryPath(nullptr);
+        setPerfettoLaunchWithVfork(false);
+    }
+
+    TemporaryDir mDir;
+    string mBinary;
+    string mArgsPath;
+    string mConfigPath;
+};
+
+INSTANTIATE_TEST_SUITE_P(Launch, PerfettoTest, testing::Bool(), PerfettoTest::ToString);
+
+}  // namespace
+
+TEST_P(PerfettoTest, TestCollectTrace) {
+    PerfettoDetails config;
+    config.set_trace_config("trace config");
+    ASSERT_TRUE(CollectPerfettoTraceAndUploadToDropbox(config, /*subscription_id=*/2,
+                                                       /*alert_id=*/3, kConfigKey));
+
+    // The script has exited, so its output is complete.
+    string args;
+    ASSERT_TRUE(ReadFileToString(mArgsPath, &args));
+    EXPECT_EQ("--background --config - --dropbox perfetto --alert-id 3 --config-id 12345 "
+              "--config-uid 1005 --subscription-id 2\n",
+              args);
+    string readConfig;
+    ASSERT_TRUE(ReadFileToString(mConfigPath, &readConfig));
+    EXPECT_EQ("trace config", readConfig);
+}
+
+TEST_P(PerfettoTest, TestEmptyConfig) {
+    PerfettoDetails config;
+    EXPECT_FALSE(CollectPerfettoTraceAndUploadToDropbox(config, /*subscription_id=*/2,
+                                                        /*alert_id=*/3, kConfigKey));
+    string args;
+    EXPECT_FALSE(ReadFileToString(mArgsPath, &args));
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
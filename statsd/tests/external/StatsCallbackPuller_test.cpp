@@ -16,6 +16,7 @@
 
 #include <aidl/android/os/BnPullAtomCallback.h>
 #include <aidl/android/os/IPullAtomResultReceiver.h>
+#include <aidl/android/util/StatsEventListParcel.h>
 #include <aidl/android/util/StatsEventParcel.h>
 #include <android/binder_interface_utils.h>
 #include <gmock/gmock.h>
@@ -41,6 +42,7 @@ using namespace testing;
 using Status = ::ndk::ScopedAStatus;
 using aidl::android::os::BnPullAtomCallback;
 using aidl::android::os::IPullAtomResultReceiver;
+using aidl::android::util::StatsEventListParcel;
 using aidl::android::util::StatsEventParcel;
 using ::ndk::SharedRefBase;
 using std::make_shared;
@@ -56,6 +58,13 @@ vector<int64_t> values;
 int64_t pullDelayNs;
 int64_t pullTimeoutNs;
 int64_t pullCoolDownNs;
+// Whether the events are sent in pages of one, but the last.
+bool pullInPages;
+// Whether the events are packed in one buffer, whether its offsets are out of bounds, and
+// whether the buffer starts with bytes that belong to no event.
+bool pullPacked;
+bool pullMalformed;
+bool pullLeadingBytes;
 std::thread pullThread;
 
 AStatsEvent* createSimpleEvent(int64_t value) {
@@ -83,6 +92,27 @@ void executePull(const shared_ptr<IPullAtomResultReceiver>& resultReceiver) {
     }
 
     sleep_for(std::chrono::nanoseconds(pullDelayNs));
+    if (pullPacked) {
+        StatsEventListParcel packed;
+        if (pullLeadingBytes) {
+            packed.buffer.push_back(0);
+        }
+        for (const StatsEventParcel& parcel : parcels) {
+            packed.offsets.push_back(packed.buffer.size());
+            packed.buffer.insert(packed.buffer.end(), parcel.buffer.begin(), parcel.buffer.end());
+        }
+        if (pullMalformed) {
+            packed.offsets.push_back(packed.buffer.size() + 1);
+        }
+        resultReceiver->pullFinishedPacked(pullTagId, pullSuccess, packed);
+        return;
+    }
+    if (pullInPages && !parcels.empty()) {
+        for (size_t i = 0; i + 1 < parcels.size(); i++) {
+            resultReceiver->pullChunk(pullTagId, {parcels[i]});
+        }
+        parcels.erase(parcels.begin(), parcels.end() - 1);
+    }
     resultReceiver->pullFinished(pullTagId, pullSuccess, parcels);
 }
 
@@ -104,6 +134,10 @@ public:
     void SetUp() override {
         pullSuccess = false;
         pullDelayNs = 0;
+        pullInPages = false;
+        pullPacked = false;
+        pullMalformed = false;
+        pullLeadingBytes = false;
         values.clear();
         pullTimeoutNs = 10000000000LL;  // 10 seconds.
         pullCoolDownNs = 1000000000;    // 1 second.
@@ -152,6 +186,110 @@ TEST_F(StatsCallbackPullerTest, PullFail) {
     ASSERT_EQ(0, dataHolder.size());
 }
 
+TEST_F(StatsCallbackPullerTest, PullInPages) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    pullSuccess = true;
+    pullInPages = true;
+    values = {1, 2, 3};
+
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {});
+
+    vector<shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_SUCCESS);
+    ASSERT_EQ(3, dataHolder.size());
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(values[i], dataHolder[i]->getValues()[0].mValue.int_value);
+    }
+}
+
+TEST_F(StatsCallbackPullerTest, PullInPagesFail) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    pullSuccess = false;
+    pullInPages = true;
+    values = {1, 2, 3};
+
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {});
+
+    // The pages already received are discarded.
+    vector<shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_FAIL);
+    ASSERT_EQ(0, dataHolder.size());
+}
+
+TEST_F(StatsCallbackPullerTest, PullPacked) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    pullSuccess = true;
+    pullPacked = true;
+    values = {1, 2, 3};
+
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {});
+
+    vector<shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_SUCCESS);
+    ASSERT_EQ(3, dataHolder.size());
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(pullTagId, dataHolder[i]->GetTagId());
+        EXPECT_EQ(values[i], dataHolder[i]->getValues()[0].mValue.int_value);
+    }
+}
+
+TEST_F(StatsCallbackPullerTest, PulledEventsShareOneAllocation) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    pullSuccess = true;
+    values = {1, 2, 3};
+
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {});
+
+    vector<shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_SUCCESS);
+    ASSERT_EQ(3, dataHolder.size());
+    const uint8_t* first = reinterpret_cast<const uint8_t*>(dataHolder[0].get());
+    const uint8_t* second = reinterpret_cast<const uint8_t*>(dataHolder[1].get());
+    const uint8_t* third = reinterpret_cast<const uint8_t*>(dataHolder[2].get());
+    EXPECT_EQ(second - first, third - second);
+
+    // Each event is released on its own, the others stay valid.
+    EXPECT_EQ(1, dataHolder[0].use_count());
+    std::weak_ptr<LogEvent> dropped = dataHolder[0];
+    dataHolder.erase(dataHolder.begin());
+    EXPECT_TRUE(dropped.expired());
+    EXPECT_EQ(2, dataHolder[0]->getValues()[0].mValue.int_value);
+    EXPECT_EQ(3, dataHolder[1]->getValues()[0].mValue.int_value);
+}
+
+TEST_F(StatsCallbackPullerTest, PullPackedMalformed) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    pullSuccess = true;
+    pullPacked = true;
+    pullMalformed = true;
+    values = {1, 2, 3};
+
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {});
+
+    vector<shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_FAIL);
+    ASSERT_EQ(0, dataHolder.size());
+}
+
+TEST_F(StatsCallbackPullerTest, PullPackedLeadingBytes) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    pullSuccess = true;
+    pullPacked = true;
+    pullLeadingBytes = true;
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {});
+    vector<shared_ptr<LogEvent>> dataHolder;
+
+    // A buffer with no offsets must be empty.
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_FAIL);
+    ASSERT_EQ(0, dataHolder.size());
+    pullThread.join();
+
+    // The first event must start the buffer.
+    values = {1, 2};
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_FAIL);
+    ASSERT_EQ(0, dataHolder.size());
+}
+
 TEST_F(StatsCallbackPullerTest, PullTimeout) {
     shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
     pullSuccess = true;
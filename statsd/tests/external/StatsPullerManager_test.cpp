@@ -19,6 +19,7 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include "src/guardrail/StatsdStats.h"
 #include "stats_event.h"
 #include "tests/statsd_test_util.h"
 
@@ -40,6 +41,7 @@ int uid1 = 9999;
 int uid2 = 8888;
 ConfigKey configKey(50, 12345);
 ConfigKey badConfigKey(60, 54321);
+ConfigKey configKey2(70, 7777);
 int unregisteredUid = 98765;
 int64_t coolDownNs = NS_PER_SEC;
 int64_t timeoutNs = NS_PER_SEC / 2;
@@ -86,6 +88,46 @@ public:
     }
 };
 
+class FakePullDataReceiver : public PullDataReceiver {
+public:
+    void onDataPulled(const vector<shared_ptr<LogEvent>>& data, bool pullSuccess,
+                      int64_t originalPullTimeNs) override {
+        pulls.push_back({pullSuccess, data});
+        pullTimesNs.push_back(originalPullTimeNs);
+    }
+    void onDeferredDataPulled(const vector<shared_ptr<LogEvent>>& data, bool pullSuccess,
+                              int64_t eventTimeNs, int64_t /*pullDelayNs*/) override {
+        deferredPulls.push_back({pullSuccess, data});
+        deferredEventTimesNs.push_back(eventTimeNs);
+    }
+    vector<std::pair<bool, vector<shared_ptr<LogEvent>>>> pulls;
+    vector<int64_t> pullTimesNs;
+    vector<std::pair<bool, vector<shared_ptr<LogEvent>>>> deferredPulls;
+    vector<int64_t> deferredEventTimesNs;
+};
+
+// Registers [receiver] with [pullerManager] when it gets its first pull.
+class RegisteringPullDataReceiver : public FakePullDataReceiver {
+public:
+    RegisteringPullDataReceiver(const sp<StatsPullerManager>& pullerManager,
+                                const sp<PullDataReceiver>& receiver, int64_t nextPullTimeNs)
+        : mPullerManager(pullerManager), mReceiver(receiver), mNextPullTimeNs(nextPullTimeNs) {
+    }
+    void onDataPulled(const vector<shared_ptr<LogEvent>>& data, bool pullSuccess,
+                      int64_t originalPullTimeNs) override {
+        if (pulls.empty()) {
+            mPullerManager->RegisterReceiver(pullTagId2, configKey, mReceiver, mNextPullTimeNs,
+                                             60 * NS_PER_SEC);
+        }
+        FakePullDataReceiver::onDataPulled(data, pullSuccess, originalPullTimeNs);
+    }
+
+private:
+    const sp<StatsPullerManager> mPullerManager;
+    const sp<PullDataReceiver> mReceiver;
+    const int64_t mNextPullTimeNs;
+};
+
 sp<StatsPullerManager> createPullerManagerAndRegister() {
     sp<StatsPullerManager> pullerManager = new StatsPullerManager();
     shared_ptr<FakePullAtomCallback> cb1 = SharedRefBase::make<FakePullAtomCallback>(uid1);
@@ -145,6 +187,190 @@ TEST(StatsPullerManagerTest, TestPullConfigKeyNoPullerWithUid) {
     EXPECT_FALSE(pullerManager->Pull(pullTagId2, configKey, /*timestamp =*/1, &data));
 }
 
+TEST(StatsPullerManagerTest, TestParallelAlarmPulls) {
+    sp<StatsPullerManager> pullerManager = createPullerManagerAndRegister();
+    sp<FakePullUidProvider> uidProvider = new FakePullUidProvider();
+    pullerManager->RegisterPullUidProvider(configKey, uidProvider);
+    pullerManager->SetParallelPulls(/*numThreads=*/2, /*deadlineNs=*/10 * NS_PER_SEC);
+
+    sp<FakePullDataReceiver> receiver1 = new FakePullDataReceiver();
+    sp<FakePullDataReceiver> receiver2 = new FakePullDataReceiver();
+    const int64_t intervalNs = 60 * NS_PER_SEC;
+    pullerManager->RegisterReceiver(pullTagId1, configKey, receiver1, /*nextPullTimeNs=*/10,
+                                    intervalNs);
+    pullerManager->RegisterReceiver(pullTagId2, configKey, receiver2, /*nextPullTimeNs=*/10,
+                                    intervalNs);
+
+    pullerManager->OnAlarmFired(/*elapsedTimeNs=*/20);
+
+    ASSERT_EQ(receiver1->pulls.size(), 1);
+    EXPECT_TRUE(receiver1->pulls[0].first);
+    ASSERT_EQ(receiver1->pulls[0].second.size(), 1);
+    EXPECT_EQ(receiver1->pulls[0].second[0]->GetTagId(), pullTagId1);
+    EXPECT_EQ(receiver1->pulls[0].second[0]->GetElapsedTimestampNs(), 20);
+    EXPECT_EQ(receiver1->pulls[0].second[0]->getValues()[0].mValue.int_value, uid2);
+    EXPECT_EQ(receiver1->pullTimesNs, vector<int64_t>({20}));
+
+    // There is no puller for the uid of pullTagId2.
+    ASSERT_EQ(receiver2->pulls.size(), 1);
+    EXPECT_FALSE(receiver2->pulls[0].first);
+    EXPECT_TRUE(receiver2->pulls[0].second.empty());
+
+    // Nothing is due until the next interval.
+    pullerManager->OnAlarmFired(/*elapsedTimeNs=*/30);
+    EXPECT_EQ(receiver1->pulls.size(), 1);
+    EXPECT_EQ(receiver2->pulls.size(), 1);
+}
+
+TEST(StatsPullerManagerTest, TestReceiverRegisteredDuringParallelPulls) {
+    sp<StatsPullerManager> pullerManager = createPullerManagerAndRegister();
+    sp<FakePullUidProvider> uidProvider = new FakePullUidProvider();
+    pullerManager->RegisterPullUidProvider(configKey, uidProvider);
+    pullerManager->SetParallelPulls(/*numThreads=*/2, /*deadlineNs=*/10 * NS_PER_SEC);
+
+    // The second receiver is registered while the pulls of the alarm are dispatched, with mLock
+    // released, and is due before the next pull of the first one.
+    sp<FakePullDataReceiver> receiver2 = new FakePullDataReceiver();
+    sp<RegisteringPullDataReceiver> receiver1 = new RegisteringPullDataReceiver(
+            pullerManager, receiver2, /*nextPullTimeNs=*/30 * NS_PER_SEC);
+    pullerManager->RegisterReceiver(pullTagId1, configKey, receiver1, /*nextPullTimeNs=*/10,
+                                    /*intervalNs=*/60 * NS_PER_SEC);
+
+    pullerManager->OnAlarmFired(/*elapsedTimeNs=*/20);
+    ASSERT_EQ(receiver1->pulls.size(), 1);
+    EXPECT_EQ(pullerManager->mNextPullTimeNs, 30 * NS_PER_SEC);
+
+    pullerManager->OnAlarmFired(30 * NS_PER_SEC);
+    EXPECT_EQ(receiver1->pulls.size(), 1);
+    EXPECT_EQ(receiver2->pulls.size(), 1);
+    EXPECT_EQ(pullerManager->mNextPullTimeNs, 10 + 60 * NS_PER_SEC);
+}
+
+TEST(StatsPullerManagerTest, TestAlarmPullsCoalescedAcrossConfigs) {
+    StatsdStats::getInstance().reset();
+    sp<StatsPullerManager> pullerManager = createPullerManagerAndRegister();
+    sp<FakePullUidProvider> uidProvider = new FakePullUidProvider();
+    pullerManager->RegisterPullUidProvider(configKey, uidProvider);
+    pullerManager->RegisterPullUidProvider(configKey2, uidProvider);
+
+    sp<FakePullDataReceiver> receiver1 = new FakePullDataReceiver();
+    sp<FakePullDataReceiver> receiver2 = new FakePullDataReceiver();
+    const int64_t intervalNs = 60 * NS_PER_SEC;
+    pullerManager->RegisterReceiver(pullTagId1, configKey, receiver1, /*nextPullTimeNs=*/10,
+                                    intervalNs);
+    pullerManager->RegisterReceiver(pullTagId1, configKey2, receiver2, /*nextPullTimeNs=*/10,
+                                    intervalNs);
+
+    pullerManager->OnAlarmFired(/*elapsedTimeNs=*/20);
+
+    // One pull, whose events are passed to both receivers.
+    EXPECT_EQ(StatsdStats::getInstance().mPulledAtomStats[pullTagId1].totalPull, 1);
+    ASSERT_EQ(receiver1->pulls.size(), 1);
+    ASSERT_EQ(receiver2->pulls.size(), 1);
+    EXPECT_TRUE(receiver1->pulls[0].first);
+    EXPECT_TRUE(receiver2->pulls[0].first);
+    ASSERT_EQ(receiver1->pulls[0].second.size(), 1);
+    EXPECT_EQ(receiver1->pulls[0].second, receiver2->pulls[0].second);
+}
+
+TEST(StatsPullerManagerTest, TestPullAlarmsAligned) {
+    sp<StatsPullerManager> pullerManager = createPullerManagerAndRegister();
+    pullerManager->SetPullAlignmentWindow(5 * NS_PER_SEC);
+
+    sp<FakePullDataReceiver> receiver1 = new FakePullDataReceiver();
+    sp<FakePullDataReceiver> receiver2 = new FakePullDataReceiver();
+    sp<FakePullDataReceiver> receiver3 = new FakePullDataReceiver();
+    const int64_t intervalNs = 60 * NS_PER_SEC;
+    pullerManager->RegisterReceiver(pullTagId1, configKey, receiver1, 100 * NS_PER_SEC,
+                                    intervalNs);
+    pullerManager->RegisterReceiver(pullTagId1, configKey2, receiver2, 103 * NS_PER_SEC,
+                                    intervalNs);
+    pullerManager->RegisterReceiver(pullTagId2, configKey, receiver3, 110 * NS_PER_SEC,
+                                    intervalNs);
+
+    // The first pull is deferred to the second, the third is out of the window.
+    EXPECT_EQ(pullerManager->mNextPullTimeNs, 100 * NS_PER_SEC);
+    EXPECT_EQ(pullerManager->GetAlignedPullTimeLocked(), 103 * NS_PER_SEC);
+
+    pullerManager->OnAlarmFired(103 * NS_PER_SEC);
+    ASSERT_EQ(receiver1->pulls.size(), 1);
+    ASSERT_EQ(receiver2->pulls.size(), 1);
+    EXPECT_EQ(receiver3->pulls.size(), 0);
+    // Still stamped with the time of the alarm, to be snapped to the bucket ends.
+    EXPECT_EQ(receiver1->pullTimesNs, vector<int64_t>({103 * NS_PER_SEC}));
+    EXPECT_EQ(pullerManager->mNextPullTimeNs, 110 * NS_PER_SEC);
+    EXPECT_EQ(pullerManager->GetAlignedPullTimeLocked(), 110 * NS_PER_SEC);
+}
+
+TEST(StatsPullerManagerTest, TestDeferredPullsShareOnePull) {
+    StatsdStats::getInstance().reset();
+    sp<StatsPullerManager> pullerManager = createPullerManagerAndRegister();
+    sp<FakePullUidProvider> uidProvider = new FakePullUidProvider();
+    pullerManager->RegisterPullUidProvider(configKey, uidProvider);
+    pullerManager->RegisterPullUidProvider(configKey2, uidProvider);
+    sp<FakePullDataReceiver> receiver1 = new FakePullDataReceiver();
+    sp<FakePullDataReceiver> receiver2 = new FakePullDataReceiver();
+    sp<FakePullDataReceiver> receiver3 = new FakePullDataReceiver();
+
+    // Not queued until deferred pulls are enabled.
+    EXPECT_FALSE(pullerManager->PullDeferred(pullTagId1, configKey, /*eventTimeNs=*/10, receiver1));
+
+    pullerManager->EnableDeferredPulls();
+    EXPECT_TRUE(pullerManager->PullDeferred(pullTagId1, configKey, /*eventTimeNs=*/10, receiver1));
+    EXPECT_TRUE(pullerManager->PullDeferred(pullTagId1, configKey2, /*eventTimeNs=*/20, receiver2));
+    EXPECT_TRUE(pullerManager->PullDeferred(pullTagId1, badConfigKey, /*eventTimeNs=*/30,
+                                            receiver3));
+    pullerManager->DispatchDeferredPulls(/*waitForPending=*/true);
+
+    // Pulled from the puller once, the later pull may be served from its cache.
+    const auto& pullStats = StatsdStats::getInstance().mPulledAtomStats[pullTagId1];
+    EXPECT_EQ(pullStats.totalPull - pullStats.totalPullFromCache, 1);
+    ASSERT_EQ(receiver1->deferredPulls.size(), 1);
+    ASSERT_EQ(receiver2->deferredPulls.size(), 1);
+    EXPECT_TRUE(receiver1->deferredPulls[0].first);
+    EXPECT_TRUE(receiver2->deferredPulls[0].first);
+    ASSERT_EQ(receiver1->deferredPulls[0].second.size(), 1);
+    EXPECT_EQ(receiver1->deferredPulls[0].second, receiver2->deferredPulls[0].second);
+    EXPECT_THAT(receiver1->deferredEventTimesNs, testing::ElementsAre(10));
+    EXPECT_THAT(receiver2->deferredEventTimesNs, testing::ElementsAre(20));
+    EXPECT_TRUE(receiver1->pulls.empty());
+
+    // The config without a pull uid provider fails.
+    ASSERT_EQ(receiver3->deferredPulls.size(), 1);
+    EXPECT_FALSE(receiver3->deferredPulls[0].first);
+    EXPECT_THAT(receiver3->deferredEventTimesNs, testing::ElementsAre(30));
+}
+
+TEST(StatsPullerManagerTest, TestDeferredPullWindow) {
+    StatsdStats::getInstance().reset();
+    sp<StatsPullerManager> pullerManager = createPullerManagerAndRegister();
+    sp<FakePullUidProvider> uidProvider = new FakePullUidProvider();
+    pullerManager->RegisterPullUidProvider(configKey, uidProvider);
+    pullerManager->RegisterPullUidProvider(configKey2, uidProvider);
+    sp<FakePullDataReceiver> receiver1 = new FakePullDataReceiver();
+    sp<FakePullDataReceiver> receiver2 = new FakePullDataReceiver();
+
+    // The window outlasts the test, the pulls are only issued once they are waited for.
+    pullerManager->SetDeferredPullWindow(3600 * NS_PER_SEC);
+    pullerManager->EnableDeferredPulls();
+    EXPECT_TRUE(pullerManager->PullDeferred(pullTagId1, configKey, /*eventTimeNs=*/10, receiver1));
+    EXPECT_TRUE(pullerManager->PullDeferred(pullTagId1, configKey2, /*eventTimeNs=*/20, receiver2));
+    EXPECT_TRUE(pullerManager->PullDeferred(pullTagId1, configKey, /*eventTimeNs=*/30, receiver1));
+    pullerManager->DispatchDeferredPulls(/*waitForPending=*/false);
+    EXPECT_TRUE(receiver1->deferredPulls.empty());
+    pullerManager->DispatchDeferredPulls(/*waitForPending=*/true);
+
+    // All the pulls queued within the window share one pull.
+    const auto& pullStats = StatsdStats::getInstance().mPulledAtomStats[pullTagId1];
+    EXPECT_EQ(pullStats.totalPull, 1);
+    ASSERT_EQ(receiver1->deferredPulls.size(), 2);
+    ASSERT_EQ(receiver2->deferredPulls.size(), 1);
+    EXPECT_EQ(receiver1->deferredPulls[0].second, receiver2->deferredPulls[0].second);
+    EXPECT_EQ(receiver1->deferredPulls[1].second, receiver2->deferredPulls[0].second);
+    EXPECT_THAT(receiver1->deferredEventTimesNs, testing::ElementsAre(10, 30));
+    EXPECT_THAT(receiver2->deferredEventTimesNs, testing::ElementsAre(20));
+}
+
 }  // namespace statsd
 }  // namespace os
-}  // namespace android
\ No newline at end of file
+}  // namespace android
@@ -82,6 +82,11 @@ public:
         pullDelayNs = 0;
         pullData.clear();
     }
+
+    void TearDown() override {
+        // Restores the default of the global flag, even if a test failed with it set.
+        StatsPuller::SetDeltaEncoding(false);
+    }
 };
 
 }  // Anonymous namespace.
@@ -308,6 +313,78 @@ TEST_F(StatsPullerTest, PullFailsAndPullSameEventTime) {
     ASSERT_EQ(0, dataHolder.size());
 }
 
+TEST_F(StatsPullerTest, AdaptiveTimeoutFromLatency) {
+    pullData.push_back(createSimpleEvent(1111L, 33));
+    pullSuccess = true;
+
+    StatsPuller::SetAdaptiveTimeouts(true);
+    FakePuller adaptivePuller;
+    vector<std::shared_ptr<LogEvent>> dataHolder;
+    // Fast pulls halve the 5ms timeout.
+    for (int i = 0; i < 8; i++) {
+        EXPECT_EQ(adaptivePuller.Pull(getElapsedRealtimeNs(), &dataHolder), PULL_SUCCESS);
+        sleep_for(std::chrono::milliseconds(21));
+    }
+
+    pullDelayNs = MillisToNano(3);
+    EXPECT_EQ(adaptivePuller.Pull(getElapsedRealtimeNs(), &dataHolder), PULL_FAIL);
+    StatsPuller::SetAdaptiveTimeouts(false);
+
+    // The registered timeout still applies to the other pullers.
+    sleep_for(std::chrono::milliseconds(11));
+    EXPECT_EQ(puller.Pull(getElapsedRealtimeNs(), &dataHolder), PULL_SUCCESS);
+}
+
+TEST_F(StatsPullerTest, PullBatchSharedWithCache) {
+    pullData.push_back(createSimpleEvent(1111L, 33));
+
+    pullSuccess = true;
+
+    const int64_t eventTimeNs = getElapsedRealtimeNs();
+    PulledEventBatch batch1;
+    EXPECT_EQ(puller.Pull(eventTimeNs, &batch1), PULL_SUCCESS);
+    ASSERT_NE(batch1, nullptr);
+    ASSERT_EQ(1, batch1->size());
+    EXPECT_EQ(33, (*batch1)[0]->getValues()[0].mValue.int_value);
+
+    // Served from the cache, without copying the events.
+    PulledEventBatch batch2;
+    EXPECT_EQ(puller.Pull(eventTimeNs, &batch2), PULL_SUCCESS);
+    EXPECT_EQ(batch1, batch2);
+
+    // A failed pull does not set the batch.
+    sleep_for(std::chrono::milliseconds(11));
+    pullSuccess = false;
+    PulledEventBatch batch3;
+    EXPECT_EQ(puller.Pull(getElapsedRealtimeNs(), &batch3), PULL_FAIL);
+    EXPECT_EQ(batch3, nullptr);
+    ASSERT_EQ(1, batch1->size());
+}
+
+TEST_F(StatsPullerTest, DeltaEncodingReusesUnchangedRows) {
+    StatsPuller::SetDeltaEncoding(true);
+    pullData.push_back(createSimpleEvent(1111L, 33));
+    pullData.push_back(createSimpleEvent(1111L, 44));
+    pullSuccess = true;
+
+    vector<std::shared_ptr<LogEvent>> dataHolder1;
+    EXPECT_EQ(puller.Pull(getElapsedRealtimeNs(), &dataHolder1), PULL_SUCCESS);
+    ASSERT_EQ(2, dataHolder1.size());
+
+    sleep_for(std::chrono::milliseconds(11));
+    pullData.clear();
+    pullData.push_back(createSimpleEvent(2222L, 33));
+    pullData.push_back(createSimpleEvent(2222L, 55));
+
+    // The unchanged row is the event of the first pull.
+    vector<std::shared_ptr<LogEvent>> dataHolder2;
+    EXPECT_EQ(puller.Pull(getElapsedRealtimeNs(), &dataHolder2), PULL_SUCCESS);
+    ASSERT_EQ(2, dataHolder2.size());
+    EXPECT_EQ(dataHolder1[0], dataHolder2[0]);
+    EXPECT_EQ(pullData[1], dataHolder2[1]);
+    EXPECT_EQ(55, dataHolder2[1]->getValues()[0].mValue.long_value);
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
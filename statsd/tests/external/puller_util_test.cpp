@@ -277,9 +277,9 @@ TEST(PullerUtilTest, MergeNoDimensionAttributionChain) {
     const vector<FieldValue>* actualFieldValues = &data[0]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(400, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
     EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
     EXPECT_EQ(isolatedAdditiveData + hostAdditiveData, actualFieldValues->at(5).mValue.int_value);
 }
@@ -308,18 +308,18 @@ TEST(PullerUtilTest, MergeWithDimensionAttributionChain) {
     const vector<FieldValue>* actualFieldValues = &data[0]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(200, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(hostUid, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
     EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
     EXPECT_EQ(hostAdditiveData, actualFieldValues->at(5).mValue.int_value);
 
     actualFieldValues = &data[1]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(200, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(hostUid, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
     EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
     EXPECT_EQ(hostAdditiveData + isolatedAdditiveData, actualFieldValues->at(5).mValue.int_value);
 }
@@ -344,18 +344,18 @@ TEST(PullerUtilTest, NoMergeHostUidOnlyAttributionChain) {
     const vector<FieldValue>* actualFieldValues = &data[0]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(400, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
     EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
     EXPECT_EQ(hostAdditiveData, actualFieldValues->at(5).mValue.int_value);
 
     actualFieldValues = &data[1]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(400, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
     EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
     EXPECT_EQ(isolatedAdditiveData, actualFieldValues->at(5).mValue.int_value);
 }
@@ -381,9 +381,9 @@ TEST(PullerUtilTest, IsolatedUidOnlyAttributionChain) {
     const vector<FieldValue>* actualFieldValues = &data[0]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(400, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
     EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
     EXPECT_EQ(hostAdditiveData, actualFieldValues->at(5).mValue.int_value);
 
@@ -391,9 +391,9 @@ TEST(PullerUtilTest, IsolatedUidOnlyAttributionChain) {
     actualFieldValues = &data[1]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(400, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
     EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
     EXPECT_EQ(isolatedAdditiveData, actualFieldValues->at(5).mValue.int_value);
 }
@@ -422,9 +422,9 @@ TEST(PullerUtilTest, MultipleIsolatedUidToOneHostUidAttributionChain) {
     const vector<FieldValue>* actualFieldValues = &data[0]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(400, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
     EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
     EXPECT_EQ(isolatedAdditiveData + hostAdditiveData + hostAdditiveData,
               actualFieldValues->at(5).mValue.int_value);
@@ -541,6 +541,53 @@ TEST(PullerUtilTest, RepeatedUidField) {
     EXPECT_EQ(hostAdditiveData, actualFieldValues->at(4).mValue.int_value);
 }
 
+TEST(PullerUtilTest, HashMergeKeepsPullOrder) {
+    vector<int> uidArray1 = {isolatedUid1, hostUid};
+    vector<int> uidArray2 = {isolatedUid1, isolatedUid3};
+
+    vector<shared_ptr<LogEvent>> data = {
+            // {30, 20}->22->21
+            makeRepeatedUidLogEvent(uidAtomTagId, timestamp, uidArray1, hostNonAdditiveData,
+                                    hostAdditiveData),
+
+            // {30, 3000}->22->21 (different uid, not merged)
+            makeRepeatedUidLogEvent(uidAtomTagId, timestamp, uidArray2, hostNonAdditiveData,
+                                    hostAdditiveData),
+
+            // {30, 20}->32->21 (different non-additive field, not merged)
+            makeRepeatedUidLogEvent(uidAtomTagId, timestamp, uidArray1, isolatedNonAdditiveData,
+                                    hostAdditiveData),
+
+            // {30, 20}->22->31 (different additive field, merged)
+            makeRepeatedUidLogEvent(uidAtomTagId, timestamp, uidArray1, hostNonAdditiveData,
+                                    isolatedAdditiveData),
+    };
+
+    setHashMergeIsolatedUids(true);
+    sp<MockUidMap> uidMap = makeMockUidMap();
+    mapAndMergeIsolatedUidsToHostUid(data, uidMap, uidAtomTagId, additiveFields);
+    setHashMergeIsolatedUids(false);
+
+    ASSERT_EQ(3, (int)data.size());
+    // Events 1 and 4 are merged into event 1.
+    const vector<FieldValue>* actualFieldValues = &data[0]->getValues();
+    ASSERT_EQ(4, actualFieldValues->size());
+    EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
+    EXPECT_EQ(hostUid, actualFieldValues->at(1).mValue.int_value);
+    EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(2).mValue.int_value);
+    EXPECT_EQ(hostAdditiveData + isolatedAdditiveData, actualFieldValues->at(3).mValue.int_value);
+
+    actualFieldValues = &data[1]->getValues();
+    ASSERT_EQ(4, actualFieldValues->size());
+    EXPECT_EQ(hostUid2, actualFieldValues->at(1).mValue.int_value);
+    EXPECT_EQ(hostAdditiveData, actualFieldValues->at(3).mValue.int_value);
+
+    actualFieldValues = &data[2]->getValues();
+    ASSERT_EQ(4, actualFieldValues->size());
+    EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(2).mValue.int_value);
+    EXPECT_EQ(hostAdditiveData, actualFieldValues->at(3).mValue.int_value);
+}
+
 // Test that repeated uid events with multiple repeated non-additive fields are sorted and merged
 // correctly.
 TEST(PullerUtilTest, MultipleRepeatedFields) {
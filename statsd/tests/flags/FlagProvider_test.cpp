@@ -61,6 +61,20 @@ TEST_P(FlagProviderTest_SPlus, TestGetFlagBoolServerFlagFalse) {
     EXPECT_FALSE(FlagProvider::getInstance().getFlagBool(TEST_FLAG, GetParam().flagValue));
 }
 
+string getServerFlagFuncNamespace(const string& flagNamespace, const string& flagName,
+                                  const string& defaultValue) {
+    return flagNamespace;
+}
+
+TEST_P(FlagProviderTest_SPlus, TestGetJavaFlagString) {
+    FlagProvider::getInstance().overrideFuncs(&isAtLeastSFuncTrue, &getServerFlagFuncNamespace);
+    // The flags of StatsService::updateProperties() are read from the same namespace at startup.
+    EXPECT_EQ(STATSD_JAVA_NAMESPACE,
+              FlagProvider::getInstance().getJavaFlagString(TEST_FLAG, GetParam().flagValue));
+    EXPECT_EQ(STATSD_NATIVE_NAMESPACE,
+              FlagProvider::getInstance().getFlagString(TEST_FLAG, GetParam().flagValue));
+}
+
 TEST_P(FlagProviderTest_SPlus, TestOverrideLocalFlags) {
     FlagProvider::getInstance().overrideFuncs(&isAtLeastSFuncTrue);
 
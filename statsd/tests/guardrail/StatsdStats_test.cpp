@@ -17,6 +17,7 @@
 #include "tests/statsd_test_util.h"
 
 #include <gtest/gtest.h>
+#include <thread>
 #include <vector>
 
 #ifdef __ANDROID__
@@ -218,6 +219,49 @@ TEST(StatsdStatsTest, TestSubStats) {
     EXPECT_EQ(1, configReport2.alert_stats(0).alerted_times());
 }
 
+TEST(StatsdStatsTest, TestDimensionCardinality) {
+    StatsdStats stats;
+    ConfigKey key(0, 12345);
+    stats.noteConfigReceived(key, 2, 3, 4, 5, {}, true);
+
+    stats.noteConditionDimensionSize(key, StringToId("condition1"), 250);
+    stats.noteConditionDimensionCardinality(key, StringToId("condition1"), 900);
+    stats.noteConditionDimensionCardinality(key, StringToId("condition1"), 800);
+    stats.noteConditionDimensionCardinality(key, StringToId("condition2"), 40);
+    stats.noteMetricDimensionCardinality(key, StringToId("metric1"), 5000);
+
+    vector<uint8_t> output;
+    stats.dumpStats(&output, true);
+    StatsdStatsReport report;
+    EXPECT_TRUE(report.ParseFromArray(&output[0], output.size()));
+    ASSERT_EQ(1, report.config_stats_size());
+    const auto& configReport = report.config_stats(0);
+
+    ASSERT_EQ(2, configReport.condition_stats_size());
+    for (const auto& conditionStats : configReport.condition_stats()) {
+        if (conditionStats.id() == StringToId("condition1")) {
+            EXPECT_EQ(250, conditionStats.max_tuple_counts());
+            EXPECT_EQ(900, conditionStats.estimated_cardinality());
+        } else {
+            EXPECT_EQ(StringToId("condition2"), conditionStats.id());
+            EXPECT_FALSE(conditionStats.has_max_tuple_counts());
+            EXPECT_EQ(40, conditionStats.estimated_cardinality());
+        }
+    }
+
+    ASSERT_EQ(1, configReport.metric_stats_size());
+    EXPECT_EQ(StringToId("metric1"), configReport.metric_stats(0).id());
+    EXPECT_FALSE(configReport.metric_stats(0).has_max_tuple_counts());
+    EXPECT_EQ(5000, configReport.metric_stats(0).estimated_cardinality());
+
+    // Reset by the previous dump.
+    stats.dumpStats(&output, false);
+    EXPECT_TRUE(report.ParseFromArray(&output[0], output.size()));
+    ASSERT_EQ(1, report.config_stats_size());
+    EXPECT_EQ(0, report.config_stats(0).condition_stats_size());
+    EXPECT_EQ(0, report.config_stats(0).metric_stats_size());
+}
+
 TEST(StatsdStatsTest, TestAtomLog) {
     StatsdStats stats;
     time_t now = time(nullptr);
@@ -251,6 +295,69 @@ TEST(StatsdStatsTest, TestAtomLog) {
     EXPECT_TRUE(sensorAtomGood);
 }
 
+TEST(StatsdStatsTest, TestAtomLogFromThreads) {
+    StatsdStats stats;
+    time_t now = time(nullptr);
+    const int threadCount = 8;
+    const int logsPerThread = 1000;
+
+    vector<std::thread> threads;
+    for (int i = 0; i < threadCount; i++) {
+        threads.emplace_back([&stats, now] {
+            for (int j = 0; j < logsPerThread; j++) {
+                stats.noteAtomLogged(util::SENSOR_STATE_CHANGED, now);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    vector<uint8_t> output;
+    stats.dumpStats(&output, false);
+    StatsdStatsReport report;
+    EXPECT_TRUE(report.ParseFromArray(&output[0], output.size()));
+
+    ASSERT_EQ(1, report.atom_stats_size());
+    EXPECT_EQ(util::SENSOR_STATE_CHANGED, report.atom_stats(0).tag());
+    EXPECT_EQ(threadCount * logsPerThread, report.atom_stats(0).count());
+
+    // Reset clears every shard.
+    stats.reset();
+    output.clear();
+    stats.dumpStats(&output, false);
+    report.Clear();
+    EXPECT_TRUE(report.ParseFromArray(output.data(), output.size()));
+    EXPECT_EQ(0, report.atom_stats_size());
+}
+
+TEST(StatsdStatsTest, TestAtomSkipped) {
+    StatsdStats stats;
+    time_t now = time(nullptr);
+    int newAtom = StatsdStats::kMaxPushedAtomId + 1;
+
+    stats.noteAtomLogged(util::SENSOR_STATE_CHANGED, now + 1);
+    stats.noteAtomsSkipped({{util::SENSOR_STATE_CHANGED, 2}, {newAtom, 3}});
+
+    vector<uint8_t> output;
+    stats.dumpStats(&output, false);
+    StatsdStatsReport report;
+    EXPECT_TRUE(report.ParseFromArray(&output[0], output.size()));
+
+    ASSERT_EQ(2, report.atom_stats_size());
+    for (const auto& atomStats : report.atom_stats()) {
+        if (atomStats.tag() == util::SENSOR_STATE_CHANGED) {
+            EXPECT_EQ(3, atomStats.count());
+            EXPECT_EQ(2, atomStats.skip_count());
+        } else {
+            EXPECT_EQ(newAtom, atomStats.tag());
+            EXPECT_EQ(3, atomStats.count());
+            EXPECT_EQ(3, atomStats.skip_count());
+        }
+        EXPECT_FALSE(atomStats.has_error_count());
+    }
+}
+
 TEST(StatsdStatsTest, TestNonPlatformAtomLog) {
     StatsdStats stats;
     time_t now = time(nullptr);
@@ -350,6 +457,7 @@ TEST(StatsdStatsTest, TestAtomMetricsStats) {
     stats.noteBucketBoundaryDelayNs(10000000000LL, 2L);
 
     stats.noteBucketBoundaryDelayNs(10000000001LL, 1L);
+    stats.noteStaleBasesEvicted(10000000001LL, 3);
 
     vector<uint8_t> output;
     stats.dumpStats(&output, false);
@@ -370,6 +478,31 @@ TEST(StatsdStatsTest, TestAtomMetricsStats) {
     EXPECT_EQ(0L, atomStats2.bucket_dropped());
     EXPECT_EQ(0L, atomStats2.min_bucket_boundary_delay_ns());
     EXPECT_EQ(1L, atomStats2.max_bucket_boundary_delay_ns());
+    EXPECT_FALSE(atomStats.has_stale_bases_evicted());
+    EXPECT_EQ(3L, atomStats2.stale_bases_evicted());
+}
+
+TEST(StatsdStatsTest, TestMetricCost) {
+    StatsdStats stats;
+    stats.noteMetricCost(1, 8, 800, 50, 1000);
+    stats.noteMetricCost(1, 16, 1600, 30, 500);
+    stats.noteBucketDropped(2);
+
+    vector<uint8_t> output;
+    stats.dumpStats(&output, false);
+    StatsdStatsReport report;
+    ASSERT_TRUE(report.ParseFromArray(&output[0], output.size()));
+    ASSERT_EQ(2, report.atom_metric_stats_size());
+
+    // The counts and times add up, the byte size is the largest.
+    auto atomStats = report.atom_metric_stats(0);
+    EXPECT_EQ(1, atomStats.metric_id());
+    EXPECT_EQ(24, atomStats.matched_event_count());
+    EXPECT_EQ(2400, atomStats.event_processing_time_ns());
+    EXPECT_EQ(80, atomStats.dump_time_ns());
+    EXPECT_EQ(1000, atomStats.max_byte_size());
+
+    EXPECT_FALSE(report.atom_metric_stats(1).has_matched_event_count());
 }
 
 TEST(StatsdStatsTest, TestAnomalyMonitor) {
@@ -501,6 +634,45 @@ TEST(StatsdStatsTest, TestActivationBroadcastGuardrailHit) {
     EXPECT_TRUE(uid2Good);
 }
 
+TEST(StatsdStatsTest, TestAtomClientDrops) {
+    StatsdStats stats;
+    int loggedAtomTag = 100;
+    int droppedAtomTag = 101;
+
+    stats.noteAtomLogged(loggedAtomTag, /*timeSec=*/0);
+    stats.noteLogLost(/*wallClockTimeSec=*/0, /*count=*/3, /*lastError=*/-11, loggedAtomTag,
+                      /*uid=*/1000, /*pid=*/1);
+    // Atoms whose events were all dropped are reported too.
+    stats.noteLogLost(/*wallClockTimeSec=*/0, /*count=*/4, /*lastError=*/-11, droppedAtomTag,
+                      /*uid=*/1000, /*pid=*/1);
+    stats.noteLogLost(/*wallClockTimeSec=*/1, /*count=*/2, /*lastError=*/-11, loggedAtomTag,
+                      /*uid=*/1000, /*pid=*/1);
+    // The drops of the atoms the client did not count by themselves are not attributed.
+    stats.noteLogLost(/*wallClockTimeSec=*/1, /*count=*/6, /*lastError=*/-11, /*lastTag=*/0,
+                      /*uid=*/1000, /*pid=*/1);
+
+    vector<uint8_t> output;
+    stats.dumpStats(&output, false);
+    StatsdStatsReport report;
+    EXPECT_TRUE(report.ParseFromArray(&output[0], output.size()));
+
+    ASSERT_EQ(2, report.atom_stats_size());
+    EXPECT_EQ(loggedAtomTag, report.atom_stats(0).tag());
+    EXPECT_EQ(1, report.atom_stats(0).count());
+    EXPECT_EQ(5, report.atom_stats(0).client_drop_count());
+    EXPECT_EQ(droppedAtomTag, report.atom_stats(1).tag());
+    EXPECT_EQ(0, report.atom_stats(1).count());
+    EXPECT_EQ(4, report.atom_stats(1).client_drop_count());
+    EXPECT_EQ(6, report.unattributed_client_drop_count());
+
+    // The reports sent together are one loss.
+    ASSERT_EQ(2, report.detected_log_loss_size());
+    EXPECT_EQ(7, report.detected_log_loss(0).count());
+    EXPECT_EQ(droppedAtomTag, report.detected_log_loss(0).last_tag());
+    EXPECT_EQ(8, report.detected_log_loss(1).count());
+    EXPECT_EQ(loggedAtomTag, report.detected_log_loss(1).last_tag());
+}
+
 TEST(StatsdStatsTest, TestAtomErrorStats) {
     StatsdStats stats;
 
@@ -536,6 +708,276 @@ TEST(StatsdStatsTest, TestAtomErrorStats) {
     EXPECT_EQ(numErrors, pulledAtomStats.atom_error_count());
 }
 
+TEST(StatsdStatsTest, TestSocketBatchReadStats) {
+    StatsdStats stats;
+
+    stats.noteSocketBatchRead(1);
+    stats.noteSocketBatchRead(1);
+    stats.noteSocketBatchRead(9);
+    stats.noteSocketBatchRead(32);
+    stats.noteSocketBatchRead(500);
+
+    int64_t oldestEventTimestampNs = getElapsedRealtimeNs();
+    stats.noteEventQueueOverflow(oldestEventTimestampNs, /*count=*/3);
+
+    vector<uint8_t> output;
+    stats.dumpStats(&output, false);
+    StatsdStatsReport report;
+    EXPECT_TRUE(report.ParseFromArray(&output[0], output.size()));
+
+    ASSERT_TRUE(report.has_socket_read_stats());
+    const auto& histogram = report.socket_read_stats().batched_read_size();
+    ASSERT_EQ(StatsdStats::kNumBinsInSocketBatchReadHistogram, histogram.size());
+    EXPECT_EQ(2, histogram[1]);
+    EXPECT_EQ(1, histogram[9]);
+    EXPECT_EQ(1, histogram[12]);
+    EXPECT_EQ(1, histogram[StatsdStats::kNumBinsInSocketBatchReadHistogram - 1]);
+
+    EXPECT_EQ(3, report.queue_overflow().count());
+    EXPECT_FALSE(report.socket_read_stats().has_kernel_drop_count());
+    EXPECT_FALSE(report.socket_read_stats().has_receive_buffer_grow_count());
+
+    stats.reset();
+    stats.dumpStats(&output, false);
+    EXPECT_TRUE(report.ParseFromArray(&output[0], output.size()));
+    EXPECT_FALSE(report.has_socket_read_stats());
+}
+
+TEST(StatsdStatsTest, TestSocketDropStats) {
+    StatsdStats stats;
+
+    stats.noteSocketKernelDrops(5);
+    stats.noteSocketKernelDrops(2);
+    stats.noteSocketReceiveBufferGrown(512 * 1024);
+    stats.noteSocketReceiveBufferGrown(1024 * 1024);
+
+    vector<uint8_t> output;
+    stats.dumpStats(&output, false);
+    StatsdStatsReport report;
+    EXPECT_TRUE(report.ParseFromArray(&output[0], output.size()));
+
+    ASSERT_TRUE(report.has_socket_read_stats());
+    EXPECT_EQ(7, report.socket_read_stats().kernel_drop_count());
+    EXPECT_EQ(2, report.socket_read_stats().receive_buffer_grow_count());
+    EXPECT_EQ(1024 * 1024, report.socket_read_stats().receive_buffer_bytes());
+
+    stats.reset();
+    stats.dumpStats(&output, false);
+    EXPECT_TRUE(report.ParseFromArray(&output[0], output.size()));
+    EXPECT_FALSE(report.has_socket_read_stats());
+}
+
+TEST(StatsdStatsTest, TestLogEventValuesRegrown) {
+    StatsdStats stats;
+
+    stats.noteLogEventValuesRegrown(3);
+    stats.noteLogEventValuesRegrown(1);
+
+    vector<uint8_t> output;
+    stats.dumpStats(&output, false);
+    StatsdStatsReport report;
+    EXPECT_TRUE(report.ParseFromArray(&output[0], output.size()));
+    ASSERT_TRUE(report.has_log_event_parse_stats());
+    EXPECT_EQ(4, report.log_event_parse_stats().values_regrow_count());
+
+    stats.reset();
+    stats.dumpStats(&output, false);
+    EXPECT_TRUE(report.ParseFromArray(&output[0], output.size()));
+    EXPECT_FALSE(report.has_log_event_parse_stats());
+}
+
+TEST(StatsdStatsTest, TestEventQueueOverflowPerUid) {
+    StatsdStats stats;
+
+    int64_t oldestEventTimestampNs = getElapsedRealtimeNs();
+    stats.noteEventQueueOverflow(oldestEventTimestampNs, /*count=*/4, /*droppedBytes=*/300,
+                                 /*appCount=*/3);
+    stats.noteEventQueueOverflowForUid(10001);
+    stats.noteEventQueueOverflowForUids({10001, 10001, 1000});
+
+    vector<uint8_t> output;
+    stats.dumpStats(&output, false);
+    StatsdStatsReport report;
+    EXPECT_TRUE(report.ParseFromArray(&output[0], output.size()));
+
+    ASSERT_TRUE(report.has_queue_overflow());
+    EXPECT_EQ(4, report.queue_overflow().count());
+    EXPECT_EQ(300, report.queue_overflow().dropped_bytes());
+    EXPECT_EQ(3, report.queue_overflow().app_count());
+    const auto& uidDrops = report.queue_overflow().uid_drops();
+    ASSERT_EQ(2, uidDrops.size());
+    EXPECT_EQ(1000, uidDrops[0].uid());
+    EXPECT_EQ(1, uidDrops[0].count());
+    EXPECT_EQ(10001, uidDrops[1].uid());
+    EXPECT_EQ(3, uidDrops[1].count());
+
+    // The number of tracked uids is bounded.
+    for (size_t i = 0; i < StatsdStats::kMaxEventQueueOverflowUids + 10; i++) {
+        stats.noteEventQueueOverflowForUid(20000 + i);
+    }
+    EXPECT_EQ(StatsdStats::kMaxEventQueueOverflowUids, stats.mEventQueueOverflowPerUid.size());
+
+    stats.reset();
+    EXPECT_TRUE(stats.mEventQueueOverflowPerUid.empty());
+}
+
+TEST(StatsdStatsTest, TestEventRateStats) {
+    StatsdStats stats;
+    const int64_t startNs = 600 * NS_PER_SEC;
+
+    stats.noteEventsQueued(startNs, 5, 2);
+    for (int i = 0; i < 5; i++) {
+        stats.noteAtomLogged(util::SENSOR_STATE_CHANGED, 600);
+    }
+    stats.noteEventsQueued(startNs + NS_PER_SEC / 10, 1, 7);
+    stats.noteAtomLogged(util::APP_CRASH_OCCURRED, 600);
+    stats.noteEventsQueued(startNs + 59 * NS_PER_SEC, 3, 1);
+    for (int i = 0; i < 3; i++) {
+        stats.noteAtomLogged(util::APP_CRASH_OCCURRED, 659);
+    }
+    // Starts the next minute.
+    stats.noteEventsQueued(startNs + 61 * NS_PER_SEC, 2, 0);
+    stats.noteAtomLogged(util::SENSOR_STATE_CHANGED, 661);
+
+    vector<uint8_t> output;
+    stats.dumpStats(&output, false);
+    StatsdStatsReport report;
+    EXPECT_TRUE(report.ParseFromArray(&output[0], output.size()));
+    const StatsdStatsReport::EventRateStats& eventRates = report.event_rate_stats();
+
+    ASSERT_EQ(3, eventRates.second_size());
+    EXPECT_EQ(600, eventRates.second(0).start_elapsed_sec());
+    EXPECT_EQ(6, eventRates.second(0).event_count());
+    EXPECT_EQ(7, eventRates.second(0).max_queue_size());
+    EXPECT_EQ(0, eventRates.second(0).top_atom_size());
+    EXPECT_EQ(659, eventRates.second(1).start_elapsed_sec());
+    EXPECT_EQ(3, eventRates.second(1).event_count());
+    EXPECT_EQ(661, eventRates.second(2).start_elapsed_sec());
+    EXPECT_EQ(2, eventRates.second(2).event_count());
+
+    ASSERT_EQ(2, eventRates.minute_size());
+    EXPECT_EQ(600, eventRates.minute(0).start_elapsed_sec());
+    EXPECT_EQ(9, eventRates.minute(0).event_count());
+    EXPECT_EQ(7, eventRates.minute(0).max_queue_size());
+    ASSERT_EQ(2, eventRates.minute(0).top_atom_size());
+    EXPECT_EQ(util::SENSOR_STATE_CHANGED, eventRates.minute(0).top_atom(0).atom_id());
+    EXPECT_EQ(5, eventRates.minute(0).top_atom(0).count());
+    EXPECT_EQ(util::APP_CRASH_OCCURRED, eventRates.minute(0).top_atom(1).atom_id());
+    EXPECT_EQ(4, eventRates.minute(0).top_atom(1).count());
+    EXPECT_EQ(660, eventRates.minute(1).start_elapsed_sec());
+    EXPECT_EQ(2, eventRates.minute(1).event_count());
+    ASSERT_EQ(1, eventRates.minute(1).top_atom_size());
+    EXPECT_EQ(util::SENSOR_STATE_CHANGED, eventRates.minute(1).top_atom(0).atom_id());
+    EXPECT_EQ(1, eventRates.minute(1).top_atom(0).count());
+}
+
+TEST(StatsdStatsTest, TestLatencyHistogramBins) {
+    EXPECT_EQ(0u, StatsdStats::getLatencyHistogramBin(0));
+    EXPECT_EQ(0u, StatsdStats::getLatencyHistogramBin(999));
+    EXPECT_EQ(1u, StatsdStats::getLatencyHistogramBin(1000));
+    EXPECT_EQ(1u, StatsdStats::getLatencyHistogramBin(1999));
+    EXPECT_EQ(3u, StatsdStats::getLatencyHistogramBin(2000));
+    EXPECT_EQ(4u, StatsdStats::getLatencyHistogramBin(3000));
+    EXPECT_EQ(5u, StatsdStats::getLatencyHistogramBin(4000));
+    EXPECT_EQ(5u, StatsdStats::getLatencyHistogramBin(5999));
+    EXPECT_EQ(6u, StatsdStats::getLatencyHistogramBin(6000));
+    EXPECT_EQ(46u, StatsdStats::getLatencyHistogramBin((1LL << 22) * 1500));
+    EXPECT_EQ((size_t)StatsdStats::kNumBinsInLatencyHistogram - 1,
+              StatsdStats::getLatencyHistogramBin((1LL << 23) * 1000));
+    EXPECT_EQ((size_t)StatsdStats::kNumBinsInLatencyHistogram - 1,
+              StatsdStats::getLatencyHistogramBin(100 * NS_PER_SEC));
+}
+
+TEST(StatsdStatsTest, TestPullTimePercentiles) {
+    StatsdStats stats;
+    EXPECT_EQ(0, StatsdStats::getLatencyHistogramPercentileNs({}, 50));
+
+    for (int i = 0; i < 98; i++) {
+        stats.notePullTime(10, /*pullTimeNs=*/1500);
+    }
+    stats.notePullTime(10, /*pullTimeNs=*/5000);
+    stats.notePullTime(10, /*pullTimeNs=*/5000);
+
+    const vector<int64_t>& histogram = stats.mPulledAtomStats[10].pullTimeHistogram;
+    EXPECT_EQ(2000, StatsdStats::getLatencyHistogramPercentileNs(histogram, 50));
+    EXPECT_EQ(6000, StatsdStats::getLatencyHistogramPercentileNs(histogram, 99));
+    EXPECT_EQ(6000, StatsdStats::getLatencyHistogramPercentileNs(histogram, 100));
+
+    // The overflow bin reports its lower bound.
+    stats.notePullTime(11, /*pullTimeNs=*/100 * NS_PER_SEC);
+    EXPECT_EQ((1LL << 23) * 1000, StatsdStats::getLatencyHistogramPercentileNs(
+                                          stats.mPulledAtomStats[11].pullTimeHistogram, 50));
+}
+
+TEST(StatsdStatsTest, TestIngestionLatencyStats) {
+    StatsdStats stats;
+
+    // Atom 10 is logged the most, then atom 11.
+    for (int i = 0; i < 3; i++) {
+        stats.noteLogEventLatency(10, /*queueWaitNs=*/2000, /*processingNs=*/500);
+    }
+    stats.noteLogEventLatency(11, /*queueWaitNs=*/4000, /*processingNs=*/1000);
+    stats.noteLogEventLatency(11, /*queueWaitNs=*/4000, /*processingNs=*/1000);
+    // Only the most logged atoms are broken down.
+    for (size_t i = 0; i < StatsdStats::kMaxLatencyReportedAtoms; i++) {
+        stats.noteLogEventLatency(100 + i, /*queueWaitNs=*/0, /*processingNs=*/0);
+    }
+
+    vector<uint8_t> output;
+    stats.dumpStats(&output, false);
+    StatsdStatsReport report;
+    EXPECT_TRUE(report.ParseFromArray(&output[0], output.size()));
+
+    ASSERT_TRUE(report.has_ingestion_latency_stats());
+    const auto& latencyStats = report.ingestion_latency_stats();
+    ASSERT_EQ(StatsdStats::kNumBinsInLatencyHistogram, latencyStats.queue_wait_latency_size());
+    ASSERT_EQ(StatsdStats::kNumBinsInLatencyHistogram, latencyStats.processing_latency_size());
+    EXPECT_EQ(StatsdStats::kMaxLatencyReportedAtoms, (size_t)latencyStats.queue_wait_latency(0));
+    EXPECT_EQ(3, latencyStats.queue_wait_latency(3));
+    EXPECT_EQ(2, latencyStats.queue_wait_latency(5));
+    EXPECT_EQ(13, latencyStats.processing_latency(0));
+    EXPECT_EQ(2, latencyStats.processing_latency(1));
+
+    ASSERT_EQ(StatsdStats::kMaxLatencyReportedAtoms, (size_t)latencyStats.atom_latency_size());
+    EXPECT_EQ(10, latencyStats.atom_latency(0).atom_id());
+    EXPECT_EQ(3, latencyStats.atom_latency(0).queue_wait_latency(3));
+    EXPECT_EQ(3, latencyStats.atom_latency(0).processing_latency(0));
+    EXPECT_EQ(11, latencyStats.atom_latency(1).atom_id());
+    EXPECT_EQ(2, latencyStats.atom_latency(1).queue_wait_latency(5));
+    EXPECT_EQ(2, latencyStats.atom_latency(1).processing_latency(1));
+
+    stats.reset();
+    EXPECT_EQ(0, stats.mIngestionLatency.count);
+    EXPECT_TRUE(stats.mAtomIngestionLatency.empty());
+}
+
+TEST(StatsdStatsTest, TestIngestionLatencyBatch) {
+    StatsdStats stats;
+    StatsdStats::LogEventLatencies latencies;
+    latencies.add(10, /*queueWaitNs=*/2000, /*processingNs=*/500);
+    latencies.add(10, /*queueWaitNs=*/2000, /*processingNs=*/500);
+    latencies.add(11, /*queueWaitNs=*/4000, /*processingNs=*/1000);
+    EXPECT_EQ(3, latencies.count());
+    EXPECT_EQ(0, stats.mIngestionLatency.count);
+
+    stats.noteLogEventLatencies(&latencies);
+    EXPECT_EQ(0, latencies.count());
+    EXPECT_EQ(3, stats.mIngestionLatency.count);
+    EXPECT_EQ(2, stats.mIngestionLatency.queueWait[3]);
+    EXPECT_EQ(1, stats.mIngestionLatency.queueWait[5]);
+    ASSERT_EQ(2u, stats.mAtomIngestionLatency.size());
+    EXPECT_EQ(2, stats.mAtomIngestionLatency[10].count);
+    EXPECT_EQ(2, stats.mAtomIngestionLatency[10].processing[0]);
+    EXPECT_EQ(1, stats.mAtomIngestionLatency[11].processing[1]);
+
+    // The cleared entries are not reported again.
+    latencies.add(11, /*queueWaitNs=*/4000, /*processingNs=*/1000);
+    stats.noteLogEventLatencies(&latencies);
+    EXPECT_EQ(4, stats.mIngestionLatency.count);
+    EXPECT_EQ(2, stats.mAtomIngestionLatency[10].count);
+    EXPECT_EQ(2, stats.mAtomIngestionLatency[11].count);
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
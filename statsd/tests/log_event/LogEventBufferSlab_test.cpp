@@ -0,0 +1,117 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "logd/LogEventBufferSlab.h"
+
+#include <gtest/gtest.h>
+
+#include "logd/LogEvent.h"
+#include "stats_event.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+TEST(LogEventBufferSlabTest, TestObtainAndRelease) {
+    LogEventBufferSlab slab(/*numBuffers=*/2, /*bufferSize=*/64);
+    EXPECT_EQ(64u, slab.bufferSize());
+    EXPECT_EQ(2u, slab.available());
+
+    LogEventBufferSlab::Buffer first = slab.obtain();
+    LogEventBufferSlab::Buffer second = slab.obtain();
+    ASSERT_TRUE(first);
+    ASSERT_TRUE(second);
+    EXPECT_NE(first.get(), second.get());
+    EXPECT_EQ(0u, slab.available());
+
+    // The slab is exhausted.
+    EXPECT_FALSE(slab.obtain());
+
+    // Moving transfers ownership, copying does not.
+    LogEventBufferSlab::Buffer moved = std::move(first);
+    EXPECT_FALSE(first);
+    ASSERT_TRUE(moved);
+    LogEventBufferSlab::Buffer copy = moved;
+    EXPECT_FALSE(copy);
+    EXPECT_EQ(0u, slab.available());
+
+    moved.reset();
+    EXPECT_EQ(1u, slab.available());
+    {
+        LogEventBufferSlab::Buffer scoped = std::move(second);
+    }
+    EXPECT_EQ(2u, slab.available());
+}
+
+TEST(LogEventBufferSlabTest, TestDeferredParse) {
+    AStatsEvent* statsEvent = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(statsEvent, 10);
+    AStatsEvent_overwriteTimestamp(statsEvent, 1000);
+    AStatsEvent_writeInt32(statsEvent, 7);
+    AStatsEvent_build(statsEvent);
+    size_t size;
+    uint8_t* buf = AStatsEvent_getBuffer(statsEvent, &size);
+
+    const size_t offset = 8;
+    LogEventBufferSlab slab(/*numBuffers=*/1, /*bufferSize=*/offset + size);
+    LogEventBufferSlab::Buffer buffer = slab.obtain();
+    ASSERT_TRUE(buffer);
+    memcpy(buffer.get() + offset, buf, size);
+    AStatsEvent_release(statsEvent);
+
+    LogEvent event(/*uid=*/100, /*pid=*/200);
+    event.setElapsedTimestampNs(500);
+    event.setDeferredBuffer(std::move(buffer), offset, size);
+    EXPECT_TRUE(event.hasDeferredBuffer());
+    EXPECT_EQ(100, event.GetUid());
+    EXPECT_EQ(500, event.GetElapsedTimestampNs());
+    EXPECT_EQ(0u, slab.available());
+
+    // A copy does not take the buffer.
+    LogEvent copy(event);
+    EXPECT_FALSE(copy.hasDeferredBuffer());
+
+    EXPECT_TRUE(event.parseDeferredBuffer());
+    EXPECT_FALSE(event.hasDeferredBuffer());
+    EXPECT_EQ(1u, slab.available());
+    EXPECT_TRUE(event.isValid());
+    EXPECT_EQ(10, event.GetTagId());
+    EXPECT_EQ(1000, event.GetElapsedTimestampNs());
+    ASSERT_EQ(1, event.size());
+    EXPECT_EQ(7, event.getValues()[0].mValue.int_value);
+}
+
+TEST(LogEventBufferSlabTest, TestResetReleasesDeferredBuffer) {
+    LogEventBufferSlab slab(/*numBuffers=*/1, /*bufferSize=*/64);
+    LogEvent event(/*uid=*/100, /*pid=*/200);
+    event.setDeferredBuffer(slab.obtain(), /*offset=*/0, /*len=*/0);
+    EXPECT_EQ(0u, slab.available());
+
+    event.reset(/*uid=*/300, /*pid=*/400);
+    EXPECT_FALSE(event.hasDeferredBuffer());
+    EXPECT_EQ(1u, slab.available());
+
+    // Parsing without a buffer fails.
+    EXPECT_FALSE(event.parseDeferredBuffer());
+    EXPECT_FALSE(event.isValid());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
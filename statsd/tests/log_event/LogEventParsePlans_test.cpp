@@ -0,0 +1,80 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "logd/LogEventParsePlans.h"
+
+#include <gtest/gtest.h>
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+const uint8_t kTypeInfos[] = {0x00, 0x01};
+const uint32_t kOffsets[] = {0, 5};
+
+}  // anonymous namespace
+
+TEST(LogEventParsePlansTest, TestAddAndGet) {
+    LogEventParsePlans plans(/*numSlots=*/16);
+    EXPECT_EQ(nullptr, plans.get(10));
+
+    plans.add(10, kTypeInfos, kOffsets, /*numFields=*/2, /*numBytes=*/14);
+    const LogEventParsePlan* plan = plans.get(10);
+    ASSERT_NE(nullptr, plan);
+    EXPECT_EQ(10, plan->atomId);
+    EXPECT_EQ(std::vector<uint8_t>(kTypeInfos, kTypeInfos + 2), plan->typeInfos);
+    EXPECT_EQ(std::vector<uint32_t>(kOffsets, kOffsets + 2), plan->offsets);
+    EXPECT_EQ(14, plan->numBytes);
+    EXPECT_EQ(nullptr, plans.get(11));
+}
+
+TEST(LogEventParsePlansTest, TestExistingPlanKept) {
+    LogEventParsePlans plans(/*numSlots=*/16);
+    plans.add(10, kTypeInfos, kOffsets, /*numFields=*/2, /*numBytes=*/14);
+    plans.add(10, kTypeInfos, kOffsets, /*numFields=*/1, /*numBytes=*/5);
+    ASSERT_NE(nullptr, plans.get(10));
+    EXPECT_EQ(14, plans.get(10)->numBytes);
+    EXPECT_EQ(1, plans.size());
+}
+
+TEST(LogEventParsePlansTest, TestCollidingAtomsReplaced) {
+    // 4 slots, so atoms 1 and 5 share a slot.
+    LogEventParsePlans plans(/*numSlots=*/3);
+    plans.add(1, kTypeInfos, kOffsets, /*numFields=*/2, /*numBytes=*/14);
+    plans.add(5, kTypeInfos, kOffsets, /*numFields=*/1, /*numBytes=*/5);
+    EXPECT_EQ(nullptr, plans.get(1));
+    ASSERT_NE(nullptr, plans.get(5));
+    EXPECT_EQ(5, plans.get(5)->numBytes);
+    EXPECT_EQ(2, plans.size());
+}
+
+TEST(LogEventParsePlansTest, TestMaxPlans) {
+    LogEventParsePlans plans(/*numSlots=*/LogEventParsePlans::kMaxPlans * 2);
+    for (size_t i = 0; i < LogEventParsePlans::kMaxPlans + 1; i++) {
+        plans.add(i, kTypeInfos, kOffsets, /*numFields=*/2, /*numBytes=*/14);
+    }
+    EXPECT_EQ(LogEventParsePlans::kMaxPlans, plans.size());
+    EXPECT_EQ(nullptr, plans.get(LogEventParsePlans::kMaxPlans));
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -0,0 +1,119 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "logd/LogEventPool.h"
+
+#include <gtest/gtest.h>
+
+#include "stats_event.h"
+#include "tests/statsd_test_util.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unique_ptr;
+
+namespace {
+
+void parseEvent(int32_t atomId, int64_t timestampNs, int32_t numFields, LogEvent* logEvent) {
+    AStatsEvent* statsEvent = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(statsEvent, atomId);
+    AStatsEvent_overwriteTimestamp(statsEvent, timestampNs);
+    for (int i = 0; i < numFields; i++) {
+        AStatsEvent_writeInt32(statsEvent, i);
+    }
+    parseStatsEventToLogEvent(statsEvent, logEvent);
+}
+
+}  // anonymous namespace
+
+TEST(LogEventPoolTest, TestObtainFromEmptyPool) {
+    LogEventPool pool(10);
+    unique_ptr<LogEvent> event = pool.obtain(/*uid=*/100, /*pid=*/200);
+    ASSERT_NE(nullptr, event);
+    EXPECT_EQ(100, event->GetUid());
+    EXPECT_EQ(200, event->GetPid());
+    EXPECT_EQ(0, event->size());
+}
+
+TEST(LogEventPoolTest, TestReleasedEventIsReset) {
+    LogEventPool pool(10);
+    unique_ptr<LogEvent> event = pool.obtain(/*uid=*/100, /*pid=*/200);
+    parseEvent(/*atomId=*/10, /*timestampNs=*/1000, /*numFields=*/5, event.get());
+    ASSERT_EQ(5, event->size());
+    const size_t capacity = event->getValues().capacity();
+    const LogEvent* rawEvent = event.get();
+
+    pool.release(std::move(event));
+    EXPECT_EQ(1u, pool.size());
+
+    event = pool.obtain(/*uid=*/300, /*pid=*/400);
+    EXPECT_EQ(0u, pool.size());
+    // The same object is handed out again, with its capacity retained.
+    EXPECT_EQ(rawEvent, event.get());
+    EXPECT_EQ(capacity, event->getValues().capacity());
+    EXPECT_EQ(300, event->GetUid());
+    EXPECT_EQ(400, event->GetPid());
+    EXPECT_EQ(0, event->size());
+    EXPECT_EQ(0, event->GetTagId());
+    EXPECT_TRUE(event->isValid());
+    EXPECT_FALSE(event->hasAttributionChain());
+
+    parseEvent(/*atomId=*/11, /*timestampNs=*/2000, /*numFields=*/2, event.get());
+    EXPECT_TRUE(event->isValid());
+    EXPECT_EQ(11, event->GetTagId());
+    EXPECT_EQ(2000, event->GetElapsedTimestampNs());
+    EXPECT_EQ(2, event->size());
+}
+
+TEST(LogEventPoolTest, TestPoolSizeIsBounded) {
+    LogEventPool pool(2);
+    std::vector<unique_ptr<LogEvent>> events;
+    for (int i = 0; i < 4; i++) {
+        events.push_back(pool.obtain(/*uid=*/0, /*pid=*/0));
+    }
+
+    pool.release(&events);
+    EXPECT_TRUE(events.empty());
+    EXPECT_EQ(2u, pool.size());
+}
+
+TEST(LogEventPoolTest, TestLargeEventIsNotPooled) {
+    LogEventPool pool(10);
+    unique_ptr<LogEvent> event = pool.obtain(/*uid=*/0, /*pid=*/0);
+
+    // Two repeated fields of 100 elements each hold more values than kMaxPooledValuesCapacity.
+    AStatsEvent* statsEvent = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(statsEvent, 10);
+    AStatsEvent_overwriteTimestamp(statsEvent, 1000);
+    std::vector<int32_t> elements(100, 1);
+    AStatsEvent_writeInt32Array(statsEvent, elements.data(), elements.size());
+    AStatsEvent_writeInt32Array(statsEvent, elements.data(), elements.size());
+    parseStatsEventToLogEvent(statsEvent, event.get());
+    ASSERT_TRUE(event->isValid());
+    ASSERT_GT(event->getValues().capacity(), LogEventPool::kMaxPooledValuesCapacity);
+
+    pool.release(std::move(event));
+    EXPECT_EQ(0u, pool.size());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -34,12 +34,13 @@ using std::unique_ptr;
 
 namespace {
 
-std::unique_ptr<LogEvent> makeLogEvent(uint64_t timestampNs) {
+std::unique_ptr<LogEvent> makeLogEvent(uint64_t timestampNs, int32_t uid = 0,
+                                       int32_t atomId = 10) {
     AStatsEvent* statsEvent = AStatsEvent_obtain();
-    AStatsEvent_setAtomId(statsEvent, 10);
+    AStatsEvent_setAtomId(statsEvent, atomId);
     AStatsEvent_overwriteTimestamp(statsEvent, timestampNs);
 
-    std::unique_ptr<LogEvent> logEvent = std::make_unique<LogEvent>(/*uid=*/0, /*pid=*/0);
+    std::unique_ptr<LogEvent> logEvent = std::make_unique<LogEvent>(uid, /*pid=*/0);
     parseStatsEventToLogEvent(statsEvent, logEvent.get());
     return logEvent;
 }
@@ -106,6 +107,266 @@ TEST(LogEventQueue_test, TestSlowConsumer) {
     writer.join();
 }
 
+TEST(LogEventQueue_test, TestPushBatch) {
+    LogEventQueue queue(5);
+    int64_t timeBaseNs = 100;
+
+    std::vector<unique_ptr<LogEvent>> batch;
+    for (int i = 0; i < 3; i++) {
+        batch.push_back(makeLogEvent(timeBaseNs + i * 1000));
+    }
+    int64_t oldestEventNs = 0;
+    EXPECT_EQ(0u, queue.pushBatch(&batch, &oldestEventNs));
+    EXPECT_TRUE(batch.empty());
+
+    // Only 2 of the 4 events fit in the queue.
+    for (int i = 3; i < 7; i++) {
+        batch.push_back(makeLogEvent(timeBaseNs + i * 1000));
+    }
+    EXPECT_EQ(2u, queue.pushBatch(&batch, &oldestEventNs));
+    EXPECT_EQ(timeBaseNs, oldestEventNs);
+    EXPECT_TRUE(batch.empty());
+
+    for (int i = 0; i < 5; i++) {
+        auto event = queue.waitPop();
+        EXPECT_TRUE(event != nullptr);
+        // All events are in right order.
+        EXPECT_EQ(timeBaseNs + i * 1000, event->GetElapsedTimestampNs());
+    }
+}
+
+TEST(LogEventQueue_test, TestWaitPopBatch) {
+    LogEventQueue queue(50);
+    int64_t timeBaseNs = 100;
+
+    // Times out when the queue stays empty.
+    std::vector<unique_ptr<LogEvent>> events;
+    EXPECT_EQ(0u, queue.waitPopBatch(/*maxSize=*/10, /*timeoutMs=*/10, &events));
+    EXPECT_TRUE(events.empty());
+
+    for (int i = 0; i < 15; i++) {
+        int64_t oldestEventNs;
+        EXPECT_TRUE(queue.push(makeLogEvent(timeBaseNs + i * 1000), &oldestEventNs));
+    }
+
+    EXPECT_EQ(10u, queue.waitPopBatch(/*maxSize=*/10, /*timeoutMs=*/-1, &events));
+    EXPECT_EQ(5u, queue.waitPopBatch(/*maxSize=*/10, /*timeoutMs=*/-1, &events));
+    ASSERT_EQ(15u, events.size());
+    for (int i = 0; i < 15; i++) {
+        // All events are in right order.
+        EXPECT_EQ(timeBaseNs + i * 1000, events[i]->GetElapsedTimestampNs());
+    }
+}
+
+TEST(LogEventQueue_test, TestDropNewestReportsUid) {
+    LogEventQueue queue(2);
+    int64_t oldestEventNs;
+    std::vector<LogEventQueue::DroppedEvent> droppedEvents;
+    EXPECT_TRUE(queue.push(makeLogEvent(100, /*uid=*/1000), &oldestEventNs, &droppedEvents));
+    EXPECT_TRUE(queue.push(makeLogEvent(200, /*uid=*/1000), &oldestEventNs, &droppedEvents));
+    EXPECT_FALSE(queue.push(makeLogEvent(300, /*uid=*/10001), &oldestEventNs, &droppedEvents));
+    EXPECT_EQ(100, oldestEventNs);
+    ASSERT_EQ(1u, droppedEvents.size());
+    EXPECT_EQ(10001, droppedEvents[0].uid);
+}
+
+TEST(LogEventQueue_test, TestShedNoisiestUid) {
+    const int32_t noisyUid = 10001;
+    const int32_t systemUid = 1000;
+    LogEventQueue queue(5, LogEventQueue::SHED_NOISIEST_UID);
+    int64_t oldestEventNs;
+    std::vector<LogEventQueue::DroppedEvent> droppedEvents;
+
+    EXPECT_TRUE(queue.push(makeLogEvent(100, systemUid), &oldestEventNs, &droppedEvents));
+    for (int i = 1; i < 5; i++) {
+        EXPECT_TRUE(queue.push(makeLogEvent(100 + i * 100, noisyUid), &oldestEventNs));
+    }
+
+    // The queue is full: the oldest event of the noisy uid is dropped for the system event.
+    EXPECT_FALSE(queue.push(makeLogEvent(600, systemUid), &oldestEventNs, &droppedEvents));
+    ASSERT_EQ(1u, droppedEvents.size());
+    EXPECT_EQ(noisyUid, droppedEvents[0].uid);
+    EXPECT_EQ(100, oldestEventNs);
+
+    // The noisy uid still has the most queued events, so its own incoming event is dropped.
+    EXPECT_FALSE(queue.push(makeLogEvent(700, noisyUid), &oldestEventNs, &droppedEvents));
+    ASSERT_EQ(2u, droppedEvents.size());
+    EXPECT_EQ(noisyUid, droppedEvents[1].uid);
+
+    // Batched pushes follow the same policy. After the first event, the system uid is the
+    // noisiest one and gets shed in turn.
+    std::vector<unique_ptr<LogEvent>> batch;
+    batch.push_back(makeLogEvent(800, systemUid));
+    batch.push_back(makeLogEvent(900, noisyUid));
+    droppedEvents.clear();
+    EXPECT_EQ(2u, queue.pushBatch(&batch, &oldestEventNs, &droppedEvents));
+    ASSERT_EQ(2u, droppedEvents.size());
+    EXPECT_EQ(noisyUid, droppedEvents[0].uid);
+    EXPECT_EQ(systemUid, droppedEvents[1].uid);
+
+    std::vector<unique_ptr<LogEvent>> events;
+    EXPECT_EQ(5u, queue.waitPopBatch(/*maxSize=*/10, /*timeoutMs=*/-1, &events));
+    const std::vector<int64_t> expectedTimestampsNs = {400, 500, 600, 800, 900};
+    ASSERT_EQ(expectedTimestampsNs.size(), events.size());
+    for (size_t i = 0; i < events.size(); i++) {
+        // Remaining events are in right order.
+        EXPECT_EQ(expectedTimestampsNs[i], events[i]->GetElapsedTimestampNs());
+    }
+}
+
+TEST(LogEventQueue_test, TestShedEvictsInSteps) {
+    const int32_t noisyUid = 10001;
+    const int32_t systemUid = 1000;
+    LogEventQueue queue(10, LogEventQueue::SHED_NOISIEST_UID);
+    int64_t oldestEventNs;
+    for (int i = 0; i < 10; i++) {
+        EXPECT_TRUE(queue.push(makeLogEvent(100 + i * 100, noisyUid), &oldestEventNs));
+    }
+
+    // The capacity drops well below the queue size, as in the byte budget mode: each push only
+    // evicts up to kMaxEvictionsPerPush events, then drops the incoming one.
+    {
+        std::unique_lock<std::mutex> lock(queue.mMutex);
+        queue.mCapacity = 5;
+    }
+    std::vector<LogEventQueue::DroppedEvent> droppedEvents;
+    EXPECT_FALSE(queue.push(makeLogEvent(1100, systemUid), &oldestEventNs, &droppedEvents));
+    ASSERT_EQ(LogEventQueue::kMaxEvictionsPerPush + 1, droppedEvents.size());
+    for (size_t i = 0; i < LogEventQueue::kMaxEvictionsPerPush; i++) {
+        EXPECT_EQ(noisyUid, droppedEvents[i].uid);
+    }
+    EXPECT_EQ(systemUid, droppedEvents.back().uid);
+    EXPECT_EQ(10 - LogEventQueue::kMaxEvictionsPerPush, queue.size());
+
+    // The next pushes keep shedding the noisy uid until the event fits.
+    droppedEvents.clear();
+    EXPECT_FALSE(queue.push(makeLogEvent(1200, systemUid), &oldestEventNs, &droppedEvents));
+    EXPECT_EQ(10 - 2 * LogEventQueue::kMaxEvictionsPerPush, queue.size());
+    droppedEvents.clear();
+    EXPECT_FALSE(queue.push(makeLogEvent(1300, systemUid), &oldestEventNs, &droppedEvents));
+    ASSERT_EQ(2u, droppedEvents.size());
+    EXPECT_EQ(noisyUid, droppedEvents[0].uid);
+    EXPECT_EQ(noisyUid, droppedEvents[1].uid);
+    EXPECT_EQ(5u, queue.size());
+}
+
+TEST(LogEventQueue_test, TestByteBudget) {
+    const size_t eventSizeBytes = makeLogEvent(100)->getSizeBytes();
+    ASSERT_GT(eventSizeBytes, 0u);
+
+    LogEventQueue queue(10);
+    queue.setByteBudget(/*maxBytes=*/eventSizeBytes * 2, /*minCapacity=*/1);
+    int64_t oldestEventNs;
+    std::vector<LogEventQueue::DroppedEvent> droppedEvents;
+    EXPECT_TRUE(queue.push(makeLogEvent(100), &oldestEventNs, &droppedEvents));
+    EXPECT_TRUE(queue.push(makeLogEvent(200), &oldestEventNs, &droppedEvents));
+
+    // The event count is well under the limit, but the byte budget is used up.
+    EXPECT_FALSE(queue.push(makeLogEvent(300, /*uid=*/10001), &oldestEventNs, &droppedEvents));
+    EXPECT_EQ(100, oldestEventNs);
+    ASSERT_EQ(1u, droppedEvents.size());
+    EXPECT_EQ(10001, droppedEvents[0].uid);
+    EXPECT_EQ(eventSizeBytes, droppedEvents[0].sizeBytes);
+
+    // Popping an event returns its bytes to the budget.
+    std::vector<unique_ptr<LogEvent>> events;
+    EXPECT_EQ(1u, queue.waitPopBatch(/*maxSize=*/1, /*timeoutMs=*/-1, &events));
+    EXPECT_TRUE(queue.push(makeLogEvent(400), &oldestEventNs, &droppedEvents));
+}
+
+TEST(LogEventQueue_test, TestByteBudgetAdaptsToDrainRate) {
+    LogEventQueue queue(1000);
+    queue.setByteBudget(/*maxBytes=*/1024 * 1024, /*minCapacity=*/10);
+    EXPECT_EQ(1000u, queue.getCapacity());
+
+    std::unique_lock<std::mutex> lock(queue.mMutex);
+    queue.mQueue.push_back(makeLogEvent(100));
+    // The queue was empty before the first pop, so no drain time is accounted yet.
+    queue.noteDrainLocked(/*nowNs=*/0, /*count=*/1);
+    EXPECT_EQ(1000u, queue.mCapacity);
+
+    // Backlogged for a full window while draining 1 event per second: the target capacity is
+    // clamped to the minimum, and the capacity moves halfway towards it.
+    queue.mQueue.clear();
+    queue.noteDrainLocked(/*nowNs=*/NS_PER_SEC, /*count=*/1);
+    EXPECT_EQ(505u, queue.mCapacity);
+
+    // An empty queue is not backlogged, so idle time does not lower the drain rate.
+    queue.noteDrainLocked(/*nowNs=*/100 * NS_PER_SEC, /*count=*/0);
+    EXPECT_EQ(505u, queue.mCapacity);
+
+    // A fast consumer brings the capacity back up towards the limit.
+    queue.mQueue.push_back(makeLogEvent(200));
+    queue.noteDrainLocked(/*nowNs=*/101 * NS_PER_SEC, /*count=*/0);
+    queue.noteDrainLocked(/*nowNs=*/102 * NS_PER_SEC, /*count=*/10000);
+    EXPECT_EQ(752u, queue.mCapacity);
+}
+
+TEST(LogEventQueue_test, TestPriorityLane) {
+    const int32_t priorityAtomId = 20;
+    LogEventQueue queue(2);
+    queue.setPriorityLane({priorityAtomId}, /*capacity=*/2);
+    int64_t oldestEventNs;
+    std::vector<LogEventQueue::DroppedEvent> droppedEvents;
+    EXPECT_TRUE(queue.push(makeLogEvent(100), &oldestEventNs, &droppedEvents));
+    EXPECT_TRUE(queue.push(makeLogEvent(200), &oldestEventNs, &droppedEvents));
+    EXPECT_FALSE(queue.push(makeLogEvent(300), &oldestEventNs, &droppedEvents));
+
+    // The priority lane has its own capacity.
+    EXPECT_TRUE(queue.push(makeLogEvent(400, /*uid=*/0, priorityAtomId), &oldestEventNs,
+                           &droppedEvents));
+    EXPECT_TRUE(queue.push(makeLogEvent(500, /*uid=*/0, priorityAtomId), &oldestEventNs,
+                           &droppedEvents));
+    EXPECT_FALSE(queue.push(makeLogEvent(600, /*uid=*/10001, priorityAtomId), &oldestEventNs,
+                            &droppedEvents));
+    EXPECT_EQ(100, oldestEventNs);
+    ASSERT_EQ(2u, droppedEvents.size());
+    EXPECT_EQ(10001, droppedEvents[1].uid);
+    EXPECT_EQ(4u, queue.size());
+    size_t expectedBytes = 0;
+    for (int64_t timestampNs : {100, 200, 400, 500}) {
+        expectedBytes += sizeof(LogEvent) + makeLogEvent(timestampNs)->getSizeBytes();
+    }
+    EXPECT_EQ(expectedBytes, queue.getQueuedByteSize());
+
+    // The priority lane is drained first, each lane in order.
+    std::vector<unique_ptr<LogEvent>> events;
+    EXPECT_EQ(4u, queue.waitPopBatch(/*maxSize=*/10, /*timeoutMs=*/-1, &events));
+    EXPECT_EQ(0u, queue.getQueuedByteSize());
+    const std::vector<int64_t> expectedTimestampsNs = {400, 500, 100, 200};
+    ASSERT_EQ(expectedTimestampsNs.size(), events.size());
+    for (size_t i = 0; i < events.size(); i++) {
+        EXPECT_EQ(expectedTimestampsNs[i], events[i]->GetElapsedTimestampNs());
+    }
+}
+
+TEST(LogEventQueue_test, TestAppLane) {
+    const int32_t appUid = 1010123;  // App 10123 of user 10.
+    LogEventQueue queue(2);
+    queue.setAppLane(/*capacity=*/1);
+    int64_t oldestEventNs;
+    std::vector<LogEventQueue::DroppedEvent> droppedEvents;
+    EXPECT_TRUE(queue.push(makeLogEvent(100, appUid), &oldestEventNs, &droppedEvents));
+    EXPECT_FALSE(queue.push(makeLogEvent(200, appUid), &oldestEventNs, &droppedEvents));
+    EXPECT_EQ(100, oldestEventNs);
+    ASSERT_EQ(1u, droppedEvents.size());
+    EXPECT_EQ(appUid, droppedEvents[0].uid);
+
+    // The flood of the app doesn't take the capacity of the platform events.
+    EXPECT_TRUE(queue.push(makeLogEvent(50, /*uid=*/1000), &oldestEventNs, &droppedEvents));
+    EXPECT_TRUE(queue.push(makeLogEvent(300, /*uid=*/0), &oldestEventNs, &droppedEvents));
+    EXPECT_EQ(3u, queue.size());
+
+    // The lanes are drained in timestamp order.
+    std::vector<unique_ptr<LogEvent>> events;
+    EXPECT_EQ(3u, queue.waitPopBatch(/*maxSize=*/10, /*timeoutMs=*/-1, &events));
+    const std::vector<int64_t> expectedTimestampsNs = {50, 100, 300};
+    ASSERT_EQ(expectedTimestampsNs.size(), events.size());
+    for (size_t i = 0; i < events.size(); i++) {
+        EXPECT_EQ(expectedTimestampsNs[i], events[i]->GetElapsedTimestampNs());
+    }
+}
+
 #else
 GTEST_LOG_(INFO) << "This test does nothing.\n";
 #endif
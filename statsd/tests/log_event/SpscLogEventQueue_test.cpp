@@ -0,0 +1,186 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "logd/SpscLogEventQueue.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <stdio.h>
+
+#include <thread>
+
+#include "stats_event.h"
+#include "tests/statsd_test_util.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using namespace android;
+using namespace testing;
+
+using std::unique_ptr;
+
+namespace {
+
+std::unique_ptr<LogEvent> makeLogEvent(uint64_t timestampNs) {
+    AStatsEvent* statsEvent = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(statsEvent, 10);
+    AStatsEvent_overwriteTimestamp(statsEvent, timestampNs);
+
+    std::unique_ptr<LogEvent> logEvent = std::make_unique<LogEvent>(/*uid=*/0, /*pid=*/0);
+    parseStatsEventToLogEvent(statsEvent, logEvent.get());
+    return logEvent;
+}
+
+} // anonymous namespace
+
+#ifdef __ANDROID__
+TEST(SpscLogEventQueue_test, TestGoodConsumer) {
+    SpscLogEventQueue queue(50);
+    int64_t timeBaseNs = 100;
+    std::thread writer([&queue, timeBaseNs] {
+        for (int i = 0; i < 100; i++) {
+            int64_t oldestEventNs;
+            bool success = queue.push(makeLogEvent(timeBaseNs + i * 1000), &oldestEventNs);
+            EXPECT_TRUE(success);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    std::thread reader([&queue, timeBaseNs] {
+        for (int i = 0; i < 100; i++) {
+            auto event = queue.waitPop();
+            EXPECT_TRUE(event != nullptr);
+            // All events are in right order.
+            EXPECT_EQ(timeBaseNs + i * 1000, event->GetElapsedTimestampNs());
+        }
+    });
+
+    reader.join();
+    writer.join();
+}
+
+TEST(SpscLogEventQueue_test, TestSlowConsumer) {
+    SpscLogEventQueue queue(50);
+    int64_t timeBaseNs = 100;
+    std::thread writer([&queue, timeBaseNs] {
+        int failure_count = 0;
+        int64_t oldestEventNs;
+        for (int i = 0; i < 100; i++) {
+            bool success = queue.push(makeLogEvent(timeBaseNs + i * 1000), &oldestEventNs);
+            if (!success) failure_count++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        // There is some remote chance that reader thread not get chance to run before writer thread
+        // ends. That's why the following comparison is not "==".
+        // There will be at least 45 events lost due to overflow.
+        EXPECT_TRUE(failure_count >= 45);
+        // The oldest event must be at least the 6th event.
+        EXPECT_TRUE(oldestEventNs <= (100 + 5 * 1000));
+    });
+
+    std::thread reader([&queue, timeBaseNs] {
+        // The consumer quickly processed 5 events, then it got stuck (not reading anymore).
+        for (int i = 0; i < 5; i++) {
+            auto event = queue.waitPop();
+            EXPECT_TRUE(event != nullptr);
+            // All events are in right order.
+            EXPECT_EQ(timeBaseNs + i * 1000, event->GetElapsedTimestampNs());
+        }
+    });
+
+    reader.join();
+    writer.join();
+}
+
+TEST(SpscLogEventQueue_test, TestPushBatchWrapsAround) {
+    SpscLogEventQueue queue(4);
+    int64_t timeBaseNs = 100;
+    int64_t oldestEventNs = 0;
+
+    // Push and pop more events than the capacity so that the positions wrap around.
+    for (int round = 0; round < 3; round++) {
+        std::vector<unique_ptr<LogEvent>> batch;
+        for (int i = 0; i < 6; i++) {
+            batch.push_back(makeLogEvent(timeBaseNs + (round * 6 + i) * 1000));
+        }
+        EXPECT_EQ(2u, queue.pushBatch(&batch, &oldestEventNs));
+        EXPECT_EQ(timeBaseNs + round * 6 * 1000, oldestEventNs);
+        EXPECT_TRUE(batch.empty());
+
+        for (int i = 0; i < 4; i++) {
+            auto event = queue.waitPop();
+            EXPECT_TRUE(event != nullptr);
+            EXPECT_EQ(timeBaseNs + (round * 6 + i) * 1000, event->GetElapsedTimestampNs());
+        }
+    }
+}
+
+TEST(SpscLogEventQueue_test, TestBlockedConsumerWakesUp) {
+    SpscLogEventQueue queue(10);
+    int64_t timeBaseNs = 100;
+
+    std::thread reader([&queue, timeBaseNs] {
+        auto event = queue.waitPop();
+        EXPECT_TRUE(event != nullptr);
+        EXPECT_EQ(timeBaseNs, event->GetElapsedTimestampNs());
+    });
+
+    // Give the reader time to block on the empty queue.
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    int64_t oldestEventNs;
+    EXPECT_TRUE(queue.push(makeLogEvent(timeBaseNs), &oldestEventNs));
+    reader.join();
+}
+
+TEST(SpscLogEventQueue_test, TestWaitPopBatch) {
+    SpscLogEventQueue queue(50);
+    int64_t timeBaseNs = 100;
+
+    // Times out when the queue stays empty.
+    std::vector<unique_ptr<LogEvent>> events;
+    EXPECT_EQ(0u, queue.waitPopBatch(/*maxSize=*/10, /*timeoutMs=*/10, &events));
+    EXPECT_TRUE(events.empty());
+
+    std::thread writer([&queue, timeBaseNs] {
+        for (int i = 0; i < 100; i++) {
+            int64_t oldestEventNs;
+            // Retry when the queue is full so that no event is lost.
+            while (!queue.push(makeLogEvent(timeBaseNs + i * 1000), &oldestEventNs)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    while (events.size() < 100) {
+        EXPECT_LE(queue.waitPopBatch(/*maxSize=*/10, /*timeoutMs=*/-1, &events), 10u);
+    }
+    writer.join();
+
+    ASSERT_EQ(100u, events.size());
+    for (int i = 0; i < 100; i++) {
+        // All events are in right order.
+        EXPECT_EQ(timeBaseNs + i * 1000, events[i]->GetElapsedTimestampNs());
+    }
+}
+
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
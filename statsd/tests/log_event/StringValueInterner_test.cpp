@@ -0,0 +1,110 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "logd/StringValueInterner.h"
+
+#include <gtest/gtest.h>
+
+#include "stats_event.h"
+#include "tests/statsd_test_util.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::make_shared;
+using std::string;
+using std::vector;
+
+namespace {
+
+void makeAttributionLogEvent(LogEvent* logEvent, int64_t timestampNs, const vector<int>& uids,
+                             const vector<string>& tags) {
+    AStatsEvent* statsEvent = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(statsEvent, 10);
+    AStatsEvent_overwriteTimestamp(statsEvent, timestampNs);
+    writeAttribution(statsEvent, uids, tags);
+    parseStatsEventToLogEvent(statsEvent, logEvent);
+}
+
+}  // anonymous namespace
+
+TEST(StringValueInternerTest, TestInternSameString) {
+    StringValueInterner interner(/*numSlots=*/16, /*maxLength=*/32);
+    sp<const ValuePayload> first = interner.intern("com.android.phone");
+    ASSERT_NE(nullptr, first);
+    EXPECT_EQ("com.android.phone", first->bytes());
+    EXPECT_EQ(std::hash<std::string_view>()("com.android.phone"), first->hash());
+
+    string copy = "com.android.phone";
+    EXPECT_EQ(first, interner.intern(copy));
+    EXPECT_EQ(1, interner.getHitCount());
+
+    EXPECT_NE(first, interner.intern("com.android.systemui"));
+}
+
+TEST(StringValueInternerTest, TestTooLong) {
+    StringValueInterner interner(/*numSlots=*/16, /*maxLength=*/4);
+    EXPECT_NE(nullptr, interner.intern("abcd"));
+    EXPECT_EQ(nullptr, interner.intern("abcde"));
+}
+
+TEST(StringValueInternerTest, TestSlotReplaced) {
+    // A single slot keeps the last string only.
+    StringValueInterner interner(/*numSlots=*/1, /*maxLength=*/32);
+    sp<const ValuePayload> a = interner.intern("a");
+    sp<const ValuePayload> b = interner.intern("b");
+    EXPECT_EQ("a", a->bytes());
+    EXPECT_EQ("b", b->bytes());
+    EXPECT_EQ(b, interner.intern("b"));
+    EXPECT_NE(a, interner.intern("a"));
+    EXPECT_EQ(1, interner.getHitCount());
+}
+
+TEST(StringValueInternerTest, TestAttributionTagsShared) {
+    LogEvent::setStringValueInterner(
+            make_shared<StringValueInterner>(/*numSlots=*/64, /*maxLength=*/32));
+    vector<int> uids = {1001, 1002};
+    vector<string> tags = {"tag1", "tag2"};
+    LogEvent event1(/*uid=*/0, /*pid=*/0);
+    LogEvent event2(/*uid=*/0, /*pid=*/0);
+    makeAttributionLogEvent(&event1, /*timestampNs=*/1000, uids, tags);
+    makeAttributionLogEvent(&event2, /*timestampNs=*/2000, uids, tags);
+    LogEvent::setStringValueInterner(nullptr);
+
+    const vector<FieldValue>& values1 = event1.getValues();
+    const vector<FieldValue>& values2 = event2.getValues();
+    ASSERT_EQ(values1.size(), values2.size());
+    for (size_t i = 0; i < values1.size(); i++) {
+        EXPECT_EQ(values1[i], values2[i]);
+        if (values1[i].mValue.getType() == STRING) {
+            EXPECT_EQ(values1[i].mValue.payload, values2[i].mValue.payload);
+        }
+    }
+
+    // Dimension keys built from either event hash the same.
+    HashableDimensionKey key1(values1);
+    HashableDimensionKey key2(values2);
+    EXPECT_EQ(key1, key2);
+    EXPECT_EQ(std::hash<HashableDimensionKey>()(key1), std::hash<HashableDimensionKey>()(key2));
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
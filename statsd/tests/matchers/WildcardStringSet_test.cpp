@@ -0,0 +1,88 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "matchers/WildcardStringSet.h"
+
+#include <gtest/gtest.h>
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+TEST(WildcardStringSetTest, TestInvalidPatterns) {
+    WildcardStringSet set;
+    EXPECT_FALSE(WildcardStringSet::isValidPattern(""));
+    EXPECT_FALSE(WildcardStringSet::isValidPattern("com.app\\"));
+    EXPECT_TRUE(WildcardStringSet::isValidPattern("com.app\\\\"));
+    EXPECT_FALSE(set.add(""));
+    EXPECT_FALSE(set.add("com.app\\"));
+    EXPECT_TRUE(set.empty());
+}
+
+TEST(WildcardStringSetTest, TestLiterals) {
+    WildcardStringSet set;
+    EXPECT_TRUE(set.add("com.app"));
+    EXPECT_TRUE(set.add("com.app"));
+    EXPECT_TRUE(set.add("lit\\*"));
+    EXPECT_FALSE(set.empty());
+    EXPECT_TRUE(set.matches("com.app"));
+    EXPECT_FALSE(set.matches("com.ap"));
+    EXPECT_FALSE(set.matches("com.apps"));
+    EXPECT_TRUE(set.matches("lit*"));
+    EXPECT_FALSE(set.matches("lit"));
+}
+
+TEST(WildcardStringSetTest, TestPrefixes) {
+    WildcardStringSet set;
+    EXPECT_TRUE(set.add("com.vendor.*"));
+    EXPECT_TRUE(set.add("com.vendor.camera**"));
+    EXPECT_TRUE(set.add("org.*"));
+    EXPECT_TRUE(set.matches("com.vendor."));
+    EXPECT_TRUE(set.matches("com.vendor.camera"));
+    EXPECT_TRUE(set.matches("org.app"));
+    EXPECT_FALSE(set.matches("com.vendor"));
+    EXPECT_FALSE(set.matches("com.other.app"));
+    EXPECT_FALSE(set.matches(""));
+
+    WildcardStringSet all;
+    EXPECT_TRUE(all.add("*"));
+    EXPECT_FALSE(all.empty());
+    EXPECT_TRUE(all.matches(""));
+    EXPECT_TRUE(all.matches("anything"));
+}
+
+TEST(WildcardStringSetTest, TestPatterns) {
+    WildcardStringSet set;
+    EXPECT_TRUE(set.add("a?c"));
+    EXPECT_TRUE(set.add("x*y*z"));
+    EXPECT_TRUE(set.add("*.test"));
+    EXPECT_TRUE(set.matches("abc"));
+    EXPECT_FALSE(set.matches("ac"));
+    EXPECT_FALSE(set.matches("abbc"));
+    EXPECT_TRUE(set.matches("xyz"));
+    EXPECT_TRUE(set.matches("xaaybbz"));
+    EXPECT_TRUE(set.matches("xyyzz"));
+    EXPECT_FALSE(set.matches("xzy"));
+    EXPECT_TRUE(set.matches("com.app.test"));
+    EXPECT_FALSE(set.matches("com.app.test2"));
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
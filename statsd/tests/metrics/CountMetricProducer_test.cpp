@@ -114,9 +114,8 @@ TEST(CountMetricProducerTest, TestNonDimensionalEvents) {
     // Flushes.
     countProducer.flushIfNeededLocked(bucketStartTimeNs + bucketSizeNs + 1);
     ASSERT_EQ(1UL, countProducer.mPastBuckets.size());
-    EXPECT_TRUE(countProducer.mPastBuckets.find(DEFAULT_METRIC_DIMENSION_KEY) !=
-                countProducer.mPastBuckets.end());
-    const auto& buckets = countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY];
+    EXPECT_TRUE(countProducer.mPastBuckets.contains(DEFAULT_METRIC_DIMENSION_KEY));
+    const auto& buckets = countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
     ASSERT_EQ(1UL, buckets.size());
     EXPECT_EQ(bucketStartTimeNs, buckets[0].mBucketStartNs);
     EXPECT_EQ(bucketStartTimeNs + bucketSizeNs, buckets[0].mBucketEndNs);
@@ -130,10 +129,10 @@ TEST(CountMetricProducerTest, TestNonDimensionalEvents) {
 
     countProducer.flushIfNeededLocked(bucketStartTimeNs + 2 * bucketSizeNs + 1);
     ASSERT_EQ(1UL, countProducer.mPastBuckets.size());
-    EXPECT_TRUE(countProducer.mPastBuckets.find(DEFAULT_METRIC_DIMENSION_KEY) !=
-                countProducer.mPastBuckets.end());
-    ASSERT_EQ(2UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
-    const auto& bucketInfo2 = countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][1];
+    EXPECT_TRUE(countProducer.mPastBuckets.contains(DEFAULT_METRIC_DIMENSION_KEY));
+    ASSERT_EQ(2UL, countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY).size());
+    const CountBucket bucketInfo2 =
+            countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY)[1];
     EXPECT_EQ(bucket2StartTimeNs, bucketInfo2.mBucketStartNs);
     EXPECT_EQ(bucket2StartTimeNs + bucketSizeNs, bucketInfo2.mBucketEndNs);
     EXPECT_EQ(1LL, bucketInfo2.mCount);
@@ -141,9 +140,8 @@ TEST(CountMetricProducerTest, TestNonDimensionalEvents) {
     // nothing happens in bucket 3. we should not record anything for bucket 3.
     countProducer.flushIfNeededLocked(bucketStartTimeNs + 3 * bucketSizeNs + 1);
     ASSERT_EQ(1UL, countProducer.mPastBuckets.size());
-    EXPECT_TRUE(countProducer.mPastBuckets.find(DEFAULT_METRIC_DIMENSION_KEY) !=
-                countProducer.mPastBuckets.end());
-    const auto& buckets3 = countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY];
+    EXPECT_TRUE(countProducer.mPastBuckets.contains(DEFAULT_METRIC_DIMENSION_KEY));
+    const auto& buckets3 = countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
     ASSERT_EQ(2UL, buckets3.size());
 }
 
@@ -179,10 +177,9 @@ TEST(CountMetricProducerTest, TestEventsWithNonSlicedCondition) {
 
     countProducer.flushIfNeededLocked(bucketStartTimeNs + bucketSizeNs + 1);
     ASSERT_EQ(1UL, countProducer.mPastBuckets.size());
-    EXPECT_TRUE(countProducer.mPastBuckets.find(DEFAULT_METRIC_DIMENSION_KEY) !=
-                countProducer.mPastBuckets.end());
+    EXPECT_TRUE(countProducer.mPastBuckets.contains(DEFAULT_METRIC_DIMENSION_KEY));
 
-    const auto& buckets = countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY];
+    const auto& buckets = countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
     ASSERT_EQ(1UL, buckets.size());
     const auto& bucketInfo = buckets[0];
     EXPECT_EQ(bucketStartTimeNs, bucketInfo.mBucketStartNs);
@@ -237,9 +234,8 @@ TEST(CountMetricProducerTest, TestEventsWithSlicedCondition) {
     countProducer.onMatchedLogEvent(1 /*log matcher index*/, event2);
     countProducer.flushIfNeededLocked(bucketStartTimeNs + bucketSizeNs + 1);
     ASSERT_EQ(1UL, countProducer.mPastBuckets.size());
-    EXPECT_TRUE(countProducer.mPastBuckets.find(DEFAULT_METRIC_DIMENSION_KEY) !=
-                countProducer.mPastBuckets.end());
-    const auto& buckets = countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY];
+    EXPECT_TRUE(countProducer.mPastBuckets.contains(DEFAULT_METRIC_DIMENSION_KEY));
+    const auto& buckets = countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
     ASSERT_EQ(1UL, buckets.size());
     const auto& bucketInfo = buckets[0];
     EXPECT_EQ(bucketStartTimeNs, bucketInfo.mBucketStartNs);
@@ -290,11 +286,11 @@ TEST_P(CountMetricProducerTest_PartialBucket, TestSplitInCurrentBucket) {
             countProducer.onStatsdInitCompleted(eventTimeNs);
             break;
     }
-    ASSERT_EQ(1UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
-    EXPECT_EQ(bucketStartTimeNs,
-              countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][0].mBucketStartNs);
-    EXPECT_EQ(eventTimeNs,
-              countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][0].mBucketEndNs);
+    vector<CountBucket> pastBuckets =
+            countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
+    ASSERT_EQ(1UL, pastBuckets.size());
+    EXPECT_EQ(bucketStartTimeNs, pastBuckets[0].mBucketStartNs);
+    EXPECT_EQ(eventTimeNs, pastBuckets[0].mBucketEndNs);
     EXPECT_EQ(0, countProducer.getCurrentBucketNum());
     EXPECT_EQ(eventTimeNs, countProducer.mCurrentBucketStartTimeNs);
     // Anomaly tracker only contains full buckets.
@@ -305,7 +301,7 @@ TEST_P(CountMetricProducerTest_PartialBucket, TestSplitInCurrentBucket) {
     LogEvent event2(/*uid=*/0, /*pid=*/0);
     makeLogEvent(&event2, bucketStartTimeNs + 59 * NS_PER_SEC + 10, tagId, /*uid=*/"222");
     countProducer.onMatchedLogEvent(1 /*log matcher index*/, event2);
-    ASSERT_EQ(1UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
+    ASSERT_EQ(1UL, countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY).size());
     EXPECT_EQ(eventTimeNs, countProducer.mCurrentBucketStartTimeNs);
     EXPECT_EQ(0, countProducer.getCurrentBucketNum());
     EXPECT_EQ(0, anomalyTracker->getSumOverPastBuckets(DEFAULT_METRIC_DIMENSION_KEY));
@@ -314,7 +310,7 @@ TEST_P(CountMetricProducerTest_PartialBucket, TestSplitInCurrentBucket) {
     LogEvent event3(/*uid=*/0, /*pid=*/0);
     makeLogEvent(&event3, bucketStartTimeNs + 62 * NS_PER_SEC + 10, tagId, /*uid=*/"333");
     countProducer.onMatchedLogEvent(1 /*log matcher index*/, event3);
-    ASSERT_EQ(2UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
+    ASSERT_EQ(2UL, countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY).size());
     EXPECT_EQ(lastEndTimeNs, countProducer.mCurrentBucketStartTimeNs);
     EXPECT_EQ(1, countProducer.getCurrentBucketNum());
     EXPECT_EQ(2, anomalyTracker->getSumOverPastBuckets(DEFAULT_METRIC_DIMENSION_KEY));
@@ -355,28 +351,27 @@ TEST_P(CountMetricProducerTest_PartialBucket, TestSplitInNextBucket) {
             countProducer.onStatsdInitCompleted(eventTimeNs);
             break;
     }
-    ASSERT_EQ(1UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
-    EXPECT_EQ(bucketStartTimeNs,
-              countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][0].mBucketStartNs);
-    EXPECT_EQ(bucketStartTimeNs + bucketSizeNs,
-              countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][0].mBucketEndNs);
+    vector<CountBucket> pastBuckets =
+            countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
+    ASSERT_EQ(1UL, pastBuckets.size());
+    EXPECT_EQ(bucketStartTimeNs, pastBuckets[0].mBucketStartNs);
+    EXPECT_EQ(bucketStartTimeNs + bucketSizeNs, pastBuckets[0].mBucketEndNs);
     EXPECT_EQ(eventTimeNs, countProducer.mCurrentBucketStartTimeNs);
 
     // Next event occurs in same bucket as partial bucket created.
     LogEvent event2(/*uid=*/0, /*pid=*/0);
     makeLogEvent(&event2, bucketStartTimeNs + 70 * NS_PER_SEC + 10, tagId, /*uid=*/"222");
     countProducer.onMatchedLogEvent(1 /*log matcher index*/, event2);
-    ASSERT_EQ(1UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
+    ASSERT_EQ(1UL, countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY).size());
 
     // Third event in following bucket.
     LogEvent event3(/*uid=*/0, /*pid=*/0);
     makeLogEvent(&event3, bucketStartTimeNs + 121 * NS_PER_SEC + 10, tagId, /*uid=*/"333");
     countProducer.onMatchedLogEvent(1 /*log matcher index*/, event3);
-    ASSERT_EQ(2UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
-    EXPECT_EQ((int64_t)eventTimeNs,
-              countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][1].mBucketStartNs);
-    EXPECT_EQ(bucketStartTimeNs + 2 * bucketSizeNs,
-              countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][1].mBucketEndNs);
+    pastBuckets = countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
+    ASSERT_EQ(2UL, pastBuckets.size());
+    EXPECT_EQ((int64_t)eventTimeNs, pastBuckets[1].mBucketStartNs);
+    EXPECT_EQ(bucketStartTimeNs + 2 * bucketSizeNs, pastBuckets[1].mBucketEndNs);
 }
 
 TEST(CountMetricProducerTest, TestSplitOnAppUpgradeDisabled) {
@@ -413,7 +408,7 @@ TEST(CountMetricProducerTest, TestSplitOnAppUpgradeDisabled) {
     // Check that there's a past bucket and the bucket end is not adjusted.
     countProducer.notifyAppUpgrade(eventTimeNs);
 
-    ASSERT_EQ(0UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
+    ASSERT_EQ(0UL, countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY).size());
     EXPECT_EQ(0, countProducer.getCurrentBucketNum());
     EXPECT_EQ(bucketStartTimeNs, countProducer.mCurrentBucketStartTimeNs);
     // Anomaly tracker only contains full buckets.
@@ -424,7 +419,7 @@ TEST(CountMetricProducerTest, TestSplitOnAppUpgradeDisabled) {
     LogEvent event2(/*uid=*/0, /*pid=*/0);
     makeLogEvent(&event2, eventTimeNs + 10 * NS_PER_SEC, tagId, /*uid=*/"222");
     countProducer.onMatchedLogEvent(1 /*log matcher index*/, event2);
-    ASSERT_EQ(0UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
+    ASSERT_EQ(0UL, countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY).size());
     EXPECT_EQ(bucketStartTimeNs, countProducer.mCurrentBucketStartTimeNs);
     EXPECT_EQ(0, countProducer.getCurrentBucketNum());
     EXPECT_EQ(0, anomalyTracker->getSumOverPastBuckets(DEFAULT_METRIC_DIMENSION_KEY));
@@ -433,12 +428,12 @@ TEST(CountMetricProducerTest, TestSplitOnAppUpgradeDisabled) {
     LogEvent event3(/*uid=*/0, /*pid=*/0);
     makeLogEvent(&event3, bucketStartTimeNs + 62 * NS_PER_SEC + 10, tagId, /*uid=*/"333");
     countProducer.onMatchedLogEvent(1 /*log matcher index*/, event3);
-    ASSERT_EQ(1UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
-    EXPECT_EQ(bucketStartTimeNs,
-              countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][0].mBucketStartNs);
-    EXPECT_EQ(bucketStartTimeNs + 60 * NS_PER_SEC,
-              countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][0].mBucketEndNs);
-    EXPECT_EQ(2, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][0].mCount);
+    vector<CountBucket> pastBuckets =
+            countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
+    ASSERT_EQ(1UL, pastBuckets.size());
+    EXPECT_EQ(bucketStartTimeNs, pastBuckets[0].mBucketStartNs);
+    EXPECT_EQ(bucketStartTimeNs + 60 * NS_PER_SEC, pastBuckets[0].mBucketEndNs);
+    EXPECT_EQ(2, pastBuckets[0].mCount);
     EXPECT_EQ(bucketStartTimeNs + 60 * NS_PER_SEC, countProducer.mCurrentBucketStartTimeNs);
     EXPECT_EQ(1, countProducer.getCurrentBucketNum());
     EXPECT_EQ(2, anomalyTracker->getSumOverPastBuckets(DEFAULT_METRIC_DIMENSION_KEY));
@@ -538,6 +533,356 @@ TEST(CountMetricProducerTest, TestOneWeekTimeUnit) {
     EXPECT_EQ(fiveWeeksOneDayNs, countProducer.getCurrentBucketEndTimeNs());
 }
 
+TEST(CountMetricProducerTest, TestPastBucketsShareBucketBounds) {
+    const MetricDimensionKey key1 = getMockedMetricDimensionKey(/*tagId=*/1, 0, "1");
+    const MetricDimensionKey key2 = getMockedMetricDimensionKey(/*tagId=*/1, 0, "2");
+
+    CountPastBuckets pastBuckets;
+    pastBuckets.addCount(key1, 0, 10, 1);
+    pastBuckets.addCount(key2, 0, 10, 2);
+    // key1 has no count in the second bucket.
+    pastBuckets.addCount(key2, 10, 15, 3);
+    pastBuckets.addCount(key1, 15, 20, 4);
+    pastBuckets.addCount(key2, 15, 20, 5);
+
+    ASSERT_EQ(2UL, pastBuckets.size());
+    // Three bucket bounds and five counts.
+    EXPECT_EQ(3 * 2 * sizeof(int64_t) + 5 * (sizeof(uint32_t) + sizeof(int64_t)),
+              pastBuckets.byteSize());
+
+    vector<CountBucket> buckets = pastBuckets.getBuckets(key1);
+    ASSERT_EQ(2UL, buckets.size());
+    EXPECT_EQ(0, buckets[0].mBucketStartNs);
+    EXPECT_EQ(10, buckets[0].mBucketEndNs);
+    EXPECT_EQ(1, buckets[0].mCount);
+    EXPECT_EQ(15, buckets[1].mBucketStartNs);
+    EXPECT_EQ(20, buckets[1].mBucketEndNs);
+    EXPECT_EQ(4, buckets[1].mCount);
+
+    buckets = pastBuckets.getBuckets(key2);
+    ASSERT_EQ(3UL, buckets.size());
+    EXPECT_EQ(10, buckets[1].mBucketStartNs);
+    EXPECT_EQ(15, buckets[1].mBucketEndNs);
+    EXPECT_EQ(3, buckets[1].mCount);
+    EXPECT_EQ(5, buckets[2].mCount);
+
+    pastBuckets.clear();
+    EXPECT_TRUE(pastBuckets.empty());
+    EXPECT_EQ(0UL, pastBuckets.byteSize());
+    EXPECT_TRUE(pastBuckets.getBuckets(key1).empty());
+}
+
+TEST(CountMetricProducerTest, TestPastBucketsShareDimensionKeys) {
+    const MetricDimensionKey key1 = getMockedMetricDimensionKey(/*tagId=*/1, 0, "1");
+    const MetricDimensionKey key2 = getMockedMetricDimensionKey(/*tagId=*/1, 0, "2");
+
+    CountPastBuckets pastBuckets1;
+    CountPastBuckets pastBuckets2;
+    pastBuckets1.addCount(key1, 0, 10, 1);
+    pastBuckets1.addCount(key1, 10, 20, 2);
+
+    // The keys move to the shared table with their counts.
+    sp<MetricDimensionKeyTable> keyTable = new MetricDimensionKeyTable();
+    pastBuckets1.setKeyTable(keyTable);
+    pastBuckets2.setKeyTable(keyTable);
+    EXPECT_EQ(1UL, keyTable->size());
+    EXPECT_EQ(2UL, pastBuckets1.getBuckets(key1).size());
+
+    pastBuckets2.addCount(key1, 0, 10, 3);
+    pastBuckets2.addCount(key2, 0, 10, 4);
+    EXPECT_EQ(2UL, keyTable->size());
+    ASSERT_EQ(1UL, pastBuckets2.getBuckets(key1).size());
+    EXPECT_EQ(3, pastBuckets2.getBuckets(key1)[0].mCount);
+
+    // key1 stays in the table while pastBuckets1 has it.
+    pastBuckets2.clear();
+    EXPECT_EQ(1UL, keyTable->size());
+    EXPECT_TRUE(pastBuckets1.contains(key1));
+    EXPECT_FALSE(pastBuckets2.contains(key1));
+
+    pastBuckets1.clear();
+    EXPECT_EQ(0UL, keyTable->size());
+}
+
+TEST(CountMetricProducerTest, TestDimensionCardinalityEstimate) {
+    int64_t bucketStartTimeNs = 10000000000;
+    int tagId = 1;
+
+    CountMetric metric;
+    metric.set_id(1);
+    metric.set_bucket(ONE_MINUTE);
+    metric.mutable_dimensions_in_what()->set_field(tagId);
+    metric.mutable_dimensions_in_what()->add_child()->set_field(1);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    CountMetricProducer countProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, bucketStartTimeNs, bucketStartTimeNs);
+    countProducer.setDimensionCardinalityEstimate(true);
+
+    for (int value : {1, 2, 1, 3}) {
+        shared_ptr<LogEvent> event =
+                CreateTwoValueLogEvent(tagId, bucketStartTimeNs + 1, value, /*value2=*/0);
+        countProducer.onMatchedLogEvent(1 /*log matcher index*/, *event);
+    }
+
+    ProtoOutputStream output;
+    ReportStrings strSet;
+    countProducer.onDumpReport(bucketStartTimeNs + 10, true /*include current partial bucket*/,
+                               true /*erase data*/, FAST, &strSet, &output);
+    StatsLogReport report = outputStreamToProto(&output);
+    EXPECT_EQ(3, report.estimated_dimension_cardinality());
+
+    // The estimate restarts after the report is erased.
+    ProtoOutputStream output2;
+    countProducer.onDumpReport(bucketStartTimeNs + 20, true /*include current partial bucket*/,
+                               true /*erase data*/, FAST, &strSet, &output2);
+    report = outputStreamToProto(&output2);
+    EXPECT_EQ(0, report.estimated_dimension_cardinality());
+
+    // A config update restarts the estimate, or drops it.
+    shared_ptr<LogEvent> event =
+            CreateTwoValueLogEvent(tagId, bucketStartTimeNs + 21, /*value1=*/4, /*value2=*/0);
+    countProducer.onMatchedLogEvent(1 /*log matcher index*/, *event);
+    countProducer.setDimensionCardinalityEstimate(true);
+    ASSERT_NE(nullptr, countProducer.mDimensionCardinality);
+    EXPECT_EQ(0, countProducer.mDimensionCardinality->estimate());
+    countProducer.setDimensionCardinalityEstimate(false);
+    ProtoOutputStream output3;
+    countProducer.onDumpReport(bucketStartTimeNs + 30, true /*include current partial bucket*/,
+                               true /*erase data*/, FAST, &strSet, &output3);
+    report = outputStreamToProto(&output3);
+    EXPECT_FALSE(report.has_estimated_dimension_cardinality());
+}
+
+TEST(CountMetricProducerTest, TestMaxHeavyHitters) {
+    int64_t bucketStartTimeNs = 10000000000;
+    int tagId = 1;
+
+    CountMetric metric;
+    metric.set_id(1);
+    metric.set_bucket(ONE_MINUTE);
+    metric.mutable_dimensions_in_what()->set_field(tagId);
+    metric.mutable_dimensions_in_what()->add_child()->set_field(1);
+    metric.set_max_heavy_hitters(2);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    CountMetricProducer countProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, bucketStartTimeNs, bucketStartTimeNs);
+
+    // 3 replaces 2, which has the lowest count, and counts from it.
+    for (int value : {1, 1, 1, 2, 3}) {
+        shared_ptr<LogEvent> event =
+                CreateTwoValueLogEvent(tagId, bucketStartTimeNs + 1, value, /*value2=*/0);
+        countProducer.onMatchedLogEvent(1 /*log matcher index*/, *event);
+    }
+    EXPECT_EQ(2UL, countProducer.mCurrentSlicedCounter->size());
+    EXPECT_EQ(1UL, countProducer.mCurrentCountErrors.size());
+    // The lowest count is at the front of the index.
+    ASSERT_EQ(2UL, countProducer.mHeavyHitterCounts.size());
+    EXPECT_EQ(2, countProducer.mHeavyHitterCounts.begin()->first);
+    EXPECT_EQ(3, countProducer.mHeavyHitterCounts.rbegin()->first);
+
+    ProtoOutputStream output;
+    ReportStrings strSet;
+    countProducer.onDumpReport(bucketStartTimeNs + 10, true /*include current partial bucket*/,
+                               true /*erase data*/, FAST, &strSet, &output);
+    StatsLogReport report = outputStreamToProto(&output);
+    ASSERT_EQ(2, report.count_metrics().data_size());
+    std::map<int, CountBucketInfo> bucketsByValue;
+    for (const CountMetricData& data : report.count_metrics().data()) {
+        ASSERT_EQ(1, data.dimension_leaf_values_in_what_size());
+        ASSERT_EQ(1, data.bucket_info_size());
+        bucketsByValue[data.dimension_leaf_values_in_what(0).value_int()] = data.bucket_info(0);
+    }
+    EXPECT_EQ(3, bucketsByValue[1].count());
+    EXPECT_FALSE(bucketsByValue[1].has_count_error());
+    EXPECT_EQ(2, bucketsByValue[3].count());
+    EXPECT_EQ(1, bucketsByValue[3].count_error());
+
+    // The errors restart with the bucket.
+    EXPECT_TRUE(countProducer.mCurrentCountErrors.empty());
+    EXPECT_TRUE(countProducer.mHeavyHitterCounts.empty());
+}
+
+TEST(CountMetricProducerTest, TestPastBucketRollup) {
+    int64_t bucketStartTimeNs = 10000000000;
+    int64_t bucketSizeNs = TimeUnitToBucketSizeInMillis(ONE_MINUTE) * 1000000LL;
+    int64_t rollupBucketSizeNs = 5 * bucketSizeNs;
+    int tagId = 1;
+
+    CountMetric metric;
+    metric.set_id(1);
+    metric.set_bucket(ONE_MINUTE);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    CountMetricProducer countProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, bucketStartTimeNs, bucketStartTimeNs);
+    countProducer.setPastBucketRollup(/*minAgeNs=*/2 * bucketSizeNs, rollupBucketSizeNs);
+
+    // One event per bucket for 12 buckets.
+    for (int i = 0; i < 12; i++) {
+        LogEvent event(/*uid=*/0, /*pid=*/0);
+        makeLogEvent(&event, bucketStartTimeNs + i * bucketSizeNs + 1, tagId);
+        countProducer.onMatchedLogEvent(1 /*log matcher index*/, event);
+    }
+    countProducer.flushIfNeededLocked(bucketStartTimeNs + 12 * bucketSizeNs + 1);
+
+    // The buckets that are 2 minutes old by the flush are merged by 5 minutes.
+    const auto& buckets = countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
+    ASSERT_EQ(4UL, buckets.size());
+    EXPECT_EQ(bucketStartTimeNs, buckets[0].mBucketStartNs);
+    EXPECT_EQ(bucketStartTimeNs + rollupBucketSizeNs, buckets[0].mBucketEndNs);
+    EXPECT_EQ(5LL, buckets[0].mCount);
+    EXPECT_EQ(bucketStartTimeNs + rollupBucketSizeNs, buckets[1].mBucketStartNs);
+    EXPECT_EQ(bucketStartTimeNs + 2 * rollupBucketSizeNs, buckets[1].mBucketEndNs);
+    EXPECT_EQ(5LL, buckets[1].mCount);
+    EXPECT_EQ(bucketStartTimeNs + 10 * bucketSizeNs, buckets[2].mBucketStartNs);
+    EXPECT_EQ(1LL, buckets[2].mCount);
+    EXPECT_EQ(bucketStartTimeNs + 11 * bucketSizeNs, buckets[3].mBucketStartNs);
+    EXPECT_EQ(1LL, buckets[3].mCount);
+
+    // The rolled up buckets are reported with their bounds.
+    ProtoOutputStream output;
+    ReportStrings strSet;
+    countProducer.onDumpReport(bucketStartTimeNs + 12 * bucketSizeNs + 2,
+                               false /*include current partial bucket*/, true /*erase data*/,
+                               FAST, &strSet, &output);
+    StatsLogReport report = outputStreamToProto(&output);
+    ASSERT_EQ(1, report.count_metrics().data_size());
+    const CountMetricData& data = report.count_metrics().data(0);
+    ASSERT_EQ(4, data.bucket_info_size());
+    EXPECT_EQ(NanoToMillis(bucketStartTimeNs), data.bucket_info(0).start_bucket_elapsed_millis());
+    EXPECT_EQ(NanoToMillis(bucketStartTimeNs + rollupBucketSizeNs),
+              data.bucket_info(0).end_bucket_elapsed_millis());
+    EXPECT_EQ(5, data.bucket_info(0).count());
+    EXPECT_TRUE(data.bucket_info(2).has_bucket_num());
+
+    // A config update without past_bucket_rollup stops the rollup.
+    countProducer.setPastBucketRollup(/*minAgeNs=*/0, /*bucketSizeNs=*/0);
+    for (int i = 12; i < 24; i++) {
+        LogEvent event(/*uid=*/0, /*pid=*/0);
+        makeLogEvent(&event, bucketStartTimeNs + i * bucketSizeNs + 1, tagId);
+        countProducer.onMatchedLogEvent(1 /*log matcher index*/, event);
+    }
+    countProducer.flushIfNeededLocked(bucketStartTimeNs + 24 * bucketSizeNs + 1);
+    EXPECT_EQ(12UL, countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY).size());
+}
+
+TEST(CountMetricProducerTest, TestCostTrackingDisabled) {
+    int64_t bucketStartTimeNs = 10000000000;
+    int tagId = 1;
+
+    CountMetric metric;
+    metric.set_id(1);
+    metric.set_bucket(ONE_MINUTE);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    CountMetricProducer countProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, bucketStartTimeNs, bucketStartTimeNs);
+    countProducer.setCostTracking(true);
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event, bucketStartTimeNs + 1, tagId);
+    countProducer.onMatchedLogEvent(1 /*log matcher index*/, event);
+    EXPECT_EQ(1, countProducer.mCostEventCount);
+
+    // A config update without track_metric_cost drops the cost and stops measuring it.
+    countProducer.setCostTracking(false);
+    EXPECT_EQ(0, countProducer.mCostEventCount);
+    countProducer.onMatchedLogEvent(1 /*log matcher index*/, event);
+    EXPECT_EQ(0, countProducer.mCostEventCount);
+}
+
+TEST(CountMetricProducerTest, TestDimensionalSampling) {
+    int64_t bucketStartTimeNs = 10000000000;
+    int tagId = 1;
+    const int32_t shardCount = 4;
+
+    CountMetric metric;
+    metric.set_id(1);
+    metric.set_bucket(ONE_MINUTE);
+    metric.mutable_dimensions_in_what()->set_field(tagId);
+    metric.mutable_dimensions_in_what()->add_child()->set_field(1);
+    DimensionalSamplingInfo* samplingInfo = metric.mutable_dimensional_sampling_info();
+    samplingInfo->mutable_sampled_what_field()->set_field(tagId);
+    samplingInfo->mutable_sampled_what_field()->add_child()->set_field(1);
+    samplingInfo->set_shard_count(shardCount);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    CountMetricProducer countProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, bucketStartTimeNs, bucketStartTimeNs);
+    countProducer.setSamplingInfo(metric.dimensional_sampling_info());
+
+    // Each value is either kept with all of its events or dropped.
+    std::set<int> expectedValues;
+    for (int value = 0; value < 100; value++) {
+        if (hashValue(Value(value)) % shardCount == 0) {
+            expectedValues.insert(value);
+        }
+        for (int i = 0; i < 2; i++) {
+            shared_ptr<LogEvent> event =
+                    CreateTwoValueLogEvent(tagId, bucketStartTimeNs + 1, value, /*value2=*/0);
+            countProducer.onMatchedLogEvent(1 /*log matcher index*/, *event);
+        }
+    }
+    ASSERT_FALSE(expectedValues.empty());
+    ASSERT_LT(expectedValues.size(), 100UL);
+
+    ProtoOutputStream output;
+    ReportStrings strSet;
+    countProducer.onDumpReport(bucketStartTimeNs + 10, true /*include current partial bucket*/,
+                               true /*erase data*/, FAST, &strSet, &output);
+    StatsLogReport report = outputStreamToProto(&output);
+    EXPECT_EQ(shardCount, report.sampling_shard_count());
+    std::set<int> values;
+    for (const CountMetricData& data : report.count_metrics().data()) {
+        ASSERT_EQ(1, data.dimension_leaf_values_in_what_size());
+        ASSERT_EQ(1, data.bucket_info_size());
+        EXPECT_EQ(2, data.bucket_info(0).count());
+        values.insert(data.dimension_leaf_values_in_what(0).value_int());
+    }
+    EXPECT_EQ(expectedValues, values);
+}
+
+TEST(CountMetricProducerTest, TestMemoryUsage) {
+    Alert alert;
+    alert.set_id(11);
+    alert.set_metric_id(1);
+    alert.set_trigger_if_sum_gt(100);
+    alert.set_num_buckets(2);
+
+    int64_t bucketStartTimeNs = 10000000000;
+    int64_t bucketSizeNs = TimeUnitToBucketSizeInMillis(ONE_MINUTE) * 1000000LL;
+    int tagId = 1;
+
+    CountMetric metric;
+    metric.set_id(1);
+    metric.set_bucket(ONE_MINUTE);
+    *metric.mutable_dimensions_in_what() = CreateDimensions(tagId, {1 /*uid field*/});
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    CountMetricProducer countProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, bucketStartTimeNs, bucketStartTimeNs);
+    sp<AlarmMonitor> alarmMonitor;
+    countProducer.addAnomalyTracker(alert, alarmMonitor, UPDATE_NEW, bucketStartTimeNs);
+    EXPECT_EQ(0UL, countProducer.currentBucketByteSize());
+    EXPECT_EQ(0UL, countProducer.anomalyTrackerByteSize());
+
+    countProducer.onMatchedLogEvent(1 /*log matcher index*/,
+                                    *CreateTwoValueLogEvent(tagId, bucketStartTimeNs + 1, 1, 0));
+    const size_t oneKeySize = countProducer.currentBucketByteSize();
+    EXPECT_GT(oneKeySize, 0UL);
+    countProducer.onMatchedLogEvent(1 /*log matcher index*/,
+                                    *CreateTwoValueLogEvent(tagId, bucketStartTimeNs + 2, 2, 0));
+    EXPECT_GT(countProducer.currentBucketByteSize(), oneKeySize);
+
+    // The counts move to the past buckets and the anomaly tracker.
+    countProducer.onMatchedLogEvent(
+            1 /*log matcher index*/,
+            *CreateTwoValueLogEvent(tagId, bucketStartTimeNs + bucketSizeNs + 1, 1, 0));
+    EXPECT_EQ(oneKeySize, countProducer.currentBucketByteSize());
+    EXPECT_GT(countProducer.anomalyTrackerByteSize(), 0UL);
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
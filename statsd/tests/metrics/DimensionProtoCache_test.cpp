@@ -0,0 +1,172 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/metrics/DimensionProtoCache.h"
+
+#include <gtest/gtest.h>
+
+#include "src/stats_log.pb.h"
+#include "stats_log_util.h"
+
+#ifdef __ANDROID__
+
+using android::util::FIELD_TYPE_MESSAGE;
+using android::util::ProtoOutputStream;
+using android::util::ProtoReader;
+using std::string;
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+const int FIELD_ID_DIMENSION = 1;
+const int FIELD_ID_DIMENSION_LEAF = 4;
+
+HashableDimensionKey makeDimension(int32_t uid, const string& tag) {
+    int pos1[] = {1, 1, 1};
+    int pos2[] = {1, 1, 2};
+    int pos3[] = {2, 0, 0};
+    HashableDimensionKey dimension;
+    dimension.addValue(FieldValue(Field(10, pos1, 2), Value(uid)));
+    dimension.addValue(FieldValue(Field(10, pos2, 2), Value(tag)));
+    dimension.addValue(FieldValue(Field(10, pos3, 0), Value((int64_t)99999)));
+    return dimension;
+}
+
+string toBytes(ProtoOutputStream& proto) {
+    string bytes;
+    sp<ProtoReader> reader = proto.data();
+    while (reader->readBuffer() != NULL) {
+        size_t toRead = reader->currentToRead();
+        bytes.append(reinterpret_cast<const char*>(reader->readBuffer()), toRead);
+        reader->move(toRead);
+    }
+    return bytes;
+}
+
+string writeDimension(const HashableDimensionKey& dimension, ReportStrings* strSet) {
+    ProtoOutputStream proto;
+    uint64_t token = proto.start(FIELD_TYPE_MESSAGE | FIELD_ID_DIMENSION);
+    writeDimensionToProto(dimension, strSet, &proto);
+    proto.end(token);
+    return toBytes(proto);
+}
+
+string writeLeafNodes(const HashableDimensionKey& dimension, ReportStrings* strSet) {
+    ProtoOutputStream proto;
+    writeDimensionLeafNodesToProto(dimension, FIELD_ID_DIMENSION_LEAF, strSet, &proto);
+    return toBytes(proto);
+}
+
+}  // namespace
+
+TEST(DimensionProtoCacheTest, TestWriteDimension) {
+    const HashableDimensionKey dimension = makeDimension(10025, "tag");
+    DimensionProtoCache cache;
+
+    for (int i = 0; i < 2; i++) {
+        ProtoOutputStream proto;
+        cache.writeDimension(dimension, FIELD_ID_DIMENSION, nullptr, &proto);
+        EXPECT_EQ(writeDimension(dimension, nullptr), toBytes(proto));
+    }
+    EXPECT_EQ(1UL, cache.size());
+
+    // Hashing the strings serializes the dimension again, and reports the strings every time.
+    for (int i = 0; i < 2; i++) {
+        ProtoOutputStream proto;
+        ReportStrings strSet;
+        cache.writeDimension(dimension, FIELD_ID_DIMENSION, &strSet, &proto);
+        ReportStrings expectedStrSet;
+        EXPECT_EQ(writeDimension(dimension, &expectedStrSet), toBytes(proto));
+        EXPECT_EQ(expectedStrSet.hashedStrings(), strSet.hashedStrings());
+    }
+}
+
+TEST(DimensionProtoCacheTest, TestWriteDimensionLeafNodes) {
+    const HashableDimensionKey dimension = makeDimension(10025, "tag");
+    DimensionProtoCache cache;
+
+    for (int i = 0; i < 2; i++) {
+        ProtoOutputStream proto;
+        cache.writeDimensionLeafNodes(dimension, FIELD_ID_DIMENSION_LEAF, nullptr, &proto);
+        EXPECT_EQ(writeLeafNodes(dimension, nullptr), toBytes(proto));
+    }
+
+    ProtoOutputStream proto;
+    ReportStrings strSet;
+    cache.writeDimensionLeafNodes(dimension, FIELD_ID_DIMENSION_LEAF, &strSet, &proto);
+    ReportStrings expectedStrSet;
+    EXPECT_EQ(writeLeafNodes(dimension, &expectedStrSet), toBytes(proto));
+    EXPECT_EQ(expectedStrSet.hashedStrings(), strSet.hashedStrings());
+}
+
+TEST(DimensionProtoCacheTest, TestWriteDimensionWithDictionary) {
+    const HashableDimensionKey dimension1 = makeDimension(1, "tag");
+    const HashableDimensionKey dimension2 = makeDimension(2, "tag");
+    DimensionProtoCache cache;
+
+    ProtoOutputStream proto;
+    ReportStrings strSet(true /* dictionary */);
+    cache.writeDimension(dimension1, FIELD_ID_DIMENSION, &strSet, &proto);
+    cache.writeDimension(dimension2, FIELD_ID_DIMENSION, &strSet, &proto);
+    EXPECT_EQ(0UL, cache.size());
+    EXPECT_EQ(1UL, strSet.size());
+
+    ReportStrings expectedStrSet(true /* dictionary */);
+    EXPECT_EQ(writeDimension(dimension1, &expectedStrSet) +
+                      writeDimension(dimension2, &expectedStrSet),
+              toBytes(proto));
+
+    // The dimension is written to the field of CountMetricData.dimensions_in_what.
+    CountMetricData data;
+    ASSERT_TRUE(data.ParseFromString(writeDimension(makeDimension(3, "tag3"), &strSet)));
+    const DimensionsValue& tag = data.dimensions_in_what().value_tuple().dimensions_value(0)
+                                         .value_tuple().dimensions_value(1);
+    EXPECT_EQ(1U, tag.value_str_index());
+    EXPECT_EQ(2UL, strSet.size());
+}
+
+TEST(DimensionProtoCacheTest, TestPruneUnused) {
+    const HashableDimensionKey dimension1 = makeDimension(1, "tag1");
+    const HashableDimensionKey dimension2 = makeDimension(2, "tag2");
+    DimensionProtoCache cache;
+    EXPECT_EQ(0UL, cache.byteSize());
+
+    ProtoOutputStream proto;
+    cache.writeDimension(dimension1, FIELD_ID_DIMENSION, nullptr, &proto);
+    cache.writeDimension(dimension2, FIELD_ID_DIMENSION, nullptr, &proto);
+    cache.pruneUnused();
+    EXPECT_EQ(2UL, cache.size());
+    const size_t twoDimensionsByteSize = cache.byteSize();
+    EXPECT_GT(twoDimensionsByteSize, 0UL);
+
+    // The next dump only reports dimension2.
+    cache.writeDimensionLeafNodes(dimension2, FIELD_ID_DIMENSION_LEAF, nullptr, &proto);
+    cache.pruneUnused();
+    EXPECT_EQ(1UL, cache.size());
+    EXPECT_LT(cache.byteSize(), twoDimensionsByteSize);
+
+    cache.pruneUnused();
+    EXPECT_EQ(0UL, cache.size());
+    EXPECT_EQ(0UL, cache.byteSize());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -85,7 +85,7 @@ TEST_F(EventMetricProducerTest, TestNoCondition) {
 
     // Check dump report content.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     eventProducer.onDumpReport(bucketStartTimeNs + 20, true /*include current partial bucket*/,
                                true /*erase data*/, FAST, &strSet, &output);
 
@@ -127,7 +127,7 @@ TEST_F(EventMetricProducerTest, TestEventsWithNonSlicedCondition) {
 
     // Check dump report content.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     eventProducer.onDumpReport(bucketStartTimeNs + 20, true /*include current partial bucket*/,
                                true /*erase data*/, FAST, &strSet, &output);
 
@@ -180,7 +180,7 @@ TEST_F(EventMetricProducerTest, TestEventsWithSlicedCondition) {
 
     // Check dump report content.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     eventProducer.onDumpReport(bucketStartTimeNs + 20, true /*include current partial bucket*/,
                                true /*erase data*/, FAST, &strSet, &output);
 
@@ -219,7 +219,7 @@ TEST_F(EventMetricProducerTest, TestOneAtomTagAggregatedEvents) {
 
     // Check dump report content.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     eventProducer.onDumpReport(bucketStartTimeNs + 50, true /*include current partial bucket*/,
                                true /*erase data*/, FAST, &strSet, &output);
 
@@ -267,7 +267,7 @@ TEST_F(EventMetricProducerTest, TestTwoAtomTagAggregatedEvents) {
 
     // Check dump report content.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     eventProducer.onDumpReport(bucketStartTimeNs + 50, true /*include current partial bucket*/,
                                true /*erase data*/, FAST, &strSet, &output);
 
@@ -287,6 +287,52 @@ TEST_F(EventMetricProducerTest, TestTwoAtomTagAggregatedEvents) {
         }
     }
 }
+
+TEST_F(EventMetricProducerTest, TestEncodedAtomsWithoutDeduplication) {
+    int64_t bucketStartTimeNs = 10000000000;
+    int tagId = 1;
+
+    EventMetric metric;
+    metric.set_id(1);
+    metric.set_deduplicate_atoms(false);
+
+    LogEvent event1(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event1, tagId, bucketStartTimeNs + 20, "111");
+    LogEvent event2(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event2, tagId, bucketStartTimeNs + 10, "111");
+    LogEvent event3(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event3, tagId, bucketStartTimeNs + 30, "222");
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    EventMetricProducer eventProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, bucketStartTimeNs);
+
+    eventProducer.onMatchedLogEvent(1 /*matcher index*/, event1);
+    eventProducer.onMatchedLogEvent(1 /*matcher index*/, event2);
+    eventProducer.onMatchedLogEvent(1 /*matcher index*/, event3);
+    EXPECT_TRUE(eventProducer.mAggregatedAtoms.empty());
+    EXPECT_EQ(eventProducer.mEncodedAtoms.size(), eventProducer.byteSize());
+
+    // Check dump report content.
+    ProtoOutputStream output;
+    ReportStrings strSet;
+    eventProducer.onDumpReport(bucketStartTimeNs + 50, true /*include current partial bucket*/,
+                               true /*erase data*/, FAST, &strSet, &output);
+    EXPECT_EQ(0UL, eventProducer.byteSize());
+
+    StatsLogReport report = outputStreamToProto(&output);
+    EXPECT_TRUE(report.has_event_metrics());
+    ASSERT_EQ(3, report.event_metrics().data_size());
+
+    const vector<int64_t> expectedTimestampsNs = {bucketStartTimeNs + 20, bucketStartTimeNs + 10,
+                                                  bucketStartTimeNs + 30};
+    for (int i = 0; i < report.event_metrics().data_size(); i++) {
+        AggregatedAtomInfo atomInfo = report.event_metrics().data(i).aggregated_atom_info();
+        EXPECT_TRUE(atomInfo.has_atom());
+        ASSERT_EQ(1, atomInfo.elapsed_timestamp_nanos_size());
+        EXPECT_EQ(expectedTimestampsNs[i], atomInfo.elapsed_timestamp_nanos(0));
+    }
+}
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
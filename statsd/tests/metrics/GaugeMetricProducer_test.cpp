@@ -70,6 +70,12 @@ shared_ptr<LogEvent> makeLogEvent(int32_t atomId, int64_t timestampNs, int32_t v
     parseStatsEventToLogEvent(statsEvent, logEvent.get());
     return logEvent;
 }
+
+class MockDeferringStatsPullerManager : public MockStatsPullerManager {
+public:
+    MOCK_METHOD4(PullDeferred, bool(int tagId, const ConfigKey& configKey, int64_t eventTimeNs,
+                                    wp<PullDataReceiver> receiver));
+};
 }  // anonymous namespace
 
 // Setup for parameterized tests.
@@ -112,6 +118,37 @@ TEST(GaugeMetricProducerTest, TestFirstBucket) {
     EXPECT_EQ(660000000005, gaugeProducer.getCurrentBucketEndTimeNs());
 }
 
+/*
+ * Tests that the pulled metrics are only registered to the puller once in use, since the
+ * MetricsManagers are built while the pulls of the other configs are delivered.
+ */
+TEST(GaugeMetricProducerTest, TestRegisterReceiverOnFirstBucket) {
+    GaugeMetric metric;
+    metric.set_id(metricId);
+    metric.set_bucket(ONE_MINUTE);
+    metric.set_max_pull_delay_sec(INT_MAX);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+
+    sp<EventMatcherWizard> eventMatcherWizard =
+            createEventMatcherWizard(tagId, logEventMatcherIndex);
+
+    // No call is expected from the constructor.
+    sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+    GaugeMetricProducer gaugeProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, logEventMatcherIndex, eventMatcherWizard,
+                                      tagId, -1, tagId, bucketStartTimeNs, bucketStartTimeNs,
+                                      pullerManager);
+
+    EXPECT_CALL(*pullerManager, RegisterReceiver(tagId, kConfigKey, _, bucket2StartTimeNs,
+                                                 bucketSizeNs))
+            .WillOnce(Return());
+    EXPECT_CALL(*pullerManager, UnRegisterReceiver(tagId, kConfigKey, _)).WillOnce(Return());
+    EXPECT_CALL(*pullerManager, Pull(tagId, kConfigKey, bucketStartTimeNs, _))
+            .WillOnce(Return(false));
+    gaugeProducer.prepareFirstBucket();
+}
+
 TEST(GaugeMetricProducerTest, TestPulledEventsNoCondition) {
     GaugeMetric metric;
     metric.set_id(metricId);
@@ -295,6 +332,45 @@ TEST_P(GaugeMetricProducerTest_PartialBucket, TestPushedEvents) {
     EXPECT_EQ(2, anomalyTracker->getSumOverPastBuckets(DEFAULT_METRIC_DIMENSION_KEY));
 }
 
+TEST(GaugeMetricProducerTest, TestAnomalyTrackerAddedMidBucket) {
+    sp<AlarmMonitor> alarmMonitor;
+    GaugeMetric metric;
+    metric.set_id(metricId);
+    metric.set_bucket(ONE_MINUTE);
+    metric.mutable_gauge_fields_filter()->set_include_all(true);
+
+    Alert alert;
+    alert.set_id(101);
+    alert.set_metric_id(metricId);
+    alert.set_trigger_if_sum_gt(25);
+    alert.set_num_buckets(100);
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+
+    sp<EventMatcherWizard> eventMatcherWizard =
+            createEventMatcherWizard(tagId, logEventMatcherIndex);
+
+    GaugeMetricProducer gaugeProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, logEventMatcherIndex, eventMatcherWizard,
+                                      -1 /* -1 means no pulling */, -1, tagId, bucketStartTimeNs,
+                                      bucketStartTimeNs, pullerManager);
+    gaugeProducer.prepareFirstBucket();
+
+    // The atom stored before the tracker is added still counts for the bucket.
+    LogEvent event1(/*uid=*/0, /*pid=*/0);
+    CreateTwoValueLogEvent(&event1, tagId, bucketStartTimeNs + 10, 3, 10);
+    gaugeProducer.onMatchedLogEvent(1 /*log matcher index*/, event1);
+    sp<AnomalyTracker> anomalyTracker = gaugeProducer.addAnomalyTracker(
+            alert, alarmMonitor, UPDATE_NEW, bucketStartTimeNs + 20);
+    ASSERT_NE(nullptr, anomalyTracker);
+
+    LogEvent event2(/*uid=*/0, /*pid=*/0);
+    CreateTwoValueLogEvent(&event2, tagId, bucketStartTimeNs + 65 * NS_PER_SEC, 1, 10);
+    gaugeProducer.onMatchedLogEvent(1 /*log matcher index*/, event2);
+    EXPECT_EQ(1L, gaugeProducer.mCurrentBucketNum);
+    EXPECT_EQ(3, anomalyTracker->getSumOverPastBuckets(DEFAULT_METRIC_DIMENSION_KEY));
+}
+
 TEST_P(GaugeMetricProducerTest_PartialBucket, TestPulled) {
     GaugeMetric metric;
     metric.set_id(metricId);
@@ -492,6 +568,67 @@ TEST(GaugeMetricProducerTest, TestPulledEventsWithCondition) {
                             ->mValue.int_value);
 }
 
+TEST(GaugeMetricProducerTest, TestDeferredPullKeepsScheduledState) {
+    GaugeMetric metric;
+    metric.set_id(metricId);
+    metric.set_bucket(ONE_MINUTE);
+    metric.set_max_pull_delay_sec(10);
+    metric.set_split_bucket_for_app_upgrade(true);
+    auto gaugeFieldMatcher = metric.mutable_gauge_fields_filter()->mutable_fields();
+    gaugeFieldMatcher->set_field(tagId);
+    gaugeFieldMatcher->add_child()->set_field(2);
+    metric.set_condition(StringToId("SCREEN_ON"));
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+
+    sp<EventMatcherWizard> eventMatcherWizard =
+            createEventMatcherWizard(tagId, logEventMatcherIndex);
+
+    // The first bucket and the condition changes are pulled synchronously, only the partial
+    // bucket is deferred.
+    sp<MockDeferringStatsPullerManager> pullerManager =
+            new StrictMock<MockDeferringStatsPullerManager>();
+    EXPECT_CALL(*pullerManager, RegisterReceiver(tagId, kConfigKey, _, _, _)).WillOnce(Return());
+    EXPECT_CALL(*pullerManager, UnRegisterReceiver(tagId, kConfigKey, _)).WillOnce(Return());
+    EXPECT_CALL(*pullerManager, Pull(tagId, kConfigKey, bucketStartTimeNs, _))
+            .WillOnce(Return(false));
+    EXPECT_CALL(*pullerManager, PullDeferred(tagId, kConfigKey, partialBucketSplitTimeNs, _))
+            .WillOnce(Return(true));
+
+    GaugeMetricProducer gaugeProducer(kConfigKey, metric, 0 /*condition index*/,
+                                      {ConditionState::kTrue}, wizard, protoHash,
+                                      logEventMatcherIndex, eventMatcherWizard, tagId, -1, tagId,
+                                      bucketStartTimeNs, bucketStartTimeNs, pullerManager);
+    gaugeProducer.prepareFirstBucket();
+
+    gaugeProducer.notifyAppUpgrade(partialBucketSplitTimeNs);
+    ASSERT_EQ(1UL, gaugeProducer.mDeferredPulls.size());
+    EXPECT_EQ(partialBucketSplitTimeNs, gaugeProducer.mCurrentBucketStartTimeNs);
+
+    // The condition turns false before the data arrives, the data is still matched since the
+    // condition was true when the pull was issued.
+    gaugeProducer.onConditionChanged(false, partialBucketSplitTimeNs + 10);
+    vector<shared_ptr<LogEvent>> allData;
+    allData.push_back(CreateRepeatedValueLogEvent(tagId, partialBucketSplitTimeNs + 20, 120));
+    // The pull itself was quick, however late the data is dispatched.
+    gaugeProducer.onDeferredDataPulled(allData, /*pullSuccess=*/true, partialBucketSplitTimeNs,
+                                       /*pullDelayNs=*/NS_PER_SEC);
+    EXPECT_TRUE(gaugeProducer.mDeferredPulls.empty());
+    EXPECT_EQ(ConditionState::kFalse, gaugeProducer.mCondition);
+    ASSERT_EQ(1UL, gaugeProducer.mCurrentSlicedBucket->size());
+    const GaugeAtom& atom = gaugeProducer.mCurrentSlicedBucket->begin()->second.front();
+    EXPECT_EQ(120, atom.mFields->begin()->mValue.int_value);
+    EXPECT_EQ(partialBucketSplitTimeNs, atom.mElapsedTimestampNs);
+
+    // The data of a pull that is not pending is dropped.
+    allData.clear();
+    allData.push_back(CreateRepeatedValueLogEvent(tagId, partialBucketSplitTimeNs + 30, 130));
+    gaugeProducer.onDeferredDataPulled(allData, /*pullSuccess=*/true, partialBucketSplitTimeNs,
+                                       /*pullDelayNs=*/NS_PER_SEC);
+    ASSERT_EQ(1UL, gaugeProducer.mCurrentSlicedBucket->size());
+    EXPECT_EQ(1UL, gaugeProducer.mCurrentSlicedBucket->begin()->second.size());
+}
+
 TEST(GaugeMetricProducerTest, TestPulledEventsWithSlicedCondition) {
     const int conditionTag = 65;
     GaugeMetric metric;
@@ -515,7 +652,7 @@ TEST(GaugeMetricProducerTest, TestPulledEventsWithSlicedCondition) {
                         int pos[] = {1, 0, 0};
                         Field f(conditionTag, pos, 0);
                         HashableDimensionKey key;
-                        key.mutableValues()->emplace_back(f, Value((int32_t)1000000));
+                        key.addValue(FieldValue(f, Value((int32_t)1000000)));
 
                         return ConditionState::kTrue;
                     }));
@@ -789,6 +926,60 @@ TEST(GaugeMetricProducerTest, TestRemoveDimensionInOutput) {
     EXPECT_THAT(atomValues, UnorderedElementsAre(5, 6));
 }
 
+TEST(GaugeMetricProducerTest, TestReservoirSamples) {
+    GaugeMetric metric;
+    metric.set_id(metricId);
+    metric.set_bucket(ONE_MINUTE);
+    metric.set_sampling_type(GaugeMetric::RESERVOIR_SAMPLES);
+    metric.set_max_num_gauge_atoms_per_bucket(3);
+    metric.mutable_gauge_fields_filter()->set_include_all(true);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+    sp<EventMatcherWizard> eventMatcherWizard =
+            createEventMatcherWizard(tagId, logEventMatcherIndex);
+
+    GaugeMetricProducer gaugeProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, logEventMatcherIndex, eventMatcherWizard,
+                                      -1 /* -1 means no pulling */, -1, tagId, bucketStartTimeNs,
+                                      bucketStartTimeNs, pullerManager);
+    gaugeProducer.prepareFirstBucket();
+
+    // The first atoms are kept until the reservoir is full.
+    for (int i = 1; i <= 3; i++) {
+        LogEvent event(/*uid=*/0, /*pid=*/0);
+        CreateTwoValueLogEvent(&event, tagId, bucketStartTimeNs + i, 1, i);
+        gaugeProducer.onMatchedLogEvent(1 /*log matcher index*/, event);
+    }
+    ASSERT_EQ(3UL, gaugeProducer.mCurrentSlicedBucket->begin()->second.size());
+
+    // Later atoms replace some of them, without growing the bucket.
+    for (int i = 4; i <= 100; i++) {
+        LogEvent event(/*uid=*/0, /*pid=*/0);
+        CreateTwoValueLogEvent(&event, tagId, bucketStartTimeNs + i, 1, i);
+        gaugeProducer.onMatchedLogEvent(1 /*log matcher index*/, event);
+    }
+    const vector<GaugeAtom>& gaugeAtoms = gaugeProducer.mCurrentSlicedBucket->begin()->second;
+    ASSERT_EQ(3UL, gaugeAtoms.size());
+    set<int> atomValues;
+    for (const GaugeAtom& atom : gaugeAtoms) {
+        const int value = atom.mFields->at(1).mValue.int_value;
+        EXPECT_EQ(bucketStartTimeNs + value, atom.mElapsedTimestampNs);
+        atomValues.insert(value);
+    }
+    EXPECT_EQ(3UL, atomValues.size());
+    EXPECT_EQ(100, gaugeProducer.mCurrentSampledAtomCounts.begin()->second);
+
+    // The next bucket starts a new reservoir.
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    CreateTwoValueLogEvent(&event, tagId, bucket2StartTimeNs + 1, 1, 101);
+    gaugeProducer.onMatchedLogEvent(1 /*log matcher index*/, event);
+    ASSERT_EQ(1UL, gaugeProducer.mPastBuckets.size());
+    EXPECT_EQ(3UL, gaugeProducer.mPastBuckets.begin()->second.back().mAggregatedAtoms.size());
+    ASSERT_EQ(1UL, gaugeProducer.mCurrentSlicedBucket->begin()->second.size());
+    EXPECT_EQ(1, gaugeProducer.mCurrentSampledAtomCounts.begin()->second);
+}
+
 /*
  * Test that BUCKET_TOO_SMALL dump reason is logged when a flushed bucket size
  * is smaller than the "min_bucket_size_nanos" specified in the metric config.
@@ -828,7 +1019,7 @@ TEST(GaugeMetricProducerTest_BucketDrop, TestBucketDropWhenBucketTooSmall) {
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     gaugeProducer.onDumpReport(bucketStartTimeNs + 9000000, true /* include recent buckets */, true,
                                FAST /* dump_latency */, &strSet, &output);
 
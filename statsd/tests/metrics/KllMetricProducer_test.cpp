@@ -30,7 +30,6 @@
 
 using namespace testing;
 using android::sp;
-using dist_proc::aggregation::KllQuantile;
 using std::make_shared;
 using std::optional;
 using std::set;
@@ -62,7 +61,8 @@ const int64_t bucket6StartTimeNs = bucketStartTimeNs + 5 * bucketSizeNs;
 
 static void assertPastBucketsSingleKey(
         const std::unordered_map<MetricDimensionKey,
-                                 std::vector<PastBucket<unique_ptr<KllQuantile>>>>& mPastBuckets,
+                                 std::vector<PastBucket<unique_ptr<StagedKllQuantile>>>>&
+                mPastBuckets,
         const std::initializer_list<int>& expectedKllCountsList,
         const std::initializer_list<int64_t>& expectedDurationNsList,
         const std::initializer_list<int64_t>& expectedStartTimeNsList,
@@ -82,11 +82,12 @@ static void assertPastBucketsSingleKey(
     }
 
     ASSERT_EQ(1, mPastBuckets.size());
-    const vector<PastBucket<unique_ptr<KllQuantile>>>& buckets = mPastBuckets.begin()->second;
+    const vector<PastBucket<unique_ptr<StagedKllQuantile>>>& buckets =
+            mPastBuckets.begin()->second;
     ASSERT_EQ(expectedKllCounts.size(), buckets.size());
 
     for (int i = 0; i < expectedKllCounts.size(); i++) {
-        EXPECT_EQ(expectedKllCounts[i], buckets[i].aggregates[0]->num_values())
+        EXPECT_EQ(expectedKllCounts[i], buckets[i].aggregates[0]->getNumValues())
                 << "Number of entries in KLL sketch differ at index " << i;
         EXPECT_EQ(expectedDurationNs[i], buckets[i].mConditionTrueNs)
                 << "Condition duration value differ at index " << i;
@@ -237,20 +238,81 @@ TEST(KllMetricProducerTest, TestPushedEventsWithoutCondition) {
     ASSERT_EQ(1UL, kllProducer->mCurrentSlicedBucket.size());
     const KllMetricProducer::Interval& curInterval0 =
             kllProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
-    EXPECT_EQ(1, curInterval0.aggregate->num_values());
+    EXPECT_EQ(1, curInterval0.aggregate->getNumValues());
     EXPECT_GT(curInterval0.sampleSize, 0);
 
     kllProducer->onMatchedLogEvent(1 /*log matcher index*/, event2);
 
     // has one slice
     ASSERT_EQ(1UL, kllProducer->mCurrentSlicedBucket.size());
-    EXPECT_EQ(2, curInterval0.aggregate->num_values());
+    EXPECT_EQ(2, curInterval0.aggregate->getNumValues());
 
     kllProducer->flushIfNeededLocked(bucket2StartTimeNs);
     TRACE_CALL(assertPastBucketsSingleKey, kllProducer->mPastBuckets, {2}, {bucketSizeNs},
                {bucketStartTimeNs}, {bucket2StartTimeNs});
 }
 
+TEST(KllMetricProducerTest, TestSketchesReusedAcrossBuckets) {
+    const KllMetric& metric = KllMetricProducerTestHelper::createMetric();
+    sp<KllMetricProducer> kllProducer =
+            KllMetricProducerTestHelper::createKllProducerNoConditions(metric);
+
+    LogEvent event1(/*uid=*/0, /*pid=*/0);
+    CreateRepeatedValueLogEvent(&event1, atomId, bucketStartTimeNs + 10, 10);
+    kllProducer->onMatchedLogEvent(1 /*log matcher index*/, event1);
+    kllProducer->flushIfNeededLocked(bucket2StartTimeNs);
+
+    // The sketch of the past bucket is closed, and its KllQuantile is pooled.
+    ASSERT_EQ(1UL, kllProducer->mPastBuckets.size());
+    const auto& pastBucket = kllProducer->mPastBuckets.begin()->second[0];
+    EXPECT_TRUE(pastBucket.aggregates[0]->isClosed());
+    EXPECT_FALSE(pastBucket.aggregates[0]->getClosedSketchBytes().empty());
+    EXPECT_EQ(1u, kllProducer->mSketchPool.size());
+
+    LogEvent event2(/*uid=*/0, /*pid=*/0);
+    CreateRepeatedValueLogEvent(&event2, atomId, bucket2StartTimeNs + 10, 20);
+    kllProducer->onMatchedLogEvent(1 /*log matcher index*/, event2);
+    EXPECT_EQ(0u, kllProducer->mSketchPool.size());
+
+    kllProducer->flushIfNeededLocked(bucket3StartTimeNs);
+    TRACE_CALL(assertPastBucketsSingleKey, kllProducer->mPastBuckets, {1, 1},
+               {bucketSizeNs, bucketSizeNs}, {bucketStartTimeNs, bucket2StartTimeNs},
+               {bucket2StartTimeNs, bucket3StartTimeNs});
+    EXPECT_EQ(1u, kllProducer->mSketchPool.size());
+}
+
+TEST(KllMetricProducerTest, TestQuantileAnomalyDetection) {
+    const KllMetric& metric = KllMetricProducerTestHelper::createMetric();
+    sp<KllMetricProducer> kllProducer =
+            KllMetricProducerTestHelper::createKllProducerNoConditions(metric);
+
+    Alert alert;
+    alert.set_id(101);
+    alert.set_metric_id(metricId);
+    alert.set_num_buckets(1);
+    alert.set_refractory_period_secs(10);
+    alert.set_trigger_if_sum_gt(100);
+    alert.set_quantile(0.5);
+    sp<AnomalyTracker> anomalyTracker = kllProducer->addAnomalyTracker(
+            alert, /*anomalyAlarmMonitor=*/nullptr, UPDATE_NEW, bucketStartTimeNs);
+    ASSERT_NE(nullptr, anomalyTracker);
+
+    LogEvent event1(/*uid=*/0, /*pid=*/0);
+    CreateRepeatedValueLogEvent(&event1, atomId, bucketStartTimeNs + 10, 10);
+    LogEvent event2(/*uid=*/0, /*pid=*/0);
+    CreateRepeatedValueLogEvent(&event2, atomId, bucketStartTimeNs + 20, 200);
+    LogEvent event3(/*uid=*/0, /*pid=*/0);
+    CreateRepeatedValueLogEvent(&event3, atomId, bucketStartTimeNs + 30, 300);
+
+    // The median is not above the threshold until the third value.
+    kllProducer->onMatchedLogEvent(1 /*log matcher index*/, event1);
+    kllProducer->onMatchedLogEvent(1 /*log matcher index*/, event2);
+    EXPECT_EQ(0u, anomalyTracker->getRefractoryPeriodEndsSec(DEFAULT_METRIC_DIMENSION_KEY));
+    kllProducer->onMatchedLogEvent(1 /*log matcher index*/, event3);
+    EXPECT_EQ(std::ceil(1.0 * event3.GetElapsedTimestampNs() / NS_PER_SEC) + 10,
+              anomalyTracker->getRefractoryPeriodEndsSec(DEFAULT_METRIC_DIMENSION_KEY));
+}
+
 TEST(KllMetricProducerTest, TestPushedEventsWithCondition) {
     const KllMetric& metric = KllMetricProducerTestHelper::createMetric();
     sp<KllMetricProducer> kllProducer = KllMetricProducerTestHelper::createKllProducerWithCondition(
@@ -272,7 +334,7 @@ TEST(KllMetricProducerTest, TestPushedEventsWithCondition) {
     ASSERT_EQ(1UL, kllProducer->mCurrentSlicedBucket.size());
     const KllMetricProducer::Interval& curInterval0 =
             kllProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
-    EXPECT_EQ(1, curInterval0.aggregate->num_values());
+    EXPECT_EQ(1, curInterval0.aggregate->getNumValues());
 
     LogEvent event3(/*uid=*/0, /*pid=*/0);
     CreateRepeatedValueLogEvent(&event3, atomId, bucketStartTimeNs + 30, 30);
@@ -280,7 +342,7 @@ TEST(KllMetricProducerTest, TestPushedEventsWithCondition) {
 
     // has one slice
     ASSERT_EQ(1UL, kllProducer->mCurrentSlicedBucket.size());
-    EXPECT_EQ(2, curInterval0.aggregate->num_values());
+    EXPECT_EQ(2, curInterval0.aggregate->getNumValues());
 
     kllProducer->onConditionChangedLocked(false, bucketStartTimeNs + 35);
 
@@ -290,7 +352,7 @@ TEST(KllMetricProducerTest, TestPushedEventsWithCondition) {
 
     // has one slice
     ASSERT_EQ(1UL, kllProducer->mCurrentSlicedBucket.size());
-    EXPECT_EQ(2, curInterval0.aggregate->num_values());
+    EXPECT_EQ(2, curInterval0.aggregate->getNumValues());
 
     kllProducer->flushIfNeededLocked(bucket2StartTimeNs);
     TRACE_CALL(assertPastBucketsSingleKey, kllProducer->mPastBuckets, {2}, {20},
@@ -311,7 +373,7 @@ TEST(KllMetricProducerTest_BucketDrop, TestInvalidBucketWhenConditionUnknown) {
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     int64_t dumpReportTimeNs = bucketStartTimeNs + 10000;
     kllProducer->onDumpReport(dumpReportTimeNs, true /* include recent buckets */, true,
                               NO_TIME_CONSTRAINTS /* dumpLatency */, &strSet, &output);
@@ -349,7 +411,7 @@ TEST(KllMetricProducerTest_BucketDrop, TestBucketDropWhenBucketTooSmall) {
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     int64_t dumpReportTimeNs = bucketStartTimeNs + 9000000;
     kllProducer->onDumpReport(dumpReportTimeNs, true /* include recent buckets */, true,
                               NO_TIME_CONSTRAINTS /* dumpLatency */, &strSet, &output);
@@ -381,7 +443,7 @@ TEST(KllMetricProducerTest_BucketDrop, TestBucketDropWhenDataUnavailable) {
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     int64_t dumpReportTimeNs = bucketStartTimeNs + 10000000000;  // 10 seconds
     kllProducer->onDumpReport(dumpReportTimeNs, true /* include current bucket */, true,
                               NO_TIME_CONSTRAINTS /* dumpLatency */, &strSet, &output);
@@ -417,7 +479,7 @@ TEST(KllMetricProducerTest, TestForcedBucketSplitWhenConditionUnknownSkipsBucket
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     int64_t dumpReportTimeNs = bucketStartTimeNs + 10000000000;  // 10 seconds
     kllProducer->onDumpReport(dumpReportTimeNs, false /* include current buckets */, true,
                               NO_TIME_CONSTRAINTS /* dumpLatency */, &strSet, &output);
@@ -453,9 +515,18 @@ TEST(KllMetricProducerTest, TestByteSize) {
     kllProducer->onMatchedLogEvent(1 /*log matcher index*/, event2);
     kllProducer->flushIfNeededLocked(bucket2StartTimeNs);
 
-    const size_t expectedSize = kllProducer->kBucketSize + 4 /* one int aggIndex entry */ +
-                                16 /* two int64_t entries in KllQuantile object */;
+    // The closed sketch only counts its serialized bytes, and the pool counts the compactors of
+    // its KllQuantile.
+    ASSERT_EQ(1UL, kllProducer->mPastBuckets.size());
+    const auto& pastBucket = kllProducer->mPastBuckets.begin()->second[0];
+    const size_t closedSketchSize = pastBucket.aggregates[0]->getClosedSketchBytes().size();
+    EXPECT_GT(closedSketchSize, 0u);
+    EXPECT_EQ(closedSketchSize, pastBucket.aggregates[0]->getByteSize());
+    const size_t poolSize = kllProducer->mSketchPool.getByteSize();
+    EXPECT_GT(poolSize, 0u);
 
+    const size_t expectedSize = kllProducer->kBucketSize + 4 /* one int aggIndex entry */ +
+                                closedSketchSize + poolSize;
     EXPECT_EQ(expectedSize, kllProducer->byteSize());
 }
 
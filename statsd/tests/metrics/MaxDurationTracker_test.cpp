@@ -418,6 +418,38 @@ TEST(MaxDurationTrackerTest, TestAnomalyPredictedTimestamp_UpdatedOnStop) {
               (unsigned long long)(alarm->timestampSec * NS_PER_SEC));
 }
 
+TEST(MaxDurationTrackerTest, TestStartedDurationsFollowStates) {
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+
+    int64_t bucketStartTimeNs = 10000000000;
+    int64_t bucketNum = 0;
+
+    MaxDurationTracker tracker(kConfigKey, metricId, eventKey, wizard, 1, false, bucketStartTimeNs,
+                               bucketNum, bucketStartTimeNs, bucketSizeNs, true, false, {});
+
+    tracker.noteStart(key1, true, bucketStartTimeNs + 10, ConditionKey());
+    tracker.noteStart(key2, true, bucketStartTimeNs + 20, ConditionKey());
+    ASSERT_EQ(2u, tracker.mStartedDurations.size());
+    EXPECT_EQ(bucketStartTimeNs + 10, tracker.mStartedDurations.top()->originNs);
+
+    // key1 ran for 20ns before it was paused, so it resumes with an origin 20ns before.
+    tracker.noteConditionChanged(key1, false, bucketStartTimeNs + 30);
+    ASSERT_EQ(1u, tracker.mStartedDurations.size());
+    EXPECT_EQ(bucketStartTimeNs + 20, tracker.mStartedDurations.top()->originNs);
+    tracker.noteConditionChanged(key1, true, bucketStartTimeNs + 35);
+    ASSERT_EQ(2u, tracker.mStartedDurations.size());
+    EXPECT_EQ(bucketStartTimeNs + 15, tracker.mStartedDurations.top()->originNs);
+
+    tracker.noteStop(key1, bucketStartTimeNs + 40, false);
+    ASSERT_EQ(1u, tracker.mStartedDurations.size());
+    EXPECT_EQ(bucketStartTimeNs + 20, tracker.mStartedDurations.top()->originNs);
+    EXPECT_EQ(25, tracker.mDuration);
+
+    tracker.noteStopAll(bucketStartTimeNs + 50);
+    EXPECT_TRUE(tracker.mStartedDurations.empty());
+    EXPECT_TRUE(tracker.mInfos.empty());
+}
+
 TEST(MaxDurationTrackerTest, TestUploadThreshold) {
     sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
 
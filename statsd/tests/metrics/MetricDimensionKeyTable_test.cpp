@@ -0,0 +1,63 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/metrics/MetricDimensionKeyTable.h"
+
+#include <gtest/gtest.h>
+
+#include "metrics_test_helper.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+TEST(MetricDimensionKeyTableTest, TestAcquireAndRelease) {
+    const MetricDimensionKey key1 = getMockedMetricDimensionKey(/*tagId=*/1, 0, "1");
+    const MetricDimensionKey key2 = getMockedMetricDimensionKey(/*tagId=*/1, 0, "2");
+    sp<MetricDimensionKeyTable> table = new MetricDimensionKeyTable();
+
+    const uint32_t id1 = table->acquire(key1);
+    const uint32_t id2 = table->acquire(key2);
+    EXPECT_NE(id1, id2);
+    EXPECT_EQ(id1, table->acquire(key1));
+    EXPECT_EQ(2UL, table->size());
+    EXPECT_EQ(key1, table->getKey(id1));
+    EXPECT_EQ(key2, table->getKey(id2));
+
+    uint32_t id;
+    ASSERT_TRUE(table->find(key2, &id));
+    EXPECT_EQ(id2, id);
+
+    // key1 has two references.
+    table->release(id1);
+    EXPECT_TRUE(table->find(key1, &id));
+    table->release(id1);
+    EXPECT_FALSE(table->find(key1, &id));
+    EXPECT_EQ(1UL, table->size());
+
+    // The id of key1 is reused.
+    const MetricDimensionKey key3 = getMockedMetricDimensionKey(/*tagId=*/1, 0, "3");
+    EXPECT_EQ(id1, table->acquire(key3));
+    EXPECT_EQ(key3, table->getKey(id1));
+    EXPECT_EQ(2UL, table->size());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -1948,6 +1948,49 @@ TEST(NumericValueMetricProducerTest, TestTrimUnusedDimensionKey) {
     EXPECT_EQ(bucketSizeNs, iterator->second[1].mConditionTrueNs);
 }
 
+TEST(NumericValueMetricProducerTest, TestEvictStaleBases) {
+    ValueMetric metric = NumericValueMetricProducerTestHelper::createMetric();
+    metric.mutable_dimensions_in_what()->set_field(tagId);
+    metric.mutable_dimensions_in_what()->add_child()->set_field(1);
+
+    sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+    EXPECT_CALL(*pullerManager, Pull(tagId, kConfigKey, bucketStartTimeNs, _))
+            .WillOnce(Invoke([](int tagId, const ConfigKey&, const int64_t,
+                                vector<std::shared_ptr<LogEvent>>* data) {
+                data->clear();
+                data->push_back(CreateTwoValueLogEvent(tagId, bucketStartTimeNs, 1, 3));
+                data->push_back(CreateTwoValueLogEvent(tagId, bucketStartTimeNs, 2, 5));
+                return true;
+            }));
+
+    sp<NumericValueMetricProducer> valueProducer =
+            NumericValueMetricProducerTestHelper::createValueProducerNoConditions(pullerManager,
+                                                                                  metric);
+    ASSERT_EQ(2UL, valueProducer->mDimInfos.size());
+
+    // Only dimension 2 is in the next pulls of the bucket. Dimension 1 is kept until it missed
+    // kMaxPullsWithoutDimension pulls.
+    vector<shared_ptr<LogEvent>> allData;
+    for (uint64_t i = 1; i <= NumericValueMetricProducer::kMaxPullsWithoutDimension; i++) {
+        const int64_t pullTimeNs = bucketStartTimeNs + i * NS_PER_SEC;
+        allData.clear();
+        allData.push_back(CreateTwoValueLogEvent(tagId, pullTimeNs, 2, 5 + i));
+        valueProducer->accumulateEvents(allData, pullTimeNs, pullTimeNs);
+        ASSERT_EQ(i < NumericValueMetricProducer::kMaxPullsWithoutDimension ? 2UL : 1UL,
+                  valueProducer->mDimInfos.size());
+    }
+    auto dimInfoIt = valueProducer->mDimInfos.begin();
+    EXPECT_EQ(2, dimInfoIt->first.getValues()[0].mValue.int_value);
+    EXPECT_EQ(15, dimInfoIt->second.dimExtras[0].value().long_value);
+
+    // The values of dimension 2 are still aggregated in the bucket.
+    allData.clear();
+    allData.push_back(CreateTwoValueLogEvent(tagId, bucket2StartTimeNs, 2, 20));
+    valueProducer->onDataPulled(allData, /** succeed */ true, bucket2StartTimeNs);
+    assertPastBucketValuesSingleKey(valueProducer->mPastBuckets, {15}, {bucketSizeNs}, {0},
+                                    {bucketStartTimeNs}, {bucket2StartTimeNs});
+}
+
 TEST(NumericValueMetricProducerTest, TestResetBaseOnPullFailAfterConditionChange_EndOfBucket) {
     ValueMetric metric = NumericValueMetricProducerTestHelper::createMetricWithCondition();
 
@@ -2088,6 +2131,112 @@ TEST(NumericValueMetricProducerTest, TestResetBaseOnPullDelayExceeded) {
     ASSERT_EQ(0UL, valueProducer->mCurrentSlicedBucket.size());
 }
 
+// Enables the StatsPuller delta encoding, a global flag, for the duration of a test.
+class NumericValueMetricProducerDeltaEncodingTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        StatsPuller::SetDeltaEncoding(true);
+    }
+
+    void TearDown() override {
+        StatsPuller::SetDeltaEncoding(false);
+    }
+};
+
+TEST_F(NumericValueMetricProducerDeltaEncodingTest, TestUnchangedPulledDimensionsSkipped) {
+    ValueMetric metric = NumericValueMetricProducerTestHelper::createMetric();
+    sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+    EXPECT_CALL(*pullerManager, Pull(tagId, kConfigKey, bucketStartTimeNs, _))
+            .WillOnce(Invoke([](int tagId, const ConfigKey&, const int64_t,
+                                vector<std::shared_ptr<LogEvent>>* data) {
+                data->clear();
+                data->push_back(CreateRepeatedValueLogEvent(tagId, bucketStartTimeNs, 3));
+                return true;
+            }));
+
+    sp<NumericValueMetricProducer> valueProducer =
+            NumericValueMetricProducerTestHelper::createValueProducerNoConditions(pullerManager,
+                                                                                  metric);
+
+    vector<shared_ptr<LogEvent>> allData;
+    allData.push_back(CreateRepeatedValueLogEvent(tagId, bucketStartTimeNs + 10, 5));
+    valueProducer->onDataPulled(allData, /** succeed */ true, bucketStartTimeNs + 10);
+    ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
+    const Interval& interval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    EXPECT_EQ(2, interval.aggregate.long_value);
+    EXPECT_EQ(1, interval.sampleSize);
+
+    // The same event, as handed out again by a puller for an unchanged row, is not aggregated.
+    valueProducer->onDataPulled(allData, /** succeed */ true, bucketStartTimeNs + 20);
+    EXPECT_EQ(2, interval.aggregate.long_value);
+    EXPECT_EQ(1, interval.sampleSize);
+    ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
+    EXPECT_EQ(5, valueProducer->mDimInfos.begin()->second.dimExtras[0].value().long_value);
+
+    // An event with the same values that is not the last pulled one is aggregated.
+    allData.clear();
+    allData.push_back(CreateRepeatedValueLogEvent(tagId, bucketStartTimeNs + 30, 5));
+    valueProducer->onDataPulled(allData, /** succeed */ true, bucketStartTimeNs + 30);
+    EXPECT_EQ(2, interval.aggregate.long_value);
+    EXPECT_EQ(2, interval.sampleSize);
+
+    allData.clear();
+    allData.push_back(CreateRepeatedValueLogEvent(tagId, bucketStartTimeNs + 40, 9));
+    valueProducer->onDataPulled(allData, /** succeed */ true, bucketStartTimeNs + 40);
+    EXPECT_EQ(6, interval.aggregate.long_value);
+    EXPECT_EQ(3, interval.sampleSize);
+
+    // The rows of the last pull are counted.
+    const size_t byteSize = valueProducer->currentBucketByteSize();
+    valueProducer->mLastPulledRows.clear();
+    EXPECT_LT(valueProducer->currentBucketByteSize(), byteSize);
+}
+
+TEST(NumericValueMetricProducerTest, TestBulkDiffsMatchPerEventDiffs) {
+    // The values of the pulls, with a reset.
+    const vector<int64_t> pulledValues = {5, 4, 10};
+    vector<int64_t> aggregates[2];
+    vector<int> sampleSizes[2];
+    for (int bulkDiffs = 0; bulkDiffs < 2; bulkDiffs++) {
+        NumericValueMetricProducer::SetBulkDiffs(bulkDiffs);
+        ValueMetric metric = NumericValueMetricProducerTestHelper::createMetric();
+        sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+        EXPECT_CALL(*pullerManager, Pull(tagId, kConfigKey, bucketStartTimeNs, _))
+                .WillOnce(Invoke([](int tagId, const ConfigKey&, const int64_t,
+                                    vector<std::shared_ptr<LogEvent>>* data) {
+                    data->clear();
+                    data->push_back(CreateRepeatedValueLogEvent(tagId, bucketStartTimeNs, 3));
+                    return true;
+                }));
+        sp<NumericValueMetricProducer> valueProducer =
+                NumericValueMetricProducerTestHelper::createValueProducerNoConditions(
+                        pullerManager, metric);
+
+        for (size_t i = 0; i < pulledValues.size(); i++) {
+            const int64_t pullTimeNs = bucketStartTimeNs + 10 * (i + 1);
+            vector<shared_ptr<LogEvent>> allData;
+            allData.push_back(CreateRepeatedValueLogEvent(tagId, pullTimeNs, pulledValues[i]));
+            valueProducer->onDataPulled(allData, /** succeed */ true, pullTimeNs);
+
+            ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
+            const Interval& interval =
+                    valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            aggregates[bulkDiffs].push_back(interval.aggregate.long_value);
+            sampleSizes[bulkDiffs].push_back(interval.sampleSize);
+            ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
+            EXPECT_EQ(pulledValues[i],
+                      valueProducer->mDimInfos.begin()->second.dimExtras[0].value().long_value);
+        }
+        EXPECT_TRUE(valueProducer->mBulkDiffDimensions.empty());
+    }
+    NumericValueMetricProducer::SetBulkDiffs(false);
+
+    EXPECT_EQ(vector<int64_t>({2, 2, 8}), aggregates[1]);
+    EXPECT_EQ(vector<int>({1, 1, 2}), sampleSizes[1]);
+    EXPECT_EQ(aggregates[0], aggregates[1]);
+    EXPECT_EQ(sampleSizes[0], sampleSizes[1]);
+}
+
 TEST(NumericValueMetricProducerTest, TestResetBaseOnPullTooLate) {
     ValueMetric metric = NumericValueMetricProducerTestHelper::createMetricWithCondition();
 
@@ -2189,7 +2338,7 @@ TEST(NumericValueMetricProducerTest_BucketDrop, TestInvalidBucketWhenOneConditio
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucket2StartTimeNs + 10, false /* include partial bucket */, true,
                                 FAST /* dumpLatency */, &strSet, &output);
 
@@ -2249,7 +2398,7 @@ TEST(NumericValueMetricProducerTest_BucketDrop, TestInvalidBucketWhenGuardRailHi
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucket2StartTimeNs + 10000, false /* include recent buckets */,
                                 true, FAST /* dumpLatency */, &strSet, &output);
 
@@ -2325,7 +2474,7 @@ TEST(NumericValueMetricProducerTest_BucketDrop, TestInvalidBucketWhenInitialPull
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucket2StartTimeNs + 10000, false /* include recent buckets */,
                                 true, FAST /* dumpLatency */, &strSet, &output);
 
@@ -2401,7 +2550,7 @@ TEST(NumericValueMetricProducerTest_BucketDrop, TestInvalidBucketWhenLastPullFai
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucket2StartTimeNs + 10000, false /* include recent buckets */,
                                 true, FAST /* dumpLatency */, &strSet, &output);
 
@@ -2988,7 +3137,7 @@ TEST(NumericValueMetricProducerTest, TestFastDumpWithoutCurrentBucket) {
     valueProducer->onDataPulled(allData, /** succeed */ true, bucket2StartTimeNs);
 
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucket4StartTimeNs, false /* include recent buckets */, true, FAST,
                                 &strSet, &output);
 
@@ -3029,7 +3178,7 @@ TEST(NumericValueMetricProducerTest, TestPullNeededNoTimeConstraints) {
                                                                                   metric);
 
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucketStartTimeNs + 10, true /* include recent buckets */, true,
                                 NO_TIME_CONSTRAINTS, &strSet, &output);
 
@@ -3229,7 +3378,7 @@ TEST(NumericValueMetricProducerTest_BucketDrop, TestInvalidBucketWhenDumpReportR
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucketStartTimeNs + 40, true /* include recent buckets */, true,
                                 FAST /* dumpLatency */, &strSet, &output);
     ASSERT_EQ(0UL, valueProducer->mCurrentSlicedBucket.size());
@@ -3285,7 +3434,7 @@ TEST(NumericValueMetricProducerTest_BucketDrop, TestInvalidBucketWhenConditionEv
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucket2StartTimeNs + 100, true /* include recent buckets */, true,
                                 NO_TIME_CONSTRAINTS /* dumpLatency */, &strSet, &output);
 
@@ -3355,7 +3504,7 @@ TEST(NumericValueMetricProducerTest_BucketDrop, TestInvalidBucketWhenAccumulateE
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucket2StartTimeNs + 100, true /* include recent buckets */, true,
                                 NO_TIME_CONSTRAINTS /* dumpLatency */, &strSet, &output);
 
@@ -3410,7 +3559,7 @@ TEST(NumericValueMetricProducerTest_BucketDrop, TestInvalidBucketWhenConditionUn
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     int64_t dumpReportTimeNs = bucketStartTimeNs + 10000;
     valueProducer->onDumpReport(dumpReportTimeNs, true /* include recent buckets */, true,
                                 NO_TIME_CONSTRAINTS /* dumpLatency */, &strSet, &output);
@@ -3460,7 +3609,7 @@ TEST(NumericValueMetricProducerTest_BucketDrop, TestInvalidBucketWhenPullFailed)
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     int64_t dumpReportTimeNs = bucketStartTimeNs + 10000;
     valueProducer->onDumpReport(dumpReportTimeNs, true /* include recent buckets */, true,
                                 NO_TIME_CONSTRAINTS /* dumpLatency */, &strSet, &output);
@@ -3524,7 +3673,7 @@ TEST(NumericValueMetricProducerTest_BucketDrop, TestInvalidBucketWhenMultipleBuc
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(dumpTimeNs, true /* include current buckets */, true,
                                 NO_TIME_CONSTRAINTS /* dumpLatency */, &strSet, &output);
 
@@ -3594,7 +3743,7 @@ TEST(NumericValueMetricProducerTest_BucketDrop, TestBucketDropWhenBucketTooSmall
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     int64_t dumpReportTimeNs = bucketStartTimeNs + 9000000;
     valueProducer->onDumpReport(dumpReportTimeNs, true /* include recent buckets */, true,
                                 NO_TIME_CONSTRAINTS /* dumpLatency */, &strSet, &output);
@@ -3629,7 +3778,7 @@ TEST(NumericValueMetricProducerTest_BucketDrop, TestBucketDropWhenDataUnavailabl
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     int64_t dumpReportTimeNs = bucketStartTimeNs + 10000000000;  // 10 seconds
     valueProducer->onDumpReport(dumpReportTimeNs, true /* include current bucket */, true,
                                 NO_TIME_CONSTRAINTS /* dumpLatency */, &strSet, &output);
@@ -3697,7 +3846,7 @@ TEST(NumericValueMetricProducerTest_BucketDrop, TestConditionUnknownMultipleBuck
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     int64_t dumpReportTimeNs = bucket2StartTimeNs + 15 * NS_PER_SEC;  // 15 seconds
     valueProducer->onDumpReport(dumpReportTimeNs, true /* include current bucket */, true,
                                 NO_TIME_CONSTRAINTS /* dumpLatency */, &strSet, &output);
@@ -3779,7 +3928,7 @@ TEST(NumericValueMetricProducerTest_BucketDrop,
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     int64_t dumpReportTimeNs = bucket2StartTimeNs + 10000000000;  // 10 seconds
     valueProducer->onDumpReport(dumpReportTimeNs, false /* include current buckets */, true,
                                 NO_TIME_CONSTRAINTS /* dumpLatency */, &strSet, &output);
@@ -3830,7 +3979,7 @@ TEST(NumericValueMetricProducerTest_BucketDrop, TestMultipleBucketDropEvents) {
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     int64_t dumpReportTimeNs = bucketStartTimeNs + 1000;
     valueProducer->onDumpReport(dumpReportTimeNs, true /* include recent buckets */, true,
                                 FAST /* dumpLatency */, &strSet, &output);
@@ -3913,7 +4062,7 @@ TEST(NumericValueMetricProducerTest_BucketDrop, TestMaxBucketDropEvents) {
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     int64_t dumpReportTimeNs = bucketStartTimeNs + 1000;
     // Because we already have 10 dump events in the current bucket,
     // this case should not be added to the list of dump events.
@@ -4182,7 +4331,7 @@ TEST(NumericValueMetricProducerTest, TestSlicedState) {
 
     // Start dump report and check output.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucketStartTimeNs + 50 * NS_PER_SEC,
                                 true /* include recent buckets */, true, NO_TIME_CONSTRAINTS,
                                 &strSet, &output);
@@ -4476,7 +4625,7 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithMap) {
 
     // Start dump report and check output.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucketStartTimeNs + 50 * NS_PER_SEC,
                                 true /* include recent buckets */, true, NO_TIME_CONSTRAINTS,
                                 &strSet, &output);
@@ -4723,7 +4872,7 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithPrimaryField_WithDimensi
 
     // Start dump report and check output.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     int64_t dumpReportTimeNs = bucket2StartTimeNs + 50 * NS_PER_SEC;
     valueProducer->onDumpReport(dumpReportTimeNs, true /* include recent buckets */, true,
                                 NO_TIME_CONSTRAINTS, &strSet, &output);
@@ -4977,7 +5126,7 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithMissingDataInStateChange
 
     // Start dump report and check output.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucketStartTimeNs + 50 * NS_PER_SEC,
                                 true /* include recent buckets */, true, NO_TIME_CONSTRAINTS,
                                 &strSet, &output);
@@ -5082,7 +5231,7 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithMissingDataThenFlushBuck
 
     // Start dump report and check output.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucketStartTimeNs + 50 * NS_PER_SEC,
                                 true /* include recent buckets */, true, NO_TIME_CONSTRAINTS,
                                 &strSet, &output);
@@ -5275,7 +5424,7 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithNoPullOnBucketBoundary)
 
     // Start dump report and check output.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucket2StartTimeNs + 50 * NS_PER_SEC,
                                 true /* include recent buckets */, true, NO_TIME_CONSTRAINTS,
                                 &strSet, &output);
@@ -5427,6 +5576,8 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithDataMissingInConditionCh
 
     // Bucket status after condition change to false.
     valueProducer->onConditionChanged(false, bucketStartTimeNs + 30 * NS_PER_SEC);
+    // The condition timers only catch up with the change when the dimensions are touched.
+    valueProducer->syncAllConditionTimersLocked();
     // Base for dimension key {}
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
     ASSERT_EQ(2UL, valueProducer->mCurrentSlicedBucket.size());
@@ -5493,7 +5644,7 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithDataMissingInConditionCh
 
     // Start dump report and check output.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucketStartTimeNs + 50 * NS_PER_SEC,
                                 true /* include recent buckets */, true, NO_TIME_CONSTRAINTS,
                                 &strSet, &output);
@@ -5739,7 +5890,7 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithMultipleDimensions) {
 
     // Start dump report and check output.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucket2StartTimeNs + 50 * NS_PER_SEC,
                                 true /* include recent buckets */, true, NO_TIME_CONSTRAINTS,
                                 &strSet, &output);
@@ -5953,6 +6104,8 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithCondition) {
 
     // Bucket 2 status after condition change to false.
     valueProducer->onConditionChanged(false, bucket2StartTimeNs + 10 * NS_PER_SEC);
+    // The condition timers only catch up with the change when the dimensions are touched.
+    valueProducer->syncAllConditionTimersLocked();
     // Base for dimension key {}
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
     itBase = valueProducer->mDimInfos.find(DEFAULT_DIMENSION_KEY);
@@ -5975,7 +6128,7 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithCondition) {
 
     // Start dump report and check output.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucket2StartTimeNs + 50 * NS_PER_SEC,
                                 true /* include recent buckets */, true, NO_TIME_CONSTRAINTS,
                                 &strSet, &output);
@@ -6123,7 +6276,7 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithConditionFalseMultipleBu
 
     // Start dump report and check output.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucket3StartTimeNs + 30 * NS_PER_SEC,
                                 true /* include recent buckets */, true, NO_TIME_CONSTRAINTS,
                                 &strSet, &output);
@@ -6153,6 +6306,45 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithConditionFalseMultipleBu
                         10 * NS_PER_SEC, -1);
 }
 
+TEST(NumericValueMetricProducerTest, TestSlicedStateConditionTimersSyncedLazily) {
+    ValueMetric metric = NumericValueMetricProducerTestHelper::createMetricWithConditionAndState(
+            "BATTERY_SAVER_MODE_STATE");
+    sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+
+    StateManager::getInstance().clear();
+    sp<NumericValueMetricProducer> valueProducer =
+            NumericValueMetricProducerTestHelper::createValueProducerWithConditionAndState(
+                    pullerManager, metric, {util::BATTERY_SAVER_MODE_STATE_CHANGED}, {},
+                    ConditionState::kFalse, /*pullAtomId=*/-1);
+    StateManager::getInstance().registerListener(util::BATTERY_SAVER_MODE_STATE_CHANGED,
+                                                 valueProducer);
+
+    valueProducer->onConditionChanged(true, bucketStartTimeNs + 10 * NS_PER_SEC);
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    CreateRepeatedValueLogEvent(&event, tagId, bucketStartTimeNs + 15 * NS_PER_SEC, 10);
+    valueProducer->onMatchedLogEvent(1 /*log matcher index*/, event);
+    ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
+    const ConditionTimer& timer =
+            valueProducer->mCurrentSlicedBucket.begin()->second.conditionTimer;
+    assertConditionTimer(timer, true, 0, bucketStartTimeNs + 15 * NS_PER_SEC);
+
+    // The condition changes are only logged, the timer of the dimension is left untouched.
+    valueProducer->onConditionChanged(false, bucketStartTimeNs + 20 * NS_PER_SEC);
+    valueProducer->onConditionChanged(true, bucketStartTimeNs + 30 * NS_PER_SEC);
+    valueProducer->onConditionChanged(false, bucketStartTimeNs + 40 * NS_PER_SEC);
+    valueProducer->onConditionChanged(true, bucketStartTimeNs + 50 * NS_PER_SEC);
+    EXPECT_EQ(5UL, valueProducer->mConditionChanges.size());
+    assertConditionTimer(timer, true, 0, bucketStartTimeNs + 15 * NS_PER_SEC);
+
+    // The timer catches up when the bucket is flushed: the condition was true from 15s to 20s,
+    // 30s to 40s and 50s to the end of the bucket.
+    valueProducer->flushIfNeededLocked(bucket2StartTimeNs);
+    EXPECT_TRUE(valueProducer->mConditionChanges.empty());
+    ASSERT_EQ(1UL, valueProducer->mPastBuckets.size());
+    ASSERT_EQ(1UL, valueProducer->mPastBuckets.begin()->second.size());
+    EXPECT_EQ(25 * NS_PER_SEC, valueProducer->mPastBuckets.begin()->second[0].mConditionTrueNs);
+}
+
 /*
  * Test slicing by state for metric that slices by state with a primary field,
  * has multiple dimensions, and a pull that returns incomplete data.
@@ -6323,7 +6515,7 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithMultipleDimensionsMissin
 
     // Start dump report and check output.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucket2StartTimeNs + 50 * NS_PER_SEC,
                                 true /* include recent buckets */, true, NO_TIME_CONSTRAINTS,
                                 &strSet, &output);
@@ -6432,7 +6624,7 @@ TEST(NumericValueMetricProducerTest, TestForcedBucketSplitWhenConditionUnknownSk
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     int64_t dumpReportTimeNs = bucketStartTimeNs + 10000000000;  // 10 seconds
     valueProducer->onDumpReport(dumpReportTimeNs, false /* include current buckets */, true,
                                 NO_TIME_CONSTRAINTS /* dumpLatency */, &strSet, &output);
@@ -6498,7 +6690,7 @@ TEST(NumericValueMetricProducerTest, TestUploadThreshold) {
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     int64_t dumpReportTimeNs = bucket2StartTimeNs + 10000000000;
     valueProducer->onDumpReport(dumpReportTimeNs, true /* include current buckets */, true,
                                 NO_TIME_CONSTRAINTS /* dumpLatency */, &strSet, &output);
@@ -6975,7 +7167,7 @@ TEST(NumericValueMetricProducerTest_ConditionCorrection, TestThresholdNotDefined
 
     // generate dump report and validate correction value in the reported buckets
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucket3StartTimeNs, false /* include partial bucket */, true,
                                 FAST /* dumpLatency */, &strSet, &output);
 
@@ -7030,7 +7222,7 @@ TEST(NumericValueMetricProducerTest_ConditionCorrection, TestThresholdDefinedZer
 
     // generate dump report and validate correction value in the reported buckets
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucket3StartTimeNs, false /* include partial bucket */, true,
                                 FAST /* dumpLatency */, &strSet, &output);
 
@@ -7098,7 +7290,7 @@ TEST(NumericValueMetricProducerTest_ConditionCorrection, TestThresholdUploadPass
 
     // generate dump report and validate correction value in the reported buckets
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucket3StartTimeNs, false /* include partial bucket */, true,
                                 FAST /* dumpLatency */, &strSet, &output);
 
@@ -7157,7 +7349,7 @@ TEST(NumericValueMetricProducerTest_ConditionCorrection, TestThresholdUploadPass
 
     // generate dump report and validate correction value in the reported buckets
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucket3StartTimeNs, false /* include partial bucket */, true,
                                 FAST /* dumpLatency */, &strSet, &output);
 
@@ -7214,7 +7406,7 @@ TEST(NumericValueMetricProducerTest_ConditionCorrection, TestThresholdUploadSkip
 
     // generate dump report and validate correction value in the reported buckets
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucket3StartTimeNs, false /* include partial bucket */, true,
                                 FAST /* dumpLatency */, &strSet, &output);
 
@@ -7309,7 +7501,7 @@ TEST(NumericValueMetricProducerTest_ConditionCorrection, TestLateStateChangeSlic
 
     // Start dump report and check output.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     valueProducer->onDumpReport(bucket4StartTimeNs + 10, false /* do not include partial buckets */,
                                 true, NO_TIME_CONSTRAINTS, &strSet, &output);
 
@@ -7395,7 +7587,7 @@ TEST(NumericValueMetricProducerTest, TestSubsetDimensions) {
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     int64_t dumpReportTimeNs = bucket2StartTimeNs + 10000000000;
     valueProducer->onDumpReport(dumpReportTimeNs, true /* include current buckets */, true,
                                 NO_TIME_CONSTRAINTS /* dumpLatency */, &strSet, &output);
@@ -7472,7 +7664,7 @@ TEST(NumericValueMetricProducerTest, TestRepeatedValueFieldAndDimensions) {
 
     // Check dump report.
     ProtoOutputStream output;
-    std::set<string> strSet;
+    ReportStrings strSet;
     int64_t dumpReportTimeNs = bucket2StartTimeNs + 10000000000;
     valueProducer->onDumpReport(dumpReportTimeNs, true /* include current buckets */, true,
                                 NO_TIME_CONSTRAINTS /* dumpLatency */, &strSet, &output);
@@ -291,6 +291,52 @@ TEST(OringDurationTrackerTest, TestDurationConditionChangeNested) {
     EXPECT_EQ(15LL, buckets[eventKey][0].mDuration);
 }
 
+TEST(OringDurationTrackerTest, TestStartedAndPausedKey) {
+    const MetricDimensionKey eventKey = getMockedMetricDimensionKey(TagId, 0, "event");
+
+    const HashableDimensionKey kEventKey1 = getMockedDimensionKey(TagId, 2, "maps");
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+
+    ConditionKey key1;
+    key1[StringToId("APP_BACKGROUND")] = kConditionKey1;
+
+    // Queried for both the started and the paused starts of the key.
+    EXPECT_CALL(*wizard, query(_, key1, _))
+            .Times(2)
+            .WillRepeatedly(Return(ConditionState::kFalse));
+
+    unordered_map<MetricDimensionKey, vector<DurationBucket>> buckets;
+
+    int64_t bucketStartTimeNs = 10000000000;
+    int64_t bucketSizeNs = 30 * 1000 * 1000 * 1000LL;
+    int64_t bucketNum = 0;
+    int64_t eventStartTimeNs = bucketStartTimeNs + 1;
+
+    OringDurationTracker tracker(kConfigKey, metricId, eventKey, wizard, 1, true, bucketStartTimeNs,
+                                 bucketNum, bucketStartTimeNs, bucketSizeNs, true, false, {});
+
+    tracker.noteStart(kEventKey1, true, eventStartTimeNs, key1);
+    tracker.noteStart(kEventKey1, false, eventStartTimeNs + 5, key1);
+    EXPECT_EQ(1u, tracker.mStartedCount);
+    EXPECT_EQ(1u, tracker.mPausedCount);
+    EXPECT_EQ(1u, tracker.mKeys.size());
+
+    // The started start is paused, the key keeps its paused count.
+    tracker.onSlicedConditionMayChange(true, eventStartTimeNs + 15);
+    EXPECT_EQ(0u, tracker.mStartedCount);
+    EXPECT_EQ(1u, tracker.mPausedCount);
+    EXPECT_EQ(1, tracker.mKeys.find(kEventKey1)->pausedCount);
+
+    tracker.noteStop(kEventKey1, eventStartTimeNs + 20, false);
+    EXPECT_TRUE(tracker.mKeys.empty());
+    EXPECT_EQ(0u, tracker.mConditionKeyCount);
+
+    EXPECT_TRUE(tracker.flushIfNeeded(bucketStartTimeNs + bucketSizeNs + 1, emptyThreshold,
+                                      &buckets));
+    ASSERT_EQ(1u, buckets[eventKey].size());
+    EXPECT_EQ(15LL, buckets[eventKey][0].mDuration);
+}
+
 TEST(OringDurationTrackerTest, TestPredictAnomalyTimestamp) {
     const MetricDimensionKey eventKey = getMockedMetricDimensionKey(TagId, 0, "event");
 
@@ -484,10 +530,10 @@ TEST(OringDurationTrackerTest, TestAnomalyDetectionExpiredAlarm) {
     tracker.noteStart(kEventKey1, true, eventStartTimeNs, ConditionKey());
     tracker.noteStop(kEventKey1, eventStartTimeNs + 10, false);
     EXPECT_EQ(anomalyTracker->getRefractoryPeriodEndsSec(eventKey), 0U);
-    EXPECT_TRUE(tracker.mStarted.empty());
+    EXPECT_EQ(0u, tracker.mStartedCount);
     EXPECT_EQ(10LL, tracker.mStateKeyDurationMap[DEFAULT_DIMENSION_KEY].mDuration);  // 10ns
 
-    ASSERT_EQ(0u, tracker.mStarted.size());
+    ASSERT_EQ(0u, tracker.mStartedCount);
 
     tracker.noteStart(kEventKey1, true, eventStartTimeNs + 20, ConditionKey());
     ASSERT_EQ(1u, anomalyTracker->mAlarms.size());
@@ -0,0 +1,156 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/metrics/StagedKllQuantile.h"
+
+#include <gtest/gtest.h>
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+TEST(StagedKllQuantileTest, TestStagedValuesAreCounted) {
+    StagedKllQuantile kll;
+    kll.add(5);
+    kll.add(3);
+    EXPECT_EQ(2, kll.getNumValues());
+    EXPECT_EQ(0, kll.getNumStoredValues());
+
+    kll.flush();
+    EXPECT_EQ(2, kll.getNumValues());
+    EXPECT_EQ(2, kll.getNumStoredValues());
+}
+
+TEST(StagedKllQuantileTest, TestFullBatchIsFlushed) {
+    StagedKllQuantile kll;
+    for (size_t i = 0; i < StagedKllQuantile::kMaxStagedValues; i++) {
+        kll.add(i);
+    }
+    EXPECT_EQ(StagedKllQuantile::kMaxStagedValues, kll.getNumStoredValues());
+    kll.add(0);
+    EXPECT_EQ(StagedKllQuantile::kMaxStagedValues + 1, kll.getNumValues());
+    EXPECT_EQ(StagedKllQuantile::kMaxStagedValues, kll.getNumStoredValues());
+}
+
+TEST(StagedKllQuantileTest, TestRepeatedValuesAreWeighted) {
+    StagedKllQuantile kll;
+    // Three of each value: each is stored once at level 0 and once at level 1.
+    for (int i = 0; i < 3; i++) {
+        kll.add(7);
+        kll.add(2);
+    }
+    kll.seal();
+    EXPECT_EQ(6, kll.getNumValues());
+    EXPECT_EQ(4, kll.getNumStoredValues());
+
+    const zetasketch::android::AggregatorStateProto proto = kll.serializeToProto();
+    EXPECT_EQ(6, proto.num_values());
+}
+
+TEST(StagedKllQuantileTest, TestExactValuesBeforeSketch) {
+    dist_proc::aggregation::XorShiftRandomGenerator random(1);
+    StagedKllQuantile kll(&random);
+    for (size_t i = 0; i < StagedKllQuantile::kMaxExactValues - 1; i++) {
+        kll.add(i);
+    }
+    kll.seal();
+    EXPECT_EQ(StagedKllQuantile::kMaxExactValues - 1, kll.getNumValues());
+    EXPECT_EQ(StagedKllQuantile::kMaxExactValues - 1, kll.getNumStoredValues());
+    EXPECT_EQ(std::vector<std::optional<int64_t>>({0, 31, 62}),
+              kll.getQuantiles({0, 0.5, 1}));
+}
+
+TEST(StagedKllQuantileTest, TestSketchCreatedPastExactValues) {
+    dist_proc::aggregation::XorShiftRandomGenerator random(1);
+    StagedKllQuantile kll(&random);
+    for (size_t i = 0; i < StagedKllQuantile::kMaxExactValues; i++) {
+        kll.add(i);
+    }
+    EXPECT_EQ(StagedKllQuantile::kMaxExactValues, kll.getNumStoredValues());
+    // Later values are staged in the smaller batches.
+    kll.add(0);
+    EXPECT_EQ(StagedKllQuantile::kMaxExactValues + 1, kll.getNumValues());
+    EXPECT_EQ(StagedKllQuantile::kMaxExactValues, kll.getNumStoredValues());
+
+    const zetasketch::android::AggregatorStateProto proto = kll.serializeToProto();
+    EXPECT_EQ(StagedKllQuantile::kMaxExactValues + 1, proto.num_values());
+}
+
+TEST(StagedKllQuantileTest, TestCloseKeepsReport) {
+    KllSketchPool pool;
+    StagedKllQuantile quantilesKll(&pool);
+    StagedKllQuantile sketchKll(&pool);
+    for (int i = 1; i <= 10; i++) {
+        quantilesKll.add(i);
+        sketchKll.add(i);
+    }
+
+    quantilesKll.close({0, 1}, /*diffEncodeCompactors=*/false);
+    EXPECT_TRUE(quantilesKll.isClosed());
+    EXPECT_EQ(10, quantilesKll.getNumValues());
+    EXPECT_EQ(10, quantilesKll.getNumStoredValues());
+    EXPECT_EQ(std::vector<std::optional<int64_t>>({1, 10}), quantilesKll.getClosedQuantiles());
+    EXPECT_TRUE(quantilesKll.getClosedSketchBytes().empty());
+    EXPECT_EQ(1u, pool.size());
+
+    sketchKll.close({}, /*diffEncodeCompactors=*/false);
+    zetasketch::android::AggregatorStateProto proto;
+    ASSERT_TRUE(proto.ParseFromString(sketchKll.getClosedSketchBytes()));
+    EXPECT_EQ(10, proto.num_values());
+    EXPECT_EQ(2u, pool.size());
+}
+
+TEST(StagedKllQuantileTest, TestPooledSketchesReused) {
+    KllSketchPool pool;
+    StagedKllQuantile kll(&pool);
+    kll.add(5);
+    kll.close({0.5}, /*diffEncodeCompactors=*/false);
+    ASSERT_EQ(1u, pool.size());
+
+    // The reused KllQuantile was Reset().
+    StagedKllQuantile reusedKll(&pool);
+    EXPECT_EQ(0u, pool.size());
+    EXPECT_EQ(0, reusedKll.getNumValues());
+    reusedKll.add(7);
+    reusedKll.close({0.5}, /*diffEncodeCompactors=*/false);
+    EXPECT_EQ(std::vector<std::optional<int64_t>>({7}), reusedKll.getClosedQuantiles());
+}
+
+TEST(StagedKllQuantileTest, TestPoolKeepsLastBucket) {
+    KllSketchPool pool;
+    pool.put(dist_proc::aggregation::KllQuantile::Create());
+    pool.put(dist_proc::aggregation::KllQuantile::Create());
+    pool.put(dist_proc::aggregation::KllQuantile::Create());
+    pool.endBucket();
+    EXPECT_EQ(3u, pool.size());
+
+    // One sketch is taken during the next bucket, and one is put when it closes.
+    EXPECT_NE(nullptr, pool.take());
+    pool.put(dist_proc::aggregation::KllQuantile::Create());
+    pool.endBucket();
+    EXPECT_EQ(1u, pool.size());
+
+    pool.endBucket();
+    EXPECT_EQ(0u, pool.size());
+    EXPECT_EQ(nullptr, pool.take());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
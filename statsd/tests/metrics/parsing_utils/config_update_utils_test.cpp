@@ -83,14 +83,20 @@ map<int64_t, uint64_t> oldStateHashes;
 std::set<int64_t> noReportMetricIds;
 
 bool initConfig(const StatsdConfig& config) {
-    return initStatsdConfig(
-            key, config, uidMap, pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor,
-            timeBaseNs, timeBaseNs, allTagIds, oldAtomMatchingTrackers, oldAtomMatchingTrackerMap,
-            oldConditionTrackers, oldConditionTrackerMap, oldMetricProducers, oldMetricProducerMap,
-            oldAnomalyTrackers, oldAlarmTrackers, tmpConditionToMetricMap, tmpTrackerToMetricMap,
-            tmpTrackerToConditionMap, tmpActivationAtomTrackerToMetricMap,
-            tmpDeactivationAtomTrackerToMetricMap, oldAlertTrackerMap, metricsWithActivation,
-            oldStateHashes, noReportMetricIds);
+    if (!initStatsdConfig(key, config, uidMap, pullerManager, anomalyAlarmMonitor,
+                          periodicAlarmMonitor, timeBaseNs, timeBaseNs, allTagIds,
+                          oldAtomMatchingTrackers, oldAtomMatchingTrackerMap, oldConditionTrackers,
+                          oldConditionTrackerMap, oldMetricProducers, oldMetricProducerMap,
+                          oldAnomalyTrackers, oldAlarmTrackers, tmpConditionToMetricMap,
+                          tmpTrackerToMetricMap, tmpTrackerToConditionMap,
+                          tmpActivationAtomTrackerToMetricMap,
+                          tmpDeactivationAtomTrackerToMetricMap, oldAlertTrackerMap,
+                          metricsWithActivation, oldStateHashes, noReportMetricIds)) {
+        return false;
+    }
+    // Like MetricsManager::init() once the config is in use.
+    registerStateListeners(oldMetricProducers);
+    return true;
 }
 }  // anonymous namespace
 
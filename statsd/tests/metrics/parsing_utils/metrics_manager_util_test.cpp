@@ -713,6 +713,21 @@ TEST(MetricsManagerTest, TestCreateAtomMatchingTrackerSimple) {
     EXPECT_EQ(atomIds.count(util::SCREEN_STATE_CHANGED), 1);
 }
 
+TEST(MetricsManagerTest, TestCreateAtomMatchingTrackerInvalidWildcard) {
+    sp<UidMap> uidMap = new UidMap();
+    AtomMatcher matcher;
+    matcher.set_id(123);
+    SimpleAtomMatcher* simpleAtomMatcher = matcher.mutable_simple_atom_matcher();
+    simpleAtomMatcher->set_atom_id(util::WAKELOCK_STATE_CHANGED);
+    simpleAtomMatcher->add_field_value_matcher()->set_field(1);
+    // Empty patterns are invalid.
+    simpleAtomMatcher->mutable_field_value_matcher(0)->set_eq_wildcard_string("");
+    EXPECT_EQ(createAtomMatchingTracker(matcher, 0, uidMap), nullptr);
+
+    simpleAtomMatcher->mutable_field_value_matcher(0)->set_eq_wildcard_string("com.vendor.*");
+    EXPECT_NE(createAtomMatchingTracker(matcher, 0, uidMap), nullptr);
+}
+
 TEST(MetricsManagerTest, TestCreateAtomMatchingTrackerCombination) {
     int index = 1;
     int64_t id = 123;
@@ -794,6 +809,50 @@ TEST(MetricsManagerTest, TestCreateConditionTrackerCombination) {
     EXPECT_FALSE(tracker->IsSimpleCondition());
 }
 
+TEST(MetricsManagerTest, TestGetSharedConditionStateKey) {
+    StatsdConfig config;
+    *config.add_atom_matcher() = CreateScreenTurnedOnAtomMatcher();
+    *config.add_atom_matcher() = CreateScreenTurnedOffAtomMatcher();
+    Predicate predicate = CreateScreenIsOnPredicate();
+    unordered_map<int64_t, int> atomTrackerMap;
+    atomTrackerMap[config.atom_matcher(0).id()] = 0;
+    atomTrackerMap[config.atom_matcher(1).id()] = 1;
+    const string key = getSharedConditionStateKey(config, predicate, atomTrackerMap);
+    EXPECT_FALSE(key.empty());
+
+    // The ids don't matter.
+    StatsdConfig renamedConfig = config;
+    renamedConfig.mutable_atom_matcher(0)->set_id(StringToId("RenamedScreenOn"));
+    renamedConfig.mutable_atom_matcher(1)->set_id(StringToId("RenamedScreenOff"));
+    Predicate renamedPredicate = predicate;
+    renamedPredicate.set_id(StringToId("RenamedScreenIsOn"));
+    renamedPredicate.mutable_simple_predicate()->set_start(StringToId("RenamedScreenOn"));
+    renamedPredicate.mutable_simple_predicate()->set_stop(StringToId("RenamedScreenOff"));
+    unordered_map<int64_t, int> renamedAtomTrackerMap;
+    renamedAtomTrackerMap[StringToId("RenamedScreenOn")] = 0;
+    renamedAtomTrackerMap[StringToId("RenamedScreenOff")] = 1;
+    EXPECT_EQ(key, getSharedConditionStateKey(renamedConfig, renamedPredicate,
+                                              renamedAtomTrackerMap));
+
+    // The matchers do.
+    StatsdConfig otherConfig = config;
+    otherConfig.mutable_atom_matcher(0)
+            ->mutable_simple_atom_matcher()
+            ->mutable_field_value_matcher(0)
+            ->set_eq_int(android::view::DisplayStateEnum::DISPLAY_STATE_DOZE);
+    EXPECT_NE(key, getSharedConditionStateKey(otherConfig, predicate, atomTrackerMap));
+
+    // So do the predicate fields.
+    Predicate unnestedPredicate = predicate;
+    unnestedPredicate.mutable_simple_predicate()->set_count_nesting(false);
+    EXPECT_NE(key, getSharedConditionStateKey(config, unnestedPredicate, atomTrackerMap));
+
+    Predicate combinationPredicate;
+    combinationPredicate.mutable_combination()->set_operation(LogicalOperation::NOT);
+    combinationPredicate.mutable_combination()->add_predicate(predicate.id());
+    EXPECT_TRUE(getSharedConditionStateKey(config, combinationPredicate, atomTrackerMap).empty());
+}
+
 TEST(MetricsManagerTest, TestCreateAnomalyTrackerInvalidMetric) {
     Alert alert;
     alert.set_id(123);
@@ -929,6 +988,131 @@ TEST(MetricsManagerTest, TestCreateDurationProducerDimensionsInWhatInvalid) {
     EXPECT_FALSE(metricsManager->isConfigValid());
 }
 
+namespace {
+
+StatsdConfig createConfigForCost() {
+    StatsdConfig config;
+    config.add_allowed_log_source("AID_ROOT");
+    *config.add_atom_matcher() = CreateScreenTurnedOnAtomMatcher();
+
+    CountMetric* countMetric = config.add_count_metric();
+    countMetric->set_id(StringToId("ScreenOnCount"));
+    countMetric->set_what(StringToId("ScreenTurnedOn"));
+    *countMetric->mutable_dimensions_in_what() =
+            CreateDimensions(util::SCREEN_STATE_CHANGED, {1, 2});
+    countMetric->set_bucket(FIVE_MINUTES);
+
+    Alarm* alarm = config.add_alarm();
+    alarm->set_id(StringToId("Alarm"));
+    alarm->set_offset_millis(1);
+    alarm->set_period_millis(60 * 1000);
+    return config;
+}
+
+}  // namespace
+
+TEST(MetricsManagerTest, TestEstimateConfigCost) {
+    StatsdStats::getInstance().reset();
+    for (int i = 0; i < 100; i++) {
+        StatsdStats::getInstance().noteAtomLogged(util::SCREEN_STATE_CHANGED, 1);
+    }
+    // The rate is over at least one second.
+    const double eventsPerSec = StatsdStats::getInstance().getPushedAtomRate(
+            util::SCREEN_STATE_CHANGED);
+    EXPECT_GT(eventsPerSec, 0);
+    EXPECT_LE(eventsPerSec, 100);
+
+    const ConfigCost cost = estimateConfigCost(createConfigForCost(), /* pullerManager */ nullptr);
+    EXPECT_DOUBLE_EQ(eventsPerSec, cost.matcherEvaluationsPerSec);
+    EXPECT_DOUBLE_EQ(eventsPerSec, cost.metricEventsPerSec);
+    // 10 values of each of the 2 dimension fields.
+    EXPECT_EQ(100, cost.dimensionKeys);
+    EXPECT_EQ(0, cost.pullsPerHour);
+    EXPECT_DOUBLE_EQ(60, cost.alarmsPerHour);
+    ASSERT_EQ(1U, cost.metrics.size());
+    EXPECT_EQ(StringToId("ScreenOnCount"), cost.metrics[0].metricId);
+    EXPECT_GT(cost.metrics[0].cost, eventsPerSec);
+    EXPECT_GT(cost.cost, cost.metrics[0].cost + cost.matcherEvaluationsPerSec);
+    StatsdStats::getInstance().reset();
+}
+
+TEST(MetricsManagerTest, TestDowngradeConfig) {
+    StatsdConfig config = createConfigForCost();
+    const int64_t expensiveMetricId = config.count_metric(0).id();
+    CountMetric* cheapMetric = config.add_count_metric();
+    *cheapMetric = config.count_metric(0);
+    cheapMetric->set_id(StringToId("CheapCount"));
+    cheapMetric->clear_dimensions_in_what();
+
+    Alert* alert = config.add_alert();
+    alert->set_id(StringToId("Alert"));
+    alert->set_metric_id(expensiveMetricId);
+    Subscription* subscription = config.add_subscription();
+    subscription->set_id(StringToId("Subscription"));
+    subscription->set_rule_type(Subscription::ALERT);
+    subscription->set_rule_id(alert->id());
+    config.add_metric_activation()->set_metric_id(expensiveMetricId);
+    config.add_no_report_metric(expensiveMetricId);
+    config.add_no_report_metric(cheapMetric->id());
+
+    const ConfigCost cost = estimateConfigCost(config, /* pullerManager */ nullptr);
+    ASSERT_EQ(2U, cost.metrics.size());
+    // Removing the metrics does not save the cost of the matchers and alarms.
+    const double nonMetricCost = cost.cost - cost.metrics[0].cost - cost.metrics[1].cost;
+    EXPECT_EQ(-1, downgradeConfig(cost, nonMetricCost / 2, &config));
+    EXPECT_EQ(2, config.count_metric_size());
+    EXPECT_EQ(0, downgradeConfig(cost, cost.cost, &config));
+    EXPECT_EQ(1, downgradeConfig(cost, cost.cost - cost.metrics[0].cost, &config));
+
+    ASSERT_EQ(1, config.count_metric_size());
+    EXPECT_EQ(cheapMetric->id(), config.count_metric(0).id());
+    EXPECT_EQ(0, config.alert_size());
+    EXPECT_EQ(0, config.subscription_size());
+    EXPECT_EQ(0, config.metric_activation_size());
+    ASSERT_EQ(1, config.no_report_metric_size());
+    EXPECT_EQ(StringToId("CheapCount"), config.no_report_metric(0));
+}
+
+TEST(MetricsManagerTest, TestConfigOverCostBudget) {
+    const StatsdConfig config = createConfigForCost();
+    ConfigKey key(123, 987);
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+    sp<UidMap> uidMap = new UidMap();
+
+    // The alarm alone costs more.
+    MetricsManager::SetConfigCostBudget("0.5");
+    sp<MetricsManager> metricsManager = new MetricsManager(
+            key, config, 456, 456, uidMap, pullerManager, anomalyAlarmMonitor,
+            periodicAlarmMonitor);
+    EXPECT_FALSE(metricsManager->isConfigValid());
+    EXPECT_TRUE(metricsManager->mAllMetricProducers.empty());
+    EXPECT_DOUBLE_EQ(60, metricsManager->getConfigCost().alarmsPerHour);
+
+    // The alarm can't be removed, removing the metric is not enough.
+    MetricsManager::SetConfigCostBudget("0.5:downgrade");
+    metricsManager = new MetricsManager(key, config, 456, 456, uidMap, pullerManager,
+                                        anomalyAlarmMonitor, periodicAlarmMonitor);
+    EXPECT_FALSE(metricsManager->isConfigValid());
+    EXPECT_TRUE(metricsManager->mAllMetricProducers.empty());
+
+    // The alarm costs 0.83, the metric of 100 dimension keys 1.
+    MetricsManager::SetConfigCostBudget("1:downgrade");
+    metricsManager = new MetricsManager(key, config, 456, 456, uidMap, pullerManager,
+                                        anomalyAlarmMonitor, periodicAlarmMonitor);
+    EXPECT_TRUE(metricsManager->isConfigValid());
+    EXPECT_TRUE(metricsManager->mAllMetricProducers.empty());
+    EXPECT_TRUE(metricsManager->getConfigCost().metrics.empty());
+    EXPECT_LE(metricsManager->getConfigCost().cost, 1);
+
+    MetricsManager::SetConfigCostBudget("");
+    metricsManager = new MetricsManager(key, config, 456, 456, uidMap, pullerManager,
+                                        anomalyAlarmMonitor, periodicAlarmMonitor);
+    EXPECT_TRUE(metricsManager->isConfigValid());
+    EXPECT_EQ(1U, metricsManager->mAllMetricProducers.size());
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/shell/AtomTraceRecorder.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+#include "tests/statsd_test_util.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::vector;
+
+TEST(AtomTraceRecorderTest, TestCapture) {
+    sp<AtomTraceRecorder> recorder = new AtomTraceRecorder(nullptr);
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+
+    // Parsed before the capture, without a raw buffer.
+    std::unique_ptr<LogEvent> earlyEvent = CreateScreenStateChangedEvent(
+            500 /*timestamp*/, ::android::view::DisplayStateEnum::DISPLAY_STATE_OFF);
+
+    AtomTraceRecorder::CaptureStats stats;
+    std::thread capture(
+            [&] { EXPECT_TRUE(recorder->capture(fds[1], /*durationSec=*/1, &stats)); });
+    EXPECT_TRUE(recorder->waitForCaptureStarted(std::chrono::seconds(10)));
+
+    // Another capture can't start while the first one runs.
+    AtomTraceRecorder::CaptureStats otherStats;
+    EXPECT_FALSE(recorder->capture(fds[1], /*durationSec=*/1, &otherStats));
+
+    std::unique_ptr<LogEvent> event = CreateScreenStateChangedEvent(
+            1000 /*timestamp*/, ::android::view::DisplayStateEnum::DISPLAY_STATE_ON);
+    recorder->onLogEvent(*earlyEvent);
+    recorder->onLogEvent(*event);
+    capture.join();
+    close(fds[1]);
+
+    EXPECT_EQ(1, stats.atomCount);
+    EXPECT_EQ(0, stats.droppedAtomCount);
+    EXPECT_EQ(1, stats.missingPayloadCount);
+
+    std::string trace;
+    ASSERT_TRUE(android::base::ReadFdToString(fds[0], &trace));
+    close(fds[0]);
+    EXPECT_EQ(stats.byteCount, trace.size());
+    vector<AtomTraceRecord> records;
+    ASSERT_TRUE(decodeAtomTrace(reinterpret_cast<const uint8_t*>(trace.data()), trace.size(),
+                                &records));
+    ASSERT_EQ(1, records.size());
+    EXPECT_EQ(event->GetUid(), records[0].uid);
+    EXPECT_EQ(event->GetPid(), records[0].pid);
+    EXPECT_EQ(1000, records[0].elapsedTimestampNs);
+
+    // The payload is the socket encoding of the atom.
+    LogEvent decoded(records[0].uid, records[0].pid);
+    ASSERT_TRUE(decoded.parseBuffer(records[0].payload.data(), records[0].payload.size()));
+    EXPECT_EQ(event->getValues(), decoded.getValues());
+
+    // The raw buffers are no longer retained.
+    std::unique_ptr<LogEvent> lateEvent = CreateScreenStateChangedEvent(
+            2000 /*timestamp*/, ::android::view::DisplayStateEnum::DISPLAY_STATE_OFF);
+    EXPECT_EQ(nullptr, lateEvent->getRawBuffer());
+}
+
+TEST(AtomTraceRecorderTest, TestAllAtomsInUseWhileCapturing) {
+    std::shared_ptr<LogEventFilter> filter = std::make_shared<LogEventFilter>();
+    const int consumer = 0;
+    filter->setAtomIds({1}, &consumer);
+    sp<AtomTraceRecorder> recorder = new AtomTraceRecorder(filter);
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+
+    AtomTraceRecorder::CaptureStats stats;
+    std::thread capture(
+            [&] { EXPECT_TRUE(recorder->capture(fds[1], /*durationSec=*/1, &stats)); });
+    EXPECT_TRUE(recorder->waitForCaptureStarted(std::chrono::seconds(10)));
+    EXPECT_TRUE(filter->isAtomInUse(2));
+    capture.join();
+    EXPECT_FALSE(filter->isAtomInUse(2));
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
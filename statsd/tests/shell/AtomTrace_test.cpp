@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/shell/AtomTrace.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::string;
+using std::vector;
+
+namespace {
+
+vector<AtomTraceRecord> decode(const string& trace) {
+    vector<AtomTraceRecord> records;
+    EXPECT_TRUE(decodeAtomTrace(reinterpret_cast<const uint8_t*>(trace.data()), trace.size(),
+                                &records));
+    return records;
+}
+
+}  // anonymous namespace
+
+TEST(AtomTraceTest, TestRoundTrip) {
+    const vector<uint8_t> payload1 = {1, 2, 3};
+    const vector<uint8_t> payload2(300, 7);
+    string trace;
+    AtomTraceEncoder::appendHeader(&trace);
+    AtomTraceEncoder encoder;
+    encoder.appendRecord(1000, 10, 5000, payload1.data(), payload1.size(), &trace);
+    // Out of order timestamps, negative uid and pid, and an empty payload.
+    encoder.appendRecord(-1, -1, 4000, nullptr, 0, &trace);
+    encoder.appendRecord(10123, 2345, INT64_MAX, payload2.data(), payload2.size(), &trace);
+
+    const vector<AtomTraceRecord> records = decode(trace);
+    ASSERT_EQ(3, records.size());
+    EXPECT_EQ(1000, records[0].uid);
+    EXPECT_EQ(10, records[0].pid);
+    EXPECT_EQ(5000, records[0].elapsedTimestampNs);
+    EXPECT_EQ(payload1, records[0].payload);
+    EXPECT_EQ(-1, records[1].uid);
+    EXPECT_EQ(-1, records[1].pid);
+    EXPECT_EQ(4000, records[1].elapsedTimestampNs);
+    EXPECT_TRUE(records[1].payload.empty());
+    EXPECT_EQ(10123, records[2].uid);
+    EXPECT_EQ(2345, records[2].pid);
+    EXPECT_EQ(INT64_MAX, records[2].elapsedTimestampNs);
+    EXPECT_EQ(payload2, records[2].payload);
+}
+
+TEST(AtomTraceTest, TestHeaderOnly) {
+    string trace;
+    AtomTraceEncoder::appendHeader(&trace);
+    EXPECT_TRUE(decode(trace).empty());
+}
+
+TEST(AtomTraceTest, TestTruncatedTrace) {
+    const vector<uint8_t> payload = {1, 2, 3, 4};
+    string trace;
+    AtomTraceEncoder::appendHeader(&trace);
+    AtomTraceEncoder encoder;
+    encoder.appendRecord(1000, 10, 5000, payload.data(), payload.size(), &trace);
+    encoder.appendRecord(1000, 10, 6000, payload.data(), payload.size(), &trace);
+    trace.resize(trace.size() - 1);
+
+    vector<AtomTraceRecord> records;
+    EXPECT_FALSE(decodeAtomTrace(reinterpret_cast<const uint8_t*>(trace.data()), trace.size(),
+                                 &records));
+    ASSERT_EQ(1, records.size());
+    EXPECT_EQ(payload, records[0].payload);
+}
+
+TEST(AtomTraceTest, TestMissingHeader) {
+    const string trace = "not a trace";
+    vector<AtomTraceRecord> records;
+    EXPECT_FALSE(decodeAtomTrace(reinterpret_cast<const uint8_t*>(trace.data()), trace.size(),
+                                 &records));
+    EXPECT_TRUE(records.empty());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -31,6 +31,7 @@ using namespace android::os::statsd;
 using android::sp;
 using std::vector;
 using testing::_;
+using testing::AnyNumber;
 using testing::Invoke;
 using testing::NaggyMock;
 using testing::StrictMock;
@@ -142,6 +143,144 @@ TEST(ShellSubscriberTest, testPushedSubscription) {
     runShellTest(config, uidMap, pullerManager, pushedList, shellData);
 }
 
+TEST(ShellSubscriberTest, testPushedSubscriptionBatchesAtoms) {
+    sp<MockUidMap> uidMap = new NaggyMock<MockUidMap>();
+
+    sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+    vector<std::shared_ptr<LogEvent>> pushedList;
+    pushedList.push_back(CreateScreenStateChangedEvent(
+            1000 /*timestamp*/, ::android::view::DisplayStateEnum::DISPLAY_STATE_ON));
+    // Not subscribed.
+    pushedList.push_back(CreateScreenBrightnessChangedEvent(1500 /*timestamp*/, 100));
+    pushedList.push_back(CreateScreenStateChangedEvent(
+            2000 /*timestamp*/, ::android::view::DisplayStateEnum::DISPLAY_STATE_OFF));
+
+    ShellSubscription config;
+    config.add_pushed()->set_atom_id(29);
+    config.add_pushed()->set_atom_id(10016);
+
+    // The atoms pushed together are sent in one ShellData.
+    ShellData shellData;
+    shellData.add_atom()->mutable_screen_state_changed()->set_state(
+            ::android::view::DisplayStateEnum::DISPLAY_STATE_ON);
+    shellData.add_atom()->mutable_screen_state_changed()->set_state(
+            ::android::view::DisplayStateEnum::DISPLAY_STATE_OFF);
+
+    runShellTest(config, uidMap, pullerManager, pushedList, shellData);
+}
+
+namespace {
+
+// Starts a subscription with [config] on a new thread, and returns the read end of its data pipe.
+int startSubscription(const sp<ShellSubscriber>& shellClient, const ShellSubscription& config) {
+    int fds_config[2];
+    EXPECT_EQ(0, pipe(fds_config));
+    int fds_data[2];
+    EXPECT_EQ(0, pipe(fds_data));
+
+    size_t bufferSize = config.ByteSize();
+    write(fds_config[1], &bufferSize, sizeof(bufferSize));
+    vector<uint8_t> buffer(bufferSize);
+    config.SerializeToArray(&buffer[0], bufferSize);
+    write(fds_config[1], buffer.data(), bufferSize);
+    close(fds_config[1]);
+
+    std::thread reader([shellClient, in = fds_config[0], out = fds_data[1]] {
+        shellClient->startNewSubscription(in, out, /*timeoutSec=*/-1);
+    });
+    reader.detach();
+    return fds_data[0];
+}
+
+// Reads the next ShellData that is not a heartbeat from [fd].
+ShellData readShellData(int fd) {
+    size_t dataSize = 0;
+    while (dataSize == 0) {
+        read(fd, &dataSize, sizeof(dataSize));
+    }
+    vector<uint8_t> dataBuffer(dataSize);
+    EXPECT_EQ((int)dataSize, read(fd, dataBuffer.data(), dataSize));
+    ShellData shellData;
+    EXPECT_TRUE(shellData.ParseFromArray(dataBuffer.data(), dataSize));
+    return shellData;
+}
+
+}  // namespace
+
+TEST(ShellSubscriberTest, testConcurrentPushedSubscriptions) {
+    sp<MockUidMap> uidMap = new NaggyMock<MockUidMap>();
+    sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+    sp<ShellSubscriber> shellClient = new ShellSubscriber(uidMap, pullerManager);
+
+    ShellSubscription screenConfig;
+    screenConfig.add_pushed()->set_atom_id(29);
+    ShellSubscription screenAndBrightnessConfig;
+    screenAndBrightnessConfig.add_pushed()->set_atom_id(29);
+    screenAndBrightnessConfig.add_pushed()->set_atom_id(9);
+
+    const int screenFd = startSubscription(shellClient, screenConfig);
+    const int screenAndBrightnessFd = startSubscription(shellClient, screenAndBrightnessConfig);
+    ASSERT_TRUE(shellClient->waitForSubscriptionCount(2, std::chrono::seconds(10)));
+
+    // The first subscription is not ended by the second.
+    shellClient->onLogEvent(*CreateScreenStateChangedEvent(
+            1000 /*timestamp*/, ::android::view::DisplayStateEnum::DISPLAY_STATE_ON));
+    shellClient->onLogEvent(*CreateScreenBrightnessChangedEvent(1500 /*timestamp*/, 100));
+
+    ShellData expectedScreenData;
+    expectedScreenData.add_atom()->mutable_screen_state_changed()->set_state(
+            ::android::view::DisplayStateEnum::DISPLAY_STATE_ON);
+    ShellData expectedScreenAndBrightnessData = expectedScreenData;
+    expectedScreenAndBrightnessData.add_atom()->mutable_screen_brightness_changed()->set_level(
+            100);
+
+    EXPECT_EQ(expectedScreenData.SerializeAsString(),
+              readShellData(screenFd).SerializeAsString());
+    EXPECT_EQ(expectedScreenAndBrightnessData.SerializeAsString(),
+              readShellData(screenAndBrightnessFd).SerializeAsString());
+
+    close(screenFd);
+    close(screenAndBrightnessFd);
+}
+
+TEST(ShellSubscriberTest, testRawPushedSubscription) {
+    sp<MockUidMap> uidMap = new NaggyMock<MockUidMap>();
+    sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+    sp<ShellSubscriber> shellClient = new ShellSubscriber(uidMap, pullerManager);
+
+    ShellSubscription config;
+    config.add_pushed()->set_atom_id(29);
+    config.set_raw_pushed_atoms(true);
+    const int dataFd = startSubscription(shellClient, config);
+    ASSERT_TRUE(shellClient->waitForSubscriptionCount(1, std::chrono::seconds(10)));
+
+    // Parsed while the subscription retains the raw buffers.
+    std::unique_ptr<LogEvent> event = CreateScreenStateChangedEvent(
+            1000 /*timestamp*/, ::android::view::DisplayStateEnum::DISPLAY_STATE_ON);
+    ASSERT_NE(nullptr, event->getRawBuffer());
+    shellClient->onLogEvent(*event);
+
+    // Only the atoms of the raw subscriptions keep their raw buffers.
+    EXPECT_EQ(nullptr, CreateScreenBrightnessChangedEvent(1000 /*timestamp*/, 100)->getRawBuffer());
+
+    ShellData shellData = readShellData(dataFd);
+    EXPECT_EQ(0, shellData.atom_size());
+    ASSERT_EQ(1, shellData.raw_atom_size());
+    const RawAtom& rawAtom = shellData.raw_atom(0);
+    EXPECT_EQ(event->GetUid(), rawAtom.uid());
+    EXPECT_EQ(event->GetPid(), rawAtom.pid());
+    EXPECT_EQ(1000, rawAtom.elapsed_timestamp_nanos());
+
+    // The payload is the socket encoding of the atom.
+    string payload = rawAtom.payload();
+    LogEvent decoded(/*uid=*/0, /*pid=*/0);
+    ASSERT_TRUE(decoded.parseBuffer(reinterpret_cast<uint8_t*>(payload.data()), payload.size()));
+    EXPECT_EQ(29, decoded.GetTagId());
+    EXPECT_EQ(event->getValues(), decoded.getValues());
+
+    close(dataFd);
+}
+
 namespace {
 
 int kUid1 = 1000;
@@ -198,10 +337,63 @@ TEST(ShellSubscriberTest, testPulledSubscription) {
                 data->push_back(makeCpuActiveTimeAtom(/*uid=*/kUid2, /*timeMillis=*/kCpuTime2));
                 return true;
             }));
+    EXPECT_CALL(*pullerManager, RegisterPullUidProvider(_, _)).Times(AnyNumber());
+    EXPECT_CALL(*pullerManager, UnregisterPullUidProvider(_, _)).Times(AnyNumber());
+    EXPECT_CALL(*pullerManager, RegisterReceiver(10016, _, _, _, _)).Times(AnyNumber());
+    EXPECT_CALL(*pullerManager, UnRegisterReceiver(10016, _, _)).Times(AnyNumber());
     runShellTest(getPulledConfig(), uidMap, pullerManager, vector<std::shared_ptr<LogEvent>>(),
                  getExpectedShellData());
 }
 
+TEST(ShellSubscriberTest, testPulledSubscriptionUsesPullSchedule) {
+    sp<MockUidMap> uidMap = new NaggyMock<MockUidMap>();
+
+    sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+    const vector<int32_t> uids = {AID_SYSTEM};
+    vector<std::shared_ptr<LogEvent>> pulledData = {
+            makeCpuActiveTimeAtom(/*uid=*/kUid1, /*timeMillis=*/kCpuTime1),
+            makeCpuActiveTimeAtom(/*uid=*/kUid2, /*timeMillis=*/kCpuTime2)};
+    // Only the initial pull is issued by the subscription.
+    EXPECT_CALL(*pullerManager, Pull(10016, uids, _, _))
+            .WillOnce(Invoke([&pulledData](int tagId, const vector<int32_t>&, const int64_t,
+                                           vector<std::shared_ptr<LogEvent>>* data) {
+                *data = pulledData;
+                return true;
+            }));
+    wp<PullUidProvider> uidProvider;
+    wp<PullDataReceiver> receiver;
+    int64_t intervalNs = 0;
+    EXPECT_CALL(*pullerManager, RegisterPullUidProvider(_, _))
+            .WillOnce(Invoke([&uidProvider](const ConfigKey&, wp<PullUidProvider> provider) {
+                uidProvider = provider;
+            }));
+    EXPECT_CALL(*pullerManager, RegisterReceiver(10016, _, _, _, _))
+            .WillOnce(Invoke([&receiver, &intervalNs](int, const ConfigKey&,
+                                                      wp<PullDataReceiver> pullReceiver, int64_t,
+                                                      int64_t pullIntervalNs) {
+                receiver = pullReceiver;
+                intervalNs = pullIntervalNs;
+            }));
+    EXPECT_CALL(*pullerManager, UnregisterPullUidProvider(_, _)).Times(AnyNumber());
+    EXPECT_CALL(*pullerManager, UnRegisterReceiver(10016, _, _)).Times(AnyNumber());
+
+    sp<ShellSubscriber> shellClient = new ShellSubscriber(uidMap, pullerManager);
+    const int dataFd = startSubscription(shellClient, getPulledConfig());
+
+    const string expectedData = getExpectedShellData().SerializeAsString();
+    EXPECT_EQ(expectedData, readShellData(dataFd).SerializeAsString());
+    EXPECT_EQ(2000 * NS_PER_SEC / 1000, intervalNs);
+    ASSERT_NE(nullptr, uidProvider.promote());
+    EXPECT_EQ(uids, uidProvider.promote()->getPullAtomUids(10016));
+
+    // The scheduled pulls of the puller manager are sent to the subscription.
+    ASSERT_NE(nullptr, receiver.promote());
+    receiver.promote()->onDataPulled(pulledData, /*pullSuccess=*/true, /*originalPullTimeNs=*/0);
+    EXPECT_EQ(expectedData, readShellData(dataFd).SerializeAsString());
+
+    close(dataFd);
+}
+
 #else
 GTEST_LOG_(INFO) << "This test does nothing.\n";
 #endif
@@ -0,0 +1,119 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "socket/LogEventFilter.h"
+
+#include <gtest/gtest.h>
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+const int kConsumer1 = 0;
+const int kConsumer2 = 1;
+}  // anonymous namespace
+
+TEST(LogEventFilterTest, TestAtomIds) {
+    LogEventFilter filter;
+    EXPECT_FALSE(filter.isAtomInUse(1));
+
+    filter.setAtomIds({1, 2}, &kConsumer1);
+    EXPECT_TRUE(filter.isAtomInUse(1));
+    EXPECT_TRUE(filter.isAtomInUse(2));
+    EXPECT_FALSE(filter.isAtomInUse(3));
+
+    filter.setAtomIds({3}, &kConsumer1);
+    EXPECT_FALSE(filter.isAtomInUse(1));
+    EXPECT_TRUE(filter.isAtomInUse(3));
+}
+
+TEST(LogEventFilterTest, TestMultipleConsumers) {
+    LogEventFilter filter;
+    filter.setAtomIds({1, 2}, &kConsumer1);
+    filter.setAtomIds({2, 100}, &kConsumer2);
+    EXPECT_TRUE(filter.isAtomInUse(1));
+    EXPECT_TRUE(filter.isAtomInUse(2));
+    EXPECT_TRUE(filter.isAtomInUse(100));
+
+    filter.setAtomIds({}, &kConsumer1);
+    EXPECT_FALSE(filter.isAtomInUse(1));
+    EXPECT_TRUE(filter.isAtomInUse(2));
+    EXPECT_TRUE(filter.isAtomInUse(100));
+
+    filter.setAtomIds({}, &kConsumer2);
+    EXPECT_FALSE(filter.isAtomInUse(2));
+    EXPECT_FALSE(filter.isAtomInUse(100));
+}
+
+TEST(LogEventFilterTest, TestHasConsumers) {
+    LogEventFilter filter;
+    EXPECT_FALSE(filter.hasConsumers());
+
+    filter.setAtomIds({1}, &kConsumer1);
+    filter.setAllAtomsInUse(true, &kConsumer2);
+    EXPECT_TRUE(filter.hasConsumers());
+
+    filter.setAtomIds({}, &kConsumer1);
+    EXPECT_TRUE(filter.hasConsumers());
+    filter.setAllAtomsInUse(false, &kConsumer2);
+    EXPECT_FALSE(filter.hasConsumers());
+}
+
+TEST(LogEventFilterTest, TestAtomIdsOutOfRange) {
+    LogEventFilter filter;
+    filter.setAtomIds({1, LogEventFilter::kMaxFilteredAtomId + 1}, &kConsumer1);
+    EXPECT_TRUE(filter.isAtomInUse(-1));
+    EXPECT_TRUE(filter.isAtomInUse(LogEventFilter::kMaxFilteredAtomId));
+    EXPECT_FALSE(filter.isAtomInUse(LogEventFilter::kMaxFilteredAtomId - 1));
+}
+
+TEST(LogEventFilterTest, TestDisabledFilter) {
+    LogEventFilter filter;
+    filter.setAtomIds({1}, &kConsumer1);
+
+    filter.setFilteringEnabled(false);
+    EXPECT_TRUE(filter.isAtomInUse(1));
+    EXPECT_TRUE(filter.isAtomInUse(2));
+
+    filter.setFilteringEnabled(true);
+    EXPECT_TRUE(filter.isAtomInUse(1));
+    EXPECT_FALSE(filter.isAtomInUse(2));
+}
+
+TEST(LogEventFilterTest, TestAllAtomsInUse) {
+    LogEventFilter filter;
+    filter.setAtomIds({1}, &kConsumer1);
+
+    filter.setAllAtomsInUse(true, &kConsumer2);
+    EXPECT_TRUE(filter.isAtomInUse(2));
+
+    // Enabling the filtering does not override the consumer.
+    filter.setFilteringEnabled(false);
+    filter.setFilteringEnabled(true);
+    EXPECT_TRUE(filter.isAtomInUse(2));
+
+    filter.setAllAtomsInUse(false, &kConsumer2);
+    EXPECT_TRUE(filter.isAtomInUse(1));
+    EXPECT_FALSE(filter.isAtomInUse(2));
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "socket/SharedMemoryRing.h"
+
+#include <gtest/gtest.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "logd/LogEvent.h"
+#include "stats_event.h"
+#include "stats_socket.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using android::base::unique_fd;
+using std::unique_ptr;
+using std::vector;
+
+TEST(SharedMemoryRingTest, TestReadAtomsWrittenToRing) {
+    int ringFd;
+    int wakeFd;
+    ASSERT_EQ(AStatsSocket_createRing(STATS_RING_MIN_CAPACITY, &ringFd, &wakeFd), 0);
+    unique_ptr<SharedMemoryRing> ring =
+            SharedMemoryRing::map(unique_fd(ringFd), unique_fd(wakeFd), 1000, 1234);
+    ASSERT_NE(ring, nullptr);
+    EXPECT_TRUE(ring->prepareWait());
+
+    // More atoms than fit in the ring at once, so that it wraps around.
+    const int atomCount = 2000;
+    int readCount = 0;
+    for (int i = 0; i < atomCount; i++) {
+        AStatsEvent* event = AStatsEvent_obtain();
+        AStatsEvent_setAtomId(event, 100);
+        AStatsEvent_writeInt32(event, i);
+        EXPECT_GT(AStatsEvent_write(event), 0);
+        AStatsEvent_release(event);
+
+        EXPECT_TRUE(ring->read(/*maxAtoms=*/10, [&](uint8_t* atom, size_t size) {
+            LogEvent logEvent(ring->uid(), ring->pid());
+            ASSERT_TRUE(logEvent.parseBuffer(atom, size));
+            EXPECT_EQ(logEvent.GetTagId(), 100);
+            ASSERT_EQ(logEvent.getValues().size(), 1);
+            EXPECT_EQ(logEvent.getValues()[0].mValue.int_value, readCount);
+            readCount++;
+        }));
+    }
+    AStatsSocket_closeRing();
+
+    EXPECT_EQ(readCount, atomCount);
+    EXPECT_TRUE(ring->prepareWait());
+}
+
+TEST(SharedMemoryRingTest, TestRejectsUnsealedMemory) {
+    const size_t size = STATS_RING_HEADER_SIZE + STATS_RING_MIN_CAPACITY;
+    unique_fd ringFd(memfd_create("test_ring", MFD_CLOEXEC));
+    ASSERT_GE(ringFd.get(), 0);
+    ASSERT_EQ(ftruncate(ringFd.get(), size), 0);
+
+    EXPECT_EQ(SharedMemoryRing::map(std::move(ringFd), unique_fd(), 1000, 1234), nullptr);
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "socket/StatsSocketListener.h"
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "stats_event.h"
+#include "stats_socket.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using android::base::unique_fd;
+using std::vector;
+
+namespace {
+
+constexpr std::chrono::seconds kTimeout(10);
+
+// Builds an empty ring of STATS_RING_MIN_CAPACITY bytes, like AStatsSocket_createRing(), which
+// only allows one ring per process.
+void createRing(unique_fd* ringFd, unique_fd* wakeFd) {
+    const size_t size = STATS_RING_HEADER_SIZE + STATS_RING_MIN_CAPACITY;
+    ringFd->reset(memfd_create("test_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+    ASSERT_GE(ringFd->get(), 0);
+    ASSERT_EQ(ftruncate(ringFd->get(), size), 0);
+    ASSERT_EQ(fcntl(ringFd->get(), F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL), 0);
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, ringFd->get(), 0);
+    ASSERT_NE(memory, MAP_FAILED);
+    stats_ring_header* header = static_cast<stats_ring_header*>(memory);
+    header->magic = STATS_RING_MAGIC;
+    header->version = STATS_RING_VERSION;
+    header->capacity = STATS_RING_MIN_CAPACITY;
+    munmap(memory, size);
+    wakeFd->reset(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+    ASSERT_GE(wakeFd->get(), 0);
+}
+
+sp<StatsSocketListener> createListener(const std::shared_ptr<LogEventQueue>& queue,
+                                       unique_fd* socket) {
+    int sockets[2];
+    EXPECT_EQ(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, sockets), 0);
+    socket->reset(sockets[1]);
+    return new StatsSocketListener(queue, /*batchReadSize=*/1, /*eventPool=*/nullptr,
+                                   /*bufferSlab=*/nullptr, /*maxReceiveBufferBytes=*/0,
+                                   /*logEventFilter=*/nullptr, sockets[0]);
+}
+
+}  // namespace
+
+TEST(StatsSocketListenerTest, TestRegisterRing) {
+    std::shared_ptr<LogEventQueue> queue = std::make_shared<LogEventQueue>(100);
+    unique_fd socket;
+    sp<StatsSocketListener> listener = createListener(queue, &socket);
+
+    // An unsealed memfd is rejected.
+    unique_fd unsealedFd(memfd_create("test_ring", MFD_CLOEXEC));
+    ASSERT_EQ(ftruncate(unsealedFd.get(), STATS_RING_HEADER_SIZE + STATS_RING_MIN_CAPACITY), 0);
+    EXPECT_FALSE(listener->registerRing(std::move(unsealedFd), unique_fd(), 1000, getpid()));
+    EXPECT_EQ(0, listener->getRingCount());
+
+    int ringFd;
+    int wakeFd;
+    ASSERT_EQ(AStatsSocket_createRing(STATS_RING_MIN_CAPACITY, &ringFd, &wakeFd), 0);
+    ASSERT_TRUE(listener->registerRing(unique_fd(ringFd), unique_fd(wakeFd), 1000, getpid()));
+    EXPECT_EQ(1, listener->getRingCount());
+
+    // The atoms written to the ring are queued.
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, 100);
+    AStatsEvent_writeInt32(event, 42);
+    EXPECT_GT(AStatsEvent_write(event), 0);
+    AStatsEvent_release(event);
+    vector<std::unique_ptr<LogEvent>> events;
+    ASSERT_EQ(1, queue->waitPopBatch(1, /*timeoutMs=*/10000, &events));
+    EXPECT_EQ(100, events[0]->GetTagId());
+    EXPECT_EQ(1000, events[0]->GetUid());
+    ASSERT_EQ(1, events[0]->getValues().size());
+    EXPECT_EQ(42, events[0]->getValues()[0].mValue.int_value);
+
+    AStatsSocket_closeRing();
+    listener->unregisterRing(1000, getpid());
+    EXPECT_EQ(0, listener->getRingCount());
+}
+
+TEST(StatsSocketListenerTest, TestRingLimit) {
+    std::shared_ptr<LogEventQueue> queue = std::make_shared<LogEventQueue>(100);
+    unique_fd socket;
+    sp<StatsSocketListener> listener = createListener(queue, &socket);
+
+    unique_fd ringFd;
+    unique_fd wakeFd;
+    for (size_t i = 0; i < StatsSocketListener::kMaxRings; i++) {
+        createRing(&ringFd, &wakeFd);
+        EXPECT_TRUE(listener->registerRing(std::move(ringFd), std::move(wakeFd), 1000 + i,
+                                           getpid()));
+    }
+    EXPECT_EQ(StatsSocketListener::kMaxRings, listener->getRingCount());
+
+    // The client of a rejected ring keeps writing to the socket.
+    const int32_t extraUid = 1000 + StatsSocketListener::kMaxRings;
+    createRing(&ringFd, &wakeFd);
+    EXPECT_FALSE(listener->registerRing(std::move(ringFd), std::move(wakeFd), extraUid, getpid()));
+
+    // A client can replace its ring.
+    createRing(&ringFd, &wakeFd);
+    EXPECT_TRUE(listener->registerRing(std::move(ringFd), std::move(wakeFd), 1000, getpid()));
+    EXPECT_EQ(StatsSocketListener::kMaxRings, listener->getRingCount());
+
+    // Unregistering a ring frees its slot.
+    listener->unregisterRing(1000, getpid());
+    EXPECT_EQ(StatsSocketListener::kMaxRings - 1, listener->getRingCount());
+    createRing(&ringFd, &wakeFd);
+    EXPECT_TRUE(listener->registerRing(std::move(ringFd), std::move(wakeFd), extraUid, getpid()));
+    EXPECT_EQ(StatsSocketListener::kMaxRings, listener->getRingCount());
+}
+
+TEST(StatsSocketListenerTest, TestRingReleasedWhenClientExits) {
+    std::shared_ptr<LogEventQueue> queue = std::make_shared<LogEventQueue>(100);
+    unique_fd socket;
+    sp<StatsSocketListener> listener = createListener(queue, &socket);
+
+    // The child exits once the pipe is closed.
+    int pipeFds[2];
+    ASSERT_EQ(pipe2(pipeFds, O_CLOEXEC), 0);
+    unique_fd readFd(pipeFds[0]);
+    unique_fd writeFd(pipeFds[1]);
+    const pid_t child = fork();
+    ASSERT_GE(child, 0);
+    if (child == 0) {
+        writeFd.reset();
+        char c;
+        read(readFd.get(), &c, 1);
+        _exit(0);
+    }
+    readFd.reset();
+
+    unique_fd ringFd;
+    unique_fd wakeFd;
+    createRing(&ringFd, &wakeFd);
+    ASSERT_TRUE(listener->registerRing(std::move(ringFd), std::move(wakeFd), 1000, child));
+    EXPECT_EQ(1, listener->getRingCount());
+
+    writeFd.reset();
+    ASSERT_EQ(child, TEMP_FAILURE_RETRY(waitpid(child, nullptr, 0)));
+    EXPECT_TRUE(listener->waitForRingCount(0, kTimeout));
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
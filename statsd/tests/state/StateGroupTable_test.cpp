@@ -0,0 +1,98 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "state/StateGroupTable.h"
+
+#include <gtest/gtest.h>
+
+#include <limits>
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unordered_map;
+
+namespace {
+
+// Checks that [table] maps the states of [stateGroups] and nothing else in [minState, maxState].
+void expectGroups(const StateGroupTable& table, const unordered_map<int, int64_t>& stateGroups,
+                  int minState, int maxState) {
+    for (int state = minState; state <= maxState; state++) {
+        int64_t groupId = -1;
+        const auto it = stateGroups.find(state);
+        if (it == stateGroups.end()) {
+            EXPECT_FALSE(table.getGroupId(state, &groupId)) << state;
+        } else {
+            ASSERT_TRUE(table.getGroupId(state, &groupId)) << state;
+            EXPECT_EQ(it->second, groupId) << state;
+        }
+    }
+}
+
+}  // namespace
+
+TEST(StateGroupTableTest, TestDenseGroups) {
+    const unordered_map<int, int64_t> stateGroups = {
+            {-1, 1000}, {1, 1000}, {2, 2000}, {5, 2000}, {7, 3000}};
+    StateGroupTable table(27, stateGroups);
+
+    EXPECT_EQ(27, table.getAtomId());
+    EXPECT_TRUE(table.isDense());
+    expectGroups(table, stateGroups, -10, 20);
+
+    int64_t groupId;
+    EXPECT_FALSE(table.getGroupId(std::numeric_limits<int>::min(), &groupId));
+    EXPECT_FALSE(table.getGroupId(std::numeric_limits<int>::max(), &groupId));
+}
+
+TEST(StateGroupTableTest, TestSparseGroups) {
+    const unordered_map<int, int64_t> stateGroups = {
+            {0, 1}, {1000, 2}, {std::numeric_limits<int>::max(), 3}};
+    StateGroupTable table(27, stateGroups);
+
+    EXPECT_FALSE(table.isDense());
+    expectGroups(table, stateGroups, -5, 1005);
+
+    int64_t groupId;
+    ASSERT_TRUE(table.getGroupId(std::numeric_limits<int>::max(), &groupId));
+    EXPECT_EQ(3, groupId);
+}
+
+TEST(StateGroupTableTest, TestNoGroups) {
+    StateGroupTable table(27, {});
+
+    int64_t groupId;
+    EXPECT_FALSE(table.getGroupId(0, &groupId));
+}
+
+TEST(StateGroupTableTest, TestBuild) {
+    const unordered_map<int, unordered_map<int, int64_t>> stateGroupMap = {
+            {27, {{1, 10}, {2, 20}}}, {29, {{1, 30}}}};
+    const std::vector<StateGroupTable> tables = StateGroupTable::build(stateGroupMap);
+
+    ASSERT_EQ(2, tables.size());
+    for (const StateGroupTable& table : tables) {
+        expectGroups(table, stateGroupMap.at(table.getAtomId()), 0, 3);
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -164,6 +164,37 @@ TEST(StateManagerTest, TestOnLogEvent) {
               getStateInt(mgr, util::SCREEN_STATE_CHANGED, queryKey));
 }
 
+TEST(StateManagerTest, TestGetStateValueCacheFollowsStateEvents) {
+    sp<TestStateListener> listener1 = new TestStateListener();
+    StateManager mgr;
+    mgr.registerListener(util::SCREEN_STATE_CHANGED, listener1);
+
+    std::unique_ptr<LogEvent> event = CreateScreenStateChangedEvent(
+            timestampNs, android::view::DisplayStateEnum::DISPLAY_STATE_ON);
+    mgr.onLogEvent(*event);
+    // The second query is answered from the cache.
+    for (int i = 0; i < 2; i++) {
+        EXPECT_EQ(android::view::DisplayStateEnum::DISPLAY_STATE_ON,
+                  getStateInt(mgr, util::SCREEN_STATE_CHANGED, DEFAULT_DIMENSION_KEY));
+    }
+
+    event = CreateScreenStateChangedEvent(timestampNs,
+                                          android::view::DisplayStateEnum::DISPLAY_STATE_OFF);
+    mgr.onLogEvent(*event);
+    EXPECT_EQ(android::view::DisplayStateEnum::DISPLAY_STATE_OFF,
+              getStateInt(mgr, util::SCREEN_STATE_CHANGED, DEFAULT_DIMENSION_KEY));
+
+    // Another StateManager doesn't see the answers of this one.
+    StateManager otherMgr;
+    otherMgr.registerListener(util::SCREEN_STATE_CHANGED, listener1);
+    EXPECT_EQ(StateTracker::kStateUnknown,
+              getStateInt(otherMgr, util::SCREEN_STATE_CHANGED, DEFAULT_DIMENSION_KEY));
+
+    mgr.clear();
+    FieldValue output;
+    EXPECT_FALSE(mgr.getStateValue(util::SCREEN_STATE_CHANGED, DEFAULT_DIMENSION_KEY, &output));
+}
+
 /**
  * Test registering listeners to StateTrackers
  *
@@ -401,7 +432,7 @@ TEST(StateTrackerTest, TestStateChangePrimaryFieldAttrChain) {
     ASSERT_EQ(3, listener1->updates[0].mKey.getValues().size());
     EXPECT_EQ(1001, listener1->updates[0].mKey.getValues()[0].mValue.int_value);
     EXPECT_EQ(1, listener1->updates[0].mKey.getValues()[1].mValue.int_value);
-    EXPECT_EQ("wakelockName", listener1->updates[0].mKey.getValues()[2].mValue.str_value);
+    EXPECT_EQ("wakelockName", listener1->updates[0].mKey.getValues()[2].mValue.getString());
     EXPECT_EQ(WakelockStateChanged::ACQUIRE, listener1->updates[0].mState);
 
     // Check StateTracker was updated by querying for state.
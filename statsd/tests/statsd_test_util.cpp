@@ -910,6 +910,8 @@ sp<MockUidMap> makeMockUidMapForHosts(const map<int, vector<int>>& hostUidToIsol
     for (const auto& [hostUid, isolatedUids] : hostUidToIsolatedUidsMap) {
         for (const int isolatedUid : isolatedUids) {
             EXPECT_CALL(*uidMap, getHostUidOrSelf(isolatedUid)).WillRepeatedly(Return(hostUid));
+            // Also seen by the lock-free snapshots of the isolated uid map.
+            uidMap->assignIsolatedUid(isolatedUid, hostUid);
         }
     }
 
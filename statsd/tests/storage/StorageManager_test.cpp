@@ -12,10 +12,15 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <android-base/stringprintf.h>
 #include <android-base/unique_fd.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <stdio.h>
+#include <sys/stat.h>
+
+#include <thread>
+
 #include "src/storage/StorageManager.h"
 
 #ifdef __ANDROID__
@@ -25,6 +30,9 @@ namespace os {
 namespace statsd {
 
 using namespace testing;
+using android::base::StringPrintf;
+using android::util::FIELD_COUNT_REPEATED;
+using android::util::FIELD_TYPE_MESSAGE;
 using std::make_shared;
 using std::shared_ptr;
 using std::vector;
@@ -119,6 +127,8 @@ bool prepareLocalHistoryTestFiles() {
     } else {
         return false;
     }
+    // The files were not written by StorageManager.
+    StorageManager::rebuildDataFileIndex();
     return true;
 }
 
@@ -127,6 +137,7 @@ void clearLocalHistoryTestFiles() {
     TEMP_FAILURE_RETRY(remove(file2.c_str()));
     TEMP_FAILURE_RETRY(remove(file1_history.c_str()));
     TEMP_FAILURE_RETRY(remove(file2_history.c_str()));
+    StorageManager::rebuildDataFileIndex();
 }
 
 bool fileExist(string name) {
@@ -196,6 +207,233 @@ TEST(StorageManagerTest, AppendConfigReportTest4) {
     clearLocalHistoryTestFiles();
 }
 
+TEST(StorageManagerTest, DataFileIndexTest) {
+    const ConfigKey key(1066, 2);
+    const string fileName = StorageManager::getDataFileName(2557169347, 1066, 2);
+    const string content = "content";
+    EXPECT_FALSE(StorageManager::hasConfigMetricsReport(key));
+
+    StorageManager::writeFile(fileName.c_str(), content.data(), content.size());
+    EXPECT_TRUE(StorageManager::hasConfigMetricsReport(key));
+
+    // The file becomes a history file, which only adb dumps include.
+    ProtoOutputStream out;
+    StorageManager::appendConfigMetricsReport(key, &out, false /*erase?*/, false /*isAdb?*/);
+    EXPECT_GT(out.size(), content.size());
+    EXPECT_FALSE(StorageManager::hasConfigMetricsReport(key));
+    EXPECT_TRUE(fileExist(fileName + "_history"));
+
+    ProtoOutputStream adbOut;
+    StorageManager::appendConfigMetricsReport(key, &adbOut, true /*erase?*/, true /*isAdb?*/);
+    EXPECT_GT(adbOut.size(), content.size());
+    EXPECT_FALSE(fileExist(fileName + "_history"));
+
+    ProtoOutputStream emptyOut;
+    StorageManager::appendConfigMetricsReport(key, &emptyOut, true /*erase?*/, true /*isAdb?*/);
+    EXPECT_EQ(0UL, emptyOut.size());
+}
+
+TEST(StorageManagerTest, AtomicWriteTest) {
+    const string fileName = StorageManager::getDataFileName(2557169347, 1066, 4);
+    const string tmpFileName = testDir + "." + fileName.substr(testDir.size()) + ".tmp";
+    {
+        StorageManager::ScopedSyncBatch syncBatch;
+        const string longContent = "long content";
+        StorageManager::writeFile(fileName.c_str(), longContent.data(), longContent.size());
+        // The shorter content replaces the longer one.
+        const string content = "content";
+        StorageManager::writeFile(fileName.c_str(), content.data(), content.size());
+    }
+    string content;
+    ASSERT_TRUE(StorageManager::readFileToString(fileName.c_str(), &content));
+    EXPECT_EQ("content", content);
+    EXPECT_FALSE(fileExist(tmpFileName));
+
+    StorageManager::deleteFile(fileName.c_str());
+    EXPECT_FALSE(StorageManager::hasConfigMetricsReport(ConfigKey(1066, 4)));
+}
+
+TEST(StorageManagerTest, ConcurrentWriteTest) {
+    const string fileName = StorageManager::getDataFileName(2557169347, 1066, 7);
+    const string longContent(64 * 1024, 'a');
+    const string content(1024, 'b');
+
+    // Each write replaces the file as a whole, whatever the order of the writes.
+    std::thread thread([&]() {
+        for (int i = 0; i < 20; i++) {
+            StorageManager::writeFile(fileName.c_str(), longContent.data(), longContent.size());
+        }
+    });
+    for (int i = 0; i < 20; i++) {
+        StorageManager::writeFile(fileName.c_str(), content.data(), content.size());
+    }
+    thread.join();
+
+    string fileContent;
+    ASSERT_TRUE(StorageManager::readFileToString(fileName.c_str(), &fileContent));
+    EXPECT_TRUE(fileContent == content || fileContent == longContent);
+    StorageManager::deleteFile(fileName.c_str());
+}
+
+TEST(StorageManagerTest, RefreshConfigFileTimestampTest) {
+    const long oldTimestampSec = time(nullptr) - 24 * 60 * 60;
+    const string fileName = StringPrintf("/data/misc/stats-service/%ld_1066_6", oldTimestampSec);
+    const string config = "config";
+    StorageManager::writeFile(fileName.c_str(), config.data(), config.size());
+    // A stale copy of the same config, and the file of another config.
+    const string staleFileName =
+            StringPrintf("/data/misc/stats-service/%ld_1066_6", oldTimestampSec - 1);
+    const string staleConfig = "stale config";
+    StorageManager::writeFile(staleFileName.c_str(), staleConfig.data(), staleConfig.size());
+    const string otherFileName =
+            StringPrintf("/data/misc/stats-service/%ld_1066_7", oldTimestampSec);
+    StorageManager::writeFile(otherFileName.c_str(), config.data(), config.size());
+
+    StorageManager::refreshConfigFileTimestamp(ConfigKey(1066, 6), fileName);
+    EXPECT_FALSE(fileExist(fileName));
+    EXPECT_FALSE(fileExist(staleFileName));
+    EXPECT_TRUE(fileExist(otherFileName));
+    string content;
+    EXPECT_TRUE(StorageManager::readConfigFromDisk(ConfigKey(1066, 6), &content));
+    EXPECT_EQ(config, content);
+
+    StorageManager::deleteSuffixedFiles("/data/misc/stats-service", "_1066_6");
+    StorageManager::deleteSuffixedFiles("/data/misc/stats-service", "_1066_7");
+    EXPECT_FALSE(StorageManager::readConfigFromDisk(ConfigKey(1066, 6), &content));
+}
+
+TEST(StorageManagerTest, AsyncWriteTest) {
+    const ConfigKey key(1066, 5);
+    const string fileName = StorageManager::getDataFileName(2557169347, 1066, 5);
+    const string metadataFileName = testDir + "metadata_test";
+    StorageManager::setWriteQueue(std::make_shared<AsyncTaskQueue>(1 /*maxPendingTasks*/,
+                                                                   "statsd.test"));
+    {
+        StorageManager::ScopedSyncBatch syncBatch;
+        // More writes than fit in the queue.
+        StorageManager::writeFileAsync(metadataFileName, "old content");
+        StorageManager::writeFileAsync(metadataFileName, "content");
+        StorageManager::writeReportFile(fileName, vector<uint8_t>{'r', 'e', 'p', 'o', 'r', 't'});
+    }
+    // The queued report is included.
+    EXPECT_TRUE(StorageManager::hasConfigMetricsReport(key));
+    StorageManager::flushWrites();
+    StorageManager::setWriteQueue(nullptr);
+
+    string content;
+    ASSERT_TRUE(StorageManager::readFileToString(metadataFileName.c_str(), &content));
+    EXPECT_EQ("content", content);
+    StorageManager::deleteFile(metadataFileName.c_str());
+    ProtoOutputStream out;
+    StorageManager::appendConfigMetricsReport(key, &out, true /*erase?*/, true /*isAdb?*/);
+    EXPECT_GT(out.size(), 6UL);
+    EXPECT_FALSE(fileExist(fileName));
+}
+
+TEST(StorageManagerTest, CompressedReportTest) {
+    const ConfigKey key(1066, 3);
+    const string fileName = StorageManager::getDataFileName(2557169347, 1066, 3);
+    string content;
+    for (int i = 0; i < 1000; i++) {
+        content += "content";
+    }
+    const vector<uint8_t> report(content.begin(), content.end());
+
+    StorageManager::setCompressReports(true);
+    StorageManager::writeReportFile(fileName.c_str(), report);
+    StorageManager::setCompressReports(false);
+    struct stat fileStat;
+    ASSERT_EQ(0, stat(fileName.c_str(), &fileStat));
+    EXPECT_LT((size_t)fileStat.st_size, content.size() / 10);
+
+    // Both dumps get the uncompressed report.
+    ProtoOutputStream expected;
+    expected.write(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | 2 /*reports*/, content.c_str(),
+                   content.size());
+    ProtoOutputStream out;
+    StorageManager::appendConfigMetricsReport(key, &out, false /*erase?*/, true /*isAdb?*/);
+    EXPECT_EQ(expected.size(), out.size());
+
+    android::base::unique_fd fd(TEMP_FAILURE_RETRY(
+            open(testDir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, S_IRUSR | S_IWUSR)));
+    ASSERT_NE(-1, fd);
+    size_t totalBytes = 0;
+    EXPECT_TRUE(StorageManager::writeConfigMetricsReportsToFd(key, fd, true /*erase?*/,
+                                                              true /*isAdb?*/, &totalBytes));
+    EXPECT_EQ(expected.size(), totalBytes);
+    EXPECT_FALSE(fileExist(fileName));
+}
+
+TEST(StorageManagerTest, ReplacedReportKeptTest) {
+    const ConfigKey key(1066, 5);
+    const string fileName = StorageManager::getDataFileName(2557169347, 1066, 5);
+    const string content = "content";
+    const string newContent = "new content";
+    StorageManager::writeFile(fileName.c_str(), content.data(), content.size());
+
+    // A report of the same second is written while the dump reads the previous one.
+    string readContent;
+    EXPECT_TRUE(StorageManager::forEachConfigMetricsReport(
+            key, true /*erase?*/, false /*isAdb?*/, [&](int fd, bool isCheckpoint) {
+                EXPECT_FALSE(isCheckpoint);
+                EXPECT_TRUE(StorageManager::readReportFile(fd, &readContent));
+                StorageManager::writeFile(fileName.c_str(), newContent.data(), newContent.size());
+                return true;
+            }));
+    EXPECT_EQ(content, readContent);
+
+    // The new report is kept for the next dump.
+    EXPECT_TRUE(StorageManager::hasConfigMetricsReport(key));
+    string fileContent;
+    ASSERT_TRUE(StorageManager::readFileToString(fileName.c_str(), &fileContent));
+    EXPECT_EQ(newContent, fileContent);
+    StorageManager::deleteFile(fileName.c_str());
+    EXPECT_FALSE(StorageManager::hasConfigMetricsReport(key));
+}
+
+TEST(StorageManagerTest, CheckpointSealedDuringRebuildTest) {
+    const ConfigKey key(1066, 6);
+    StorageManager::appendCheckpoint(key, vector<uint8_t>{1, 2, 3});
+
+    // The log being read stays sealed when the index is rebuilt, so the next checkpoint goes to
+    // a new log, which the dump does not delete.
+    EXPECT_TRUE(StorageManager::forEachConfigMetricsReport(
+            key, true /*erase?*/, false /*isAdb?*/, [&key](int, bool isCheckpoint) {
+                EXPECT_TRUE(isCheckpoint);
+                StorageManager::rebuildDataFileIndex();
+                StorageManager::appendCheckpoint(key, vector<uint8_t>{4, 5, 6});
+                return true;
+            }));
+    EXPECT_TRUE(StorageManager::hasConfigMetricsReport(key));
+
+    ProtoOutputStream out;
+    StorageManager::appendConfigMetricsReport(key, &out, true /*erase?*/, false /*isAdb?*/);
+    EXPECT_GT(out.size(), 3UL);
+    EXPECT_FALSE(StorageManager::hasConfigMetricsReport(key));
+}
+
+TEST(StorageManagerTest, WriteReportsToFdFailureTest) {
+    const ConfigKey key(1066, 4);
+    const string fileName = StorageManager::getDataFileName(2557169347, 1066, 4);
+    const string content = "content";
+    StorageManager::writeFile(fileName.c_str(), content.data(), content.size());
+
+    // The reports can't be written to a read only fd, so the file is kept.
+    android::base::unique_fd readOnlyFd(open("/dev/null", O_RDONLY | O_CLOEXEC));
+    ASSERT_NE(-1, readOnlyFd);
+    size_t totalBytes = 0;
+    EXPECT_FALSE(StorageManager::writeConfigMetricsReportsToFd(key, readOnlyFd, true /*erase?*/,
+                                                               false /*isAdb?*/, &totalBytes));
+    EXPECT_EQ(0UL, totalBytes);
+    EXPECT_TRUE(fileExist(fileName));
+    EXPECT_TRUE(StorageManager::hasConfigMetricsReport(key));
+
+    ProtoOutputStream out;
+    StorageManager::appendConfigMetricsReport(key, &out, true /*erase?*/, false /*isAdb?*/);
+    EXPECT_GT(out.size(), content.size());
+    EXPECT_FALSE(fileExist(fileName));
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -0,0 +1,100 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "subscriber/IncidentdReporter.h"
+
+#include <gtest/gtest.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "stats_util.h"
+
+using std::vector;
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+const ConfigKey kConfigKey(0, 12345);
+
+// Records the merged reports instead of calling incidentd.
+class IncidentdReporterTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        SetTakeIncidentReportFunc(
+                [this](const IncidentdDetails&, const vector<vector<uint8_t>>& headers) {
+                    std::lock_guard<std::mutex> lock(mMutex);
+                    mHeaderCounts.push_back(headers.size());
+                    mCondition.notify_all();
+                    return true;
+                });
+    }
+
+    void TearDown() override {
+        SetTakeIncidentReportFunc(nullptr);
+    }
+
+    bool waitForReports(size_t count) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        return mCondition.wait_for(lock, std::chrono::seconds(10),
+                                   [this, count] { return mHeaderCounts.size() >= count; });
+    }
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    vector<size_t> mHeaderCounts;
+};
+
+}  // namespace
+
+TEST_F(IncidentdReporterTest, TestNoSection) {
+    IncidentdDetails config;
+    EXPECT_FALSE(GenerateIncidentReport(config, /*rule_id=*/1, /*metricId=*/2,
+                                        DEFAULT_METRIC_DIMENSION_KEY, /*metricValue=*/3,
+                                        kConfigKey));
+}
+
+TEST_F(IncidentdReporterTest, TestTooManyHeaders) {
+    IncidentdDetails config;
+    config.add_section(1);
+    config.add_section(2);
+
+    // The merged report keeps 20 headers, the next request is rejected.
+    for (int i = 0; i < 20; i++) {
+        EXPECT_TRUE(GenerateIncidentReport(config, /*rule_id=*/i, /*metricId=*/2,
+                                           DEFAULT_METRIC_DIMENSION_KEY, /*metricValue=*/3,
+                                           kConfigKey));
+    }
+    EXPECT_FALSE(GenerateIncidentReport(config, /*rule_id=*/20, /*metricId=*/2,
+                                        DEFAULT_METRIC_DIMENSION_KEY, /*metricValue=*/3,
+                                        kConfigKey));
+
+    ASSERT_TRUE(waitForReports(1));
+    std::lock_guard<std::mutex> lock(mMutex);
+    ASSERT_EQ(1, mHeaderCounts.size());
+    EXPECT_EQ(20, mHeaderCounts[0]);
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -18,6 +18,10 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <atomic>
+
+#include "stats_log_util.h"
+#include "tests/metrics/metrics_test_helper.h"
 #include "tests/statsd_test_util.h"
 
 using namespace testing;
@@ -56,7 +60,12 @@ public:
     }
 
     void TearDown() override {
-        SubscriberReporter::getInstance();
+        SubscriberReporter& reporter = SubscriberReporter::getInstance();
+        reporter.stopCoalescingThread();
+        {
+            lock_guard<mutex> lock(reporter.mLock);
+            reporter.mElapsedRealtimeNs = getElapsedRealtimeNs;
+        }
         SubscriberReporter::getInstance().unsetBroadcastSubscriber(configKey1, subscriptionId1);
         SubscriberReporter::getInstance().unsetBroadcastSubscriber(configKey1, subscriptionId2);
         SubscriberReporter::getInstance().unsetBroadcastSubscriber(configKey2, subscriptionId1);
@@ -99,6 +108,64 @@ TEST_F(SubscriberReporterTest, TestBroadcastSubscriberDeathKeepsReplacedPir) {
                                  {configKey2, {{subscriptionId1, pir3}}}};
     EXPECT_THAT(SubscriberReporter::getInstance().mIntentMap, ContainerEq(expectedIntentMap));
 }
+
+TEST_F(SubscriberReporterTest, TestCoalescedBroadcasts) {
+    Subscription subscription;
+    subscription.set_id(7);
+    subscription.set_rule_id(8);
+    subscription.mutable_broadcast_subscriber_details()->set_subscriber_id(subscriptionId1);
+    subscription.mutable_broadcast_subscriber_details()->set_min_broadcast_interval_millis(200);
+
+    const MetricDimensionKey key1(getMockedDimensionKey(/*tagId=*/1, /*key=*/1, "a"),
+                                  DEFAULT_DIMENSION_KEY);
+    const MetricDimensionKey key2(getMockedDimensionKey(/*tagId=*/1, /*key=*/1, "b"),
+                                  DEFAULT_DIMENSION_KEY);
+    std::vector<StatsDimensionsValueParcel> sentDimensions;
+    EXPECT_CALL(*pir1, sendSubscriberBroadcast(0, 12345, 7, 8, _, _))
+            .Times(2)
+            .WillRepeatedly(Invoke([&sentDimensions](int64_t, int64_t, int64_t, int64_t,
+                                                     const vector<string>&,
+                                                     const StatsDimensionsValueParcel& dims) {
+                sentDimensions.push_back(dims);
+                return Status::ok();
+            }));
+
+    // The coalescing thread only sends the broadcasts when the fake clock moves.
+    SubscriberReporter& reporter = SubscriberReporter::getInstance();
+    std::atomic<int64_t> nowNs(1000 * NS_PER_SEC);
+    {
+        lock_guard<mutex> lock(reporter.mLock);
+        reporter.mElapsedRealtimeNs = [&nowNs] { return nowNs.load(); };
+    }
+
+    // The first trigger is sent right away, the next ones once the interval expired.
+    reporter.alertBroadcastSubscriber(configKey1, subscription, key1);
+    reporter.alertBroadcastSubscriber(configKey1, subscription, key2);
+    reporter.alertBroadcastSubscriber(configKey1, subscription, key1);
+    reporter.alertBroadcastSubscriber(configKey1, subscription, key2);
+    {
+        lock_guard<mutex> lock(reporter.mLock);
+        ASSERT_EQ(1, sentDimensions.size());
+        EXPECT_EQ(key1.getDimensionKeyInWhat().toStatsDimensionsValueParcel(), sentDimensions[0]);
+    }
+
+    lock_guard<mutex> lock(reporter.mLock);
+    nowNs += 199 * NS_PER_SEC / 1000;
+    EXPECT_EQ(nowNs + NS_PER_SEC / 1000, reporter.sendDueCoalescedBroadcastsLocked(nowNs));
+    ASSERT_EQ(1, sentDimensions.size());
+
+    nowNs += NS_PER_SEC / 1000;
+    EXPECT_EQ(nowNs + 200 * NS_PER_SEC / 1000, reporter.sendDueCoalescedBroadcastsLocked(nowNs));
+    ASSERT_EQ(2, sentDimensions.size());
+    EXPECT_EQ(0, sentDimensions[1].field);
+    EXPECT_EQ(STATS_DIMENSIONS_VALUE_TUPLE_TYPE, sentDimensions[1].valueType);
+    ASSERT_EQ(2, sentDimensions[1].tupleValue.size());
+    EXPECT_EQ(key2.getDimensionKeyInWhat().toStatsDimensionsValueParcel(),
+              sentDimensions[1].tupleValue[0]);
+    EXPECT_EQ(key1.getDimensionKeyInWhat().toStatsDimensionsValueParcel(),
+              sentDimensions[1].tupleValue[1]);
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -0,0 +1,92 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/AsyncTaskQueue.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+// Lets one thread wait until another one opens it.
+class Latch {
+public:
+    void open() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mOpen = true;
+        mCondition.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait(lock, [this] { return mOpen; });
+    }
+
+private:
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    bool mOpen = false;
+};
+
+}  // namespace
+
+TEST(AsyncTaskQueueTest, TestRunsTasksInOrder) {
+    AsyncTaskQueue queue(10, "statsd.test");
+    std::vector<int> order;
+    for (int i = 0; i < 5; i++) {
+        EXPECT_TRUE(queue.push([&order, i] { order.push_back(i); }));
+    }
+    queue.drain();
+    EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 4}), order);
+    EXPECT_EQ(0u, queue.getDroppedTaskCount());
+}
+
+TEST(AsyncTaskQueueTest, TestDropsTasksWhenFull) {
+    AsyncTaskQueue queue(1, "statsd.test");
+    Latch started;
+    Latch release;
+    std::atomic<int> runs(0);
+    // Blocks the worker so that the next tasks wait in the queue.
+    EXPECT_TRUE(queue.push([&] {
+        started.open();
+        release.wait();
+        runs++;
+    }));
+    started.wait();
+    EXPECT_TRUE(queue.push([&runs] { runs++; }));
+    EXPECT_FALSE(queue.push([&runs] { runs++; }));
+    EXPECT_EQ(1u, queue.getDroppedTaskCount());
+
+    release.open();
+    queue.drain();
+    EXPECT_EQ(2, runs.load());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "utils/BlockedBloomFilter.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "hash.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+uint64_t hashOf(int64_t value) {
+    return Hash64(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+}  // anonymous namespace
+
+TEST(BlockedBloomFilterTest, TestNoFalseNegatives) {
+    BlockedBloomFilter filter(1000);
+    for (int64_t i = 0; i < 1000; i++) {
+        filter.add(hashOf(i));
+    }
+    EXPECT_FALSE(filter.isFull());
+    for (int64_t i = 0; i < 1000; i++) {
+        EXPECT_TRUE(filter.mayContain(hashOf(i))) << i;
+    }
+}
+
+TEST(BlockedBloomFilterTest, TestFalsePositiveRate) {
+    BlockedBloomFilter filter(1000);
+    for (int64_t i = 0; i < 1000; i++) {
+        filter.add(hashOf(i));
+    }
+    int falsePositives = 0;
+    for (int64_t i = 1000; i < 11000; i++) {
+        falsePositives += filter.mayContain(hashOf(i));
+    }
+    // About 3% once the filter holds the keys it was sized for.
+    EXPECT_LT(falsePositives, 500);
+}
+
+TEST(BlockedBloomFilterTest, TestFullAndRebuild) {
+    BlockedBloomFilter filter;
+    EXPECT_EQ(sizeof(uint64_t), filter.byteSize());
+    std::vector<uint64_t> hashes;
+    for (int64_t i = 0; i < 9; i++) {
+        hashes.push_back(hashOf(i));
+        filter.add(hashes.back());
+    }
+    EXPECT_TRUE(filter.isFull());
+
+    // Drops the hashes that are no longer in the keys.
+    hashes.erase(hashes.begin(), hashes.begin() + 4);
+    filter.rebuild(hashes, [](uint64_t hash) { return hash; });
+    EXPECT_FALSE(filter.isFull());
+    EXPECT_EQ(2 * sizeof(uint64_t), filter.byteSize());
+    for (uint64_t hash : hashes) {
+        EXPECT_TRUE(filter.mayContain(hash));
+    }
+    int removedHits = 0;
+    for (int64_t i = 0; i < 4; i++) {
+        removedHits += filter.mayContain(hashOf(i));
+    }
+    EXPECT_LT(removedHits, 4);
+}
+
+TEST(BlockedBloomFilterTest, TestClear) {
+    BlockedBloomFilter filter(100);
+    for (int64_t i = 0; i < 100; i++) {
+        filter.add(hashOf(i));
+    }
+    const size_t byteSize = filter.byteSize();
+    filter.clear();
+    EXPECT_EQ(byteSize, filter.byteSize());
+    for (int64_t i = 0; i < 100; i++) {
+        EXPECT_FALSE(filter.mayContain(hashOf(i))) << i;
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
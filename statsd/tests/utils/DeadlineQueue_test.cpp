@@ -0,0 +1,78 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/DeadlineQueue.h"
+
+#include <gtest/gtest.h>
+
+#include <limits>
+#include <vector>
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::vector;
+
+TEST(DeadlineQueueTest, TestPopExpiredInDeadlineOrder) {
+    DeadlineQueue queue;
+    EXPECT_EQ(std::numeric_limits<int64_t>::max(), queue.nextDeadlineNs());
+
+    queue.schedule(/*index=*/1, 300);
+    queue.schedule(/*index=*/2, 100);
+    queue.schedule(/*index=*/3, 200);
+    EXPECT_EQ(100, queue.nextDeadlineNs());
+
+    // Deadlines expire strictly after their time.
+    vector<int> expired;
+    queue.popExpired(200, [&](int index) { expired.push_back(index); });
+    EXPECT_EQ(vector<int>({2}), expired);
+    EXPECT_EQ(200, queue.nextDeadlineNs());
+
+    expired.clear();
+    queue.popExpired(1000, [&](int index) { expired.push_back(index); });
+    EXPECT_EQ(vector<int>({3, 1}), expired);
+    EXPECT_EQ(0UL, queue.size());
+}
+
+TEST(DeadlineQueueTest, TestScheduleFromCallback) {
+    DeadlineQueue queue;
+    queue.schedule(/*index=*/1, 100);
+    queue.schedule(/*index=*/1, 150);
+
+    // Both entries of index 1 expire, and the callback schedules it once more.
+    int calls = 0;
+    queue.popExpired(200, [&](int index) {
+        calls++;
+        if (calls == 1) {
+            queue.schedule(index, 500);
+        }
+    });
+    EXPECT_EQ(2, calls);
+    ASSERT_EQ(1UL, queue.size());
+    EXPECT_EQ(500, queue.nextDeadlineNs());
+
+    queue.clear();
+    EXPECT_EQ(0UL, queue.size());
+    EXPECT_EQ(std::numeric_limits<int64_t>::max(), queue.nextDeadlineNs());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -0,0 +1,99 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/FlatHashMap.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+// Sends all the keys to few slots, so that probe sequences overlap and wrap around.
+struct CollidingHash {
+    size_t operator()(int key) const {
+        return key % 3;
+    }
+};
+
+}  // anonymous namespace
+
+TEST(FlatHashMapTest, TestInsertFindErase) {
+    FlatHashMap<int, int> map;
+    EXPECT_TRUE(map.empty());
+    EXPECT_EQ(nullptr, map.find(1));
+    EXPECT_FALSE(map.erase(1));
+
+    map[1] = 10;
+    map[2] = 20;
+    map[1]++;
+    EXPECT_EQ(2UL, map.size());
+    ASSERT_NE(nullptr, map.find(1));
+    EXPECT_EQ(11, *map.find(1));
+    EXPECT_EQ(20, *map.find(2));
+
+    EXPECT_TRUE(map.erase(1));
+    EXPECT_FALSE(map.erase(1));
+    EXPECT_EQ(nullptr, map.find(1));
+    EXPECT_EQ(1UL, map.size());
+
+    map.clear();
+    EXPECT_TRUE(map.empty());
+    EXPECT_EQ(nullptr, map.find(2));
+    EXPECT_EQ(0, map[2]);
+}
+
+TEST(FlatHashMapTest, TestMatchesStdMap) {
+    FlatHashMap<int, int, CollidingHash> map;
+    std::map<int, int> expected;
+    // Deterministic mix of insertions and erasures, growing the map a few times.
+    unsigned int seed = 1;
+    for (int i = 0; i < 2000; i++) {
+        seed = seed * 1103515245 + 12345;
+        const int key = (seed >> 16) % 64;
+        if ((seed >> 8) % 3 == 0) {
+            EXPECT_EQ(expected.erase(key) > 0, map.erase(key));
+        } else {
+            map[key] += i;
+            expected[key] += i;
+        }
+        ASSERT_EQ(expected.size(), map.size());
+    }
+    for (int key = 0; key < 64; key++) {
+        const auto it = expected.find(key);
+        if (it == expected.end()) {
+            EXPECT_EQ(nullptr, map.find(key));
+        } else {
+            ASSERT_NE(nullptr, map.find(key));
+            EXPECT_EQ(it->second, *map.find(key));
+        }
+    }
+
+    std::map<int, int> visited;
+    map.forEach([&](const int& key, int& value) { visited[key] = value; });
+    EXPECT_EQ(expected, visited);
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -0,0 +1,58 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/FlatIndexMap.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#ifdef __ANDROID__
+
+using testing::ElementsAre;
+using testing::IsEmpty;
+
+namespace android {
+namespace os {
+namespace statsd {
+
+TEST(FlatIndexMapTest, TestBuild) {
+    FlatIndexMap map;
+    EXPECT_TRUE(map.get(0).empty());
+
+    map.build({{0, {3, 1}}, {2, {5}}}, 4);
+    EXPECT_THAT(map.get(0), ElementsAre(3, 1));
+    EXPECT_THAT(map.get(1), IsEmpty());
+    EXPECT_THAT(map.get(2), ElementsAre(5));
+    EXPECT_THAT(map.get(3), IsEmpty());
+    EXPECT_THAT(map.get(4), IsEmpty());
+    EXPECT_THAT(map.get(-1), IsEmpty());
+}
+
+TEST(FlatIndexMapTest, TestRebuild) {
+    FlatIndexMap map;
+    map.build({{0, {3, 1}}, {2, {5}}}, 4);
+
+    // Keys out of range are dropped.
+    map.build({{1, {2}}, {7, {1}}}, 2);
+    EXPECT_THAT(map.get(0), IsEmpty());
+    EXPECT_THAT(map.get(1), ElementsAre(2));
+    EXPECT_THAT(map.get(2), IsEmpty());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -0,0 +1,78 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/GenerationIndexSet.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#ifdef __ANDROID__
+
+using testing::ElementsAre;
+
+namespace android {
+namespace os {
+namespace statsd {
+
+TEST(GenerationIndexSetTest, TestInsertAndErase) {
+    GenerationIndexSet set;
+    set.resize(10);
+    EXPECT_TRUE(set.empty());
+
+    EXPECT_TRUE(set.insert(7));
+    EXPECT_TRUE(set.insert(2));
+    EXPECT_FALSE(set.insert(7));
+    EXPECT_TRUE(set.contains(7));
+    EXPECT_FALSE(set.contains(3));
+    EXPECT_THAT(set.getIndices(), ElementsAre(7, 2));
+
+    set.erase(7);
+    set.erase(3);
+    EXPECT_FALSE(set.contains(7));
+    EXPECT_THAT(set.getIndices(), ElementsAre(2));
+    EXPECT_FALSE(set.empty());
+}
+
+TEST(GenerationIndexSetTest, TestClear) {
+    GenerationIndexSet set;
+    set.resize(10);
+    set.insert(1);
+    set.insert(9);
+
+    set.clear();
+    EXPECT_TRUE(set.empty());
+    EXPECT_FALSE(set.contains(1));
+    EXPECT_FALSE(set.contains(9));
+
+    EXPECT_TRUE(set.insert(9));
+    EXPECT_THAT(set.getIndices(), ElementsAre(9));
+}
+
+TEST(GenerationIndexSetTest, TestResize) {
+    GenerationIndexSet set;
+    set.resize(2);
+    set.insert(1);
+
+    set.resize(4);
+    EXPECT_TRUE(set.empty());
+    EXPECT_FALSE(set.contains(1));
+    EXPECT_TRUE(set.insert(3));
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
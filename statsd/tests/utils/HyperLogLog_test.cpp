@@ -0,0 +1,72 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/HyperLogLog.h"
+
+#include <gtest/gtest.h>
+
+#include "hash.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+uint64_t hashOf(int64_t value) {
+    return Hash64(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+}  // anonymous namespace
+
+TEST(HyperLogLogTest, TestEstimateWithinError) {
+    for (int64_t count : {10, 1000, 100000}) {
+        HyperLogLog hll;
+        for (int64_t i = 0; i < count; i++) {
+            hll.add(hashOf(i));
+        }
+        EXPECT_NEAR(count, hll.estimate(), count * 0.1) << count;
+    }
+}
+
+TEST(HyperLogLogTest, TestDuplicatesNotCounted) {
+    HyperLogLog hll;
+    EXPECT_EQ(0, hll.estimate());
+    for (int repeat = 0; repeat < 10; repeat++) {
+        for (int64_t i = 0; i < 100; i++) {
+            hll.add(hashOf(i));
+        }
+    }
+    EXPECT_NEAR(100, hll.estimate(), 10);
+}
+
+TEST(HyperLogLogTest, TestClear) {
+    HyperLogLog hll;
+    for (int64_t i = 0; i < 1000; i++) {
+        hll.add(hashOf(i));
+    }
+    hll.clear();
+    EXPECT_EQ(0, hll.estimate());
+    hll.add(hashOf(1));
+    EXPECT_EQ(1, hll.estimate());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -0,0 +1,111 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/MapNodePool.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <unordered_map>
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+TEST(MapNodePoolTest, TestRecycleKeepsNodesOfLastBucket) {
+    unordered_map<string, vector<int>> map;
+    MapNodePool<unordered_map<string, vector<int>>> pool;
+
+    pool.get(map, "a").push_back(1);
+    pool.get(map, "b").push_back(2);
+    pool.get(map, "a").push_back(3);
+    ASSERT_EQ(2UL, map.size());
+    EXPECT_EQ(vector<int>({1, 3}), map["a"]);
+    const size_t bucketCount = map.bucket_count();
+
+    pool.recycle(map);
+    EXPECT_TRUE(map.empty());
+    EXPECT_EQ(bucketCount, map.bucket_count());
+    EXPECT_EQ(2UL, pool.size());
+
+    // Pooled nodes come back with the new key and a default value.
+    EXPECT_TRUE(pool.get(map, "c").empty());
+    EXPECT_EQ(1UL, pool.size());
+    pool.get(map, "c").push_back(4);
+    EXPECT_EQ(vector<int>({4}), map["c"]);
+    EXPECT_EQ(map.end(), map.find("a"));
+
+    // The node left unused in the last bucket is freed.
+    pool.recycle(map);
+    EXPECT_EQ(1UL, pool.size());
+
+    pool.get(map, "d");
+    pool.get(map, "e");
+    EXPECT_EQ(0UL, pool.size());
+    EXPECT_EQ(2UL, map.size());
+}
+
+TEST(MapNodePoolTest, TestResetKeepsStorage) {
+    unordered_map<string, vector<int>> map;
+    MapNodePool<unordered_map<string, vector<int>>> pool;
+    auto clear = [](vector<int>& value) { value.clear(); };
+
+    pool.get(map, "a").assign({1, 2, 3});
+    pool.get(map, "b").assign({4});
+    const int* storage = map["a"].data();
+
+    // Erased entries go to the pool, with their reset value.
+    auto next = pool.erase(map, map.find("a"), clear);
+    EXPECT_EQ(1UL, map.size());
+    EXPECT_EQ(1UL, pool.size());
+    EXPECT_TRUE(next == map.end() || next->first == "b");
+
+    vector<int>& value = pool.get(map, "c");
+    EXPECT_TRUE(value.empty());
+    EXPECT_EQ(storage, value.data());
+    EXPECT_GE(value.capacity(), 3UL);
+
+    pool.recycle(map, clear);
+    EXPECT_EQ(2UL, pool.size());
+    pool.get(map, "d");
+    pool.get(map, "e");
+    EXPECT_EQ(0UL, pool.size());
+    EXPECT_GE(map["d"].capacity() + map["e"].capacity(), 4UL);
+}
+
+TEST(MapNodePoolTest, TestEmplaceConstructsWithoutPooledNode) {
+    unordered_map<string, vector<int>> map;
+    MapNodePool<unordered_map<string, vector<int>>> pool;
+
+    EXPECT_EQ(vector<int>({7, 7}), pool.emplace(map, "a", 2, 7));
+    // Existing values are returned as they are.
+    EXPECT_EQ(vector<int>({7, 7}), pool.emplace(map, "a", 1, 8));
+
+    pool.recycle(map);
+    // Pooled nodes come back with their reset value.
+    EXPECT_TRUE(pool.emplace(map, "b", 1, 9).empty());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -0,0 +1,65 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/ParallelExecutor.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <vector>
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+TEST(ParallelExecutorTest, TestRunsEveryTaskOnce) {
+    ParallelExecutor executor(3);
+    EXPECT_EQ(3u, executor.getNumThreads());
+
+    for (size_t numTasks : {0, 1, 2, 10, 100}) {
+        std::vector<std::atomic<int>> runs(numTasks);
+        executor.run(numTasks, [&runs](size_t index) { runs[index]++; });
+        for (size_t i = 0; i < numTasks; i++) {
+            EXPECT_EQ(1, runs[i].load()) << "task " << i << " of " << numTasks;
+        }
+    }
+}
+
+TEST(ParallelExecutorTest, TestRunIsSerialWithoutThreads) {
+    ParallelExecutor executor(0);
+    std::vector<size_t> order;
+    executor.run(5, [&order](size_t index) { order.push_back(index); });
+    EXPECT_EQ(std::vector<size_t>({0, 1, 2, 3, 4}), order);
+}
+
+TEST(ParallelExecutorTest, TestRunsTasksConcurrently) {
+    ParallelExecutor executor(1);
+    // Both tasks wait for each other, which only completes if they run at the same time.
+    std::atomic<int> started(0);
+    executor.run(2, [&started](size_t) {
+        started++;
+        while (started.load() < 2) {
+        }
+    });
+    EXPECT_EQ(2, started.load());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -0,0 +1,103 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/AsyncTaskQueue.h"
+#include "utils/ThreadTopology.h"
+
+#include <gtest/gtest.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <thread>
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+TEST(ThreadTopologyTest, TestParseConfig) {
+    std::array<ThreadTopology::RoleSettings, (size_t)ThreadRole::COUNT> settings;
+    EXPECT_TRUE(ThreadTopology::parseConfig(
+            "ingest:nice=-4; workers:cpus=0x0f,uclamp_min=128,uclamp_max=512,threads=2;",
+            &settings));
+
+    const ThreadTopology::RoleSettings& ingest = settings[(size_t)ThreadRole::INGEST];
+    EXPECT_EQ(-4, ingest.nice);
+    EXPECT_EQ(0u, ingest.cpuMask);
+    EXPECT_EQ(0, ingest.uclampMin);
+    EXPECT_EQ(1024, ingest.uclampMax);
+
+    const ThreadTopology::RoleSettings& workers = settings[(size_t)ThreadRole::WORKERS];
+    EXPECT_EQ(0, workers.nice);
+    EXPECT_EQ(0x0fu, workers.cpuMask);
+    EXPECT_EQ(128, workers.uclampMin);
+    EXPECT_EQ(512, workers.uclampMax);
+    EXPECT_EQ(2u, workers.poolSize);
+
+    EXPECT_EQ(ThreadTopology::RoleSettings(), settings[(size_t)ThreadRole::PROCESSING]);
+}
+
+TEST(ThreadTopologyTest, TestMalformedEntriesIgnored) {
+    std::array<ThreadTopology::RoleSettings, (size_t)ThreadRole::COUNT> settings;
+    EXPECT_FALSE(ThreadTopology::parseConfig(
+            "unknown:nice=1;pulls:nice=40;background:cpus=15;workers:uclamp_min=600,uclamp_max=500;"
+            "processing:nice;ingest:nice=2",
+            &settings));
+
+    for (size_t role = 0; role < (size_t)ThreadRole::COUNT; role++) {
+        if (role != (size_t)ThreadRole::INGEST) {
+            EXPECT_EQ(ThreadTopology::RoleSettings(), settings[role]);
+        }
+    }
+    EXPECT_EQ(2, settings[(size_t)ThreadRole::INGEST].nice);
+}
+
+TEST(ThreadTopologyTest, TestPoolSize) {
+    ThreadTopology& topology = ThreadTopology::getInstance();
+    topology.setConfig("pulls:threads=5");
+    EXPECT_EQ(5u, topology.getPoolSize(ThreadRole::PULLS, 3));
+    EXPECT_EQ(3u, topology.getPoolSize(ThreadRole::WORKERS, 3));
+
+    topology.setConfig("");
+    EXPECT_EQ(3u, topology.getPoolSize(ThreadRole::PULLS, 3));
+}
+
+TEST(ThreadTopologyTest, TestAppliedToJoinedThreadsOnChange) {
+    ThreadTopology& topology = ThreadTopology::getInstance();
+    topology.setConfig("background:nice=5");
+
+    int niceAtJoin = 0;
+    int niceAfterChange = 0;
+    std::thread thread([&] {
+        ScopedThreadRole role(ThreadRole::BACKGROUND);
+        niceAtJoin = getpriority(PRIO_PROCESS, gettid());
+        // Raising the nice value needs no privilege.
+        topology.setConfig("background:nice=10");
+        niceAfterChange = getpriority(PRIO_PROCESS, gettid());
+    });
+    thread.join();
+
+    EXPECT_EQ(5, niceAtJoin);
+    EXPECT_EQ(10, niceAfterChange);
+    topology.setConfig("");
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif